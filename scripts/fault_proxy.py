@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+# Reverse proxy for the bench servers that breaks one GET in --every; see
+# "Fault injection" in updownload.md.
+import argparse, itertools, json, re, signal, socket, struct, sys, threading, time
+import http.client, urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+ap = argparse.ArgumentParser()
+ap.add_argument("--listen", type=int, default=8090)
+ap.add_argument("--upstream", default="http://127.0.0.1:8080")
+ap.add_argument("--faults", default="reset,429,503,truncate,stall,norange")
+ap.add_argument("--every", type=int, default=20)
+ap.add_argument("--stall", type=float, default=30, help="seconds a stall dribbles a byte a second")
+ap.add_argument("--label", default="run")
+args = ap.parse_args()
+up = urllib.parse.urlsplit(args.upstream)
+kinds = itertools.cycle(args.faults.split(","))
+# Faults that send half the body and then break the response.
+CUT = ("reset", "truncate", "stall")
+HOP = {"connection", "keep-alive", "proxy-connection", "transfer-encoding", "te", "upgrade", "host"}
+
+lock = threading.Lock()
+gets, sent, first, last = 0, 0, None, None
+faults, covered, pending, recover, ids = {}, {}, [], {}, itertools.count()
+
+def deliver(rid, path, start, n):
+    """Counts n bytes of path from start; resolves faults they repair."""
+    global sent, first, last
+    now = time.monotonic()
+    with lock:
+        sent += n
+        first, last = first or now, now
+        spans = covered.setdefault(path, [])
+        spans.append([start, start + n])
+        spans.sort()
+        merged = [spans[0]]
+        for a, b in spans[1:]:
+            if a <= merged[-1][1]:
+                merged[-1][1] = max(merged[-1][1], b)
+            else:
+                merged.append([a, b])
+        covered[path] = merged
+        for p in pending[:]:
+            if p["path"] == path and p["rid"] != rid and start <= p["offset"] < start + n:
+                recover.setdefault(p["kind"], []).append((now - p["t"]) * 1000)
+                pending.remove(p)
+
+def broke(rid, kind, path, offset):
+    with lock:
+        faults[kind] = faults.get(kind, 0) + 1
+        if kind != "norange":
+            pending.append({"rid": rid, "kind": kind, "path": path, "offset": offset, "t": time.monotonic()})
+    print("fault %s %s @%d" % (kind, path, offset), file=sys.stderr)
+
+def report(*_):
+    with lock:
+        useful = sum(b - a for spans in covered.values() for a, b in spans)
+        secs = (last - first) if first else 0
+        out = {"label": args.label, "gets": gets, "faults": faults,
+               "sent_mb": round(sent / 1048576, 1), "useful_mb": round(useful / 1048576, 1),
+               "wasted_mb": round((sent - useful) / 1048576, 1),
+               "goodput_mib_s": round(useful / 1048576 / secs, 2) if secs else 0,
+               "recover_ms": {k: {"n": len(v), "p50": round(sorted(v)[len(v) // 2]), "max": round(max(v))}
+                              for k, v in recover.items()},
+               "unrecovered": len(pending)}
+    print(json.dumps(out))
+    sys.exit(0)
+
+class Proxy(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *_):
+        pass
+
+    def __getattr__(self, name):
+        if name.startswith("do_"):
+            return self.relay
+        raise AttributeError(name)
+
+    def relay(self):
+        global gets
+        rid = next(ids)
+        fault = None
+        if self.command == "GET":
+            with lock:
+                gets += 1
+                if gets % args.every == 0:
+                    fault = next(kinds)
+        path = urllib.parse.unquote(self.path.split("?")[0])
+        asked = re.match(r"bytes=(\d+)-", self.headers.get("Range", ""))
+        offset = int(asked.group(1)) if asked else 0
+        if fault in ("429", "503"):
+            broke(rid, fault, path, offset)
+            self.send_response(int(fault))
+            self.send_header("Retry-After", "1")
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        length = int(self.headers.get("Content-Length") or 0)
+        body = self.rfile.read(length) if length else None
+        headers = {k: v for k, v in self.headers.items()
+                   if k.lower() not in HOP and not (fault == "norange" and k.lower() == "range")}
+        conn = http.client.HTTPConnection(up.hostname, up.port or 80, timeout=120)
+        conn.request(self.command, self.path, body, headers)
+        res = conn.getresponse()
+        total = res.getheader("Content-Length")
+        if fault in CUT and (total is None or int(total) < 2):
+            fault = None
+        if fault == "norange":
+            broke(rid, fault, path, offset)
+        given = re.match(r"bytes (\d+)-", res.getheader("Content-Range", ""))
+        start = int(given.group(1)) if given else 0
+        cut = int(total) // 2 if fault in CUT else None
+
+        self.send_response(res.status, res.reason)
+        for k, v in res.getheaders():
+            if k.lower() not in HOP:
+                self.send_header(k, v)
+        chunked = total is None and self.command != "HEAD" and res.status not in (204, 304)
+        if chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        done = 0
+        while self.command != "HEAD":
+            block = res.read(min(65536, cut - done) if cut is not None else 65536)
+            if not block:
+                break
+            self.wfile.write(b"%x\r\n%s\r\n" % (len(block), block) if chunked else block)
+            deliver(rid, path, start + done, len(block))
+            done += len(block)
+            if cut is not None and done >= cut:
+                break
+        if chunked:
+            self.wfile.write(b"0\r\n\r\n")
+        if cut is None:
+            conn.close()
+            return
+
+        broke(rid, fault, path, start + done)
+        self.close_connection = True
+        if fault == "stall":
+            for _ in range(int(args.stall)):
+                time.sleep(1)
+                block = res.read(1)
+                try:
+                    self.wfile.write(block)
+                    self.wfile.flush()
+                except OSError:
+                    break
+                deliver(rid, path, start + done, len(block))
+                done += len(block)
+        self.wfile.flush()
+        if fault == "reset":
+            self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            self.wfile.close()
+            self.rfile.close()
+            self.connection.close()
+        conn.close()
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def handle_error(self, request, client_address):
+        pass
+
+signal.signal(signal.SIGINT, report)
+signal.signal(signal.SIGTERM, report)
+Server(("", args.listen), Proxy).serve_forever()
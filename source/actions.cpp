@@ -1,5 +1,14 @@
 #include <string.h>
+#include <sys/stat.h>
 #include <archive.h>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "common.h"
 #include "config.h"
 #include "windows.h"
@@ -7,118 +16,1678 @@
 #include "clients/ftpclient.h"
 #include "clients/sftpclient.h"
 #include "clients/webdav.h"
+#ifdef NEO_WITH_SMB
+#include "clients/smbclient.h"
+#endif
+#ifdef NEO_WITH_NFS
+#include "clients/nfsclient.h"
+#endif
+#ifdef NEO_WITH_HTML_INDEX
+#include "clients/apache.h"
+#include "clients/archiveorg.h"
+#include "clients/iis.h"
+#include "clients/myrient.h"
+#include "clients/nginx.h"
+#include "clients/npxserve.h"
+#include "clients/rclone.h"
+#endif
+#include "transfer_journal.h"
+#include "transfer_stats.h"
+#include "buffer_pool.h"
+#include "local_copy.h"
+#include "remote_archive.h"
+#include "remote_bridge.h"
+#include "remote_zip.h"
+#include "upload_source.h"
+#include "listing_index.h"
+#include "listing_diff.h"
+#include "local_scan.h"
+#include "local_trash.h"
+#include "folder_size.h"
+#include "cancel.h"
+#include "catalogue.h"
+#include "client_pool.h"
+#include "connection_budget.h"
+#include "download_cache.h"
+#include "memory_governor.h"
+#include "metalink.h"
+#include "site_bench.h"
+#include "preflight.h"
+#include "rate_limiter.h"
 #include "util.h"
 #include "lang.h"
 #include "actions.h"
 #include "zip_util.h"
+#include "installer.h"
+#include "zip_writer.h"
 #include "logger.h"
+#include "threads.h"
+#include "thumbnails.h"
+#include "image_prefetch.h"
+#include "resolver.h"
+#include "keepalive.h"
+#include "transfer_history.h"
 
 namespace Actions
 {
-    // Background worker entry point used by the WebDAV parallel
-    // download scheduler. Defined later in this file.
-    static void ParallelDownloadWorkerThread(void *argp);
-
     namespace
     {
-        struct ParallelDownloadJob
+        // One queued download: a remote entry and the local directory it is
+        // downloaded into. Folder jobs expand into their children when a
+        // worker picks them up.
+        struct DownloadJob
         {
             DirEntry entry;
-            std::string destBase;
+            std::string destDir;
         };
 
-        struct ParallelDownloadWorkerCtx
+        // Shared job queue for DownloadFilesThread. Workers pull the next
+        // job as soon as they finish one, so a large file never holds up
+        // the small ones queued behind it.
+        struct DownloadQueue
         {
-            ParallelDownloadJob job;
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<DownloadJob> jobs;
+            int active = 0;
+            int failed = 0;
+            int backgroundFailed = 0;
+            // Files downloaded in full, for the batch summary.
+            int filesOk = 0;
+            int64_t bytesOk = 0;
+
+            // Blocks until a job is available or all work is done. Folder
+            // expansion by a busy worker can still add jobs, so an empty
+            // queue only means "done" once no worker is active.
+            bool Next(DownloadJob &job)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (jobs.empty() && active > 0 && !Cancel::Stopped())
+                    cv.wait_for(lock, std::chrono::milliseconds(100));
+                if (Cancel::Stopped() || jobs.empty())
+                    return false;
+                job = jobs.front();
+                jobs.pop_front();
+                active++;
+                TransferStats::SetQueued((int)jobs.size());
+                return true;
+            }
+
+            // Children go to the front, in order, so workers stay focused on
+            // one folder at a time like the old recursive walk.
+            void PushFront(const std::vector<DownloadJob> &children)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.insert(jobs.begin(), children.begin(), children.end());
+                TransferStats::SetQueued((int)jobs.size());
+                cv.notify_all();
+            }
+
+            // Counts a finished file towards the overall batch progress.
+            void FileDone(int64_t size, bool ok)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch_files_done++;
+                batch_bytes_done += size;
+                if (ok)
+                {
+                    filesOk++;
+                    bytesOk += size;
+                }
+            }
+
+            void Done(bool ok, bool background)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                active--;
+                if (!ok)
+                {
+                    failed++;
+                    if (background)
+                        backgroundFailed++;
+                }
+                cv.notify_all();
+            }
+        };
+
+        struct DownloadWorkerCtx
+        {
+            DownloadQueue *queue = nullptr;
+            // TransferStats slot; the primary connection has 0.
+            int slot = 0;
             RemoteSettings settings;
+            // Ranged download tuning learned by this worker's connection.
+            int tuned_parallel = 0;
+            int tuned_chunk_mb = 0;
+            bool connected = false;
+        };
+
+        // State of the background remote listing. The worker thread only
+        // appends to `pending`; the UI thread moves those entries into
+        // remote_files in PollRemoteListing, so the browser never sees a
+        // vector that is being written to.
+        //
+        // Every request bumps `generation`. A worker whose generation is no
+        // longer current stops at its next batch and its rows are dropped,
+        // so navigating never waits for it: the newest network request is
+        // parked in `deferred` and started once the old worker has exited,
+        // as remoteclient serves one listing at a time.
+        struct RemoteListing
+        {
+            std::mutex mutex;
+            uint32_t generation = 0;
+            // Generation the running worker was started for.
+            uint32_t worker_generation = 0;
+            std::vector<DirEntry> pending;
+            // Every row received so far, unfiltered; UI thread only.
+            CompactListing all;
+            std::string path;
+            std::string filter;
+            // In: validator of the cached listing being revalidated (empty
+            // for a plain listing). Out: validator of the new listing.
+            std::string validator;
+            int received = 0;
             int result = 0;
+            bool finished = false;
+            bool running = false;
+            // The ping before listing failed; the connection was closed.
+            bool lost = false;
+            // Stale cached rows are on screen until the first new batch.
+            bool replace = false;
+            // The folder on screen is listed again: its rows stay, and the
+            // new listing is merged into them once complete.
+            bool merge = false;
+            // The validator matched; the cached rows are current.
+            bool unchanged = false;
+            // Listing a folder next to the focused one for the cache only;
+            // nothing is shown.
+            bool prefetch = false;
+            // Rows are the server's matches for `query` below `path`, not
+            // a listing: they are neither indexed nor cached.
+            bool search = false;
+            std::string query;
+            bool select_first = false;
+            int prev_count = -1;
+            Thread thread;
+            // When the worker was started, for the LISTING log line.
+            uint64_t started_at = 0;
+
+            bool deferred = false;
+            bool deferred_apply_filter = false;
+            bool deferred_select_first = false;
+            int deferred_prev_count = -1;
+            bool deferred_use_cache = false;
         };
 
-        static std::string BuildLocalDestForEntry(const DirEntry &entry, const char *baseLocalDir)
+        RemoteListing remote_listing;
+
+        // The login Connect() does, run on a thread of its own so the UI
+        // keeps drawing: last_site at launch (auto_connect) and a fresh
+        // session for a dead SFTP/FTP one (reconnect_on_resume).
+        struct BackgroundConnect
         {
-            if (entry.isDir)
-            {
-                char new_dir[512];
-                sprintf(new_dir, "%s%s%s", baseLocalDir, FS::hasEndSlash(baseLocalDir) ? "" : "/", entry.name);
-                return std::string(new_dir);
-            }
-            return std::string(baseLocalDir);
-        }
+            Thread thread;
+            bool running = false;
+            std::atomic<bool> finished{false};
+            RemoteClient *client = nullptr;
+            RemoteSettings settings;
+            std::string site;
+            // Replaces remoteclient instead of becoming the first one.
+            bool reconnect = false;
+            // Disconnect() came first; the result is thrown away.
+            bool abandoned = false;
+            int result = 0;
+            uint64_t started_at = 0;
+        };
+
+        BackgroundConnect background_connect;
+        AppletHookCookie resume_hook;
+        std::atomic<bool> resumed{false};
+        bool reconnect_pending = false;
+        uint64_t last_reconnect = 0;
+        // A dropped session is reopened at most this often.
+        const uint64_t kReconnectIntervalUs = 30000000;
+        // Keep-alives of the primary connection. The keep-alive thread asks
+        // for it when a probe is due; the UI hands it over once nothing
+        // else uses it, and remote actions wait until the probe is back.
+        std::atomic<bool> primary_probe_wanted{false};
+        std::atomic<bool> primary_probing{false};
+        std::atomic<bool> primary_probe_failed{false};
+
+        // Folders queued for listing_prefetch around the focused remote
+        // row. Planned once the focus has rested on a row for a moment.
+        struct RemotePrefetch
+        {
+            std::string folder;
+            std::string focus;
+            uint64_t focus_tick = 0;
+            bool planned = false;
+            std::vector<std::string> queue;
+        };
+
+        RemotePrefetch remote_prefetch;
+
+        // Full listings behind local_files and remote_files, which are the
+        // sorted and filtered rows the panes show.
+        ListingIndex local_index;
+        ListingIndex remote_index;
+
+        // Per-site cache of complete remote listings keyed by path. Cleared
+        // on connect/disconnect and whenever a blocking refresh reports a
+        // change made through this app.
+        struct CachedListing
+        {
+            CompactListing entries;
+            std::string validator;
+            uint64_t fetched = 0;
+            uint64_t used = 0;
+            Metrics::Held held{Metrics::GAUGE_MEM_LISTINGS};
+        };
+
+        std::mutex listing_cache_mutex;
+        std::map<std::string, CachedListing> listing_cache;
+        size_t listing_cache_size = 0;
+
+        // Downloads left unfinished by an earlier session, offered once per
+        // site and session after connecting.
+        std::vector<DownloadJob> resume_jobs;
+        bool resume_requested = false;
+        std::set<std::string> resume_offered;
+
+        // Downloads queued with background_transfers on. A coordinator
+        // thread works `queue` on connections of its own, never
+        // remoteclient, so the browser keeps its connection; downloads
+        // started meanwhile are appended to `queue`. The UI thread starts
+        // and joins the thread, and `mutex` orders an append against the
+        // coordinator deciding that the queue has run dry.
+        struct BackgroundDownloads
+        {
+            std::mutex mutex;
+            DownloadQueue queue;
+            RemoteSettings settings;
+            // Remote paths queued since the thread started, folders
+            // included, so nothing is fetched twice.
+            std::set<std::string> queued;
+            // A folder's size was unknown; batch_*_total are left at 0.
+            bool unknown_totals = false;
+            Thread thread;
+            bool running = false;
+            // The coordinator takes no more jobs; the next append starts
+            // another one.
+            bool closing = false;
+            // Jobs were let in short of space because the trash may make
+            // up the difference; the coordinator empties it and checks the
+            // queue again before its next round.
+            bool reclaim = false;
+            // The queue's threads poll this instead of stop_activity, so
+            // only its own Cancel stops it.
+            bool cancel = false;
+            std::atomic<bool> finished{false};
+        };
+
+        BackgroundDownloads background_downloads;
+    }
+
+    // Background worker entry point used by the download queue, and the
+    // loop it runs on its own connection. Defined later in this file.
+    static void DownloadWorkerThread(void *argp);
+    static void WorkDownloadQueue(DownloadWorkerCtx *ctx);
+
+    static bool IsHttpClient(RemoteClient *client)
+    {
+        return client != nullptr &&
+               (client->clientType() == CLIENT_TYPE_WEBDAV || client->clientType() == CLIENT_TYPE_HTTP_SERVER);
+    }
+
+    // Starts webdav_autotune from the tuning the transfer history found
+    // fastest for the site on the current interface, else from the values
+    // stored for the site.
+    static void SeedTuning(RemoteClient *client, const RemoteSettings &settings)
+    {
+        if (client == nullptr || client->clientType() != CLIENT_TYPE_WEBDAV)
+            return;
+        int parallel = settings.tuned_parallel;
+        int chunk_mb = settings.tuned_chunk_mb;
+        TransferHistory::Best(settings.site_name, settings.type, NetIface::Last().type, &parallel, &chunk_mb);
+        ((WebDAVClient *)client)->SetTuning(parallel, chunk_mb);
+    }
+
+    // Seeds a WebDAV client with the ranged download tuning for its site
+    // (SeedTuning) and its rclone rc API, and HTTP clients with what is known of
+    // the server (see host_caps.h).
+    static void ApplySiteTuning(RemoteClient *client, const RemoteSettings &settings)
+    {
+        SeedTuning(client, settings);
+        if (client != nullptr && client->clientType() == CLIENT_TYPE_WEBDAV)
+            ((WebDAVClient *)client)->SetRclone(settings.rclone_rc, settings.rclone_rc_fs);
+        if (IsHttpClient(client))
+            ((BaseClient *)client)->SetStoredCaps(settings.caps);
+    }
+
+    // Keeps what this session learned about the site's server for the
+    // next one.
+    static void SaveSiteCaps(RemoteClient *client)
+    {
+        if (!IsHttpClient(client) || remote_settings == nullptr)
+            return;
+        HostCaps::Caps caps = ((BaseClient *)client)->GetCaps();
+        if (caps == remote_settings->caps)
+            return;
+        remote_settings->caps = caps;
+        CONFIG::SaveSiteCaps(last_site, caps);
+    }
+
+    // Adds the batch that just ended to the transfer history.
+    static void AddHistory(const RemoteSettings *settings, TransferHistory::Direction direction,
+                           const TransferStats::Summary &summary, int files, int64_t bytes, int parallel, int chunk_mb)
+    {
+        if (settings == nullptr || files <= 0)
+            return;
+        TransferHistory::Record record;
+        memset(&record, 0, sizeof(record));
+        snprintf(record.site, sizeof(record.site), "%s", settings->site_name);
+        record.bytes = bytes;
+        record.ms = (uint32_t)(summary.secs * 1000);
+        record.files = (uint32_t)files;
+        record.retries = (uint32_t)summary.retries;
+        record.protocol = (uint8_t)settings->type;
+        record.direction = (uint8_t)direction;
+        record.workers = (uint8_t)summary.workers;
+        record.parallel = (uint8_t)parallel;
+        record.chunk_mb = (uint16_t)chunk_mb;
+        record.mib_s = summary.secs > 0 ? (float)(bytes / summary.secs / 1048576.0) : 0.0f;
+        TransferHistory::Add(record);
+    }
+
+    static bool GetLearnedTuning(RemoteClient *client, int *parallel, int *chunk_mb)
+    {
+        if (client == nullptr || client->clientType() != CLIENT_TYPE_WEBDAV)
+            return false;
+        return ((WebDAVClient *)client)->GetTuning(parallel, chunk_mb);
     }
 
     static int FtpCallback(int64_t xfered, void *arg)
     {
         bytes_transfered = xfered;
+        TransferStats::SetBytes(xfered);
         return 1;
     }
 
-    void RefreshLocalFiles(bool apply_filter)
+    // Opens the connection a queue worker runs on. FTP logins come from
+    // the session pool ([FTP] session_pool), so the next batch and the
+    // parallel segment fetches reuse them instead of logging in again;
+    // other clients come from ClientPool the same way.
+    // Logs and returns nullptr when the worker cannot connect; `what`
+    // names the queue in that line.
+    static RemoteClient *ConnectWorkerClient(const RemoteSettings &settings, const char *what)
+    {
+        if (strncmp(settings.server, "ftp://", 6) == 0)
+        {
+            FtpClient *ftpclient = FtpClient::AcquireSession(settings.server, settings.username, settings.password,
+                                                             FtpClient::pasv);
+            if (ftpclient == nullptr)
+            {
+                Logger::Logf(Logger::LOG_ERROR, "%s worker connect failed server=%s", what, settings.server);
+                return nullptr;
+            }
+            ftpclient->SetCallbackBytes(256000);
+            ftpclient->SetCallbackXferFunction(FtpCallback);
+            return ftpclient;
+        }
+
+        std::string key = ClientPool::Key(settings.server, settings.username);
+        RemoteClient *client = ClientPool::Take(key);
+        if (client != nullptr)
+        {
+            // The interface may have changed since it was pooled.
+            SeedTuning(client, settings);
+            return client;
+        }
+        client = CreateRemoteClient(settings);
+        if (client == nullptr)
+            return nullptr;
+        ApplySiteTuning(client, settings);
+        if (!client->Connect(settings.server, settings.username, settings.password))
+        {
+            const char *resp = client->LastResponse();
+            Logger::Logf(Logger::LOG_ERROR, "%s worker connect failed server=%s resp=%s",
+                         what, settings.server, resp ? resp : "");
+            delete client;
+            return nullptr;
+        }
+        ClientPool::Lend(key, client);
+        return client;
+    }
+
+    static void ReleaseWorkerClient(RemoteClient *client)
+    {
+        if (client->clientType() == CLIENT_TYPE_FTP)
+        {
+            FtpClient::ReleaseSession((FtpClient *)client);
+            return;
+        }
+        // A cancelled SFTP transfer may have left a request half done on
+        // it; curl drops the connection of an aborted request by itself.
+        bool reusable = !Cancel::Stopped() || client->clientType() == CLIENT_TYPE_WEBDAV ||
+                        client->clientType() == CLIENT_TYPE_HTTP_SERVER;
+        if (ClientPool::Give(client, reusable))
+            return;
+        client->Quit();
+        delete client;
+    }
+
+    static void ShowLocalIndex(const char *filter)
+    {
+        local_index.SetSort((ListingSort)listing_sort);
+        local_index.SetFilter(filter);
+        local_index.View(local_files);
+    }
+
+    static void ShowRemoteIndex(const char *filter)
+    {
+        remote_index.SetSort((ListingSort)listing_sort);
+        remote_index.SetFilter(filter);
+        remote_index.View(remote_files);
+    }
+
+    // Files are stat()ed up front only when the sort needs their size or
+    // date; the pane fills in the rows it draws otherwise.
+    static bool LocalDetailsNeeded()
+    {
+        return listing_sort != LISTING_SORT_NAME;
+    }
+
+    static struct
+    {
+        std::string filter;
+        bool select_first = false;
+        int prev_count = -1;
+        bool replace = false;
+        bool merge = false;
+    } local_listing;
+
+    // Entries downloads wrote, as (folder, name), for the local pane to
+    // take over with ACTION_UPDATE_LOCAL_FILES instead of reading the
+    // folder again. Past kMaxLocalChanges the pane just reads it.
+    static const size_t kMaxLocalChanges = 1024;
+    static std::mutex local_changes_mutex;
+    static std::vector<std::pair<std::string, std::string>> local_changes;
+    static bool local_changes_overflow = false;
+
+    static void NoteLocalChange(const std::string &directory, const char *name)
+    {
+        std::lock_guard<std::mutex> lock(local_changes_mutex);
+        if (local_changes.size() >= kMaxLocalChanges)
+            local_changes_overflow = true;
+        else
+            local_changes.emplace_back(directory, name);
+    }
+
+    static int RowOf(const std::vector<DirEntry> &files, const char *name)
+    {
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            if (strcmp(files[i].name, name) == 0)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // After a merge the focused row stays focused and, scrolled by the rows
+    // that came or went above it, where it was on screen; marked rows that
+    // still exist stay marked.
+    static void KeepPlace(const std::vector<DirEntry> &files, const char *focused, int before, char *keep, int *shift,
+                          Selection &marked, const Selection::Marks &marks)
+    {
+        int after = RowOf(files, focused);
+        if (before >= 0 && after >= 0 && after != before)
+        {
+            snprintf(keep, 256, "%s", focused);
+            *shift = after - before;
+        }
+        marked.Restore(marks);
+    }
+
+    static void ShowMergedLocalIndex(const char *filter)
+    {
+        std::string focused = selected_local_file.name;
+        int before = RowOf(local_files, focused.c_str());
+        Selection::Marks marks = multi_selected_local_files.Save();
+        ShowLocalIndex(filter);
+        KeepPlace(local_files, focused.c_str(), before, local_file_to_keep, &local_keep_shift,
+                  multi_selected_local_files, marks);
+    }
+
+    // A new listing of the folder on screen is merged into it; any other
+    // replaces it. Returns true when it was merged.
+    static bool ApplyLocalListing(const std::string &path, CompactListing &&fresh, const char *filter)
+    {
+        int changes = local_index.Holds(path) ? local_index.Merge(fresh) : -1;
+        if (changes >= 0)
+        {
+            Logger::Logf(Logger::LOG_DEBUG, "LISTING merge local path=%s entries=%zu changes=%d", path.c_str(),
+                         fresh.Size(), changes);
+            ShowMergedLocalIndex(filter);
+            return true;
+        }
+        multi_selected_local_files.clear();
+        local_index.Assign(path, std::move(fresh));
+        ShowLocalIndex(filter);
+        return false;
+    }
+
+    void RefreshLocalFiles(bool apply_filter)
+    {
+        LocalScan::Cancel();
+        int err;
+        bool details = LocalDetailsNeeded();
+        ApplyLocalListing(local_directory, CompactListing(FS::ListDir(local_directory, &err, details)),
+                          apply_filter ? local_filter : "");
+        if (err != 0)
+            snprintf(status_message, 1023, "%s", lang_strings[STR_FAIL_READ_LOCAL_DIR_MSG]);
+        else
+            LocalScan::Store(local_directory, details, local_index.Entries());
+    }
+
+    static void SelectFirstLocalFile(bool select_first, int prev_count)
+    {
+        if (select_first && !local_files.empty() && (prev_count < 0 || prev_count != (int)local_files.size()))
+            sprintf(local_file_to_select, "%s", local_files[0].name);
+    }
+
+    void StartLocalListing(bool apply_filter, bool select_first, int prev_count, bool use_cache)
+    {
+        bool details = LocalDetailsNeeded();
+        CompactListing cached;
+        if (use_cache && LocalScan::Lookup(local_directory, details, cached))
+        {
+            LocalScan::Cancel();
+            multi_selected_local_files.clear();
+            local_index.Assign(local_directory, std::move(cached));
+            ShowLocalIndex(apply_filter ? local_filter : "");
+            SelectFirstLocalFile(select_first, prev_count);
+            return;
+        }
+        local_listing.filter = apply_filter ? local_filter : "";
+        local_listing.select_first = select_first;
+        local_listing.prev_count = prev_count;
+        // Reading the folder on screen again keeps its rows, and the
+        // marks and focus on them, until the new listing is merged in.
+        local_listing.merge = !use_cache && local_index.Holds(local_directory);
+        local_listing.replace = !local_listing.merge;
+        if (!local_listing.merge)
+        {
+            multi_selected_local_files.clear();
+            local_index.Clear();
+        }
+        LocalScan::Start(local_directory, details);
+        PollLocalListing();
+    }
+
+    void PollLocalListing()
+    {
+        if (!LocalScan::Running())
+            return;
+
+        std::vector<DirEntry> rows;
+        bool ok;
+        bool finished = LocalScan::Poll(rows, &ok);
+        if (local_listing.replace && (!rows.empty() || finished))
+        {
+            // The previous folder's rows stay until the new ones come.
+            multi_selected_local_files.clear();
+            local_files.clear();
+            local_listing.replace = false;
+        }
+        std::string lower_filter = Util::ToLower(local_listing.filter);
+        for (DirEntry &entry : rows)
+        {
+            if (local_listing.merge)
+                break;
+            if (lower_filter.empty() || strcmp(entry.name, "..") == 0 ||
+                Util::ToLower(entry.name).find(lower_filter) != std::string::npos)
+                local_files.push_back(entry);
+        }
+        if (!finished)
+            return;
+
+        // A folder on screen that could not be read again keeps its rows.
+        bool kept = !ok && local_listing.merge;
+        if (!kept && !ApplyLocalListing(LocalScan::Path(), std::move(LocalScan::Result()), local_listing.filter.c_str()))
+            SelectFirstLocalFile(local_listing.select_first, local_listing.prev_count);
+        LocalScan::Result().Clear();
+        if (!ok)
+            snprintf(status_message, 1023, "%s", lang_strings[STR_FAIL_READ_LOCAL_DIR_MSG]);
+    }
+
+    void ApplyLocalFilter()
+    {
+        // Filtering narrows the listing already on screen instead of
+        // reading the folder again.
+        if (!local_index.Holds(local_directory))
+        {
+            RefreshLocalFiles(true);
+            return;
+        }
+        multi_selected_local_files.clear();
+        ShowLocalIndex(local_filter);
+    }
+
+    static bool PingRemote()
+    {
+        // For WebDAV, avoid the extra HEAD-based Ping() which some
+        // proxies/servers (or certificate setups) handle poorly. Just rely
+        // on the PROPFIND in ListDir to detect connection issues.
+        if (remoteclient->clientType() != CLIENT_TYPE_WEBDAV)
+        {
+            if (!remoteclient->Ping())
+            {
+                remoteclient->Quit();
+                snprintf(status_message, 1023, "%s", lang_strings[STR_CONNECTION_CLOSE_ERR_MSG]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void ClearListingCache()
+    {
+        std::lock_guard<std::mutex> lock(listing_cache_mutex);
+        listing_cache.clear();
+        listing_cache_size = 0;
+    }
+
+    static void CacheListing(const std::string &path, const CompactListing &entries, const std::string &validator)
+    {
+        std::lock_guard<std::mutex> lock(listing_cache_mutex);
+        auto it = listing_cache.find(path);
+        if (it != listing_cache.end())
+        {
+            listing_cache_size -= it->second.entries.Size();
+            listing_cache.erase(it);
+        }
+        // listing_cache_entries, less on a small or short heap.
+        size_t limit = MemoryGovernor::ListingCacheEntries();
+        if (entries.Size() > limit)
+            return;
+
+        // Evict the least recently used folders until the new one fits.
+        while (listing_cache_size + entries.Size() > limit)
+        {
+            auto oldest = listing_cache.begin();
+            for (auto cur = listing_cache.begin(); cur != listing_cache.end(); ++cur)
+            {
+                if (cur->second.used < oldest->second.used)
+                    oldest = cur;
+            }
+            listing_cache_size -= oldest->second.entries.Size();
+            listing_cache.erase(oldest);
+        }
+
+        CachedListing &cached = listing_cache[path];
+        cached.entries = entries;
+        cached.validator = validator;
+        cached.fetched = Util::GetTick();
+        cached.used = cached.fetched;
+        cached.held.Set((int64_t)entries.Bytes());
+        listing_cache_size += entries.Size();
+    }
+
+    static bool LookupListing(const std::string &path, CachedListing &out)
+    {
+        std::lock_guard<std::mutex> lock(listing_cache_mutex);
+        auto it = listing_cache.find(path);
+        if (it == listing_cache.end())
+            return false;
+        it->second.used = Util::GetTick();
+        out = it->second;
+        return true;
+    }
+
+    static bool HasFreshListing(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(listing_cache_mutex);
+        auto it = listing_cache.find(path);
+        return it != listing_cache.end() &&
+               Util::GetTick() - it->second.fetched < static_cast<uint64_t>(listing_cache_seconds) * 1000000ull;
+    }
+
+    static void TouchListing(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(listing_cache_mutex);
+        auto it = listing_cache.find(path);
+        if (it != listing_cache.end())
+            it->second.fetched = Util::GetTick();
+    }
+
+    static void SelectFirstRemoteFile(bool select_first, int prev_count)
+    {
+        if (select_first && remote_files.size() > 0 && (prev_count < 0 || prev_count != remote_files.size()))
+            sprintf(remote_file_to_select, "%s", remote_files[0].name);
+    }
+
+    // Folders inside an archive opened as a folder are listed from its
+    // index; leaving the archive closes it.
+    static bool ListRemoteArchive(bool select_first, int prev_count)
+    {
+        if (!RemoteArchive::IsOpen())
+            return false;
+        if (!RemoteArchive::Contains(remote_directory))
+        {
+            RemoteArchive::Close();
+            return false;
+        }
+
+        multi_selected_remote_files.clear();
+        remote_index.Assign(remote_directory, RemoteArchive::ListDir(remote_directory));
+        ShowRemoteIndex("");
+        snprintf(status_message, 1023, "%s", "");
+        SelectFirstRemoteFile(select_first, prev_count);
+        return true;
+    }
+
+    static void ShowMergedRemoteIndex(const char *filter)
+    {
+        std::string focused = selected_remote_file.name;
+        int before = RowOf(remote_files, focused.c_str());
+        Selection::Marks marks = multi_selected_remote_files.Save();
+        ShowRemoteIndex(filter);
+        KeepPlace(remote_files, focused.c_str(), before, remote_file_to_keep, &remote_keep_shift,
+                  multi_selected_remote_files, marks);
+    }
+
+    // As ApplyLocalListing(), for the remote pane.
+    static bool ApplyRemoteListing(const std::string &path, CompactListing &&fresh, const char *filter)
+    {
+        int changes = remote_index.Holds(path) ? remote_index.Merge(fresh) : -1;
+        if (changes >= 0)
+        {
+            Logger::Logf(Logger::LOG_DEBUG, "LISTING merge remote path=%s entries=%zu changes=%d", path.c_str(),
+                         fresh.Size(), changes);
+            ShowMergedRemoteIndex(filter);
+            return true;
+        }
+        multi_selected_remote_files.clear();
+        remote_index.Assign(path, std::move(fresh));
+        ShowRemoteIndex(filter);
+        return false;
+    }
+
+    void RefreshRemoteFiles(bool apply_filter)
+    {
+        CancelRemoteListing();
+        if (ListRemoteArchive(false, -1))
+            return;
+        if (!PingRemote())
+            return;
+
+        // Blocking refreshes follow changes made on the server, which may
+        // have touched other cached folders as well (moves, deletes).
+        ClearListingCache();
+
+        ApplyRemoteListing(remote_directory, CompactListing(remoteclient->ListDir(remote_directory)),
+                           apply_filter ? remote_filter : "");
+        snprintf(status_message, 1023, "%s", remoteclient->LastResponse());
+        if (listing_cache_entries > 0)
+            CacheListing(remote_directory, remote_index.Entries(), "");
+    }
+
+    // Catalogue matches shown for one search; the count is reported.
+    static const size_t kCatalogueMatches = 2000;
+
+    // With a catalogue of the site holding the folder on screen, the filter
+    // finds matches anywhere below it instead of in its listing alone.
+    static bool ShowCatalogueMatches()
+    {
+        if (remote_filter[0] == '\0' || remote_settings == nullptr || RemoteArchive::IsOpen() ||
+            !Catalogue::Covers(remote_settings->server, remote_directory))
+            return false;
+
+        std::vector<DirEntry> matches;
+        size_t found = Catalogue::Search(remote_settings->server, remote_directory, remote_filter,
+                                         kCatalogueMatches, matches);
+        if (!matches.empty())
+            DirEntry::Sort(matches);
+        multi_selected_remote_files.clear();
+        remote_files.clear();
+        if (strcmp(remote_directory, "/") != 0)
+        {
+            remote_files.emplace_back();
+            Util::SetupPreviousFolder(remote_directory, &remote_files.back());
+        }
+        remote_files.insert(remote_files.end(), matches.begin(), matches.end());
+        snprintf(status_message, 1023, lang_strings[STR_CATALOGUE_MATCHES], (long long)found,
+                 (long long)matches.size());
+        return true;
+    }
+
+    static bool StartRemoteSearch();
+
+    // The filter on the folder on screen alone.
+    static void FilterRemoteFolder()
+    {
+        if (RemoteListingInProgress() || !remote_index.Holds(remote_directory))
+        {
+            StartRemoteListing(true, false, -1, false);
+            return;
+        }
+        multi_selected_remote_files.clear();
+        ShowRemoteIndex(remote_filter);
+    }
+
+    // A server that searches itself goes first, then the site's catalogue,
+    // then the listing on screen.
+    void ApplyRemoteFilter()
+    {
+        if (StartRemoteSearch() || ShowCatalogueMatches())
+            return;
+        FilterRemoteFolder();
+    }
+
+    static void RemoteListingThread(void *argp)
+    {
+        std::string path;
+        std::string cached_validator;
+        std::string query;
+        bool prefetch;
+        bool search;
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            path = remote_listing.path;
+            cached_validator = remote_listing.validator;
+            prefetch = remote_listing.prefetch;
+            search = remote_listing.search;
+            query = remote_listing.query;
+        }
+        // A prefetch only fills the cache and does not hold transfers back.
+        RateLimiter::Interactive lane(!prefetch);
+
+        // Same check as PingRemote(), off the UI thread: a dead control
+        // connection can take the full timeout to notice. Prefetches run
+        // right after a listing went through and skip it.
+        if (!prefetch && remoteclient->clientType() != CLIENT_TYPE_WEBDAV && !remoteclient->Ping())
+        {
+            remoteclient->Quit();
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.lost = true;
+            remote_listing.finished = true;
+            return;
+        }
+
+        // worker_generation is re-read per batch: a prefetch of the folder
+        // the user then opens is adopted by moving it to the new generation.
+        auto on_batch = [](const std::vector<DirEntry> &batch)
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            if (remote_listing.worker_generation != remote_listing.generation)
+                return false;
+            for (const DirEntry &entry : batch)
+            {
+                if (strcmp(entry.name, "..") != 0)
+                    remote_listing.received++;
+                remote_listing.pending.push_back(entry);
+            }
+            return true;
+        };
+        if (search)
+        {
+            int ret = remoteclient->Search(path, query, on_batch);
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.result = ret;
+            remote_listing.finished = true;
+            return;
+        }
+
+        // Grab the folder's validator first so it describes a state no
+        // newer than the listing cached with it. When it matches the cached
+        // one the stale rows on screen are current and nothing is listed.
+        std::string validator;
+        if (listing_cache_entries > 0)
+        {
+            if (!remoteclient->GetDirValidator(path, validator))
+                validator.clear();
+        }
+        if (!cached_validator.empty() && validator == cached_validator)
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.unchanged = true;
+            remote_listing.result = 1;
+            remote_listing.finished = true;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.validator = validator;
+        }
+
+        int ret = remoteclient->ListDirStreamed(path, on_batch);
+
+        std::lock_guard<std::mutex> lock(remote_listing.mutex);
+        remote_listing.result = ret;
+        remote_listing.finished = true;
+    }
+
+    void StartRemoteListing(bool apply_filter, bool select_first, int prev_count, bool use_cache)
+    {
+        // Cached listings are complete; a filter is applied to them here.
+        const char *filter = apply_filter ? remote_filter : "";
+        remote_listing.deferred = false;
+        {
+            // Retires the running worker, if any, without waiting for it,
+            // unless it is prefetching this very folder: then it carries on
+            // as the listing on screen, starting with what it already has.
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.generation++;
+            remote_listing.received = 0;
+            if (remote_listing.running && remote_listing.prefetch && remote_listing.path == remote_directory)
+            {
+                std::vector<DirEntry> received = remote_listing.all.ToVector();
+                remote_listing.all.Clear();
+                remote_listing.pending.insert(remote_listing.pending.begin(), received.begin(), received.end());
+                for (const DirEntry &entry : remote_listing.pending)
+                {
+                    if (strcmp(entry.name, "..") != 0)
+                        remote_listing.received++;
+                }
+                remote_listing.filter = filter;
+                remote_listing.prefetch = false;
+                remote_listing.replace = true;
+                remote_listing.merge = false;
+                remote_listing.select_first = select_first;
+                remote_listing.prev_count = prev_count;
+                remote_listing.worker_generation = remote_listing.generation;
+                multi_selected_remote_files.clear();
+                return;
+            }
+        }
+        if (ListRemoteArchive(select_first, prev_count))
+            return;
+
+        CachedListing cached;
+        bool have_cached = use_cache && listing_cache_entries > 0 &&
+                           LookupListing(remote_directory, cached);
+        if (have_cached && Util::GetTick() - cached.fetched < static_cast<uint64_t>(listing_cache_seconds) * 1000000ull)
+        {
+            multi_selected_remote_files.clear();
+            remote_index.Assign(remote_directory, std::move(cached.entries));
+            ShowRemoteIndex(filter);
+            snprintf(status_message, 1023, "%s", "");
+            SelectFirstRemoteFile(select_first, prev_count);
+            return;
+        }
+
+        // Otherwise the previous rows stay on screen until the first batch
+        // arrives, or, for the folder on screen listed again, until the
+        // new listing is merged into them.
+        bool revalidate = have_cached && !cached.validator.empty();
+        bool merge = !use_cache && remote_index.Holds(remote_directory);
+        if (!merge)
+            multi_selected_remote_files.clear();
+        if (revalidate)
+        {
+            // Show the stale listing right away; it is replaced only if the
+            // folder turns out to have changed.
+            remote_index.Assign(remote_directory, std::move(cached.entries));
+            ShowRemoteIndex(filter);
+            SelectFirstRemoteFile(select_first, prev_count);
+        }
+        if (remote_listing.running)
+        {
+            remote_listing.deferred = true;
+            remote_listing.deferred_apply_filter = apply_filter;
+            remote_listing.deferred_select_first = select_first;
+            remote_listing.deferred_prev_count = prev_count;
+            remote_listing.deferred_use_cache = use_cache;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.pending.clear();
+            remote_listing.all.Clear();
+            remote_listing.path = remote_directory;
+            remote_listing.filter = filter;
+            remote_listing.validator = (revalidate) ? cached.validator : "";
+            remote_listing.received = 0;
+            remote_listing.result = 0;
+            remote_listing.finished = false;
+            remote_listing.lost = false;
+            remote_listing.unchanged = false;
+            remote_listing.prefetch = false;
+            remote_listing.search = false;
+            remote_listing.replace = !merge;
+            remote_listing.merge = merge;
+            remote_listing.worker_generation = remote_listing.generation;
+            remote_listing.select_first = select_first;
+            remote_listing.prev_count = prev_count;
+        }
+
+        int res = Threads::Create(&remote_listing.thread, RemoteListingThread, NULL, 0x100000, Threads::ROLE_NETWORK, "listing");
+        if (R_FAILED(res))
+        {
+            // No thread to spare; fall back to the blocking listing.
+            RefreshRemoteFiles(apply_filter);
+            SelectFirstRemoteFile(select_first, prev_count);
+            return;
+        }
+        remote_listing.running = true;
+        remote_listing.started_at = Util::GetTick();
+        threadStart(&remote_listing.thread);
+        snprintf(status_message, 1023, "%s", "");
+    }
+
+    static bool StartRemoteSearch()
+    {
+        if (!remote_search || remote_filter[0] == '\0' || remoteclient == nullptr || RemoteArchive::IsOpen())
+            return false;
+        ClientType type = remoteclient->clientType();
+        if (type != CLIENT_TYPE_WEBDAV && type != CLIENT_TYPE_SFTP)
+            return false;
+
+        // The search replaces whatever the worker was doing.
+        CancelRemoteListing();
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.generation++;
+            remote_listing.pending.clear();
+            remote_listing.all.Clear();
+            remote_listing.path = remote_directory;
+            remote_listing.query = remote_filter;
+            remote_listing.filter = "";
+            remote_listing.validator = "";
+            remote_listing.received = 0;
+            remote_listing.result = 0;
+            remote_listing.finished = false;
+            remote_listing.lost = false;
+            remote_listing.unchanged = false;
+            remote_listing.prefetch = false;
+            remote_listing.search = true;
+            remote_listing.replace = false;
+            remote_listing.merge = false;
+            remote_listing.worker_generation = remote_listing.generation;
+            remote_listing.select_first = false;
+            remote_listing.prev_count = -1;
+        }
+        int res = Threads::Create(&remote_listing.thread, RemoteListingThread, NULL, 0x100000, Threads::ROLE_NETWORK, "search");
+        if (R_FAILED(res))
+            return false;
+
+        // Matches stream in below the way up.
+        multi_selected_remote_files.clear();
+        remote_files.clear();
+        if (strcmp(remote_directory, "/") != 0)
+        {
+            remote_files.emplace_back();
+            Util::SetupPreviousFolder(remote_directory, &remote_files.back());
+        }
+        remote_listing.running = true;
+        remote_listing.started_at = Util::GetTick();
+        threadStart(&remote_listing.thread);
+        snprintf(status_message, 1023, "%s", "");
+        return true;
+    }
+
+    static void FinishRemoteSearch()
+    {
+        Logger::Logf("SEARCH path=%s query=%s matches=%zu ms=%llu result=%d", remote_listing.path.c_str(),
+                     remote_listing.query.c_str(), remote_listing.all.Size(),
+                     (unsigned long long)((Util::GetTick() - remote_listing.started_at) / 1000),
+                     remote_listing.result);
+        remote_listing.all.Clear();
+        if (remote_listing.result < 0)
+        {
+            // The server cannot search after all.
+            if (!ShowCatalogueMatches())
+                FilterRemoteFolder();
+            return;
+        }
+        size_t first = !remote_files.empty() && strcmp(remote_files[0].name, "..") == 0 ? 1 : 0;
+        // Matches marked while they streamed in stay marked.
+        Selection::Marks marks = multi_selected_remote_files.Save();
+        DirEntry::Sort(remote_files, first);
+        multi_selected_remote_files.Restore(marks);
+        if (remote_listing.result > 0)
+            snprintf(status_message, 1023, lang_strings[STR_SEARCH_MATCHES], (long long)(remote_files.size() - first));
+        else
+            snprintf(status_message, 1023, "%s", remoteclient->LastResponse());
+    }
+
+    void PollRemoteListing()
+    {
+        if (!remote_listing.running)
+            return;
+
+        bool finished;
+        bool stale;
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            stale = remote_listing.worker_generation != remote_listing.generation;
+            if (stale)
+                remote_listing.pending.clear();
+            if (!remote_listing.prefetch && remote_listing.replace && !remote_listing.pending.empty())
+            {
+                // Rows of the previous folder, or a cached listing that
+                // turned out to be outdated, give way to the new ones.
+                multi_selected_remote_files.clear();
+                remote_files.clear();
+                remote_listing.replace = false;
+            }
+            std::string lower_filter = Util::ToLower(remote_listing.filter);
+            for (DirEntry &entry : remote_listing.pending)
+            {
+                if (!remote_listing.prefetch && !remote_listing.merge &&
+                    (lower_filter.empty() || strcmp(entry.name, "..") == 0 ||
+                     Util::ToLower(entry.name).find(lower_filter) != std::string::npos))
+                    remote_files.push_back(entry);
+                remote_listing.all.Append(entry);
+            }
+            remote_listing.pending.clear();
+            finished = remote_listing.finished;
+        }
+        if (!finished)
+            return;
+
+        Threads::Join(&remote_listing.thread);
+        remote_listing.running = false;
+
+        if (stale)
+        {
+            remote_listing.all.Clear();
+            if (remote_listing.deferred)
+                StartRemoteListing(remote_listing.deferred_apply_filter, remote_listing.deferred_select_first,
+                                   remote_listing.deferred_prev_count, remote_listing.deferred_use_cache);
+            return;
+        }
+        if (remote_listing.prefetch)
+        {
+            Logger::Logf("LISTING PREFETCH path=%s entries=%zu ok=%d", remote_listing.path.c_str(),
+                         remote_listing.all.Size(), remote_listing.result > 0 ? 1 : 0);
+            if (remote_listing.result > 0)
+                CacheListing(remote_listing.path, remote_listing.all, remote_listing.validator);
+            remote_listing.all.Clear();
+            return;
+        }
+        if (remote_listing.lost)
+        {
+            snprintf(status_message, 1023, "%s", lang_strings[STR_CONNECTION_CLOSE_ERR_MSG]);
+            if (reconnect_on_resume && Util::GetTick() - last_reconnect > kReconnectIntervalUs)
+                reconnect_pending = true;
+            return;
+        }
+        if (remote_listing.search)
+        {
+            FinishRemoteSearch();
+            return;
+        }
+        if (remote_listing.unchanged)
+        {
+            // Rows and selection were already set from the cache.
+            TouchListing(remote_listing.path);
+            snprintf(status_message, 1023, "%s", "");
+            return;
+        }
+
+        Logger::Logf("LISTING path=%s entries=%zu ms=%llu ok=%d", remote_listing.path.c_str(),
+                     remote_listing.all.Size(),
+                     (unsigned long long)((Util::GetTick() - remote_listing.started_at) / 1000),
+                     remote_listing.result > 0 ? 1 : 0);
+        // A failed listing of the folder on screen leaves its rows alone.
+        if (remote_listing.merge && remote_listing.result <= 0)
+        {
+            remote_listing.all.Clear();
+            snprintf(status_message, 1023, "%s", remoteclient->LastResponse());
+            return;
+        }
+        bool merged = ApplyRemoteListing(remote_listing.path, std::move(remote_listing.all), remote_listing.filter.c_str());
+        remote_listing.all.Clear();
+        snprintf(status_message, 1023, "%s", remoteclient->LastResponse());
+        if (remote_listing.result && listing_cache_entries > 0)
+            CacheListing(remote_listing.path, remote_index.Entries(), remote_listing.validator);
+        if (!merged)
+            SelectFirstRemoteFile(remote_listing.select_first, remote_listing.prev_count);
+    }
+
+    void CancelRemoteListing()
+    {
+        if (!remote_listing.running)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.generation++;
+        }
+        Threads::Join(&remote_listing.thread);
+        remote_listing.running = false;
+        remote_listing.deferred = false;
+        remote_listing.pending.clear();
+        remote_listing.all.Clear();
+        remote_listing.finished = false;
+    }
+
+    bool RemoteListingInProgress()
+    {
+        // A stale listing that is only winding down doesn't count, unless
+        // the request that replaced it is waiting for the connection.
+        return remote_listing.running && !remote_listing.prefetch &&
+               (remote_listing.deferred || remote_listing.worker_generation == remote_listing.generation);
+    }
+
+    bool RemoteConnectionBusy()
+    {
+        return remote_listing.running;
+    }
+
+    void CancelRemotePrefetch()
+    {
+        if (!remote_listing.running || !remote_listing.prefetch)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.generation++;
+        }
+        // Planned again, minus what got cached, once things are idle.
+        remote_prefetch.planned = false;
+        remote_prefetch.queue.clear();
+    }
+
+    static void PlanRemotePrefetch()
+    {
+        remote_prefetch.queue.clear();
+        int focus = 0;
+        for (size_t i = 0; i < remote_files.size(); i++)
+        {
+            if (remote_prefetch.focus == remote_files[i].name)
+            {
+                focus = (int)i;
+                break;
+            }
+        }
+
+        // The focused row first, then its neighbours nearest first.
+        int count = (int)remote_files.size();
+        for (int step = 0; step < count * 2 && (int)remote_prefetch.queue.size() < listing_prefetch; step++)
+        {
+            int index = focus + ((step % 2 == 0) ? step / 2 : -(step + 1) / 2);
+            if (index < 0 || index >= count)
+                continue;
+            const DirEntry &entry = remote_files[index];
+            if (entry.isDir && strcmp(entry.name, "..") != 0)
+                remote_prefetch.queue.push_back(entry.path);
+        }
+    }
+
+    static bool StartRemotePrefetch(const std::string &path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(remote_listing.mutex);
+            remote_listing.pending.clear();
+            remote_listing.all.Clear();
+            remote_listing.path = path;
+            remote_listing.filter = "";
+            remote_listing.validator = "";
+            remote_listing.received = 0;
+            remote_listing.result = 0;
+            remote_listing.finished = false;
+            remote_listing.lost = false;
+            remote_listing.unchanged = false;
+            remote_listing.prefetch = true;
+            remote_listing.search = false;
+            remote_listing.replace = false;
+            remote_listing.worker_generation = remote_listing.generation;
+        }
+
+        // Lowest priority: the UI and transfers come first.
+        int res = Threads::Create(&remote_listing.thread, RemoteListingThread, NULL, 0x100000, Threads::ROLE_BACKGROUND, "listing prefetch");
+        if (R_FAILED(res))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "LISTING PREFETCH threadCreate failed rc=0x%x path=%s", res, path.c_str());
+            remote_listing.prefetch = false;
+            return false;
+        }
+        remote_listing.running = true;
+        remote_listing.started_at = Util::GetTick();
+        threadStart(&remote_listing.thread);
+        return true;
+    }
+
+    void PrefetchRemoteListings()
+    {
+        if (listing_prefetch <= 0 || listing_cache_entries <= 0 || remoteclient == nullptr ||
+            !remoteclient->IsConnected() || remote_listing.running || activity_inprogess ||
+            file_transfering || RemoteArchive::IsOpen() || !remote_index.Holds(remote_directory))
+            return;
+
+        uint64_t now = Util::GetTick();
+        if (remote_prefetch.folder != remote_directory || remote_prefetch.focus != selected_remote_file.name)
+        {
+            remote_prefetch.folder = remote_directory;
+            remote_prefetch.focus = selected_remote_file.name;
+            remote_prefetch.focus_tick = now;
+            remote_prefetch.planned = false;
+            remote_prefetch.queue.clear();
+            return;
+        }
+        if (!remote_prefetch.planned)
+        {
+            // Don't spend requests on rows merely scrolled past.
+            if (now - remote_prefetch.focus_tick < 300000)
+                return;
+            PlanRemotePrefetch();
+            remote_prefetch.planned = true;
+        }
+
+        while (!remote_prefetch.queue.empty())
+        {
+            std::string path = remote_prefetch.queue.front();
+            remote_prefetch.queue.erase(remote_prefetch.queue.begin());
+            if (HasFreshListing(path))
+                continue;
+            StartRemotePrefetch(path);
+            return;
+        }
+    }
+
+    int RemoteListingCount()
+    {
+        std::lock_guard<std::mutex> lock(remote_listing.mutex);
+        return remote_listing.received;
+    }
+
+    // The folder the properties dialog is sizing. The crawl thread owns
+    // everything but `running`, `key` and `finished` until it finishes.
+    static struct
+    {
+        Thread thread;
+        bool running = false;
+        std::atomic<bool> finished{false};
+        std::string key;
+        std::string path;
+        bool remote = false;
+        RemoteSettings settings;
+        FolderSize::Progress progress;
+        FolderSize::Totals totals;
+        bool ok = false;
+    } folder_size;
+
+    // One request where the server keeps the figure or lists a tree in one
+    // go; otherwise folder_size_workers sessions crawl the folders.
+    static bool SizeRemoteFolder(FolderSize::Totals &totals)
+    {
+        FolderSize::Progress &progress = folder_size.progress;
+        std::vector<RemoteClient *> clients(folder_size_workers, nullptr);
+        clients[0] = ConnectWorkerClient(folder_size.settings, "Folder size");
+        if (clients[0] == nullptr)
+            return false;
+
+        bool ok;
+        int64_t used = 0;
+        if (clients[0]->UsedBytes(folder_size.path, &used) == 1)
+        {
+            totals.bytes = used;
+            totals.files = -1;
+            totals.folders = -1;
+            ok = true;
+        }
+        else
+        {
+            ok = clients[0]->ListTree(folder_size.path, [&progress](const std::vector<DirEntry> &batch)
+                                      {
+                                          for (const DirEntry &entry : batch)
+                                              progress.Add(entry);
+                                          return !progress.cancel;
+                                      }) == 1;
+            if (!ok && !progress.cancel)
+            {
+                progress.Reset();
+                ok = FolderSize::Walk(
+                    folder_size.path, folder_size_workers, Threads::ROLE_NETWORK,
+                    [&clients](int worker, const std::string &path, std::vector<DirEntry> &entries)
+                    {
+                        return clients[worker]->ListDirStreamed(path, [&entries](const std::vector<DirEntry> &batch)
+                                                                {
+                                                                    entries.insert(entries.end(), batch.begin(), batch.end());
+                                                                    return true;
+                                                                }) != 0;
+                    },
+                    progress,
+                    [&clients](int worker)
+                    {
+                        clients[worker] = ConnectWorkerClient(folder_size.settings, "Folder size");
+                        return clients[worker] != nullptr;
+                    });
+            }
+            totals = progress.Snapshot();
+        }
+
+        for (RemoteClient *client : clients)
+        {
+            if (client != nullptr)
+                ReleaseWorkerClient(client);
+        }
+        return ok && !progress.cancel;
+    }
+
+    static void FolderSizeThread(void *argp)
+    {
+        FolderSize::Totals totals;
+        bool ok;
+        if (folder_size.remote)
+            ok = SizeRemoteFolder(totals);
+        else
+        {
+            ok = FolderSize::Local(folder_size.path, folder_size_workers, folder_size.progress);
+            totals = folder_size.progress.Snapshot();
+        }
+        if (ok)
+            FolderSize::Store(folder_size.key, totals);
+        folder_size.totals = totals;
+        folder_size.ok = ok;
+        folder_size.finished = true;
+    }
+
+    void PollFolderSize()
+    {
+        if (!folder_size.running || !folder_size.finished)
+            return;
+        Threads::Join(&folder_size.thread);
+        folder_size.running = false;
+    }
+
+    void CancelFolderSize()
+    {
+        // Joined by PollFolderSize() once the crawl notices.
+        folder_size.progress.cancel = true;
+        folder_size.key.clear();
+    }
+
+    void StartFolderSize(const DirEntry &entry, bool remote)
+    {
+        std::string site = remote ? (remote_settings != nullptr ? remote_settings->server : "") : "";
+        std::string key = FolderSize::Key(site, entry.path);
+        if (key == folder_size.key && (folder_size.running || folder_size.finished))
+            return;
+        if (folder_size.running)
+        {
+            folder_size.progress.cancel = true;
+            Threads::Join(&folder_size.thread);
+            folder_size.running = false;
+        }
+
+        folder_size.key = key;
+        folder_size.path = entry.path;
+        folder_size.remote = remote;
+        folder_size.progress.Reset();
+        folder_size.progress.cancel = false;
+        folder_size.finished = false;
+        if (FolderSize::Lookup(key, folder_size.totals))
+        {
+            folder_size.ok = true;
+            folder_size.finished = true;
+            return;
+        }
+        folder_size.ok = false;
+        if (remote && (remote_settings == nullptr || RemoteArchive::Contains(entry.path)))
+        {
+            folder_size.finished = true;
+            return;
+        }
+        if (remote)
+            folder_size.settings = *remote_settings;
+
+        Result rc = Threads::Create(&folder_size.thread, FolderSizeThread, nullptr, 0x10000,
+                                    remote ? Threads::ROLE_NETWORK : Threads::ROLE_DISK, "folder size");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "FOLDER SIZE threadCreate failed rc=0x%x", rc);
+            folder_size.finished = true;
+            return;
+        }
+        threadStart(&folder_size.thread);
+        folder_size.running = true;
+    }
+
+    bool FolderSizeStatus(FolderSize::Totals &totals, bool *ok)
+    {
+        if (!folder_size.finished)
+        {
+            totals = folder_size.progress.Snapshot();
+            *ok = true;
+            return false;
+        }
+        totals = folder_size.totals;
+        *ok = folder_size.ok;
+        return true;
+    }
+
+    void BuildCatalogueThread(void *argp)
+    {
+        RemoteSettings settings = *remote_settings;
+        std::string root = remote_directory;
+        FolderSize::Progress progress;
+        std::vector<RemoteClient *> clients(folder_size_workers, nullptr);
+        snprintf(activity_message, 1024, lang_strings[STR_CATALOGUE_PROGRESS], 0LL, 0LL);
+
+        bool ok = false;
+        clients[0] = ConnectWorkerClient(settings, "Catalogue");
+        if (clients[0] != nullptr)
+        {
+            // Runs after each folder on some worker.
+            auto update = [&progress]()
+            {
+                if (Cancel::Stopped())
+                    progress.cancel = true;
+                snprintf(activity_message, 1024, lang_strings[STR_CATALOGUE_PROGRESS], (long long)progress.folders,
+                         (long long)progress.files);
+            };
+            ok = Catalogue::Build(
+                settings.server, root, folder_size_workers,
+                [&clients, &root, &update](const DirEntryBatchFn &on_batch)
+                {
+                    return clients[0]->ListTree(root, [&](const std::vector<DirEntry> &batch)
+                                                {
+                                                    bool more = on_batch(batch);
+                                                    update();
+                                                    return more;
+                                                }) == 1;
+                },
+                [&clients, &update](int worker, const std::string &path, std::vector<DirEntry> &entries)
+                {
+                    int ret = clients[worker]->ListDirStreamed(path, [&entries](const std::vector<DirEntry> &batch)
+                                                               {
+                                                                   entries.insert(entries.end(), batch.begin(), batch.end());
+                                                                   return true;
+                                                               });
+                    update();
+                    return ret != 0;
+                },
+                [&clients](int worker, const std::string &path, std::string &validator)
+                { return clients[worker]->GetDirValidator(path, validator); },
+                progress,
+                [&clients, &settings](int worker)
+                {
+                    clients[worker] = ConnectWorkerClient(settings, "Catalogue");
+                    return clients[worker] != nullptr;
+                });
+        }
+        for (RemoteClient *client : clients)
+        {
+            if (client != nullptr)
+                ReleaseWorkerClient(client);
+        }
+
+        if (ok)
+            snprintf(status_message, 1023, lang_strings[STR_CATALOGUE_BUILT], (long long)progress.folders,
+                     (long long)progress.files);
+        activity_inprogess = false;
+        stop_activity = false;
+        Windows::SetModalMode(false);
+        threadExit();
+    }
+
+    void BuildCatalogue()
     {
-        multi_selected_local_files.clear();
-        local_files.clear();
-        int err;
-        if (strlen(local_filter) > 0 && apply_filter)
+        sprintf(status_message, "%s", "");
+        int res = Threads::Create(&bk_activity_thid, BuildCatalogueThread, NULL, 0x10000, Threads::ROLE_NETWORK, "catalogue");
+        if (R_FAILED(res))
         {
-            std::vector<DirEntry> temp_files = FS::ListDir(local_directory, &err);
-            std::string lower_filter = Util::ToLower(local_filter);
-            for (std::vector<DirEntry>::iterator it = temp_files.begin(); it != temp_files.end();)
-            {
-                std::string lower_name = Util::ToLower(it->name);
-                if (lower_name.find(lower_filter) != std::string::npos || strcmp(it->name, "..") == 0)
-                {
-                    local_files.push_back(*it);
-                }
-                ++it;
-            }
-            temp_files.clear();
+            activity_inprogess = false;
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
         }
         else
         {
-            local_files = FS::ListDir(local_directory, &err);
+            threadStart(&bk_activity_thid);
         }
-        DirEntry::Sort(local_files);
-        if (err != 0)
-            snprintf(status_message, 1023, "%s", lang_strings[STR_FAIL_READ_LOCAL_DIR_MSG]);
     }
 
-    void RefreshRemoteFiles(bool apply_filter)
+    void BenchmarkSiteThread(void *argp)
     {
-        // For WebDAV, avoid the extra HEAD-based Ping() which some
-        // proxies/servers (or certificate setups) handle poorly. Just rely
-        // on the PROPFIND in ListDir to detect connection issues.
-        if (remoteclient->clientType() != CLIENT_TYPE_WEBDAV)
+        RemoteSettings settings = *remote_settings;
+        DirEntry file = selected_remote_file;
+        SiteBench::Result result;
+        RemoteClient *client = ConnectWorkerClient(settings, "Site benchmark");
+        if (client != nullptr)
         {
-            if (!remoteclient->Ping())
-            {
-                remoteclient->Quit();
-                snprintf(status_message, 1023, "%s", lang_strings[STR_CONNECTION_CLOSE_ERR_MSG]);
-                return;
-            }
+            SiteBench::Run(client, file, result,
+                           [&result](int index, int count, const SiteBench::Point &point)
+                           {
+                               snprintf(activity_message, 1024, lang_strings[STR_BENCHMARK_SITE_PROGRESS], index + 1,
+                                        count, SiteBench::Label(result.type, point).c_str());
+                               bytes_to_download = (int64_t)result.bytes;
+                               bytes_transfered = 0;
+                               prev_tick = Util::GetTick();
+                           });
+            ReleaseWorkerClient(client);
         }
+        else
+            result.error = lang_strings[STR_CONNECTION_CLOSE_ERR_MSG];
 
-        multi_selected_remote_files.clear();
-        remote_files.clear();
-        if (strlen(remote_filter) > 0 && apply_filter)
+        if (!Cancel::Stopped())
         {
-            std::vector<DirEntry> temp_files = remoteclient->ListDir(remote_directory);
-            std::string lower_filter = Util::ToLower(remote_filter);
-            for (std::vector<DirEntry>::iterator it = temp_files.begin(); it != temp_files.end();)
-            {
-                std::string lower_name = Util::ToLower(it->name);
-                if (lower_name.find(lower_filter) != std::string::npos || strcmp(it->name, "..") == 0)
-                {
-                    remote_files.push_back(*it);
-                }
-                ++it;
-            }
-            temp_files.clear();
+            SiteBench::SetLast(result);
+            Windows::ShowSiteBench();
+        }
+        activity_inprogess = false;
+        file_transfering = false;
+        stop_activity = false;
+        Windows::SetModalMode(false);
+        threadExit();
+    }
+
+    void BenchmarkSite()
+    {
+        sprintf(status_message, "%s", "");
+        int res = Threads::Create(&bk_activity_thid, BenchmarkSiteThread, NULL, 0x10000, Threads::ROLE_NETWORK, "site bench");
+        if (R_FAILED(res))
+        {
+            activity_inprogess = false;
+            file_transfering = false;
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
         }
         else
         {
-            remote_files = remoteclient->ListDir(remote_directory);
+            threadStart(&bk_activity_thid);
         }
-        DirEntry::Sort(remote_files);
-        snprintf(status_message, 1023, "%s", remoteclient->LastResponse());
     }
 
     void HandleChangeLocalDirectory(const DirEntry entry)
@@ -146,11 +1715,8 @@ namespace Actions
         {
             sprintf(local_directory, "%s", entry.path);
         }
-        RefreshLocalFiles(false);
-        if (strcmp(entry.name, "..") != 0)
-        {
-            sprintf(local_file_to_select, "%s", local_files[0].name);
-        }
+        // Going up keeps the folder just left selected.
+        StartLocalListing(false, strcmp(entry.name, "..") != 0, -1, true);
         selected_action = ACTION_NONE;
     }
 
@@ -159,16 +1725,9 @@ namespace Actions
         if (!entry.isDir)
             return;
 
-        if (remoteclient->clientType() != CLIENT_TYPE_WEBDAV)
-        {
-            if (!remoteclient->Ping())
-            {
-                remoteclient->Quit();
-                snprintf(status_message, 1023, "%s", lang_strings[STR_CONNECTION_CLOSE_ERR_MSG]);
-                return;
-            }
-        }
-
+        // The connection is checked by the listing worker, and only when
+        // the folder is not served from the listing cache. A listing still
+        // running for the previous folder is abandoned, not waited for.
         if (strcmp(entry.name, "..") == 0)
         {
             std::string temp_path = std::string(entry.directory);
@@ -189,24 +1748,64 @@ namespace Actions
         {
             sprintf(remote_directory, "%s", entry.path);
         }
-        RefreshRemoteFiles(false);
-        if (strcmp(entry.name, "..") != 0)
-        {
-            sprintf(remote_file_to_select, "%s", remote_files[0].name);
-        }
+        StartRemoteListing(false, strcmp(entry.name, "..") != 0, -1, true);
         if (selected_action != ACTION_APPLY_REMOTE_NATIVE_FILTER)
             selected_action = ACTION_NONE;
     }
 
     void HandleRefreshLocalFiles()
     {
-        int prev_count = local_files.size();
-        RefreshLocalFiles(false);
-        int new_count = local_files.size();
-        if (prev_count != new_count)
         {
-            sprintf(local_file_to_select, "%s", local_files[0].name);
+            // The listing covers whatever downloads noted.
+            std::lock_guard<std::mutex> lock(local_changes_mutex);
+            local_changes.clear();
+            local_changes_overflow = false;
+        }
+        // An explicit refresh reads the card again: the cache only knows
+        // about changes made by the app.
+        StartLocalListing(false, true, local_files.size(), false);
+        selected_action = ACTION_NONE;
+    }
+
+    void HandleUpdateLocalFiles()
+    {
+        std::vector<std::pair<std::string, std::string>> changes;
+        bool overflow;
+        {
+            std::lock_guard<std::mutex> lock(local_changes_mutex);
+            changes.swap(local_changes);
+            overflow = local_changes_overflow;
+            local_changes_overflow = false;
         }
+        // Only a complete listing of the folder on screen can take them.
+        if (overflow || LocalScan::Running() || !local_index.Holds(local_directory))
+        {
+            HandleRefreshLocalFiles();
+            return;
+        }
+        std::string folder = local_directory;
+        Util::Rtrim(folder, "/");
+        int applied = 0;
+        for (const auto &change : changes)
+        {
+            std::string directory = change.first;
+            Util::Rtrim(directory, "/");
+            if (directory != folder)
+                continue;
+            DirEntry entry;
+            if (FS::GetEntry(change.first, change.second, entry))
+                local_index.Upsert(entry);
+            else
+                local_index.Remove(change.second.c_str());
+            applied++;
+        }
+        if (applied > 0)
+        {
+            ShowMergedLocalIndex(local_index.Filter().c_str());
+            LocalScan::Store(local_directory, false, local_index.Entries());
+        }
+        Logger::Logf(Logger::LOG_DEBUG, "LISTING update local path=%s changes=%d/%zu", local_directory, applied,
+                     changes.size());
         selected_action = ACTION_NONE;
     }
 
@@ -214,13 +1813,7 @@ namespace Actions
     {
         if (remoteclient != nullptr)
         {
-            int prev_count = remote_files.size();
-            RefreshRemoteFiles(false);
-            int new_count = remote_files.size();
-            if (prev_count != new_count)
-            {
-                sprintf(remote_file_to_select, "%s", remote_files[0].name);
-            }
+            StartRemoteListing(false, true, remote_files.size(), false);
         }
         if (selected_action != ACTION_APPLY_REMOTE_NATIVE_FILTER)
             selected_action = ACTION_NONE;
@@ -286,24 +1879,33 @@ namespace Actions
     {
         std::vector<DirEntry> files;
         if (multi_selected_local_files.size() > 0)
-            std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(files));
+            files = multi_selected_local_files.Entries();
         else
             files.push_back(selected_local_file);
 
+        // Entries the trash took leave the pane like the ones a download
+        // wrote arrive; the folder is only read again after a slow delete.
+        bool slow = false;
         for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
         {
-            FS::RmRecursive(it->path);
+            if (LocalTrash::Move(it->path))
+                NoteLocalChange(it->directory, it->name);
+            else
+            {
+                FS::RmRecursive(it->path);
+                slow = true;
+            }
         }
         activity_inprogess = false;
         Windows::SetModalMode(false);
-        selected_action = ACTION_REFRESH_LOCAL_FILES;
+        selected_action = slow ? ACTION_REFRESH_LOCAL_FILES : ACTION_UPDATE_LOCAL_FILES;
         threadExit();
     }
 
     void DeleteSelectedLocalFiles()
     {
         sprintf(activity_message, "%s", "");
-        int res = threadCreate(&bk_activity_thid, DeleteSelectedLocalFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, DeleteSelectedLocalFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "delete local");
         if (R_FAILED(res))
         {
             threadClose(&bk_activity_thid);
@@ -314,29 +1916,235 @@ namespace Actions
         }
     }
 
+    // Files found by a remote delete walk, waiting for a connection to
+    // delete them. Bounded, so a huge tree does not pile up in memory while
+    // the walk runs ahead of the deletes.
+    struct DeleteQueue
+    {
+        static const size_t kMaxQueued = 4096;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::string> files;
+        bool walking = true;
+        // Worker connections that are up; the walk only waits for room
+        // while someone is there to make it.
+        int consumers = 0;
+        int deleted = 0;
+        int failed = 0;
+        std::string lastFailed;
+
+        void Push(const std::string &path)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (files.size() >= kMaxQueued && consumers > 0 && !Cancel::Stopped())
+                cv.wait_for(lock, std::chrono::milliseconds(100));
+            files.push_back(path);
+            cv.notify_all();
+        }
+
+        bool Next(std::string &path)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (files.empty() && walking && !Cancel::Stopped())
+                cv.wait_for(lock, std::chrono::milliseconds(100));
+            if (Cancel::Stopped() || files.empty())
+                return false;
+            path = files.front();
+            files.pop_front();
+            cv.notify_all();
+            return true;
+        }
+
+        void Done(const std::string &path, bool ok)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ok)
+                deleted++;
+            else
+            {
+                failed++;
+                lastFailed = path;
+            }
+        }
+
+        void SetConsumer(bool up)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            consumers += up ? 1 : -1;
+            cv.notify_all();
+        }
+
+        void Finish()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            walking = false;
+            cv.notify_all();
+        }
+    };
+
+    struct DeleteWorkerCtx
+    {
+        DeleteQueue *queue = nullptr;
+        RemoteSettings settings;
+    };
+
+    static void DrainDeleteQueue(DeleteQueue *queue, RemoteClient *client)
+    {
+        std::string path;
+        while (queue->Next(path))
+        {
+            sprintf(activity_message, "%s %s", lang_strings[STR_DELETING], path.c_str());
+            queue->Done(path, client->Delete(path) > 0);
+        }
+    }
+
+    static void DeleteWorkerThread(void *argp)
+    {
+        DeleteWorkerCtx *ctx = static_cast<DeleteWorkerCtx *>(argp);
+        RemoteClient *client = ConnectWorkerClient(ctx->settings, "Remote delete");
+        if (client == nullptr)
+        {
+            threadExit();
+            return;
+        }
+
+        ctx->queue->SetConsumer(true);
+        DrainDeleteQueue(ctx->queue, client);
+        ctx->queue->SetConsumer(false);
+
+        ReleaseWorkerClient(client);
+        threadExit();
+    }
+
+    // Queues every file below `path` and records its folders deepest first.
+    static void WalkRemoteDelete(const std::string &path, DeleteQueue &queue, std::vector<std::string> &dirs)
+    {
+        if (Cancel::Stopped())
+            return;
+
+        sprintf(activity_message, "%s %s", lang_strings[STR_DELETING], path.c_str());
+        std::vector<DirEntry> entries = remoteclient->ListDir(path);
+        for (const DirEntry &entry : entries)
+        {
+            if (Cancel::Stopped())
+                return;
+            if (!entry.isDir)
+                queue.Push(entry.path);
+            else if (strcmp(entry.name, "..") != 0)
+                WalkRemoteDelete(entry.path, queue, dirs);
+        }
+        dirs.push_back(path);
+    }
+
+    // Deletes `entries` from the connected site. WebDAV removes a folder
+    // with one DELETE of the collection; folders it refuses and those on
+    // other protocols are walked on the primary connection, which queues
+    // their files for up to remote_delete_workers connections and then
+    // removes the emptied folders.
+    static void DeleteRemoteEntries(const std::vector<DirEntry> &entries)
+    {
+        uint64_t start = Util::GetTick();
+        DeleteQueue queue;
+        std::vector<std::string> walk;
+        int files = 0;
+        for (const DirEntry &entry : entries)
+        {
+            if (!entry.isDir)
+            {
+                queue.Push(entry.path);
+                files++;
+                continue;
+            }
+            if (remoteclient->clientType() == CLIENT_TYPE_WEBDAV)
+            {
+                sprintf(activity_message, "%s %s", lang_strings[STR_DELETING], entry.path);
+                if (remoteclient->Rmdir(entry.path, true))
+                {
+                    queue.deleted++;
+                    continue;
+                }
+                Logger::Logf("Remote delete collection refused path=%s, walking it", entry.path);
+            }
+            walk.push_back(entry.path);
+        }
+
+        // A few selected files are not worth extra connections.
+        int workers = remote_delete_workers - 1;
+        if (walk.empty() && files < 8)
+            workers = 0;
+        else
+        {
+            RemoteClient *probe = CreateRemoteClient(remote_settings->server);
+            if (probe == nullptr)
+                workers = 0;
+            delete probe;
+        }
+
+        std::vector<DeleteWorkerCtx> worker_ctx(workers);
+        std::vector<Thread> threads(workers);
+        std::vector<bool> started(workers, false);
+        for (int i = 0; i < workers; i++)
+        {
+            worker_ctx[i].queue = &queue;
+            worker_ctx[i].settings = *remote_settings;
+            Result rc = Threads::Create(&threads[i], DeleteWorkerThread, &worker_ctx[i], 0x100000, Threads::ROLE_NETWORK, "delete worker");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "Remote delete: failed to create worker thread rc=0x%08x", rc);
+                continue;
+            }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        std::vector<std::string> dirs;
+        for (const std::string &path : walk)
+            WalkRemoteDelete(path, queue, dirs);
+        queue.Finish();
+
+        // Whatever the workers have not taken yet (all of it without
+        // workers) goes from here.
+        DrainDeleteQueue(&queue, remoteclient);
+        for (int i = 0; i < workers; i++)
+        {
+            if (!started[i])
+                continue;
+            Threads::Join(&threads[i]);
+        }
+
+        int dirs_failed = 0;
+        for (const std::string &dir : dirs)
+        {
+            if (Cancel::Stopped())
+                break;
+            sprintf(activity_message, "%s %s", lang_strings[STR_DELETING], dir.c_str());
+            if (!remoteclient->Rmdir(dir, false))
+            {
+                dirs_failed++;
+                snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_DEL_DIR_MSG], dir.c_str());
+            }
+        }
+        if (queue.failed > 0)
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_DEL_FILE_MSG], queue.lastFailed.c_str());
+
+        Logger::Logf("Remote delete entries=%d deleted=%d failed=%d dirs=%d dirs_failed=%d workers=%d ms=%llu",
+                     (int)entries.size(), queue.deleted, queue.failed, (int)dirs.size(), dirs_failed, workers,
+                     (unsigned long long)((Util::GetTick() - start) / 1000));
+    }
+
     void DeleteSelectedRemotesFilesThread(void *argp)
     {
         if (remoteclient->clientType() != CLIENT_TYPE_WEBDAV ? remoteclient->Ping() : true)
         {
             std::vector<DirEntry> files;
             if (multi_selected_remote_files.size() > 0)
-                std::copy(multi_selected_remote_files.begin(), multi_selected_remote_files.end(), std::back_inserter(files));
+                files = multi_selected_remote_files.Entries();
             else
                 files.push_back(selected_remote_file);
 
-            for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
-            {
-                if (it->isDir)
-                    remoteclient->Rmdir(it->path, true);
-                else
-                {
-                    sprintf(activity_message, "%s %s", lang_strings[STR_DELETING], it->path);
-                    if (!remoteclient->Delete(it->path))
-                    {
-                        snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAILED], remoteclient->LastResponse());
-                    }
-                }
-            }
+            DeleteRemoteEntries(files);
+            FolderSize::Invalidate(remote_settings->server, remote_directory);
             selected_action = ACTION_REFRESH_REMOTE_FILES;
         }
         else
@@ -353,7 +2161,7 @@ namespace Actions
     void DeleteSelectedRemotesFiles()
     {
         sprintf(activity_message, "%s", "");
-        int res = threadCreate(&bk_activity_thid, DeleteSelectedRemotesFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, DeleteSelectedRemotesFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "delete remote");
         if (R_FAILED(res))
         {
             threadClose(&bk_activity_thid);
@@ -364,6 +2172,122 @@ namespace Actions
         }
     }
 
+    // Whether the `kept` bytes already at `dest` are the start of `src`:
+    // resume_verify_blocks 64 KiB samples, the last bytes kept and the rest
+    // spread over them, compared with the card. The journal says this file
+    // began the remote one; the samples catch a remote file changed since.
+    static bool UploadTailMatches(RemoteClient *client, const std::string &src, const std::string &dest, int64_t kept)
+    {
+        const int64_t kSample = 64 * 1024;
+        if (resume_verify_blocks <= 0)
+            return true;
+
+        int count = (int)std::min<int64_t>(resume_verify_blocks, (kept + kSample - 1) / kSample);
+        std::vector<std::vector<char>> remote(count);
+        std::vector<RemoteRange> ranges(count);
+        for (int i = 0; i < count; i++)
+        {
+            int64_t start = i == 0 ? std::max<int64_t>(0, kept - kSample) : kept * i / count;
+            int64_t size = std::min(kSample, kept - start);
+            remote[i].resize(size);
+            ranges[i].offset = start;
+            ranges[i].size = size;
+            ranges[i].buffer = remote[i].data();
+        }
+        // Unlike a download, nothing to resume is better than a bad guess.
+        if (!client->GetRanges(dest, ranges))
+            return false;
+
+        std::vector<char> local(kSample);
+        for (const RemoteRange &range : ranges)
+        {
+            UploadSource source(src, range.offset, range.size);
+            bool same = source.Open() && source.Read(local.data(), range.size) == (int64_t)range.size &&
+                        memcmp(local.data(), range.buffer, range.size) == 0;
+            source.Close();
+            if (!same)
+            {
+                Logger::Logf("UPLOAD resume verify mismatch dest=%s offset=%llu kept=%lld", dest.c_str(),
+                             (unsigned long long)range.offset, (long long)kept);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Put() that continues a partial remote file an earlier attempt left.
+    // With transfer_journal on, an upload journal names the local file and
+    // its mtime before any byte goes out; a later Put() of the same file to
+    // the same destination asks the server how much of it arrived, checks
+    // the samples and sends only the rest. The journal goes once the file
+    // is complete.
+    static int PutResumable(RemoteClient *client, const std::string &src, const std::string &dest, int64_t size)
+    {
+        struct stat st;
+        if (!transfer_journal || size <= 0 || stat(src.c_str(), &st) != 0)
+            return client->Put(src, dest);
+
+        char validator[64];
+        snprintf(validator, sizeof(validator), "mtime:%lld", (long long)st.st_mtime);
+        TransferJournal journal;
+        uint64_t offset = 0;
+        int64_t kept = -1;
+        if (journal.LoadUpload(last_site, dest) && journal.local_path == src && journal.validator == validator &&
+            journal.size == size && client->Size(dest, &kept) && kept > 0 && kept < size &&
+            UploadTailMatches(client, src, dest, kept))
+            offset = (uint64_t)kept;
+
+        journal.upload = true;
+        journal.site = last_site;
+        journal.remote_path = dest;
+        journal.local_path = src;
+        journal.validator = validator;
+        journal.Reset(size);
+        if (offset > 0)
+            journal.MarkDone(0, (int64_t)offset - 1);
+        journal.Save();
+        if (offset > 0)
+            Logger::Logf("UPLOAD resume dest=%s offset=%llu size=%lld", dest.c_str(), (unsigned long long)offset,
+                         (long long)size);
+
+        int ret = client->Put(src, dest, offset);
+        if (ret > 0)
+            journal.Remove();
+        return ret;
+    }
+
+    // Put() of a local file, or of a DBI-style split folder as the one file
+    // it holds. WebDAV reads the parts itself, in parallel chunks where the
+    // server takes them; other protocols get them back to back as one
+    // PutStream() body, so the file is never put together on the card.
+    static int PutLocalFile(RemoteClient *client, const std::string &src, const std::string &dest)
+    {
+        int64_t split_size = UploadSource::SplitSize(src);
+        if (split_size < 0)
+            return PutResumable(client, src, dest, FS::GetSize(src));
+        if (client->clientType() == CLIENT_TYPE_WEBDAV)
+            return PutResumable(client, src, dest, split_size);
+
+        UploadSource source(src);
+        if (!source.Open() || (int64_t)source.Size() != split_size)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "UPLOAD split folder unreadable path=%s", src.c_str());
+            return 0;
+        }
+        int ret = client->PutStream(dest, source.Size(), [&source](char *buffer, size_t size)
+                                    { return source.Read(buffer, size); });
+        source.Close();
+        Logger::Logf("UPLOAD split folder path=%s dest=%s bytes=%lld ok=%d", src.c_str(), dest.c_str(),
+                     (long long)split_size, ret > 0 ? 1 : 0);
+        if (ret < 0)
+        {
+            // SMB cannot upload a stream; it needs the file whole on the card.
+            Logger::Logf(Logger::LOG_ERROR, "UPLOAD split folder needs PutStream path=%s", src.c_str());
+            return 0;
+        }
+        return ret;
+    }
+
       int UploadFile(const char *src, const char *dest)
       {
           int ret;
@@ -401,7 +2325,7 @@ namespace Actions
         {
             prev_tick = Util::GetTick();
             sprintf(activity_message, "%s %s\n", lang_strings[STR_UPLOADING], src);
-            return remoteclient->Put(src, dest);
+            return PutLocalFile(remoteclient, src, dest);
         }
 
         return 1;
@@ -409,7 +2333,7 @@ namespace Actions
 
     int Upload(const DirEntry &src, const char *dest)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
             return 1;
 
         int ret;
@@ -420,7 +2344,7 @@ namespace Actions
             remoteclient->Mkdir(dest);
             for (int i = 0; i < entries.size(); i++)
             {
-                if (stop_activity)
+                if (Cancel::Stopped())
                     return 1;
 
                 int path_length = strlen(dest) + strlen(entries[i].name) + 2;
@@ -475,7 +2399,140 @@ namespace Actions
             }
             free(new_path);
         }
-        return 1;
+        return 1;
+    }
+
+    // One file of an upload batch.
+    struct UploadJob
+    {
+        std::string src;
+        std::string dest;
+        int64_t size;
+    };
+
+    // All jobs are known before the workers start, so unlike the download
+    // queue nothing is ever added while they run.
+    struct UploadQueue
+    {
+        std::mutex mutex;
+        std::deque<UploadJob> jobs;
+        int failed = 0;
+        std::string lastFailed;
+        int filesOk = 0;
+        int64_t bytesOk = 0;
+
+        bool Next(UploadJob &job)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (Cancel::Stopped() || jobs.empty())
+                return false;
+            job = jobs.front();
+            jobs.pop_front();
+            TransferStats::SetQueued((int)jobs.size());
+            return true;
+        }
+
+        void Done(const UploadJob &job, bool ok)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch_files_done++;
+            batch_bytes_done += job.size;
+            if (ok)
+            {
+                filesOk++;
+                bytesOk += job.size;
+            }
+            else
+            {
+                failed++;
+                lastFailed = job.src;
+            }
+        }
+    };
+
+    struct UploadWorkerCtx
+    {
+        UploadQueue *queue = nullptr;
+        int slot = 0;
+        RemoteSettings settings;
+    };
+
+    // Lists `src` into file jobs below `dest_dir`, creating the remote
+    // folders on the way down so every job's parent exists before the
+    // workers start.
+    static void AddUploadJobs(const DirEntry &src, const std::string &dest_dir, std::vector<UploadJob> &jobs)
+    {
+        std::string dest = dest_dir + (FS::hasEndSlash(dest_dir.c_str()) ? "" : "/") + src.name;
+        if (!src.isDir)
+        {
+            jobs.push_back({src.path, dest, (int64_t)src.file_size});
+            return;
+        }
+        // Parts a split download left go up as the file they make.
+        int64_t split_size = UploadSource::SplitSize(src.path);
+        if (split_size >= 0)
+        {
+            jobs.push_back({src.path, dest, split_size});
+            return;
+        }
+
+        sprintf(activity_message, "%s %s", lang_strings[STR_UPLOADING], src.path);
+        remoteclient->Mkdir(dest);
+        int err = 0;
+        std::vector<DirEntry> entries = FS::ListDir(src.path, &err);
+        for (const DirEntry &entry : entries)
+        {
+            if (Cancel::Stopped())
+                return;
+            if (strcmp(entry.name, "..") != 0)
+                AddUploadJobs(entry, dest, jobs);
+        }
+    }
+
+    static void RunUploadWorker(UploadQueue *queue, RemoteClient *client, bool background)
+    {
+        UploadJob job;
+        while (queue->Next(job))
+        {
+            TransferStats::BeginFile(job.src, job.size);
+            int ret;
+            if (background)
+            {
+                ret = PutLocalFile(client, job.src, job.dest);
+            }
+            else
+            {
+                // The primary connection keeps the overwrite prompt and the
+                // status messages.
+                bytes_to_download = job.size;
+                bytes_transfered = 0;
+                ret = UploadFile(job.src.c_str(), job.dest.c_str());
+            }
+            TransferStats::EndFile();
+            if (ret <= 0)
+                Logger::Logf(Logger::LOG_ERROR, "Upload queue job failed path=%s resp=%s", job.src.c_str(),
+                             client->LastResponse() ? client->LastResponse() : "");
+            queue->Done(job, ret > 0);
+        }
+    }
+
+    static void UploadWorkerThread(void *argp)
+    {
+        UploadWorkerCtx *ctx = static_cast<UploadWorkerCtx *>(argp);
+        TransferStats::Bind(ctx->slot);
+
+        // The remaining workers pick up the jobs one cannot connect for.
+        RemoteClient *client = ConnectWorkerClient(ctx->settings, "Upload queue");
+        if (client == nullptr)
+        {
+            threadExit();
+            return;
+        }
+
+        RunUploadWorker(ctx->queue, client, true);
+
+        ReleaseWorkerClient(client);
+        threadExit();
     }
 
     void UploadFilesThread(void *argp)
@@ -483,23 +2540,93 @@ namespace Actions
         file_transfering = true;
         std::vector<DirEntry> files;
         if (multi_selected_local_files.size() > 0)
-            std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(files));
+            files = multi_selected_local_files.Entries();
         else
             files.push_back(selected_local_file);
+        // Rows selected without being drawn may still lack their size.
+        for (DirEntry &file : files)
+            FS::EnsureDetails(file);
+        FolderSize::Invalidate(remote_settings->server, remote_directory);
+
+        // Largest first, so a big file does not end up running alone at the
+        // end of the batch.
+        std::vector<UploadJob> manifest;
+        for (const DirEntry &file : files)
+            AddUploadJobs(file, remote_directory, manifest);
+        std::stable_sort(manifest.begin(), manifest.end(), [](const UploadJob &a, const UploadJob &b)
+                         { return a.size > b.size; });
+
+        UploadQueue queue;
+        queue.jobs.assign(manifest.begin(), manifest.end());
+        int64_t total = 0;
+        for (const UploadJob &job : manifest)
+            total += job.size;
+        batch_files_done = 0;
+        batch_bytes_done = 0;
+        batch_files_total = (int)manifest.size();
+        batch_bytes_total = total;
+        batch_start_tick = Util::GetTick();
+
+        // Extra workers each open their own connection and cannot answer
+        // the overwrite prompt, as for downloads.
+        CONFIG::RefreshSiteProfile(remote_settings);
+        int workers = upload_parallel_files;
+        if (overwrite_type == OVERWRITE_PROMPT || manifest.size() < 2)
+            workers = 1;
+        else
+        {
+            RemoteClient *probe = CreateRemoteClient(remote_settings->server);
+            if (probe == nullptr)
+                workers = 1;
+            delete probe;
+        }
+        Logger::Logf("Upload queue start jobs=%d bytes=%lld workers=%d", (int)manifest.size(), (long long)total, workers);
 
-        for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
+        TransferStats::Reset(workers);
+        TransferStats::SetQueued((int)queue.jobs.size());
+        TransferStats::Bind(0);
+
+        std::vector<UploadWorkerCtx> worker_ctx(workers > 1 ? workers - 1 : 0);
+        std::vector<Thread> threads(worker_ctx.size());
+        std::vector<bool> started(worker_ctx.size(), false);
+        for (size_t i = 0; i < worker_ctx.size(); ++i)
         {
-            if (it->isDir)
-            {
-                char new_dir[512];
-                sprintf(new_dir, "%s%s%s", remote_directory, FS::hasEndSlash(remote_directory) ? "" : "/", it->name);
-                Upload(*it, new_dir);
-            }
-            else
+            worker_ctx[i].queue = &queue;
+            worker_ctx[i].slot = (int)i + 1;
+            worker_ctx[i].settings = *remote_settings;
+            Result rc = Threads::Create(&threads[i], UploadWorkerThread, &worker_ctx[i], 0x100000, Threads::ROLE_NETWORK, "upload worker");
+            if (R_FAILED(rc))
             {
-                Upload(*it, remote_directory);
+                Logger::Logf(Logger::LOG_ERROR, "Upload queue: failed to create worker thread rc=0x%08x", rc);
+                continue;
             }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        RunUploadWorker(&queue, remoteclient, false);
+
+        for (size_t i = 0; i < worker_ctx.size(); ++i)
+        {
+            if (!started[i])
+                continue;
+            Threads::Join(&threads[i]);
         }
+
+        TransferStats::Summary summary = TransferStats::LogSummary("uploads", queue.filesOk, queue.bytesOk);
+        AddHistory(remote_settings, TransferHistory::DIRECTION_UPLOAD, summary, queue.filesOk, queue.bytesOk, 0, 0);
+        TransferStats::Bind(-1);
+        TransferStats::Reset(0);
+        BufferPool::LogStats("uploads");
+        BufferPool::Trim();
+
+        if (!Cancel::Stopped() && queue.failed > 1)
+            snprintf(status_message, 1023, "%d transfer(s) failed – see log for details", queue.failed);
+        else if (!Cancel::Stopped() && queue.failed == 1)
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_UPLOAD_MSG], queue.lastFailed.c_str());
+
+        batch_files_total = 0;
+        batch_bytes_total = 0;
         activity_inprogess = false;
         file_transfering = false;
         multi_selected_local_files.clear();
@@ -511,7 +2638,7 @@ namespace Actions
     void UploadFiles()
     {
         sprintf(activity_message, "%s", "");
-        int res = threadCreate(&bk_activity_thid, UploadFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, UploadFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "upload");
         if (R_FAILED(res))
         {
             threadClose(&bk_activity_thid);
@@ -522,7 +2649,67 @@ namespace Actions
         }
     }
 
-    static int DownloadFileWithClient(RemoteClient *client, const char *src, const char *dest)
+    // Set while a download batch runs whose overwrite questions were all
+    // answered before it started; the files it still holds are replaced
+    // without asking.
+    static std::atomic<bool> overwrites_settled(false);
+
+    // The files the Metalink description just downloaded to `dest` lists,
+    // fetched into its folder from their mirrors. A file that is no
+    // Metalink after all is left as it is.
+    static int DownloadMetalinkFiles(const char *dest, bool interactive)
+    {
+        static const int64_t kMaxMetalinkSize = 4 * 1024 * 1024;
+        std::vector<Metalink::File> files;
+        if (FS::GetSize(dest) > kMaxMetalinkSize)
+            return 1;
+        std::vector<char> data = FS::Load(dest);
+        if (!Metalink::Parse(std::string(data.begin(), data.end()), files))
+        {
+            Logger::Logf(Logger::LOG_WARN, "METALINK nothing to fetch path=%s", dest);
+            return 1;
+        }
+
+        std::string dir = dest;
+        dir.resize(dir.find_last_of('/') + 1);
+        for (const Metalink::File &file : files)
+        {
+            if (Cancel::Stopped())
+                return 0;
+            std::string out = dir + file.name;
+            if (overwrite_type == OVERWRITE_NONE && FS::FileExists(out))
+                continue;
+            FS::MkDirs(out.substr(0, out.find_last_of('/')));
+            Preflight::Plan plan;
+            if (!Preflight::Fits(out, (uint64_t)file.size, &plan))
+            {
+                if (interactive)
+                    snprintf(status_message, 1023, lang_strings[STR_NOT_ENOUGH_SPACE], plan.needed / 1048576.0,
+                             plan.free / 1048576.0);
+                return 0;
+            }
+
+            bytes_to_download = file.size;
+            bytes_transfered = 0;
+            prev_tick = Util::GetTick();
+            if (interactive)
+                sprintf(activity_message, "%s %s\n", lang_strings[STR_DOWNLOADING], file.name.c_str());
+            std::string error;
+            if (!Metalink::Download(file, out, error))
+            {
+                if (interactive)
+                    snprintf(status_message, 1023, "%s %s: %s", lang_strings[STR_FAIL_DOWNLOAD_MSG],
+                             file.name.c_str(), error.c_str());
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // `size_hint` is the remote size from the listing the file came from,
+    // or 0 when unknown, and `modified` its listed date when known.
+    static int DownloadFileWithClient(RemoteClient *client, const char *src, const char *dest, int64_t size_hint = 0,
+                                      const DateTime *modified = nullptr)
     {
         int ret;
         bytes_transfered = 0;
@@ -532,14 +2719,17 @@ namespace Actions
             return 0;
         }
 
-        // For WebDAV, skip explicit size probes (some proxies misbehave on HEAD/PROPFIND).
+        // For WebDAV, skip explicit size probes (some proxies misbehave on
+        // HEAD/PROPFIND); the listing size is handed to GetKnownSize below.
         if (client->clientType() == CLIENT_TYPE_WEBDAV)
         {
-            bytes_to_download = 0;
+            bytes_to_download = (size_hint > 0) ? size_hint : 0;
         }
         else
         {
-            ret = client->Size(src, &bytes_to_download);
+            int64_t size = 0;
+            ret = client->Size(src, &size);
+            bytes_to_download = size;
             if (ret == 0)
             {
                 client->Quit();
@@ -550,8 +2740,15 @@ namespace Actions
         }
 
         const bool interactive = (client == remoteclient);
+        // A journaled destination is our own unfinished download, not a
+        // file to protect from overwriting.
+        const bool resumable = TransferJournal::Exists(dest);
 
-        if (overwrite_type == OVERWRITE_PROMPT && FS::FileExists(dest) && interactive)
+        if (resumable || overwrites_settled)
+        {
+            confirm_state = CONFIRM_YES;
+        }
+        else if (overwrite_type == OVERWRITE_PROMPT && FS::FileExists(dest) && interactive)
         {
             sprintf(confirm_message, "%s %s?", lang_strings[STR_OVERWRITE], dest);
             confirm_state = CONFIRM_WAIT;
@@ -575,9 +2772,42 @@ namespace Actions
 
         if (confirm_state == CONFIRM_YES)
         {
+            // Files of folders expanded on the way were not in the batch
+            // preflight.
+            int64_t expected = client->clientType() == CLIENT_TYPE_WEBDAV ? size_hint : bytes_to_download;
+            Preflight::Plan plan;
+            if (expected > 0 && !Preflight::Fits(dest, (uint64_t)expected, &plan))
+            {
+                if (interactive)
+                    snprintf(status_message, 1023, lang_strings[STR_NOT_ENOUGH_SPACE], plan.needed / 1048576.0,
+                             plan.free / 1048576.0);
+                return 0;
+            }
+
+            // The same file downloaded before and still on the card needs
+            // no network.
+            std::string validator = modified != nullptr ? DownloadCache::Validator(*modified) : "";
+            std::string cached = expected > 0 ? DownloadCache::Find(last_site, src, (uint64_t)expected, validator) : "";
+            if (!cached.empty())
+            {
+                bool same = cached == dest;
+                if (!same && interactive)
+                    sprintf(activity_message, "%s %s\n", lang_strings[STR_COPYING], cached.c_str());
+                if (same || LocalCopy::CopyFile(cached, dest))
+                {
+                    Logger::Logf("DOWNLOAD CACHE hit path=%s from=%s bytes=%lld", src, same ? "dest" : cached.c_str(),
+                                 (long long)expected);
+                    if (same)
+                        bytes_transfered += expected;
+                    else
+                        DownloadCache::Record(last_site, src, (uint64_t)expected, validator, dest);
+                    return 1;
+                }
+                if (Cancel::Stopped())
+                    return 0;
+            }
+
             const int kMaxAutoResumeAttempts = 6;
-            const int64_t kAutoResumeTotalNs = 20000000000ll; // ~20 seconds total across all attempts
-            const int64_t kPerAttemptDelayNs = kAutoResumeTotalNs / kMaxAutoResumeAttempts;
             int auto_attempts = 0;
 
             while (true)
@@ -585,9 +2815,15 @@ namespace Actions
                 prev_tick = Util::GetTick();
                 if (interactive)
                     sprintf(activity_message, "%s %s\n", lang_strings[STR_DOWNLOADING], src);
-                int ok = client->Get(dest, src);
+                int ok = client->GetKnownSize(dest, src, size_hint);
                 if (ok)
+                {
+                    DownloadCache::Record(last_site, src, (uint64_t)std::max<int64_t>(expected, bytes_to_download),
+                                          validator, dest);
+                    if (metalink && Metalink::IsMetalink(src))
+                        return DownloadMetalinkFiles(dest, interactive);
                     return 1;
+                }
 
                 const char *resp = client->LastResponse();
                 if (resp && strcmp(resp, lang_strings[STR_CANCEL_ACTION_MSG]) == 0)
@@ -596,7 +2832,7 @@ namespace Actions
                     return 0;
                 }
 
-                Logger::Logf("Download failed path=%s resp=%s", src, resp ? resp : "");
+                Logger::Logf(Logger::LOG_ERROR, "Download failed path=%s resp=%s", src, resp ? resp : "");
 
                 // For non-WebDAV clients, keep legacy behaviour and fail immediately.
                 if (client->clientType() != CLIENT_TYPE_WEBDAV || !interactive)
@@ -606,24 +2842,28 @@ namespace Actions
                 // the user to confirm. This helps smooth over transient
                 // "Couldn't connect to server" blips from VPN / proxy setups
                 // without spamming confirm dialogs.
+                // The ranged paths already retried what failed, and the
+                // journal or the partial file keeps what arrived, so this
+                // picks up the rest. The wait backs off with jitter and
+                // honours a Retry-After the server sent.
                 if (interactive && auto_attempts < kMaxAutoResumeAttempts)
                 {
+                    uint64_t delay_us = ((BaseClient *)client)->RetryDelayUs(auto_attempts);
                     ++auto_attempts;
-                    Logger::Logf("Download auto-resume attempt %d/%d path=%s",
+                    Logger::Logf("Download auto-resume attempt %d/%d path=%s delay_ms=%llu",
                                  auto_attempts,
                                  kMaxAutoResumeAttempts,
-                                 src);
+                                 src,
+                                 (unsigned long long)(delay_us / 1000));
 
-                    const int slices = 20;
-                    const int64_t slice = kPerAttemptDelayNs / slices;
-                    for (int i = 0; i < slices; ++i)
+                    for (uint64_t waited = 0; waited < delay_us; waited += 100000)
                     {
-                        if (stop_activity)
+                        if (Cancel::Stopped())
                         {
                             Logger::Logf("Download auto-resume cancelled path=%s", src);
                             return 0;
                         }
-                        svcSleepThread(slice);
+                        svcSleepThread(100000000ull);
                     }
 
                     // Loop back and attempt the download again automatically.
@@ -676,7 +2916,7 @@ namespace Actions
 
     static int DownloadWithClient(RemoteClient *client, const DirEntry &src, const char *dest)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
             return 1;
 
         int ret;
@@ -687,7 +2927,7 @@ namespace Actions
             FS::MkDirs(dest);
             for (int i = 0; i < entries.size(); i++)
             {
-                if (stop_activity)
+                if (Cancel::Stopped())
                     return 1;
 
                 int path_length = strlen(dest) + strlen(entries[i].name) + 2;
@@ -711,7 +2951,8 @@ namespace Actions
                 {
                     if (client == remoteclient)
                         snprintf(activity_message, 1024, "%s %s", lang_strings[STR_DOWNLOADING], entries[i].path);
-                    ret = DownloadFileWithClient(client, entries[i].path, new_path);
+                    ret = DownloadFileWithClient(client, entries[i].path, new_path, entries[i].file_size,
+                                                 &entries[i].modified);
                     if (ret <= 0)
                     {
                         if (client == remoteclient)
@@ -754,7 +2995,7 @@ namespace Actions
             snprintf(new_path, path_length, "%s%s%s", dest, FS::hasEndSlash(dest) ? "" : "/", src.name);
             if (client == remoteclient)
                 snprintf(activity_message, 1024, "%s %s", lang_strings[STR_DOWNLOADING], src.path);
-            ret = DownloadFileWithClient(client, src.path, new_path);
+            ret = DownloadFileWithClient(client, src.path, new_path, src.file_size, &src.modified);
             if (ret <= 0)
             {
                 free(new_path);
@@ -788,225 +3029,940 @@ namespace Actions
             }
             free(new_path);
         }
-        return 1;
+        return 1;
+    }
+
+    int Download(const DirEntry &src, const char *dest)
+    {
+        return DownloadWithClient(remoteclient, src, dest);
+    }
+
+    // Runs queued jobs on `client` until the queue is drained. Folder jobs
+    // are listed with the worker's own client and their entries queued.
+    // `server` is the site's, whose ConnectionBudget the files share.
+    static void RunDownloadWorker(DownloadQueue *queue, RemoteClient *client, const char *server, bool background)
+    {
+        DownloadJob job;
+        while (queue->Next(job))
+        {
+            bool ok = true;
+            if (job.entry.isDir)
+            {
+                std::string local_dir = job.destDir;
+                if (!FS::hasEndSlash(local_dir.c_str()))
+                    local_dir += "/";
+                local_dir += job.entry.name;
+                FS::MkDirs(local_dir);
+                NoteLocalChange(job.destDir, job.entry.name);
+
+                // The other workers idle once the queue runs dry; let the
+                // listing that refills it overtake their transfers.
+                std::vector<DirEntry> entries;
+                {
+                    RateLimiter::Interactive lane;
+                    entries = client->ListDir(job.entry.path);
+                }
+                std::vector<DownloadJob> children;
+                for (const DirEntry &child : entries)
+                {
+                    if (strcmp(child.name, "..") == 0)
+                        continue;
+                    children.push_back({child, local_dir});
+                }
+                queue->PushFront(children);
+            }
+            else
+            {
+                TransferStats::BeginFile(job.entry.name, job.entry.file_size);
+                {
+                    ConnectionBudget::Ticket ticket(server, job.entry.file_size);
+                    ok = DownloadWithClient(client, job.entry, job.destDir.c_str()) > 0;
+                }
+                TransferStats::EndFile();
+                NoteLocalChange(job.destDir, job.entry.name);
+                if (!ok)
+                    Logger::Logf(Logger::LOG_ERROR, "Download queue job failed path=%s resp=%s",
+                                 job.entry.path,
+                                 client->LastResponse() ? client->LastResponse() : "");
+                queue->FileDone(job.entry.file_size, ok);
+            }
+            queue->Done(ok, background);
+        }
+    }
+
+    // Folders averaging at most small_file_batch_kb per file, with at least
+    // this many files, are worth fetching as one archive.
+    static const size_t kMinArchiveFiles = 32;
+
+    // Small files cost a request, a file open and a progress reset each. A
+    // freshly downloaded folder of mostly small files is fetched instead as
+    // one tar the server builds (RemoteClient::GetFolderArchive) and
+    // extracted as it arrives. Files from `first` on are the folder's
+    // listing; those that came out whole are dropped from `files`, the rest
+    // stay queued.
+    static void FetchFolderArchive(RemoteClient *client, const DownloadJob &job, const std::string &local_root,
+                                   std::vector<DownloadJob> &files, size_t first)
+    {
+        size_t count = files.size() - first;
+        if (small_file_batch_kb <= 0 || count < kMinArchiveFiles || Cancel::Stopped())
+            return;
+        int64_t bytes = 0;
+        for (size_t i = first; i < files.size(); i++)
+            bytes += files[i].entry.file_size;
+        if (bytes / (int64_t)count > (int64_t)small_file_batch_kb * 1024)
+            return;
+
+        // The archive names entries below the folder's own name; anything
+        // else is not ours to write.
+        std::string name = job.entry.name;
+        std::string prefix = name + "/";
+        uint64_t start = Util::GetTick();
+        sprintf(activity_message, "%s %s\n", lang_strings[STR_DOWNLOADING], job.entry.path);
+        int ret = ZipUtil::ExtractFolderStreamed(job.entry, job.destDir, client, [&](std::string &pathname)
+                                                 { return pathname == name || pathname.compare(0, prefix.size(), prefix) == 0; });
+        if (ret < 0)
+            return;
+
+        size_t kept = first;
+        int extracted = 0;
+        int64_t extracted_bytes = 0;
+        for (size_t i = first; i < files.size(); i++)
+        {
+            const DownloadJob &file = files[i];
+            std::string local = file.destDir + (FS::hasEndSlash(file.destDir.c_str()) ? "" : "/") + file.entry.name;
+            if (FS::GetSize(local) == (int64_t)file.entry.file_size)
+            {
+                extracted++;
+                extracted_bytes += file.entry.file_size;
+                continue;
+            }
+            files[kept++] = file;
+        }
+        files.resize(kept);
+
+        Logger::Logf("Download folder archive path=%s ok=%d files=%d/%d bytes=%lld ms=%llu",
+                     job.entry.path, ret, extracted, (int)count, (long long)extracted_bytes,
+                     (unsigned long long)((Util::GetTick() - start) / 1000));
+    }
+
+    // Expands the selected folders into a flat list of file jobs with one
+    // recursive listing each (RemoteClient::ListTree), creating the local
+    // folders up front. The largest files are queued first so they do not
+    // end up running alone at the end of the batch, and the total feeds the
+    // overall progress. Returns false, leaving `jobs` untouched, when the
+    // protocol or server cannot list a tree in one go; the queue then
+    // expands folders as workers reach them.
+    static bool BuildDownloadManifest(RemoteClient *client, std::deque<DownloadJob> &jobs)
+    {
+        // ~1.7 KiB per entry; bigger trees are expanded lazily instead.
+        static const size_t kMaxManifestFiles = 20000;
+
+        std::vector<DownloadJob> files;
+        std::vector<std::string> dirs;
+        for (const DownloadJob &job : jobs)
+        {
+            if (!job.entry.isDir)
+            {
+                files.push_back(job);
+                continue;
+            }
+
+            std::string root = job.entry.path;
+            Util::Rtrim(root, "/");
+            std::string local_root = job.destDir;
+            if (!FS::hasEndSlash(local_root.c_str()))
+                local_root += "/";
+            local_root += job.entry.name;
+            dirs.push_back(local_root);
+            NoteLocalChange(job.destDir, job.entry.name);
+            bool fresh = !FS::FolderExists(local_root);
+            size_t first = files.size();
+            size_t first_dir = dirs.size();
+
+            int ret = client->ListTree(job.entry.path, [&](const std::vector<DirEntry> &batch)
+                                       {
+                                           for (const DirEntry &entry : batch)
+                                           {
+                                               std::string rel = std::string(entry.directory).substr(root.size());
+                                               if (rel == "/")
+                                                   rel.clear();
+                                               std::string local_dir = local_root + rel;
+                                               if (entry.isDir)
+                                                   dirs.push_back(local_dir + "/" + entry.name);
+                                               else
+                                                   files.push_back({entry, local_dir});
+                                           }
+                                           return files.size() <= kMaxManifestFiles && !Cancel::Stopped();
+                                       });
+            if (ret == 0)
+            {
+                Logger::Logf("Download manifest unavailable path=%s, expanding folders lazily", job.entry.path);
+                return false;
+            }
+            // The properties dialog gets the size for free.
+            FolderSize::Totals totals;
+            totals.files = (int64_t)(files.size() - first);
+            totals.folders = (int64_t)(dirs.size() - first_dir);
+            for (size_t i = first; i < files.size(); i++)
+                totals.bytes += files[i].entry.file_size;
+            FolderSize::Store(FolderSize::Key(remote_settings->server, job.entry.path), totals);
+            // Extracting never asks before overwriting, so it only fills
+            // folders that did not exist yet.
+            if (fresh)
+                FetchFolderArchive(client, job, local_root, files, first);
+        }
+
+        for (const std::string &dir : dirs)
+            FS::MkDirs(dir);
+
+        std::stable_sort(files.begin(), files.end(), [](const DownloadJob &a, const DownloadJob &b)
+                         { return a.entry.file_size > b.entry.file_size; });
+
+        int64_t total = 0;
+        for (const DownloadJob &job : files)
+            total += job.entry.file_size;
+        batch_files_done = 0;
+        batch_bytes_done = 0;
+        batch_files_total = static_cast<int>(files.size());
+        batch_bytes_total = total;
+        batch_start_tick = Util::GetTick();
+        jobs.assign(files.begin(), files.end());
+
+        Logger::Logf("Download manifest files=%d dirs=%d bytes=%lld",
+                     batch_files_total, (int)dirs.size(), (long long)total);
+        return true;
+    }
+
+    // Folders expanded lazily still get batch totals, and with them an ETA,
+    // when every one of them was sized before (properties, an earlier
+    // manifest) and the sizes include file counts.
+    static void UseKnownFolderSizes(const std::deque<DownloadJob> &jobs)
+    {
+        int64_t files = 0;
+        int64_t bytes = 0;
+        for (const DownloadJob &job : jobs)
+        {
+            if (!job.entry.isDir)
+            {
+                files++;
+                bytes += job.entry.file_size;
+                continue;
+            }
+            FolderSize::Totals totals;
+            if (!FolderSize::Lookup(FolderSize::Key(remote_settings->server, job.entry.path), totals) || totals.files < 0)
+                return;
+            files += totals.files;
+            bytes += totals.bytes;
+        }
+        batch_files_done = 0;
+        batch_bytes_done = 0;
+        batch_files_total = (int)files;
+        batch_bytes_total = bytes;
+        batch_start_tick = Util::GetTick();
+        Logger::Logf("Download totals from folder sizes files=%lld bytes=%lld", (long long)files, (long long)bytes);
+    }
+
+    // Refuses a batch that cannot fit on the SD card before it starts,
+    // instead of an hour into it. Folders still to be expanded count with
+    // the size FolderSize knows for them, if any. `reclaim` is for the
+    // transfer thread: it empties the trash before giving up. Without it
+    // a batch short only while the trash holds deletes is let through and
+    // `*trash` set, for the transfer thread to empty it and check again.
+    static bool PreflightDownloads(const std::deque<DownloadJob> &jobs, const char *server, bool reclaim,
+                                   bool *trash = nullptr)
+    {
+        std::vector<Preflight::File> files;
+        uint64_t unlisted = 0;
+        for (const DownloadJob &job : jobs)
+        {
+            std::string dest = job.destDir + (FS::hasEndSlash(job.destDir.c_str()) ? "" : "/") + job.entry.name;
+            if (job.entry.isDir)
+            {
+                // One being resumed holds an unknown part of it already.
+                FolderSize::Totals totals;
+                if (!FS::FolderExists(dest) &&
+                    FolderSize::Lookup(FolderSize::Key(server, job.entry.path), totals))
+                    unlisted += totals.bytes;
+                continue;
+            }
+            files.push_back({dest, job.entry.file_size});
+        }
+        if (files.empty() && unlisted == 0)
+            return true;
+
+        Preflight::Plan plan = Preflight::Check(jobs.front().destDir, files, unlisted, reclaim);
+        if (plan.Fits())
+            return true;
+        if (plan.trash && trash != nullptr)
+        {
+            snprintf(status_message, 1023, lang_strings[STR_SPACE_AFTER_TRASH], plan.needed / 1048576.0,
+                     plan.free / 1048576.0);
+            *trash = true;
+            return true;
+        }
+        snprintf(status_message, 1023, lang_strings[STR_NOT_ENOUGH_SPACE], plan.needed / 1048576.0, plan.free / 1048576.0);
+        return false;
+    }
+
+    // Downloading rows of an archive opened as a folder extracts them.
+    static void ExtractRemoteArchiveEntries(const std::string &dest)
+    {
+        std::vector<DirEntry> files;
+        if (multi_selected_remote_files.size() > 0)
+            files = multi_selected_remote_files.Entries();
+        else
+            files.push_back(selected_remote_file);
+
+        int failed = RemoteArchive::Extract(remoteclient, files, dest);
+        if (failed > 1 && !Cancel::Stopped())
+            snprintf(status_message, 1023, "%d %s", failed, lang_strings[STR_FAILED_TO_EXTRACT]);
+    }
+
+    // Keeps what the ranged downloads learned for the next session; the
+    // primary connection, when it took part, ran longest, so it wins.
+    // The values go to `*parallel` and `*chunk_mb` for the history, 0
+    // when no download was autotuned.
+    static void SaveLearnedTuning(RemoteClient *primary, const std::vector<DownloadWorkerCtx> &worker_ctx, int *parallel,
+                                  int *chunk_mb)
+    {
+        int tuned_parallel = 0;
+        int tuned_chunk_mb = 0;
+        if (!GetLearnedTuning(primary, &tuned_parallel, &tuned_chunk_mb))
+        {
+            for (const DownloadWorkerCtx &ctx : worker_ctx)
+            {
+                if (ctx.tuned_parallel > 0)
+                {
+                    tuned_parallel = ctx.tuned_parallel;
+                    tuned_chunk_mb = ctx.tuned_chunk_mb;
+                }
+            }
+        }
+        if (tuned_parallel > 0 && remote_settings != nullptr &&
+            (tuned_parallel != remote_settings->tuned_parallel || tuned_chunk_mb != remote_settings->tuned_chunk_mb))
+        {
+            remote_settings->tuned_parallel = tuned_parallel;
+            remote_settings->tuned_chunk_mb = tuned_chunk_mb;
+            CONFIG::SaveSiteTuning(last_site, tuned_parallel, tuned_chunk_mb);
+        }
+        *parallel = tuned_parallel;
+        *chunk_mb = tuned_chunk_mb;
+    }
+
+    // Asks once, before a batch of file jobs starts, about every one that
+    // would replace a file on the SD card, and drops the jobs of files to
+    // keep. Each destination folder is read once instead of a stat() per
+    // file. Journaled destinations are our own unfinished downloads and
+    // resume without asking. Returns false when the batch was cancelled.
+    static bool ResolveDownloadConflicts(std::deque<DownloadJob> &jobs)
+    {
+        std::map<std::string, std::set<std::string>> present;
+        std::vector<size_t> hits;
+        transfer_conflicts.clear();
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            const DownloadJob &job = jobs[i];
+            auto dir = present.find(job.destDir);
+            if (dir == present.end())
+            {
+                dir = present.emplace(job.destDir, std::set<std::string>()).first;
+                std::set<std::string> &names = dir->second;
+                FS::ScanDir(job.destDir, false, [&names](const DirEntry &entry)
+                            {
+                                if (!entry.isDir)
+                                    names.insert(entry.name);
+                                return true; });
+            }
+            if (dir->second.count(job.entry.name) == 0)
+                continue;
+            std::string dest = job.destDir + (FS::hasEndSlash(job.destDir.c_str()) ? "" : "/") + job.entry.name;
+            if (TransferJournal::Exists(dest))
+                continue;
+            hits.push_back(i);
+            transfer_conflicts.push_back({dest, job.entry.file_size, true});
+        }
+        if (hits.empty())
+            return true;
+
+        snprintf(confirm_message, 255, lang_strings[STR_CONFLICTS_MSG], (int)hits.size());
+        conflicts_state = CONFIRM_WAIT;
+        action_to_take = selected_action;
+        activity_inprogess = false;
+        while (conflicts_state == CONFIRM_WAIT)
+        {
+            svcSleepThread(100000000ull);
+        }
+        activity_inprogess = true;
+        selected_action = action_to_take;
+
+        bool go = conflicts_state == CONFIRM_YES;
+        std::vector<bool> keep(jobs.size(), false);
+        int kept = 0;
+        for (size_t k = 0; go && k < hits.size(); k++)
+        {
+            if (!transfer_conflicts[k].overwrite)
+            {
+                keep[hits[k]] = true;
+                kept++;
+            }
+        }
+        transfer_conflicts.clear();
+        Logger::Logf("Download conflicts files=%d overwrite=%d keep=%d cancelled=%d", (int)hits.size(),
+                     go ? (int)hits.size() - kept : 0, kept, go ? 0 : 1);
+        if (!go)
+            return false;
+
+        std::deque<DownloadJob> left;
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            if (!keep[i])
+                left.push_back(jobs[i]);
+            else if (batch_files_total > 0)
+            {
+                batch_files_total--;
+                batch_bytes_total -= jobs[i].entry.file_size;
+            }
+        }
+        jobs.swap(left);
+        return true;
+    }
+
+    // Works through `queue` on up to download_parallel_files connections,
+    // the primary one included, then logs the batch. `may_prompt` keeps it
+    // to the primary connection, the only one that can ask before
+    // overwriting, unless every file was known up front and the questions
+    // were settled in one dialog.
+    static void RunDownloadQueue(DownloadQueue &queue, bool may_prompt)
+    {
+        batch_files_total = 0;
+        batch_bytes_total = 0;
+        if (remoteclient != nullptr && !BuildDownloadManifest(remoteclient, queue.jobs))
+            UseKnownFolderSizes(queue.jobs);
+
+        // Folders expanded lazily can only be asked about as each file
+        // comes up.
+        bool all_files = std::none_of(queue.jobs.begin(), queue.jobs.end(), [](const DownloadJob &job)
+                                      { return job.entry.isDir; });
+        if (may_prompt && all_files)
+        {
+            if (!ResolveDownloadConflicts(queue.jobs))
+                return;
+            may_prompt = false;
+            overwrites_settled = true;
+        }
+        if (!PreflightDownloads(queue.jobs, remote_settings != nullptr ? remote_settings->server : "", true))
+        {
+            overwrites_settled = false;
+            return;
+        }
+
+        // Extra workers each open their own connection, so they need a
+        // client factory for this protocol, and they cannot answer the
+        // overwrite prompt. A single selected folder still fans out once
+        // it has been listed.
+        CONFIG::RefreshSiteProfile(remote_settings);
+        SeedTuning(remoteclient, *remote_settings);
+        // Each file takes at least one of the site's connections.
+        int workers = std::min(MemoryGovernor::ParallelFiles(download_parallel_files), ConnectionBudget::Total());
+        if (may_prompt || remoteclient == nullptr)
+            workers = 1;
+        else
+        {
+            RemoteClient *probe = CreateRemoteClient(remote_settings->server);
+            if (probe == nullptr)
+                workers = 1;
+            delete probe;
+        }
+
+        Logger::Logf("Download queue start jobs=%d workers=%d", (int)queue.jobs.size(), workers);
+
+        TransferStats::Reset(workers);
+        TransferStats::SetQueued((int)queue.jobs.size());
+        TransferStats::Bind(0);
+
+        std::vector<DownloadWorkerCtx> worker_ctx(workers > 1 ? workers - 1 : 0);
+        std::vector<Thread> threads(worker_ctx.size());
+        std::vector<bool> started(worker_ctx.size(), false);
+        for (size_t i = 0; i < worker_ctx.size(); ++i)
+        {
+            worker_ctx[i].queue = &queue;
+            worker_ctx[i].slot = (int)i + 1;
+            worker_ctx[i].settings = *remote_settings;
+
+            Result rc = Threads::Create(&threads[i], DownloadWorkerThread, &worker_ctx[i], 0x100000, Threads::ROLE_NETWORK, "download worker");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "Download queue: failed to create worker thread rc=0x%08x", rc);
+                continue;
+            }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        // The primary connection works the queue too and keeps the
+        // interactive behaviour (status messages, auto-resume prompts).
+        RunDownloadWorker(&queue, remoteclient, remote_settings->server, false);
+
+        for (size_t i = 0; i < worker_ctx.size(); ++i)
+        {
+            if (!started[i])
+                continue;
+            Threads::Join(&threads[i]);
+        }
+
+        overwrites_settled = false;
+        int tuned_parallel, tuned_chunk_mb;
+        SaveLearnedTuning(remoteclient, worker_ctx, &tuned_parallel, &tuned_chunk_mb);
+        SaveSiteCaps(remoteclient);
+
+        TransferStats::Summary summary = TransferStats::LogSummary("downloads", queue.filesOk, queue.bytesOk);
+        AddHistory(remote_settings, TransferHistory::DIRECTION_DOWNLOAD, summary, queue.filesOk, queue.bytesOk,
+                   tuned_parallel, tuned_chunk_mb);
+        Threads::LogUsage("downloads");
+        TransferStats::Bind(-1);
+        TransferStats::Reset(0);
+
+        // Idle transfer buffers go back to the heap between batches.
+        BufferPool::LogStats("downloads");
+        BufferPool::Trim();
+
+        // A single failure on the primary connection already left a
+        // detailed status message.
+        if (!Cancel::Stopped() && (queue.failed > 1 || queue.backgroundFailed > 0))
+        {
+            snprintf(status_message, 1023, "%d transfer(s) failed – see log for details", queue.failed);
+        }
+    }
+
+    void DownloadFilesThread(void *argp)
+    {
+        stop_activity = false;
+        file_transfering = true;
+
+        if (!resume_requested && RemoteArchive::Contains(remote_directory))
+        {
+            ExtractRemoteArchiveEntries(local_directory);
+            file_transfering = false;
+            activity_inprogess = false;
+            multi_selected_remote_files.clear();
+            Windows::SetModalMode(false);
+            selected_action = ACTION_REFRESH_LOCAL_FILES;
+            threadExit();
+        }
+
+        DownloadQueue queue;
+        if (resume_requested)
+        {
+            queue.jobs.assign(resume_jobs.begin(), resume_jobs.end());
+            resume_jobs.clear();
+            resume_requested = false;
+        }
+        else if (multi_selected_remote_files.size() > 0)
+        {
+            multi_selected_remote_files.ForEach([&](const DirEntry &entry)
+                                                { queue.jobs.push_back({entry, local_directory}); });
+        }
+        else
+        {
+            queue.jobs.push_back({selected_remote_file, local_directory});
+        }
+
+        RunDownloadQueue(queue, overwrite_type == OVERWRITE_PROMPT);
+
+        file_transfering = false;
+        batch_files_total = 0;
+        batch_bytes_total = 0;
+        activity_inprogess = false;
+        stop_activity = false;
+        multi_selected_remote_files.clear();
+        Windows::SetModalMode(false);
+        selected_action = ACTION_UPDATE_LOCAL_FILES;
+        threadExit();
+    }
+
+    void DownloadFiles()
+    {
+        sprintf(status_message, "%s", "");
+        stop_activity = false;
+        bytes_transfered = 0;
+        bytes_to_download = 0;
+        int res = Threads::Create(&bk_activity_thid, DownloadFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "download");
+        if (R_FAILED(res))
+        {
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
     }
 
-    int Download(const DirEntry &src, const char *dest)
+    void ResumeDownloads()
     {
-        return DownloadWithClient(remoteclient, src, dest);
+        if (resume_jobs.empty())
+            return;
+        resume_requested = true;
+        DownloadFiles();
     }
 
-    void DownloadFilesThread(void *argp)
+    // Whether `path`, or a folder above it, is in the background queue.
+    static bool AlreadyQueued(const std::set<std::string> &queued, const std::string &path)
     {
-        stop_activity = false;
-        file_transfering = true;
-        std::vector<DirEntry> files;
-        if (multi_selected_remote_files.size() > 0)
-            std::copy(multi_selected_remote_files.begin(), multi_selected_remote_files.end(), std::back_inserter(files));
-        else
-            files.push_back(selected_remote_file);
-
-        bool use_parallel_scheduler = false;
-        if (remoteclient != nullptr &&
-            remoteclient->clientType() == CLIENT_TYPE_WEBDAV &&
-            download_parallel_files > 1 &&
-            files.size() > 1 &&
-            overwrite_type != OVERWRITE_PROMPT)
+        std::string folder = FolderSize::Key("", path);
+        while (!folder.empty())
         {
-            use_parallel_scheduler = true;
+            if (queued.count(folder) > 0)
+                return true;
+            size_t slash = folder.find_last_of('/');
+            if (slash == std::string::npos || slash == 0)
+                break;
+            folder.resize(slash);
         }
+        return false;
+    }
 
-        if (!use_parallel_scheduler)
+    // Runs rounds of download_parallel_files workers, this thread the
+    // first of them, until a round ends with nothing appended meanwhile.
+    static void BackgroundDownloadThread(void *argp)
+    {
+        BackgroundDownloads &bg = background_downloads;
+        DownloadQueue &queue = bg.queue;
+        // The workers and the clients they open inherit it.
+        Cancel::Bind(&bg.cancel);
+        while (true)
         {
-            for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
+            // Jobs let in on the hope of the trash: empty it here, off the
+            // UI thread, and turn them away if they still do not fit.
+            std::deque<DownloadJob> recheck;
             {
-                if (stop_activity)
-                    break;
-
-                if (it->isDir)
-                {
-                    char new_dir[512];
-                    sprintf(new_dir, "%s%s%s", local_directory, FS::hasEndSlash(local_directory) ? "" : "/", it->name);
-                    Download(*it, new_dir);
-                }
-                else
+                std::lock_guard<std::mutex> lock(bg.mutex);
+                if (bg.reclaim)
                 {
-                    Download(*it, local_directory);
+                    std::lock_guard<std::mutex> queue_lock(queue.mutex);
+                    recheck = queue.jobs;
                 }
+                bg.reclaim = false;
+            }
+            if (!recheck.empty() && !PreflightDownloads(recheck, bg.settings.server, true))
+            {
+                std::lock_guard<std::mutex> lock(bg.mutex);
+                std::lock_guard<std::mutex> queue_lock(queue.mutex);
+                queue.jobs.clear();
+                bg.closing = true;
+                break;
             }
-        }
-        else
-        {
-            // Run downloads in small "waves" where one job stays attached
-            // to the main connection (keeping existing UI/confirm behaviour)
-            // and the remaining jobs in the wave use their own WebDAV
-            // clients in background threads.
-            RemoteSettings settings_copy = *remote_settings;
-            int max_parallel = download_parallel_files;
-            if (max_parallel < 2)
-                max_parallel = 2;
-            else if (max_parallel > 3)
-                max_parallel = 3;
 
-            size_t index = 0;
-            int failed_jobs = 0;
+            CONFIG::RefreshSiteProfile(&bg.settings);
+            int workers = std::min(MemoryGovernor::ParallelFiles(download_parallel_files), ConnectionBudget::Total());
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.failed = 0;
+                queue.backgroundFailed = 0;
+                queue.filesOk = 0;
+                queue.bytesOk = 0;
+                Logger::Logf("Download queue start jobs=%d workers=%d background=1", (int)queue.jobs.size(), workers);
+                TransferStats::Reset(workers);
+                TransferStats::SetQueued((int)queue.jobs.size());
+            }
 
-            while (index < files.size() && !stop_activity)
+            std::vector<DownloadWorkerCtx> worker_ctx(workers);
+            for (size_t i = 0; i < worker_ctx.size(); ++i)
+            {
+                worker_ctx[i].queue = &queue;
+                worker_ctx[i].slot = (int)i;
+                worker_ctx[i].settings = bg.settings;
+            }
+            std::vector<Thread> threads(worker_ctx.size() - 1);
+            std::vector<bool> started(threads.size(), false);
+            for (size_t i = 0; i < threads.size(); ++i)
+            {
+                Result rc = Threads::Create(&threads[i], DownloadWorkerThread, &worker_ctx[i + 1], 0x100000, Threads::ROLE_NETWORK, "download worker");
+                if (R_FAILED(rc))
+                {
+                    Logger::Logf(Logger::LOG_ERROR, "Download queue: failed to create worker thread rc=0x%08x", rc);
+                    continue;
+                }
+                threadStart(&threads[i]);
+                started[i] = true;
+            }
+            WorkDownloadQueue(&worker_ctx[0]);
+            for (size_t i = 0; i < threads.size(); ++i)
             {
-                size_t remaining = files.size() - index;
-                size_t wave_size = remaining < static_cast<size_t>(max_parallel) ? remaining : static_cast<size_t>(max_parallel);
+                if (started[i])
+                    Threads::Join(&threads[i]);
+            }
 
-                // Leader job uses the primary connection for full UI integration.
-                DirEntry leader = files[index];
-                std::string leader_dest = BuildLocalDestForEntry(leader, local_directory);
-                index++;
+            bool connected = false;
+            for (const DownloadWorkerCtx &ctx : worker_ctx)
+                connected = connected || ctx.connected;
+            int tuned_parallel, tuned_chunk_mb;
+            SaveLearnedTuning(nullptr, worker_ctx, &tuned_parallel, &tuned_chunk_mb);
+            TransferStats::Summary summary = TransferStats::LogSummary("downloads", queue.filesOk, queue.bytesOk);
+            AddHistory(&bg.settings, TransferHistory::DIRECTION_DOWNLOAD, summary, queue.filesOk, queue.bytesOk,
+                       tuned_parallel, tuned_chunk_mb);
+            Threads::LogUsage("downloads");
+            TransferStats::Bind(-1);
+            TransferStats::Reset(0);
+            BufferPool::LogStats("downloads");
+            BufferPool::Trim();
+
+            // Nothing answers for a background failure, so even one is
+            // reported.
+            if (!Cancel::Stopped() && !connected)
+                snprintf(status_message, 1023, "%s", lang_strings[STR_FAIL_TIMEOUT_MSG]);
+            else if (!Cancel::Stopped() && queue.failed > 0)
+                snprintf(status_message, 1023, "%d transfer(s) failed – see log for details", queue.failed);
+
+            // Jobs left over were appended after the last worker found the
+            // queue empty; they get another round. Without a connection
+            // or once cancelled they are dropped.
+            std::lock_guard<std::mutex> lock(bg.mutex);
+            std::lock_guard<std::mutex> queue_lock(queue.mutex);
+            if (Cancel::Stopped() || !connected)
+                queue.jobs.clear();
+            if (queue.jobs.empty())
+            {
+                bg.closing = true;
+                break;
+            }
+        }
+        bg.finished = true;
+        threadExit();
+    }
 
-                size_t bg_count = (wave_size > 0) ? (wave_size - 1) : 0;
-                std::vector<ParallelDownloadWorkerCtx> worker_ctx(bg_count);
-                std::vector<Thread> threads(bg_count);
+    // Caller holds background_downloads.mutex, and the coordinator has
+    // closed the queue.
+    static void JoinBackgroundDownloads()
+    {
+        BackgroundDownloads &bg = background_downloads;
+        Threads::Join(&bg.thread);
+        bg.running = false;
+        bg.cancel = false;
+        batch_files_total = 0;
+        batch_bytes_total = 0;
+        Logger::Logf("Download queue background done files=%d bytes=%lld", batch_files_done, (long long)batch_bytes_done);
+    }
 
-                for (size_t i = 0; i < bg_count; ++i, ++index)
-                {
-                    worker_ctx[i].job.entry = files[index];
-                    worker_ctx[i].job.destBase = BuildLocalDestForEntry(files[index], local_directory);
-                    worker_ctx[i].settings = settings_copy;
-                    worker_ctx[i].result = 0;
-
-                    Result rc = threadCreate(&threads[i],
-                                             ParallelDownloadWorkerThread,
-                                             &worker_ctx[i],
-                                             nullptr,
-                                             0x100000,
-                                             0x3B,
-                                             -2);
-                    if (R_FAILED(rc))
-                    {
-                        threads[i].handle = 0;
-                        Logger::Logf("Parallel download: failed to create worker thread rc=0x%08x", rc);
-                        worker_ctx[i].result = 0;
-                        failed_jobs++;
-                    }
-                    else
-                    {
-                        threadStart(&threads[i]);
-                    }
-                }
+    bool QueueBackgroundDownloads()
+    {
+        if (!background_transfers || overwrite_type == OVERWRITE_PROMPT || remoteclient == nullptr ||
+            remote_settings == nullptr || RemoteArchive::Contains(remote_directory))
+            return false;
+        BackgroundDownloads &bg = background_downloads;
+        if (bg.running && strcmp(bg.settings.server, remote_settings->server) != 0)
+            return false;
+        // The queue only runs on connections of its own.
+        RemoteClient *probe = CreateRemoteClient(remote_settings->server);
+        if (probe == nullptr)
+            return false;
+        delete probe;
+
+        std::vector<DirEntry> entries;
+        if (multi_selected_remote_files.size() > 0)
+            entries = multi_selected_remote_files.Entries();
+        else
+            entries.push_back(selected_remote_file);
 
-                // Run leader synchronously with the main client.
-                if (!stop_activity)
-                {
-                    if (leader.isDir)
-                    {
-                        Download(leader, leader_dest.c_str());
-                    }
-                    else
-                    {
-                        Download(leader, local_directory);
-                    }
-                }
+        std::lock_guard<std::mutex> lock(bg.mutex);
+        bool fresh = !bg.running || bg.closing;
+        if (fresh)
+        {
+            if (bg.running)
+                JoinBackgroundDownloads();
+            bg.queue.jobs.clear();
+            bg.queued.clear();
+            bg.unknown_totals = false;
+            bg.settings = *remote_settings;
+            bg.closing = false;
+            bg.reclaim = false;
+            bg.finished = false;
+            batch_files_total = 0;
+            batch_files_done = 0;
+            batch_bytes_total = 0;
+            batch_bytes_done = 0;
+            batch_start_tick = Util::GetTick();
+        }
 
-                // Wait for background jobs in this wave to finish.
-                for (size_t i = 0; i < bg_count; ++i)
-                {
-                    if (threads[i].handle != 0)
-                    {
-                        threadWaitForExit(&threads[i]);
-                        threadClose(&threads[i]);
-                    }
-                    if (worker_ctx[i].result <= 0)
-                        failed_jobs++;
-                }
+        std::deque<DownloadJob> jobs;
+        for (const DirEntry &entry : entries)
+        {
+            if (strcmp(entry.name, "..") != 0 && !AlreadyQueued(bg.queued, entry.path))
+                jobs.push_back({entry, local_directory});
+        }
+        bool trash = false;
+        if (!jobs.empty() && !PreflightDownloads(jobs, remote_settings->server, false, &trash))
+            jobs.clear();
+        if (trash)
+            bg.reclaim = true;
+
+        int64_t files = 0;
+        int64_t bytes = 0;
+        for (const DownloadJob &job : jobs)
+        {
+            bg.queued.insert(FolderSize::Key("", job.entry.path));
+            if (!job.entry.isDir)
+            {
+                files++;
+                bytes += job.entry.file_size;
+                continue;
+            }
+            FolderSize::Totals totals;
+            if (FolderSize::Lookup(FolderSize::Key(remote_settings->server, job.entry.path), totals) && totals.files >= 0)
+            {
+                files += totals.files;
+                bytes += totals.bytes;
+            }
+            else
+                bg.unknown_totals = true;
+        }
 
-                if (stop_activity)
-                    break;
+        {
+            std::lock_guard<std::mutex> queue_lock(bg.queue.mutex);
+            if (bg.unknown_totals)
+            {
+                batch_files_total = 0;
+                batch_bytes_total = 0;
+            }
+            else
+            {
+                batch_files_total += (int)files;
+                batch_bytes_total += bytes;
             }
+            bg.queue.jobs.insert(bg.queue.jobs.end(), jobs.begin(), jobs.end());
+            TransferStats::SetQueued((int)bg.queue.jobs.size());
+            bg.queue.cv.notify_all();
+        }
+        Logger::Logf("Download queue append jobs=%d fresh=%d", (int)jobs.size(), fresh ? 1 : 0);
+        multi_selected_remote_files.clear();
+        if (jobs.empty())
+        {
+            // Preflight said why; otherwise it was all queued already.
+            if (status_message[0] == '\0')
+                snprintf(status_message, 1023, lang_strings[STR_DOWNLOADS_QUEUED], 0);
+            return true;
+        }
+        snprintf(status_message, 1023, lang_strings[STR_DOWNLOADS_QUEUED], (int)jobs.size());
 
-            if (failed_jobs > 0 && !stop_activity)
+        if (fresh)
+        {
+            bg.cancel = false;
+            Result rc = Threads::Create(&bg.thread, BackgroundDownloadThread, NULL, 0x100000, Threads::ROLE_NETWORK, "download queue");
+            if (R_FAILED(rc))
             {
-                snprintf(status_message, 1023, "%d transfer(s) failed – see log for details", failed_jobs);
+                Logger::Logf(Logger::LOG_ERROR, "Download queue: failed to create background thread rc=0x%08x", rc);
+                bg.queue.jobs.clear();
+                batch_files_total = 0;
+                batch_bytes_total = 0;
+                snprintf(status_message, 1023, "%s", "");
+                return false;
             }
+            threadStart(&bg.thread);
+            bg.running = true;
         }
+        return true;
+    }
 
-        file_transfering = false;
-        activity_inprogess = false;
-        stop_activity = false;
-        multi_selected_remote_files.clear();
-        Windows::SetModalMode(false);
-        selected_action = ACTION_REFRESH_LOCAL_FILES;
-        threadExit();
+    bool BackgroundDownloadsRunning()
+    {
+        return background_downloads.running;
     }
 
-    void DownloadFiles()
+    void CancelBackgroundDownloads(bool wait)
     {
-        sprintf(status_message, "%s", "");
-        stop_activity = false;
-        bytes_transfered = 0;
-        bytes_to_download = 0;
-        int res = threadCreate(&bk_activity_thid, DownloadFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
-        if (R_FAILED(res))
-        {
-            threadClose(&bk_activity_thid);
-        }
-        else
+        BackgroundDownloads &bg = background_downloads;
+        if (!bg.running)
+            return;
+        Cancel::Request(&bg.cancel);
+        if (!wait)
+            return;
+        // The coordinator takes the mutex once more before it finishes.
+        while (!bg.finished)
+            svcSleepThread(10000000ull);
+        std::lock_guard<std::mutex> lock(bg.mutex);
+        if (bg.running)
+            JoinBackgroundDownloads();
+    }
+
+    void PollBackgroundDownloads()
+    {
+        BackgroundDownloads &bg = background_downloads;
+        if (!bg.running || !bg.finished)
+            return;
         {
-            threadStart(&bk_activity_thid);
+            std::lock_guard<std::mutex> lock(bg.mutex);
+            if (!bg.running)
+                return;
+            JoinBackgroundDownloads();
         }
+        if (selected_action == ACTION_NONE)
+            selected_action = ACTION_UPDATE_LOCAL_FILES;
     }
 
-    static void ParallelDownloadWorkerThread(void *argp)
+    // Asks whether to resume the downloads journaled for the connected site.
+    static void OfferJournalResume()
     {
-        ParallelDownloadWorkerCtx *ctx = static_cast<ParallelDownloadWorkerCtx *>(argp);
-        if (!ctx)
-        {
-            threadExit();
+        if (!transfer_journal || remoteclient == nullptr || remoteclient->clientType() != CLIENT_TYPE_WEBDAV)
+            return;
+        if (!resume_offered.insert(last_site).second)
             return;
-        }
 
-        WebDAVClient *client = new WebDAVClient();
-        if (!client->Connect(ctx->settings.server, ctx->settings.username, ctx->settings.password))
-        {
-            const char *resp = client->LastResponse();
-            Logger::Logf("Parallel WebDAV connect failed server=%s resp=%s",
-                         ctx->settings.server,
-                         resp ? resp : "");
-            ctx->result = 0;
-            client->Quit();
-            delete client;
-            threadExit();
+        std::vector<TransferJournal> pending = TransferJournal::List(last_site);
+        if (pending.empty())
             return;
+
+        resume_jobs.clear();
+        int64_t left = 0;
+        for (const TransferJournal &journal : pending)
+        {
+            size_t local_slash = journal.local_path.find_last_of('/');
+            size_t remote_slash = journal.remote_path.find_last_of('/');
+            if (local_slash == std::string::npos || remote_slash == std::string::npos)
+                continue;
+
+            DownloadJob job;
+            memset(&job.entry, 0, sizeof(DirEntry));
+            snprintf(job.entry.name, sizeof(job.entry.name), "%s", journal.local_path.c_str() + local_slash + 1);
+            snprintf(job.entry.path, sizeof(job.entry.path), "%s", journal.remote_path.c_str());
+            snprintf(job.entry.directory, sizeof(job.entry.directory), "%s",
+                     remote_slash == 0 ? "/" : journal.remote_path.substr(0, remote_slash).c_str());
+            job.entry.file_size = journal.size;
+            job.entry.selectable = true;
+            job.destDir = journal.local_path.substr(0, local_slash);
+            if (job.destDir.empty())
+                job.destDir = "/";
+            resume_jobs.push_back(job);
+            left += journal.size - journal.DoneBytes();
         }
+        if (resume_jobs.empty())
+            return;
 
-        int ret = DownloadWithClient(client, ctx->job.entry, ctx->job.destBase.c_str());
-        ctx->result = ret;
+        Logger::Logf("Journal resume offer site=%s files=%d left=%lld",
+                     last_site, (int)resume_jobs.size(), (long long)left);
+        snprintf(confirm_message, 255, lang_strings[STR_RESUME_DOWNLOADS_MSG],
+                 (int)resume_jobs.size(), left / 1048576.0);
+        confirm_state = CONFIRM_WAIT;
+        action_to_take = ACTION_RESUME_DOWNLOADS;
+    }
 
-        client->Quit();
-        delete client;
-        threadExit();
+    static void WorkDownloadQueue(DownloadWorkerCtx *ctx)
+    {
+        TransferStats::Bind(ctx->slot);
+
+        // The remaining workers pick up the jobs one cannot connect for.
+        RemoteClient *client = ConnectWorkerClient(ctx->settings, "Download queue");
+        if (client == nullptr)
+            return;
+        ctx->connected = true;
+
+        RunDownloadWorker(ctx->queue, client, ctx->settings.server, true);
+        GetLearnedTuning(client, &ctx->tuned_parallel, &ctx->tuned_chunk_mb);
+
+        ReleaseWorkerClient(client);
     }
 
-    void KeepAliveThread(void *argp)
+    static void DownloadWorkerThread(void *argp)
     {
-        long idle;
-        while (true)
-        {
-            if (remoteclient != nullptr && remoteclient->clientType() == CLIENT_TYPE_FTP)
-            {
-                FtpClient *ftpclient = (FtpClient *)remoteclient;
-                idle = ftpclient->GetIdleTime();
-                if (idle > 60000000)
-                {
-                    if (!ftpclient->Noop())
-                    {
-                        ftpclient->Quit();
-                        snprintf(status_message, 1023, lang_strings[STR_REMOTE_TERM_CONN_MSG]);
-                        threadExit();
-                    }
-                }
-                svcSleepThread(5000000000ull);
-            }
-            else
-                threadExit();
-        }
+        WorkDownloadQueue(static_cast<DownloadWorkerCtx *>(argp));
         threadExit();
     }
 
@@ -1015,13 +3971,13 @@ namespace Actions
         FS::MkDirs(extract_zip_folder);
         std::vector<DirEntry> files;
         if (multi_selected_local_files.size() > 0)
-            std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(files));
+            files = multi_selected_local_files.Entries();
         else
             files.push_back(selected_local_file);
 
         for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
         {
-            if (stop_activity)
+            if (Cancel::Stopped())
                 break;
             if (!it->isDir)
             {
@@ -1043,7 +3999,7 @@ namespace Actions
     void ExtractLocalZips()
     {
         sprintf(status_message, "%s", "");
-        int res = threadCreate(&bk_activity_thid, ExtractZipThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, ExtractZipThread, NULL, 0x100000, Threads::ROLE_NETWORK, "extract zip");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1061,19 +4017,34 @@ namespace Actions
     void ExtractRemoteZipThread(void *argp)
     {
         FS::MkDirs(extract_zip_folder);
+        if (RemoteArchive::Contains(remote_directory))
+        {
+            ExtractRemoteArchiveEntries(extract_zip_folder);
+            activity_inprogess = false;
+            file_transfering = false;
+            multi_selected_remote_files.clear();
+            Windows::SetModalMode(false);
+            selected_action = ACTION_REFRESH_LOCAL_FILES;
+            threadExit();
+        }
+
         std::vector<DirEntry> files;
         if (multi_selected_remote_files.size() > 0)
-            std::copy(multi_selected_remote_files.begin(), multi_selected_remote_files.end(), std::back_inserter(files));
+            files = multi_selected_remote_files.Entries();
         else
             files.push_back(selected_remote_file);
 
         for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
         {
-            if (stop_activity)
+            if (Cancel::Stopped())
                 break;
             if (!it->isDir)
             {
-                int ret = ZipUtil::Extract(*it, extract_zip_folder, remoteclient);
+                int ret = -1;
+                if (archive_streaming && ZipUtil::CanStream(*it))
+                    ret = ZipUtil::ExtractStreamed(*it, extract_zip_folder, remoteclient);
+                if (ret < 0)
+                    ret = ZipUtil::Extract(*it, extract_zip_folder, remoteclient);
                 if (ret == 0)
                 {
                     sprintf(status_message, "%s %s", lang_strings[STR_FAILED_TO_EXTRACT], it->name);
@@ -1091,7 +4062,7 @@ namespace Actions
     void ExtractRemoteZips()
     {
         sprintf(status_message, "%s", "");
-        int res = threadCreate(&bk_activity_thid, ExtractRemoteZipThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, ExtractRemoteZipThread, NULL, 0x100000, Threads::ROLE_NETWORK, "extract remote zip");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1106,65 +4077,182 @@ namespace Actions
         }
     }
 
-    void MakeZipThread(void *argp)
+    void InstallRemotePackagesThread(void *argp)
     {
-        int res;
-        struct archive *a = archive_write_new();
+        std::vector<DirEntry> files;
+        if (multi_selected_remote_files.size() > 0)
+            files = multi_selected_remote_files.Entries();
+        else
+            files.push_back(selected_remote_file);
 
-        if (a != NULL)
+        int failed = 0;
+        for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
         {
-            archive_write_set_format_zip(a);
-            archive_write_open_filename(a, zip_file_path);
-            if (res < ARCHIVE_OK)
+            if (Cancel::Stopped())
+                break;
+            if (!Installer::CanInstall(*it))
+                continue;
+            if (Installer::InstallRemote(*it, remoteclient) == 0)
             {
-                sprintf(status_message, "%s", "archive_write_open_filename failed");
-                goto finish;
+                failed++;
+                svcSleepThread(100000000ull);
             }
+        }
+        Logger::Logf("INSTALL batch files=%d failed=%d", (int)files.size(), failed);
+        activity_inprogess = false;
+        file_transfering = false;
+        multi_selected_remote_files.clear();
+        Windows::SetModalMode(false);
+    }
+
+    void InstallRemotePackages()
+    {
+        sprintf(status_message, "%s", "");
+        int res = Threads::Create(&bk_activity_thid, InstallRemotePackagesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "install remote");
+        if (R_FAILED(res))
+        {
+            file_transfering = false;
+            activity_inprogess = false;
+            multi_selected_remote_files.clear();
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
+    }
+
+    void OpenRemoteArchiveThread(void *argp)
+    {
+        DirEntry file = selected_remote_file;
+        snprintf(activity_message, 1024, "%s", file.name);
+        bool opened;
+        {
+            RateLimiter::Interactive lane;
+            opened = RemoteArchive::Open(remoteclient, file);
+        }
+        if (opened)
+        {
+            snprintf(remote_directory, sizeof(remote_directory), "%s", file.path);
+            selected_action = ACTION_REFRESH_REMOTE_FILES;
+        }
+        else
+        {
+            Logger::Logf(Logger::LOG_ERROR, "ARCHIVE open failed path=%s status=%s", file.path, status_message);
+        }
+        activity_inprogess = false;
+        Windows::SetModalMode(false);
+        threadExit();
+    }
+
+    void OpenRemoteArchive()
+    {
+        sprintf(status_message, "%s", "");
+        int res = Threads::Create(&bk_activity_thid, OpenRemoteArchiveThread, NULL, 0x100000, Threads::ROLE_NETWORK, "open archive");
+        if (R_FAILED(res))
+        {
+            activity_inprogess = false;
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
+    }
+
+    void MakeZipThread(void *argp)
+    {
+        int res = 1;
+        ZipWriter zip(zip_file_path, zip_workers);
 
+        if (zip.Open())
+        {
             std::vector<DirEntry> files;
             if (multi_selected_local_files.size() > 0)
-                std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(files));
+                files = multi_selected_local_files.Entries();
             else
                 files.push_back(selected_local_file);
 
-            for (std::vector<DirEntry>::iterator it = files.begin(); it != files.end(); ++it)
-            {
-                if (stop_activity)
-                    break;
-
-                if (strcmp(it->path, it->directory) != 0 && strlen(it->path) > strlen(it->directory))
-                    res = ZipUtil::ZipAddPath(a, it->path, strlen(it->directory) + 1);
-                else
-                    res = -1;
+            res = ZipUtil::ZipAddEntries(zip, files);
 
-                if (res <= 0)
+            // A cancelled archive is dropped rather than left with a
+            // truncated last entry.
+            if (res <= 0 || Cancel::Stopped() || !zip.Close())
+            {
+                zip.Abort();
+                if (!Cancel::Stopped())
                 {
                     sprintf(status_message, "%s", lang_strings[STR_ERROR_CREATE_ZIP]);
                     svcSleepThread(1000000000ull);
-                    goto finish;
                 }
             }
         }
         else
         {
-            sprintf(status_message, "%s", lang_strings[STR_ERROR_CREATE_ZIP]);
+            zip.Abort();
+            sprintf(status_message, "%s", lang_strings[STR_ERROR_CREATE_ZIP]);
+        }
+
+        activity_inprogess = false;
+        multi_selected_local_files.clear();
+        Windows::SetModalMode(false);
+        selected_action = ACTION_REFRESH_LOCAL_FILES;
+        return NULL;
+    }
+
+    void MakeLocalZip()
+    {
+        sprintf(status_message, "%s", "");
+
+        int res = Threads::Create(&bk_activity_thid, MakeZipThread, NULL, 0x100000, Threads::ROLE_NETWORK, "make zip");
+        if (R_FAILED(res))
+        {
+            file_transfering = false;
+            activity_inprogess = false;
+            multi_selected_local_files.clear();
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
+    }
+
+    void MakeRemoteZipThread(void *argp)
+    {
+        std::vector<DirEntry> files;
+        if (multi_selected_local_files.size() > 0)
+            files = multi_selected_local_files.Entries();
+        else
+            files.push_back(selected_local_file);
+        for (DirEntry &file : files)
+            FS::EnsureDetails(file);
+        FolderSize::Invalidate(remote_settings->server, remote_directory);
+
+        sprintf(activity_message, "%s %s", lang_strings[STR_COMPRESSING], zip_file_path);
+        std::string error;
+        if (!RemoteZip::Create(remoteclient, files, zip_file_path, error) && !Cancel::Stopped())
+        {
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_ERROR_CREATE_ZIP], error.c_str());
+            svcSleepThread(1000000000ull);
         }
 
-    finish:
-        if (a != nullptr)
-            archive_write_free(a);
         activity_inprogess = false;
+        file_transfering = false;
         multi_selected_local_files.clear();
         Windows::SetModalMode(false);
-        selected_action = ACTION_REFRESH_LOCAL_FILES;
-        return NULL;
+        selected_action = ACTION_REFRESH_REMOTE_FILES;
+        threadExit();
     }
 
-    void MakeLocalZip()
+    void MakeRemoteZip()
     {
         sprintf(status_message, "%s", "");
 
-        int res = threadCreate(&bk_activity_thid, MakeZipThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, MakeRemoteZipThread, NULL, 0x100000, Threads::ROLE_NETWORK, "remote zip");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1179,56 +4267,299 @@ namespace Actions
         }
     }
 
-    void Connect()
+    RemoteClient *CreateRemoteClient(const char *server)
     {
-        CONFIG::SaveConfig();
-        if (strncmp(remote_settings->server, "sftp://", 7) == 0)
+        if (strncmp(server, "sftp://", 7) == 0)
         {
-            remoteclient = new SftpClient();
+            return new SftpClient();
         }
-        else if (strncmp(remote_settings->server, "ftp://", 6) == 0)
+        else if (strncmp(server, "ftp://", 6) == 0)
         {
             FtpClient *ftpclient = new FtpClient();
             ftpclient->SetConnmode(FtpClient::pasv);
             ftpclient->SetCallbackBytes(256000);
             ftpclient->SetCallbackXferFunction(FtpCallback);
-            remoteclient = ftpclient;
+            return ftpclient;
         }
-        else if (strncmp(remote_settings->server, "webdav://", 9) == 0 ||
-                 strncmp(remote_settings->server, "webdavs://", 10) == 0 ||
-                 strncmp(remote_settings->server, "http://", 7) == 0 ||
-                 strncmp(remote_settings->server, "https://", 8) == 0)
+        else if (strncmp(server, "webdav://", 9) == 0 ||
+                 strncmp(server, "webdavs://", 10) == 0 ||
+                 strncmp(server, "http://", 7) == 0 ||
+                 strncmp(server, "https://", 8) == 0)
         {
-            remoteclient = new WebDAVClient();
+            return new WebDAVClient();
         }
-        else if (strncmp(remote_settings->server, "nfs://", 6) == 0)
+#ifdef NEO_WITH_SMB
+        else if (strncmp(server, "smb://", 6) == 0)
         {
-            // remoteclient = new NfsClient();
+            return new SmbClient();
         }
-        else
+#endif
+#ifdef NEO_WITH_NFS
+        else if (strncmp(server, "nfs://", 6) == 0)
+        {
+            return new NfsClient();
+        }
+#endif
+        return nullptr;
+    }
+
+    RemoteClient *CreateRemoteClient(const RemoteSettings &settings)
+    {
+#ifdef NEO_WITH_HTML_INDEX
+        if (settings.type == CLIENT_TYPE_HTTP_SERVER)
+        {
+            const char *type = settings.http_server_type;
+            if (strcmp(type, HTTP_SERVER_APACHE) == 0)
+                return new ApacheClient();
+            if (strcmp(type, HTTP_SERVER_MS_IIS) == 0)
+                return new IISClient();
+            if (strcmp(type, HTTP_SERVER_NGINX) == 0)
+                return new NginxClient();
+            if (strcmp(type, HTTP_SERVER_NPX_SERVE) == 0)
+                return new NpxServeClient();
+            if (strcmp(type, HTTP_SERVER_RCLONE) == 0)
+                return new RCloneClient();
+            if (strcmp(type, HTTP_SERVER_ARCHIVEORG) == 0)
+                return new ArchiveOrgClient();
+            if (strcmp(type, HTTP_SERVER_MYRIENT) == 0)
+                return new MyrientClient();
+        }
+#endif
+        return CreateRemoteClient(settings.server);
+    }
+
+    RemoteClient *ConnectBackgroundClient(const RemoteSettings &settings, const char *what)
+    {
+        return ConnectWorkerClient(settings, what);
+    }
+
+    void ReleaseBackgroundClient(RemoteClient *client)
+    {
+        ReleaseWorkerClient(client);
+    }
+
+    // The primary connection's keep-alive task; the probe itself only runs
+    // once PollConnectionManager() handed the connection over.
+    static int64_t KeepPrimaryAlive()
+    {
+        if (!primary_probing)
+        {
+            primary_probe_wanted = true;
+            return -1;
+        }
+        int64_t next = remoteclient->KeepAlive(KeepAlive::Interval());
+        if (next == 0)
+            primary_probe_failed = true;
+        primary_probing = false;
+        return next > 0 ? next : -1;
+    }
+
+    // Drops the primary connection's keep-alive before it goes away.
+    static void CancelPrimaryKeepAlive()
+    {
+        KeepAlive::Cancel("primary");
+        primary_probe_wanted = false;
+        primary_probing = false;
+        primary_probe_failed = false;
+    }
+
+    // Makes `client`, just logged in, the primary connection and lists the
+    // remote pane on it. A reconnect keeps the folder and listing cache.
+    static void OnConnected(RemoteClient *client, bool reconnect)
+    {
+        remoteclient = client;
+        if (!reconnect)
+            ClearListingCache();
+        StartRemoteListing(false, false, -1, false);
+        if (!reconnect)
+            OfferJournalResume();
+
+        if (KeepAlive::Interval() > 0)
+            KeepAlive::Schedule("primary", KeepPrimaryAlive, KeepAlive::Interval());
+    }
+
+    static void BackgroundConnectThread(void *argp)
+    {
+        BackgroundConnect &bg = background_connect;
+        bg.result = bg.client->Connect(bg.settings.server, bg.settings.username, bg.settings.password);
+        bg.finished = true;
+    }
+
+    static bool StartBackgroundConnect(bool reconnect)
+    {
+        BackgroundConnect &bg = background_connect;
+        if (bg.running || remote_settings == nullptr || remote_settings->server[0] == '\0')
+            return false;
+        if (!reconnect)
+            CONFIG::ApplySiteProfile(remote_settings);
+        RemoteClient *client = CreateRemoteClient(remote_settings->server);
+        if (client == nullptr)
+            return false;
+        ApplySiteTuning(client, *remote_settings);
+
+        bg.client = client;
+        bg.settings = *remote_settings;
+        bg.site = last_site;
+        bg.reconnect = reconnect;
+        bg.abandoned = false;
+        bg.result = 0;
+        bg.finished = false;
+        int res = Threads::Create(&bg.thread, BackgroundConnectThread, NULL, 0x100000, Threads::ROLE_NETWORK, "connect");
+        if (R_FAILED(res))
+        {
+            delete client;
+            bg.client = nullptr;
+            return false;
+        }
+        Logger::Logf("Connect site=%s profile=%s background=1 reconnect=%d", last_site, CONFIG::AppliedProfile(),
+                     reconnect ? 1 : 0);
+        bg.running = true;
+        bg.started_at = Util::GetTick();
+        threadStart(&bg.thread);
+        snprintf(status_message, 1023, "%s...", lang_strings[STR_CONNECTING]);
+        return true;
+    }
+
+    static void OnAppletHook(AppletHookType hook, void *param)
+    {
+        if (hook == AppletHookType_OnResume)
+            resumed = true;
+    }
+
+    void StartConnectionManager()
+    {
+        KeepAlive::Init();
+        appletHook(&resume_hook, OnAppletHook, NULL);
+        if (auto_connect && remoteclient == nullptr)
+            StartBackgroundConnect(false);
+    }
+
+    void PollConnectionManager()
+    {
+        BackgroundConnect &bg = background_connect;
+        if (resumed.exchange(false))
+        {
+            // Sleep closes every socket, and the console may have woken up
+            // on another network.
+            Resolver::Clear();
+            if (reconnect_on_resume && remoteclient != nullptr && remoteclient->clientType() != CLIENT_TYPE_WEBDAV)
+                reconnect_pending = true;
+        }
+        // The keep-alive thread gets the idle primary connection for a
+        // probe; one that failed it is reopened like after a resume.
+        if (primary_probe_wanted && remoteclient != nullptr && !bg.running && !remote_listing.running &&
+            !activity_inprogess && !file_transfering)
+        {
+            primary_probe_wanted = false;
+            primary_probing = true;
+            KeepAlive::Schedule("primary", KeepPrimaryAlive, 0);
+        }
+        if (primary_probe_failed.exchange(false))
+        {
+            Logger::Logf(Logger::LOG_WARN, "Connection keep-alive failed site=%s", last_site);
+            if (reconnect_on_resume && remoteclient != nullptr && Util::GetTick() - last_reconnect > kReconnectIntervalUs)
+                reconnect_pending = true;
+        }
+        // Transfers that were running retry on connections of their own;
+        // the primary one is replaced once they are done.
+        if (reconnect_pending && !bg.running && !primary_probing && !activity_inprogess && !file_transfering)
+        {
+            reconnect_pending = false;
+            if (remoteclient != nullptr)
+            {
+                last_reconnect = Util::GetTick();
+                StartBackgroundConnect(true);
+            }
+        }
+        if (!bg.running || !bg.finished)
+            return;
+
+        Threads::Join(&bg.thread);
+        bg.running = false;
+        RemoteClient *client = bg.client;
+        bg.client = nullptr;
+        bool wanted = !bg.abandoned && bg.site == last_site && (remoteclient != nullptr) == bg.reconnect;
+        Logger::Logf("Connect background site=%s reconnect=%d ok=%d used=%d ms=%llu", bg.site.c_str(),
+                     bg.reconnect ? 1 : 0, bg.result > 0 ? 1 : 0, wanted ? 1 : 0,
+                     (unsigned long long)((Util::GetTick() - bg.started_at) / 1000));
+        if (bg.result <= 0 || !wanted)
+        {
+            if (wanted)
+            {
+                const char *resp = client->LastResponse();
+                snprintf(status_message, 1023, "%s",
+                         (resp && resp[0] != '\0') ? resp : lang_strings[STR_FAIL_TIMEOUT_MSG]);
+            }
+            else if (!bg.abandoned)
+            {
+                snprintf(status_message, 1023, "%s", "");
+            }
+            client->Quit();
+            delete client;
+            return;
+        }
+
+        if (bg.reconnect)
+        {
+            CancelRemoteListing();
+            Thumbnails::Clear(true);
+            ImagePrefetch::Clear();
+            CancelPrimaryKeepAlive();
+            RemoteClient *old = remoteclient;
+            remoteclient = nullptr;
+            old->Quit();
+            // The pooled worker sessions died with it.
+            if (old->clientType() == CLIENT_TYPE_FTP)
+                FtpClient::ClosePool();
+            ClientPool::Close();
+            delete old;
+        }
+        // A Connect press waited for this login.
+        if (selected_action == ACTION_CONNECT)
+            selected_action = ACTION_NONE;
+        OnConnected(client, bg.reconnect);
+    }
+
+    bool BackgroundConnectInProgress()
+    {
+        return background_connect.running || primary_probing;
+    }
+
+    void StopConnectionManager()
+    {
+        // A probe in flight finishes before the connection goes away.
+        KeepAlive::Exit();
+        CancelBackgroundDownloads(true);
+        appletUnhook(&resume_hook);
+        BackgroundConnect &bg = background_connect;
+        if (!bg.running)
+            return;
+        Threads::Join(&bg.thread);
+        bg.running = false;
+        bg.client->Quit();
+        delete bg.client;
+        bg.client = nullptr;
+    }
+
+    void Connect()
+    {
+        CONFIG::SaveConfig();
+        CONFIG::ApplySiteProfile(remote_settings);
+        Logger::Logf("Connect site=%s profile=%s webdav_chunk_mb=%d webdav_parallel=%d download_parallel_files=%d",
+                     last_site, CONFIG::AppliedProfile(), webdav_chunk_size_mb,
+                     webdav_parallel_connections, download_parallel_files);
+        remoteclient = CreateRemoteClient(*remote_settings);
+        if (remoteclient == nullptr)
         {
             snprintf(status_message, 1023, "%s", lang_strings[STR_PROTOCOL_NOT_SUPPORTED]);
             selected_action = ACTION_NONE;
             return;
         }
+        ApplySiteTuning(remoteclient, *remote_settings);
 
         if (remoteclient->Connect(remote_settings->server, remote_settings->username, remote_settings->password))
         {
-            RefreshRemoteFiles(false);
-            snprintf(status_message, 1023, "%s", remoteclient->LastResponse());
-
-            if (remoteclient->clientType() == CLIENT_TYPE_FTP)
-            {
-                int res = threadCreate(&ftp_keep_alive_thid, KeepAliveThread, NULL, NULL, 0x10000, 0x3B, -2);
-                if (R_FAILED(res))
-                {
-                    threadClose(&ftp_keep_alive_thid);
-                }
-                else
-                {
-                    threadStart(&ftp_keep_alive_thid);
-                }
-            }
+            OnConnected(remoteclient, false);
         }
         else
         {
@@ -1254,11 +4585,26 @@ namespace Actions
 
     void Disconnect()
     {
+        // A login still on its way is dropped when it arrives.
+        background_connect.abandoned = true;
+        reconnect_pending = false;
+        CancelBackgroundDownloads(true);
+        CancelPrimaryKeepAlive();
+        CancelRemoteListing();
+        ClearListingCache();
+        Catalogue::Unload();
+        RemoteArchive::Close();
+        Thumbnails::Clear(true);
+        ImagePrefetch::Clear();
         if (remoteclient != nullptr)
         {
+            SaveSiteCaps(remoteclient);
             remoteclient->Quit();
+            FtpClient::ClosePool();
+            ClientPool::Close();
             multi_selected_remote_files.clear();
             remote_files.clear();
+            remote_index.Clear();
             sprintf(remote_directory, "/");
             snprintf(status_message, 1023, "");
         }
@@ -1267,157 +4613,67 @@ namespace Actions
 
     void SelectAllLocalFiles()
     {
-        for (int i = 0; i < local_files.size(); i++)
-        {
-            if (strcmp(local_files[i].name, "..") != 0)
-                multi_selected_local_files.insert(local_files[i]);
-        }
+        multi_selected_local_files.SelectAll();
     }
 
     void SelectAllRemoteFiles()
     {
-        for (int i = 0; i < remote_files.size(); i++)
-        {
-            if (strcmp(remote_files[i].name, "..") != 0)
-                multi_selected_remote_files.insert(remote_files[i]);
-        }
+        multi_selected_remote_files.SelectAll();
     }
 
-    int CopyOrMoveLocalFile(const char *src, const char *dest, bool isCopy)
+    bool ConfirmLocalOverwrite(const std::string &dest)
     {
-        int ret;
-        if (overwrite_type == OVERWRITE_PROMPT && FS::FileExists(dest))
-        {
-            sprintf(confirm_message, "%s %s?", lang_strings[STR_OVERWRITE], dest);
-            confirm_state = CONFIRM_WAIT;
-            action_to_take = selected_action;
-            activity_inprogess = false;
-            while (confirm_state == CONFIRM_WAIT)
-            {
-                svcSleepThread(100000000ull);
-            }
-            activity_inprogess = true;
-            selected_action = action_to_take;
-        }
-        else if (overwrite_type == OVERWRITE_NONE && FS::FileExists(dest))
-        {
-            confirm_state = CONFIRM_NO;
-        }
-        else
-        {
-            confirm_state = CONFIRM_YES;
-        }
-
-        if (confirm_state == CONFIRM_YES)
+        if (overwrite_type == OVERWRITE_NONE)
+            return false;
+        if (overwrite_type != OVERWRITE_PROMPT)
+            return true;
+
+        sprintf(confirm_message, "%s %s?", lang_strings[STR_OVERWRITE], dest.c_str());
+        confirm_state = CONFIRM_WAIT;
+        action_to_take = selected_action;
+        activity_inprogess = false;
+        while (confirm_state == CONFIRM_WAIT)
         {
-            prev_tick = Util::GetTick();
-            if (isCopy)
-                return FS::Copy(src, dest);
-            else
-                return FS::Move(src, dest);
+            svcSleepThread(100000000ull);
         }
-
-        return 1;
+        activity_inprogess = true;
+        selected_action = action_to_take;
+        return confirm_state == CONFIRM_YES;
     }
 
-    int CopyOrMove(const DirEntry &src, const char *dest, bool isCopy)
+    void CopyOrMoveLocalFiles(bool isCopy)
     {
-        if (stop_activity)
-            return 1;
-
-        int ret;
-        if (src.isDir)
+        std::vector<LocalCopy::Item> items;
+        for (std::vector<DirEntry>::iterator it = local_paste_files.begin(); it != local_paste_files.end(); ++it)
         {
-            int err;
-            std::vector<DirEntry> entries = FS::ListDir(src.path, &err);
-            FS::MkDirs(dest);
-            for (int i = 0; i < entries.size(); i++)
-            {
-                if (stop_activity)
-                    return 1;
-
-                int path_length = strlen(dest) + strlen(entries[i].name) + 2;
-                char *new_path = (char *)malloc(path_length);
-                snprintf(new_path, path_length, "%s%s%s", dest, FS::hasEndSlash(dest) ? "" : "/", entries[i].name);
-
-                if (entries[i].isDir)
-                {
-                    if (strcmp(entries[i].name, "..") == 0)
-                        continue;
+            if (strcmp(it->directory, local_directory) == 0)
+                continue;
 
-                    FS::MkDirs(new_path);
-                    ret = CopyOrMove(entries[i], new_path, isCopy);
-                    if (ret <= 0)
-                    {
-                        free(new_path);
-                        return ret;
-                    }
-                }
-                else
-                {
-                    snprintf(activity_message, 1024, "%s %s", isCopy ? lang_strings[STR_COPYING] : lang_strings[STR_MOVING], entries[i].path);
-                    bytes_to_download = entries[i].file_size;
-                    bytes_transfered = 0;
-                    prev_tick = Util::GetTick();
-                    ret = CopyOrMoveLocalFile(entries[i].path, new_path, isCopy);
-                    if (ret <= 0)
-                    {
-                        snprintf(status_message, 1023, "%s %s", isCopy ? lang_strings[STR_FAIL_COPY_MSG] : lang_strings[STR_FAIL_MOVE_MSG], entries[i].path);
-                        free(new_path);
-                        return ret;
-                    }
-                }
-                free(new_path);
-            }
-        }
-        else
-        {
-            int path_length = strlen(dest) + strlen(src.name) + 2;
-            char *new_path = (char *)malloc(path_length);
-            snprintf(new_path, path_length, "%s%s%s", dest, FS::hasEndSlash(dest) ? "" : "/", src.name);
-            snprintf(activity_message, 1024, "%s %s", isCopy ? lang_strings[STR_COPYING] : lang_strings[STR_MOVING], src.name);
-            bytes_to_download = src.file_size;
-            ret = CopyOrMoveLocalFile(src.path, new_path, isCopy);
-            if (ret <= 0)
+            if (it->isDir && strncmp(local_directory, it->path, strlen(it->path)) == 0)
             {
-                free(new_path);
-                snprintf(status_message, 1023, "%s %s", isCopy ? lang_strings[STR_FAIL_COPY_MSG] : lang_strings[STR_FAIL_MOVE_MSG], src.name);
-                return 0;
+                snprintf(status_message, 1023, "%s", isCopy ? lang_strings[STR_CANT_COPY_TO_SUBDIR_MSG] : lang_strings[STR_CANT_MOVE_TO_SUBDIR_MSG]);
+                continue;
             }
-            free(new_path);
+
+            LocalCopy::Item item;
+            item.source = it->path;
+            item.dest = std::string(local_directory) + (FS::hasEndSlash(local_directory) ? "" : "/") + it->name;
+            item.isDir = it->isDir;
+            items.push_back(item);
         }
-        return 1;
+
+        // Prompts are answered one at a time, so only copy in parallel when
+        // no prompt can come up.
+        int workers = overwrite_type == OVERWRITE_PROMPT ? 1 : local_copy_workers;
+        std::string failed;
+        if (LocalCopy::Run(items, !isCopy, workers, ConfirmLocalOverwrite, &failed) > 0)
+            snprintf(status_message, 1023, "%s %s", isCopy ? lang_strings[STR_FAIL_COPY_MSG] : lang_strings[STR_FAIL_MOVE_MSG], failed.c_str());
     }
 
     void MoveLocalFilesThread(void *argp)
     {
         file_transfering = true;
-        for (std::vector<DirEntry>::iterator it = local_paste_files.begin(); it != local_paste_files.end(); ++it)
-        {
-            if (stop_activity)
-                break;
-
-            if (strcmp(it->directory, local_directory) == 0)
-                continue;
-
-            if (it->isDir)
-            {
-                if (strncmp(local_directory, it->path, strlen(it->path)) == 0)
-                {
-                    snprintf(status_message, 1023, "%s", lang_strings[STR_CANT_MOVE_TO_SUBDIR_MSG]);
-                    continue;
-                }
-                char new_dir[512];
-                sprintf(new_dir, "%s%s%s", local_directory, FS::hasEndSlash(local_directory) ? "" : "/", it->name);
-                CopyOrMove(*it, new_dir, false);
-                FS::RmRecursive(it->path);
-            }
-            else
-            {
-                CopyOrMove(*it, local_directory, false);
-                FS::Rm(it->path);
-            }
-        }
+        CopyOrMoveLocalFiles(false);
         activity_inprogess = false;
         file_transfering = false;
         local_paste_files.clear();
@@ -1429,7 +4685,7 @@ namespace Actions
     void MoveLocalFiles()
     {
         snprintf(status_message, 1023, "%s", "");
-        int res = threadCreate(&bk_activity_thid, MoveLocalFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, MoveLocalFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "move local");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1447,30 +4703,7 @@ namespace Actions
     void CopyLocalFilesThread(void *argp)
     {
         file_transfering = true;
-        for (std::vector<DirEntry>::iterator it = local_paste_files.begin(); it != local_paste_files.end(); ++it)
-        {
-            if (stop_activity)
-                break;
-
-            if (strcmp(it->directory, local_directory) == 0)
-                continue;
-
-            if (it->isDir)
-            {
-                if (strncmp(local_directory, it->path, strlen(it->path)) == 0)
-                {
-                    snprintf(status_message, 1023, "%s", lang_strings[STR_CANT_COPY_TO_SUBDIR_MSG]);
-                    continue;
-                }
-                char new_dir[512];
-                sprintf(new_dir, "%s%s%s", local_directory, FS::hasEndSlash(local_directory) ? "" : "/", it->name);
-                CopyOrMove(*it, new_dir, true);
-            }
-            else
-            {
-                CopyOrMove(*it, local_directory, true);
-            }
-        }
+        CopyOrMoveLocalFiles(true);
         activity_inprogess = false;
         file_transfering = false;
         local_paste_files.clear();
@@ -1482,7 +4715,7 @@ namespace Actions
     void CopyLocalFiles()
     {
         snprintf(status_message, 1023, "%s", "");
-        int res = threadCreate(&bk_activity_thid, CopyLocalFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, CopyLocalFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "copy local");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1497,10 +4730,61 @@ namespace Actions
         }
     }
 
-    int CopyOrMoveRemoteFile(const std::string &src, const std::string &dest, bool isCopy)
+    // Second session for same-site copies the server cannot make itself,
+    // opened on the first such file and closed when the paste ends.
+    static RemoteClient *copy_peer = nullptr;
+    static bool copy_peer_failed = false;
+
+    static void CloseCopyPeer()
     {
-        int ret;
-        if (overwrite_type == OVERWRITE_PROMPT && remoteclient->FileExists(dest))
+        if (copy_peer != nullptr)
+        {
+            copy_peer->Quit();
+            delete copy_peer;
+            copy_peer = nullptr;
+        }
+        copy_peer_failed = false;
+    }
+
+    // Copies `src` to `dest` on the connected site by streaming it from a
+    // second session through RemoteBridge, as a paste between sites does.
+    static int StreamRemoteCopy(const std::string &src, const std::string &dest)
+    {
+        if (copy_peer == nullptr && !copy_peer_failed)
+        {
+            copy_peer = CreateRemoteClient(remote_settings->server);
+            ApplySiteTuning(copy_peer, *remote_settings);
+            if (copy_peer != nullptr &&
+                !copy_peer->Connect(remote_settings->server, remote_settings->username, remote_settings->password))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "COPY second session failed resp=%s", copy_peer->LastResponse());
+                delete copy_peer;
+                copy_peer = nullptr;
+            }
+            copy_peer_failed = copy_peer == nullptr;
+        }
+        if (copy_peer == nullptr)
+            return 0;
+
+        int64_t size = 0;
+        if (!copy_peer->Size(src, &size) || size < 0)
+            size = 0;
+        bytes_to_download = size;
+        bytes_transfered = 0;
+        file_transfering = true;
+        std::string error;
+        int ret = RemoteBridge::CopyFile(copy_peer, src, (uint64_t)size, remoteclient, dest, error);
+        file_transfering = false;
+        if (ret <= 0)
+            Logger::Logf(Logger::LOG_ERROR, "COPY stream failed path=%s err=%s", src.c_str(), error.c_str());
+        return ret;
+    }
+
+    // Applies overwrite_type to `dest`, asking when it exists and the user
+    // wants prompts; true to go ahead.
+    static bool ConfirmRemoteOverwrite(const std::string &dest, bool exists)
+    {
+        if (exists && overwrite_type == OVERWRITE_PROMPT)
         {
             sprintf(confirm_message, "%s %s?", lang_strings[STR_OVERWRITE], dest.c_str());
             confirm_state = CONFIRM_WAIT;
@@ -1513,7 +4797,7 @@ namespace Actions
             activity_inprogess = true;
             selected_action = action_to_take;
         }
-        else if (overwrite_type == OVERWRITE_NONE && remoteclient->FileExists(dest))
+        else if (exists && overwrite_type == OVERWRITE_NONE)
         {
             confirm_state = CONFIRM_NO;
         }
@@ -1521,12 +4805,22 @@ namespace Actions
         {
             confirm_state = CONFIRM_YES;
         }
+        return confirm_state == CONFIRM_YES;
+    }
 
-        if (confirm_state == CONFIRM_YES)
+    int CopyOrMoveRemoteFile(const std::string &src, const std::string &dest, bool isCopy)
+    {
+        bool exists = overwrite_type != OVERWRITE_ALL && remoteclient->FileExists(dest);
+        if (ConfirmRemoteOverwrite(dest, exists))
         {
             prev_tick = Util::GetTick();
             if (isCopy)
-                return remoteclient->Copy(src, dest);
+            {
+                int ret = remoteclient->Copy(src, dest);
+                if (ret < 0)
+                    ret = StreamRemoteCopy(src, dest);
+                return ret;
+            }
             else
                 return remoteclient->Move(src, dest);
         }
@@ -1534,12 +4828,109 @@ namespace Actions
         return 1;
     }
 
+    struct MoveWorkerCtx
+    {
+        std::vector<RemoteMove> *moves = nullptr;
+        std::atomic<size_t> *next = nullptr;
+        RemoteSettings settings;
+    };
+
+    static void DrainMoves(std::vector<RemoteMove> &moves, std::atomic<size_t> &next, RemoteClient *client)
+    {
+        size_t i;
+        while (!Cancel::Stopped() && (i = next.fetch_add(1)) < moves.size())
+        {
+            sprintf(activity_message, "%s %s", lang_strings[STR_MOVING], moves[i].from.c_str());
+            moves[i].ok = client->Move(moves[i].from, moves[i].to) > 0;
+        }
+    }
+
+    static void MoveWorkerThread(void *argp)
+    {
+        MoveWorkerCtx *ctx = static_cast<MoveWorkerCtx *>(argp);
+        RemoteClient *client = ConnectWorkerClient(ctx->settings, "Remote move");
+        if (client == nullptr)
+        {
+            threadExit();
+            return;
+        }
+        DrainMoves(*ctx->moves, *ctx->next, client);
+        ReleaseWorkerClient(client);
+        threadExit();
+    }
+
+    // Moves `moves` on the connected site and returns the connections
+    // used. SMB sends them together on its one connection (MoveBatch);
+    // elsewhere each entry is one request, a rename or a WebDAV MOVE of a
+    // whole folder, spread over up to remote_move_workers connections.
+    static int MoveRemoteEntries(std::vector<RemoteMove> &moves)
+    {
+        sprintf(activity_message, "%s %s", lang_strings[STR_MOVING], moves[0].from.c_str());
+        if (remoteclient->MoveBatch(moves) >= 0)
+            return 1;
+
+        // A few entries are not worth extra connections.
+        int workers = moves.size() < 4 ? 0 : std::min<int>(remote_move_workers, (int)moves.size()) - 1;
+        if (workers > 0)
+        {
+            RemoteClient *probe = CreateRemoteClient(remote_settings->server);
+            if (probe == nullptr)
+                workers = 0;
+            delete probe;
+        }
+
+        std::atomic<size_t> next{0};
+        std::vector<MoveWorkerCtx> worker_ctx(workers);
+        std::vector<Thread> threads(workers);
+        std::vector<bool> started(workers, false);
+        for (int i = 0; i < workers; i++)
+        {
+            worker_ctx[i].moves = &moves;
+            worker_ctx[i].next = &next;
+            worker_ctx[i].settings = *remote_settings;
+            Result rc = Threads::Create(&threads[i], MoveWorkerThread, &worker_ctx[i], 0x100000, Threads::ROLE_NETWORK, "move worker");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "Remote move: failed to create worker thread rc=0x%08x", rc);
+                continue;
+            }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        // Whatever the workers do not take (all of it without workers)
+        // goes from here.
+        DrainMoves(moves, next, remoteclient);
+        for (int i = 0; i < workers; i++)
+        {
+            if (started[i])
+                Threads::Join(&threads[i]);
+        }
+        return workers + 1;
+    }
+
     void MoveRemoteFilesThread(void *argp)
     {
         file_transfering = false;
+        uint64_t start = Util::GetTick();
+
+        // The target is the folder on screen, so its listing tells which
+        // names are taken without a round trip per entry.
+        std::set<std::string> taken;
+        bool listed = remote_index.Holds(remote_directory);
+        if (listed)
+        {
+            const CompactListing &entries = remote_index.Entries();
+            for (size_t i = 0; i < entries.Size(); i++)
+                taken.insert(entries.Name(i));
+        }
+
+        std::vector<RemoteMove> moves;
+        std::set<std::string> sources;
+        int skipped = 0;
         for (std::vector<DirEntry>::iterator it = remote_paste_files.begin(); it != remote_paste_files.end(); ++it)
         {
-            if (stop_activity)
+            if (Cancel::Stopped())
                 break;
 
             if (strcmp(it->directory, remote_directory) == 0)
@@ -1556,10 +4947,36 @@ namespace Actions
                 }
             }
 
-            snprintf(activity_message, 1024, "%s %s", lang_strings[STR_MOVING], it->path);
-            int res = CopyOrMoveRemoteFile(it->path, new_path, false);
-            if (res == 0)
-                snprintf(status_message, 1023, "%s - %s", it->name, lang_strings[STR_FAIL_COPY_MSG]);
+            bool exists = overwrite_type != OVERWRITE_ALL &&
+                          (listed ? taken.count(it->name) > 0 : remoteclient->FileExists(new_path));
+            if (!ConfirmRemoteOverwrite(new_path, exists))
+            {
+                skipped++;
+                continue;
+            }
+            RemoteMove move;
+            move.from = it->path;
+            move.to = new_path;
+            moves.push_back(move);
+            sources.insert(it->directory);
+        }
+
+        if (!moves.empty() && !Cancel::Stopped())
+        {
+            int connections = MoveRemoteEntries(moves);
+            int failed = 0;
+            for (const RemoteMove &move : moves)
+            {
+                if (move.ok)
+                    continue;
+                failed++;
+                snprintf(status_message, 1023, "%s - %s", move.from.c_str(), lang_strings[STR_FAIL_COPY_MSG]);
+            }
+            for (const std::string &source : sources)
+                FolderSize::Invalidate(remote_settings->server, source);
+            FolderSize::Invalidate(remote_settings->server, remote_directory);
+            Logger::Logf("Remote move entries=%d failed=%d skipped=%d connections=%d ms=%llu", (int)moves.size(),
+                         failed, skipped, connections, (unsigned long long)((Util::GetTick() - start) / 1000));
         }
         activity_inprogess = false;
         file_transfering = false;
@@ -1572,7 +4989,7 @@ namespace Actions
     void MoveRemoteFiles()
     {
         snprintf(status_message, 1023, "%s", "");
-        int res = threadCreate(&bk_activity_thid, MoveRemoteFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, MoveRemoteFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "move remote");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1589,18 +5006,46 @@ namespace Actions
 
     int CopyRemotePath(const DirEntry &src, const char *dest)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
             return 1;
 
         int ret;
         if (src.isDir)
         {
+            // Into a new folder the server copies the whole tree in one go,
+            // with no overwrite decisions to make. SIZE fails on folders for
+            // FTP, so existence is read from the parent's listing.
+            std::string dest_dir(dest);
+            size_t slash = dest_dir.find_last_of('/');
+            std::string parent = slash == std::string::npos || slash == 0 ? "/" : dest_dir.substr(0, slash);
+            bool exists = false;
+            for (const DirEntry &entry : remoteclient->ListDir(parent))
+            {
+                if (strcmp(entry.name, dest_dir.c_str() + slash + 1) == 0)
+                {
+                    exists = true;
+                    break;
+                }
+            }
+            if (!exists)
+            {
+                snprintf(activity_message, 1024, "%s %s", lang_strings[STR_COPYING], src.path);
+                ret = remoteclient->CopyTree(src.path, dest);
+                if (ret >= 0)
+                {
+                    Logger::Logf("COPY tree server-side from=%s to=%s ok=%d", src.path, dest, ret);
+                    if (ret == 0)
+                        snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_COPY_MSG], src.path);
+                    return ret;
+                }
+            }
+
             int err;
             std::vector<DirEntry> entries = remoteclient->ListDir(src.path);
             remoteclient->Mkdir(dest);
             for (int i = 0; i < entries.size(); i++)
             {
-                if (stop_activity)
+                if (Cancel::Stopped())
                     return 1;
 
                 int path_length = strlen(dest) + strlen(entries[i].name) + 2;
@@ -1660,7 +5105,7 @@ namespace Actions
         file_transfering = false;
         for (std::vector<DirEntry>::iterator it = remote_paste_files.begin(); it != remote_paste_files.end(); ++it)
         {
-            if (stop_activity)
+            if (Cancel::Stopped())
                 break;
 
             if (strcmp(it->directory, remote_directory) == 0)
@@ -1686,6 +5131,7 @@ namespace Actions
                     snprintf(status_message, 1023, "%s - %s", it->name, lang_strings[STR_FAIL_COPY_MSG]);
             }
         }
+        CloseCopyPeer();
         activity_inprogess = false;
         file_transfering = false;
         remote_paste_files.clear();
@@ -1697,7 +5143,7 @@ namespace Actions
     void CopyRemoteFiles()
     {
         snprintf(status_message, 1023, "%s", "");
-        int res = threadCreate(&bk_activity_thid, CopyRemoteFilesThread, NULL, NULL, 0x100000, 0x3B, -2);
+        int res = Threads::Create(&bk_activity_thid, CopyRemoteFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "copy remote");
         if (R_FAILED(res))
         {
             file_transfering = false;
@@ -1712,6 +5158,408 @@ namespace Actions
         }
     }
 
+    static std::string JoinRemotePath(const std::string &dir, const char *name)
+    {
+        return dir + (FS::hasEndSlash(dir.c_str()) ? "" : "/") + name;
+    }
+
+    static int CopySiteFile(RemoteClient *source, const DirEntry &src, const std::string &dest, bool move)
+    {
+        if (overwrite_type == OVERWRITE_PROMPT && remoteclient->FileExists(dest))
+        {
+            sprintf(confirm_message, "%s %s?", lang_strings[STR_OVERWRITE], dest.c_str());
+            confirm_state = CONFIRM_WAIT;
+            action_to_take = selected_action;
+            activity_inprogess = false;
+            while (confirm_state == CONFIRM_WAIT)
+            {
+                svcSleepThread(100000000ull);
+            }
+            activity_inprogess = true;
+            selected_action = action_to_take;
+        }
+        else if (overwrite_type == OVERWRITE_NONE && remoteclient->FileExists(dest))
+        {
+            confirm_state = CONFIRM_NO;
+        }
+        else
+        {
+            confirm_state = CONFIRM_YES;
+        }
+        if (confirm_state != CONFIRM_YES)
+            return 1;
+
+        // The stream length comes from the size, so listings that leave it
+        // out are asked for it.
+        int64_t size = src.file_size;
+        if (size <= 0 && (!source->Size(src.path, &size) || size < 0))
+            size = 0;
+
+        snprintf(activity_message, 1024, "%s %s", lang_strings[STR_COPYING], src.path);
+        bytes_to_download = size;
+        bytes_transfered = 0;
+        prev_tick = Util::GetTick();
+        std::string error;
+        if (!RemoteBridge::CopyFile(source, src.path, (uint64_t)size, remoteclient, dest, error))
+        {
+            snprintf(status_message, 1023, "%s %s - %s", lang_strings[STR_FAIL_COPY_MSG], src.name, error.c_str());
+            return 0;
+        }
+        // Only what was copied goes, so skipped files keep their folders.
+        if (move && !source->Delete(src.path))
+            Logger::Logf(Logger::LOG_ERROR, "SITE COPY delete after move failed path=%s resp=%s",
+                         src.path, source->LastResponse());
+        return 1;
+    }
+
+    // Copies `src` into the folder `dest` (for a folder, `dest` is the new
+    // folder itself), like CopyRemotePath but from `source`.
+    static int CopySitePath(RemoteClient *source, const DirEntry &src, const std::string &dest, bool move)
+    {
+        if (Cancel::Stopped())
+            return 1;
+
+        if (!src.isDir)
+            return CopySiteFile(source, src, JoinRemotePath(dest, src.name), move);
+
+        std::vector<DirEntry> entries = source->ListDir(src.path);
+        remoteclient->Mkdir(dest);
+        for (const DirEntry &entry : entries)
+        {
+            if (Cancel::Stopped())
+                return 1;
+            if (strcmp(entry.name, "..") == 0)
+                continue;
+
+            std::string new_path = JoinRemotePath(dest, entry.name);
+            int ret = entry.isDir ? CopySitePath(source, entry, new_path, move)
+                                  : CopySiteFile(source, entry, new_path, move);
+            if (ret <= 0)
+                return ret;
+        }
+        // Fails, and keeps the folder, while a skipped file is still in it.
+        if (move && !Cancel::Stopped())
+            source->Rmdir(src.path, false);
+        return 1;
+    }
+
+    void CopySiteFilesThread(void *argp)
+    {
+        file_transfering = true;
+        bool move = remote_paste_action == ACTION_REMOTE_CUT;
+        Logger::Logf("SITE COPY from=%s to=%s files=%zu move=%d", remote_paste_settings.site_name,
+                     remote_settings->site_name, remote_paste_files.size(), move ? 1 : 0);
+
+        // A session of its own even for the same server: the bridge reads
+        // on one connection while it writes on the other.
+        RemoteClient *source = CreateRemoteClient(remote_paste_settings.server);
+        ApplySiteTuning(source, remote_paste_settings);
+        if (source == nullptr)
+        {
+            snprintf(status_message, 1023, "%s", lang_strings[STR_PROTOCOL_NOT_SUPPORTED]);
+        }
+        else if (!source->Connect(remote_paste_settings.server, remote_paste_settings.username,
+                                  remote_paste_settings.password))
+        {
+            const char *resp = source->LastResponse();
+            snprintf(status_message, 1023, "%s", resp && resp[0] != '\0' ? resp : lang_strings[STR_FAIL_TIMEOUT_MSG]);
+        }
+        else
+        {
+            bool same_site = strcmp(remote_paste_settings.server, remote_settings->server) == 0;
+            for (const DirEntry &entry : remote_paste_files)
+            {
+                if (Cancel::Stopped())
+                    break;
+                // On the same server a file pasted onto itself would be
+                // truncated while it is read.
+                if (same_site && strcmp(entry.directory, remote_directory) == 0)
+                    continue;
+                if (same_site && entry.isDir && strncmp(remote_directory, entry.path, strlen(entry.path)) == 0)
+                {
+                    snprintf(status_message, 1023, "%s", lang_strings[STR_CANT_COPY_TO_SUBDIR_MSG]);
+                    continue;
+                }
+                std::string dest = entry.isDir ? JoinRemotePath(remote_directory, entry.name)
+                                               : std::string(remote_directory);
+                if (CopySitePath(source, entry, dest, move) <= 0)
+                    break;
+            }
+            source->Quit();
+        }
+        delete source;
+
+        activity_inprogess = false;
+        file_transfering = false;
+        remote_paste_files.clear();
+        Windows::SetModalMode(false);
+        selected_action = ACTION_REFRESH_REMOTE_FILES;
+        threadExit();
+    }
+
+    void PasteRemoteFiles()
+    {
+        snprintf(status_message, 1023, "%s", "");
+        bool same_site = strcmp(remote_paste_settings.server, remote_settings->server) == 0 &&
+                         strcmp(remote_paste_settings.username, remote_settings->username) == 0;
+        uint32_t needed = remote_paste_action == ACTION_REMOTE_CUT ? REMOTE_ACTION_CUT : REMOTE_ACTION_COPY;
+        if (same_site && (remoteclient->SupportedActions() & needed))
+        {
+            if (remote_paste_action == ACTION_REMOTE_CUT)
+                MoveRemoteFiles();
+            else
+                CopyRemoteFiles();
+            return;
+        }
+
+        int res = Threads::Create(&bk_activity_thid, CopySiteFilesThread, NULL, 0x100000, Threads::ROLE_NETWORK, "copy site");
+        if (R_FAILED(res))
+        {
+            file_transfering = false;
+            activity_inprogess = false;
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
+    }
+
+    // What one sync run copied and removed, for its log line.
+    struct SyncTally
+    {
+        int files = 0;
+        int64_t bytes = 0;
+        int removed = 0;
+        int failed = 0;
+    };
+
+    static void SyncRemoveLocal(const std::string &path, bool isDir, SyncTally &tally)
+    {
+        if (isDir)
+            FS::RmRecursive(path);
+        else
+            FS::Rm(path);
+        tally.removed++;
+    }
+
+    // Diffs one remote folder against its local copy and queues what has
+    // to come down; subfolders follow once the folder's own pass is done.
+    // A changed local file is deleted first, so the download starts over
+    // instead of resuming into it.
+    static void SyncFolderToLocal(RemoteClient *client, const std::string &remote_dir, const std::string &local_dir,
+                                  std::vector<DownloadJob> &jobs, SyncTally &tally)
+    {
+        if (Cancel::Stopped())
+            return;
+
+        int err = 0;
+        CompactListing remote(client->ListDir(remote_dir));
+        CompactListing local(FS::ListDir(local_dir, &err));
+        std::vector<DirEntry> folders;
+        ListingDiff::Compare(remote, local, [&](ListingDiff::Change change, size_t r, size_t l)
+                             {
+                                 if (change == ListingDiff::DIFF_EXTRA)
+                                 {
+                                     if (sync_delete_extras)
+                                         SyncRemoveLocal(FS::GetPath(local_dir, local.Name(l)), local.IsDir(l), tally);
+                                     return;
+                                 }
+                                 if (change == ListingDiff::DIFF_CHANGED)
+                                     SyncRemoveLocal(FS::GetPath(local_dir, local.Name(l)), local.IsDir(l), tally);
+                                 else if (change == ListingDiff::DIFF_SAME && !remote.IsDir(r))
+                                     return;
+
+                                 DownloadJob job;
+                                 remote.Get(r, job.entry);
+                                 if (job.entry.isDir)
+                                 {
+                                     folders.push_back(job.entry);
+                                     return;
+                                 }
+                                 job.destDir = local_dir;
+                                 tally.files++;
+                                 tally.bytes += job.entry.file_size;
+                                 jobs.push_back(job);
+                             });
+
+        for (const DirEntry &folder : folders)
+        {
+            std::string local_path = FS::GetPath(local_dir, folder.name);
+            FS::MkDirs(local_path);
+            SyncFolderToLocal(client, folder.path, local_path, jobs, tally);
+        }
+    }
+
+    void SyncToLocalThread(void *argp)
+    {
+        stop_activity = false;
+        file_transfering = true;
+        uint64_t start = Util::GetTick();
+        sprintf(activity_message, "%s %s", lang_strings[STR_SYNC_COMPARING], remote_directory);
+
+        std::vector<DownloadJob> jobs;
+        SyncTally tally;
+        SyncFolderToLocal(remoteclient, remote_directory, local_directory, jobs, tally);
+        Logger::Logf("SYNC DIFF to=local remote=%s local=%s files=%d bytes=%lld removed=%d ms=%llu",
+                     remote_directory, local_directory, tally.files, (long long)tally.bytes, tally.removed,
+                     (unsigned long long)((Util::GetTick() - start) / 1000));
+
+        if (!Cancel::Stopped() && !jobs.empty())
+        {
+            DownloadQueue queue;
+            queue.jobs.assign(jobs.begin(), jobs.end());
+            // Nothing left to overwrite, so every worker can take part.
+            RunDownloadQueue(queue, false);
+        }
+        else if (!Cancel::Stopped() && tally.removed == 0)
+        {
+            sprintf(status_message, "%s", lang_strings[STR_SYNC_UP_TO_DATE]);
+        }
+
+        file_transfering = false;
+        batch_files_total = 0;
+        batch_bytes_total = 0;
+        activity_inprogess = false;
+        stop_activity = false;
+        Windows::SetModalMode(false);
+        selected_action = ACTION_REFRESH_LOCAL_FILES;
+        threadExit();
+    }
+
+    void SyncToLocal()
+    {
+        sprintf(status_message, "%s", "");
+        bytes_transfered = 0;
+        bytes_to_download = 0;
+        int res = Threads::Create(&bk_activity_thid, SyncToLocalThread, NULL, 0x100000, Threads::ROLE_NETWORK, "sync to local");
+        if (R_FAILED(res))
+        {
+            file_transfering = false;
+            activity_inprogess = false;
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
+    }
+
+    static void SyncRemoveRemote(const DirEntry &entry, SyncTally &tally)
+    {
+        if (entry.isDir)
+            remoteclient->Rmdir(entry.path, true);
+        else
+            remoteclient->Delete(entry.path);
+        tally.removed++;
+    }
+
+    // Uploads are sent as the diff finds them: the upload path has a
+    // single connection, so there is no queue to feed.
+    static void SyncFolderToRemote(const std::string &local_dir, const std::string &remote_dir, SyncTally &tally)
+    {
+        if (Cancel::Stopped())
+            return;
+
+        int err = 0;
+        CompactListing local(FS::ListDir(local_dir, &err));
+        CompactListing remote(remoteclient->ListDir(remote_dir));
+        std::vector<DirEntry> files;
+        std::vector<DirEntry> folders;
+        ListingDiff::Compare(local, remote, [&](ListingDiff::Change change, size_t l, size_t r)
+                             {
+                                 if (change == ListingDiff::DIFF_EXTRA || change == ListingDiff::DIFF_CHANGED)
+                                 {
+                                     DirEntry extra;
+                                     remote.Get(r, extra);
+                                     // A changed file is overwritten in place; only
+                                     // a folder/file clash has to go first.
+                                     if (change == ListingDiff::DIFF_EXTRA ? sync_delete_extras
+                                                                           : extra.isDir != local.IsDir(l))
+                                         SyncRemoveRemote(extra, tally);
+                                     if (change == ListingDiff::DIFF_EXTRA)
+                                         return;
+                                 }
+                                 else if (change == ListingDiff::DIFF_SAME && !local.IsDir(l))
+                                     return;
+
+                                 DirEntry entry;
+                                 local.Get(l, entry);
+                                 if (entry.isDir)
+                                 {
+                                     if (change != ListingDiff::DIFF_SAME)
+                                         remoteclient->Mkdir(JoinRemotePath(remote_dir, entry.name));
+                                     folders.push_back(entry);
+                                 }
+                                 else
+                                     files.push_back(entry);
+                             });
+
+        for (const DirEntry &file : files)
+        {
+            if (Cancel::Stopped())
+                return;
+            std::string dest = JoinRemotePath(remote_dir, file.name);
+            snprintf(activity_message, 1024, "%s %s", lang_strings[STR_UPLOADING], file.path);
+            bytes_to_download = file.file_size;
+            bytes_transfered = 0;
+            prev_tick = Util::GetTick();
+            if (remoteclient->Put(file.path, dest) <= 0)
+            {
+                snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_UPLOAD_MSG], file.path);
+                tally.failed++;
+                continue;
+            }
+            tally.files++;
+            tally.bytes += file.file_size;
+        }
+
+        for (const DirEntry &folder : folders)
+            SyncFolderToRemote(folder.path, JoinRemotePath(remote_dir, folder.name), tally);
+    }
+
+    void SyncToRemoteThread(void *argp)
+    {
+        stop_activity = false;
+        file_transfering = true;
+        uint64_t start = Util::GetTick();
+        sprintf(activity_message, "%s %s", lang_strings[STR_SYNC_COMPARING], local_directory);
+
+        SyncTally tally;
+        SyncFolderToRemote(local_directory, remote_directory, tally);
+        Logger::Logf("SYNC to=remote local=%s remote=%s files=%d bytes=%lld removed=%d failed=%d ms=%llu",
+                     local_directory, remote_directory, tally.files, (long long)tally.bytes, tally.removed,
+                     tally.failed, (unsigned long long)((Util::GetTick() - start) / 1000));
+        if (!Cancel::Stopped() && tally.files == 0 && tally.removed == 0 && tally.failed == 0)
+            sprintf(status_message, "%s", lang_strings[STR_SYNC_UP_TO_DATE]);
+
+        activity_inprogess = false;
+        file_transfering = false;
+        stop_activity = false;
+        Windows::SetModalMode(false);
+        selected_action = ACTION_REFRESH_REMOTE_FILES;
+        threadExit();
+    }
+
+    void SyncToRemote()
+    {
+        sprintf(status_message, "%s", "");
+        int res = Threads::Create(&bk_activity_thid, SyncToRemoteThread, NULL, 0x100000, Threads::ROLE_NETWORK, "sync to remote");
+        if (R_FAILED(res))
+        {
+            file_transfering = false;
+            activity_inprogess = false;
+            Windows::SetModalMode(false);
+            threadClose(&bk_activity_thid);
+        }
+        else
+        {
+            threadStart(&bk_activity_thid);
+        }
+    }
+
     void CreateLocalFile(char *filename)
     {
         std::string new_file = FS::GetPath(local_directory, filename);
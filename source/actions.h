@@ -3,6 +3,10 @@
 
 #include <switch.h>
 #include "common.h"
+#include "clients/remote_client.h"
+#include "folder_size.h"
+
+struct RemoteSettings;
 
 #define CONFIRM_NONE -1
 #define CONFIRM_WAIT 0
@@ -25,6 +29,9 @@ enum ACTIONS
     ACTION_APPLY_LOCAL_FILTER,
     ACTION_APPLY_REMOTE_FILTER,
     ACTION_REFRESH_LOCAL_FILES,
+    // The local pane takes the entries downloads wrote without reading
+    // the folder again.
+    ACTION_UPDATE_LOCAL_FILES,
     ACTION_REFRESH_REMOTE_FILES,
     ACTION_SHOW_LOCAL_PROPERTIES,
     ACTION_SHOW_REMOTE_PROPERTIES,
@@ -32,12 +39,15 @@ enum ACTIONS
     ACTION_REMOTE_SELECT_ALL,
     ACTION_LOCAL_CLEAR_ALL,
     ACTION_REMOTE_CLEAR_ALL,
+    ACTION_LOCAL_INVERT_SELECTION,
+    ACTION_REMOTE_INVERT_SELECTION,
     ACTION_CONNECT,
     ACTION_DISCONNECT,
     ACTION_DISCONNECT_AND_EXIT,
     ACTION_EXTRACT_LOCAL_ZIP,
     ACTION_EXTRACT_REMOTE_ZIP,
     ACTION_CREATE_LOCAL_ZIP,
+    ACTION_CREATE_REMOTE_ZIP,
     ACTION_LOCAL_CUT,
     ACTION_LOCAL_COPY,
     ACTION_LOCAL_PASTE,
@@ -50,7 +60,14 @@ enum ACTIONS
     ACTION_NEW_REMOTE_FILE,
     ACTION_VIEW_LOCAL_IMAGE,
     ACTION_VIEW_REMOTE_IMAGE,
-    ACTION_APPLY_REMOTE_NATIVE_FILTER
+    ACTION_APPLY_REMOTE_NATIVE_FILTER,
+    ACTION_RESUME_DOWNLOADS,
+    ACTION_OPEN_REMOTE_ARCHIVE,
+    ACTION_SYNC_TO_LOCAL,
+    ACTION_SYNC_TO_REMOTE,
+    ACTION_INSTALL_REMOTE_PACKAGES,
+    ACTION_BUILD_CATALOGUE,
+    ACTION_BENCHMARK_SITE
 };
 
 enum OverWriteType
@@ -60,18 +77,70 @@ enum OverWriteType
     OVERWRITE_ALL
 };
 
+// A file a download batch would replace, and whether to, as settled in
+// the one dialog asked before the batch starts.
+struct TransferConflict
+{
+    std::string path;
+    int64_t size;
+    bool overwrite;
+};
+
 static Thread bk_activity_thid;
-static Thread smb_keep_alive_thid;
-static Thread ftp_keep_alive_thid;
 
 namespace Actions
 {
 
     void RefreshLocalFiles(bool apply_filter);
     void RefreshRemoteFiles(bool apply_filter);
+    // Lists local_directory on a background thread, rows showing up in
+    // local_files as PollLocalListing() picks them up each frame. With
+    // `use_cache` a listing the app kept of the folder is shown at once.
+    // `select_first` and `prev_count` work as for StartRemoteListing().
+    void StartLocalListing(bool apply_filter, bool select_first, int prev_count, bool use_cache);
+    void PollLocalListing();
+    // Apply local_filter/remote_filter to the listing on screen, listing
+    // the folder first only when it isn't loaded.
+    void ApplyLocalFilter();
+    void ApplyRemoteFilter();
+    // Lists remote_directory on a background thread. Entries show up in
+    // remote_files as PollRemoteListing() picks them up each frame; once
+    // done the list is sorted and, with `select_first`, the first row is
+    // selected (only if the count differs from `prev_count` when >= 0).
+    // With `use_cache` a cached listing of the folder is shown instead, and
+    // revalidated in the background once it is older than
+    // listing_cache_seconds. Never waits for a listing still running: that
+    // one is abandoned, and the new one starts as soon as it has let go of
+    // the connection.
+    void StartRemoteListing(bool apply_filter, bool select_first, int prev_count, bool use_cache);
+    void PollRemoteListing();
+    void CancelRemoteListing();
+    // A listing for the remote pane is on its way (prefetches excluded).
+    bool RemoteListingInProgress();
+    // Some listing, possibly a prefetch, is using remoteclient.
+    bool RemoteConnectionBusy();
+    // Lists up to listing_prefetch folders around the focused remote row
+    // into the listing cache while nothing else needs the connection.
+    // Called each idle frame; starts at most one listing at a time.
+    void PrefetchRemoteListings();
+    // Stops a running prefetch at its next batch, without waiting.
+    void CancelRemotePrefetch();
+    // Entries received so far by the running listing, before filtering.
+    int RemoteListingCount();
+    // Sizes the folder `entry` of the local or (`remote`) remote pane in
+    // the background for the properties dialog, taking a size known from
+    // earlier as it is. Asking again for the same folder does nothing.
+    void StartFolderSize(const DirEntry &entry, bool remote);
+    // Totals so far of that folder. Returns true once they are final, with
+    // `*ok` false when it could not be sized.
+    bool FolderSizeStatus(FolderSize::Totals &totals, bool *ok);
+    void CancelFolderSize();
+    // Reaps a finished crawl; called each frame.
+    void PollFolderSize();
     void HandleChangeLocalDirectory(const DirEntry entry);
     void HandleChangeRemoteDirectory(const DirEntry entry);
     void HandleRefreshLocalFiles();
+    void HandleUpdateLocalFiles();
     void HandleRefreshRemoteFiles();
     void CreateNewLocalFolder(char *new_folder);
     void CreateNewRemoteFolder(char *new_folder);
@@ -85,16 +154,62 @@ namespace Actions
     void UploadFiles();
     void DownloadFilesThread(void *argp);
     void DownloadFiles();
+    // Restarts the interrupted downloads offered after connecting; their
+    // journals make them fetch only the missing blocks.
+    void ResumeDownloads();
+    // With background_transfers on and an overwrite mode other than
+    // prompt, appends the selected remote entries to the background
+    // download queue, starting it if need be, and returns true. False
+    // when the download has to run the blocking way instead.
+    bool QueueBackgroundDownloads();
+    bool BackgroundDownloadsRunning();
+    // Stops the background queue; `wait` joins it before returning.
+    void CancelBackgroundDownloads(bool wait);
+    // Joins a finished background queue and refreshes the local pane;
+    // once a frame.
+    void PollBackgroundDownloads();
+    // Creates an unconnected client for `server`, configured like the
+    // primary connection. Returns nullptr for unsupported protocols.
+    RemoteClient *CreateRemoteClient(const char *server);
+    // As above for a site, which also picks the client of an HTTP index
+    // site's server type when those are built in.
+    RemoteClient *CreateRemoteClient(const RemoteSettings &settings);
+    // A connection of its own for a background job such as the thumbnail
+    // workers, logged in like a queue worker's; nullptr when that fails.
+    RemoteClient *ConnectBackgroundClient(const RemoteSettings &settings, const char *what);
+    void ReleaseBackgroundClient(RemoteClient *client);
     void Connect();
     void Disconnect();
+    // Logs in to last_site in the background at launch (auto_connect) and
+    // watches for the console waking up, when the SFTP/FTP session is
+    // reopened the same way (reconnect_on_resume). PollConnectionManager()
+    // hands a finished login to the remote pane; once a frame.
+    void StartConnectionManager();
+    void PollConnectionManager();
+    void StopConnectionManager();
+    // A background login or a keep-alive probe of the primary connection
+    // is running; remote actions wait for it.
+    bool BackgroundConnectInProgress();
     void SelectAllLocalFiles();
     void SelectAllRemoteFiles();
     void ExtractZipThread(void *argp);
     void ExtractLocalZips();
     void ExtractRemoteZipThread(void *argp);
     void ExtractRemoteZips();
+    // Installs the selected remote packages (see Installer) without
+    // downloading them first.
+    void InstallRemotePackagesThread(void *argp);
+    void InstallRemotePackages();
+    // Opens selected_remote_file as a folder (see RemoteArchive) and shows
+    // its root in the remote pane.
+    void OpenRemoteArchiveThread(void *argp);
+    void OpenRemoteArchive();
     void MakeZipThread(void *argp);
     void MakeLocalZip();
+    // Zips the selected local files into zip_file_path on the remote site
+    // (see RemoteZip).
+    void MakeRemoteZipThread(void *argp);
+    void MakeRemoteZip();
     void MoveLocalFilesThread(void *argp);
     void MoveLocalFiles();
     void CopyLocalFilesThread(void *argp);
@@ -103,6 +218,26 @@ namespace Actions
     void MoveRemoteFiles();
     void CopyRemoteFilesThread(void *argp);
     void CopyRemoteFiles();
+    // Pastes remote_paste_files into remote_directory: with the server's
+    // own copy/move when they come from the connected site and it has one,
+    // otherwise streamed from a second session to remote_paste_settings.
+    void PasteRemoteFiles();
+    void CopySiteFilesThread(void *argp);
+    // One-way sync of the current folders, recursively: copies only the
+    // files the destination lacks or has with another size or an older
+    // mtime, and with sync_delete_extras removes what the source lacks.
+    void SyncToLocalThread(void *argp);
+    void SyncToLocal();
+    void SyncToRemoteThread(void *argp);
+    void SyncToRemote();
+    // Catalogues the remote folder on screen and everything below it (see
+    // Catalogue); building it again only lists what may have changed.
+    void BuildCatalogueThread(void *argp);
+    void BuildCatalogue();
+    // Runs SiteBench on its own connection with selected_remote_file and
+    // opens the results dialog when done.
+    void BenchmarkSiteThread(void *argp);
+    void BenchmarkSite();
     void CreateLocalFile(char *filename);
     void CreateRemoteFile(char *filename);
 }
@@ -0,0 +1,181 @@
+#include <cstdlib>
+#include <malloc.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include "buffer_pool.h"
+#include "config.h"
+#include "logger.h"
+#include "memory_governor.h"
+#include "metrics.h"
+
+namespace
+{
+    // How long a lease waits for budget before it is granted anyway. Callers
+    // that already hold buffers and need one more would otherwise deadlock
+    // against each other.
+    const std::chrono::milliseconds kBudgetWait(2000);
+
+    std::mutex pool_mutex;
+    std::condition_variable pool_cv;
+    std::map<size_t, std::vector<char *>> idle_buffers;
+    BufferPool::Stats stats;
+
+    size_t Budget()
+    {
+        return MemoryGovernor::TransferBudget();
+    }
+
+    size_t SizeClass(size_t size)
+    {
+        size_t cls = BufferPool::kMinClass;
+        while (cls < size)
+            cls <<= 1;
+        return cls;
+    }
+
+    void FreeIdleLocked()
+    {
+        for (auto &entry : idle_buffers)
+        {
+            for (char *buffer : entry.second)
+                free(buffer);
+            entry.second.clear();
+        }
+        stats.idle = 0;
+    }
+}
+
+namespace BufferPool
+{
+    Stats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        return stats;
+    }
+
+    void Trim()
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        FreeIdleLocked();
+    }
+
+    void LogStats(const char *tag)
+    {
+        Stats s = GetStats();
+        Logger::Logf("POOL %s in_use=%zu idle=%zu peak=%zu budget=%zu waits=%llu overdrafts=%llu",
+                     tag, s.in_use, s.idle, s.peak, Budget(),
+                     (unsigned long long)s.waits, (unsigned long long)s.overdrafts);
+    }
+}
+
+TransferBuffer::TransferBuffer(TransferBuffer &&other)
+    : ptr(other.ptr), length(other.length), capacity(other.capacity)
+{
+    other.ptr = nullptr;
+    other.length = 0;
+    other.capacity = 0;
+}
+
+TransferBuffer &TransferBuffer::operator=(TransferBuffer &&other)
+{
+    if (this != &other)
+    {
+        Release();
+        ptr = other.ptr;
+        length = other.length;
+        capacity = other.capacity;
+        other.ptr = nullptr;
+        other.length = 0;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+bool TransferBuffer::Acquire(size_t size)
+{
+    if (ptr && capacity >= size)
+    {
+        length = size;
+        return true;
+    }
+    Release();
+
+    size_t cls = SizeClass(size);
+    std::unique_lock<std::mutex> lock(pool_mutex);
+
+    // A lease that fits the budget on its own never waits for an empty pool.
+    if (stats.in_use > 0 && stats.in_use + cls > Budget())
+    {
+        stats.waits++;
+        bool fits = pool_cv.wait_for(lock, kBudgetWait, [cls]
+                                     { return stats.in_use == 0 || stats.in_use + cls <= Budget(); });
+        if (!fits)
+        {
+            stats.overdrafts++;
+            Logger::Logf("POOL over budget size=%zu in_use=%zu budget=%zu", cls, stats.in_use, Budget());
+        }
+    }
+
+    std::vector<char *> &free_list = idle_buffers[cls];
+    if (!free_list.empty())
+    {
+        ptr = free_list.back();
+        free_list.pop_back();
+        stats.idle -= cls;
+    }
+    else
+    {
+        ptr = static_cast<char *>(memalign(BufferPool::kAlignment, cls));
+        if (!ptr)
+        {
+            // Idle buffers of other classes may be what fragments the heap.
+            FreeIdleLocked();
+            ptr = static_cast<char *>(memalign(BufferPool::kAlignment, cls));
+        }
+        if (!ptr)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "POOL allocation failed size=%zu in_use=%zu", cls, stats.in_use);
+            return false;
+        }
+    }
+
+    length = size;
+    capacity = cls;
+    stats.in_use += cls;
+    if (stats.in_use > stats.peak)
+        stats.peak = stats.in_use;
+    Metrics::Set(Metrics::GAUGE_POOL_BYTES, (int64_t)stats.in_use);
+    return true;
+}
+
+void TransferBuffer::Release()
+{
+    if (!ptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        stats.in_use -= capacity;
+        Metrics::Set(Metrics::GAUGE_POOL_BYTES, (int64_t)stats.in_use);
+        // Keep the buffer for the next lease while leased and idle bytes
+        // together stay within the budget.
+        if (stats.in_use + stats.idle + capacity <= Budget())
+        {
+            idle_buffers[capacity].push_back(ptr);
+            stats.idle += capacity;
+        }
+        else
+        {
+            free(ptr);
+        }
+    }
+    pool_cv.notify_all();
+
+    ptr = nullptr;
+    length = 0;
+    capacity = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef NEO_BUFFER_POOL_H
+#define NEO_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Page-aligned transfer buffers shared by every client, the archive code and
+// the local writers. Buffers are recycled in power-of-two size classes so a
+// long session does not fragment the heap, and the bytes leased at once are
+// held to transfer_memory_mb.
+namespace BufferPool
+{
+    const size_t kAlignment = 0x1000;
+    // Smallest size class; smaller requests are rounded up to it.
+    const size_t kMinClass = 64 * 1024;
+
+    struct Stats
+    {
+        size_t in_use = 0;
+        size_t idle = 0;
+        size_t peak = 0;
+        // Leases that had to wait for budget, and those granted over it
+        // after waiting too long.
+        uint64_t waits = 0;
+        uint64_t overdrafts = 0;
+    };
+
+    Stats GetStats();
+    // Frees every idle buffer back to the heap.
+    void Trim();
+    void LogStats(const char *tag);
+}
+
+// RAII lease of one pool buffer. The buffer returns to the pool when the
+// lease is released or destroyed.
+class TransferBuffer
+{
+public:
+    TransferBuffer() {}
+    explicit TransferBuffer(size_t size) { Acquire(size); }
+    ~TransferBuffer() { Release(); }
+
+    TransferBuffer(TransferBuffer &&other);
+    TransferBuffer &operator=(TransferBuffer &&other);
+    TransferBuffer(const TransferBuffer &) = delete;
+    TransferBuffer &operator=(const TransferBuffer &) = delete;
+
+    // Leases at least `size` bytes, waiting briefly while the budget is
+    // exhausted by other leases. Returns false only when the heap is out.
+    bool Acquire(size_t size);
+    void Release();
+
+    char *data() const { return ptr; }
+    // Bytes requested; the underlying size class may be larger.
+    size_t size() const { return length; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+private:
+    char *ptr = nullptr;
+    size_t length = 0;
+    size_t capacity = 0;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef NEO_BYTE_SINK_H
+#define NEO_BYTE_SINK_H
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+// Destination of bytes read from a remote file (RemoteReader::StreamTo()).
+// Writes may come at any offset and, from ranges read in parallel, from
+// several threads at once. LocalFileSink is the one for a flat file or
+// split parts on the card, and digests what it writes when asked to.
+class ByteSink
+{
+public:
+    virtual ~ByteSink() {}
+    // False stops the read, e.g. on a full card.
+    virtual bool WriteAt(uint64_t offset, const void *data, size_t size) = 0;
+};
+
+// Into `capacity` bytes at `data` (a TransferBuffer, say), for an image
+// or another small file read whole. Writes past the end fail, so a file
+// larger than expected stops the read instead of overrunning it.
+class MemorySink : public ByteSink
+{
+public:
+    MemorySink(char *data, size_t capacity) : data(data), capacity(capacity) {}
+
+    bool WriteAt(uint64_t offset, const void *bytes, size_t size) override
+    {
+        if (offset > capacity || size > capacity - offset)
+            return false;
+        memcpy(data + offset, bytes, size);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (offset + size > end)
+            end = (size_t)(offset + size);
+        return true;
+    }
+
+    // Where the furthest write ended.
+    size_t Size() const { return end; }
+
+private:
+    char *data;
+    size_t capacity;
+    std::mutex mutex;
+    size_t end = 0;
+};
+
+#endif
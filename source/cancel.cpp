@@ -0,0 +1,74 @@
+#include <map>
+#include <mutex>
+
+#include "cancel.h"
+
+extern bool stop_activity;
+
+namespace
+{
+    struct Entry
+    {
+        bool *flag;
+        Cancel::Hook hook;
+    };
+
+    // Held while hooks run, so Remove() never returns with one running.
+    std::mutex hooks_mutex;
+    std::map<int, Entry> hooks;
+    int last_id = 0;
+
+    thread_local bool *bound = nullptr;
+}
+
+namespace Cancel
+{
+    bool *Flag()
+    {
+        return bound != nullptr ? bound : &stop_activity;
+    }
+
+    bool Stopped()
+    {
+        return *Flag();
+    }
+
+    void Bind(bool *flag)
+    {
+        bound = flag;
+    }
+
+    void Request(bool *flag)
+    {
+        if (flag == nullptr)
+            flag = &stop_activity;
+        std::lock_guard<std::mutex> lock(hooks_mutex);
+        *flag = true;
+        for (auto &entry : hooks)
+        {
+            if (entry.second.flag == flag)
+                entry.second.hook();
+        }
+    }
+
+    int Add(const Hook &hook)
+    {
+        std::lock_guard<std::mutex> lock(hooks_mutex);
+        int id = ++last_id;
+        if (id <= 0)
+            id = last_id = 1;
+        bool *flag = Flag();
+        hooks[id] = {flag, hook};
+        if (*flag)
+            hook();
+        return id;
+    }
+
+    void Remove(int id)
+    {
+        if (id == 0)
+            return;
+        std::lock_guard<std::mutex> lock(hooks_mutex);
+        hooks.erase(id);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef NEO_CANCEL_H
+#define NEO_CANCEL_H
+
+#include <functional>
+
+// Cancelling the running activity. Each thread polls one flag, Stopped():
+// stop_activity unless the thread was bound to another one, as the
+// background download queue binds its coordinator to a flag of its own so
+// that cancelling a modal copy, delete or upload leaves it running. A
+// thread made with Threads::Create polls the flag of the thread that made
+// it. Request() also wakes what cannot poll while it waits on the network.
+// An engine adds a hook for as long as it sits in such a wait (a blocking
+// recv() on an FTP data connection, a curl multi poll) and the hooks of the
+// cancelled flag run on the cancelling thread, so Cancel takes effect at
+// once instead of after the next chunk.
+namespace Cancel
+{
+    typedef std::function<void()> Hook;
+
+    // The flag the calling thread polls.
+    bool *Flag();
+    // The calling thread's flag is set.
+    bool Stopped();
+    // Makes `flag` the calling thread's; nullptr goes back to
+    // stop_activity.
+    void Bind(bool *flag);
+
+    // Sets `flag` (stop_activity when nullptr) and runs the hooks added
+    // under it so far.
+    void Request(bool *flag = nullptr);
+    // Adds `hook` under the calling thread's flag until Remove(), running
+    // it at once when a cancel is already pending. Returns its id, never 0.
+    int Add(const Hook &hook);
+    // Removes hook `id` (0 is ignored), waiting for it when it is running.
+    void Remove(int id);
+}
+
+#endif
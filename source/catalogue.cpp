@@ -0,0 +1,665 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "catalogue.h"
+#include "fs.h"
+#include "lang.h"
+#include "logger.h"
+#include "util.h"
+#include "listing_kernels.h"
+
+namespace Catalogue
+{
+    namespace
+    {
+        const char kMagic[8] = {'N', 'E', 'O', 'C', 'A', 'T', 0, 0};
+        const uint32_t kVersion = 1;
+        const uint32_t kDir = 1;
+        const uint32_t kLink = 2;
+
+        // All offsets count from the start of the file, names from the start
+        // of their pool.
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t folders;
+            uint32_t entries;
+            uint32_t namesBytes;
+            uint32_t lowerBytes;
+            uint32_t root;
+            uint64_t built;
+        };
+
+        struct FolderRecord
+        {
+            uint32_t path;
+            uint32_t validator;
+            uint32_t first;
+            uint32_t count;
+            // The folder's date in its parent's listing, packed; 0 unknown.
+            uint64_t modified;
+        };
+
+        struct EntryRecord
+        {
+            uint32_t name;
+            uint32_t lower;
+            uint32_t folder;
+            uint32_t flags;
+            uint64_t size;
+            uint64_t modified;
+        };
+
+        uint64_t Pack(const DateTime &d)
+        {
+            return ((uint64_t)d.year << 40) | ((uint64_t)d.month << 32) | ((uint64_t)d.day << 24) |
+                   ((uint64_t)d.hours << 16) | ((uint64_t)d.minutes << 8) | d.seconds;
+        }
+
+        DateTime Unpack(uint64_t packed)
+        {
+            DateTime d;
+            memset(&d, 0, sizeof(d));
+            d.year = (uint16_t)(packed >> 40);
+            d.month = (uint8_t)(packed >> 32);
+            d.day = (uint8_t)(packed >> 24);
+            d.hours = (uint8_t)(packed >> 16);
+            d.minutes = (uint8_t)(packed >> 8);
+            d.seconds = (uint8_t)packed;
+            return d;
+        }
+
+        std::string JoinPath(const std::string &folder, const char *name)
+        {
+            return folder + (!folder.empty() && folder.back() == '/' ? "" : "/") + name;
+        }
+
+        std::string Normalize(const std::string &path)
+        {
+            std::string out = path.empty() ? "/" : path;
+            while (out.size() > 1 && out.back() == '/')
+                out.pop_back();
+            return out;
+        }
+
+        std::string FileFor(const std::string &site)
+        {
+            // FNV-1a
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            for (unsigned char c : site)
+            {
+                hash ^= c;
+                hash *= 0x100000001b3ULL;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "/%016llx.cat", (unsigned long long)hash);
+            return CATALOGUE_PATH + std::string(name);
+        }
+
+        // A catalogue file in memory, used where it lies.
+        class Image
+        {
+        public:
+            bool Load(const std::string &file)
+            {
+                data.clear();
+                header = nullptr;
+                int fd = open(file.c_str(), O_RDONLY);
+                if (fd < 0)
+                    return false;
+                struct stat st;
+                bool ok = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header);
+                if (ok)
+                {
+                    data.resize((size_t)st.st_size);
+                    size_t done = 0;
+                    while (ok && done < data.size())
+                    {
+                        ssize_t got = read(fd, data.data() + done, data.size() - done);
+                        ok = got > 0;
+                        done += ok ? (size_t)got : 0;
+                    }
+                }
+                close(fd);
+                if (!ok || !Map())
+                {
+                    data.clear();
+                    return false;
+                }
+                return true;
+            }
+
+            void Take(std::vector<char> &&bytes)
+            {
+                data = std::move(bytes);
+                if (!Map())
+                    data.clear();
+            }
+
+            bool Valid() const { return header != nullptr; }
+            const Header &Head() const { return *header; }
+            const char *Str(uint32_t offset) const { return names + offset; }
+            std::string Root() const { return Str(header->root); }
+            size_t Bytes() const { return data.size(); }
+
+            const FolderRecord *Find(const std::string &path) const
+            {
+                const FolderRecord *end = folders + header->folders;
+                const FolderRecord *it = std::lower_bound(folders, end, path, [this](const FolderRecord &f, const std::string &p)
+                                                          { return strcmp(Str(f.path), p.c_str()) < 0; });
+                return it != end && path == Str(it->path) ? it : nullptr;
+            }
+
+            void Get(uint32_t index, DirEntry &out) const
+            {
+                const EntryRecord &e = entries[index];
+                const char *folder = Str(folders[e.folder].path);
+                memset(&out, 0, sizeof(out));
+                snprintf(out.directory, sizeof(out.directory), "%s", folder);
+                snprintf(out.name, sizeof(out.name), "%s", Str(e.name));
+                snprintf(out.path, sizeof(out.path), "%s", JoinPath(folder, out.name).c_str());
+                out.isDir = (e.flags & kDir) != 0;
+                out.isLink = (e.flags & kLink) != 0;
+                out.selectable = true;
+                out.file_size = e.size;
+                out.modified = Unpack(e.modified);
+                if (out.isDir)
+                    snprintf(out.display_size, sizeof(out.display_size), "%s", lang_strings[STR_FOLDER]);
+                else
+                    DirEntry::SetDisplaySize(&out);
+            }
+
+            void Append(const FolderRecord &folder, std::vector<DirEntry> &out) const
+            {
+                size_t start = out.size();
+                out.resize(start + folder.count);
+                for (uint32_t i = 0; i < folder.count; i++)
+                    Get(folder.first + i, out[start + i]);
+            }
+
+            // Folder indices of `path` itself (kNoFolder when it has no
+            // record) and [first, last) of everything below it. "a" sorts
+            // before "a-b" before "a/b", so those are two runs.
+            void Range(const std::string &path, uint32_t &self, uint32_t &first, uint32_t &last) const
+            {
+                self = kNoFolder;
+                if (path == "/")
+                {
+                    first = 0;
+                    last = header->folders;
+                    return;
+                }
+                const FolderRecord *end = folders + header->folders;
+                auto before = [this](const FolderRecord &f, const std::string &p)
+                { return strcmp(Str(f.path), p.c_str()) < 0; };
+                const FolderRecord *own = std::lower_bound(folders, end, path, before);
+                const FolderRecord *below = std::lower_bound(folders, end, path + "/", before);
+                const FolderRecord *after = std::lower_bound(folders, end, path + "0", before);
+                first = (uint32_t)(below - folders);
+                last = (uint32_t)(after - folders);
+                if (own != end && path == Str(own->path))
+                {
+                    if (own + 1 == below)
+                        first--;
+                    else
+                        self = (uint32_t)(own - folders);
+                }
+            }
+
+            size_t Search(const std::string &path, const std::string &query, size_t limit, std::vector<DirEntry> &out) const
+            {
+                uint32_t self, first, last;
+                Range(path, self, first, last);
+                bool prefix = !query.empty() && query[0] == '^';
+                std::string needle = Util::ToLower(prefix ? query.substr(1) : query);
+                if (needle.empty())
+                    return 0;
+
+                auto wanted = [&](uint32_t index)
+                {
+                    uint32_t folder = entries[index].folder;
+                    return (folder >= first && folder < last) || folder == self;
+                };
+                size_t matched = 0;
+                auto take = [&](uint32_t index)
+                {
+                    if (!wanted(index))
+                        return;
+                    if (out.size() < limit)
+                    {
+                        out.emplace_back();
+                        Get(index, out.back());
+                    }
+                    matched++;
+                };
+
+                if (prefix)
+                {
+                    const uint32_t *end = byName + header->entries;
+                    const uint32_t *it = std::lower_bound(byName, end, needle, [this](uint32_t i, const std::string &n)
+                                                          { return strcmp(lower + entries[i].lower, n.c_str()) < 0; });
+                    for (; it != end && strncmp(lower + entries[*it].lower, needle.c_str(), needle.size()) == 0; it++)
+                        take(*it);
+                    return matched;
+                }
+
+                // Entries of a folder run are contiguous, and so are their
+                // lowercased names.
+                auto scan = [&](uint32_t from, uint32_t to)
+                {
+                    if (from >= to)
+                        return;
+                    uint32_t e0 = folders[from].first;
+                    uint32_t e1 = folders[to - 1].first + folders[to - 1].count;
+                    if (e0 >= e1)
+                        return;
+                    const char *cursor = lower + entries[e0].lower;
+                    const char *stop = e1 < header->entries ? lower + entries[e1].lower : lower + header->lowerBytes;
+                    while (cursor < stop)
+                    {
+                        const char *hit = (const char *)memmem(cursor, stop - cursor, needle.data(), needle.size());
+                        if (hit == nullptr)
+                            break;
+                        // Names are NUL-separated, so a hit lies within one.
+                        const EntryRecord *end = entries + e1;
+                        const EntryRecord *it = std::upper_bound(entries + e0, end, (uint32_t)(hit - lower),
+                                                                 [](uint32_t offset, const EntryRecord &e)
+                                                                 { return offset < e.lower; });
+                        uint32_t index = (uint32_t)(it - entries) - 1;
+                        take(index);
+                        cursor = lower + entries[index].lower + strlen(lower + entries[index].lower) + 1;
+                    }
+                };
+                if (self != kNoFolder)
+                    scan(self, self + 1);
+                scan(first, last);
+                return matched;
+            }
+
+        private:
+            static const uint32_t kNoFolder = 0xFFFFFFFFU;
+            std::vector<char> data;
+            const Header *header = nullptr;
+            const FolderRecord *folders = nullptr;
+            const EntryRecord *entries = nullptr;
+            const uint32_t *byName = nullptr;
+            const char *names = nullptr;
+            const char *lower = nullptr;
+
+            bool Map()
+            {
+                header = nullptr;
+                if (data.size() < sizeof(Header))
+                    return false;
+                const Header *h = (const Header *)data.data();
+                if (memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 || h->version != kVersion)
+                    return false;
+                uint64_t need = sizeof(Header) + (uint64_t)h->folders * sizeof(FolderRecord) +
+                                (uint64_t)h->entries * (sizeof(EntryRecord) + sizeof(uint32_t)) + h->namesBytes +
+                                h->lowerBytes;
+                if (need != data.size() || h->namesBytes == 0 || h->root >= h->namesBytes)
+                    return false;
+                const char *p = data.data() + sizeof(Header);
+                folders = (const FolderRecord *)p;
+                p += h->folders * sizeof(FolderRecord);
+                entries = (const EntryRecord *)p;
+                p += h->entries * sizeof(EntryRecord);
+                byName = (const uint32_t *)p;
+                p += h->entries * sizeof(uint32_t);
+                names = p;
+                lower = p + h->namesBytes;
+                if (names[h->namesBytes - 1] != '\0' || (h->lowerBytes > 0 && lower[h->lowerBytes - 1] != '\0'))
+                    return false;
+                header = h;
+                return true;
+            }
+        };
+
+        struct BuiltEntry
+        {
+            uint32_t name;
+            uint32_t flags;
+            uint64_t size;
+            uint64_t modified;
+        };
+
+        struct BuiltFolder
+        {
+            std::string path;
+            std::string validator;
+            uint64_t modified = 0;
+            std::vector<char> names;
+            std::vector<BuiltEntry> entries;
+
+            void Add(const DirEntry &entry)
+            {
+                BuiltEntry e;
+                e.name = (uint32_t)names.size();
+                names.insert(names.end(), entry.name, entry.name + strlen(entry.name) + 1);
+                e.flags = (entry.isDir ? kDir : 0) | (entry.isLink ? kLink : 0);
+                e.size = entry.file_size;
+                e.modified = Pack(entry.modified);
+                entries.push_back(e);
+            }
+        };
+
+        // The tree as it is crawled; Visit() runs on every crawl worker.
+        struct Builder
+        {
+            const Image *old = nullptr;
+            const FolderSize::ListFn *list = nullptr;
+            const ValidatorFn *validator = nullptr;
+            std::mutex mutex;
+            std::vector<BuiltFolder> folders;
+            // Dates of folders as their parents were listed in this pass.
+            std::unordered_map<std::string, uint64_t> dates;
+            int listed = 0;
+            int reused = 0;
+
+            bool Visit(int worker, const std::string &path, std::vector<DirEntry> &entries)
+            {
+                const FolderRecord *prev = old != nullptr && old->Valid() ? old->Find(path) : nullptr;
+                std::string token;
+                bool has_token = *validator && (*validator)(worker, path, token) && !token.empty();
+                uint64_t date = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto it = dates.find(path);
+                    if (it != dates.end())
+                        date = it->second;
+                }
+
+                bool reuse = false;
+                if (prev != nullptr)
+                    reuse = has_token ? token == old->Str(prev->validator) : date != 0 && date == prev->modified;
+                if (reuse)
+                    old->Append(*prev, entries);
+                else if (!(*list)(worker, path, entries))
+                    return false;
+
+                BuiltFolder folder;
+                folder.path = path;
+                folder.validator = has_token ? token : "";
+                folder.modified = date;
+                std::vector<std::pair<std::string, uint64_t>> children;
+                for (const DirEntry &entry : entries)
+                {
+                    if (strcmp(entry.name, "..") == 0)
+                        continue;
+                    folder.Add(entry);
+                    // A reused folder's children have their dates from last
+                    // time, which proves nothing about them.
+                    if (entry.isDir && !reuse)
+                        children.emplace_back(Normalize(entry.path), Pack(entry.modified));
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &child : children)
+                    dates[child.first] = child.second;
+                folders.push_back(std::move(folder));
+                if (reuse)
+                    reused++;
+                else
+                    listed++;
+                return true;
+            }
+
+            // Takes a recursive listing's batch; folders are keyed by the
+            // entries' directory.
+            void AddTree(const std::vector<DirEntry> &batch, std::unordered_map<std::string, size_t> &by_path)
+            {
+                for (const DirEntry &entry : batch)
+                {
+                    if (strcmp(entry.name, "..") == 0)
+                        continue;
+                    std::string dir = Normalize(entry.directory);
+                    auto it = by_path.find(dir);
+                    if (it == by_path.end())
+                    {
+                        it = by_path.emplace(dir, folders.size()).first;
+                        folders.emplace_back();
+                        folders.back().path = dir;
+                    }
+                    folders[it->second].Add(entry);
+                    if (entry.isDir && by_path.find(Normalize(entry.path)) == by_path.end())
+                    {
+                        by_path.emplace(Normalize(entry.path), folders.size());
+                        folders.emplace_back();
+                        folders.back().path = Normalize(entry.path);
+                        folders.back().modified = Pack(entry.modified);
+                    }
+                }
+            }
+
+            std::vector<char> Serialize(const std::string &root)
+            {
+                std::sort(folders.begin(), folders.end(), [](const BuiltFolder &a, const BuiltFolder &b)
+                          { return a.path < b.path; });
+                std::vector<char> names;
+                std::vector<char> lower;
+                auto store = [&names](const std::string &text)
+                {
+                    uint32_t offset = (uint32_t)names.size();
+                    names.insert(names.end(), text.c_str(), text.c_str() + text.size() + 1);
+                    return offset;
+                };
+
+                Header header;
+                memset(&header, 0, sizeof(header));
+                memcpy(header.magic, kMagic, sizeof(kMagic));
+                header.version = kVersion;
+                header.root = store(root);
+                header.built = (uint64_t)time(nullptr);
+
+                std::vector<FolderRecord> folder_records(folders.size());
+                std::vector<EntryRecord> entry_records;
+                for (size_t i = 0; i < folders.size(); i++)
+                {
+                    BuiltFolder &folder = folders[i];
+                    FolderRecord &record = folder_records[i];
+                    record.path = store(folder.path);
+                    record.validator = store(folder.validator);
+                    record.first = (uint32_t)entry_records.size();
+                    record.count = (uint32_t)folder.entries.size();
+                    record.modified = folder.modified;
+                    for (const BuiltEntry &e : folder.entries)
+                    {
+                        EntryRecord out;
+                        const char *name = folder.names.data() + e.name;
+                        out.name = store(name);
+                        out.lower = (uint32_t)lower.size();
+                        size_t length = strlen(name);
+                        lower.resize(lower.size() + length + 1);
+                        ListingKernels::FoldLower(name, length, &lower[out.lower]);
+                        lower.back() = '\0';
+                        out.folder = (uint32_t)i;
+                        out.flags = e.flags;
+                        out.size = e.size;
+                        out.modified = e.modified;
+                        entry_records.push_back(out);
+                    }
+                    // Built folders are not needed once copied.
+                    std::vector<char>().swap(folder.names);
+                    std::vector<BuiltEntry>().swap(folder.entries);
+                }
+
+                std::vector<uint32_t> by_name(entry_records.size());
+                for (size_t i = 0; i < by_name.size(); i++)
+                    by_name[i] = (uint32_t)i;
+                std::sort(by_name.begin(), by_name.end(), [&](uint32_t a, uint32_t b)
+                          { return strcmp(lower.data() + entry_records[a].lower, lower.data() + entry_records[b].lower) < 0; });
+
+                header.folders = (uint32_t)folder_records.size();
+                header.entries = (uint32_t)entry_records.size();
+                header.namesBytes = (uint32_t)names.size();
+                header.lowerBytes = (uint32_t)lower.size();
+
+                std::vector<char> out;
+                out.reserve(sizeof(header) + folder_records.size() * sizeof(FolderRecord) +
+                            entry_records.size() * (sizeof(EntryRecord) + sizeof(uint32_t)) + names.size() + lower.size());
+                auto put = [&out](const void *data, size_t size)
+                { out.insert(out.end(), (const char *)data, (const char *)data + size); };
+                put(&header, sizeof(header));
+                put(folder_records.data(), folder_records.size() * sizeof(FolderRecord));
+                put(entry_records.data(), entry_records.size() * sizeof(EntryRecord));
+                put(by_name.data(), by_name.size() * sizeof(uint32_t));
+                put(names.data(), names.size());
+                put(lower.data(), lower.size());
+                return out;
+            }
+        };
+
+        std::mutex loaded_mutex;
+        std::string loaded_site;
+        // Whether loading `loaded_site` was tried, so a site without a
+        // catalogue does not hit the card on every search.
+        bool loaded_tried = false;
+        Image loaded;
+
+        // Only with loaded_mutex held.
+        const Image &Use(const std::string &site)
+        {
+            if (!loaded_tried || site != loaded_site)
+            {
+                loaded_site = site;
+                loaded_tried = true;
+                loaded.Load(FileFor(site));
+            }
+            return loaded;
+        }
+
+        bool Save(const std::string &file, const std::vector<char> &data)
+        {
+            FS::MkDirs(CATALOGUE_PATH);
+            std::string tmp = file + ".tmp";
+            FILE *out = FS::Create(tmp);
+            if (out == nullptr)
+                return false;
+            bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+            ok = fclose(out) == 0 && ok;
+            if (!ok)
+            {
+                FS::Rm(tmp);
+                return false;
+            }
+            FS::Rm(file);
+            return FS::Rename(tmp, file);
+        }
+    }
+
+    bool Build(const std::string &site, const std::string &root, int workers, const TreeFn &tree,
+               const FolderSize::ListFn &list, const ValidatorFn &validator, FolderSize::Progress &progress,
+               const FolderSize::JoinFn &join)
+    {
+        uint64_t started = Util::GetTick();
+        std::string top = Normalize(root);
+        std::string file = FileFor(site);
+        Image old;
+        old.Load(file);
+
+        Builder builder;
+        builder.list = &list;
+        builder.validator = &validator;
+        // A catalogue of another root shares no folders worth checking.
+        if (old.Valid() && old.Root() == top)
+            builder.old = &old;
+
+        std::unordered_map<std::string, size_t> by_path;
+        by_path.emplace(top, 0);
+        builder.folders.emplace_back();
+        builder.folders.back().path = top;
+        bool ok = tree && tree([&](const std::vector<DirEntry> &batch)
+                               {
+                                   builder.AddTree(batch, by_path);
+                                   for (const DirEntry &entry : batch)
+                                       progress.Add(entry);
+                                   return !progress.cancel;
+                               });
+        if (!ok && !progress.cancel)
+        {
+            by_path.clear();
+            builder.folders.clear();
+            progress.Reset();
+            ok = FolderSize::Walk(
+                top, workers, Threads::ROLE_NETWORK,
+                [&builder](int worker, const std::string &path, std::vector<DirEntry> &entries)
+                { return builder.Visit(worker, Normalize(path), entries); },
+                progress, join);
+        }
+        else
+            builder.listed = 1;
+        if (!ok || progress.cancel)
+        {
+            Logger::Logf(Logger::LOG_WARN, "CATALOGUE site=%s root=%s failed cancelled=%d", site.c_str(), top.c_str(),
+                         progress.cancel ? 1 : 0);
+            return false;
+        }
+
+        std::vector<char> data = builder.Serialize(top);
+        bool saved = Save(file, data);
+        Logger::Logf(saved ? Logger::LOG_INFO : Logger::LOG_ERROR,
+                     "CATALOGUE site=%s root=%s folders=%zu entries=%lld listed=%d reused=%d bytes=%zu ms=%llu saved=%d",
+                     site.c_str(), top.c_str(), builder.folders.size(),
+                     (long long)(progress.files + progress.folders), builder.listed, builder.reused, data.size(),
+                     (unsigned long long)((Util::GetTick() - started) / 1000), saved ? 1 : 0);
+
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        loaded_site = site;
+        loaded_tried = true;
+        loaded.Take(std::move(data));
+        return saved;
+    }
+
+    bool Covers(const std::string &site, const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        const Image &image = Use(site);
+        if (!image.Valid())
+            return false;
+        std::string root = image.Root();
+        std::string folder = Normalize(path);
+        return root == "/" || folder == root || folder.compare(0, root.size() + 1, root + "/") == 0;
+    }
+
+    size_t Search(const std::string &site, const std::string &path, const std::string &query, size_t limit,
+                  std::vector<DirEntry> &out)
+    {
+        uint64_t started = Util::GetTick();
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        const Image &image = Use(site);
+        if (!image.Valid())
+            return 0;
+        size_t matched = image.Search(Normalize(path), query, limit, out);
+        Logger::Logf(Logger::LOG_DEBUG, "CATALOGUE search path=%s query=%s matched=%zu us=%llu", path.c_str(),
+                     query.c_str(), matched, (unsigned long long)(Util::GetTick() - started));
+        return matched;
+    }
+
+    bool Info(const std::string &site, std::string &root, time_t &built, uint32_t &entries)
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        const Image &image = Use(site);
+        if (!image.Valid())
+            return false;
+        root = image.Root();
+        built = (time_t)image.Head().built;
+        entries = image.Head().entries;
+        return true;
+    }
+
+    void Unload()
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        loaded = Image();
+        loaded_site.clear();
+        loaded_tried = false;
+    }
+}
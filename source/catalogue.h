@@ -0,0 +1,61 @@
+#ifndef NEO_CATALOGUE_H
+#define NEO_CATALOGUE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "config.h"
+#include "folder_size.h"
+#include "clients/remote_client.h"
+
+#define CATALOGUE_PATH DATA_PATH "/catalogues"
+
+// An offline catalogue of a remote folder tree, so the filter box can find
+// a file anywhere below the folder on screen without a request. The tree is
+// crawled once, by the folder size workers or with one recursive listing,
+// and kept under CATALOGUE_PATH, one file per site. The file is a position
+// independent image, header, folder and entry arrays, a name index and the
+// string pools, usable in place once read; names are stored lowercased a
+// second time in entry order, so a substring search is one memmem() over
+// that pool and a prefix search a binary search of the name index.
+//
+// Building it again revisits only what may have changed: a folder whose
+// WebDAV validator is the same as last time, or whose date in its freshly
+// listed parent is, keeps the entries it had.
+namespace Catalogue
+{
+    // Fetches the validator of `path` for worker `worker`, as
+    // RemoteClient::GetDirValidator(). False when the protocol has none.
+    using ValidatorFn = std::function<bool(int worker, const std::string &path, std::string &validator)>;
+    // Streams the whole tree in one go, as RemoteClient::ListTree(); false
+    // when it cannot, and the tree is crawled instead.
+    using TreeFn = std::function<bool(const DirEntryBatchFn &on_batch)>;
+
+    // Catalogues `root` of `site` and stores it, replacing the site's
+    // previous catalogue. `list`, `validator` and `join` work as for
+    // FolderSize::Walk() on `workers` threads; `tree` is tried first.
+    // Returns false when the crawl failed or was cancelled, leaving the
+    // previous catalogue as it was.
+    bool Build(const std::string &site, const std::string &root, int workers, const TreeFn &tree,
+               const FolderSize::ListFn &list, const ValidatorFn &validator, FolderSize::Progress &progress,
+               const FolderSize::JoinFn &join);
+
+    // The catalogue of `site`, read from the card on first use, holds
+    // `path`.
+    bool Covers(const std::string &site, const std::string &path);
+    // Entries below `path` whose name contains `query`, ignoring case, or
+    // starts with it when `query` begins with '^'. Up to `limit` of them go
+    // to `out`; returns how many matched.
+    size_t Search(const std::string &site, const std::string &path, const std::string &query, size_t limit,
+                  std::vector<DirEntry> &out);
+    // Root, build time and size of the catalogue of `site`. False when it
+    // has none.
+    bool Info(const std::string &site, std::string &root, time_t &built, uint32_t &entries);
+    // Drops the catalogue held in memory, e.g. on disconnect.
+    void Unload();
+}
+
+#endif
@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+#include <mbedtls/md.h>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "checksum.h"
+#include "util.h"
+
+namespace
+{
+    const size_t kReadBackSize = 1024 * 1024;
+
+    int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    bool DecodeHex(const std::string &text, std::vector<uint8_t> &out)
+    {
+        if (text.empty() || text.size() % 2 != 0)
+            return false;
+        out.clear();
+        for (size_t i = 0; i < text.size(); i += 2)
+        {
+            int hi = HexValue(text[i]);
+            int lo = HexValue(text[i + 1]);
+            if (hi < 0 || lo < 0)
+                return false;
+            out.push_back((uint8_t)(hi << 4 | lo));
+        }
+        return true;
+    }
+
+    bool DecodeBase64(const std::string &text, std::vector<uint8_t> &out)
+    {
+        static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        out.clear();
+        uint32_t bits = 0;
+        int count = 0;
+        for (char c : text)
+        {
+            if (c == '=')
+                break;
+            const char *pos = strchr(kAlphabet, c);
+            if (c == '\0' || pos == nullptr)
+                return false;
+            bits = (bits << 6) | (uint32_t)(pos - kAlphabet);
+            count += 6;
+            if (count >= 8)
+            {
+                count -= 8;
+                out.push_back((uint8_t)(bits >> count));
+            }
+        }
+        return !out.empty();
+    }
+
+    size_t DigestSize(FileDigest::Algo algo)
+    {
+        switch (algo)
+        {
+        case FileDigest::CRC32:
+        case FileDigest::ADLER32:
+            return 4;
+        case FileDigest::MD5:
+            return 16;
+        case FileDigest::SHA1:
+            return 20;
+        case FileDigest::SHA256:
+            return 32;
+        default:
+            return 0;
+        }
+    }
+
+    // Lower is preferred: the combinable sums verify parallel downloads
+    // without reading the file back.
+    int Preference(FileDigest::Algo algo)
+    {
+        switch (algo)
+        {
+        case FileDigest::CRC32:
+            return 0;
+        case FileDigest::ADLER32:
+            return 1;
+        case FileDigest::SHA256:
+            return 2;
+        case FileDigest::SHA1:
+            return 3;
+        case FileDigest::MD5:
+            return 4;
+        default:
+            return 5;
+        }
+    }
+
+    void Offer(FileDigest &best, FileDigest::Algo algo, const std::vector<uint8_t> &value)
+    {
+        if (value.size() != DigestSize(algo))
+            return;
+        if (!best.Valid() || Preference(algo) < Preference(best.algo))
+        {
+            best.algo = algo;
+            best.value = value;
+        }
+    }
+
+    const mbedtls_md_info_t *MdInfo(FileDigest::Algo algo)
+    {
+        switch (algo)
+        {
+        case FileDigest::MD5:
+            return mbedtls_md_info_from_type(MBEDTLS_MD_MD5);
+        case FileDigest::SHA1:
+            return mbedtls_md_info_from_type(MBEDTLS_MD_SHA1);
+        case FileDigest::SHA256:
+            return mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+        default:
+            return nullptr;
+        }
+    }
+
+    void PutBigEndian(uint32_t value, std::vector<uint8_t> &out)
+    {
+        out.assign({(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value});
+    }
+}
+
+std::string FileDigest::Hex() const
+{
+    static const char kDigits[] = "0123456789abcdef";
+    std::string hex;
+    for (uint8_t b : value)
+    {
+        hex += kDigits[b >> 4];
+        hex += kDigits[b & 0xF];
+    }
+    return hex;
+}
+
+const char *FileDigest::Name(Algo algo)
+{
+    switch (algo)
+    {
+    case CRC32:
+        return "crc32";
+    case ADLER32:
+        return "adler32";
+    case MD5:
+        return "md5";
+    case SHA1:
+        return "sha1";
+    case SHA256:
+        return "sha256";
+    default:
+        return "none";
+    }
+}
+
+FileDigest Checksum::FromHex(FileDigest::Algo algo, const std::string &hex)
+{
+    FileDigest digest;
+    if (DecodeHex(hex, digest.value))
+        digest.algo = algo;
+    else
+        digest.value.clear();
+    return digest;
+}
+
+FileDigest Checksum::FromHeaders(const std::map<std::string, std::string> &lowercase_headers)
+{
+    FileDigest best;
+    std::vector<uint8_t> value;
+
+    auto oc = lowercase_headers.find("oc-checksum");
+    if (oc != lowercase_headers.end())
+    {
+        for (std::string token : Util::Split(oc->second, " "))
+        {
+            Util::Trim(token, " \t\r\n");
+            size_t colon = token.find(':');
+            if (colon == std::string::npos || !DecodeHex(token.substr(colon + 1), value))
+                continue;
+            std::string type = Util::ToLower(token.substr(0, colon));
+            if (type == "sha256")
+                Offer(best, FileDigest::SHA256, value);
+            else if (type == "sha1")
+                Offer(best, FileDigest::SHA1, value);
+            else if (type == "md5")
+                Offer(best, FileDigest::MD5, value);
+            else if (type == "adler32")
+                Offer(best, FileDigest::ADLER32, value);
+            else if (type == "crc32")
+                Offer(best, FileDigest::CRC32, value);
+        }
+    }
+
+    auto digest = lowercase_headers.find("digest");
+    if (digest != lowercase_headers.end())
+    {
+        for (std::string token : Util::Split(digest->second, ","))
+        {
+            Util::Trim(token, " \t\r\n");
+            size_t eq = token.find('=');
+            if (eq == std::string::npos)
+                continue;
+            std::string type = Util::ToLower(token.substr(0, eq));
+            std::string text = token.substr(eq + 1);
+            // RFC 3230: adler32 is hex, the others base64.
+            if (type == "adler32")
+            {
+                if (DecodeHex(text, value))
+                    Offer(best, FileDigest::ADLER32, value);
+                continue;
+            }
+            if (!DecodeBase64(text, value))
+                continue;
+            if (type == "sha-256")
+                Offer(best, FileDigest::SHA256, value);
+            else if (type == "sha")
+                Offer(best, FileDigest::SHA1, value);
+            else if (type == "md5")
+                Offer(best, FileDigest::MD5, value);
+        }
+    }
+    return best;
+}
+
+const char *Checksum::WantDigest()
+{
+    return "adler32;q=1, sha-256;q=0.8, sha;q=0.5, md5;q=0.3";
+}
+
+uint32_t Checksum::Crc32(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+#if defined(__ARM_FEATURE_CRC32)
+    crc = ~crc;
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32d(crc, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0)
+        crc = __crc32b(crc, *p++);
+    return ~crc;
+#else
+    while (size > 0)
+    {
+        uInt take = size > 0x40000000 ? 0x40000000 : (uInt)size;
+        crc = (uint32_t)crc32(crc, p, take);
+        p += take;
+        size -= take;
+    }
+    return crc;
+#endif
+}
+
+ChecksumWriter::ChecksumWriter(FileDigest::Algo algo)
+    : algo(algo)
+{
+    const mbedtls_md_info_t *info = MdInfo(algo);
+    if (!info)
+        return;
+    mbedtls_md_context_t *ctx = new mbedtls_md_context_t;
+    mbedtls_md_init(ctx);
+    if (mbedtls_md_setup(ctx, info, 0) != 0 || mbedtls_md_starts(ctx) != 0)
+    {
+        mbedtls_md_free(ctx);
+        delete ctx;
+        stream_broken = true;
+        return;
+    }
+    md = ctx;
+}
+
+ChecksumWriter::~ChecksumWriter()
+{
+    if (md)
+    {
+        mbedtls_md_context_t *ctx = static_cast<mbedtls_md_context_t *>(md);
+        mbedtls_md_free(ctx);
+        delete ctx;
+    }
+}
+
+uint32_t ChecksumWriter::sum(uint32_t start, const char *data, size_t size) const
+{
+    if (algo == FileDigest::CRC32)
+        return Checksum::Crc32(start, data, size);
+    uLong adler = start;
+    while (size > 0)
+    {
+        uInt take = size > 0x40000000 ? 0x40000000 : (uInt)size;
+        adler = adler32(adler, (const Bytef *)data, take);
+        data += take;
+        size -= take;
+    }
+    return (uint32_t)adler;
+}
+
+uint32_t ChecksumWriter::combine(uint32_t a, uint32_t b, uint64_t b_size) const
+{
+    if (algo == FileDigest::CRC32)
+        return (uint32_t)crc32_combine(a, b, (z_off_t)b_size);
+    return (uint32_t)adler32_combine(a, b, (z_off_t)b_size);
+}
+
+void ChecksumWriter::Update(uint64_t offset, const char *data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    if (combinable())
+    {
+        uint32_t value = sum(algo == FileDigest::CRC32 ? 0 : 1, data, size);
+        // Extend the piece this write continues (the common case: a range
+        // streaming in), so there is about one piece per range.
+        auto open = open_ends.find(offset);
+        if (open != open_ends.end())
+        {
+            Piece &piece = pieces[open->second];
+            size_t index = open->second;
+            open_ends.erase(open);
+            piece.sum = combine(piece.sum, value, size);
+            piece.size += size;
+            piece.seq = seq++;
+            open_ends[piece.offset + piece.size] = index;
+            return;
+        }
+        pieces.push_back({offset, size, value, seq++});
+        open_ends[offset + size] = pieces.size() - 1;
+        return;
+    }
+
+    if (!md || stream_broken)
+        return;
+    mbedtls_md_context_t *ctx = static_cast<mbedtls_md_context_t *>(md);
+    if (offset > stream_end)
+    {
+        stream_broken = true;
+        return;
+    }
+    // A retried request rewrites bytes already hashed; only what lies
+    // beyond them is new.
+    uint64_t skip = stream_end - offset;
+    if (skip >= size)
+        return;
+    mbedtls_md_update(ctx, reinterpret_cast<const unsigned char *>(data + skip), size - skip);
+    stream_end += size - skip;
+}
+
+bool ChecksumWriter::readRange(uint64_t offset, uint64_t size, const ReadFn &read, uint32_t &out) const
+{
+    std::vector<char> buffer(kReadBackSize);
+    uint32_t value = (algo == FileDigest::CRC32) ? 0 : 1;
+    while (size > 0)
+    {
+        size_t take = size > buffer.size() ? buffer.size() : (size_t)size;
+        if (!read(offset, buffer.data(), take))
+            return false;
+        value = sum(value, buffer.data(), take);
+        offset += take;
+        size -= take;
+    }
+    out = value;
+    return true;
+}
+
+bool ChecksumWriter::finalCombined(uint64_t size, const ReadFn &read, FileDigest &out)
+{
+    open_ends.clear();
+    // Newest first among pieces at the same offset: what is on disk.
+    std::sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b)
+              { return a.offset != b.offset ? a.offset < b.offset : a.seq > b.seq; });
+
+    uint32_t total = 0;
+    bool have = false;
+    uint64_t cur = 0;
+    size_t i = 0;
+    while (cur < size)
+    {
+        while (i < pieces.size() && pieces[i].offset < cur)
+            i++;
+        uint32_t value;
+        uint64_t length;
+        if (i < pieces.size() && pieces[i].offset == cur)
+        {
+            length = std::min(pieces[i].size, size - cur);
+            if (length == pieces[i].size)
+                value = pieces[i].sum;
+            else if (!readRange(cur, length, read, value))
+                return false;
+        }
+        else
+        {
+            // Nothing was written here this time; read it back.
+            uint64_t next = (i < pieces.size()) ? pieces[i].offset : size;
+            length = std::min(next, size) - cur;
+            if (!readRange(cur, length, read, value))
+                return false;
+        }
+        total = have ? combine(total, value, length) : value;
+        have = true;
+        cur += length;
+    }
+    if (!have)
+        total = (algo == FileDigest::CRC32) ? 0 : 1;
+
+    out.algo = algo;
+    PutBigEndian(total, out.value);
+    return true;
+}
+
+bool ChecksumWriter::finalStream(uint64_t size, const ReadFn &read, FileDigest &out)
+{
+    const mbedtls_md_info_t *info = MdInfo(algo);
+    if (!info)
+        return false;
+    mbedtls_md_context_t *ctx = static_cast<mbedtls_md_context_t *>(md);
+    mbedtls_md_context_t fresh;
+    bool reread = (ctx == nullptr || stream_broken || stream_end != size);
+    if (reread)
+    {
+        // The writes were not in file order; hash the file once instead.
+        mbedtls_md_init(&fresh);
+        if (mbedtls_md_setup(&fresh, info, 0) != 0 || mbedtls_md_starts(&fresh) != 0)
+        {
+            mbedtls_md_free(&fresh);
+            return false;
+        }
+        ctx = &fresh;
+        std::vector<char> buffer(kReadBackSize);
+        uint64_t offset = 0;
+        while (offset < size)
+        {
+            size_t take = (size - offset) > buffer.size() ? buffer.size() : (size_t)(size - offset);
+            if (!read(offset, buffer.data(), take))
+            {
+                mbedtls_md_free(&fresh);
+                return false;
+            }
+            mbedtls_md_update(ctx, reinterpret_cast<const unsigned char *>(buffer.data()), take);
+            offset += take;
+        }
+    }
+
+    unsigned char digest[MBEDTLS_MD_MAX_SIZE];
+    int rc = mbedtls_md_finish(ctx, digest);
+    if (reread)
+        mbedtls_md_free(&fresh);
+    if (rc != 0)
+        return false;
+    out.algo = algo;
+    out.value.assign(digest, digest + mbedtls_md_get_size(info));
+    return true;
+}
+
+bool ChecksumWriter::Covers(uint64_t size) const
+{
+    if (!combinable())
+        return md != nullptr && !stream_broken && stream_end == size;
+
+    // The walk finalCombined() makes, without the sums.
+    std::vector<Piece> sorted(pieces);
+    std::sort(sorted.begin(), sorted.end(), [](const Piece &a, const Piece &b)
+              { return a.offset != b.offset ? a.offset < b.offset : a.seq > b.seq; });
+    uint64_t cur = 0;
+    size_t i = 0;
+    while (cur < size)
+    {
+        while (i < sorted.size() && sorted[i].offset < cur)
+            i++;
+        if (i == sorted.size() || sorted[i].offset != cur || sorted[i].size > size - cur)
+            return false;
+        cur += sorted[i].size;
+    }
+    return true;
+}
+
+bool ChecksumWriter::Final(uint64_t size, const ReadFn &read, FileDigest &out)
+{
+    if (algo == FileDigest::NONE)
+        return false;
+    if (combinable())
+        return finalCombined(size, read, out);
+    return finalStream(size, read, out);
+}
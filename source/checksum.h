@@ -0,0 +1,105 @@
+#ifndef NEO_CHECKSUM_H
+#define NEO_CHECKSUM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+// A digest of a whole remote file, as the server states it or as computed
+// locally.
+struct FileDigest
+{
+    enum Algo
+    {
+        NONE,
+        CRC32,
+        ADLER32,
+        MD5,
+        SHA1,
+        SHA256
+    };
+
+    Algo algo = NONE;
+    std::vector<uint8_t> value;
+
+    bool Valid() const { return algo != NONE && !value.empty(); }
+    std::string Hex() const;
+    static const char *Name(Algo algo);
+};
+
+namespace Checksum
+{
+    // Strongest digest in the `OC-Checksum` (ownCloud/Nextcloud,
+    // "SHA1:<hex>") or RFC 3230 `Digest` ("sha-256=<base64>") response
+    // headers, keyed by lowercase name; NONE when neither has one we know.
+    FileDigest FromHeaders(const std::map<std::string, std::string> &lowercase_headers);
+
+    // `algo` digest from its hex text, e.g. from a listing; NONE when the
+    // text is not hex.
+    FileDigest FromHex(FileDigest::Algo algo, const std::string &hex);
+
+    // Value for a `Want-Digest` request header listing what we verify.
+    const char *WantDigest();
+
+    // zlib-compatible CRC-32, on the ARMv8 CRC32 instructions when the
+    // target has them.
+    uint32_t Crc32(uint32_t crc, const void *data, size_t size);
+}
+
+// Digest of a file that is written at arbitrary offsets, computed while the
+// data passes through instead of reading the file back afterwards.
+//
+// CRC-32 and Adler-32 are kept per write and combined in offset order at the
+// end (zlib's *_combine), so parallel ranges cost nothing extra. MD5 and the
+// SHAs can only run in file order: they follow the writes while those stay
+// sequential and otherwise fall back to reading the file once. Bytes no
+// write covered (a resumed download's old part) are read back the same way.
+class ChecksumWriter
+{
+public:
+    using ReadFn = std::function<bool(uint64_t offset, char *data, size_t size)>;
+
+    explicit ChecksumWriter(FileDigest::Algo algo);
+    ~ChecksumWriter();
+
+    FileDigest::Algo Algo() const { return algo; }
+
+    // Not thread-safe; LocalFileSink calls it under its checksum lock.
+    void Update(uint64_t offset, const char *data, size_t size);
+    // Digest of [0, size), filling in from `read` what Update() did not see.
+    bool Final(uint64_t size, const ReadFn &read, FileDigest &out);
+    // Whether Final(size) would not need to read anything back.
+    bool Covers(uint64_t size) const;
+
+private:
+    struct Piece
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t sum;
+        // Write order; a rewritten range (a retried request) wins.
+        uint64_t seq;
+    };
+
+    FileDigest::Algo algo;
+    std::vector<Piece> pieces;
+    // Index of the piece ending at each offset.
+    std::unordered_map<uint64_t, size_t> open_ends;
+    uint64_t seq = 0;
+    // In-order digest state (MD5/SHA); `stream_end` is how far it got.
+    void *md = nullptr;
+    uint64_t stream_end = 0;
+    bool stream_broken = false;
+
+    bool combinable() const { return algo == FileDigest::CRC32 || algo == FileDigest::ADLER32; }
+    uint32_t sum(uint32_t start, const char *data, size_t size) const;
+    uint32_t combine(uint32_t a, uint32_t b, uint64_t b_size) const;
+    bool readRange(uint64_t offset, uint64_t size, const ReadFn &read, uint32_t &out) const;
+    bool finalCombined(uint64_t size, const ReadFn &read, FileDigest &out);
+    bool finalStream(uint64_t size, const ReadFn &read, FileDigest &out);
+};
+
+#endif
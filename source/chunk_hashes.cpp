@@ -0,0 +1,317 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <mbedtls/md.h>
+
+#include "chunk_hashes.h"
+#include "transfer_journal.h"
+#include "util.h"
+#include "logger.h"
+
+namespace
+{
+    // Sidecars listing more chunks than this are not read.
+    const size_t kMaxChunks = 1 << 20;
+
+    typedef std::vector<std::vector<uint8_t>> Level;
+
+    // Inner node over `left` and `right`; the prefix keeps an inner node
+    // from ever equalling a leaf.
+    std::vector<uint8_t> Node(const std::vector<uint8_t> &left, const std::vector<uint8_t> &right)
+    {
+        std::vector<uint8_t> input;
+        input.reserve(1 + left.size() + right.size());
+        input.push_back(1);
+        input.insert(input.end(), left.begin(), left.end());
+        input.insert(input.end(), right.begin(), right.end());
+        std::vector<uint8_t> out(32);
+        mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), input.data(), input.size(), out.data());
+        return out;
+    }
+
+    // Every level of the tree over `leaves`, the leaves first.
+    std::vector<Level> Levels(const Level &leaves)
+    {
+        std::vector<Level> levels(1, leaves);
+        while (levels.back().size() > 1)
+        {
+            const Level &below = levels.back();
+            Level above((below.size() + 1) / 2);
+            for (size_t i = 0; i < above.size(); i++)
+                above[i] = 2 * i + 1 < below.size() ? Node(below[2 * i], below[2 * i + 1]) : below[2 * i];
+            levels.push_back(std::move(above));
+        }
+        return levels;
+    }
+
+    // Leaves under node `index` of `level` where `a` and `b` differ.
+    void Diff(const std::vector<Level> &a, const std::vector<Level> &b, size_t level, size_t index,
+              std::vector<size_t> &out)
+    {
+        if (a[level][index] == b[level][index])
+            return;
+        if (level == 0)
+        {
+            out.push_back(index);
+            return;
+        }
+        for (size_t child = index * 2; child < index * 2 + 2 && child < a[level - 1].size(); child++)
+            Diff(a, b, level - 1, child, out);
+    }
+}
+
+ChunkHashTree::ChunkHashTree(int64_t size, int64_t chunk, FileDigest::Algo algo)
+    : size(size > 0 ? size : 0), chunk(chunk > 0 ? chunk : TransferJournal::kBlockSize), algo(algo)
+{
+    size_t count = (size_t)((this->size + this->chunk - 1) / this->chunk);
+    leaves.resize(count);
+    writers.resize(count);
+    covered.assign(count, 0);
+    written.assign(count, 0);
+}
+
+ChunkHashTree::~ChunkHashTree()
+{
+}
+
+int64_t ChunkHashTree::ChunkBytes(size_t index) const
+{
+    return std::min(chunk, size - (int64_t)index * chunk);
+}
+
+bool ChunkHashTree::SetReference(const std::vector<std::vector<uint8_t>> &digests)
+{
+    reference.clear();
+    if (digests.size() != leaves.size() || digests.empty())
+        return false;
+    size_t length = algo == FileDigest::SHA256 ? 32 : algo == FileDigest::SHA1 ? 20 : algo == FileDigest::MD5 ? 16 : 4;
+    for (const std::vector<uint8_t> &digest : digests)
+    {
+        if (digest.size() != length)
+            return false;
+    }
+    reference = digests;
+    return true;
+}
+
+void ChunkHashTree::LoadLeaves(const TransferJournal &journal)
+{
+    if (algo != FileDigest::CRC32 || chunk != TransferJournal::kBlockSize)
+        return;
+    for (size_t i = 0; i < leaves.size() && i < journal.crcs.size(); i++)
+    {
+        uint32_t crc = journal.crcs[i];
+        if (crc != 0)
+            leaves[i] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+    }
+}
+
+void ChunkHashTree::SaveLeaves(TransferJournal &journal) const
+{
+    if (algo != FileDigest::CRC32 || chunk != TransferJournal::kBlockSize)
+        return;
+    journal.crcs.assign(leaves.size(), 0);
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+        const std::vector<uint8_t> &leaf = leaves[i];
+        if (leaf.size() == 4)
+            journal.crcs[i] = (uint32_t)leaf[0] << 24 | (uint32_t)leaf[1] << 16 | (uint32_t)leaf[2] << 8 | leaf[3];
+    }
+}
+
+void ChunkHashTree::Update(uint64_t offset, const char *data, size_t length)
+{
+    for (int64_t at = (int64_t)offset, end = (int64_t)(offset + length); at < end;)
+    {
+        size_t i = (size_t)(at / chunk);
+        if (i >= leaves.size())
+            break;
+        int64_t stop = std::min(end, (int64_t)(i + 1) * chunk);
+        if (!writers[i])
+            writers[i].reset(new ChecksumWriter(algo));
+        // A chunk written again after it was complete is digested anew.
+        leaves[i].clear();
+        writers[i]->Update((uint64_t)(at - (int64_t)i * chunk), data + (at - (int64_t)offset), (size_t)(stop - at));
+        written[i] += stop - at;
+        at = stop;
+    }
+}
+
+bool ChunkHashTree::Digest(size_t index, const ReadFn &read, std::vector<uint8_t> &out)
+{
+    std::unique_ptr<ChecksumWriter> writer(std::move(writers[index]));
+    if (!writer)
+        writer.reset(new ChecksumWriter(algo));
+    uint64_t base = (uint64_t)index * chunk;
+    FileDigest got;
+    if (!writer->Final((uint64_t)ChunkBytes(index),
+                       [&](uint64_t offset, char *data, size_t length)
+                       { return read(base + offset, data, length); },
+                       got))
+        return false;
+    out.swap(got.value);
+    return true;
+}
+
+bool ChunkHashTree::Complete(size_t index, const ReadFn &read)
+{
+    if (!Digest(index, read, leaves[index]))
+    {
+        leaves[index].clear();
+        Logger::Logf(Logger::LOG_WARN, "CHUNK digest failed index=%zu", index);
+        return false;
+    }
+    if (HasReference() && leaves[index] != reference[index])
+        Logger::Logf(Logger::LOG_WARN, "CHUNK bad index=%zu offset=%lld", index, (long long)index * chunk);
+    return true;
+}
+
+void ChunkHashTree::Done(int64_t start, int64_t end)
+{
+    // Never called on to read: Covers() vouches for the writer.
+    static const ReadFn none = [](uint64_t, char *, size_t)
+    { return false; };
+    for (size_t i = (size_t)(start / chunk); i < leaves.size() && (int64_t)i * chunk <= end; i++)
+    {
+        int64_t from = std::max(start, (int64_t)i * chunk);
+        int64_t to = std::min(end + 1, (int64_t)i * chunk + ChunkBytes(i));
+        covered[i] += to - from;
+        if (covered[i] < ChunkBytes(i) || !leaves[i].empty())
+            continue;
+        if (writers[i] && writers[i]->Covers((uint64_t)ChunkBytes(i)))
+            Complete(i, none);
+    }
+}
+
+bool ChunkHashTree::Finish(const ReadFn &read)
+{
+    int deferred = 0;
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+        if (!leaves[i].empty() || (covered[i] < ChunkBytes(i) && !HasReference()))
+            continue;
+        deferred += covered[i] >= ChunkBytes(i) ? 1 : 0;
+        if (!Complete(i, read))
+            return false;
+    }
+    if (deferred > 0)
+        Logger::Logf("CHUNK read back chunks=%d", deferred);
+    return true;
+}
+
+void ChunkHashTree::Restart(const std::vector<Span> &spans)
+{
+    for (const Span &span : spans)
+    {
+        for (size_t i = (size_t)(span.first / chunk); i < leaves.size() && (int64_t)i * chunk < span.second; i++)
+        {
+            leaves[i].clear();
+            writers[i].reset();
+            covered[i] = 0;
+            written[i] = 0;
+        }
+    }
+}
+
+std::vector<uint8_t> ChunkHashTree::Root() const
+{
+    if (leaves.empty())
+        return std::vector<uint8_t>();
+    return Levels(leaves).back()[0];
+}
+
+std::vector<ChunkHashTree::Span> ChunkHashTree::Bad() const
+{
+    std::vector<size_t> bad;
+    if (HasReference())
+    {
+        std::vector<Level> ours = Levels(leaves);
+        std::vector<Level> theirs = Levels(reference);
+        Diff(ours, theirs, ours.size() - 1, 0, bad);
+    }
+    return Merge(bad, chunk, size);
+}
+
+std::vector<ChunkHashTree::Span> ChunkHashTree::SelfCheck(const ReadFn &read)
+{
+    std::vector<size_t> suspects;
+    int rewritten = 0;
+    int unseen = 0;
+    std::vector<uint8_t> disk;
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+        if (leaves[i].empty())
+            unseen++;
+        else if (written[i] > ChunkBytes(i))
+            rewritten++;
+        else
+        {
+            writers[i].reset();
+            if (Digest(i, read, disk) && disk == leaves[i])
+                continue;
+            Logger::Logf(Logger::LOG_WARN, "CHUNK differs on card index=%zu offset=%lld", i, (long long)i * chunk);
+        }
+        suspects.push_back(i);
+    }
+    Logger::Logf("CHUNK self-check chunks=%zu suspects=%zu rewritten=%d unseen=%d", leaves.size(),
+                 suspects.size(), rewritten, unseen);
+    return Merge(suspects, chunk, size);
+}
+
+std::vector<ChunkHashTree::Span> ChunkHashTree::Merge(const std::vector<size_t> &chunks, int64_t chunk, int64_t size)
+{
+    std::vector<Span> spans;
+    for (size_t i : chunks)
+    {
+        int64_t from = (int64_t)i * chunk;
+        int64_t to = std::min(size, from + chunk);
+        if (!spans.empty() && spans.back().second == from)
+            spans.back().second = to;
+        else
+            spans.push_back(Span(from, to));
+    }
+    return spans;
+}
+
+bool ChunkHashTree::ParseList(const std::string &text, FileDigest &whole,
+                              std::vector<std::vector<uint8_t>> &digests, int64_t &chunk)
+{
+    digests.clear();
+    chunk = TransferJournal::kBlockSize;
+    bool sized = false;
+    for (size_t pos = 0; pos < text.size();)
+    {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos)
+            eol = text.size();
+        std::string line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+        Util::Trim(line, " \t\r");
+        if (line.empty())
+            continue;
+        if (line[0] == '#')
+        {
+            char word[16];
+            long long bytes = 0;
+            if (sscanf(line.c_str(), "# %15s %lld", word, &bytes) == 2 && strcmp(word, "chunk") == 0 && bytes > 0)
+            {
+                chunk = bytes;
+                sized = true;
+            }
+            continue;
+        }
+        FileDigest digest = Checksum::FromHex(FileDigest::SHA256, line.substr(0, line.find_first_of(" \t")));
+        if (!digest.Valid() || digest.value.size() != 32 || digests.size() >= kMaxChunks)
+            return false;
+        digests.push_back(digest.value);
+    }
+    if (digests.empty())
+        return false;
+    if (digests.size() == 1 && !sized)
+    {
+        whole.algo = FileDigest::SHA256;
+        whole.value = digests[0];
+        digests.clear();
+    }
+    return true;
+}
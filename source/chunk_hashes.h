@@ -0,0 +1,109 @@
+#ifndef NEO_CHUNK_HASHES_H
+#define NEO_CHUNK_HASHES_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+#include "checksum.h"
+
+class TransferJournal;
+
+// Digests of each fixed-size chunk of a ranged download, kept as the leaves
+// of a Merkle tree (each node the SHA-256 of its two children, an odd node
+// carried up as is). A whole-file digest only says that something in 20 GB
+// is wrong; the leaves say which chunks, so a repair fetches only those.
+//
+// Leaves are digests of what arrived off the network: a ChecksumWriter per
+// chunk follows the writes. A chunk the writer can finish without the card
+// (CRC-32 whenever the ranges tiled it, SHA-256 only when they came in
+// order) gets its leaf as its last range completes, on the multi client's
+// thread. The others are left to Finish(), one pass on the download thread
+// once the ranges are in, so no connection waits for the sink to drain and
+// a chunk to be read back. Against a reference (the "<file>.sha256" list a
+// server publishes) the two trees are compared from the root down, and the
+// chunks under differing nodes are the bad ones. Without one the leaves
+// are CRC-32s, which cost nothing per range and are kept in the journal;
+// once the whole file fails its digest, SelfCheck() compares them with the
+// card. A chunk whose bytes there differ from what arrived, one written
+// more than once (a retried or stolen range) and one an earlier session
+// wrote without a leaf to show for it are the suspects.
+//
+// Not thread-safe; the multi client calls it from its one thread, and the
+// download thread once the multi client has returned.
+class ChunkHashTree
+{
+public:
+    // Half-open byte span, as CHTTPMultiClient takes them.
+    typedef std::pair<int64_t, int64_t> Span;
+    // Reads file offsets back from the card.
+    using ReadFn = ChecksumWriter::ReadFn;
+
+    ChunkHashTree(int64_t size, int64_t chunk, FileDigest::Algo algo);
+    ~ChunkHashTree();
+
+    int64_t ChunkSize() const { return chunk; }
+    FileDigest::Algo Algo() const { return algo; }
+    size_t Count() const { return leaves.size(); }
+
+    // Leaves the server lists; false, keeping none, when they do not cover
+    // the file in this tree's algorithm.
+    bool SetReference(const std::vector<std::vector<uint8_t>> &digests);
+    bool HasReference() const { return !reference.empty(); }
+
+    // CRC-32 leaves of journal blocks, from and back to `journal`; no-ops
+    // for any other tree.
+    void LoadLeaves(const TransferJournal &journal);
+    void SaveLeaves(TransferJournal &journal) const;
+
+    void Update(uint64_t offset, const char *data, size_t size);
+    // Bytes [start, end] are in. Completes the leaves they finish that
+    // need no read-back; a leaf that differs from the reference is logged
+    // at once.
+    void Done(int64_t start, int64_t end);
+    // Completes, reading back from the card, the leaves of chunks this
+    // session fetched that Done() left open, and with a reference also
+    // those of chunks an earlier session fetched. False on a read error.
+    bool Finish(const ReadFn &read);
+    // Drops the leaves under `spans` before they are fetched again.
+    void Restart(const std::vector<Span> &spans);
+
+    // Root over the leaves; a leaf not complete counts as empty.
+    std::vector<uint8_t> Root() const;
+    // Chunks whose leaves are not complete or differ from the reference,
+    // merged into spans; none without a reference.
+    std::vector<Span> Bad() const;
+    // The suspects described above, merged into spans. Reads every chunk
+    // that has a leaf back from the card.
+    std::vector<Span> SelfCheck(const ReadFn &read);
+
+    // Reads a "<file>.sha256" sidecar: one hex SHA-256 per line, optionally
+    // followed by a name as sha256sum writes it, for consecutive chunks of
+    // the size a "# chunk <bytes>" line gives (4 MiB without one). A
+    // single line without a chunk size is the digest of the whole file and
+    // goes to `whole` instead. False when the text is not such a list.
+    static bool ParseList(const std::string &text, FileDigest &whole,
+                          std::vector<std::vector<uint8_t>> &digests, int64_t &chunk);
+
+private:
+    int64_t size;
+    int64_t chunk;
+    FileDigest::Algo algo;
+    // Empty until the chunk is complete.
+    std::vector<std::vector<uint8_t>> leaves;
+    std::vector<std::vector<uint8_t>> reference;
+    std::vector<std::unique_ptr<ChecksumWriter>> writers;
+    // Bytes the completed ranges covered, and bytes written, per chunk.
+    std::vector<int64_t> covered;
+    std::vector<int64_t> written;
+
+    int64_t ChunkBytes(size_t index) const;
+    bool Digest(size_t index, const ReadFn &read, std::vector<uint8_t> &out);
+    // Digest() into the leaf of `index`, logged against the reference.
+    bool Complete(size_t index, const ReadFn &read);
+    static std::vector<Span> Merge(const std::vector<size_t> &chunks, int64_t chunk, int64_t size);
+};
+
+#endif
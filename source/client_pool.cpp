@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "client_pool.h"
+#include "config.h"
+#include "keepalive.h"
+#include "logger.h"
+#include "util.h"
+
+namespace
+{
+    // Used this recently, a client goes out without a probe.
+    const uint64_t kTrustUs = 15ULL * 1000000;
+
+    struct Idle
+    {
+        std::string key;
+        RemoteClient *client;
+        uint64_t releasedAt;
+    };
+
+    std::mutex pool_mutex;
+    std::vector<Idle> pool;
+    // Clients handed out, by the key they go back under.
+    std::map<RemoteClient *, std::string> lent;
+
+    void Disconnect(RemoteClient *client)
+    {
+        client->Quit();
+        delete client;
+    }
+
+    // False when `client` failed its probe.
+    bool Probe(RemoteClient *client, uint64_t interval_us)
+    {
+        return client->IsConnected() && client->KeepAlive(interval_us) != 0;
+    }
+
+    int64_t KeepPoolAlive()
+    {
+        uint64_t interval = KeepAlive::Interval();
+        uint64_t max_unused = (uint64_t)keepalive_pool_seconds * 1000000;
+        std::vector<Idle> due;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            due.swap(pool);
+        }
+
+        // Out of the pool meanwhile, so no worker gets one mid-probe.
+        int64_t next = -1;
+        std::vector<Idle> kept;
+        for (Idle &idle : due)
+        {
+            uint64_t unused = Util::GetTick() - idle.releasedAt;
+            if (unused >= max_unused || !Probe(idle.client, interval))
+            {
+                Logger::Logf(Logger::LOG_DEBUG, "CLIENT POOL retired key=%s unused_s=%llu", idle.key.c_str(),
+                             (unsigned long long)(unused / 1000000));
+                Disconnect(idle.client);
+                continue;
+            }
+            kept.push_back(idle);
+            int64_t wait = (int64_t)std::min(interval, max_unused - unused);
+            if (next < 0 || wait < next)
+                next = wait;
+        }
+
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (Idle &idle : kept)
+        {
+            if ((int)pool.size() < client_pool)
+                pool.push_back(idle);
+            else
+                Disconnect(idle.client);
+        }
+        return pool.empty() ? -1 : next;
+    }
+}
+
+namespace ClientPool
+{
+    std::string Key(const std::string &server, const std::string &user)
+    {
+        return user + "@" + server;
+    }
+
+    RemoteClient *Take(const std::string &key)
+    {
+        while (true)
+        {
+            Idle idle = {"", nullptr, 0};
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                for (size_t i = pool.size(); i-- > 0;)
+                {
+                    if (pool[i].key != key)
+                        continue;
+                    idle = pool[i];
+                    pool.erase(pool.begin() + i);
+                    break;
+                }
+            }
+            if (idle.client == nullptr)
+                return nullptr;
+
+            uint64_t unused = Util::GetTick() - idle.releasedAt;
+            if (unused < kTrustUs || Probe(idle.client, kTrustUs))
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                lent[idle.client] = key;
+                Logger::Logf(Logger::LOG_DEBUG, "CLIENT POOL reuse key=%s idle_ms=%llu", key.c_str(),
+                             (unsigned long long)(unused / 1000));
+                return idle.client;
+            }
+            // The server dropped it meanwhile; try the next one.
+            Disconnect(idle.client);
+        }
+    }
+
+    void Lend(const std::string &key, RemoteClient *client)
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        lent[client] = key;
+    }
+
+    bool Give(RemoteClient *client, bool reusable)
+    {
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            auto it = lent.find(client);
+            if (it == lent.end())
+                return false;
+            std::string key = it->second;
+            lent.erase(it);
+            if (!reusable || !client->IsConnected() || (int)pool.size() >= client_pool)
+                return false;
+            pool.push_back({key, client, Util::GetTick()});
+        }
+        uint64_t interval = KeepAlive::Interval();
+        if (interval > 0)
+            KeepAlive::Schedule("client pool", KeepPoolAlive, interval);
+        return true;
+    }
+
+    void Close()
+    {
+        KeepAlive::Cancel("client pool");
+        std::vector<Idle> idle;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            idle.swap(pool);
+        }
+        for (Idle &entry : idle)
+            Disconnect(entry.client);
+        if (!idle.empty())
+            Logger::Logf("CLIENT POOL closed clients=%d", (int)idle.size());
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef NEO_CLIENT_POOL_H
+#define NEO_CLIENT_POOL_H
+
+#include <string>
+
+#include "clients/remote_client.h"
+
+// Connected WebDAV/HTTP and SFTP clients of the transfer, folder size,
+// catalogue and preview workers, kept between jobs ([Global] client_pool)
+// so the next one to the same site skips Connect(): the session setup, the
+// Ping and, for SFTP, the SSH handshake and login. A client idle for a
+// while is checked with its KeepAlive() probe before it is handed out, and
+// the keep-alive thread probes pooled ones like the FTP sessions and drops
+// those unused for keepalive_pool_seconds. FTP logins have their own pool
+// (FtpClient::AcquireSession).
+namespace ClientPool
+{
+    // `server` and `user` as one pool key.
+    std::string Key(const std::string &server, const std::string &user);
+    // A pooled client connected as `key`, or nullptr when none is left
+    // that passes its check.
+    RemoteClient *Take(const std::string &key);
+    // Records a freshly connected `client` as connected as `key`, so
+    // Give() can pool it.
+    void Lend(const std::string &key, RemoteClient *client);
+    // Takes back a client from Take() or Lend(); without `reusable` (a
+    // transfer on it was cancelled) it is only forgotten. Returns false
+    // when it is not kept (unknown, disconnected, not reusable or the pool
+    // is full); the caller disconnects it then.
+    bool Give(RemoteClient *client, bool reusable);
+    // Disconnects every pooled client, on disconnect.
+    void Close();
+}
+
+#endif
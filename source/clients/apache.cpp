@@ -6,230 +6,176 @@
 #include "clients/apache.h"
 #include "lang.h"
 #include "util.h"
+#include "clients/html_index.h"
 #include "windows.h"
 
-std::vector<DirEntry> ApacheClient::ListDir(const std::string &path)
+// Apache mod_autoindex (FancyIndexing with HTMLTable): <tr><td><img alt="[DIR]"></td>
+// <td><a href="name/">..</a></td><td>date</td><td>size</td>...</tr>
+static int ParseRow(lxb_dom_element_t *element, const std::string &path, DirEntry &entry)
 {
-    CHTTPClient::HeadersMap headers;
-    CHTTPClient::HttpResponse res;
-    std::vector<DirEntry> out;
-    DirEntry entry;
-    memset(&entry, 0, sizeof(DirEntry));
+    const lxb_char_t *value;
+    size_t value_len;
+    std::string tmp_string;
 
-    if (path[path.length() - 1] == '/' && path.length() > 1)
-    {
-        strcpy(entry.directory, path.c_str());
-    }
-    else
-    {
-        sprintf(entry.directory, "%s", path.c_str());
-    }
-    sprintf(entry.name, "..");
-    sprintf(entry.path, "%s", entry.directory);
-    sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
-    entry.file_size = 0;
-    entry.isDir = true;
-    entry.selectable = false;
-    out.push_back(entry);
+    lxb_dom_node_t *node = Util::NextChildElement(element);
+    if (node == nullptr) return 0;
 
-    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
-    if (client->Get(encoded_url, headers, res))
+    value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
+    tmp_string = std::string((const char *)value, value_len);
+
+    if (tmp_string.compare("th") == 0)
+        return 0; // skip th, which are the headers
+
+    // file/folder indicator
+    if (tmp_string.compare("td") == 0)
     {
-        if (HTTP_SUCCESS(res.iCode))
-        {
-            lxb_status_t status;
-            lxb_dom_attr_t *attr;
-            lxb_dom_node_t *node;
-            lxb_dom_element_t *element;
-            lxb_html_document_t *document;
-            lxb_dom_collection_t *collection;
+        // get the child img element
+        lxb_dom_node_t *img = Util::NextChildElement(lxb_dom_interface_element(node));
+        if (img == nullptr) return 0;
 
-            document = lxb_html_document_create();
-            status = lxb_html_document_parse(document, (lxb_char_t *)res.strBody.data(), res.strBody.size());
-            if (status != LXB_STATUS_OK)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
-            collection = lxb_dom_collection_make(&document->dom_document, 128);
-            if (collection == NULL)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
-            status = lxb_dom_elements_by_tag_name(lxb_dom_interface_element(document->body),
-                                                collection, (const lxb_char_t *)"tr", 2);
-            if (status != LXB_STATUS_OK)
+        value = lxb_dom_element_local_name(lxb_dom_interface_element(img), &value_len);
+        tmp_string = std::string((const char *)value, value_len);
+        if (tmp_string.compare("img") == 0)
+        {
+            value = lxb_dom_element_get_attribute(lxb_dom_interface_element(img), (const lxb_char_t *)"alt", 3, &value_len);
+            tmp_string = std::string((const char *)value, value_len);
+            if (tmp_string.compare("[PARENTDIR]") == 0)
+                return 0;
+            else if (tmp_string.compare("[DIR]") == 0)
             {
-                lxb_dom_collection_destroy(collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
+                entry.isDir = true;
+                entry.selectable = true;
+                entry.file_size = 0;
+                sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
             }
-
-            int coll_size = lxb_dom_collection_length(collection);
-            if (coll_size < 1)
+            else
             {
-                lxb_dom_collection_destroy(collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
+                entry.isDir = false;
+                entry.selectable = true;
             }
+        } else return 0; // invalid record
+    }
+    else return 0; // invalid record
+
+    // file/folder name
+    node = Util::NextElement(node);
+    if (node == nullptr) return 0;
+    value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
+    tmp_string = std::string((const char *)value, value_len);
+    if (tmp_string.compare("td") == 0)
+    {
+        // get the child <a> element
+        lxb_dom_node_t *a_node = Util::NextChildElement(lxb_dom_interface_element(node));
+        if (a_node == nullptr) return 0;
 
-            const lxb_char_t *value;
-            size_t value_len;
-            std::string tmp_string;
-            for (size_t i = 0; i < lxb_dom_collection_length(collection); i++)
+        value = lxb_dom_element_local_name(lxb_dom_interface_element(a_node), &value_len);
+        tmp_string = std::string((const char *)value, value_len);
+        if (tmp_string.compare("a") == 0)
+        {
+            value = lxb_dom_element_get_attribute(lxb_dom_interface_element(a_node), (const lxb_char_t *)"href", 4, &value_len);
+            tmp_string = std::string((const char *)value, value_len);
+            tmp_string = Util::Rtrim(tmp_string, "/");
+            tmp_string = BaseClient::UnEscape(tmp_string);
+            if (tmp_string.compare("..") != 0)
             {
-                DirEntry entry;
-                memset(&entry, 0, sizeof(DirEntry));
-
-                element = lxb_dom_collection_element(collection, i);
-                node = Util::NextChildElement(element);
-                if (node == nullptr) continue;
-
-                value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-
-                if (tmp_string.compare("th") == 0)
-                    continue; // skip th, which are the headers
-
-                // file/folder indicator
-                if (tmp_string.compare("td") == 0)
-                {
-                    // get the child img element
-                    lxb_dom_node_t *img = Util::NextChildElement(lxb_dom_interface_element(node));
-                    if (img == nullptr) continue;
-
-                    value = lxb_dom_element_local_name(lxb_dom_interface_element(img), &value_len);
-                    tmp_string = std::string((const char *)value, value_len);
-                    if (tmp_string.compare("img") == 0)
-                    {
-                        value = lxb_dom_element_get_attribute(lxb_dom_interface_element(img), (const lxb_char_t *)"alt", 3, &value_len);
-                        tmp_string = std::string((const char *)value, value_len);
-                        if (tmp_string.compare("[PARENTDIR]") == 0)
-                            continue;
-                        else if (tmp_string.compare("[DIR]") == 0)
-                        {
-                            entry.isDir = true;
-                            entry.selectable = true;
-                            entry.file_size = 0;
-                            sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
-                        }
-                        else
-                        {
-                            entry.isDir = false;
-                            entry.selectable = true;
-                        }
-                    } else continue; // invalid record
-                }
-                else continue; // invalid record
-
-                // file/folder name
-                node = Util::NextElement(node);
-                if (node == nullptr) continue;
-                value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string.compare("td") == 0)
+                sprintf(entry.directory, "%s", path.c_str());
+                sprintf(entry.name, "%s", tmp_string.c_str());
+                if (path.length() > 0 && path[path.length() - 1] == '/')
                 {
-                    // get the child <a> element
-                    lxb_dom_node_t *a_node = Util::NextChildElement(lxb_dom_interface_element(node));
-                    if (a_node == nullptr) continue;
-
-                    value = lxb_dom_element_local_name(lxb_dom_interface_element(a_node), &value_len);
-                    tmp_string = std::string((const char *)value, value_len);
-                    if (tmp_string.compare("a") == 0)
-                    {
-                        value = lxb_dom_element_get_attribute(lxb_dom_interface_element(a_node), (const lxb_char_t *)"href", 4, &value_len);
-                        tmp_string = std::string((const char *)value, value_len);
-                        tmp_string = Util::Rtrim(tmp_string, "/");
-                        tmp_string = BaseClient::UnEscape(tmp_string);
-                        if (tmp_string.compare("..") != 0)
-                        {
-                            sprintf(entry.directory, "%s", path.c_str());
-                            sprintf(entry.name, "%s", tmp_string.c_str());
-                            if (path.length() > 0 && path[path.length() - 1] == '/')
-                            {
-                                sprintf(entry.path, "%s%s", path.c_str(), entry.name);
-                            }
-                            else
-                            {
-                                sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
-                            }
-                        }
-                    }
-                }
-                else continue; // not valid record
-
-                // datetime
-                node = Util::NextElement(node);
-                if (node == nullptr) continue;
-                value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string.compare("td") == 0)
-                {
-                    value = lxb_dom_node_text_content(node, &value_len);
-                    tmp_string = std::string((const char *)value, value_len);
-                    std::vector<std::string> date_time = Util::Split(tmp_string, " ");
-                    if (date_time.size() == 2)
-                    {
-                        std::vector<std::string> adate = Util::Split(date_time[0], "-");
-                        if (adate.size() == 3)
-                        {
-                            entry.modified.year = atoi(adate[0].c_str());
-                            entry.modified.month = atoi(adate[1].c_str());
-                            entry.modified.day = atoi(adate[2].c_str());
-                        }
-
-                        std::vector<std::string> atime = Util::Split(date_time[1], ":");
-                        if (atime.size() == 2)
-                        {
-                            entry.modified.hours = atoi(atime[0].c_str());
-                            entry.modified.minutes = atoi(atime[1].c_str());
-                        }
-                    }
+                    sprintf(entry.path, "%s%s", path.c_str(), entry.name);
                 }
-                else continue; // invalid record
-
-                // filesize
-                node = Util::NextElement(node);
-                if (node == nullptr) continue;
-                value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string.compare("td") == 0)
+                else
                 {
-                    value = lxb_dom_node_text_content(node, &value_len);
-                    tmp_string = std::string((const char *)value, value_len);
-                    tmp_string = Util::Trim(tmp_string, " ");
-                    if (!entry.isDir)
-                    {
-                        char multiplier = tmp_string[tmp_string.length()-1];
-                        std::string filesize = tmp_string.substr(0, tmp_string.length()-1);
-                        sprintf(entry.display_size, "%s", tmp_string.c_str());
-                        if (multiplier == 'K')
-                            entry.file_size = atof(filesize.c_str()) * 1024;
-                        else if (multiplier == 'M')
-                            entry.file_size = atof(filesize.c_str()) * 1024 * 1024;
-                        else if (multiplier == 'G')
-                            entry.file_size = atof(filesize.c_str()) * 1024 * 1024 * 1024;
-                        else if (multiplier == 'G')
-                            entry.file_size = atof(filesize.c_str()) * 1024 * 1024 * 1024 * 1024;
-                        else
-                            entry.file_size = atoi(tmp_string.c_str());
-                    }
+                    sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
                 }
-
-                out.push_back(entry);
+            }
+        }
+    }
+    else return 0; // not valid record
+
+    // datetime
+    node = Util::NextElement(node);
+    if (node == nullptr) return 0;
+    value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
+    tmp_string = std::string((const char *)value, value_len);
+    if (tmp_string.compare("td") == 0)
+    {
+        value = lxb_dom_node_text_content(node, &value_len);
+        tmp_string = std::string((const char *)value, value_len);
+        std::vector<std::string> date_time = Util::Split(tmp_string, " ");
+        if (date_time.size() == 2)
+        {
+            std::vector<std::string> adate = Util::Split(date_time[0], "-");
+            if (adate.size() == 3)
+            {
+                entry.modified.year = atoi(adate[0].c_str());
+                entry.modified.month = atoi(adate[1].c_str());
+                entry.modified.day = atoi(adate[2].c_str());
             }
 
-            lxb_dom_collection_destroy(collection, true);
-            lxb_html_document_destroy(document);
+            std::vector<std::string> atime = Util::Split(date_time[1], ":");
+            if (atime.size() == 2)
+            {
+                entry.modified.hours = atoi(atime[0].c_str());
+                entry.modified.minutes = atoi(atime[1].c_str());
+            }
         }
     }
-    else
+    else return 0; // invalid record
+
+    // filesize
+    node = Util::NextElement(node);
+    if (node == nullptr) return 0;
+    value = lxb_dom_element_local_name(lxb_dom_interface_element(node), &value_len);
+    tmp_string = std::string((const char *)value, value_len);
+    if (tmp_string.compare("td") == 0)
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
-        return out;
+        value = lxb_dom_node_text_content(node, &value_len);
+        tmp_string = std::string((const char *)value, value_len);
+        tmp_string = Util::Trim(tmp_string, " ");
+        if (!entry.isDir)
+        {
+            char multiplier = tmp_string[tmp_string.length()-1];
+            std::string filesize = tmp_string.substr(0, tmp_string.length()-1);
+            sprintf(entry.display_size, "%s", tmp_string.c_str());
+            if (multiplier == 'K')
+                entry.file_size = atof(filesize.c_str()) * 1024;
+            else if (multiplier == 'M')
+                entry.file_size = atof(filesize.c_str()) * 1024 * 1024;
+            else if (multiplier == 'G')
+                entry.file_size = atof(filesize.c_str()) * 1024 * 1024 * 1024;
+            else if (multiplier == 'T')
+                entry.file_size = atof(filesize.c_str()) * 1024 * 1024 * 1024 * 1024;
+            else
+                entry.file_size = atoi(tmp_string.c_str());
+        }
     }
 
-finish:
+    return 1;
+}
+
+std::vector<DirEntry> ApacheClient::ListDir(const std::string &path)
+{
+    std::vector<DirEntry> out;
+    ListDirStreamed(path, [&out](const std::vector<DirEntry> &batch)
+                    {
+                        out.insert(out.end(), batch.begin(), batch.end());
+                        return true;
+                    });
     return out;
-}
\ No newline at end of file
+}
+
+int ApacheClient::ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch)
+{
+    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    std::string error;
+    int ret = HtmlIndex::ListDirStreamed(client, encoded_url, path, "apache", "tr",
+                                         [&path](lxb_dom_element_t *row, size_t index, DirEntry &entry)
+                                         {
+                                             return ParseRow(row, path, entry);
+                                         },
+                                         on_batch, error);
+    if (ret == 0)
+        sprintf(this->response, "%s", error.c_str());
+    return ret;
+}
@@ -1,17 +1,23 @@
 #include <lexbor/html/parser.h>
 #include <lexbor/dom/interfaces/element.h>
 #include <lexbor/dom/interfaces/node.h>
+#include <json-c/json.h>
 #include <fstream>
 #include <map>
+#include <algorithm>
+#include <set>
+#include <time.h>
 #include "common.h"
 #include "config.h"
 #include "clients/remote_client.h"
 #include "clients/archiveorg.h"
 #include "lang.h"
 #include "util.h"
+#include "clients/html_index.h"
 #include "windows.h"
-
-static std::map<std::string, int> month_map = {{"Jan", 1}, {"Feb", 2}, {"Mar", 3}, {"Apr", 4}, {"May", 5}, {"Jun", 6}, {"Jul", 7}, {"Aug", 8}, {"Sep", 9}, {"Oct", 10}, {"Nov", 11}, {"Dec", 12}};
+#include "logger.h"
+#include "checksum.h"
+#include "listing_kernels.h"
 
 std::string ArchiveOrgClient::GenerateRandomId(const int len)
 {
@@ -82,223 +88,417 @@ int ArchiveOrgClient::Login(const std::string &username, const std::string &pass
     return 0;
 }
 
-std::vector<DirEntry> ArchiveOrgClient::ListDir(const std::string &path)
+// <table class="directory-listing-table">: <tr><td><a href="name/">..</a></td>
+// <td>date</td><td>size</td></tr>
+static int ParseHtmlRow(lxb_dom_element_t *tr_element, const std::string &path, const std::string &lower_filter,
+                        DirEntry &entry)
 {
+    lxb_dom_element_t *td_element;
+    std::string tmp_string;
+    const lxb_char_t *value;
+    size_t value_len;
+
+    std::vector<lxb_dom_element_t *> td = HtmlIndex::Children(tr_element, "td");
+    if (td.empty())
+        return 0; // header
+    if (td.size() < 3)
+        return -1;
+
+    // td0 contains the <a> tag
+    td_element = td[0];
+    lxb_dom_node_t *a_node = Util::NextChildElement(td_element);
+    // there is no a_node in protected links
+    if (a_node == nullptr)
+        return 0;
+
+    value = lxb_dom_element_local_name(lxb_dom_interface_element(a_node), &value_len);
+    tmp_string = std::string((const char *)value, value_len);
+    if (tmp_string.compare("a") != 0)
+        return -1;
+    tmp_string = HtmlIndex::Attribute(lxb_dom_interface_element(a_node), "href");
+    if (tmp_string.empty())
+        return 0;
+    if (tmp_string[tmp_string.length()-1] == '/')
+        tmp_string = tmp_string.substr(0, tmp_string.length()-1);
+    tmp_string = BaseClient::UnEscape(tmp_string);
+    sprintf(entry.name, "%s", tmp_string.c_str());
+    sprintf(entry.directory, "%s", path.c_str());
+    if (path.length() > 0 && path[path.length() - 1] == '/')
+    {
+        sprintf(entry.path, "%s%s", path.c_str(), entry.name);
+    }
+    else
+    {
+        sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
+    }
+
+    if (apply_native_filter_state == 1)
+    {
+        std::string temp_name = Util::ToLower(entry.name);
+        if (lower_filter.length() > 0 && temp_name.find(lower_filter) == std::string::npos)
+            return 0;
+    }
+
+    // next td contains the date
+    td_element = td[1];
+    value = lxb_dom_node_text_content(Util::NextChildTextNode(td_element), &value_len);
+    tmp_string = value ? std::string((const char *)value, value_len) : "";
+    std::vector<std::string> date_time = Util::Split(tmp_string, " ");
+
+    if (date_time.size() > 1)
+    {
+        std::vector<std::string> adate = Util::Split(date_time[0], "-");
+        if (adate.size() == 3)
+        {
+            entry.modified.day = atoi(adate[0].c_str());
+            entry.modified.month = ListingKernels::Month(adate[1].c_str());
+            entry.modified.year = atoi(adate[2].c_str());
+        }
+
+        std::vector<std::string> atime = Util::Split(date_time[1], ":");
+        if (atime.size() == 2)
+        {
+            entry.modified.hours = atoi(atime[0].c_str());
+            entry.modified.minutes = atoi(atime[1].c_str());
+        }
+    }
+
+    // next td contains file size, if fize size is "-", then it's a directory
+    td_element = td[2];
+    value = lxb_dom_node_text_content(Util::NextChildTextNode(td_element), &value_len);
+    tmp_string = value ? std::string((const char *)value, value_len) : "";
+
+    if (tmp_string.compare("-") == 0)
+    {
+        entry.isDir = true;
+        entry.selectable = true;
+        entry.file_size = 0;
+        sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+    }
+    else
+    {
+        entry.isDir = false;
+        entry.selectable = true;
+        uint64_t multiplier = 1;
+        float fsize = tmp_string.empty() ? 0 : atof(tmp_string.substr(0, tmp_string.size()-1).c_str());
+        switch (tmp_string.empty() ? 'B' : tmp_string[tmp_string.size()-1]) {
+            case 'B':
+                multiplier = 1;
+                break;
+            case 'K':
+                multiplier = 1024;
+                break;
+            case 'M':
+                multiplier = 1048576;
+                break;
+            case 'G':
+                multiplier = 1073741824;
+                break;
+            default:
+                multiplier = 1;
+        }
+        entry.file_size = fsize * multiplier;
+        DirEntry::SetDisplaySize(&entry);
+    }
+
+    return 1;
+}
+
+std::vector<DirEntry> ArchiveOrgClient::ListDirHtml(const std::string &path)
+{
+    std::string encoded_path = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path)+"/");
+    std::string lower_filter = Util::ToLower(remote_filter);
+    std::string error;
+    size_t list_rows = 0;
+    bool too_many = false;
+
+    // Parsed as it arrives, a row at a time; see MyrientClient::ListDir for
+    // why the filter prompt keeps this a plain ListDir.
+    std::vector<DirEntry> out = HtmlIndex::ListDir(client, encoded_path, path, "archiveorg", "tr",
+                                                   [&](lxb_dom_element_t *row, size_t index, DirEntry &entry)
+                                                   {
+                                                       lxb_dom_element_t *table = HtmlIndex::Ancestor(row, "table");
+                                                       if (table == nullptr || HtmlIndex::Attribute(table, "class").compare("directory-listing-table") != 0)
+                                                           return 0;
+                                                       if (apply_native_filter_state == 2 && ++list_rows > 500)
+                                                       {
+                                                           too_many = true;
+                                                           return -1;
+                                                       }
+                                                       return ParseHtmlRow(row, path, lower_filter, entry);
+                                                   },
+                                                   error);
+    if (!error.empty())
+    {
+        sprintf(this->response, "%s", error.c_str());
+        return out;
+    }
+    if (too_many)
+    {
+        out.resize(1);
+        selected_action = ACTION_APPLY_REMOTE_NATIVE_FILTER;
+        return out;
+    }
+
+    apply_native_filter_state = 2;
+    return out;
+}
+
+bool ArchiveOrgClient::SplitItemPath(const std::string &full, std::string &item, std::string &rest)
+{
+    const std::string prefix = "/download/";
+    if (full.compare(0, prefix.size(), prefix) != 0 || full.size() == prefix.size())
+        return false;
+    size_t slash = full.find('/', prefix.size());
+    item = full.substr(prefix.size(), slash == std::string::npos ? std::string::npos : slash - prefix.size());
+    rest = slash == std::string::npos ? "" : full.substr(slash + 1);
+    while (!rest.empty() && rest[rest.size() - 1] == '/')
+        rest.erase(rest.size() - 1);
+    return !item.empty();
+}
+
+static std::string JsonString(json_object *parent, const char *key)
+{
+    json_object *value = json_object_object_get(parent, key);
+    if (value == nullptr || json_object_get_type(value) != json_type_string)
+        return "";
+    return json_object_get_string(value);
+}
+
+const ArchiveOrgClient::ItemMetadata *ArchiveOrgClient::Metadata(const std::string &item)
+{
+    // Re-read now and then, since uploads keep adding files to items.
+    const uint64_t kMaxAgeUs = 600ULL * 1000000ULL;
+    uint64_t now = Util::GetTick();
+    auto cached = items.find(item);
+    if (cached != items.end() && now - cached->second.fetched < kMaxAgeUs)
+        return &cached->second;
+
     CHTTPClient::HeadersMap headers;
     CHTTPClient::HttpResponse res;
+    std::string metadata_url = this->host_url + CHTTPClient::EncodeUrl("/metadata/" + item);
+    if (!client->GetListing(metadata_url, headers, res) || !HTTP_SUCCESS(res.iCode))
+    {
+        Logger::Logf("ARCHIVEORG metadata failed item=%s code=%ld err=%s", item.c_str(), res.iCode,
+                     res.errMessage.c_str());
+        return nullptr;
+    }
+
+    // An unknown or dark item answers 200 with "{}".
+    json_object *jobj = json_tokener_parse(res.strBody.c_str());
+    json_object *jfiles = jobj ? json_object_object_get(jobj, "files") : nullptr;
+    std::string dir = jobj ? JsonString(jobj, "dir") : "";
+    if (jfiles == nullptr || json_object_get_type(jfiles) != json_type_array || dir.empty())
+    {
+        if (jobj)
+            json_object_put(jobj);
+        Logger::Logf("ARCHIVEORG metadata empty item=%s", item.c_str());
+        return nullptr;
+    }
+
+    ItemMetadata meta;
+    meta.fetched = now;
+
+    // The item is served from d1, d2 and any other workable server, all
+    // under the same folder.
+    std::vector<std::string> servers;
+    servers.push_back(JsonString(jobj, "d1"));
+    servers.push_back(JsonString(jobj, "d2"));
+    json_object *jworkable = json_object_object_get(jobj, "workable_servers");
+    if (jworkable && json_object_get_type(jworkable) == json_type_array)
+    {
+        size_t count = json_object_array_length(jworkable);
+        for (size_t i = 0; i < count; i++)
+        {
+            json_object *jserver = json_object_array_get_idx(jworkable, i);
+            if (jserver && json_object_get_type(jserver) == json_type_string)
+                servers.push_back(json_object_get_string(jserver));
+        }
+    }
+    for (const std::string &server : servers)
+    {
+        if (server.empty())
+            continue;
+        std::string node = "https://" + server + CHTTPClient::EncodeUrl(dir);
+        if (std::find(meta.nodes.begin(), meta.nodes.end(), node) == meta.nodes.end())
+            meta.nodes.push_back(node);
+    }
+
+    // Sizes and mtimes come as decimal strings.
+    size_t count = json_object_array_length(jfiles);
+    meta.files.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        json_object *jfile = json_object_array_get_idx(jfiles, i);
+        ItemFile file;
+        file.name = JsonString(jfile, "name");
+        if (file.name.empty())
+            continue;
+        file.size = strtoull(JsonString(jfile, "size").c_str(), nullptr, 10);
+        file.mtime = (time_t)strtoll(JsonString(jfile, "mtime").c_str(), nullptr, 10);
+        file.md5 = JsonString(jfile, "md5");
+        file.sha1 = JsonString(jfile, "sha1");
+        file.original = JsonString(jfile, "original");
+        file.thumb = !file.original.empty() && JsonString(jfile, "format").find("Thumb") != std::string::npos;
+        meta.files.push_back(file);
+    }
+    json_object_put(jobj);
+
+    Logger::Logf("ARCHIVEORG metadata item=%s files=%d datanodes=%d bytes=%zu", item.c_str(),
+                 (int)meta.files.size(), (int)meta.nodes.size(), res.strBody.size());
+    ItemMetadata &slot = items[item];
+    slot = std::move(meta);
+    return &slot;
+}
+
+std::vector<DirEntry> ArchiveOrgClient::ListDir(const std::string &path)
+{
+    // Inside an item the metadata API has the whole file tree in one
+    // compact response; anything else is still an HTML page.
+    std::string item, rest;
+    const ItemMetadata *meta = nullptr;
+    if (SplitItemPath(GetFullPath(path), item, rest))
+        meta = Metadata(item);
+    if (meta == nullptr)
+        return ListDirHtml(path);
 
     std::vector<DirEntry> out;
     DirEntry entry;
     Util::SetupPreviousFolder(path, &entry);
     out.push_back(entry);
 
-    std::string encoded_path = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path)+"/");
-    if (client->Get(encoded_path, headers, res))
+    std::string lower_filter = Util::ToLower(remote_filter);
+    std::string prefix = rest.empty() ? "" : rest + "/";
+
+    // Files are listed with their full path in the item; folders exist only
+    // as prefixes of those.
+    std::set<std::string> folders;
+    int rows = 0;
+    for (const ItemFile &file : meta->files)
+    {
+        if (file.name.compare(0, prefix.size(), prefix) == 0 && file.name.size() > prefix.size())
+            rows++;
+    }
+    if (apply_native_filter_state == 2 && rows > 500)
+    {
+        selected_action = ACTION_APPLY_REMOTE_NATIVE_FILTER;
+        return out;
+    }
+
+    for (const ItemFile &file : meta->files)
     {
-        lxb_status_t status;
-        lxb_dom_attr_t *attr;
-        lxb_dom_element_t *tr_element, *td_element;
-        lxb_html_document_t *document;
-        lxb_dom_collection_t *tr_collection;
-        lxb_dom_collection_t *td_collection;
-        std::string tmp_string;
-        const lxb_char_t *value;
-        size_t value_len;
-        std::string lower_filter = Util::ToLower(remote_filter);
-
-        // Extract first 100 tr in the <table id="list"> element
-        std::string res_body = std::string(res.strBody.data());
-        res.strBody.clear();
-        size_t start_parse_pos = res_body.find("<table class=\"directory-listing-table\">");
-        size_t table_list_end_pos = res_body.find("</table>", start_parse_pos);
-
-        int rows = Util::CountOccurrence(res_body, "<tr >", start_parse_pos, table_list_end_pos);
-        if (apply_native_filter_state == 2 && rows > 500)
+        if (file.name.compare(0, prefix.size(), prefix) != 0 || file.name.size() <= prefix.size())
+            continue;
+        std::string name = file.name.substr(prefix.size());
+        size_t slash = name.find('/');
+        bool is_dir = slash != std::string::npos;
+        if (is_dir)
         {
-            selected_action = ACTION_APPLY_REMOTE_NATIVE_FILTER;
-            return out;
+            name = name.substr(0, slash);
+            if (!folders.insert(name).second)
+                continue;
         }
 
-        start_parse_pos = Util::NthOccurrence(res_body, "<tr >", 1, start_parse_pos, table_list_end_pos);
-        size_t tr_nth_start_pos = Util::NthOccurrence(res_body, "<tr >", 100, start_parse_pos, table_list_end_pos);
-        size_t tr_nth_end_pos = res_body.find("</tr>", tr_nth_start_pos) + 5;;
-
-        while (tr_nth_start_pos != std::string::npos)
+        if (apply_native_filter_state == 1)
         {
-            std::string temp_str = "<html><body><table><tbody>" + res_body.substr(start_parse_pos, tr_nth_end_pos-start_parse_pos) + "</tbody></table></body></html>";
-
-            document = lxb_html_document_create();
-            status = lxb_html_document_parse(document, (lxb_char_t *)temp_str.c_str(), temp_str.length());
-            if (status != LXB_STATUS_OK)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+            std::string temp_name = Util::ToLower(name);
+            if (lower_filter.length() > 0 && temp_name.find(lower_filter) == std::string::npos)
+                continue;
+        }
 
-            tr_collection = lxb_dom_collection_make(&document->dom_document, 128);
-            if (tr_collection == NULL)
+        DirEntry entry;
+        memset(&entry, 0, sizeof(DirEntry));
+        snprintf(entry.name, sizeof(entry.name), "%s", name.c_str());
+        snprintf(entry.directory, sizeof(entry.directory), "%s", path.c_str());
+        if (path.length() > 0 && path[path.length() - 1] == '/')
+            snprintf(entry.path, sizeof(entry.path), "%s%s", path.c_str(), entry.name);
+        else
+            snprintf(entry.path, sizeof(entry.path), "%s/%s", path.c_str(), entry.name);
+        entry.selectable = true;
+        entry.isDir = is_dir;
+        if (is_dir)
+        {
+            sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+        }
+        else
+        {
+            entry.file_size = file.size;
+            DirEntry::SetDisplaySize(&entry);
+            if (file.mtime > 0)
             {
-                lxb_html_document_destroy(document);
-                goto finish;
+                struct tm tm = *localtime(&file.mtime);
+                entry.modified.day = tm.tm_mday;
+                entry.modified.month = tm.tm_mon + 1;
+                entry.modified.year = tm.tm_year + 1900;
+                entry.modified.hours = tm.tm_hour;
+                entry.modified.minutes = tm.tm_min;
+                entry.modified.seconds = tm.tm_sec;
             }
+        }
+        out.push_back(entry);
+    }
 
-            status = lxb_dom_elements_by_tag_name(lxb_dom_interface_element(document->body),
-                                                tr_collection, (const lxb_char_t *)"tr", 2);
-            if (status != LXB_STATUS_OK && lxb_dom_collection_length(tr_collection) < 2)
-            {
-                lxb_dom_collection_destroy(tr_collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+    apply_native_filter_state = 2;
+    return out;
+}
 
-            // skip row 0 , since it has the previous folder header
-            for (size_t i = 0; i < lxb_dom_collection_length(tr_collection); i++)
-            {
-                DirEntry entry;
-                std::string title, aclass;
-                memset(&entry.modified, 0, sizeof(DateTime));
-
-                tr_element = lxb_dom_collection_element(tr_collection, i);
-
-                td_collection = lxb_dom_collection_make(&document->dom_document, 5);
-                status = lxb_dom_elements_by_tag_name(tr_element,
-                                                    td_collection, (const lxb_char_t *)"td", 2);
-                if (status != LXB_STATUS_OK || lxb_dom_collection_length(td_collection) < 3)
-                {
-                    lxb_dom_collection_destroy(td_collection, true);
-                    lxb_dom_collection_destroy(tr_collection, true);
-                    lxb_html_document_destroy(document);
-                    goto finish;
-                }
-
-                // td0 contains the <a> tag
-                td_element = lxb_dom_collection_element(td_collection, 0);
-                lxb_dom_node_t *a_node = Util::NextChildElement(td_element);
-                // there is no a_node in protected links
-                if (a_node == nullptr)
-                {
-                    lxb_dom_collection_destroy(td_collection, true);
-                    continue;
-                }
-
-                value = lxb_dom_element_local_name(lxb_dom_interface_element(a_node), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string.compare("a") != 0)
-                {
-                    lxb_dom_collection_destroy(td_collection, true);
-                    lxb_dom_collection_destroy(tr_collection, true);
-                    lxb_html_document_destroy(document);
-                    goto finish;
-                }
-                value = lxb_dom_element_get_attribute(lxb_dom_interface_element(a_node), (const lxb_char_t *)"href", 4, &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string[tmp_string.length()-1] == '/')
-                    tmp_string = tmp_string.substr(0, tmp_string.length()-1);
-                tmp_string = BaseClient::UnEscape(tmp_string);
-                sprintf(entry.name, "%s", tmp_string.c_str());
-                sprintf(entry.directory, "%s", path.c_str());
-                if (path.length() > 0 && path[path.length() - 1] == '/')
-                {
-                    sprintf(entry.path, "%s%s", path.c_str(), entry.name);
-                }
-                else
-                {
-                    sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
-                }
-
-                if (apply_native_filter_state == 1)
-                {
-                    std::string temp_name = Util::ToLower(entry.name);
-                    if (lower_filter.length() > 0 && temp_name.find(lower_filter) == std::string::npos)
-                    {
-                        lxb_dom_collection_destroy(td_collection, true);
-                        continue;
-                    }
-                }
-
-                // next td contains the date
-                td_element = lxb_dom_collection_element(td_collection, 1);
-                value = lxb_dom_node_text_content(Util::NextChildTextNode(td_element), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                std::vector<std::string> date_time = Util::Split(tmp_string, " ");
-
-                if (date_time.size() > 1)
-                {
-                    std::vector<std::string> adate = Util::Split(date_time[0], "-");
-                    if (adate.size() == 3)
-                    {
-                        entry.modified.day = atoi(adate[0].c_str());
-                        entry.modified.month = month_map[adate[1]];
-                        entry.modified.year = atoi(adate[2].c_str());
-                    }
-
-                    std::vector<std::string> atime = Util::Split(date_time[1], ":");
-                    if (atime.size() == 2)
-                    {
-                        entry.modified.hours = atoi(atime[0].c_str());
-                        entry.modified.minutes = atoi(atime[1].c_str());
-                    }
-                }
-
-                // next td contains file size, if fize size is "-", then it's a directory
-                td_element = lxb_dom_collection_element(td_collection, 2);
-                value = lxb_dom_node_text_content(Util::NextChildTextNode(td_element), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-
-                if (tmp_string.compare("-") == 0)
-                {
-                    entry.isDir = true;
-                    entry.selectable = true;
-                    entry.file_size = 0;
-                    sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
-                }
-                else
-                {
-                    entry.isDir = false;
-                    entry.selectable = true;
-                    uint64_t multiplier = 0;
-                    float fsize = atof(tmp_string.substr(0, tmp_string.size()-1).c_str());
-                    switch (tmp_string[tmp_string.size()-1]) {
-                        case 'B':
-                            multiplier = 1;
-                            break;
-                        case 'K':
-                            multiplier = 1024;
-                            break;
-                        case 'M':
-                            multiplier = 1048576;
-                            break;
-                        case 'G':
-                            multiplier = 1073741824;
-                            break;
-                        default:
-                            multiplier = 1;
-                    }
-                    entry.file_size = fsize * multiplier;
-                    DirEntry::SetDisplaySize(&entry);
-                }
-
-                lxb_dom_collection_destroy(td_collection, true);
-                out.push_back(entry);
-            }
+int ArchiveOrgClient::GetPreview(const std::string &path, int width, int height, const RemoteStreamFn &on_data)
+{
+    std::string item, rest;
+    if (!thumbnail_server_previews || !SplitItemPath(GetFullPath(path), item, rest) || rest.empty())
+        return -1;
+    const ItemMetadata *meta = Metadata(item);
+    if (meta == nullptr)
+        return -1;
+
+    // The derivative sits in the item next to its original, which the
+    // metadata names by its path in the item, as `rest` is.
+    std::string dir = path;
+    while (!dir.empty() && dir[dir.size() - 1] == '/')
+        dir.erase(dir.size() - 1);
+    if (dir.size() < rest.size() || dir.compare(dir.size() - rest.size(), rest.size(), rest) != 0)
+        return -1;
+    dir.erase(dir.size() - rest.size());
+    for (const ItemFile &file : meta->files)
+    {
+        if (file.thumb && file.original == rest)
+            return GetStream(dir + file.name, file.size, on_data);
+    }
+    return 0;
+}
 
-            lxb_dom_collection_destroy(tr_collection, true);
-            lxb_html_document_destroy(document);
-            temp_str.clear();
+std::vector<std::string> ArchiveOrgClient::MirrorUrls(const std::string &path)
+{
+    // /download/<item>/<file> redirects to one of the item's datanodes;
+    // ranges can go to all of them directly.
+    std::vector<std::string> urls;
+    std::string item, rest;
+    if (!SplitItemPath(GetFullPath(path), item, rest) || rest.empty())
+        return urls;
+    const ItemMetadata *meta = Metadata(item);
+    if (meta == nullptr)
+        return urls;
+    for (const std::string &node : meta->nodes)
+        urls.push_back(node + CHTTPClient::EncodeUrl("/" + rest));
+    return urls;
+}
 
-            start_parse_pos = tr_nth_end_pos+1;
-            tr_nth_start_pos = Util::NthOccurrence(res_body, "<tr >", 100, start_parse_pos, table_list_end_pos);
-            tr_nth_end_pos = res_body.find("</tr>", tr_nth_start_pos)+5;
-        }
-        res_body.clear();
-    }
-    else
+FileDigest ArchiveOrgClient::ExpectedDigest(const std::string &path)
+{
+    std::string item, rest;
+    if (!SplitItemPath(GetFullPath(path), item, rest) || rest.empty())
+        return FileDigest();
+    const ItemMetadata *meta = Metadata(item);
+    if (meta == nullptr)
+        return FileDigest();
+    for (const ItemFile &file : meta->files)
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
-        return out;
+        if (file.name != rest)
+            continue;
+        FileDigest digest = Checksum::FromHex(FileDigest::SHA1, file.sha1);
+        if (!digest.Valid())
+            digest = Checksum::FromHex(FileDigest::MD5, file.md5);
+        return digest;
     }
-
-finish:
-    apply_native_filter_state = 2;
-    return out;
+    return FileDigest();
 }
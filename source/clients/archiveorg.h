@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <time.h>
 #include "clients/remote_client.h"
 #include "clients/baseclient.h"
 #include "common.h"
@@ -12,10 +14,51 @@ class ArchiveOrgClient : public BaseClient
 public:
     int Connect(const std::string &url, const std::string &username, const std::string &password);
     std::vector<DirEntry> ListDir(const std::string &path);
+    // The "Thumbnail" derivative Archive.org keeps of an image, when the
+    // item has one.
+    int GetPreview(const std::string &path, int width, int height, const RemoteStreamFn &on_data) override;
+
+protected:
+    // The file on every datanode that holds its item.
+    std::vector<std::string> MirrorUrls(const std::string &path) override;
+    // The item's SHA-1 (MD5 when absent) for the file.
+    FileDigest ExpectedDigest(const std::string &path) override;
 
 private:
+    struct ItemFile
+    {
+        // Path inside the item, e.g. "disc1/track01.bin".
+        std::string name;
+        uint64_t size = 0;
+        time_t mtime = 0;
+        std::string md5;
+        std::string sha1;
+        // File a derivative was made from, empty for originals.
+        std::string original;
+        // A derivative of the "Thumbnail" or "JPEG Thumb" format.
+        bool thumb = false;
+    };
+
+    struct ItemMetadata
+    {
+        // "https://<datanode><dir>" bases.
+        std::vector<std::string> nodes;
+        std::vector<ItemFile> files;
+        uint64_t fetched = 0;
+    };
+
     int Login(const std::string &username, const std::string &password);
     std::string GenerateRandomId(const int len);
+    // The original scraper, for pages outside an item (collections, the
+    // site root) or an item whose metadata cannot be read.
+    std::vector<DirEntry> ListDirHtml(const std::string &path);
+    // /metadata/<item>, parsed and kept for a few minutes; nullptr when
+    // the API has nothing for it.
+    const ItemMetadata *Metadata(const std::string &item);
+    // Splits a full "/download/<item>[/<rest>]" path.
+    static bool SplitItemPath(const std::string &full, std::string &item, std::string &rest);
+
+    std::map<std::string, ItemMetadata> items;
 };
 
 #endif
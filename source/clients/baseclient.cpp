@@ -1,4 +1,5 @@
 #include <fstream>
+#include <algorithm>
 #include <curl/curl.h>
 #include "common.h"
 #include "clients/remote_client.h"
@@ -7,6 +8,13 @@
 #include "lang.h"
 #include "util.h"
 #include "windows.h"
+#include "transfer_stats.h"
+#include "httpclient/HTTPMultiClient.h"
+#include "host_health.h"
+#include "local_sink.h"
+#include "logger.h"
+#include "fs.h"
+#include "cancel.h"
 
 BaseClient::BaseClient(){};
 
@@ -19,16 +27,17 @@ BaseClient::~BaseClient()
 int BaseClient::DownloadProgressCallback(void* ptr, double dTotalToDownload, double dNowDownloaded, double dTotalToUpload, double dNowUploaded)
 {
     CHTTPClient::ProgressFnStruct *progress_data = (CHTTPClient::ProgressFnStruct*) ptr;
-    uint64_t *bytes_transfered = (uint64_t *) progress_data->pOwner;
-	*bytes_transfered = dNowDownloaded;
+    Metrics::Value<int64_t> *bytes_transfered = (Metrics::Value<int64_t> *) progress_data->pOwner;
+	*bytes_transfered = (int64_t)dNowDownloaded;
+    TransferStats::SetBytes((int64_t)dNowDownloaded);
     return 0;
 }
 
 int BaseClient::UploadProgressCallback(void* ptr, double dTotalToDownload, double dNowDownloaded, double dTotalToUpload, double dNowUploaded)
 {
     CHTTPClient::ProgressFnStruct *progress_data = (CHTTPClient::ProgressFnStruct*) ptr;
-    uint64_t *bytes_transfered = (uint64_t *) progress_data->pOwner;
-    *bytes_transfered = dNowUploaded;
+    Metrics::Value<int64_t> *bytes_transfered = (Metrics::Value<int64_t> *) progress_data->pOwner;
+    *bytes_transfered = (int64_t)dNowUploaded;
     return 0;
 }
 
@@ -44,6 +53,7 @@ int BaseClient::Connect(const std::string &url, const std::string &username, con
         this->host_url = url.substr(0, root_pos);
         this->base_path = url.substr(root_pos);
     }
+    HostCaps::Seed(this->host_url, stored_caps);
     client = new CHTTPClient([](const std::string& log){});
     client->SetBasicAuth(this->http_username, this->http_password);
     // Many home/self-hosted WebDAV/HTTP endpoints (including Tailscale Funnel)
@@ -52,6 +62,7 @@ int BaseClient::Connect(const std::string &url, const std::string &username, con
     // connecting to such servers, disable strict peer verification here.
     client->InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
     client->SetCertificateFile(CACERT_FILE);
+    client->SetCancelFlag(Cancel::Flag());
 
     if (Ping())
     {
@@ -63,6 +74,21 @@ int BaseClient::Connect(const std::string &url, const std::string &username, con
     return 0;
 }
 
+void BaseClient::SetStoredCaps(const HostCaps::Caps &caps)
+{
+    stored_caps = caps;
+}
+
+HostCaps::Caps BaseClient::GetCaps() const
+{
+    return HostCaps::Get(host_url);
+}
+
+uint64_t BaseClient::RetryDelayUs(int attempt) const
+{
+    return HostHealth::RetryDelayUs(host_url, attempt, 2000000, 30000000);
+}
+
 int BaseClient::Mkdir(const std::string &path)
 {
     sprintf(this->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
@@ -81,39 +107,45 @@ int BaseClient::Size(const std::string &path, int64_t *size)
     CHTTPClient::HttpResponse res;
 
     std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
-    if (client->Head(encoded_url, headers, res))
+    // A host known to fail HEAD goes straight to the ranged GET.
+    bool try_head = HostCaps::Get(encoded_url).head != 0;
+    if (try_head)
     {
+        if (!client->Head(encoded_url, headers, res))
+        {
+            sprintf(this->response, "%s", res.errMessage.c_str());
+            return 0;
+        }
         if (HTTP_SUCCESS(res.iCode))
         {
             std::string content_length = res.mapHeadersLowercase["content-length"];
             if (content_length.length() > 0)
-                *size = atoll(content_length.c_str());
-            return 1;
-        }
-        else // Server doesn't support HEAD request. Try get range with 0 bytes and grab size from the response header 
-             // example: Content-Range: bytes 0-10/4372785
-        {
-            CHTTPClient::HttpResponse range_res;
-            CHTTPClient::HeadersMap range_headers;
-            range_headers["Range"] = "bytes=0-1";
-            if (client->Get(encoded_url, range_headers, range_res))
             {
-                if (HTTP_SUCCESS(range_res.iCode))
-                {
-                    std::string content_range = range_res.mapHeaders["Content-Range"];
-                    std::vector<std::string> range_parts = Util::Split(content_range, "/");
-                    if (range_parts.size() == 2)
-                    {
-                        *size = atoll(range_parts[1].c_str());
-                        return 1;
-                    }
-                }
+                *size = atoll(content_length.c_str());
+                HostCaps::Learn(encoded_url, &HostCaps::Caps::head, 1);
             }
+            return 1;
         }
     }
-    else
+
+    // Server doesn't support HEAD request. Try get range with 0 bytes and grab size from the response header
+    // example: Content-Range: bytes 0-10/4372785
+    CHTTPClient::HttpResponse range_res;
+    CHTTPClient::HeadersMap range_headers;
+    range_headers["Range"] = "bytes=0-1";
+    if (client->Get(encoded_url, range_headers, range_res) && HTTP_SUCCESS(range_res.iCode))
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
+        std::string content_range = range_res.mapHeadersLowercase["content-range"];
+        std::vector<std::string> range_parts = Util::Split(content_range, "/");
+        if (range_parts.size() == 2)
+        {
+            *size = atoll(range_parts[1].c_str());
+            if (try_head)
+                HostCaps::Learn(encoded_url, &HostCaps::Caps::head, 0);
+            // The answer settles range support too.
+            HostCaps::Learn(encoded_url, &HostCaps::Caps::range, range_res.iCode == 206 ? 1 : 0);
+            return 1;
+        }
     }
     return 0;
 }
@@ -123,17 +155,41 @@ int BaseClient::Get(const std::string &outputfile, const std::string &path, uint
     long status;
     bytes_transfered = 0;
     prev_tick = Util::GetTick();
-    if (!Size(path, &bytes_to_download))
+    int64_t size = 0;
+    if (!Size(path, &size))
     {
         sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
         return 0;
     }
+    bytes_to_download = size;
 
-    client->SetProgressFnCallback(&bytes_transfered, DownloadProgressCallback);
     std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    expected_digest = verify_downloads ? ExpectedDigest(path) : FileDigest();
+
+    int ranged = GetRangedIfWorthIt(outputfile, encoded_url, path, offset);
+    if (ranged >= 0)
+        return ranged;
+
+    client->SetProgressFnCallback(&bytes_transfered, DownloadProgressCallback);
     if (client->DownloadFile(outputfile, encoded_url, status))
     {
-        return 1;
+        if (!expected_digest.Valid() || bytes_to_download <= 0)
+            return 1;
+        // One stream, so read the file back once rather than hashing
+        // inside curl's write path.
+        FILE *in = fopen(outputfile.c_str(), "rb");
+        ChecksumWriter checksum(expected_digest.algo);
+        FileDigest actual;
+        bool digested = in && checksum.Final(static_cast<uint64_t>(bytes_to_download),
+                                             [in](uint64_t offset, char *data, size_t size)
+                                             {
+                                                 return fseeko(in, static_cast<off_t>(offset), SEEK_SET) == 0 &&
+                                                        fread(data, 1, size, in) == size;
+                                             },
+                                             actual);
+        if (in)
+            fclose(in);
+        return VerifyDownload(outputfile, false, digested, actual) ? 1 : 0;
     }
     else
     {
@@ -165,6 +221,292 @@ int BaseClient::GetRange(const std::string &path, void *buffer, uint64_t size, u
     return 0;
 }
 
+namespace
+{
+    // Ranges closer than this are read as one; the bytes between cost less
+    // than another round trip.
+    const uint64_t kCoalesceGap = 128 * 1024;
+    const uint64_t kMaxGroupBytes = 8 * 1024 * 1024;
+    // Parts of one multipart request; Apache refuses more than 200.
+    const size_t kMaxPartsPerRequest = 32;
+    // Rounds of fetching chunks that failed their hash again.
+    const int kRepairRounds = 3;
+
+    // `text` lowercased, for case-blind header matching.
+    std::string Lower(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        return text;
+    }
+
+    // "bytes <first>-<last>/<total>" of a Content-Range value.
+    bool ParseContentRange(const std::string &value, int64_t &first, int64_t &last)
+    {
+        long long a = 0, b = 0;
+        if (sscanf(value.c_str(), " bytes %lld-%lld", &a, &b) != 2 || b < a)
+            return false;
+        first = a;
+        last = b;
+        return true;
+    }
+
+    // Hands each part of a multipart/byteranges `body` to `deliver`.
+    void ParseByteRanges(const std::string &body, const std::string &boundary,
+                         const CHTTPMultiClient::RangeSinkFn &deliver)
+    {
+        std::string delimiter = "--" + boundary;
+        size_t pos = 0;
+        while ((pos = body.find(delimiter, pos)) != std::string::npos)
+        {
+            pos += delimiter.size();
+            if (body.compare(pos, 2, "--") == 0)
+                return;
+            size_t headers_end = body.find("\r\n\r\n", pos);
+            if (headers_end == std::string::npos)
+                return;
+            std::string headers = Lower(body.substr(pos, headers_end - pos));
+            size_t at = headers.find("content-range:");
+            int64_t first = 0, last = 0;
+            if (at == std::string::npos || !ParseContentRange(headers.substr(at + 14), first, last))
+                return;
+            size_t data = headers_end + 4;
+            size_t len = (size_t)(last - first + 1);
+            if (data + len > body.size())
+                return;
+            deliver(first, body.data() + data, len);
+            pos = data + len;
+        }
+    }
+}
+
+bool BaseClient::GetSpans(const std::string &encoded_url, const std::vector<CHTTPMultiClient::Span> &spans,
+                          const CHTTPMultiClient::RangeSinkFn &deliver)
+{
+    std::string range = "bytes=";
+    int64_t wanted = 0;
+    for (const CHTTPMultiClient::Span &span : spans)
+    {
+        if (range.size() > 6)
+            range += ",";
+        range += std::to_string(span.first) + "-" + std::to_string(span.second - 1);
+        wanted += span.second - span.first;
+    }
+    CHTTPClient::HeadersMap headers;
+    headers["Range"] = range;
+
+    // A server that ignores the ranges sends the whole file; that is cut
+    // off once it runs past what the parts could take.
+    int64_t limit = wanted + 4096 + (int64_t)spans.size() * 256;
+    std::string body;
+    bool overrun = false;
+    CHTTPClient::HttpResponse res;
+    bool ok = client->GetToSink(encoded_url, headers,
+                                [&](const char *data, size_t len)
+                                {
+                                    if ((int64_t)(body.size() + len) > limit)
+                                    {
+                                        overrun = true;
+                                        return false;
+                                    }
+                                    body.append(data, len);
+                                    return true;
+                                },
+                                res);
+    bool multi = spans.size() > 1;
+    if (overrun || (ok && res.iCode == 200))
+    {
+        if (multi)
+            HostCaps::Learn(encoded_url, &HostCaps::Caps::multirange, 0);
+        return false;
+    }
+    if (!ok || res.iCode != 206)
+    {
+        snprintf(this->response, sizeof(this->response), "%s", res.errMessage.c_str());
+        return false;
+    }
+
+    std::string type = Lower(res.mapHeadersLowercase["content-type"]);
+    size_t at = type.find("boundary=");
+    if (type.compare(0, 20, "multipart/byteranges") == 0 && at != std::string::npos)
+    {
+        // The boundary keeps its case; only the header name was lowered.
+        std::string boundary = res.mapHeadersLowercase["content-type"].substr(at + 9);
+        boundary = boundary.substr(0, boundary.find(';'));
+        Util::Trim(boundary, " \"");
+        ParseByteRanges(body, boundary, deliver);
+        if (multi)
+            HostCaps::Learn(encoded_url, &HostCaps::Caps::multirange, 1);
+        return true;
+    }
+
+    // One part: a single span, or the server merged them.
+    int64_t first = 0, last = 0;
+    if (!ParseContentRange(res.mapHeadersLowercase["content-range"], first, last))
+        first = spans[0].first;
+    deliver(first, body.data(), body.size());
+    return true;
+}
+
+int BaseClient::GetRanges(const std::string &path, std::vector<RemoteRange> &ranges)
+{
+    if (ranges.size() < 2)
+        return RemoteClient::GetRanges(path, ranges);
+
+    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    uint64_t started = Util::GetTick();
+
+    // Nearby ranges become one span of a group.
+    std::vector<size_t> order(ranges.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&ranges](size_t a, size_t b)
+              { return ranges[a].offset < ranges[b].offset; });
+    std::vector<CHTTPMultiClient::Span> groups;
+    for (size_t i : order)
+    {
+        int64_t start = (int64_t)ranges[i].offset;
+        int64_t end = start + (int64_t)ranges[i].size;
+        if (!groups.empty() && start <= groups.back().second + (int64_t)kCoalesceGap &&
+            end - groups.back().first <= (int64_t)kMaxGroupBytes)
+            groups.back().second = std::max(groups.back().second, end);
+        else
+            groups.push_back({start, end});
+    }
+
+    // Copies what arrives into every range it overlaps.
+    std::vector<uint64_t> covered(ranges.size(), 0);
+    CHTTPMultiClient::RangeSinkFn deliver = [&](int64_t offset, const char *data, size_t len)
+    {
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            int64_t start = std::max(offset, (int64_t)ranges[i].offset);
+            int64_t end = std::min(offset + (int64_t)len, (int64_t)(ranges[i].offset + ranges[i].size));
+            if (start >= end)
+                continue;
+            memcpy(static_cast<char *>(ranges[i].buffer) + (start - (int64_t)ranges[i].offset), data + (start - offset),
+                   (size_t)(end - start));
+            covered[i] += (uint64_t)(end - start);
+        }
+        return true;
+    };
+    auto groupDone = [&](const CHTTPMultiClient::Span &group)
+    {
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            if ((int64_t)ranges[i].offset >= group.first && (int64_t)ranges[i].offset < group.second &&
+                covered[i] < ranges[i].size)
+                return false;
+        }
+        return true;
+    };
+
+    int requests = 0;
+    if (groups.size() == 1 || HostCaps::Get(encoded_url).multirange != 0)
+    {
+        for (size_t i = 0; i < groups.size() && !Cancel::Stopped(); i += kMaxPartsPerRequest)
+        {
+            std::vector<CHTTPMultiClient::Span> batch(groups.begin() + i,
+                                                      groups.begin() + std::min(groups.size(), i + kMaxPartsPerRequest));
+            requests++;
+            if (!GetSpans(encoded_url, batch, deliver) && HostCaps::Get(encoded_url).multirange == 0)
+                break;
+        }
+    }
+
+    // What is still missing goes out as one request per group, all of
+    // them in flight at once.
+    std::vector<CHTTPMultiClient::Span> missing;
+    for (const CHTTPMultiClient::Span &group : groups)
+    {
+        if (!groupDone(group))
+            missing.push_back(group);
+    }
+    if (!missing.empty() && !Cancel::Stopped())
+    {
+        CHTTPMultiClient engine;
+        SetupMultiClient(engine, 3);
+        // These reads feed a caller's buffers, not a download's progress bar.
+        engine.SetProgressCounter(nullptr);
+        // Each group is its own engine file, so one failed group doesn't
+        // fail the others.
+        std::vector<std::pair<int, CHTTPMultiClient::Span>> files;
+        for (const CHTTPMultiClient::Span &group : missing)
+            files.push_back({engine.AddFileSpans(encoded_url, group.second, group.second - group.first, deliver,
+                                                 std::vector<CHTTPMultiClient::Span>(1, group)),
+                             group});
+        int parallel = clientType() == CLIENT_TYPE_WEBDAV ? webdav_parallel_connections : http_parallel_connections;
+        parallel = std::max(1, std::min(parallel, (int)missing.size()));
+        RunMultiClient(engine, encoded_url, parallel);
+        requests += (int)missing.size();
+        for (const auto &file : files)
+        {
+            const CHTTPMultiClient::FileResult &result = engine.GetResult(file.first);
+            if (!result.ok)
+                SetMultiClientError(result);
+        }
+    }
+
+    int ret = 1;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        ranges[i].ok = covered[i] >= ranges[i].size;
+        if (!ranges[i].ok)
+            ret = 0;
+    }
+    Logger::Logf(Logger::LOG_DEBUG, "HTTP GET ranges url=%s ranges=%zu groups=%zu requests=%d ok=%d ms=%llu",
+                 encoded_url.c_str(), ranges.size(), groups.size(), requests, ret,
+                 (unsigned long long)((Util::GetTick() - started) / 1000));
+    return ret;
+}
+
+int BaseClient::BenchRead(const std::string &path, uint64_t bytes, int workers, int chunk_kb,
+                          const std::string &scratch)
+{
+    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    LocalFileSink sink(scratch);
+    if (!sink.Open(false))
+    {
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
+        return 0;
+    }
+    sink.Preallocate(bytes);
+
+    CHTTPMultiClient engine;
+    SetupMultiClient(engine, 3);
+    int index = engine.AddFileSpans(encoded_url, (int64_t)bytes, (int64_t)chunk_kb * 1024,
+                                    [&sink](int64_t offset, const char *data, size_t len)
+                                    {
+                                        return sink.WriteAt(static_cast<uint64_t>(offset), data, len);
+                                    },
+                                    std::vector<CHTTPMultiClient::Span>(1, CHTTPMultiClient::Span(0, (int64_t)bytes)));
+    bool ok = RunMultiClient(engine, encoded_url, workers);
+    bool written = sink.Close();
+    if (!ok)
+        SetMultiClientError(engine.GetResult(index));
+    else if (!written)
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+    return ok && written ? 1 : 0;
+}
+
+int BaseClient::GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data)
+{
+    // One plain GET; the body goes to `on_data` as curl delivers it.
+    CHTTPClient::HttpResponse res;
+    CHTTPClient::HeadersMap headers;
+    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    if (!client->GetToSink(encoded_url, headers, on_data, res))
+    {
+        sprintf(this->response, "%s", res.errMessage.c_str());
+        return 0;
+    }
+    if (res.iCode != 200)
+    {
+        sprintf(this->response, "%ld - %s", res.iCode, lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
+    }
+    return 1;
+}
+
 int BaseClient::Put(const std::string &inputfile, const std::string &path, uint64_t offset)
 {
     sprintf(this->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
@@ -186,7 +528,7 @@ int BaseClient::Delete(const std::string &path)
 int BaseClient::Copy(const std::string &from, const std::string &to)
 {
     sprintf(this->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
-    return 0;
+    return -1;
 }
 
 int BaseClient::Move(const std::string &from, const std::string &to)
@@ -367,3 +709,443 @@ int BaseClient::GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset)
     sprintf(this->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
     return -1;
 }
+
+int BaseClient::GetRangedIfWorthIt(const std::string &outputfile, const std::string &encoded_url,
+                                   const std::string &path, uint64_t offset)
+{
+    // Index hosts like Myrient and Archive.org throttle each connection, so
+    // anything worth a few ranges goes out as parallel ranges instead.
+    int64_t chunk_size = static_cast<int64_t>(webdav_chunk_size_mb) * 1024 * 1024;
+    if (offset != 0 || http_parallel_connections <= 1 || bytes_to_download < 2 * chunk_size ||
+        LocalFileSink::NeedsSplit(bytes_to_download))
+        return -1;
+    std::string final_url;
+    if (!ProbeRangeSupport(encoded_url, &final_url))
+        return -1;
+
+    // Ranges sent straight to the redirect target (a CDN node or datanode)
+    // skip a round trip. The original URL stays the primary source, so a
+    // signed target that expires mid-file is simply dropped.
+    std::vector<std::string> mirrors = MirrorUrls(path);
+    if (!final_url.empty() && final_url != encoded_url)
+        mirrors.insert(mirrors.begin(), final_url);
+
+    // There is no validator to resume against, so the journal stays in
+    // memory.
+    TransferJournal journal;
+    journal.Reset(bytes_to_download);
+    return GetRangedParallel(outputfile, encoded_url, bytes_to_download, chunk_size,
+                             http_parallel_connections, journal, false, mirrors);
+}
+
+bool BaseClient::ProbeRangeSupport(const std::string &encoded_url, std::string *final_url)
+{
+    int known = HostCaps::Get(encoded_url).range;
+    if (known >= 0)
+        return known == 1;
+
+    CHTTPClient::HttpResponse res;
+    CHTTPClient::HeadersMap headers;
+    headers["Range"] = "bytes=0-0";
+
+    if (!client->Get(encoded_url, headers, res))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "HTTP GET range probe error url=%s err=%s",
+                     encoded_url.c_str(), res.errMessage.c_str());
+        return false;
+    }
+
+    // Error pages say nothing about ranges.
+    if (res.iCode == 206 || res.iCode == 200)
+        HostCaps::Learn(encoded_url, &HostCaps::Caps::range, res.iCode == 206 ? 1 : 0);
+    if (res.iCode == 206)
+    {
+        Logger::Logf("HTTP GET range probe ok url=%s code=%ld",
+                     encoded_url.c_str(), res.iCode);
+        if (final_url)
+            *final_url = res.strEffectiveUrl;
+        return true;
+    }
+
+    Logger::Logf("HTTP GET range probe unsupported url=%s code=%ld",
+                 encoded_url.c_str(), res.iCode);
+    return false;
+}
+
+void BaseClient::FetchDigest(const std::string &encoded_url)
+{
+    // Nextcloud/ownCloud send OC-Checksum with every GET; RFC 3230 servers
+    // answer Want-Digest. The digest covers the whole file, not the range.
+    CHTTPClient::HttpResponse res;
+    CHTTPClient::HeadersMap headers;
+    headers["Range"] = "bytes=0-0";
+    headers["Want-Digest"] = Checksum::WantDigest();
+
+    if (!client->Get(encoded_url, headers, res) || !HTTP_SUCCESS(res.iCode))
+    {
+        Logger::Logf("HTTP VERIFY digest probe failed url=%s code=%ld err=%s",
+                     encoded_url.c_str(), res.iCode, res.errMessage.c_str());
+        return;
+    }
+
+    expected_digest = Checksum::FromHeaders(res.mapHeadersLowercase);
+    if (expected_digest.Valid())
+        Logger::Logf("HTTP VERIFY expecting url=%s %s=%s", encoded_url.c_str(),
+                     FileDigest::Name(expected_digest.algo), expected_digest.Hex().c_str());
+    else
+        Logger::Logf("HTTP VERIFY no server checksum url=%s", encoded_url.c_str());
+}
+
+bool BaseClient::VerifyDownload(const std::string &outputfile, bool split, bool digested, const FileDigest &actual)
+{
+    if (!expected_digest.Valid())
+        return true;
+    if (!digested)
+    {
+        // A read-back error says nothing about the data, and the write
+        // path already reports real disk failures.
+        Logger::Logf(Logger::LOG_WARN, "HTTP VERIFY skipped path=%s, could not digest the file", outputfile.c_str());
+        return true;
+    }
+    if (actual.value == expected_digest.value)
+    {
+        Logger::Logf("HTTP VERIFY ok path=%s %s=%s", outputfile.c_str(),
+                     FileDigest::Name(actual.algo), actual.Hex().c_str());
+        return true;
+    }
+
+    Logger::Logf(Logger::LOG_ERROR, "HTTP VERIFY mismatch path=%s %s expected=%s actual=%s", outputfile.c_str(),
+                 FileDigest::Name(actual.algo), expected_digest.Hex().c_str(), actual.Hex().c_str());
+    // Left in place, the full-size file would pass for a finished download.
+    if (split)
+        FS::RmRecursive(outputfile);
+    else
+        FS::Rm(outputfile);
+    sprintf(this->response, "%s", lang_strings[STR_CHECKSUM_MISMATCH]);
+    return false;
+}
+
+std::unique_ptr<ChunkHashTree> BaseClient::StartChunkHashes(const std::string &encoded_url, int64_t size,
+                                                            const TransferJournal &journal)
+{
+    if (!verify_downloads || !verify_chunks || size <= 0)
+        return nullptr;
+
+    CHTTPClient::HttpResponse res;
+    CHTTPClient::HeadersMap headers;
+    FileDigest whole;
+    std::vector<std::vector<uint8_t>> digests;
+    int64_t chunk = 0;
+    if (client->Get(encoded_url + ".sha256", headers, res) && res.iCode == 200 &&
+        ChunkHashTree::ParseList(res.strBody, whole, digests, chunk))
+    {
+        if (!digests.empty())
+        {
+            std::unique_ptr<ChunkHashTree> tree(new ChunkHashTree(size, chunk, FileDigest::SHA256));
+            if (tree->SetReference(digests))
+            {
+                Logger::Logf("HTTP VERIFY chunk list url=%s chunks=%zu chunk_kb=%lld", encoded_url.c_str(),
+                             digests.size(), (long long)(chunk / 1024));
+                return tree;
+            }
+            Logger::Logf(Logger::LOG_WARN, "HTTP VERIFY chunk list ignored url=%s chunks=%zu expected=%zu",
+                         encoded_url.c_str(), digests.size(), tree->Count());
+        }
+        else if (!expected_digest.Valid())
+        {
+            expected_digest = whole;
+            Logger::Logf("HTTP VERIFY expecting url=%s %s=%s from sidecar", encoded_url.c_str(),
+                         FileDigest::Name(whole.algo), whole.Hex().c_str());
+        }
+    }
+
+    // Without a list the leaves only narrow down a whole-file mismatch.
+    if (!expected_digest.Valid())
+        return nullptr;
+    std::unique_ptr<ChunkHashTree> tree(new ChunkHashTree(size, TransferJournal::kBlockSize, FileDigest::CRC32));
+    tree->LoadLeaves(journal);
+    return tree;
+}
+
+std::vector<ChunkHashTree::Span> BaseClient::RepairChunks(LocalFileSink &sink, const std::string &encoded_url,
+                                                          int64_t size, int64_t chunk_size, int parallel,
+                                                          ChunkHashTree &tree, bool &digested, FileDigest &actual)
+{
+    ChunkHashTree::ReadFn read = [&sink](uint64_t offset, char *data, size_t len)
+    { return sink.ReadAt(offset, data, len); };
+    bool mismatch = digested && actual.value != expected_digest.value;
+    std::vector<ChunkHashTree::Span> bad;
+    // A whole-file digest that matches outranks the list.
+    if (digested && !mismatch)
+        return bad;
+    // The leaves the ranges could not finish in passing are read back now,
+    // and with a list the chunks an earlier session fetched too.
+    bool finished = tree.Finish(read);
+    if (tree.HasReference() && finished)
+        bad = tree.Bad();
+    if (bad.empty() && mismatch)
+        bad = tree.SelfCheck(read);
+
+    for (int round = 0; !bad.empty() && round < kRepairRounds && !Cancel::Stopped(); round++)
+    {
+        int64_t bytes = 0;
+        for (const ChunkHashTree::Span &span : bad)
+            bytes += span.second - span.first;
+        Logger::Logf(Logger::LOG_WARN, "HTTP VERIFY repair url=%s round=%d spans=%zu bytes=%lld",
+                     encoded_url.c_str(), round, bad.size(), (long long)bytes);
+        bytes_transfered += -bytes;
+        tree.Restart(bad);
+        if (expected_digest.Valid())
+            sink.EnableChecksum(expected_digest.algo);
+
+        CHTTPMultiClient engine;
+        SetupMultiClient(engine, 6);
+        engine.AddFileSpans(encoded_url, size, chunk_size,
+                            [&sink, &tree](int64_t offset, const char *data, size_t len)
+                            {
+                                tree.Update(static_cast<uint64_t>(offset), data, len);
+                                return sink.WriteAt(static_cast<uint64_t>(offset), data, len);
+                            },
+                            bad,
+                            [&tree](int64_t start, int64_t end)
+                            { tree.Done(start, end); });
+        // The earlier digest stands, so a file left half repaired fails.
+        if (!RunMultiClient(engine, encoded_url, parallel))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "HTTP VERIFY repair failed url=%s round=%d", encoded_url.c_str(), round);
+            break;
+        }
+        digested = expected_digest.Valid() && sink.Digest(static_cast<uint64_t>(size), actual);
+        // Without a list the suspects were all there was to try.
+        bad.clear();
+        if (tree.HasReference())
+        {
+            tree.Finish(read);
+            bad = tree.Bad();
+        }
+    }
+
+    if (!tree.HasReference())
+        return std::vector<ChunkHashTree::Span>();
+    if (bad.empty())
+    {
+        FileDigest root;
+        root.algo = FileDigest::SHA256;
+        root.value = tree.Root();
+        Logger::Logf("HTTP VERIFY chunks ok url=%s chunks=%zu root=%s", encoded_url.c_str(), tree.Count(),
+                     root.Hex().c_str());
+    }
+    return bad;
+}
+
+void BaseClient::KeepBadChunks(const std::string &outputfile, bool split, const std::vector<ChunkHashTree::Span> &bad,
+                               const ChunkHashTree &tree, TransferJournal &journal)
+{
+    sprintf(this->response, "%s", lang_strings[STR_CHECKSUM_MISMATCH]);
+    if (journal.Kept())
+    {
+        for (const ChunkHashTree::Span &span : bad)
+            journal.MarkMissing(span.first, span.second - 1);
+        tree.SaveLeaves(journal);
+        if (journal.Save())
+        {
+            Logger::Logf(Logger::LOG_ERROR, "HTTP VERIFY kept for repair path=%s spans=%zu", outputfile.c_str(),
+                         bad.size());
+            return;
+        }
+        journal.Remove();
+    }
+    Logger::Logf(Logger::LOG_ERROR, "HTTP VERIFY chunks bad path=%s spans=%zu", outputfile.c_str(), bad.size());
+    // Left in place, the full-size file would pass for a finished download.
+    if (split)
+        FS::RmRecursive(outputfile);
+    else
+        FS::Rm(outputfile);
+}
+
+void BaseClient::SetupMultiClient(CHTTPMultiClient &engine, int max_attempts)
+{
+    engine.SetBasicAuth(http_username, http_password);
+    engine.SetCertificateFile(CACERT_FILE);
+    // Connections wait to see whether they can share one only where that
+    // may pay off.
+    engine.SetMultiplex(webdav_multiplex && HostCaps::Get(host_url).http2 != 0);
+    engine.SetRetryPolicy(max_attempts, 1000000, 16000000);
+    engine.SetProgressCounter(bytes_transfered.Atomic());
+    engine.SetCancelFlag(Cancel::Flag());
+    engine.SetEndgameSteal((int64_t)webdav_range_steal_kb * 1024);
+}
+
+bool BaseClient::RunMultiClient(CHTTPMultiClient &engine, const std::string &encoded_url, int parallel)
+{
+    HostCaps::Caps caps = HostCaps::Get(encoded_url);
+    if (caps.max_parallel > 0 && parallel > caps.max_parallel)
+    {
+        Logger::Logf("HTTP ranged-parallel url=%s parallel=%d capped=%d", encoded_url.c_str(), parallel, caps.max_parallel);
+        parallel = caps.max_parallel;
+    }
+    // An open breaker makes this a sequential ranged download that still
+    // retries only the ranges that failed.
+    int healthy = HostHealth::Parallel(encoded_url, parallel);
+    if (healthy < parallel)
+    {
+        Logger::Logf("HTTP ranged-parallel url=%s parallel=%d unhealthy=%d", encoded_url.c_str(), parallel, healthy);
+        parallel = healthy;
+    }
+    bool ok = engine.Run(parallel);
+
+    const CHTTPMultiClient::ServerTraits &seen = engine.Traits();
+    if (seen.http2 >= 0)
+        HostCaps::Learn(encoded_url, &HostCaps::Caps::http2, seen.http2);
+    // One fewer than the count it first refused.
+    int tolerated = seen.throttledAt - 1;
+    if (tolerated >= 1 && (caps.max_parallel == 0 || tolerated < caps.max_parallel))
+        HostCaps::Learn(encoded_url, &HostCaps::Caps::max_parallel, tolerated);
+    if (seen.rangeIgnored)
+        HostCaps::Learn(encoded_url, &HostCaps::Caps::range, 0);
+    return ok;
+}
+
+void BaseClient::SetMultiClientError(const CHTTPMultiClient::FileResult &result)
+{
+    if (Cancel::Stopped())
+        sprintf(this->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+    else if (result.errorMessage.empty() || result.errorMessage == "local write failed")
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+    else
+        snprintf(this->response, sizeof(this->response), "%s", result.errorMessage.c_str());
+}
+
+int BaseClient::GetRangedParallel(const std::string &outputfile,
+                                    const std::string &encoded_url,
+                                    int64_t size,
+                                    int64_t chunk_size,
+                                    int parallel,
+                                    TransferJournal &journal,
+                                    bool resume,
+                                    const std::vector<std::string> &mirrors)
+{
+    LocalFileSink sink(outputfile);
+    if (resume && !FS::FileExists(outputfile))
+    {
+        resume = false;
+        journal.Reset(size);
+    }
+    if (!sink.Open(resume))
+    {
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP GET parallel open failed path=%s", outputfile.c_str());
+        return 0;
+    }
+
+    // Reserving the whole file up front lets out-of-order ranges land
+    // without FAT32 zero-filling the gap in front of each one.
+    if (!resume && size > 0)
+        sink.Preallocate(static_cast<uint64_t>(size));
+    std::unique_ptr<ChunkHashTree> tree = StartChunkHashes(encoded_url, size, journal);
+    if (expected_digest.Valid())
+        sink.EnableChecksum(expected_digest.algo);
+
+    std::vector<CHTTPMultiClient::Span> spans = journal.MissingSpans();
+    bytes_transfered = resume ? journal.DoneBytes() : 0;
+    TransferStats::SetBytes(bytes_transfered);
+
+    CHTTPMultiClient engine;
+    SetupMultiClient(engine, 6);
+    StartAutoTune(engine, chunk_size, parallel);
+    int index = engine.AddFileSpans(encoded_url, size, chunk_size,
+                               [&sink, &tree](int64_t offset, const char *data, size_t len)
+                               {
+                                   if (tree)
+                                       tree->Update(static_cast<uint64_t>(offset), data, len);
+                                   return sink.WriteAt(static_cast<uint64_t>(offset), data, len);
+                               },
+                               spans,
+                               [&journal, &sink, &tree](int64_t start, int64_t end)
+                               {
+                                   if (tree)
+                                       tree->Done(start, end);
+                                   journal.MarkDone(start, end);
+                                   if (journal.SaveDue() && sink.Flush())
+                                   {
+                                       if (tree)
+                                           tree->SaveLeaves(journal);
+                                       journal.Save();
+                                   }
+                               });
+    if (!mirrors.empty())
+    {
+        engine.AddMirrors(index, mirrors);
+        Logger::Logf("HTTP GET ranged-parallel url=%s mirrors=%d", encoded_url.c_str(), (int)mirrors.size());
+    }
+
+    bool ok = RunMultiClient(engine, encoded_url, parallel);
+    FinishAutoTune(engine);
+    FileDigest actual;
+    bool digested = ok && expected_digest.Valid() && sink.Digest(static_cast<uint64_t>(size), actual);
+    std::vector<ChunkHashTree::Span> bad;
+    if (ok && tree)
+        bad = RepairChunks(sink, encoded_url, size, chunk_size, parallel, *tree, digested, actual);
+    // An interrupted download keeps the CRC-32s of the chunks it finished.
+    else if (tree && !tree->HasReference())
+        tree->Finish([&sink](uint64_t offset, char *data, size_t len)
+                     { return sink.ReadAt(offset, data, len); });
+    // A queued write that failed after its range completed leaves blocks
+    // the journal already counted, so only a clean sink keeps the journal.
+    bool written = sink.Close();
+    if (written && !bad.empty())
+        KeepBadChunks(outputfile, false, bad, *tree, journal);
+    else if (ok || !written)
+        journal.Remove();
+    else
+    {
+        if (tree)
+            tree->SaveLeaves(journal);
+        journal.Save();
+    }
+
+    const CHTTPMultiClient::FileResult &result = engine.GetResult(index);
+    if (!written)
+    {
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP GET ranged-parallel write failed path=%s", outputfile.c_str());
+        return 0;
+    }
+    if (!ok)
+    {
+        SetMultiClientError(result);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP GET ranged-parallel error url=%s err=%s",
+                     encoded_url.c_str(),
+                     result.errorMessage.c_str());
+        return 0;
+    }
+
+    if (bytes_transfered <= 0)
+    {
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        Logger::Logf("HTTP GET ranged-parallel produced no data url=%s", encoded_url.c_str());
+        return 0;
+    }
+    if (!bad.empty() || !VerifyDownload(outputfile, false, digested, actual))
+        return 0;
+
+    uint64_t now = Util::GetTick();
+    double elapsed_sec = (now - prev_tick) * 1.0 / 1000000.0;
+    double mb = (bytes_transfered / 1048576.0);
+    double avg_mbps = (elapsed_sec > 0.0) ? (mb / elapsed_sec) : 0.0;
+
+    Logger::Logf("HTTP PERF ranged-parallel url=%s size=%lld chunk_mb=%lld parallel=%d elapsed=%.2fs avg=%.2f MiB/s",
+                 encoded_url.c_str(),
+                 static_cast<long long>(bytes_transfered),
+                 static_cast<long long>(chunk_size / (1024 * 1024)),
+                 parallel,
+                 elapsed_sec,
+                 avg_mbps);
+
+    Logger::Logf("HTTP GET ranged-parallel done url=%s code=%ld bytes=%lld parallel=%d",
+                 encoded_url.c_str(),
+                 result.lastHttpCode,
+                 static_cast<long long>(bytes_transfered),
+                 parallel);
+    return 1;
+}
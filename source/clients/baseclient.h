@@ -3,9 +3,17 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include "httpclient/HTTPClient.h"
+#include "httpclient/HTTPMultiClient.h"
 #include "clients/remote_client.h"
 #include "common.h"
+#include "transfer_journal.h"
+#include "checksum.h"
+#include "chunk_hashes.h"
+#include "host_caps.h"
+
+class LocalFileSink;
 
 class BaseClient : public RemoteClient
 {
@@ -18,6 +26,16 @@ public:
     int Size(const std::string &path, int64_t *size);
     int Get(const std::string &outputfile, const std::string &path, uint64_t offset=0);
     int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset);
+    // Ranges closer than 128 KiB are merged. The groups go out as one
+    // multipart/byteranges request where the host answers those (HostCaps
+    // multirange), and whatever is still missing as parallel requests on a
+    // CHTTPMultiClient.
+    int GetRanges(const std::string &path, std::vector<RemoteRange> &ranges) override;
+    // Parallel ranges of `chunk_kb` on `workers` connections, as
+    // GetRangedParallel() runs them.
+    int BenchRead(const std::string &path, uint64_t bytes, int workers, int chunk_kb,
+                  const std::string &scratch) override;
+    int GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data) override;
     int Put(const std::string &inputfile, const std::string &path, uint64_t offset=0);
     int Rename(const std::string &src, const std::string &dst);
     int Delete(const std::string &path);
@@ -37,12 +55,88 @@ public:
     int Quit();
     ClientType clientType();
     uint32_t SupportedActions();
+    // Capabilities stored with the site; Connect() seeds HostCaps with
+    // them. GetCaps() returns what is known of the site's host by now.
+    void SetStoredCaps(const HostCaps::Caps &caps);
+    HostCaps::Caps GetCaps() const;
+    // Wait before retry `attempt` (0 for the first) of a whole file, from
+    // HostHealth for the site's host.
+    uint64_t RetryDelayUs(int attempt) const;
     static std::string Escape(const std::string &url);
     static std::string UnEscape(const std::string &url);
     static int DownloadProgressCallback(void* ptr, double dTotalToDownload, double dNowDownloaded, double dTotalToUpload, double dNowUploaded);
     static int UploadProgressCallback(void* ptr, double dTotalToDownload, double dNowDownloaded, double dTotalToUpload, double dNowUploaded);
 
 protected:
+    // Whether a one-byte `Range` GET of `encodedUrl` comes back as 206,
+    // asked once per host (HostCaps); `finalUrl` receives where redirects
+    // led when the probe ran.
+    bool ProbeRangeSupport(const std::string &encodedUrl, std::string *finalUrl = nullptr);
+    // GetRangedParallel of `bytes_to_download` bytes when http_parallel
+    // allows it, the file spans a few chunks and the server honours Range.
+    // A redirect target joins MirrorUrls() as a source. Returns -1 when
+    // the caller should stream a plain GET instead.
+    int GetRangedIfWorthIt(const std::string &outputfile, const std::string &encodedUrl,
+                           const std::string &path, uint64_t offset);
+    // Asks for the checksum of `encodedUrl` (verify_downloads) and keeps
+    // it in expected_digest; leaves it empty when the server has none.
+    void FetchDigest(const std::string &encodedUrl);
+    // Compares a finished download against expected_digest. On a mismatch
+    // it deletes `outputfile` (a folder when `split`), sets response and
+    // returns false; without a digest to compare it returns true.
+    bool VerifyDownload(const std::string &outputfile, bool split, bool digested, const FileDigest &actual);
+    // With verify_downloads and verify_chunks, per-chunk digests for a
+    // ranged download of `size` bytes of `encodedUrl`: SHA-256 leaves to
+    // check against the "<url>.sha256" list the server publishes (which
+    // may hold the whole file's digest instead, then kept in
+    // expected_digest), or CRC-32 leaves seeded from `journal`. nullptr
+    // when there is nothing to check them against.
+    std::unique_ptr<ChunkHashTree> StartChunkHashes(const std::string &encodedUrl, int64_t size,
+                                                    const TransferJournal &journal);
+    // Fetches again, on the still open `sink`, the chunks `tree` finds bad,
+    // or its suspects once the file failed expected_digest, for a few
+    // rounds, digesting the file afresh after each; `digested` and
+    // `actual` follow the last digest. Returns the chunks a reference
+    // still rejects.
+    std::vector<ChunkHashTree::Span> RepairChunks(LocalFileSink &sink, const std::string &encodedUrl, int64_t size,
+                                                  int64_t chunk_size, int parallel, ChunkHashTree &tree,
+                                                  bool &digested, FileDigest &actual);
+    // After RepairChunks() left `bad`: with a kept journal the file stays
+    // and `bad` is marked missing, so the next attempt fetches only that;
+    // otherwise the file is deleted. Sets response.
+    void KeepBadChunks(const std::string &outputfile, bool split, const std::vector<ChunkHashTree::Span> &bad,
+                       const ChunkHashTree &tree, TransferJournal &journal);
+    // Downloads the journal's missing spans of a range-capable URL into
+    // `outputfile` with up to `parallel` ranges in flight on one
+    // CHTTPMultiClient. A journal without a destination keeps no state on
+    // SD. Returns 1, or 0 with response set.
+    int GetRangedParallel(const std::string &outputfile,
+                          const std::string &encodedUrl,
+                          int64_t size,
+                          int64_t chunk_size,
+                          int parallel,
+                          TransferJournal &journal,
+                          bool resume,
+                          const std::vector<std::string> &mirrors = std::vector<std::string>());
+    // Other URLs of `path` that GetRangedParallel may spread ranges over
+    // (datanodes, mirrors); none by default.
+    virtual std::vector<std::string> MirrorUrls(const std::string &path) { return std::vector<std::string>(); }
+    // Checksum the site lists for `path`, checked by Get() when
+    // verify_downloads is on; none by default.
+    virtual FileDigest ExpectedDigest(const std::string &path) { return FileDigest(); }
+    void SetupMultiClient(CHTTPMultiClient &engine, int max_attempts);
+    // One GET of the sorted half-open `spans` of `encodedUrl`, several as a
+    // multi-range request; what arrives goes to `deliver` by offset. False
+    // when the request failed or the server ignored the ranges.
+    bool GetSpans(const std::string &encodedUrl, const std::vector<CHTTPMultiClient::Span> &spans,
+                  const CHTTPMultiClient::RangeSinkFn &deliver);
+    // engine.Run() with no more requests in flight than the host of
+    // `encodedUrl` is known to take, then keeps what the run showed of it.
+    bool RunMultiClient(CHTTPMultiClient &engine, const std::string &encodedUrl, int parallel);
+    void SetMultiClientError(const CHTTPMultiClient::FileResult &result);
+    // Adaptive range count/size around GetRangedParallel; off by default.
+    virtual void StartAutoTune(CHTTPMultiClient &engine, int64_t chunk_size, int parallel) {}
+    virtual void FinishAutoTune(const CHTTPMultiClient &engine) {}
 
     CHTTPClient *client;
     std::string base_path;
@@ -51,6 +145,8 @@ protected:
     std::string http_password;
     char response[512];
     bool connected = false;
+    FileDigest expected_digest;
+    HostCaps::Caps stored_caps;
 };
 
 #endif
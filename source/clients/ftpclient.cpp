@@ -10,9 +10,33 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <switch.h>
+#include <zlib.h>
 
 #include "lang.h"
 #include "clients/ftpclient.h"
+#include "config.h"
+#include "logger.h"
+#include "threads.h"
+#include "transfer_trace.h"
+#include "rate_limiter.h"
+#include "transfer_stats.h"
+#include "parse_profile.h"
+#include "local_sink.h"
+#include "transfer_pipeline.h"
+#include "upload_source.h"
+#include "buffer_pool.h"
+#include "cancel.h"
+#include "resolver.h"
+#include "socket_tuning.h"
+#include "keepalive.h"
 #include "util.h"
 #include "windows.h"
 
@@ -24,6 +48,361 @@
 #define FTP_CLIENT_READ 1
 #define FTP_CLIENT_WRITE 2
 
+#define FTP_SEGMENT_ATTEMPTS 3
+
+namespace
+{
+	/* Parallel segment workers share the GUI progress counter. */
+	std::mutex ftp_progress_mutex;
+
+	void AddProgress(int64_t delta)
+	{
+		std::lock_guard<std::mutex> lock(ftp_progress_mutex);
+		bytes_transfered += delta;
+		TransferStats::AddBytes(delta);
+	}
+
+	struct FtpParallelContext
+	{
+		LocalFileSink *sink = NULL;
+		std::string path;
+		uint64_t size = 0;
+		uint64_t segment = 0;
+		/* segments are claimed with one fetch_add; the lock only guards
+		   errorMessage */
+		std::atomic<uint64_t> nextOffset{0};
+		std::atomic<bool> hadError{false};
+		std::mutex stateMutex;
+		std::string errorMessage;
+		/* TransferStats slot of the queue worker that owns the file */
+		int statsSlot = -1;
+	};
+
+	struct FtpWorkerArgs
+	{
+		FtpParallelContext *ctx = nullptr;
+		FtpClient *client = nullptr;
+	};
+
+	void FtpParallelWorker(FtpParallelContext *ctx, FtpClient *client)
+	{
+		while (true)
+		{
+			if (ctx->hadError || Cancel::Stopped())
+				return;
+			uint64_t start = ctx->nextOffset.fetch_add(ctx->segment);
+			if (start >= ctx->size)
+				return;
+			uint64_t length = std::min(ctx->segment, ctx->size - start);
+
+			bool ok = false;
+			for (int attempt = 1; attempt <= FTP_SEGMENT_ATTEMPTS; attempt++)
+			{
+				uint64_t done = 0;
+				ok = client->GetSegment(*ctx->sink, ctx->path, start, length, &done) == 1;
+				if (ok)
+				{
+					TransferStats::RangeDone(start, start + length);
+					break;
+				}
+				/* the segment is fetched again from its start */
+				AddProgress(-(int64_t)done);
+				if (Cancel::Stopped())
+					break;
+				TransferStats::AddRetry();
+				LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "FTP GET parallel segment error path=%s offset=%llu len=%llu attempt=%d/%d resp=%s",
+							     ctx->path.c_str(), (unsigned long long)start, (unsigned long long)length,
+							     attempt, FTP_SEGMENT_ATTEMPTS, client->LastResponse());
+			}
+
+			if (!ok)
+			{
+				std::lock_guard<std::mutex> lock(ctx->stateMutex);
+				if (!ctx->hadError.exchange(true))
+				{
+					ctx->errorMessage = Cancel::Stopped() ? lang_strings[STR_CANCEL_ACTION_MSG] : client->LastResponse();
+				}
+				return;
+			}
+		}
+	}
+
+	void FtpParallelWorkerThread(void *argp)
+	{
+		FtpWorkerArgs *args = static_cast<FtpWorkerArgs *>(argp);
+		TransferStats::Bind(args->ctx->statsSlot);
+		FtpParallelWorker(args->ctx, args->client);
+	}
+
+	/* Idle logins by "user@url", most recently released last. */
+	struct PooledSession
+	{
+		std::string key;
+		FtpClient *client;
+		/* last traffic, a keep-alive NOOP included */
+		uint64_t idleSince;
+		/* last handed back by a worker */
+		uint64_t releasedAt;
+	};
+
+	std::mutex ftp_pool_mutex;
+	std::vector<PooledSession> ftp_pool;
+	/* reused straight away below this idle time, NOOP-checked up to the
+	 * second one; servers commonly drop logins idle for a few minutes */
+	const uint64_t kPoolTrustUs = 15ULL * 1000000;
+	const uint64_t kPoolMaxIdleUs = 240ULL * 1000000;
+
+	/* Entries of recent listings by FtpClient::listingKey(), shared by every
+	 * session so the workers of a folder walk size files other workers
+	 * listed without TYPE/SIZE round trips. */
+	struct FtpCachedEntry
+	{
+		int64_t size;
+		bool isDir;
+		uint64_t tick;
+	};
+
+	std::mutex ftp_listing_mutex;
+	std::unordered_map<std::string, FtpCachedEntry> ftp_listing_cache;
+	/* folders whose complete listing is cached, so a name missing from it
+	 * is known not to exist */
+	std::unordered_map<std::string, uint64_t> ftp_listed_dirs;
+	const size_t kMaxCachedEntries = 65536;
+
+	std::string ParentPath(const std::string &path)
+	{
+		size_t slash = path.find_last_of('/');
+		return slash == std::string::npos ? "" : path.substr(0, slash);
+	}
+
+	/* Listing lines are parsed where they lie in the read buffer; a field
+	 * is a pointer and length into the line. */
+	struct FtpField
+	{
+		const char *p;
+		size_t n;
+	};
+
+	enum FtpListFormat
+	{
+		FTP_LIST_UNKNOWN,
+		FTP_LIST_UNIX,
+		FTP_LIST_DOS,
+		FTP_LIST_MLSD
+	};
+
+	/* bytes read from the data connection per recv() while listing */
+	const size_t kListReadSize = 256 * 1024;
+	/* deflated bytes read per recv() in MODE Z */
+	const size_t kDeflateReadSize = 64 * 1024;
+
+	/* names whose data deflates well enough to be worth MODE Z on a file */
+	bool Compressible(const std::string &path)
+	{
+		static const std::set<std::string> extra = {".csv", ".md", ".sql", ".svg", ".js", ".css", ".yml",
+													".yaml", ".tar", ".bmp", ".htm", ".cfg"};
+		std::string ext = path;
+		size_t dot = ext.rfind('.');
+		if (dot == std::string::npos || ext.find('/', dot) != std::string::npos)
+			return false;
+		ext = Util::ToLower(ext.substr(dot));
+		return text_file_extensions.count(ext) > 0 || extra.count(ext) > 0;
+	}
+
+	bool NextField(const char *&cur, const char *end, FtpField &field)
+	{
+		while (cur < end && (*cur == ' ' || *cur == '\t'))
+			cur++;
+		if (cur == end)
+			return false;
+		field.p = cur;
+		while (cur < end && *cur != ' ' && *cur != '\t')
+			cur++;
+		field.n = cur - field.p;
+		return true;
+	}
+
+	bool AllDigits(const FtpField &field)
+	{
+		for (size_t i = 0; i < field.n; i++)
+		{
+			if (field.p[i] < '0' || field.p[i] > '9')
+				return false;
+		}
+		return field.n > 0;
+	}
+
+	/* value of the first `n` characters of `p` that are digits */
+	uint64_t Digits(const char *p, size_t n)
+	{
+		uint64_t value = 0;
+		for (size_t i = 0; i < n && p[i] >= '0' && p[i] <= '9'; i++)
+			value = value * 10 + (p[i] - '0');
+		return value;
+	}
+
+	bool FieldIs(const FtpField &field, const char *text)
+	{
+		size_t n = strlen(text);
+		return field.n == n && strncasecmp(field.p, text, n) == 0;
+	}
+
+	int MonthOf(const FtpField &field)
+	{
+		static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+		if (field.n != 3)
+			return 0;
+		for (int i = 0; i < 12; i++)
+		{
+			if (strncasecmp(field.p, months + i * 3, 3) == 0)
+				return i + 1;
+		}
+		return 0;
+	}
+
+	void SetName(DirEntry *entry, const char *p, size_t n, size_t max)
+	{
+		n = MIN(n, max);
+		memcpy(entry->name, p, n);
+		entry->name[n] = '\0';
+	}
+
+	/* The format of a LIST reply, told from its first entry line. */
+	FtpListFormat DetectListFormat(const char *line, size_t len)
+	{
+		if (len >= 8 && isdigit((unsigned char)line[0]) && (line[2] == '-' || line[2] == '/'))
+			return FTP_LIST_DOS;
+		if (len >= 10 && strchr("-dlbcps", line[0]) != NULL)
+			return FTP_LIST_UNIX;
+		return FTP_LIST_UNKNOWN;
+	}
+
+	/* "drwxr-xr-x 2 owner group 4096 Jan 12 10:30 name". The size is the
+	 * field before the month, so listings without a group column or with
+	 * extra columns parse the same. */
+	int ParseUnixLine(const char *line, size_t len, int this_year, DirEntry *entry)
+	{
+		const char *cur = line, *end = line + len;
+		FtpField perms, prev, field, day, when;
+		if (!NextField(cur, end, perms))
+			return -1;
+		prev.n = 0;
+		int month = 0;
+		for (int i = 1; i < 8 && NextField(cur, end, field); i++)
+		{
+			if (i >= 3 && AllDigits(prev) && (month = MonthOf(field)) != 0)
+				break;
+			prev = field;
+		}
+		if (month == 0 || !NextField(cur, end, day) || !NextField(cur, end, when))
+			return -1;
+
+		if (when.n == 4 && AllDigits(when))
+			entry->modified.year = (uint16_t)Digits(when.p, 4);
+		else if (when.n == 5 && when.p[2] == ':')
+		{
+			entry->modified.hours = (uint8_t)Digits(when.p, 2);
+			entry->modified.minutes = (uint8_t)Digits(when.p + 3, 2);
+			entry->modified.year = (uint16_t)this_year;
+		}
+		else
+			return -1;
+
+		// the name follows one space and may itself start with spaces
+		if (cur == end)
+			return -1;
+		cur++;
+		if (cur == end)
+			return -1;
+
+		entry->isDir = perms.p[0] == 'd';
+		entry->file_size = Digits(prev.p, prev.n);
+		entry->modified.month = (uint8_t)month;
+		entry->modified.day = (uint8_t)Digits(day.p, day.n);
+		SetName(entry, cur, end - cur, FTP_CLIENT_MAX_FILENAME_LEN);
+		return 1;
+	}
+
+	/* "01-12-20  10:30AM       <DIR>          name" (IIS and other
+	 * MS-DOS style servers), years given as yy or yyyy. */
+	int ParseDosLine(const char *line, size_t len, DirEntry *entry)
+	{
+		const char *cur = line, *end = line + len;
+		FtpField date, time, size;
+		if (!NextField(cur, end, date) || !NextField(cur, end, time) || !NextField(cur, end, size))
+			return -1;
+		if (!((date.n == 8 || date.n == 10) && date.p[2] == date.p[5] && (date.p[2] == '-' || date.p[2] == '/')))
+			return -1;
+		if (time.n < 5 || time.p[2] != ':')
+			return -1;
+		while (cur < end && (*cur == ' ' || *cur == '\t'))
+			cur++;
+		if (cur == end)
+			return -1;
+
+		entry->modified.month = (uint8_t)Digits(date.p, 2);
+		entry->modified.day = (uint8_t)Digits(date.p + 3, 2);
+		entry->modified.year = (uint16_t)(date.n == 8 ? 2000 + Digits(date.p + 6, 2) : Digits(date.p + 6, 4));
+		int hours = (int)Digits(time.p, 2);
+		if (time.n >= 7 && (time.p[5] == 'P' || time.p[5] == 'p'))
+			hours = hours % 12 + 12;
+		else if (time.n >= 7 && (time.p[5] == 'A' || time.p[5] == 'a'))
+			hours = hours % 12;
+		entry->modified.hours = (uint8_t)hours;
+		entry->modified.minutes = (uint8_t)Digits(time.p + 3, 2);
+		if (FieldIs(size, "<DIR>"))
+			entry->isDir = true;
+		else
+			entry->file_size = Digits(size.p, size.n);
+		SetName(entry, cur, end - cur, FTP_CLIENT_MAX_FILENAME_LEN);
+		return 1;
+	}
+
+	/* "type=file;size=1234;modify=20200112103000; name" (RFC 3659). The
+	 * listed folder itself and its parent are skipped with 0. */
+	int ParseMlsdLine(const char *line, size_t len, DirEntry *entry)
+	{
+		const char *end = line + len;
+		const char *space = static_cast<const char *>(memchr(line, ' ', len));
+		if (space == NULL || space + 1 == end)
+			return -1;
+
+		for (const char *fact = line; fact < space;)
+		{
+			const char *stop = static_cast<const char *>(memchr(fact, ';', space - fact));
+			if (stop == NULL)
+				stop = space;
+			const char *eq = static_cast<const char *>(memchr(fact, '=', stop - fact));
+			if (eq != NULL)
+			{
+				FtpField key = {fact, (size_t)(eq - fact)};
+				FtpField value = {eq + 1, (size_t)(stop - eq - 1)};
+				if (FieldIs(key, "type"))
+				{
+					if (FieldIs(value, "cdir") || FieldIs(value, "pdir"))
+						return 0;
+					entry->isDir = FieldIs(value, "dir");
+				}
+				else if (FieldIs(key, "size"))
+					entry->file_size = Digits(value.p, value.n);
+				else if (FieldIs(key, "modify") && value.n >= 14)
+				{
+					entry->modified.year = (uint16_t)Digits(value.p, 4);
+					entry->modified.month = (uint8_t)Digits(value.p + 4, 2);
+					entry->modified.day = (uint8_t)Digits(value.p + 6, 2);
+					entry->modified.hours = (uint8_t)Digits(value.p + 8, 2);
+					entry->modified.minutes = (uint8_t)Digits(value.p + 10, 2);
+					entry->modified.seconds = (uint8_t)Digits(value.p + 12, 2);
+				}
+			}
+			fact = stop + 1;
+		}
+
+		SetName(entry, space + 1, end - space - 1, sizeof(entry->name) - 1);
+		return 1;
+	}
+}
+
 FtpClient::FtpClient()
 {
 	mp_ftphandle = static_cast<ftphandle *>(calloc(1, sizeof(ftphandle)));
@@ -49,6 +428,8 @@ FtpClient::~FtpClient()
 int FtpClient::Connect(const std::string &url, const std::string &user, const std::string &pass)
 {
 	int port = 21;
+	site_copy = -1;
+	mode_z_on = false;
 	std::string host = url.substr(6);
 	size_t colon_pos = host.find(":");
 	if (colon_pos != std::string::npos)
@@ -57,10 +438,7 @@ int FtpClient::Connect(const std::string &url, const std::string &user, const st
 		host = host.substr(0, colon_pos);
 	}
 
-	struct hostent *he;
-	struct in_addr **addr_list;
-	char ip[20];
-	int i;
+	char ip[INET_ADDRSTRLEN];
 
 	if (strcmp(host.c_str(), "localhost") == 0)
 	{
@@ -68,18 +446,15 @@ int FtpClient::Connect(const std::string &url, const std::string &user, const st
 	}
 	else
 	{
-		if ((he = gethostbyname(host.c_str())) == NULL)
+		// The control and data connections here are IPv4 only.
+		struct sockaddr_storage resolved;
+		socklen_t resolved_len = 0;
+		if (!Resolver::Resolve(host, port, &resolved, &resolved_len) || resolved.ss_family != AF_INET)
 		{
 			sprintf(mp_ftphandle->response, "%s", lang_strings[STR_COULD_NOT_RESOLVE_HOST]);
 			return 0;
 		}
-
-		addr_list = (struct in_addr **)he->h_addr_list;
-		for (i = 0; addr_list[i] != NULL; i++)
-		{
-			strcpy(ip, inet_ntoa(*addr_list[i]));
-			break;
-		}
+		inet_ntop(AF_INET, &((struct sockaddr_in *)&resolved)->sin_addr, ip, sizeof(ip));
 	}
 
 	int sControl;
@@ -114,11 +489,15 @@ int FtpClient::Connect(const std::string &url, const std::string &user, const st
 		return 0;
 	}
 
+	uint64_t connect_start = Util::GetTick();
 	retval = connect(sControl, (sockaddr *)&server_addr, sizeof(server_addr));
+	if (retval == 0)
+		SocketTuning::ObserveRtt(SocketTuning::HostOf(url), Util::GetTick() - connect_start);
 	if (retval == -1)
 	{
 		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_TIMEOUT_MSG]);
 		close(sControl);
+		Resolver::Forget(host);
 		return 0;
 	}
 	mp_ftphandle->handle = sControl;
@@ -147,6 +526,9 @@ int FtpClient::Connect(const std::string &url, const std::string &user, const st
 		if (*LastResponse() == '2')
 		{
 			mp_ftphandle->is_connected = true;
+			conn_url = url;
+			conn_user = user;
+			conn_pass = pass;
 			return 1;
 		}
 		else
@@ -163,6 +545,9 @@ int FtpClient::Connect(const std::string &url, const std::string &user, const st
 	if ((ret = FtpSendCmd(cmd, "2", mp_ftphandle)))
 	{
 		mp_ftphandle->is_connected = true;
+		conn_url = url;
+		conn_user = user;
+		conn_pass = pass;
 	}
 	else
 	{
@@ -293,7 +678,7 @@ int FtpClient::Readline(char *buf, int max, ftphandle *nControl)
 			break;
 		}
 
-		x = recv(nControl->handle, nControl->cput, nControl->cleft, 0);
+		x = DataRecv(nControl, nControl->cput, nControl->cleft);
 
 		if (x == -1)
 		{
@@ -356,7 +741,8 @@ void FtpClient::SetConnmode(connmode mode)
  *
  * return 1 if successful, 0 otherwise
  */
-int FtpClient::FtpAccess(const std::string &path, accesstype type, transfermode mode, ftphandle *nControl, ftphandle **nData)
+int FtpClient::FtpAccess(const std::string &path, accesstype type, transfermode mode, ftphandle *nControl, ftphandle **nData,
+						 bool deflate)
 {
 	char buf[512];
 	int dir;
@@ -370,6 +756,14 @@ int FtpClient::FtpAccess(const std::string &path, accesstype type, transfermode
 	if (!FtpSendCmd(buf, "2", nControl))
 		return 0;
 
+	/* the mode stays for the session, so it only changes between a
+	 * deflated transfer and one that is not; a resumed read is never
+	 * deflated, as REST offsets in MODE Z are not agreed on */
+	bool listing = type == FtpClient::dir || type == FtpClient::dirverbose || type == FtpClient::dirmlsd;
+	deflate = ftp_mode_z > 0 && mode_z != 0 && (listing || (deflate && type == FtpClient::fileread && nControl->offset == 0));
+	if (deflate != mode_z_on && !SetModeZ(deflate, nControl) && !deflate)
+		return 0;
+
 	switch (type)
 	{
 	case FtpClient::dir:
@@ -391,7 +785,7 @@ int FtpClient::FtpAccess(const std::string &path, accesstype type, transfermode
 		break;
 	case FtpClient::filewriteappend:
 	case FtpClient::filewrite:
-		strcpy(buf, "STOR");
+		strcpy(buf, type == FtpClient::filewriteappend && append_upload ? "APPE" : "STOR");
 		dir = FTP_CLIENT_WRITE;
 		break;
 	default:
@@ -426,9 +820,97 @@ int FtpClient::FtpAccess(const std::string &path, accesstype type, transfermode
 		}
 	}
 
+	(*nData)->started = Util::GetTick();
+	if (mode_z_on)
+	{
+		z_stream *zs = static_cast<z_stream *>(calloc(1, sizeof(z_stream)));
+		(*nData)->zbuf = static_cast<char *>(malloc(kDeflateReadSize));
+		if (zs == NULL || (*nData)->zbuf == NULL || inflateInit(zs) != Z_OK)
+		{
+			free(zs);
+			FtpClose(*nData);
+			*nData = NULL;
+			sprintf(nControl->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+			return 0;
+		}
+		(*nData)->zs = zs;
+	}
+
+	/* a recv() or send() blocked on a stalled server returns as soon as
+	 * the transfer is cancelled */
+	int handle = (*nData)->handle;
+	(*nData)->cancel_hook = Cancel::Add([handle]()
+										{ shutdown(handle, SHUT_RDWR); });
 	return 1;
 }
 
+bool FtpClient::SetModeZ(bool on, ftphandle *nControl)
+{
+	if (FtpSendCmd(on ? "MODE Z" : "MODE S", "2", nControl))
+	{
+		if (on && mode_z != 1)
+			Logger::Logf("FTP MODE Z accepted server=%s", conn_url.c_str());
+		mode_z_on = on;
+		if (on)
+			mode_z = 1;
+		return true;
+	}
+	if (on)
+	{
+		Logger::Logf("FTP MODE Z refused server=%s resp=%s", conn_url.c_str(), nControl->response);
+		mode_z = 0;
+	}
+	return false;
+}
+
+bool FtpClient::WantsDeflate(const std::string &path) const
+{
+	if (ftp_mode_z < 2 || mode_z == 0 || !Compressible(path))
+		return false;
+	double rate = SocketTuning::Rate(SocketTuning::HostOf(conn_url));
+	return rate > 0 && rate * 8 < ftp_mode_z_mbps * 1000000.0;
+}
+
+ssize_t FtpClient::DataRecv(ftphandle *nData, void *buf, size_t max)
+{
+	if (nData->zs == NULL)
+	{
+		ssize_t got = recv(nData->handle, buf, max, 0);
+		if (got > 0)
+			nData->wire += got;
+		return got;
+	}
+
+	/* inflates until some output is ready, reading the socket whenever
+	 * the deflated bytes run out */
+	z_stream *zs = nData->zs;
+	zs->next_out = static_cast<Bytef *>(buf);
+	zs->avail_out = (uInt)max;
+	while (zs->avail_out == max && !nData->zend)
+	{
+		if (zs->avail_in == 0)
+		{
+			ssize_t got = recv(nData->handle, nData->zbuf, kDeflateReadSize, 0);
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got <= 0)
+				return got;
+			nData->wire += got;
+			zs->next_in = reinterpret_cast<Bytef *>(nData->zbuf);
+			zs->avail_in = (uInt)got;
+		}
+		int ret = inflate(zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			nData->zend = true;
+		else if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			Logger::Logf(Logger::LOG_ERROR, "FTP MODE Z inflate error=%d server=%s", ret, conn_url.c_str());
+			return -1;
+		}
+	}
+	return (ssize_t)(max - zs->avail_out);
+}
+
 /*
  * FtpAcceptConnection - accept connection from server
  *
@@ -537,12 +1019,16 @@ int FtpClient::FtpOpenPasv(ftphandle *nControl, ftphandle **nData, transfermode
 	sin.sa.sa_data[0] = v[0];
 	sin.sa.sa_data[1] = v[1];
 
-	if (mp_ftphandle->offset != 0)
+	if (mp_ftphandle->offset != 0 && !(dir == FTP_CLIENT_WRITE && append_upload))
 	{
 		char buf[512];
 		sprintf(buf, "REST %lld", mp_ftphandle->offset);
 		if (!FtpSendCmd(buf, "3", nControl))
-			return 0;
+		{
+			if (dir == FTP_CLIENT_WRITE)
+				rest_stor_refused = true;
+			return -1;
+		}
 	}
 
 	sData = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -562,6 +1048,7 @@ int FtpClient::FtpOpenPasv(ftphandle *nControl, ftphandle **nData, transfermode
 		close(sData);
 		return -1;
 	}
+	SocketTuning::Apply(sData, SocketTuning::HostOf(conn_url));
 
 	if (nControl->dir != FTP_CLIENT_CONTROL)
 		return -1;
@@ -669,6 +1156,7 @@ int FtpClient::FtpOpenPort(ftphandle *nControl, ftphandle **nData, transfermode
 		close(sData);
 		return -1;
 	}
+	SocketTuning::Apply(sData, SocketTuning::HostOf(conn_url));
 
 	sin.in.sin_port = 0;
 	if (bind(sData, &sin.sa, sizeof(sin)) == -1)
@@ -696,14 +1184,16 @@ int FtpClient::FtpOpenPort(ftphandle *nControl, ftphandle **nData, transfermode
 		return -1;
 	}
 
-	if (mp_ftphandle->offset != 0)
+	if (mp_ftphandle->offset != 0 && !(dir == FTP_CLIENT_WRITE && append_upload))
 	{
 		char buf[512];
 		sprintf(buf, "REST %lld", mp_ftphandle->offset);
 		if (!FtpSendCmd(buf, "3", nControl))
 		{
+			if (dir == FTP_CLIENT_WRITE)
+				rest_stor_refused = true;
 			close(sData);
-			return 0;
+			return -1;
 		}
 	}
 
@@ -776,6 +1266,11 @@ int FtpClient::FtpXfer(const std::string &localfile, const std::string &path, ft
 	FILE *local = NULL;
 	ftphandle *nData;
 
+	/* Uploads of a file read the card on a disk thread ahead of the
+	   socket, so neither waits for the other block by block. */
+	if (localfile.length() != 0 && ((type == FtpClient::filewrite) || (type == FtpClient::filewriteappend)))
+		return FtpUpload(localfile, path, nControl, type, mode);
+
 	if (localfile.length() != 0)
 	{
 		char ac[3] = "  ";
@@ -825,7 +1320,15 @@ int FtpClient::FtpXfer(const std::string &localfile, const std::string &path, ft
 		return 0;
 	}
 
-	dbuf = static_cast<char *>(malloc(FTP_CLIENT_BUFSIZ));
+	TransferBuffer lease(FTP_CLIENT_BUFSIZ);
+	dbuf = lease.data();
+	if (dbuf == NULL)
+	{
+		if (localfile.length() != 0)
+			fclose(local);
+		FtpClose(nData);
+		return 0;
+	}
 	if ((type == FtpClient::filewrite) || (type == FtpClient::filewriteappend))
 	{
 		while ((l = fread(dbuf, 1, FTP_CLIENT_BUFSIZ, local)) > 0)
@@ -846,13 +1349,63 @@ int FtpClient::FtpXfer(const std::string &localfile, const std::string &path, ft
 			}
 		}
 	}
-	free(dbuf);
+	lease.Release();
 	fflush(local);
 	if (localfile.length() != 0)
 		fclose(local);
 	return FtpClose(nData);
 }
 
+/*
+ * FtpUpload - send a local file, read ahead by an UploadSource
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int FtpClient::FtpUpload(const std::string &localfile, const std::string &path, ftphandle *nControl, accesstype type, transfermode mode)
+{
+	ftphandle *nData;
+	UploadSource source(localfile, type == FtpClient::filewriteappend ? nControl->offset : 0);
+	if (!source.Open())
+	{
+		snprintf(nControl->response, sizeof(nControl->response), "Could not open %s", localfile.c_str());
+		return 0;
+	}
+	if (!FtpAccess(path, type, mode, nControl, &nData))
+		return 0;
+
+	/* the next block is read while this one goes out through the tuned
+	   socket buffer; send() may take less than the whole block */
+	TransferBuffer buffer(UploadSource::kBufferSize);
+	if (!buffer)
+	{
+		FtpClose(nData);
+		return 0;
+	}
+	bool failed = false;
+	int64_t l = 0;
+	while (!failed && (l = source.Read(buffer.data(), buffer.size())) > 0)
+	{
+		for (int64_t sent = 0; sent < l;)
+		{
+			int c = FtpWrite(buffer.data() + sent, (int)(l - sent), nData);
+			if (c <= 0)
+			{
+				failed = true;
+				break;
+			}
+			sent += c;
+		}
+	}
+	if (l < 0)
+	{
+		failed = true;
+		if (!Cancel::Stopped())
+			snprintf(nControl->response, sizeof(nControl->response), "Could not read %s", localfile.c_str());
+	}
+	int ret = FtpClose(nData);
+	return failed ? 0 : ret;
+}
+
 /*
  * FtpWrite - write to a data connection
  */
@@ -867,6 +1420,8 @@ int FtpClient::FtpWrite(void *buf, int len, ftphandle *nData)
 	else
 	{
 		i = send(nData->handle, buf, len, 0);
+		if (i > 0)
+			RateLimiter::Consume(i);
 	}
 	if (i == -1)
 		return 0;
@@ -899,7 +1454,9 @@ int FtpClient::FtpRead(void *buf, int max, ftphandle *nData)
 		i = Readline(static_cast<char *>(buf), max, nData);
 	else
 	{
-		i = recv(nData->handle, buf, max, 0);
+		i = DataRecv(nData, buf, max);
+		if (i > 0)
+			RateLimiter::Consume(i);
 	}
 	if (i == -1)
 		return 0;
@@ -975,6 +1532,8 @@ int FtpClient::FtpClose(ftphandle *nData)
 {
 	ftphandle *ctrl;
 
+	Cancel::Remove(nData->cancel_hook);
+	nData->cancel_hook = 0;
 	if (nData->dir == FTP_CLIENT_WRITE)
 	{
 		if (nData->buf != NULL)
@@ -984,6 +1543,16 @@ int FtpClient::FtpClose(ftphandle *nData)
 		return 0;
 	if (nData->buf)
 		free(nData->buf);
+	if (nData->zs)
+	{
+		if (nData->wire > 0 && nData->xfered > 0)
+			Logger::Logf(Logger::LOG_DEBUG, "FTP MODE Z bytes=%lld wire=%lld", (long long)nData->xfered, (long long)nData->wire);
+		inflateEnd(nData->zs);
+		free(nData->zs);
+	}
+	free(nData->zbuf);
+	if (nData->dir == FTP_CLIENT_READ && nData->started > 0)
+		SocketTuning::ObserveRate(SocketTuning::HostOf(conn_url), (uint64_t)nData->wire, Util::GetTick() - nData->started);
 	shutdown(nData->handle, SHUT_WR);
 	struct linger lng = {1, 0};
 	setsockopt(mp_ftphandle->handle, SOL_SOCKET, SO_LINGER, &lng, sizeof(lng));
@@ -1101,6 +1670,7 @@ int FtpClient::SysType(char *buf, int max)
 int FtpClient::Mkdir(const std::string &path)
 {
 	std::string cmd = "MKD " + path;
+	forgetListing(path, false);
 	if (!FtpSendCmd(cmd, "2", mp_ftphandle))
 		return 0;
 	return 1;
@@ -1156,6 +1726,7 @@ bool FtpClient::Ping()
 int FtpClient::Rmdir(const std::string &path)
 {
 	std::string cmd = "RMD " + path;
+	forgetListing(path, true);
 	if (!FtpSendCmd(cmd, "2", mp_ftphandle))
 		return 0;
 	return 1;
@@ -1168,14 +1739,14 @@ int FtpClient::Rmdir(const std::string &path)
  */
 int FtpClient::Rmdir(const std::string &path, bool recursive)
 {
-	if (stop_activity)
+	if (Cancel::Stopped())
 		return 1;
 
 	std::vector<DirEntry> list = ListDir(path);
 	int ret;
 	for (int i = 0; i < list.size(); i++)
 	{
-		if (stop_activity)
+		if (Cancel::Stopped())
 			return 1;
 
 		if (list[i].isDir && recursive)
@@ -1218,6 +1789,10 @@ int FtpClient::Size(const std::string &path, int64_t *size)
 	if ((path.length() + 7) > sizeof(cmd))
 		return 0;
 
+	int cached = cachedSize(path, size);
+	if (cached >= 0)
+		return cached;
+
 	sprintf(cmd, "TYPE %c", FtpClient::transfermode::image);
 	if (!FtpSendCmd(cmd, "2", mp_ftphandle))
 		return 0;
@@ -1249,11 +1824,89 @@ bool FtpClient::FileExists(const std::string &path)
 
 int FtpClient::Get(const std::string &outputfile, const std::string &path, uint64_t offset)
 {
+	/* the size picks both the parallel path and the FAT32 split */
+	int64_t size = -1;
+	bool may_split = force_fat32 || webdav_split_large;
+	if ((may_split || (offset == 0 && ftp_parallel_connections > 1)) && !Size(path, &size))
+		size = -1;
+
+	bool split = size >= 0 && LocalFileSink::NeedsSplit((uint64_t)size);
+	LocalFileSink sink(outputfile, split ? LocalFileSink::kSplitPartSize : 0);
+
+	uint64_t segment = (uint64_t)ftp_segment_mb * 1024 * 1024;
+	int ok;
+	if (offset == 0 && ftp_parallel_connections > 1 && size > 0 && (uint64_t)size >= 2 * segment)
+		ok = GetParallel(sink, path, (uint64_t)size);
+	else
+		ok = GetToSink(sink, path, offset);
+
+	if (!ok)
+	{
+		/* partial data stays on disk for a later resume */
+		sink.Close();
+		return 0;
+	}
+	if (!sink.Finish())
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * FtpGetToSink - stream a remote file from offset into a local sink
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int FtpClient::GetToSink(LocalFileSink &sink, const std::string &path, uint64_t offset)
+{
+	ftphandle *nData;
+	if (!sink.Open(offset > 0))
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
+		return 0;
+	}
+
 	mp_ftphandle->offset = offset;
-	if (offset == 0)
-		return FtpXfer(outputfile, path, mp_ftphandle, FtpClient::fileread, FtpClient::transfermode::image);
+	int ok = FtpAccess(path, FtpClient::fileread, FtpClient::transfermode::image, mp_ftphandle, &nData,
+					   offset == 0 && WantsDeflate(path));
+	mp_ftphandle->offset = 0;
+	if (!ok)
+		return 0;
+
+	/* progress is reported by the transfer callback inside FtpRead */
+	bool write_failed = false;
+	TransferBuffer lease(FTP_CLIENT_BUFSIZ);
+	char *dbuf = lease.data();
+	if (dbuf == NULL)
+		write_failed = true;
 	else
-		return FtpXfer(outputfile, path, mp_ftphandle, FtpClient::filereadappend, FtpClient::transfermode::image);
+	{
+		Pipeline::Trace trace(TransferTrace::TRACE_FTP_BLOCK, offset);
+		Pipeline::Disk disk(sink, offset);
+		auto chain = Pipeline::Compose(trace, disk);
+		int l;
+		while ((l = FtpRead(dbuf, FTP_CLIENT_BUFSIZ, nData)) > 0)
+		{
+			if (!chain.Push(dbuf, l))
+			{
+				write_failed = true;
+				break;
+			}
+		}
+		if (!write_failed && !chain.Finish())
+			write_failed = true;
+	}
+	lease.Release();
+
+	ok = FtpClose(nData);
+	if (write_failed)
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+		return 0;
+	}
+	return ok;
 }
 
 int FtpClient::GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset)
@@ -1290,6 +1943,159 @@ int FtpClient::GetRange(const std::string &path, void *buffer, uint64_t size, ui
 
 }
 
+/*
+ * FtpGetSegment - download [offset, offset+length) of a remote file into an
+ * shared local sink at the same offset, using REST on a fresh data
+ * connection. The transfer is abandoned once the range is complete.
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int FtpClient::GetSegment(LocalFileSink &sink, const std::string &path, uint64_t offset, uint64_t length, uint64_t *done)
+{
+	ftphandle *nData;
+	uint64_t got = 0;
+	if (done)
+		*done = 0;
+
+	mp_ftphandle->offset = offset;
+	int ok = FtpAccess(path, FtpClient::fileread, FtpClient::transfermode::image, mp_ftphandle, &nData);
+	mp_ftphandle->offset = 0;
+	if (!ok)
+		return 0;
+
+	TransferBuffer lease(FTP_CLIENT_BUFSIZ);
+	char *dbuf = lease.data();
+	if (dbuf != NULL)
+	{
+		Pipeline::Trace trace(TransferTrace::TRACE_FTP_BLOCK, offset);
+		Pipeline::Progress<AddProgress> progress;
+		Pipeline::Disk disk(sink, offset);
+		auto chain = Pipeline::Compose(trace, progress, disk);
+		int l;
+		while (got < length && !Cancel::Stopped())
+		{
+			uint64_t want = length - got;
+			if (want > FTP_CLIENT_BUFSIZ)
+				want = FTP_CLIENT_BUFSIZ;
+			if ((l = FtpRead(dbuf, (int)want, nData)) <= 0)
+				break;
+			if (!chain.Push(dbuf, l))
+				break;
+			got += l;
+		}
+		/* bytes only count once they reached the sink */
+		if (!chain.Finish())
+		{
+			AddProgress(-(int64_t)got);
+			got = 0;
+		}
+	}
+	lease.Release();
+
+	/* Closing early makes the server answer 426 instead of 226; either
+	 * reply is consumed here so the control connection stays in sync. */
+	int closed = FtpClose(nData);
+	if (done)
+		*done = got;
+	if (got != length)
+	{
+		if (Cancel::Stopped())
+			sprintf(mp_ftphandle->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+		else if (closed)
+			sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * FtpGetParallel - download a file over ftp_parallel_connections logins that
+ * claim ftp_segment_mb segments from a shared cursor
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int FtpClient::GetParallel(LocalFileSink &sink, const std::string &path, uint64_t size)
+{
+	if (!sink.Open(false))
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
+		return 0;
+	}
+	/* reserve the file so each connection writes its segments in place */
+	sink.Preallocate(size);
+
+	FtpParallelContext ctx;
+	ctx.sink = &sink;
+	ctx.path = path;
+	ctx.size = size;
+	ctx.segment = (uint64_t)ftp_segment_mb * 1024 * 1024;
+	ctx.statsSlot = TransferStats::CurrentWorker();
+
+	uint64_t segments = (size + ctx.segment - 1) / ctx.segment;
+	int extra = ftp_parallel_connections - 1;
+	if ((uint64_t)extra >= segments)
+		extra = (int)segments - 1;
+
+	/* logins that fail are skipped; the rest share the work */
+	std::vector<FtpClient *> clients;
+	for (int i = 0; i < extra; i++)
+	{
+		FtpClient *client = AcquireSession(conn_url, conn_user, conn_pass, (connmode)mp_ftphandle->cmode);
+		if (client == NULL)
+		{
+			Logger::Logf(Logger::LOG_ERROR, "FTP GET parallel connect failed index=%d", i);
+			continue;
+		}
+		clients.push_back(client);
+	}
+
+	Logger::Logf("FTP GET parallel path=%s size=%llu connections=%d segment_mb=%d",
+				 path.c_str(), (unsigned long long)size, (int)clients.size() + 1, ftp_segment_mb);
+
+	/* progress is counted by the segment workers, not the absolute
+	 * per-connection callback */
+	FtpCallbackXfer xfercb = mp_ftphandle->xfercb;
+	mp_ftphandle->xfercb = NULL;
+
+	std::vector<Thread> threads(clients.size());
+	std::vector<FtpWorkerArgs> workerArgs(clients.size());
+	std::vector<bool> started(clients.size(), false);
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		workerArgs[i].ctx = &ctx;
+		workerArgs[i].client = clients[i];
+		Result rc = Threads::Create(&threads[i], FtpParallelWorkerThread, &workerArgs[i], 0x10000, Threads::ROLE_NETWORK, "ftp segment");
+		if (R_FAILED(rc))
+		{
+			Logger::Logf(Logger::LOG_ERROR, "FTP GET parallel threadCreate failed index=%d rc=0x%x", (int)i, rc);
+			continue;
+		}
+		threadStart(&threads[i]);
+		started[i] = true;
+	}
+
+	FtpParallelWorker(&ctx, this);
+
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		if (!started[i])
+			continue;
+		Threads::Join(&threads[i]);
+	}
+	for (FtpClient *client : clients)
+		ReleaseSession(client);
+	clients.clear();
+	mp_ftphandle->xfercb = xfercb;
+
+	if (ctx.hadError)
+	{
+		snprintf(mp_ftphandle->response, sizeof(mp_ftphandle->response), "%s", ctx.errorMessage.c_str());
+		Logger::Logf(Logger::LOG_ERROR, "FTP GET parallel error path=%s err=%s", path.c_str(), ctx.errorMessage.c_str());
+		return 0;
+	}
+	return 1;
+}
+
 /*
  * FtpPut - issue a PUT command and send data from input
  *
@@ -1298,16 +2104,112 @@ int FtpClient::GetRange(const std::string &path, void *buffer, uint64_t size, ui
 
 int FtpClient::Put(const std::string &inputfile, const std::string &path, uint64_t offset)
 {
+	forgetListing(path, false);
 	mp_ftphandle->offset = offset;
 	if (offset == 0)
 		return FtpXfer(inputfile, path, mp_ftphandle, FtpClient::filewrite, FtpClient::transfermode::image);
+
+	/* resume with REST+STOR; a server that refuses REST before STOR gets
+	   APPE, which appends to the offset bytes the caller found there. The
+	   refusal comes before the data connection, so nothing went out yet */
+	append_upload = rest_stor_refused;
+	int ret = FtpXfer(inputfile, path, mp_ftphandle, FtpClient::filewriteappend, FtpClient::transfermode::image);
+	if (!ret && !append_upload && rest_stor_refused)
+	{
+		Logger::Logf("FTP upload resume via APPE path=%s offset=%llu", path.c_str(), (unsigned long long)offset);
+		append_upload = true;
+		ret = FtpXfer(inputfile, path, mp_ftphandle, FtpClient::filewriteappend, FtpClient::transfermode::image);
+	}
+	append_upload = false;
+	mp_ftphandle->offset = 0;
+	return ret;
+}
+
+int FtpClient::PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source)
+{
+	ftphandle *nData;
+	forgetListing(path, false);
+	mp_ftphandle->offset = 0;
+	if (!FtpAccess(path, FtpClient::filewrite, FtpClient::transfermode::image, mp_ftphandle, &nData))
+		return 0;
+
+	/* progress is reported by the transfer callback inside FtpWrite */
+	bool failed = false;
+	TransferBuffer lease(FTP_CLIENT_BUFSIZ);
+	char *dbuf = lease.data();
+	if (dbuf == NULL)
+		failed = true;
+	else
+	{
+		int64_t l;
+		while ((l = source(dbuf, FTP_CLIENT_BUFSIZ)) > 0)
+		{
+			if (FtpWrite(dbuf, (int)l, nData) < l)
+			{
+				failed = true;
+				break;
+			}
+		}
+		if (l < 0)
+			failed = true;
+	}
+	lease.Release();
+
+	int ok = FtpClose(nData);
+	if (failed)
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_UPLOAD_MSG]);
+		return 0;
+	}
+	return ok;
+}
+
+/*
+ * GetStream - one RETR for the whole file instead of the default's data
+ * connection per block.
+ */
+int FtpClient::GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data)
+{
+	ftphandle *nData;
+	mp_ftphandle->offset = 0;
+	if (!FtpAccess(path, FtpClient::fileread, FtpClient::transfermode::image, mp_ftphandle, &nData, WantsDeflate(path)))
+		return 0;
+
+	bool failed = false;
+	uint64_t total = 0;
+	TransferBuffer lease(FTP_CLIENT_BUFSIZ);
+	char *dbuf = lease.data();
+	if (dbuf == NULL)
+		failed = true;
 	else
-		return FtpXfer(inputfile, path, mp_ftphandle, FtpClient::filewriteappend, FtpClient::transfermode::image);
+	{
+		int l;
+		while (total < size && (l = FtpRead(dbuf, FTP_CLIENT_BUFSIZ, nData)) > 0)
+		{
+			if (!on_data(dbuf, l))
+			{
+				failed = true;
+				break;
+			}
+			total += l;
+		}
+	}
+	lease.Release();
+
+	int ok = FtpClose(nData);
+	if (failed || total < size)
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+		return 0;
+	}
+	return ok;
 }
 
 int FtpClient::Rename(const std::string &src, const std::string &dst)
 {
 	std::string cmd = "RNFR " + src;
+	forgetListing(src, true);
+	forgetListing(dst, true);
 	if (!FtpSendCmd(cmd, "3", mp_ftphandle))
 		return 0;
 	cmd = "RNTO " + dst;
@@ -1320,6 +2222,7 @@ int FtpClient::Rename(const std::string &src, const std::string &dst)
 int FtpClient::Delete(const std::string &path)
 {
 	std::string cmd = "DELE " + path;
+	forgetListing(path, false);
 	if (!FtpSendCmd(cmd, "2", mp_ftphandle))
 		return 0;
 	return 1;
@@ -1556,47 +2459,6 @@ int FtpClient::ParseDirEntry(char *line, DirEntry *dirEntry)
 	return 1;
 }
 
-int FtpClient::ParseMLSDDirEntry(char *line, DirEntry *dirEntry)
-{
-	char *p;
-	char *token;
-	char *facts;
-	char *keypair;
-	char key[128];
-	char value[128];
-
-	// Spilt string by space
-	facts = strtok_r(line, " ", &p);
-
-	// path is the rest of the line after space
-	token = strtok_r(p, "\r\n", &p);
-	snprintf(dirEntry->name, 256, "%s", token);
-
-	// split properties by semi-colon and get the key value pair
-	while ((keypair = strtok_r(facts, ";", &facts)))
-	{
-		sscanf(keypair, "%[^=]=%s", key, value);
-		if (strcasecmp(key, "type") == 0)
-		{
-			dirEntry->isDir = false;
-			if (strcasecmp(value, "dir") == 0)
-			{
-				dirEntry->isDir = true;
-			}
-		}
-		else if (strcasecmp(key, "size") == 0)
-		{
-			dirEntry->file_size = atoll(value);
-		}
-		else if (strcasecmp(key, "modify") == 0)
-		{
-			sscanf(value, "%4d%2d%2d%2d%2d%2d", &dirEntry->modified.year, &dirEntry->modified.month, &dirEntry->modified.day,
-				   &dirEntry->modified.hours, &dirEntry->modified.minutes, &dirEntry->modified.seconds);
-		}
-	}
-	return 1;
-}
-
 std::vector<DirEntry> FtpClient::ListDir(const std::string &path)
 {
 	std::vector<DirEntry> out;
@@ -1605,51 +2467,199 @@ std::vector<DirEntry> FtpClient::ListDir(const std::string &path)
 	out.push_back(entry);
 
 	ftphandle *nData;
-	char buf[1024];
-	int ret;
 	mp_ftphandle->offset = 0;
 
 	Chdir(path);
-	nData = RawOpen("", FtpClient::dirverbose, FtpClient::ascii);
-	if (nData != NULL)
-	{
-		ret = FtpRead(buf, 1024, nData);
-		while (ret > 0)
+	/* MLSD has exact sizes and times in one fixed format; servers that
+	 * reject it are listed with LIST from then on */
+	bool use_mlsd = mlsd != 0;
+	nData = RawOpen("", use_mlsd ? FtpClient::dirmlsd : FtpClient::dirverbose, FtpClient::ascii);
+	if (nData == NULL && use_mlsd && mlsd < 0 && mp_ftphandle->response[0] == '5')
+	{
+		mlsd = 0;
+		use_mlsd = false;
+		nData = RawOpen("", FtpClient::dirverbose, FtpClient::ascii);
+	}
+	if (nData == NULL)
+		return out;
+	if (use_mlsd)
+		mlsd = 1;
+
+	/* The reply is read in large blocks and split into lines in place. A
+	 * LIST reply is in one format throughout, so it is told once from the
+	 * first entry and only lines that do not fit go through the trial
+	 * parser. */
+	FtpListFormat format = use_mlsd ? FTP_LIST_MLSD : FTP_LIST_UNKNOWN;
+	int this_year = cur_time.tm_year + 1900;
+	auto add_line = [&](char *line, size_t len)
+	{
+		if (len > 0 && line[len - 1] == '\r')
+			len--;
+		if (len == 0)
+			return;
+		line[len] = '\0';
+
+		DirEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.selectable = true;
+		if (format == FTP_LIST_UNKNOWN)
+			format = DetectListFormat(line, len);
+		int parsed = -1;
+		if (format == FTP_LIST_MLSD)
+			parsed = ParseMlsdLine(line, len, &entry);
+		else if (format == FTP_LIST_UNIX)
+			parsed = ParseUnixLine(line, len, this_year, &entry);
+		else if (format == FTP_LIST_DOS)
+			parsed = ParseDosLine(line, len, &entry);
+		if (parsed < 0 && format != FTP_LIST_MLSD)
 		{
-			DirEntry entry;
 			memset(&entry, 0, sizeof(entry));
 			entry.selectable = true;
-			if (ParseDirEntry(buf, &entry) > 0)
-			{
-				sprintf(entry.directory, "%s", path.c_str());
-				if (path.length() > 0 && path[path.length() - 1] == '/')
-				{
-					sprintf(entry.path, "%s%s", path.c_str(), entry.name);
-				}
-				else
-				{
-					sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
-				}
+			parsed = ParseDirEntry(line, &entry);
+		}
+		if (parsed <= 0 || strcmp(entry.name, "..") == 0 || strcmp(entry.name, ".") == 0)
+			return;
 
-				if (entry.isDir)
-				{
-					sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
-				}
-				else
-				{
-					DirEntry::SetDisplaySize(&entry);
-				}
-				if (strcmp(entry.name, "..") != 0 && strcmp(entry.name, ".") != 0)
-					out.push_back(entry);
-			}
-			ret = FtpRead(buf, 1024, nData);
+		if (path.length() > 0 && path[path.length() - 1] == '/')
+			snprintf(entry.path, sizeof(entry.path), "%s%s", path.c_str(), entry.name);
+		else
+			snprintf(entry.path, sizeof(entry.path), "%s/%s", path.c_str(), entry.name);
+		snprintf(entry.directory, sizeof(entry.directory), "%s", path.c_str());
+		if (entry.isDir)
+			snprintf(entry.display_size, sizeof(entry.display_size), "%s", lang_strings[STR_FOLDER]);
+		else
+			DirEntry::SetDisplaySize(&entry);
+		out.push_back(entry);
+	};
+
+	ParseProfile profile(use_mlsd ? "ftp_mlsd" : "ftp");
+	TransferBuffer block(kListReadSize);
+	if (!block)
+		Logger::Logf(Logger::LOG_ERROR, "FTP LIST out of memory path=%s", path.c_str());
+	bool complete = (bool)block;
+	size_t held = 0;
+	bool overlong = false;
+	while (block)
+	{
+		gettimeofday(&tick, NULL);
+		/* one byte stays free to terminate the last line */
+		ssize_t got = DataRecv(nData, block.data() + held, block.size() - 1 - held);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			complete = false;
+		if (got <= 0)
+			break;
+		nData->xfered += got;
+		held += got;
+
+		size_t before = out.size();
+		profile.Resume();
+		char *begin = block.data();
+		char *stop = begin + held;
+		char *newline;
+		while ((newline = static_cast<char *>(memchr(begin, '\n', stop - begin))) != NULL)
+		{
+			if (!overlong)
+				add_line(begin, newline - begin);
+			overlong = false;
+			begin = newline + 1;
 		}
-		FtpClose(nData);
+		held = stop - begin;
+		if (held == block.size() - 1)
+		{
+			/* no name is that long; the line is dropped up to its end */
+			overlong = true;
+			held = 0;
+		}
+		else if (held > 0 && begin != block.data())
+			memmove(block.data(), begin, held);
+		profile.Pause();
+		profile.Add(got, out.size() - before);
+	}
+	if (complete && held > 0 && !overlong)
+	{
+		size_t before = out.size();
+		profile.Resume();
+		add_line(block.data(), held);
+		profile.Pause();
+		profile.Add(0, out.size() - before);
 	}
 
+	if (FtpClose(nData) && complete)
+		cacheListing(path, out);
 	return out;
 }
 
+std::string FtpClient::listingKey(const std::string &path) const
+{
+	std::string trimmed = path;
+	while (!trimmed.empty() && trimmed[trimmed.length() - 1] == '/')
+		trimmed.erase(trimmed.length() - 1);
+	return conn_user + "@" + conn_url + "|" + trimmed;
+}
+
+void FtpClient::cacheListing(const std::string &path, const std::vector<DirEntry> &entries)
+{
+	if (ftp_listing_cache_secs <= 0)
+		return;
+	uint64_t now = Util::GetTick();
+
+	std::lock_guard<std::mutex> lock(ftp_listing_mutex);
+	if (ftp_listing_cache.size() + entries.size() > kMaxCachedEntries)
+	{
+		ftp_listing_cache.clear();
+		ftp_listed_dirs.clear();
+	}
+	for (const DirEntry &entry : entries)
+	{
+		if (strcmp(entry.name, "..") == 0)
+			continue;
+		ftp_listing_cache[listingKey(entry.path)] = {(int64_t)entry.file_size, entry.isDir, now};
+	}
+	ftp_listed_dirs[listingKey(path)] = now;
+}
+
+int FtpClient::cachedSize(const std::string &path, int64_t *size) const
+{
+	if (ftp_listing_cache_secs <= 0)
+		return -1;
+	uint64_t oldest = Util::GetTick() - (uint64_t)ftp_listing_cache_secs * 1000000;
+
+	std::lock_guard<std::mutex> lock(ftp_listing_mutex);
+	auto it = ftp_listing_cache.find(listingKey(path));
+	if (it != ftp_listing_cache.end() && it->second.tick >= oldest)
+	{
+		/* SIZE fails on folders; let the server say so */
+		if (it->second.isDir)
+			return -1;
+		*size = it->second.size;
+		return 1;
+	}
+	auto dir = ftp_listed_dirs.find(listingKey(ParentPath(path)));
+	if (dir != ftp_listed_dirs.end() && dir->second >= oldest)
+		return 0;
+	return -1;
+}
+
+void FtpClient::forgetListing(const std::string &path, bool tree)
+{
+	std::string key = listingKey(path);
+	std::string parent = listingKey(ParentPath(path));
+
+	std::lock_guard<std::mutex> lock(ftp_listing_mutex);
+	ftp_listing_cache.erase(key);
+	ftp_listed_dirs.erase(parent);
+	if (!tree)
+		return;
+	std::string prefix = key + "/";
+	for (auto it = ftp_listing_cache.begin(); it != ftp_listing_cache.end();)
+		it = it->first.compare(0, prefix.size(), prefix) == 0 ? ftp_listing_cache.erase(it) : std::next(it);
+	for (auto it = ftp_listed_dirs.begin(); it != ftp_listed_dirs.end();)
+		it = (it->first == key || it->first.compare(0, prefix.size(), prefix) == 0) ? ftp_listed_dirs.erase(it)
+																					: std::next(it);
+}
+
 void FtpClient::SetCallbackXferFunction(FtpCallbackXfer pointer)
 {
 	mp_ftphandle->xfercb = pointer;
@@ -1674,7 +2684,19 @@ long FtpClient::GetIdleTime()
 {
 	timeval now;
 	gettimeofday(&now, NULL);
-	return now.tv_usec - tick.tv_usec;
+	return (now.tv_sec - tick.tv_sec) * 1000000L + (now.tv_usec - tick.tv_usec);
+}
+
+int64_t FtpClient::KeepAlive(uint64_t interval_us)
+{
+	if (!IsConnected())
+		return 0;
+	long idle = GetIdleTime();
+	if (idle >= 0 && (uint64_t)idle < interval_us)
+		return interval_us - idle;
+	if (!Noop())
+		return 0;
+	return interval_us;
 }
 
 ClientType FtpClient::clientType()
@@ -1684,7 +2706,7 @@ ClientType FtpClient::clientType()
 
 uint32_t FtpClient::SupportedActions()
 {
-	return REMOTE_ACTION_ALL ^ REMOTE_ACTION_CUT ^ REMOTE_ACTION_COPY ^ REMOTE_ACTION_PASTE ^ REMOTE_ACTION_RAW_READ;
+	return REMOTE_ACTION_ALL ^ REMOTE_ACTION_RAW_READ;
 }
 
 std::string FtpClient::GetPath(std::string ppath1, std::string ppath2)
@@ -1697,16 +2719,45 @@ std::string FtpClient::GetPath(std::string ppath1, std::string ppath2)
 	return path1;
 }
 
+/*
+ * Copy - server-side copy through SITE CPFR/CPTO (ProFTPD mod_copy), which
+ * takes files and whole folders alike; other servers reject the unknown
+ * SITE command and get -1.
+ */
 int FtpClient::Copy(const std::string &from, const std::string &to)
 {
-	sprintf(mp_ftphandle->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
-	return 0;
+	if (site_copy == 0)
+	{
+		sprintf(mp_ftphandle->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+		return -1;
+	}
+	std::string cmd = "SITE CPFR " + from;
+	forgetListing(to, true);
+	if (!FtpSendCmd(cmd, "3", mp_ftphandle))
+	{
+		const char *resp = mp_ftphandle->response;
+		if (strncmp(resp, "500", 3) == 0 || strncmp(resp, "502", 3) == 0 || strncmp(resp, "504", 3) == 0)
+		{
+			site_copy = 0;
+			return -1;
+		}
+		return 0;
+	}
+	cmd = "SITE CPTO " + to;
+	if (!FtpSendCmd(cmd, "2", mp_ftphandle))
+		return 0;
+	site_copy = 1;
+	return 1;
+}
+
+int FtpClient::CopyTree(const std::string &from, const std::string &to)
+{
+	return Copy(from, to);
 }
 
 int FtpClient::Move(const std::string &from, const std::string &to)
 {
-	sprintf(mp_ftphandle->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
-	return 0;
+	return Rename(from, to);
 }
 
 int FtpClient::Head(const std::string &path, void *buffer, uint64_t len)
@@ -1741,3 +2792,178 @@ int FtpClient::GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset)
 	sprintf(mp_ftphandle->response, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
 	return -1;
 }
+
+FtpClient *FtpClient::AcquireSession(const std::string &url, const std::string &user, const std::string &pass, connmode mode)
+{
+	std::string key = user + "@" + url;
+	while (true)
+	{
+		FtpClient *client = NULL;
+		uint64_t idle = 0;
+		{
+			std::lock_guard<std::mutex> lock(ftp_pool_mutex);
+			for (size_t i = ftp_pool.size(); i-- > 0;)
+			{
+				if (ftp_pool[i].key != key)
+					continue;
+				client = ftp_pool[i].client;
+				idle = Util::GetTick() - ftp_pool[i].idleSince;
+				ftp_pool.erase(ftp_pool.begin() + i);
+				break;
+			}
+		}
+		if (client == NULL)
+			break;
+
+		if (idle < kPoolTrustUs || (idle < kPoolMaxIdleUs && client->Noop()))
+		{
+			client->SetConnmode(mode);
+			Logger::Logf(Logger::LOG_DEBUG, "FTP POOL reuse server=%s idle_ms=%llu", url.c_str(), (unsigned long long)(idle / 1000));
+			return client;
+		}
+		/* the server dropped it meanwhile; try the next one */
+		client->Quit();
+		delete client;
+	}
+
+	FtpClient *client = new FtpClient();
+	client->SetConnmode(mode);
+	if (!client->Connect(url, user, pass))
+	{
+		Logger::Logf(Logger::LOG_ERROR, "FTP POOL connect failed server=%s resp=%s", url.c_str(), client->LastResponse());
+		delete client;
+		return NULL;
+	}
+	return client;
+}
+
+void FtpClient::ReleaseSession(FtpClient *client)
+{
+	if (client == NULL)
+		return;
+
+	/* the next user sets up its own progress reporting */
+	client->SetCallbackXferFunction(NULL);
+	client->SetCallbackArg(NULL);
+	client->SetCallbackBytes(0);
+
+	/* a cancelled transfer may leave replies unread on the control
+	 * connection, so those sessions are not reused */
+	if (client->mp_ftphandle->is_connected && !Cancel::Stopped())
+	{
+		bool pooled = false;
+		{
+			std::lock_guard<std::mutex> lock(ftp_pool_mutex);
+			if ((int)ftp_pool.size() < ftp_session_pool)
+			{
+				uint64_t now = Util::GetTick();
+				ftp_pool.push_back({client->conn_user + "@" + client->conn_url, client, now, now});
+				pooled = true;
+			}
+		}
+		if (pooled)
+		{
+			uint64_t interval = KeepAlive::Interval();
+			if (interval > 0)
+				KeepAlive::Schedule("ftp pool", KeepPoolAlive, interval);
+			return;
+		}
+	}
+	client->Quit();
+	delete client;
+}
+
+int64_t FtpClient::KeepPoolAlive()
+{
+	uint64_t interval = KeepAlive::Interval();
+	uint64_t max_unused = (uint64_t)keepalive_pool_seconds * 1000000;
+	std::vector<PooledSession> due;
+	int64_t next = -1;
+	{
+		std::lock_guard<std::mutex> lock(ftp_pool_mutex);
+		uint64_t now = Util::GetTick();
+		for (size_t i = ftp_pool.size(); i-- > 0;)
+		{
+			uint64_t idle = now - ftp_pool[i].idleSince;
+			uint64_t unused = now - ftp_pool[i].releasedAt;
+			if (idle >= interval || unused >= max_unused)
+			{
+				due.push_back(ftp_pool[i]);
+				ftp_pool.erase(ftp_pool.begin() + i);
+				continue;
+			}
+			int64_t wait = (int64_t)MIN(interval - idle, max_unused - unused);
+			if (next < 0 || wait < next)
+				next = wait;
+		}
+	}
+
+	/* out of the pool meanwhile, so no worker gets one mid-NOOP */
+	for (PooledSession &session : due)
+	{
+		FtpClient *client = session.client;
+		uint64_t unused = Util::GetTick() - session.releasedAt;
+		if (unused >= max_unused)
+		{
+			Logger::Logf(Logger::LOG_DEBUG, "FTP POOL retired server=%s unused_s=%llu", client->conn_url.c_str(),
+						 (unsigned long long)(unused / 1000000));
+			client->Quit();
+			delete client;
+			continue;
+		}
+		if (!client->Noop())
+		{
+			/* the server is about to drop it, or did; a fresh login
+			 * takes its place so the next worker does not wait for one */
+			Logger::Logf(Logger::LOG_DEBUG, "FTP POOL keep-alive failed server=%s, logging in again", client->conn_url.c_str());
+			FtpClient *fresh = new FtpClient();
+			bool ok = fresh->Connect(client->conn_url, client->conn_user, client->conn_pass);
+			client->Quit();
+			delete client;
+			if (!ok)
+			{
+				delete fresh;
+				continue;
+			}
+			client = fresh;
+		}
+
+		bool kept = false;
+		{
+			std::lock_guard<std::mutex> lock(ftp_pool_mutex);
+			if ((int)ftp_pool.size() < ftp_session_pool)
+			{
+				ftp_pool.push_back({session.key, client, Util::GetTick(), session.releasedAt});
+				kept = true;
+			}
+		}
+		if (!kept)
+		{
+			client->Quit();
+			delete client;
+			continue;
+		}
+		int64_t wait = (int64_t)MIN(interval, max_unused - unused);
+		if (next < 0 || wait < next)
+			next = wait;
+	}
+	return next;
+}
+
+void FtpClient::ClosePool()
+{
+	/* sessions out for a NOOP come back first */
+	KeepAlive::Cancel("ftp pool");
+	std::vector<PooledSession> sessions;
+	{
+		std::lock_guard<std::mutex> lock(ftp_pool_mutex);
+		sessions.swap(ftp_pool);
+	}
+	for (PooledSession &session : sessions)
+	{
+		session.client->Quit();
+		delete session.client;
+	}
+	if (!sessions.empty())
+		Logger::Logf("FTP POOL closed sessions=%d", (int)sessions.size());
+}
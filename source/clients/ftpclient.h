@@ -12,6 +12,8 @@
 
 typedef int (*FtpCallbackXfer)(int64_t xfered, void *arg);
 
+struct z_stream_s;
+
 struct ftphandle
 {
 	char *cput, *cget;
@@ -30,8 +32,19 @@ struct ftphandle
 	FtpCallbackXfer xfercb;
 	void *cbarg;
 	bool is_connected;
+	/* Cancel hook that shuts a data connection down, 0 for none */
+	int cancel_hook;
+	/* Inflater of a MODE Z data connection, NULL in stream mode */
+	z_stream_s *zs;
+	char *zbuf;
+	bool zend;
+	/* Bytes that came over the wire, and when the connection opened */
+	int64_t wire;
+	uint64_t started;
 };
 
+class LocalFileSink;
+
 class FtpClient : public RemoteClient
 {
 public:
@@ -79,10 +92,14 @@ public:
 	int Size(const std::string &path, int64_t *size);
 	int Get(const std::string &outputfile, const std::string &path, uint64_t offset = 0);
 	int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset);
+	int GetSegment(LocalFileSink &sink, const std::string &path, uint64_t offset, uint64_t length, uint64_t *done = NULL);
 	int Put(const std::string &inputfile, const std::string &path, uint64_t offset = 0);
+	int PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source);
+	int GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data);
 	int Rename(const std::string &src, const std::string &dst);
 	int Delete(const std::string &path);
     int Copy(const std::string &from, const std::string &to);
+    int CopyTree(const std::string &from, const std::string &to);
     int Move(const std::string &from, const std::string &to);
 	int Head(const std::string &path, void *buffer, uint64_t len);
 	std::vector<DirEntry> ListDir(const std::string &path);
@@ -99,17 +116,48 @@ public:
 	bool IsConnected();
 	char *LastResponse();
 	long GetIdleTime();
+	int64_t KeepAlive(uint64_t interval_us);
 	int Quit();
 	std::string GetPath(std::string path1, std::string path2);
 	ClientType clientType();
 	uint32_t SupportedActions();
 
+	// Logged-in sessions shared by transfer workers and parallel segment
+	// fetches ([FTP] session_pool). AcquireSession() hands out an idle
+	// login to the same server, checked with NOOP when it sat unused for a
+	// while, or logs in a new one; NULL when that fails. ReleaseSession()
+	// takes it back and logs out what the pool cannot keep.
+	static FtpClient *AcquireSession(const std::string &url, const std::string &user, const std::string &pass, connmode mode);
+	static void ReleaseSession(FtpClient *client);
+	// Logs out every pooled session, on disconnect.
+	static void ClosePool();
+
 private:
+	// The pool's keep-alive task: NOOPs sessions idle for keepalive_seconds,
+	// replaces the ones that fail it and logs out the ones unused for
+	// keepalive_pool_seconds.
+	static int64_t KeepPoolAlive();
+
 	ftphandle *mp_ftphandle;
 	struct tm cur_time;
 	timeval tick;
 	char server[128];
 	int server_port;
+	std::string conn_url;
+	std::string conn_user;
+	std::string conn_pass;
+	// Whether SITE CPFR/CPTO works: -1 untried, 0 rejected, 1 worked.
+	int site_copy = -1;
+	// Whether the server lists with MLSD: -1 untried, 0 rejected, 1 worked.
+	int mlsd = -1;
+	// Whether MODE Z is accepted: -1 untried, 0 rejected, 1 worked; and
+	// whether the session is in it now.
+	int mode_z = -1;
+	bool mode_z_on = false;
+	// Whether the server refused REST before STOR, so resumed uploads go
+	// out as APPE; and whether this one does.
+	bool rest_stor_refused = false;
+	bool append_upload = false;
 
 	int FtpSendCmd(const std::string &cmd, const std::string &expected_resp, ftphandle *nControl);
 	ftphandle *RawOpen(const std::string &path, accesstype type, transfermode mode);
@@ -124,13 +172,35 @@ private:
 	int FtpOpenPort(ftphandle *nControl, ftphandle **nData, transfermode mode, int dir, std::string &cmd);
 	int FtpAcceptConnection(ftphandle *nData, ftphandle *nControl);
 	int CorrectPasvResponse(int *v);
-	int FtpAccess(const std::string &path, accesstype type, transfermode mode, ftphandle *nControl, ftphandle **nData);
+	// Listings are deflated whenever the server takes MODE Z, a file read
+	// only with `deflate`.
+	int FtpAccess(const std::string &path, accesstype type, transfermode mode, ftphandle *nControl, ftphandle **nData,
+				  bool deflate = false);
+	// Switches the session to MODE Z or back to MODE S. False when the
+	// server refused; it is not asked for MODE Z again.
+	bool SetModeZ(bool on, ftphandle *nControl);
+	// Whether a whole-file read of `path` is worth deflating: ftp_mode_z
+	// 2, a text-like name and a host slower than ftp_mode_z_mbps so far.
+	bool WantsDeflate(const std::string &path) const;
+	// recv() of a data connection, inflated in MODE Z: -1 on error, 0 at
+	// the end of the data.
+	ssize_t DataRecv(ftphandle *nData, void *buf, size_t max);
+	int GetParallel(LocalFileSink &sink, const std::string &path, uint64_t size);
+	int GetToSink(LocalFileSink &sink, const std::string &path, uint64_t offset);
 	int FtpXfer(const std::string &localfile, const std::string &path, ftphandle *nControl, accesstype type, transfermode mode);
+	int FtpUpload(const std::string &localfile, const std::string &path, ftphandle *nControl, accesstype type, transfermode mode);
 	int FtpWrite(void *buf, int len, ftphandle *nData);
 	int FtpRead(void *buf, int max, ftphandle *nData);
 	int FtpClose(ftphandle *nData);
 	int ParseDirEntry(char *line, DirEntry *dirEntry);
-	int ParseMLSDDirEntry(char *line, DirEntry *dirEntry);
+	// Shared listing cache (see [FTP] listing_cache_secs). cachedSize()
+	// returns 1 with `size` set, 0 when the freshly listed parent lacks the
+	// name and -1 when only the server can tell. Changes made through a
+	// session forget what they touched, with everything below for `tree`.
+	std::string listingKey(const std::string &path) const;
+	void cacheListing(const std::string &path, const std::vector<DirEntry> &entries);
+	int cachedSize(const std::string &path, int64_t *size) const;
+	void forgetListing(const std::string &path, bool tree);
 };
 
 #endif
\ No newline at end of file
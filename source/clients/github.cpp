@@ -2,6 +2,9 @@
 #include <json-c/json.h>
 #include <fstream>
 #include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
 #include "common.h"
 #include "clients/remote_client.h"
 #include "clients/github.h"
@@ -10,6 +13,79 @@
 #include "lang.h"
 #include "util.h"
 #include "windows.h"
+#include "logger.h"
+#include "listing_kernels.h"
+
+namespace
+{
+    // Release list pages by URL, shared by every session so a reconnect or
+    // an expired list revalidates with If-None-Match. GitHub does not count
+    // 304 replies against the anonymous rate limit.
+    const size_t kMaxCachedPageBytes = 8 * 1024 * 1024;
+    std::mutex g_pages_mutex;
+    std::map<std::string, GithubClient::CachedPage> g_pages;
+    size_t g_pages_bytes = 0;
+
+    std::string JsonString(json_object *parent, const char *key)
+    {
+        json_object *value = json_object_object_get(parent, key);
+        if (value == nullptr || json_object_get_type(value) != json_type_string)
+            return "";
+        return json_object_get_string(value);
+    }
+
+    // "2024-05-01T12:34:56Z"; drafts have no date and stay zeroed.
+    void ParseTimestamp(const std::string &date_time, DateTime &out)
+    {
+        memset(&out, 0, sizeof(DateTime));
+        ListingKernels::ParseIsoDate(date_time, out);
+    }
+
+    // Link: <https://api.github.com/...&page=2>; rel="next", <...>; rel="last"
+    std::string NextPageUrl(const std::string &link)
+    {
+        for (const std::string &part : Util::Split(link, ","))
+        {
+            if (part.find("rel=\"next\"") == std::string::npos)
+                continue;
+            size_t open = part.find('<');
+            size_t close = part.find('>', open);
+            if (open != std::string::npos && close != std::string::npos)
+                return part.substr(open + 1, close - open - 1);
+        }
+        return "";
+    }
+}
+
+bool GithubClient::LookupPage(const std::string &url, CachedPage &page)
+{
+    std::lock_guard<std::mutex> lock(g_pages_mutex);
+    auto it = g_pages.find(url);
+    if (it == g_pages.end())
+        return false;
+    page = it->second;
+    return true;
+}
+
+void GithubClient::StorePage(const std::string &url, const CachedPage &page)
+{
+    std::lock_guard<std::mutex> lock(g_pages_mutex);
+    auto it = g_pages.find(url);
+    if (it != g_pages.end())
+    {
+        g_pages_bytes -= it->second.body.size();
+        g_pages.erase(it);
+    }
+    if (page.etag.empty())
+        return;
+    if (g_pages_bytes + page.body.size() > kMaxCachedPageBytes)
+    {
+        g_pages.clear();
+        g_pages_bytes = 0;
+    }
+    g_pages[url] = page;
+    g_pages_bytes += page.body.size();
+}
 
 int GithubClient::Connect(const std::string &url, const std::string &username, const std::string &password)
 {
@@ -45,21 +121,7 @@ std::vector<DirEntry> GithubClient::ListDir(const std::string &path)
 
     if (path.compare("/") == 0) // return releases as folders
     {
-        for (std::vector<GitRelease>::iterator release = m_releases.begin(); release != m_releases.end();)
-        {
-            DirEntry entry;
-            entry.isDir = true;
-            entry.selectable = true;
-            entry.file_size = 0;
-            snprintf(entry.directory, 512, "%s", "/");
-            snprintf(entry.name, 256, "%s", release->name.c_str());
-            snprintf(entry.path, 768, "/%s", release->name.c_str());
-            snprintf(entry.display_size, 48, "%s", lang_strings[STR_FOLDER]);
-            entry.modified = release->modified;
-            
-            out.push_back(entry);
-            release++;
-        }
+        AppendReleaseEntries(m_releases, 0, out);
     }
     else // return assets in the releases matching the path
     {
@@ -86,6 +148,58 @@ std::vector<DirEntry> GithubClient::ListDir(const std::string &path)
     return out;
 }
 
+int GithubClient::ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch)
+{
+    if (path.compare("/") != 0)
+    {
+        on_batch(ListDir(path));
+        return 1;
+    }
+
+    // Each page of releases shows up as soon as it is parsed.
+    std::vector<DirEntry> batch;
+    DirEntry entry;
+    Util::SetupPreviousFolder(path, &entry);
+    batch.push_back(entry);
+    bool streamed = false;
+    bool ok = ParseReleases([&](const std::vector<GitRelease> &releases, size_t first)
+                            {
+                                streamed = true;
+                                AppendReleaseEntries(releases, first, batch);
+                                bool more = on_batch(batch);
+                                batch.clear();
+                                return more;
+                            });
+    if (!ok && !streamed)
+        return 0;
+    if (!streamed)
+    {
+        // Still fresh, nothing was fetched.
+        AppendReleaseEntries(m_releases, 0, batch);
+        on_batch(batch);
+    }
+    return ok ? 1 : 0;
+}
+
+void GithubClient::AppendReleaseEntries(const std::vector<GitRelease> &releases, size_t first, std::vector<DirEntry> &out)
+{
+    for (size_t i = first; i < releases.size(); i++)
+    {
+        const GitRelease &release = releases[i];
+        DirEntry entry;
+        memset(&entry, 0, sizeof(DirEntry));
+        entry.isDir = true;
+        entry.selectable = true;
+        entry.file_size = 0;
+        snprintf(entry.directory, 512, "%s", "/");
+        snprintf(entry.name, 256, "%s", release.name.c_str());
+        snprintf(entry.path, 768, "/%s", release.name.c_str());
+        snprintf(entry.display_size, 48, "%s", lang_strings[STR_FOLDER]);
+        entry.modified = release.modified;
+        out.push_back(entry);
+    }
+}
+
 int GithubClient::Size(const std::string &path, int64_t *size)
 {
     if (!ParseReleases())
@@ -159,14 +273,22 @@ int GithubClient::Get(const std::string &outputfile, const std::string &path, ui
     prev_tick = Util::GetTick();
     CHTTPClient::HeadersMap headers;
 
-    if (!Size(path, &bytes_to_download))
+    int64_t size = 0;
+    if (!Size(path, &size))
     {
         sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
         return 0;
     }
+    bytes_to_download = size;
 
-    client->SetProgressFnCallback(&bytes_transfered, DownloadProgressCallback);
     std::string encoded_url = this->m_download_url + CHTTPClient::EncodeUrl(m_assets[path_parts[0]][path_parts[1]].url);
+    // Assets redirect to a CDN that serves ranges.
+    expected_digest = FileDigest();
+    int ranged = GetRangedIfWorthIt(outputfile, encoded_url, path, offset);
+    if (ranged >= 0)
+        return ranged;
+
+    client->SetProgressFnCallback(&bytes_transfered, DownloadProgressCallback);
     if (client->DownloadFile(outputfile, encoded_url, status))
     {
         return 1;
@@ -211,82 +333,117 @@ int GithubClient::GetRange(const std::string &path, void *buffer, uint64_t size,
     return 0;
 }
 
-bool GithubClient::ParseReleases()
+bool GithubClient::ParseReleases(const ReleasePageFn &on_page)
 {
-    CHTTPClient::HeadersMap headers;
-    CHTTPClient::HttpResponse res;
+    // A minute-old list is good enough for browsing assets. After that the
+    // next listing revalidates every page, which is free while unchanged.
+    const uint64_t kFreshUs = 60ULL * 1000000ULL;
+    uint64_t now = Util::GetTick();
+    if (releases_parsed && now - parsed_at < kFreshUs)
+        return true;
+
+    std::vector<GitRelease> releases;
+    std::map<std::string, std::map<std::string, GitAsset>> assets;
+    std::string url = this->host_url + this->base_path + "?per_page=100";
+    int pages = 0, revalidated = 0;
+    client->SetProgressFnCallback(&bytes_transfered, DownloadProgressCallback);
+    while (!url.empty() && pages < kMaxReleasePages)
+    {
+        CHTTPClient::HeadersMap headers;
+        CHTTPClient::HttpResponse res;
+        CachedPage cached;
+        bool have = LookupPage(url, cached);
+        if (have && !cached.etag.empty())
+            headers["If-None-Match"] = cached.etag;
+
+        if (!client->GetListing(url, headers, res))
+        {
+            sprintf(this->response, "%s", res.errMessage.c_str());
+            return false;
+        }
 
-    if (!releases_parsed)
+        if (res.iCode == 304 && have)
+        {
+            revalidated++;
+        }
+        else if (HTTP_SUCCESS(res.iCode))
+        {
+            cached.etag = res.mapHeadersLowercase["etag"];
+            cached.body = res.strBody;
+            cached.next = NextPageUrl(res.mapHeadersLowercase["link"]);
+            StorePage(url, cached);
+        }
+        else
+        {
+            sprintf(this->response, "%ld - %s", res.iCode, lang_strings[STR_FAIL_READ_LOCAL_DIR_MSG]);
+            Logger::Logf(Logger::LOG_ERROR, "GITHUB releases url=%s code=%ld", url.c_str(), res.iCode);
+            return false;
+        }
+
+        size_t first = releases.size();
+        ParsePage(cached.body, releases, assets);
+        pages++;
+        url = cached.next;
+        if (on_page && !on_page(releases, first))
+            break;
+    }
+
+    m_releases.swap(releases);
+    m_assets.swap(assets);
+    releases_parsed = true;
+    parsed_at = now;
+    Logger::Logf("GITHUB releases path=%s count=%d pages=%d not_modified=%d", this->base_path.c_str(),
+                 (int)m_releases.size(), pages, revalidated);
+    return true;
+}
+
+void GithubClient::ParsePage(const std::string &body, std::vector<GitRelease> &releases,
+                             std::map<std::string, std::map<std::string, GitAsset>> &assets)
+{
+    json_object *jobj = json_tokener_parse(body.c_str());
+    if (jobj == nullptr)
+        return;
+    if (json_object_get_type(jobj) != json_type_array)
     {
-        std::string encoded_url = this->host_url + this->base_path + "?per_page=100&page=1";
-        client->SetProgressFnCallback(&bytes_transfered, DownloadProgressCallback);
-        if (client->Get(encoded_url, headers, res))
+        json_object_put(jobj);
+        return;
+    }
+
+    size_t release_count = json_object_array_length(jobj);
+    for (size_t release_idx = 0; release_idx < release_count; ++release_idx)
+    {
+        GitRelease release_entry;
+
+        json_object *release = json_object_array_get_idx(jobj, release_idx);
+        release_entry.name = JsonString(release, "tag_name");
+        if (release_entry.name.empty())
+            continue;
+        ParseTimestamp(JsonString(release, "published_at"), release_entry.modified);
+
+        json_object *obj_assets = json_object_object_get(release, "assets");
+        if (obj_assets && json_object_get_type(obj_assets) == json_type_array)
         {
-            if (HTTP_SUCCESS(res.iCode))
+            std::map<std::string, GitAsset> release_assets;
+            size_t asset_count = json_object_array_length(obj_assets);
+
+            for (size_t asset_idx = 0; asset_idx < asset_count; ++asset_idx)
             {
-                json_object *jobj = json_tokener_parse(res.strBody.data());
-                struct array_list *areleases = json_object_get_array(jobj);
-
-                for (size_t release_idx = 0; release_idx < areleases->length; ++release_idx)
-                {
-                    GitRelease release_entry;
-
-                    json_object *release = (json_object *)array_list_get_idx(areleases, release_idx);
-                    release_entry.name = std::string(json_object_get_string(json_object_object_get(release, "tag_name")));
-                    std::string date_time = std::string(json_object_get_string(json_object_object_get(release, "published_at")));
-
-                    auto date_time_array = Util::Split(date_time, "T");
-                    auto date_array = Util::Split(date_time_array[0], "-");
-                    auto time_array = Util::Split(date_time_array[1], ":");
-                    release_entry.modified.year = std::atoi(date_array[0].c_str());
-                    release_entry.modified.month = std::atoi(date_array[1].c_str());
-                    release_entry.modified.day = std::atoi(date_array[2].c_str());
-                    release_entry.modified.hours = std::atoi(time_array[0].c_str());
-                    release_entry.modified.minutes = std::atoi(time_array[1].c_str());
-                    release_entry.modified.seconds = std::atoi(time_array[2].substr(0,2).c_str());
-
-                    json_object *obj_assets = json_object_object_get(release, "assets");
-                    if (json_object_get_type(obj_assets) == json_type_array)
-                    {
-                        struct array_list *aassets = json_object_get_array(obj_assets);
-                        std::map<std::string, GitAsset> assets;
-
-                        for (size_t asset_idx = 0; asset_idx < aassets->length; ++asset_idx)
-                        {
-                            GitAsset asset_entry;
-
-                            json_object *asset = (json_object *)array_list_get_idx(aassets, asset_idx);
-                            asset_entry.name = std::string(json_object_get_string(json_object_object_get(asset, "name")));
-                            asset_entry.size = json_object_get_int64(json_object_object_get(asset, "size"));
-                            std::string date_time = std::string(json_object_get_string(json_object_object_get(asset, "updated_at")));
-                            asset_entry.url = std::string(json_object_get_string(json_object_object_get(asset, "browser_download_url")));
-                            Util::ReplaceAll(asset_entry.url, "https://github.com", "");
-
-                            auto date_time_array = Util::Split(date_time, "T");
-                            auto date_array = Util::Split(date_time_array[0], "-");
-                            auto time_array = Util::Split(date_time_array[1], ":");
-                            asset_entry.modified.year = std::atoi(date_array[0].c_str());
-                            asset_entry.modified.month = std::atoi(date_array[1].c_str());
-                            asset_entry.modified.day = std::atoi(date_array[2].c_str());
-                            asset_entry.modified.hours = std::atoi(time_array[0].c_str());
-                            asset_entry.modified.minutes = std::atoi(time_array[1].c_str());
-                            asset_entry.modified.seconds = std::atoi(time_array[2].substr(0,2).c_str());
-
-                            assets.insert(std::make_pair(asset_entry.name, asset_entry));
-                        }
-
-                        m_assets.insert(std::make_pair(release_entry.name, assets));
-                    }
-
-                    m_releases.push_back(release_entry);
-                }
-
-                releases_parsed = true;
-                return 1;
+                GitAsset asset_entry;
+
+                json_object *asset = json_object_array_get_idx(obj_assets, asset_idx);
+                asset_entry.name = JsonString(asset, "name");
+                asset_entry.size = json_object_get_int64(json_object_object_get(asset, "size"));
+                asset_entry.url = JsonString(asset, "browser_download_url");
+                Util::ReplaceAll(asset_entry.url, "https://github.com", "");
+                ParseTimestamp(JsonString(asset, "updated_at"), asset_entry.modified);
+
+                release_assets.insert(std::make_pair(asset_entry.name, asset_entry));
             }
+
+            assets.insert(std::make_pair(release_entry.name, release_assets));
         }
-        return 0;
-    }
 
-    return 1;
+        releases.push_back(release_entry);
+    }
+    json_object_put(jobj);
 }
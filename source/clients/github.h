@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <functional>
 #include "clients/remote_client.h"
 #include "clients/baseclient.h"
 #include "common.h"
@@ -17,6 +19,17 @@ public:
     int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset);
     int Head(const std::string &path, void *buffer, uint64_t len);
     bool FileExists(const std::string &path);
+    // The release list arrives a page at a time.
+    int ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch) override;
+
+    // A release list page as last served, for If-None-Match.
+    struct CachedPage
+    {
+        std::string etag;
+        std::string body;
+        // Link rel="next", empty on the last page.
+        std::string next;
+    };
 
 private:
     struct GitAsset
@@ -33,12 +46,26 @@ private:
         DateTime modified;
     };
 
+    // Sees the releases parsed so far after each page, from index `first`
+    // on; returning false stops the fetch.
+    using ReleasePageFn = std::function<bool(const std::vector<GitRelease> &releases, size_t first)>;
+    static const int kMaxReleasePages = 50;
+
     std::vector<GitRelease> m_releases;
     std::map<std::string, std::map<std::string, GitAsset>> m_assets;
     bool releases_parsed = false;
+    uint64_t parsed_at = 0;
     std::string m_download_url;
 
-    bool ParseReleases();
+    // Loads every page of the release list by following the Link header,
+    // unless the last load is under a minute old. Unchanged pages come
+    // from the shared page cache through 304 replies.
+    bool ParseReleases(const ReleasePageFn &on_page = nullptr);
+    static void ParsePage(const std::string &body, std::vector<GitRelease> &releases,
+                          std::map<std::string, std::map<std::string, GitAsset>> &assets);
+    static void AppendReleaseEntries(const std::vector<GitRelease> &releases, size_t first, std::vector<DirEntry> &out);
+    static bool LookupPage(const std::string &url, CachedPage &page);
+    static void StorePage(const std::string &url, const CachedPage &page);
 };
 
 #endif
\ No newline at end of file
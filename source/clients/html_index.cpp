@@ -0,0 +1,372 @@
+#include <cctype>
+#include <cstring>
+#include <lexbor/dom/interfaces/node.h>
+#include "clients/html_index.h"
+#include "host_caps.h"
+#include "parse_profile.h"
+#include "util.h"
+
+namespace
+{
+    // The node after `node` in document order, past everything below it.
+    lxb_dom_node_t *NextSkippingChildren(lxb_dom_node_t *node)
+    {
+        for (; node != nullptr; node = node->parent)
+        {
+            if (node->next != nullptr)
+                return node->next;
+        }
+        return nullptr;
+    }
+
+    lxb_dom_node_t *NextInOrder(lxb_dom_node_t *node)
+    {
+        if (node->first_child != nullptr)
+            return node->first_child;
+        return NextSkippingChildren(node);
+    }
+}
+
+HtmlRowStream::HtmlRowStream(const char *row_tag, const RowFn &on_row)
+    : row_tag(row_tag), on_row(on_row)
+{
+    document = lxb_html_document_create();
+    if (document == nullptr || lxb_html_document_parse_chunk_begin(document) != LXB_STATUS_OK)
+        failed = true;
+}
+
+HtmlRowStream::~HtmlRowStream()
+{
+    if (document != nullptr)
+        lxb_html_document_destroy(document);
+}
+
+bool HtmlRowStream::Feed(const char *data, size_t size)
+{
+    if (failed || stopped)
+        return false;
+    if (lxb_html_document_parse_chunk(document, (const lxb_char_t *)data, size) != LXB_STATUS_OK)
+    {
+        failed = true;
+        return false;
+    }
+    return drain(false);
+}
+
+bool HtmlRowStream::Finish()
+{
+    if (failed || stopped)
+        return false;
+    if (lxb_html_document_parse_chunk_end(document) != LXB_STATUS_OK)
+    {
+        failed = true;
+        return false;
+    }
+    return drain(true);
+}
+
+bool HtmlRowStream::drain(bool all)
+{
+    lxb_dom_node_t *node = lxb_dom_interface_node(document)->first_child;
+    while (node != nullptr)
+    {
+        size_t name_len = 0;
+        const lxb_char_t *name = nullptr;
+        if (node->type == LXB_DOM_NODE_TYPE_ELEMENT)
+            name = lxb_dom_element_local_name(lxb_dom_interface_element(node), &name_len);
+        if (name == nullptr || name_len != row_tag.size() || memcmp(name, row_tag.data(), name_len) != 0)
+        {
+            node = NextInOrder(node);
+            continue;
+        }
+
+        // The parser only ever appends, so a row with nothing after it yet
+        // may still be growing; anything later does not exist yet either.
+        lxb_dom_node_t *next = NextSkippingChildren(node);
+        if (next == nullptr && !all)
+            return true;
+
+        bool more = on_row(lxb_dom_interface_element(node), rows++);
+
+        // The whitespace between rows goes with them.
+        while (node->prev != nullptr && node->prev->type == LXB_DOM_NODE_TYPE_TEXT)
+        {
+            lxb_dom_node_t *text = node->prev;
+            lxb_dom_node_remove(text);
+            lxb_dom_node_destroy(text);
+        }
+        lxb_dom_node_remove(node);
+        lxb_dom_node_destroy_deep(node);
+
+        if (!more)
+        {
+            stopped = true;
+            return false;
+        }
+        node = next;
+    }
+    return true;
+}
+
+namespace
+{
+    // The entries of a parsed JSON listing, through `add`.
+    bool AddJsonItems(json_object *root, const HtmlIndex::JsonListing &json, const std::function<bool(const DirEntry &)> &add)
+    {
+        json_object *items = root;
+        if (json.items_key != nullptr && (json_object_get_type(root) != json_type_object ||
+                                          !json_object_object_get_ex(root, json.items_key, &items)))
+            return false;
+        if (json_object_get_type(items) != json_type_array)
+            return false;
+
+        size_t count = json_object_array_length(items);
+        for (size_t i = 0; i < count; i++)
+        {
+            json_object *item = json_object_array_get_idx(items, i);
+            if (json_object_get_type(item) != json_type_object)
+                continue;
+            DirEntry entry;
+            memset(&entry, 0, sizeof(DirEntry));
+            int parsed = json.parse_item(item, entry);
+            if (parsed < 0)
+                break;
+            if (parsed > 0 && !add(entry))
+                break;
+        }
+        return true;
+    }
+
+    int List(CHTTPClient *client, const std::string &url, const std::string &path, const char *parser,
+             const char *row_tag, const HtmlIndex::ParseRowFn &parse_row, const HtmlIndex::JsonListing *json,
+             const DirEntryBatchFn &on_batch, std::string &error)
+    {
+        // Entries leave in small batches while the page is still downloading,
+        // so the first rows of a huge folder show up right away.
+        static const size_t kListBatchSize = 64;
+
+        std::vector<DirEntry> out;
+        DirEntry entry;
+        Util::SetupPreviousFolder(path, &entry);
+        out.push_back(entry);
+        size_t total = 0;
+        bool cancelled = false;
+
+        auto add = [&](const DirEntry &entry)
+        {
+            out.push_back(entry);
+            total++;
+            if (out.size() >= kListBatchSize)
+            {
+                cancelled = !on_batch(out);
+                out.clear();
+            }
+            return !cancelled;
+        };
+
+        ParseProfile profile(parser);
+        HtmlRowStream stream(row_tag, [&](lxb_dom_element_t *row, size_t index)
+                             {
+                                 DirEntry entry;
+                                 memset(&entry, 0, sizeof(DirEntry));
+                                 int parsed = parse_row(row, index, entry);
+                                 if (parsed < 0)
+                                     return false;
+                                 if (parsed == 0)
+                                     return true;
+                                 return add(entry);
+                             });
+
+        CHTTPClient::HeadersMap headers;
+        bool asked = json != nullptr && json->accept != nullptr && HostCaps::Get(url).json_listing != 0;
+        if (asked)
+            headers["Accept"] = json->accept;
+
+        // JSON replies are not split into rows; the tokener keeps what came
+        // so far, which is a fraction of the same listing in HTML.
+        enum
+        {
+            FORM_UNKNOWN,
+            FORM_HTML,
+            FORM_JSON
+        } form = FORM_UNKNOWN;
+        json_tokener *tokener = nullptr;
+        json_object *root = nullptr;
+        bool json_failed = false;
+
+        CHTTPClient::HttpResponse res;
+        bool ok = client->GetListingToSink(url, headers, [&](const char *data, size_t size)
+                                    {
+                                        if (form == FORM_UNKNOWN)
+                                        {
+                                            while (size > 0 && isspace((unsigned char)*data))
+                                            {
+                                                data++;
+                                                size--;
+                                            }
+                                            if (size == 0)
+                                                return true;
+                                            form = json != nullptr && (*data == '[' || *data == '{') ? FORM_JSON : FORM_HTML;
+                                            if (form == FORM_JSON)
+                                                tokener = json_tokener_new();
+                                        }
+                                        if (form == FORM_JSON)
+                                        {
+                                            if (root != nullptr)
+                                                return true;
+                                            profile.Resume();
+                                            root = json_tokener_parse_ex(tokener, data, (int)size);
+                                            json_failed = root == nullptr && json_tokener_get_error(tokener) != json_tokener_continue;
+                                            profile.Pause();
+                                            profile.Add(size, 0);
+                                            return !json_failed;
+                                        }
+                                        size_t before = total;
+                                        profile.Resume();
+                                        bool more = stream.Feed(data, size);
+                                        profile.Pause();
+                                        profile.Add(size, total - before);
+                                        return more;
+                                    }, res);
+        if (tokener != nullptr)
+            json_tokener_free(tokener);
+
+        // A row that ended the listing or a page lexbor gave up on aborts the
+        // transfer too; both keep the entries found up to there.
+        if (!ok && !stream.Stopped() && !stream.Failed() && !json_failed)
+        {
+            if (root != nullptr)
+                json_object_put(root);
+            error = res.errMessage;
+            on_batch(out);
+            return 0;
+        }
+
+        // A server that will not send JSON at all is asked once without it.
+        if (asked && res.iCode == 406)
+        {
+            HostCaps::Learn(url, &HostCaps::Caps::json_listing, 0);
+            return List(client, url, path, parser, row_tag, parse_row, json, on_batch, error);
+        }
+
+        if (ok && HTTP_SUCCESS(res.iCode))
+        {
+            size_t before = total;
+            profile.Resume();
+            if (form == FORM_JSON && root != nullptr)
+                AddJsonItems(root, *json, add);
+            else if (form != FORM_JSON)
+                stream.Finish();
+            profile.Pause();
+            profile.Add(0, total - before);
+            if (json != nullptr && form != FORM_UNKNOWN)
+                HostCaps::Learn(url, &HostCaps::Caps::json_listing, form == FORM_JSON ? 1 : 0);
+        }
+        if (root != nullptr)
+            json_object_put(root);
+
+        if (!cancelled && !out.empty())
+            on_batch(out);
+        return 1;
+    }
+}
+
+int HtmlIndex::ListDirStreamed(CHTTPClient *client, const std::string &url, const std::string &path,
+                               const char *parser, const char *row_tag, const ParseRowFn &parse_row,
+                               const DirEntryBatchFn &on_batch, std::string &error)
+{
+    return List(client, url, path, parser, row_tag, parse_row, nullptr, on_batch, error);
+}
+
+int HtmlIndex::ListDirStreamed(CHTTPClient *client, const std::string &url, const std::string &path,
+                               const char *parser, const char *row_tag, const ParseRowFn &parse_row,
+                               const JsonListing &json, const DirEntryBatchFn &on_batch, std::string &error)
+{
+    return List(client, url, path, parser, row_tag, parse_row, &json, on_batch, error);
+}
+
+bool HtmlIndex::ParseJson(const std::string &body, const JsonListing &json, std::vector<DirEntry> &out)
+{
+    size_t first = body.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos || (body[first] != '[' && body[first] != '{'))
+        return false;
+    json_object *root = json_tokener_parse(body.c_str() + first);
+    if (root == nullptr)
+        return false;
+    bool parsed = AddJsonItems(root, json, [&out](const DirEntry &entry)
+                               {
+                                   out.push_back(entry);
+                                   return true;
+                               });
+    json_object_put(root);
+    return parsed;
+}
+
+std::string HtmlIndex::JsonString(json_object *item, const char *key)
+{
+    json_object *value = nullptr;
+    if (!json_object_object_get_ex(item, key, &value) || json_object_get_type(value) != json_type_string)
+        return "";
+    return json_object_get_string(value);
+}
+
+int64_t HtmlIndex::JsonInt(json_object *item, const char *key)
+{
+    json_object *value = nullptr;
+    if (!json_object_object_get_ex(item, key, &value) || json_object_get_type(value) != json_type_int)
+        return -1;
+    return json_object_get_int64(value);
+}
+
+std::vector<lxb_dom_element_t *> HtmlIndex::Children(lxb_dom_element_t *parent, const char *tag)
+{
+    std::vector<lxb_dom_element_t *> out;
+    size_t tag_len = strlen(tag);
+    for (lxb_dom_node_t *node = lxb_dom_interface_node(parent)->first_child; node != nullptr; node = node->next)
+    {
+        if (node->type != LXB_DOM_NODE_TYPE_ELEMENT)
+            continue;
+        size_t name_len = 0;
+        const lxb_char_t *name = lxb_dom_element_local_name(lxb_dom_interface_element(node), &name_len);
+        if (name != nullptr && name_len == tag_len && memcmp(name, tag, tag_len) == 0)
+            out.push_back(lxb_dom_interface_element(node));
+    }
+    return out;
+}
+
+lxb_dom_element_t *HtmlIndex::Ancestor(lxb_dom_element_t *element, const char *tag)
+{
+    size_t tag_len = strlen(tag);
+    for (lxb_dom_node_t *node = lxb_dom_interface_node(element)->parent; node != nullptr; node = node->parent)
+    {
+        if (node->type != LXB_DOM_NODE_TYPE_ELEMENT)
+            continue;
+        size_t name_len = 0;
+        const lxb_char_t *name = lxb_dom_element_local_name(lxb_dom_interface_element(node), &name_len);
+        if (name != nullptr && name_len == tag_len && memcmp(name, tag, tag_len) == 0)
+            return lxb_dom_interface_element(node);
+    }
+    return nullptr;
+}
+
+std::string HtmlIndex::Attribute(lxb_dom_element_t *element, const char *name)
+{
+    size_t value_len = 0;
+    const lxb_char_t *value = lxb_dom_element_get_attribute(element, (const lxb_char_t *)name, strlen(name), &value_len);
+    if (value == nullptr)
+        return "";
+    return std::string((const char *)value, value_len);
+}
+
+std::vector<DirEntry> HtmlIndex::ListDir(CHTTPClient *client, const std::string &url, const std::string &path,
+                                         const char *parser, const char *row_tag, const ParseRowFn &parse_row,
+                                         std::string &error)
+{
+    std::vector<DirEntry> out;
+    ListDirStreamed(client, url, path, parser, row_tag, parse_row, [&out](const std::vector<DirEntry> &batch)
+                    {
+                        out.insert(out.end(), batch.begin(), batch.end());
+                        return true;
+                    }, error);
+    return out;
+}
@@ -0,0 +1,139 @@
+#ifndef NEO_HTML_INDEX_H
+#define NEO_HTML_INDEX_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <lexbor/html/parser.h>
+#include <lexbor/dom/interfaces/element.h>
+#include <json-c/json.h>
+#include "httpclient/HTTPClient.h"
+#include "clients/remote_client.h"
+#include "common.h"
+
+// Parses an HTML page with lexbor's chunk parser while it downloads and
+// hands over every `row_tag` element (e.g. "tr") once the parser has moved
+// past it. Handed rows are removed from the document, so however long an
+// autoindex page is, the tree only ever holds the row still arriving.
+class HtmlRowStream
+{
+public:
+    // `index` counts rows from 0 in document order. Return false to stop;
+    // Feed() and Finish() then fail with Stopped() set.
+    using RowFn = std::function<bool(lxb_dom_element_t *row, size_t index)>;
+
+    HtmlRowStream(const char *row_tag, const RowFn &on_row);
+    ~HtmlRowStream();
+
+    bool Feed(const char *data, size_t size);
+    // Ends the document and hands over the rows that were still open.
+    bool Finish();
+    bool Stopped() const { return stopped; }
+    // lexbor gave up on the page; rows handed over so far stay valid.
+    bool Failed() const { return failed; }
+
+private:
+    std::string row_tag;
+    RowFn on_row;
+    lxb_html_document_t *document = nullptr;
+    size_t rows = 0;
+    bool failed = false;
+    bool stopped = false;
+
+    bool drain(bool all);
+};
+
+// Steps over the text and comment nodes between a page's elements.
+namespace Util
+{
+    // First element child of `element`, or nullptr.
+    inline lxb_dom_node_t *NextChildElement(lxb_dom_element_t *element)
+    {
+        lxb_dom_node_t *node = element != nullptr ? lxb_dom_interface_node(element)->first_child : nullptr;
+        while (node != nullptr && node->type != LXB_DOM_NODE_TYPE_ELEMENT)
+            node = node->next;
+        return node;
+    }
+
+    // Next element sibling of `node`, or nullptr.
+    inline lxb_dom_node_t *NextElement(lxb_dom_node_t *node)
+    {
+        node = node != nullptr ? node->next : nullptr;
+        while (node != nullptr && node->type != LXB_DOM_NODE_TYPE_ELEMENT)
+            node = node->next;
+        return node;
+    }
+
+    // First text child of `element`, or nullptr.
+    inline lxb_dom_node_t *NextChildTextNode(lxb_dom_element_t *element)
+    {
+        lxb_dom_node_t *node = element != nullptr ? lxb_dom_interface_node(element)->first_child : nullptr;
+        while (node != nullptr && node->type != LXB_DOM_NODE_TYPE_TEXT)
+            node = node->next;
+        return node;
+    }
+}
+
+namespace HtmlIndex
+{
+    // Turns one row into an entry of the listing: 1 when it filled
+    // `entry`, 0 to skip the row, -1 to end the listing at this row.
+    using ParseRowFn = std::function<int(lxb_dom_element_t *row, size_t index, DirEntry &entry)>;
+
+    // GETs the index page at `url` and streams the entries of `path` to
+    // `on_batch` while the page downloads, ".." first. `parser` names the
+    // page format in the LISTING PARSE debug line. Returns 0 with `error`
+    // set when the request failed; a non-2xx reply lists only "..".
+    int ListDirStreamed(CHTTPClient *client, const std::string &url, const std::string &path, const char *parser,
+                        const char *row_tag, const ParseRowFn &parse_row, const DirEntryBatchFn &on_batch,
+                        std::string &error);
+
+    // Turns one object of a JSON listing into an entry; returns as
+    // ParseRowFn.
+    using ParseJsonFn = std::function<int(json_object *item, DirEntry &entry)>;
+
+    // The JSON form some servers give of the same index: nginx with
+    // autoindex_format json, or npx serve and rclone serve when asked.
+    struct JsonListing
+    {
+        // Accept header asking for it, or nullptr when the server's
+        // configuration decides.
+        const char *accept = nullptr;
+        // Member holding the entries' array, or nullptr when the reply is
+        // the array itself.
+        const char *items_key = nullptr;
+        ParseJsonFn parse_item;
+    };
+
+    // As above, but takes whichever form the server answers with. The
+    // first byte tells them apart; the answer is learned per host
+    // (HostCaps json_listing), so a server that keeps sending HTML is not
+    // asked for JSON again.
+    int ListDirStreamed(CHTTPClient *client, const std::string &url, const std::string &path, const char *parser,
+                        const char *row_tag, const ParseRowFn &parse_row, const JsonListing &json,
+                        const DirEntryBatchFn &on_batch, std::string &error);
+
+    // Appends the entries of a whole reply `body` to `out`; false when it
+    // is not a JSON listing.
+    bool ParseJson(const std::string &body, const JsonListing &json, std::vector<DirEntry> &out);
+
+    // String and integer members of a listing object; "" and -1 when
+    // missing or of another type.
+    std::string JsonString(json_object *item, const char *key);
+    int64_t JsonInt(json_object *item, const char *key);
+
+    // Element children of `parent` named `tag`, e.g. the cells of a row.
+    std::vector<lxb_dom_element_t *> Children(lxb_dom_element_t *parent, const char *tag);
+
+    // Closest ancestor of `element` named `tag`, or nullptr.
+    lxb_dom_element_t *Ancestor(lxb_dom_element_t *element, const char *tag);
+    // `name` attribute of `element`, empty when missing.
+    std::string Attribute(lxb_dom_element_t *element, const char *name);
+
+    // ListDirStreamed() gathered into one vector, for ListDir().
+    std::vector<DirEntry> ListDir(CHTTPClient *client, const std::string &url, const std::string &path,
+                                  const char *parser, const char *row_tag, const ParseRowFn &parse_row,
+                                  std::string &error);
+}
+
+#endif
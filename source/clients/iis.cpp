@@ -6,6 +6,7 @@
 #include "clients/iis.h"
 #include "lang.h"
 #include "util.h"
+#include "parse_profile.h"
 #include "windows.h"
 
 std::vector<DirEntry> IISClient::ListDir(const std::string &path)
@@ -18,10 +19,11 @@ std::vector<DirEntry> IISClient::ListDir(const std::string &path)
     out.push_back(entry);
 
     std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
-    if (client->Get(encode_url, headers, res))
+    if (client->GetListing(encode_url, headers, res))
     {
         if (HTTP_SUCCESS(res.iCode))
         {
+            ParseProfile profile("iis", res.strBody.size(), out);
             lxb_status_t status;
             lxb_dom_attr_t *attr;
             lxb_dom_node_t *node;
@@ -11,6 +11,10 @@ class MyrientClient : public BaseClient
 {
 public:
     std::vector<DirEntry> ListDir(const std::string &path);
+
+protected:
+    // The same path under each [Global] myrient_mirrors base URL.
+    std::vector<std::string> MirrorUrls(const std::string &path) override;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,872 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "lang.h"
+#include "nfsclient.h"
+#include "config.h"
+#include "windows.h"
+#include "util.h"
+#include "fs.h"
+#include "local_sink.h"
+#include "buffer_pool.h"
+#include "transfer_stats.h"
+#include "logger.h"
+#include "resolver.h"
+#include "cancel.h"
+
+namespace
+{
+    struct NfsIoSlot
+    {
+        // Own buffer for downloads and uploads; readAt() reads straight
+        // into the caller's memory instead.
+        TransferBuffer buf;
+        uint8_t *dest = nullptr;
+        uint64_t offset = 0;
+        uint32_t length = 0;
+        int status = 0;
+        bool busy = false;
+        bool done = false;
+    };
+
+    // libnfs hands a READ's data to the callback, valid only until it
+    // returns.
+    void NfsReadCallback(int status, struct nfs_context *nfs, void *data, void *private_data)
+    {
+        NfsIoSlot *slot = (NfsIoSlot *)private_data;
+        if (status > 0)
+            memcpy(slot->dest, data, MIN((uint32_t)status, slot->length));
+        slot->status = status;
+        slot->done = true;
+    }
+
+    void NfsWriteCallback(int status, struct nfs_context *nfs, void *data, void *private_data)
+    {
+        NfsIoSlot *slot = (NfsIoSlot *)private_data;
+        slot->status = status;
+        slot->done = true;
+    }
+
+    // The RPCs of one transfer, all on the client's context. Replies come
+    // back out of order; callers pick up finished slots and reuse them.
+    struct NfsIoQueue
+    {
+        struct nfs_context *nfs;
+        std::vector<NfsIoSlot> slots;
+
+        // `block_size` 0 leaves the slots without buffers.
+        NfsIoQueue(struct nfs_context *ctx, uint32_t block_size) : nfs(ctx), slots(nfs_io_depth)
+        {
+            if (block_size == 0)
+                return;
+            for (auto &slot : slots)
+            {
+                slot.buf.Acquire(block_size);
+                slot.dest = (uint8_t *)slot.buf.data();
+            }
+            // Fewer RPCs in flight rather than none when the transfer
+            // buffer pool is short.
+            slots.erase(std::remove_if(slots.begin(), slots.end(), [](const NfsIoSlot &slot)
+                                       { return !slot.buf; }),
+                        slots.end());
+        }
+
+        // Callbacks point into the slots, so wait out what is in flight.
+        ~NfsIoQueue()
+        {
+            while (Busy() > 0 && Service(100))
+                ;
+        }
+
+        NfsIoSlot *Idle()
+        {
+            for (auto &slot : slots)
+            {
+                if (!slot.busy)
+                    return &slot;
+            }
+            return NULL;
+        }
+
+        bool Active() const
+        {
+            for (auto &slot : slots)
+            {
+                if (slot.busy)
+                    return true;
+            }
+            return false;
+        }
+
+        int Busy() const
+        {
+            int n = 0;
+            for (auto &slot : slots)
+            {
+                if (slot.busy && !slot.done)
+                    n++;
+            }
+            return n;
+        }
+
+        bool Read(struct nfsfh *fh, NfsIoSlot *slot)
+        {
+            slot->status = 0;
+            slot->done = false;
+            if (nfs_pread_async(nfs, fh, slot->offset, slot->length, NfsReadCallback, slot) < 0)
+                return false;
+            slot->busy = true;
+            return true;
+        }
+
+        bool Write(struct nfsfh *fh, NfsIoSlot *slot)
+        {
+            slot->status = 0;
+            slot->done = false;
+            if (nfs_pwrite_async(nfs, fh, slot->offset, slot->length, slot->dest, NfsWriteCallback, slot) < 0)
+                return false;
+            slot->busy = true;
+            return true;
+        }
+
+        // Waits up to timeout_ms for socket events and dispatches replies.
+        // Returns false when the connection failed.
+        bool Service(int timeout_ms)
+        {
+            struct pollfd pfd;
+            pfd.fd = nfs_get_fd(nfs);
+            pfd.events = nfs_which_events(nfs);
+            pfd.revents = 0;
+            if (poll(&pfd, 1, timeout_ms) < 0)
+                return false;
+            if (pfd.revents == 0)
+                return true;
+            return nfs_service(nfs, pfd.revents) >= 0;
+        }
+    };
+}
+
+NfsClient::NfsClient()
+{
+    snprintf(response, 1023, "%s", "");
+}
+
+NfsClient::~NfsClient()
+{
+    if (nfs != nullptr)
+        nfs_destroy_context(nfs);
+}
+
+void NfsClient::setError()
+{
+    snprintf(response, 1023, "%s", nfs != nullptr ? nfs_get_error(nfs) : lang_strings[STR_FAILED]);
+}
+
+std::string NfsClient::exportPath(const std::string &path) const
+{
+    std::string out = path;
+    out = Util::Rtrim(out, "/");
+    if (out.empty() || out[0] != '/')
+        out = "/" + out;
+    return out;
+}
+
+/*
+ * NfsConnect - mount the export named by an nfs://server/export URL; the
+ * credentials of AUTH_SYS come from its uid/gid query arguments
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int NfsClient::Connect(const std::string &url, const std::string &user, const std::string &pass)
+{
+    nfs = nfs_init_context();
+    if (nfs == NULL)
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_FAIL_INIT_NFS_CONTEXT]);
+        return 0;
+    }
+
+    struct nfs_url *nfs_url = nfs_parse_url_dir(nfs, url.c_str());
+    if (nfs_url == NULL)
+    {
+        setError();
+        return 0;
+    }
+    if (nfs_url->path == NULL || strlen(nfs_url->path) == 0)
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_NFS_EXP_PATH_MISSING_MSG]);
+        nfs_destroy_url(nfs_url);
+        return 0;
+    }
+
+    // Asked for before the mount, which settles them with the server's
+    // FSINFO rtmax/wtmax.
+    uint32_t rw_size = (uint32_t)nfs_rw_size_kb * 1024;
+    nfs_set_version(nfs, NFS_V3);
+    nfs_set_readmax(nfs, rw_size);
+    nfs_set_writemax(nfs, rw_size);
+    nfs_set_timeout(nfs, 30000);
+    // READDIRPLUS replies as large as a READ, so big folders take few
+    // round trips.
+    nfs_set_readdir_max_buffer_size(nfs, rw_size, rw_size);
+
+    std::string server = nfs_url->server;
+    std::string address;
+    if (Resolver::ResolveText(server, address))
+        server = address;
+
+    if (nfs_mount(nfs, server.c_str(), nfs_url->path) != 0)
+    {
+        snprintf(response, 1023, "%s: %s", lang_strings[STR_FAIL_MOUNT_NFS_MSG], nfs_get_error(nfs));
+        nfs_destroy_url(nfs_url);
+        return 0;
+    }
+    nfs_destroy_url(nfs_url);
+
+    read_size = (uint32_t)nfs_get_readmax(nfs);
+    write_size = (uint32_t)nfs_get_writemax(nfs);
+    connected = true;
+    Logger::Logf("NFS mounted server=%s rsize=%u wsize=%u depth=%d", server.c_str(), read_size, write_size,
+                 nfs_io_depth);
+    return 1;
+}
+
+/*
+ * NfsLastResponse - return a pointer to the last response received
+ */
+const char *NfsClient::LastResponse()
+{
+    return (const char *)response;
+}
+
+/*
+ * IsConnected - return true if connected to remote
+ */
+bool NfsClient::IsConnected()
+{
+    return connected;
+}
+
+/*
+ * Ping - a GETATTR of the export's root. libnfs reconnects a dropped TCP
+ * connection by itself, so no keep-alive is needed between requests.
+ */
+bool NfsClient::Ping()
+{
+    struct nfs_stat_64 st;
+    connected = nfs != nullptr && nfs_stat64(nfs, "/", &st) == 0;
+    return connected;
+}
+
+/*
+ * NfsQuit - unmount and disconnect from remote
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int NfsClient::Quit()
+{
+    if (nfs != nullptr)
+    {
+        nfs_umount(nfs);
+        nfs_destroy_context(nfs);
+    }
+    nfs = NULL;
+    connected = false;
+    return 1;
+}
+
+/*
+ * NfsMkdir - create a directory at server
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int NfsClient::Mkdir(const std::string &path)
+{
+    if (nfs_mkdir(nfs, exportPath(path).c_str()) != 0)
+    {
+        setError();
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * NfsRmdir - remove directory and all files under directory at remote
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int NfsClient::Rmdir(const std::string &path, bool recursive)
+{
+    if (Cancel::Stopped())
+        return 1;
+
+    std::vector<DirEntry> list = ListDir(path);
+    int ret;
+    for (int i = 0; i < list.size(); i++)
+    {
+        if (Cancel::Stopped())
+            return 1;
+
+        if (strcmp(list[i].name, "..") == 0)
+            continue;
+        if (list[i].isDir && recursive)
+        {
+            ret = Rmdir(list[i].path, recursive);
+            if (ret == 0)
+            {
+                snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_DEL_DIR_MSG], list[i].path);
+                return 0;
+            }
+        }
+        else
+        {
+            snprintf(activity_message, 1023, "%s %s\n", lang_strings[STR_DELETING], list[i].path);
+            ret = Delete(list[i].path);
+            if (ret == 0)
+            {
+                snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_DEL_FILE_MSG], list[i].path);
+                return 0;
+            }
+        }
+    }
+    if (nfs_rmdir(nfs, exportPath(path).c_str()) != 0)
+    {
+        setError();
+        snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAIL_DEL_DIR_MSG], path.c_str());
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * NfsGet - download a file, resuming at `offset`
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int NfsClient::Get(const std::string &outputfile, const std::string &path, uint64_t offset)
+{
+    int64_t size;
+    if (!Size(path, &size))
+        return 0;
+    return download(outputfile, path, size, offset);
+}
+
+int NfsClient::GetKnownSize(const std::string &outputfile, const std::string &path, int64_t size, uint64_t offset)
+{
+    // The size of a READDIRPLUS listing saves the GETATTR.
+    if (size <= 0)
+        return Get(outputfile, path, offset);
+    return download(outputfile, path, size, offset);
+}
+
+int NfsClient::download(const std::string &outputfile, const std::string &path, int64_t size, uint64_t offset)
+{
+    bytes_to_download = size;
+    struct nfsfh *in = NULL;
+    if (nfs_open(nfs, exportPath(path).c_str(), O_RDONLY, &in) != 0)
+    {
+        setError();
+        return 0;
+    }
+
+    LocalFileSink out(outputfile, LocalFileSink::NeedsSplit(size) ? LocalFileSink::kSplitPartSize : 0);
+    if (!out.Open(offset > 0))
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+        nfs_close(nfs, in);
+        return 0;
+    }
+    // Blocks complete out of order; reserving the file keeps FAT32 from
+    // zero-filling the gap in front of each one.
+    out.Preallocate(size);
+
+    bool failed = false;
+    uint64_t next = offset;
+    bytes_transfered = offset;
+    prev_tick = Util::GetTick();
+    {
+        NfsIoQueue queue(nfs, read_size);
+        if (queue.slots.empty())
+        {
+            snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+            failed = true;
+        }
+        while (!failed)
+        {
+            if (Cancel::Stopped())
+            {
+                snprintf(response, 1023, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+                failed = true;
+                break;
+            }
+
+            NfsIoSlot *slot;
+            while (next < (uint64_t)size && (slot = queue.Idle()) != NULL)
+            {
+                slot->offset = next;
+                slot->length = (uint32_t)MIN((uint64_t)read_size, (uint64_t)size - next);
+                if (!queue.Read(in, slot))
+                {
+                    setError();
+                    failed = true;
+                    break;
+                }
+                next += slot->length;
+            }
+
+            for (auto &s : queue.slots)
+            {
+                if (failed || !s.busy || !s.done)
+                    continue;
+                s.busy = false;
+                if (s.status <= 0)
+                {
+                    snprintf(response, 1023, "%s", s.status < 0 ? strerror(-s.status) : lang_strings[STR_FAILED]);
+                    failed = true;
+                    break;
+                }
+                if (!out.WriteAt(s.offset, s.dest, s.status))
+                {
+                    snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+                    failed = true;
+                    break;
+                }
+                bytes_transfered += s.status;
+                TransferStats::AddBytes(s.status);
+
+                // Short read: ask again for the rest of this block.
+                if ((uint32_t)s.status < s.length)
+                {
+                    s.offset += s.status;
+                    s.length -= s.status;
+                    if (!queue.Read(in, &s))
+                    {
+                        setError();
+                        failed = true;
+                        break;
+                    }
+                }
+            }
+
+            if (failed || (next >= (uint64_t)size && !queue.Active()))
+                break;
+
+            if (!queue.Service(100))
+            {
+                setError();
+                failed = true;
+            }
+        }
+    }
+    nfs_close(nfs, in);
+    if (failed)
+    {
+        out.Close();
+        return 0;
+    }
+    if (!out.Finish())
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+        return 0;
+    }
+    return 1;
+}
+
+bool NfsClient::readAt(struct nfsfh *fh, uint8_t *buffer, uint64_t size, uint64_t offset)
+{
+    NfsIoQueue queue(nfs, 0);
+    uint64_t next = 0;
+    bool failed = false;
+    while (!failed)
+    {
+        NfsIoSlot *slot;
+        while (next < size && (slot = queue.Idle()) != NULL)
+        {
+            slot->dest = buffer + next;
+            slot->offset = offset + next;
+            slot->length = (uint32_t)MIN((uint64_t)read_size, size - next);
+            if (!queue.Read(fh, slot))
+            {
+                setError();
+                failed = true;
+                break;
+            }
+            next += slot->length;
+        }
+
+        for (auto &s : queue.slots)
+        {
+            if (failed || !s.busy || !s.done)
+                continue;
+            s.busy = false;
+            // Zero is the end of the file, short of the range.
+            if (s.status <= 0)
+            {
+                snprintf(response, 1023, "%s", s.status < 0 ? strerror(-s.status) : lang_strings[STR_FAILED]);
+                failed = true;
+                break;
+            }
+            if ((uint32_t)s.status < s.length)
+            {
+                s.dest += s.status;
+                s.offset += s.status;
+                s.length -= s.status;
+                if (!queue.Read(fh, &s))
+                {
+                    setError();
+                    failed = true;
+                    break;
+                }
+            }
+        }
+
+        if (failed || (next >= size && !queue.Active()))
+            break;
+
+        if (!queue.Service(100))
+        {
+            setError();
+            failed = true;
+        }
+    }
+    return !failed;
+}
+
+int NfsClient::GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset)
+{
+    struct nfsfh *in = (struct nfsfh *)Open(path, O_RDONLY);
+    if (in == NULL)
+        return 0;
+
+    int ret = GetRange(in, buffer, size, offset);
+    nfs_close(nfs, in);
+    return ret;
+}
+
+int NfsClient::GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset)
+{
+    return readAt((struct nfsfh *)fp, (uint8_t *)buffer, size, offset) ? 1 : 0;
+}
+
+int NfsClient::GetRanges(const std::string &path, std::vector<RemoteRange> &ranges)
+{
+    // One OPEN (a LOOKUP on NFSv3) for the whole batch.
+    struct nfsfh *in = (struct nfsfh *)Open(path, O_RDONLY);
+    if (in == NULL)
+        return 0;
+
+    int ret = 1;
+    for (RemoteRange &range : ranges)
+    {
+        range.ok = readAt(in, (uint8_t *)range.buffer, range.size, range.offset);
+        if (!range.ok)
+            ret = 0;
+    }
+    nfs_close(nfs, in);
+    return ret;
+}
+
+int NfsClient::writeFrom(const std::string &path, const RemoteSourceFn &source, uint64_t offset)
+{
+    struct nfsfh *out = NULL;
+    int rc = offset > 0 ? nfs_open(nfs, exportPath(path).c_str(), O_WRONLY, &out)
+                        : nfs_create(nfs, exportPath(path).c_str(), O_WRONLY | O_TRUNC, 0644, &out);
+    if (rc != 0)
+    {
+        setError();
+        return 0;
+    }
+
+    uint64_t next = offset;
+    bool eof = false;
+    bool failed = false;
+    bytes_transfered = offset;
+    prev_tick = Util::GetTick();
+    {
+        // The source refills whichever slot is free while the other slots'
+        // writes are on the wire.
+        NfsIoQueue queue(nfs, write_size);
+        if (queue.slots.empty())
+        {
+            snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+            failed = true;
+        }
+        while (!failed)
+        {
+            if (Cancel::Stopped())
+            {
+                snprintf(response, 1023, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+                failed = true;
+                break;
+            }
+
+            NfsIoSlot *slot;
+            while (!eof && (slot = queue.Idle()) != NULL)
+            {
+                int64_t count = source((char *)slot->dest, write_size);
+                if (count < 0)
+                {
+                    snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+                    failed = true;
+                    break;
+                }
+                if (count == 0)
+                {
+                    eof = true;
+                    break;
+                }
+                slot->offset = next;
+                slot->length = (uint32_t)count;
+                if (!queue.Write(out, slot))
+                {
+                    setError();
+                    failed = true;
+                    break;
+                }
+                next += (uint64_t)count;
+            }
+
+            for (auto &s : queue.slots)
+            {
+                if (failed || !s.busy || !s.done)
+                    continue;
+                s.busy = false;
+                if (s.status <= 0)
+                {
+                    snprintf(response, 1023, "%s", s.status < 0 ? strerror(-s.status) : lang_strings[STR_FAILED]);
+                    failed = true;
+                    break;
+                }
+                bytes_transfered += s.status;
+
+                // Short write: send the rest of this block again.
+                if ((uint32_t)s.status < s.length)
+                {
+                    memmove(s.dest, s.dest + s.status, s.length - s.status);
+                    s.offset += s.status;
+                    s.length -= s.status;
+                    if (!queue.Write(out, &s))
+                    {
+                        setError();
+                        failed = true;
+                        break;
+                    }
+                }
+            }
+
+            if (failed || (eof && !queue.Active()))
+                break;
+
+            if (!queue.Service(100))
+            {
+                setError();
+                failed = true;
+            }
+        }
+    }
+    // libnfs sends UNSTABLE writes; the COMMIT makes the server keep them.
+    if (!failed && nfs_fsync(nfs, out) != 0)
+    {
+        setError();
+        failed = true;
+    }
+    nfs_close(nfs, out);
+    return failed ? 0 : 1;
+}
+
+/*
+ * NfsPut - upload a local file
+ *
+ * return 1 if successful, 0 otherwise
+ */
+int NfsClient::Put(const std::string &inputfile, const std::string &path, uint64_t offset)
+{
+    bytes_to_download = FS::GetSize(inputfile);
+    if (bytes_to_download < 0)
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+        return 0;
+    }
+
+    FILE *in = FS::OpenRead(inputfile);
+    if (in == NULL)
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+        return 0;
+    }
+    if (offset > (uint64_t)bytes_to_download || (offset > 0 && FS::Seek(in, offset) < 0))
+    {
+        snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+        FS::Close(in);
+        return 0;
+    }
+
+    int ret = writeFrom(path, [in](char *buffer, size_t size) -> int64_t
+                        { return FS::Read(in, buffer, (uint32_t)size); }, offset);
+    FS::Close(in);
+    return ret;
+}
+
+int NfsClient::PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source)
+{
+    if (size != REMOTE_SIZE_UNKNOWN)
+        bytes_to_download = size;
+    return writeFrom(path, source);
+}
+
+int NfsClient::Rename(const std::string &src, const std::string &dst)
+{
+    if (nfs_rename(nfs, exportPath(src).c_str(), exportPath(dst).c_str()) != 0)
+    {
+        setError();
+        return 0;
+    }
+    return 1;
+}
+
+int NfsClient::Delete(const std::string &path)
+{
+    if (nfs_unlink(nfs, exportPath(path).c_str()) != 0)
+    {
+        setError();
+        return 0;
+    }
+    return 1;
+}
+
+int NfsClient::Copy(const std::string &from, const std::string &to)
+{
+    snprintf(response, 1023, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+    return -1;
+}
+
+int NfsClient::Move(const std::string &from, const std::string &to)
+{
+    return Rename(from, to);
+}
+
+int NfsClient::Size(const std::string &path, int64_t *size)
+{
+    struct nfs_stat_64 st;
+    if (nfs_stat64(nfs, exportPath(path).c_str(), &st) != 0)
+    {
+        setError();
+        return 0;
+    }
+    *size = (int64_t)st.nfs_size;
+    return 1;
+}
+
+bool NfsClient::FileExists(const std::string &path)
+{
+    struct nfs_stat_64 st;
+    return nfs_stat64(nfs, exportPath(path).c_str(), &st) == 0;
+}
+
+std::vector<DirEntry> NfsClient::ListDir(const std::string &path)
+{
+    std::vector<DirEntry> out;
+    DirEntry entry;
+    Util::SetupPreviousFolder(path, &entry);
+    out.push_back(entry);
+
+    // nfs_opendir() reads the whole folder with READDIRPLUS before it
+    // returns, so the loop below is local.
+    struct nfsdir *dir = NULL;
+    if (nfs_opendir(nfs, exportPath(path).c_str(), &dir) != 0)
+    {
+        snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAIL_READ_LOCAL_DIR_MSG], nfs_get_error(nfs));
+        return out;
+    }
+
+    struct nfsdirent *ent;
+    while ((ent = nfs_readdir(nfs, dir)) != NULL)
+    {
+        if (strcmp(ent->name, "..") == 0 || strcmp(ent->name, ".") == 0)
+            continue;
+
+        DirEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        snprintf(entry.directory, 511, "%s", path.c_str());
+        snprintf(entry.name, 255, "%s", ent->name);
+        if (path.length() > 0 && path[path.length() - 1] == '/')
+            snprintf(entry.path, sizeof(entry.path), "%s%s", path.c_str(), ent->name);
+        else
+            snprintf(entry.path, sizeof(entry.path), "%s/%s", path.c_str(), ent->name);
+        entry.selectable = true;
+
+        time_t t = (time_t)ent->mtime.tv_sec;
+        struct tm tm = *localtime(&t);
+        entry.modified.day = tm.tm_mday;
+        entry.modified.month = tm.tm_mon + 1;
+        entry.modified.year = tm.tm_year + 1900;
+        entry.modified.hours = tm.tm_hour;
+        entry.modified.minutes = tm.tm_min;
+        entry.modified.seconds = tm.tm_sec;
+
+        if (S_ISDIR(ent->mode))
+        {
+            entry.isDir = true;
+            entry.file_size = 0;
+            sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+        }
+        else if (S_ISLNK(ent->mode))
+        {
+            entry.isLink = true;
+            entry.file_size = 0;
+            sprintf(entry.display_size, "%s", lang_strings[STR_LINK]);
+        }
+        else
+        {
+            entry.file_size = ent->size;
+            DirEntry::SetDisplaySize(&entry);
+        }
+        out.push_back(entry);
+    }
+    nfs_closedir(nfs, dir);
+    return out;
+}
+
+std::string NfsClient::GetPath(std::string ppath1, std::string ppath2)
+{
+    std::string path1 = ppath1;
+    std::string path2 = ppath2;
+    path1 = Util::Rtrim(Util::Trim(path1, " "), "/");
+    path2 = Util::Trim(Util::Trim(path2, " "), "/");
+    return path1 + "/" + path2;
+}
+
+ClientType NfsClient::clientType()
+{
+    return CLIENT_TYPE_NFS;
+}
+
+uint32_t NfsClient::SupportedActions()
+{
+    return REMOTE_ACTION_ALL ^ REMOTE_ACTION_CUT ^ REMOTE_ACTION_COPY ^ REMOTE_ACTION_PASTE;
+}
+
+void *NfsClient::Open(const std::string &path, int flags)
+{
+    struct nfsfh *fh = NULL;
+    int ret = (flags & O_CREAT) ? nfs_create(nfs, exportPath(path).c_str(), flags & ~O_CREAT, 0644, &fh)
+                                : nfs_open(nfs, exportPath(path).c_str(), flags, &fh);
+    if (ret != 0)
+    {
+        setError();
+        return NULL;
+    }
+    return fh;
+}
+
+void NfsClient::Close(void *fp)
+{
+    nfs_close(nfs, (struct nfsfh *)fp);
+}
@@ -0,0 +1,67 @@
+#ifndef NFSCLIENT_H
+#define NFSCLIENT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <nfsc/libnfs.h>
+#include "common.h"
+#include "remote_client.h"
+
+// NFSv3 through libnfs. Transfers keep [NFS] io_depth READ/WRITE RPCs of up
+// to rw_size_kb in flight on the one context, serviced with nfs_service();
+// listings come from READDIRPLUS, so they carry sizes and times without a
+// GETATTR per entry. Server URLs are nfs://server/export[?uid=..&gid=..];
+// paths are relative to the export.
+class NfsClient : public RemoteClient
+{
+public:
+    NfsClient();
+    ~NfsClient();
+    int Connect(const std::string &url, const std::string &user, const std::string &pass);
+    int Mkdir(const std::string &path);
+    int Rmdir(const std::string &path, bool recursive);
+    int Size(const std::string &path, int64_t *size);
+    int Get(const std::string &outputfile, const std::string &path, uint64_t offset = 0);
+    int GetKnownSize(const std::string &outputfile, const std::string &path, int64_t size, uint64_t offset = 0);
+    int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset);
+    int GetRanges(const std::string &path, std::vector<RemoteRange> &ranges);
+    int Put(const std::string &inputfile, const std::string &path, uint64_t offset = 0);
+    int PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source);
+    int Rename(const std::string &src, const std::string &dst);
+    int Delete(const std::string &path);
+    int Copy(const std::string &from, const std::string &to);
+    int Move(const std::string &from, const std::string &to);
+    bool FileExists(const std::string &path);
+    std::vector<DirEntry> ListDir(const std::string &path);
+    std::string GetPath(std::string path1, std::string path2);
+    int GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset);
+    void *Open(const std::string &path, int flags);
+    void Close(void *fp);
+    bool IsConnected();
+    bool Ping();
+    const char *LastResponse();
+    int Quit();
+    ClientType clientType();
+    uint32_t SupportedActions();
+
+private:
+    // Reads `size` bytes at `offset` of `fh` straight into `buffer`, split
+    // into pipelined READs. Returns false on a failed or short read.
+    bool readAt(struct nfsfh *fh, uint8_t *buffer, uint64_t size, uint64_t offset);
+    // Writes what `source` yields to `path`, created or truncated, as
+    // pipelined WRITEs followed by a COMMIT. With `offset` the file is kept
+    // and written from there on, for a resumed upload.
+    int writeFrom(const std::string &path, const RemoteSourceFn &source, uint64_t offset = 0);
+    int download(const std::string &outputfile, const std::string &path, int64_t size, uint64_t offset);
+    std::string exportPath(const std::string &path) const;
+    void setError();
+    struct nfs_context *nfs = nullptr;
+    char response[1024];
+    bool connected = false;
+    uint32_t read_size = 0;
+    uint32_t write_size = 0;
+};
+
+#endif
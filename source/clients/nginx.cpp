@@ -1,19 +1,57 @@
 #include <lexbor/html/parser.h>
 #include <lexbor/dom/interfaces/element.h>
+#include <algorithm>
 #include <fstream>
 #include <map>
 #include <vector>
 #include "common.h"
 #include "clients/remote_client.h"
 #include "clients/nginx.h"
+#include "clients/html_index.h"
+#include "host_caps.h"
 #include "lang.h"
 #include "util.h"
+#include "parse_profile.h"
+#include "listing_kernels.h"
 #include "windows.h"
 
-static std::map<std::string, int> months = {
-    {"Jan", 1}, {"Feb", 2}, {"Mar", 3}, {"Apr", 4}, {"May", 5}, {"Jun", 6},
-    {"Jul", 7}, {"Aug", 8}, {"Sep", 9}, {"Oct", 10}, {"Nov", 11}, {"Dec", 12}
-};
+// autoindex_format json: [{"name":"x", "type":"directory"|"file",
+// "mtime":"Wed, 14 Oct 2026 12:00:00 GMT", "size":123}], exact sizes.
+static int ParseJsonItem(json_object *item, const std::string &path, DirEntry &entry)
+{
+    std::string name = HtmlIndex::JsonString(item, "name");
+    std::string type = HtmlIndex::JsonString(item, "type");
+    if (name.empty() || name.compare("..") == 0)
+        return 0;
+
+    sprintf(entry.directory, "%s", path.c_str());
+    sprintf(entry.name, "%s", name.c_str());
+    if (path.length() > 0 && path[path.length() - 1] == '/')
+    {
+        sprintf(entry.path, "%s%s", path.c_str(), entry.name);
+    }
+    else
+    {
+        sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
+    }
+
+    entry.selectable = true;
+    if (type.compare("directory") == 0)
+    {
+        entry.isDir = true;
+        entry.file_size = 0;
+        sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+    }
+    else
+    {
+        entry.isDir = false;
+        entry.file_size = std::max<int64_t>(0, HtmlIndex::JsonInt(item, "size"));
+        DirEntry::SetDisplaySize(&entry);
+    }
+
+    ListingKernels::ParseHttpDate(HtmlIndex::JsonString(item, "mtime"), entry.modified);
+    return 1;
+}
 
 std::vector<DirEntry> NginxClient::ListDir(const std::string &path)
 {
@@ -25,10 +63,23 @@ std::vector<DirEntry> NginxClient::ListDir(const std::string &path)
     out.push_back(entry);
 
     std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
-    if (client->Get(encode_url, headers, res))
+    if (client->GetListing(encode_url, headers, res))
     {
         if (HTTP_SUCCESS(res.iCode))
         {
+            // The server's autoindex_format decides; JSON is tried first
+            // since it carries exact sizes and seconds.
+            HtmlIndex::JsonListing json;
+            json.parse_item = [&path](json_object *item, DirEntry &entry)
+            {
+                return ParseJsonItem(item, path, entry);
+            };
+            bool is_json = HtmlIndex::ParseJson(res.strBody, json, out);
+            HostCaps::Learn(encode_url, &HostCaps::Caps::json_listing, is_json ? 1 : 0);
+            if (is_json)
+                goto finish;
+
+            ParseProfile profile("nginx", res.strBody.size(), out);
             lxb_status_t status;
             lxb_dom_attr_t *attr;
             lxb_dom_node_t *node;
@@ -129,7 +180,7 @@ std::vector<DirEntry> NginxClient::ListDir(const std::string &path)
                         if (adate.size() == 3)
                         {
                             entry.modified.day = atoi(adate[0].c_str());
-                            entry.modified.month = months.find(adate[1])->second;
+                            entry.modified.month = ListingKernels::Month(adate[1].c_str());
                             entry.modified.year = atoi(adate[2].c_str());
                         }
 
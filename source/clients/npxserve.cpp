@@ -6,105 +6,134 @@
 #include "clients/npxserve.h"
 #include "lang.h"
 #include "util.h"
+#include "clients/html_index.h"
 #include "windows.h"
 
-std::vector<DirEntry> NpxServeClient::ListDir(const std::string &path)
+// npx serve: every entry is an <a title="name/" class="folder ..."> link.
+static int ParseRow(lxb_dom_element_t *element, const std::string &path, DirEntry &entry)
 {
-    CHTTPClient::HeadersMap headers;
-    CHTTPClient::HttpResponse res;
-    std::vector<DirEntry> out;
-    DirEntry entry;
-    Util::SetupPreviousFolder(path, &entry);
-    out.push_back(entry);
+    lxb_dom_attr_t *attr;
+    std::string title, aclass;
 
-    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
-    if (client->Get(encoded_url, headers, res))
+    attr = lxb_dom_element_attr_by_name(element, (lxb_char_t *)"title", 5);
+    if (attr != nullptr)
+        title = std::string((char *)attr->value->data, attr->value->length);
+    attr = lxb_dom_element_attr_by_name(element, (lxb_char_t *)"class", 5);
+    if (attr != nullptr)
+        aclass = std::string((char *)attr->value->data, attr->value->length);
+
+    sprintf(entry.directory, "%s", path.c_str());
+    sprintf(entry.name, "%s", Util::Rtrim(title, "/").c_str());
+    if (path.length() > 0 && path[path.length() - 1] == '/')
+    {
+        sprintf(entry.path, "%s%s", path.c_str(), entry.name);
+    }
+    else
     {
-        if (HTTP_SUCCESS(res.iCode))
-        {
-            lxb_status_t status;
-            lxb_dom_attr_t *attr;
-            lxb_dom_element_t *element;
-            lxb_html_document_t *document;
-            lxb_dom_collection_t *collection;
-            document = lxb_html_document_create();
-            status = lxb_html_document_parse(document, (lxb_char_t *)res.strBody.data(), res.strBody.size());
-            if (status != LXB_STATUS_OK)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
-            collection = lxb_dom_collection_make(&document->dom_document, 128);
-            if (collection == NULL)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
-            status = lxb_dom_elements_by_tag_name(lxb_dom_interface_element(document->body),
-                                                collection, (const lxb_char_t *)"a", 1);
-            if (status != LXB_STATUS_OK)
-            {
-                lxb_dom_collection_destroy(collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+        sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
+    }
 
-            for (size_t i = 0; i < lxb_dom_collection_length(collection); i++)
-            {
-                DirEntry entry;
-                std::string title, aclass;
-                memset(&entry.modified, 0, sizeof(DateTime));
-                element = lxb_dom_collection_element(collection, i);
-                attr = lxb_dom_element_attr_by_name(element, (lxb_char_t *)"title", 5);
-                if (attr != nullptr)
-                    title = std::string((char *)attr->value->data, attr->value->length);
-                attr = lxb_dom_element_attr_by_name(element, (lxb_char_t *)"class", 5);
-                if (attr != nullptr)
-                    aclass = std::string((char *)attr->value->data, attr->value->length);
+    sprintf(entry.display_date, "%s", "--");
+    size_t space_pos = aclass.find(" ");
+    std::string ent_type = aclass.substr(0, space_pos);
 
-                sprintf(entry.directory, "%s", path.c_str());
-                sprintf(entry.name, "%s", Util::Rtrim(title, "/").c_str());
-                if (path.length() > 0 && path[path.length() - 1] == '/')
-                {
-                    sprintf(entry.path, "%s%s", path.c_str(), entry.name);
-                }
-                else
-                {
-                    sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
-                }
+    if (ent_type.compare("folder") == 0)
+    {
+        sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+        entry.isDir = true;
+        entry.selectable = true;
+    }
+    else if (ent_type.compare("file") == 0)
+    {
+        sprintf(entry.display_size, "%s", "???B");
+        entry.isDir = false;
+        entry.selectable = true;
+        entry.file_size = 0;
+    }
+    else
+        return 0;
 
-                sprintf(entry.display_date, "%s", "--");
-                size_t space_pos = aclass.find(" ");
-                std::string ent_type = aclass.substr(0, space_pos);
+    return 1;
+}
 
-                if (ent_type.compare("folder") == 0)
-                {
-                    sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
-                    entry.isDir = true;
-                    entry.selectable = true;
-                }
-                else if (ent_type.compare("file") == 0)
-                {
-                    sprintf(entry.display_size, "%s", "???B");
-                    entry.isDir = false;
-                    entry.selectable = true;
-                    entry.file_size = 0;
-                }
-                else
-                    continue;
+// With Accept: application/json: {"files":[{"base":"name/", "type":"folder"},
+// {"base":"name", "type":"file", "size":"12 KB"}, ...]}. Sizes are rounded
+// to whole units, still better than none in the HTML page.
+static int ParseJsonItem(json_object *item, const std::string &path, DirEntry &entry)
+{
+    std::string base = HtmlIndex::JsonString(item, "base");
+    base = Util::Rtrim(base, "/");
+    std::string type = HtmlIndex::JsonString(item, "type");
+    if (base.empty() || base.compare("..") == 0)
+        return 0;
 
-                out.push_back(entry);
-            }
-            lxb_dom_collection_destroy(collection, true);
-            lxb_html_document_destroy(document);
-        }
+    sprintf(entry.directory, "%s", path.c_str());
+    sprintf(entry.name, "%s", base.c_str());
+    if (path.length() > 0 && path[path.length() - 1] == '/')
+    {
+        sprintf(entry.path, "%s%s", path.c_str(), entry.name);
     }
     else
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
-        return out;
+        sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
+    }
+
+    sprintf(entry.display_date, "%s", "--");
+    entry.selectable = true;
+    if (type.compare("folder") == 0 || type.compare("directory") == 0)
+    {
+        sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+        entry.isDir = true;
+        return 1;
+    }
+
+    entry.isDir = false;
+    std::string size = HtmlIndex::JsonString(item, "size");
+    if (size.empty())
+    {
+        sprintf(entry.display_size, "%s", "???B");
+        return 1;
     }
+    sprintf(entry.display_size, "%s", size.c_str());
+    double value = atof(size.c_str());
+    const char *units = "KMGTP";
+    size_t unit = size.find_last_of(units);
+    const char *found = unit != std::string::npos ? strchr(units, size[unit]) : nullptr;
+    for (int i = found != nullptr ? (int)(found - units) + 1 : 0; i > 0; i--)
+        value *= 1024;
+    entry.file_size = (int64_t)value;
+    return 1;
+}
 
-finish:
+std::vector<DirEntry> NpxServeClient::ListDir(const std::string &path)
+{
+    std::vector<DirEntry> out;
+    ListDirStreamed(path, [&out](const std::vector<DirEntry> &batch)
+                    {
+                        out.insert(out.end(), batch.begin(), batch.end());
+                        return true;
+                    });
     return out;
-}
\ No newline at end of file
+}
+
+int NpxServeClient::ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch)
+{
+    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    std::string error;
+    HtmlIndex::JsonListing json;
+    json.accept = "application/json";
+    json.items_key = "files";
+    json.parse_item = [&path](json_object *item, DirEntry &entry)
+    {
+        return ParseJsonItem(item, path, entry);
+    };
+    int ret = HtmlIndex::ListDirStreamed(client, encoded_url, path, "npxserve", "a",
+                                         [&path](lxb_dom_element_t *row, size_t index, DirEntry &entry)
+                                         {
+                                             return ParseRow(row, path, entry);
+                                         },
+                                         json, on_batch, error);
+    if (ret == 0)
+        sprintf(this->response, "%s", error.c_str());
+    return ret;
+}
@@ -11,6 +11,8 @@ class NpxServeClient : public BaseClient
 {
 public:
     std::vector<DirEntry> ListDir(const std::string &path);
+    // Rows are handed on as the index page downloads.
+    int ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch) override;
 };
 
 #endif
\ No newline at end of file
@@ -1,214 +1,195 @@
 #include <lexbor/html/parser.h>
 #include <lexbor/dom/interfaces/element.h>
+#include <algorithm>
 #include <fstream>
 #include "common.h"
 #include "clients/remote_client.h"
 #include "clients/rclone.h"
 #include "lang.h"
 #include "util.h"
+#include "clients/html_index.h"
 #include "windows.h"
+#include "listing_kernels.h"
 
-std::vector<DirEntry> RCloneClient::ListDir(const std::string &path)
+// rclone serve http: <tr><td></td><td><svg><use xlink:href="#folder"/></svg>
+// <a href="name/">..</a></td><td><span>size</span></td><td><time datetime=".."></td></tr>
+static int ParseRow(lxb_dom_element_t *tr_element, const std::string &path, DirEntry &entry)
 {
-    CHTTPClient::HeadersMap headers;
-    CHTTPClient::HttpResponse res;
-    std::vector<DirEntry> out;
-    DirEntry entry;
-    Util::SetupPreviousFolder(path, &entry);
-    out.push_back(entry);
-
-    std::string encoded_path = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path)+"/");
-    if (client->Get(encoded_path, headers, res))
+    const lxb_char_t *value;
+    size_t value_len;
+    std::string tmp_string;
+
+    std::vector<lxb_dom_element_t *> td = HtmlIndex::Children(tr_element, "td");
+    if (td.size() < 4)
+        return -1;
+
+    // td 0 is empty, td 1 is file or folder
+    lxb_dom_element_t *td_element = td[1];
+    lxb_dom_node_t *use_node = Util::NextChildElement(lxb_dom_interface_element(Util::NextChildElement(td_element)));
+    if (use_node == nullptr)
+        return -1;
+    value = lxb_dom_element_local_name(lxb_dom_interface_element(use_node), &value_len);
+    tmp_string = std::string((const char *)value, value_len);
+    if (tmp_string.compare("use") != 0)
+        return -1;
+    value = lxb_dom_element_get_attribute(lxb_dom_interface_element(use_node), (const lxb_char_t *)"xlink:href", 10, &value_len);
+    tmp_string = value ? std::string((const char *)value, value_len) : "";
+    if (tmp_string.compare("#folder") == 0)
     {
-        if (HTTP_SUCCESS(res.iCode))
-        {
-            lxb_status_t status;
-            lxb_dom_attr_t *attr;
-            lxb_dom_element_t *tbody_element, *tr_element, *td_element;
-            lxb_html_document_t *document;
-            lxb_dom_collection_t *tbody_collection;
-            lxb_dom_collection_t *tr_collection;
-            lxb_dom_collection_t *td_collection;
+        entry.isDir = true;
+        entry.selectable = true;
+        entry.file_size = 0;
+        sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+    }
+    else
+    {
+        entry.isDir = false;
+        entry.selectable = true;
+    }
 
-            document = lxb_html_document_create();
-            status = lxb_html_document_parse(document, (lxb_char_t *)res.strBody.data(), res.strBody.size());
-            if (status != LXB_STATUS_OK)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+    // <a> element contains the file/folder name
+    lxb_dom_node_t *a_node = Util::NextChildElement(lxb_dom_interface_element(Util::NextElement(Util::NextChildElement(td_element))));
+    if (a_node == nullptr)
+        return -1;
+    value = lxb_dom_element_get_attribute(lxb_dom_interface_element(a_node), (const lxb_char_t *)"href", 4, &value_len);
+    tmp_string = value ? std::string((const char *)value, value_len) : "";
+    if (tmp_string.empty())
+        return 0;
+    if (tmp_string[tmp_string.length()-1] == '/')
+        tmp_string = tmp_string.substr(0, tmp_string.length()-1);
+    tmp_string = BaseClient::UnEscape(tmp_string);
+    sprintf(entry.name, "%s", tmp_string.c_str());
+    sprintf(entry.directory, "%s", path.c_str());
+    if (path.length() > 0 && path[path.length() - 1] == '/')
+    {
+        sprintf(entry.path, "%s%s", path.c_str(), entry.name);
+    }
+    else
+    {
+        sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
+    }
 
-            tbody_collection = lxb_dom_collection_make(&document->dom_document, 1);
-            if (tbody_collection == NULL)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+    // td 3 - filesize
+    if (!entry.isDir)
+    {
+        lxb_dom_node_t *size_node = Util::NextChildElement(td[2]);
+        if (size_node != nullptr && size_node->first_child != nullptr)
+        {
+            value = lxb_dom_node_text_content(size_node->first_child, &value_len);
+            tmp_string = std::string((const char *)value, value_len);
+            entry.file_size = atol(tmp_string.c_str());
+        }
+        DirEntry::SetDisplaySize(&entry);
+    }
 
-            tr_collection = lxb_dom_collection_make(&document->dom_document, 128);
-            if (tbody_collection == NULL)
-            {
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+    // td 4 - datetime
+    lxb_dom_node_t *date_node = Util::NextChildElement(td[3]);
+    if (date_node == nullptr)
+        return 1;
+    value = lxb_dom_element_get_attribute(lxb_dom_interface_element(date_node), (const lxb_char_t *)"datetime", 8, &value_len);
+    tmp_string = value ? std::string((const char *)value, value_len) : "";
+    std::vector<std::string> date_time = Util::Split(tmp_string, " ");
 
-            status = lxb_dom_elements_by_tag_name(lxb_dom_interface_element(document->body),
-                                                tbody_collection, (const lxb_char_t *)"tbody", 5);
-            if (status != LXB_STATUS_OK)
-            {
-                lxb_dom_collection_destroy(tr_collection, true);
-                lxb_dom_collection_destroy(tbody_collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+    if (date_time.size() > 1)
+    {
+        std::vector<std::string> adate = Util::Split(date_time[0], "-");
+        if (adate.size() == 3)
+        {
+            entry.modified.year = atoi(adate[0].c_str());
+            entry.modified.month = atoi(adate[1].c_str());
+            entry.modified.day = atoi(adate[2].c_str());
+        }
 
-            if (lxb_dom_collection_length(tbody_collection) < 1)
-            {
-                lxb_dom_collection_destroy(tr_collection, true);
-                lxb_dom_collection_destroy(tbody_collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
-            }
+        std::vector<std::string> atime = Util::Split(date_time[1], ":");
+        if (atime.size() == 3)
+        {
+            entry.modified.hours = atoi(atime[0].c_str());
+            entry.modified.minutes = atoi(atime[1].c_str());
 
-            // Get the first tbody which should only be 1
-            tbody_element = lxb_dom_collection_element(tbody_collection, 0);
-            status = lxb_dom_elements_by_tag_name(tbody_element,
-                                                tr_collection, (const lxb_char_t *)"tr", 2);
-            if (status != LXB_STATUS_OK)
+            std::vector<std::string> sec_msec = Util::Split(atime[2], ".");
+            if (sec_msec.size() > 0)
             {
-                lxb_dom_collection_destroy(tr_collection, true);
-                lxb_dom_collection_destroy(tbody_collection, true);
-                lxb_html_document_destroy(document);
-                goto finish;
+                entry.modified.seconds = atoi(sec_msec[0].c_str());
             }
+        }
+    }
 
-            // skip row 0 , since it has the previous folder header
-            for (size_t i = 1; i < lxb_dom_collection_length(tr_collection); i++)
-            {
-                DirEntry entry;
-                std::string title, aclass;
-                memset(&entry.modified, 0, sizeof(DateTime));
-                const lxb_char_t *value;
-                size_t value_len;
-                std::string tmp_string;
-
-                tr_element = lxb_dom_collection_element(tr_collection, i);
-
-                td_collection = lxb_dom_collection_make(&document->dom_document, 5);
-                status = lxb_dom_elements_by_tag_name(tr_element,
-                                                    td_collection, (const lxb_char_t *)"td", 2);
-                if (status != LXB_STATUS_OK || lxb_dom_collection_length(td_collection) < 0)
-                {
-                    lxb_dom_collection_destroy(td_collection, true);
-                    lxb_dom_collection_destroy(tr_collection, true);
-                    lxb_dom_collection_destroy(tbody_collection, true);
-                    lxb_html_document_destroy(document);
-                    goto finish;
-                }
-
-                // td 0 is empty, td 1 is file or folder
-                td_element = lxb_dom_collection_element(td_collection, 1);
-                lxb_dom_node_t *use_node = Util::NextChildElement(lxb_dom_interface_element(Util::NextChildElement(td_element)));
-                value = lxb_dom_element_local_name(lxb_dom_interface_element(use_node), &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string.compare("use") != 0)
-                {
-                    lxb_dom_collection_destroy(td_collection, true);
-                    lxb_dom_collection_destroy(tr_collection, true);
-                    lxb_dom_collection_destroy(tbody_collection, true);
-                    lxb_html_document_destroy(document);
-                    goto finish;
-                }
-                value = lxb_dom_element_get_attribute(lxb_dom_interface_element(use_node), (const lxb_char_t *)"xlink:href", 10, &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string.compare("#folder") == 0)
-                {
-                    entry.isDir = true;
-                    entry.selectable = true;
-                    entry.file_size = 0;
-                    sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);                
-                }
-                else
-                {
-                    entry.isDir = false;
-                    entry.selectable = true;
-                }
-
-                // <a> element contains the file/folder name
-                lxb_dom_node_t *a_node = Util::NextChildElement(lxb_dom_interface_element(Util::NextElement(Util::NextChildElement(td_element))));
-                value = lxb_dom_element_get_attribute(lxb_dom_interface_element(a_node), (const lxb_char_t *)"href", 4, &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                if (tmp_string[tmp_string.length()-1] == '/')
-                    tmp_string = tmp_string.substr(0, tmp_string.length()-1);
-                tmp_string = BaseClient::UnEscape(tmp_string);
-                sprintf(entry.name, "%s", tmp_string.c_str());
-                sprintf(entry.directory, "%s", path.c_str());
-                if (path.length() > 0 && path[path.length() - 1] == '/')
-                {
-                    sprintf(entry.path, "%s%s", path.c_str(), entry.name);
-                }
-                else
-                {
-                    sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
-                }
-
-                // td 3 - filesize
-                if (!entry.isDir)
-                {
-                    td_element = lxb_dom_collection_element(td_collection, 2);
-                    lxb_dom_node_t *size_node = Util::NextChildElement(td_element);
-                    value = lxb_dom_node_text_content(size_node->first_child, &value_len);
-                    tmp_string = std::string((const char *)value, value_len);
-                    entry.file_size = atol(tmp_string.c_str());
-                    DirEntry::SetDisplaySize(&entry);
-                }
-
-                // td 4 - datetime
-                td_element = lxb_dom_collection_element(td_collection, 3);
-                lxb_dom_node_t *date_node = Util::NextChildElement(td_element);
-                value = lxb_dom_element_get_attribute(lxb_dom_interface_element(date_node), (const lxb_char_t *)"datetime", 8, &value_len);
-                tmp_string = std::string((const char *)value, value_len);
-                std::vector<std::string> date_time = Util::Split(tmp_string, " ");
-
-                if (date_time.size() > 1)
-                {
-                    std::vector<std::string> adate = Util::Split(date_time[0], "-");
-                    if (adate.size() == 3)
-                    {
-                        entry.modified.year = atoi(adate[0].c_str());
-                        entry.modified.month = atoi(adate[1].c_str());
-                        entry.modified.day = atoi(adate[2].c_str());
-                    }
-
-                    std::vector<std::string> atime = Util::Split(date_time[1], ":");
-                    if (atime.size() == 3)
-                    {
-                        entry.modified.hours = atoi(atime[0].c_str());
-                        entry.modified.minutes = atoi(atime[1].c_str());
-
-                        std::vector<std::string> sec_msec = Util::Split(atime[2], ".");
-                        if (sec_msec.size() > 0)
-                        {
-                            entry.modified.seconds = atoi(sec_msec[0].c_str());
-                        }
-                    }
-                }
+    return 1;
+}
 
-                lxb_dom_collection_destroy(td_collection, true);
-                out.push_back(entry);
-            }
+// The same directory as JSON: {"Entries":[{"Leaf":"name", "IsDir":false,
+// "Size":123, "ModTime":"2026-10-14T12:00:00.123Z"}, ...]}.
+static int ParseJsonItem(json_object *item, const std::string &path, DirEntry &entry)
+{
+    std::string leaf = HtmlIndex::JsonString(item, "Leaf");
+    if (leaf.empty())
+        return 0;
+    leaf = Util::Rtrim(leaf, "/");
+    sprintf(entry.name, "%s", leaf.c_str());
+    sprintf(entry.directory, "%s", path.c_str());
+    if (path.length() > 0 && path[path.length() - 1] == '/')
+    {
+        sprintf(entry.path, "%s%s", path.c_str(), entry.name);
+    }
+    else
+    {
+        sprintf(entry.path, "%s/%s", path.c_str(), entry.name);
+    }
 
-            lxb_dom_collection_destroy(tr_collection, true);
-            lxb_dom_collection_destroy(tbody_collection, true);
-            lxb_html_document_destroy(document);
-        }
+    json_object *is_dir = nullptr;
+    entry.selectable = true;
+    entry.isDir = json_object_object_get_ex(item, "IsDir", &is_dir) && json_object_get_boolean(is_dir);
+    if (entry.isDir)
+    {
+        entry.file_size = 0;
+        sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
     }
     else
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
-        return out;
+        entry.file_size = std::max<int64_t>(0, HtmlIndex::JsonInt(item, "Size"));
+        DirEntry::SetDisplaySize(&entry);
     }
 
-finish:
+    ListingKernels::ParseIsoDate(HtmlIndex::JsonString(item, "ModTime"), entry.modified);
+    return 1;
+}
+
+std::vector<DirEntry> RCloneClient::ListDir(const std::string &path)
+{
+    std::vector<DirEntry> out;
+    ListDirStreamed(path, [&out](const std::vector<DirEntry> &batch)
+                    {
+                        out.insert(out.end(), batch.begin(), batch.end());
+                        return true;
+                    });
     return out;
-}
\ No newline at end of file
+}
+
+int RCloneClient::ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch)
+{
+    std::string encoded_path = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path)+"/");
+    std::string error;
+    size_t body_rows = 0;
+    HtmlIndex::JsonListing json;
+    json.accept = "application/json, text/html;q=0.5";
+    json.items_key = "Entries";
+    json.parse_item = [&path](json_object *item, DirEntry &entry)
+    {
+        return ParseJsonItem(item, path, entry);
+    };
+    int ret = HtmlIndex::ListDirStreamed(client, encoded_path, path, "rclone", "tr",
+                                         [&](lxb_dom_element_t *row, size_t index, DirEntry &entry)
+                                         {
+                                             // Only the listing's tbody counts, and its first
+                                             // row is the previous folder.
+                                             if (HtmlIndex::Ancestor(row, "tbody") == nullptr)
+                                                 return 0;
+                                             if (body_rows++ == 0)
+                                                 return 0;
+                                             return ParseRow(row, path, entry);
+                                         },
+                                         json, on_batch, error);
+    if (ret == 0)
+        sprintf(this->response, "%s", error.c_str());
+    return ret;
+}
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cstring>
+#include "clients/rclone_rc.h"
+#include "config.h"
+#include "lang.h"
+#include "logger.h"
+#include "util.h"
+#include "listing_kernels.h"
+
+namespace
+{
+    // Strongest first, as Checksum::FromHeaders picks them.
+    const struct
+    {
+        const char *name;
+        FileDigest::Algo algo;
+    } kHashes[] = {
+        {"sha256", FileDigest::SHA256},
+        {"sha1", FileDigest::SHA1},
+        {"md5", FileDigest::MD5},
+        {"crc32", FileDigest::CRC32},
+    };
+
+    // Digests kept from listings before they are dropped wholesale.
+    const size_t kMaxDigests = 65536;
+
+    std::string JsonString(json_object *parent, const char *key)
+    {
+        json_object *value = nullptr;
+        if (!json_object_object_get_ex(parent, key, &value) || json_object_get_type(value) != json_type_string)
+            return "";
+        return json_object_get_string(value);
+    }
+
+    // "2026-10-14T12:34:56.123456789+02:00", as the server has it.
+    void ParseModTime(const std::string &date_time, DateTime &out)
+    {
+        ListingKernels::ParseIsoDate(date_time, out);
+    }
+
+    json_object *Params(std::initializer_list<std::pair<const char *, std::string>> members)
+    {
+        json_object *params = json_object_new_object();
+        for (const auto &member : members)
+            json_object_object_add(params, member.first, json_object_new_string(member.second.c_str()));
+        return params;
+    }
+}
+
+RcloneRc::RcloneRc(const std::string &url, const std::string &fs, const std::string &user, const std::string &pass)
+    : url(url), fs(fs)
+{
+    Util::Rtrim(this->url, "/");
+    http = new CHTTPClient([](const std::string &log) {});
+    // --rc-user/--rc-pass are usually the site's own; an rc without auth
+    // ignores them.
+    http->SetBasicAuth(user, pass);
+    http->InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
+    http->SetCertificateFile(CACERT_FILE);
+}
+
+RcloneRc::~RcloneRc()
+{
+    http->CleanupSession();
+    delete http;
+}
+
+bool RcloneRc::call(const char *method, json_object *params, json_object **reply)
+{
+    std::string request = json_object_to_json_string_ext(params, JSON_C_TO_STRING_PLAIN);
+    json_object_put(params);
+
+    CHTTPClient::HeadersMap headers;
+    headers["Content-Type"] = "application/json";
+    headers["Accept"] = "application/json";
+    std::string body;
+    CHTTPClient::HttpResponse res;
+    uint64_t started = Util::GetTick();
+    bool ok = http->CustomRequestToSink("POST", url + "/" + method, headers,
+                                        [&body](const char *data, size_t len)
+                                        {
+                                            body.append(data, len);
+                                            return true;
+                                        },
+                                        res, &request);
+    if (!ok && res.strBody.empty())
+    {
+        error = res.errMessage;
+        Logger::Logf(Logger::LOG_ERROR, "RCLONE RC %s failed err=%s", method, error.c_str());
+        return false;
+    }
+    if (!HTTP_SUCCESS(res.iCode))
+    {
+        // Errors come back as {"error": "...", "status": 500}.
+        json_object *answer = json_tokener_parse(res.strBody.c_str());
+        error = answer != nullptr ? JsonString(answer, "error") : "";
+        if (error.empty())
+            error = "rc " + std::string(method) + " HTTP " + std::to_string(res.iCode);
+        if (answer != nullptr)
+            json_object_put(answer);
+        Logger::Logf(Logger::LOG_ERROR, "RCLONE RC %s code=%ld err=%s", method, res.iCode, error.c_str());
+        return false;
+    }
+
+    Logger::Logf("RCLONE RC %s bytes=%zu ms=%llu", method, body.size(),
+                 (unsigned long long)((Util::GetTick() - started) / 1000));
+    if (reply == nullptr)
+        return true;
+    *reply = json_tokener_parse(body.c_str());
+    if (*reply == nullptr)
+    {
+        error = "rc " + std::string(method) + ": invalid JSON";
+        return false;
+    }
+    return true;
+}
+
+std::string RcloneRc::remote(const std::string &path)
+{
+    std::string out = path;
+    Util::Trim(out, "/");
+    return out;
+}
+
+std::string RcloneRc::fsAt(const std::string &path) const
+{
+    std::string rel = remote(path);
+    if (rel.empty())
+        return fs;
+    if (fs.empty() || fs.back() == ':' || fs.back() == '/')
+        return fs + rel;
+    return fs + "/" + rel;
+}
+
+json_object *RcloneRc::fsParams(const std::string &path) const
+{
+    return Params({{"fs", fs}, {"remote", remote(path)}});
+}
+
+bool RcloneRc::pickHash()
+{
+    if (hash_known)
+        return !hash_name.empty();
+    json_object *reply = nullptr;
+    if (!call("operations/fsinfo", Params({{"fs", fs}}), &reply))
+        return false;
+    hash_known = true;
+    json_object *hashes = nullptr;
+    if (json_object_object_get_ex(reply, "Hashes", &hashes) && json_object_get_type(hashes) == json_type_array)
+    {
+        size_t count = json_object_array_length(hashes);
+        for (const auto &hash : kHashes)
+        {
+            for (size_t i = 0; i < count && hash_name.empty(); i++)
+            {
+                json_object *name = json_object_array_get_idx(hashes, i);
+                if (json_object_get_type(name) == json_type_string && strcmp(json_object_get_string(name), hash.name) == 0)
+                {
+                    hash_name = hash.name;
+                    hash_algo = hash.algo;
+                }
+            }
+            if (!hash_name.empty())
+                break;
+        }
+    }
+    json_object_put(reply);
+    Logger::Logf("RCLONE RC fs=%s hash=%s", fs.c_str(), hash_name.empty() ? "none" : hash_name.c_str());
+    return !hash_name.empty();
+}
+
+bool RcloneRc::List(const std::string &path, bool recurse, bool hashes, std::vector<DirEntry> &out)
+{
+    hashes = hashes && pickHash();
+    std::string dir = remote(path);
+
+    json_object *params = fsParams(path);
+    json_object *opt = json_object_new_object();
+    json_object_object_add(opt, "recurse", json_object_new_boolean(recurse));
+    json_object_object_add(opt, "noMimeType", json_object_new_boolean(true));
+    if (hashes)
+    {
+        json_object *types = json_object_new_array();
+        json_object_array_add(types, json_object_new_string(hash_name.c_str()));
+        json_object_object_add(opt, "showHash", json_object_new_boolean(true));
+        json_object_object_add(opt, "hashTypes", types);
+    }
+    json_object_object_add(params, "opt", opt);
+
+    json_object *reply = nullptr;
+    if (!call("operations/list", params, &reply))
+        return false;
+    json_object *list = nullptr;
+    if (!json_object_object_get_ex(reply, "list", &list) || json_object_get_type(list) != json_type_array)
+    {
+        json_object_put(reply);
+        error = "rc operations/list: no list";
+        return false;
+    }
+
+    std::string base = path;
+    Util::Rtrim(base, "/");
+    if (hashes && digests.size() > kMaxDigests)
+        digests.clear();
+
+    size_t count = json_object_array_length(list);
+    out.reserve(out.size() + count);
+    for (size_t i = 0; i < count; i++)
+    {
+        json_object *item = json_object_array_get_idx(list, i);
+        std::string rel = JsonString(item, "Path");
+        // Path counts from the fs root; the listed folder is cut off.
+        if (!dir.empty() && rel.compare(0, dir.size() + 1, dir + "/") == 0)
+            rel = rel.substr(dir.size() + 1);
+        if (rel.empty())
+            continue;
+
+        size_t slash = rel.find_last_of('/');
+        std::string parent = slash == std::string::npos ? base : base + "/" + rel.substr(0, slash);
+        std::string name = slash == std::string::npos ? rel : rel.substr(slash + 1);
+        if (parent.empty())
+            parent = "/";
+
+        DirEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.selectable = true;
+        snprintf(entry.directory, sizeof(entry.directory), "%s", parent.c_str());
+        snprintf(entry.name, sizeof(entry.name), "%s", name.c_str());
+        snprintf(entry.path, sizeof(entry.path), "%s%s%s", parent.c_str(), parent == "/" ? "" : "/", name.c_str());
+
+        json_object *value = nullptr;
+        entry.isDir = json_object_object_get_ex(item, "IsDir", &value) && json_object_get_boolean(value);
+        if (entry.isDir)
+            sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
+        else
+        {
+            if (json_object_object_get_ex(item, "Size", &value))
+                entry.file_size = std::max<int64_t>(0, json_object_get_int64(value));
+            DirEntry::SetDisplaySize(&entry);
+        }
+        ParseModTime(JsonString(item, "ModTime"), entry.modified);
+
+        json_object *sums = nullptr;
+        if (hashes && !entry.isDir && json_object_object_get_ex(item, "Hashes", &sums))
+        {
+            FileDigest digest = Checksum::FromHex(hash_algo, JsonString(sums, hash_name.c_str()));
+            if (digest.Valid())
+                digests[entry.path] = digest;
+        }
+        out.push_back(entry);
+    }
+    json_object_put(reply);
+    return true;
+}
+
+bool RcloneRc::Size(const std::string &path, int64_t *bytes, int64_t *count)
+{
+    json_object *reply = nullptr;
+    if (!call("operations/size", Params({{"fs", fsAt(path)}}), &reply))
+        return false;
+    json_object *value = nullptr;
+    bool ok = json_object_object_get_ex(reply, "bytes", &value);
+    if (ok)
+        *bytes = json_object_get_int64(value);
+    if (count != nullptr && json_object_object_get_ex(reply, "count", &value))
+        *count = json_object_get_int64(value);
+    json_object_put(reply);
+    return ok;
+}
+
+FileDigest RcloneRc::Digest(const std::string &path)
+{
+    auto cached = digests.find(path);
+    if (cached != digests.end())
+        return cached->second;
+    if (!pickHash())
+        return FileDigest();
+
+    json_object *params = fsParams(path);
+    json_object *opt = json_object_new_object();
+    json_object *types = json_object_new_array();
+    json_object_array_add(types, json_object_new_string(hash_name.c_str()));
+    json_object_object_add(opt, "showHash", json_object_new_boolean(true));
+    json_object_object_add(opt, "hashTypes", types);
+    json_object_object_add(params, "opt", opt);
+
+    json_object *reply = nullptr;
+    if (!call("operations/stat", params, &reply))
+        return FileDigest();
+    FileDigest digest;
+    json_object *item = nullptr, *sums = nullptr;
+    if (json_object_object_get_ex(reply, "item", &item) && json_object_get_type(item) == json_type_object &&
+        json_object_object_get_ex(item, "Hashes", &sums))
+        digest = Checksum::FromHex(hash_algo, JsonString(sums, hash_name.c_str()));
+    json_object_put(reply);
+    return digest;
+}
+
+bool RcloneRc::transfer(const char *method, const std::string &from, const std::string &to)
+{
+    json_object *params = Params({{"srcFs", fs}, {"srcRemote", remote(from)}, {"dstFs", fs}, {"dstRemote", remote(to)}});
+    return call(method, params);
+}
+
+bool RcloneRc::CopyFile(const std::string &from, const std::string &to)
+{
+    return transfer("operations/copyfile", from, to);
+}
+
+bool RcloneRc::MoveFile(const std::string &from, const std::string &to)
+{
+    bool ok = transfer("operations/movefile", from, to);
+    if (ok)
+        digests.erase(from);
+    return ok;
+}
+
+bool RcloneRc::CopyDir(const std::string &from, const std::string &to)
+{
+    json_object *params = Params({{"srcFs", fsAt(from)}, {"dstFs", fsAt(to)}});
+    json_object_object_add(params, "createEmptySrcDirs", json_object_new_boolean(true));
+    return call("sync/copy", params);
+}
+
+bool RcloneRc::DeleteFile(const std::string &path)
+{
+    digests.erase(path);
+    return call("operations/deletefile", fsParams(path));
+}
+
+bool RcloneRc::Mkdir(const std::string &path)
+{
+    return call("operations/mkdir", fsParams(path));
+}
+
+bool RcloneRc::Rmdir(const std::string &path, bool recursive)
+{
+    return call(recursive ? "operations/purge" : "operations/rmdir", fsParams(path));
+}
@@ -0,0 +1,71 @@
+#ifndef NEO_RCLONE_RC_H
+#define NEO_RCLONE_RC_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <json-c/json.h>
+#include "httpclient/HTTPClient.h"
+#include "checksum.h"
+#include "common.h"
+
+// rclone's remote control API, for a site served by rclone (serve webdav
+// or serve http started with --rc, or rclone rcd). Every call is one JSON
+// POST to <rc>/<method> naming `fs`, the rclone fs the site's root is
+// (e.g. "gdrive:media"), and a path below it. A whole tree comes back from
+// one operations/list with sizes, times and hashes, and copies and moves
+// run inside rclone, without the data passing through the Switch. Paths
+// are the site's own, "/" being the served root.
+class RcloneRc
+{
+public:
+    RcloneRc(const std::string &url, const std::string &fs, const std::string &user, const std::string &pass);
+    ~RcloneRc();
+
+    // operations/list of folder `path`, everything below it with
+    // `recurse`, into `out` as DirEntry rows without "..". With `hashes`
+    // the files' strongest hash is asked for too and kept for Digest().
+    bool List(const std::string &path, bool recurse, bool hashes, std::vector<DirEntry> &out);
+    // operations/size: bytes and file count of the folder `path`.
+    bool Size(const std::string &path, int64_t *bytes, int64_t *count);
+    // Hash of the file `path`, from the last listing with hashes or one
+    // operations/stat; NONE when the fs keeps none we can check.
+    FileDigest Digest(const std::string &path);
+
+    bool CopyFile(const std::string &from, const std::string &to);
+    bool MoveFile(const std::string &from, const std::string &to);
+    // sync/copy of the folder `from` into `to`, empty folders included.
+    bool CopyDir(const std::string &from, const std::string &to);
+    bool DeleteFile(const std::string &path);
+    bool Mkdir(const std::string &path);
+    // operations/purge of `recursive` folders, else operations/rmdir.
+    bool Rmdir(const std::string &path, bool recursive);
+
+    const std::string &Error() const { return error; }
+
+private:
+    std::string url;
+    std::string fs;
+    CHTTPClient *http;
+    std::string error;
+    // The hash listings ask for, from operations/fsinfo: "" none, unset
+    // before the first call.
+    bool hash_known = false;
+    std::string hash_name;
+    FileDigest::Algo hash_algo = FileDigest::NONE;
+    // Hashes seen in listings, by site path.
+    std::map<std::string, FileDigest> digests;
+
+    // POSTs `params` (consumed) to `method`; `reply` receives the parsed
+    // answer, to be released by the caller, when not nullptr.
+    bool call(const char *method, json_object *params, json_object **reply = nullptr);
+    // `path` relative to `fs`, without slashes at either end.
+    static std::string remote(const std::string &path);
+    // `fs` joined with `path`, for calls on a fs of their own.
+    std::string fsAt(const std::string &path) const;
+    json_object *fsParams(const std::string &path) const;
+    bool pickHash();
+    bool transfer(const char *method, const std::string &from, const std::string &to);
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <fcntl.h>
 #include "common.h"
 
 enum RemoteActions
@@ -35,6 +38,41 @@ enum ClientType
     CLINET_TYPE_UNKNOWN
 };
 
+// One range of a GetRanges() batch; `ok` is set by the call.
+struct RemoteRange
+{
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    void *buffer = nullptr;
+    bool ok = false;
+};
+
+// One rename of a MoveBatch(); `ok` is set by the call.
+struct RemoteMove
+{
+    std::string from;
+    std::string to;
+    bool ok = false;
+};
+
+// Receives the next bytes of a GetStream() body. Return false to stop.
+typedef std::function<bool(const char *data, size_t size)> RemoteStreamFn;
+
+// Fills `buffer` with up to `size` bytes of a PutStream() body. Returns the
+// count, 0 at the end of the body or -1 to abort the upload.
+typedef std::function<int64_t(char *buffer, size_t size)> RemoteSourceFn;
+
+// PutStream() size of a body whose length is only known at its end, such
+// as a zip being compressed as it goes out.
+#define REMOTE_SIZE_UNKNOWN UINT64_MAX
+
+// Receives a chunk of directory entries in arrival order. Return false to
+// stop the listing early.
+typedef std::function<bool(const std::vector<DirEntry> &batch)> DirEntryBatchFn;
+
+class RemoteReader;
+struct ReadHints;
+
 class RemoteClient
 {
 public:
@@ -45,14 +83,166 @@ public:
     virtual int Rmdir(const std::string &path, bool recursive) = 0;
     virtual int Size(const std::string &path, int64_t *size) = 0;
     virtual int Get(const std::string &outputfile, const std::string &path, uint64_t offset = 0) = 0;
+    // Get for callers that already know the remote size, e.g. from the
+    // directory listing, so the client can skip its own size probe.
+    // `size` <= 0 means unknown.
+    virtual int GetKnownSize(const std::string &outputfile, const std::string &path, int64_t size, uint64_t offset = 0)
+    {
+        return Get(outputfile, path, offset);
+    }
     virtual int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset) = 0;
+    // Reads every range of `path` into its buffer, concurrently where the
+    // protocol allows it. Returns 0 when any range failed.
+    virtual int GetRanges(const std::string &path, std::vector<RemoteRange> &ranges)
+    {
+        int ret = 1;
+        for (RemoteRange &range : ranges)
+        {
+            range.ok = GetRange(path, range.buffer, range.size, range.offset) > 0;
+            if (!range.ok)
+                ret = 0;
+        }
+        return ret;
+    }
+    // Downloads the first `bytes` of `path` into the file `scratch` the
+    // way Get() would, with `workers` requests or pipelined reads in
+    // flight of `chunk_kb` each, for SiteBench. Returns -1 when the
+    // protocol has no such knobs.
+    virtual int BenchRead(const std::string &path, uint64_t bytes, int workers, int chunk_kb,
+                          const std::string &scratch)
+    {
+        return -1;
+    }
+    // Streams `path` (`size` bytes) from the start to `on_data` in order,
+    // as one transfer where the protocol allows it. The default reads
+    // sequential ranges, through a raw handle on REMOTE_ACTION_RAW_READ
+    // clients. Returns 0 on failure or when `on_data` stopped it.
+    virtual int GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data)
+    {
+        const uint64_t block = 1024 * 1024;
+        std::vector<char> buffer(block);
+        void *fp = nullptr;
+        bool raw = (SupportedActions() & REMOTE_ACTION_RAW_READ) != 0;
+        if (raw && (fp = Open(path, O_RDONLY)) == nullptr)
+            return 0;
+
+        int ret = 1;
+        for (uint64_t offset = 0; offset < size; offset += block)
+        {
+            uint64_t len = size - offset < block ? size - offset : block;
+            int got = raw ? GetRange(fp, buffer.data(), len, offset) : GetRange(path, buffer.data(), len, offset);
+            if (got <= 0 || !on_data(buffer.data(), len))
+            {
+                ret = 0;
+                break;
+            }
+        }
+        if (raw)
+            Close(fp);
+        return ret;
+    }
+    // Streams the folder `path` with everything below it as one tar
+    // archive built by the server, with entry names relative to `path`.
+    // Returns -1 when the server builds none (nothing was delivered), so
+    // the caller fetches the files one by one instead, and 0 on failure.
+    virtual int GetFolderArchive(const std::string &path, const RemoteStreamFn &on_data)
+    {
+        return -1;
+    }
+    // Streams a small JPEG or PNG of the image `path` that the server
+    // renders or keeps itself, about `width` x `height`, for the thumbnail
+    // grid. Returns -1 when the site has none, so the caller reads the file
+    // instead, and 0 when there is none for this file or the request failed.
+    virtual int GetPreview(const std::string &path, int width, int height, const RemoteStreamFn &on_data)
+    {
+        return -1;
+    }
+    // `path` opened for reading (see remote_reader.h); nullptr when its
+    // size or a handle on it could not be had. A client may return a
+    // reader of its own that reads faster.
+    virtual std::unique_ptr<RemoteReader> OpenRead(const std::string &path, const ReadHints &hints);
     virtual int Put(const std::string &inputfile, const std::string &path, uint64_t offset = 0) = 0;
+    // Uploads `size` bytes pulled from `source` to `path`, for data that
+    // does not come from a local file (a transfer between two sites). With
+    // REMOTE_SIZE_UNKNOWN the body runs until `source` returns 0.
+    // Returns 0 on failure and -1 when the protocol cannot upload from a
+    // stream, so the caller can fall back to Put() of a temporary file.
+    virtual int PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source)
+    {
+        return -1;
+    }
     virtual int Rename(const std::string &src, const std::string &dst) = 0;
     virtual int Delete(const std::string &path) = 0;
+    // Copies a file on the server without the data passing through here.
+    // Returns 0 on failure and -1 when the server cannot copy by itself, so
+    // the caller can stream the file through a second session instead.
     virtual int Copy(const std::string &from, const std::string &to) = 0;
+    // Copies the folder `from` with everything below it to `to`, which must
+    // not exist yet, on the server in one go. Returns -1 when the server
+    // cannot, so the caller copies the files one by one, and 0 on failure.
+    virtual int CopyTree(const std::string &from, const std::string &to)
+    {
+        return -1;
+    }
     virtual int Move(const std::string &from, const std::string &to) = 0;
+    // Moves every entry of `moves` with requests in flight together on
+    // this connection. Returns -1 when the protocol cannot, so the caller
+    // spreads Move() calls over several connections instead, and 0 when
+    // any move failed.
+    virtual int MoveBatch(std::vector<RemoteMove> &moves)
+    {
+        return -1;
+    }
     virtual bool FileExists(const std::string &path) = 0;
     virtual std::vector<DirEntry> ListDir(const std::string &path) = 0;
+    // Streams the listing of `path` to `on_batch` while it is still
+    // arriving; the first batch starts with the ".." entry. Clients without
+    // an incremental listing deliver the whole ListDir() result at once.
+    // Returns 0 when the listing failed.
+    virtual int ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch)
+    {
+        on_batch(ListDir(path));
+        return 1;
+    }
+    // Fetches a cheap token that changes whenever the listing of `path`
+    // does (an ETag or modification time), used to revalidate cached
+    // listings. Returns false when the protocol has no such token.
+    virtual bool GetDirValidator(const std::string &path, std::string &validator)
+    {
+        return false;
+    }
+    // Streams every file and folder below `path` (recursively, without the
+    // ".." entry) in one request where the protocol allows it. Returns 0
+    // when unsupported, refused by the server or stopped by `on_batch`;
+    // callers then walk the tree with ListDir.
+    virtual int ListTree(const std::string &path, const DirEntryBatchFn &on_batch)
+    {
+        return 0;
+    }
+    // Streams the files and folders below `path` whose name contains
+    // `query`, ignoring case, found by the server itself (WebDAV SEARCH, a
+    // remote find) instead of a listing per folder. Returns -1 when the
+    // server cannot search, so the caller uses the catalogue or filters the
+    // folder on screen; 0 when the search failed or `on_batch` stopped it.
+    virtual int Search(const std::string &path, const std::string &query, const DirEntryBatchFn &on_batch)
+    {
+        return -1;
+    }
+    // Bytes the server accounts to the folder `path` with everything below
+    // it, when it keeps that figure itself and no listing is needed.
+    // Returns -1 when it does not, 0 on failure.
+    virtual int UsedBytes(const std::string &path, int64_t *bytes)
+    {
+        return -1;
+    }
+    // Keeps the connection from timing out while nothing uses it: sends a
+    // cheap probe once no traffic went over it for `interval_us`. Returns
+    // the microseconds until it wants to be asked again, 0 when the
+    // connection turned out dead, -1 when the protocol needs none.
+    virtual int64_t KeepAlive(uint64_t interval_us)
+    {
+        return -1;
+    }
     virtual std::string GetPath(std::string path1, std::string path2) = 0;
     virtual int GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset) = 0;
     virtual void *Open(const std::string &path, int flags) = 0;
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -6,202 +7,411 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <cstring>
 #include <stdio.h>
 #include <stdlib.h>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <switch.h>
 
 #include "lang.h"
 #include "util.h"
 #include "config.h"
+#include "logger.h"
+#include "threads.h"
+#include "transfer_trace.h"
+#include "rate_limiter.h"
+#include "transfer_stats.h"
+#include "metrics.h"
+#include "fs.h"
+#include "checksum.h"
+#include "local_sink.h"
+#include "transfer_pipeline.h"
+#include "buffer_pool.h"
+#include "ssh_crypto.h"
+#include "resolver.h"
+#include "socket_tuning.h"
+#include "keepalive.h"
 #include "clients/sftpclient.h"
+#include "cancel.h"
 
 // Progress and cancel globals defined in windows.cpp
-extern int64_t bytes_transfered;
-extern bool stop_activity;
+extern Metrics::Value<int64_t> bytes_transfered;
 
 static bool g_libssh2_initialized = false;
 // Tunable constants for throughput.
 // Use smaller buffers so progress updates feel smoother and avoid large "burst"
 // writes. Tuned for more stable throughput display on Switch.
 static const size_t kTransferBufferSize = 512 * 1024; // 512 KB transfer buffer
-static const int kSocketBufferSize = 512 * 1024;      // 512 KB TCP buffers
+static const int kSegmentAttempts = 3;                // tries per parallel segment
 
-// Simple DNS helpers to fall back to public resolvers when system DNS fails.
-static bool SkipDnsName(const unsigned char *buf, size_t len, size_t &offset)
+// Parallel downloads update the shared progress counter from several
+// sessions at once; it is atomic.
+static void AddProgress(int64_t delta)
 {
-    while (offset < len)
+    bytes_transfered += delta;
+    TransferStats::AddBytes(delta);
+}
+
+// Attributes from recent listings, shared by every session to the same
+// server so a download worker can size a file another worker listed. Keys
+// are SftpClient::attrKey() of the full path.
+struct SftpCachedAttrs
+{
+    int64_t size;
+    // Listed without a usable size (a symlink, or no size attribute): it
+    // exists, but only the server knows its size.
+    bool unknown;
+    uint64_t tick;
+};
+
+static std::mutex g_attr_mutex;
+static std::unordered_map<std::string, SftpCachedAttrs> g_attr_cache;
+// Folders whose complete listing is cached, so a name missing from it is
+// known not to exist.
+static std::unordered_map<std::string, uint64_t> g_listed_dirs;
+static const size_t kMaxCachedAttrs = 65536;
+
+// Last measured download speed per server URL, in KiB/s, which decides
+// whether new sessions ask for compression.
+static std::mutex g_link_mutex;
+static std::unordered_map<std::string, int64_t> g_link_kbps;
+static const uint64_t kMinMeasureBytes = 4 * 1024 * 1024;
+
+// `preferred` (fastest first) narrowed to what libssh2 implements, or
+// `fallback` when none of it is.
+static std::string MethodList(LIBSSH2_SESSION *sess, int method, const std::vector<std::string> &preferred,
+                              const char *fallback)
+{
+    const char **algs = nullptr;
+    int count = libssh2_session_supported_algs(sess, method, &algs);
+    std::string out;
+    for (const std::string &name : preferred)
     {
-        unsigned char labellen = buf[offset];
-        if (labellen == 0)
+        for (int i = 0; i < count; i++)
         {
-            offset += 1;
-            return true;
-        }
-        // Compression pointer: 11xxxxxx xxxxxxxx
-        if ((labellen & 0xC0) == 0xC0)
-        {
-            if (offset + 1 >= len)
-                return false;
-            offset += 2;
-            return true;
+            if (name == algs[i])
+            {
+                out += (out.empty() ? "" : ",") + name;
+                break;
+            }
         }
-        offset += 1 + labellen;
     }
-    return false;
+    if (count > 0)
+        libssh2_free(sess, algs);
+    return out.empty() ? std::string(fallback) : out;
 }
 
-static bool ResolveHostWithServer(const std::string &host, int port, const char *dns_ip, struct sockaddr_in *out_addr)
+// Host keys seen per "host:port", kept in SSH_HOSTS_FILE as
+// "<host:port> <type> <sha256 hex>" lines. A reconnect asks for the same
+// key type first, so the server proves the key it proved last time and a
+// changed key shows up in the log.
+struct SftpHostKey
 {
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)
-        return false;
-
-    struct timeval tv;
-    tv.tv_sec = 2;
-    tv.tv_usec = 0;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-
-    struct sockaddr_in dns_addr;
-    memset(&dns_addr, 0, sizeof(dns_addr));
-    dns_addr.sin_family = AF_INET;
-    dns_addr.sin_port = htons(53);
-    if (inet_pton(AF_INET, dns_ip, &dns_addr.sin_addr) != 1)
-    {
-        close(sockfd);
-        return false;
-    }
-
-    unsigned char buf[512];
-    memset(buf, 0, sizeof(buf));
-
-    uint16_t id = (uint16_t)rand();
-    buf[0] = (id >> 8) & 0xFF;
-    buf[1] = id & 0xFF;
-    buf[2] = 0x01; // RD
-    buf[3] = 0x00;
-    buf[4] = 0x00;
-    buf[5] = 0x01; // QDCOUNT = 1
-    // ANCOUNT, NSCOUNT, ARCOUNT already zero
-
-    size_t offset = 12;
-    std::string h = host;
-    // ensure no trailing dot
-    if (!h.empty() && h.back() == '.')
-        h.pop_back();
-
-    size_t start = 0;
-    while (start < h.size() && offset + 1 < sizeof(buf))
-    {
-        size_t dot = h.find('.', start);
-        if (dot == std::string::npos)
-            dot = h.size();
-        size_t labellen = dot - start;
-        if (labellen > 63 || offset + 1 + labellen >= sizeof(buf))
-        {
-            close(sockfd);
-            return false;
-        }
-        buf[offset++] = (unsigned char)labellen;
-        memcpy(buf + offset, h.c_str() + start, labellen);
-        offset += labellen;
-        start = dot;
-        if (start < h.size() && h[start] == '.')
-            start++;
-    }
-    if (offset >= sizeof(buf))
+    int type = 0;
+    std::string sha256;
+};
+
+static std::mutex g_hostkey_mutex;
+static std::map<std::string, SftpHostKey> g_hostkeys;
+static bool g_hostkeys_loaded = false;
+
+static void LoadHostKeys()
+{
+    if (g_hostkeys_loaded)
+        return;
+    g_hostkeys_loaded = true;
+    FILE *fp = fopen(SSH_HOSTS_FILE, "r");
+    if (fp == nullptr)
+        return;
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != nullptr)
     {
-        close(sockfd);
-        return false;
+        char host[256], hash[80];
+        int type = 0;
+        if (sscanf(line, "%255s %d %79s", host, &type, hash) != 3)
+            continue;
+        SftpHostKey &key = g_hostkeys[host];
+        key.type = type;
+        key.sha256 = hash;
     }
-    buf[offset++] = 0; // end of qname
+    fclose(fp);
+}
+
+static void SaveHostKeys()
+{
+    FILE *fp = fopen(SSH_HOSTS_FILE, "w");
+    if (fp == nullptr)
+        return;
+    for (const auto &it : g_hostkeys)
+        fprintf(fp, "%s %d %s\n", it.first.c_str(), it.second.type, it.second.sha256.c_str());
+    fclose(fp);
+}
 
-    // QTYPE=A, QCLASS=IN
-    if (offset + 4 > sizeof(buf))
+// Names libssh2 gives the host key methods of a LIBSSH2_HOSTKEY_TYPE_*.
+static std::vector<std::string> HostKeyMethods(int type)
+{
+    switch (type)
     {
-        close(sockfd);
-        return false;
+    case LIBSSH2_HOSTKEY_TYPE_RSA:
+        return {"rsa-sha2-512", "rsa-sha2-256", "ssh-rsa"};
+    case LIBSSH2_HOSTKEY_TYPE_DSS:
+        return {"ssh-dss"};
+    case LIBSSH2_HOSTKEY_TYPE_ECDSA_256:
+        return {"ecdsa-sha2-nistp256"};
+    case LIBSSH2_HOSTKEY_TYPE_ECDSA_384:
+        return {"ecdsa-sha2-nistp384"};
+    case LIBSSH2_HOSTKEY_TYPE_ECDSA_521:
+        return {"ecdsa-sha2-nistp521"};
+    case LIBSSH2_HOSTKEY_TYPE_ED25519:
+        return {"ssh-ed25519"};
+    default:
+        return {};
     }
-    buf[offset++] = 0;
-    buf[offset++] = 1;
-    buf[offset++] = 0;
-    buf[offset++] = 1;
+}
 
-    ssize_t sent = sendto(sockfd, buf, offset, 0, (struct sockaddr *)&dns_addr, sizeof(dns_addr));
-    if (sent < 0)
+// Every host key method libssh2 has, those of the key `host` showed last
+// time first; empty when it is a new host.
+static std::string HostKeyPreference(LIBSSH2_SESSION *sess, const std::string &host)
+{
+    int type = 0;
     {
-        close(sockfd);
-        return false;
+        std::lock_guard<std::mutex> lock(g_hostkey_mutex);
+        LoadHostKeys();
+        auto it = g_hostkeys.find(host);
+        if (it == g_hostkeys.end())
+            return "";
+        type = it->second.type;
     }
 
-    struct sockaddr_in from_addr;
-    socklen_t from_len = sizeof(from_addr);
-    ssize_t recvd = recvfrom(sockfd, buf, sizeof(buf), 0, (struct sockaddr *)&from_addr, &from_len);
-    if (recvd <= 0)
+    std::vector<std::string> known = HostKeyMethods(type);
+    const char **algs = nullptr;
+    int count = libssh2_session_supported_algs(sess, LIBSSH2_METHOD_HOSTKEY, &algs);
+    std::string first, rest;
+    for (int i = 0; i < count; i++)
     {
-        close(sockfd);
-        return false;
+        bool is_known = std::find(known.begin(), known.end(), algs[i]) != known.end();
+        std::string &out = is_known ? first : rest;
+        out += (out.empty() ? "" : ",") + std::string(algs[i]);
     }
-    close(sockfd);
-
-    if (recvd < 12)
-        return false;
+    if (count > 0)
+        libssh2_free(sess, algs);
+    if (first.empty())
+        return "";
+    return rest.empty() ? first : first + "," + rest;
+}
 
-    size_t resp_len = (size_t)recvd;
-    uint16_t qdcount = (buf[4] << 8) | buf[5];
-    uint16_t ancount = (buf[6] << 8) | buf[7];
-    uint16_t nscount = (buf[8] << 8) | buf[9];
-    uint16_t arcount = (buf[10] << 8) | buf[11];
-    if (qdcount != 1 || (ancount + arcount) == 0)
-        return false;
+// Records the key `sess` was handshaken with, warning when `host` showed
+// another one before. Connecting goes on either way: there is nowhere to
+// ask whether the new key is expected.
+static void RememberHostKey(LIBSSH2_SESSION *sess, const std::string &host)
+{
+    size_t key_len = 0;
+    int type = 0;
+    const char *hash = libssh2_hostkey_hash(sess, LIBSSH2_HOSTKEY_HASH_SHA256);
+    if (libssh2_session_hostkey(sess, &key_len, &type) == nullptr || hash == nullptr)
+        return;
 
-    size_t resp_off = 12;
-    if (!SkipDnsName(buf, resp_len, resp_off))
-        return false;
-    if (resp_off + 4 > resp_len)
-        return false;
-    // skip QTYPE/QCLASS
-    resp_off += 4;
+    static const char hex[] = "0123456789abcdef";
+    std::string sha256;
+    for (int i = 0; i < 32; i++)
+    {
+        sha256 += hex[(unsigned char)hash[i] >> 4];
+        sha256 += hex[(unsigned char)hash[i] & 0xF];
+    }
 
-    uint32_t total_rr = (uint32_t)ancount + (uint32_t)nscount + (uint32_t)arcount;
+    std::lock_guard<std::mutex> lock(g_hostkey_mutex);
+    LoadHostKeys();
+    SftpHostKey &known = g_hostkeys[host];
+    if (known.type == type && known.sha256 == sha256)
+        return;
+    if (!known.sha256.empty())
+        Logger::Logf(Logger::LOG_WARN, "SFTP host key changed host=%s type=%d->%d sha256=%s",
+                     host.c_str(), known.type, type, sha256.c_str());
+    known.type = type;
+    known.sha256 = sha256;
+    SaveHostKeys();
+}
 
-    for (uint32_t i = 0; i < total_rr && resp_off + 12 <= resp_len; ++i)
+namespace
+{
+    struct SftpParallelContext
+    {
+        LocalFileSink *sink = nullptr;
+        std::string path;
+        uint64_t size = 0;
+        uint64_t segment = 0;
+        // Segments are claimed with one fetch_add; the lock only guards
+        // errorMessage.
+        std::atomic<uint64_t> nextOffset{0};
+        std::atomic<bool> hadError{false};
+        std::mutex stateMutex;
+        std::string errorMessage;
+        // TransferStats slot of the queue worker that owns the file.
+        int statsSlot = -1;
+    };
+
+    struct SftpWorkerArgs
     {
-        if (!SkipDnsName(buf, resp_len, resp_off))
-            return false;
-        if (resp_off + 10 > resp_len)
-            return false;
-        uint16_t type = (buf[resp_off] << 8) | buf[resp_off + 1];
-        uint16_t clas = (buf[resp_off + 2] << 8) | buf[resp_off + 3];
-        uint16_t rdlength = (buf[resp_off + 8] << 8) | buf[resp_off + 9];
-        resp_off += 10;
-        if (resp_off + rdlength > resp_len)
-            return false;
+        SftpParallelContext *ctx = nullptr;
+        SftpClient *client = nullptr;
+    };
 
-        if (type == 1 && clas == 1 && rdlength == 4)
+    static void SftpParallelWorker(SftpParallelContext *ctx, SftpClient *client)
+    {
+        while (true)
         {
-            memset(out_addr, 0, sizeof(*out_addr));
-            out_addr->sin_family = AF_INET;
-            out_addr->sin_port = htons(port);
-            memcpy(&out_addr->sin_addr, buf + resp_off, 4);
-            return true;
+            if (ctx->hadError || Cancel::Stopped())
+                return;
+            uint64_t start = ctx->nextOffset.fetch_add(ctx->segment);
+            if (start >= ctx->size)
+                return;
+            uint64_t length = std::min(ctx->segment, ctx->size - start);
+
+            bool ok = false;
+            for (int attempt = 1; attempt <= kSegmentAttempts && !ok; ++attempt)
+            {
+                uint64_t done = 0;
+                ok = client->GetSegment(*ctx->sink, ctx->path, start, length, &done) == 1;
+                if (ok)
+                {
+                    TransferStats::RangeDone(start, start + length);
+                    break;
+                }
+
+                // The segment is fetched again from its start; roll back.
+                AddProgress(-(int64_t)done);
+                if (Cancel::Stopped())
+                    break;
+                TransferStats::AddRetry();
+                LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "SFTP GET parallel segment error path=%s offset=%llu len=%llu attempt=%d/%d err=%s",
+                                 ctx->path.c_str(),
+                                 (unsigned long long)start,
+                                 (unsigned long long)length,
+                                 attempt,
+                                 kSegmentAttempts,
+                                 client->LastResponse());
+            }
+
+            if (!ok)
+            {
+                std::lock_guard<std::mutex> lock(ctx->stateMutex);
+                if (!ctx->hadError.exchange(true))
+                {
+                    ctx->errorMessage = Cancel::Stopped() ? lang_strings[STR_CANCEL_ACTION_MSG] : client->LastResponse();
+                }
+                return;
+            }
         }
-        resp_off += rdlength;
     }
 
-    return false;
-}
+    static void SftpParallelWorkerThread(void *argp)
+    {
+        SftpWorkerArgs *args = static_cast<SftpWorkerArgs *>(argp);
+        TransferStats::Bind(args->ctx->statsSlot);
+        SftpParallelWorker(args->ctx, args->client);
+    }
 
-static bool ResolveHostFallback(const std::string &host, int port, struct sockaddr_in *out_addr)
-{
-    const char *dns_servers[] = {"1.1.1.1", "8.8.8.8"};
+    // Double-buffered read-ahead for uploads: the reader thread fills one
+    // buffer from the local file while the session drains the other.
+    struct SftpUploadReader
+    {
+        const RemoteSourceFn *source = nullptr;
+        TransferBuffer buffers[2];
+        size_t sizes[2] = {0, 0};
+        bool full[2] = {false, false};
+        bool readError = false;
+        bool stop = false;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    static void SftpUploadReaderThread(void *argp)
+    {
+        SftpUploadReader *reader = static_cast<SftpUploadReader *>(argp);
+        for (int idx = 0;; idx ^= 1)
+        {
+            {
+                std::unique_lock<std::mutex> lock(reader->mutex);
+                reader->cv.wait(lock, [reader, idx]
+                                { return reader->stop || !reader->full[idx]; });
+                if (reader->stop)
+                    return;
+            }
+
+            TransferBuffer &buffer = reader->buffers[idx];
+            int64_t got = (*reader->source)(buffer.data(), buffer.size());
+            size_t count = got > 0 ? (size_t)got : 0;
+
+            std::lock_guard<std::mutex> lock(reader->mutex);
+            reader->sizes[idx] = count;
+            reader->full[idx] = true;
+            if (got < 0)
+                reader->readError = true;
+            reader->cv.notify_all();
+            // An empty buffer marks end of input for the writer.
+            if (count == 0)
+                return;
+        }
+    }
 
-    for (const char *dns_ip : dns_servers)
+    // The local side of a delta update: MD5s of the old copy, on a disk
+    // thread while the server hashes its own. `block` 0 hashes the first
+    // `size` bytes as one.
+    struct SftpLocalHasher
     {
-        if (ResolveHostWithServer(host, port, dns_ip, out_addr))
+        std::string path;
+        uint64_t size = 0;
+        uint64_t block = 0;
+        std::vector<std::string> sums;
+        bool ok = false;
+    };
+
+    static void SftpLocalHashThread(void *argp)
+    {
+        SftpLocalHasher *hasher = static_cast<SftpLocalHasher *>(argp);
+        int fd = open(hasher->path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        // Our own descriptor, so nobody else moves its position.
+        ChecksumWriter::ReadFn read_at = [fd](uint64_t offset, char *data, size_t size)
+        {
+            if (lseek(fd, (off_t)offset, SEEK_SET) < 0)
+                return false;
+            while (size > 0)
+            {
+                ssize_t got = read(fd, data, size);
+                if (got <= 0)
+                    return false;
+                data += got;
+                size -= (size_t)got;
+            }
             return true;
+        };
+
+        uint64_t block = hasher->block > 0 ? hasher->block : hasher->size;
+        bool ok = true;
+        for (uint64_t start = 0; ok && start < hasher->size && !Cancel::Stopped(); start += block)
+        {
+            uint64_t len = std::min(block, hasher->size - start);
+            ChecksumWriter writer(FileDigest::MD5);
+            FileDigest digest;
+            ok = writer.Final(len, [&](uint64_t offset, char *data, size_t size)
+                              { return read_at(start + offset, data, size); },
+                              digest);
+            hasher->sums.push_back(digest.Hex());
+        }
+        close(fd);
+        hasher->ok = ok && !Cancel::Stopped();
     }
-    return false;
 }
 
 SftpClient::SftpClient()
@@ -270,6 +480,9 @@ int SftpClient::Connect(const std::string &url, const std::string &user, const s
 
     if (connected)
         Quit();
+    exec_copy = -1;
+    // Any left belonged to a session that is gone.
+    read_handles.clear();
 
     // Parse URL: sftp://host[:port][/base]
     std::string host_part;
@@ -313,137 +526,12 @@ int SftpClient::Connect(const std::string &url, const std::string &user, const s
     base_path = Util::Trim(base_path, " ");
     base_path = Util::Trim(base_path, "/");
 
-    // Resolve host: try numeric IPv4/IPv6 first, then system DNS (IPv4/IPv6),
-    // then fallback IPv4 DNS.
     struct sockaddr_storage server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
     socklen_t server_addr_len = 0;
-    bool resolved = false;
-
-    struct in_addr v4;
-    struct in6_addr v6;
-    if (inet_pton(AF_INET, host_part.c_str(), &v4) == 1)
-    {
-        struct sockaddr_in *sa = (struct sockaddr_in *)&server_addr;
-        sa->sin_family = AF_INET;
-        sa->sin_port = htons(port);
-        sa->sin_addr = v4;
-        server_addr_len = sizeof(struct sockaddr_in);
-        resolved = true;
-    }
-    else if (inet_pton(AF_INET6, host_part.c_str(), &v6) == 1)
-    {
-        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&server_addr;
-        sa6->sin6_family = AF_INET6;
-        sa6->sin6_port = htons(port);
-        sa6->sin6_addr = v6;
-        server_addr_len = sizeof(struct sockaddr_in6);
-        resolved = true;
-    }
-    else
+    if (!Resolver::Resolve(host_part, port, &server_addr, &server_addr_len))
     {
-        // First try getaddrinfo with AF_UNSPEC (IPv4 or IPv6).
-        struct addrinfo hints;
-        struct addrinfo *res = nullptr;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
-
-        char port_str[16];
-        snprintf(port_str, sizeof(port_str), "%d", port);
-
-        int gai = getaddrinfo(host_part.c_str(), port_str, &hints, &res);
-        int last_gai = gai;
-        if (gai == 0 && res)
-        {
-            // Prefer IPv4 results first, then IPv6.
-            struct addrinfo *chosen = nullptr;
-            for (struct addrinfo *p = res; p != nullptr; p = p->ai_next)
-            {
-                if (p->ai_family == AF_INET)
-                {
-                    chosen = p;
-                    break;
-                }
-            }
-            if (!chosen)
-            {
-                for (struct addrinfo *p = res; p != nullptr; p = p->ai_next)
-                {
-                    if (p->ai_family == AF_INET6)
-                    {
-                        chosen = p;
-                        break;
-                    }
-                }
-            }
-
-            if (chosen)
-            {
-                size_t copy_len = chosen->ai_addrlen;
-                if (copy_len > sizeof(server_addr))
-                    copy_len = sizeof(server_addr);
-                memcpy(&server_addr, chosen->ai_addr, copy_len);
-                server_addr_len = (socklen_t)copy_len;
-                resolved = true;
-            }
-            freeaddrinfo(res);
-        }
-        else
-        {
-            if (res)
-                freeaddrinfo(res);
-        }
-
-        // If getaddrinfo failed or returned nothing usable, fall back to gethostbyname (IPv4).
-        if (!resolved)
-        {
-            struct hostent *he = gethostbyname(host_part.c_str());
-            if (he && he->h_addrtype == AF_INET && he->h_addr_list && he->h_addr_list[0])
-            {
-                struct in_addr addr_in;
-                memcpy(&addr_in, he->h_addr_list[0], sizeof(struct in_addr));
-
-                struct sockaddr_in v4_he;
-                memset(&v4_he, 0, sizeof(v4_he));
-                v4_he.sin_family = AF_INET;
-                v4_he.sin_port = htons(port);
-                v4_he.sin_addr = addr_in;
-
-                memcpy(&server_addr, &v4_he, sizeof(v4_he));
-                server_addr_len = sizeof(struct sockaddr_in);
-                resolved = true;
-            }
-        }
-
-        // If still not resolved, try manual IPv4 DNS against known public resolvers.
-        if (!resolved)
-        {
-            struct sockaddr_in v4_addr;
-            memset(&v4_addr, 0, sizeof(v4_addr));
-            v4_addr.sin_family = AF_INET;
-            v4_addr.sin_port = htons(port);
-            if (!ResolveHostFallback(host_part, port, &v4_addr))
-            {
-                char buf[256];
-                if (last_gai != 0)
-                {
-                    snprintf(buf, sizeof(buf), "%s (%s)",
-                             lang_strings[STR_COULD_NOT_RESOLVE_HOST],
-                             gai_strerror(last_gai));
-                }
-                else
-                {
-                    snprintf(buf, sizeof(buf), "%s (fallback DNS failed)",
-                             lang_strings[STR_COULD_NOT_RESOLVE_HOST]);
-                }
-                setResponse(buf);
-                return 0;
-            }
-            memcpy(&server_addr, &v4_addr, sizeof(v4_addr));
-            server_addr_len = sizeof(struct sockaddr_in);
-            resolved = true;
-        }
+        setResponse(lang_strings[STR_COULD_NOT_RESOLVE_HOST]);
+        return 0;
     }
 
     int s = socket(((struct sockaddr *)&server_addr)->sa_family, SOCK_STREAM, 0);
@@ -453,16 +541,19 @@ int SftpClient::Connect(const std::string &url, const std::string &user, const s
         return 0;
     }
 
-    int bufsize = kSocketBufferSize;
-    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
-    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    std::string tune_host = SocketTuning::HostOf(url);
+    SocketTuning::Apply(s, tune_host);
 
     int flag = 1;
     setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
 
-    if (connect(s, (struct sockaddr *)&server_addr, server_addr_len) != 0)
+    uint64_t connect_start = Util::GetTick();
+    if (connect(s, (struct sockaddr *)&server_addr, server_addr_len) == 0)
+        SocketTuning::ObserveRtt(tune_host, Util::GetTick() - connect_start);
+    else
     {
         close(s);
+        Resolver::Forget(host_part);
         setResponse(lang_strings[STR_FAIL_TIMEOUT_MSG]);
         return 0;
     }
@@ -475,22 +566,49 @@ int SftpClient::Connect(const std::string &url, const std::string &user, const s
         return 0;
     }
 
+    // Handshake and login block; the session goes non-blocking once SFTP is
+    // up so every later call can be polled (see nb()).
     libssh2_session_set_blocking(sess, 1);
 
-    // Prefer faster modern ciphers/MACs and disable expensive compression by default.
+    // Ciphers and MACs in the order measured fastest on this console.
+    std::vector<std::string> cipher_rank, mac_rank;
+    SshCrypto::Ranking(cipher_rank, mac_rank);
+    std::string ciphers = MethodList(sess, LIBSSH2_METHOD_CRYPT_CS, cipher_rank,
+                                     "chacha20-poly1305@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr");
+    std::string macs = MethodList(sess, LIBSSH2_METHOD_MAC_CS, mac_rank, "hmac-sha2-256,hmac-sha1");
     libssh2_session_method_pref(sess, LIBSSH2_METHOD_KEX,
                                 "curve25519-sha256@libssh.org,diffie-hellman-group-exchange-sha256,"
                                 "diffie-hellman-group14-sha1");
-    libssh2_session_method_pref(sess, LIBSSH2_METHOD_CRYPT_CS,
-                                "chacha20-poly1305@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr");
-    libssh2_session_method_pref(sess, LIBSSH2_METHOD_CRYPT_SC,
-                                "chacha20-poly1305@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr");
-    libssh2_session_method_pref(sess, LIBSSH2_METHOD_MAC_CS,
-                                "hmac-sha2-256,hmac-sha1");
-    libssh2_session_method_pref(sess, LIBSSH2_METHOD_MAC_SC,
-                                "hmac-sha2-256,hmac-sha1");
-    libssh2_session_method_pref(sess, LIBSSH2_METHOD_COMP_CS, "none,zlib@openssh.com,zlib");
-    libssh2_session_method_pref(sess, LIBSSH2_METHOD_COMP_SC, "none,zlib@openssh.com,zlib");
+    libssh2_session_method_pref(sess, LIBSSH2_METHOD_CRYPT_CS, ciphers.c_str());
+    libssh2_session_method_pref(sess, LIBSSH2_METHOD_CRYPT_SC, ciphers.c_str());
+    libssh2_session_method_pref(sess, LIBSSH2_METHOD_MAC_CS, macs.c_str());
+    libssh2_session_method_pref(sess, LIBSSH2_METHOD_MAC_SC, macs.c_str());
+
+    // Compression costs more CPU than it saves unless the link is slow.
+    int64_t link_kbps = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_link_mutex);
+        auto it = g_link_kbps.find(url);
+        if (it != g_link_kbps.end())
+            link_kbps = it->second;
+    }
+    bool compress = sftp_compress_below_kb > 0 && link_kbps > 0 && link_kbps < sftp_compress_below_kb;
+    if (compress)
+    {
+        libssh2_session_flag(sess, LIBSSH2_FLAG_COMPRESS, 1);
+        libssh2_session_method_pref(sess, LIBSSH2_METHOD_COMP_CS, "zlib@openssh.com,zlib,none");
+        libssh2_session_method_pref(sess, LIBSSH2_METHOD_COMP_SC, "zlib@openssh.com,zlib,none");
+    }
+    else
+    {
+        libssh2_session_method_pref(sess, LIBSSH2_METHOD_COMP_CS, "none,zlib@openssh.com,zlib");
+        libssh2_session_method_pref(sess, LIBSSH2_METHOD_COMP_SC, "none,zlib@openssh.com,zlib");
+    }
+
+    std::string host_key = host_part + ":" + std::to_string(port);
+    std::string host_key_methods = HostKeyPreference(sess, host_key);
+    if (!host_key_methods.empty())
+        libssh2_session_method_pref(sess, LIBSSH2_METHOD_HOSTKEY, host_key_methods.c_str());
 
     int rc = libssh2_session_handshake(sess, s);
     if (rc != 0)
@@ -504,6 +622,14 @@ int SftpClient::Connect(const std::string &url, const std::string &user, const s
         close(s);
         return 0;
     }
+    {
+        const char *cipher = libssh2_session_methods(sess, LIBSSH2_METHOD_CRYPT_SC);
+        const char *mac = libssh2_session_methods(sess, LIBSSH2_METHOD_MAC_SC);
+        const char *comp = libssh2_session_methods(sess, LIBSSH2_METHOD_COMP_SC);
+        Logger::Logf("SFTP session cipher=%s mac=%s comp=%s link_kbps=%lld", cipher ? cipher : "?",
+                     mac ? mac : "?", comp ? comp : "?", (long long)link_kbps);
+    }
+    RememberHostKey(sess, host_key);
 
     rc = libssh2_userauth_password(sess, user.c_str(), pass.c_str());
     if (rc != 0)
@@ -533,10 +659,18 @@ int SftpClient::Connect(const std::string &url, const std::string &user, const s
         return 0;
     }
 
+    libssh2_session_set_blocking(sess, 0);
+    // Asks for a reply, so the probe is two-way traffic for NATs and VPNs
+    // on the path too.
+    if (KeepAlive::Interval() > 0)
+        libssh2_keepalive_config(sess, 1, (unsigned)(KeepAlive::Interval() / 1000000));
     sock = s;
     session = sess;
     sftp = sftp_sess;
     connected = true;
+    conn_url = url;
+    conn_user = user;
+    conn_pass = pass;
 
     setResponse(lang_strings[STR_CONNECT]);
     return 1;
@@ -548,9 +682,10 @@ int SftpClient::Mkdir(const std::string &path)
         return 0;
 
     std::string full = getFullPath(path);
-    int rc = libssh2_sftp_mkdir_ex(sftp, full.c_str(), (unsigned int)full.size(),
-                                   LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
-                                   LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH);
+    forgetAttrs(full, false);
+    int rc = nb([&] { return libssh2_sftp_mkdir_ex(sftp, full.c_str(), (unsigned int)full.size(),
+                                                    LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
+                                                    LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH); });
     if (rc == 0)
         return 1;
 
@@ -564,7 +699,8 @@ int SftpClient::Rmdir(const std::string &path, bool recursive)
         return 0;
 
     std::string full = getFullPath(path);
-    int rc = libssh2_sftp_rmdir_ex(sftp, full.c_str(), (unsigned int)full.size());
+    forgetAttrs(full, true);
+    int rc = nb([&] { return libssh2_sftp_rmdir_ex(sftp, full.c_str(), (unsigned int)full.size()); });
     if (rc == 0)
         return 1;
 
@@ -578,9 +714,13 @@ int SftpClient::Size(const std::string &path, int64_t *size)
         return 0;
 
     std::string full = getFullPath(path);
+    int cached = cachedSize(full, size);
+    if (cached >= 0)
+        return cached;
+
     LIBSSH2_SFTP_ATTRIBUTES attrs;
-    int rc = libssh2_sftp_stat_ex(sftp, full.c_str(), (unsigned int)full.size(),
-                                  LIBSSH2_SFTP_STAT, &attrs);
+    int rc = nb([&] { return libssh2_sftp_stat_ex(sftp, full.c_str(), (unsigned int)full.size(),
+                                                   LIBSSH2_SFTP_STAT, &attrs); });
     if (rc != 0)
         return 0;
 
@@ -592,184 +732,635 @@ int SftpClient::Size(const std::string &path, int64_t *size)
     return 0;
 }
 
-int SftpClient::Get(const std::string &outputfile, const std::string &path, uint64_t offset)
+std::string SftpClient::attrKey(const std::string &full) const
 {
-    if (!connected || !sftp)
-        return 0;
+    return conn_user + "@" + conn_url + "|" + full;
+}
 
-    std::string full = getFullPath(path);
-    LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open_ex(
-        sftp, full.c_str(), (unsigned int)full.size(),
-        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE);
-    if (!handle)
+int SftpClient::cachedSize(const std::string &full, int64_t *size) const
+{
+    if (sftp_attr_cache_secs <= 0)
+        return -1;
+    uint64_t oldest = Util::GetTick() - (uint64_t)sftp_attr_cache_secs * 1000000;
+
+    std::lock_guard<std::mutex> lock(g_attr_mutex);
+    auto it = g_attr_cache.find(attrKey(full));
+    if (it != g_attr_cache.end() && it->second.tick >= oldest)
     {
-        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        return 0;
+        if (it->second.unknown)
+            return -1;
+        *size = it->second.size;
+        return 1;
     }
+    size_t slash = full.find_last_of('/');
+    auto dir = g_listed_dirs.find(attrKey(slash == std::string::npos ? "" : full.substr(0, slash)));
+    if (dir != g_listed_dirs.end() && dir->second >= oldest)
+        return 0;
+    return -1;
+}
 
-    FILE *file = fopen(outputfile.c_str(), "wb");
-    if (!file)
+void SftpClient::forgetAttrs(const std::string &full, bool tree)
+{
+    closeReadHandles(full, tree);
+    std::string key = attrKey(full);
+    size_t slash = full.find_last_of('/');
+    std::string parent = attrKey(slash == std::string::npos ? "" : full.substr(0, slash));
+
+    std::lock_guard<std::mutex> lock(g_attr_mutex);
+    g_attr_cache.erase(key);
+    g_listed_dirs.erase(parent);
+    if (!tree)
+        return;
+    std::string prefix = key + "/";
+    for (auto it = g_attr_cache.begin(); it != g_attr_cache.end();)
+        it = it->first.compare(0, prefix.size(), prefix) == 0 ? g_attr_cache.erase(it) : std::next(it);
+    for (auto it = g_listed_dirs.begin(); it != g_listed_dirs.end();)
+        it = (it->first == key || it->first.compare(0, prefix.size(), prefix) == 0) ? g_listed_dirs.erase(it)
+                                                                                    : std::next(it);
+}
+
+bool SftpClient::waitSocket(int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = 0;
+    pfd.revents = 0;
+
+    int dir = libssh2_session_block_directions(session);
+    if (dir & LIBSSH2_SESSION_BLOCK_INBOUND)
+        pfd.events |= POLLIN;
+    if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+        pfd.events |= POLLOUT;
+    if (pfd.events == 0)
+        pfd.events = POLLIN;
+
+    return poll(&pfd, 1, timeout_ms) >= 0;
+}
+
+template <typename Fn>
+auto SftpClient::nb(Fn fn) -> decltype(fn())
+{
+    while (true)
     {
-        libssh2_sftp_close(handle);
-        setResponse(lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
-        return 0;
+        auto rc = fn();
+        if (rc != LIBSSH2_ERROR_EAGAIN)
+            return rc;
+        waitSocket(100);
     }
+}
 
-    // Use a fully buffered FILE* with a buffer similar to our transfer buffer.
-    // This reduces syscall overhead when writing many large chunks.
-    setvbuf(file, nullptr, _IOFBF, kTransferBufferSize);
+template <typename Fn>
+auto SftpClient::nbHandle(Fn fn) -> decltype(fn())
+{
+    while (true)
+    {
+        auto handle = fn();
+        if (handle || libssh2_session_last_errno(session) != LIBSSH2_ERROR_EAGAIN)
+            return handle;
+        waitSocket(100);
+    }
+}
 
-    if (offset > 0)
+int SftpClient::pipelinedRead(LIBSSH2_SFTP_HANDLE *handle, LocalFileSink &sink, uint64_t offset, uint64_t limit, uint64_t *done)
+{
+    // libssh2 keeps issuing SSH_FXP_READ requests ahead of the caller for
+    // as much data as the destination buffer can take, and hands the replies
+    // back in file order. Sizing the buffer to depth * request size therefore
+    // keeps that many requests outstanding per RTT instead of one 512 KB
+    // window. The session is non-blocking, so we poll the socket in short
+    // slices and cancel stays responsive while requests are in flight.
+    size_t window = bench_window > 0 ? bench_window : (size_t)sftp_pipeline_depth * (size_t)sftp_request_kb * 1024;
+    if (window < kTransferBufferSize)
+        window = kTransferBufferSize;
+    TransferBuffer buffer(window);
+    if (!buffer)
     {
-        libssh2_sftp_seek64(handle, offset);
-        fseeko(file, (off_t)offset, SEEK_SET);
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
     }
 
-    std::vector<char> buffer(kTransferBufferSize);
+    Pipeline::Throttle throttle;
+    Pipeline::Progress<AddProgress> progress;
+    Pipeline::Disk disk(sink, offset);
+    auto chain = Pipeline::Compose(throttle, progress, disk);
 
-    while (true)
+    uint64_t total = 0;
+    int result = 1;
+    bool trace = TransferTrace::Enabled();
+    uint64_t trace_offset = trace ? libssh2_sftp_tell64(handle) : 0;
+    uint64_t batch_start = trace ? Util::GetTick() : 0;
+    uint64_t started = Util::GetTick();
+
+    while (limit == 0 || total < limit)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
         {
             setResponse(lang_strings[STR_CANCEL_ACTION_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            // Leave partial file on disk so the user can see it.
-            return 0;
+            result = 0;
+            break;
         }
 
-        ssize_t rc = libssh2_sftp_read(handle, buffer.data(), buffer.size());
+        size_t to_read = buffer.size();
+        if (limit > 0 && limit - total < to_read)
+            to_read = (size_t)(limit - total);
+
+        ssize_t rc = libssh2_sftp_read(handle, buffer.data(), to_read);
+        if (rc == LIBSSH2_ERROR_EAGAIN)
+        {
+            waitSocket(100);
+            continue;
+        }
         if (rc < 0)
         {
             setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            return 0;
+            result = 0;
+            break;
         }
         if (rc == 0)
             break;
+        if (trace)
+        {
+            uint64_t now = Util::GetTick();
+            TransferTrace::Record(TransferTrace::TRACE_SFTP_READ, -1, batch_start, now, trace_offset + total, (uint64_t)rc, 1);
+            batch_start = now;
+        }
 
-        size_t written = fwrite(buffer.data(), 1, (size_t)rc, file);
-        if (written != (size_t)rc)
+        // Counts the bytes once they are in the disk block and books them
+        // against the rate limit.
+        if (!chain.Push(buffer.data(), (size_t)rc))
         {
             setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            return 0;
+            result = 0;
+            break;
         }
+        total += (uint64_t)rc;
+    }
+    if (result && !chain.Finish())
+    {
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        result = 0;
+    }
 
-        // Update global progress counter used by the GUI.
-        bytes_transfered += (int64_t)rc;
+    uint64_t elapsed = Util::GetTick() - started;
+    if (result && total >= kMinMeasureBytes && elapsed > 0)
+    {
+        std::lock_guard<std::mutex> lock(g_link_mutex);
+        g_link_kbps[conn_url] = (int64_t)(total * 1000000 / elapsed / 1024);
     }
+    if (result)
+        SocketTuning::ObserveRate(SocketTuning::HostOf(conn_url), total, elapsed);
 
-    fclose(file);
-    libssh2_sftp_close(handle);
-    setResponse(lang_strings[STR_DOWNLOADING]);
-    return 1;
+    if (done)
+        *done = total;
+    return result;
 }
 
-int SftpClient::GetSegment(const std::string &outputfile, const std::string &path, uint64_t offset, uint64_t length)
+int SftpClient::Get(const std::string &outputfile, const std::string &path, uint64_t offset)
 {
-    if (!connected || !sftp || length == 0)
+    if (!connected || !sftp)
         return 0;
 
+    // The size decides both the parallel path and the FAT32 split, so it is
+    // only fetched when either can apply.
+    int64_t size = -1;
+    bool may_split = force_fat32 || webdav_split_large;
+    if ((may_split || (offset == 0 && sftp_parallel_sessions > 1)) && !Size(path, &size))
+        size = -1;
+
+    // An older copy on the card is brought up to date in place when it is
+    // large enough for the hashing to pay off.
+    if (offset == 0 && sftp_delta_min_mb > 0 && exec_delta != 0)
+    {
+        int64_t local = FS::FileExists(outputfile) ? FS::GetSize(outputfile) : -1;
+        if (local >= (int64_t)sftp_delta_min_mb * 1048576 && (size >= 0 || Size(path, &size)) && size > 0 &&
+            !LocalFileSink::NeedsSplit((uint64_t)size))
+        {
+            int ret = deltaGet(outputfile, path, (uint64_t)size, (uint64_t)local);
+            if (ret >= 0)
+                return ret;
+        }
+    }
+
+    if (offset == 0 && sftp_parallel_sessions > 1 && size > 0)
+    {
+        uint64_t segment = (uint64_t)sftp_segment_mb * 1024 * 1024;
+        if ((uint64_t)size >= 2 * segment)
+            return getParallel(outputfile, path, (uint64_t)size);
+    }
+
     std::string full = getFullPath(path);
-    LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open_ex(
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
         sftp, full.c_str(), (unsigned int)full.size(),
-        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE);
+        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE); });
     if (!handle)
     {
         setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
         return 0;
     }
 
-    FILE *file = fopen(outputfile.c_str(), "r+b");
-    if (!file)
+    // Keep the existing bytes when resuming instead of truncating them.
+    bool split = size >= 0 && LocalFileSink::NeedsSplit((uint64_t)size);
+    LocalFileSink sink(outputfile, split ? LocalFileSink::kSplitPartSize : 0);
+    if (!sink.Open(offset > 0))
     {
-        libssh2_sftp_close(handle);
+        nb([&] { return libssh2_sftp_close(handle); });
         setResponse(lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
         return 0;
     }
 
-    setvbuf(file, nullptr, _IOFBF, kTransferBufferSize);
+    if (offset > 0)
+        libssh2_sftp_seek64(handle, offset);
 
-    libssh2_sftp_seek64(handle, offset);
-    fseeko(file, (off_t)offset, SEEK_SET);
+    int ok = pipelinedRead(handle, sink, offset, 0, nullptr);
+    nb([&] { return libssh2_sftp_close(handle); });
 
-    std::vector<char> buffer(kTransferBufferSize);
-    uint64_t remaining = length;
+    if (!ok)
+    {
+        // Leave partial file on disk so the user can see it (and resume).
+        sink.Close();
+        return 0;
+    }
 
-    while (remaining > 0)
+    if (!sink.Finish())
     {
-        if (stop_activity)
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
+    }
+    setResponse(lang_strings[STR_DOWNLOADING]);
+    return 1;
+}
+
+int SftpClient::getParallel(const std::string &outputfile, const std::string &path, uint64_t size)
+{
+    LocalFileSink sink(outputfile, LocalFileSink::NeedsSplit(size) ? LocalFileSink::kSplitPartSize : 0);
+    if (!sink.Open(false))
+    {
+        setResponse(lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
+        return 0;
+    }
+    // Reserve the file so every session can write its segment in place.
+    sink.Preallocate(size);
+
+    SftpParallelContext ctx;
+    ctx.sink = &sink;
+    ctx.path = path;
+    ctx.size = size;
+    ctx.segment = (uint64_t)sftp_segment_mb * 1024 * 1024;
+    ctx.statsSlot = TransferStats::CurrentWorker();
+
+    uint64_t segments = (size + ctx.segment - 1) / ctx.segment;
+    int extra = sftp_parallel_sessions - 1;
+    if ((uint64_t)extra >= segments)
+        extra = (int)segments - 1;
+
+    // Extra logins that fail are skipped; the download continues on the
+    // sessions that did connect.
+    std::vector<std::unique_ptr<SftpClient>> clients;
+    for (int i = 0; i < extra; ++i)
+    {
+        auto client = std::make_unique<SftpClient>();
+        if (!client->Connect(conn_url, conn_user, conn_pass))
         {
-            setResponse(lang_strings[STR_CANCEL_ACTION_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            return 0;
+            Logger::Logf(Logger::LOG_ERROR, "SFTP GET parallel session connect failed index=%d err=%s", i, client->LastResponse());
+            continue;
         }
+        clients.push_back(std::move(client));
+    }
 
-        size_t to_read = buffer.size();
-        if (remaining < to_read)
-            to_read = (size_t)remaining;
+    Logger::Logf("SFTP GET parallel path=%s size=%llu sessions=%d segment_mb=%d",
+                 path.c_str(),
+                 (unsigned long long)size,
+                 (int)clients.size() + 1,
+                 sftp_segment_mb);
 
-        ssize_t rc = libssh2_sftp_read(handle, buffer.data(), to_read);
-        if (rc < 0)
+    std::vector<Thread> threads(clients.size());
+    std::vector<SftpWorkerArgs> workerArgs(clients.size());
+    std::vector<bool> started(clients.size(), false);
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        workerArgs[i].ctx = &ctx;
+        workerArgs[i].client = clients[i].get();
+        Result rc = Threads::Create(&threads[i], SftpParallelWorkerThread, &workerArgs[i], 0x10000, Threads::ROLE_NETWORK, "sftp segment");
+        if (R_FAILED(rc))
         {
-            setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            return 0;
+            Logger::Logf(Logger::LOG_ERROR, "SFTP GET parallel threadCreate failed index=%d rc=0x%x", (int)i, rc);
+            continue;
         }
-        if (rc == 0)
-            break;
+        threadStart(&threads[i]);
+        started[i] = true;
+    }
 
-        size_t written = fwrite(buffer.data(), 1, (size_t)rc, file);
-        if (written != (size_t)rc)
-        {
-            setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            return 0;
-        }
+    // This session claims segments too instead of idling until the join.
+    SftpParallelWorker(&ctx, this);
 
-        remaining -= (uint64_t)rc;
-        bytes_transfered += (int64_t)rc;
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        if (!started[i])
+            continue;
+        Threads::Join(&threads[i]);
     }
+    clients.clear();
 
-    fclose(file);
-    libssh2_sftp_close(handle);
-    return remaining == 0 ? 1 : 0;
-}
-
-int SftpClient::GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset)
-{
-    if (!connected || !sftp || !buffer || size == 0)
+    if (ctx.hadError)
+    {
+        sink.Close();
+        setResponse(ctx.errorMessage.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "SFTP GET parallel error path=%s err=%s", path.c_str(), ctx.errorMessage.c_str());
         return 0;
+    }
 
-    std::string full = getFullPath(path);
-    LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open_ex(
-        sftp, full.c_str(), (unsigned int)full.size(),
-        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE);
-    if (!handle)
+    if (!sink.Finish())
+    {
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
         return 0;
+    }
+    setResponse(lang_strings[STR_DOWNLOADING]);
+    return 1;
+}
+
+int SftpClient::GetSegment(LocalFileSink &sink, const std::string &path, uint64_t offset, uint64_t length, uint64_t *done)
+{
+    if (done)
+        *done = 0;
+
+    if (!connected || !sftp || length == 0)
+        return 0;
+
+    std::string full = getFullPath(path);
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
+        sftp, full.c_str(), (unsigned int)full.size(),
+        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE); });
+    if (!handle)
+    {
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
+    }
 
     libssh2_sftp_seek64(handle, offset);
 
-    uint64_t remaining = size;
-    char *out = static_cast<char *>(buffer);
+    uint64_t got = 0;
+    int ok = pipelinedRead(handle, sink, offset, length, &got);
+    if (done)
+        *done = got;
 
-    while (remaining > 0)
+    nb([&] { return libssh2_sftp_close(handle); });
+    if (ok && got != length)
+    {
+        // The remote file ended before the segment did.
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        ok = 0;
+    }
+    return ok;
+}
+
+int SftpClient::BenchRead(const std::string &path, uint64_t bytes, int workers, int chunk_kb,
+                          const std::string &scratch)
+{
+    LocalFileSink sink(scratch);
+    if (!sink.Open(false))
+    {
+        setResponse(lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
+        return 0;
+    }
+    sink.Preallocate(bytes);
+    bench_window = (size_t)workers * (size_t)chunk_kb * 1024;
+    int ok = GetSegment(sink, path, 0, bytes);
+    bench_window = 0;
+    if (!sink.Close() && ok)
+    {
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        ok = 0;
+    }
+    return ok;
+}
+
+SftpClient::ReadHandle *SftpClient::readHandle(const std::string &full)
+{
+    uint64_t now = Util::GetTick();
+    for (size_t i = read_handles.size(); i-- > 0;)
+    {
+        if (read_handles[i].full == full)
+        {
+            read_handles[i].lastUse = now;
+            return &read_handles[i];
+        }
+    }
+
+    // Make room: the idle ones go, or else the least recently used.
+    for (size_t i = read_handles.size(); i-- > 0;)
+    {
+        if (now - read_handles[i].lastUse > kReadHandleIdleUs)
+        {
+            LIBSSH2_SFTP_HANDLE *handle = read_handles[i].handle;
+            nb([&] { return libssh2_sftp_close(handle); });
+            read_handles.erase(read_handles.begin() + i);
+        }
+    }
+    if (read_handles.size() >= kReadHandles)
     {
-        ssize_t rc = libssh2_sftp_read(handle, out, (size_t)remaining);
+        auto oldest = std::min_element(read_handles.begin(), read_handles.end(),
+                                       [](const ReadHandle &a, const ReadHandle &b)
+                                       { return a.lastUse < b.lastUse; });
+        LIBSSH2_SFTP_HANDLE *handle = oldest->handle;
+        nb([&] { return libssh2_sftp_close(handle); });
+        read_handles.erase(oldest);
+    }
+
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
+        sftp, full.c_str(), (unsigned int)full.size(),
+        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE); });
+    if (!handle)
+        return nullptr;
+
+    read_handles.emplace_back();
+    ReadHandle &entry = read_handles.back();
+    entry.full = full;
+    entry.handle = handle;
+    entry.lastUse = now;
+    return &entry;
+}
+
+void SftpClient::closeReadHandles(const std::string &full, bool tree)
+{
+    std::string prefix = full + "/";
+    for (size_t i = read_handles.size(); i-- > 0;)
+    {
+        const std::string &name = read_handles[i].full;
+        if (!full.empty() && name != full && !(tree && name.compare(0, prefix.size(), prefix) == 0))
+            continue;
+        LIBSSH2_SFTP_HANDLE *handle = read_handles[i].handle;
+        if (session != nullptr)
+            nb([&] { return libssh2_sftp_close(handle); });
+        read_handles.erase(read_handles.begin() + i);
+    }
+}
+
+size_t SftpClient::readFully(LIBSSH2_SFTP_HANDLE *handle, char *out, size_t size)
+{
+    size_t got = 0;
+    while (got < size)
+    {
+        ssize_t rc = nb([&] { return libssh2_sftp_read(handle, out + got, size - got); });
         if (rc <= 0)
             break;
-        remaining -= (uint64_t)rc;
-        out += rc;
+        got += (size_t)rc;
+        RateLimiter::Consume((size_t)rc);
     }
+    return got;
+}
 
-    libssh2_sftp_close(handle);
-    return remaining == 0 ? 1 : 0;
+int SftpClient::GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset)
+{
+    if (!connected || !sftp || !buffer || size == 0)
+        return 0;
+
+    std::string full = getFullPath(path);
+    ReadHandle *entry = readHandle(full);
+    if (entry == nullptr)
+        return 0;
+
+    char *out = static_cast<char *>(buffer);
+    uint64_t at = offset;
+    uint64_t remaining = size;
+    if (at >= entry->aheadOffset && at < entry->aheadOffset + entry->aheadLen)
+    {
+        size_t count = (size_t)std::min<uint64_t>(remaining, entry->aheadOffset + entry->aheadLen - at);
+        memcpy(out, entry->ahead.data() + (at - entry->aheadOffset), count);
+        out += count;
+        at += count;
+        remaining -= count;
+    }
+    bool sequential = offset == entry->lastEnd;
+    entry->lastEnd = offset + size;
+    if (remaining == 0)
+        return 1;
+
+    // libssh2 drops what it read ahead on a seek, so only seek away.
+    if (entry->pos != at)
+    {
+        libssh2_sftp_seek64(entry->handle, at);
+        entry->pos = at;
+    }
+
+    bool ok;
+    size_t ahead = (size_t)sftp_read_ahead_kb * 1024;
+    if (sequential && remaining < ahead)
+    {
+        entry->ahead.resize(ahead);
+        size_t got = readFully(entry->handle, entry->ahead.data(), ahead);
+        entry->pos += got;
+        entry->aheadOffset = at;
+        entry->aheadLen = got;
+        ok = got >= remaining;
+        if (ok)
+            memcpy(out, entry->ahead.data(), (size_t)remaining);
+    }
+    else
+    {
+        size_t got = readFully(entry->handle, out, (size_t)remaining);
+        entry->pos += got;
+        ok = got == remaining;
+    }
+
+    // A failed or short read leaves the handle in doubt.
+    if (!ok)
+        closeReadHandles(full, false);
+    return ok ? 1 : 0;
+}
+
+int SftpClient::pipelinedWrite(LIBSSH2_SFTP_HANDLE *handle, const RemoteSourceFn &source)
+{
+    // Like pipelinedRead, libssh2 splits one large non-blocking write into
+    // many SSH_FXP_WRITE requests and only waits for their ACKs as it goes,
+    // so a depth * request size buffer keeps that many writes outstanding.
+    size_t window = (size_t)sftp_pipeline_depth * (size_t)sftp_request_kb * 1024;
+    if (window < kTransferBufferSize)
+        window = kTransferBufferSize;
+
+    SftpUploadReader reader;
+    reader.source = &source;
+    if (!reader.buffers[0].Acquire(window) || !reader.buffers[1].Acquire(window))
+    {
+        setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
+        return 0;
+    }
+
+    Thread thread;
+    Result trc = Threads::Create(&thread, SftpUploadReaderThread, &reader, 0x4000, Threads::ROLE_DISK, "sftp put reader");
+    if (R_FAILED(trc))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "SFTP PUT reader threadCreate failed rc=0x%x", trc);
+        setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
+        return 0;
+    }
+    threadStart(&thread);
+
+    int result = 1;
+    for (int idx = 0; result; idx ^= 1)
+    {
+        size_t count = 0;
+        {
+            std::unique_lock<std::mutex> lock(reader.mutex);
+            while (!reader.full[idx] && !Cancel::Stopped())
+                reader.cv.wait_for(lock, std::chrono::milliseconds(100));
+            if (Cancel::Stopped())
+            {
+                setResponse(lang_strings[STR_CANCEL_ACTION_MSG]);
+                result = 0;
+                break;
+            }
+            if (reader.readError)
+            {
+                setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
+                result = 0;
+                break;
+            }
+            count = reader.sizes[idx];
+        }
+        if (count == 0)
+            break;
+
+        const char *ptr = reader.buffers[idx].data();
+        size_t left = count;
+        while (left > 0)
+        {
+            if (Cancel::Stopped())
+            {
+                setResponse(lang_strings[STR_CANCEL_ACTION_MSG]);
+                result = 0;
+                break;
+            }
+
+            ssize_t written = libssh2_sftp_write(handle, ptr, left);
+            if (written == LIBSSH2_ERROR_EAGAIN)
+            {
+                waitSocket(100);
+                continue;
+            }
+            if (written < 0)
+            {
+                setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
+                result = 0;
+                break;
+            }
+            ptr += written;
+            RateLimiter::Consume((size_t)written);
+            left -= (size_t)written;
+            AddProgress((int64_t)written);
+        }
+
+        std::lock_guard<std::mutex> lock(reader.mutex);
+        reader.full[idx] = false;
+        reader.cv.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reader.mutex);
+        reader.stop = true;
+        reader.cv.notify_all();
+    }
+    Threads::Join(&thread);
+    return result;
 }
 
 int SftpClient::Put(const std::string &inputfile, const std::string &path, uint64_t offset)
@@ -784,13 +1375,20 @@ int SftpClient::Put(const std::string &inputfile, const std::string &path, uint6
         return 0;
     }
 
+    // Resuming keeps the bytes already on the server; only a fresh upload
+    // truncates the remote file.
+    unsigned long flags = LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT;
+    if (offset == 0)
+        flags |= LIBSSH2_FXF_TRUNC;
+
     std::string full = getFullPath(path);
-    LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open_ex(
+    forgetAttrs(full, false);
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
         sftp, full.c_str(), (unsigned int)full.size(),
-        LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
+        flags,
         LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
         LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH,
-        LIBSSH2_SFTP_OPENFILE);
+        LIBSSH2_SFTP_OPENFILE); });
     if (!handle)
     {
         fclose(file);
@@ -804,54 +1402,117 @@ int SftpClient::Put(const std::string &inputfile, const std::string &path, uint6
         fseeko(file, (off_t)offset, SEEK_SET);
     }
 
-    std::vector<char> buffer(kTransferBufferSize);
+    RemoteSourceFn source = [file](char *buffer, size_t size) -> int64_t
+    {
+        size_t count = fread(buffer, 1, size, file);
+        if (count == 0 && ferror(file))
+            return -1;
+        return (int64_t)count;
+    };
+    int ok = pipelinedWrite(handle, source);
 
-    while (true)
+    fclose(file);
+    nb([&] { return libssh2_sftp_close(handle); });
+    if (!ok)
+        return 0;
+
+    setResponse(lang_strings[STR_UPLOADING]);
+    return 1;
+}
+
+int SftpClient::PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source)
+{
+    if (!connected || !sftp)
+        return 0;
+
+    std::string full = getFullPath(path);
+    forgetAttrs(full, false);
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
+        sftp, full.c_str(), (unsigned int)full.size(),
+        LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
+        LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
+        LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH,
+        LIBSSH2_SFTP_OPENFILE); });
+    if (!handle)
+    {
+        setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
+        return 0;
+    }
+
+    int ok = pipelinedWrite(handle, source);
+    nb([&] { return libssh2_sftp_close(handle); });
+    if (!ok)
+        return 0;
+
+    setResponse(lang_strings[STR_UPLOADING]);
+    return 1;
+}
+
+int SftpClient::GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data)
+{
+    if (!connected || !sftp)
+        return 0;
+
+    std::string full = getFullPath(path);
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
+        sftp, full.c_str(), (unsigned int)full.size(),
+        LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE); });
+    if (!handle)
+    {
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
+    }
+
+    // One handle read with a pipeline-sized buffer, as in pipelinedRead,
+    // instead of the default's open/read/close per block. Progress is
+    // left to the caller, which counts what it forwards.
+    size_t window = (size_t)sftp_pipeline_depth * (size_t)sftp_request_kb * 1024;
+    if (window < kTransferBufferSize)
+        window = kTransferBufferSize;
+    TransferBuffer buffer(window);
+    if (!buffer)
+    {
+        nb([&] { return libssh2_sftp_close(handle); });
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
+    }
+
+    int result = 1;
+    uint64_t total = 0;
+    while (total < size)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
         {
             setResponse(lang_strings[STR_CANCEL_ACTION_MSG]);
-            fclose(file);
-            libssh2_sftp_close(handle);
-            return 0;
+            result = 0;
+            break;
         }
 
-        size_t read_count = fread(buffer.data(), 1, buffer.size(), file);
-        if (read_count == 0)
+        size_t to_read = buffer.size();
+        if (size - total < to_read)
+            to_read = (size_t)(size - total);
+        ssize_t rc = libssh2_sftp_read(handle, buffer.data(), to_read);
+        if (rc == LIBSSH2_ERROR_EAGAIN)
         {
-            if (ferror(file))
-            {
-                setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
-                fclose(file);
-                libssh2_sftp_close(handle);
-                return 0;
-            }
+            waitSocket(100);
+            continue;
+        }
+        if (rc <= 0)
+        {
+            setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+            result = 0;
             break;
         }
-
-        char *ptr = buffer.data();
-        size_t left = read_count;
-
-        while (left > 0)
+        if (!on_data(buffer.data(), (size_t)rc))
         {
-            ssize_t written = libssh2_sftp_write(handle, ptr, left);
-            if (written < 0)
-            {
-                setResponse(lang_strings[STR_FAIL_UPLOAD_MSG]);
-                fclose(file);
-                libssh2_sftp_close(handle);
-                return 0;
-            }
-            ptr += written;
-            left -= (size_t)written;
-            bytes_transfered += (int64_t)written;
+            result = 0;
+            break;
         }
+        total += (uint64_t)rc;
+        RateLimiter::Consume((size_t)rc);
     }
-
-    fclose(file);
-    libssh2_sftp_close(handle);
-    setResponse(lang_strings[STR_UPLOADING]);
-    return 1;
+    nb([&] { return libssh2_sftp_close(handle); });
+    return result;
 }
 
 int SftpClient::Rename(const std::string &src, const std::string &dst)
@@ -861,13 +1522,15 @@ int SftpClient::Rename(const std::string &src, const std::string &dst)
 
     std::string full_src = getFullPath(src);
     std::string full_dst = getFullPath(dst);
-
-    int rc = libssh2_sftp_rename_ex(sftp,
-                                    full_src.c_str(), (unsigned int)full_src.size(),
-                                    full_dst.c_str(), (unsigned int)full_dst.size(),
-                                    LIBSSH2_SFTP_RENAME_OVERWRITE |
-                                    LIBSSH2_SFTP_RENAME_ATOMIC |
-                                    LIBSSH2_SFTP_RENAME_NATIVE);
+    forgetAttrs(full_src, true);
+    forgetAttrs(full_dst, true);
+
+    int rc = nb([&] { return libssh2_sftp_rename_ex(sftp,
+                                                     full_src.c_str(), (unsigned int)full_src.size(),
+                                                     full_dst.c_str(), (unsigned int)full_dst.size(),
+                                                     LIBSSH2_SFTP_RENAME_OVERWRITE |
+                                                     LIBSSH2_SFTP_RENAME_ATOMIC |
+                                                     LIBSSH2_SFTP_RENAME_NATIVE); });
     if (rc == 0)
         return 1;
 
@@ -881,7 +1544,8 @@ int SftpClient::Delete(const std::string &path)
         return 0;
 
     std::string full = getFullPath(path);
-    int rc = libssh2_sftp_unlink_ex(sftp, full.c_str(), (unsigned int)full.size());
+    forgetAttrs(full, false);
+    int rc = nb([&] { return libssh2_sftp_unlink_ex(sftp, full.c_str(), (unsigned int)full.size()); });
     if (rc == 0)
         return 1;
 
@@ -889,10 +1553,427 @@ int SftpClient::Delete(const std::string &path)
     return 0;
 }
 
+static std::string ShellQuote(const std::string &arg)
+{
+    std::string out = "'";
+    for (char c : arg)
+    {
+        if (c == '\'')
+            out += "'\\''";
+        else
+            out += c;
+    }
+    out += "'";
+    return out;
+}
+
+int SftpClient::execCopy(const std::string &from, const std::string &to, bool recursive)
+{
+    if (!connected || !session || exec_copy == 0)
+    {
+        setResponse(lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+        return -1;
+    }
+
+    forgetAttrs(getFullPath(to), true);
+    std::string cmd = std::string("cp -p") + (recursive ? " -R" : "") + " -- " +
+                      ShellQuote(getFullPath(from)) + " " + ShellQuote(getFullPath(to));
+    LIBSSH2_CHANNEL *channel = nbHandle([&] { return libssh2_channel_open_session(session); });
+    if (!channel)
+    {
+        Logger::Logf("SFTP copy no exec channel err=%d", libssh2_session_last_errno(session));
+        exec_copy = 0;
+        setResponse(lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+        return -1;
+    }
+    if (nb([&] { return libssh2_channel_exec(channel, cmd.c_str()); }) != 0)
+    {
+        Logger::Logf("SFTP copy exec refused err=%d", libssh2_session_last_errno(session));
+        nb([&] { return libssh2_channel_free(channel); });
+        exec_copy = 0;
+        setResponse(lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+        return -1;
+    }
+    nb([&] { return libssh2_channel_send_eof(channel); });
+
+    // cp prints nothing on success; keep the first error line.
+    std::string errors;
+    char buf[256];
+    ssize_t rc;
+    while ((rc = nb([&] { return libssh2_channel_read(channel, buf, sizeof(buf)); })) > 0)
+    {
+    }
+    while ((rc = nb([&] { return libssh2_channel_read_stderr(channel, buf, sizeof(buf)); })) > 0)
+    {
+        if (errors.size() < sizeof(response) - 1)
+            errors.append(buf, (size_t)rc);
+    }
+    nb([&] { return libssh2_channel_close(channel); });
+    nb([&] { return libssh2_channel_wait_closed(channel); });
+    int status = libssh2_channel_get_exit_status(channel);
+    nb([&] { return libssh2_channel_free(channel); });
+
+    // 126/127: no cp, or a restricted shell that may not run it.
+    if (status == 126 || status == 127)
+    {
+        Logger::Logf("SFTP copy unavailable status=%d", status);
+        exec_copy = 0;
+        setResponse(lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+        return -1;
+    }
+    if (status != 0)
+    {
+        size_t eol = errors.find('\n');
+        if (eol != std::string::npos)
+            errors.resize(eol);
+        Logger::Logf(Logger::LOG_ERROR, "SFTP copy failed from=%s to=%s status=%d err=%s",
+                     from.c_str(), to.c_str(), status, errors.c_str());
+        setResponse(errors.empty() ? lang_strings[STR_FAIL_COPY_MSG] : errors.c_str());
+        return 0;
+    }
+    // A ForceCommand internal-sftp account runs the SFTP server instead of
+    // the command, which then exits cleanly on our EOF; only the copy
+    // showing up proves cp ran.
+    if (exec_copy < 0 && !FileExists(to))
+    {
+        Logger::Logf("SFTP copy exec ignored by server");
+        exec_copy = 0;
+        setResponse(lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
+        return -1;
+    }
+    exec_copy = 1;
+    return 1;
+}
+
 int SftpClient::Copy(const std::string &from, const std::string &to)
 {
-    setResponse(lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
-    return 0;
+    return execCopy(from, to, false);
+}
+
+int SftpClient::CopyTree(const std::string &from, const std::string &to)
+{
+    return execCopy(from, to, true);
+}
+
+int SftpClient::Search(const std::string &path, const std::string &query, const DirEntryBatchFn &on_batch)
+{
+    static const size_t kListBatchSize = 64;
+    static const char *kMarker = "neo_sftp find";
+
+    if (!connected || !session || exec_search == 0)
+        return -1;
+
+    // -iname takes a glob; the query is matched literally.
+    std::string pattern = "*";
+    for (char c : query)
+    {
+        if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')
+            pattern += '\\';
+        pattern += c;
+    }
+    pattern += "*";
+    std::string root = getFullPath(path);
+    // The marker proves a shell ran the command: a ForceCommand
+    // internal-sftp account would answer with nothing at all.
+    std::string cmd = std::string("echo '") + kMarker + "' && find " + ShellQuote(root) + " -mindepth 1 -iname " +
+                      ShellQuote(pattern) + " -printf '%y %s %T@ %p\\n'";
+    LIBSSH2_CHANNEL *channel = nbHandle([&] { return libssh2_channel_open_session(session); });
+    if (!channel)
+    {
+        Logger::Logf("SFTP search no exec channel err=%d", libssh2_session_last_errno(session));
+        exec_search = 0;
+        return -1;
+    }
+    if (nb([&] { return libssh2_channel_exec(channel, cmd.c_str()); }) != 0)
+    {
+        Logger::Logf("SFTP search exec refused err=%d", libssh2_session_last_errno(session));
+        nb([&] { return libssh2_channel_free(channel); });
+        exec_search = 0;
+        return -1;
+    }
+    nb([&] { return libssh2_channel_send_eof(channel); });
+
+    uint64_t started = Util::GetTick();
+    std::string prefix = base_path.empty() ? "" : "/" + base_path;
+    std::string pending;
+    std::vector<DirEntry> out;
+    size_t total = 0;
+    bool marked = false;
+    bool stopped = false;
+    char buf[4096];
+    ssize_t rc;
+    while (!stopped && (rc = nb([&] { return libssh2_channel_read(channel, buf, sizeof(buf)); })) > 0)
+    {
+        pending.append(buf, (size_t)rc);
+        size_t start = 0;
+        size_t eol;
+        while (!stopped && (eol = pending.find('\n', start)) != std::string::npos)
+        {
+            std::string line = pending.substr(start, eol - start);
+            start = eol + 1;
+            if (!marked)
+            {
+                marked = line == kMarker;
+                continue;
+            }
+            // "<type> <size> <epoch.frac> <path>"
+            char type;
+            unsigned long long size;
+            double mtime;
+            int consumed = 0;
+            if (sscanf(line.c_str(), "%c %llu %lf %n", &type, &size, &mtime, &consumed) != 3 || consumed <= 0)
+                continue;
+            std::string full = line.substr((size_t)consumed);
+            if (!prefix.empty())
+            {
+                if (full.compare(0, prefix.size(), prefix) != 0)
+                    continue;
+                full.erase(0, prefix.size());
+            }
+            size_t slash = full.find_last_of('/');
+            if (slash == std::string::npos)
+                continue;
+
+            DirEntry e;
+            memset(&e, 0, sizeof(e));
+            snprintf(e.directory, sizeof(e.directory), "%s", slash == 0 ? "/" : full.substr(0, slash).c_str());
+            snprintf(e.name, sizeof(e.name), "%s", full.substr(slash + 1).c_str());
+            snprintf(e.path, sizeof(e.path), "%s", full.c_str());
+            e.isDir = type == 'd';
+            e.isLink = type == 'l';
+            e.selectable = true;
+            e.file_size = e.isDir ? 0 : size;
+            time_t t = (time_t)mtime;
+            struct tm tm;
+            gmtime_r(&t, &tm);
+            e.modified.year = tm.tm_year + 1900;
+            e.modified.month = tm.tm_mon + 1;
+            e.modified.day = tm.tm_mday;
+            e.modified.hours = tm.tm_hour;
+            e.modified.minutes = tm.tm_min;
+            e.modified.seconds = tm.tm_sec;
+            if (e.isDir)
+                snprintf(e.display_size, sizeof(e.display_size), "%s", lang_strings[STR_FOLDER]);
+            else
+                DirEntry::SetDisplaySize(&e);
+            out.push_back(e);
+            total++;
+            if (out.size() >= kListBatchSize)
+            {
+                stopped = !on_batch(out);
+                out.clear();
+            }
+        }
+        pending.erase(0, start);
+    }
+
+    std::string errors;
+    while ((rc = nb([&] { return libssh2_channel_read_stderr(channel, buf, sizeof(buf)); })) > 0)
+    {
+        if (errors.size() < 256)
+            errors.append(buf, (size_t)rc);
+    }
+    nb([&] { return libssh2_channel_close(channel); });
+    nb([&] { return libssh2_channel_wait_closed(channel); });
+    int status = libssh2_channel_get_exit_status(channel);
+    nb([&] { return libssh2_channel_free(channel); });
+    if (stopped)
+        return 0;
+
+    size_t eol = errors.find('\n');
+    if (eol != std::string::npos)
+        errors.resize(eol);
+    // 126/127: no find, or a restricted shell; a find without -printf
+    // (busybox, BSD) complains and lists nothing.
+    if (!marked || status == 126 || status == 127 || (total == 0 && errors.find("printf") != std::string::npos))
+    {
+        Logger::Logf("SFTP search unavailable status=%d marked=%d err=%s", status, marked ? 1 : 0, errors.c_str());
+        exec_search = 0;
+        return -1;
+    }
+    // Unreadable folders make find exit 1 after listing the rest.
+    if (status != 0 && total == 0)
+    {
+        Logger::Logf(Logger::LOG_WARN, "SFTP search failed path=%s status=%d err=%s", root.c_str(), status,
+                     errors.c_str());
+        return -1;
+    }
+    exec_search = 1;
+    if (!out.empty() && !on_batch(out))
+        return 0;
+    Logger::Logf("SFTP search path=%s query=%s entries=%zu status=%d ms=%llu", root.c_str(), query.c_str(), total,
+                 status, (unsigned long long)((Util::GetTick() - started) / 1000));
+    return 1;
+}
+
+int SftpClient::execOutput(const std::string &cmd, std::string &out)
+{
+    LIBSSH2_CHANNEL *channel = nbHandle([&] { return libssh2_channel_open_session(session); });
+    if (!channel)
+        return -1;
+    if (nb([&] { return libssh2_channel_exec(channel, cmd.c_str()); }) != 0)
+    {
+        nb([&] { return libssh2_channel_free(channel); });
+        return -1;
+    }
+    nb([&] { return libssh2_channel_send_eof(channel); });
+
+    char buf[4096];
+    ssize_t rc;
+    while (!Cancel::Stopped() && (rc = nb([&] { return libssh2_channel_read(channel, buf, sizeof(buf)); })) > 0)
+        out.append(buf, (size_t)rc);
+    while (!Cancel::Stopped() && (rc = nb([&] { return libssh2_channel_read_stderr(channel, buf, sizeof(buf)); })) > 0)
+    {
+    }
+    nb([&] { return libssh2_channel_close(channel); });
+    nb([&] { return libssh2_channel_wait_closed(channel); });
+    int status = libssh2_channel_get_exit_status(channel);
+    nb([&] { return libssh2_channel_free(channel); });
+    return status;
+}
+
+int SftpClient::deltaGet(const std::string &outputfile, const std::string &path, uint64_t size, uint64_t local)
+{
+    static const char *kMarker = "neo_sftp delta";
+
+    if (!connected || !session)
+        return -1;
+
+    uint64_t started = Util::GetTick();
+    std::string file = ShellQuote(getFullPath(path));
+    uint64_t block = (uint64_t)sftp_delta_block_kb * 1024;
+    uint64_t blocks = (size + block - 1) / block;
+
+    // Hashes both copies at once; -1 when the host cannot, 0 on a local
+    // read error or cancel. The marker proves a shell ran the command, as
+    // for Search().
+    auto hashBoth = [&](SftpLocalHasher &hasher, const std::string &cmd, std::vector<std::string> &remote) -> int
+    {
+        Thread thread;
+        bool threaded = R_SUCCEEDED(Threads::Create(&thread, SftpLocalHashThread, &hasher, 0x10000,
+                                                    Threads::ROLE_DISK, "sftp delta hash"));
+        if (threaded)
+            threadStart(&thread);
+        std::string out;
+        int status = execOutput(std::string("echo '") + kMarker + "' && " + cmd, out);
+        if (threaded)
+            Threads::Join(&thread);
+        else
+            SftpLocalHashThread(&hasher);
+
+        std::vector<std::string> lines;
+        for (size_t start = 0, eol; (eol = out.find('\n', start)) != std::string::npos; start = eol + 1)
+            lines.push_back(out.substr(start, eol - start));
+        if (status < 0 || status == 126 || status == 127 || lines.empty() || lines[0] != kMarker)
+        {
+            if (!Cancel::Stopped())
+            {
+                Logger::Logf("SFTP delta unavailable status=%d", status);
+                exec_delta = 0;
+            }
+            return Cancel::Stopped() ? 0 : -1;
+        }
+        if (status != 0 || !hasher.ok)
+        {
+            if (!Cancel::Stopped())
+                Logger::Logf(Logger::LOG_WARN, "SFTP delta hashing failed path=%s status=%d local_ok=%d", path.c_str(),
+                             status, hasher.ok ? 1 : 0);
+            return Cancel::Stopped() ? 0 : -1;
+        }
+        exec_delta = 1;
+        // "<md5>  -" per hashed piece.
+        for (size_t i = 1; i < lines.size(); i++)
+            remote.push_back(lines[i].substr(0, lines[i].find(' ')));
+        return 1;
+    };
+
+    // Fetched runs, as offset and length.
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    const char *mode = "append";
+    int ret = -1;
+    if (size >= local)
+    {
+        SftpLocalHasher hasher;
+        hasher.path = outputfile;
+        hasher.size = local;
+        std::vector<std::string> remote;
+        ret = hashBoth(hasher, "head -c " + std::to_string(local) + " -- " + file + " | md5sum", remote);
+        if (ret == 1 && remote.size() == 1 && hasher.sums.size() == 1 && remote[0] == hasher.sums[0])
+        {
+            if (size > local)
+                runs.push_back({local, size - local});
+        }
+        else if (ret == 1)
+            ret = -1;
+    }
+    if (ret < 0 && exec_delta != 0)
+    {
+        mode = "blocks";
+        SftpLocalHasher hasher;
+        hasher.path = outputfile;
+        hasher.size = local;
+        hasher.block = block;
+        std::vector<std::string> remote;
+        std::string cmd = "f=" + file + "; i=0; while [ $i -lt " + std::to_string(blocks) + " ]; do dd if=\"$f\" bs=" +
+                          std::to_string(block) + " skip=$i count=1 2>/dev/null | md5sum || exit 1; i=$((i+1)); done";
+        ret = hashBoth(hasher, cmd, remote);
+        if (ret == 1 && remote.size() != blocks)
+        {
+            // The file changed while it was hashed.
+            Logger::Logf(Logger::LOG_WARN, "SFTP delta block count path=%s want=%llu got=%zu", path.c_str(),
+                         (unsigned long long)blocks, remote.size());
+            ret = -1;
+        }
+        for (uint64_t i = 0; ret == 1 && i < blocks; i++)
+        {
+            if (i < hasher.sums.size() && hasher.sums[i] == remote[i])
+                continue;
+            uint64_t start = i * block;
+            uint64_t len = std::min(block, size - start);
+            if (!runs.empty() && runs.back().first + runs.back().second == start)
+                runs.back().second += len;
+            else
+                runs.push_back({start, len});
+        }
+    }
+    if (ret <= 0)
+    {
+        if (ret == 0)
+            setResponse(lang_strings[Cancel::Stopped() ? STR_CANCEL_ACTION_MSG : STR_FAIL_DOWNLOAD_MSG]);
+        return ret;
+    }
+
+    LocalFileSink sink(outputfile, 0);
+    if (!sink.Open(true))
+    {
+        setResponse(lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG]);
+        return 0;
+    }
+    uint64_t fetched = 0;
+    for (const auto &run : runs)
+    {
+        uint64_t done = 0;
+        int ok = GetSegment(sink, path, run.first, run.second, &done);
+        fetched += done;
+        if (!ok)
+        {
+            sink.Close();
+            return 0;
+        }
+    }
+    if (!sink.Finish() || (local > size && truncate(outputfile.c_str(), (off_t)size) != 0))
+    {
+        setResponse(lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        return 0;
+    }
+    // The bytes kept count as done for the progress bar, not the speed.
+    bytes_transfered += (int64_t)(size - fetched);
+
+    Logger::Logf("SFTP delta path=%s mode=%s size=%llu local=%llu runs=%zu fetched=%llu ms=%llu", path.c_str(), mode,
+                 (unsigned long long)size, (unsigned long long)local, runs.size(), (unsigned long long)fetched,
+                 (unsigned long long)((Util::GetTick() - started) / 1000));
+    setResponse(lang_strings[STR_DOWNLOADING]);
+    return 1;
 }
 
 int SftpClient::Move(const std::string &from, const std::string &to)
@@ -918,22 +1999,32 @@ std::vector<DirEntry> SftpClient::ListDir(const std::string &path)
     out.push_back(entry);
 
     std::string full = getFullPath(path);
-    LIBSSH2_SFTP_HANDLE *dir = libssh2_sftp_opendir(sftp, full.c_str());
+    LIBSSH2_SFTP_HANDLE *dir = nbHandle([&] { return libssh2_sftp_opendir(sftp, full.c_str()); });
     if (!dir)
         return out;
 
+    // libssh2 fetches names a READDIR reply at a time (as many as the
+    // server packs in); their attributes are kept for Size()/FileExists().
+    bool cache = sftp_attr_cache_secs > 0;
+    bool complete = false;
+    std::vector<std::pair<std::string, SftpCachedAttrs>> listed;
+    uint64_t now = Util::GetTick();
+
     while (true)
     {
         char filename[512];
         LIBSSH2_SFTP_ATTRIBUTES attrs;
-        int rc = libssh2_sftp_readdir_ex(
+        int rc = nb([&] { return libssh2_sftp_readdir_ex(
             dir,
             filename, sizeof(filename),
             nullptr, 0,
-            &attrs);
+            &attrs); });
 
         if (rc <= 0)
+        {
+            complete = rc == 0;
             break;
+        }
 
         if (filename[0] == '\0' || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
             continue;
@@ -965,13 +2056,37 @@ std::vector<DirEntry> SftpClient::ListDir(const std::string &path)
         if (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE)
             e.file_size = (uint64_t)attrs.filesize;
 
+        if (cache)
+        {
+            // readdir reports a symlink itself, not what it points to.
+            bool link = (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && LIBSSH2_SFTP_S_ISLNK(attrs.permissions);
+            bool sized = (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) && !link;
+            listed.push_back({full.empty() ? std::string(filename) : full + "/" + filename,
+                              {sized ? (int64_t)attrs.filesize : 0, !sized, now}});
+        }
+
         DirEntry::SetDisplaySize(&e);
         snprintf(e.display_date, sizeof(e.display_date), "%s", "");
 
         out.push_back(e);
     }
 
-    libssh2_sftp_closedir(dir);
+    nb([&] { return libssh2_sftp_closedir(dir); });
+
+    if (cache)
+    {
+        std::lock_guard<std::mutex> lock(g_attr_mutex);
+        if (g_attr_cache.size() + listed.size() > kMaxCachedAttrs)
+        {
+            g_attr_cache.clear();
+            g_listed_dirs.clear();
+        }
+        for (const auto &item : listed)
+            g_attr_cache[attrKey(item.first)] = item.second;
+        if (complete)
+            g_listed_dirs[attrKey(full)] = now;
+    }
+
     DirEntry::Sort(out);
     return out;
 }
@@ -1004,10 +2119,11 @@ int SftpClient::GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset)
 
     while (remaining > 0)
     {
-        ssize_t rc = libssh2_sftp_read(handle, out, (size_t)remaining);
+        ssize_t rc = nb([&] { return libssh2_sftp_read(handle, out, (size_t)remaining); });
         if (rc <= 0)
             break;
         remaining -= (uint64_t)rc;
+        RateLimiter::Consume((size_t)rc);
         out += rc;
     }
 
@@ -1034,11 +2150,11 @@ void *SftpClient::Open(const std::string &path, int flags)
                LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH;
     }
 
-    LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open_ex(
+    LIBSSH2_SFTP_HANDLE *handle = nbHandle([&] { return libssh2_sftp_open_ex(
         sftp, full.c_str(), (unsigned int)full.size(),
         open_flags,
         mode,
-        LIBSSH2_SFTP_OPENFILE);
+        LIBSSH2_SFTP_OPENFILE); });
 
     return handle;
 }
@@ -1049,7 +2165,7 @@ void SftpClient::Close(void *fp)
         return;
 
     LIBSSH2_SFTP_HANDLE *handle = static_cast<LIBSSH2_SFTP_HANDLE *>(fp);
-    libssh2_sftp_close(handle);
+    nb([&] { return libssh2_sftp_close(handle); });
 }
 
 bool SftpClient::IsConnected()
@@ -1062,6 +2178,34 @@ bool SftpClient::Ping()
     return connected;
 }
 
+int64_t SftpClient::KeepAlive(uint64_t interval_us)
+{
+    if (!connected || session == nullptr)
+        return 0;
+    // Idle since the last preview, so nothing reads through them now.
+    uint64_t now = Util::GetTick();
+    for (size_t i = read_handles.size(); i-- > 0;)
+    {
+        if (now - read_handles[i].lastUse > kReadHandleIdleUs)
+        {
+            std::string full = read_handles[i].full;
+            closeReadHandles(full, false);
+        }
+    }
+    // libssh2 counts from the last packet it sent and only sends a
+    // keepalive once the interval set in Connect() has passed.
+    int next_s = 0;
+    int rc = libssh2_keepalive_send(session, &next_s);
+    if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN)
+    {
+        char *errmsg = nullptr;
+        libssh2_session_last_error(session, &errmsg, nullptr, 0);
+        Logger::Logf(Logger::LOG_WARN, "SFTP keep-alive failed rc=%d err=%s", rc, errmsg ? errmsg : "");
+        return 0;
+    }
+    return (int64_t)MAX(next_s, 1) * 1000000;
+}
+
 const char *SftpClient::LastResponse()
 {
     return response;
@@ -1072,8 +2216,13 @@ int SftpClient::Quit()
     if (!connected)
         return 1;
 
+    // A short blocking goodbye rather than polling it out.
+    if (session)
+        libssh2_session_set_blocking(session, 1);
+
     if (sftp)
     {
+        closeReadHandles("", true);
         libssh2_sftp_shutdown(sftp);
         sftp = nullptr;
     }
@@ -1102,5 +2251,5 @@ ClientType SftpClient::clientType()
 
 uint32_t SftpClient::SupportedActions()
 {
-    return REMOTE_ACTION_ALL ^ REMOTE_ACTION_CUT ^ REMOTE_ACTION_COPY ^ REMOTE_ACTION_PASTE ^ REMOTE_ACTION_RAW_READ;
+    return REMOTE_ACTION_ALL ^ REMOTE_ACTION_RAW_READ;
 }
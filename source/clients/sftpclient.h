@@ -1,6 +1,7 @@
 #ifndef SFTPCLIENT_H
 #define SFTPCLIENT_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <libssh2.h>
@@ -9,6 +10,8 @@
 #include "clients/remote_client.h"
 #include "common.h"
 
+class LocalFileSink;
+
 class SftpClient : public RemoteClient
 {
 public:
@@ -21,22 +24,33 @@ public:
     int Size(const std::string &path, int64_t *size) override;
     int Get(const std::string &outputfile, const std::string &path, uint64_t offset = 0) override;
     // Download a specific byte range [offset, offset+length) of a remote file into
-    // the given local file. The local file must already exist and be large enough.
-    int GetSegment(const std::string &outputfile, const std::string &path, uint64_t offset, uint64_t length);
+    // the given local sink, which several sessions may share.
+    // When `done` is set it receives the bytes written, even on failure.
+    int GetSegment(LocalFileSink &sink, const std::string &path, uint64_t offset, uint64_t length, uint64_t *done = nullptr);
     int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset) override;
+    // One GetSegment() of `bytes` with a pipeline of `workers` reads of
+    // `chunk_kb`, in place of sftp_pipeline_depth and request_kb.
+    int BenchRead(const std::string &path, uint64_t bytes, int workers, int chunk_kb,
+                  const std::string &scratch) override;
     int Put(const std::string &inputfile, const std::string &path, uint64_t offset = 0) override;
+    int PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source) override;
+    int GetStream(const std::string &path, uint64_t size, const RemoteStreamFn &on_data) override;
     int Rename(const std::string &src, const std::string &dst) override;
     int Delete(const std::string &path) override;
     int Copy(const std::string &from, const std::string &to) override;
+    int CopyTree(const std::string &from, const std::string &to) override;
     int Move(const std::string &from, const std::string &to) override;
     bool FileExists(const std::string &path) override;
     std::vector<DirEntry> ListDir(const std::string &path) override;
+    // Runs `find -iname` on the host over an exec channel.
+    int Search(const std::string &path, const std::string &query, const DirEntryBatchFn &on_batch) override;
     std::string GetPath(std::string path1, std::string path2) override;
     int GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset) override;
     void *Open(const std::string &path, int flags) override;
     void Close(void *fp) override;
     bool IsConnected() override;
     bool Ping() override;
+    int64_t KeepAlive(uint64_t interval_us) override;
     const char *LastResponse() override;
     int Quit() override;
     ClientType clientType() override;
@@ -49,9 +63,99 @@ private:
     bool connected;
     char response[512];
     std::string base_path;
+    // Kept from the last successful Connect so parallel downloads can open
+    // extra sessions to the same server.
+    std::string conn_url;
+    std::string conn_user;
+    std::string conn_pass;
+    // Whether `cp` runs over an exec channel: -1 untried, 0 not, 1 yes.
+    int exec_copy = -1;
+    // Whether GNU `find` runs over an exec channel, as exec_copy.
+    int exec_search = -1;
+    // Whether `md5sum` runs over an exec channel for delta updates, as
+    // exec_copy.
+    int exec_delta = -1;
+    // Read window of a BenchRead(), 0 otherwise.
+    size_t bench_window = 0;
+
+    // Read handles GetRange(path) keeps open between calls, so previews and
+    // zip browsing cost one READ per range instead of OPEN, READ and CLOSE.
+    // `ahead` holds [SFTP] read_ahead_kb fetched past a read that carried
+    // on where the previous one ended.
+    struct ReadHandle
+    {
+        std::string full;
+        LIBSSH2_SFTP_HANDLE *handle = nullptr;
+        // Where the handle reads next, and where the last range ended.
+        uint64_t pos = 0;
+        uint64_t lastEnd = UINT64_MAX;
+        std::vector<char> ahead;
+        uint64_t aheadOffset = 0;
+        size_t aheadLen = 0;
+        uint64_t lastUse = 0;
+    };
+    static const size_t kReadHandles = 4;
+    // Closed when unused this long, so the server does not keep the files
+    // open (and, on Windows hosts, locked) after a preview.
+    static const uint64_t kReadHandleIdleUs = 30ULL * 1000000;
+    std::vector<ReadHandle> read_handles;
 
     std::string getFullPath(const std::string &path) const;
     void setResponse(const char *msg);
+    bool waitSocket(int timeout_ms);
+    // The session is non-blocking once connected. nb() repeats a libssh2
+    // call while it answers EAGAIN, polling the socket in between, and
+    // nbHandle() does the same for calls returning a handle. Neither stops
+    // on cancel: libssh2 keeps a half-sent request in per-call state that
+    // the next, different call would trip over. The data loops poll on
+    // their own and check stop_activity between slices.
+    template <typename Fn>
+    auto nb(Fn fn) -> decltype(fn());
+    template <typename Fn>
+    auto nbHandle(Fn fn) -> decltype(fn());
+    // Shared attribute cache (see [SFTP] attr_cache_secs). cachedSize()
+    // returns 1 with `size` set, 0 when the freshly listed parent lacks the
+    // name and -1 when only the server can tell. Every change made through
+    // a session forgets what it touched, with everything below for `tree`,
+    // and closes the session's read handles of it.
+    std::string attrKey(const std::string &full) const;
+    int cachedSize(const std::string &full, int64_t *size) const;
+    void forgetAttrs(const std::string &full, bool tree);
+    // The cached read handle of `full`, opened when there is none.
+    ReadHandle *readHandle(const std::string &full);
+    // Closes the read handles of `full`, with those below it for `tree`;
+    // "" closes all. forgetAttrs() calls it for every change.
+    void closeReadHandles(const std::string &full, bool tree);
+    // Reads until `size` bytes arrived, the file ended or a read failed;
+    // returns the count.
+    size_t readFully(LIBSSH2_SFTP_HANDLE *handle, char *out, size_t size);
+    // Server-side copy by running `cp` on the host: libssh2 cannot send the
+    // copy-data extension, but most hosts serving SFTP have a shell. Returns
+    // 1, 0 with response set, or -1 when the account cannot run commands.
+    int execCopy(const std::string &from, const std::string &to, bool recursive);
+    // Copy up to `limit` bytes (0 = until EOF) from the handle's current
+    // position into `sink` at `offset`, keeping [SFTP] pipeline_depth read
+    // requests in flight. Returns 1 once everything read is on its way to
+    // disk, 0 on error/cancel with response set.
+    int pipelinedRead(LIBSSH2_SFTP_HANDLE *handle, LocalFileSink &sink, uint64_t offset, uint64_t limit, uint64_t *done);
+    // Copy what `source` yields to the handle, pulling ahead on a second
+    // thread while [SFTP] pipeline_depth writes stay in flight.
+    int pipelinedWrite(LIBSSH2_SFTP_HANDLE *handle, const RemoteSourceFn &source);
+    // Runs `cmd` on the host over an exec channel, its output into `out`
+    // until it exits or the transfer is cancelled. Returns the exit status,
+    // or -1 when the account cannot run commands.
+    int execOutput(const std::string &cmd, std::string &out);
+    // Delta update of the `local` bytes of an older `outputfile` to the
+    // remote file of `size` bytes ([SFTP] delta_min_mb). A copy the remote
+    // file only appended to is checked with one MD5 of the common prefix
+    // and gets the tail; otherwise the host hashes [SFTP] delta_block_kb
+    // blocks with `dd | md5sum` while a disk thread hashes the local ones,
+    // and only the blocks that differ are fetched. Returns 1, 0 with
+    // response set, or -1 when a full download has to do.
+    int deltaGet(const std::string &outputfile, const std::string &path, uint64_t size, uint64_t local);
+    // Download `size` bytes using [SFTP] parallel_sessions sessions that
+    // share a segment cursor. Returns 1 on success, 0 with response set.
+    int getParallel(const std::string &outputfile, const std::string &path, uint64_t size);
 };
 
 #endif
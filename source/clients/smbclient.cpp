@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <unistd.h>
+#include <switch.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
@@ -10,10 +11,284 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 #include "lang.h"
 #include "smbclient.h"
+#include "config.h"
 #include "windows.h"
 #include "util.h"
+#include "local_sink.h"
+#include "buffer_pool.h"
+#include "transfer_trace.h"
+#include "transfer_stats.h"
+#include "logger.h"
+#include "threads.h"
+#include "resolver.h"
+#include "socket_tuning.h"
+#include "keepalive.h"
+#include "cancel.h"
+
+namespace
+{
+	/* Stats from recent listings, shared by every session to the same
+	 * share so a download worker can size a file another worker listed.
+	 * Keys are SmbClient::attrKey() of the share relative path. */
+	struct SmbCachedAttrs
+	{
+		int64_t size;
+		/* listed as a link or folder: it exists, but only a stat sizes it */
+		bool unknown;
+		uint64_t tick;
+	};
+
+	std::mutex smb_attr_mutex;
+	std::unordered_map<std::string, SmbCachedAttrs> smb_attr_cache;
+	/* folders whose complete listing is cached, so a name missing from it
+	 * is known not to exist */
+	std::unordered_map<std::string, uint64_t> smb_listed_dirs;
+	const size_t kMaxCachedAttrs = 65536;
+
+	/* Idle sessions by user@url, plus how many sessions are open per key
+	 * (pooled, lent out or the browsing one) and the count at which a
+	 * server last refused another. */
+	struct SmbPooledSession
+	{
+		std::string key;
+		SmbClient *client;
+		/* last traffic, a keep-alive ECHO included */
+		uint64_t idleSince;
+		/* last handed back by a worker */
+		uint64_t releasedAt;
+	};
+
+	std::mutex smb_pool_mutex;
+	std::vector<SmbPooledSession> smb_pool;
+	std::unordered_map<std::string, int> smb_open_sessions;
+	std::unordered_map<std::string, int> smb_session_limit;
+	/* reused without an ECHO below this idle time */
+	const uint64_t kPoolTrustUs = 15ULL * 1000000;
+
+	/* NT statuses of a server that takes no more sessions from us */
+	const uint32_t kStatusInsufficientResources = 0xC000009A;
+	const uint32_t kStatusRequestNotAccepted = 0xC00000D0;
+
+	struct SmbPrewarmArgs
+	{
+		const std::string *url;
+		const std::string *user;
+		const std::string *pass;
+		SmbClient *client = nullptr;
+	};
+
+	void SmbPrewarmThread(void *argp)
+	{
+		SmbPrewarmArgs *args = static_cast<SmbPrewarmArgs *>(argp);
+		args->client = SmbClient::AcquireSession(*args->url, *args->user, *args->pass);
+	}
+
+	/* A download's handle is closed without waiting for the reply, which
+	 * the next request on the connection picks up. */
+	void SmbCloseCallback(struct smb2_context *smb2, int status, void *command_data, void *private_data)
+	{
+	}
+
+	struct SmbIoSlot
+	{
+		TransferBuffer buf;
+		uint64_t offset = 0;
+		uint32_t length = 0;
+		int status = 0;
+		bool busy = false;
+		bool done = false;
+		/* issue and completion ticks, for the transfer trace */
+		uint64_t issued = 0;
+		uint64_t completed = 0;
+
+		uint8_t *data() { return reinterpret_cast<uint8_t *>(buf.data()); }
+	};
+
+	static void SmbIoCallback(struct smb2_context *smb2, int status, void *command_data, void *private_data)
+	{
+		SmbIoSlot *slot = (SmbIoSlot *)private_data;
+		slot->status = status;
+		slot->done = true;
+		if (TransferTrace::Enabled())
+			slot->completed = Util::GetTick();
+	}
+
+	// Wait up to timeout_ms for socket events and dispatch replies.
+	// Returns false when the connection failed.
+	static bool SmbService(struct smb2_context *smb2, int timeout_ms)
+	{
+		struct pollfd pfd;
+		pfd.fd = smb2_get_fd(smb2);
+		pfd.events = smb2_which_events(smb2);
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout_ms) < 0)
+			return false;
+		if (pfd.revents == 0)
+			return true;
+		return smb2_service(smb2, pfd.revents) >= 0;
+	}
+
+	struct SmbRename
+	{
+		std::string from;
+		std::string to;
+		int status = 0;
+		bool done = false;
+	};
+
+	static void SmbRenameCallback(struct smb2_context *smb2, int status, void *command_data, void *private_data)
+	{
+		SmbRename *rename = (SmbRename *)private_data;
+		rename->status = status;
+		rename->done = true;
+	}
+
+	// Fixed pool of request buffers driven by smb2_service. Replies complete
+	// out of order; callers pick up finished slots and recycle them.
+	struct SmbIoQueue
+	{
+		struct smb2_context *smb2;
+		std::vector<SmbIoSlot> slots;
+
+		SmbIoQueue(struct smb2_context *ctx, uint32_t block_size) : smb2(ctx), slots(smb_io_depth)
+		{
+			for (auto &slot : slots)
+				slot.buf.Acquire(block_size);
+			// Run with fewer requests in flight rather than fail outright
+			// when the transfer buffer pool is short.
+			slots.erase(std::remove_if(slots.begin(), slots.end(), [](const SmbIoSlot &slot)
+									   { return !slot.buf; }),
+						slots.end());
+		}
+
+		// Callbacks reference the slots, so never release them while a
+		// request is still on the wire.
+		~SmbIoQueue()
+		{
+			while (Busy() > 0 && Service(100))
+				;
+		}
+
+		SmbIoSlot *Idle()
+		{
+			for (auto &slot : slots)
+			{
+				if (!slot.busy)
+					return &slot;
+			}
+			return NULL;
+		}
+
+		// True while any slot is in flight or holds an unprocessed reply.
+		bool Active() const
+		{
+			for (auto &slot : slots)
+			{
+				if (slot.busy)
+					return true;
+			}
+			return false;
+		}
+
+		// Number of requests still waiting for a reply.
+		int Busy() const
+		{
+			int n = 0;
+			for (auto &slot : slots)
+			{
+				if (slot.busy && !slot.done)
+					n++;
+			}
+			return n;
+		}
+
+		bool Service(int timeout_ms)
+		{
+			return SmbService(smb2, timeout_ms);
+		}
+	};
+
+	/* tries per parallel segment */
+	const int kSegmentAttempts = 3;
+
+	struct SmbParallelContext
+	{
+		LocalFileSink *sink = NULL;
+		std::string path;
+		uint64_t size = 0;
+		uint64_t segment = 0;
+		/* segments are claimed with one fetch_add; the lock only guards
+		 * errorMessage */
+		std::atomic<uint64_t> nextOffset{0};
+		std::atomic<bool> hadError{false};
+		std::mutex stateMutex;
+		std::string errorMessage;
+		/* TransferStats slot of the queue worker that owns the file */
+		int statsSlot = -1;
+	};
+
+	struct SmbWorkerArgs
+	{
+		SmbParallelContext *ctx = NULL;
+		SmbClient *client = NULL;
+	};
+
+	void SmbParallelWorker(SmbParallelContext *ctx, SmbClient *client)
+	{
+		while (!ctx->hadError && !Cancel::Stopped())
+		{
+			uint64_t start = ctx->nextOffset.fetch_add(ctx->segment);
+			if (start >= ctx->size)
+				return;
+			uint64_t length = MIN(ctx->segment, ctx->size - start);
+
+			bool ok = false;
+			for (int attempt = 1; attempt <= kSegmentAttempts && !ok; attempt++)
+			{
+				uint64_t done = 0;
+				ok = client->GetSegment(*ctx->sink, ctx->path, start, length, &done) == 1;
+				if (ok)
+				{
+					TransferStats::RangeDone(start, start + length);
+					break;
+				}
+
+				/* the segment is read again from its start */
+				bytes_transfered -= (int64_t)done;
+				TransferStats::AddBytes(-(int64_t)done);
+				if (Cancel::Stopped())
+					break;
+				TransferStats::AddRetry();
+				LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "SMB GET parallel segment error path=%s offset=%llu len=%llu attempt=%d/%d err=%s",
+								 ctx->path.c_str(), (unsigned long long)start, (unsigned long long)length, attempt,
+								 kSegmentAttempts, client->LastResponse());
+			}
+
+			if (!ok)
+			{
+				std::lock_guard<std::mutex> lock(ctx->stateMutex);
+				if (!ctx->hadError.exchange(true))
+					ctx->errorMessage = Cancel::Stopped() ? lang_strings[STR_CANCEL_ACTION_MSG] : client->LastResponse();
+				return;
+			}
+		}
+	}
+
+	void SmbParallelWorkerThread(void *argp)
+	{
+		SmbWorkerArgs *args = static_cast<SmbWorkerArgs *>(argp);
+		TransferStats::Bind(args->ctx->statsSlot);
+		SmbParallelWorker(args->ctx, args->client);
+	}
+}
 
 SmbClient::SmbClient()
 {
@@ -22,6 +297,8 @@ SmbClient::SmbClient()
 
 SmbClient::~SmbClient()
 {
+	if (counted)
+		countSession(-1);
 	if (smb2 != nullptr)
 	{
 		smb2_destroy_context(smb2);
@@ -51,19 +328,250 @@ int SmbClient::Connect(const std::string &url, const std::string &user, const st
 	smb2_set_security_mode(smb2, SMB2_NEGOTIATE_SIGNING_ENABLED);
 	smb2_set_timeout(smb2, 30);
 
-	if (smb2_connect_share(smb2, smb_url->server, smb_url->share, user.c_str()) < 0)
+	// libsmb2 would run its own lookup for every pooled session; a
+	// "host:port" server is left to it.
+	std::string server = smb_url->server;
+	std::string address;
+	if (server.find(':') == std::string::npos && Resolver::ResolveText(server, address))
+		server = address;
+
+	if (smb2_connect_share(smb2, server.c_str(), smb_url->share, user.c_str()) < 0)
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
 		return 0;
 	}
 	smb2_destroy_url(smb_url);
 
+	// The socket is libsmb2's and already connected, so this takes one
+	// echo for the round trip and widens what the window scale allows.
+	std::string tune_host = SocketTuning::HostOf(url);
+	uint64_t echo_start = Util::GetTick();
+	if (smb2_echo(smb2) == 0)
+		SocketTuning::ObserveRtt(tune_host, Util::GetTick() - echo_start);
+	SocketTuning::Apply(smb2_get_fd(smb2), tune_host);
+
 	max_read_size = smb2_get_max_read_size(smb2);
 	max_write_size = smb2_get_max_write_size(smb2);
+	conn_url = url;
+	conn_user = user;
+	conn_pass = pass;
 	connected = true;
+	countSession(1);
+	if (!pool_member)
+		prewarmSessions(url, user, pass);
 	return 1;
 }
 
+void SmbClient::countSession(int delta)
+{
+	std::lock_guard<std::mutex> lock(smb_pool_mutex);
+	smb_open_sessions[conn_user + "@" + conn_url] += delta;
+	counted = delta > 0;
+}
+
+/*
+ * Each extra session is a full negotiate and session setup, so they all
+ * run at once and connecting costs about one of them.
+ */
+void SmbClient::prewarmSessions(const std::string &url, const std::string &user, const std::string &pass)
+{
+	int want;
+	{
+		std::lock_guard<std::mutex> lock(smb_pool_mutex);
+		std::string key = user + "@" + url;
+		want = smb_sessions - smb_open_sessions[key];
+		auto limit = smb_session_limit.find(key);
+		if (limit != smb_session_limit.end())
+			want = MIN(want, limit->second - smb_open_sessions[key]);
+	}
+	if (want <= 0)
+		return;
+
+	uint64_t start = Util::GetTick();
+	std::vector<Thread> threads(want);
+	std::vector<SmbPrewarmArgs> args(want);
+	std::vector<bool> started(want, false);
+	for (int i = 0; i < want; i++)
+	{
+		args[i].url = &url;
+		args[i].user = &user;
+		args[i].pass = &pass;
+		Result rc = Threads::Create(&threads[i], SmbPrewarmThread, &args[i], 0x10000, Threads::ROLE_NETWORK, "smb prewarm");
+		if (R_FAILED(rc))
+		{
+			Logger::Logf(Logger::LOG_ERROR, "SMB POOL threadCreate failed index=%d rc=0x%x", i, rc);
+			continue;
+		}
+		threadStart(&threads[i]);
+		started[i] = true;
+	}
+
+	int ready = 0;
+	for (int i = 0; i < want; i++)
+	{
+		if (!started[i])
+			continue;
+		Threads::Join(&threads[i]);
+		if (args[i].client != nullptr)
+			ready++;
+	}
+	/* pooled only now, so no thread picked up another's session */
+	for (auto &arg : args)
+		ReleaseSession(arg.client);
+	Logger::Logf("SMB POOL prewarmed server=%s sessions=%d of=%d ms=%llu", url.c_str(), ready, want,
+				 (unsigned long long)((Util::GetTick() - start) / 1000));
+}
+
+SmbClient *SmbClient::AcquireSession(const std::string &url, const std::string &user, const std::string &pass)
+{
+	std::string key = user + "@" + url;
+	while (true)
+	{
+		SmbClient *client = nullptr;
+		uint64_t idle = 0;
+		{
+			std::lock_guard<std::mutex> lock(smb_pool_mutex);
+			for (size_t i = smb_pool.size(); i-- > 0;)
+			{
+				if (smb_pool[i].key != key)
+					continue;
+				client = smb_pool[i].client;
+				idle = Util::GetTick() - smb_pool[i].idleSince;
+				smb_pool.erase(smb_pool.begin() + i);
+				break;
+			}
+		}
+		if (client == nullptr)
+			break;
+		if (idle < kPoolTrustUs || client->Ping())
+			return client;
+		/* the server dropped it meanwhile; try the next one */
+		delete client;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(smb_pool_mutex);
+		auto limit = smb_session_limit.find(key);
+		if (limit != smb_session_limit.end() && smb_open_sessions[key] >= limit->second)
+			return nullptr;
+	}
+
+	SmbClient *client = new SmbClient();
+	client->pool_member = true;
+	if (!client->Connect(url, user, pass))
+	{
+		uint32_t status = client->smb2 != nullptr ? (uint32_t)smb2_get_nterror(client->smb2) : 0;
+		if (status == kStatusInsufficientResources || status == kStatusRequestNotAccepted)
+		{
+			std::lock_guard<std::mutex> lock(smb_pool_mutex);
+			int open = MAX(smb_open_sessions[key], 1);
+			smb_session_limit[key] = open;
+			Logger::Logf(Logger::LOG_WARN, "SMB POOL server refused session server=%s open=%d", url.c_str(), open);
+		}
+		else
+			Logger::Logf(Logger::LOG_ERROR, "SMB POOL connect failed server=%s resp=%s", url.c_str(), client->LastResponse());
+		delete client;
+		return nullptr;
+	}
+	return client;
+}
+
+void SmbClient::ReleaseSession(SmbClient *client)
+{
+	if (client == nullptr)
+		return;
+
+	/* a cancelled transfer may leave replies in flight, so those
+	 * sessions are not reused */
+	if (client->connected && !Cancel::Stopped())
+	{
+		std::string key = client->conn_user + "@" + client->conn_url;
+		std::lock_guard<std::mutex> lock(smb_pool_mutex);
+		int idle = 0;
+		for (auto &session : smb_pool)
+		{
+			if (session.key == key)
+				idle++;
+		}
+		/* one session of the count browses */
+		if (idle < smb_sessions - 1)
+		{
+			uint64_t now = Util::GetTick();
+			smb_pool.push_back({key, client, now, now});
+			if (KeepAlive::Interval() > 0)
+				KeepAlive::Schedule("smb pool", KeepPoolAlive, KeepAlive::Interval());
+			return;
+		}
+	}
+	client->Quit();
+	delete client;
+}
+
+int64_t SmbClient::KeepPoolAlive()
+{
+	uint64_t interval = KeepAlive::Interval();
+	uint64_t max_unused = (uint64_t)keepalive_pool_seconds * 1000000;
+	std::vector<SmbPooledSession> due;
+	int64_t next = -1;
+	{
+		std::lock_guard<std::mutex> lock(smb_pool_mutex);
+		uint64_t now = Util::GetTick();
+		for (size_t i = smb_pool.size(); i-- > 0;)
+		{
+			uint64_t idle = now - smb_pool[i].idleSince;
+			uint64_t unused = now - smb_pool[i].releasedAt;
+			if (idle >= interval || unused >= max_unused)
+			{
+				due.push_back(smb_pool[i]);
+				smb_pool.erase(smb_pool.begin() + i);
+				continue;
+			}
+			int64_t wait = (int64_t)MIN(interval - idle, max_unused - unused);
+			if (next < 0 || wait < next)
+				next = wait;
+		}
+	}
+
+	/* out of the pool meanwhile, so no worker gets one mid-ECHO */
+	for (auto &session : due)
+	{
+		uint64_t unused = Util::GetTick() - session.releasedAt;
+		if (unused >= max_unused || !session.client->Ping())
+		{
+			Logger::Logf(Logger::LOG_DEBUG, "SMB POOL retired server=%s unused_s=%llu", session.client->conn_url.c_str(),
+						 (unsigned long long)(unused / 1000000));
+			delete session.client;
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(smb_pool_mutex);
+			smb_pool.push_back({session.key, session.client, Util::GetTick(), session.releasedAt});
+		}
+		int64_t wait = (int64_t)MIN(interval, max_unused - unused);
+		if (next < 0 || wait < next)
+			next = wait;
+	}
+	return next;
+}
+
+void SmbClient::ClosePool()
+{
+	/* sessions out for an ECHO come back first */
+	KeepAlive::Cancel("smb pool");
+	std::vector<SmbPooledSession> sessions;
+	{
+		std::lock_guard<std::mutex> lock(smb_pool_mutex);
+		sessions.swap(smb_pool);
+	}
+	for (auto &session : sessions)
+	{
+		session.client->Quit();
+		delete session.client;
+	}
+	if (!sessions.empty())
+		Logger::Logf("SMB POOL closed sessions=%d", (int)sessions.size());
+}
+
 /*
  * SmbLastResponse - return a pointer to the last response received
  */
@@ -89,6 +597,17 @@ bool SmbClient::Ping()
 	return connected;
 }
 
+/*
+ * KeepAlive - libsmb2 keeps no idle time, so the ECHO goes out every
+ * interval
+ */
+int64_t SmbClient::KeepAlive(uint64_t interval_us)
+{
+	if (!connected || !Ping())
+		return 0;
+	return interval_us;
+}
+
 /*
  * SmbQuit - disconnect from remote
  *
@@ -96,9 +615,13 @@ bool SmbClient::Ping()
  */
 int SmbClient::Quit()
 {
+	if (counted)
+		countSession(-1);
 	smb2_destroy_context(smb2);
 	smb2 = NULL;
 	connected = false;
+	if (!pool_member)
+		ClosePool();
 	return 1;
 }
 
@@ -111,6 +634,7 @@ int SmbClient::Mkdir(const std::string &ppath)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
+	forgetAttrs(path, false);
 	if (smb2_mkdir(smb2, path.c_str()) != 0)
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
@@ -128,6 +652,7 @@ int SmbClient::_Rmdir(const std::string &ppath)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
+	forgetAttrs(path, true);
 	if (smb2_rmdir(smb2, path.c_str()) != 0)
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
@@ -143,14 +668,14 @@ int SmbClient::_Rmdir(const std::string &ppath)
  */
 int SmbClient::Rmdir(const std::string &path, bool recursive)
 {
-	if (stop_activity)
+	if (Cancel::Stopped())
 		return 1;
 
 	std::vector<DirEntry> list = ListDir(path);
 	int ret;
 	for (int i = 0; i < list.size(); i++)
 	{
-		if (stop_activity)
+		if (Cancel::Stopped())
 			return 1;
 
 		if (list[i].isDir && recursive)
@@ -191,15 +716,118 @@ int SmbClient::Rmdir(const std::string &path, bool recursive)
  * return 1 if successful, 0 otherwise
  */
 
+int SmbClient::readBlocks(struct smb2fh *in, LocalFileSink &out, uint64_t start, uint64_t length, uint64_t *done)
+{
+	// Keep several reads outstanding and write each block at its offset as
+	// it completes.
+	SmbIoQueue queue(smb2, max_read_size);
+	if (queue.slots.empty())
+	{
+		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		return 0;
+	}
+	uint64_t end = start + length;
+	uint64_t next = start;
+	bool failed = false;
+	while (!failed)
+	{
+		if (Cancel::Stopped())
+		{
+			snprintf(response, 1023, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+			failed = true;
+			break;
+		}
+
+		SmbIoSlot *slot;
+		while (next < end && (slot = queue.Idle()) != NULL)
+		{
+			slot->offset = next;
+			slot->length = (end - next < max_read_size) ? (uint32_t)(end - next) : max_read_size;
+			slot->status = 0;
+			slot->done = false;
+			slot->issued = TransferTrace::Enabled() ? Util::GetTick() : 0;
+			if (smb2_pread_async(smb2, in, slot->data(), slot->length, slot->offset, SmbIoCallback, slot) < 0)
+			{
+				snprintf(response, 1023, "%s", smb2_get_error(smb2));
+				failed = true;
+				break;
+			}
+			slot->busy = true;
+			next += slot->length;
+		}
+
+		for (auto &s : queue.slots)
+		{
+			if (failed || !s.busy || !s.done)
+				continue;
+			s.busy = false;
+			if (TransferTrace::Enabled())
+				TransferTrace::Record(TransferTrace::TRACE_SMB_BLOCK, -1, s.issued, s.completed, s.offset,
+									  s.status > 0 ? (uint64_t)s.status : 0, s.status > 0 ? 1 : 0);
+			if (s.status <= 0)
+			{
+				snprintf(response, 1023, "%s", s.status < 0 ? strerror(-s.status) : lang_strings[STR_FAILED]);
+				failed = true;
+				break;
+			}
+			if (!out.WriteAt(s.offset, s.data(), s.status))
+			{
+				snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+				failed = true;
+				break;
+			}
+			bytes_transfered += s.status;
+			TransferStats::AddBytes(s.status);
+			if (done)
+				*done += s.status;
+
+			// Short read: ask again for the rest of this block.
+			if ((uint32_t)s.status < s.length)
+			{
+				s.offset += s.status;
+				s.length -= s.status;
+				s.status = 0;
+				s.done = false;
+				s.issued = TransferTrace::Enabled() ? Util::GetTick() : 0;
+				if (smb2_pread_async(smb2, in, s.data(), s.length, s.offset, SmbIoCallback, &s) < 0)
+				{
+					snprintf(response, 1023, "%s", smb2_get_error(smb2));
+					failed = true;
+					break;
+				}
+				s.busy = true;
+			}
+		}
+
+		if (failed || (next >= end && !queue.Active()))
+			break;
+
+		if (!queue.Service(100))
+		{
+			snprintf(response, 1023, "%s", smb2_get_error(smb2));
+			failed = true;
+		}
+	}
+	return failed ? 0 : 1;
+}
+
 int SmbClient::Get(const std::string &outputfile, const std::string &ppath, uint64_t offset)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
-	if (!Size(path.c_str(), &bytes_to_download))
+	int64_t remote_size = 0;
+	if (!Size(path.c_str(), &remote_size))
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
 		return 0;
 	}
+	bytes_to_download = remote_size;
+	bytes_transfered = 0;
+	prev_tick = Util::GetTick();
+
+	uint64_t segment = (uint64_t)smb_segment_mb * 1024 * 1024;
+	if (smb_parallel_sessions > 1 && (uint64_t)remote_size >= 2 * segment)
+		return getParallel(outputfile, path, (uint64_t)remote_size);
 
 	struct smb2fh* in = smb2_open(smb2, path.c_str(), O_RDONLY);
 	if (in == NULL)
@@ -208,33 +836,128 @@ int SmbClient::Get(const std::string &outputfile, const std::string &ppath, uint
 		return 0;
 	}
 
-	FILE* out = FS::Create(outputfile);
-	if (out == NULL)
+	LocalFileSink out(outputfile, LocalFileSink::NeedsSplit(bytes_to_download) ? LocalFileSink::kSplitPartSize : 0);
+	if (!out.Open(false))
 	{
 		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		smb2_close(smb2, in);
 		return 0;
 	}
+	// Blocks complete out of order; reserving the file keeps FAT32 from
+	// zero-filling the gap in front of each one.
+	out.Preallocate(bytes_to_download);
+
+	bool failed = !readBlocks(in, out, 0, (uint64_t)remote_size, nullptr);
+	if (failed || smb2_close_async(smb2, in, SmbCloseCallback, NULL) < 0)
+		smb2_close(smb2, in);
+	if (failed)
+	{
+		out.Close();
+		return 0;
+	}
+	if (!out.Finish())
+	{
+		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		return 0;
+	}
+	return 1;
+}
 
-	uint8_t *buff = (uint8_t*)malloc(max_read_size);
-	int count = 0;
-	bytes_transfered = 0;
-	prev_tick = Util::GetTick();
-	while ((count = smb2_read(smb2, in, buff, max_read_size)) > 0)
+int SmbClient::GetSegment(LocalFileSink &sink, const std::string &path, uint64_t offset, uint64_t length, uint64_t *done)
+{
+	if (done)
+		*done = 0;
+	struct smb2fh *in = smb2_open(smb2, path.c_str(), O_RDONLY);
+	if (in == NULL)
+	{
+		snprintf(response, 1023, "%s", smb2_get_error(smb2));
+		return 0;
+	}
+	int ok = readBlocks(in, sink, offset, length, done);
+	if (!ok || smb2_close_async(smb2, in, SmbCloseCallback, NULL) < 0)
+		smb2_close(smb2, in);
+	return ok;
+}
+
+/*
+ * One session's signing and the server's per-session limits cap a single
+ * stream; several pooled sessions each read their own segments of the
+ * file, every one with io_depth requests in flight, into one sink.
+ */
+int SmbClient::getParallel(const std::string &outputfile, const std::string &path, uint64_t size)
+{
+	LocalFileSink sink(outputfile, LocalFileSink::NeedsSplit(size) ? LocalFileSink::kSplitPartSize : 0);
+	if (!sink.Open(false))
+	{
+		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		return 0;
+	}
+	sink.Preallocate(size);
+
+	SmbParallelContext ctx;
+	ctx.sink = &sink;
+	ctx.path = path;
+	ctx.size = size;
+	ctx.segment = (uint64_t)smb_segment_mb * 1024 * 1024;
+	ctx.statsSlot = TransferStats::CurrentWorker();
+
+	uint64_t segments = (size + ctx.segment - 1) / ctx.segment;
+	int extra = smb_parallel_sessions - 1;
+	if ((uint64_t)extra >= segments)
+		extra = (int)segments - 1;
+
+	/* sessions the pool cannot give are done without */
+	std::vector<SmbClient *> clients;
+	for (int i = 0; i < extra; i++)
 	{
-		if (count < 0)
+		SmbClient *client = AcquireSession(conn_url, conn_user, conn_pass);
+		if (client == nullptr)
+			break;
+		clients.push_back(client);
+	}
+
+	Logger::Logf("SMB GET parallel path=%s size=%llu sessions=%d segment_mb=%d", path.c_str(),
+				 (unsigned long long)size, (int)clients.size() + 1, smb_segment_mb);
+
+	std::vector<Thread> threads(clients.size());
+	std::vector<SmbWorkerArgs> args(clients.size());
+	std::vector<bool> started(clients.size(), false);
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		args[i].ctx = &ctx;
+		args[i].client = clients[i];
+		Result rc = Threads::Create(&threads[i], SmbParallelWorkerThread, &args[i], 0x10000, Threads::ROLE_NETWORK, "smb segment");
+		if (R_FAILED(rc))
 		{
-			snprintf(response, 1023, "%s", smb2_get_error(smb2));
-			FS::Close(out);
-			smb2_close(smb2, in);
-			free((void*)buff);
-			return 0;
+			Logger::Logf(Logger::LOG_ERROR, "SMB GET parallel threadCreate failed index=%d rc=0x%x", (int)i, rc);
+			continue;
 		}
-		FS::Write(out, buff, count);
-		bytes_transfered += count;
+		threadStart(&threads[i]);
+		started[i] = true;
+	}
+
+	/* this session claims segments too */
+	SmbParallelWorker(&ctx, this);
+
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		if (started[i])
+			Threads::Join(&threads[i]);
+		ReleaseSession(clients[i]);
+	}
+
+	if (ctx.hadError)
+	{
+		sink.Close();
+		snprintf(response, 1023, "%s", ctx.errorMessage.c_str());
+		Logger::Logf(Logger::LOG_ERROR, "SMB GET parallel error path=%s err=%s", path.c_str(), ctx.errorMessage.c_str());
+		return 0;
+	}
+	if (!sink.Finish())
+	{
+		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		return 0;
 	}
-	FS::Close(out);
-	smb2_close(smb2, in);
-	free((void*)buff);
 	return 1;
 }
 
@@ -276,19 +999,76 @@ int SmbClient::GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset)
 int SmbClient::Copy(const std::string &ffrom, const std::string &tto)
 {
 	snprintf(response, 1023, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
-	return 0;
+	return -1;
 }
 
 int SmbClient::Move(const std::string &ffrom, const std::string &tto)
 {
-	snprintf(response, 1023, "%s", lang_strings[STR_UNSUPPORTED_OPERATION_MSG]);
-	return 0;
+	return Rename(ffrom, tto);
+}
+
+int SmbClient::MoveBatch(std::vector<RemoteMove> &moves)
+{
+	// libsmb2 sends each rename as one compound of create, set-info and
+	// close, and up to smb_io_depth of them go out before a reply is
+	// awaited, so a batch costs a round trip per smb_io_depth moves.
+	std::vector<SmbRename> renames(moves.size());
+	for (size_t i = 0; i < moves.size(); i++)
+	{
+		renames[i].from = moves[i].from;
+		renames[i].to = moves[i].to;
+		renames[i].from = Util::Trim(renames[i].from, "/");
+		renames[i].to = Util::Trim(renames[i].to, "/");
+		forgetAttrs(renames[i].from, true);
+		forgetAttrs(renames[i].to, true);
+	}
+
+	size_t next = 0;
+	int in_flight = 0;
+	bool connection_ok = true;
+	while (connection_ok && (next < renames.size() || in_flight > 0))
+	{
+		while (next < renames.size() && in_flight < smb_io_depth)
+		{
+			SmbRename &rename = renames[next++];
+			if (smb2_rename_async(smb2, rename.from.c_str(), rename.to.c_str(), SmbRenameCallback, &rename) < 0)
+			{
+				rename.status = -1;
+				rename.done = true;
+				continue;
+			}
+			in_flight++;
+		}
+		connection_ok = SmbService(smb2, 100);
+		in_flight = 0;
+		for (size_t i = 0; i < next; i++)
+		{
+			if (!renames[i].done)
+				in_flight++;
+		}
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < moves.size(); i++)
+	{
+		moves[i].ok = renames[i].done && renames[i].status == 0;
+		if (!moves[i].ok)
+			failed++;
+	}
+	if (failed > 0)
+		snprintf(response, 1023, "%s", smb2_get_error(smb2));
+	Logger::Logf("SMB rename batch moves=%zu failed=%d connection_ok=%d", moves.size(), failed, connection_ok ? 1 : 0);
+	return failed == 0 ? 1 : 0;
 }
 
 bool SmbClient::FileExists(const std::string &ppath)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
+	int64_t size;
+	int cached = cachedSize(path, &size);
+	if (cached >= 0)
+		return cached == 1;
 	smb2_stat_64 st;
 	int ret = smb2_stat(smb2, path.c_str(), &st);
 	if (ret != 0)
@@ -323,36 +1103,120 @@ int SmbClient::Put(const std::string &inputfile, const std::string &ppath, uint6
 		return 0;
 	}
 	
-	struct smb2fh* out = smb2_open(smb2, path.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+	// A resumed upload keeps the `offset` bytes already on the share and
+	// writes the rest of the file after them.
+	if (offset > (uint64_t)bytes_to_download || (offset > 0 && FS::Seek(in, offset) < 0))
+	{
+		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		FS::Close(in);
+		return 0;
+	}
+
+	forgetAttrs(path, false);
+	struct smb2fh* out = smb2_open(smb2, path.c_str(), offset > 0 ? O_WRONLY | O_CREAT : O_WRONLY | O_CREAT | O_TRUNC);
 	if (out == NULL)
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
+		FS::Close(in);
 		return 0;
 	}
 
-	uint8_t* buff = (uint8_t*)malloc(max_write_size);
-	int count = 0;
-	bytes_transfered = 0;
+	// Local reads refill whichever pool slot is free while the other slots'
+	// writes are on the wire, so the pool doubles as the read-ahead ring.
+	SmbIoQueue queue(smb2, max_write_size);
+	if (queue.slots.empty())
+	{
+		snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+		FS::Close(in);
+		smb2_close(smb2, out);
+		return 0;
+	}
+	uint64_t next = offset;
+	bool eof = false;
+	bool failed = false;
+	bytes_transfered = offset;
 	prev_tick = Util::GetTick();
-	while ((count = FS::Read(in, buff, max_write_size)) > 0)
+	while (!failed)
 	{
-		if (count < 0)
+		if (Cancel::Stopped())
 		{
-			snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
-			FS::Close(in);
-			smb2_close(smb2, out);
-			free(buff);
-			return 0;
+			snprintf(response, 1023, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+			failed = true;
+			break;
+		}
+
+		SmbIoSlot *slot;
+		while (!eof && (slot = queue.Idle()) != NULL)
+		{
+			int count = FS::Read(in, slot->data(), max_write_size);
+			if (count < 0)
+			{
+				snprintf(response, 1023, "%s", lang_strings[STR_FAILED]);
+				failed = true;
+				break;
+			}
+			if (count == 0)
+			{
+				eof = true;
+				break;
+			}
+			slot->offset = next;
+			slot->length = (uint32_t)count;
+			slot->status = 0;
+			slot->done = false;
+			if (smb2_pwrite_async(smb2, out, slot->data(), slot->length, slot->offset, SmbIoCallback, slot) < 0)
+			{
+				snprintf(response, 1023, "%s", smb2_get_error(smb2));
+				failed = true;
+				break;
+			}
+			slot->busy = true;
+			next += (uint64_t)count;
+		}
+
+		for (auto &s : queue.slots)
+		{
+			if (failed || !s.busy || !s.done)
+				continue;
+			s.busy = false;
+			if (s.status <= 0)
+			{
+				snprintf(response, 1023, "%s", s.status < 0 ? strerror(-s.status) : lang_strings[STR_FAILED]);
+				failed = true;
+				break;
+			}
+			bytes_transfered += s.status;
+
+			// Short write: send the rest of this block again.
+			if ((uint32_t)s.status < s.length)
+			{
+				memmove(s.data(), s.data() + s.status, s.length - s.status);
+				s.offset += s.status;
+				s.length -= s.status;
+				s.status = 0;
+				s.done = false;
+				if (smb2_pwrite_async(smb2, out, s.data(), s.length, s.offset, SmbIoCallback, &s) < 0)
+				{
+					snprintf(response, 1023, "%s", smb2_get_error(smb2));
+					failed = true;
+					break;
+				}
+				s.busy = true;
+			}
+		}
+
+		if (failed || (eof && !queue.Active()))
+			break;
+
+		if (!queue.Service(100))
+		{
+			snprintf(response, 1023, "%s", smb2_get_error(smb2));
+			failed = true;
 		}
-		smb2_write(smb2, out, buff, count);
-		bytes_transfered += count;
 	}
 	FS::Close(in);
 	smb2_close(smb2, out);
-	free(buff);
-
-	return 1;
-
+	return failed ? 0 : 1;
 }
 
 int SmbClient::Rename(const std::string &src, const std::string &dst)
@@ -361,6 +1225,8 @@ int SmbClient::Rename(const std::string &src, const std::string &dst)
 	std::string path2 = std::string(dst);
 	path1 = Util::Trim(path1, "/");
 	path2 = Util::Trim(path2, "/");
+	forgetAttrs(path1, true);
+	forgetAttrs(path2, true);
 	if (smb2_rename(smb2, path1.c_str(), path2.c_str()) != 0)
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
@@ -374,6 +1240,7 @@ int SmbClient::Delete(const std::string &ppath)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
+	forgetAttrs(path, false);
 	if (smb2_unlink(smb2, path.c_str()) != 0)
 	{
 		snprintf(response, 1023, "%s", smb2_get_error(smb2));
@@ -387,6 +1254,12 @@ int SmbClient::Size(const std::string &ppath, int64_t *size)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
+	int cached = cachedSize(path, size);
+	if (cached == 0)
+		snprintf(response, 1023, "%s", strerror(ENOENT));
+	if (cached >= 0)
+		return cached;
+
 	smb2_stat_64 st;
 	if (smb2_stat(smb2, path.c_str(), &st) != 0)
 	{
@@ -398,6 +1271,52 @@ int SmbClient::Size(const std::string &ppath, int64_t *size)
 	return 1;
 }
 
+std::string SmbClient::attrKey(const std::string &path) const
+{
+	return conn_user + "@" + conn_url + "|" + path;
+}
+
+int SmbClient::cachedSize(const std::string &path, int64_t *size) const
+{
+	if (smb_attr_cache_secs <= 0)
+		return -1;
+	uint64_t oldest = Util::GetTick() - (uint64_t)smb_attr_cache_secs * 1000000;
+
+	std::lock_guard<std::mutex> lock(smb_attr_mutex);
+	auto it = smb_attr_cache.find(attrKey(path));
+	if (it != smb_attr_cache.end() && it->second.tick >= oldest)
+	{
+		if (it->second.unknown)
+			return -1;
+		*size = it->second.size;
+		return 1;
+	}
+	size_t slash = path.find_last_of('/');
+	auto dir = smb_listed_dirs.find(attrKey(slash == std::string::npos ? "" : path.substr(0, slash)));
+	if (dir != smb_listed_dirs.end() && dir->second >= oldest)
+		return 0;
+	return -1;
+}
+
+void SmbClient::forgetAttrs(const std::string &path, bool tree)
+{
+	std::string key = attrKey(path);
+	size_t slash = path.find_last_of('/');
+	std::string parent = attrKey(slash == std::string::npos ? "" : path.substr(0, slash));
+
+	std::lock_guard<std::mutex> lock(smb_attr_mutex);
+	smb_attr_cache.erase(key);
+	smb_listed_dirs.erase(parent);
+	if (!tree)
+		return;
+	std::string prefix = key + "/";
+	for (auto it = smb_attr_cache.begin(); it != smb_attr_cache.end();)
+		it = it->first.compare(0, prefix.size(), prefix) == 0 ? smb_attr_cache.erase(it) : std::next(it);
+	for (auto it = smb_listed_dirs.begin(); it != smb_listed_dirs.end();)
+		it = (it->first == key || it->first.compare(0, prefix.size(), prefix) == 0) ? smb_listed_dirs.erase(it)
+																					: std::next(it);
+}
+
 std::vector<DirEntry> SmbClient::ListDir(const std::string &path)
 {
 	std::vector<DirEntry> out;
@@ -416,6 +1335,13 @@ std::vector<DirEntry> SmbClient::ListDir(const std::string &path)
 		return out;
 	}
 
+	// smb2_opendir has already fetched the whole folder; the stats it got
+	// are kept so the downloads that follow skip their own smb2_stat.
+	bool cache = smb_attr_cache_secs > 0;
+	std::string folder = Util::Trim(ppath, "/");
+	std::vector<std::pair<std::string, SmbCachedAttrs>> listed;
+	uint64_t now = Util::GetTick();
+
 	while ((ent = smb2_readdir(smb2, dir)))
 	{
 		DirEntry entry;
@@ -427,11 +1353,11 @@ std::vector<DirEntry> SmbClient::ListDir(const std::string &path)
 		entry.selectable = true;
 		if (path.length() > 0 && path[path.length() - 1] == '/')
 		{
-			sprintf(entry.path, "%s%s", path.c_str(), ent->name);
+			snprintf(entry.path, sizeof(entry.path), "%s%s", path.c_str(), ent->name);
 		}
 		else
 		{
-			sprintf(entry.path, "%s/%s", path.c_str(), ent->name);
+			snprintf(entry.path, sizeof(entry.path), "%s/%s", path.c_str(), ent->name);
 		}
 
 		time_t t = (time_t)ent->st.smb2_mtime;
@@ -474,10 +1400,30 @@ std::vector<DirEntry> SmbClient::ListDir(const std::string &path)
 			sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
 			break;
 		}
-		if (strcmp(entry.name, "..") != 0 && strcmp(entry.name, ".") != 0)
-			out.push_back(entry);
+		if (strcmp(entry.name, "..") == 0 || strcmp(entry.name, ".") == 0)
+			continue;
+		if (cache)
+		{
+			bool sized = ent->st.smb2_type == SMB2_TYPE_FILE;
+			listed.push_back({folder.empty() ? std::string(ent->name) : folder + "/" + ent->name,
+							  {sized ? (int64_t)ent->st.smb2_size : 0, !sized, now}});
+		}
+		out.push_back(entry);
 	}
 	smb2_closedir(smb2, dir);
+
+	if (cache)
+	{
+		std::lock_guard<std::mutex> lock(smb_attr_mutex);
+		if (smb_attr_cache.size() + listed.size() > kMaxCachedAttrs)
+		{
+			smb_attr_cache.clear();
+			smb_listed_dirs.clear();
+		}
+		for (const auto &item : listed)
+			smb_attr_cache[attrKey(item.first)] = item.second;
+		smb_listed_dirs[attrKey(folder)] = now;
+	}
 	return out;
 }
 
@@ -495,10 +1441,12 @@ int SmbClient::Head(const std::string &ppath, void* buffer, uint16_t len)
 {
 	std::string path = std::string(ppath);
 	path = Util::Trim(path, "/");
-	if (!Size(path.c_str(), &bytes_to_download))
+	int64_t remote_size = 0;
+	if (!Size(path.c_str(), &remote_size))
 	{
 		return 0;
 	}
+	bytes_to_download = remote_size;
 
 	struct smb2fh* in = smb2_open(smb2, path.c_str(), O_RDONLY);
 	if (in == NULL)
@@ -521,7 +1469,7 @@ ClientType SmbClient::clientType()
 
 uint32_t SmbClient::SupportedActions()
 {
-	return REMOTE_ACTION_ALL ^ REMOTE_ACTION_CUT ^ REMOTE_ACTION_COPY ^ REMOTE_ACTION_PASTE;
+	return REMOTE_ACTION_ALL ^ REMOTE_ACTION_COPY;
 }
 
 void *SmbClient::Open(const std::string &ppath, int flags)
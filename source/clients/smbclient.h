@@ -13,6 +13,8 @@
 
 #define SMB_CLIENT_MAX_FILENAME_LEN 256
 
+class LocalFileSink;
+
 class SmbClient : public RemoteClient
 {
 public:
@@ -23,6 +25,10 @@ public:
 	int Rmdir(const std::string &path, bool recursive);
 	int Size(const std::string &path, int64_t *size);
 	int Get(const std::string &outputfile, const std::string &path, uint64_t offset = 0);
+	// Reads [offset, offset+length) of a remote file into `sink`, which
+	// several sessions may share; `done` receives the bytes written, even
+	// on failure.
+	int GetSegment(LocalFileSink &sink, const std::string &path, uint64_t offset, uint64_t length, uint64_t *done = nullptr);
 	int GetRange(const std::string &path, void *buffer, uint64_t size, uint64_t offset);
 	int Put(const std::string &inputfile, const std::string &path, uint64_t offset = 0);
 	int Rename(const std::string &src, const std::string &dst);
@@ -30,12 +36,14 @@ public:
 	bool FileExists(const std::string &path);
     int Copy(const std::string &from, const std::string &to);
     int Move(const std::string &from, const std::string &to);
+	int MoveBatch(std::vector<RemoteMove> &moves);
 	std::vector<DirEntry> ListDir(const std::string &path);
 	int GetRange(void *fp, void *buffer, uint64_t size, uint64_t offset);
 	void *Open(const std::string &path, int flags);
 	void Close(void *fp);
 	bool IsConnected();
 	bool Ping();
+	int64_t KeepAlive(uint64_t interval_us);
 	const char *LastResponse();
 	int Quit();
 	std::string GetPath(std::string ppath1, std::string ppath2);
@@ -43,13 +51,52 @@ public:
 	ClientType clientType();
 	uint32_t SupportedActions();
 
+	// Sessions per share kept for transfer workers ([SMB] sessions).
+	// Connect() sets up the extra ones in parallel. AcquireSession() hands
+	// out an idle one, or negotiates a new one unless the server already
+	// refused that many; NULL when that fails. ReleaseSession() keeps the
+	// session for the next user, or logs it off when the pool is full.
+	static SmbClient *AcquireSession(const std::string &url, const std::string &user, const std::string &pass);
+	static void ReleaseSession(SmbClient *client);
+	// Logs off every pooled session; Quit() on the first session does it.
+	static void ClosePool();
+
 private:
+	// The pool's keep-alive task: echoes sessions idle for keepalive_seconds
+	// and logs off the ones that fail it or went unused for
+	// keepalive_pool_seconds.
+	static int64_t KeepPoolAlive();
 	int _Rmdir(const std::string &path);
-	struct smb2_context *smb2;
+	// [start, start+length) of `in` into `out` with io_depth reads in
+	// flight, counting progress (and `done`). 1, or 0 with response set.
+	int readBlocks(struct smb2fh *in, LocalFileSink &out, uint64_t start, uint64_t length, uint64_t *done);
+	// A file of two segments or more, fetched in segment_mb pieces by up
+	// to parallel_sessions pooled sessions at once.
+	int getParallel(const std::string &outputfile, const std::string &path, uint64_t size);
+	void prewarmSessions(const std::string &url, const std::string &user, const std::string &pass);
+	void countSession(int delta);
+	// Shared stat cache (see [SMB] attr_cache_secs), keyed by the share
+	// relative path. cachedSize() returns 1 with `size` set, 0 when the
+	// freshly listed parent lacks the name and -1 when only the server can
+	// tell. Changes made through a session forget what they touched, with
+	// everything below for `tree`.
+	std::string attrKey(const std::string &path) const;
+	int cachedSize(const std::string &path, int64_t *size) const;
+	void forgetAttrs(const std::string &path, bool tree);
+	struct smb2_context *smb2 = nullptr;
 	char response[1024];
 	bool connected = false;
 	uint32_t max_read_size = 0;
 	uint32_t max_write_size = 0;
+	std::string conn_url;
+	std::string conn_user;
+	// Kept for the pooled sessions a parallel download takes.
+	std::string conn_pass;
+	// Set on sessions created by AcquireSession(), which Connect() does not
+	// prewarm for and Quit() does not close the pool for.
+	bool pool_member = false;
+	// Counted in the open sessions of its share, from Connect() on.
+	bool counted = false;
 };
 
 #endif
\ No newline at end of file
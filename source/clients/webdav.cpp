@@ -3,29 +3,39 @@
 #include <algorithm>
 #include <cctype>
 #include <memory>
+#include <vector>
 #include <mutex>
 #include <switch.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "common.h"
 #include "clients/remote_client.h"
 #include "clients/webdav.h"
-#include "pugixml/pugiext.hpp"
+#include "httpclient/HTTPMultiClient.h"
+#include "clients/webdav_propfind.h"
 #include "fs.h"
 #include "lang.h"
 #include "config.h"
 #include "util.h"
 #include "windows.h"
 #include "logger.h"
+#include "threads.h"
+#include "local_sink.h"
+#include "upload_source.h"
+#include "buffer_pool.h"
+#include "transfer_stats.h"
+#include "host_health.h"
+#include "parse_profile.h"
+#include "listing_kernels.h"
+#include "cancel.h"
 #include <switch/runtime/devices/fs_dev.h>
 
-static const char *months[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 
 namespace
 {
-    struct SplitFileWriter;
-
     static std::string SanitizePathComponent(const std::string &name)
     {
         // Preserve extension (e.g. ".nsp") but aggressively sanitize the
@@ -86,7 +96,7 @@ namespace
             {
                 if (mkdir(current.c_str(), 0777) != 0 && errno != EEXIST)
                 {
-                    Logger::Logf("WEBDAV MKDIR failed path=%s errno=%d", current.c_str(), errno);
+                    Logger::Logf(Logger::LOG_ERROR, "WEBDAV MKDIR failed path=%s errno=%d", current.c_str(), errno);
                     // Keep going; final stat check below will decide success.
                 }
             }
@@ -96,7 +106,7 @@ namespace
         {
             if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST)
             {
-                Logger::Logf("WEBDAV MKDIR failed path=%s errno=%d", directory.c_str(), errno);
+                Logger::Logf(Logger::LOG_ERROR, "WEBDAV MKDIR failed path=%s errno=%d", directory.c_str(), errno);
             }
         }
 
@@ -131,790 +141,153 @@ namespace
         if (EnsureDirectoryTree(parent))
             return true;
 
-        Logger::Logf("WEBDAV MKDIR parent failed for path=%s, falling back to /Download", parent.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV MKDIR parent failed for path=%s, falling back to /Download", parent.c_str());
         std::string fallback = "/Download";
         if (!EnsureDirectoryTree(fallback))
         {
-            Logger::Logf("WEBDAV MKDIR fallback '/Download' also failed");
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV MKDIR fallback '/Download' also failed");
             return false;
         }
         return true;
     }
 
-    struct WebDAVChunkTask
-    {
-        std::string url;
-        std::string user;
-        std::string pass;
-        std::string rangeHeader;
-        CHTTPClient *client = nullptr;
-        int64_t start = 0;
-        int64_t end = 0;
-        long httpCode = 0;
-        std::string err;
-        std::string data;
-        bool ok = false;
-    };
-
-    struct WebDAVParallelContext
-    {
-        std::string url;
-        std::string outputPath;
-        FILE *file = nullptr;
-        int64_t size = 0;
-        int64_t chunk_size = 0;
-
-        std::mutex stateMutex;
-        std::mutex fileMutex;
-
-        int64_t nextOffset = 0;
-        bool hadError = false;
-        long lastHttpCode = 0;
-        std::string errorMessage;
-    };
-
-    struct WebDAVWorkerArgs
-    {
-        WebDAVParallelContext *ctx = nullptr;
-        CHTTPClient *client = nullptr;
-    };
-
-    struct WebDAVParallelSplitContext
-    {
-        std::string url;
-        SplitFileWriter *sink = nullptr;
-        int64_t size = 0;
-        int64_t chunk_size = 0;
-
-        std::mutex stateMutex;
-        std::mutex sinkMutex;
-
-        int64_t nextOffset = 0;
-        bool hadError = false;
-        long lastHttpCode = 0;
-        std::string errorMessage;
-    };
-
-    struct WebDAVSplitWorkerArgs
-    {
-        WebDAVParallelSplitContext *ctx = nullptr;
-        CHTTPClient *client = nullptr;
-    };
-
-    struct SplitFileWriter
+    // Fills a browser entry for the resource `name` inside `directory` from
+    // its PROPFIND properties.
+    static void FillDirEntry(DirEntry &entry, const std::string &directory, const std::string &name,
+                             const WebDAVPropfindEntry &e)
     {
-        std::string basePath;
-        std::string dirPath;
-        uint64_t partSize;
-        FILE *currentPart = nullptr;
-        int currentIndex = -1;
+        memset(&entry, 0, sizeof(entry));
+        entry.selectable = true;
+        snprintf(entry.directory, sizeof(entry.directory), "%s", directory.c_str());
+        snprintf(entry.name, sizeof(entry.name), "%s", name.c_str());
 
-        explicit SplitFileWriter(const std::string &base, uint64_t part_sz)
-            : basePath(base), partSize(part_sz)
+        if (directory.length() == 1 and directory[0] == '/')
         {
-            dirPath = basePath;
-            if (!FS::hasEndSlash(dirPath.c_str()))
-                dirPath.push_back('/');
+            snprintf(entry.path, sizeof(entry.path), "%s%s", directory.c_str(), name.c_str());
         }
-
-        ~SplitFileWriter()
-        {
-            close();
-        }
-
-        bool open()
+        else
         {
-            // If a plain file with this name already exists (from a previous
-            // non-split download attempt), remove it so we can create a
-            // directory with the same path for DBI-style splits.
-            if (FS::FileExists(basePath))
-            {
-                FS::Rm(basePath);
-            }
-
-            // Create the split directory (and parents) using a local helper
-            // that walks the path and calls mkdir() directly, so we don't
-            // depend on any existing MkDirs behaviour.
-            if (!EnsureDirectoryTree(basePath))
-            {
-                Logger::Logf("WEBDAV GET split mkdirs failed base=%s", basePath.c_str());
-                return false;
-            }
-
-            return true;
+            snprintf(entry.path, sizeof(entry.path), "%s/%s", directory.c_str(), name.c_str());
         }
 
-        void close()
+        entry.isDir = e.isCollection;
+        entry.file_size = 0;
+        if (!entry.isDir)
         {
-            if (currentPart)
-            {
-                fclose(currentPart);
-                currentPart = nullptr;
-            }
-            currentIndex = -1;
+            entry.file_size = atoll(e.contentLength.c_str());
+            DirEntry::SetDisplaySize(&entry);
         }
-
-        bool openPart(int index)
+        else
         {
-            if (currentIndex == index && currentPart)
-                return true;
-
-            if (currentPart)
-            {
-                fclose(currentPart);
-                currentPart = nullptr;
-            }
-
-            char name[16];
-            std::snprintf(name, sizeof(name), "%02d", index);
-            std::string partPath = dirPath + name;
-
-            currentPart = std::fopen(partPath.c_str(), "r+b");
-            if (!currentPart)
-                currentPart = std::fopen(partPath.c_str(), "w+b");
-            if (!currentPart)
-            {
-                Logger::Logf("WEBDAV SPLIT fopen failed path=%s errno=%d", partPath.c_str(), errno);
-                return false;
-            }
-
-            currentIndex = index;
-            return true;
+            sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
         }
 
-        bool write(uint64_t offset, const void *data, size_t size)
-        {
-            const unsigned char *ptr = static_cast<const unsigned char *>(data);
-            uint64_t curOffset = offset;
-            size_t remaining = size;
-
-            while (remaining > 0)
-            {
-                uint64_t index = curOffset / partSize;
-                uint64_t offsetInPart = curOffset % partSize;
-                uint64_t spaceInPart = partSize - offsetInPart;
-                size_t toWrite = remaining;
-                if (toWrite > spaceInPart)
-                    toWrite = static_cast<size_t>(spaceInPart);
-
-                if (!openPart(static_cast<int>(index)))
-                    return false;
-
-                if (fseeko(currentPart, (off_t)offsetInPart, SEEK_SET) != 0)
-                {
-                    Logger::Logf("WEBDAV SPLIT fseeko failed base=%s index=%llu offsetInPart=%llu errno=%d",
-                                 basePath.c_str(),
-                                 static_cast<unsigned long long>(index),
-                                 static_cast<unsigned long long>(offsetInPart),
-                                 errno);
-                    return false;
-                }
-
-                size_t written = std::fwrite(ptr, 1, toWrite, currentPart);
-                if (written != toWrite)
-                {
-                    Logger::Logf("WEBDAV SPLIT fwrite failed base=%s index=%llu expected=%zu written=%zu errno=%d",
-                                 basePath.c_str(),
-                                 static_cast<unsigned long long>(index),
-                                 toWrite,
-                                 written,
-                                 errno);
-                    return false;
-                }
-
-                ptr += written;
-                remaining -= written;
-                curOffset += written;
-            }
+        ListingKernels::ParseHttpDate(e.lastModified, entry.modified);
+    }
 
-            return true;
-        }
+    // Shared state of one chunked upload. Workers claim chunk numbers from
+    // `next` and PUT them with their own connection, each streamed from a
+    // ranged UploadSource; the first hard failure stops the rest.
+    struct ChunkUploadContext
+    {
+        std::mutex mutex;
+        std::string inputfile;
+        std::string uploadUrl;
+        std::string destination;
+        std::string user;
+        std::string pass;
+        int64_t size = 0;
+        int64_t chunkSize = 0;
+        int chunks = 0;
+        int next = 0;
+        bool failed = false;
+        std::string error;
     };
 
-    static int64_t GetSplitLocalSize(const std::string &basePath, uint64_t partSize)
-    {
-        int64_t total = 0;
-        std::string dirPath = basePath;
-        if (!FS::hasEndSlash(dirPath.c_str()))
-            dirPath.push_back('/');
+    const int kChunkUploadAttempts = 3;
 
-        for (int index = 0;; ++index)
+    static void FailChunkUpload(ChunkUploadContext *ctx, const std::string &err)
+    {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        if (!ctx->failed)
         {
-            char name[16];
-            std::snprintf(name, sizeof(name), "%02d", index);
-            std::string partPath = dirPath + name;
-            int64_t sz = FS::GetSize(partPath);
-            if (sz <= 0)
-                break;
-            total += sz;
-            if ((uint64_t)sz < partSize)
-                break;
+            ctx->failed = true;
+            ctx->error = err;
         }
-        return total;
     }
 
-    void WebDAVChunkDownloadThread(void *argp)
+    static void ChunkUploadWorker(ChunkUploadContext *ctx)
     {
-        WebDAVChunkTask *task = static_cast<WebDAVChunkTask *>(argp);
-        if (!task)
-            return;
+        CHTTPClient http([](const std::string &) {});
+        http.SetBasicAuth(ctx->user, ctx->pass);
+        http.InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
+        http.SetCertificateFile(CACERT_FILE);
 
-        const int kMaxAttempts = 6;
-        const int64_t kRetryDelayNs = 5000000000ll; // 5 seconds
-
-        CHTTPClient *http = task->client;
-        if (!http)
-        {
-            task->err = "internal error";
-            task->httpCode = 0;
-            task->ok = false;
-            return;
-        }
+        CHTTPClient::HeadersMap headers;
+        headers["Destination"] = ctx->destination;
+        headers["OC-Total-Length"] = std::to_string(ctx->size);
 
-        for (int attempt = 0; attempt < kMaxAttempts; ++attempt)
+        while (true)
         {
-            if (stop_activity)
+            int index;
             {
-                task->err = lang_strings[STR_CANCEL_ACTION_MSG];
-                task->httpCode = 0;
-                task->ok = false;
-                return;
+                std::lock_guard<std::mutex> lock(ctx->mutex);
+                if (ctx->failed || Cancel::Stopped() || ctx->next >= ctx->chunks)
+                    break;
+                index = ctx->next++;
             }
 
-            CHTTPClient::HttpResponse res;
-            CHTTPClient::HeadersMap headers;
-            if (!task->rangeHeader.empty())
-                headers["Range"] = task->rangeHeader;
-
-            bool ok = http->Get(task->url, headers, res);
-            task->httpCode = res.iCode;
-
-            if (!ok)
+            // The chunk is read ahead while it is sent, instead of all of
+            // it into memory first.
+            int64_t offset = static_cast<int64_t>(index) * ctx->chunkSize;
+            size_t len = static_cast<size_t>(std::min<int64_t>(ctx->chunkSize, ctx->size - offset));
+            UploadSource source(ctx->inputfile, static_cast<uint64_t>(offset), static_cast<int64_t>(len));
+            if (!source.Open() || source.Size() != len)
             {
-                task->err = res.errMessage;
-
-                bool retryable = (task->httpCode == 0);
-                Logger::Logf("WEBDAV GET parallel range error url=%s range=%s code=%ld err=%s attempt=%d/%d",
-                             task->url.c_str(),
-                             task->rangeHeader.c_str(),
-                             task->httpCode,
-                             task->err.c_str(),
-                             attempt + 1,
-                             kMaxAttempts);
-
-                if (!retryable || attempt == kMaxAttempts - 1)
-                {
-                    task->ok = false;
-                    return;
-                }
-
-                // Sleep in small slices so user cancel is responsive.
-                const int slices = 50;
-                const int64_t slice = kRetryDelayNs / slices;
-                for (int s = 0; s < slices; ++s)
-                {
-                    if (stop_activity)
-                    {
-                        task->err = lang_strings[STR_CANCEL_ACTION_MSG];
-                        task->httpCode = 0;
-                        task->ok = false;
-                        return;
-                    }
-                    svcSleepThread(slice);
-                }
-                continue;
+                FailChunkUpload(ctx, lang_strings[STR_FAIL_UPLOAD_MSG]);
+                break;
             }
 
-            if (res.iCode != 206)
-            {
-                task->err = "unexpected http code";
-                Logger::Logf("WEBDAV GET parallel unexpected code url=%s range=%s code=%ld attempt=%d/%d",
-                             task->url.c_str(),
-                             task->rangeHeader.c_str(),
-                             res.iCode,
-                             attempt + 1,
-                             kMaxAttempts);
-
-                bool retryable = (res.iCode >= 500 && res.iCode < 600);
-                if (!retryable || attempt == kMaxAttempts - 1)
-                {
-                    task->ok = false;
-                    return;
-                }
-
-                const int slices = 50;
-                const int64_t slice = kRetryDelayNs / slices;
-                for (int s = 0; s < slices; ++s)
-                {
-                    if (stop_activity)
-                    {
-                        task->err = lang_strings[STR_CANCEL_ACTION_MSG];
-                        task->httpCode = 0;
-                        task->ok = false;
-                        return;
-                    }
-                    svcSleepThread(slice);
-                }
-                continue;
-            }
+            // Nextcloud numbers chunks from 1; zero-padding keeps them in
+            // order when the server assembles them by name.
+            char name[16];
+            snprintf(name, sizeof(name), "/%05d", index + 1);
+            std::string url = ctx->uploadUrl + name;
 
-            if (res.strBody.empty())
+            bool sent = false;
+            for (int attempt = 1; attempt <= kChunkUploadAttempts && !sent && !Cancel::Stopped(); ++attempt)
             {
-                task->err = "empty body";
-                Logger::Logf("WEBDAV GET parallel empty body url=%s range=%s attempt=%d/%d",
-                             task->url.c_str(),
-                             task->rangeHeader.c_str(),
-                             attempt + 1,
-                             kMaxAttempts);
-
-                if (attempt == kMaxAttempts - 1)
-                {
-                    task->ok = false;
-                    return;
-                }
-
-                const int slices = 50;
-                const int64_t slice = kRetryDelayNs / slices;
-                for (int s = 0; s < slices; ++s)
+                CHTTPClient::HttpResponse res;
+                bool ok = (attempt == 1 || source.Seek(0)) && http.PutSource(url, headers, source, res);
+                if (ok && HTTP_SUCCESS(res.iCode))
                 {
-                    if (stop_activity)
-                    {
-                        task->err = lang_strings[STR_CANCEL_ACTION_MSG];
-                        task->httpCode = 0;
-                        task->ok = false;
-                        return;
-                    }
-                    svcSleepThread(slice);
+                    sent = true;
+                    break;
                 }
-                continue;
-            }
-
-            task->data.swap(res.strBody);
-            task->ok = true;
-            return;
-        }
-    }
-
-    void WebDAVParallelWorkerThread(void *argp)
-    {
-        WebDAVWorkerArgs *args = static_cast<WebDAVWorkerArgs *>(argp);
-        if (!args || !args->ctx || !args->client)
-            return;
-
-        WebDAVParallelContext *ctx = args->ctx;
-        CHTTPClient *http = args->client;
-
-        const int kMaxAttempts = 6;
-        const int64_t kRetryDelayNs = 5000000000ll; // 5 seconds
-
-        while (true)
-        {
-            int64_t start = 0;
-            int64_t end = 0;
-
-            {
-                std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                if (ctx->hadError)
-                    return;
-                if (ctx->nextOffset >= ctx->size)
-                    return;
-
-                start = ctx->nextOffset;
-                end = start + ctx->chunk_size - 1;
-                if (end >= ctx->size)
-                    end = ctx->size - 1;
-
-                ctx->nextOffset = end + 1;
+                LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "WEBDAV PUT chunk error url=%s code=%ld err=%s attempt=%d/%d",
+                                 url.c_str(), res.iCode, res.errMessage.c_str(), attempt, kChunkUploadAttempts);
+                // Client errors will not go away by sending the chunk again.
+                if (ok && res.iCode >= 400 && res.iCode < 500)
+                    break;
+                svcSleepThread(2000000000ull);
             }
-
-            char range_header[64];
-            std::snprintf(range_header, sizeof(range_header), "bytes=%lld-%lld",
-                          static_cast<long long>(start),
-                          static_cast<long long>(end));
-
-            for (int attempt = 0; attempt < kMaxAttempts; ++attempt)
+            if (!sent)
             {
-                if (stop_activity)
-                {
-                    std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                    if (!ctx->hadError)
-                    {
-                        ctx->hadError = true;
-                        ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                    }
-                    return;
-                }
-
-                CHTTPClient::HttpResponse res;
-                CHTTPClient::HeadersMap headers;
-                headers["Range"] = range_header;
-
-                bool ok = http->Get(ctx->url, headers, res);
-                long httpCode = res.iCode;
-
-                if (!ok)
-                {
-                    std::string err = res.errMessage;
-
-                    bool retryable = (httpCode == 0);
-                    Logger::Logf("WEBDAV GET parallel range error url=%s range=%s code=%ld err=%s attempt=%d/%d",
-                                 ctx->url.c_str(),
-                                 range_header,
-                                 httpCode,
-                                 err.c_str(),
-                                 attempt + 1,
-                                 kMaxAttempts);
-
-                    if (!retryable || attempt == kMaxAttempts - 1)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = err;
-                        }
-                        return;
-                    }
-
-                    const int slices = 50;
-                    const int64_t slice = kRetryDelayNs / slices;
-                    for (int s = 0; s < slices; ++s)
-                    {
-                        if (stop_activity)
-                        {
-                            std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                            if (!ctx->hadError)
-                            {
-                                ctx->hadError = true;
-                                ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                            }
-                            return;
-                        }
-                        svcSleepThread(slice);
-                    }
-                    continue;
-                }
-
-                if (res.iCode != 206)
-                {
-                    std::string err = "unexpected http code";
-                    Logger::Logf("WEBDAV GET parallel unexpected code url=%s range=%s code=%ld attempt=%d/%d",
-                                 ctx->url.c_str(),
-                                 range_header,
-                                 res.iCode,
-                                 attempt + 1,
-                                 kMaxAttempts);
-
-                    bool retryable = (res.iCode >= 500 && res.iCode < 600);
-                    if (!retryable || attempt == kMaxAttempts - 1)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = err;
-                        }
-                        return;
-                    }
-
-                    const int slices = 50;
-                    const int64_t slice = kRetryDelayNs / slices;
-                    for (int s = 0; s < slices; ++s)
-                    {
-                        if (stop_activity)
-                        {
-                            std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                            if (!ctx->hadError)
-                            {
-                                ctx->hadError = true;
-                                ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                            }
-                            return;
-                        }
-                        svcSleepThread(slice);
-                    }
-                    continue;
-                }
-
-                if (res.strBody.empty())
-                {
-                    std::string err = "empty body";
-                    Logger::Logf("WEBDAV GET parallel empty body url=%s range=%s attempt=%d/%d",
-                                 ctx->url.c_str(),
-                                 range_header,
-                                 attempt + 1,
-                                 kMaxAttempts);
-
-                    if (attempt == kMaxAttempts - 1)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = err;
-                        }
-                        return;
-                    }
-
-                    const int slices = 50;
-                    const int64_t slice = kRetryDelayNs / slices;
-                    for (int s = 0; s < slices; ++s)
-                    {
-                        if (stop_activity)
-                        {
-                            std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                            if (!ctx->hadError)
-                            {
-                                ctx->hadError = true;
-                                ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                            }
-                            return;
-                        }
-                        svcSleepThread(slice);
-                    }
-                    continue;
-                }
-
-                {
-                    std::lock_guard<std::mutex> fileLock(ctx->fileMutex);
-                    if (fseeko(ctx->file, (off_t)start, SEEK_SET) != 0)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = lang_strings[STR_FAIL_DOWNLOAD_MSG];
-                        }
-                        return;
-                    }
-
-                    size_t written = std::fwrite(res.strBody.data(), 1, res.strBody.size(), ctx->file);
-                    if (written != res.strBody.size())
-                    {
-                        Logger::Logf("WEBDAV GET parallel write failed path=%s expected=%zu written=%zu",
-                                     ctx->outputPath.c_str(),
-                                     res.strBody.size(),
-                                     written);
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = lang_strings[STR_FAIL_DOWNLOAD_MSG];
-                        }
-                        return;
-                    }
-
-                    bytes_transfered += static_cast<int64_t>(written);
-                    ctx->lastHttpCode = res.iCode;
-                }
-
+                FailChunkUpload(ctx, Cancel::Stopped() ? lang_strings[STR_CANCEL_ACTION_MSG] : lang_strings[STR_FAIL_UPLOAD_MSG]);
                 break;
             }
+
+            std::lock_guard<std::mutex> lock(ctx->mutex);
+            bytes_transfered += static_cast<int64_t>(len);
         }
+
+        http.CleanupSession();
     }
 
-    void WebDAVParallelSplitWorkerThread(void *argp)
+    static void ChunkUploadThread(void *argp)
     {
-        WebDAVSplitWorkerArgs *args = static_cast<WebDAVSplitWorkerArgs *>(argp);
-        if (!args || !args->ctx || !args->client)
-            return;
-
-        WebDAVParallelSplitContext *ctx = args->ctx;
-        CHTTPClient *http = args->client;
-
-        const int kMaxAttempts = 10;
-        const int64_t kRetryDelayNs = 5000000000ll; // 5 seconds
-
-        while (true)
-        {
-            int64_t start = 0;
-            int64_t end = 0;
-
-            {
-                std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                if (ctx->hadError)
-                    return;
-                if (ctx->nextOffset >= ctx->size)
-                    return;
-
-                start = ctx->nextOffset;
-                end = start + ctx->chunk_size - 1;
-                if (end >= ctx->size)
-                    end = ctx->size - 1;
-
-                ctx->nextOffset = end + 1;
-            }
-
-            char range_header[64];
-            std::snprintf(range_header, sizeof(range_header), "bytes=%lld-%lld",
-                          static_cast<long long>(start),
-                          static_cast<long long>(end));
-
-            for (int attempt = 0; attempt < kMaxAttempts; ++attempt)
-            {
-                if (stop_activity)
-                {
-                    std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                    if (!ctx->hadError)
-                    {
-                        ctx->hadError = true;
-                        ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                    }
-                    return;
-                }
-
-                CHTTPClient::HttpResponse res;
-                CHTTPClient::HeadersMap headers;
-                headers["Range"] = range_header;
-
-                bool ok = http->Get(ctx->url, headers, res);
-                long httpCode = res.iCode;
-
-                if (!ok)
-                {
-                    std::string err = res.errMessage;
-
-                    bool retryable = (httpCode == 0);
-                    Logger::Logf("WEBDAV GET split-parallel range error url=%s range=%s code=%ld err=%s attempt=%d/%d",
-                                 ctx->url.c_str(),
-                                 range_header,
-                                 httpCode,
-                                 err.c_str(),
-                                 attempt + 1,
-                                 kMaxAttempts);
-
-                    if (!retryable || attempt == kMaxAttempts - 1)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = err;
-                        }
-                        return;
-                    }
-
-                    const int slices = 50;
-                    const int64_t slice = kRetryDelayNs / slices;
-                    for (int s = 0; s < slices; ++s)
-                    {
-                        if (stop_activity)
-                        {
-                            std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                            if (!ctx->hadError)
-                            {
-                                ctx->hadError = true;
-                                ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                            }
-                            return;
-                        }
-                        svcSleepThread(slice);
-                    }
-                    continue;
-                }
-
-                if (res.iCode != 206)
-                {
-                    std::string err = "unexpected http code";
-                    Logger::Logf("WEBDAV GET split-parallel unexpected code url=%s range=%s code=%ld attempt=%d/%d",
-                                 ctx->url.c_str(),
-                                 range_header,
-                                 res.iCode,
-                                 attempt + 1,
-                                 kMaxAttempts);
-
-                    bool retryable = (res.iCode >= 500 && res.iCode < 600);
-                    if (!retryable || attempt == kMaxAttempts - 1)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = err;
-                        }
-                        return;
-                    }
-
-                    const int slices = 50;
-                    const int64_t slice = kRetryDelayNs / slices;
-                    for (int s = 0; s < slices; ++s)
-                    {
-                        if (stop_activity)
-                        {
-                            std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                            if (!ctx->hadError)
-                            {
-                                ctx->hadError = true;
-                                ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                            }
-                            return;
-                        }
-                        svcSleepThread(slice);
-                    }
-                    continue;
-                }
-
-                if (res.strBody.empty())
-                {
-                    std::string err = "empty body";
-                    Logger::Logf("WEBDAV GET split-parallel empty body url=%s range=%s attempt=%d/%d",
-                                 ctx->url.c_str(),
-                                 range_header,
-                                 attempt + 1,
-                                 kMaxAttempts);
-
-                    if (attempt == kMaxAttempts - 1)
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = err;
-                        }
-                        return;
-                    }
-
-                    const int slices = 50;
-                    const int64_t slice = kRetryDelayNs / slices;
-                    for (int s = 0; s < slices; ++s)
-                    {
-                        if (stop_activity)
-                        {
-                            std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                            if (!ctx->hadError)
-                            {
-                                ctx->hadError = true;
-                                ctx->errorMessage = lang_strings[STR_CANCEL_ACTION_MSG];
-                            }
-                            return;
-                        }
-                        svcSleepThread(slice);
-                    }
-                    continue;
-                }
-
-                {
-                    std::lock_guard<std::mutex> sinkLock(ctx->sinkMutex);
-                    if (!ctx->sink->write(static_cast<uint64_t>(start),
-                                          res.strBody.data(),
-                                          res.strBody.size()))
-                    {
-                        std::lock_guard<std::mutex> lock(ctx->stateMutex);
-                        if (!ctx->hadError)
-                        {
-                            ctx->hadError = true;
-                            ctx->errorMessage = lang_strings[STR_FAIL_DOWNLOAD_MSG];
-                        }
-                        return;
-                    }
-
-                    bytes_transfered += static_cast<int64_t>(res.strBody.size());
-                    ctx->lastHttpCode = res.iCode;
-                }
-
-                break;
-            }
-        }
+        ChunkUploadWorker(static_cast<ChunkUploadContext *>(argp));
+        threadExit();
     }
 }
 
@@ -928,110 +301,162 @@ std::string WebDAVClient::GetHttpUrl(std::string url)
 int WebDAVClient::Connect(const std::string &host, const std::string &user, const std::string &pass)
 {
     std::string url = GetHttpUrl(host);
+    rclone.reset();
+    if (!rclone_url.empty())
+        rclone.reset(new RcloneRc(rclone_url, rclone_fs, user, pass));
     return BaseClient::Connect(url, user, pass);
 }
 
-bool WebDAVClient::PropFind(const std::string &path, int depth, CHTTPClient::HttpResponse &res)
+void WebDAVClient::SetRclone(const std::string &url, const std::string &fs)
 {
-    CHTTPClient::HeadersMap headers;
-    headers["Accept"] = "*/*";
-    headers["Depth"] = std::to_string(depth);
-    std::string encoded_path = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
-
-    return client->CustomRequest("PROPFIND", encoded_path, headers, res);
+    rclone_url = url;
+    rclone_fs = fs;
 }
 
-int WebDAVClient::Size(const std::string &path, int64_t *size)
+bool WebDAVClient::PropFind(const std::string &path, int depth, const WebDAVPropfindParser::EntryFn &onEntry,
+                            const bool *cancel, long *httpCode, const char *props)
 {
-    CHTTPClient::HttpResponse res;
-
-    Logger::Logf("WEBDAV Size path='%s'", path.c_str());
+    // Entries are built from these four; allprop makes Nextcloud and SFTPGo
+    // add permissions, ids, quota and dead properties to every one of them.
+    static const char *kEntryProps = "<d:resourcetype/><d:getcontentlength/><d:getlastmodified/><d:getetag/>";
+    bool entry_props = props == nullptr && !prop_body_rejected;
+    if (entry_props)
+        props = kEntryProps;
 
-    if (PropFind(path, 1, res))
+    CHTTPClient::HeadersMap headers;
+    headers["Accept"] = "*/*";
+    headers["Depth"] = (depth < 0) ? "infinity" : std::to_string(depth);
+    std::string request;
+    if (props != nullptr)
     {
-        pugi::xml_document document;
-        document.load_buffer(res.strBody.data(), res.strBody.size());
-        auto multistatus = document.select_node("*[local-name()='multistatus']").node();
-        auto responses = multistatus.select_nodes("*[local-name()='response']");
+        headers["Content-Type"] = "application/xml; charset=utf-8";
+        request = std::string("<?xml version=\"1.0\" encoding=\"utf-8\"?><d:propfind xmlns:d=\"DAV:\"><d:prop>") +
+                  props + "</d:prop></d:propfind>";
+    }
+    std::string encoded_path = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
 
-        // Normalize target path to the logical path the UI uses (without
-        // any WebDAV base path like "/dav"). This makes it match the
-        // href values returned by SFTPGo and other servers that expose
-        // physical paths (eg "/F:2TB/...") directly.
-        std::string target_path_without_sep = path;
-        Util::Trim(target_path_without_sep, " ");
-        Util::Rtrim(target_path_without_sep, "/");
-        if (target_path_without_sep.empty())
-            target_path_without_sep = "/";
+    // The multistatus body is parsed as it streams in; entries reach the
+    // caller while the rest of the listing is still on the wire.
+    ParseProfile profile("webdav");
+    WebDAVPropfindParser parser([&profile, &onEntry](const WebDAVPropfindEntry &entry)
+                                {
+                                    profile.Add(0, 1);
+                                    onEntry(entry);
+                                });
+    CHTTPClient::HttpResponse res;
+    bool ok = client->CustomRequestToSink("PROPFIND", encoded_path, headers,
+                                          [&parser, &profile, cancel](const char *data, size_t len)
+                                          {
+                                              if (cancel && *cancel)
+                                                  return false;
+                                              profile.Resume();
+                                              bool fed = parser.Feed(data, len);
+                                              profile.Pause();
+                                              profile.Add(len, 0);
+                                              return fed;
+                                          },
+                                          res, props != nullptr ? &request : nullptr);
+    if (entry_props && (res.iCode == 400 || res.iCode == 415 || res.iCode == 422))
+    {
+        Logger::Logf("WEBDAV PROPFIND prop body rejected code=%ld, using allprop", res.iCode);
+        prop_body_rejected = true;
+        return PropFind(path, depth, onEntry, cancel, httpCode, nullptr);
+    }
+    if (httpCode)
+        *httpCode = res.iCode;
+    if (!ok)
+    {
+        if (res.errMessage == "local write failed")
+            snprintf(this->response, sizeof(this->response), "PROPFIND: %s", parser.Error());
+        else
+            snprintf(this->response, sizeof(this->response), "%s", res.errMessage.c_str());
+        return false;
+    }
+    if (res.iCode < 200 || res.iCode >= 300)
+        return true;
 
-        Logger::Logf("WEBDAV Size normalized target_path='%s', responses=%zu",
-                     target_path_without_sep.c_str(), responses.size());
+    profile.Resume();
+    bool complete = parser.Finish();
+    profile.Pause();
+    if (!complete)
+        Logger::Logf("WEBDAV PROPFIND truncated body path='%s' err=%s", path.c_str(), parser.Error());
+    return true;
+}
 
-        for (auto response : responses)
+std::string WebDAVClient::ResourcePath(const std::string &href) const
+{
+    std::string resource_path = CHTTPClient::DecodeUrl(href, false);
+    resource_path.erase(resource_path.find_last_not_of('/') + 1);
+    // Strip any WebDAV base path (eg "/dav") from the beginning, so URLs
+    // like "/dav/F:2TB/..." match our logical path "/F:2TB/...". This
+    // also matches servers like SFTPGo that expose physical paths.
+    if (!this->base_path.empty() && this->base_path != "/")
+    {
+        if (resource_path.compare(0, this->base_path.size(), this->base_path) == 0)
         {
-            pugi::xml_node href = response.node().select_node("*[local-name()='href']").node();
-            if (!href || !href.first_child())
-                continue;
-
-            std::string resource_path = CHTTPClient::DecodeUrl(href.first_child().value(), false);
-            auto resource_path_without_sep = resource_path.erase(resource_path.find_last_not_of('/') + 1);
-            // Strip any WebDAV base path (eg "/dav") from the beginning,
-            // so URLs like "/dav/F:2TB/..." match our logical path
-            // "/F:2TB/...".
-            if (!this->base_path.empty() && this->base_path != "/")
-            {
-                if (resource_path_without_sep.compare(0, this->base_path.size(), this->base_path) == 0)
-                {
-                    resource_path_without_sep.erase(0, this->base_path.size());
-                    if (resource_path_without_sep.empty())
-                        resource_path_without_sep = "/";
-                }
-            }
-
-            Logger::Logf("WEBDAV Size href='%s' -> resource_path='%s' target='%s'",
-                         href.first_child().value(),
-                         resource_path_without_sep.c_str(),
-                         target_path_without_sep.c_str());
-
-            if (resource_path_without_sep != target_path_without_sep)
-                continue;
-
-            auto propstat = response.node().select_node("*[local-name()='propstat']").node();
-            auto prop = propstat.select_node("*[local-name()='prop']").node();
-            auto len_node = prop.select_node("*[local-name()='getcontentlength']").node();
-            if (!len_node || !len_node.first_child())
-                continue;
-
-            std::string content_length = len_node.first_child().value();
-            *size = atoll(content_length.c_str());
-            return 1;
+            resource_path.erase(0, this->base_path.size());
+            if (resource_path.empty())
+                resource_path = "/";
         }
     }
-    else
+    return resource_path;
+}
+
+int WebDAVClient::Size(const std::string &path, int64_t *size)
+{
+    Logger::Logf("WEBDAV Size path='%s'", path.c_str());
+
+    // Normalize target path to the logical path the UI uses (without
+    // any WebDAV base path like "/dav").
+    std::string target_path_without_sep = path;
+    Util::Trim(target_path_without_sep, " ");
+    Util::Rtrim(target_path_without_sep, "/");
+    if (target_path_without_sep.empty())
+        target_path_without_sep = "/";
+
+    bool found = false;
+    bool ok = PropFind(path, 0, [&](const WebDAVPropfindEntry &e)
+                       {
+                           if (found || e.href.empty() || e.contentLength.empty())
+                               return;
+                           if (ResourcePath(e.href) != target_path_without_sep)
+                               return;
+                           *size = atoll(e.contentLength.c_str());
+                           found = true;
+                       });
+    if (!ok)
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
-        Logger::Logf("WEBDAV Size PROPFIND failed err=%s", this->response);
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV Size PROPFIND failed err=%s", this->response);
+        return 0;
     }
 
-    return 0;
+    if (!found)
+        Logger::Logf("WEBDAV Size no match target='%s'", target_path_without_sep.c_str());
+    return found ? 1 : 0;
 }
 
 int WebDAVClient::Get(const std::string &outputfile, const std::string &path, uint64_t offset)
+{
+    return GetKnownSize(outputfile, path, 0, offset);
+}
+
+int WebDAVClient::GetKnownSize(const std::string &outputfile, const std::string &path, int64_t known_size, uint64_t offset)
 {
     bytes_transfered = 0;
     prev_tick = Util::GetTick();
 
-    if (stop_activity)
+    if (Cancel::Stopped())
     {
         sprintf(this->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
         Logger::Logf("WEBDAV GET cancelled before start path=%s", path.c_str());
         return 0;
     }
 
-    // First, try to get the full size via PROPFIND so we can download
-    // in smaller HTTP range chunks (more robust with Tailscale/Funnel).
-    int64_t size = 0;
-    if (!Size(path, &size) || size <= 0)
+    // The full size lets us download in smaller HTTP range chunks (more
+    // robust with Tailscale/Funnel). It normally comes from the listing
+    // the file was picked from; only probe with PROPFIND when unknown.
+    int64_t size = known_size;
+    if (size <= 0 && (!Size(path, &size) || size <= 0))
     {
         Logger::Logf("WEBDAV GET unable to determine size for path='%s', falling back to single GET",
                      path.c_str());
@@ -1044,7 +469,7 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         if (!client->Get(encoded_url_fallback, headers_fallback, res_fallback))
         {
             sprintf(this->response, "%s", res_fallback.errMessage.c_str());
-            Logger::Logf("WEBDAV GET fallback error url=%s err=%s",
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET fallback error url=%s err=%s",
                          encoded_url_fallback.c_str(), res_fallback.errMessage.c_str());
             return 0;
         }
@@ -1052,7 +477,7 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         if (!HTTP_SUCCESS(res_fallback.iCode))
         {
             sprintf(this->response, "%ld - %s", res_fallback.iCode, lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET fallback http error url=%s code=%ld",
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET fallback http error url=%s code=%ld",
                          encoded_url_fallback.c_str(), res_fallback.iCode);
             return 0;
         }
@@ -1061,7 +486,7 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         if (!file_fallback)
         {
             sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET fallback fopen failed path=%s", outputfile.c_str());
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET fallback fopen failed path=%s", outputfile.c_str());
             return 0;
         }
 
@@ -1071,7 +496,7 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         if (written_fb != res_fallback.strBody.size())
         {
             sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET fallback write failed path=%s expected=%zu written=%zu",
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET fallback write failed path=%s expected=%zu written=%zu",
                          outputfile.c_str(), res_fallback.strBody.size(), written_fb);
             return 0;
         }
@@ -1096,6 +521,11 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
     }
 
     std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    expected_digest = FileDigest();
+    if (verify_downloads)
+        FetchDigest(encoded_url);
+    if (verify_downloads && !expected_digest.Valid() && rclone)
+        expected_digest = rclone->Digest(path);
 
     // Use configurable HTTP range chunk size (in MiB), defaulting to 8 MiB.
     // This keeps per-request overhead low over high-latency links while
@@ -1108,13 +538,13 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         chunk_mb = 32;
     int64_t chunk_size = static_cast<int64_t>(chunk_mb) * 1024 * 1024;
 
-    const uint64_t kSplitPartSize = 4294901760ULL; // 4 GiB - 64 KiB
+    const uint64_t kSplitPartSize = LocalFileSink::kSplitPartSize;
     // For files larger than 4 GiB, use the DBI-style split layout when
     // either the user explicitly requests it via webdav_split_large=1 or
     // when we are emulating FAT32 (force_fat32=1). On exFAT, the default
     // is now to keep a single flat NSP so tools like Tinfoil see a normal
     // game file instead of a split folder.
-    bool need_split = force_fat32 || (webdav_split_large && size > 0xFFFFFFFFLL);
+    bool need_split = LocalFileSink::NeedsSplit(size);
 
     if (need_split)
     {
@@ -1160,8 +590,10 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
             splitBase.push_back('/');
         splitBase += safeName;
 
-        int64_t local_split_size = GetSplitLocalSize(splitBase, kSplitPartSize);
-        if (local_split_size >= size)
+        // Parallel runs write parts out of order, so their size alone does
+        // not prove the download finished while a journal is still open.
+        int64_t local_split_size = LocalFileSink::SplitLocalSize(splitBase, kSplitPartSize);
+        if (local_split_size >= size && !TransferJournal::Exists(outputfile))
         {
             bytes_to_download = size;
             bytes_transfered = size;
@@ -1177,17 +609,8 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         int parallel = webdav_parallel_connections;
         if (parallel < 1)
             parallel = 1;
-        else if (parallel > 16)
-            parallel = 16;
-
-        const int64_t max_window = 256LL * 1024 * 1024; // 256 MiB
-        if (chunk_size * parallel > max_window)
-        {
-            chunk_size = max_window / parallel;
-            if (chunk_size < (1LL * 1024 * 1024))
-                chunk_size = 1LL * 1024 * 1024;
-            chunk_mb = static_cast<int>(chunk_size / (1024 * 1024));
-        }
+        else if (parallel > 32)
+            parallel = 32;
 
         Logger::Logf("WEBDAV GET split (ranged) url=%s -> output=%s remote_size=%lld local_size=%lld chunk_size=%lld parallel=%d",
                      encoded_url.c_str(),
@@ -1201,14 +624,24 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
         if (wants_parallel_split && ProbeRangeSupport(encoded_url))
         {
             Logger::Logf("WEBDAV GET using parallel split ranged download url=%s", encoded_url.c_str());
+            TransferJournal journal;
+            bool resume = PrepareJournal(journal, outputfile, splitBase, path, encoded_url, size, kSplitPartSize);
             return GetRangedParallelSplit(splitBase,
                                           encoded_url,
                                           size,
                                           chunk_size,
                                           parallel,
-                                          kSplitPartSize);
+                                          kSplitPartSize,
+                                          journal,
+                                          resume);
         }
 
+        if (local_split_size > 0 && local_split_size < size &&
+            !VerifyResume(splitBase, kSplitPartSize, path, {std::make_pair((int64_t)0, local_split_size)}))
+        {
+            local_split_size = 0;
+            bytes_transfered = 0;
+        }
         Logger::Logf("WEBDAV GET using sequential split ranged download url=%s", encoded_url.c_str());
         return GetRangedSequentialSplit(splitBase,
                                         encoded_url,
@@ -1262,8 +695,16 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
     // are writing to a single file. If we find a local file smaller than
     // the remote size, resume from that offset using a sequential ranged
     // download to avoid restarting.
+    // A parallel run pre-sizes its file, so one with a journal resumes
+    // through the journal below instead.
     int64_t local_size = FS::GetSize(singleOutput);
-    if (local_size > 0 && local_size < size)
+    if (local_size > 0 && local_size < size && !TransferJournal::Exists(outputfile) &&
+        !VerifyResume(singleOutput, 0, path, {std::make_pair((int64_t)0, local_size)}))
+    {
+        Logger::Logf("WEBDAV GET resume refused, remote changed output=%s", singleOutput.c_str());
+        local_size = 0;
+    }
+    if (local_size > 0 && local_size < size && !TransferJournal::Exists(outputfile))
     {
         if (!EnsureParentDirectory(outputfile))
         {
@@ -1294,17 +735,9 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
     else if (parallel > 32)
         parallel = 32;
 
-    // Keep the total in-flight window (chunk_size * parallel) under a
-    // cap to avoid excessive memory usage when the user configures both
-    // a large chunk size and many workers.
-    const int64_t max_window = 256LL * 1024 * 1024; // 256 MiB
-    if (chunk_size * parallel > max_window)
-    {
-        chunk_size = max_window / parallel;
-        if (chunk_size < (1LL * 1024 * 1024))
-            chunk_size = 1LL * 1024 * 1024;
-        chunk_mb = static_cast<int>(chunk_size / (1024 * 1024));
-    }
+    // Range bodies are streamed to disk through a fixed 1 MiB buffer per
+    // worker, so chunk_size * parallel no longer bounds memory usage and
+    // needs no in-flight window cap.
 
     Logger::Logf("WEBDAV GET (ranged) url=%s -> output=%s size=%lld chunk_size=%lld parallel=%d",
                  encoded_url.c_str(),
@@ -1320,45 +753,22 @@ int WebDAVClient::Get(const std::string &outputfile, const std::string &path, ui
     if (wants_parallel && ProbeRangeSupport(encoded_url))
     {
         Logger::Logf("WEBDAV GET using parallel ranged download url=%s", encoded_url.c_str());
-        return GetRangedParallel(singleOutput, encoded_url, size, chunk_size, parallel);
+        TransferJournal journal;
+        bool resume = PrepareJournal(journal, outputfile, singleOutput, path, encoded_url, size, 0);
+        return GetRangedParallel(singleOutput, encoded_url, size, chunk_size, parallel, journal, resume);
     }
 
     Logger::Logf("WEBDAV GET using sequential ranged download url=%s", encoded_url.c_str());
     return GetRangedSequential(singleOutput, encoded_url, size, chunk_size);
 }
 
-bool WebDAVClient::ProbeRangeSupport(const std::string &encoded_url)
+int WebDAVClient::GetRangedSequential(const std::string &outputfile,
+                                      const std::string &encoded_url,
+                                      int64_t size,
+                                      int64_t chunk_size)
 {
-    CHTTPClient::HttpResponse res;
-    CHTTPClient::HeadersMap headers;
-    headers["Range"] = "bytes=0-0";
-
-    if (!client->Get(encoded_url, headers, res))
-    {
-        Logger::Logf("WEBDAV GET range probe error url=%s err=%s",
-                     encoded_url.c_str(), res.errMessage.c_str());
-        return false;
-    }
-
-    if (res.iCode == 206)
-    {
-        Logger::Logf("WEBDAV GET range probe ok url=%s code=%ld",
-                     encoded_url.c_str(), res.iCode);
-        return true;
-    }
-
-    Logger::Logf("WEBDAV GET range probe unsupported url=%s code=%ld",
-                 encoded_url.c_str(), res.iCode);
-    return false;
-}
-
-int WebDAVClient::GetRangedSequential(const std::string &outputfile,
-                                      const std::string &encoded_url,
-                                      int64_t size,
-                                      int64_t chunk_size)
-{
-    return GetRangedSequential(outputfile, encoded_url, size, chunk_size, 0);
-}
+    return GetRangedSequential(outputfile, encoded_url, size, chunk_size, 0);
+}
 
 int WebDAVClient::GetRangedSequential(const std::string &outputfile,
                                       const std::string &encoded_url,
@@ -1370,12 +780,18 @@ int WebDAVClient::GetRangedSequential(const std::string &outputfile,
     if (!file)
     {
         sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        Logger::Logf("WEBDAV GET fopen failed path=%s", outputfile.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET fopen failed path=%s", outputfile.c_str());
         return 0;
     }
 
     int64_t offset_bytes = start_offset;
     long last_code = 0;
+    // Failed attempts at the current chunk; only that chunk is fetched again.
+    int attempt = 0;
+    const int kMaxChunkAttempts = 6;
+    std::unique_ptr<ChecksumWriter> checksum;
+    if (expected_digest.Valid())
+        checksum.reset(new ChecksumWriter(expected_digest.algo));
 
     if (offset_bytes > 0)
     {
@@ -1383,7 +799,7 @@ int WebDAVClient::GetRangedSequential(const std::string &outputfile,
         {
             std::fclose(file);
             sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET ranged resume seek failed path=%s offset=%lld",
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET ranged resume seek failed path=%s offset=%lld",
                          outputfile.c_str(),
                          static_cast<long long>(offset_bytes));
             return 0;
@@ -1392,7 +808,7 @@ int WebDAVClient::GetRangedSequential(const std::string &outputfile,
 
     while (offset_bytes < size)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
         {
             std::fclose(file);
             sprintf(this->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
@@ -1411,47 +827,102 @@ int WebDAVClient::GetRangedSequential(const std::string &outputfile,
                       static_cast<long long>(offset_bytes),
                       static_cast<long long>(end));
 
-        CHTTPClient::HeadersMap headers;
-        headers["Range"] = range_header;
+
+        // Stream the range straight into the output file; the file position
+        // already sits at offset_bytes, so plain sequential writes suffice.
+        int64_t chunk_written = 0;
+        bool write_failed = false;
+        CHTTPClient::SinkFn sink = [&](const char *data, size_t len) -> bool
+        {
+            if (Cancel::Stopped())
+                return false;
+
+            size_t written = std::fwrite(data, 1, len, file);
+            if (written != len)
+            {
+                Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET range write failed path=%s expected=%zu written=%zu",
+                             outputfile.c_str(), len, written);
+                write_failed = true;
+                return false;
+            }
+
+            if (checksum)
+                checksum->Update(static_cast<uint64_t>(offset_bytes + chunk_written), data, len);
+            chunk_written += static_cast<int64_t>(written);
+            bytes_transfered = offset_bytes + chunk_written;
+            TransferStats::SetBytes(bytes_transfered);
+            return true;
+        };
 
         CHTTPClient::HttpResponse res;
-        if (!client->Get(encoded_url, headers, res))
+        bool got = client->GetRangeToSink(encoded_url, offset_bytes, end, sink, res);
+        bool chunk_ok = got && (res.iCode == 206 || res.iCode == 200);
+        bool retryable = got ? (res.iCode >= 500 || res.iCode == 429) : (res.iCode == 0);
+        if (!chunk_ok && !write_failed && !Cancel::Stopped() && retryable)
         {
-            sprintf(this->response, "%s", res.errMessage.c_str());
-            Logger::Logf("WEBDAV GET range error url=%s range=%s err=%s",
+            if (res.iCode == 429 || res.iCode == 503)
+            {
+                HostHealth::Record(encoded_url, HostHealth::OUTCOME_THROTTLED);
+                uint64_t after = HostHealth::RetryAfterUs(res.mapHeadersLowercase);
+                if (after > 0)
+                    HostHealth::Hold(encoded_url, after);
+            }
+            else
+            {
+                HostHealth::Record(encoded_url, got ? HostHealth::OUTCOME_ERROR : HostHealth::OUTCOME_RESET);
+            }
+
+            if (attempt + 1 < kMaxChunkAttempts &&
+                fseeko(file, (off_t)offset_bytes, SEEK_SET) == 0)
+            {
+                uint64_t delay = HostHealth::RetryDelayUs(encoded_url, attempt, 1000000, 16000000);
+                ++attempt;
+                LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "WEBDAV GET range retry url=%s range=%s code=%ld err=%s attempt=%d/%d delay_ms=%llu",
+                                 encoded_url.c_str(), range_header, res.iCode, res.errMessage.c_str(),
+                                 attempt, kMaxChunkAttempts, (unsigned long long)(delay / 1000));
+                bytes_transfered = offset_bytes;
+                TransferStats::SetBytes(bytes_transfered);
+                TransferStats::AddRetry();
+                for (uint64_t waited = 0; waited < delay && !Cancel::Stopped(); waited += 100000)
+                    svcSleepThread(100000000ull);
+                continue;
+            }
+        }
+
+        if (!got)
+        {
+            if (write_failed)
+                sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+            else if (Cancel::Stopped())
+                sprintf(this->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+            else
+                snprintf(this->response, sizeof(this->response), "%s", res.errMessage.c_str());
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET range error url=%s range=%s err=%s",
                          encoded_url.c_str(), range_header, res.errMessage.c_str());
             std::fclose(file);
             return 0;
         }
 
         last_code = res.iCode;
-        if (!(res.iCode == 206 || res.iCode == 200))
+        if (!chunk_ok)
         {
             sprintf(this->response, "%ld - %s", res.iCode, lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET range http error url=%s range=%s code=%ld",
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET range http error url=%s range=%s code=%ld",
                          encoded_url.c_str(), range_header, res.iCode);
             std::fclose(file);
             return 0;
         }
 
-        if (res.strBody.empty())
+        if (chunk_written == 0)
         {
             Logger::Logf("WEBDAV GET range empty body url=%s range=%s", encoded_url.c_str(), range_header);
             break;
         }
 
-        size_t written = std::fwrite(res.strBody.data(), 1, res.strBody.size(), file);
-        if (written != res.strBody.size())
-        {
-            sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET range write failed path=%s expected=%zu written=%zu",
-                         outputfile.c_str(), res.strBody.size(), written);
-            std::fclose(file);
-            return 0;
-        }
-
-        offset_bytes += static_cast<int64_t>(res.strBody.size());
+        offset_bytes += chunk_written;
         bytes_transfered = offset_bytes;
+        attempt = 0;
+        HostHealth::Record(encoded_url, HostHealth::OUTCOME_OK);
 
         // If server ignored Range and returned the full file with 200,
         // we are done after the first iteration.
@@ -1470,6 +941,26 @@ int WebDAVClient::GetRangedSequential(const std::string &outputfile,
         return 0;
     }
 
+    if (checksum)
+    {
+        // Only a resumed head the writes did not see is read back.
+        FILE *in = nullptr;
+        FileDigest actual;
+        bool digested = checksum->Final(static_cast<uint64_t>(offset_bytes),
+                                        [&](uint64_t offset, char *data, size_t len)
+                                        {
+                                            if (!in)
+                                                in = std::fopen(outputfile.c_str(), "rb");
+                                            return in && fseeko(in, (off_t)offset, SEEK_SET) == 0 &&
+                                                   std::fread(data, 1, len, in) == len;
+                                        },
+                                        actual);
+        if (in)
+            std::fclose(in);
+        if (!VerifyDownload(outputfile, false, digested, actual))
+            return 0;
+    }
+
     uint64_t now = Util::GetTick();
     double elapsed_sec = (now - prev_tick) * 1.0 / 1000000.0;
     double mb = (offset_bytes / 1048576.0);
@@ -1494,20 +985,25 @@ int WebDAVClient::GetRangedSequentialSplit(const std::string &outputfile,
                                            int64_t start_offset,
                                            uint64_t partSize)
 {
-    SplitFileWriter sink(outputfile, partSize);
-    if (!sink.open())
+    // Part sizes double as the resume point here, so nothing is reserved
+    // ahead of the data.
+    LocalFileSink sink(outputfile, partSize);
+    if (!sink.Open(start_offset > 0))
     {
         sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        Logger::Logf("WEBDAV GET split open failed base=%s", outputfile.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split open failed base=%s", outputfile.c_str());
         return 0;
     }
+    if (expected_digest.Valid())
+        sink.EnableChecksum(expected_digest.algo);
 
     int64_t offset_bytes = start_offset;
     long last_code = 0;
+    LocalSinkStream stream(sink, static_cast<uint64_t>(start_offset));
 
     while (offset_bytes < size)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
         {
             sprintf(this->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
             Logger::Logf("WEBDAV GET split range cancelled url=%s bytes=%lld",
@@ -1525,14 +1021,40 @@ int WebDAVClient::GetRangedSequentialSplit(const std::string &outputfile,
                       static_cast<long long>(offset_bytes),
                       static_cast<long long>(end));
 
-        CHTTPClient::HeadersMap headers;
-        headers["Range"] = range_header;
+
+        int64_t chunk_written = 0;
+        bool write_failed = false;
+        CHTTPClient::SinkFn sinkFn = [&](const char *data, size_t len) -> bool
+        {
+            if (Cancel::Stopped())
+                return false;
+
+            if (!stream.Write(data, len))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split write failed base=%s offset=%lld size=%zu",
+                             outputfile.c_str(),
+                             static_cast<long long>(offset_bytes + chunk_written),
+                             len);
+                write_failed = true;
+                return false;
+            }
+
+            chunk_written += static_cast<int64_t>(len);
+            bytes_transfered = offset_bytes + chunk_written;
+            TransferStats::SetBytes(bytes_transfered);
+            return true;
+        };
 
         CHTTPClient::HttpResponse res;
-        if (!client->Get(encoded_url, headers, res))
+        if (!client->GetRangeToSink(encoded_url, offset_bytes, end, sinkFn, res))
         {
-            sprintf(this->response, "%s", res.errMessage.c_str());
-            Logger::Logf("WEBDAV GET split range error url=%s range=%s err=%s",
+            if (write_failed)
+                sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+            else if (Cancel::Stopped())
+                sprintf(this->response, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+            else
+                snprintf(this->response, sizeof(this->response), "%s", res.errMessage.c_str());
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split range error url=%s range=%s err=%s",
                          encoded_url.c_str(), range_header, res.errMessage.c_str());
             return 0;
         }
@@ -1541,31 +1063,19 @@ int WebDAVClient::GetRangedSequentialSplit(const std::string &outputfile,
         if (!(res.iCode == 206 || res.iCode == 200))
         {
             sprintf(this->response, "%ld - %s", res.iCode, lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET split range http error url=%s range=%s code=%ld",
+            Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split range http error url=%s range=%s code=%ld",
                          encoded_url.c_str(), range_header, res.iCode);
             return 0;
         }
 
-        if (res.strBody.empty())
+        if (chunk_written == 0)
         {
             Logger::Logf("WEBDAV GET split range empty body url=%s range=%s",
                          encoded_url.c_str(), range_header);
             break;
         }
 
-        if (!sink.write(static_cast<uint64_t>(offset_bytes),
-                        res.strBody.data(),
-                        res.strBody.size()))
-        {
-            sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-            Logger::Logf("WEBDAV GET split write failed base=%s offset=%lld size=%zu",
-                         outputfile.c_str(),
-                         static_cast<long long>(offset_bytes),
-                         res.strBody.size());
-            return 0;
-        }
-
-        offset_bytes += static_cast<int64_t>(res.strBody.size());
+        offset_bytes += chunk_written;
         bytes_transfered = offset_bytes;
 
         if (res.iCode == 200)
@@ -1574,6 +1084,13 @@ int WebDAVClient::GetRangedSequentialSplit(const std::string &outputfile,
         }
     }
 
+    if (!stream.Flush())
+    {
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split write failed base=%s", outputfile.c_str());
+        return 0;
+    }
+
     if (offset_bytes <= 0)
     {
         sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
@@ -1596,15 +1113,23 @@ int WebDAVClient::GetRangedSequentialSplit(const std::string &outputfile,
     Logger::Logf("WEBDAV GET split ranged done url=%s code=%ld bytes=%lld",
                  encoded_url.c_str(), last_code, static_cast<long long>(offset_bytes));
 
+    if (expected_digest.Valid())
+    {
+        FileDigest actual;
+        bool digested = sink.Digest(static_cast<uint64_t>(offset_bytes), actual);
+        sink.Close();
+        if (!VerifyDownload(outputfile, true, digested, actual))
+            return 0;
+    }
+
     // Mark the split base directory as a concatenation file for the
     // sequential split path as well so that the OS sees it as a single
     // logical file.
-    Result cat_rc = fsdevSetConcatenationFileAttribute(outputfile.c_str());
-    if (R_FAILED(cat_rc))
+    if (!sink.Finish())
     {
-        Logger::Logf("WEBDAV GET split-ranged failed to set concatenation attribute path=%s rc=0x%08x",
-                     outputfile.c_str(),
-                     cat_rc);
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split write failed base=%s", outputfile.c_str());
+        return 0;
     }
     return 1;
 }
@@ -1614,90 +1139,97 @@ int WebDAVClient::GetRangedParallelSplit(const std::string &outputfile,
                                          int64_t size,
                                          int64_t chunk_size,
                                          int parallel,
-                                         uint64_t partSize)
+                                         uint64_t partSize,
+                                         TransferJournal &journal,
+                                         bool resume)
 {
-    SplitFileWriter sink(outputfile, partSize);
-    if (!sink.open())
+    // Parts are kept on resume, so blocks from an earlier run stay in place.
+    LocalFileSink sink(outputfile, partSize);
+    if (!sink.Open(resume))
     {
         sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        Logger::Logf("WEBDAV GET split-parallel open failed base=%s", outputfile.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split-parallel open failed base=%s", outputfile.c_str());
         return 0;
     }
-
-    bytes_transfered = 0;
-
-    WebDAVParallelSplitContext ctx;
-    ctx.url = encoded_url;
-    ctx.sink = &sink;
-    ctx.size = size;
-    ctx.chunk_size = chunk_size;
-    ctx.nextOffset = 0;
-    ctx.hadError = false;
-    ctx.lastHttpCode = 0;
-
-    std::vector<std::unique_ptr<CHTTPClient>> httpClients;
-    httpClients.reserve(parallel);
-    for (int i = 0; i < parallel; ++i)
-    {
-        auto client = std::make_unique<CHTTPClient>([](const std::string &) {});
-        client->SetBasicAuth(http_username, http_password);
-        client->InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
-        client->SetCertificateFile(CACERT_FILE);
-        httpClients.push_back(std::move(client));
-    }
-
-    std::vector<Thread> threads(parallel);
-    std::vector<WebDAVSplitWorkerArgs> workerArgs(parallel);
-
-    bool threadError = false;
-    for (int i = 0; i < parallel; ++i)
-    {
-        workerArgs[i].ctx = &ctx;
-        workerArgs[i].client = httpClients[i].get();
-
-        Result rc = threadCreate(&threads[i],
-                                 WebDAVParallelSplitWorkerThread,
-                                 &workerArgs[i],
-                                 nullptr,
-                                 0x4000,
-                                 0x3B,
-                                 -2);
-        if (R_FAILED(rc))
-        {
-            threadError = true;
-            Logger::Logf("WEBDAV GET split-parallel threadCreate failed index=%d rc=0x%x", i, rc);
-            break;
-        }
+    if (!resume)
+        sink.Preallocate(static_cast<uint64_t>(size));
+    std::unique_ptr<ChunkHashTree> tree = StartChunkHashes(encoded_url, size, journal);
+    if (expected_digest.Valid())
+        sink.EnableChecksum(expected_digest.algo);
+
+    std::vector<CHTTPMultiClient::Span> spans = journal.MissingSpans();
+    bytes_transfered = resume ? journal.DoneBytes() : 0;
+    TransferStats::SetBytes(bytes_transfered);
+
+    // All ranges are driven from this thread through one curl multi handle;
+    // the split writer, the chunk hashes and the journal therefore need no
+    // locking.
+    CHTTPMultiClient engine;
+    SetupMultiClient(engine, 10);
+    StartAutoTune(engine, chunk_size, parallel);
+    int file = engine.AddFileSpans(encoded_url, size, chunk_size,
+                                   [&sink, &tree](int64_t offset, const char *data, size_t len)
+                                   {
+                                       if (tree)
+                                           tree->Update(static_cast<uint64_t>(offset), data, len);
+                                       return sink.WriteAt(static_cast<uint64_t>(offset), data, len);
+                                   },
+                                   spans,
+                                   [&journal, &sink, &tree](int64_t start, int64_t end)
+                                   {
+                                       if (tree)
+                                           tree->Done(start, end);
+                                       // Queued writes must reach the card before the
+                                       // journal may claim their blocks.
+                                       journal.MarkDone(start, end);
+                                       if (journal.SaveDue() && sink.Flush())
+                                       {
+                                           if (tree)
+                                               tree->SaveLeaves(journal);
+                                           journal.Save();
+                                       }
+                                   });
+
+    bool ok = RunMultiClient(engine, encoded_url, parallel);
+    FinishAutoTune(engine);
+    // Blocks kept from an earlier run are read back; everything fetched
+    // now was digested on its way to the card.
+    FileDigest actual;
+    bool digested = ok && expected_digest.Valid() && sink.Digest(static_cast<uint64_t>(size), actual);
+    std::vector<ChunkHashTree::Span> bad;
+    if (ok && tree)
+        bad = RepairChunks(sink, encoded_url, size, chunk_size, parallel, *tree, digested, actual);
+    // An interrupted download keeps the CRC-32s of the chunks it finished.
+    else if (tree && !tree->HasReference())
+        tree->Finish([&sink](uint64_t offset, char *data, size_t len)
+                     { return sink.ReadAt(offset, data, len); });
+    // A queued write that failed after its range completed leaves blocks
+    // the journal already counted, so only a clean sink keeps the journal.
+    bool written = sink.Close();
+    if (written && !bad.empty())
+        KeepBadChunks(outputfile, true, bad, *tree, journal);
+    else if (ok || !written)
+        journal.Remove();
+    else
+    {
+        if (tree)
+            tree->SaveLeaves(journal);
+        journal.Save();
     }
-
-    if (!threadError)
+    const CHTTPMultiClient::FileResult &result = engine.GetResult(file);
+    if (!written)
     {
-        for (int i = 0; i < parallel; ++i)
-        {
-            if (threads[i].handle == 0)
-                continue;
-            threadStart(&threads[i]);
-        }
-
-        for (int i = 0; i < parallel; ++i)
-        {
-            if (threads[i].handle == 0)
-                continue;
-            threadWaitForExit(&threads[i]);
-            threadClose(&threads[i]);
-        }
+        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split-parallel write failed path=%s", outputfile.c_str());
+        return 0;
     }
-
+    if (!ok)
     {
-        std::lock_guard<std::mutex> lock(ctx.stateMutex);
-        if (ctx.hadError)
-        {
-            sprintf(this->response, "%s", ctx.errorMessage.c_str());
-            Logger::Logf("WEBDAV GET split-parallel error url=%s err=%s",
-                         encoded_url.c_str(),
-                         ctx.errorMessage.c_str());
-            return 0;
-        }
+        SetMultiClientError(result);
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV GET split-parallel error url=%s err=%s",
+                     encoded_url.c_str(),
+                     result.errorMessage.c_str());
+        return 0;
     }
 
     if (bytes_transfered <= 0)
@@ -1706,19 +1238,15 @@ int WebDAVClient::GetRangedParallelSplit(const std::string &outputfile,
         Logger::Logf("WEBDAV GET split-parallel produced no data url=%s", encoded_url.c_str());
         return 0;
     }
+    if (!bad.empty() || !VerifyDownload(outputfile, true, digested, actual))
+        return 0;
 
     // Mark the split base directory as a concatenation file so that HOS
     // (and tools like DBI/Tinfoil that use the normal FS APIs) can see
     // it as a single file whose contents are the concatenation of 00, 01,
     // ... parts. This mirrors what DBI does when splitting >4 GiB files
     // on FAT32 via its "archived folder" behaviour.
-    Result cat_rc = fsdevSetConcatenationFileAttribute(outputfile.c_str());
-    if (R_FAILED(cat_rc))
-    {
-        Logger::Logf("WEBDAV GET split-parallel failed to set concatenation attribute path=%s rc=0x%08x",
-                     outputfile.c_str(),
-                     cat_rc);
-    }
+    sink.Finish();
 
     uint64_t now = Util::GetTick();
     double elapsed_sec = (now - prev_tick) * 1.0 / 1000000.0;
@@ -1734,288 +1262,821 @@ int WebDAVClient::GetRangedParallelSplit(const std::string &outputfile,
 
     Logger::Logf("WEBDAV GET split-parallel ranged done url=%s code=%ld bytes=%lld",
                  encoded_url.c_str(),
-                 ctx.lastHttpCode,
+                 result.lastHttpCode,
                  static_cast<long long>(bytes_transfered));
 
     return 1;
 }
 
-int WebDAVClient::GetRangedParallel(const std::string &outputfile,
-                                    const std::string &encoded_url,
-                                    int64_t size,
-                                    int64_t chunk_size,
-                                    int parallel)
+// Reads `size` bytes at `offset` of a flat file, or of a split folder of
+// `partSize` parts, as written by LocalFileSink.
+static bool ReadLocalRange(const std::string &target, uint64_t partSize, int64_t offset, char *buffer, size_t size)
 {
-    FILE *file = std::fopen(outputfile.c_str(), "wb");
-    if (!file)
+    while (size > 0)
     {
-        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        Logger::Logf("WEBDAV GET parallel fopen failed path=%s", outputfile.c_str());
-        return 0;
+        std::string file = target;
+        int64_t in_part = offset;
+        size_t len = size;
+        if (partSize > 0)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "%s%02d", FS::hasEndSlash(target.c_str()) ? "" : "/", (int)(offset / partSize));
+            file += name;
+            in_part = offset % partSize;
+            len = std::min<uint64_t>(size, partSize - in_part);
+        }
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        ssize_t got = pread(fd, buffer, len, (off_t)in_part);
+        close(fd);
+        if (got != (ssize_t)len)
+            return false;
+        buffer += len;
+        offset += len;
+        size -= len;
     }
+    return true;
+}
 
-    if (size > 0 && size <= 0xFFFFFFFFLL)
+// Blocks a journal has on disk, as [start, end) spans.
+static std::vector<std::pair<int64_t, int64_t>> KeptSpans(const TransferJournal &journal, int64_t size)
+{
+    std::vector<std::pair<int64_t, int64_t>> kept;
+    int64_t from = 0;
+    for (const auto &missing : journal.MissingSpans())
     {
-        if (fseeko(file, (off_t)(size - 1), SEEK_SET) == 0)
-        {
-            int c = fputc(0, file);
-            (void)c;
-            fflush(file);
-        }
-        fseeko(file, 0, SEEK_SET);
+        if (missing.first > from)
+            kept.push_back(std::make_pair(from, missing.first));
+        from = missing.second;
     }
+    if (from < size)
+        kept.push_back(std::make_pair(from, size));
+    return kept;
+}
 
-    bytes_transfered = 0;
+bool WebDAVClient::VerifyResume(const std::string &target, uint64_t partSize, const std::string &path,
+                                const std::vector<std::pair<int64_t, int64_t>> &spans)
+{
+    const int64_t kSample = 64 * 1024;
+    int64_t kept = 0;
+    for (const auto &span : spans)
+        kept += span.second - span.first;
+    if (resume_verify_blocks <= 0 || kept <= 0)
+        return true;
 
-    WebDAVParallelContext ctx;
-    ctx.url = encoded_url;
-    ctx.outputPath = outputfile;
-    ctx.file = file;
-    ctx.size = size;
-    ctx.chunk_size = chunk_size;
-    ctx.nextOffset = 0;
-    ctx.hadError = false;
-    ctx.lastHttpCode = 0;
-
-    std::vector<std::unique_ptr<CHTTPClient>> httpClients;
-    httpClients.reserve(parallel);
-    for (int i = 0; i < parallel; ++i)
-    {
-        auto client = std::make_unique<CHTTPClient>([](const std::string &){});
-        client->SetBasicAuth(http_username, http_password);
-        client->InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
-        client->SetCertificateFile(CACERT_FILE);
-        httpClients.push_back(std::move(client));
-    }
-
-    std::vector<Thread> threads(parallel);
-    std::vector<WebDAVWorkerArgs> workerArgs(parallel);
-
-    bool threadError = false;
-    for (int i = 0; i < parallel; ++i)
-    {
-        workerArgs[i].ctx = &ctx;
-        workerArgs[i].client = httpClients[i].get();
-
-        Result rc = threadCreate(&threads[i],
-                                 WebDAVParallelWorkerThread,
-                                 &workerArgs[i],
-                                 nullptr,
-                                 0x10000,
-                                 0x3B,
-                                 -2);
-        if (R_FAILED(rc))
+    // The tail is where a file that was appended to or rewritten since
+    // differs first; the random blocks catch one changed in place.
+    std::vector<std::pair<int64_t, int64_t>> samples;
+    int64_t tail = std::min(kSample, spans.back().second - spans.back().first);
+    samples.push_back(std::make_pair(spans.back().second - tail, tail));
+    uint64_t seed = Util::GetTick() | 1;
+    for (int i = 1; i < resume_verify_blocks && kept > tail; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        int64_t pick = (int64_t)(seed % (uint64_t)kept);
+        for (const auto &span : spans)
         {
-            Logger::Logf("WEBDAV GET parallel failed to create worker thread url=%s rc=0x%08x",
-                         encoded_url.c_str(),
-                         rc);
-            threadError = true;
+            int64_t span_size = span.second - span.first;
+            if (pick >= span_size)
+            {
+                pick -= span_size;
+                continue;
+            }
+            int64_t start = span.first + pick;
+            samples.push_back(std::make_pair(start, std::min(kSample, span.second - start)));
             break;
         }
+    }
 
-        threadStart(&threads[i]);
+    std::vector<std::vector<char>> remote(samples.size());
+    std::vector<RemoteRange> ranges(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        remote[i].resize(samples[i].second);
+        ranges[i].offset = samples[i].first;
+        ranges[i].size = samples[i].second;
+        ranges[i].buffer = remote[i].data();
+    }
+    uint64_t start = Util::GetTick();
+    // Without the server's bytes nothing is known to differ; the download
+    // itself will find out whether the server is there.
+    if (!GetRanges(path, ranges))
+    {
+        Logger::Logf(Logger::LOG_WARN, "WEBDAV GET resume verify skipped path=%s samples=%d", target.c_str(),
+                     (int)samples.size());
+        return true;
     }
 
-    for (int i = 0; i < parallel; ++i)
+    std::vector<char> local(kSample);
+    for (size_t i = 0; i < samples.size(); i++)
     {
-        if (threads[i].handle != 0)
+        if (!ReadLocalRange(target, partSize, samples[i].first, local.data(), samples[i].second) ||
+            memcmp(local.data(), remote[i].data(), samples[i].second) != 0)
         {
-            threadWaitForExit(&threads[i]);
-            threadClose(&threads[i]);
+            Logger::Logf("WEBDAV GET resume verify mismatch path=%s offset=%lld kept=%lld", target.c_str(),
+                         (long long)samples[i].first, (long long)kept);
+            return false;
         }
     }
+    Logger::Logf("WEBDAV GET resume verified path=%s samples=%d kept=%lld ms=%llu", target.c_str(),
+                 (int)samples.size(), (long long)kept, (unsigned long long)((Util::GetTick() - start) / 1000));
+    return true;
+}
 
-    std::fclose(file);
-
-    if (threadError)
+bool WebDAVClient::PrepareJournal(TransferJournal &journal,
+                                  const std::string &key,
+                                  const std::string &target,
+                                  const std::string &path,
+                                  const std::string &encoded_url,
+                                  int64_t size,
+                                  uint64_t partSize)
+{
+    if (!transfer_journal)
     {
-        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        return 0;
+        journal.Reset(size);
+        return false;
     }
 
-    if (ctx.hadError)
-    {
-        if (!ctx.errorMessage.empty())
-            snprintf(this->response, sizeof(this->response), "%s", ctx.errorMessage.c_str());
-        else
-            sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+    // A file or collection validator both come from the same Depth:0
+    // PROPFIND; without one, old blocks cannot be trusted.
+    std::string validator;
+    GetDirValidator(path, validator);
 
-        Logger::Logf("WEBDAV GET ranged-parallel error url=%s err=%s",
-                     encoded_url.c_str(),
-                     ctx.errorMessage.c_str());
-        return 0;
-    }
-
-    if (bytes_transfered <= 0)
+    if (journal.Load(key))
     {
-        sprintf(this->response, "%s", lang_strings[STR_FAIL_DOWNLOAD_MSG]);
-        Logger::Logf("WEBDAV GET ranged-parallel produced no data url=%s", encoded_url.c_str());
-        return 0;
+        bool same = journal.url == encoded_url && journal.size == size && journal.part_size == partSize &&
+                    !validator.empty() && journal.validator == validator;
+        bool present = (partSize > 0) ? FS::FolderExists(target) : FS::FileExists(target);
+        if (same && present && VerifyResume(target, partSize, path, KeptSpans(journal, size)))
+        {
+            Logger::Logf("WEBDAV GET journal resume path=%s done=%lld/%lld",
+                         key.c_str(),
+                         static_cast<long long>(journal.DoneBytes()),
+                         static_cast<long long>(size));
+            return true;
+        }
+        Logger::Logf("WEBDAV GET journal discarded path=%s validator=%s now=%s present=%d same=%d",
+                     key.c_str(), journal.validator.c_str(), validator.c_str(), present ? 1 : 0, same ? 1 : 0);
+        journal.Remove();
     }
 
-    uint64_t now = Util::GetTick();
-    double elapsed_sec = (now - prev_tick) * 1.0 / 1000000.0;
-    double mb = (bytes_transfered / 1048576.0);
-    double avg_mbps = (elapsed_sec > 0.0) ? (mb / elapsed_sec) : 0.0;
+    journal.site = last_site;
+    journal.remote_path = path;
+    journal.local_path = validator.empty() ? "" : key;
+    journal.url = encoded_url;
+    journal.validator = validator;
+    journal.part_size = partSize;
+    journal.Reset(size);
+    journal.Save();
+    return false;
+}
 
-    Logger::Logf("WEBDAV PERF ranged-parallel url=%s size=%lld chunk_mb=%lld parallel=%d elapsed=%.2fs avg=%.2f MiB/s",
-                 encoded_url.c_str(),
-                 static_cast<long long>(bytes_transfered),
-                 static_cast<long long>(chunk_size / (1024 * 1024)),
+void WebDAVClient::StartAutoTune(CHTTPMultiClient &engine, int64_t chunk_size, int parallel)
+{
+    if (!webdav_autotune || parallel <= 1)
+        return;
+
+    // Without history start halfway to the ceiling so the controller can
+    // move in both directions.
+    int workers = tuned_parallel;
+    if (workers <= 0)
+        workers = (parallel + 1) / 2;
+    int64_t chunk = chunk_size;
+    if (tuned_chunk_mb > 0)
+        chunk = static_cast<int64_t>(tuned_chunk_mb) * 1024 * 1024;
+
+    engine.SetAutoTune(std::min(workers, parallel), chunk, 1024 * 1024, 32LL * 1024 * 1024);
+    Logger::Logf("WEBDAV autotune start workers=%d/%d chunk_mb=%lld",
+                 std::min(workers, parallel),
                  parallel,
-                 elapsed_sec,
-                 avg_mbps);
+                 static_cast<long long>(chunk / (1024 * 1024)));
+}
 
-    Logger::Logf("WEBDAV GET ranged-parallel done url=%s code=%ld bytes=%lld parallel=%d",
-                 encoded_url.c_str(),
-                 ctx.lastHttpCode,
-                 static_cast<long long>(bytes_transfered),
-                 parallel);
-    return 1;
+void WebDAVClient::FinishAutoTune(const CHTTPMultiClient &engine)
+{
+    if (!webdav_autotune)
+        return;
+
+    int workers = engine.TunedWorkers();
+    int chunk_mb = static_cast<int>(engine.TunedChunk() / (1024 * 1024));
+    if (workers <= 0 || chunk_mb <= 0)
+        return;
+
+    tuned_parallel = workers;
+    tuned_chunk_mb = chunk_mb;
+    tuning_learned = true;
+    Logger::Logf("WEBDAV autotune learned workers=%d chunk_mb=%d", workers, chunk_mb);
+}
+
+void WebDAVClient::SetTuning(int parallel, int chunk_mb)
+{
+    tuned_parallel = parallel;
+    tuned_chunk_mb = chunk_mb;
+}
+
+bool WebDAVClient::GetTuning(int *parallel, int *chunk_mb) const
+{
+    if (!tuning_learned)
+        return false;
+    *parallel = tuned_parallel;
+    *chunk_mb = tuned_chunk_mb;
+    return true;
 }
 
 std::vector<DirEntry> WebDAVClient::ListDir(const std::string &path)
 {
-    CHTTPClient::HttpResponse res;
+    std::vector<DirEntry> out;
+    ListDirStreamed(path, [&out](const std::vector<DirEntry> &batch)
+                    {
+                        out.insert(out.end(), batch.begin(), batch.end());
+                        return true;
+                    });
+    return out;
+}
+
+int WebDAVClient::ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch)
+{
+    // Entries are handed on in small batches as the PROPFIND body is parsed,
+    // so the browser can draw the first rows of a huge folder right away.
+    static const size_t kListBatchSize = 64;
+
     std::vector<DirEntry> out;
     DirEntry entry;
     Util::SetupPreviousFolder(path, &entry);
     out.push_back(entry);
+    size_t total = 0;
+    bool stopped = false;
 
     Logger::Logf("WEBDAV ListDir path='%s'", path.c_str());
 
-    if (PropFind(path, 1, res))
+    // operations/list works on rclone serve http too, which has no PROPFIND.
+    if (rclone && rclone->List(path, false, false, out))
     {
-        pugi::xml_document document;
-        document.load_buffer(res.strBody.data(), res.strBody.size());
-        auto multistatus = document.select_node("*[local-name()='multistatus']").node();
-        auto responses = multistatus.select_nodes("*[local-name()='response']");
+        on_batch(out);
+        return 1;
+    }
 
-        // Normalize the current logical path (what the user sees in the UI)
-        // without any WebDAV base path (eg "/dav").
-        std::string target_path_without_sep = path;
-        Util::Trim(target_path_without_sep, " ");
-        Util::Rtrim(target_path_without_sep, "/");
-        if (target_path_without_sep.empty())
-            target_path_without_sep = "/";
+    // Normalize the current logical path (what the user sees in the UI)
+    // without any WebDAV base path (eg "/dav").
+    std::string target_path_without_sep = path;
+    Util::Trim(target_path_without_sep, " ");
+    Util::Rtrim(target_path_without_sep, "/");
+    if (target_path_without_sep.empty())
+        target_path_without_sep = "/";
+
+    bool ok = PropFind(path, 1, [&](const WebDAVPropfindEntry &e)
+                       {
+                           if (e.href.empty())
+                               return;
+
+                           std::string resource_path_without_sep = ResourcePath(e.href);
+                           if (resource_path_without_sep == target_path_without_sep)
+                               return;
+
+                           size_t pos2 = resource_path_without_sep.find_last_of('/');
+                           auto name = resource_path_without_sep.substr(pos2 + 1);
+
+                           DirEntry entry;
+                           FillDirEntry(entry, path, name, e);
+                           out.push_back(entry);
+                           total++;
+                           if (out.size() >= kListBatchSize && !stopped)
+                           {
+                               stopped = !on_batch(out);
+                               out.clear();
+                           }
+                       }, &stopped);
+    if (stopped)
+    {
+        Logger::Logf("WEBDAV ListDir cancelled path='%s' entries=%zu", path.c_str(), total);
+        return 1;
+    }
+    if (!out.empty())
+        on_batch(out);
+    if (!ok)
+    {
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV ListDir PROPFIND failed err=%s", this->response);
+        return 0;
+    }
 
-        Logger::Logf("WEBDAV ListDir normalized target_path='%s', responses=%zu",
-                     target_path_without_sep.c_str(), responses.size());
+    Logger::Logf("WEBDAV ListDir target_path='%s' entries=%zu",
+                 target_path_without_sep.c_str(), total);
+    return 1;
+}
 
-        for (auto response : responses)
+int WebDAVClient::ListTree(const std::string &path, const DirEntryBatchFn &on_batch)
+{
+    static const size_t kListBatchSize = 64;
+
+    // One operations/list of the whole tree; with verify_downloads it
+    // carries the hashes the downloads are checked against.
+    std::vector<DirEntry> tree;
+    if (rclone && rclone->List(path, true, verify_downloads, tree))
+    {
+        Logger::Logf("WEBDAV ListTree rc path='%s' entries=%zu", path.c_str(), tree.size());
+        for (size_t i = 0; i < tree.size(); i += kListBatchSize)
         {
-            pugi::xml_node href = response.node().select_node("*[local-name()='href']").node();
-            if (!href || !href.first_child())
-                continue;
+            std::vector<DirEntry> batch(tree.begin() + i, tree.begin() + std::min(tree.size(), i + kListBatchSize));
+            if (!on_batch(batch))
+                return 0;
+        }
+        return 1;
+    }
 
-            std::string resource_path = CHTTPClient::DecodeUrl(href.first_child().value(), false);
-            auto resource_path_without_sep = resource_path.erase(resource_path.find_last_not_of('/') + 1);
-            if (!this->base_path.empty() && this->base_path != "/")
-            {
-                if (resource_path_without_sep.compare(0, this->base_path.size(), this->base_path) == 0)
-                {
-                    resource_path_without_sep.erase(0, this->base_path.size());
-                    if (resource_path_without_sep.empty())
-                        resource_path_without_sep = "/";
-                }
-            }
+    if (!webdav_tree_scan || HostCaps::Get(host_url).depth_infinity == 0)
+        return 0;
 
-            Logger::Logf("WEBDAV ListDir href='%s' -> resource_path='%s'",
-                         href.first_child().value(),
-                         resource_path_without_sep.c_str());
+    std::string root = path;
+    Util::Trim(root, " ");
+    Util::Rtrim(root, "/");
+    if (root.empty())
+        root = "/";
 
-            if (resource_path_without_sep == target_path_without_sep)
-                continue;
+    Logger::Logf("WEBDAV ListTree path='%s'", root.c_str());
 
-            size_t pos2 = resource_path_without_sep.find_last_of('/');
-            auto name = resource_path_without_sep.substr(pos2 + 1);
-            auto propstat = response.node().select_node("*[local-name()='propstat']").node();
-            auto prop = propstat.select_node("*[local-name()='prop']").node();
+    std::vector<DirEntry> out;
+    size_t total = 0;
+    bool stopped = false;
+    bool outside = false;
+    long code = 0;
+    bool ok = PropFind(path, -1, [&](const WebDAVPropfindEntry &e)
+                       {
+                           if (e.href.empty() || stopped)
+                               return;
+
+                           std::string resource = ResourcePath(e.href);
+                           if (resource == root)
+                               return;
+
+                           // Every resource must live below the root, or the
+                           // local layout cannot be derived from its path.
+                           size_t slash = resource.find_last_of('/');
+                           std::string parent = (slash == 0) ? "/" : resource.substr(0, slash);
+                           if (slash == std::string::npos ||
+                               (root != "/" && resource.compare(0, root.size() + 1, root + "/") != 0))
+                           {
+                               outside = true;
+                               stopped = true;
+                               return;
+                           }
+
+                           DirEntry entry;
+                           FillDirEntry(entry, parent, resource.substr(slash + 1), e);
+                           out.push_back(entry);
+                           total++;
+                           if (out.size() >= kListBatchSize)
+                           {
+                               stopped = !on_batch(out);
+                               out.clear();
+                           }
+                       }, &stopped, &code);
+
+    if (outside)
+    {
+        Logger::Logf("WEBDAV ListTree unexpected href outside '%s'", root.c_str());
+        return 0;
+    }
+    if (stopped)
+        return 0;
+    if (ok && (code == 403 || code == 501))
+        HostCaps::Learn(host_url, &HostCaps::Caps::depth_infinity, 0);
+    if (!ok || code != 207)
+    {
+        // Servers commonly refuse Depth: infinity with 403
+        // (propfind-finite-depth); the caller walks the tree instead.
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV ListTree PROPFIND failed code=%ld err=%s", code, ok ? "" : this->response);
+        return 0;
+    }
+    HostCaps::Learn(host_url, &HostCaps::Caps::depth_infinity, 1);
+    if (!out.empty() && !on_batch(out))
+        return 0;
 
-            std::string creation_date;
-            std::string content_length;
-            std::string m_date;
-            std::string resource_type;
+    Logger::Logf("WEBDAV ListTree path='%s' entries=%zu", root.c_str(), total);
+    return 1;
+}
 
-            auto cd_node = prop.select_node("*[local-name()='creationdate']").node();
-            if (cd_node && cd_node.first_child())
-                creation_date = cd_node.first_child().value();
+static std::string XmlEscape(const std::string &text)
+{
+    std::string out;
+    for (char c : text)
+    {
+        if (c == '&')
+            out += "&amp;";
+        else if (c == '<')
+            out += "&lt;";
+        else if (c == '>')
+            out += "&gt;";
+        else
+            out += c;
+    }
+    return out;
+}
 
-            auto len_node = prop.select_node("*[local-name()='getcontentlength']").node();
-            if (len_node && len_node.first_child())
-                content_length = len_node.first_child().value();
+int WebDAVClient::Search(const std::string &path, const std::string &query, const DirEntryBatchFn &on_batch)
+{
+    static const size_t kListBatchSize = 64;
+
+    if (HostCaps::Get(host_url).search == 0)
+        return -1;
+
+    std::string root = path;
+    Util::Trim(root, " ");
+    Util::Rtrim(root, "/");
+    if (root.empty())
+        root = "/";
+
+    // Nextcloud answers SEARCH on the DAV root only, scoped to a path
+    // below /files/<user>, and returns hrefs of that form.
+    std::string arbiter = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    std::string scope = GetFullPath(path);
+    std::string strip;
+    size_t remote = this->base_path.find("/remote.php/");
+    if (remote != std::string::npos)
+    {
+        std::string prefix = this->base_path.substr(0, remote) + "/remote.php/dav";
+        std::string rest = this->base_path.substr(remote + strlen("/remote.php/"));
+        std::string user;
+        if (rest.compare(0, strlen("dav/files/"), "dav/files/") == 0)
+        {
+            rest.erase(0, strlen("dav/files/"));
+            size_t slash = rest.find('/');
+            user = rest.substr(0, slash);
+            rest = (slash == std::string::npos) ? "" : rest.substr(slash);
+        }
+        else if (rest.compare(0, strlen("webdav"), "webdav") == 0)
+        {
+            user = this->http_username;
+            rest.erase(0, strlen("webdav"));
+        }
+        if (!user.empty())
+        {
+            arbiter = this->host_url + CHTTPClient::EncodeUrl(prefix + "/");
+            strip = prefix + "/files/" + user + rest;
+            scope = "/files/" + user + rest + (root == "/" ? "" : root);
+        }
+    }
 
-            auto md_node = prop.select_node("*[local-name()='getlastmodified']").node();
-            if (md_node && md_node.first_child())
-                m_date = md_node.first_child().value();
+    // basicsearch's like takes % and _ as wildcards, escaped with a
+    // backslash.
+    std::string literal;
+    for (char c : query)
+    {
+        if (c == '%' || c == '_' || c == '\\')
+            literal += '\\';
+        literal += c;
+    }
+    std::string request =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?><d:searchrequest xmlns:d=\"DAV:\"><d:basicsearch>"
+        "<d:select><d:prop><d:displayname/><d:resourcetype/><d:getcontentlength/><d:getlastmodified/>"
+        "<d:getetag/></d:prop></d:select><d:from><d:scope><d:href>" +
+        XmlEscape(CHTTPClient::EncodeUrl(scope)) +
+        "</d:href><d:depth>infinity</d:depth></d:scope></d:from><d:where><d:like><d:prop><d:displayname/>"
+        "</d:prop><d:literal>%" +
+        XmlEscape(literal) + "%</d:literal></d:like></d:where></d:basicsearch></d:searchrequest>";
 
-            auto rt_node = prop.select_node("*[local-name()='resourcetype']").node();
-            if (rt_node && rt_node.first_child())
-                resource_type = rt_node.first_child().name();
+    CHTTPClient::HeadersMap headers;
+    headers["Accept"] = "*/*";
+    headers["Content-Type"] = "text/xml; charset=utf-8";
 
-            DirEntry entry;
-            memset(&entry, 0, sizeof(entry));
-            entry.selectable = true;
-            sprintf(entry.directory, "%s", path.c_str());
-            sprintf(entry.name, "%s", name.c_str());
+    Logger::Logf("WEBDAV Search path='%s' query='%s' arbiter=%s", root.c_str(), query.c_str(), arbiter.c_str());
+    uint64_t started = Util::GetTick();
+    std::vector<DirEntry> out;
+    size_t total = 0;
+    bool stopped = false;
+    WebDAVPropfindParser parser([&](const WebDAVPropfindEntry &e)
+                                {
+                                    if (e.href.empty() || stopped)
+                                        return;
+                                    std::string resource;
+                                    if (!strip.empty())
+                                    {
+                                        resource = CHTTPClient::DecodeUrl(e.href, false);
+                                        resource.erase(resource.find_last_not_of('/') + 1);
+                                        if (resource.compare(0, strip.size(), strip) != 0)
+                                            return;
+                                        resource.erase(0, strip.size());
+                                    }
+                                    else
+                                        resource = ResourcePath(e.href);
+                                    if (resource.empty() || resource == root)
+                                        return;
+                                    size_t slash = resource.find_last_of('/');
+                                    if (slash == std::string::npos ||
+                                        (root != "/" && resource.compare(0, root.size() + 1, root + "/") != 0))
+                                        return;
+
+                                    DirEntry entry;
+                                    FillDirEntry(entry, slash == 0 ? "/" : resource.substr(0, slash),
+                                                 resource.substr(slash + 1), e);
+                                    out.push_back(entry);
+                                    total++;
+                                    if (out.size() >= kListBatchSize)
+                                    {
+                                        stopped = !on_batch(out);
+                                        out.clear();
+                                    }
+                                });
+    CHTTPClient::HttpResponse res;
+    bool ok = client->CustomRequestToSink("SEARCH", arbiter, headers,
+                                          [&parser, &stopped](const char *data, size_t len)
+                                          { return !stopped && parser.Feed(data, len); },
+                                          res, &request);
+    if (stopped)
+        return 0;
+    if (!ok)
+    {
+        snprintf(this->response, sizeof(this->response), "%s", res.errMessage.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV Search failed err=%s", this->response);
+        return 0;
+    }
+    if (res.iCode != 207)
+    {
+        // 405/501 from servers without the search plugin, 400/422 from
+        // ones that do not take this grammar.
+        Logger::Logf("WEBDAV Search unsupported code=%ld", res.iCode);
+        if (res.iCode == 400 || res.iCode == 405 || res.iCode == 415 || res.iCode == 422 || res.iCode == 501)
+            HostCaps::Learn(host_url, &HostCaps::Caps::search, 0);
+        return -1;
+    }
+    parser.Finish();
+    HostCaps::Learn(host_url, &HostCaps::Caps::search, 1);
+    if (!out.empty() && !on_batch(out))
+        return 0;
+    Logger::Logf("WEBDAV Search path='%s' entries=%zu ms=%llu", root.c_str(), total,
+                 (unsigned long long)((Util::GetTick() - started) / 1000));
+    return 1;
+}
 
-            if (path.length() == 1 and path[0] == '/')
-            {
-                sprintf(entry.path, "%s%s", path.c_str(), name.c_str());
-            }
-            else
-            {
-                sprintf(entry.path, "%s/%s", path.c_str(), name.c_str());
-            }
+int WebDAVClient::UsedBytes(const std::string &path, int64_t *bytes)
+{
+    if (rclone && rclone->Size(path, bytes, nullptr))
+        return 1;
 
-            entry.isDir = resource_type.find("collection") != std::string::npos;
-            entry.file_size = 0;
-            if (!entry.isDir)
-            {
-                entry.file_size = atoll(content_length.c_str());
-                DirEntry::SetDisplaySize(&entry);
-            }
-            else
-            {
-                sprintf(entry.display_size, "%s", lang_strings[STR_FOLDER]);
-            }
+    // RFC 4331 quota-used-bytes: Nextcloud, ownCloud and others keep it
+    // per folder, so a Depth:0 request stands in for walking the tree.
+    std::string target = path;
+    Util::Rtrim(target, "/");
+    if (target.empty())
+        target = "/";
+
+    std::string used;
+    long code = 0;
+    bool ok = PropFind(path, 0, [&](const WebDAVPropfindEntry &e)
+                       {
+                           if (used.empty() && !e.quotaUsed.empty() && ResourcePath(e.href) == target)
+                               used = e.quotaUsed;
+                       },
+                       nullptr, &code, "<d:quota-used-bytes/>");
+    if (!ok)
+        return 0;
+    if (code != 207 || used.empty() || used[0] < '0' || used[0] > '9')
+        return -1;
+    *bytes = atoll(used.c_str());
+    Logger::Logf("WEBDAV UsedBytes path='%s' bytes=%lld", path.c_str(), (long long)*bytes);
+    return 1;
+}
 
-            char modified_date[32];
-            char *p_char = NULL;
-            sprintf(modified_date, "%s", m_date.c_str());
-            p_char = strchr(modified_date, ' ');
-            if (p_char)
-            {
-                char month[5];
-                sscanf(p_char, "%d %s %d %d:%d:%d", &entry.modified.day, month, &entry.modified.year, &entry.modified.hours, &entry.modified.minutes, &entry.modified.seconds);
-                for (int k = 0; k < 12; k++)
-                {
-                    if (strcmp(month, months[k]) == 0)
-                    {
-                        entry.modified.month = k + 1;
-                        break;
-                    }
-                }
-            }
-            out.push_back(entry);
+bool WebDAVClient::GetDirValidator(const std::string &path, std::string &validator)
+{
+    // Depth:0 only describes the collection itself, so this stays a tiny
+    // request even for folders with thousands of entries. Prefer the ETag;
+    // fall back to getlastmodified for servers that omit it on collections.
+    validator.clear();
+    bool ok = PropFind(path, 0, [&validator](const WebDAVPropfindEntry &e)
+                       {
+                           if (!validator.empty())
+                               return;
+                           if (!e.etag.empty())
+                               validator = "etag:" + e.etag;
+                           else if (!e.lastModified.empty())
+                               validator = "mtime:" + e.lastModified;
+                       });
+    if (!ok)
+        return false;
+    return !validator.empty();
+}
+
+bool WebDAVClient::NextcloudRoot(std::string &install, std::string &user, std::string &folder) const
+{
+    // Accept both the current endpoint (".../remote.php/dav/files/<user>")
+    // and the legacy one (".../remote.php/webdav").
+    size_t remote = this->base_path.find("/remote.php/");
+    if (remote == std::string::npos)
+        return false;
+    install = this->base_path.substr(0, remote);
+    folder = this->base_path.substr(remote + strlen("/remote.php/"));
+    user.clear();
+    if (folder.compare(0, strlen("dav/files/"), "dav/files/") == 0)
+    {
+        folder.erase(0, strlen("dav/files/"));
+        size_t slash = folder.find('/');
+        user = folder.substr(0, slash);
+        folder = (slash == std::string::npos) ? "" : folder.substr(slash);
+    }
+    else if (folder.compare(0, strlen("webdav"), "webdav") == 0)
+    {
+        user = this->http_username;
+        folder.erase(0, strlen("webdav"));
+    }
+    return !user.empty();
+}
+
+bool WebDAVClient::NextcloudUploadUrls(const std::string &path, std::string &uploads, std::string &destination)
+{
+    // Chunked uploads always go through ".../remote.php/dav/uploads/<user>".
+    std::string install, user, rest;
+    if (!NextcloudRoot(install, user, rest))
+        return false;
+    std::string prefix = install + "/remote.php/dav";
+
+    std::string target = path;
+    target = Util::Trim(Util::Trim(target, " "), "/");
+    std::string dest_path = prefix + "/files/" + user + rest + "/" + target;
+    Util::ReplaceAll(dest_path, "//", "/");
+    destination = this->host_url + CHTTPClient::EncodeUrl(dest_path);
+
+    char id[40];
+    snprintf(id, sizeof(id), "neo_sftp-%llx", static_cast<unsigned long long>(Util::GetTick()));
+    uploads = this->host_url + CHTTPClient::EncodeUrl(prefix + "/uploads/" + user) + "/" + id;
+    return true;
+}
+
+int WebDAVClient::PutChunked(const std::string &inputfile, const std::string &path, int64_t size)
+{
+    std::string upload_url;
+    std::string destination;
+    if (!NextcloudUploadUrls(path, upload_url, destination))
+        return -1;
+
+    CHTTPClient::HeadersMap headers;
+    headers["Destination"] = destination;
+    CHTTPClient::HttpResponse res;
+    if (!client->CustomRequest("MKCOL", upload_url, headers, res) || !HTTP_SUCCESS(res.iCode))
+    {
+        // Not a Nextcloud, or chunking v2 is not available there.
+        Logger::Logf("WEBDAV chunked upload unavailable url=%s code=%ld", upload_url.c_str(), res.iCode);
+        return -1;
+    }
+
+    ChunkUploadContext ctx;
+    ctx.inputfile = inputfile;
+    ctx.uploadUrl = upload_url;
+    ctx.destination = destination;
+    ctx.user = this->http_username;
+    ctx.pass = this->http_password;
+    ctx.size = size;
+    // Nextcloud takes at most 10000 chunks of at least 5 MiB (but the last).
+    ctx.chunkSize = static_cast<int64_t>(webdav_upload_chunk_mb) * 1024 * 1024;
+    if ((size + ctx.chunkSize - 1) / ctx.chunkSize > 10000)
+        ctx.chunkSize = (size + 9999) / 10000;
+    ctx.chunks = static_cast<int>((size + ctx.chunkSize - 1) / ctx.chunkSize);
+
+    int workers = std::min(webdav_upload_parallel, ctx.chunks);
+    Logger::Logf("WEBDAV chunked upload start path=%s size=%lld chunks=%d chunk=%lld workers=%d",
+                 path.c_str(), static_cast<long long>(size), ctx.chunks,
+                 static_cast<long long>(ctx.chunkSize), workers);
+
+    std::vector<Thread> threads(workers > 1 ? workers - 1 : 0);
+    std::vector<bool> started(threads.size(), false);
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        Result rc = Threads::Create(&threads[i], ChunkUploadThread, &ctx, 0x80000, Threads::ROLE_NETWORK, "webdav chunk");
+        if (R_FAILED(rc))
+            continue;
+        threadStart(&threads[i]);
+        started[i] = true;
+    }
+    ChunkUploadWorker(&ctx);
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        if (!started[i])
+            continue;
+        Threads::Join(&threads[i]);
+    }
+
+    if (!ctx.failed && !Cancel::Stopped())
+    {
+        // Assemble: MOVE the virtual ".file" onto the destination.
+        headers["OC-Total-Length"] = std::to_string(size);
+        headers["Overwrite"] = "T";
+        if (client->CustomRequest("MOVE", upload_url + "/.file", headers, res) && HTTP_SUCCESS(res.iCode))
+        {
+            Logger::Logf("WEBDAV chunked upload done path=%s code=%ld", path.c_str(), res.iCode);
+            return 1;
         }
+        ctx.error = lang_strings[STR_FAIL_UPLOAD_MSG];
+        Logger::Logf(Logger::LOG_ERROR, "WEBDAV chunked upload assemble failed path=%s code=%ld", path.c_str(), res.iCode);
     }
-    else
+
+    // Drop the chunks already sent.
+    CHTTPClient::HeadersMap none;
+    client->CustomRequest("DELETE", upload_url, none, res);
+    snprintf(this->response, sizeof(this->response), "%s",
+             Cancel::Stopped() ? lang_strings[STR_CANCEL_ACTION_MSG] : ctx.error.c_str());
+    return 0;
+}
+
+bool WebDAVClient::ProbeRangedPut(const std::string &path)
+{
+    // Two bytes, then the second rewritten through Content-Range: a server
+    // that writes at the offset holds "ab", one that ignores the header "b".
+    size_t slash = path.find_last_of('/');
+    std::string scratch = (slash == std::string::npos ? std::string() : path.substr(0, slash + 1)) + ".neo_sftp_range_probe";
+    std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(scratch));
+    CHTTPClient::HeadersMap none;
+    CHTTPClient::HttpResponse res;
+    if (!client->PutData(encode_url, none, "aa", 2, res) || !HTTP_SUCCESS(res.iCode))
     {
-        sprintf(this->response, "%s", res.errMessage.c_str());
-        Logger::Logf("WEBDAV ListDir PROPFIND failed err=%s", this->response);
-        return out;
+        // Not even a plain PUT there; nothing learnt.
+        Logger::Logf("WEBDAV PUT range probe path=%s code=%ld, not learnt", scratch.c_str(), res.iCode);
+        return false;
     }
+    CHTTPClient::HeadersMap headers;
+    headers["Content-Range"] = "bytes 1-1/2";
+    CHTTPClient::HttpResponse ranged_res;
+    CHTTPClient::HttpResponse got;
+    bool ranged = client->PutData(encode_url, headers, "b", 1, ranged_res) && HTTP_SUCCESS(ranged_res.iCode) &&
+                  client->Get(encode_url, none, got) && HTTP_SUCCESS(got.iCode) && got.strBody == "ab";
+    CHTTPClient::HttpResponse deleted;
+    client->CustomRequest("DELETE", encode_url, none, deleted);
+    Logger::Logf("WEBDAV PUT range probe code=%ld body=%zu ranged=%d", ranged_res.iCode, got.strBody.size(),
+                 ranged ? 1 : 0);
+    HostCaps::Learn(host_url, &HostCaps::Caps::ranged_put, ranged ? 1 : 0);
+    return ranged;
+}
 
-    return out;
+int WebDAVClient::PutRange(const std::string &inputfile, const std::string &path, uint64_t offset, int64_t size)
+{
+    if ((int64_t)offset >= size)
+        return -1;
+    // A server that ignores Content-Range would replace the partial with
+    // the tail, so it is tried on a scratch file before the real one.
+    int known = HostCaps::Get(host_url).ranged_put;
+    if (known == 0 || (known < 0 && !ProbeRangedPut(path)))
+        return -1;
+
+    UploadSource source(inputfile, offset);
+    if (!source.Open())
+        return -1;
+    CHTTPClient::HeadersMap headers;
+    headers["Content-Range"] = "bytes " + std::to_string(offset) + "-" + std::to_string(size - 1) + "/" +
+                               std::to_string(size);
+    client->SetProgressFnCallback(&bytes_transfered, UploadProgressCallback);
+    std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    CHTTPClient::HttpResponse res;
+    bool sent = client->PutSource(encode_url, headers, source, res);
+    source.Close();
+    if (!sent || res.iCode == 503 || res.iCode == 507)
+    {
+        // Cut off or out of room: the part on the server is still good to
+        // resume from next time.
+        sprintf(this->response, "%ld - %s", res.iCode, lang_strings[STR_FAIL_UPLOAD_MSG]);
+        return 0;
+    }
+
+    // RFC 7231 lets a server refuse Content-Range on PUT (400, 501); the
+    // probe said this one does not, and the size confirms it.
+    int64_t stored = -1;
+    bool ranged = HTTP_SUCCESS(res.iCode) && Size(path, &stored) && stored == size;
+    Logger::Logf("WEBDAV PUT range path=%s offset=%llu size=%lld code=%ld stored=%lld", path.c_str(),
+                 (unsigned long long)offset, (long long)size, res.iCode, (long long)stored);
+    HostCaps::Learn(host_url, &HostCaps::Caps::ranged_put, ranged ? 1 : 0);
+    return ranged ? 1 : -1;
 }
 
 int WebDAVClient::Put(const std::string &inputfile, const std::string &path, uint64_t offset)
 {
-    size_t bytes_remaining = FS::GetSize(inputfile);
+    // A split folder goes up as the one file it holds; UploadSource reads
+    // its parts back to back, for the chunks as for a plain PUT.
+    int64_t split_size = UploadSource::SplitSize(inputfile);
+    size_t bytes_remaining = split_size >= 0 ? split_size : FS::GetSize(inputfile);
     bytes_transfered = 0;
     prev_tick = Util::GetTick();
 
+    // Resuming goes through a ranged PUT where the server writes one;
+    // otherwise the whole file goes up again. A Nextcloud chunk collection
+    // is dropped when an upload fails, so there is none to continue.
+    if (offset > 0)
+    {
+        int ret = PutRange(inputfile, path, offset, static_cast<int64_t>(bytes_remaining));
+        if (ret >= 0)
+            return ret;
+        bytes_transfered = 0;
+    }
+
+    // Large files go up in parallel chunks where the server has a chunked
+    // upload protocol; everything else is one streaming PUT.
+    if (webdav_upload_parallel > 1 && bytes_remaining > static_cast<size_t>(webdav_upload_chunk_mb) * 1024 * 1024)
+    {
+        int ret = PutChunked(inputfile, path, static_cast<int64_t>(bytes_remaining));
+        if (ret >= 0)
+            return ret;
+        bytes_transfered = 0;
+    }
+
     client->SetProgressFnCallback(&bytes_transfered, UploadProgressCallback);
     std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
     long status;
@@ -2031,8 +2092,147 @@ int WebDAVClient::Put(const std::string &inputfile, const std::string &path, uin
     return 0;
 }
 
+int WebDAVClient::PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source)
+{
+    bytes_transfered = 0;
+    prev_tick = Util::GetTick();
+
+    // A stream cannot be re-read, so this is always one plain PUT.
+    client->SetProgressFnCallback(&bytes_transfered, UploadProgressCallback);
+    std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    long status = 0;
+    if (client->UploadStream(encode_url, size, source, status) && HTTP_SUCCESS(status))
+        return 1;
+
+    sprintf(this->response, "%ld - %s", status, lang_strings[STR_FAIL_UPLOAD_MSG]);
+    Logger::Logf(Logger::LOG_ERROR, "WEBDAV PUT stream failed url=%s code=%ld", encode_url.c_str(), status);
+    return 0;
+}
+
+int WebDAVClient::GetFolderArchive(const std::string &path, const RemoteStreamFn &on_data)
+{
+    if (folder_archive == 0)
+        return -1;
+
+    // Nextcloud (30+) answers a GET on a collection with the folder as a
+    // tar stream when asked for one; plain WebDAV servers send an HTML
+    // index or an error instead, which is recognised before any byte of it
+    // is passed on.
+    CHTTPClient::HttpResponse res;
+    CHTTPClient::HeadersMap headers;
+    headers["Accept"] = "application/x-tar";
+    std::string encoded_url = this->host_url + CHTTPClient::EncodeUrl(GetFullPath(path));
+    if (!FS::hasEndSlash(encoded_url.c_str()))
+        encoded_url += "/";
+
+    auto tar_reply = [&res]()
+    {
+        auto type = res.mapHeadersLowercase.find("content-type");
+        return res.iCode == 200 && type != res.mapHeadersLowercase.end() &&
+               type->second.find("tar") != std::string::npos;
+    };
+    bool checked = false;
+    bool is_tar = false;
+    uint64_t delivered = 0;
+    bool ok = client->GetToSink(encoded_url, headers, [&](const char *data, size_t size)
+                                {
+                                    if (!checked)
+                                    {
+                                        checked = true;
+                                        is_tar = tar_reply();
+                                    }
+                                    if (!is_tar)
+                                        return false;
+                                    delivered += size;
+                                    return on_data(data, size);
+                                },
+                                res);
+    if (ok && !checked)
+        is_tar = tar_reply();
+
+    if (delivered == 0 && !is_tar)
+    {
+        if (folder_archive != 1)
+        {
+            Logger::Logf("WEBDAV folder archive unavailable url=%s code=%ld", encoded_url.c_str(), res.iCode);
+            folder_archive = 0;
+        }
+        return -1;
+    }
+    folder_archive = 1;
+
+    if (!ok || res.iCode != 200)
+    {
+        if (res.errMessage.empty())
+            sprintf(this->response, "%ld - %s", res.iCode, lang_strings[STR_FAIL_DOWNLOAD_MSG]);
+        else
+            sprintf(this->response, "%s", res.errMessage.c_str());
+        return 0;
+    }
+    Logger::Logf("WEBDAV folder archive url=%s bytes=%llu", encoded_url.c_str(), (unsigned long long)delivered);
+    return 1;
+}
+
+int WebDAVClient::GetPreview(const std::string &path, int width, int height, const RemoteStreamFn &on_data)
+{
+    std::string install, user, folder;
+    if (previews == 0 || !thumbnail_server_previews || !NextcloudRoot(install, user, folder))
+        return -1;
+
+    // The preview route takes the path below the user's files. Without
+    // forceIcon a file it has no preview of is a 404 rather than the icon
+    // of its type; a login page or a 401 means the route does not take
+    // the site's credentials, and it is not asked again.
+    std::string name = path;
+    std::string file = folder + "/" + Util::Trim(Util::Trim(name, " "), "/");
+    Util::ReplaceAll(file, "//", "/");
+    char size[64];
+    snprintf(size, sizeof(size), "&x=%d&y=%d&a=1&forceIcon=0", width, height);
+    std::string url = this->host_url + CHTTPClient::EncodeUrl(install + "/index.php/core/preview.png") + "?file=" +
+                      CHTTPClient::EncodeUrl(file) + size;
+
+    CHTTPClient::HttpResponse res;
+    CHTTPClient::HeadersMap headers;
+    headers["Accept"] = "image/*";
+    auto image_reply = [&res]()
+    {
+        auto type = res.mapHeadersLowercase.find("content-type");
+        return res.iCode == 200 && type != res.mapHeadersLowercase.end() && type->second.compare(0, 6, "image/") == 0;
+    };
+    bool checked = false;
+    bool is_image = false;
+    bool ok = client->GetToSink(url, headers, [&](const char *data, size_t len)
+                                {
+                                    if (!checked)
+                                    {
+                                        checked = true;
+                                        is_image = image_reply();
+                                    }
+                                    return is_image && on_data(data, len);
+                                },
+                                res);
+    if (ok && !checked)
+        is_image = image_reply();
+
+    if (is_image && ok)
+    {
+        previews = 1;
+        return 1;
+    }
+    if (previews != 1 && (res.iCode == 401 || res.iCode == 200))
+    {
+        Logger::Logf("WEBDAV previews unavailable url=%s code=%ld", url.c_str(), res.iCode);
+        previews = 0;
+        return -1;
+    }
+    return 0;
+}
+
 int WebDAVClient::Mkdir(const std::string &path)
 {
+    if (rclone && rclone->Mkdir(path))
+        return 1;
+
     CHTTPClient::HeadersMap headers;
     CHTTPClient::HttpResponse res;
 
@@ -2051,6 +2251,8 @@ int WebDAVClient::Mkdir(const std::string &path)
 
 int WebDAVClient::Rmdir(const std::string &path, bool recursive)
 {
+    if (rclone && rclone->Rmdir(path, recursive))
+        return 1;
     return Delete(path);
 }
 
@@ -2061,6 +2263,9 @@ int WebDAVClient::Rename(const std::string &src, const std::string &dst)
 
 int WebDAVClient::Delete(const std::string &path)
 {
+    if (rclone && rclone->DeleteFile(path))
+        return 1;
+
     CHTTPClient::HeadersMap headers;
     CHTTPClient::HttpResponse res;
 
@@ -2080,6 +2285,10 @@ int WebDAVClient::Delete(const std::string &path)
 
 int WebDAVClient::Copy(const std::string &from, const std::string &to)
 {
+    // Server-side wherever the backend can, else inside rclone.
+    if (rclone && rclone->CopyFile(from, to))
+        return 1;
+
     CHTTPClient::HeadersMap headers;
     CHTTPClient::HttpResponse res;
 
@@ -2091,13 +2300,48 @@ int WebDAVClient::Copy(const std::string &from, const std::string &to)
     {
         if (HTTP_SUCCESS(res.iCode))
             return 1;
+        if (res.iCode == 501 || res.iCode == 502)
+            return -1;
     }
 
     return 0;
 }
 
+int WebDAVClient::CopyTree(const std::string &from, const std::string &to)
+{
+    if (rclone && rclone->CopyDir(from, to))
+        return 1;
+
+    CHTTPClient::HeadersMap headers;
+    CHTTPClient::HttpResponse res;
+
+    std::string src = GetFullPath(from);
+    if (src.empty() || src.back() != '/')
+        src += "/";
+    headers["Accept"] = "*/*";
+    headers["Destination"] = GetFullPath(to);
+    headers["Depth"] = "infinity";
+    // Never merge into or replace an existing folder; the caller checked.
+    headers["Overwrite"] = "F";
+    std::string encode_url = this->host_url + CHTTPClient::EncodeUrl(src);
+
+    if (!client->CustomRequest("COPY", encode_url, headers, res))
+        return 0;
+    if (res.iCode == 201 || res.iCode == 204)
+        return 1;
+    // 207 lists members that failed; the rest were copied.
+    Logger::Logf(Logger::LOG_ERROR, "WebDAV COPY tree from=%s to=%s code=%ld", from.c_str(), to.c_str(), res.iCode);
+    if (res.iCode == 405 || res.iCode == 501 || res.iCode == 502)
+        return -1;
+    return 0;
+}
+
 int WebDAVClient::Move(const std::string &from, const std::string &to)
 {
+    // movefile takes files only; folders go on to MOVE.
+    if (rclone && rclone->MoveFile(from, to))
+        return 1;
+
     CHTTPClient::HeadersMap headers;
     CHTTPClient::HttpResponse res;
 
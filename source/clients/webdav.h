@@ -1,11 +1,17 @@
 #ifndef WEBDAV_H
 #define WEBDAV_H
 
+#include <memory>
 #include <string>
 #include <vector>
 #include "clients/baseclient.h"
+#include "clients/rclone_rc.h"
+#include "httpclient/HTTPMultiClient.h"
+#include "clients/webdav_propfind.h"
 #include "clients/remote_client.h"
 #include "common.h"
+#include "transfer_journal.h"
+#include "checksum.h"
 
 class WebDAVClient : public BaseClient
 {
@@ -16,18 +22,67 @@ public:
     int Rename(const std::string &src, const std::string &dst);
     int Delete(const std::string &path);
     int Copy(const std::string &from, const std::string &to);
+    int CopyTree(const std::string &from, const std::string &to);
     int Move(const std::string &from, const std::string &to);
     int Put(const std::string &inputfile, const std::string &path, uint64_t offset = 0);
+    int PutStream(const std::string &path, uint64_t size, const RemoteSourceFn &source) override;
     int Size(const std::string &path, int64_t *size);
     int Get(const std::string &outputfile, const std::string &path, uint64_t offset = 0) override;
+    int GetKnownSize(const std::string &outputfile, const std::string &path, int64_t size, uint64_t offset = 0) override;
+    int GetFolderArchive(const std::string &path, const RemoteStreamFn &on_data) override;
+    // Nextcloud's and ownCloud's /index.php/core/preview.png.
+    int GetPreview(const std::string &path, int width, int height, const RemoteStreamFn &on_data) override;
     std::vector<DirEntry> ListDir(const std::string &path);
+    int ListDirStreamed(const std::string &path, const DirEntryBatchFn &on_batch) override;
+    bool GetDirValidator(const std::string &path, std::string &validator) override;
+    int ListTree(const std::string &path, const DirEntryBatchFn &on_batch) override;
+    int UsedBytes(const std::string &path, int64_t *bytes) override;
+    // RFC 5323 basicsearch on displayname, through Nextcloud's arbiter at
+    // .../remote.php/dav when the site is one, else the folder itself.
+    int Search(const std::string &path, const std::string &query, const DirEntryBatchFn &on_batch) override;
     ClientType clientType();
     uint32_t SupportedActions();
     static std::string GetHttpUrl(std::string url);
+    // Starting point for webdav_autotune, usually the values stored for the
+    // site. 0 means unknown.
+    void SetTuning(int parallel, int chunk_mb);
+    // Values learned by the last autotuned download; false if none ran.
+    bool GetTuning(int *parallel, int *chunk_mb) const;
+    // rclone's rc API for a site rclone serves (see rclone_rc.h), used
+    // from Connect() on for listings, trees, folder sizes, hashes and
+    // server-side operations before the WebDAV requests. Empty `url`
+    // leaves it off.
+    void SetRclone(const std::string &url, const std::string &fs);
 
 private:
-    bool PropFind(const std::string &path, int depth, CHTTPClient::HttpResponse &res);
-    bool ProbeRangeSupport(const std::string &encodedUrl);
+    // Streams a PROPFIND of `path` through the multistatus parser, calling
+    // `onEntry` per <response>. Returns false with response set on a
+    // transport or XML error. Setting `*cancel` aborts the transfer. A
+    // negative depth sends "Depth: infinity". Without `props` only the
+    // properties a WebDAVPropfindEntry is built from are asked for; with
+    // it, the DAV: properties named there, e.g. "<d:quota-used-bytes/>".
+    bool PropFind(const std::string &path, int depth, const WebDAVPropfindParser::EntryFn &onEntry,
+                  const bool *cancel = nullptr, long *httpCode = nullptr, const char *props = nullptr);
+    // Decoded href without trailing slash or the site's base path.
+    std::string ResourcePath(const std::string &href) const;
+    // Splits the base path of a Nextcloud/ownCloud site into the install
+    // prefix before /remote.php, the user and the folder below that
+    // user's files. Returns false when the site is not such an endpoint.
+    bool NextcloudRoot(std::string &install, std::string &user, std::string &folder) const;
+    // Chunk collection and final URL of a Nextcloud chunked (v2) upload of
+    // `path`. Returns false when the site is not a Nextcloud endpoint.
+    bool NextcloudUploadUrls(const std::string &path, std::string &uploads, std::string &destination);
+    // Parallel chunked upload. Returns -1 when the server has no chunked
+    // upload protocol, so the caller can fall back to a plain PUT.
+    int PutChunked(const std::string &inputfile, const std::string &path, int64_t size);
+    // Whether the server writes a Content-Range PUT at its offset, tried on
+    // a scratch file beside `path` and learnt into HostCaps; false, without
+    // learning, when it takes no PUT there at all.
+    bool ProbeRangedPut(const std::string &path);
+    // PUT of bytes `offset` to `size` of the file with Content-Range, which
+    // Apache mod_dav writes at that offset, for a resumed upload. Returns -1
+    // when the server does not, so the caller uploads the whole file.
+    int PutRange(const std::string &inputfile, const std::string &path, uint64_t offset, int64_t size);
     int GetRangedSequential(const std::string &outputfile,
                             const std::string &encodedUrl,
                             int64_t size,
@@ -48,12 +103,46 @@ private:
                                int64_t size,
                                int64_t chunk_size,
                                int parallel,
-                               uint64_t partSize);
-    int GetRangedParallel(const std::string &outputfile,
-                          const std::string &encodedUrl,
-                          int64_t size,
-                          int64_t chunk_size,
-                          int parallel);
+                               uint64_t partSize,
+                               TransferJournal &journal,
+                               bool resume);
+    // Compares resume_verify_blocks 64 KiB samples of the data kept in
+    // `target` (the [start, end) `spans` of it) with the same ranges of
+    // `path` on the server: the last bytes kept and the rest at random.
+    // False when one differs, so the download starts over instead of
+    // finishing a file of two versions.
+    bool VerifyResume(const std::string &target, uint64_t partSize, const std::string &path,
+                      const std::vector<std::pair<int64_t, int64_t>> &spans);
+    // Loads the resume journal of `key` (the requested destination) or
+    // starts a new one. Returns true when an earlier run against the same
+    // remote version left blocks in `target` worth keeping; a journal whose
+    // URL, size or ETag/mtime no longer match, or whose blocks fail
+    // VerifyResume(), is discarded.
+    bool PrepareJournal(TransferJournal &journal,
+                        const std::string &key,
+                        const std::string &target,
+                        const std::string &path,
+                        const std::string &encodedUrl,
+                        int64_t size,
+                        uint64_t partSize);
+    // Enables the engine's adaptive mode below the `parallel` ceiling, and
+    // records what it settled on after Run().
+    void StartAutoTune(CHTTPMultiClient &engine, int64_t chunk_size, int parallel) override;
+    void FinishAutoTune(const CHTTPMultiClient &engine) override;
+
+    int tuned_parallel = 0;
+    int tuned_chunk_mb = 0;
+    bool tuning_learned = false;
+    // Whether a folder GET returned a tar archive: -1 not tried yet.
+    int folder_archive = -1;
+    // Whether the server renders previews: -1 not tried yet.
+    int previews = -1;
+    // The server turned down a PROPFIND naming its properties; listings
+    // fall back to allprop.
+    bool prop_body_rejected = false;
+    std::string rclone_url;
+    std::string rclone_fs;
+    std::unique_ptr<RcloneRc> rclone;
 };
 
 #endif
@@ -0,0 +1,178 @@
+#include <cstring>
+#include "clients/webdav_propfind.h"
+
+// Namespace-aware expat reports "uri<sep>local"; we only need the local part.
+static const XML_Char kNamespaceSeparator = '\x01';
+
+WebDAVPropfindParser::WebDAVPropfindParser(EntryFn fn)
+    : parser(XML_ParserCreateNS(nullptr, kNamespaceSeparator)), onEntry(std::move(fn))
+{
+    if (!parser)
+    {
+        failed = true;
+        return;
+    }
+    XML_SetUserData(parser, this);
+    XML_SetElementHandler(parser, &WebDAVPropfindParser::startElement, &WebDAVPropfindParser::endElement);
+    XML_SetCharacterDataHandler(parser, &WebDAVPropfindParser::characterData);
+}
+
+WebDAVPropfindParser::~WebDAVPropfindParser()
+{
+    if (parser)
+        XML_ParserFree(parser);
+}
+
+bool WebDAVPropfindParser::Feed(const char *data, size_t size)
+{
+    if (failed)
+        return false;
+    if (XML_Parse(parser, data, static_cast<int>(size), 0) == XML_STATUS_ERROR)
+        failed = true;
+    return !failed;
+}
+
+bool WebDAVPropfindParser::Finish()
+{
+    if (failed)
+        return false;
+    if (XML_Parse(parser, nullptr, 0, 1) == XML_STATUS_ERROR)
+        failed = true;
+    return !failed;
+}
+
+const char *WebDAVPropfindParser::Error() const
+{
+    if (!parser)
+        return "out of memory";
+    return XML_ErrorString(XML_GetErrorCode(parser));
+}
+
+const char *WebDAVPropfindParser::localName(const XML_Char *name)
+{
+    const char *sep = std::strrchr(name, kNamespaceSeparator);
+    return sep ? sep + 1 : name;
+}
+
+void WebDAVPropfindParser::startElement(void *userData, const XML_Char *name, const XML_Char **)
+{
+    auto *self = static_cast<WebDAVPropfindParser *>(userData);
+    const char *local = localName(name);
+
+    if (self->depthInResponse == 0)
+    {
+        if (std::strcmp(local, "response") == 0)
+        {
+            self->depthInResponse = 1;
+            self->entry = WebDAVPropfindEntry{};
+        }
+        return;
+    }
+    self->depthInResponse++;
+
+    if (self->inResourceType)
+    {
+        if (std::strcmp(local, "collection") == 0)
+            self->pending.isCollection = true;
+        return;
+    }
+
+    self->field = FIELD_NONE;
+    if (std::strcmp(local, "propstat") == 0)
+    {
+        self->inPropstat = true;
+        self->pending = WebDAVPropfindEntry{};
+        self->status.clear();
+    }
+    else if (std::strcmp(local, "href") == 0 && !self->inPropstat)
+        self->field = FIELD_HREF;
+    else if (std::strcmp(local, "status") == 0 && self->inPropstat)
+        self->field = FIELD_STATUS;
+    else if (std::strcmp(local, "creationdate") == 0)
+        self->field = FIELD_CREATION_DATE;
+    else if (std::strcmp(local, "getcontentlength") == 0)
+        self->field = FIELD_CONTENT_LENGTH;
+    else if (std::strcmp(local, "getlastmodified") == 0)
+        self->field = FIELD_LAST_MODIFIED;
+    else if (std::strcmp(local, "getetag") == 0)
+        self->field = FIELD_ETAG;
+    else if (std::strcmp(local, "quota-used-bytes") == 0)
+        self->field = FIELD_QUOTA_USED;
+    else if (std::strcmp(local, "resourcetype") == 0)
+        self->inResourceType = true;
+
+    self->text.clear();
+}
+
+void WebDAVPropfindParser::endElement(void *userData, const XML_Char *name)
+{
+    auto *self = static_cast<WebDAVPropfindParser *>(userData);
+    if (self->depthInResponse == 0)
+        return;
+    const char *local = localName(name);
+
+    switch (self->field)
+    {
+    case FIELD_HREF:
+        self->entry.href = self->text;
+        break;
+    case FIELD_CREATION_DATE:
+        self->pending.creationDate = self->text;
+        break;
+    case FIELD_CONTENT_LENGTH:
+        self->pending.contentLength = self->text;
+        break;
+    case FIELD_LAST_MODIFIED:
+        self->pending.lastModified = self->text;
+        break;
+    case FIELD_ETAG:
+        self->pending.etag = self->text;
+        break;
+    case FIELD_QUOTA_USED:
+        self->pending.quotaUsed = self->text;
+        break;
+    case FIELD_STATUS:
+        self->status = self->text;
+        break;
+    default:
+        break;
+    }
+    self->field = FIELD_NONE;
+    self->text.clear();
+
+    if (std::strcmp(local, "resourcetype") == 0)
+        self->inResourceType = false;
+
+    if (std::strcmp(local, "propstat") == 0 && self->inPropstat)
+    {
+        self->inPropstat = false;
+        // "HTTP/1.1 200 OK"; a missing status is treated as success.
+        const char *sp = std::strchr(self->status.c_str(), ' ');
+        if (self->status.empty() || (sp && sp[1] == '2'))
+        {
+            WebDAVPropfindEntry &e = self->entry;
+            const WebDAVPropfindEntry &p = self->pending;
+            if (!p.creationDate.empty())
+                e.creationDate = p.creationDate;
+            if (!p.contentLength.empty())
+                e.contentLength = p.contentLength;
+            if (!p.lastModified.empty())
+                e.lastModified = p.lastModified;
+            if (!p.etag.empty())
+                e.etag = p.etag;
+            if (!p.quotaUsed.empty())
+                e.quotaUsed = p.quotaUsed;
+            e.isCollection = e.isCollection || p.isCollection;
+        }
+    }
+
+    if (--self->depthInResponse == 0 && self->onEntry)
+        self->onEntry(self->entry);
+}
+
+void WebDAVPropfindParser::characterData(void *userData, const XML_Char *s, int len)
+{
+    auto *self = static_cast<WebDAVPropfindParser *>(userData);
+    if (self->field != FIELD_NONE)
+        self->text.append(s, static_cast<size_t>(len));
+}
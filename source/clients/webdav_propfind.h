@@ -0,0 +1,75 @@
+#ifndef WEBDAV_PROPFIND_H
+#define WEBDAV_PROPFIND_H
+
+#include <string>
+#include <functional>
+#include <expat.h>
+
+// Properties of one <response> element of a PROPFIND multistatus body.
+struct WebDAVPropfindEntry
+{
+    std::string href;
+    std::string creationDate;
+    std::string contentLength;
+    std::string lastModified;
+    std::string etag;
+    // RFC 4331, only sent when asked for by name.
+    std::string quotaUsed;
+    bool isCollection = false;
+};
+
+// Incremental multistatus parser built on expat. Body bytes are fed as they
+// arrive from curl and every <response> is handed to the callback as soon
+// as its closing tag is seen, so nothing like a DOM of the whole listing is
+// ever built. Elements are matched on their local name only, whatever
+// namespace prefix the server picked.
+class WebDAVPropfindParser
+{
+public:
+    using EntryFn = std::function<void(const WebDAVPropfindEntry &entry)>;
+
+    explicit WebDAVPropfindParser(EntryFn onEntry);
+    ~WebDAVPropfindParser();
+
+    // Returns false once the document is malformed; later calls are ignored.
+    bool Feed(const char *data, size_t size);
+    // Signal end of input. Returns false if the document was incomplete.
+    bool Finish();
+    const char *Error() const;
+
+private:
+    enum Field
+    {
+        FIELD_NONE = 0,
+        FIELD_HREF,
+        FIELD_CREATION_DATE,
+        FIELD_CONTENT_LENGTH,
+        FIELD_LAST_MODIFIED,
+        FIELD_ETAG,
+        FIELD_QUOTA_USED,
+        FIELD_STATUS
+    };
+
+    XML_Parser parser;
+    EntryFn onEntry;
+    bool failed = false;
+
+    int depthInResponse = 0;
+    bool inPropstat = false;
+    bool inResourceType = false;
+    Field field = FIELD_NONE;
+    std::string text;
+
+    WebDAVPropfindEntry entry;
+    // Props of the current <propstat>; only merged into `entry` when the
+    // propstat's status is 2xx (404 propstats list missing properties).
+    WebDAVPropfindEntry pending;
+    std::string status;
+
+    static void startElement(void *userData, const XML_Char *name, const XML_Char **atts);
+    static void endElement(void *userData, const XML_Char *name);
+    static void characterData(void *userData, const XML_Char *s, int len);
+    static const char *localName(const XML_Char *name);
+};
+
+#endif
@@ -60,10 +60,9 @@ struct DirEntry
         return strcasecmp(p1->name, p2->name);
     }
 
-    static void Sort(std::vector<DirEntry> &list)
-    {
-        qsort(&list[0], list.size(), sizeof(DirEntry), DirEntryComparator);
-    }
+    // DirEntryComparator's order for the entries from `first` on, with
+    // the names folded once (listing_kernels.cpp).
+    static void Sort(std::vector<DirEntry> &list, size_t first = 0);
 
     static void SetDisplaySize(DirEntry *entry)
     {
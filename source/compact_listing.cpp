@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "compact_listing.h"
+#include "lang.h"
+
+CompactListing::CompactListing(const std::vector<DirEntry> &list)
+{
+    Reserve(list.size());
+    for (const DirEntry &entry : list)
+        Append(entry);
+}
+
+void CompactListing::Append(const DirEntry &entry)
+{
+    entries.push_back(pack(entry));
+}
+
+void CompactListing::Set(size_t index, const DirEntry &entry)
+{
+    entries[index] = pack(entry);
+}
+
+void CompactListing::Erase(const std::vector<bool> &drop)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (!drop[i])
+            entries[kept++] = entries[i];
+    }
+    entries.resize(kept);
+}
+
+CompactListing::Entry CompactListing::pack(const DirEntry &entry)
+{
+    Entry e;
+    if (lastDirectory != kNone && strcmp(arena.data() + lastDirectory, entry.directory) == 0)
+        e.directory = lastDirectory;
+    else
+        e.directory = lastDirectory = store(entry.directory);
+    e.name = store(entry.name);
+
+    char scratch[sizeof(entry.path)];
+    joinPath(entry.directory, entry.name, scratch, sizeof(scratch));
+    if (strcmp(scratch, entry.path) != 0)
+        e.path = store(entry.path);
+
+    defaultDisplaySize(entry.isDir, entry.file_size, scratch, sizeof(entry.display_size));
+    if (strcmp(scratch, entry.display_size) != 0)
+        e.displaySize = store(entry.display_size);
+    if (entry.display_date[0] != '\0')
+        e.displayDate = store(entry.display_date);
+
+    e.flags = (entry.isDir ? kDir : 0) | (entry.isLink ? kLink : 0) | (entry.selectable ? kSelectable : 0);
+    e.fileSize = entry.file_size;
+    e.modified = entry.modified;
+    return e;
+}
+
+void CompactListing::Clear()
+{
+    arena.clear();
+    entries.clear();
+    lastDirectory = kNone;
+}
+
+void CompactListing::Reserve(size_t count)
+{
+    entries.reserve(count);
+    // Names average a few dozen bytes.
+    arena.reserve(count * 32);
+}
+
+size_t CompactListing::Bytes() const
+{
+    return arena.capacity() + entries.capacity() * sizeof(Entry);
+}
+
+void CompactListing::Get(size_t index, DirEntry &out) const
+{
+    const Entry &e = entries[index];
+    const char *directory = arena.data() + e.directory;
+    const char *name = arena.data() + e.name;
+
+    snprintf(out.directory, sizeof(out.directory), "%s", directory);
+    snprintf(out.name, sizeof(out.name), "%s", name);
+    if (e.path != kNone)
+        snprintf(out.path, sizeof(out.path), "%s", arena.data() + e.path);
+    else
+        joinPath(directory, name, out.path, sizeof(out.path));
+    if (e.displaySize != kNone)
+        snprintf(out.display_size, sizeof(out.display_size), "%s", arena.data() + e.displaySize);
+    else
+        defaultDisplaySize((e.flags & kDir) != 0, e.fileSize, out.display_size, sizeof(out.display_size));
+    snprintf(out.display_date, sizeof(out.display_date), "%s", e.displayDate != kNone ? arena.data() + e.displayDate : "");
+
+    out.file_size = e.fileSize;
+    out.isDir = (e.flags & kDir) != 0;
+    out.isLink = (e.flags & kLink) != 0;
+    out.selectable = (e.flags & kSelectable) != 0;
+    out.modified = e.modified;
+}
+
+std::vector<DirEntry> CompactListing::ToVector() const
+{
+    std::vector<DirEntry> out(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        Get(i, out[i]);
+    return out;
+}
+
+uint32_t CompactListing::store(const char *text)
+{
+    uint32_t offset = (uint32_t)arena.size();
+    arena.insert(arena.end(), text, text + strlen(text) + 1);
+    return offset;
+}
+
+void CompactListing::joinPath(const char *directory, const char *name, char *out, size_t size)
+{
+    size_t length = strlen(directory);
+    bool slash = length > 0 && directory[length - 1] == '/';
+    snprintf(out, size, "%s%s%s", directory, slash ? "" : "/", name);
+}
+
+void CompactListing::defaultDisplaySize(bool isDir, uint64_t size, char *out, size_t length)
+{
+    if (isDir)
+        snprintf(out, length, "%s", lang_strings[STR_FOLDER]);
+    else if (size < 1024)
+        snprintf(out, length, "%lluB", (unsigned long long)size);
+    else if (size < 1024 * 1024)
+        snprintf(out, length, "%.2fKB", size * 1.0f / 1024);
+    else if (size < 1024 * 1024 * 1024)
+        snprintf(out, length, "%.2fMB", size * 1.0f / (1024 * 1024));
+    else
+        snprintf(out, length, "%.2fGB", size * 1.0f / (1024 * 1024 * 1024));
+}
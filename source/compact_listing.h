@@ -0,0 +1,77 @@
+#ifndef NEO_COMPACT_LISTING_H
+#define NEO_COMPACT_LISTING_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "common.h"
+
+// A folder listing stored without DirEntry's fixed-size buffers. Strings
+// live NUL-terminated in one arena per listing and entries refer to them
+// by offset: the directory is stored once for all entries that share it,
+// the path only when it isn't directory + "/" + name, and the display size
+// only when it differs from the one formatted from the file size on Get().
+// An entry costs about 64 bytes plus its name instead of ~1.7 KiB.
+class CompactListing
+{
+public:
+    CompactListing() {}
+    explicit CompactListing(const std::vector<DirEntry> &list);
+
+    void Append(const DirEntry &entry);
+    // Replaces entry `index`; its old strings stay in the arena.
+    void Set(size_t index, const DirEntry &entry);
+    // Drops the entries whose `drop` flag is set, keeping the others in
+    // order. Their strings stay in the arena until the listing is copied.
+    void Erase(const std::vector<bool> &drop);
+    void Clear();
+    void Reserve(size_t count);
+
+    size_t Size() const { return entries.size(); }
+    bool Empty() const { return entries.empty(); }
+    // Approximate heap bytes held, for logging.
+    size_t Bytes() const;
+
+    const char *Name(size_t index) const { return arena.data() + entries[index].name; }
+    bool IsDir(size_t index) const { return (entries[index].flags & kDir) != 0; }
+    uint64_t FileSize(size_t index) const { return entries[index].fileSize; }
+    const DateTime &Modified(size_t index) const { return entries[index].modified; }
+
+    // Rebuilds the full DirEntry of `index`.
+    void Get(size_t index, DirEntry &out) const;
+    std::vector<DirEntry> ToVector() const;
+
+private:
+    static const uint32_t kNone = 0xFFFFFFFFU;
+    enum Flags
+    {
+        kDir = 1,
+        kLink = 2,
+        kSelectable = 4
+    };
+
+    struct Entry
+    {
+        uint32_t directory = kNone;
+        uint32_t name = kNone;
+        // kNone: derived from directory and name, or the default display.
+        uint32_t path = kNone;
+        uint32_t displaySize = kNone;
+        uint32_t displayDate = kNone;
+        uint8_t flags = 0;
+        uint64_t fileSize = 0;
+        DateTime modified;
+    };
+
+    std::vector<char> arena;
+    std::vector<Entry> entries;
+    uint32_t lastDirectory = kNone;
+
+    Entry pack(const DirEntry &entry);
+    uint32_t store(const char *text);
+    static void joinPath(const char *directory, const char *name, char *out, size_t size);
+    static void defaultDisplaySize(bool isDir, uint64_t size, char *out, size_t length);
+};
+
+#endif
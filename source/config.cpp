@@ -1,10 +1,14 @@
 #include <string>
 #include <cstring>
+#include <strings.h>
 #include <map>
 
 #include "config.h"
 #include "fs.h"
 #include "lang.h"
+#include "listing_index.h"
+#include "logger.h"
+#include "net_iface.h"
 
 extern "C"
 {
@@ -21,9 +25,119 @@ char language[128];
 int max_edit_file_size;
 int webdav_chunk_size_mb;
 int webdav_parallel_connections;
+int http_parallel_connections;
+int site_connections;
+char myrient_mirrors[512];
 int download_parallel_files;
+bool background_transfers;
+int upload_parallel_files;
+int rate_limit_kb;
 bool webdav_split_large;
+bool webdav_multiplex;
+bool webdav_tree_scan;
+bool webdav_autotune;
+int webdav_range_steal_kb;
+bool verify_downloads;
+bool verify_chunks;
+bool metalink;
+bool sync_delete_extras;
+int small_file_batch_kb;
+bool transfer_journal;
+int download_cache;
+int download_cache_min_mb;
+int resume_verify_blocks;
+int transfer_memory_mb;
+int memory_reserve_mb;
+bool memory_governor;
+bool socket_tuning;
+int socket_link_mbps;
+int disk_queue_mb;
+int disk_reorder_mb;
+int disk_block_kb;
+int site_bench_mb;
+int site_copy_buffer_mb;
+int local_copy_workers;
+int remote_delete_workers;
+int remote_move_workers;
+int archive_cache_mb;
+int archive_prefetch;
+bool archive_streaming;
+bool install_to_nand;
+int image_cache_mb;
+int image_prefetch_workers;
+int viewer_cache_mb;
+bool http_compress_listings;
+bool http3;
+bool tls_resume;
+int folder_size_workers;
+bool fast_delete;
+bool remote_search;
+int thumbnail_workers;
+int thumbnail_cache_mb;
+bool thumbnail_server_previews;
+bool package_info;
+int idle_fps;
+int progress_fps;
+int cpu_boost;
+int cpu_boost_min_battery;
+bool keep_awake_enabled;
+int screen_off_minutes;
+int status_port;
+// Threads start before the config is read (the logger's), so these hold
+// their defaults until then.
+bool thread_affinity = true;
+int ui_core = 0;
+int network_priority = 0x3B;
+int disk_priority = 0x2C;
+bool auto_connect;
+bool reconnect_on_resume;
+int dns_cache_seconds;
+char dns_servers[128];
+int dns_race_ms;
+int site_probe_workers;
+int keepalive_seconds;
+int keepalive_pool_seconds;
+int client_pool;
+int host_breaker_seconds;
+int zip_workers;
+int unzip_workers;
+int webdav_upload_parallel;
+int webdav_upload_chunk_mb;
 bool force_fat32;
+int listing_cache_seconds;
+int listing_cache_entries;
+int listing_sort;
+int listing_prefetch;
+int sftp_pipeline_depth;
+int sftp_request_kb;
+int sftp_parallel_sessions;
+int sftp_segment_mb;
+int sftp_attr_cache_secs;
+char sftp_cipher_order[256];
+char sftp_mac_order[256];
+int sftp_compress_below_kb;
+int sftp_read_ahead_kb;
+int sftp_delta_min_mb;
+int sftp_delta_block_kb;
+int ftp_parallel_connections;
+int ftp_segment_mb;
+int ftp_session_pool;
+int ftp_listing_cache_secs;
+int ftp_mode_z;
+int ftp_mode_z_mbps;
+int smb_io_depth;
+int smb_attr_cache_secs;
+int smb_sessions;
+int smb_parallel_sessions;
+int smb_segment_mb;
+int nfs_io_depth;
+int nfs_rw_size_kb;
+int server_port;
+char server_root[256];
+int server_connections;
+int server_read_buffer_kb;
+char server_user[64];
+char server_password[128];
 std::vector<std::string> sites;
 std::map<std::string, RemoteSettings> site_settings;
 std::set<std::string> text_file_extensions;
@@ -33,6 +147,59 @@ RemoteClient *remoteclient;
 std::vector<std::string> http_servers;
 std::vector<std::string> langs;
 bool logging_enabled = true;
+int log_level = Logger::LOG_INFO;
+bool transfer_trace = false;
+bool memory_overlay = false;
+bool frame_profiler = false;
+bool timeline_trace = false;
+bool transfer_history = true;
+
+namespace
+{
+    // Transfer knobs as read from the global INI sections, restored before a
+    // site profile is layered on top of them.
+    struct TransferKnobs
+    {
+        int webdav_chunk_mb;
+        int webdav_parallel;
+        int download_parallel_files;
+        bool webdav_split_large;
+        int sftp_pipeline_depth;
+        int ftp_parallel_connections;
+        int smb_io_depth;
+        int upload_parallel_files;
+        int rate_limit_kb;
+    };
+
+    TransferKnobs global_knobs;
+    int global_http_parallel;
+    int global_site_connections;
+    // What the last ApplySiteProfile() went by.
+    NetIface::Type applied_iface = NetIface::TYPE_NONE;
+    const char *applied_profile = "";
+
+    struct ProfilePreset
+    {
+        const char *name;
+        TransferKnobs knobs;
+    };
+
+    // LAN: low latency, so few large ranges saturate the link. WAN: many
+    // ranges and deep pipelines to cover the round trip. Metered: one
+    // stream at a time with small requests, so a cancel wastes little.
+    // webdav_split_large is a storage choice and rate_limit_kb depends on the
+    // link, so both always come from the INI.
+    const ProfilePreset kProfilePresets[] = {
+        {PROFILE_LAN, {16, 4, 4, true, 32, 1, 16, 4, 0}},
+        {PROFILE_WAN, {8, 12, 2, true, 64, 4, 32, 2, 0}},
+        {PROFILE_METERED, {4, 2, 1, true, 16, 1, 8, 1, 0}},
+    };
+
+    int Clamp(int value, int lo, int hi)
+    {
+        return (value < lo) ? lo : ((value > hi) ? hi : value);
+    }
+}
 
 namespace CONFIG
 {
@@ -75,6 +242,37 @@ namespace CONFIG
         logging_enabled = ReadBool(CONFIG_GLOBAL, CONFIG_LOGGING_ENABLED, true);
         WriteBool(CONFIG_GLOBAL, CONFIG_LOGGING_ENABLED, logging_enabled);
 
+        // Most verbose level written: "error", "warn", "info" or "debug"
+        // (per-request HTTP lines and curl's own tracing).
+        static const char *level_names[] = {"error", "warn", "info", "debug"};
+        log_level = Logger::ParseLevel(ReadString(CONFIG_GLOBAL, CONFIG_LOG_LEVEL, "info"));
+        WriteString(CONFIG_GLOBAL, CONFIG_LOG_LEVEL, level_names[log_level]);
+
+        // Per-request timing records (curl phases, SFTP/FTP/SMB blocks,
+        // disk writes) appended to TRACE_FILE; see transfer_trace.h.
+        transfer_trace = ReadBool(CONFIG_GLOBAL, CONFIG_TRANSFER_TRACE, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TRANSFER_TRACE, transfer_trace);
+
+        // Heap, budget and per-subsystem memory drawn over the browser;
+        // see memory_stats.h.
+        memory_overlay = ReadBool(CONFIG_GLOBAL, CONFIG_MEMORY_OVERLAY, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_MEMORY_OVERLAY, memory_overlay);
+
+        // UI frame times by section, drawn over the browser; see
+        // frame_profiler.h.
+        frame_profiler = ReadBool(CONFIG_GLOBAL, CONFIG_FRAME_PROFILER, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_FRAME_PROFILER, frame_profiler);
+
+        // Per-thread spans (frames, requests, parses, disk writes) kept in
+        // memory and exported from Settings; see timeline.h.
+        timeline_trace = ReadBool(CONFIG_GLOBAL, CONFIG_TIMELINE_TRACE, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TIMELINE_TRACE, timeline_trace);
+
+        // Finished batches kept in HISTORY_FILE, shown per site in
+        // Settings and seeding webdav_autotune; see transfer_history.h.
+        transfer_history = ReadBool(CONFIG_GLOBAL, CONFIG_TRANSFER_HISTORY, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TRANSFER_HISTORY, transfer_history);
+
         // WebDAV download chunk size in MiB for ranged GETs. Default to 8 MiB,
         // and clamp to a conservative range to avoid excessive memory usage.
         webdav_chunk_size_mb = ReadInt(CONFIG_GLOBAL, CONFIG_WEBDAV_CHUNK_MB, 8);
@@ -95,18 +293,64 @@ namespace CONFIG
             webdav_parallel_connections = 32;
         WriteInt(CONFIG_GLOBAL, CONFIG_WEBDAV_PARALLEL, webdav_parallel_connections);
 
-        // Maximum number of individual files to download in parallel at the
-        // scheduler level. This is a coarse-grained knob that controls how
-        // many separate WebDAV transfers can be in flight at once on top of
-        // any per-file range parallelism. Default to 2 for a good balance
-        // between throughput and CPU/SD pressure.
+        // Ranges in flight per file on the HTTP index servers (Apache,
+        // Nginx, Myrient, Archive.org, ...). Kept lower than WebDAV's since
+        // these are public hosts; 1 keeps the single streamed GET.
+        http_parallel_connections = ReadInt(CONFIG_GLOBAL, CONFIG_HTTP_PARALLEL, 4);
+        if (http_parallel_connections < 1)
+            http_parallel_connections = 1;
+        else if (http_parallel_connections > 32)
+            http_parallel_connections = 32;
+        WriteInt(CONFIG_GLOBAL, CONFIG_HTTP_PARALLEL, http_parallel_connections);
+
+        // Connections to one site across the files of a batch and their
+        // ranges (ConnectionBudget); 0 = the larger of webdav_parallel and
+        // download_parallel_files.
+        site_connections = ReadInt(CONFIG_GLOBAL, CONFIG_SITE_CONNECTIONS, 0);
+        if (site_connections < 0)
+            site_connections = 0;
+        else if (site_connections > 64)
+            site_connections = 64;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SITE_CONNECTIONS, site_connections);
+
+        // Comma-separated base URLs mirroring a Myrient site's root; ranges
+        // are spread over them and the site itself.
+        snprintf(myrient_mirrors, sizeof(myrient_mirrors), "%s", ReadString(CONFIG_GLOBAL, CONFIG_MYRIENT_MIRRORS, ""));
+        WriteString(CONFIG_GLOBAL, CONFIG_MYRIENT_MIRRORS, myrient_mirrors);
+
+        // Number of download queue workers, i.e. how many files can be in
+        // flight at once on any protocol, on top of any per-file range
+        // parallelism. Each extra worker opens its own connection. Default
+        // to 2 for a good balance between throughput and CPU/SD pressure.
         download_parallel_files = ReadInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_PARALLEL_FILES, 2);
         if (download_parallel_files < 1)
             download_parallel_files = 1;
-        else if (download_parallel_files > 3)
-            download_parallel_files = 3;
+        else if (download_parallel_files > 8)
+            download_parallel_files = 8;
         WriteInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_PARALLEL_FILES, download_parallel_files);
 
+        // Downloads that need no overwrite prompt run on their own
+        // connections behind a status strip, and the browser stays usable.
+        background_transfers = ReadBool(CONFIG_GLOBAL, CONFIG_BACKGROUND_TRANSFERS, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_BACKGROUND_TRANSFERS, background_transfers);
+
+        // The same for uploads: files sent at once, each extra one on its
+        // own connection, largest first.
+        upload_parallel_files = ReadInt(CONFIG_GLOBAL, CONFIG_UPLOAD_PARALLEL_FILES, 2);
+        if (upload_parallel_files < 1)
+            upload_parallel_files = 1;
+        else if (upload_parallel_files > 8)
+            upload_parallel_files = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_UPLOAD_PARALLEL_FILES, upload_parallel_files);
+
+        // Bandwidth cap shared by all transfers, in KiB/s; 0 = unlimited.
+        rate_limit_kb = ReadInt(CONFIG_GLOBAL, CONFIG_RATE_LIMIT_KB, 0);
+        if (rate_limit_kb < 0)
+            rate_limit_kb = 0;
+        else if (rate_limit_kb > 1048576)
+            rate_limit_kb = 1048576;
+        WriteInt(CONFIG_GLOBAL, CONFIG_RATE_LIMIT_KB, rate_limit_kb);
+
         // When true (default), large WebDAV downloads (>4 GiB) are written
         // using the DBI-style split layout so they are safe on FAT32 and
         // installable by DBI/Tinfoil via the concatenation file mechanism.
@@ -116,12 +360,802 @@ namespace CONFIG
         webdav_split_large = ReadBool(CONFIG_GLOBAL, CONFIG_WEBDAV_SPLIT_LARGE, true);
         WriteBool(CONFIG_GLOBAL, CONFIG_WEBDAV_SPLIT_LARGE, webdav_split_large);
 
+        // When true (default), parallel WebDAV ranges may share one HTTP/2
+        // connection as multiplexed streams if the server negotiates h2.
+        // Set to 0 to force one TCP/TLS connection per in-flight range,
+        // which can be faster on lossy links where a single stream stalls.
+        webdav_multiplex = ReadBool(CONFIG_GLOBAL, CONFIG_WEBDAV_MULTIPLEX, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_WEBDAV_MULTIPLEX, webdav_multiplex);
+
+        // When true (default), a folder download first asks the WebDAV
+        // server for the whole tree with one "Depth: infinity" PROPFIND to
+        // build the file list and byte total up front. Servers that refuse
+        // it are walked folder by folder as before.
+        webdav_tree_scan = ReadBool(CONFIG_GLOBAL, CONFIG_WEBDAV_TREE_SCAN, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_WEBDAV_TREE_SCAN, webdav_tree_scan);
+
+        // When true (default), parallel WebDAV ranged downloads adapt the
+        // number of ranges in flight (up to webdav_parallel) and the range
+        // size (1..32 MiB) to the measured throughput, backing off when the
+        // server answers 429/503 or drops connections. The values learned
+        // are stored per site and used as the starting point next time.
+        webdav_autotune = ReadBool(CONFIG_GLOBAL, CONFIG_WEBDAV_AUTOTUNE, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_WEBDAV_AUTOTUNE, webdav_autotune);
+
+        // Near the end of a parallel WebDAV download a range that nobody
+        // else can help with would hold up the file; an idle connection
+        // takes the second half of the range with the most left, as long as
+        // that is at least twice this many KiB. 0 turns it off.
+        webdav_range_steal_kb = ReadInt(CONFIG_GLOBAL, CONFIG_WEBDAV_RANGE_STEAL_KB, 1024);
+        if (webdav_range_steal_kb < 0)
+            webdav_range_steal_kb = 0;
+        if (webdav_range_steal_kb > 65536)
+            webdav_range_steal_kb = 65536;
+        WriteInt(CONFIG_GLOBAL, CONFIG_WEBDAV_RANGE_STEAL_KB, webdav_range_steal_kb);
+
+        // When true, WebDAV downloads ask for the server's checksum
+        // (OC-Checksum or RFC 3230 Digest), digest the data as it is
+        // written and delete the file on a mismatch. Off by default: most
+        // servers send none, which costs one small request per file.
+        verify_downloads = ReadBool(CONFIG_GLOBAL, CONFIG_VERIFY_DOWNLOADS, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_VERIFY_DOWNLOADS, verify_downloads);
+
+        // With verify_downloads, parallel ranged downloads also digest each
+        // chunk, check the chunks against a "<file>.sha256" list when the
+        // server has one, and fetch only the bad chunks again instead of
+        // deleting a file that fails (see chunk_hashes.h).
+        verify_chunks = ReadBool(CONFIG_GLOBAL, CONFIG_VERIFY_CHUNKS, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_VERIFY_CHUNKS, verify_chunks);
+
+        // A downloaded .meta4/.metalink also fetches the files it lists from
+        // all their mirrors, checking every piece hash (see metalink.h).
+        metalink = ReadBool(CONFIG_GLOBAL, CONFIG_METALINK, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_METALINK, metalink);
+
+        // When true, Sync also deletes what the destination folder has and
+        // the source does not, making it an exact mirror. Off by default, so
+        // a sync never removes files.
+        sync_delete_extras = ReadBool(CONFIG_GLOBAL, CONFIG_SYNC_DELETE_EXTRAS, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_SYNC_DELETE_EXTRAS, sync_delete_extras);
+
+        // Folder downloads whose files average at most this many KiB are
+        // fetched as one tar archive when the server builds one (Nextcloud
+        // 30+), instead of a request and a file open per file. 0 disables.
+        small_file_batch_kb = ReadInt(CONFIG_GLOBAL, CONFIG_SMALL_FILE_BATCH_KB, 256);
+        if (small_file_batch_kb < 0)
+            small_file_batch_kb = 0;
+        else if (small_file_batch_kb > 16384)
+            small_file_batch_kb = 16384;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SMALL_FILE_BATCH_KB, small_file_batch_kb);
+
+        // When true (default), parallel WebDAV downloads keep a journal of
+        // the blocks already written under /switch/neo_sftp/journal, so a
+        // download cut off by sleep mode or a crash resumes with only the
+        // missing blocks, and unfinished ones are offered on connect. A
+        // journal is discarded when the remote ETag/mtime changed. Uploads
+        // keep one too, so a cut-off upload continues the partial remote
+        // file on the next attempt instead of starting over.
+        transfer_journal = ReadBool(CONFIG_GLOBAL, CONFIG_TRANSFER_JOURNAL, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TRANSFER_JOURNAL, transfer_journal);
+
+        // Finished downloads of download_cache_min_mb or more remembered
+        // (see download_cache.h), so the same remote file is copied from the
+        // card instead of fetched again. 0 = off.
+        download_cache = ReadInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_CACHE, 256);
+        if (download_cache < 0)
+            download_cache = 0;
+        else if (download_cache > 4096)
+            download_cache = 4096;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_CACHE, download_cache);
+        download_cache_min_mb = ReadInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_CACHE_MIN_MB, 16);
+        if (download_cache_min_mb < 1)
+            download_cache_min_mb = 1;
+        else if (download_cache_min_mb > 65536)
+            download_cache_min_mb = 65536;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_CACHE_MIN_MB, download_cache_min_mb);
+
+        // 64 KiB samples of a partial WebDAV download compared with the
+        // server before it is resumed: the last one kept, the rest at random.
+        // A mismatch starts the download over. Resumed uploads compare as
+        // many samples of the remote part with the card. 0 = trust the
+        // partial data.
+        resume_verify_blocks = ReadInt(CONFIG_GLOBAL, CONFIG_RESUME_VERIFY_BLOCKS, 4);
+        if (resume_verify_blocks < 0)
+            resume_verify_blocks = 0;
+        else if (resume_verify_blocks > 16)
+            resume_verify_blocks = 16;
+        WriteInt(CONFIG_GLOBAL, CONFIG_RESUME_VERIFY_BLOCKS, resume_verify_blocks);
+
+        // Upper bound, in MiB, on the transfer buffers leased from the
+        // shared pool at once (network reads, local writes, upload chunks,
+        // archive extraction). A lease that would exceed it waits for
+        // others to return theirs.
+        transfer_memory_mb = ReadInt(CONFIG_GLOBAL, CONFIG_TRANSFER_MEMORY_MB, 256);
+        if (transfer_memory_mb < 32)
+            transfer_memory_mb = 32;
+        else if (transfer_memory_mb > 2048)
+            transfer_memory_mb = 2048;
+        WriteInt(CONFIG_GLOBAL, CONFIG_TRANSFER_MEMORY_MB, transfer_memory_mb);
+
+        // Heap, in MiB, the parallel engines leave free for listings,
+        // textures and everything else: they claim no more ranges in flight
+        // once less than this plus a range is left.
+        memory_reserve_mb = ReadInt(CONFIG_GLOBAL, CONFIG_MEMORY_RESERVE_MB, 32);
+        if (memory_reserve_mb < 8)
+            memory_reserve_mb = 8;
+        else if (memory_reserve_mb > 256)
+            memory_reserve_mb = 256;
+        WriteInt(CONFIG_GLOBAL, CONFIG_MEMORY_RESERVE_MB, memory_reserve_mb);
+
+        // Scale the transfer budget, workers, range sizes and caches to
+        // the heap the app got (applet or title mode) and to how much of
+        // it is free; see memory_governor.h.
+        memory_governor = ReadBool(CONFIG_GLOBAL, CONFIG_MEMORY_GOVERNOR, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_MEMORY_GOVERNOR, memory_governor);
+
+        // TCP buffers sized per host from its round trip and rate; the
+        // link speed, in Mbit/s, is assumed until a connection measured
+        // one. See socket_tuning.h.
+        socket_tuning = ReadBool(CONFIG_GLOBAL, CONFIG_SOCKET_TUNING, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_SOCKET_TUNING, socket_tuning);
+        socket_link_mbps = ReadInt(CONFIG_GLOBAL, CONFIG_SOCKET_LINK_MBPS, 300);
+        if (socket_link_mbps < 10)
+            socket_link_mbps = 10;
+        else if (socket_link_mbps > 1000)
+            socket_link_mbps = 1000;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SOCKET_LINK_MBPS, socket_link_mbps);
+
+        // Downloads hand filled buffers to a writer thread per file instead
+        // of writing from the network loop, so SD stalls (cluster
+        // allocation, wear levelling) don't stop the socket reads until
+        // this many MiB are queued. 0 writes inline.
+        disk_queue_mb = ReadInt(CONFIG_GLOBAL, CONFIG_DISK_QUEUE_MB, 32);
+        if (disk_queue_mb < 0)
+            disk_queue_mb = 0;
+        else if (disk_queue_mb > 256)
+            disk_queue_mb = 256;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_QUEUE_MB, disk_queue_mb);
+
+        // Out of order writes from parallel ranges wait in the writer, up
+        // to this many MiB (and half of disk_queue_mb), for the gap before
+        // them so the card sees one sequential stream. 0 never waits.
+        disk_reorder_mb = ReadInt(CONFIG_GLOBAL, CONFIG_DISK_REORDER_MB, 16);
+        if (disk_reorder_mb < 0)
+            disk_reorder_mb = 0;
+        else if (disk_reorder_mb > 128)
+            disk_reorder_mb = 128;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_REORDER_MB, disk_reorder_mb);
+
+        // Size of the writes streamed downloads and extractions make, in
+        // KiB rounded to 64 KiB; the settings' SD card benchmark finds the
+        // smallest one that runs the card at full speed.
+        disk_block_kb = ReadInt(CONFIG_GLOBAL, CONFIG_DISK_BLOCK_KB, 1024);
+        if (disk_block_kb < 64)
+            disk_block_kb = 64;
+        else if (disk_block_kb > 4096)
+            disk_block_kb = 4096;
+        disk_block_kb -= disk_block_kb % 64;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_BLOCK_KB, disk_block_kb);
+
+        // Bytes of the chosen file each point of the site benchmark
+        // downloads (ConnectionPanel's gauge button).
+        site_bench_mb = ReadInt(CONFIG_GLOBAL, CONFIG_SITE_BENCH_MB, 64);
+        if (site_bench_mb < 8)
+            site_bench_mb = 8;
+        else if (site_bench_mb > 1024)
+            site_bench_mb = 1024;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SITE_BENCH_MB, site_bench_mb);
+
+        // Files pasted from another site stream from one connection to the
+        // other; this many MiB may sit between the download and the upload
+        // before the download waits. A zip made straight on a remote site
+        // queues this much for its upload as well.
+        site_copy_buffer_mb = ReadInt(CONFIG_GLOBAL, CONFIG_SITE_COPY_BUFFER_MB, 16);
+        if (site_copy_buffer_mb < 2)
+            site_copy_buffer_mb = 2;
+        else if (site_copy_buffer_mb > 256)
+            site_copy_buffer_mb = 256;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SITE_COPY_BUFFER_MB, site_copy_buffer_mb);
+
+        // Files copied or moved at once between local folders and drives.
+        // Each copy already overlaps its reads with the writer thread above;
+        // a second one mostly helps folders of small files. Overwrite
+        // prompts always run one file at a time.
+        local_copy_workers = ReadInt(CONFIG_GLOBAL, CONFIG_LOCAL_COPY_WORKERS, 2);
+        if (local_copy_workers < 1)
+            local_copy_workers = 1;
+        else if (local_copy_workers > 8)
+            local_copy_workers = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_LOCAL_COPY_WORKERS, local_copy_workers);
+
+        // Connections deleting remote files at once, the primary one
+        // included, while a folder tree is walked. Extra ones are separate
+        // sessions (SFTP, FTP, WebDAV); 1 deletes one file at a time.
+        remote_delete_workers = ReadInt(CONFIG_GLOBAL, CONFIG_REMOTE_DELETE_WORKERS, 4);
+        if (remote_delete_workers < 1)
+            remote_delete_workers = 1;
+        else if (remote_delete_workers > 8)
+            remote_delete_workers = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_REMOTE_DELETE_WORKERS, remote_delete_workers);
+
+        // Connections moving remote entries at once, the primary one
+        // included; SMB sends its renames together on its one connection.
+        remote_move_workers = ReadInt(CONFIG_GLOBAL, CONFIG_REMOTE_MOVE_WORKERS, 4);
+        if (remote_move_workers < 1)
+            remote_move_workers = 1;
+        else if (remote_move_workers > 8)
+            remote_move_workers = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_REMOTE_MOVE_WORKERS, remote_move_workers);
+
+        // Extracting a remote archive reads it through a cache of 1 MiB
+        // blocks of up to archive_cache_mb MiB. A fetch thread stays
+        // archive_prefetch blocks ahead of the reader, fetching them with
+        // concurrent ranged requests where the protocol allows it, so
+        // extraction isn't bound to one round trip per block. 0 disables
+        // prefetching.
+        archive_cache_mb = ReadInt(CONFIG_GLOBAL, CONFIG_ARCHIVE_CACHE_MB, 16);
+        if (archive_cache_mb < 4)
+            archive_cache_mb = 4;
+        else if (archive_cache_mb > 128)
+            archive_cache_mb = 128;
+        WriteInt(CONFIG_GLOBAL, CONFIG_ARCHIVE_CACHE_MB, archive_cache_mb);
+
+        archive_prefetch = ReadInt(CONFIG_GLOBAL, CONFIG_ARCHIVE_PREFETCH, 4);
+        if (archive_prefetch < 0)
+            archive_prefetch = 0;
+        else if (archive_prefetch > 16)
+            archive_prefetch = 16;
+        WriteInt(CONFIG_GLOBAL, CONFIG_ARCHIVE_PREFETCH, archive_prefetch);
+
+        // Zip and tar archives are extracted from one sequential download
+        // instead, with up to archive_cache_mb MiB read ahead. A zip that
+        // needs its central directory falls back to the block cache.
+        archive_streaming = ReadBool(CONFIG_GLOBAL, CONFIG_ARCHIVE_STREAMING, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_ARCHIVE_STREAMING, archive_streaming);
+
+        // Packages installed from a remote site (installer.h) go to the SD
+        // card unless this sends them to the console's own storage.
+        install_to_nand = ReadBool(CONFIG_GLOBAL, CONFIG_INSTALL_TO_NAND, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_INSTALL_TO_NAND, install_to_nand);
+
+        // Remote images are fetched into memory and decoded from there;
+        // their textures stay cached up to image_cache_mb MiB of video
+        // memory, so viewing one again needs neither network nor SD card.
+        image_cache_mb = ReadInt(CONFIG_GLOBAL, CONFIG_IMAGE_CACHE_MB, 64);
+        if (image_cache_mb < 0)
+            image_cache_mb = 0;
+        else if (image_cache_mb > 256)
+            image_cache_mb = 256;
+        WriteInt(CONFIG_GLOBAL, CONFIG_IMAGE_CACHE_MB, image_cache_mb);
+        // While an image is viewed, this many threads decode the ones next
+        // to it into that cache (image_prefetch.h), 0 decoding none ahead.
+        image_prefetch_workers = ReadInt(CONFIG_GLOBAL, CONFIG_IMAGE_PREFETCH_WORKERS, 2);
+        if (image_prefetch_workers < 0)
+            image_prefetch_workers = 0;
+        else if (image_prefetch_workers > 3)
+            image_prefetch_workers = 3;
+        WriteInt(CONFIG_GLOBAL, CONFIG_IMAGE_PREFETCH_WORKERS, image_prefetch_workers);
+
+        // Text files above max_edit_file_size open in the viewer
+        // (text_pager.h), which keeps up to viewer_cache_mb MiB of them in
+        // memory.
+        viewer_cache_mb = ReadInt(CONFIG_GLOBAL, CONFIG_VIEWER_CACHE_MB, 4);
+        if (viewer_cache_mb < 1)
+            viewer_cache_mb = 1;
+        else if (viewer_cache_mb > 64)
+            viewer_cache_mb = 64;
+        WriteInt(CONFIG_GLOBAL, CONFIG_VIEWER_CACHE_MB, viewer_cache_mb);
+
+        // Directory listings, PROPFIND and API JSON are asked for with
+        // Accept-Encoding (ContentDecoder.h); file data never is.
+        http_compress_listings = ReadBool(CONFIG_GLOBAL, CONFIG_HTTP_COMPRESS_LISTINGS, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_HTTP_COMPRESS_LISTINGS, http_compress_listings);
+
+        // HTTPS hosts that advertise h3 in Alt-Svc are asked over QUIC,
+        // when libcurl was built with it; see CHTTPClient::InitSession().
+        http3 = ReadBool(CONFIG_GLOBAL, CONFIG_HTTP3, false);
+        WriteBool(CONFIG_GLOBAL, CONFIG_HTTP3, http3);
+        // TLS sessions saved at exit and resumed at the next launch; see
+        // CHTTPConnectionPool::LoadSessions().
+        tls_resume = ReadBool(CONFIG_GLOBAL, CONFIG_TLS_RESUME, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TLS_RESUME, tls_resume);
+
+        // Folder sizes (properties, transfer totals) are crawled by this
+        // many workers, each on its own connection for remote folders.
+        folder_size_workers = ReadInt(CONFIG_GLOBAL, CONFIG_FOLDER_SIZE_WORKERS, 3);
+        if (folder_size_workers < 1)
+            folder_size_workers = 1;
+        else if (folder_size_workers > 8)
+            folder_size_workers = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_FOLDER_SIZE_WORKERS, folder_size_workers);
+
+        // Local deletes move the entries into the trash folder, emptied in
+        // the background; see LocalTrash.
+        fast_delete = ReadBool(CONFIG_GLOBAL, CONFIG_FAST_DELETE, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_FAST_DELETE, fast_delete);
+
+        // Search in the remote pane asks the server (WebDAV SEARCH, find
+        // over SSH) before the catalogue and the folder on screen.
+        remote_search = ReadBool(CONFIG_GLOBAL, CONFIG_REMOTE_SEARCH, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_REMOTE_SEARCH, remote_search);
+
+        // The grid view (Minus) decodes thumbnails on this many threads,
+        // 0 showing icons only, and keeps them as small JPEGs in up to
+        // thumbnail_cache_mb MiB of the SD card.
+        thumbnail_workers = ReadInt(CONFIG_GLOBAL, CONFIG_THUMBNAIL_WORKERS, 2);
+        if (thumbnail_workers < 0)
+            thumbnail_workers = 0;
+        else if (thumbnail_workers > 4)
+            thumbnail_workers = 4;
+        WriteInt(CONFIG_GLOBAL, CONFIG_THUMBNAIL_WORKERS, thumbnail_workers);
+        thumbnail_cache_mb = ReadInt(CONFIG_GLOBAL, CONFIG_THUMBNAIL_CACHE_MB, 32);
+        if (thumbnail_cache_mb < 0)
+            thumbnail_cache_mb = 0;
+        else if (thumbnail_cache_mb > 512)
+            thumbnail_cache_mb = 512;
+        WriteInt(CONFIG_GLOBAL, CONFIG_THUMBNAIL_CACHE_MB, thumbnail_cache_mb);
+        // Remote thumbnails come as previews the server renders (Nextcloud,
+        // ownCloud) or keeps (Archive.org) where it has them, instead of
+        // the image itself.
+        thumbnail_server_previews = ReadBool(CONFIG_GLOBAL, CONFIG_THUMBNAIL_SERVER_PREVIEWS, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_THUMBNAIL_SERVER_PREVIEWS, thumbnail_server_previews);
+
+        // The grid reads the icon, title and version of NRO and NSP
+        // packages with a few ranged requests (see package_info.h).
+        package_info = ReadBool(CONFIG_GLOBAL, CONFIG_PACKAGE_INFO, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_PACKAGE_INFO, package_info);
+
+        // With the controls idle the screen is redrawn only idle_fps times
+        // a second, and progress_fps times while something runs in the
+        // background; 60 redraws every frame.
+        idle_fps = ReadInt(CONFIG_GLOBAL, CONFIG_IDLE_FPS, 2);
+        if (idle_fps < 1)
+            idle_fps = 1;
+        else if (idle_fps > 60)
+            idle_fps = 60;
+        WriteInt(CONFIG_GLOBAL, CONFIG_IDLE_FPS, idle_fps);
+        progress_fps = ReadInt(CONFIG_GLOBAL, CONFIG_PROGRESS_FPS, 10);
+        if (progress_fps < 1)
+            progress_fps = 1;
+        else if (progress_fps > 60)
+            progress_fps = 60;
+        WriteInt(CONFIG_GLOBAL, CONFIG_PROGRESS_FPS, progress_fps);
+
+        // CPU boost (see power.h): 0 never, 1 while a transfer or another
+        // CPU-bound job runs, 2 always. On battery it is dropped below
+        // cpu_boost_min_battery percent.
+        cpu_boost = ReadInt(CONFIG_GLOBAL, CONFIG_CPU_BOOST, 1);
+        if (cpu_boost < 0 || cpu_boost > 2)
+            cpu_boost = 1;
+        WriteInt(CONFIG_GLOBAL, CONFIG_CPU_BOOST, cpu_boost);
+        cpu_boost_min_battery = ReadInt(CONFIG_GLOBAL, CONFIG_CPU_BOOST_MIN_BATTERY, 20);
+        if (cpu_boost_min_battery < 0)
+            cpu_boost_min_battery = 0;
+        else if (cpu_boost_min_battery > 100)
+            cpu_boost_min_battery = 100;
+        WriteInt(CONFIG_GLOBAL, CONFIG_CPU_BOOST_MIN_BATTERY, cpu_boost_min_battery);
+
+        // No auto-sleep or dimming while a transfer runs, and the backlight
+        // off after screen_off_minutes without input (0 = leave it on).
+        keep_awake_enabled = ReadBool(CONFIG_GLOBAL, CONFIG_KEEP_AWAKE, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_KEEP_AWAKE, keep_awake_enabled);
+        screen_off_minutes = ReadInt(CONFIG_GLOBAL, CONFIG_SCREEN_OFF_MINUTES, 5);
+        if (screen_off_minutes < 0)
+            screen_off_minutes = 0;
+        else if (screen_off_minutes > 120)
+            screen_off_minutes = 120;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SCREEN_OFF_MINUTES, screen_off_minutes);
+
+        // Read-only HTTP status page for watching a transfer from another
+        // machine; 0 = off.
+        status_port = ReadInt(CONFIG_GLOBAL, CONFIG_STATUS_PORT, 0);
+        if (status_port != 0 && (status_port < 1024 || status_port > 65535))
+            status_port = 0;
+        WriteInt(CONFIG_GLOBAL, CONFIG_STATUS_PORT, status_port);
+
+        // Thread placement (see threads.h): the UI stays on ui_core and
+        // network and disk threads go to the other two cores. Priorities
+        // run from 28 (highest an application gets here) to 63.
+        thread_affinity = ReadBool(CONFIG_GLOBAL, CONFIG_THREAD_AFFINITY, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_THREAD_AFFINITY, thread_affinity);
+        ui_core = ReadInt(CONFIG_GLOBAL, CONFIG_UI_CORE, 0);
+        if (ui_core < 0 || ui_core > 2)
+            ui_core = 0;
+        WriteInt(CONFIG_GLOBAL, CONFIG_UI_CORE, ui_core);
+        network_priority = ReadInt(CONFIG_GLOBAL, CONFIG_NETWORK_PRIORITY, 0x3B);
+        if (network_priority < 28)
+            network_priority = 28;
+        else if (network_priority > 63)
+            network_priority = 63;
+        WriteInt(CONFIG_GLOBAL, CONFIG_NETWORK_PRIORITY, network_priority);
+        disk_priority = ReadInt(CONFIG_GLOBAL, CONFIG_DISK_PRIORITY, 0x2C);
+        if (disk_priority < 28)
+            disk_priority = 28;
+        else if (disk_priority > 63)
+            disk_priority = 63;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_PRIORITY, disk_priority);
+
+        // Connecting to last_site in the background at launch, and again
+        // after the console wakes up with the SFTP or FTP session dead.
+        auto_connect = ReadBool(CONFIG_GLOBAL, CONFIG_AUTO_CONNECT, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_AUTO_CONNECT, auto_connect);
+        reconnect_on_resume = ReadBool(CONFIG_GLOBAL, CONFIG_RECONNECT_ON_RESUME, true);
+        WriteBool(CONFIG_GLOBAL, CONFIG_RECONNECT_ON_RESUME, reconnect_on_resume);
+        // Host lookups (see resolver.h): how long a resolved address is
+        // reused (0 resolves on every connection), the public servers asked
+        // when the system resolver is slow, and how long it gets first.
+        dns_cache_seconds = ReadInt(CONFIG_GLOBAL, CONFIG_DNS_CACHE_SECONDS, 600);
+        if (dns_cache_seconds < 0)
+            dns_cache_seconds = 0;
+        else if (dns_cache_seconds > 86400)
+            dns_cache_seconds = 86400;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DNS_CACHE_SECONDS, dns_cache_seconds);
+        snprintf(dns_servers, sizeof(dns_servers), "%s", ReadString(CONFIG_GLOBAL, CONFIG_DNS_SERVERS, "1.1.1.1,8.8.8.8"));
+        WriteString(CONFIG_GLOBAL, CONFIG_DNS_SERVERS, dns_servers);
+        dns_race_ms = ReadInt(CONFIG_GLOBAL, CONFIG_DNS_RACE_MS, 300);
+        if (dns_race_ms < 0)
+            dns_race_ms = 0;
+        else if (dns_race_ms > 10000)
+            dns_race_ms = 10000;
+        WriteInt(CONFIG_GLOBAL, CONFIG_DNS_RACE_MS, dns_race_ms);
+        // Threads timing every saved site when the connection panel opens
+        // (see site_probe.h); 0 turns the probe off.
+        site_probe_workers = ReadInt(CONFIG_GLOBAL, CONFIG_SITE_PROBE_WORKERS, 4);
+        if (site_probe_workers < 0)
+            site_probe_workers = 0;
+        else if (site_probe_workers > 8)
+            site_probe_workers = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_SITE_PROBE_WORKERS, site_probe_workers);
+        // Idle connections (see keepalive.h) are probed after this many
+        // seconds without traffic (0 turns keep-alives off); pooled
+        // sessions nobody used for keepalive_pool_seconds are logged out.
+        keepalive_seconds = ReadInt(CONFIG_GLOBAL, CONFIG_KEEPALIVE_SECONDS, 60);
+        if (keepalive_seconds < 0)
+            keepalive_seconds = 0;
+        else if (keepalive_seconds > 3600)
+            keepalive_seconds = 3600;
+        WriteInt(CONFIG_GLOBAL, CONFIG_KEEPALIVE_SECONDS, keepalive_seconds);
+        keepalive_pool_seconds = ReadInt(CONFIG_GLOBAL, CONFIG_KEEPALIVE_POOL_SECONDS, 900);
+        if (keepalive_pool_seconds < 0)
+            keepalive_pool_seconds = 0;
+        else if (keepalive_pool_seconds > 86400)
+            keepalive_pool_seconds = 86400;
+        WriteInt(CONFIG_GLOBAL, CONFIG_KEEPALIVE_POOL_SECONDS, keepalive_pool_seconds);
+        // Connected WebDAV/HTTP and SFTP worker clients kept between jobs
+        // (see client_pool.h), so the next batch skips the handshakes.
+        client_pool = ReadInt(CONFIG_GLOBAL, CONFIG_CLIENT_POOL, 4);
+        if (client_pool < 0)
+            client_pool = 0;
+        else if (client_pool > 16)
+            client_pool = 16;
+        WriteInt(CONFIG_GLOBAL, CONFIG_CLIENT_POOL, client_pool);
+        // A WebDAV/HTTP host failing too many requests (see host_health.h)
+        // gets one request at a time for this many seconds (0 = never).
+        host_breaker_seconds = ReadInt(CONFIG_GLOBAL, CONFIG_HOST_BREAKER_SECONDS, 120);
+        if (host_breaker_seconds < 0)
+            host_breaker_seconds = 0;
+        else if (host_breaker_seconds > 3600)
+            host_breaker_seconds = 3600;
+        WriteInt(CONFIG_GLOBAL, CONFIG_HOST_BREAKER_SECONDS, host_breaker_seconds);
+
+        // Creating a zip deflates 1 MiB chunks on this many threads, spread
+        // over the three application cores, while the activity thread reads
+        // ahead and writes. Already-compressed files are stored either way.
+        zip_workers = ReadInt(CONFIG_GLOBAL, CONFIG_ZIP_WORKERS, 3);
+        if (zip_workers < 1)
+            zip_workers = 1;
+        else if (zip_workers > 6)
+            zip_workers = 6;
+        WriteInt(CONFIG_GLOBAL, CONFIG_ZIP_WORKERS, zip_workers);
+
+        // Zips on the SD card are extracted on this many threads, each
+        // decompressing whole entries, and multi-block .tar.xz/.tar.zst
+        // decoded on as many (parallel_decoder.h); 1 uses one thread.
+        unzip_workers = ReadInt(CONFIG_GLOBAL, CONFIG_UNZIP_WORKERS, 3);
+        if (unzip_workers < 1)
+            unzip_workers = 1;
+        else if (unzip_workers > 4)
+            unzip_workers = 4;
+        WriteInt(CONFIG_GLOBAL, CONFIG_UNZIP_WORKERS, unzip_workers);
+
+        // Parallel chunked WebDAV uploads (Nextcloud chunking v2): files
+        // larger than one chunk are sent as webdav_upload_chunk_mb pieces
+        // over webdav_upload_parallel connections and assembled on the
+        // server. Other servers, or 1 here, use a single streaming PUT.
+        // Nextcloud needs chunks of at least 5 MiB.
+        webdav_upload_parallel = ReadInt(CONFIG_GLOBAL, CONFIG_WEBDAV_UPLOAD_PARALLEL, 4);
+        if (webdav_upload_parallel < 1)
+            webdav_upload_parallel = 1;
+        else if (webdav_upload_parallel > 8)
+            webdav_upload_parallel = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_WEBDAV_UPLOAD_PARALLEL, webdav_upload_parallel);
+
+        webdav_upload_chunk_mb = ReadInt(CONFIG_GLOBAL, CONFIG_WEBDAV_UPLOAD_CHUNK_MB, 16);
+        if (webdav_upload_chunk_mb < 5)
+            webdav_upload_chunk_mb = 5;
+        else if (webdav_upload_chunk_mb > 100)
+            webdav_upload_chunk_mb = 100;
+        WriteInt(CONFIG_GLOBAL, CONFIG_WEBDAV_UPLOAD_CHUNK_MB, webdav_upload_chunk_mb);
+
         // When set, treat the SD card as FAT32 for the purposes of large
         // downloads and automatically switch to a split-file layout for
         // files larger than 4 GiB so they can be stored safely.
         force_fat32 = ReadInt(CONFIG_GLOBAL, CONFIG_FORCE_FAT32, 0) != 0;
         WriteInt(CONFIG_GLOBAL, CONFIG_FORCE_FAT32, force_fat32 ? 1 : 0);
 
+        // Remote listing cache: folders visited in this session are shown
+        // from memory when browsing back into them. Listings younger than
+        // listing_cache_seconds are used as is; older ones are shown right
+        // away and revalidated against the folder's ETag/mtime (WebDAV) or
+        // listed again. listing_cache_entries bounds the entries kept over
+        // all folders (about 100 bytes each); 0 disables the cache. The
+        // refresh action always lists again.
+        listing_cache_seconds = ReadInt(CONFIG_GLOBAL, CONFIG_LISTING_CACHE_SECONDS, 300);
+        if (listing_cache_seconds < 0)
+            listing_cache_seconds = 0;
+        else if (listing_cache_seconds > 86400)
+            listing_cache_seconds = 86400;
+        WriteInt(CONFIG_GLOBAL, CONFIG_LISTING_CACHE_SECONDS, listing_cache_seconds);
+
+        listing_cache_entries = ReadInt(CONFIG_GLOBAL, CONFIG_LISTING_CACHE_ENTRIES, 65536);
+        if (listing_cache_entries < 0)
+            listing_cache_entries = 0;
+        else if (listing_cache_entries > 524288)
+            listing_cache_entries = 524288;
+        WriteInt(CONFIG_GLOBAL, CONFIG_LISTING_CACHE_ENTRIES, listing_cache_entries);
+
+        // Order of both panes below the folders: "name", "size" (largest
+        // first) or "date" (newest first).
+        static const char *sort_names[] = {"name", "size", "date"};
+        listing_sort = ListingIndex::ParseSort(ReadString(CONFIG_GLOBAL, CONFIG_LISTING_SORT, "name"));
+        WriteString(CONFIG_GLOBAL, CONFIG_LISTING_SORT, sort_names[listing_sort]);
+
+        // Folders around the focused remote row listed into the cache while
+        // the connection is idle, so opening one is instant. Any other use
+        // of the connection cancels the prefetch. 0 disables it.
+        listing_prefetch = ReadInt(CONFIG_GLOBAL, CONFIG_LISTING_PREFETCH, 0);
+        if (listing_prefetch < 0)
+            listing_prefetch = 0;
+        else if (listing_prefetch > 8)
+            listing_prefetch = 8;
+        WriteInt(CONFIG_GLOBAL, CONFIG_LISTING_PREFETCH, listing_prefetch);
+
+        // SFTP pipelining: number of read/write requests kept in flight on a
+        // single file handle, and the size of each request in KiB. The
+        // product is the read-ahead window per RTT, so high-latency links
+        // want a deeper pipeline. libssh2 may split requests further to
+        // respect its own packet size limit.
+        sftp_pipeline_depth = ReadInt(CONFIG_SFTP, CONFIG_SFTP_PIPELINE_DEPTH, 16);
+        if (sftp_pipeline_depth < 1)
+            sftp_pipeline_depth = 1;
+        else if (sftp_pipeline_depth > 64)
+            sftp_pipeline_depth = 64;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_PIPELINE_DEPTH, sftp_pipeline_depth);
+
+        sftp_request_kb = ReadInt(CONFIG_SFTP, CONFIG_SFTP_REQUEST_KB, 32);
+        if (sftp_request_kb < 8)
+            sftp_request_kb = 8;
+        else if (sftp_request_kb > 256)
+            sftp_request_kb = 256;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_REQUEST_KB, sftp_request_kb);
+
+        // Parallel SFTP downloads: total SSH sessions used per file (the
+        // connected one plus parallel_sessions - 1 extra logins), each
+        // fetching segment_mb ranges from a shared cursor. Servers that
+        // throttle per channel scale roughly with the session count.
+        sftp_parallel_sessions = ReadInt(CONFIG_SFTP, CONFIG_SFTP_PARALLEL_SESSIONS, 1);
+        if (sftp_parallel_sessions < 1)
+            sftp_parallel_sessions = 1;
+        else if (sftp_parallel_sessions > 8)
+            sftp_parallel_sessions = 8;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_PARALLEL_SESSIONS, sftp_parallel_sessions);
+
+        sftp_segment_mb = ReadInt(CONFIG_SFTP, CONFIG_SFTP_SEGMENT_MB, 32);
+        if (sftp_segment_mb < 4)
+            sftp_segment_mb = 4;
+        else if (sftp_segment_mb > 256)
+            sftp_segment_mb = 256;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_SEGMENT_MB, sftp_segment_mb);
+
+        // How long sizes from a listing answer Size()/FileExists() without
+        // a stat round trip; 0 = always ask the server.
+        sftp_attr_cache_secs = ReadInt(CONFIG_SFTP, CONFIG_SFTP_ATTR_CACHE_SECS, 60);
+        if (sftp_attr_cache_secs < 0)
+            sftp_attr_cache_secs = 0;
+        else if (sftp_attr_cache_secs > 3600)
+            sftp_attr_cache_secs = 3600;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_ATTR_CACHE_SECS, sftp_attr_cache_secs);
+
+        // SSH ciphers and MACs fastest first on this console, measured on
+        // the first SFTP connect; empty = measure again.
+        snprintf(sftp_cipher_order, sizeof(sftp_cipher_order), "%s", ReadString(CONFIG_SFTP, CONFIG_SFTP_CIPHER_ORDER, ""));
+        WriteString(CONFIG_SFTP, CONFIG_SFTP_CIPHER_ORDER, sftp_cipher_order);
+        snprintf(sftp_mac_order, sizeof(sftp_mac_order), "%s", ReadString(CONFIG_SFTP, CONFIG_SFTP_MAC_ORDER, ""));
+        WriteString(CONFIG_SFTP, CONFIG_SFTP_MAC_ORDER, sftp_mac_order);
+
+        // New sessions to a server whose last transfer ran slower than this
+        // (KiB/s) ask for zlib compression; 0 = never compress.
+        sftp_compress_below_kb = ReadInt(CONFIG_SFTP, CONFIG_SFTP_COMPRESS_BELOW_KB, 256);
+        if (sftp_compress_below_kb < 0)
+            sftp_compress_below_kb = 0;
+        else if (sftp_compress_below_kb > 1048576)
+            sftp_compress_below_kb = 1048576;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_COMPRESS_BELOW_KB, sftp_compress_below_kb);
+
+        // Small range reads that carry on where the last one of a file
+        // ended fetch this much ahead into a per-handle buffer; 0 = off.
+        sftp_read_ahead_kb = ReadInt(CONFIG_SFTP, CONFIG_SFTP_READ_AHEAD_KB, 256);
+        if (sftp_read_ahead_kb < 0)
+            sftp_read_ahead_kb = 0;
+        else if (sftp_read_ahead_kb > 4096)
+            sftp_read_ahead_kb = 4096;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_READ_AHEAD_KB, sftp_read_ahead_kb);
+
+        // Overwriting a local copy at least this large (MiB) compares block
+        // hashes with the server and fetches only what changed; 0 = off.
+        sftp_delta_min_mb = ReadInt(CONFIG_SFTP, CONFIG_SFTP_DELTA_MIN_MB, 64);
+        if (sftp_delta_min_mb < 0)
+            sftp_delta_min_mb = 0;
+        else if (sftp_delta_min_mb > 65536)
+            sftp_delta_min_mb = 65536;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_DELTA_MIN_MB, sftp_delta_min_mb);
+
+        sftp_delta_block_kb = ReadInt(CONFIG_SFTP, CONFIG_SFTP_DELTA_BLOCK_KB, 1024);
+        if (sftp_delta_block_kb < 64)
+            sftp_delta_block_kb = 64;
+        else if (sftp_delta_block_kb > 16384)
+            sftp_delta_block_kb = 16384;
+        WriteInt(CONFIG_SFTP, CONFIG_SFTP_DELTA_BLOCK_KB, sftp_delta_block_kb);
+
+        // Segmented FTP downloads: control+data connection pairs used per
+        // file, each fetching segment_mb ranges via REST. Helps servers
+        // that cap bandwidth per connection.
+        ftp_parallel_connections = ReadInt(CONFIG_FTP, CONFIG_FTP_PARALLEL_CONNECTIONS, 1);
+        if (ftp_parallel_connections < 1)
+            ftp_parallel_connections = 1;
+        else if (ftp_parallel_connections > 8)
+            ftp_parallel_connections = 8;
+        WriteInt(CONFIG_FTP, CONFIG_FTP_PARALLEL_CONNECTIONS, ftp_parallel_connections);
+
+        ftp_segment_mb = ReadInt(CONFIG_FTP, CONFIG_FTP_SEGMENT_MB, 32);
+        if (ftp_segment_mb < 4)
+            ftp_segment_mb = 4;
+        else if (ftp_segment_mb > 256)
+            ftp_segment_mb = 256;
+        WriteInt(CONFIG_FTP, CONFIG_FTP_SEGMENT_MB, ftp_segment_mb);
+
+        // Idle FTP logins kept for the next download worker or segment
+        // fetch to the same server; 0 = log out after every use.
+        ftp_session_pool = ReadInt(CONFIG_FTP, CONFIG_FTP_SESSION_POOL, 4);
+        if (ftp_session_pool < 0)
+            ftp_session_pool = 0;
+        else if (ftp_session_pool > 16)
+            ftp_session_pool = 16;
+        WriteInt(CONFIG_FTP, CONFIG_FTP_SESSION_POOL, ftp_session_pool);
+
+        // How long FTP listings answer Size()/FileExists() without a SIZE
+        // round trip; 0 = always ask the server.
+        ftp_listing_cache_secs = ReadInt(CONFIG_FTP, CONFIG_FTP_LISTING_CACHE_SECS, 60);
+        if (ftp_listing_cache_secs < 0)
+            ftp_listing_cache_secs = 0;
+        else if (ftp_listing_cache_secs > 3600)
+            ftp_listing_cache_secs = 3600;
+        WriteInt(CONFIG_FTP, CONFIG_FTP_LISTING_CACHE_SECS, ftp_listing_cache_secs);
+
+        // MODE Z (deflate) data connections where the server has them: 0
+        // never, 1 for listings, 2 also for downloads of text-like files
+        // from a host whose connections have not reached mode_z_mbps.
+        ftp_mode_z = ReadInt(CONFIG_FTP, CONFIG_FTP_MODE_Z, 2);
+        if (ftp_mode_z < 0)
+            ftp_mode_z = 0;
+        else if (ftp_mode_z > 2)
+            ftp_mode_z = 2;
+        WriteInt(CONFIG_FTP, CONFIG_FTP_MODE_Z, ftp_mode_z);
+        ftp_mode_z_mbps = ReadInt(CONFIG_FTP, CONFIG_FTP_MODE_Z_MBPS, 20);
+        if (ftp_mode_z_mbps < 1)
+            ftp_mode_z_mbps = 1;
+        else if (ftp_mode_z_mbps > 1000)
+            ftp_mode_z_mbps = 1000;
+        WriteInt(CONFIG_FTP, CONFIG_FTP_MODE_Z_MBPS, ftp_mode_z_mbps);
+
+        // SMB: async read requests kept outstanding per transfer, each of
+        // the server's max read size. libsmb2 holds back requests the
+        // server has not granted credits for, so deeper only costs memory.
+        smb_io_depth = ReadInt(CONFIG_SMB, CONFIG_SMB_IO_DEPTH, 8);
+        if (smb_io_depth < 1)
+            smb_io_depth = 1;
+        else if (smb_io_depth > 32)
+            smb_io_depth = 32;
+        WriteInt(CONFIG_SMB, CONFIG_SMB_IO_DEPTH, smb_io_depth);
+
+        // How long the stats an SMB listing returned answer Size() and
+        // FileExists() without a CREATE/QUERY_INFO/CLOSE round trip.
+        smb_attr_cache_secs = ReadInt(CONFIG_SMB, CONFIG_SMB_ATTR_CACHE_SECS, 60);
+        if (smb_attr_cache_secs < 0)
+            smb_attr_cache_secs = 0;
+        else if (smb_attr_cache_secs > 3600)
+            smb_attr_cache_secs = 3600;
+        WriteInt(CONFIG_SMB, CONFIG_SMB_ATTR_CACHE_SECS, smb_attr_cache_secs);
+
+        // SMB contexts per share, the first included; the others are set
+        // up in parallel when connecting and kept for transfer workers.
+        smb_sessions = ReadInt(CONFIG_SMB, CONFIG_SMB_SESSIONS, 4);
+        if (smb_sessions < 1)
+            smb_sessions = 1;
+        else if (smb_sessions > 8)
+            smb_sessions = 8;
+        WriteInt(CONFIG_SMB, CONFIG_SMB_SESSIONS, smb_sessions);
+
+        // Sessions of the pool reading one large file at once, each its own
+        // segment_mb pieces; 1 reads every file on one session.
+        smb_parallel_sessions = ReadInt(CONFIG_SMB, CONFIG_SMB_PARALLEL_SESSIONS, 1);
+        if (smb_parallel_sessions < 1)
+            smb_parallel_sessions = 1;
+        else if (smb_parallel_sessions > 8)
+            smb_parallel_sessions = 8;
+        WriteInt(CONFIG_SMB, CONFIG_SMB_PARALLEL_SESSIONS, smb_parallel_sessions);
+        smb_segment_mb = ReadInt(CONFIG_SMB, CONFIG_SMB_SEGMENT_MB, 32);
+        if (smb_segment_mb < 4)
+            smb_segment_mb = 4;
+        else if (smb_segment_mb > 256)
+            smb_segment_mb = 256;
+        WriteInt(CONFIG_SMB, CONFIG_SMB_SEGMENT_MB, smb_segment_mb);
+
+        // NFS: READ/WRITE RPCs kept outstanding per transfer, each of
+        // rw_size_kb; the server's own rsize/wsize still caps the size.
+        nfs_io_depth = ReadInt(CONFIG_NFS, CONFIG_NFS_IO_DEPTH, 8);
+        if (nfs_io_depth < 1)
+            nfs_io_depth = 1;
+        else if (nfs_io_depth > 32)
+            nfs_io_depth = 32;
+        WriteInt(CONFIG_NFS, CONFIG_NFS_IO_DEPTH, nfs_io_depth);
+
+        nfs_rw_size_kb = ReadInt(CONFIG_NFS, CONFIG_NFS_RW_SIZE_KB, 1024);
+        if (nfs_rw_size_kb < 32)
+            nfs_rw_size_kb = 32;
+        else if (nfs_rw_size_kb > 1024)
+            nfs_rw_size_kb = 1024;
+        WriteInt(CONFIG_NFS, CONFIG_NFS_RW_SIZE_KB, nfs_rw_size_kb);
+
+        // Server mode: the SD card over HTTP/WebDAV on `port` (0 = off),
+        // read-only, below `root`. Each of `connections` workers serves
+        // one client at a time from a read buffer of read_buffer_kb.
+        server_port = ReadInt(CONFIG_SERVER, CONFIG_SERVER_PORT, 0);
+        if (server_port != 0 && (server_port < 1024 || server_port > 65535))
+            server_port = 0;
+        WriteInt(CONFIG_SERVER, CONFIG_SERVER_PORT, server_port);
+        snprintf(server_root, sizeof(server_root), "%s", ReadString(CONFIG_SERVER, CONFIG_SERVER_ROOT, "/"));
+        WriteString(CONFIG_SERVER, CONFIG_SERVER_ROOT, server_root);
+        server_connections = ReadInt(CONFIG_SERVER, CONFIG_SERVER_CONNECTIONS, 4);
+        if (server_connections < 1)
+            server_connections = 1;
+        else if (server_connections > 8)
+            server_connections = 8;
+        WriteInt(CONFIG_SERVER, CONFIG_SERVER_CONNECTIONS, server_connections);
+        server_read_buffer_kb = ReadInt(CONFIG_SERVER, CONFIG_SERVER_READ_BUFFER_KB, 1024);
+        if (server_read_buffer_kb < 64)
+            server_read_buffer_kb = 64;
+        else if (server_read_buffer_kb > 4096)
+            server_read_buffer_kb = 4096;
+        WriteInt(CONFIG_SERVER, CONFIG_SERVER_READ_BUFFER_KB, server_read_buffer_kb);
+        // Basic auth for the file server; it does not start without a password.
+        snprintf(server_user, sizeof(server_user), "%s", ReadString(CONFIG_SERVER, CONFIG_SERVER_USER, "neo"));
+        WriteString(CONFIG_SERVER, CONFIG_SERVER_USER, server_user);
+        snprintf(server_password, sizeof(server_password), "%s", ReadString(CONFIG_SERVER, CONFIG_SERVER_PASSWORD, ""));
+        WriteString(CONFIG_SERVER, CONFIG_SERVER_PASSWORD, server_password);
+
+        global_knobs.webdav_chunk_mb = webdav_chunk_size_mb;
+        global_knobs.webdav_parallel = webdav_parallel_connections;
+        global_knobs.download_parallel_files = download_parallel_files;
+        global_knobs.webdav_split_large = webdav_split_large;
+        global_knobs.sftp_pipeline_depth = sftp_pipeline_depth;
+        global_knobs.ftp_parallel_connections = ftp_parallel_connections;
+        global_knobs.smb_io_depth = smb_io_depth;
+        global_knobs.upload_parallel_files = upload_parallel_files;
+        global_knobs.rate_limit_kb = rate_limit_kb;
+        global_http_parallel = http_parallel_connections;
+        global_site_connections = site_connections;
+
         for (int i = 0; i < sites.size(); i++)
         {
             RemoteSettings setting;
@@ -139,6 +1173,50 @@ namespace CONFIG
             sprintf(setting.http_server_type, "%s", ReadString(sites[i].c_str(), CONFIG_REMOTE_HTTP_SERVER_TYPE, HTTP_SERVER_APACHE));
             WriteString(sites[i].c_str(), CONFIG_REMOTE_HTTP_SERVER_TYPE, setting.http_server_type);
 
+            // Written by SaveSiteTuning() once a transfer has learned them.
+            setting.tuned_parallel = ReadInt(sites[i].c_str(), CONFIG_REMOTE_TUNED_PARALLEL, 0);
+            if (setting.tuned_parallel < 0 || setting.tuned_parallel > 32)
+                setting.tuned_parallel = 0;
+            setting.tuned_chunk_mb = ReadInt(sites[i].c_str(), CONFIG_REMOTE_TUNED_CHUNK_MB, 0);
+            if (setting.tuned_chunk_mb < 0 || setting.tuned_chunk_mb > 32)
+                setting.tuned_chunk_mb = 0;
+            // Written by SaveSiteCaps(); removing them makes the next
+            // transfer probe the server again.
+            setting.caps.range = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_RANGE, -1);
+            setting.caps.head = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_HEAD, -1);
+            setting.caps.http2 = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_HTTP2, -1);
+            setting.caps.depth_infinity = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_DEPTH_INFINITY, -1);
+            setting.caps.search = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_SEARCH, -1);
+            setting.caps.json_listing = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_JSON_LISTING, -1);
+            setting.caps.multirange = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_MULTIRANGE, -1);
+            setting.caps.ranged_put = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_RANGED_PUT, -1);
+            setting.caps.max_parallel = ReadInt(sites[i].c_str(), CONFIG_REMOTE_CAPS_MAX_PARALLEL, 0);
+            if (setting.caps.max_parallel < 0 || setting.caps.max_parallel > 32)
+                setting.caps.max_parallel = 0;
+
+            // Transfer profile; the override keys are optional and only
+            // read, so the INI is not filled with inherit markers.
+            sprintf(setting.profile, "%s", ReadString(sites[i].c_str(), CONFIG_REMOTE_PROFILE, ""));
+            WriteString(sites[i].c_str(), CONFIG_REMOTE_PROFILE, setting.profile);
+            snprintf(setting.profile_ethernet, sizeof(setting.profile_ethernet), "%s",
+                     ReadString(sites[i].c_str(), CONFIG_REMOTE_PROFILE_ETHERNET, ""));
+            snprintf(setting.profile_wifi, sizeof(setting.profile_wifi), "%s",
+                     ReadString(sites[i].c_str(), CONFIG_REMOTE_PROFILE_WIFI, ""));
+            setting.webdav_chunk_mb = ReadInt(sites[i].c_str(), CONFIG_WEBDAV_CHUNK_MB, 0);
+            setting.webdav_parallel = ReadInt(sites[i].c_str(), CONFIG_WEBDAV_PARALLEL, 0);
+            setting.download_parallel_files = ReadInt(sites[i].c_str(), CONFIG_DOWNLOAD_PARALLEL_FILES, 0);
+            setting.webdav_split_large = ReadInt(sites[i].c_str(), CONFIG_WEBDAV_SPLIT_LARGE, -1);
+            setting.sftp_pipeline_depth = ReadInt(sites[i].c_str(), CONFIG_REMOTE_SFTP_PIPELINE_DEPTH, 0);
+            setting.ftp_parallel_connections = ReadInt(sites[i].c_str(), CONFIG_REMOTE_FTP_PARALLEL_CONNECTIONS, 0);
+            setting.smb_io_depth = ReadInt(sites[i].c_str(), CONFIG_REMOTE_SMB_IO_DEPTH, 0);
+            setting.upload_parallel_files = ReadInt(sites[i].c_str(), CONFIG_UPLOAD_PARALLEL_FILES, 0);
+            setting.rate_limit_kb = ReadInt(sites[i].c_str(), CONFIG_RATE_LIMIT_KB, 0);
+            setting.http_parallel = ReadInt(sites[i].c_str(), CONFIG_REMOTE_HTTP_PARALLEL, 0);
+            setting.site_connections = ReadInt(sites[i].c_str(), CONFIG_REMOTE_SITE_CONNECTIONS, 0);
+            // rclone's rc API, when the site is served by rclone with --rc.
+            snprintf(setting.rclone_rc, sizeof(setting.rclone_rc), "%s", ReadString(sites[i].c_str(), CONFIG_REMOTE_RCLONE_RC, ""));
+            snprintf(setting.rclone_rc_fs, sizeof(setting.rclone_rc_fs), "%s", ReadString(sites[i].c_str(), CONFIG_REMOTE_RCLONE_RC_FS, ""));
+
             // Provide sensible defaults for the first two sites if they
             // haven't been configured yet.
             if (setting.server[0] == '\0')
@@ -193,11 +1271,166 @@ namespace CONFIG
         OpenIniFile(CONFIG_INI_FILE);
 
         WriteString(CONFIG_GLOBAL, CONFIG_LANGUAGE, language);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TRANSFER_TRACE, transfer_trace);
+        WriteBool(CONFIG_GLOBAL, CONFIG_MEMORY_OVERLAY, memory_overlay);
+        WriteBool(CONFIG_GLOBAL, CONFIG_FRAME_PROFILER, frame_profiler);
+        WriteBool(CONFIG_GLOBAL, CONFIG_TIMELINE_TRACE, timeline_trace);
+
+        WriteIniFile(CONFIG_INI_FILE);
+        CloseIniFile();
+    }
+
+    void SaveSiteTuning(const char *site, int parallel, int chunk_mb)
+    {
+        OpenIniFile(CONFIG_INI_FILE);
+
+        WriteInt(site, CONFIG_REMOTE_TUNED_PARALLEL, parallel);
+        WriteInt(site, CONFIG_REMOTE_TUNED_CHUNK_MB, chunk_mb);
+
+        WriteIniFile(CONFIG_INI_FILE);
+        CloseIniFile();
+    }
+
+    void SaveDiskTuning()
+    {
+        OpenIniFile(CONFIG_INI_FILE);
+
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_BLOCK_KB, disk_block_kb);
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_QUEUE_MB, disk_queue_mb);
+        WriteInt(CONFIG_GLOBAL, CONFIG_DISK_REORDER_MB, disk_reorder_mb);
+        WriteInt(CONFIG_GLOBAL, CONFIG_DOWNLOAD_PARALLEL_FILES, download_parallel_files);
+
+        WriteIniFile(CONFIG_INI_FILE);
+        CloseIniFile();
+    }
+
+    void SaveSiteBenchmark(const char *site, const RemoteSettings *settings)
+    {
+        OpenIniFile(CONFIG_INI_FILE);
+
+        if (settings->webdav_chunk_mb > 0)
+            WriteInt(site, CONFIG_WEBDAV_CHUNK_MB, settings->webdav_chunk_mb);
+        if (settings->webdav_parallel > 0)
+            WriteInt(site, CONFIG_WEBDAV_PARALLEL, settings->webdav_parallel);
+        if (settings->http_parallel > 0)
+            WriteInt(site, CONFIG_REMOTE_HTTP_PARALLEL, settings->http_parallel);
+        if (settings->sftp_pipeline_depth > 0)
+            WriteInt(site, CONFIG_REMOTE_SFTP_PIPELINE_DEPTH, settings->sftp_pipeline_depth);
+
+        WriteIniFile(CONFIG_INI_FILE);
+        CloseIniFile();
+    }
+
+    void SaveSiteCaps(const char *site, const HostCaps::Caps &caps)
+    {
+        OpenIniFile(CONFIG_INI_FILE);
+
+        WriteInt(site, CONFIG_REMOTE_CAPS_RANGE, caps.range);
+        WriteInt(site, CONFIG_REMOTE_CAPS_HEAD, caps.head);
+        WriteInt(site, CONFIG_REMOTE_CAPS_HTTP2, caps.http2);
+        WriteInt(site, CONFIG_REMOTE_CAPS_DEPTH_INFINITY, caps.depth_infinity);
+        WriteInt(site, CONFIG_REMOTE_CAPS_SEARCH, caps.search);
+        WriteInt(site, CONFIG_REMOTE_CAPS_JSON_LISTING, caps.json_listing);
+        WriteInt(site, CONFIG_REMOTE_CAPS_MULTIRANGE, caps.multirange);
+        WriteInt(site, CONFIG_REMOTE_CAPS_RANGED_PUT, caps.ranged_put);
+        WriteInt(site, CONFIG_REMOTE_CAPS_MAX_PARALLEL, caps.max_parallel);
+
+        WriteIniFile(CONFIG_INI_FILE);
+        CloseIniFile();
+    }
+
+    void SaveSftpCryptoOrder(const char *ciphers, const char *macs)
+    {
+        snprintf(sftp_cipher_order, sizeof(sftp_cipher_order), "%s", ciphers);
+        snprintf(sftp_mac_order, sizeof(sftp_mac_order), "%s", macs);
+
+        OpenIniFile(CONFIG_INI_FILE);
+
+        WriteString(CONFIG_SFTP, CONFIG_SFTP_CIPHER_ORDER, sftp_cipher_order);
+        WriteString(CONFIG_SFTP, CONFIG_SFTP_MAC_ORDER, sftp_mac_order);
 
         WriteIniFile(CONFIG_INI_FILE);
         CloseIniFile();
     }
 
+    void ApplySiteProfile(const RemoteSettings *settings)
+    {
+        TransferKnobs knobs = global_knobs;
+
+        NetIface::State iface = NetIface::Query();
+        const char *profile = settings->profile;
+        if (iface.type == NetIface::TYPE_ETHERNET && settings->profile_ethernet[0] != '\0')
+            profile = settings->profile_ethernet;
+        else if (iface.type == NetIface::TYPE_WIFI && settings->profile_wifi[0] != '\0')
+            profile = settings->profile_wifi;
+        applied_iface = iface.type;
+        applied_profile = "";
+
+        for (const ProfilePreset &preset : kProfilePresets)
+        {
+            if (strcasecmp(profile, preset.name) == 0)
+            {
+                applied_profile = preset.name;
+                bool split = knobs.webdav_split_large;
+                int rate = knobs.rate_limit_kb;
+                knobs = preset.knobs;
+                knobs.webdav_split_large = split;
+                knobs.rate_limit_kb = rate;
+                break;
+            }
+        }
+
+        if (settings->webdav_chunk_mb > 0)
+            knobs.webdav_chunk_mb = settings->webdav_chunk_mb;
+        if (settings->webdav_parallel > 0)
+            knobs.webdav_parallel = settings->webdav_parallel;
+        if (settings->download_parallel_files > 0)
+            knobs.download_parallel_files = settings->download_parallel_files;
+        if (settings->webdav_split_large >= 0)
+            knobs.webdav_split_large = settings->webdav_split_large != 0;
+        if (settings->sftp_pipeline_depth > 0)
+            knobs.sftp_pipeline_depth = settings->sftp_pipeline_depth;
+        if (settings->ftp_parallel_connections > 0)
+            knobs.ftp_parallel_connections = settings->ftp_parallel_connections;
+        if (settings->smb_io_depth > 0)
+            knobs.smb_io_depth = settings->smb_io_depth;
+        if (settings->upload_parallel_files > 0)
+            knobs.upload_parallel_files = settings->upload_parallel_files;
+        if (settings->rate_limit_kb > 0)
+            knobs.rate_limit_kb = settings->rate_limit_kb;
+
+        // Same bounds as the global keys in LoadConfig().
+        webdav_chunk_size_mb = Clamp(knobs.webdav_chunk_mb, 1, 32);
+        webdav_parallel_connections = Clamp(knobs.webdav_parallel, 1, 32);
+        download_parallel_files = Clamp(knobs.download_parallel_files, 1, 8);
+        webdav_split_large = knobs.webdav_split_large;
+        sftp_pipeline_depth = Clamp(knobs.sftp_pipeline_depth, 1, 64);
+        ftp_parallel_connections = Clamp(knobs.ftp_parallel_connections, 1, 8);
+        smb_io_depth = Clamp(knobs.smb_io_depth, 1, 32);
+        upload_parallel_files = Clamp(knobs.upload_parallel_files, 1, 8);
+        rate_limit_kb = Clamp(knobs.rate_limit_kb, 0, 1048576);
+        http_parallel_connections = settings->http_parallel > 0 ? Clamp(settings->http_parallel, 1, 32) : global_http_parallel;
+        site_connections = settings->site_connections > 0 ? Clamp(settings->site_connections, 1, 64) : global_site_connections;
+        Logger::Logf("PROFILE iface=%s signal=%d profile=%s", NetIface::Name(iface.type), iface.signal,
+                     applied_profile[0] != '\0' ? applied_profile : "none");
+    }
+
+    void RefreshSiteProfile(const RemoteSettings *settings)
+    {
+        if (settings == nullptr || (settings->profile_ethernet[0] == '\0' && settings->profile_wifi[0] == '\0'))
+        {
+            NetIface::Query();
+            return;
+        }
+        if (NetIface::Query().type != applied_iface)
+            ApplySiteProfile(settings);
+    }
+
+    const char *AppliedProfile()
+    {
+        return applied_profile;
+    }
+
     void SetClientType(RemoteSettings *setting)
     {
         if (strncmp(setting->server, "sftp://", 7) == 0)
@@ -7,32 +7,191 @@
 #include <map>
 #include <set>
 #include "clients/remote_client.h"
+#include "host_caps.h"
 
 #define APP_ID "neo_sftp"
 #define DATA_PATH "/switch/" APP_ID
 #define CONFIG_INI_FILE DATA_PATH "/config.ini"
 #define TMP_EDITOR_FILE DATA_PATH "/tmp_editor.txt"
 #define TMP_IMAGE_PATH DATA_PATH "/tmp_image"
+#define TMP_SITE_COPY_FILE DATA_PATH "/tmp_site_copy"
+#define TMP_REMOTE_ZIP_FILE DATA_PATH "/tmp_remote_zip"
+#define JOURNAL_PATH DATA_PATH "/journal"
+#define SSH_HOSTS_FILE DATA_PATH "/ssh_hosts"
 #define CACERT_FILE "romfs:/certs/cacert.pem"
 #define LOG_DIR "/switch/neo_sftp"
 #define LOG_FILE LOG_DIR "/log.txt"
+#define TRACE_FILE LOG_DIR "/trace.csv"
+#define TIMELINE_FILE LOG_DIR "/timeline.json"
+#define ALTSVC_FILE DATA_PATH "/altsvc.txt"
+#define TLS_SESSIONS_FILE DATA_PATH "/tls_sessions.bin"
+#define HISTORY_FILE DATA_PATH "/history.bin"
 
 #define CONFIG_GLOBAL "Global"
 
 #define CONFIG_DEFAULT_STYLE_NAME "Default"
 #define CONFIG_SWAP_XO "swap_xo"
 #define CONFIG_LOGGING_ENABLED "logging_enabled"
+#define CONFIG_LOG_LEVEL "log_level"
+#define CONFIG_TRANSFER_TRACE "transfer_trace"
+#define CONFIG_MEMORY_OVERLAY "memory_overlay"
+#define CONFIG_FRAME_PROFILER "frame_profiler"
+#define CONFIG_TIMELINE_TRACE "timeline_trace"
+#define CONFIG_TRANSFER_HISTORY "transfer_history"
 #define CONFIG_MAX_EDIT_FILE_SIZE "max_edit_file_size"
 #define CONFIG_WEBDAV_CHUNK_MB "webdav_chunk_mb"
 #define CONFIG_WEBDAV_PARALLEL "webdav_parallel"
+#define CONFIG_HTTP_PARALLEL "http_parallel"
+#define CONFIG_SITE_CONNECTIONS "site_connections"
+#define CONFIG_MYRIENT_MIRRORS "myrient_mirrors"
 #define CONFIG_DOWNLOAD_PARALLEL_FILES "download_parallel_files"
+#define CONFIG_BACKGROUND_TRANSFERS "background_transfers"
+#define CONFIG_UPLOAD_PARALLEL_FILES "upload_parallel_files"
+#define CONFIG_RATE_LIMIT_KB "rate_limit_kb"
 #define CONFIG_WEBDAV_SPLIT_LARGE "webdav_split_large"
+#define CONFIG_WEBDAV_MULTIPLEX "webdav_multiplex"
+#define CONFIG_WEBDAV_TREE_SCAN "webdav_tree_scan"
+#define CONFIG_WEBDAV_AUTOTUNE "webdav_autotune"
+#define CONFIG_WEBDAV_RANGE_STEAL_KB "webdav_range_steal_kb"
+#define CONFIG_VERIFY_DOWNLOADS "verify_downloads"
+#define CONFIG_VERIFY_CHUNKS "verify_chunks"
+#define CONFIG_METALINK "metalink"
+#define CONFIG_SYNC_DELETE_EXTRAS "sync_delete_extras"
+#define CONFIG_SMALL_FILE_BATCH_KB "small_file_batch_kb"
+#define CONFIG_TRANSFER_JOURNAL "transfer_journal"
+#define CONFIG_DOWNLOAD_CACHE "download_cache"
+#define CONFIG_DOWNLOAD_CACHE_MIN_MB "download_cache_min_mb"
+#define CONFIG_RESUME_VERIFY_BLOCKS "resume_verify_blocks"
+#define CONFIG_TRANSFER_MEMORY_MB "transfer_memory_mb"
+#define CONFIG_MEMORY_RESERVE_MB "memory_reserve_mb"
+#define CONFIG_MEMORY_GOVERNOR "memory_governor"
+#define CONFIG_SOCKET_TUNING "socket_tuning"
+#define CONFIG_SOCKET_LINK_MBPS "socket_link_mbps"
+#define CONFIG_DISK_QUEUE_MB "disk_queue_mb"
+#define CONFIG_CLIENT_POOL "client_pool"
+#define CONFIG_DISK_REORDER_MB "disk_reorder_mb"
+#define CONFIG_DISK_BLOCK_KB "disk_block_kb"
+#define CONFIG_SITE_BENCH_MB "site_bench_mb"
+#define CONFIG_SITE_COPY_BUFFER_MB "site_copy_buffer_mb"
+#define CONFIG_LOCAL_COPY_WORKERS "local_copy_workers"
+#define CONFIG_REMOTE_DELETE_WORKERS "remote_delete_workers"
+#define CONFIG_REMOTE_MOVE_WORKERS "remote_move_workers"
+#define CONFIG_ARCHIVE_CACHE_MB "archive_cache_mb"
+#define CONFIG_ARCHIVE_PREFETCH "archive_prefetch"
+#define CONFIG_ZIP_WORKERS "zip_workers"
+#define CONFIG_UNZIP_WORKERS "unzip_workers"
+#define CONFIG_ARCHIVE_STREAMING "archive_streaming"
+#define CONFIG_INSTALL_TO_NAND "install_to_nand"
+#define CONFIG_IMAGE_CACHE_MB "image_cache_mb"
+#define CONFIG_IMAGE_PREFETCH_WORKERS "image_prefetch_workers"
+#define CONFIG_VIEWER_CACHE_MB "viewer_cache_mb"
+#define CONFIG_HTTP_COMPRESS_LISTINGS "http_compress_listings"
+#define CONFIG_HTTP3 "http3"
+#define CONFIG_TLS_RESUME "tls_resume"
+#define CONFIG_FOLDER_SIZE_WORKERS "folder_size_workers"
+#define CONFIG_FAST_DELETE "fast_delete"
+#define CONFIG_REMOTE_SEARCH "remote_search"
+#define CONFIG_THUMBNAIL_WORKERS "thumbnail_workers"
+#define CONFIG_THUMBNAIL_CACHE_MB "thumbnail_cache_mb"
+#define CONFIG_THUMBNAIL_SERVER_PREVIEWS "thumbnail_server_previews"
+#define CONFIG_PACKAGE_INFO "package_info"
+#define CONFIG_IDLE_FPS "idle_fps"
+#define CONFIG_PROGRESS_FPS "progress_fps"
+#define CONFIG_CPU_BOOST "cpu_boost"
+#define CONFIG_CPU_BOOST_MIN_BATTERY "cpu_boost_min_battery"
+#define CONFIG_KEEP_AWAKE "keep_awake"
+#define CONFIG_SCREEN_OFF_MINUTES "screen_off_minutes"
+#define CONFIG_STATUS_PORT "status_port"
+#define CONFIG_THREAD_AFFINITY "thread_affinity"
+#define CONFIG_UI_CORE "ui_core"
+#define CONFIG_NETWORK_PRIORITY "network_priority"
+#define CONFIG_DISK_PRIORITY "disk_priority"
+#define CONFIG_AUTO_CONNECT "auto_connect"
+#define CONFIG_RECONNECT_ON_RESUME "reconnect_on_resume"
+#define CONFIG_DNS_CACHE_SECONDS "dns_cache_seconds"
+#define CONFIG_DNS_SERVERS "dns_servers"
+#define CONFIG_DNS_RACE_MS "dns_race_ms"
+#define CONFIG_SITE_PROBE_WORKERS "site_probe_workers"
+#define CONFIG_KEEPALIVE_SECONDS "keepalive_seconds"
+#define CONFIG_KEEPALIVE_POOL_SECONDS "keepalive_pool_seconds"
+#define CONFIG_HOST_BREAKER_SECONDS "host_breaker_seconds"
+#define CONFIG_WEBDAV_UPLOAD_PARALLEL "webdav_upload_parallel"
+#define CONFIG_WEBDAV_UPLOAD_CHUNK_MB "webdav_upload_chunk_mb"
 #define CONFIG_FORCE_FAT32 "force_fat32"
+#define CONFIG_LISTING_CACHE_SECONDS "listing_cache_seconds"
+#define CONFIG_LISTING_CACHE_ENTRIES "listing_cache_entries"
+#define CONFIG_LISTING_SORT "listing_sort"
+#define CONFIG_LISTING_PREFETCH "listing_prefetch"
+
+#define CONFIG_SFTP "SFTP"
+#define CONFIG_SFTP_PIPELINE_DEPTH "pipeline_depth"
+#define CONFIG_SFTP_REQUEST_KB "request_kb"
+#define CONFIG_SFTP_PARALLEL_SESSIONS "parallel_sessions"
+#define CONFIG_SFTP_SEGMENT_MB "segment_mb"
+#define CONFIG_SFTP_ATTR_CACHE_SECS "attr_cache_secs"
+#define CONFIG_SFTP_CIPHER_ORDER "cipher_order"
+#define CONFIG_SFTP_MAC_ORDER "mac_order"
+#define CONFIG_SFTP_COMPRESS_BELOW_KB "compress_below_kb"
+#define CONFIG_SFTP_READ_AHEAD_KB "read_ahead_kb"
+#define CONFIG_SFTP_DELTA_MIN_MB "delta_min_mb"
+#define CONFIG_SFTP_DELTA_BLOCK_KB "delta_block_kb"
+
+#define CONFIG_FTP "FTP"
+#define CONFIG_FTP_PARALLEL_CONNECTIONS "parallel_connections"
+#define CONFIG_FTP_SEGMENT_MB "segment_mb"
+#define CONFIG_FTP_SESSION_POOL "session_pool"
+#define CONFIG_FTP_LISTING_CACHE_SECS "listing_cache_secs"
+#define CONFIG_FTP_MODE_Z "mode_z"
+#define CONFIG_FTP_MODE_Z_MBPS "mode_z_mbps"
+
+#define CONFIG_SMB "SMB"
+#define CONFIG_SMB_IO_DEPTH "io_depth"
+#define CONFIG_SMB_ATTR_CACHE_SECS "attr_cache_secs"
+#define CONFIG_SMB_SESSIONS "sessions"
+#define CONFIG_SMB_PARALLEL_SESSIONS "parallel_sessions"
+#define CONFIG_SMB_SEGMENT_MB "segment_mb"
+
+#define CONFIG_NFS "NFS"
+#define CONFIG_NFS_IO_DEPTH "io_depth"
+#define CONFIG_NFS_RW_SIZE_KB "rw_size_kb"
+
+#define CONFIG_SERVER "Server"
+#define CONFIG_SERVER_PORT "port"
+#define CONFIG_SERVER_ROOT "root"
+#define CONFIG_SERVER_CONNECTIONS "connections"
+#define CONFIG_SERVER_READ_BUFFER_KB "read_buffer_kb"
+#define CONFIG_SERVER_USER "user"
+#define CONFIG_SERVER_PASSWORD "password"
 
 #define CONFIG_REMOTE_SERVER "remote_server"
 #define CONFIG_REMOTE_SERVER_USER "remote_server_user"
 #define CONFIG_REMOTE_SERVER_PASSWORD "remote_server_password"
 #define CONFIG_REMOTE_HTTP_SERVER_TYPE "remote_server_http_server_type"
+#define CONFIG_REMOTE_TUNED_PARALLEL "webdav_tuned_parallel"
+#define CONFIG_REMOTE_TUNED_CHUNK_MB "webdav_tuned_chunk_mb"
+#define CONFIG_REMOTE_CAPS_RANGE "caps_range"
+#define CONFIG_REMOTE_CAPS_HEAD "caps_head"
+#define CONFIG_REMOTE_CAPS_HTTP2 "caps_http2"
+#define CONFIG_REMOTE_CAPS_DEPTH_INFINITY "caps_depth_infinity"
+#define CONFIG_REMOTE_CAPS_SEARCH "caps_search"
+#define CONFIG_REMOTE_CAPS_JSON_LISTING "caps_json_listing"
+#define CONFIG_REMOTE_CAPS_MULTIRANGE "caps_multirange"
+#define CONFIG_REMOTE_CAPS_RANGED_PUT "caps_ranged_put"
+#define CONFIG_REMOTE_CAPS_MAX_PARALLEL "caps_max_parallel"
+#define CONFIG_REMOTE_PROFILE "profile"
+#define CONFIG_REMOTE_PROFILE_ETHERNET "profile_ethernet"
+#define CONFIG_REMOTE_PROFILE_WIFI "profile_wifi"
+#define CONFIG_REMOTE_RCLONE_RC "rclone_rc"
+#define CONFIG_REMOTE_RCLONE_RC_FS "rclone_rc_fs"
+#define CONFIG_REMOTE_SFTP_PIPELINE_DEPTH "sftp_pipeline_depth"
+#define CONFIG_REMOTE_FTP_PARALLEL_CONNECTIONS "ftp_parallel_connections"
+#define CONFIG_REMOTE_SMB_IO_DEPTH "smb_io_depth"
+#define CONFIG_REMOTE_HTTP_PARALLEL "http_parallel"
+#define CONFIG_REMOTE_SITE_CONNECTIONS "site_connections"
+
+#define PROFILE_LAN "lan"
+#define PROFILE_WAN "wan"
+#define PROFILE_METERED "metered"
 
 #define CONFIG_LAST_SITE "last_site"
 
@@ -59,6 +218,36 @@ struct RemoteSettings
     char password[128];
     char http_server_type[24];
     ClientType type;
+    // Ranged download tuning learned by webdav_autotune, 0 when unknown.
+    int tuned_parallel;
+    int tuned_chunk_mb;
+    // What WebDAV/HTTP transfers learned about the server (see host_caps.h).
+    HostCaps::Caps caps;
+    // Transfer profile: a preset (lan, wan, metered or empty) plus per-site
+    // overrides of the [Global]/[SFTP]/[FTP]/[SMB] knobs, applied on
+    // connect. 0 (-1 for webdav_split_large) keeps the global value.
+    // profile_ethernet and profile_wifi replace the preset while on that
+    // interface (see NetIface); empty keeps `profile`.
+    char profile[16];
+    char profile_ethernet[16];
+    char profile_wifi[16];
+    int webdav_chunk_mb;
+    int webdav_parallel;
+    int download_parallel_files;
+    int webdav_split_large;
+    int sftp_pipeline_depth;
+    int ftp_parallel_connections;
+    int smb_io_depth;
+    int upload_parallel_files;
+    int rate_limit_kb;
+    // http_parallel of an HTTP index site; no preset sets it.
+    int http_parallel;
+    // site_connections of the site, 0 to use the global one.
+    int site_connections;
+    // rclone rc API of a site rclone serves, and the fs it serves; empty
+    // when not used.
+    char rclone_rc[256];
+    char rclone_rc_fs[128];
 };
 
 extern bool swap_xo;
@@ -79,10 +268,124 @@ extern RemoteClient *remoteclient;
 extern int max_edit_file_size;
 extern int webdav_chunk_size_mb;
 extern int webdav_parallel_connections;
+extern int http_parallel_connections;
+extern int site_connections;
+extern char myrient_mirrors[512];
 extern int download_parallel_files;
+extern bool background_transfers;
+extern int upload_parallel_files;
+extern int rate_limit_kb;
 extern bool webdav_split_large;
+extern bool webdav_multiplex;
+extern bool webdav_tree_scan;
+extern bool webdav_autotune;
+extern int webdav_range_steal_kb;
+extern bool verify_downloads;
+extern bool verify_chunks;
+extern bool metalink;
+extern bool sync_delete_extras;
+extern int small_file_batch_kb;
+extern bool transfer_journal;
+extern int download_cache;
+extern int download_cache_min_mb;
+extern int resume_verify_blocks;
+extern int transfer_memory_mb;
+extern int memory_reserve_mb;
+extern bool memory_governor;
+extern bool socket_tuning;
+extern int socket_link_mbps;
+extern int disk_queue_mb;
+extern int disk_reorder_mb;
+extern int disk_block_kb;
+extern int site_bench_mb;
+extern int site_copy_buffer_mb;
+extern int local_copy_workers;
+extern int remote_delete_workers;
+extern int remote_move_workers;
+extern int archive_cache_mb;
+extern int image_cache_mb;
+extern int image_prefetch_workers;
+extern int viewer_cache_mb;
+extern bool http_compress_listings;
+extern bool http3;
+extern bool tls_resume;
+extern int folder_size_workers;
+extern bool fast_delete;
+extern bool remote_search;
+extern int thumbnail_workers;
+extern int thumbnail_cache_mb;
+extern bool thumbnail_server_previews;
+extern bool package_info;
+extern int idle_fps;
+extern int progress_fps;
+extern int cpu_boost;
+extern int cpu_boost_min_battery;
+extern bool keep_awake_enabled;
+extern int screen_off_minutes;
+extern int status_port;
+extern bool thread_affinity;
+extern int ui_core;
+extern int network_priority;
+extern int disk_priority;
+extern bool auto_connect;
+extern bool reconnect_on_resume;
+extern int dns_cache_seconds;
+extern char dns_servers[128];
+extern int dns_race_ms;
+extern int site_probe_workers;
+extern int keepalive_seconds;
+extern int keepalive_pool_seconds;
+extern int client_pool;
+extern int host_breaker_seconds;
+extern int archive_prefetch;
+extern bool archive_streaming;
+extern bool install_to_nand;
+extern int zip_workers;
+extern int unzip_workers;
+extern int webdav_upload_parallel;
+extern int webdav_upload_chunk_mb;
 extern bool force_fat32;
+extern int listing_cache_seconds;
+extern int listing_cache_entries;
+extern int listing_sort;
+extern int listing_prefetch;
+extern int sftp_pipeline_depth;
+extern int sftp_request_kb;
+extern int sftp_parallel_sessions;
+extern int sftp_segment_mb;
+extern int sftp_attr_cache_secs;
+extern char sftp_cipher_order[256];
+extern char sftp_mac_order[256];
+extern int sftp_compress_below_kb;
+extern int sftp_read_ahead_kb;
+extern int sftp_delta_min_mb;
+extern int sftp_delta_block_kb;
+extern int ftp_parallel_connections;
+extern int ftp_segment_mb;
+extern int ftp_session_pool;
+extern int ftp_listing_cache_secs;
+extern int ftp_mode_z;
+extern int ftp_mode_z_mbps;
+extern int smb_io_depth;
+extern int smb_attr_cache_secs;
+extern int smb_sessions;
+extern int smb_parallel_sessions;
+extern int smb_segment_mb;
+extern int nfs_io_depth;
+extern int nfs_rw_size_kb;
+extern int server_port;
+extern char server_root[256];
+extern int server_connections;
+extern int server_read_buffer_kb;
+extern char server_user[64];
+extern char server_password[128];
 extern bool logging_enabled;
+extern int log_level;
+extern bool transfer_trace;
+extern bool memory_overlay;
+extern bool frame_profiler;
+extern bool timeline_trace;
+extern bool transfer_history;
 
 namespace CONFIG
 {
@@ -90,5 +393,22 @@ namespace CONFIG
     void SaveConfig();
     void SetClientType(RemoteSettings *settings);
     void SaveGlobalConfig();
+    void SaveSiteTuning(const char *site, int parallel, int chunk_mb);
+    // The disk knobs SdBench::Apply() sets.
+    void SaveDiskTuning();
+    // The per-site overrides SiteBench::Apply() sets on `settings`.
+    void SaveSiteBenchmark(const char *site, const RemoteSettings *settings);
+    void SaveSiteCaps(const char *site, const HostCaps::Caps &caps);
+    // Keeps the measured SSH cipher/MAC ranking (see SshCrypto).
+    void SaveSftpCryptoOrder(const char *ciphers, const char *macs);
+    // Resets the transfer knobs to the INI's global values, then layers the
+    // site's profile preset and overrides on top. The preset is the one
+    // for the interface the console is on now, when the site names one.
+    void ApplySiteProfile(const RemoteSettings *settings);
+    // ApplySiteProfile() again when the interface changed since it last
+    // ran, e.g. the console was docked after connecting; at batch start.
+    void RefreshSiteProfile(const RemoteSettings *settings);
+    // The preset ApplySiteProfile() last used, empty for none.
+    const char *AppliedProfile();
 }
 #endif
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "connection_budget.h"
+#include "config.h"
+#include "logger.h"
+
+namespace
+{
+    struct Entry
+    {
+        int id;
+        std::string key;
+        int wanted = 1;
+        int64_t remaining = 0;
+        // What Share() last handed out, for the log.
+        int share = 1;
+    };
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    int next_id = 1;
+    // The calling thread's innermost Ticket, 0 for none.
+    thread_local int current = 0;
+
+    std::string Key(const std::string &url)
+    {
+        size_t scheme = url.find("://");
+        size_t start = (scheme == std::string::npos) ? 0 : scheme + 3;
+        size_t end = url.find_first_of("/?#", start);
+        std::string key = url.substr(0, end);
+        size_t at = key.rfind('@');
+        if (at != std::string::npos && at >= start)
+            key.erase(start, at + 1 - start);
+        return key;
+    }
+
+    // Called with the lock held; the share of the entry `id` after every
+    // ticket of `key` got one and the spare connections went out one by
+    // one to the most bytes left per connection.
+    int Allocate(const std::string &key, int id, int *files)
+    {
+        std::vector<Entry *> group;
+        for (Entry &e : entries)
+        {
+            if (e.key == key)
+                group.push_back(&e);
+        }
+        *files = (int)group.size();
+        std::vector<int> alloc(group.size(), 1);
+        int spare = ConnectionBudget::Total() - (int)group.size();
+        while (spare > 0)
+        {
+            int best = -1;
+            double best_left = 0;
+            for (size_t i = 0; i < group.size(); i++)
+            {
+                if (alloc[i] >= group[i]->wanted)
+                    continue;
+                double left = (double)std::max<int64_t>(group[i]->remaining, 1) / alloc[i];
+                if (best < 0 || left > best_left)
+                {
+                    best = (int)i;
+                    best_left = left;
+                }
+            }
+            if (best < 0)
+                break;
+            alloc[best]++;
+            spare--;
+        }
+        for (size_t i = 0; i < group.size(); i++)
+        {
+            if (group[i]->id == id)
+                return alloc[i];
+        }
+        return 1;
+    }
+}
+
+namespace ConnectionBudget
+{
+    int Total()
+    {
+        if (site_connections > 0)
+            return site_connections;
+        return std::max(webdav_parallel_connections, download_parallel_files);
+    }
+
+    Ticket::Ticket(const std::string &server, int64_t size)
+        : outer(current)
+    {
+        Entry entry;
+        entry.key = Key(server);
+        entry.remaining = size;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            id = next_id++;
+            entry.id = id;
+            entries.push_back(entry);
+        }
+        current = id;
+    }
+
+    Ticket::~Ticket()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [this](const Entry &e)
+                                         { return e.id == id; }),
+                          entries.end());
+        }
+        current = outer;
+    }
+
+    int Share(int wanted, int64_t remaining)
+    {
+        if (current == 0)
+            return wanted;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find_if(entries.begin(), entries.end(), [](const Entry &e)
+                               { return e.id == current; });
+        if (it == entries.end())
+            return wanted;
+        it->wanted = wanted;
+        it->remaining = remaining;
+        int files = 0;
+        int share = Allocate(it->key, it->id, &files);
+        if (share != it->share)
+        {
+            Logger::Logf(Logger::LOG_DEBUG, "BUDGET host=%s share=%d->%d wanted=%d files=%d total=%d remaining_mb=%lld",
+                         it->key.c_str(), it->share, share, wanted, files, Total(),
+                         (long long)(remaining / 1048576));
+            it->share = share;
+        }
+        return share;
+    }
+}
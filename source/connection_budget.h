@@ -0,0 +1,47 @@
+#ifndef NEO_CONNECTION_BUDGET_H
+#define NEO_CONNECTION_BUDGET_H
+
+#include <cstdint>
+#include <string>
+
+// One pool of connections per site, shared by the files a download batch
+// has in flight (download_parallel_files) and the ranges of each of them
+// (webdav_parallel, http_parallel), which would otherwise multiply: three
+// files of twelve ranges each are 36 connections to a server that starts
+// refusing at twelve. Each queue worker holds a Ticket for the file it is
+// on, and a ranged download asks Share() how many requests it may have in
+// flight, again on every turn of its loop. Every file keeps one; the rest
+// of the budget goes, a connection at a time, to whichever file has the
+// most bytes left per connection it holds, so small files take one each,
+// a large one takes what they leave, and the slots of a file that ends
+// pass to those still running. Requests already over a new share finish;
+// only new ones wait.
+namespace ConnectionBudget
+{
+    // site_connections, or when that is 0 the larger of webdav_parallel and
+    // download_parallel_files, so one file alone is never held back.
+    int Total();
+
+    // Books the calling thread's file of `size` bytes against the budget
+    // of `server`'s scheme, host and port (keyed like HostHealth) while it
+    // lives. It counts as one connection until the file asks for more.
+    class Ticket
+    {
+    public:
+        Ticket(const std::string &server, int64_t size);
+        ~Ticket();
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+
+    private:
+        int id;
+        int outer;
+    };
+
+    // Of `wanted` requests in flight, how many the calling thread's file
+    // may have with `remaining` bytes still to come; `wanted` itself on a
+    // thread without a Ticket (the site benchmark, a browse-time GET).
+    int Share(int wanted, int64_t remaining);
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "download_cache.h"
+#include "fs.h"
+#include "logger.h"
+#include "util.h"
+
+#define DOWNLOAD_CACHE_HEADER "neo_sftp download cache 1"
+
+namespace
+{
+    struct Entry
+    {
+        std::string site;
+        std::string remote;
+        uint64_t size = 0;
+        std::string validator;
+        std::string local;
+        int64_t local_mtime = 0;
+        // When the entry was last recorded or handed out.
+        int64_t used = 0;
+    };
+
+    std::mutex cache_mutex;
+    std::vector<Entry> entries;
+    bool loaded = false;
+
+    // Size and mtime of the local file; false when it is gone.
+    bool LocalStat(const std::string &path, uint64_t &size, int64_t &mtime)
+    {
+        struct stat st = {0};
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            return false;
+        size = (uint64_t)st.st_size;
+        mtime = (int64_t)st.st_mtime;
+        return true;
+    }
+
+    void Load()
+    {
+        if (loaded)
+            return;
+        loaded = true;
+        std::vector<std::string> lines;
+        if (!FS::FileExists(DOWNLOAD_CACHE_FILE) || !FS::LoadText(&lines, DOWNLOAD_CACHE_FILE) || lines.empty() ||
+            lines[0] != DOWNLOAD_CACHE_HEADER)
+            return;
+        for (size_t i = 1; i < lines.size(); i++)
+        {
+            // site, remote, size, validator, local, local mtime, used
+            std::vector<std::string> fields;
+            size_t start = 0;
+            for (size_t tab; (tab = lines[i].find('\t', start)) != std::string::npos; start = tab + 1)
+                fields.push_back(lines[i].substr(start, tab - start));
+            fields.push_back(lines[i].substr(start));
+            if (fields.size() != 7)
+                continue;
+            Entry entry;
+            entry.site = fields[0];
+            entry.remote = fields[1];
+            entry.size = strtoull(fields[2].c_str(), nullptr, 10);
+            entry.validator = fields[3];
+            entry.local = fields[4];
+            entry.local_mtime = strtoll(fields[5].c_str(), nullptr, 10);
+            entry.used = strtoll(fields[6].c_str(), nullptr, 10);
+            entries.push_back(entry);
+        }
+    }
+
+    void Save()
+    {
+        char number[64];
+        std::vector<std::string> lines;
+        lines.push_back(DOWNLOAD_CACHE_HEADER);
+        for (const Entry &entry : entries)
+        {
+            snprintf(number, sizeof(number), "\t%llu\t", (unsigned long long)entry.size);
+            std::string line = entry.site + "\t" + entry.remote + number + entry.validator + "\t" + entry.local;
+            snprintf(number, sizeof(number), "\t%lld\t%lld", (long long)entry.local_mtime, (long long)entry.used);
+            lines.push_back(line + number);
+        }
+        // Written aside and swapped in, like the journals.
+        std::string tmp = std::string(DOWNLOAD_CACHE_FILE) + ".tmp";
+        if (!FS::SaveText(&lines, tmp))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "DOWNLOAD CACHE save failed path=%s", tmp.c_str());
+            return;
+        }
+        FS::Rm(DOWNLOAD_CACHE_FILE);
+        FS::Rename(tmp, DOWNLOAD_CACHE_FILE);
+    }
+}
+
+namespace DownloadCache
+{
+    std::string Validator(const DateTime &modified)
+    {
+        if (modified.year == 0)
+            return "";
+        char text[32];
+        snprintf(text, sizeof(text), "%04u%02u%02u%02u%02u%02u", modified.year, modified.month, modified.day,
+                 modified.hours, modified.minutes, modified.seconds);
+        return text;
+    }
+
+    void Record(const std::string &site, const std::string &remote, uint64_t size, const std::string &validator,
+                const std::string &local)
+    {
+        if (download_cache <= 0 || validator.empty() || size < (uint64_t)download_cache_min_mb * 1048576)
+            return;
+        Entry entry;
+        uint64_t local_size = 0;
+        if (!LocalStat(local, local_size, entry.local_mtime) || local_size != size)
+            return;
+        entry.site = site;
+        entry.remote = remote;
+        entry.size = size;
+        entry.validator = validator;
+        entry.local = local;
+        entry.used = (int64_t)time(nullptr);
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        Load();
+        // One entry per remote file and per local file: an overwritten
+        // copy holds something else now.
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [&](const Entry &old)
+                                     { return (old.site == site && old.remote == remote) || old.local == local; }),
+                      entries.end());
+        entries.push_back(entry);
+        if ((int)entries.size() > download_cache)
+        {
+            std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+                      { return a.used > b.used; });
+            entries.resize(download_cache);
+        }
+        Save();
+    }
+
+    std::string Find(const std::string &site, const std::string &remote, uint64_t size, const std::string &validator)
+    {
+        if (download_cache <= 0 || validator.empty() || size < (uint64_t)download_cache_min_mb * 1048576)
+            return "";
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        Load();
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            Entry &entry = entries[i];
+            if (entry.site != site || entry.remote != remote)
+                continue;
+            uint64_t local_size = 0;
+            int64_t local_mtime = 0;
+            if (entry.size != size || entry.validator != validator ||
+                !LocalStat(entry.local, local_size, local_mtime) || local_size != size ||
+                local_mtime != entry.local_mtime)
+            {
+                // The remote file changed, or the copy was edited or deleted.
+                Logger::Logf(Logger::LOG_DEBUG, "DOWNLOAD CACHE stale remote=%s local=%s", remote.c_str(),
+                             entry.local.c_str());
+                entries.erase(entries.begin() + i);
+                Save();
+                return "";
+            }
+            entry.used = (int64_t)time(nullptr);
+            return entry.local;
+        }
+        return "";
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef NEO_DOWNLOAD_CACHE_H
+#define NEO_DOWNLOAD_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "common.h"
+#include "config.h"
+
+#define DOWNLOAD_CACHE_FILE DATA_PATH "/download_cache"
+
+// Where finished downloads of download_cache_min_mb or more went, so
+// fetching the same remote file again, into another folder or over the
+// copy itself, is a copy on the card or nothing at all instead of the
+// network. An entry names the site, the remote path, its size and listed
+// date, and the local file with its size and mtime once written; the local
+// file must still match both, so one changed or deleted since is never
+// handed out. Kept in DOWNLOAD_CACHE_FILE, up to download_cache entries,
+// the least recently used going first.
+namespace DownloadCache
+{
+    // The listed date of a remote file as its validator; "" when the
+    // listing had none, and such files are not kept.
+    std::string Validator(const DateTime &modified);
+    // Records `local` as holding `remote` of `site` as `size` and
+    // `validator`, replacing what was kept for either.
+    void Record(const std::string &site, const std::string &remote, uint64_t size, const std::string &validator,
+                const std::string &local);
+    // A local file that still holds `remote` as `size` and `validator`, ""
+    // when none does.
+    std::string Find(const std::string &site, const std::string &remote, uint64_t size, const std::string &validator);
+}
+
+#endif
@@ -0,0 +1,696 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <switch.h>
+#include <mbedtls/base64.h>
+
+#include "file_server.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+#include "pugixml/pugixml.hpp"
+
+namespace FileServer
+{
+    namespace
+    {
+        const int kMaxWorkers = 8;
+        const size_t kMaxHead = 16 * 1024;
+        // Request bodies (PROPFIND's) are read and ignored up to this size.
+        const int64_t kMaxBody = 1024 * 1024;
+        const int kPollMs = 500;
+        // An idle keep-alive connection is closed after this long.
+        const int kIdleSeconds = 15;
+        const int kSocketBufferSize = 512 * 1024;
+
+        struct Request
+        {
+            std::string method;
+            std::string path;
+            std::string range;
+            std::string depth;
+            std::string authorization;
+            int64_t content_length = 0;
+            bool keep_alive = true;
+        };
+
+        int listen_fd = -1;
+        Thread threads[kMaxWorkers];
+        bool started[kMaxWorkers];
+        int worker_count = 0;
+        std::atomic<bool> stopping{false};
+        std::atomic<int> client_fds[kMaxWorkers];
+        std::atomic<int> active{0};
+
+        std::string Lower(std::string text)
+        {
+            for (char &c : text)
+                c = (char)tolower((unsigned char)c);
+            return text;
+        }
+
+        int HexValue(char c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            c = (char)tolower((unsigned char)c);
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            return -1;
+        }
+
+        bool UrlDecode(const std::string &in, std::string &out)
+        {
+            out.clear();
+            for (size_t i = 0; i < in.size(); i++)
+            {
+                if (in[i] != '%')
+                {
+                    out += in[i];
+                    continue;
+                }
+                if (i + 2 >= in.size() || HexValue(in[i + 1]) < 0 || HexValue(in[i + 2]) < 0)
+                    return false;
+                out += (char)(HexValue(in[i + 1]) * 16 + HexValue(in[i + 2]));
+                i += 2;
+            }
+            return out.find('\0') == std::string::npos;
+        }
+
+        std::string UrlEncode(const std::string &in)
+        {
+            static const char *hex = "0123456789ABCDEF";
+            std::string out;
+            for (unsigned char c : in)
+            {
+                if (isalnum(c) || strchr("/-._~!$&'()*+,;=:@", c) != nullptr)
+                    out += (char)c;
+                else
+                {
+                    out += '%';
+                    out += hex[c >> 4];
+                    out += hex[c & 15];
+                }
+            }
+            return out;
+        }
+
+        std::string HtmlEscape(const std::string &in)
+        {
+            std::string out;
+            for (char c : in)
+            {
+                if (c == '&')
+                    out += "&amp;";
+                else if (c == '<')
+                    out += "&lt;";
+                else if (c == '>')
+                    out += "&gt;";
+                else if (c == '"')
+                    out += "&quot;";
+                else
+                    out += c;
+            }
+            return out;
+        }
+
+        std::string HttpDate(time_t t)
+        {
+            struct tm tm;
+            char buf[64];
+            gmtime_r(&t, &tm);
+            strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            return buf;
+        }
+
+        // Whether `local`, a path without "." or ".." segments, is the app's
+        // folder or below it. FAT compares names without case.
+        bool InAppFolder(const std::string &local)
+        {
+            static const std::string app = Lower(DATA_PATH "/");
+            std::string lower = Lower(local);
+            while (lower.find("//") != std::string::npos)
+                lower.erase(lower.find("//"), 1);
+            if (lower.back() != '/')
+                lower += '/';
+            return lower.compare(0, app.size(), app) == 0;
+        }
+
+        // The file behind a decoded URL path, or "" for one that climbs out
+        // of the root or into the app's own folder (config.ini keeps the
+        // site passwords, next to the TLS sessions, host keys, journal and
+        // trash).
+        std::string LocalPath(const std::string &path)
+        {
+            std::string root(server_root);
+            while (!root.empty() && root.back() == '/')
+                root.pop_back();
+            std::string local = root;
+            size_t start = 0;
+            while (start < path.size())
+            {
+                size_t end = path.find('/', start);
+                if (end == std::string::npos)
+                    end = path.size();
+                if (path.compare(start, end - start, "..") == 0)
+                    return "";
+                if (end > start && path.compare(start, end - start, ".") != 0)
+                    local += "/" + path.substr(start, end - start);
+                start = end + 1;
+            }
+            if (local.empty())
+                local = "/";
+            return InAppFolder(local) ? "" : local;
+        }
+
+        bool SendAll(int fd, const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t put = send(fd, data, len, 0);
+                if (put <= 0)
+                {
+                    if (put < 0 && errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += put;
+                len -= (size_t)put;
+            }
+            return true;
+        }
+
+        bool SendHead(int fd, int code, const char *reason, const Request &req, const std::string &extra,
+                      int64_t length)
+        {
+            char head[512];
+            snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\nServer: neo_sftp\r\nDate: %s\r\nContent-Length: %lld\r\n"
+                     "Connection: %s\r\n",
+                     code, reason, HttpDate(time(nullptr)).c_str(), (long long)length,
+                     req.keep_alive ? "keep-alive" : "close");
+            std::string out = head;
+            out += extra;
+            out += "\r\n";
+            return SendAll(fd, out.data(), out.size());
+        }
+
+        bool SendText(int fd, int code, const char *reason, const Request &req, const char *type,
+                      const std::string &body, const std::string &extra = "")
+        {
+            std::string headers = std::string("Content-Type: ") + type + "\r\n" + extra;
+            if (!SendHead(fd, code, reason, req, headers, (int64_t)body.size()))
+                return false;
+            if (req.method == "HEAD")
+                return true;
+            return SendAll(fd, body.data(), body.size());
+        }
+
+        // Reads the next request head, and discards its body. Returns 1 with
+        // `req` filled, 0 when the client went away or idled out, -1 on a
+        // request that cannot be parsed.
+        int ReadRequest(int fd, std::string &pending, Request &req)
+        {
+            size_t end;
+            while ((end = pending.find("\r\n\r\n")) == std::string::npos)
+            {
+                if (pending.size() > kMaxHead)
+                    return -1;
+                char buf[4096];
+                ssize_t got = recv(fd, buf, sizeof(buf), 0);
+                if (got <= 0)
+                    return 0;
+                pending.append(buf, (size_t)got);
+            }
+            std::string head = pending.substr(0, end);
+            pending.erase(0, end + 4);
+
+            size_t line_end = head.find("\r\n");
+            std::string line = head.substr(0, line_end);
+            size_t sp1 = line.find(' ');
+            size_t sp2 = line.rfind(' ');
+            if (sp1 == std::string::npos || sp2 == sp1)
+                return -1;
+            req = Request();
+            req.method = line.substr(0, sp1);
+            std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+            std::string version = line.substr(sp2 + 1);
+            req.keep_alive = version == "HTTP/1.1";
+            size_t query = target.find('?');
+            if (query != std::string::npos)
+                target.resize(query);
+            if (target.compare(0, 7, "http://") == 0)
+            {
+                size_t slash = target.find('/', 7);
+                target = slash == std::string::npos ? "/" : target.substr(slash);
+            }
+            if (!UrlDecode(target, req.path) || req.path.empty() || req.path[0] != '/')
+                return -1;
+
+            size_t pos = line_end;
+            while (pos != std::string::npos && pos < head.size())
+            {
+                size_t next = head.find("\r\n", pos + 2);
+                std::string header = head.substr(pos + 2, next == std::string::npos ? std::string::npos : next - pos - 2);
+                pos = next;
+                size_t colon = header.find(':');
+                if (colon == std::string::npos)
+                    continue;
+                std::string name = Lower(header.substr(0, colon));
+                std::string value = header.substr(colon + 1);
+                value.erase(0, value.find_first_not_of(" \t"));
+                if (name == "range")
+                    req.range = value;
+                else if (name == "depth")
+                    req.depth = value;
+                else if (name == "authorization")
+                    req.authorization = value;
+                else if (name == "content-length")
+                    req.content_length = atoll(value.c_str());
+                else if (name == "connection")
+                {
+                    std::string token = Lower(value);
+                    if (token.find("close") != std::string::npos)
+                        req.keep_alive = false;
+                    else if (token.find("keep-alive") != std::string::npos)
+                        req.keep_alive = true;
+                }
+            }
+
+            if (req.content_length < 0 || req.content_length > kMaxBody)
+                return -1;
+            int64_t body = req.content_length;
+            int64_t buffered = std::min(body, (int64_t)pending.size());
+            pending.erase(0, (size_t)buffered);
+            body -= buffered;
+            while (body > 0)
+            {
+                char buf[4096];
+                ssize_t got = recv(fd, buf, (size_t)std::min(body, (int64_t)sizeof(buf)), 0);
+                if (got <= 0)
+                    return 0;
+                body -= got;
+            }
+            return 1;
+        }
+
+        // Single ranges only, as the download tools send them. Returns 1 with
+        // [start, end] set, 0 for an unsatisfiable range, -1 to serve the
+        // whole file (no range, or one that is not understood).
+        int ParseRange(const std::string &range, int64_t size, int64_t &start, int64_t &end)
+        {
+            if (range.compare(0, 6, "bytes=") != 0 || range.find(',') != std::string::npos)
+                return -1;
+            std::string spec = range.substr(6);
+            size_t dash = spec.find('-');
+            if (dash == std::string::npos)
+                return -1;
+            std::string first = spec.substr(0, dash);
+            std::string last = spec.substr(dash + 1);
+            if (first.empty())
+            {
+                if (last.empty())
+                    return -1;
+                int64_t suffix = atoll(last.c_str());
+                if (suffix <= 0 || size == 0)
+                    return 0;
+                start = suffix >= size ? 0 : size - suffix;
+                end = size - 1;
+                return 1;
+            }
+            start = atoll(first.c_str());
+            end = last.empty() ? size - 1 : atoll(last.c_str());
+            if (start >= size || end < start)
+                return 0;
+            if (end >= size)
+                end = size - 1;
+            return 1;
+        }
+
+        bool ServeFile(int fd, const Request &req, const std::string &local, const struct stat &st,
+                       TransferBuffer &buffer, uint64_t &sent)
+        {
+            int64_t size = (int64_t)st.st_size;
+            int64_t start = 0;
+            int64_t end = size - 1;
+            int ranged = ParseRange(req.range, size, start, end);
+            std::string extra = "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n";
+            extra += "Last-Modified: " + HttpDate(st.st_mtime) + "\r\n";
+            if (ranged == 0)
+            {
+                char cr[64];
+                snprintf(cr, sizeof(cr), "Content-Range: bytes */%lld\r\n", (long long)size);
+                return SendText(fd, 416, "Range Not Satisfiable", req, "text/plain", "", cr);
+            }
+
+            int in = -1;
+            if (req.method == "GET")
+            {
+                in = open(local.c_str(), O_RDONLY);
+                if (in < 0)
+                    return SendText(fd, 403, "Forbidden", req, "text/plain", "cannot open file\n");
+            }
+
+            int64_t length = size > 0 ? end - start + 1 : 0;
+            bool ok;
+            if (ranged == 1)
+            {
+                char cr[96];
+                snprintf(cr, sizeof(cr), "Content-Range: bytes %lld-%lld/%lld\r\n", (long long)start,
+                         (long long)end, (long long)size);
+                ok = SendHead(fd, 206, "Partial Content", req, extra + cr, length);
+            }
+            else
+                ok = SendHead(fd, 200, "OK", req, extra, length);
+            if (in < 0)
+                return ok;
+
+            if (ok && start > 0 && lseek(in, (off_t)start, SEEK_SET) != (off_t)start)
+                ok = false;
+            if (ok && length > 0 && !buffer && !buffer.Acquire((size_t)server_read_buffer_kb * 1024))
+                ok = false;
+            int64_t left = ok ? length : 0;
+            while (left > 0 && !stopping)
+            {
+                size_t want = (size_t)std::min(left, (int64_t)buffer.size());
+                ssize_t got = read(in, buffer.data(), want);
+                if (got <= 0 || !SendAll(fd, buffer.data(), (size_t)got))
+                    break;
+                left -= got;
+                sent += (uint64_t)got;
+            }
+            close(in);
+            Logger::Logf(Logger::LOG_DEBUG, "FILESERVER GET path=%s start=%lld bytes=%lld ok=%d", local.c_str(),
+                         (long long)start, (long long)length, ok && left == 0 ? 1 : 0);
+            // A short body leaves the client waiting for the rest.
+            return ok && left == 0;
+        }
+
+        bool ServeIndex(int fd, const Request &req, const std::string &local)
+        {
+            std::string base = req.path;
+            if (base.back() != '/')
+                base += '/';
+            std::string body = "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>" + HtmlEscape(base) +
+                               "</title></head><body><h1>" + HtmlEscape(base) + "</h1><ul>";
+            if (base != "/")
+                body += "<li><a href=\"../\">../</a></li>";
+            DIR *dir = opendir(local.c_str());
+            if (dir == nullptr)
+                return SendText(fd, 403, "Forbidden", req, "text/plain", "cannot list folder\n");
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr)
+            {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                    continue;
+                std::string name = entry->d_name;
+                if (InAppFolder(local + "/" + name))
+                    continue;
+                if (entry->d_type == DT_DIR)
+                    name += '/';
+                body += "<li><a href=\"" + HtmlEscape(UrlEncode(name)) + "\">" + HtmlEscape(name) + "</a></li>";
+            }
+            closedir(dir);
+            body += "</ul></body></html>\n";
+            return SendText(fd, 200, "OK", req, "text/html; charset=utf-8", body);
+        }
+
+        struct StringWriter : pugi::xml_writer
+        {
+            std::string out;
+            void write(const void *data, size_t size) override { out.append((const char *)data, size); }
+        };
+
+        void AddResponse(pugi::xml_node multistatus, const std::string &href, const std::string &name,
+                         const struct stat &st)
+        {
+            pugi::xml_node response = multistatus.append_child("D:response");
+            response.append_child("D:href").text().set(UrlEncode(href).c_str());
+            pugi::xml_node propstat = response.append_child("D:propstat");
+            pugi::xml_node prop = propstat.append_child("D:prop");
+            prop.append_child("D:displayname").text().set(name.c_str());
+            pugi::xml_node type = prop.append_child("D:resourcetype");
+            if (S_ISDIR(st.st_mode))
+                type.append_child("D:collection");
+            else
+            {
+                char size[24];
+                snprintf(size, sizeof(size), "%lld", (long long)st.st_size);
+                prop.append_child("D:getcontentlength").text().set(size);
+                prop.append_child("D:getcontenttype").text().set("application/octet-stream");
+            }
+            prop.append_child("D:getlastmodified").text().set(HttpDate(st.st_mtime).c_str());
+            propstat.append_child("D:status").text().set("HTTP/1.1 200 OK");
+        }
+
+        bool ServePropfind(int fd, const Request &req, const std::string &local, const struct stat &st)
+        {
+            pugi::xml_document doc;
+            pugi::xml_node multistatus = doc.append_child("D:multistatus");
+            multistatus.append_attribute("xmlns:D") = "DAV:";
+
+            std::string href = req.path;
+            bool folder = S_ISDIR(st.st_mode);
+            if (folder && href.back() != '/')
+                href += '/';
+            std::string own = req.path == "/" ? "/" : req.path.substr(req.path.find_last_of('/', req.path.size() - 2) + 1);
+            AddResponse(multistatus, href, own, st);
+
+            if (folder && req.depth != "0")
+            {
+                DIR *dir = opendir(local.c_str());
+                if (dir == nullptr)
+                    return SendText(fd, 403, "Forbidden", req, "text/plain", "cannot list folder\n");
+                struct dirent *entry;
+                std::string prefix = local + (local.back() == '/' ? "" : "/");
+                while ((entry = readdir(dir)) != nullptr)
+                {
+                    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                        continue;
+                    struct stat child;
+                    if (InAppFolder(prefix + entry->d_name) || stat((prefix + entry->d_name).c_str(), &child) != 0)
+                        continue;
+                    std::string child_href = href + entry->d_name;
+                    if (S_ISDIR(child.st_mode))
+                        child_href += '/';
+                    AddResponse(multistatus, child_href, entry->d_name, child);
+                }
+                closedir(dir);
+            }
+
+            StringWriter writer;
+            doc.save(writer, "", pugi::format_raw, pugi::encoding_utf8);
+            return SendText(fd, 207, "Multi-Status", req, "application/xml; charset=\"utf-8\"", writer.out);
+        }
+
+        // Whether `authorization` is Basic with [Server] user and password.
+        bool Authorized(const std::string &authorization)
+        {
+            if (Lower(authorization.substr(0, 6)) != "basic ")
+                return false;
+            std::string encoded = authorization.substr(6);
+            encoded.erase(0, encoded.find_first_not_of(' '));
+            unsigned char decoded[sizeof(server_user) + sizeof(server_password) + 4];
+            size_t length = 0;
+            if (mbedtls_base64_decode(decoded, sizeof(decoded), &length, (const unsigned char *)encoded.data(),
+                                      encoded.size()) != 0)
+                return false;
+            std::string expected = std::string(server_user) + ":" + server_password;
+            // Compared in full, so the time taken does not give away a prefix.
+            unsigned char diff = length == expected.size() ? 0 : 1;
+            for (size_t i = 0; i < length && i < expected.size(); i++)
+                diff |= decoded[i] ^ (unsigned char)expected[i];
+            return diff == 0;
+        }
+
+        // Returns whether the connection can take another request.
+        bool Handle(int fd, const Request &req, TransferBuffer &buffer, uint64_t &sent)
+        {
+            static const char *kAllow = "Allow: OPTIONS, GET, HEAD, PROPFIND\r\n";
+            if (!Authorized(req.authorization))
+                return SendText(fd, 401, "Unauthorized", req, "text/plain", "login required\n",
+                                "WWW-Authenticate: Basic realm=\"" APP_ID "\", charset=\"UTF-8\"\r\n") &&
+                       req.keep_alive;
+            if (req.method == "OPTIONS")
+                return SendText(fd, 200, "OK", req, "text/plain", "", std::string(kAllow) + "DAV: 1\r\n") &&
+                       req.keep_alive;
+
+            bool known = req.method == "GET" || req.method == "HEAD" || req.method == "PROPFIND";
+            if (!known)
+                return SendText(fd, 405, "Method Not Allowed", req, "text/plain", "read-only server\n", kAllow) &&
+                       req.keep_alive;
+
+            std::string local = LocalPath(req.path);
+            struct stat st;
+            if (local.empty() || stat(local.c_str(), &st) != 0)
+                return SendText(fd, 404, "Not Found", req, "text/plain", "not found\n") && req.keep_alive;
+
+            bool ok;
+            if (req.method == "PROPFIND")
+                ok = ServePropfind(fd, req, local, st);
+            else if (S_ISDIR(st.st_mode))
+                ok = ServeIndex(fd, req, local);
+            else
+                ok = ServeFile(fd, req, local, st, buffer, sent);
+            return ok && req.keep_alive;
+        }
+
+        void ServeClient(int fd, const char *peer)
+        {
+            uint64_t opened = Util::GetTick();
+            uint64_t sent = 0;
+            int requests = 0;
+            TransferBuffer buffer;
+            std::string pending;
+            while (!stopping)
+            {
+                Request req;
+                int got = ReadRequest(fd, pending, req);
+                if (got == 0)
+                    break;
+                if (got < 0)
+                {
+                    req.keep_alive = false;
+                    SendText(fd, 400, "Bad Request", req, "text/plain", "bad request\n");
+                    break;
+                }
+                requests++;
+                if (!Handle(fd, req, buffer, sent))
+                    break;
+            }
+            double secs = (Util::GetTick() - opened) / 1000000.0;
+            Logger::Logf("FILESERVER client=%s requests=%d bytes=%llu secs=%.1f mib_s=%.2f", peer, requests,
+                         (unsigned long long)sent, secs, secs > 0.0 ? sent / secs / 1048576.0 : 0.0);
+        }
+
+        void WorkerThread(void *arg)
+        {
+            int slot = (int)(intptr_t)arg;
+            while (!stopping)
+            {
+                struct pollfd pfd = {listen_fd, POLLIN, 0};
+                if (poll(&pfd, 1, kPollMs) <= 0)
+                    continue;
+                struct sockaddr_in addr;
+                socklen_t addr_len = sizeof(addr);
+                int fd = accept(listen_fd, (struct sockaddr *)&addr, &addr_len);
+                if (fd < 0)
+                    continue;
+
+                // Accepted sockets inherit O_NONBLOCK from the listener.
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+                struct timeval idle = {kIdleSeconds, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+                int sndbuf = kSocketBufferSize;
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+                int nodelay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+                client_fds[slot] = fd;
+                active++;
+                ServeClient(fd, inet_ntoa(addr.sin_addr));
+                active--;
+                client_fds[slot] = -1;
+                close(fd);
+            }
+        }
+    }
+
+    void Start()
+    {
+        if (server_port <= 0 || listen_fd >= 0)
+            return;
+        if (server_password[0] == '\0')
+        {
+            Logger::Logf(Logger::LOG_ERROR, "FILESERVER not started: set [Server] password");
+            return;
+        }
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "FILESERVER socket failed errno=%d", errno);
+            return;
+        }
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)server_port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, kMaxWorkers) < 0)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "FILESERVER listen failed port=%d errno=%d", server_port, errno);
+            close(listen_fd);
+            listen_fd = -1;
+            return;
+        }
+        // Workers share the listener; the ones that lose an accept() race
+        // must not block in it.
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+
+        stopping = false;
+        worker_count = server_connections < kMaxWorkers ? server_connections : kMaxWorkers;
+        for (int i = 0; i < worker_count; i++)
+        {
+            client_fds[i] = -1;
+            started[i] = false;
+            ::Result rc = Threads::Create(&threads[i], WorkerThread, (void *)(intptr_t)i, 0x10000, Threads::ROLE_NETWORK,
+                                          "file server");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "FILESERVER threadCreate failed rc=0x%x", rc);
+                continue;
+            }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        struct in_addr host;
+        host.s_addr = (in_addr_t)gethostid();
+        Logger::Logf("FILESERVER listening ip=%s port=%d root=%s connections=%d read_buffer_kb=%d", inet_ntoa(host),
+                     server_port, server_root, worker_count, server_read_buffer_kb);
+    }
+
+    void Stop()
+    {
+        if (listen_fd < 0)
+            return;
+        stopping = true;
+        // Wakes workers blocked on a client.
+        for (int i = 0; i < worker_count; i++)
+        {
+            int fd = client_fds[i];
+            if (fd >= 0)
+                shutdown(fd, SHUT_RDWR);
+        }
+        for (int i = 0; i < worker_count; i++)
+        {
+            if (started[i])
+                Threads::Join(&threads[i]);
+        }
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    bool Busy()
+    {
+        return active > 0;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef NEO_FILE_SERVER_H
+#define NEO_FILE_SERVER_H
+
+// Server mode: the SD card, below [Server] root, served read-only over
+// HTTP/1.1 and WebDAV class 1 on [Server] port, so a desktop client (rclone,
+// aria2, a file manager or a browser) can pull dumps and captures instead of
+// the console pushing them one upload at a time.
+//
+// GET and HEAD serve files with single Range requests (206, 416); GET of a
+// folder returns an HTML index; PROPFIND (Depth 0 or 1) lists folders as a
+// multistatus built with pugixml; OPTIONS advertises DAV. Anything that
+// would write answers 405. Every request needs Basic auth with [Server]
+// user and password, and the server does not start without a password;
+// the app's own folder (config.ini and the other secrets) is never served.
+//
+// [Server] connections worker threads each take the next client from the
+// shared listening socket and serve its keep-alive requests until it goes
+// away, so that many clients or parallel ranges are served at once. File
+// data is read straight into a page-aligned pool buffer of read_buffer_kb
+// and sent from there.
+namespace FileServer
+{
+    // Listens when [Server] port is set; call after the config is loaded.
+    void Start();
+    // Closes the clients being served and joins the workers.
+    void Stop();
+    // A client is connected, so the console should stay awake.
+    bool Busy();
+}
+
+#endif
@@ -0,0 +1,252 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <switch.h>
+
+#include "folder_size.h"
+#include "fs.h"
+#include "logger.h"
+#include "util.h"
+
+namespace FolderSize
+{
+    namespace
+    {
+        struct Crawl
+        {
+            const ListFn *list;
+            const JoinFn *join;
+            Progress *progress;
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<std::string> folders;
+            // Workers holding a folder; the crawl is over when none does
+            // and the queue is empty.
+            int busy = 0;
+            bool failed = false;
+        };
+
+        struct WorkerArg
+        {
+            Crawl *crawl;
+            int worker;
+        };
+
+        void CrawlLoop(Crawl &crawl, int worker)
+        {
+            std::vector<DirEntry> entries;
+            std::unique_lock<std::mutex> lock(crawl.mutex);
+            while (true)
+            {
+                crawl.cv.wait(lock, [&crawl]
+                              { return !crawl.folders.empty() || crawl.busy == 0 || crawl.progress->cancel; });
+                if (crawl.progress->cancel || crawl.folders.empty())
+                    break;
+                std::string path = crawl.folders.front();
+                crawl.folders.pop_front();
+                crawl.busy++;
+                lock.unlock();
+
+                entries.clear();
+                bool ok = (*crawl.list)(worker, path, entries);
+                for (const DirEntry &entry : entries)
+                {
+                    if (strcmp(entry.name, "..") != 0 && !entry.isDir)
+                        crawl.progress->Add(entry);
+                }
+
+                lock.lock();
+                if (!ok)
+                    crawl.failed = true;
+                for (const DirEntry &entry : entries)
+                {
+                    if (strcmp(entry.name, "..") == 0 || !entry.isDir)
+                        continue;
+                    crawl.progress->Add(entry);
+                    crawl.folders.push_back(entry.path);
+                }
+                crawl.busy--;
+                crawl.cv.notify_all();
+            }
+            crawl.cv.notify_all();
+        }
+
+        void CrawlThread(void *argp)
+        {
+            WorkerArg *arg = static_cast<WorkerArg *>(argp);
+            const JoinFn &join = *arg->crawl->join;
+            if (join && !join(arg->worker))
+                return;
+            CrawlLoop(*arg->crawl, arg->worker);
+        }
+
+        struct CachedTotals
+        {
+            std::string key;
+            Totals totals;
+            uint64_t storedAt = 0;
+            bool remote = false;
+        };
+
+        std::mutex cache_mutex;
+        std::vector<CachedTotals> cache;
+
+        bool Affects(const std::string &changed, const std::string &key)
+        {
+            if (key == changed)
+                return true;
+            // A folder holding the change, or one below it.
+            const std::string &shorter = key.size() < changed.size() ? key : changed;
+            const std::string &longer = key.size() < changed.size() ? changed : key;
+            return longer.compare(0, shorter.size(), shorter) == 0 &&
+                   (longer[shorter.size()] == '/' || shorter.back() == '/');
+        }
+    }
+
+    void Progress::Reset()
+    {
+        bytes = 0;
+        files = 0;
+        folders = 0;
+    }
+
+    void Progress::Add(const DirEntry &entry)
+    {
+        if (entry.isDir)
+        {
+            folders++;
+            return;
+        }
+        files++;
+        bytes += (int64_t)entry.file_size;
+    }
+
+    Totals Progress::Snapshot() const
+    {
+        Totals totals;
+        totals.bytes = bytes;
+        totals.files = files;
+        totals.folders = folders;
+        return totals;
+    }
+
+    bool Walk(const std::string &root, int workers, Threads::Role role, const ListFn &list, Progress &progress,
+              const JoinFn &join)
+    {
+        Crawl crawl;
+        crawl.list = &list;
+        crawl.join = &join;
+        crawl.progress = &progress;
+        crawl.folders.push_back(root);
+
+        uint64_t started = Util::GetTick();
+        std::vector<Thread> threads(workers > 1 ? workers - 1 : 0);
+        std::vector<WorkerArg> args(threads.size());
+        std::vector<bool> running(threads.size(), false);
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            args[i] = {&crawl, (int)i + 1};
+            ::Result rc = Threads::Create(&threads[i], CrawlThread, &args[i], 0x8000, role, "folder size");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_WARN, "FOLDER SIZE threadCreate failed rc=0x%x", rc);
+                break;
+            }
+            threadStart(&threads[i]);
+            running[i] = true;
+        }
+        CrawlLoop(crawl, 0);
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            if (running[i])
+                Threads::Join(&threads[i]);
+        }
+
+        bool ok = !crawl.failed && !progress.cancel;
+        Logger::Logf("FOLDER SIZE path=%s workers=%d files=%lld folders=%lld bytes=%lld ms=%llu ok=%d", root.c_str(),
+                     workers, (long long)progress.files, (long long)progress.folders, (long long)progress.bytes,
+                     (unsigned long long)((Util::GetTick() - started) / 1000), ok ? 1 : 0);
+        return ok;
+    }
+
+    bool Local(const std::string &path, int workers, Progress &progress)
+    {
+        return Walk(path, workers, Threads::ROLE_DISK, [](int worker, const std::string &folder, std::vector<DirEntry> &entries)
+                    {
+                        int err;
+                        entries = FS::ListDir(folder, &err);
+                        return err == 0;
+                    },
+                    progress);
+    }
+
+    std::string Key(const std::string &site, const std::string &path)
+    {
+        std::string folder = path;
+        while (folder.size() > 1 && folder.back() == '/')
+            folder.pop_back();
+        return site + folder;
+    }
+
+    bool Lookup(const std::string &key, Totals &out)
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        uint64_t now = Util::GetTick();
+        for (const CachedTotals &entry : cache)
+        {
+            if (entry.key != key)
+                continue;
+            if (entry.remote && now - entry.storedAt > kRemoteLifetimeUs)
+                return false;
+            out = entry.totals;
+            return true;
+        }
+        return false;
+    }
+
+    void Store(const std::string &key, const Totals &totals)
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        CachedTotals *slot = nullptr;
+        for (CachedTotals &entry : cache)
+        {
+            if (entry.key == key)
+                slot = &entry;
+        }
+        if (slot == nullptr && cache.size() < kCacheFolders)
+        {
+            cache.emplace_back();
+            slot = &cache.back();
+        }
+        if (slot == nullptr)
+        {
+            slot = &cache[0];
+            for (CachedTotals &entry : cache)
+            {
+                if (entry.storedAt < slot->storedAt)
+                    slot = &entry;
+            }
+        }
+        slot->key = key;
+        slot->totals = totals;
+        slot->storedAt = Util::GetTick();
+        slot->remote = !key.empty() && key[0] != '/';
+    }
+
+    void Invalidate(const std::string &site, const std::string &path)
+    {
+        std::string changed = Key(site, path);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (size_t i = 0; i < cache.size();)
+        {
+            if (Affects(changed, cache[i].key))
+            {
+                cache[i] = std::move(cache.back());
+                cache.pop_back();
+            }
+            else
+                i++;
+        }
+    }
+}
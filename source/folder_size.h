@@ -0,0 +1,69 @@
+#ifndef NEO_FOLDER_SIZE_H
+#define NEO_FOLDER_SIZE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "threads.h"
+
+// Total size of a folder tree, for the properties dialog and the transfer
+// progress. Trees are crawled breadth-first by a few workers sharing one
+// queue of folders, each listing through its own connection or straight
+// off the SD card; results are kept per folder so the transfer code can use
+// a size the dialog already worked out, and the other way round.
+namespace FolderSize
+{
+    static const size_t kCacheFolders = 64;
+    // Remote sizes are trusted this long, changes by other clients being
+    // invisible; local ones until the app itself changes the tree.
+    static const uint64_t kRemoteLifetimeUs = 5ULL * 60 * 1000 * 1000;
+
+    struct Totals
+    {
+        int64_t bytes = 0;
+        // -1 when the size came from the server without a listing.
+        int64_t files = 0;
+        int64_t folders = 0;
+    };
+
+    // Counted so far; read from the UI while a crawl runs.
+    struct Progress
+    {
+        std::atomic<int64_t> bytes{0};
+        std::atomic<int64_t> files{0};
+        std::atomic<int64_t> folders{0};
+        std::atomic<bool> cancel{false};
+
+        void Reset();
+        void Add(const DirEntry &entry);
+        Totals Snapshot() const;
+    };
+
+    // Lists one folder for crawl worker `worker` (0 .. workers-1). Returns
+    // false when the folder could not be listed.
+    using ListFn = std::function<bool(int worker, const std::string &path, std::vector<DirEntry> &entries)>;
+    // Run first on each worker thread, e.g. to connect it; the crawl goes
+    // on without a worker it returns false for.
+    using JoinFn = std::function<bool(int worker)>;
+
+    // Crawls everything below `root` on `workers` threads, the caller's
+    // being worker 0, into `progress`. Returns false when some folder could
+    // not be listed or the crawl was cancelled.
+    bool Walk(const std::string &root, int workers, Threads::Role role, const ListFn &list, Progress &progress,
+              const JoinFn &join = nullptr);
+    // Walk() of an SD card folder.
+    bool Local(const std::string &path, int workers, Progress &progress);
+
+    // Cache keys: the site's URL and the path, "" as site for the SD card.
+    std::string Key(const std::string &site, const std::string &path);
+    bool Lookup(const std::string &key, Totals &out);
+    void Store(const std::string &key, const Totals &totals);
+    // Forgets `path` of `site`, the folders holding it and those below it.
+    void Invalidate(const std::string &site, const std::string &path);
+}
+
+#endif
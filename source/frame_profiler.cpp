@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <string.h>
+#include <imgui.h>
+
+#include "frame_profiler.h"
+#include "config.h"
+#include "logger.h"
+#include "timeline.h"
+#include "util.h"
+
+namespace
+{
+    using FrameProfiler::kFrames;
+    using FrameProfiler::SECTION_COUNT;
+
+    const uint64_t kTimelineMinUs = 200;
+
+    const char *kNames[SECTION_COUNT] = {
+        "font atlas", "new frame", "input", "texture upload", "connection panel", "browser panel",
+        "status panel", "dialogs", "actions", "ImGui::Render", "draw data", "swap buffers"};
+
+    // The frame in progress is recorded only while the profiler was on at
+    // its start, so switching it on never yields half a frame.
+    bool recording = false;
+    uint64_t frame_start = 0;
+    uint32_t current[SECTION_COUNT];
+
+    // Per frame: the sections' microseconds and the whole frame's.
+    uint32_t history[kFrames][SECTION_COUNT + 1];
+    int next_frame = 0;
+    int frames = 0;
+    uint64_t last_hitch_log = 0;
+}
+
+namespace FrameProfiler
+{
+    void BeginFrame()
+    {
+        frame_start = Timeline::Enabled() || frame_profiler ? Util::GetTick() : 0;
+        if (!frame_profiler)
+        {
+            recording = false;
+            frames = 0;
+            next_frame = 0;
+            return;
+        }
+        recording = true;
+        memset(current, 0, sizeof(current));
+    }
+
+    void EndFrame()
+    {
+        uint64_t now = Util::GetTick();
+        if (frame_start != 0)
+            Timeline::Record("frame", frame_start, now);
+        if (!recording)
+            return;
+        recording = false;
+        uint32_t total = (uint32_t)(now - frame_start);
+        uint32_t *row = history[next_frame];
+        memcpy(row, current, sizeof(current));
+        row[SECTION_COUNT] = total;
+        next_frame = (next_frame + 1) % kFrames;
+        frames = std::min(frames + 1, kFrames);
+
+        // One line a second at most while it stutters.
+        if (total >= (uint32_t)kHitchMs * 1000 && frame_start - last_hitch_log >= 1000000)
+        {
+            last_hitch_log = frame_start;
+            int worst = (int)(std::max_element(current, current + SECTION_COUNT) - current);
+            Logger::Logf("FRAME hitch ms=%.1f section=\"%s\" section_ms=%.1f", total / 1000.0, kNames[worst],
+                         current[worst] / 1000.0);
+        }
+    }
+
+    void Draw()
+    {
+        if (!frame_profiler || frames == 0)
+            return;
+
+        // Oldest first for the graph; average and worst per section.
+        float graph[kFrames];
+        uint64_t sum[SECTION_COUNT + 1] = {0};
+        uint32_t worst[SECTION_COUNT + 1] = {0};
+        int first = (next_frame - frames + kFrames) % kFrames;
+        for (int i = 0; i < frames; i++)
+        {
+            const uint32_t *row = history[(first + i) % kFrames];
+            graph[i] = row[SECTION_COUNT] / 1000.0f;
+            for (int s = 0; s <= SECTION_COUNT; s++)
+            {
+                sum[s] += row[s];
+                worst[s] = std::max(worst[s], row[s]);
+            }
+        }
+        int order[SECTION_COUNT];
+        for (int s = 0; s < SECTION_COUNT; s++)
+            order[s] = s;
+        std::sort(order, order + SECTION_COUNT, [&](int a, int b)
+                  { return worst[a] > worst[b]; });
+
+        ImGui::SetNextWindowPos(ImVec2(10, 710), ImGuiCond_Always, ImVec2(0.0f, 1.0f));
+        ImGui::SetNextWindowBgAlpha(0.75f);
+        if (ImGui::Begin("##frame_profiler", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+                                                          ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoNav |
+                                                          ImGuiWindowFlags_NoFocusOnAppearing))
+        {
+            ImGui::Text("Frame %.2f ms avg, %.2f ms worst (%d frames)", sum[SECTION_COUNT] / 1000.0 / frames,
+                        worst[SECTION_COUNT] / 1000.0, frames);
+            ImGui::PlotLines("##frametimes", graph, frames, 0, nullptr, 0.0f, (float)kHitchMs, ImVec2(360, 60));
+            for (int i = 0; i < 5; i++)
+            {
+                int s = order[i];
+                ImGui::Text("%-16s %6.2f avg %6.2f worst", kNames[s], sum[s] / 1000.0 / frames, worst[s] / 1000.0);
+            }
+        }
+        ImGui::End();
+    }
+
+    Scope::Scope(Section section)
+        : section(section), start(recording || Timeline::Enabled() ? Util::GetTick() : 0)
+    {
+    }
+
+    Scope::~Scope()
+    {
+        if (start == 0)
+            return;
+        uint64_t now = Util::GetTick();
+        if (recording)
+            current[section] += (uint32_t)(now - start);
+        // Short sections would push the frames out of the UI's ring.
+        if (now - start >= kTimelineMinUs)
+            Timeline::Record(kNames[section], start, now);
+    }
+}
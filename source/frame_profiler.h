@@ -0,0 +1,56 @@
+#ifndef NEO_FRAME_PROFILER_H
+#define NEO_FRAME_PROFILER_H
+
+#include <cstdint>
+
+// Where the UI thread's frames go, with [Global] frame_profiler (also in
+// Settings). RenderLoop and MainWindow time their steps with Scope; the
+// last kFrames frames are kept and drawn as a frame-time graph with the
+// sections that took longest named beside it, so a hitch can be told
+// apart: a listing or sort run from ExecuteActions, a texture upload, the
+// font atlas swap, ImGui's own work or the GPU. Frames over kHitchMs are
+// logged with their slowest section. With timeline_trace the frames and
+// sections also go to the Timeline. UI thread only; off, a Scope costs a
+// branch.
+namespace FrameProfiler
+{
+    static const int kFrames = 240;
+    static const int kHitchMs = 50;
+
+    enum Section
+    {
+        SECTION_FONTS,
+        SECTION_NEW_FRAME,
+        SECTION_INPUT,
+        SECTION_TEXTURES,
+        SECTION_CONNECTION_PANEL,
+        SECTION_BROWSER_PANEL,
+        SECTION_STATUS_PANEL,
+        SECTION_DIALOGS,
+        SECTION_ACTIONS,
+        SECTION_RENDER,
+        SECTION_DRAW,
+        SECTION_SWAP,
+        SECTION_COUNT
+    };
+
+    void BeginFrame();
+    void EndFrame();
+    // The overlay; from MainWindow.
+    void Draw();
+
+    class Scope
+    {
+    public:
+        explicit Scope(Section section);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Section section;
+        uint64_t start;
+    };
+}
+
+#endif
@@ -6,10 +6,14 @@
 #include <dirent.h>
 #include <filesystem>
 #include <stdio.h>
+#include <sys/statvfs.h>
 
 #include "util.h"
 #include "lang.h"
 #include "windows.h"
+#include "local_copy.h"
+#include "local_scan.h"
+#include "cancel.h"
 
 namespace FS
 {
@@ -34,7 +38,8 @@ namespace FS
 
             char last = *ptr;
             *ptr = 0;
-            mkdir(path.c_str(), 0777);
+            if (mkdir(path.c_str(), 0777) == 0)
+                LocalScan::Invalidate(path);
             *ptr = last;
             ++ptr;
         }
@@ -43,11 +48,13 @@ namespace FS
     void Rm(const std::string &file)
     {
         remove(file.c_str());
+        LocalScan::Invalidate(file);
     }
 
     void RmDir(const std::string &path)
     {
         remove(path.c_str());
+        LocalScan::Invalidate(path);
     }
 
     int64_t GetSize(const std::string &path)
@@ -73,9 +80,20 @@ namespace FS
         return (stat(path.c_str(), &dir_stat) == 0);
     }
 
+    bool FreeSpace(const std::string &path, uint64_t *bytes)
+    {
+        struct statvfs st = {0};
+        if (statvfs(path.c_str(), &st) != 0)
+            return false;
+        *bytes = (uint64_t)st.f_bavail * st.f_frsize;
+        return true;
+    }
+
     bool Rename(const std::string &from, const std::string &to)
     {
         int res = rename(from.c_str(), to.c_str());
+        LocalScan::Invalidate(from);
+        LocalScan::Invalidate(to);
 
         return res == 0;
     }
@@ -83,6 +101,7 @@ namespace FS
     FILE *Create(const std::string &path)
     {
         FILE *fd = fopen(path.c_str(), "w");
+        LocalScan::Invalidate(path);
 
         return fd;
     }
@@ -90,6 +109,7 @@ namespace FS
     FILE *OpenRW(const std::string &path)
     {
         FILE *fd = fopen(path.c_str(), "w+");
+        LocalScan::Invalidate(path);
         return fd;
     }
 
@@ -102,6 +122,7 @@ namespace FS
     FILE *Append(const std::string &path)
     {
         FILE *fd = fopen(path.c_str(), "a");
+        LocalScan::Invalidate(path);
         return fd;
     }
 
@@ -155,39 +176,36 @@ namespace FS
         if (fd == nullptr)
             return false;
 
-        lines->clear();
+        std::vector<char> data;
+        char buffer[64 * 1024];
+        size_t bytes_read;
+        while ((bytes_read = fread(buffer, 1, sizeof(buffer), fd)) > 0)
+            data.insert(data.end(), buffer, buffer + bytes_read);
+        bool failed = ferror(fd);
+        fclose(fd);
+        if (failed)
+            return false;
 
-        char buffer[1024];
-        short bytes_read;
-        std::vector<char> line = std::vector<char>(0);
-        do
+        // Lines end in \n, \r\n or a lone \r.
+        lines->clear();
+        const char *from = data.data();
+        const char *end = from + data.size();
+        while (from < end)
         {
-            bytes_read = fread(buffer, sizeof(char), 1024, fd);
-            if (bytes_read < 0)
+            const char *newline = (const char *)memchr(from, '\n', end - from);
+            if (newline == nullptr)
+                newline = end;
+            const char *cr = (const char *)memchr(from, '\r', newline - from);
+            if (cr != nullptr)
             {
-                fclose(fd);
-                return false;
+                lines->emplace_back(from, cr);
+                from = (cr + 1 < end && cr[1] == '\n') ? cr + 2 : cr + 1;
+                continue;
             }
+            lines->emplace_back(from, newline);
+            from = newline < end ? newline + 1 : end;
+        }
 
-            for (short i = 0; i < bytes_read; i++)
-            {
-                if (buffer[i] != '\r' && buffer[i] != '\n')
-                {
-                    line.push_back(buffer[i]);
-                }
-                else
-                {
-                    lines->push_back(std::string(line.data(), line.size()));
-                    line = std::vector<char>(0);
-                    if (buffer[i] == '\r' && buffer[i+1] == '\n')
-                        i++;
-                }
-            }
-        } while (bytes_read == 1024);
-        if (line.size()>0)
-            lines->push_back(std::string(line.data(), line.size()));
- 
-        fclose(fd);
         if (lines->size() == 0)
             lines->push_back("");
         return true;
@@ -214,6 +232,7 @@ namespace FS
     void Save(const std::string &path, const void *data, uint32_t size)
     {
         FILE *fd = fopen(path.c_str(), "w+");
+        LocalScan::Invalidate(path);
         if (fd == nullptr)
             return;
 
@@ -229,9 +248,75 @@ namespace FS
         }
     }
 
-    std::vector<DirEntry> ListDir(const std::string &ppath, int *err)
+    static void FormatSize(DirEntry &entry)
+    {
+        if (entry.file_size < 1024)
+        {
+            sprintf(entry.display_size, "%lldB", entry.file_size);
+        }
+        else if (entry.file_size < 1024 * 1024)
+        {
+            sprintf(entry.display_size, "%.2fKB", entry.file_size * 1.0f / 1024);
+        }
+        else if (entry.file_size < 1024 * 1024 * 1024)
+        {
+            sprintf(entry.display_size, "%.2fMB", entry.file_size * 1.0f / (1024 * 1024));
+        }
+        else
+        {
+            sprintf(entry.display_size, "%.2fGB", entry.file_size * 1.0f / (1024 * 1024 * 1024));
+        }
+    }
+
+    static void StatEntry(DirEntry &entry)
+    {
+        struct stat file_stat = {0};
+        stat(entry.path, &file_stat);
+        struct tm tm = *localtime(&file_stat.st_mtim.tv_sec);
+        entry.modified.day = tm.tm_mday;
+        entry.modified.month = tm.tm_mon + 1;
+        entry.modified.year = tm.tm_year + 1900;
+        entry.modified.hours = tm.tm_hour;
+        entry.modified.minutes = tm.tm_min;
+        entry.modified.seconds = tm.tm_sec;
+        if (entry.isDir)
+            return;
+        entry.file_size = file_stat.st_size;
+        FormatSize(entry);
+    }
+
+    bool HasDetails(const DirEntry &entry)
+    {
+        // stat() dates are 1970 at the earliest; unknown ones stay zero.
+        return entry.modified.year != 0;
+    }
+
+    void EnsureDetails(DirEntry &entry)
+    {
+        if (!HasDetails(entry) && strcmp(entry.name, "..") != 0)
+            StatEntry(entry);
+    }
+
+    bool GetEntry(const std::string &directory, const std::string &name, DirEntry &entry)
+    {
+        memset(&entry, 0, sizeof(DirEntry));
+        entry.selectable = true;
+        snprintf(entry.directory, 512, "%s", directory.c_str());
+        snprintf(entry.name, 256, "%s", name.c_str());
+        snprintf(entry.path, sizeof(entry.path), "%s%s%s", directory.c_str(), hasEndSlash(directory.c_str()) ? "" : "/",
+                 name.c_str());
+        struct stat file_stat = {0};
+        if (stat(entry.path, &file_stat) != 0)
+            return false;
+        entry.isDir = S_ISDIR(file_stat.st_mode);
+        if (entry.isDir)
+            sprintf(entry.display_size, lang_strings[STR_FOLDER]);
+        StatEntry(entry);
+        return true;
+    }
+
+    bool ScanDir(const std::string &ppath, bool details, const DirEntryFn &on_entry)
     {
-        std::vector<DirEntry> out;
         DirEntry entry;
         std::string path = ppath;
 
@@ -242,82 +327,68 @@ namespace FS
         sprintf(entry.path, "%s", path.c_str());
         entry.file_size = 0;
         entry.isDir = true;
-        out.push_back(entry);
+        if (!on_entry(entry))
+            return true;
 
         DIR *fd = opendir(path.c_str());
-        *err = 0;
         if (fd == NULL)
-        {
-            *err = 1;
-            return out;
-        }
+            return false;
 
         while (true)
         {
-            struct dirent *dirent;
-            DirEntry entry;
-            entry.selectable = true;
-            dirent = readdir(fd);
+            struct dirent *dirent = readdir(fd);
             if (dirent == NULL)
+                break;
+
+            memset(&entry, 0, sizeof(DirEntry));
+            entry.selectable = true;
+            snprintf(entry.directory, 512, "%s", path.c_str());
+            snprintf(entry.name, 256, "%s", dirent->d_name);
+
+            if (hasEndSlash(path.c_str()))
             {
-                closedir(fd);
-                return out;
+                sprintf(entry.path, "%s%s", path.c_str(), dirent->d_name);
             }
             else
             {
-                snprintf(entry.directory, 512, "%s", path.c_str());
-                snprintf(entry.name, 256, "%s", dirent->d_name);
+                sprintf(entry.path, "%s/%s", path.c_str(), dirent->d_name);
+            }
 
-                if (hasEndSlash(path.c_str()))
-                {
-                    sprintf(entry.path, "%s%s", path.c_str(), dirent->d_name);
-                }
-                else
-                {
-                    sprintf(entry.path, "%s/%s", path.c_str(), dirent->d_name);
-                }
+            // d_type says what the entry is without touching its own
+            // directory record; only sizes and dates need stat().
+            bool known = dirent->d_type != DT_UNKNOWN;
+            if (!known)
+            {
                 struct stat file_stat = {0};
                 stat(entry.path, &file_stat);
-                struct tm tm = *localtime(&file_stat.st_mtim.tv_sec);
-                entry.modified.day = tm.tm_mday;
-                entry.modified.month = tm.tm_mon + 1;
-                entry.modified.year = tm.tm_year + 1900;
-                entry.modified.hours = tm.tm_hour;
-                entry.modified.minutes = tm.tm_min;
-                entry.modified.seconds = tm.tm_sec;
-                entry.file_size = file_stat.st_size;
-
-                if (dirent->d_type & DT_DIR)
-                {
-                    entry.isDir = true;
-                    entry.file_size = 0;
-                    sprintf(entry.display_size, lang_strings[STR_FOLDER]);
-                }
-                else
-                {
-                    if (entry.file_size < 1024)
-                    {
-                        sprintf(entry.display_size, "%lldB", entry.file_size);
-                    }
-                    else if (entry.file_size < 1024 * 1024)
-                    {
-                        sprintf(entry.display_size, "%.2fKB", entry.file_size * 1.0f / 1024);
-                    }
-                    else if (entry.file_size < 1024 * 1024 * 1024)
-                    {
-                        sprintf(entry.display_size, "%.2fMB", entry.file_size * 1.0f / (1024 * 1024));
-                    }
-                    else
-                    {
-                        sprintf(entry.display_size, "%.2fGB", entry.file_size * 1.0f / (1024 * 1024 * 1024));
-                    }
-                    entry.isDir = false;
-                }
-                out.push_back(entry);
+                entry.isDir = S_ISDIR(file_stat.st_mode);
             }
+            else
+            {
+                entry.isDir = (dirent->d_type & DT_DIR) != 0;
+            }
+            if (entry.isDir)
+                sprintf(entry.display_size, lang_strings[STR_FOLDER]);
+            if (details || !known)
+                StatEntry(entry);
+
+            if (!on_entry(entry))
+                break;
         }
         closedir(fd);
+        return true;
+    }
 
+    std::vector<DirEntry> ListDir(const std::string &path, int *err, bool details)
+    {
+        std::vector<DirEntry> out;
+        *err = ScanDir(path, details, [&out](const DirEntry &entry)
+                       {
+                           out.push_back(entry);
+                           return true;
+                       })
+                   ? 0
+                   : 1;
         return out;
     }
 
@@ -358,9 +429,11 @@ namespace FS
 
     int RmRecursive(const std::string &path)
     {
-        if (stop_activity)
+        if (Cancel::Stopped())
             return 1;
-        
+        // Covers the folder and everything below it.
+        LocalScan::Invalidate(path);
+
         DIR *dfd = opendir(path.c_str());
         if (dfd != NULL)
         {
@@ -397,11 +470,11 @@ namespace FS
                         return ret;
                     }
                 }
-            } while (dir != NULL && !stop_activity);
+            } while (dir != NULL && !Cancel::Stopped());
 
             closedir(dfd);
 
-            if (stop_activity)
+            if (Cancel::Stopped())
                 return 0;
 
             int ret = rmdir(path.c_str());
@@ -452,59 +525,23 @@ namespace FS
     bool Copy(const std::string &from, const std::string &to)
     {
         MkDirs(to, true);
-        FILE *src = OpenRead(from);
-        if (!src)
-        {
-            return false;
-        }
-
+        LocalScan::Invalidate(to);
         bytes_to_download = GetSize(from);
-
-        FILE *dest = Create(to);
-        if (!dest)
-        {
-            Close(src);
-            return false;
-        }
-
-        size_t bytes_read = 0;
         bytes_transfered = 0;
         prev_tick = Util::GetTick();
-        const size_t buf_size = 0x10000;
-        unsigned char *buf = new unsigned char[buf_size];
-
-        do
-        {
-            bytes_read = Read(src, buf, buf_size);
-            if (bytes_read < 0)
-            {
-                delete[] buf;
-                Close(src);
-                Close(dest);
-                return false;
-            }
-
-            size_t bytes_written = Write(dest, buf, bytes_read);
-            if (bytes_written != bytes_read)
-            {
-                delete[] buf;
-                Close(src);
-                Close(dest);
-                return false;
-            }
-
-            bytes_transfered += bytes_read;
-        } while (bytes_transfered < bytes_to_download);
-
-        delete[] buf;
-        Close(src);
-        Close(dest);
-        return true;
+        return LocalCopy::CopyFile(from, to);
     }
 
     bool Move(const std::string &from, const std::string &to)
     {
-        return Rename(from, to);
+        if (Rename(from, to))
+            return true;
+
+        // Rename fails across mounts (sdmc and usb); fall back to copying.
+        if (!Copy(from, to))
+            return false;
+        Rm(from);
+        return true;
     }
 
     std::string GetFileExt(const std::string &filename) {
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <string>
 #include <vector>
+#include <functional>
 
 #include <cstdint>
 #define MAX_PATH_LENGTH 1024
@@ -23,6 +24,8 @@ namespace FS
 
     bool FileExists(const std::string &path);
     bool FolderExists(const std::string &path);
+    // Free bytes on the file system holding `path`.
+    bool FreeSpace(const std::string &path, uint64_t *bytes);
 
     bool Rename(const std::string &from, const std::string &to);
 
@@ -48,7 +51,21 @@ namespace FS
     void Save(const std::string &path, const void *data, uint32_t size);
 
     std::vector<std::string> ListFiles(const std::string &path);
-    std::vector<DirEntry> ListDir(const std::string &path, int *err);
+    // Folders are told from files by readdir's d_type. Without `details`
+    // files are not stat()ed: their size and date stay unknown until
+    // EnsureDetails().
+    std::vector<DirEntry> ListDir(const std::string &path, int *err, bool details = true);
+    // ListDir() one entry at a time, ".." first; `on_entry` returns false
+    // to stop. Returns false when the folder cannot be opened.
+    using DirEntryFn = std::function<bool(const DirEntry &entry)>;
+    bool ScanDir(const std::string &path, bool details, const DirEntryFn &on_entry);
+    // Whether `entry` carries its size and date.
+    bool HasDetails(const DirEntry &entry);
+    // stat()s an entry ListDir() left without details.
+    void EnsureDetails(DirEntry &entry);
+    // `name` in `directory` as ListDir() lists it with details; false when
+    // it does not exist.
+    bool GetEntry(const std::string &directory, const std::string &name, DirEntry &entry);
 
     void Sort(std::vector<DirEntry> &list);
 
@@ -3,8 +3,17 @@
 #include <glad/glad.h>
 #include <stdio.h>
 #include <switch.h>
+#include <atomic>
 #include "windows.h"
 #include "gui.h"
+#include "thumbnails.h"
+#include "image_prefetch.h"
+#include "util.h"
+#include "frame_profiler.h"
+#include "logger.h"
+#include "metrics.h"
+#include "threads.h"
+#include "power.h"
 
 bool done = false;
 int gui_mode = GUI_MODE_BROWSER;
@@ -153,101 +162,89 @@ namespace GUI
 		style.Colors[ImGuiCol_PopupBg] = ImVec4( 33.f / 255.f, 46.f / 255.f, 60.f / 255.f, 0.92f );
 	}
 
-	bool Init(FontType fontType)
+	// The Nintendo shared fonts, mapped once; atlases only point at them.
+	static PlFontData standard, extended, s_chinese, s_chinese_ext, t_chinese, korean;
+	static const ImWchar extended_range[] = {0xe000, 0xe152, 0};
+	static const ImWchar others[] = {
+		0x0020, 0x00FF, // Basic Latin + Latin Supplement
+		0x0100, 0x024F, // Latin Extended
+		0x0370, 0x03FF, // Greek
+		0x0400, 0x052F, // Cyrillic + Cyrillic Supplement
+		0x0590, 0x05FF, // Hebrew
+		0x1E00, 0x1EFF, // Latin Extended Additional
+		0x1F00, 0x1FFF, // Greek Extended
+		0x2000, 0x206F, // General Punctuation
+		0x2100, 0x214F, // Letterlike Symbols
+		0x2460, 0x24FF, // Enclosed Alphanumerics
+		0x2DE0, 0x2DFF, // Cyrillic Extended-A
+		0x31F0, 0x31FF, // Katakana Phonetic Extensions
+		0xA640, 0xA69F, // Cyrillic Extended-B
+		0xFF00, 0xFFEF, // Half-width characters
+		0,
+	};
+	static const ImWchar symbols[] = {
+		0x2000, 0x206F, // General Punctuation
+		0x2100, 0x214F, // Letterlike Symbols
+		0x2460, 0x24FF, // Enclosed Alphanumerics
+		0,
+	};
+	static const ImWchar simplified_chinese[] = {
+		// All languages with chinese included
+		0x3400, 0x4DBF, // CJK Rare
+		0x4E00, 0x9FFF, // CJK Ideograms
+		0xF900, 0xFAFF, // CJK Compatibility Ideographs
+		0,
+	};
+
+	static const ImWchar arabic[] = { // Arabic
+		0x0020, 0x00FF, // Basic Latin + Latin Supplement
+		0x0100, 0x024F, // Latin Extended
+		0x0400, 0x052F, // Cyrillic + Cyrillic Supplement
+		0x1E00, 0x1EFF, // Latin Extended Additional
+		0x2000, 0x206F, // General Punctuation
+		0x2100, 0x214F, // Letterlike Symbols
+		0x2460, 0x24FF, // Enclosed Alphanumerics
+		0x0600, 0x06FF, // Arabic
+		0x0750, 0x077F, // Arabic Supplement
+		0x0870, 0x089F, // Arabic Extended-B
+		0x08A0, 0x08FF, // Arabic Extended-A
+		0xFB50, 0xFDFF, // Arabic Presentation Forms-A
+		0xFE70, 0xFEFF, // Arabic Presentation Forms-B
+		0,
+	};
+
+	static const ImWchar fa_icons[] {
+		0xF07B, 0xF07B, // folder
+		0xF65E, 0xF65E, // new folder
+		0xF15B, 0xF15B, // file
+		0xF021, 0xF021, // refresh
+		0xF0CA, 0xF0CA, // select all
+		0xF0C9, 0xF0C9, // unselect all
+		0x2700, 0x2700, // cut
+		0xF0C5, 0xF0C5, // copy
+		0xF0EA, 0xF0EA, // paste
+		0xF31C, 0xF31C, // edit
+		0xE0AC, 0xE0AC, // rename
+		0xE5A1, 0xE5A1, // delete
+		0xF002, 0xF002, // search
+		0xF013, 0xF013, // settings
+		0xF625, 0xF625, // site benchmark
+		0xF0ED, 0xF0ED, // download
+		0xF0EE, 0xF0EE, // upload
+		0xF56E, 0xF56E, // extract
+		0xF56F, 0xF56F, // compress
+		0xF0F6, 0xF0F6, // properties
+		0xF112, 0xF112, // cancel
+		0xF0DA, 0xF0DA, // arrow right
+		0x0031, 0x0031, // 1
+		0x004C, 0x004C, // L
+		0x0052, 0x0052, // R
+		0,
+	};
+
+
+	static bool LoadSharedFonts(FontType fontType)
 	{
-		IMGUI_CHECKVERSION();
-		ImGui::CreateContext();
-		ImGuiIO &io = ImGui::GetIO(); (void)io;
-		io.Fonts->Clear();
-
-		io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
-
-		if (!GUI::InitEGL(nwindowGetDefault()))
-			return false;
-
-		gladLoadGL();
-
-		ImGui_ImplSwitch_Init("#version 130");
-
-		// Load nintendo font
-		PlFontData standard, extended, s_chinese, s_chinese_ext, t_chinese, korean;
-		ImWchar extended_range[] = {0xe000, 0xe152};
-		ImWchar others[] = {
-			0x0020, 0x00FF, // Basic Latin + Latin Supplement
-			0x0100, 0x024F, // Latin Extended
-			0x0370, 0x03FF, // Greek
-			0x0400, 0x052F, // Cyrillic + Cyrillic Supplement
-			0x0590, 0x05FF, // Hebrew
-			0x1E00, 0x1EFF, // Latin Extended Additional
-			0x1F00, 0x1FFF, // Greek Extended
-			0x2000, 0x206F, // General Punctuation
-			0x2100, 0x214F, // Letterlike Symbols
-			0x2460, 0x24FF, // Enclosed Alphanumerics
-			0x2DE0, 0x2DFF, // Cyrillic Extended-A
-			0x31F0, 0x31FF, // Katakana Phonetic Extensions
-			0xA640, 0xA69F, // Cyrillic Extended-B
-			0xFF00, 0xFFEF, // Half-width characters
-			0,
-		};
-		ImWchar symbols[] = {
-			0x2000, 0x206F, // General Punctuation
-			0x2100, 0x214F, // Letterlike Symbols
-			0x2460, 0x24FF, // Enclosed Alphanumerics
-			0,
-		};
-		ImWchar simplified_chinese[] = {
-			// All languages with chinese included
-			0x3400, 0x4DBF, // CJK Rare
-			0x4E00, 0x9FFF, // CJK Ideograms
-			0xF900, 0xFAFF, // CJK Compatibility Ideographs
-			0,
-		};
-
-		const ImWchar arabic[] = { // Arabic
-			0x0020, 0x00FF, // Basic Latin + Latin Supplement
-			0x0100, 0x024F, // Latin Extended
-			0x0400, 0x052F, // Cyrillic + Cyrillic Supplement
-			0x1E00, 0x1EFF, // Latin Extended Additional
-			0x2000, 0x206F, // General Punctuation
-			0x2100, 0x214F, // Letterlike Symbols
-			0x2460, 0x24FF, // Enclosed Alphanumerics
-			0x0600, 0x06FF, // Arabic
-			0x0750, 0x077F, // Arabic Supplement
-			0x0870, 0x089F, // Arabic Extended-B
-			0x08A0, 0x08FF, // Arabic Extended-A
-			0xFB50, 0xFDFF, // Arabic Presentation Forms-A
-			0xFE70, 0xFEFF, // Arabic Presentation Forms-B
-			0,
-		};
-
-		static const ImWchar fa_icons[] {
-			0xF07B, 0xF07B, // folder
-			0xF65E, 0xF65E, // new folder
-			0xF15B, 0xF15B, // file
-			0xF021, 0xF021, // refresh
-			0xF0CA, 0xF0CA, // select all
-			0xF0C9, 0xF0C9, // unselect all
-			0x2700, 0x2700, // cut
-			0xF0C5, 0xF0C5, // copy
-			0xF0EA, 0xF0EA, // paste
-			0xF31C, 0xF31C, // edit
-			0xE0AC, 0xE0AC, // rename
-			0xE5A1, 0xE5A1, // delete
-			0xF002, 0xF002, // search
-			0xF013, 0xF013, // settings
-			0xF0ED, 0xF0ED, // download
-			0xF0EE, 0xF0EE, // upload
-			0xF56E, 0xF56E, // extract
-			0xF56F, 0xF56F, // compress
-			0xF0F6, 0xF0F6, // properties
-			0xF112, 0xF112, // cancel
-			0xF0DA, 0xF0DA, // arrow right
-			0x0031, 0x0031, // 1
-			0x004C, 0x004C, // L
-			0x0052, 0x0052, // R
-			0,
-		};
-	
 		bool ok = R_SUCCEEDED(plGetSharedFontByType(&standard, PlSharedFontType_Standard)) &&
 				  R_SUCCEEDED(plGetSharedFontByType(&extended, PlSharedFontType_NintendoExt));
 
@@ -268,70 +265,167 @@ namespace GUI
 			ok = ok && R_SUCCEEDED(plGetSharedFontByType(&korean, PlSharedFontType_KO));
 		}
 
-		IM_ASSERT(ok);
+		return ok;
+	}
 
-		u8 *px = nullptr;
-		int w = 0, h = 0, bpp = 0;
+	// Adds the fonts for the glyphs `fontType` needs; FONT_TYPE_LATIN is
+	// the base every language starts from.
+	static void AddFonts(ImFontAtlas *atlas, FontType fontType)
+	{
 		ImFontConfig font_cfg;
-
 		font_cfg.FontDataOwnedByAtlas = false;
-		io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, others);
+		atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, others);
 		font_cfg.MergeMode = true;
-		io.Fonts->AddFontFromMemoryTTF(extended.address, extended.size, 18.0f, &font_cfg, extended_range);
-		io.Fonts->AddFontFromFileTTF("romfs:/lang/fa-solid-900.ttf", 18.0f, &font_cfg, fa_icons);
+		atlas->AddFontFromMemoryTTF(extended.address, extended.size, 18.0f, &font_cfg, extended_range);
+		atlas->AddFontFromFileTTF("romfs:/lang/fa-solid-900.ttf", 18.0f, &font_cfg, fa_icons);
 
 		if (fontType & FONT_TYPE_SIMPLIFIED_CHINESE)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromMemoryTTF(s_chinese.address, s_chinese.size, 18.0f, &font_cfg, simplified_chinese);
-			io.Fonts->AddFontFromMemoryTTF(s_chinese_ext.address, s_chinese_ext.size, 18.0f, &font_cfg, simplified_chinese);
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromMemoryTTF(s_chinese.address, s_chinese.size, 18.0f, &font_cfg, simplified_chinese);
+			atlas->AddFontFromMemoryTTF(s_chinese_ext.address, s_chinese_ext.size, 18.0f, &font_cfg, simplified_chinese);
 		}
 
 		if (fontType & FONT_TYPE_TRADITIONAL_CHINESE)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromMemoryTTF(t_chinese.address, t_chinese.size, 18.0f, &font_cfg, io.Fonts->GetGlyphRangesChineseFull());
-			io.Fonts->AddFontFromMemoryTTF(s_chinese_ext.address, s_chinese_ext.size, 18.0f, &font_cfg, simplified_chinese);
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromMemoryTTF(t_chinese.address, t_chinese.size, 18.0f, &font_cfg, atlas->GetGlyphRangesChineseFull());
+			atlas->AddFontFromMemoryTTF(s_chinese_ext.address, s_chinese_ext.size, 18.0f, &font_cfg, simplified_chinese);
 		}
 
 		if (fontType & FONT_TYPE_KOREAN)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromMemoryTTF(korean.address, korean.size, 18.0f, &font_cfg, io.Fonts->GetGlyphRangesKorean());
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromMemoryTTF(korean.address, korean.size, 18.0f, &font_cfg, atlas->GetGlyphRangesKorean());
 		}
 
 		if (fontType & FONT_TYPE_JAPANESE)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, io.Fonts->GetGlyphRangesJapanese());
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, atlas->GetGlyphRangesJapanese());
 		}
 
 		if (fontType & FONT_TYPE_THAI)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, io.Fonts->GetGlyphRangesThai());
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, atlas->GetGlyphRangesThai());
 		}
 
 		if (fontType & FONT_TYPE_ARABIC)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, arabic);
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, arabic);
 		}
 
 		if (fontType & FONT_TYPE_VIETNAMESE)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, io.Fonts->GetGlyphRangesVietnamese());
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, atlas->GetGlyphRangesVietnamese());
 		}
 
 		if (fontType & FONT_TYPE_GREEK)
 		{
-			io.Fonts->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
-			io.Fonts->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, io.Fonts->GetGlyphRangesGreek());
+			atlas->AddFontFromMemoryTTF(standard.address, standard.size, 18.0f, &font_cfg, symbols);
+			atlas->AddFontFromFileTTF("romfs:/lang/Roboto_ext.ttf", 18.0f, &font_cfg, atlas->GetGlyphRangesGreek());
 		}
 
-		io.Fonts->Flags |= ImFontAtlasFlags_NoPowerOfTwoHeight;
+		atlas->Flags |= ImFontAtlasFlags_NoPowerOfTwoHeight;
+	}
+
+	// The atlas of io.Fonts as GAUGE_MEM_FONTS: its alpha and RGBA pixels,
+	// which ImGui keeps after the upload, and the texture made from them.
+	static void AccountFonts()
+	{
+		ImFontAtlas *atlas = ImGui::GetIO().Fonts;
+		int64_t pixels = static_cast<int64_t>(atlas->TexWidth) * atlas->TexHeight;
+		Metrics::Set(Metrics::GAUGE_MEM_FONTS, pixels * (1 + 4 + 4));
+	}
+
+	// The full atlas of a CJK, Thai, Arabic, ... language is rasterised here
+	// while the first frames show the Latin one.
+	static Thread font_thread;
+	static bool font_thread_started = false;
+	static ImFontAtlas *full_atlas = nullptr;
+	static std::atomic<bool> full_atlas_ready{false};
+
+	static void BuildFullAtlas(void *arg)
+	{
+		uint64_t start = Util::GetTick();
+		full_atlas->Build();
+		Logger::Logf("STARTUP fonts full_ms=%llu", (unsigned long long)((Util::GetTick() - start) / 1000));
+		full_atlas_ready.store(true);
+	}
+
+	// Swaps in the full atlas once it is built; between frames only.
+	static void SwapFontAtlas()
+	{
+		if (!font_thread_started || !full_atlas_ready.load())
+			return;
+		Threads::Join(&font_thread);
+		font_thread_started = false;
+		plExit();
+
+		ImGuiIO &io = ImGui::GetIO();
+		ImGui_ImplSwitch_DestroyFontsTexture();
+		ImFontAtlas *base = io.Fonts;
+		// The context owns io.Fonts and deletes the full atlas on exit.
+		io.Fonts = full_atlas;
+		full_atlas = nullptr;
+		IM_DELETE(base);
+		ImGui_ImplSwitch_CreateFontsTexture();
+		AccountFonts();
+	}
+
+	bool Init(FontType fontType)
+	{
+		IMGUI_CHECKVERSION();
+		ImGui::CreateContext();
+		ImGuiIO &io = ImGui::GetIO(); (void)io;
+		io.Fonts->Clear();
+
+		io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
+
+		if (!GUI::InitEGL(nwindowGetDefault()))
+			return false;
+
+		gladLoadGL();
+
+		ImGui_ImplSwitch_Init("#version 130");
+
+		uint64_t start = Util::GetTick();
+		bool ok = GUI::LoadSharedFonts(fontType);
+		IM_ASSERT(ok);
+
+		// Latin, the symbols and the icons rasterise in a few milliseconds
+		// and are all the first frame needs. Anything more comes from a
+		// second atlas built in the background.
+		GUI::AddFonts(io.Fonts, FONT_TYPE_LATIN);
 		io.Fonts->Build();
+		Logger::Logf("STARTUP fonts base_ms=%llu", (unsigned long long)((Util::GetTick() - start) / 1000));
+
+		if ((fontType & ~FONT_TYPE_LATIN) != 0)
+		{
+			full_atlas = IM_NEW(ImFontAtlas)();
+			GUI::AddFonts(full_atlas, fontType);
+			if (R_SUCCEEDED(Threads::Create(&font_thread, BuildFullAtlas, nullptr, 0x40000, Threads::ROLE_COMPUTE, "font atlas")))
+			{
+				font_thread_started = true;
+				threadStart(&font_thread);
+			}
+			else
+			{
+				// Built here instead, on a slower start.
+				full_atlas->Build();
+				ImFontAtlas *base = io.Fonts;
+				io.Fonts = full_atlas;
+				full_atlas = nullptr;
+				IM_DELETE(base);
+				plExit();
+			}
+		}
+		else
+			plExit();
+		AccountFonts();
 
 		GUI::SetDefaultTheme();
 		return true;
@@ -342,6 +436,13 @@ namespace GUI
 		if (!appletMainLoop())
             return false;
 
+		// Frames are drawn at the display rate only while the controls are
+		// in use or an action runs; otherwise at the rate Windows::FrameRate()
+		// asks for, leaving the cores to the transfer and crypto threads.
+		static const uint64_t kInputLingerUs = 500000;
+		uint64_t last_frame = 0;
+		uint64_t last_input = 0;
+
 		Windows::Init();
 		while (!done)
 		{
@@ -349,32 +450,83 @@ namespace GUI
 
 			if (gui_mode == GUI_MODE_BROWSER)
 			{
-				up = ImGui_ImplSwitch_NewFrame();
-				ImGui::NewFrame();
-
-				Windows::HandleWindowInput(up);
+				uint64_t now = Util::GetTick();
+				if (ImGui_ImplSwitch_InputActive())
+				{
+					last_input = now;
+					Power::NoteInput();
+				}
+				int fps = now - last_input < kInputLingerUs ? 60 : Windows::FrameRate();
+				if (fps < 60 && now - last_frame < 1000000 / fps)
+				{
+					svcSleepThread(1000000000ULL / 60);
+					continue;
+				}
+				last_frame = now;
+				FrameProfiler::BeginFrame();
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_FONTS);
+					GUI::SwapFontAtlas();
+				}
+
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_NEW_FRAME);
+					up = ImGui_ImplSwitch_NewFrame();
+					ImGui::NewFrame();
+				}
+
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_INPUT);
+					Windows::HandleWindowInput(up);
+				}
 				Windows::MainWindow();
-				Windows::ExecuteActions();
-
-				ImGui::Render();
-
-				ImGuiIO &io = ImGui::GetIO(); (void)io;
-				glViewport(0, 0, static_cast<int>(io.DisplaySize.x), static_cast<int>(io.DisplaySize.y));
-				glClearColor(0.00f, 0.00f, 0.00f, 1.00f);
-				glClear(GL_COLOR_BUFFER_BIT);
-				ImGui_ImplSwitch_RenderDrawData(ImGui::GetDrawData());
-				GUI::SwapBuffers();
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_ACTIONS);
+					Windows::ExecuteActions();
+				}
+
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_RENDER);
+					ImGui::Render();
+				}
+
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_DRAW);
+					ImGuiIO &io = ImGui::GetIO(); (void)io;
+					glViewport(0, 0, static_cast<int>(io.DisplaySize.x), static_cast<int>(io.DisplaySize.y));
+					glClearColor(0.00f, 0.00f, 0.00f, 1.00f);
+					glClear(GL_COLOR_BUFFER_BIT);
+					ImGui_ImplSwitch_RenderDrawData(ImGui::GetDrawData());
+				}
+				{
+					FrameProfiler::Scope scope(FrameProfiler::SECTION_SWAP);
+					GUI::SwapBuffers();
+				}
+				FrameProfiler::EndFrame();
 			}
 			else if (gui_mode == GUI_MODE_IME)
 			{
 				Windows::HandleImeInput();
 			}
 		}
+		Thumbnails::Exit();
+		ImagePrefetch::Exit();
 
 		return 0;
 	}
 
     void Exit(void) {
+        if (font_thread_started)
+        {
+            Threads::Join(&font_thread);
+            font_thread_started = false;
+            plExit();
+        }
+        if (full_atlas != nullptr)
+        {
+            IM_DELETE(full_atlas);
+            full_atlas = nullptr;
+        }
         ImGui_ImplSwitch_Shutdown();
         GUI::ExitEGL();
     }
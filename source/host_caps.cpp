@@ -0,0 +1,72 @@
+#include <map>
+#include <mutex>
+
+#include "host_caps.h"
+#include "logger.h"
+
+namespace
+{
+    std::mutex mutex;
+    std::map<std::string, HostCaps::Caps> hosts;
+
+    std::string Key(const std::string &url)
+    {
+        size_t scheme = url.find("://");
+        size_t start = (scheme == std::string::npos) ? 0 : scheme + 3;
+        size_t end = url.find_first_of("/?#", start);
+        std::string key = url.substr(0, end);
+        // Credentials in the URL are not part of the host.
+        size_t at = key.rfind('@');
+        if (at != std::string::npos && at >= start)
+            key.erase(start, at + 1 - start);
+        return key;
+    }
+}
+
+namespace HostCaps
+{
+    Caps Get(const std::string &url)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = hosts.find(Key(url));
+        return it != hosts.end() ? it->second : Caps();
+    }
+
+    void Learn(const std::string &url, int Caps::*field, int value)
+    {
+        std::string key = Key(url);
+        std::lock_guard<std::mutex> lock(mutex);
+        Caps &caps = hosts[key];
+        if (caps.*field == value)
+            return;
+        caps.*field = value;
+        Logger::Logf("HOSTCAPS host=%s range=%d head=%d http2=%d depth_infinity=%d search=%d json_listing=%d "
+                     "multirange=%d ranged_put=%d max_parallel=%d h3=%d",
+                     key.c_str(), caps.range, caps.head, caps.http2, caps.depth_infinity, caps.search,
+                     caps.json_listing, caps.multirange, caps.ranged_put, caps.max_parallel, caps.h3);
+    }
+
+    void Seed(const std::string &url, const Caps &stored)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Caps &caps = hosts[Key(url)];
+        if (caps.range < 0)
+            caps.range = stored.range;
+        if (caps.head < 0)
+            caps.head = stored.head;
+        if (caps.http2 < 0)
+            caps.http2 = stored.http2;
+        if (caps.depth_infinity < 0)
+            caps.depth_infinity = stored.depth_infinity;
+        if (caps.search < 0)
+            caps.search = stored.search;
+        if (caps.json_listing < 0)
+            caps.json_listing = stored.json_listing;
+        if (caps.multirange < 0)
+            caps.multirange = stored.multirange;
+        if (caps.ranged_put < 0)
+            caps.ranged_put = stored.ranged_put;
+        if (caps.max_parallel <= 0)
+            caps.max_parallel = stored.max_parallel;
+    }
+}
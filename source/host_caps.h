@@ -0,0 +1,56 @@
+#ifndef NEO_HOST_CAPS_H
+#define NEO_HOST_CAPS_H
+
+#include <string>
+
+// What each WebDAV/HTTP host turned out to support, so the probes a
+// transfer would start with run once per host instead of once per file:
+// whether Range gets a 206, whether HEAD reports sizes, whether ranges came
+// over HTTP/2, whether PROPFIND takes Depth: infinity, whether SEARCH
+// (RFC 5323 basicsearch) works, whether the index page comes as JSON
+// (nginx autoindex_format json, npx serve, rclone serve), whether several
+// ranges in one request come back as multipart/byteranges, whether a PUT
+// with Content-Range writes at that offset (Apache mod_dav), and how many
+// requests in flight it takes before answering 429/503. The site's own
+// host is seeded from its settings and saved back to them
+// (CONFIG::SaveSiteCaps), so the next session starts on the fast path;
+// other hosts, like redirect targets, are kept until the app exits.
+namespace HostCaps
+{
+    // -1 unknown, 0 no, 1 yes; max_parallel is 0 when unknown.
+    struct Caps
+    {
+        int range = -1;
+        int head = -1;
+        int http2 = -1;
+        int depth_infinity = -1;
+        int search = -1;
+        int json_listing = -1;
+        int multirange = -1;
+        int ranged_put = -1;
+        int max_parallel = 0;
+        // Whether the host advertised HTTP/3 (Alt-Svc: h3) or answered over
+        // it; 0 once a QUIC connection to it failed. Kept for the session
+        // only and left out of ==, so a network that drops UDP today does
+        // not turn HTTP/3 off for the site for good.
+        int h3 = -1;
+
+        bool operator==(const Caps &other) const
+        {
+            return range == other.range && head == other.head && http2 == other.http2 &&
+                   depth_infinity == other.depth_infinity && search == other.search &&
+                   json_listing == other.json_listing && multirange == other.multirange &&
+                   ranged_put == other.ranged_put && max_parallel == other.max_parallel;
+        }
+        bool operator!=(const Caps &other) const { return !(*this == other); }
+    };
+
+    // Keyed by the scheme, host and port of `url`.
+    Caps Get(const std::string &url);
+    // Sets one field, e.g. Learn(url, &Caps::range, 1).
+    void Learn(const std::string &url, int Caps::*field, int value);
+    // Fills what this session has not learned yet from stored `caps`.
+    void Seed(const std::string &url, const Caps &caps);
+}
+
+#endif
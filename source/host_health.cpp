@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <curl/curl.h>
+
+#include "host_health.h"
+#include "config.h"
+#include "logger.h"
+#include "util.h"
+
+namespace
+{
+    // Each outcome moves the rates a tenth of the way, so about the last
+    // ten requests count.
+    const double kWeight = 0.1;
+    // Too few requests say nothing about the host.
+    const int kMinSamples = 8;
+    const double kEaseRate = 0.15;
+    const double kOpenRate = 0.4;
+
+    struct Health
+    {
+        double errors = 0.0;
+        double resets = 0.0;
+        int samples = 0;
+        uint64_t holdUntil = 0;
+        uint64_t openUntil = 0;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Health> hosts;
+
+    std::string Key(const std::string &url)
+    {
+        size_t scheme = url.find("://");
+        size_t start = (scheme == std::string::npos) ? 0 : scheme + 3;
+        size_t end = url.find_first_of("/?#", start);
+        std::string key = url.substr(0, end);
+        size_t at = key.rfind('@');
+        if (at != std::string::npos && at >= start)
+            key.erase(start, at + 1 - start);
+        return key;
+    }
+
+    // Called with the lock held; a breaker whose time is up closes with a
+    // clean record, and the next errors have to earn it again.
+    Health &Lookup(const std::string &key, uint64_t now)
+    {
+        Health &health = hosts[key];
+        if (health.openUntil != 0 && now >= health.openUntil)
+        {
+            uint64_t hold = health.holdUntil;
+            health = Health();
+            health.holdUntil = hold;
+            Logger::Logf("HOSTHEALTH host=%s breaker=closed", key.c_str());
+        }
+        return health;
+    }
+}
+
+namespace HostHealth
+{
+    void Record(const std::string &url, Outcome outcome)
+    {
+        std::string key = Key(url);
+        uint64_t now = Util::GetTick();
+        std::lock_guard<std::mutex> lock(mutex);
+        Health &health = Lookup(key, now);
+        health.errors = health.errors * (1.0 - kWeight) + (outcome != OUTCOME_OK ? kWeight : 0.0);
+        health.resets = health.resets * (1.0 - kWeight) + (outcome == OUTCOME_RESET ? kWeight : 0.0);
+        if (health.samples < kMinSamples)
+            health.samples++;
+        if (health.openUntil != 0 || host_breaker_seconds <= 0 || health.samples < kMinSamples ||
+            health.errors < kOpenRate)
+            return;
+        health.openUntil = now + (uint64_t)host_breaker_seconds * 1000000;
+        Logger::Logf("HOSTHEALTH host=%s breaker=open errors=%.2f resets=%.2f seconds=%d", key.c_str(),
+                     health.errors, health.resets, host_breaker_seconds);
+    }
+
+    void Hold(const std::string &url, uint64_t delay_us)
+    {
+        std::string key = Key(url);
+        uint64_t until = Util::GetTick() + delay_us;
+        std::lock_guard<std::mutex> lock(mutex);
+        Health &health = hosts[key];
+        if (until <= health.holdUntil)
+            return;
+        health.holdUntil = until;
+        Logger::Logf("HOSTHEALTH host=%s hold_ms=%llu", key.c_str(), (unsigned long long)(delay_us / 1000));
+    }
+
+    uint64_t HoldUs(const std::string &url)
+    {
+        std::string key = Key(url);
+        uint64_t now = Util::GetTick();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = hosts.find(key);
+        if (it == hosts.end() || it->second.holdUntil <= now)
+            return 0;
+        return it->second.holdUntil - now;
+    }
+
+    int Parallel(const std::string &url, int wanted)
+    {
+        std::string key = Key(url);
+        uint64_t now = Util::GetTick();
+        std::lock_guard<std::mutex> lock(mutex);
+        Health &health = Lookup(key, now);
+        if (health.openUntil != 0)
+            return 1;
+        if (health.samples >= kMinSamples && health.errors >= kEaseRate)
+            return std::max(1, wanted / 2);
+        return wanted;
+    }
+
+    uint64_t RetryDelayUs(const std::string &url, int attempt, uint64_t base_us, uint64_t cap_us)
+    {
+        uint64_t delay = base_us;
+        for (int i = 0; i < attempt && delay < cap_us; ++i)
+            delay *= 2;
+        delay = std::min(delay, cap_us);
+        // Half fixed, half random: long enough to matter, spread enough
+        // that parallel workers do not retry in step.
+        delay = delay / 2 + (uint64_t)rand() % (delay / 2 + 1);
+        return std::max(delay, HoldUs(url));
+    }
+
+    uint64_t RetryAfterUs(const std::map<std::string, std::string> &headers)
+    {
+        auto it = headers.find("retry-after");
+        if (it == headers.end() || it->second.empty())
+            return 0;
+        const char *value = it->second.c_str();
+        char *end = nullptr;
+        long seconds = strtol(value, &end, 10);
+        if (end == value)
+        {
+            time_t at = curl_getdate(value, nullptr);
+            if (at < 0)
+                return 0;
+            seconds = (long)(at - time(nullptr));
+        }
+        // A server asking for an hour would stall the queue; the breaker
+        // and the user's retry deal with that better.
+        seconds = std::min(std::max(seconds, 0L), 300L);
+        return (uint64_t)seconds * 1000000;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef NEO_HOST_HEALTH_H
+#define NEO_HOST_HEALTH_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// How each WebDAV/HTTP host has been answering lately, so a flaky server
+// is eased off instead of hammered: range requests report their outcome,
+// and a host whose error or reset rate climbs gets fewer requests in
+// flight, then, with the breaker open for host_breaker_seconds, one request
+// at a time. A 429/503 with Retry-After holds every request to the host
+// until it passes. Retries back off exponentially with jitter, so workers
+// that failed together do not come back together. Kept until the app exits.
+namespace HostHealth
+{
+    enum Outcome
+    {
+        OUTCOME_OK,
+        // Refused or failed by the server (5xx, short body).
+        OUTCOME_ERROR,
+        // The connection failed or was reset.
+        OUTCOME_RESET,
+        // 429 or 503.
+        OUTCOME_THROTTLED,
+    };
+
+    // Keyed by the scheme, host and port of `url`, like HostCaps.
+    void Record(const std::string &url, Outcome outcome);
+    // Holds requests to `url`'s host for `delay_us`, e.g. a Retry-After.
+    void Hold(const std::string &url, uint64_t delay_us);
+    // Microseconds left of the host's hold, 0 when none.
+    uint64_t HoldUs(const std::string &url);
+
+    // `wanted` requests in flight, lowered while the host is unhealthy and
+    // 1 while its breaker is open.
+    int Parallel(const std::string &url, int wanted);
+
+    // Back-off before retry `attempt` (0 for the first) of a request to
+    // `url`: base_us doubling per attempt up to cap_us, drawn from its
+    // upper half, or the host's hold when that is longer.
+    uint64_t RetryDelayUs(const std::string &url, int attempt, uint64_t base_us, uint64_t cap_us);
+
+    // A Retry-After value in microseconds (seconds or an HTTP date), 0 when
+    // `headers` (lowercase names) have none.
+    uint64_t RetryAfterUs(const std::map<std::string, std::string> &headers);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include "httpclient/ContentDecoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace
+{
+    const size_t kOutputSize = 64 * 1024;
+}
+
+// br is left out: libbrotli is not linked.
+const char *const ContentDecoder::kAcceptEncoding = "zstd, gzip, deflate";
+
+ContentDecoder::ContentDecoder()
+{
+    std::memset(&zlib, 0, sizeof(zlib));
+}
+
+ContentDecoder::~ContentDecoder()
+{
+    Reset();
+}
+
+bool ContentDecoder::Start(const std::string &encoding)
+{
+    Reset();
+    std::string name = encoding;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    name.erase(std::remove_if(name.begin(), name.end(), ::isspace), name.end());
+    if (name.empty() || name == "identity")
+        return true;
+
+    buffer.resize(kOutputSize);
+    if (name == "gzip" || name == "x-gzip" || name == "deflate")
+    {
+        std::memset(&zlib, 0, sizeof(zlib));
+        // 15 + 32 takes a gzip or zlib header, whichever comes.
+        if (inflateInit2(&zlib, 15 + 32) != Z_OK)
+            return false;
+        type = TYPE_ZLIB;
+        return true;
+    }
+    if (name == "zstd")
+    {
+        zstd = ZSTD_createDStream();
+        if (zstd == nullptr || ZSTD_isError(ZSTD_initDStream(zstd)))
+        {
+            Reset();
+            return false;
+        }
+        type = TYPE_ZSTD;
+        return true;
+    }
+    return false;
+}
+
+const char *ContentDecoder::Name() const
+{
+    switch (type)
+    {
+    case TYPE_ZLIB:
+        return "gzip";
+    case TYPE_ZSTD:
+        return "zstd";
+    default:
+        return "identity";
+    }
+}
+
+bool ContentDecoder::Feed(const char *data, size_t size, const OutputFn &out)
+{
+    bytesIn += size;
+    if (type == TYPE_ZLIB)
+    {
+        zlib.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zlib.avail_in = static_cast<uInt>(size);
+        // A full output buffer may leave more to come out of input
+        // already taken.
+        bool full = false;
+        while (zlib.avail_in > 0 || (full && !finished))
+        {
+            // Concatenated gzip members go on with the next one.
+            if (finished)
+            {
+                if (inflateReset(&zlib) != Z_OK)
+                    return false;
+                finished = false;
+            }
+            zlib.next_out = reinterpret_cast<Bytef *>(buffer.data());
+            zlib.avail_out = static_cast<uInt>(buffer.size());
+            int rc = inflate(&zlib, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+                return false;
+            size_t produced = buffer.size() - zlib.avail_out;
+            full = zlib.avail_out == 0;
+            bytesOut += produced;
+            if (produced > 0 && !out(buffer.data(), produced))
+                return false;
+            if (rc == Z_STREAM_END)
+                finished = true;
+            else if (produced == 0 && rc == Z_BUF_ERROR)
+                break;
+        }
+        return true;
+    }
+
+    if (type == TYPE_ZSTD)
+    {
+        ZSTD_inBuffer in = {data, size, 0};
+        bool full = false;
+        while (in.pos < in.size || full)
+        {
+            ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+            size_t rc = ZSTD_decompressStream(zstd, &output, &in);
+            if (ZSTD_isError(rc))
+                return false;
+            // 0 is the end of a frame; another may follow.
+            finished = rc == 0;
+            full = output.pos == output.size;
+            bytesOut += output.pos;
+            if (output.pos > 0 && !out(buffer.data(), output.pos))
+                return false;
+        }
+        return true;
+    }
+
+    bytesOut += size;
+    return out(data, size);
+}
+
+void ContentDecoder::Reset()
+{
+    if (type == TYPE_ZLIB)
+        inflateEnd(&zlib);
+    if (zstd != nullptr)
+        ZSTD_freeDStream(zstd);
+    zstd = nullptr;
+    type = TYPE_NONE;
+    finished = false;
+    bytesIn = 0;
+    bytesOut = 0;
+}
@@ -1,12 +1,30 @@
 ﻿#include "httpclient/HTTPClient.h"
+#include "httpclient/HTTPConnectionPool.h"
 
 #include <algorithm>
 #include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <strings.h>
+#include "config.h"
 #include "util.h"
 #include "logger.h"
+#include "transfer_trace.h"
+#include "rate_limiter.h"
+#include "resolver.h"
+#include "socket_tuning.h"
+#include "host_caps.h"
+#include "listing_kernels.h"
+#include "upload_source.h"
 
 namespace
 {
+    // Size of the per-client coalescing buffer used by GetToSink(). Matches
+    // CURLOPT_BUFFERSIZE so a full receive buffer maps to one sink write.
+    const size_t kSinkBufferSize = 1048576; // 1 MiB
+    // Largest Content-Length strBody is reserved for up front.
+    const size_t kMaxBodyReserve = 16 * 1048576;
+
     int CurlDebugCallback(CURL *handle, curl_infotype type, char *data, size_t size, void *userptr)
     {
         (void)handle;
@@ -16,10 +34,63 @@ namespace
             while (size > 0 && (data[size - 1] == '\n' || data[size - 1] == '\r'))
                 --size;
             std::string msg(data, size);
-            Logger::Logf("HTTP DEBUG: %s", msg.c_str());
+            Logger::Logf(Logger::LOG_DEBUG, "HTTP DEBUG: %s", msg.c_str());
         }
         return 0;
     }
+
+    // Host and port `url` connects to; false for a bracketed IPv6 host,
+    // which needs no lookup.
+    bool UrlHostPort(const std::string &url, std::string &host, int &port)
+    {
+        size_t scheme = url.find("://");
+        if (scheme == std::string::npos)
+            return false;
+        size_t start = scheme + 3;
+        size_t end = url.find_first_of("/?#", start);
+        std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t at = authority.rfind('@');
+        if (at != std::string::npos)
+            authority = authority.substr(at + 1);
+        if (authority.empty() || authority[0] == '[')
+            return false;
+
+        port = url.compare(0, scheme, "https") == 0 ? 443 : 80;
+        size_t colon = authority.find(':');
+        if (colon != std::string::npos)
+        {
+            port = atoi(authority.c_str() + colon + 1);
+            authority = authority.substr(0, colon);
+        }
+        if (authority.empty() || port <= 0)
+            return false;
+        host = authority;
+        return true;
+    }
+
+    // "Keep-Alive: timeout=N" by host, as last announced.
+    std::mutex keep_alive_mutex;
+    std::map<std::string, long> keep_alive_timeouts;
+    // libcurl's own limit, for hosts that announce none.
+    const long kDefaultMaxAgeConn = 118;
+
+    // http3 is on and libcurl has a QUIC stack, which devkitPro's does not
+    // come with.
+    bool Http3Available()
+    {
+#if defined(CURL_VERSION_HTTP3) && defined(CURLALTSVC_H3)
+        static const bool built = []
+        {
+            bool has = (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP3) != 0;
+            if (http3 && !has)
+                Logger::Log("HTTP3 requested but libcurl has no HTTP/3; staying on HTTP/2");
+            return has;
+        }();
+        return http3 && built;
+#else
+        return false;
+#endif
+    }
 }
 
 CHTTPClient::CHTTPClient(LogFn logFn)
@@ -29,8 +100,12 @@ CHTTPClient::CHTTPClient(LogFn logFn)
 
 CHTTPClient::~CHTTPClient()
 {
+    if (requestHeaders)
+        curl_slist_free_all(requestHeaders);
     if (curl)
         curl_easy_cleanup(curl);
+    if (resolveList)
+        curl_slist_free_all(resolveList);
 }
 
 void CHTTPClient::SetBasicAuth(const std::string &u, const std::string &p)
@@ -39,6 +114,14 @@ void CHTTPClient::SetBasicAuth(const std::string &u, const std::string &p)
     pass = p;
 }
 
+void CHTTPClient::SetCookie(const std::string &name, const std::string &value)
+{
+    cookies[name] = value;
+    cookieLine.clear();
+    for (const auto &kv : cookies)
+        cookieLine.append(cookieLine.empty() ? "" : "; ").append(kv.first).append("=").append(kv.second);
+}
+
 void CHTTPClient::InitSession(bool verifyPeer, SettingsFlag)
 {
     if (!curl)
@@ -51,6 +134,23 @@ void CHTTPClient::InitSession(bool verifyPeer, SettingsFlag)
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, verifyPeer ? 1L : 0L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, verifyPeer ? 2L : 0L);
+
+    // Reuse DNS results, TLS sessions and idle connections from every other
+    // client in the process; over Tailscale/Funnel a fresh TLS handshake
+    // costs hundreds of milliseconds per worker. Keep resolved hosts for a
+    // few minutes so long download queues don't re-resolve between files.
+    CURLSH *share = CHTTPConnectionPool::Share();
+    if (share)
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+
+#if defined(CURL_VERSION_HTTP3) && defined(CURLALTSVC_H3)
+    // libcurl's alt-svc engine keeps the h3 endpoints servers advertise in
+    // a file, so the first request of the next session can already go over
+    // QUIC; which hosts may use them is set per request.
+    if (Http3Available())
+        curl_easy_setopt(curl, CURLOPT_ALTSVC, ALTSVC_FILE);
+#endif
 }
 
 void CHTTPClient::SetCertificateFile(const std::string &path)
@@ -70,11 +170,55 @@ void CHTTPClient::SetProgressFnCallback(void *owner, int (*fn)(void *, double, d
     progressFn = nullptr;
 }
 
+void CHTTPClient::SetCancelFlag(const bool *flag)
+{
+    cancelFlag = flag;
+}
+
 void CHTTPClient::applyCommonOptions(const std::string &url)
 {
     activeUrl = url;
+    preparedUrl.clear();
 
     curl_easy_setopt(curl, CURLOPT_URL, activeUrl.c_str());
+    // The request's own host resolves through the shared resolver (cache,
+    // public servers when the system one is slow); redirects elsewhere
+    // still resolve in libcurl, which reads the list when the transfer
+    // starts.
+    if (resolveList)
+    {
+        curl_slist_free_all(resolveList);
+        resolveList = nullptr;
+    }
+    std::string host, address;
+    int port = 0;
+    if (UrlHostPort(url, host, port) && Resolver::ResolveText(host, address) && address != host)
+        resolveList = curl_slist_append(nullptr, (host + ":" + std::to_string(port) + ":" + address).c_str());
+    curl_easy_setopt(curl, CURLOPT_RESOLVE, resolveList);
+    socketHost = SocketTuning::HostOf(url);
+    SocketTuning::SetupCurl(curl, &socketHost);
+    // A connection is not reused once it sat idle for about as long as
+    // the server said it keeps one open; a request sent just as the
+    // server closes it fails instead of being retried.
+    long maxAge = kDefaultMaxAgeConn;
+    {
+        std::lock_guard<std::mutex> lock(keep_alive_mutex);
+        auto it = keep_alive_timeouts.find(host);
+        if (it != keep_alive_timeouts.end())
+            maxAge = std::max(it->second - 1, 1L);
+    }
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, maxAge);
+#if defined(CURL_VERSION_HTTP3) && defined(CURLALTSVC_H3)
+    // QUIC loss recovery rides out Wi-Fi and VPN drops that stall every
+    // TCP connection at once; a host whose QUIC failed stays on HTTP/2.
+    if (Http3Available())
+    {
+        long altsvc = CURLALTSVC_H1 | CURLALTSVC_H2;
+        if (url.compare(0, 8, "https://") == 0 && HostCaps::Get(url).h3 != 0)
+            altsvc |= CURLALTSVC_H3;
+        curl_easy_setopt(curl, CURLOPT_ALTSVC_CTRL, altsvc);
+    }
+#endif
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "neo_sftp/1.0");
     // Disable libcurl per-request verbose logging in production builds;
     // logging every line to SD can stall the UI on Switch.
@@ -90,13 +234,14 @@ void CHTTPClient::applyCommonOptions(const std::string &url)
 
     if (!caFile.empty())
         curl_easy_setopt(curl, CURLOPT_CAINFO, caFile.c_str());
+    curl_easy_setopt(curl, CURLOPT_COOKIE, cookieLine.empty() ? nullptr : cookieLine.c_str());
 
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, progressFn ? 0L : 1L);
-    if (progressFn)
-    {
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, &CHTTPClient::progressCallback);
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
-    }
+    // The transfer info callback only watches for a cancel. libcurl calls
+    // it at least once a second, also while nothing arrives. (The old
+    // progress callback took doubles where libcurl passes curl_off_t.)
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, cancelFlag ? 0L : 1L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, &CHTTPClient::xferInfoCallback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
 
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
@@ -122,22 +267,234 @@ void CHTTPClient::applyCommonOptions(const std::string &url)
     curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
     curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
     curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, 64L);
+    // Plain bodies unless a listing request asks otherwise; ranged chunks
+    // must arrive byte for byte.
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 1L);
+    // Requests that send headers or a range set them after this.
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_easy_setopt(curl, CURLOPT_RANGE, nullptr);
+}
+
+void CHTTPClient::setRequestHeaders(const HeadersMap &headers)
+{
+    // Comparing the map is far cheaper than an allocation per line, and
+    // successive requests mostly send the same few headers.
+    if (!requestHeaders || headers != requestHeadersKey)
+    {
+        if (requestHeaders)
+            curl_slist_free_all(requestHeaders);
+        requestHeaders = nullptr;
+        std::string line;
+        for (const auto &kv : headers)
+        {
+            line.assign(kv.first).append(": ").append(kv.second);
+            requestHeaders = curl_slist_append(requestHeaders, line.c_str());
+        }
+        requestHeadersKey = headers;
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, requestHeaders);
+}
+
+void CHTTPClient::rememberKeepAlive(const HttpResponse &res)
+{
+    auto header = res.mapHeadersLowercase.find("keep-alive");
+    if (header == res.mapHeadersLowercase.end())
+        return;
+    size_t pos = header->second.find("timeout=");
+    if (pos == std::string::npos)
+        return;
+    long timeout = atol(header->second.c_str() + pos + 8);
+    std::string host;
+    int port = 0;
+    if (timeout <= 0 || !UrlHostPort(activeUrl, host, port))
+        return;
+
+    // Prepared range requests skip applyCommonOptions(); they pick the
+    // limit up from the handle.
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, std::max(timeout - 1, 1L));
+    std::lock_guard<std::mutex> lock(keep_alive_mutex);
+    long &known = keep_alive_timeouts[host];
+    if (known != timeout)
+        Logger::Logf(Logger::LOG_DEBUG, "HTTP keep-alive host=%s timeout_s=%ld", host.c_str(), timeout);
+    known = timeout;
+}
+
+void CHTTPClient::rememberAltSvc(const HttpResponse &res)
+{
+#if defined(CURL_VERSION_HTTP3) && defined(CURLALTSVC_H3)
+    if (!Http3Available() || activeUrl.compare(0, 8, "https://") != 0)
+        return;
+    long version = 0;
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version);
+    if (version == CURL_HTTP_VERSION_3)
+    {
+        HostCaps::Learn(activeUrl, &HostCaps::Caps::h3, 1);
+        return;
+    }
+    // Advertised but not used yet: libcurl picks it up from the alt-svc
+    // cache on the next connection. A host that failed stays off.
+    auto header = res.mapHeadersLowercase.find("alt-svc");
+    if (header != res.mapHeadersLowercase.end() && header->second.find("h3") != std::string::npos &&
+        HostCaps::Get(activeUrl).h3 < 0)
+        HostCaps::Learn(activeUrl, &HostCaps::Caps::h3, 1);
+#else
+    (void)res;
+#endif
+}
+
+void CHTTPClient::http3Fallback(CURLcode res)
+{
+#if defined(CURL_VERSION_HTTP3) && defined(CURLALTSVC_H3)
+    if (!Http3Available() || (res != CURLE_QUIC_CONNECT_ERROR && res != CURLE_HTTP3))
+        return;
+    Logger::Logf(Logger::LOG_WARN, "HTTP3 failed url=%s err=%s; falling back to HTTP/2", activeUrl.c_str(),
+                 curl_easy_strerror(res));
+    HostCaps::Learn(activeUrl, &HostCaps::Caps::h3, 0);
+    // Prepared range requests skip applyCommonOptions().
+    curl_easy_setopt(curl, CURLOPT_ALTSVC_CTRL, (long)(CURLALTSVC_H1 | CURLALTSVC_H2));
+#else
+    (void)res;
+#endif
 }
 
 size_t CHTTPClient::writeBodyCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
     auto *res = static_cast<HttpResponse *>(userdata);
     size_t total = size * nmemb;
+    if (res->strBody.empty())
+    {
+        // The headers are in; size the body once instead of doubling it.
+        auto length = res->mapHeadersLowercase.find("content-length");
+        if (length != res->mapHeadersLowercase.end())
+        {
+            unsigned long long expected = strtoull(length->second.c_str(), nullptr, 10);
+            if (expected > total)
+                res->strBody.reserve((size_t)std::min<unsigned long long>(expected, kMaxBodyReserve));
+        }
+    }
     res->strBody.append(ptr, total);
+    res->bodyHeld.Set((int64_t)res->strBody.capacity());
+    return total;
+}
+
+size_t CHTTPClient::writeSinkCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    auto *state = static_cast<SinkState *>(userdata);
+    size_t total = size * nmemb;
+
+    // The status line is known by the time the first body byte arrives;
+    // only stream 2xx bodies so error pages never land in the output file.
+    if (!state->decided)
+    {
+        long code = 0;
+        curl_easy_getinfo(state->self->curl, CURLINFO_RESPONSE_CODE, &code);
+        state->streaming = (code >= 200 && code < 300);
+        state->decided = true;
+        if (state->self->sinkCompressed)
+        {
+            auto encoding = state->res->mapHeadersLowercase.find("content-encoding");
+            if (encoding != state->res->mapHeadersLowercase.end() && !state->self->sinkDecoder.Start(encoding->second))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "HTTP unexpected content-encoding=%s url=%s", encoding->second.c_str(),
+                             state->self->activeUrl.c_str());
+                state->decodeFailed = true;
+                return 0;
+            }
+        }
+    }
+
+    if (state->self->sinkDecoder.Active())
+    {
+        CHTTPClient *self = state->self;
+        bool ok = self->sinkDecoder.Feed(ptr, total, [self, state](const char *data, size_t size)
+                                         { return self->deliverSinkData(data, size, *state); });
+        if (!ok)
+        {
+            if (!state->sinkFailed)
+                state->decodeFailed = true;
+            return 0;
+        }
+    }
+    else if (!state->self->deliverSinkData(ptr, total, *state))
+        return 0;
+
+    if (!state->streaming)
+        return total;
+    // PROPFIND and other method bodies are listings; only GETs are bulk data.
+    if (state->self->sinkIsGet)
+        RateLimiter::Consume(total);
     return total;
 }
 
+bool CHTTPClient::deliverSinkData(const char *data, size_t size, SinkState &state)
+{
+    if (!state.streaming)
+    {
+        state.res->strBody.append(data, size);
+        state.res->bodyHeld.Set((int64_t)state.res->strBody.capacity());
+        return true;
+    }
+    return bufferSinkData(data, size, state);
+}
+
+bool CHTTPClient::bufferSinkData(const char *data, size_t size, SinkState &state)
+{
+    // Large deliveries bypass the copy entirely when nothing is pending.
+    if (sinkFill == 0 && size >= sinkBuffer.size())
+    {
+        if (!(*state.sink)(data, size))
+        {
+            state.sinkFailed = true;
+            return false;
+        }
+        return true;
+    }
+
+    while (size > 0)
+    {
+        size_t space = sinkBuffer.size() - sinkFill;
+        size_t n = (size < space) ? size : space;
+        std::memcpy(sinkBuffer.data() + sinkFill, data, n);
+        sinkFill += n;
+        data += n;
+        size -= n;
+
+        if (sinkFill == sinkBuffer.size() && !flushSinkBuffer(state))
+            return false;
+    }
+    return true;
+}
+
+bool CHTTPClient::flushSinkBuffer(SinkState &state)
+{
+    if (sinkFill == 0)
+        return true;
+
+    size_t pending = sinkFill;
+    sinkFill = 0;
+    if (!(*state.sink)(sinkBuffer.data(), pending))
+    {
+        state.sinkFailed = true;
+        return false;
+    }
+    return true;
+}
+
 size_t CHTTPClient::writeHeaderCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
     auto *res = static_cast<HttpResponse *>(userdata);
     size_t total = size * nmemb;
     std::string line(ptr, total);
 
+    // Each response of a redirect chain starts with its status line; the
+    // body's encoding is the last one's.
+    if (line.compare(0, 5, "HTTP/") == 0)
+    {
+        res->mapHeaders.erase("Content-Encoding");
+        res->mapHeadersLowercase.erase("content-encoding");
+    }
+
     auto pos = line.find(':');
     if (pos != std::string::npos)
     {
@@ -153,17 +510,47 @@ size_t CHTTPClient::writeHeaderCallback(char *ptr, size_t size, size_t nmemb, vo
 
         res->mapHeaders[name] = value;
         res->mapHeadersLowercase[lower] = value;
+        if (lower == "set-cookie")
+        {
+            size_t eq = value.find('=');
+            if (eq != std::string::npos && eq > 0)
+                res->cookies[value.substr(0, eq)] = value.substr(eq + 1, value.find(';') - eq - 1);
+        }
     }
 
     return total;
 }
 
-int CHTTPClient::progressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+size_t CHTTPClient::writeRangeHeaderCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    auto *self = static_cast<CHTTPClient *>(userdata);
+    size_t total = size * nmemb;
+    const char *colon = static_cast<const char *>(memchr(ptr, ':', total));
+    if (colon == nullptr)
+        return total;
+
+    // Only wanted names cost a string; the rest are skipped in place.
+    size_t nameLength = colon - ptr;
+    for (const std::string &key : self->rangeHeaderKeys)
+    {
+        if (key.size() != nameLength || strncasecmp(ptr, key.c_str(), nameLength) != 0)
+            continue;
+        const char *value = colon + 1;
+        const char *end = ptr + total;
+        while (value < end && (*value == ' ' || *value == '\t'))
+            value++;
+        while (end > value && (end[-1] == '\r' || end[-1] == '\n'))
+            end--;
+        self->sinkState.res->mapHeadersLowercase[key].assign(value, end - value);
+        break;
+    }
+    return total;
+}
+
+int CHTTPClient::xferInfoCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
 {
     CHTTPClient *self = static_cast<CHTTPClient *>(clientp);
-    if (!self || !self->progressFn)
-        return 0;
-    return self->progressFn(self->progressOwner.pOwner, dltotal, dlnow, ultotal, ulnow);
+    return (self->cancelFlag != nullptr && *self->cancelFlag) ? 1 : 0;
 }
 
 bool CHTTPClient::Head(const std::string &url, const HeadersMap &headers, HttpResponse &out)
@@ -180,26 +567,22 @@ bool CHTTPClient::Head(const std::string &url, const HeadersMap &headers, HttpRe
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
 
-    struct curl_slist *hdrs = nullptr;
-    for (const auto &kv : headers)
-    {
-        std::string line = kv.first + ": " + kv.second;
-        hdrs = curl_slist_append(hdrs, line.c_str());
-    }
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
+    setRequestHeaders(headers);
 
     CURLcode res = curl_easy_perform(curl);
-    if (hdrs)
-        curl_slist_free_all(hdrs);
 
     if (res != CURLE_OK)
     {
+        http3Fallback(res);
         out.errMessage = curl_easy_strerror(res);
-        Logger::Logf("HTTP HEAD error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "HTTP HEAD error url=%s err=%s", url.c_str(), out.errMessage.c_str());
         return false;
     }
 
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
     return true;
 }
 
@@ -224,26 +607,252 @@ bool CHTTPClient::Get(const std::string &url, const HeadersMap &headers, HttpRes
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
 
-    struct curl_slist *hdrs = nullptr;
-    for (const auto &kv : headers)
+    setRequestHeaders(headers);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    if (res != CURLE_OK)
     {
-        std::string line = kv.first + ": " + kv.second;
-        hdrs = curl_slist_append(hdrs, line.c_str());
+        http3Fallback(res);
+        out.errMessage = curl_easy_strerror(res);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP GET error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        return false;
     }
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
+    char *effective = nullptr;
+    if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective) == CURLE_OK && effective)
+        out.strEffectiveUrl = effective;
+    return true;
+}
+
+bool CHTTPClient::GetToSink(const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out)
+{
+    if (!BeginGetToSink(url, headers, sink, out))
+        return false;
 
     CURLcode res = curl_easy_perform(curl);
-    if (hdrs)
-        curl_slist_free_all(hdrs);
+    return EndGetToSink(res, out);
+}
+
+CURL *CHTTPClient::BeginGetToSink(const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out)
+{
+    return beginSink(nullptr, url, headers, sink, out);
+}
+
+bool CHTTPClient::GetListingToSink(const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out)
+{
+    if (!beginSink(nullptr, url, headers, sink, out, true))
+        return false;
+
+    CURLcode res = curl_easy_perform(curl);
+    return EndGetToSink(res, out);
+}
+
+bool CHTTPClient::GetListing(const std::string &url, const HeadersMap &headers, HttpResponse &out)
+{
+    // Error pages land in out.strBody on their own; 2xx bodies come here.
+    std::string body;
+    Metrics::Held held(Metrics::GAUGE_MEM_HTTP_BODIES);
+    bool ok = GetListingToSink(url, headers, [&body, &held](const char *data, size_t size)
+                               {
+                                   body.append(data, size);
+                                   held.Set((int64_t)body.capacity());
+                                   return true;
+                               },
+                               out);
+    if (HTTP_SUCCESS(out.iCode))
+    {
+        out.strBody.swap(body);
+        out.bodyHeld.Set((int64_t)out.strBody.capacity());
+    }
+    return ok;
+}
+
+bool CHTTPClient::CustomRequestToSink(const std::string &method, const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out,
+                                      const std::string *request)
+{
+    if (!beginSink(method.c_str(), url, headers, sink, out, true))
+        return false;
+    if (request != nullptr)
+    {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->data());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)request->size());
+    }
+
+    CURLcode res = curl_easy_perform(curl);
+    bool ok = EndGetToSink(res, out);
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, nullptr);
+    if (request != nullptr)
+    {
+        // Back to a bodiless request for whatever uses the handle next.
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, nullptr);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)-1);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+    if (ok)
+        Logger::Logf(Logger::LOG_DEBUG, "HTTP %s code=%ld url=%s", method.c_str(), out.iCode, url.c_str());
+    return ok;
+}
+
+bool CHTTPClient::startSink(const char *method, const SinkFn &sink, HttpResponse &out)
+{
+    out = HttpResponse{};
+
+    if (!sinkBuffer.Acquire(kSinkBufferSize))
+    {
+        out.errMessage = "out of transfer buffers";
+        return false;
+    }
+    sinkFill = 0;
+
+    sinkStartedAt = Util::GetTick();
+    sinkIsGet = method == nullptr;
+    sinkRangeStart = -1;
+
+    sinkState = SinkState{};
+    sinkState.self = this;
+    sinkState.res = &out;
+    sinkState.sink = &sink;
+    return true;
+}
+
+CURL *CHTTPClient::beginSink(const char *method, const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out,
+                             bool compressed)
+{
+    if (!curl)
+        curl = curl_easy_init();
+    if (!curl)
+        return nullptr;
+
+    if (!startSink(method, sink, out))
+        return nullptr;
+    auto range = headers.find("Range");
+    if (range != headers.end())
+        std::sscanf(range->second.c_str(), "bytes=%lld-", &sinkRangeStart);
+
+    applyCommonOptions(url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, method ? 0L : 1L);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L);
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeSinkCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sinkState);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
+    // Offered as a literal header, with libcurl's own decoding off, so the
+    // body is undone by sinkDecoder whatever libcurl was built with.
+    sinkCompressed = compressed && http_compress_listings;
+    sinkDecoder.Reset();
+    if (sinkCompressed)
+    {
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ContentDecoder::kAcceptEncoding);
+        curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 0L);
+    }
+
+    setRequestHeaders(headers);
+
+    return curl;
+}
+
+CURL *CHTTPClient::BeginRange(const std::string &url, int64_t start, int64_t end, const SinkFn &sink, HttpResponse &out)
+{
+    if (curl && !preparedUrl.empty() && url == preparedUrl)
+    {
+        // Everything but the range and the callbacks EndGetToSink() took
+        // back is still set from the first range.
+        if (!startSink(nullptr, sink, out))
+            return nullptr;
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeSinkCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sinkState);
+    }
+    else
+    {
+        if (!beginSink(nullptr, url, HeadersMap(), sink, out))
+            return nullptr;
+        preparedUrl = url;
+    }
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeRangeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, this);
+
+    char range[48];
+    std::snprintf(range, sizeof(range), "%lld-%lld", (long long)start, (long long)end);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    sinkRangeStart = start;
+    return curl;
+}
+
+bool CHTTPClient::GetRangeToSink(const std::string &url, int64_t start, int64_t end, const SinkFn &sink, HttpResponse &out)
+{
+    if (!BeginRange(url, start, end, sink, out))
+        return false;
+
+    CURLcode res = curl_easy_perform(curl);
+    return EndGetToSink(res, out);
+}
+
+void CHTTPClient::SetRangeHeaders(const std::vector<std::string> &names)
+{
+    rangeHeaderKeys = names;
+    rangeHeaderKeys.push_back("keep-alive");
+}
+
+bool CHTTPClient::EndGetToSink(CURLcode res, HttpResponse &out)
+{
+    if (res == CURLE_OK && sinkState.streaming && !flushSinkBuffer(sinkState))
+        res = CURLE_WRITE_ERROR;
+    if (sinkDecoder.Active())
+    {
+        // A body cut off mid-stream would parse as a short listing.
+        if (res == CURLE_OK && !sinkDecoder.Finished())
+        {
+            sinkState.decodeFailed = true;
+            res = CURLE_BAD_CONTENT_ENCODING;
+        }
+        Logger::Logf(Logger::LOG_DEBUG, "HTTP decoded encoding=%s in=%llu out=%llu url=%s", sinkDecoder.Name(),
+                     (unsigned long long)sinkDecoder.BytesIn(), (unsigned long long)sinkDecoder.BytesOut(), activeUrl.c_str());
+        sinkDecoder.Reset();
+    }
+    if (sinkCompressed)
+    {
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+        curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 1L);
+        sinkCompressed = false;
+    }
+    sinkFill = 0;
+    sinkBuffer.Release();
+
+    // The write callback keeps a pointer to the member sink state and the
+    // caller's sink; make sure a later request on this handle cannot reuse
+    // them after the caller's objects are gone.
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, nullptr);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, nullptr);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, nullptr);
 
     if (res != CURLE_OK)
     {
-        out.errMessage = curl_easy_strerror(res);
-        Logger::Logf("HTTP GET error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        http3Fallback(res);
+        out.errMessage = sinkState.sinkFailed ? "local write failed"
+                         : sinkState.decodeFailed ? "content decoding failed"
+                                                  : curl_easy_strerror(res);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP GET sink error url=%s err=%s", activeUrl.c_str(), out.errMessage.c_str());
+        if (sinkIsGet && TransferTrace::Enabled())
+            TransferTrace::RecordCurl(curl, sinkRangeStart >= 0 ? TransferTrace::TRACE_HTTP_RANGE : TransferTrace::TRACE_HTTP_GET,
+                                      traceSlot, sinkStartedAt, sinkRangeStart >= 0 ? sinkRangeStart : 0, 0);
         return false;
     }
 
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
+    if (sinkIsGet && TransferTrace::Enabled())
+        TransferTrace::RecordCurl(curl, sinkRangeStart >= 0 ? TransferTrace::TRACE_HTTP_RANGE : TransferTrace::TRACE_HTTP_GET,
+                                  traceSlot, sinkStartedAt, sinkRangeStart >= 0 ? sinkRangeStart : 0, out.iCode);
     return true;
 }
 
@@ -281,8 +890,9 @@ bool CHTTPClient::DownloadFile(const std::string &outputPath, const std::string
 
     if (res != CURLE_OK)
     {
+        http3Fallback(res);
         status = 0;
-        Logger::Logf("HTTP download error url=%s err=%s", url.c_str(), curl_easy_strerror(res));
+        Logger::Logf(Logger::LOG_ERROR, "HTTP download error url=%s err=%s", url.c_str(), curl_easy_strerror(res));
         return false;
     }
 
@@ -292,27 +902,133 @@ bool CHTTPClient::DownloadFile(const std::string &outputPath, const std::string
 }
 
 bool CHTTPClient::UploadFile(const std::string &inputPath, const std::string &url, long &status)
+{
+    status = 0;
+    UploadSource source(inputPath);
+    if (!source.Open())
+    {
+        Logger::Logf(Logger::LOG_ERROR, "HTTP upload open failed path=%s", inputPath.c_str());
+        return false;
+    }
+
+    HttpResponse out;
+    bool ok = PutSource(url, HeadersMap(), source, out);
+    status = out.iCode;
+    return ok;
+}
+
+size_t CHTTPClient::readUploadSourceCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    UploadSource *source = static_cast<UploadSource *>(userdata);
+    int64_t got = source->Read(ptr, size * nmemb);
+    if (got < 0)
+        return CURL_READFUNC_ABORT;
+    RateLimiter::Consume(static_cast<size_t>(got));
+    return static_cast<size_t>(got);
+}
+
+int CHTTPClient::seekUploadSourceCallback(void *userdata, curl_off_t offset, int origin)
+{
+    UploadSource *source = static_cast<UploadSource *>(userdata);
+    if (origin != SEEK_SET || offset < 0 || !source->Seek(static_cast<uint64_t>(offset)))
+        return CURL_SEEKFUNC_CANTSEEK;
+    return CURL_SEEKFUNC_OK;
+}
+
+bool CHTTPClient::PutSource(const std::string &url, const HeadersMap &headers, UploadSource &source, HttpResponse &out)
 {
     if (!curl)
         curl = curl_easy_init();
     if (!curl)
         return false;
 
-    FILE *file = std::fopen(inputPath.c_str(), "rb");
-    if (!file)
+    out = HttpResponse{};
+    applyCommonOptions(url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, nullptr);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, &CHTTPClient::readUploadSourceCallback);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &source);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, &CHTTPClient::seekUploadSourceCallback);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, &source);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(source.Size()));
+    // Fewer, larger reads; the source has them in memory already.
+    curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, 512L * 1024);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
+
+    setRequestHeaders(headers);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, nullptr);
+    curl_easy_setopt(curl, CURLOPT_READDATA, nullptr);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, nullptr);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, nullptr);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(-1));
+    curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, 64L * 1024);
+
+    if (res != CURLE_OK)
+    {
+        http3Fallback(res);
+        out.errMessage = curl_easy_strerror(res);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP upload error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        return false;
+    }
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
+    return true;
+}
+
+size_t CHTTPClient::readSourceCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    const SourceFn *source = static_cast<const SourceFn *>(userdata);
+    int64_t got = (*source)(ptr, size * nmemb);
+    if (got < 0)
+        return CURL_READFUNC_ABORT;
+    RateLimiter::Consume(static_cast<size_t>(got));
+    return static_cast<size_t>(got);
+}
+
+bool CHTTPClient::UploadStream(const std::string &url, uint64_t size, const SourceFn &source, long &status)
+{
+    if (!curl)
+        curl = curl_easy_init();
+    if (!curl)
         return false;
 
     applyCommonOptions(url);
     curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-    curl_easy_setopt(curl, CURLOPT_READDATA, file);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, &CHTTPClient::readSourceCallback);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &source);
+    // An unknown size goes out with chunked transfer encoding.
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE,
+                     static_cast<curl_off_t>(size == REMOTE_SIZE_UNKNOWN ? -1 : (int64_t)size));
+    // The reply body is small; keep it from reaching a previous request's sink.
+    HttpResponse reply;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &reply);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &reply);
 
     CURLcode res = curl_easy_perform(curl);
-    std::fclose(file);
+
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, nullptr);
+    curl_easy_setopt(curl, CURLOPT_READDATA, nullptr);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(-1));
 
     if (res != CURLE_OK)
     {
+        http3Fallback(res);
         status = 0;
-        Logger::Logf("HTTP upload error url=%s err=%s", url.c_str(), curl_easy_strerror(res));
+        Logger::Logf(Logger::LOG_ERROR, "HTTP upload stream error url=%s err=%s", url.c_str(), curl_easy_strerror(res));
         return false;
     }
 
@@ -320,6 +1036,80 @@ bool CHTTPClient::UploadFile(const std::string &inputPath, const std::string &ur
     return true;
 }
 
+size_t CHTTPClient::readBufferCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    PutState *state = static_cast<PutState *>(userdata);
+    size_t len = size * nmemb;
+    size_t left = state->size - state->pos;
+    if (len > left)
+        len = left;
+    std::memcpy(ptr, state->data + state->pos, len);
+    state->pos += len;
+    RateLimiter::Consume(len);
+    return len;
+}
+
+int CHTTPClient::seekBufferCallback(void *userdata, curl_off_t offset, int origin)
+{
+    // curl rewinds the body when it has to resend it (auth, redirects).
+    PutState *state = static_cast<PutState *>(userdata);
+    if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > state->size)
+        return CURL_SEEKFUNC_CANTSEEK;
+    state->pos = static_cast<size_t>(offset);
+    return CURL_SEEKFUNC_OK;
+}
+
+bool CHTTPClient::PutData(const std::string &url, const HeadersMap &headers, const char *data, size_t size, HttpResponse &out)
+{
+    if (!curl)
+        curl = curl_easy_init();
+    if (!curl)
+        return false;
+
+    out = HttpResponse{};
+    PutState state;
+    state.data = data;
+    state.size = size;
+
+    applyCommonOptions(url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, nullptr);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, &CHTTPClient::readBufferCallback);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &state);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, &CHTTPClient::seekBufferCallback);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, &state);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(size));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
+
+    setRequestHeaders(headers);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    // Leave the handle ready for ordinary requests again.
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, nullptr);
+    curl_easy_setopt(curl, CURLOPT_READDATA, nullptr);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, nullptr);
+
+    if (res != CURLE_OK)
+    {
+        http3Fallback(res);
+        out.errMessage = curl_easy_strerror(res);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP put error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        return false;
+    }
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
+    return true;
+}
+
 bool CHTTPClient::CustomRequest(const std::string &method, const std::string &url, const HeadersMap &headers, HttpResponse &out)
 {
     if (!curl)
@@ -341,99 +1131,112 @@ bool CHTTPClient::CustomRequest(const std::string &method, const std::string &ur
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
 
-    struct curl_slist *hdrs = nullptr;
-    for (const auto &kv : headers)
-    {
-        std::string line = kv.first + ": " + kv.second;
-        hdrs = curl_slist_append(hdrs, line.c_str());
-    }
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
+    setRequestHeaders(headers);
 
     CURLcode res = curl_easy_perform(curl);
-    if (hdrs)
-        curl_slist_free_all(hdrs);
 
     if (res != CURLE_OK)
     {
+        http3Fallback(res);
         out.errMessage = curl_easy_strerror(res);
-        Logger::Logf("HTTP custom error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "HTTP custom error url=%s err=%s", url.c_str(), out.errMessage.c_str());
         return false;
     }
 
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
-    Logger::Logf("HTTP %s code=%ld url=%s", method.c_str(), out.iCode, url.c_str());
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
+    Logger::Logf(Logger::LOG_DEBUG, "HTTP %s code=%ld url=%s", method.c_str(), out.iCode, url.c_str());
     return true;
 }
 
-void CHTTPClient::CleanupSession()
+bool CHTTPClient::UploadForm(const std::string &url, const HeadersMap &headers, const PostFormInfo &form, HttpResponse &out)
 {
-    if (curl)
+    if (!curl)
+        curl = curl_easy_init();
+    if (!curl)
+        return false;
+
+    out = HttpResponse{};
+    curl_mime *mime = curl_mime_init(curl);
+    for (const auto &field : form.fields)
     {
-        curl_easy_cleanup(curl);
-        curl = nullptr;
+        curl_mimepart *part = curl_mime_addpart(mime);
+        curl_mime_name(part, field.first.c_str());
+        curl_mime_data(part, field.second.c_str(), CURL_ZERO_TERMINATED);
     }
-}
 
-std::string CHTTPClient::EncodeUrl(const std::string &url)
-{
-    CURL *c = curl_easy_init();
-    if (!c)
-        return url;
-
-    std::string out;
-    out.reserve(url.size());
+    applyCommonOptions(url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L);
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, nullptr);
+    curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CHTTPClient::writeBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CHTTPClient::writeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &out);
 
-    size_t start = 0;
-    while (start < url.size())
-    {
-        size_t slash = url.find('/', start);
-        std::string segment = url.substr(start, (slash == std::string::npos) ? std::string::npos : slash - start);
+    setRequestHeaders(headers);
 
-        if (!segment.empty())
-        {
-            char *escaped = curl_easy_escape(c, segment.c_str(), static_cast<int>(segment.length()));
-            if (escaped)
-            {
-                out += escaped;
-                curl_free(escaped);
-            }
-            else
-            {
-                out += segment;
-            }
-        }
+    CURLcode res = curl_easy_perform(curl);
 
-        if (slash == std::string::npos)
-            break;
+    // Leave the handle ready for ordinary requests again.
+    curl_easy_setopt(curl, CURLOPT_MIMEPOST, nullptr);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    curl_mime_free(mime);
 
-        out.push_back('/');
-        start = slash + 1;
+    if (res != CURLE_OK)
+    {
+        http3Fallback(res);
+        out.errMessage = curl_easy_strerror(res);
+        Logger::Logf(Logger::LOG_ERROR, "HTTP form error url=%s err=%s", url.c_str(), out.errMessage.c_str());
+        return false;
     }
 
-    curl_easy_cleanup(c);
-    return out;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out.iCode);
+    rememberKeepAlive(out);
+    rememberAltSvc(out);
+    SocketTuning::ObserveCurl(curl, socketHost);
+    return true;
 }
 
-std::string CHTTPClient::DecodeUrl(const std::string &url, bool plusAsSpace)
+void CHTTPClient::LastTimings(int64_t &connectUs, int64_t &tlsUs, int64_t &firstByteUs, long &version) const
 {
-    CURL *c = curl_easy_init();
-    if (!c)
-        return url;
-    int len = 0;
-    char *decoded = curl_easy_unescape(c, url.c_str(), static_cast<int>(url.length()), &len);
-    std::string out = decoded ? std::string(decoded, len) : url;
-    if (decoded)
-        curl_free(decoded);
-    curl_easy_cleanup(c);
+    connectUs = tlsUs = firstByteUs = 0;
+    version = 0;
+    if (!curl)
+        return;
+    curl_off_t lookup = 0, connect = 0, app = 0, start = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start);
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version);
+    if (connect > lookup)
+        connectUs = connect - lookup;
+    if (app > connect)
+        tlsUs = app - connect;
+    curl_off_t ready = std::max(std::max(app, connect), lookup);
+    if (start > ready)
+        firstByteUs = start - ready;
+}
 
-    if (plusAsSpace)
+void CHTTPClient::CleanupSession()
+{
+    if (curl)
     {
-        for (char &ch : out)
-        {
-            if (ch == '+')
-                ch = ' ';
-        }
+        curl_easy_cleanup(curl);
+        curl = nullptr;
     }
+}
+
+std::string CHTTPClient::EncodeUrl(const std::string &url)
+{
+    return ListingKernels::EncodePath(url);
+}
 
-    return out;
+std::string CHTTPClient::DecodeUrl(const std::string &url, bool plusAsSpace)
+{
+    return ListingKernels::DecodeUrl(url, plusAsSpace);
 }
@@ -2,9 +2,16 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <functional>
 #include <curl/curl.h>
 
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "httpclient/ContentDecoder.h"
+
+class UploadSource;
+
 class CHTTPClient
 {
 public:
@@ -16,10 +23,22 @@ public:
         std::map<std::string, std::string> mapHeaders;
         std::map<std::string, std::string> mapHeadersLowercase;
         std::map<std::string, std::string> cookies;
+        // Where Get() ended up after following redirects.
+        std::string strEffectiveUrl;
+        // strBody's heap, in GAUGE_MEM_HTTP_BODIES while the response lives.
+        Metrics::Held bodyHeld{Metrics::GAUGE_MEM_HTTP_BODIES};
     };
 
     using HeadersMap = std::map<std::string, std::string>;
 
+    // Fields of a multipart/form-data POST, in order.
+    struct PostFormInfo
+    {
+        std::vector<std::pair<std::string, std::string>> fields;
+
+        void AddFormContent(const std::string &name, const std::string &value) { fields.emplace_back(name, value); }
+    };
+
     struct ProgressFnStruct
     {
         void *pOwner = nullptr;
@@ -32,20 +51,82 @@ public:
 
     using LogFn = std::function<void(const std::string &)>;
 
+    // Receives body bytes of a successful (2xx) response in order. Return
+    // false to abort the transfer (e.g. on a local write error).
+    using SinkFn = std::function<bool(const char *data, size_t size)>;
+
     explicit CHTTPClient(LogFn logFn);
     ~CHTTPClient();
 
     void SetBasicAuth(const std::string &user, const std::string &pass);
+    // Sent with every request from now on; a response's Set-Cookie lines
+    // land in HttpResponse::cookies for the caller to keep.
+    void SetCookie(const std::string &name, const std::string &value);
     void InitSession(bool verifyPeer, SettingsFlag);
     void SetCertificateFile(const std::string &path);
 
     void SetProgressFnCallback(void *owner, int (*fn)(void *, double, double, double, double));
+    // Requests end with CURLE_ABORTED_BY_CALLBACK within about a second of
+    // `*flag` turning true, also while they wait on the server.
+    void SetCancelFlag(const bool *flag);
 
     bool Head(const std::string &url, const HeadersMap &headers, HttpResponse &out);
     bool Get(const std::string &url, const HeadersMap &headers, HttpResponse &out);
+    // Like Get(), but 2xx body bytes are coalesced in a fixed, reused buffer
+    // and handed to `sink` instead of growing out.strBody. Non-2xx bodies
+    // (error pages) still land in out.strBody for diagnostics.
+    bool GetToSink(const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out);
+    // Split form of GetToSink() for callers that drive the easy handle
+    // themselves (e.g. through a curl multi handle). `sink` and `out` must
+    // stay alive until EndGetToSink() has been called with the result.
+    CURL *BeginGetToSink(const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out);
+    bool EndGetToSink(CURLcode res, HttpResponse &out);
+    // BeginGetToSink() for bytes [start, end] of `url`, for engines issuing
+    // many ranges of one file. The first call configures the handle; while
+    // the URL stays the same and no other request runs on this client, the
+    // next ones only swap in the range and the sink state. Only the headers
+    // named by SetRangeHeaders() and "keep-alive" are parsed into
+    // out.mapHeadersLowercase. Ends with EndGetToSink() like the others.
+    CURL *BeginRange(const std::string &url, int64_t start, int64_t end, const SinkFn &sink, HttpResponse &out);
+    bool GetRangeToSink(const std::string &url, int64_t start, int64_t end, const SinkFn &sink, HttpResponse &out);
+    // Lowercase names of the response headers BeginRange() keeps; by
+    // default "retry-after".
+    void SetRangeHeaders(const std::vector<std::string> &names);
+    // Request slot reported for this client's GETs in the transfer trace.
+    void SetTraceSlot(int slot) { traceSlot = slot; }
     bool DownloadFile(const std::string &outputPath, const std::string &url, long &status);
     bool UploadFile(const std::string &inputPath, const std::string &url, long &status);
+    // PUT of a body pulled from `source` (`size` bytes, no rewind), for
+    // uploads that do not come from a local file. REMOTE_SIZE_UNKNOWN sends
+    // it chunked.
+    using SourceFn = std::function<int64_t(char *buffer, size_t size)>;
+    bool UploadStream(const std::string &url, uint64_t size, const SourceFn &source, long &status);
+    // PUT of an in-memory body, e.g. one chunk of a chunked upload.
+    bool PutData(const std::string &url, const HeadersMap &headers, const char *data, size_t size, HttpResponse &out);
+    // PUT of an opened UploadSource: curl is handed its read-ahead buffers
+    // in large pieces, and rewinds are served by Seek().
+    bool PutSource(const std::string &url, const HeadersMap &headers, UploadSource &source, HttpResponse &out);
     bool CustomRequest(const std::string &method, const std::string &url, const HeadersMap &headers, HttpResponse &out);
+    // POST of `form` as multipart/form-data, e.g. a login page's.
+    bool UploadForm(const std::string &url, const HeadersMap &headers, const PostFormInfo &form, HttpResponse &out);
+    // CustomRequest() with the body delivered like GetToSink(), for large
+    // responses such as PROPFIND listings that are parsed incrementally.
+    // The body is asked for compressed (ContentDecoder) and decoded before
+    // it reaches `sink`. A `request` body, such as a PROPFIND naming the
+    // properties wanted, is sent when given.
+    bool CustomRequestToSink(const std::string &method, const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out,
+                             const std::string *request = nullptr);
+    // GetToSink() and Get() for listings and other metadata, compressed
+    // like CustomRequestToSink(). Never for file data: a compressed body
+    // has no byte offsets to resume or range on.
+    bool GetListingToSink(const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out);
+    bool GetListing(const std::string &url, const HeadersMap &headers, HttpResponse &out);
+
+    // Of the last request, in microseconds: the TCP connect after the name
+    // lookup, the TLS handshake and the wait from there to the first byte
+    // of the answer, 0 for a step it did not take (a reused connection,
+    // plain HTTP); `version` is its CURL_HTTP_VERSION_*.
+    void LastTimings(int64_t &connectUs, int64_t &tlsUs, int64_t &firstByteUs, long &version) const;
 
     void CleanupSession();
 
@@ -58,15 +139,90 @@ private:
 
     std::string user;
     std::string pass;
+    // SetCookie()'s, and their Cookie header line.
+    std::map<std::string, std::string> cookies;
+    std::string cookieLine;
     std::string caFile;
     std::string activeUrl;
+    // Host of activeUrl, for SocketTuning's socket callback.
+    std::string socketHost;
+
+    // Start, first byte of the Range (-1 without one) and trace slot of
+    // the GET in flight, for TransferTrace.
+    uint64_t sinkStartedAt = 0;
+    long long sinkRangeStart = -1;
+    bool sinkIsGet = false;
+    int traceSlot = -1;
+
+    struct SinkState
+    {
+        CHTTPClient *self = nullptr;
+        HttpResponse *res = nullptr;
+        const SinkFn *sink = nullptr;
+        bool decided = false;
+        bool streaming = false;
+        bool sinkFailed = false;
+        bool decodeFailed = false;
+    };
+
+    struct PutState
+    {
+        const char *data = nullptr;
+        size_t size = 0;
+        size_t pos = 0;
+    };
+
+    SinkState sinkState;
+    // Request headers as last set, kept while the next request sends the
+    // same ones.
+    HeadersMap requestHeadersKey;
+    struct curl_slist *requestHeaders = nullptr;
+    // URL the handle is set up for by BeginRange(); cleared by every other
+    // request.
+    std::string preparedUrl;
+    std::vector<std::string> rangeHeaderKeys{"retry-after", "keep-alive", "alt-svc"};
+    // CURLOPT_RESOLVE entry of the request's host.
+    struct curl_slist *resolveList = nullptr;
+    // Leased from the transfer pool for the duration of one sink request.
+    TransferBuffer sinkBuffer;
+    size_t sinkFill = 0;
+    // Set for listing requests, which offer ContentDecoder::kAcceptEncoding.
+    bool sinkCompressed = false;
+    ContentDecoder sinkDecoder;
 
     ProgressFnStruct progressOwner;
     int (*progressFn)(void *, double, double, double, double) = nullptr;
+    const bool *cancelFlag = nullptr;
 
     void applyCommonOptions(const std::string &url);
+    void setRequestHeaders(const HeadersMap &headers);
+    // Readies the sink state and transfer buffer for one sink request.
+    bool startSink(const char *method, const SinkFn &sink, HttpResponse &out);
+    // Learns the idle timeout a server announces in "Keep-Alive:", which
+    // applyCommonOptions() keeps connection reuse under.
+    void rememberKeepAlive(const HttpResponse &res);
+    // Learns from a response whether its host does HTTP/3 (HostCaps h3),
+    // which applyCommonOptions() lets the alt-svc cache use.
+    void rememberAltSvc(const HttpResponse &res);
+    // After a failed request: a QUIC error turns HTTP/3 off for the host,
+    // so the retry goes over HTTP/2.
+    void http3Fallback(CURLcode res);
+    // Shared setup for the sink requests; `method` nullptr means GET.
+    CURL *beginSink(const char *method, const std::string &url, const HeadersMap &headers, const SinkFn &sink, HttpResponse &out,
+                    bool compressed = false);
+    // Hands decoded body bytes to the sink, or to strBody for an error page.
+    bool deliverSinkData(const char *data, size_t size, SinkState &state);
     static size_t writeBodyCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static size_t writeSinkCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    bool bufferSinkData(const char *data, size_t size, SinkState &state);
+    bool flushSinkBuffer(SinkState &state);
     static size_t writeHeaderCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
-    static int progressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
+    static size_t writeRangeHeaderCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static size_t readBufferCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static size_t readSourceCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static int seekBufferCallback(void *userdata, curl_off_t offset, int origin);
+    static size_t readUploadSourceCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static int seekUploadSourceCallback(void *userdata, curl_off_t offset, int origin);
+    static int xferInfoCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
 };
 
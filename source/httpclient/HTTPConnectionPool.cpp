@@ -0,0 +1,331 @@
+#include "httpclient/HTTPConnectionPool.h"
+
+#include <switch.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <mbedtls/gcm.h>
+#include <mbedtls/md.h>
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+
+namespace
+{
+    CURLSH *g_share = nullptr;
+    // One lock per shared data kind, so DNS lookups never wait on a thread
+    // that is busy picking a connection from the cache.
+    std::mutex g_locks[CURL_LOCK_DATA_LAST];
+
+#if defined(CURL_VERSION_SSLS_EXPORT)
+    const char kMagic[4] = {'N', 'T', 'L', 'S'};
+    const uint32_t kVersion = 1;
+    // Enough for every host a session talks to; a ticket is a few hundred
+    // bytes, so anything much larger is not one.
+    const size_t kMaxSessions = 128;
+    const size_t kMaxHashBytes = 64;
+    const size_t kMaxSessionBytes = 16 * 1024;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        unsigned char salt[16];
+        unsigned char iv[12];
+        unsigned char tag[16];
+        uint32_t size;
+    };
+
+    bool SessionsAvailable()
+    {
+        static const bool built = (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_SSLS_EXPORT) != 0;
+        return tls_resume && built;
+    }
+
+    // The console's serial number, read once; nullptr without one. The salt
+    // sits in the clear in the header, so it cannot key the file alone.
+    const SetSysSerialNumber *Serial()
+    {
+        static SetSysSerialNumber serial;
+        static const bool found = []
+        {
+            memset(&serial, 0, sizeof(serial));
+            bool ok = false;
+            if (R_SUCCEEDED(setsysInitialize()))
+            {
+                ok = R_SUCCEEDED(setsysGetSerialNumber(&serial)) && serial.number[0] != '\0';
+                setsysExit();
+            }
+            if (!ok)
+                Logger::Log("TLS sessions: no serial number, not saved or loaded");
+            return ok;
+        }();
+        return found ? &serial : nullptr;
+    }
+
+    // HMAC-SHA256 of the console's serial number under `salt`: a copy of
+    // the file opens nowhere else.
+    bool DeriveKey(const unsigned char *salt, size_t salt_size, unsigned char *key)
+    {
+        const SetSysSerialNumber *serial = Serial();
+        const mbedtls_md_info_t *info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+        return serial != nullptr && info != nullptr &&
+               mbedtls_md_hmac(info, salt, salt_size, (const unsigned char *)serial->number,
+                               strnlen(serial->number, sizeof(serial->number)), key) == 0;
+    }
+
+    void Append(std::vector<unsigned char> &out, const void *data, size_t size)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    struct Exported
+    {
+        std::vector<unsigned char> plain;
+        size_t count = 0;
+        int64_t now = 0;
+    };
+
+    CURLcode ExportSession(CURL *handle, void *userptr, const char *session_key, const unsigned char *shmac,
+                           size_t shmac_len, const unsigned char *sdata, size_t sdata_len, curl_off_t valid_until,
+                           int ietf_tls_id, const char *alpn, size_t earlydata_max)
+    {
+        (void)handle;
+        (void)session_key;
+        (void)ietf_tls_id;
+        (void)alpn;
+        (void)earlydata_max;
+        Exported *out = (Exported *)userptr;
+        // Only the salted hash of the peer is kept, never its name.
+        if (out->count >= kMaxSessions || shmac_len == 0 || shmac_len > kMaxHashBytes || sdata_len == 0 ||
+            sdata_len > kMaxSessionBytes || (int64_t)valid_until <= out->now)
+            return CURLE_OK;
+        int64_t until = (int64_t)valid_until;
+        uint32_t hash_size = (uint32_t)shmac_len;
+        uint32_t data_size = (uint32_t)sdata_len;
+        Append(out->plain, &until, sizeof(until));
+        Append(out->plain, &hash_size, sizeof(hash_size));
+        Append(out->plain, &data_size, sizeof(data_size));
+        Append(out->plain, shmac, shmac_len);
+        Append(out->plain, sdata, sdata_len);
+        out->count++;
+        return CURLE_OK;
+    }
+
+    // An easy handle on the share, which is where the sessions live.
+    CURL *ShareHandle()
+    {
+        CURL *curl = curl_easy_init();
+        if (curl != nullptr)
+            curl_easy_setopt(curl, CURLOPT_SHARE, g_share);
+        return curl;
+    }
+#endif
+}
+
+void CHTTPConnectionPool::Init()
+{
+    if (g_share)
+        return;
+
+    g_share = curl_share_init();
+    if (!g_share)
+    {
+        Logger::Log("HTTP POOL curl_share_init failed, running without shared connections");
+        return;
+    }
+
+    curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, &CHTTPConnectionPool::lockCallback);
+    curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, &CHTTPConnectionPool::unlockCallback);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    if (curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK)
+        Logger::Log("HTTP POOL connection cache sharing not supported by this libcurl");
+}
+
+void CHTTPConnectionPool::Exit()
+{
+    if (!g_share)
+        return;
+
+    if (curl_share_cleanup(g_share) != CURLSHE_OK)
+    {
+        // Still referenced by a live easy handle; leaking it at exit is
+        // harmless, freeing it would not be.
+        Logger::Log("HTTP POOL share still in use at exit");
+    }
+    g_share = nullptr;
+}
+
+CURLSH *CHTTPConnectionPool::Share()
+{
+    return g_share;
+}
+
+void CHTTPConnectionPool::LoadSessions()
+{
+#if defined(CURL_VERSION_SSLS_EXPORT)
+    if (!g_share || !SessionsAvailable() || Serial() == nullptr)
+        return;
+    FILE *in = fopen(TLS_SESSIONS_FILE, "rb");
+    if (in == nullptr)
+        return;
+    Header header;
+    std::vector<unsigned char> sealed;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+              header.version == kVersion && header.size <= kMaxSessions * (16 + kMaxHashBytes + kMaxSessionBytes);
+    if (ok)
+    {
+        sealed.resize(header.size);
+        ok = header.size == 0 || fread(sealed.data(), 1, sealed.size(), in) == sealed.size();
+    }
+    fclose(in);
+
+    unsigned char key[32];
+    std::vector<unsigned char> plain(sealed.size());
+    if (ok)
+    {
+        mbedtls_gcm_context gcm;
+        mbedtls_gcm_init(&gcm);
+        ok = DeriveKey(header.salt, sizeof(header.salt), key) && mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, 256) == 0 &&
+             mbedtls_gcm_auth_decrypt(&gcm, sealed.size(), header.iv, sizeof(header.iv), (const unsigned char *)&header,
+                                      offsetof(Header, salt), header.tag, sizeof(header.tag), sealed.data(), plain.data()) == 0;
+        mbedtls_gcm_free(&gcm);
+        memset(key, 0, sizeof(key));
+    }
+    if (!ok)
+    {
+        // Another console's, an older format or cut off; SaveSessions()
+        // writes a new one.
+        Logger::Log("TLS sessions: file unreadable, ignored");
+        return;
+    }
+
+    CURL *curl = ShareHandle();
+    if (curl == nullptr)
+        return;
+    int64_t now = (int64_t)time(nullptr);
+    int imported = 0, expired = 0, failed = 0;
+    size_t pos = 0;
+    const size_t fixed = sizeof(int64_t) + 2 * sizeof(uint32_t);
+    while (pos + fixed <= plain.size())
+    {
+        int64_t until;
+        uint32_t hash_size, data_size;
+        memcpy(&until, &plain[pos], sizeof(until));
+        memcpy(&hash_size, &plain[pos + sizeof(until)], sizeof(hash_size));
+        memcpy(&data_size, &plain[pos + sizeof(until) + sizeof(hash_size)], sizeof(data_size));
+        pos += fixed;
+        if (hash_size > kMaxHashBytes || data_size > kMaxSessionBytes || pos + hash_size + data_size > plain.size())
+            break;
+        if (until <= now)
+            expired++;
+        else if (curl_easy_ssls_import(curl, nullptr, &plain[pos], hash_size, &plain[pos + hash_size], data_size) == CURLE_OK)
+            imported++;
+        else
+            failed++;
+        pos += hash_size + data_size;
+    }
+    curl_easy_cleanup(curl);
+    memset(plain.data(), 0, plain.size());
+    Logger::Logf("TLS sessions loaded=%d expired=%d failed=%d", imported, expired, failed);
+#endif
+}
+
+void CHTTPConnectionPool::SaveSessions()
+{
+#if defined(CURL_VERSION_SSLS_EXPORT)
+    if (!g_share)
+        return;
+    if (!SessionsAvailable())
+    {
+        // Turned off: what an earlier launch saved goes too.
+        if (!tls_resume && FS::FileExists(TLS_SESSIONS_FILE))
+            FS::Rm(TLS_SESSIONS_FILE);
+        return;
+    }
+    if (Serial() == nullptr)
+    {
+        // Nothing to key it with; one an earlier build keyed by the salt
+        // alone goes as well.
+        if (FS::FileExists(TLS_SESSIONS_FILE))
+            FS::Rm(TLS_SESSIONS_FILE);
+        return;
+    }
+    CURL *curl = ShareHandle();
+    if (curl == nullptr)
+        return;
+    Exported exported;
+    exported.now = (int64_t)time(nullptr);
+    CURLcode res = curl_easy_ssls_export(curl, &ExportSession, &exported);
+    curl_easy_cleanup(curl);
+    if (res != CURLE_OK)
+    {
+        Logger::Logf("TLS sessions export failed err=%s", curl_easy_strerror(res));
+        return;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.size = (uint32_t)exported.plain.size();
+    randomGet(header.salt, sizeof(header.salt));
+    randomGet(header.iv, sizeof(header.iv));
+    unsigned char key[32];
+    std::vector<unsigned char> sealed(exported.plain.size());
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    bool ok = DeriveKey(header.salt, sizeof(header.salt), key) && mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, 256) == 0 &&
+              mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, exported.plain.size(), header.iv, sizeof(header.iv),
+                                        (const unsigned char *)&header, offsetof(Header, salt), exported.plain.data(),
+                                        sealed.data(), sizeof(header.tag), header.tag) == 0;
+    mbedtls_gcm_free(&gcm);
+    memset(key, 0, sizeof(key));
+    memset(exported.plain.data(), 0, exported.plain.size());
+    if (!ok)
+    {
+        Logger::Log("TLS sessions: encryption failed, not saved");
+        return;
+    }
+
+    std::string tmp = std::string(TLS_SESSIONS_FILE) + ".tmp";
+    FILE *out = FS::Create(tmp);
+    if (out == nullptr)
+        return;
+    ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    if (!sealed.empty())
+        ok = fwrite(sealed.data(), 1, sealed.size(), out) == sealed.size() && ok;
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+    {
+        FS::Rm(tmp);
+        return;
+    }
+    FS::Rm(TLS_SESSIONS_FILE);
+    FS::Rename(tmp, TLS_SESSIONS_FILE);
+    Logger::Logf("TLS sessions saved=%zu bytes=%zu", exported.count, sealed.size());
+#endif
+}
+
+void CHTTPConnectionPool::lockCallback(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    (void)handle;
+    (void)access;
+    (void)userptr;
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST)
+        g_locks[data].lock();
+}
+
+void CHTTPConnectionPool::unlockCallback(CURL *handle, curl_lock_data data, void *userptr)
+{
+    (void)handle;
+    (void)userptr;
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST)
+        g_locks[data].unlock();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <curl/curl.h>
+
+// Process-wide libcurl share object. Every CHTTPClient attaches its easy
+// handle to it in InitSession(), so DNS results, TLS sessions and idle
+// connections are reused across clients, parallel range workers and
+// download jobs instead of being rebuilt for each of them.
+class CHTTPConnectionPool
+{
+public:
+    // Call after curl_global_init() and before any CHTTPClient is created.
+    static void Init();
+    // Call once all CHTTPClient instances are gone, before
+    // curl_global_cleanup().
+    static void Exit();
+    // Returns nullptr when the pool is not initialised; callers then simply
+    // run without sharing.
+    static CURLSH *Share();
+
+    // TLS sessions of the share kept in TLS_SESSIONS_FILE between
+    // launches, so the first requests to each host resume instead of
+    // running a full handshake per worker. The file is sealed with
+    // AES-256-GCM under a key bound to this console (its serial number and
+    // a random salt), and sessions past their lifetime are dropped. Needs
+    // a libcurl with session export (curl 8.12, "ssls-export" in the log's
+    // curl: line); otherwise, or with tls_resume=0, these do nothing.
+    // LoadSessions() after Init() and the config; SaveSessions() before
+    // Exit().
+    static void LoadSessions();
+    static void SaveSessions();
+
+private:
+    static void lockCallback(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+    static void unlockCallback(CURL *handle, curl_lock_data data, void *userptr);
+};
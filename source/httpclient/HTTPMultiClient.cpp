@@ -0,0 +1,895 @@
+#include "httpclient/HTTPMultiClient.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include "util.h"
+#include "cancel.h"
+#include "connection_budget.h"
+#include "host_health.h"
+#include "logger.h"
+#include "memory_governor.h"
+#include "memory_stats.h"
+#include "transfer_stats.h"
+
+namespace
+{
+    // A redirect target is trusted this long when its URL says nothing,
+    // and dropped this long before a signed one expires.
+    const uint64_t kTargetTtlUs = 10ull * 60 * 1000000;
+    const uint64_t kTargetMarginUs = 30ull * 1000000;
+
+    // Seconds after `key` in the query of `url`, 0 when absent.
+    uint64_t QueryNumber(const std::string &url, const char *key)
+    {
+        size_t query = url.find('?');
+        if (query == std::string::npos)
+            return 0;
+        std::string needle = key;
+        for (size_t pos = url.find(needle, query); pos != std::string::npos; pos = url.find(needle, pos + 1))
+        {
+            char before = url[pos - 1];
+            if (before == '?' || before == '&')
+                return strtoull(url.c_str() + pos + needle.size(), nullptr, 10);
+        }
+        return 0;
+    }
+
+    // How long the signed URL `url` stays valid, as far as its query says:
+    // S3-style X-Amz-Expires (seconds from signing, taken as now) or an
+    // absolute Expires/expires epoch (CloudFront, B2, many CDNs).
+    uint64_t TargetLifetimeUs(const std::string &url)
+    {
+        uint64_t lifetime = kTargetTtlUs;
+        uint64_t relative = QueryNumber(url, "X-Amz-Expires=");
+        uint64_t absolute = QueryNumber(url, "Expires=");
+        if (absolute == 0)
+            absolute = QueryNumber(url, "expires=");
+        if (relative > 0)
+            lifetime = std::min<uint64_t>(lifetime, relative * 1000000);
+        if (absolute > 0)
+        {
+            uint64_t now = static_cast<uint64_t>(time(nullptr));
+            lifetime = std::min<uint64_t>(lifetime, absolute > now ? (absolute - now) * 1000000 : 0);
+        }
+        return lifetime > kTargetMarginUs ? lifetime - kTargetMarginUs : 0;
+    }
+}
+
+CHTTPMultiClient::CHTTPMultiClient()
+    : multi(curl_multi_init())
+{
+}
+
+CHTTPMultiClient::~CHTTPMultiClient()
+{
+    for (auto &t : transfers)
+    {
+        if (t->busy && multi)
+            curl_multi_remove_handle(multi, t->easy);
+    }
+    transfers.clear();
+    if (multi)
+        curl_multi_cleanup(multi);
+}
+
+void CHTTPMultiClient::SetBasicAuth(const std::string &u, const std::string &p)
+{
+    user = u;
+    pass = p;
+}
+
+void CHTTPMultiClient::SetCertificateFile(const std::string &path)
+{
+    caFile = path;
+}
+
+void CHTTPMultiClient::SetMultiplex(bool enabled)
+{
+    multiplex = enabled;
+}
+
+void CHTTPMultiClient::SetRetryPolicy(int attempts, int64_t delayUs, int64_t maxDelayUs)
+{
+    maxAttempts = (attempts < 1) ? 1 : attempts;
+    retryDelayUs = (delayUs < 0) ? 0 : delayUs;
+    maxRetryDelayUs = (maxDelayUs < retryDelayUs) ? retryDelayUs : maxDelayUs;
+}
+
+void CHTTPMultiClient::SetProgressCounter(std::atomic<int64_t> *counter)
+{
+    progressCounter = counter;
+}
+
+void CHTTPMultiClient::SetCancelFlag(const bool *flag)
+{
+    cancelFlag = flag;
+}
+
+void CHTTPMultiClient::SetAutoTune(int startWorkers, int64_t startChunk, int64_t minChunk, int64_t maxChunk)
+{
+    tune.enabled = true;
+    tune.workers = (startWorkers < 1) ? 1 : startWorkers;
+    tune.minChunk = (minChunk < 1) ? 1 : minChunk;
+    tune.maxChunk = (maxChunk < tune.minChunk) ? tune.minChunk : maxChunk;
+    tune.maxChunk = std::max(tune.minChunk, MemoryGovernor::ChunkBytes(tune.maxChunk));
+    tune.chunk = std::min(std::max(startChunk, tune.minChunk), tune.maxChunk);
+}
+
+void CHTTPMultiClient::SetEndgameSteal(int64_t minBytes)
+{
+    stealMinBytes = (minBytes < 0) ? 0 : minBytes;
+}
+
+int CHTTPMultiClient::TunedWorkers() const
+{
+    return tune.enabled ? tune.workers : 0;
+}
+
+int64_t CHTTPMultiClient::TunedChunk() const
+{
+    return tune.enabled ? tune.chunk : 0;
+}
+
+const CHTTPMultiClient::ServerTraits &CHTTPMultiClient::Traits() const
+{
+    return traits;
+}
+
+int CHTTPMultiClient::AddFile(const std::string &url, int64_t size, int64_t chunkSize, RangeSinkFn sink, int64_t startOffset)
+{
+    std::vector<Span> spans;
+    spans.push_back(Span((startOffset > 0) ? startOffset : 0, size));
+    return AddFileSpans(url, size, chunkSize, std::move(sink), std::move(spans));
+}
+
+int CHTTPMultiClient::AddFileSpans(const std::string &url, int64_t size, int64_t chunkSize, RangeSinkFn sink,
+                                   std::vector<Span> spans, RangeDoneFn onRangeDone)
+{
+    FileJob job;
+    job.url = url;
+    Source primary;
+    primary.url = url;
+    job.sources.push_back(primary);
+    job.size = size;
+    job.chunkSize = MemoryGovernor::ChunkBytes((chunkSize > 0) ? chunkSize : size);
+    job.sink = std::move(sink);
+    job.onRangeDone = std::move(onRangeDone);
+    job.result.bytes = size;
+    for (Span &span : spans)
+    {
+        span.second = std::min(span.second, size);
+        if (span.first < span.second)
+        {
+            job.result.bytes -= span.second - span.first;
+            job.spans.push_back(span);
+        }
+    }
+    job.nextOffset = job.spans.empty() ? size : job.spans[0].first;
+    files.push_back(std::move(job));
+    return static_cast<int>(files.size()) - 1;
+}
+
+void CHTTPMultiClient::AddMirrors(int file, const std::vector<std::string> &urls)
+{
+    FileJob &job = files[file];
+    for (const std::string &url : urls)
+    {
+        bool known = url.empty();
+        for (const Source &src : job.sources)
+            known = known || src.url == url;
+        if (known)
+            continue;
+        Source mirror;
+        mirror.url = url;
+        job.sources.push_back(mirror);
+    }
+}
+
+void CHTTPMultiClient::learnTarget(Source &src, CURL *easy, uint64_t now)
+{
+    long redirects = 0;
+    char *effective = nullptr;
+    if (curl_easy_getinfo(easy, CURLINFO_REDIRECT_COUNT, &redirects) != CURLE_OK || redirects <= 0 ||
+        curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &effective) != CURLE_OK || effective == nullptr ||
+        src.url == effective)
+        return;
+    uint64_t lifetime = TargetLifetimeUs(effective);
+    if (lifetime == 0)
+        return;
+    src.target = effective;
+    src.targetUntil = now + lifetime;
+    Logger::Logf(Logger::LOG_DEBUG, "HTTP MULTI redirect cached url=%s target=%s ttl_s=%llu", src.url.c_str(),
+                 src.target.c_str(), (unsigned long long)(lifetime / 1000000));
+}
+
+int CHTTPMultiClient::pickSource(const FileJob &job)
+{
+    // Ties go to the earlier source, so the primary is tried first.
+    int best = 0;
+    bool found = false;
+    for (size_t i = 0; i < job.sources.size(); ++i)
+    {
+        const Source &src = job.sources[i];
+        if (src.dropped)
+            continue;
+        if (!found || src.inFlight < job.sources[best].inFlight)
+            best = static_cast<int>(i);
+        found = true;
+    }
+    return best;
+}
+
+bool CHTTPMultiClient::dropSource(FileJob &job, int index, const char *why)
+{
+    Source &src = job.sources[index];
+    if (src.dropped)
+        return true;
+    int live = 0;
+    for (const Source &other : job.sources)
+        live += other.dropped ? 0 : 1;
+    if (live <= 1)
+        return false;
+
+    src.dropped = true;
+    double rate = src.us > 0 ? src.bytes * 1000000.0 / src.us / 1048576.0 : 0.0;
+    Logger::Logf("HTTP MULTI source dropped url=%s why=%s ranges=%d rate=%.2f MiB/s",
+                 src.url.c_str(), why, src.ranges, rate);
+    return true;
+}
+
+void CHTTPMultiClient::dropSlowSources(FileJob &job)
+{
+    if (job.sources.size() < 2)
+        return;
+
+    // Judge only once every live source has finished a couple of ranges.
+    double best = 0.0;
+    for (const Source &src : job.sources)
+    {
+        if (src.dropped)
+            continue;
+        if (src.ranges < 2 || src.us == 0)
+            return;
+        best = std::max(best, src.bytes / static_cast<double>(src.us));
+    }
+    for (size_t i = 0; i < job.sources.size(); ++i)
+    {
+        const Source &src = job.sources[i];
+        if (!src.dropped && src.bytes / static_cast<double>(src.us) < best / 4.0)
+            dropSource(job, static_cast<int>(i), "slow");
+    }
+}
+
+const CHTTPMultiClient::FileResult &CHTTPMultiClient::GetResult(int index) const
+{
+    return files[index].result;
+}
+
+bool CHTTPMultiClient::cancelled() const
+{
+    return cancelFlag && *cancelFlag;
+}
+
+bool CHTTPMultiClient::hasFreshRanges(FileJob &job)
+{
+    // Step over exhausted spans so nextOffset always points into the
+    // current one.
+    while (job.spanIndex < job.spans.size() && job.nextOffset >= job.spans[job.spanIndex].second)
+    {
+        ++job.spanIndex;
+        if (job.spanIndex < job.spans.size())
+            job.nextOffset = std::max(job.nextOffset, job.spans[job.spanIndex].first);
+    }
+    return job.spanIndex < job.spans.size();
+}
+
+bool CHTTPMultiClient::hasQueuedWork() const
+{
+    if (!retries.empty())
+        return true;
+    for (size_t i = fileCursor; i < files.size(); ++i)
+    {
+        const FileJob &job = files[i];
+        if (job.failed)
+            continue;
+        if (job.spanIndex + 1 < job.spans.size() ||
+            (job.spanIndex < job.spans.size() && job.nextOffset < job.spans[job.spanIndex].second))
+            return true;
+    }
+    return false;
+}
+
+bool CHTTPMultiClient::nextRange(PendingRange &out, uint64_t now)
+{
+    // Retries first so a file's holes are filled before new ranges are
+    // claimed; a retry still waiting out its back-off does not block
+    // fresh work behind it.
+    for (auto it = retries.begin(); it != retries.end(); ++it)
+    {
+        if (files[it->file].failed)
+        {
+            retries.erase(it);
+            return nextRange(out, now);
+        }
+        if (it->readyAt <= now)
+        {
+            out = *it;
+            retries.erase(it);
+            return true;
+        }
+    }
+
+    // Fresh ranges are claimed file by file in queue order.
+    while (fileCursor < files.size())
+    {
+        FileJob &job = files[fileCursor];
+        if (job.failed || !hasFreshRanges(job))
+        {
+            ++fileCursor;
+            continue;
+        }
+        // The server asked for a pause (Retry-After).
+        if (HostHealth::HoldUs(job.url) > 0)
+            return false;
+
+        const int64_t spanEnd = job.spans[job.spanIndex].second;
+        out.file = static_cast<int>(fileCursor);
+        out.start = job.nextOffset;
+        out.end = out.start + (tune.enabled ? tune.chunk : job.chunkSize) - 1;
+        if (out.end >= spanEnd)
+            out.end = spanEnd - 1;
+        out.attempt = 0;
+        out.readyAt = 0;
+        job.nextOffset = out.end + 1;
+        return true;
+    }
+    return stealRange(out);
+}
+
+bool CHTTPMultiClient::stealRange(PendingRange &out)
+{
+    // Split points stay on 64 KiB so journal blocks are not cut up.
+    const int64_t kAlign = 64 * 1024;
+    if (stealMinBytes <= 0)
+        return false;
+
+    Transfer *victim = nullptr;
+    int64_t best = 0;
+    for (auto &t : transfers)
+    {
+        if (!t->busy || files[t->range.file].failed)
+            continue;
+        int64_t left = t->range.end + 1 - (t->range.start + t->written);
+        if (left > best)
+        {
+            best = left;
+            victim = t.get();
+        }
+    }
+    if (victim == nullptr || best < 2 * stealMinBytes)
+        return false;
+
+    int64_t from = victim->range.start + victim->written;
+    int64_t mid = from + best / 2;
+    mid -= mid % kAlign;
+    if (mid <= from)
+        return false;
+
+    out.file = victim->range.file;
+    out.start = mid;
+    out.end = victim->range.end;
+    out.attempt = 0;
+    out.readyAt = 0;
+    victim->range.end = mid - 1;
+    victim->shrunk = true;
+    steals++;
+    LOG_RATE_LIMITED(Logger::LOG_DEBUG, 1000, "HTTP MULTI steal file=%d slot=%d left=%lld split=%lld-%lld",
+                     out.file, victim->slot, static_cast<long long>(best), static_cast<long long>(out.start),
+                     static_cast<long long>(out.end));
+    return true;
+}
+
+void CHTTPMultiClient::startTransfer(Transfer &t, const PendingRange &range)
+{
+    if (!t.http)
+    {
+        t.http = std::make_unique<CHTTPClient>([](const std::string &) {});
+        t.http->SetBasicAuth(user, pass);
+        t.http->InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
+        t.http->SetTraceSlot(t.slot);
+        if (!caFile.empty())
+            t.http->SetCertificateFile(caFile);
+
+        Transfer *self = &t;
+        t.sink = [this, self](const char *data, size_t len) -> bool
+        {
+            if (cancelled())
+                return false;
+
+            FileJob &job = files[self->range.file];
+            if (job.failed)
+                return false;
+
+            const int64_t expected = self->range.end - self->range.start + 1;
+            if (self->written + static_cast<int64_t>(len) > expected)
+            {
+                if (!self->shrunk)
+                {
+                    self->overrun = true;
+                    return false;
+                }
+                // The rest is another request's now.
+                len = static_cast<size_t>(expected - self->written);
+                if (len == 0)
+                    return true;
+            }
+
+            if (!job.sink(self->range.start + self->written, data, len))
+            {
+                self->writeFailed = true;
+                return false;
+            }
+
+            self->written += static_cast<int64_t>(len);
+            tune.windowBytes += static_cast<int64_t>(len);
+            job.result.bytes += static_cast<int64_t>(len);
+            if (progressCounter)
+            {
+                progressCounter->fetch_add(static_cast<int64_t>(len), std::memory_order_relaxed);
+                TransferStats::AddBytes(static_cast<int64_t>(len));
+            }
+            return true;
+        };
+    }
+
+    t.range = range;
+    t.startedAt = Util::GetTick();
+    t.written = 0;
+    t.overrun = false;
+    t.writeFailed = false;
+    t.shrunk = false;
+
+    FileJob &job = files[range.file];
+    t.source = pickSource(job);
+    Source &src = job.sources[t.source];
+    // A source that redirected before is asked at its target directly,
+    // saving the redirect round trip (often a TLS handshake elsewhere).
+    t.viaTarget = !src.target.empty() && t.startedAt < src.targetUntil;
+    if (!t.viaTarget)
+        src.target.clear();
+    // Ranges of one source reuse the handle as the previous one left it.
+    t.easy = t.http->BeginRange(t.viaTarget ? src.target : src.url, range.start, range.end, t.sink, t.res);
+    if (!t.easy)
+    {
+        failFile(range.file, t.res.errMessage.empty() ? "internal error" : t.res.errMessage);
+        return;
+    }
+    job.sources[t.source].inFlight++;
+
+    curl_multi_add_handle(multi, t.easy);
+    t.busy = true;
+}
+
+void CHTTPMultiClient::failFile(int index, const std::string &err)
+{
+    FileJob &job = files[index];
+    if (job.failed)
+        return;
+    job.failed = true;
+    job.result.ok = false;
+    job.result.errorMessage = err;
+}
+
+void CHTTPMultiClient::finishTransfer(Transfer &t, CURLcode code)
+{
+    curl_multi_remove_handle(multi, t.easy);
+    t.busy = false;
+
+    bool ok = t.http->EndGetToSink(code, t.res);
+    long httpCode = t.res.iCode;
+    FileJob &job = files[t.range.file];
+    Source &src = job.sources[t.source];
+    src.inFlight--;
+    const int64_t expected = t.range.end - t.range.start + 1;
+
+    if (ok && traits.http2 < 0 && (httpCode == 206 || httpCode == 200))
+    {
+        long version = 0;
+        curl_easy_getinfo(t.easy, CURLINFO_HTTP_VERSION, &version);
+        traits.http2 = (version >= CURL_HTTP_VERSION_2_0) ? 1 : 0;
+    }
+    if ((httpCode == 429 || httpCode == 503) && traits.throttledAt == 0)
+    {
+        traits.throttledAt = 1;
+        for (auto &other : transfers)
+        {
+            if (other->busy)
+                traits.throttledAt++;
+        }
+    }
+
+    if (ok && httpCode == 206 && t.written == expected)
+    {
+        if (!t.viaTarget && src.target.empty())
+            learnTarget(src, t.easy, Util::GetTick());
+        HostHealth::Record(src.url, HostHealth::OUTCOME_OK);
+        job.result.lastHttpCode = httpCode;
+        uint64_t elapsed = Util::GetTick() - t.startedAt;
+        src.ranges++;
+        src.bytes += expected;
+        src.us += elapsed;
+        dropSlowSources(job);
+        tune.windowRangeUs += elapsed;
+        tune.windowRanges++;
+        if (job.onRangeDone)
+            job.onRangeDone(t.range.start, t.range.end);
+        if (progressCounter)
+            TransferStats::RangeDone(t.range.start, t.range.end + 1);
+        return;
+    }
+
+    // Throttling replies and dropped connections mean too many requests are
+    // in flight for the server or the path to it.
+    if (code != CURLE_ABORTED_BY_CALLBACK && !cancelled() &&
+        ((!ok && httpCode == 0) || httpCode == 429 || httpCode == 503))
+        tune.windowCongestion++;
+    if (code != CURLE_ABORTED_BY_CALLBACK && !cancelled() && !t.writeFailed && !t.overrun)
+    {
+        if (httpCode == 429 || httpCode == 503)
+        {
+            HostHealth::Record(src.url, HostHealth::OUTCOME_THROTTLED);
+            uint64_t after = HostHealth::RetryAfterUs(t.res.mapHeadersLowercase);
+            if (after > 0)
+                HostHealth::Hold(src.url, after);
+        }
+        else
+        {
+            HostHealth::Record(src.url, (!ok && httpCode == 0) ? HostHealth::OUTCOME_RESET : HostHealth::OUTCOME_ERROR);
+        }
+    }
+
+    // The whole range is fetched again on retry; roll back its progress.
+    job.result.bytes -= t.written;
+    if (progressCounter)
+    {
+        progressCounter->fetch_sub(t.written, std::memory_order_relaxed);
+        TransferStats::AddBytes(-t.written);
+    }
+
+    if (job.failed || cancelled())
+        return;
+
+    char range_header[64];
+    std::snprintf(range_header, sizeof(range_header), "bytes=%lld-%lld",
+                  static_cast<long long>(t.range.start),
+                  static_cast<long long>(t.range.end));
+
+    if (t.writeFailed)
+    {
+        failFile(t.range.file, "local write failed");
+        return;
+    }
+
+    if (t.viaTarget)
+    {
+        // The next range goes through the source's own URL again and
+        // learns a fresh target. A signed one that expired or was revoked
+        // says so with 403/404/410; the range is asked again at once
+        // without using up an attempt.
+        src.target.clear();
+        if (ok && (httpCode == 403 || httpCode == 404 || httpCode == 410))
+        {
+            Logger::Logf("HTTP MULTI redirect target refused url=%s range=%s code=%ld",
+                         src.url.c_str(), range_header, httpCode);
+            PendingRange again = t.range;
+            again.readyAt = 0;
+            retries.push_back(again);
+            return;
+        }
+    }
+
+    // Whatever went wrong on a mirror, the others can serve the range; it
+    // goes back to them without using up an attempt.
+    if (t.source > 0 && dropSource(job, t.source, t.overrun ? "range ignored" : "error"))
+    {
+        LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "HTTP MULTI mirror failed url=%s range=%s code=%ld err=%s",
+                         src.url.c_str(), range_header, httpCode, t.res.errMessage.c_str());
+        PendingRange again = t.range;
+        again.readyAt = 0;
+        retries.push_back(again);
+        return;
+    }
+
+    if (t.overrun)
+    {
+        // The server ignored the Range header and is sending the whole
+        // file; retrying will not help.
+        Logger::Logf("HTTP MULTI range ignored url=%s range=%s", src.url.c_str(), range_header);
+        traits.rangeIgnored = true;
+        failFile(t.range.file, "unexpected http code");
+        return;
+    }
+
+    std::string err;
+    bool retryable = false;
+    if (!ok)
+    {
+        err = t.res.errMessage;
+        retryable = (httpCode == 0);
+        LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "HTTP MULTI range error url=%s range=%s code=%ld err=%s attempt=%d/%d",
+                         src.url.c_str(), range_header, httpCode, err.c_str(),
+                         t.range.attempt + 1, maxAttempts);
+    }
+    else if (httpCode != 206)
+    {
+        err = "unexpected http code";
+        retryable = (httpCode >= 500 && httpCode < 600) || httpCode == 429;
+        LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "HTTP MULTI range unexpected code url=%s range=%s code=%ld attempt=%d/%d",
+                         src.url.c_str(), range_header, httpCode,
+                         t.range.attempt + 1, maxAttempts);
+    }
+    else
+    {
+        err = "short body";
+        retryable = true;
+        LOG_RATE_LIMITED(Logger::LOG_WARN, 1000, "HTTP MULTI range short body url=%s range=%s got=%lld attempt=%d/%d",
+                         src.url.c_str(), range_header, static_cast<long long>(t.written),
+                         t.range.attempt + 1, maxAttempts);
+    }
+
+    if (!retryable || t.range.attempt + 1 >= maxAttempts)
+    {
+        failFile(t.range.file, err);
+        return;
+    }
+
+    PendingRange retry = t.range;
+    retry.attempt++;
+    retry.readyAt = Util::GetTick() + HostHealth::RetryDelayUs(src.url, t.range.attempt,
+                                                               static_cast<uint64_t>(retryDelayUs),
+                                                               static_cast<uint64_t>(maxRetryDelayUs));
+    retries.push_back(retry);
+    TransferStats::AddRetry();
+}
+
+void CHTTPMultiClient::abortAll(const std::string &err)
+{
+    for (auto &t : transfers)
+    {
+        if (t->busy)
+            finishTransfer(*t, CURLE_ABORTED_BY_CALLBACK);
+    }
+    retries.clear();
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (files[i].result.bytes < files[i].size)
+            failFile(static_cast<int>(i), err);
+    }
+}
+
+int64_t CHTTPMultiClient::remainingBytes() const
+{
+    int64_t left = 0;
+    for (const FileJob &job : files)
+    {
+        if (!job.failed && job.result.bytes < job.size)
+            left += job.size - job.result.bytes;
+    }
+    return left;
+}
+
+void CHTTPMultiClient::retune(uint64_t now)
+{
+    // Measure over windows of a couple of seconds so a single slow range or
+    // TLS handshake does not swing the controller.
+    const uint64_t kWindowUs = 2000000;
+    if (now - tune.windowStart < kWindowUs)
+        return;
+
+    double rate = tune.windowBytes * 1000000.0 / static_cast<double>(now - tune.windowStart);
+    int prev_workers = tune.workers;
+    int64_t prev_chunk = tune.chunk;
+
+    if (tune.windowCongestion > 0)
+    {
+        // Multiplicative decrease, then give the server a few windows.
+        tune.workers = std::max(1, tune.workers / 2);
+        tune.grew = false;
+        tune.hold = 2;
+    }
+    else if (tune.hold > 0)
+    {
+        tune.hold--;
+    }
+    else if (tune.grew && rate < tune.lastRate * 1.05)
+    {
+        // The last extra worker bought nothing; step back and stay there.
+        tune.workers = std::max(1, tune.workers - 1);
+        tune.grew = false;
+        tune.hold = 5;
+    }
+    else if (tune.workers < tune.maxWorkers)
+    {
+        tune.workers++;
+        tune.grew = true;
+    }
+
+    if (tune.windowRanges > 0)
+    {
+        // Short ranges are dominated by request latency, long ones make
+        // retries expensive and stall the tail of the file.
+        uint64_t avg_us = tune.windowRangeUs / tune.windowRanges;
+        if (avg_us < 1000000 && tune.chunk < tune.maxChunk)
+            tune.chunk = std::min(tune.chunk * 2, tune.maxChunk);
+        else if (avg_us > 8000000 && tune.chunk > tune.minChunk)
+            tune.chunk = std::max(tune.chunk / 2, tune.minChunk);
+    }
+
+    if (tune.workers != prev_workers || tune.chunk != prev_chunk)
+    {
+        Logger::Logf("HTTP MULTI tune rate=%.2f MiB/s congestion=%d workers=%d->%d chunk=%lld->%lld",
+                     rate / 1048576.0, tune.windowCongestion, prev_workers, tune.workers,
+                     static_cast<long long>(prev_chunk), static_cast<long long>(tune.chunk));
+    }
+
+    tune.lastRate = rate;
+    tune.windowStart = now;
+    tune.windowBytes = 0;
+    tune.windowRangeUs = 0;
+    tune.windowRanges = 0;
+    tune.windowCongestion = 0;
+}
+
+bool CHTTPMultiClient::Run(int concurrency)
+{
+    if (!multi)
+    {
+        abortAll("internal error");
+        return false;
+    }
+
+    if (concurrency < 1)
+        concurrency = 1;
+    int wanted = concurrency;
+    concurrency = MemoryGovernor::Workers(concurrency);
+    if (concurrency < wanted)
+        Logger::Logf("HTTP MULTI memory governor level=%s workers=%d of %d",
+                     MemoryGovernor::LevelName(MemoryGovernor::Current()), concurrency, wanted);
+
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, multiplex ? CURLPIPE_MULTIPLEX : 0L);
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, static_cast<long>(concurrency));
+
+    while (transfers.size() < static_cast<size_t>(concurrency))
+    {
+        transfers.push_back(std::make_unique<Transfer>());
+        transfers.back()->slot = static_cast<int>(transfers.size()) - 1;
+    }
+
+    if (tune.enabled)
+    {
+        tune.maxWorkers = concurrency;
+        tune.workers = std::min(tune.workers, concurrency);
+        tune.windowStart = Util::GetTick();
+    }
+    steals = 0;
+    memoryHeld = false;
+
+    // A cancel wakes the poll below instead of waiting out its timeout.
+    int cancelHook = Cancel::Add([this]
+                                 { curl_multi_wakeup(multi); });
+    bool aborted = false;
+    while (true)
+    {
+        if (cancelled())
+        {
+            abortAll("cancelled");
+            aborted = true;
+            break;
+        }
+
+        uint64_t now = Util::GetTick();
+        if (tune.enabled)
+            retune(now);
+
+        // In adaptive mode idle transfers stay parked once the controller's
+        // worker target is reached; busy ones always run to completion.
+        // A host whose breaker opened mid-run drops to one request, and
+        // the other files of the batch get their share of the site.
+        int limit = tune.enabled ? tune.workers : concurrency;
+        if (fileCursor < files.size())
+            limit = HostHealth::Parallel(files[fileCursor].url, limit);
+        limit = ConnectionBudget::Share(limit, remainingBytes());
+        int active = 0;
+        for (auto &t : transfers)
+        {
+            if (t->busy)
+                ++active;
+        }
+        // A range in flight can cost its size in sink and reorder buffers.
+        // Short of that, those in flight finish first; one always runs.
+        if (active > 0 && active < limit && fileCursor < files.size())
+        {
+            int64_t chunk = tune.enabled ? tune.chunk : files[fileCursor].chunkSize;
+            int64_t headroom = MemoryStats::Headroom();
+            bool hold = headroom < chunk;
+            if (hold != memoryHeld)
+                Logger::Logf("HTTP MULTI memory %s active=%d headroom_kb=%lld", hold ? "hold" : "resume", active,
+                             (long long)(headroom / 1024));
+            memoryHeld = hold;
+            if (hold)
+                limit = active;
+        }
+        for (int i = 0; i < concurrency; ++i)
+        {
+            Transfer &t = *transfers[i];
+            if (!t.busy && active < limit)
+            {
+                PendingRange range;
+                if (nextRange(range, now))
+                {
+                    startTransfer(t, range);
+                    if (t.busy)
+                        ++active;
+                }
+            }
+        }
+
+        if (active == 0 && !hasQueuedWork())
+            break;
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc != CURLM_OK)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "HTTP MULTI perform error err=%s", curl_multi_strerror(mc));
+            abortAll(curl_multi_strerror(mc));
+            aborted = true;
+            break;
+        }
+
+        int queued = 0;
+        CURLMsg *msg = nullptr;
+        while ((msg = curl_multi_info_read(multi, &queued)) != nullptr)
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            for (auto &t : transfers)
+            {
+                if (t->busy && t->easy == msg->easy_handle)
+                {
+                    finishTransfer(*t, msg->data.result);
+                    break;
+                }
+            }
+        }
+
+        // A range whose tail was stolen is done once it reaches the split,
+        // with the server still sending.
+        for (auto &t : transfers)
+        {
+            if (t->busy && t->shrunk && t->written == t->range.end - t->range.start + 1)
+                finishTransfer(*t, CURLE_OK);
+        }
+
+        // Wake at least every 100 ms so cancel and retry back-off timers are
+        // serviced even when no socket is active.
+        curl_multi_poll(multi, nullptr, 0, 100, nullptr);
+    }
+    Cancel::Remove(cancelHook);
+    if (aborted)
+        return false;
+
+    bool all_ok = true;
+    for (auto &job : files)
+    {
+        if (!job.failed && job.result.bytes >= job.size)
+            job.result.ok = true;
+        else
+            all_ok = false;
+    }
+    if (steals > 0)
+        Logger::Logf("HTTP MULTI endgame steals=%d", steals);
+    return all_ok;
+}
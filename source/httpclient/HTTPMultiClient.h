@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <curl/curl.h>
+#include "httpclient/HTTPClient.h"
+
+// Event-driven range downloader built on curl's multi interface. A single
+// calling thread drives every range request of every queued file through
+// one multi handle, so parallelism costs an easy handle and a sink buffer
+// instead of a thread stack, and connections (or HTTP/2 streams on one
+// connection) are shared between all requests.
+class CHTTPMultiClient
+{
+public:
+    // Receives body bytes for the file at absolute `offset`. Return false to
+    // abort the range (treated as a local write failure).
+    using RangeSinkFn = std::function<bool(int64_t offset, const char *data, size_t size)>;
+    // Called once per range [start, end] whose body was fully delivered.
+    using RangeDoneFn = std::function<void(int64_t start, int64_t end)>;
+    // Half-open byte span [first, second).
+    using Span = std::pair<int64_t, int64_t>;
+
+    struct FileResult
+    {
+        bool ok = false;
+        long lastHttpCode = 0;
+        int64_t bytes = 0;
+        std::string errorMessage;
+    };
+
+    CHTTPMultiClient();
+    ~CHTTPMultiClient();
+
+    void SetBasicAuth(const std::string &user, const std::string &pass);
+    void SetCertificateFile(const std::string &path);
+    // Allow HTTP/2 multiplexing of concurrent ranges over one connection.
+    void SetMultiplex(bool enabled);
+    // A failed range is retried up to `maxAttempts` times, after a
+    // jittered back-off doubling from `retryDelayUs` to `maxRetryDelayUs`
+    // (HostHealth::RetryDelayUs), or after the server's Retry-After.
+    void SetRetryPolicy(int maxAttempts, int64_t retryDelayUs, int64_t maxRetryDelayUs);
+    // Optional shared byte counter (e.g. the UI progress total). Bytes of a
+    // failed attempt are subtracted again before the range is retried.
+    void SetProgressCounter(std::atomic<int64_t> *counter);
+    void SetCancelFlag(const bool *flag);
+    // Adaptive mode: Run() starts with `startWorkers` requests in flight and
+    // ranges of `startChunk` bytes, then tunes both at runtime between 1 and
+    // Run()'s concurrency and between minChunk and maxChunk. Workers grow
+    // by one while throughput keeps improving and are halved on HTTP
+    // 429/503 or transport errors; chunks double when ranges finish faster
+    // than a second and halve when they take many seconds.
+    void SetAutoTune(int startWorkers, int64_t startChunk, int64_t minChunk, int64_t maxChunk);
+    // Endgame: once no fresh range is left, a request that would sit idle
+    // takes the second half of the range with the most bytes still to
+    // come, and the request holding it stops at the half. Ranges with less
+    // than twice `minBytes` left are not split; 0 turns it off.
+    void SetEndgameSteal(int64_t minBytes);
+    // Values the controller settled on, for seeding the next run; 0 when
+    // adaptive mode is off.
+    int TunedWorkers() const;
+    int64_t TunedChunk() const;
+
+    // What the runs so far showed of the servers, for HostCaps.
+    struct ServerTraits
+    {
+        // 1 when a range came over HTTP/2, 0 over HTTP/1.x, -1 unknown.
+        int http2 = -1;
+        // Requests in flight when one was first answered 429 or 503; 0
+        // when none was.
+        int throttledAt = 0;
+        // A server sent the whole file in answer to a Range request.
+        bool rangeIgnored = false;
+    };
+    const ServerTraits &Traits() const;
+
+    // Queue bytes [startOffset, size) of `url` as ranges of `chunkSize`.
+    // Returns the file index used with GetResult().
+    int AddFile(const std::string &url, int64_t size, int64_t chunkSize, RangeSinkFn sink, int64_t startOffset = 0);
+    // Queue only the sorted, non-overlapping `spans` of `url`, e.g. the
+    // parts a resume journal still misses. Bytes outside them count as
+    // already done.
+    int AddFileSpans(const std::string &url, int64_t size, int64_t chunkSize, RangeSinkFn sink,
+                     std::vector<Span> spans, RangeDoneFn onRangeDone = nullptr);
+    // Other URLs serving the same bytes as `file`'s own, e.g. CDN nodes or
+    // mirrors. Each range goes to the live source with the fewest requests
+    // in flight. A mirror that fails a range or ignores Range is dropped,
+    // and so is any source running at under a quarter of the fastest one's
+    // per-range rate, as long as one source is left.
+    void AddMirrors(int file, const std::vector<std::string> &urls);
+
+    // Run until every queued range finished or its file failed, keeping at
+    // most `concurrency` requests in flight, fewer while HostHealth says the
+    // host is struggling or ConnectionBudget gives other files of the batch
+    // a share of it. Returns true when all files completed.
+    bool Run(int concurrency);
+
+    const FileResult &GetResult(int index) const;
+
+private:
+    struct Source
+    {
+        std::string url;
+        int inFlight = 0;
+        // Completed ranges and their bytes and time, for the rate check.
+        int ranges = 0;
+        int64_t bytes = 0;
+        uint64_t us = 0;
+        bool dropped = false;
+        // Where `url` redirected a completed range to (a CDN node or
+        // datanode), used for the next ranges until `targetUntil`.
+        std::string target;
+        uint64_t targetUntil = 0;
+    };
+
+    struct FileJob
+    {
+        std::string url;
+        // sources[0] is `url`.
+        std::vector<Source> sources;
+        int64_t size = 0;
+        int64_t chunkSize = 0;
+        std::vector<Span> spans;
+        size_t spanIndex = 0;
+        int64_t nextOffset = 0;
+        RangeSinkFn sink;
+        RangeDoneFn onRangeDone;
+        bool failed = false;
+        FileResult result;
+    };
+
+    struct PendingRange
+    {
+        int file = -1;
+        int64_t start = 0;
+        int64_t end = 0;
+        int attempt = 0;
+        uint64_t readyAt = 0;
+    };
+
+    struct Transfer
+    {
+        std::unique_ptr<CHTTPClient> http;
+        CHTTPClient::SinkFn sink;
+        CHTTPClient::HttpResponse res;
+        CURL *easy = nullptr;
+        int slot = 0;
+        int source = 0;
+        // Sent to the source's cached redirect target.
+        bool viaTarget = false;
+        PendingRange range;
+        uint64_t startedAt = 0;
+        int64_t written = 0;
+        bool busy = false;
+        bool overrun = false;
+        bool writeFailed = false;
+        // range.end was moved in by a steal; bytes past it are dropped and
+        // the request is ended once it has the rest.
+        bool shrunk = false;
+    };
+
+    CURLM *multi;
+    std::string user;
+    std::string pass;
+    std::string caFile;
+    bool multiplex = true;
+    int maxAttempts = 6;
+    int64_t retryDelayUs = 1000000;
+    int64_t maxRetryDelayUs = 16000000;
+    std::atomic<int64_t> *progressCounter = nullptr;
+    const bool *cancelFlag = nullptr;
+    int64_t stealMinBytes = 0;
+    int steals = 0;
+    // New ranges are held back for lack of memory (MemoryStats::Headroom).
+    bool memoryHeld = false;
+
+    struct AutoTune
+    {
+        bool enabled = false;
+        int workers = 1;
+        int maxWorkers = 1;
+        int64_t chunk = 0;
+        int64_t minChunk = 0;
+        int64_t maxChunk = 0;
+        // Current measurement window.
+        uint64_t windowStart = 0;
+        int64_t windowBytes = 0;
+        uint64_t windowRangeUs = 0;
+        int windowRanges = 0;
+        int windowCongestion = 0;
+        // Throughput of the previous window and whether the last step
+        // added a worker, so an increase that did not pay off is undone.
+        double lastRate = 0.0;
+        bool grew = false;
+        int hold = 0;
+    };
+
+    AutoTune tune;
+    ServerTraits traits;
+
+    std::vector<FileJob> files;
+    std::deque<PendingRange> retries;
+    std::vector<std::unique_ptr<Transfer>> transfers;
+    size_t fileCursor = 0;
+
+    bool cancelled() const;
+    bool nextRange(PendingRange &out, uint64_t now);
+    // Splits the busiest in-flight range for an idle request.
+    bool stealRange(PendingRange &out);
+    bool hasQueuedWork() const;
+    // Bytes of the files still running that have not arrived yet.
+    int64_t remainingBytes() const;
+    static bool hasFreshRanges(FileJob &job);
+    void startTransfer(Transfer &t, const PendingRange &range);
+    void finishTransfer(Transfer &t, CURLcode code);
+    void failFile(int index, const std::string &err);
+    static int pickSource(const FileJob &job);
+    // Returns false, keeping it, when `index` is the last live source.
+    static bool dropSource(FileJob &job, int index, const char *why);
+    static void dropSlowSources(FileJob &job);
+    // Remembers where a range of `src` was redirected to.
+    static void learnTarget(Source &src, CURL *easy, uint64_t now);
+    void abortAll(const std::string &err);
+    void retune(uint64_t now);
+};
@@ -0,0 +1,391 @@
+#include <switch.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include "image_prefetch.h"
+#include "actions.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+#include "memory_governor.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    enum SlotState
+    {
+        SLOT_QUEUED,
+        SLOT_WORKING,
+        SLOT_DECODED
+    };
+
+    struct Slot
+    {
+        DirEntry entry;
+        bool remote = false;
+        SlotState state = SLOT_QUEUED;
+        // Position in the look-ahead, 0 first.
+        int rank = 0;
+        // No longer wanted while a worker had it.
+        bool dropped = false;
+        Image image;
+    };
+
+    // Next, previous and the one after next.
+    const int kMaxAhead = 3;
+    // A decoded image is at most the viewer area in RGBA.
+    const size_t kMaxImageBytes = (size_t)MAX_IMAGE_WIDTH * MAX_IMAGE_HEIGHT * 4;
+    // Local files are read in pieces of this, so a drop is noticed.
+    const size_t kReadChunk = 256 * 1024;
+    // A worker's remote connection is released after this long idle.
+    const int kIdleSeconds = 10;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, Slot> slots;
+    std::vector<Thread> workers;
+    bool stopping = false;
+    // Texture on screen, never evicted for an image decoded ahead.
+    GLuint shown_id = 0;
+    RemoteSettings site;
+    bool have_site = false;
+    uint32_t site_generation = 0;
+
+    // Images decoded ahead that fit in image_cache_mb beside the one
+    // shown.
+    int Ahead()
+    {
+        size_t budget = MemoryGovernor::ImageCacheBytes();
+        return std::max(0, std::min<int>(kMaxAhead, (int)(budget / kMaxImageBytes) - 1));
+    }
+
+    // Still wanted; the lock is held.
+    bool Wanted(const std::string &key)
+    {
+        auto it = slots.find(key);
+        return !stopping && it != slots.end() && !it->second.dropped;
+    }
+
+    bool StillWanted(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return Wanted(key);
+    }
+
+    int64_t Fetch(const std::string &key, const DirEntry &entry, RemoteClient *client, TransferBuffer &buffer)
+    {
+        int64_t size = entry.file_size;
+        if (client != nullptr && size <= 0 && !client->Size(entry.path, &size))
+            return -1;
+        if (client == nullptr && size <= 0)
+            size = FS::GetSize(entry.path);
+        if (size <= 0 || size > MAX_REMOTE_IMAGE_BYTES || !buffer.Acquire(size))
+            return -1;
+
+        size_t received = 0;
+        if (client != nullptr)
+        {
+            int ok = client->GetStream(entry.path, size, [&](const char *data, size_t len)
+                                      {
+                                          if (received + len > (size_t)size || !StillWanted(key))
+                                              return false;
+                                          memcpy(buffer.data() + received, data, len);
+                                          received += len;
+                                          return true;
+                                      });
+            return ok && received == (size_t)size ? size : -1;
+        }
+
+        FILE *in = FS::OpenRead(entry.path);
+        if (in == nullptr)
+            return -1;
+        while (received < (size_t)size && StillWanted(key))
+        {
+            int n = FS::Read(in, buffer.data() + received, std::min(kReadChunk, (size_t)size - received));
+            if (n <= 0)
+                break;
+            received += n;
+        }
+        FS::Close(in);
+        return received == (size_t)size ? size : -1;
+    }
+
+    // The queued slot first in the look-ahead.
+    std::map<std::string, Slot>::iterator NextJob()
+    {
+        auto best = slots.end();
+        for (auto it = slots.begin(); it != slots.end(); ++it)
+        {
+            if (it->second.state == SLOT_QUEUED && (best == slots.end() || it->second.rank < best->second.rank))
+                best = it;
+        }
+        return best;
+    }
+
+    void WorkerThread(void *arg)
+    {
+        RemoteClient *client = nullptr;
+        uint32_t client_generation = 0;
+        bool connect_failed = false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            auto job = NextJob();
+            if (job == slots.end())
+            {
+                if (client == nullptr)
+                    cv.wait(lock);
+                else if (cv.wait_for(lock, std::chrono::seconds(kIdleSeconds)) == std::cv_status::timeout)
+                {
+                    lock.unlock();
+                    Actions::ReleaseBackgroundClient(client);
+                    client = nullptr;
+                    lock.lock();
+                }
+                continue;
+            }
+
+            job->second.state = SLOT_WORKING;
+            std::string key = job->first;
+            DirEntry entry = job->second.entry;
+            bool remote = job->second.remote;
+            RemoteSettings settings = site;
+            uint32_t generation = site_generation;
+            lock.unlock();
+
+            if (client_generation != generation)
+            {
+                if (client != nullptr)
+                    Actions::ReleaseBackgroundClient(client);
+                client = nullptr;
+                client_generation = generation;
+                connect_failed = false;
+            }
+            if (remote && client == nullptr && !connect_failed)
+            {
+                client = Actions::ConnectBackgroundClient(settings, "Prefetch");
+                connect_failed = client == nullptr;
+            }
+
+            Image image;
+            bool ok = false;
+            if (!remote || client != nullptr)
+            {
+                TransferBuffer buffer;
+                int64_t got = Fetch(key, entry, remote ? client : nullptr, buffer);
+                ok = got > 0 && StillWanted(key) &&
+                     Textures::DecodeImage(entry.name, (unsigned char *)buffer.data(), got, MAX_IMAGE_WIDTH, MAX_IMAGE_HEIGHT, image);
+            }
+
+            lock.lock();
+            auto it = slots.find(key);
+            if (it == slots.end())
+                continue;
+            if (!ok || it->second.dropped)
+            {
+                slots.erase(it);
+                continue;
+            }
+            it->second.state = SLOT_DECODED;
+            it->second.image = std::move(image);
+        }
+        lock.unlock();
+        if (client != nullptr)
+            Actions::ReleaseBackgroundClient(client);
+    }
+
+    // The next image from `from` in steps of `step`, or -1.
+    int NextImage(const std::vector<DirEntry> &files, int from, int step)
+    {
+        for (int i = from + step; i >= 0 && i < (int)files.size(); i += step)
+        {
+            if (ImagePrefetch::Viewable(files[i]))
+                return i;
+        }
+        return -1;
+    }
+}
+
+namespace ImagePrefetch
+{
+    void Init()
+    {
+        if (image_prefetch_workers <= 0 || Ahead() == 0)
+            return;
+
+        stopping = false;
+        workers.resize(image_prefetch_workers);
+        int started = 0;
+        for (int i = 0; i < image_prefetch_workers; i++)
+        {
+            // Decoders want more stack than a transfer does.
+            Result rc = Threads::Create(&workers[started], WorkerThread, nullptr, 0x20000, Threads::ROLE_BACKGROUND, "prefetch");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "PREFETCH threadCreate failed index=%d rc=0x%x", i, rc);
+                continue;
+            }
+            threadStart(&workers[started]);
+            started++;
+        }
+        workers.resize(started);
+        Logger::Logf("PREFETCH init workers=%d ahead=%d", started, Ahead());
+    }
+
+    void Exit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (Thread &thread : workers)
+        {
+            Threads::Join(&thread);
+        }
+        workers.clear();
+        slots.clear();
+    }
+
+    bool Viewable(const DirEntry &entry)
+    {
+        if (entry.isDir)
+            return false;
+        std::string ext = Util::ToLower(FS::GetFileExt(entry.name));
+        return image_file_extensions.find(ext) != image_file_extensions.end();
+    }
+
+    std::string Key(const DirEntry &entry, bool remote)
+    {
+        char key[1400];
+        snprintf(key, sizeof(key), "%s|%s|%llu|%04d%02d%02d%02d%02d%02d",
+                 remote ? remote_settings->server : "sdmc", entry.path, (unsigned long long)entry.file_size,
+                 entry.modified.year, entry.modified.month, entry.modified.day, entry.modified.hours,
+                 entry.modified.minutes, entry.modified.seconds);
+        return key;
+    }
+
+    void Want(const std::vector<DirEntry> &files, int current, int direction, bool remote, const Tex &shown)
+    {
+        if (current < 0 || current >= (int)files.size() || (remote && remote_settings == nullptr))
+            return;
+        int step = direction < 0 ? -1 : 1;
+        int next = NextImage(files, current, step);
+        int ahead[kMaxAhead] = {next, NextImage(files, current, -step), next < 0 ? -1 : NextImage(files, next, step)};
+
+        std::map<std::string, std::pair<DirEntry, int>> wanted;
+        for (int i = 0, rank = 0; i < kMaxAhead && rank < Ahead(); i++)
+        {
+            if (ahead[i] < 0)
+                continue;
+            DirEntry entry = files[ahead[i]];
+            if (!remote)
+                FS::EnsureDetails(entry);
+            std::string key = Key(entry, remote);
+            if (wanted.count(key) == 0 && !Textures::CacheContains(key))
+                wanted[key] = std::make_pair(entry, rank);
+            rank++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (workers.empty())
+            return;
+        shown_id = shown.id;
+        for (auto it = slots.begin(); it != slots.end();)
+        {
+            auto found = wanted.find(it->first);
+            if (found != wanted.end())
+            {
+                it->second.rank = found->second.second;
+                it->second.dropped = false;
+                wanted.erase(found);
+                ++it;
+            }
+            else if (it->second.state == SLOT_WORKING)
+            {
+                it->second.dropped = true;
+                ++it;
+            }
+            else
+                it = slots.erase(it);
+        }
+        if (remote && !have_site)
+        {
+            site = *remote_settings;
+            have_site = true;
+        }
+        for (auto &it : wanted)
+        {
+            Slot &slot = slots[it.first];
+            slot.entry = it.second.first;
+            slot.remote = remote;
+            slot.rank = it.second.second;
+        }
+        cv.notify_all();
+    }
+
+    void Cancel()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shown_id = 0;
+        for (auto it = slots.begin(); it != slots.end();)
+        {
+            if (it->second.state == SLOT_WORKING)
+            {
+                it->second.dropped = true;
+                ++it;
+            }
+            else
+                it = slots.erase(it);
+        }
+    }
+
+    void Upload()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // One a frame; a decoded image is a few MiB of texture.
+        for (auto it = slots.begin(); it != slots.end(); ++it)
+        {
+            if (it->second.state != SLOT_DECODED)
+                continue;
+            Tex texture;
+            if (!Textures::CacheContains(it->first) && Textures::Upload(it->second.image, texture) &&
+                !Textures::CacheStore(it->first, texture, shown_id))
+                Textures::Free(texture);
+            slots.erase(it);
+            break;
+        }
+    }
+
+    bool Busy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !slots.empty();
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = slots.begin(); it != slots.end();)
+        {
+            if (!it->second.remote)
+                ++it;
+            else if (it->second.state == SLOT_WORKING)
+            {
+                it->second.dropped = true;
+                ++it;
+            }
+            else
+                it = slots.erase(it);
+        }
+        have_site = false;
+        site_generation++;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef NEO_IMAGE_PREFETCH_H
+#define NEO_IMAGE_PREFETCH_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "textures.h"
+
+// Larger remote images are viewed through a temporary file instead.
+#define MAX_REMOTE_IMAGE_BYTES (32 * 1024 * 1024)
+
+// Decode-ahead for the image viewer. While one image is on screen,
+// image_prefetch_workers threads fetch and decode the images next to it in
+// the folder, the next, the previous and the one after next in the
+// direction the user is stepping, into the texture cache (Textures), so
+// stepping to them shows them at once. Remote images are read on
+// connections of the workers' own. Only as many are decoded ahead as fit in
+// image_cache_mb beside the one shown; stepping elsewhere or closing the
+// viewer drops what is queued and abandons fetches under way.
+namespace ImagePrefetch
+{
+    void Init();
+    void Exit();
+
+    // An image file the viewer opens.
+    bool Viewable(const DirEntry &entry);
+    // The texture cache key of `entry`, so a changed file is not shown
+    // from the cache.
+    std::string Key(const DirEntry &entry, bool remote);
+    // `files[current]` is on screen as `shown`, reached by stepping
+    // `direction` (1 forward, -1 back, 0 opened). Replaces the images
+    // wanted ahead.
+    void Want(const std::vector<DirEntry> &files, int current, int direction, bool remote, const Tex &shown);
+    // The viewer was closed; nothing is wanted ahead.
+    void Cancel();
+    // Turns a finished decode into a cached texture; once a frame, on the
+    // UI thread.
+    void Upload();
+    // Images wanted ahead are still being made.
+    bool Busy();
+    // Forgets the remote site, e.g. after disconnecting.
+    void Clear();
+}
+
+#endif
@@ -54,11 +54,14 @@ struct ImGui_ImplSwitch_Data
     GLuint AttribLocationVtxPos; // Vertex attributes location
     GLuint AttribLocationVtxUV;
     GLuint AttribLocationVtxColor;
-    unsigned int VboHandle, ElementsHandle;
-    GLsizeiptr VertexBufferSize;
+    unsigned int VboHandle, ElementsHandle, VaoHandle;
+    GLsizeiptr VertexBufferSize; // High-water marks of the streaming buffers
     GLsizeiptr IndexBufferSize;
     bool HasClipOrigin;
-    bool UseBufferSubData;
+    bool StateReady;             // Render state set up and still in place
+    float ProjectionWidth;       // Display the projection matrix was set for
+    float ProjectionHeight;
+    ImVec2 ProjectionPos;
     PadState pad;
     u64 start_time = 0;
     float prev_time = 0.f;
@@ -78,35 +81,6 @@ static ImGui_ImplSwitch_Data *ImGui_ImplSwitch_GetBackendData(void)
     return ImGui::GetCurrentContext() ? (ImGui_ImplSwitch_Data *)ImGui::GetIO().BackendRendererUserData : nullptr;
 }
 
-// OpenGL vertex attribute state (for ES 1.0 and ES 2.0 only)
-#ifndef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-struct ImGui_ImplSwitch_VtxAttribState
-{
-    GLint Enabled, Size, Type, Normalized, Stride;
-    GLvoid *Ptr;
-
-    void GetState(GLint index)
-    {
-        glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &Enabled);
-        glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_SIZE, &Size);
-        glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_TYPE, &Type);
-        glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &Normalized);
-        glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &Stride);
-        glGetVertexAttribPointerv(index, GL_VERTEX_ATTRIB_ARRAY_POINTER, &Ptr);
-    }
-
-    void SetState(GLint index)
-    {
-        glVertexAttribPointer(index, Size, Type, static_cast<GLboolean>(Normalized), Stride, Ptr);
-
-        if (Enabled)
-            glEnableVertexAttribArray(index);
-        else
-            glDisableVertexAttribArray(index);
-    }
-};
-#endif
-
 // Functions
 bool ImGui_ImplSwitch_Init(const char *glsl_version)
 {
@@ -316,6 +290,22 @@ static u64 ImGui_ImplSwitch_UpdateGamepads(void)
     return padGetButtonsDown(&bd->pad);
 }
 
+bool ImGui_ImplSwitch_InputActive(void)
+{
+    static PadState pad;
+    static bool pad_ready = false;
+    if (!pad_ready)
+    {
+        padInitializeDefault(&pad);
+        pad_ready = true;
+    }
+    padUpdate(&pad);
+
+    HidTouchScreenState state = {0};
+    hidGetTouchScreenStates(&state, 1);
+    return padGetButtons(&pad) != 0 || state.count > 0;
+}
+
 u64 ImGui_ImplSwitch_NewFrame(void)
 {
     ImGui_ImplSwitch_Data *bd = ImGui_ImplSwitch_GetBackendData();
@@ -349,26 +339,71 @@ u64 ImGui_ImplSwitch_NewFrame(void)
     return ImGui_ImplSwitch_UpdateGamepads();
 }
 
-static void ImGui_ImplSwitch_SetupRenderState(ImDrawData *draw_data, int fb_width, int fb_height, GLuint vertex_array_object)
+// The app draws nothing with GL but ImGui, so the state this backend needs is
+// set up once and left in place instead of being saved and restored around
+// every frame like the generic OpenGL3 backend does; only the viewport,
+// projection and scissor test are touched per frame, the last because
+// gui.cpp's glClear() must cover the whole screen. Texture binds and
+// scissor rects are issued only when they change between draw commands.
+static void ImGui_ImplSwitch_SetupRenderState(ImDrawData *draw_data, int fb_width, int fb_height)
 {
     ImGui_ImplSwitch_Data *bd = ImGui_ImplSwitch_GetBackendData();
 
-    // Setup render state: alpha-blending enabled, no face culling, no depth testing, scissor enabled, polygon fill
-    glEnable(GL_BLEND);
-    glBlendEquation(GL_FUNC_ADD);
-    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_SCISSOR_TEST);
+    if (!bd->StateReady)
+    {
+        // Setup render state: alpha-blending enabled, no face culling, no depth testing, scissor enabled, polygon fill
+        glEnable(GL_BLEND);
+        glBlendEquation(GL_FUNC_ADD);
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_STENCIL_TEST);
 #ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_PRIMITIVE_RESTART
-    if (bd->GlVersion >= 310)
-        glDisable(GL_PRIMITIVE_RESTART);
+        if (bd->GlVersion >= 310)
+            glDisable(GL_PRIMITIVE_RESTART);
 #endif
 #ifdef IMGUI_IMPL_HAS_POLYGON_MODE
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+#endif
+        glActiveTexture(GL_TEXTURE0);
+        glUseProgram(bd->ShaderHandle);
+        glUniform1i(bd->AttribLocationTex, 0);
+
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BIND_SAMPLER
+        if (bd->GlVersion >= 330)
+            glBindSampler(0, 0); // We use combined texture/sampler state. Applications using GL 3.3 may set that otherwise.
 #endif
 
+        // The VAO holds the attribute layout and the index buffer binding;
+        // the vertex buffer binding is kept for the uploads.
+#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
+        glBindVertexArray(bd->VaoHandle);
+#endif
+        glBindBuffer(GL_ARRAY_BUFFER, bd->VboHandle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bd->ElementsHandle);
+        glEnableVertexAttribArray(bd->AttribLocationVtxPos);
+        glEnableVertexAttribArray(bd->AttribLocationVtxUV);
+        glEnableVertexAttribArray(bd->AttribLocationVtxColor);
+        glVertexAttribPointer(bd->AttribLocationVtxPos, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), static_cast<GLvoid *>(IM_OFFSETOF(ImDrawVert, pos)));
+        glVertexAttribPointer(bd->AttribLocationVtxUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), reinterpret_cast<GLvoid *>(IM_OFFSETOF(ImDrawVert, uv)));
+        glVertexAttribPointer(bd->AttribLocationVtxColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), reinterpret_cast<GLvoid *>(IM_OFFSETOF(ImDrawVert, col)));
+
+        bd->StateReady = true;
+        bd->ProjectionWidth = 0.0f;
+    }
+
+    glEnable(GL_SCISSOR_TEST);
+    glViewport(0, 0, static_cast<GLsizei>(fb_width), static_cast<GLsizei>(fb_height));
+
+    // Setup orthographic projection matrix, only when the display moved or was resized
+    // Our visible imgui space lies from draw_data->DisplayPos (top left) to draw_data->DisplayPos+data_data->DisplaySize (bottom right). DisplayPos is (0,0) for single viewport apps.
+    if (bd->ProjectionWidth == draw_data->DisplaySize.x && bd->ProjectionHeight == draw_data->DisplaySize.y &&
+        bd->ProjectionPos.x == draw_data->DisplayPos.x && bd->ProjectionPos.y == draw_data->DisplayPos.y)
+        return;
+    bd->ProjectionWidth = draw_data->DisplaySize.x;
+    bd->ProjectionHeight = draw_data->DisplaySize.y;
+    bd->ProjectionPos = draw_data->DisplayPos;
+
     // Support for GL 4.5 rarely used glClipControl(GL_UPPER_LEFT)
 #if defined(GL_CLIP_ORIGIN)
     bool clip_origin_lower_left = true;
@@ -383,9 +418,6 @@ static void ImGui_ImplSwitch_SetupRenderState(ImDrawData *draw_data, int fb_widt
     }
 #endif
 
-    // Setup viewport, orthographic projection matrix
-    // Our visible imgui space lies from draw_data->DisplayPos (top left) to draw_data->DisplayPos+data_data->DisplaySize (bottom right). DisplayPos is (0,0) for single viewport apps.
-    glViewport(0, 0, static_cast<GLsizei>(fb_width), static_cast<GLsizei>(fb_height));
     float L = draw_data->DisplayPos.x;
     float R = draw_data->DisplayPos.x + draw_data->DisplaySize.x;
     float T = draw_data->DisplayPos.y;
@@ -404,34 +436,78 @@ static void ImGui_ImplSwitch_SetupRenderState(ImDrawData *draw_data, int fb_widt
         {0.0f, 0.0f, -1.0f, 0.0f},
         {(R + L) / (L - R), (T + B) / (B - T), 0.0f, 1.0f},
     };
-    glUseProgram(bd->ShaderHandle);
-    glUniform1i(bd->AttribLocationTex, 0);
     glUniformMatrix4fv(bd->AttribLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
+}
 
-#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BIND_SAMPLER
-    if (bd->GlVersion >= 330)
-        glBindSampler(0, 0); // We use combined texture/sampler state. Applications using GL 3.3 may set that otherwise.
-#endif
+// Copies every draw list into the vertex and index buffers at once. The
+// buffers grow to the largest frame seen (with some slack) and are then
+// only re-specified: mapping with GL_MAP_INVALIDATE_BUFFER_BIT orphans
+// last frame's storage, so the CPU never waits for the GPU to finish
+// reading it. Needs base vertex draws to address the lists' vertices;
+// returns false without them, and the caller uploads list by list.
+static bool ImGui_ImplSwitch_UploadFrame(ImDrawData *draw_data)
+{
+    ImGui_ImplSwitch_Data *bd = ImGui_ImplSwitch_GetBackendData();
+#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_VTX_OFFSET
+    if (bd->GlVersion < 320)
+        return false;
+    if (draw_data->TotalVtxCount == 0 || draw_data->TotalIdxCount == 0)
+        return true;
+
+    const GLsizeiptr vtx_size = static_cast<GLsizeiptr>(draw_data->TotalVtxCount) * static_cast<int>(sizeof(ImDrawVert));
+    const GLsizeiptr idx_size = static_cast<GLsizeiptr>(draw_data->TotalIdxCount) * static_cast<int>(sizeof(ImDrawIdx));
+    if (bd->VertexBufferSize < vtx_size)
+    {
+        bd->VertexBufferSize = vtx_size + vtx_size / 2;
+        glBufferData(GL_ARRAY_BUFFER, bd->VertexBufferSize, nullptr, GL_STREAM_DRAW);
+    }
+    if (bd->IndexBufferSize < idx_size)
+    {
+        bd->IndexBufferSize = idx_size + idx_size / 2;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bd->IndexBufferSize, nullptr, GL_STREAM_DRAW);
+    }
 
-    (void)vertex_array_object;
-#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    glBindVertexArray(vertex_array_object);
+    const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+    char *vtx_dst = static_cast<char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, vtx_size, access));
+    char *idx_dst = vtx_dst ? static_cast<char *>(glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, idx_size, access)) : nullptr;
+    if (vtx_dst && !idx_dst)
+    {
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        vtx_dst = nullptr;
+    }
+    GLsizeiptr vtx_offset = 0;
+    GLsizeiptr idx_offset = 0;
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+    {
+        const ImDrawList *cmd_list = draw_data->CmdLists[n];
+        const GLsizeiptr list_vtx_size = static_cast<GLsizeiptr>(cmd_list->VtxBuffer.Size) * static_cast<int>(sizeof(ImDrawVert));
+        const GLsizeiptr list_idx_size = static_cast<GLsizeiptr>(cmd_list->IdxBuffer.Size) * static_cast<int>(sizeof(ImDrawIdx));
+        if (idx_dst)
+        {
+            memcpy(vtx_dst + vtx_offset, cmd_list->VtxBuffer.Data, list_vtx_size);
+            memcpy(idx_dst + idx_offset, cmd_list->IdxBuffer.Data, list_idx_size);
+        }
+        else
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, vtx_offset, list_vtx_size, static_cast<const GLvoid *>(cmd_list->VtxBuffer.Data));
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, idx_offset, list_idx_size, static_cast<const GLvoid *>(cmd_list->IdxBuffer.Data));
+        }
+        vtx_offset += list_vtx_size;
+        idx_offset += list_idx_size;
+    }
+    if (idx_dst)
+    {
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    }
+    return true;
+#else
+    (void)draw_data;
+    (void)bd;
+    return false;
 #endif
-
-    // Bind vertex/index buffers and setup attributes for ImDrawVert
-    glBindBuffer(GL_ARRAY_BUFFER, bd->VboHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bd->ElementsHandle);
-    glEnableVertexAttribArray(bd->AttribLocationVtxPos);
-    glEnableVertexAttribArray(bd->AttribLocationVtxUV);
-    glEnableVertexAttribArray(bd->AttribLocationVtxColor);
-    glVertexAttribPointer(bd->AttribLocationVtxPos, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), static_cast<GLvoid *>(IM_OFFSETOF(ImDrawVert, pos)));
-    glVertexAttribPointer(bd->AttribLocationVtxUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), reinterpret_cast<GLvoid *>(IM_OFFSETOF(ImDrawVert, uv)));
-    glVertexAttribPointer(bd->AttribLocationVtxColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), reinterpret_cast<GLvoid *>(IM_OFFSETOF(ImDrawVert, col)));
 }
 
-// OpenGL3 Render function.
-// Note that this implementation is little overcomplicated because we are saving/setting up/restoring every OpenGL state explicitly.
-// This is in order to be able to run within an OpenGL engine that doesn't do so.
 void ImGui_ImplSwitch_RenderDrawData(ImDrawData *draw_data)
 {
     // Avoid rendering when minimized, scale coordinates for retina displays (screen coordinates != framebuffer coordinates)
@@ -441,122 +517,30 @@ void ImGui_ImplSwitch_RenderDrawData(ImDrawData *draw_data)
         return;
 
     ImGui_ImplSwitch_Data *bd = ImGui_ImplSwitch_GetBackendData();
-
-    // Backup GL state
-    GLenum last_active_texture;
-    glGetIntegerv(GL_ACTIVE_TEXTURE, reinterpret_cast<GLint *>(&last_active_texture));
-    glActiveTexture(GL_TEXTURE0);
-
-    GLuint last_program;
-    glGetIntegerv(GL_CURRENT_PROGRAM, reinterpret_cast<GLint *>(&last_program));
-
-    GLuint last_texture;
-    glGetIntegerv(GL_TEXTURE_BINDING_2D, reinterpret_cast<GLint *>(&last_texture));
-#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BIND_SAMPLER
-    GLuint last_sampler;
-    if (bd->GlVersion >= 330)
-        glGetIntegerv(GL_SAMPLER_BINDING, reinterpret_cast<GLint *>(&last_sampler));
-    else
-        last_sampler = 0;
-#endif
-    GLuint last_array_buffer;
-    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, reinterpret_cast<GLint *>(&last_array_buffer));
-#ifndef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    // This is part of VAO on OpenGL 3.0+ and OpenGL ES 3.0+.
-    GLint last_element_array_buffer;
-    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &last_element_array_buffer);
-
-    ImGui_ImplSwitch_VtxAttribState last_vtx_attrib_state_pos;
-    last_vtx_attrib_state_pos.GetState(bd->AttribLocationVtxPos);
-
-    ImGui_ImplSwitch_VtxAttribState last_vtx_attrib_state_uv;
-    last_vtx_attrib_state_uv.GetState(bd->AttribLocationVtxUV);
-
-    ImGui_ImplSwitch_VtxAttribState last_vtx_attrib_state_color;
-    last_vtx_attrib_state_color.GetState(bd->AttribLocationVtxColor);
-#endif
-#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    GLuint last_vertex_array_object;
-    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, reinterpret_cast<GLint *>(&last_vertex_array_object));
-#endif
-#ifdef IMGUI_IMPL_HAS_POLYGON_MODE
-    GLint last_polygon_mode[2];
-    glGetIntegerv(GL_POLYGON_MODE, last_polygon_mode);
-#endif
-    GLint last_viewport[4];
-    glGetIntegerv(GL_VIEWPORT, last_viewport);
-
-    GLint last_scissor_box[4];
-    glGetIntegerv(GL_SCISSOR_BOX, last_scissor_box);
-
-    GLenum last_blend_src_rgb;
-    glGetIntegerv(GL_BLEND_SRC_RGB, reinterpret_cast<GLint *>(&last_blend_src_rgb));
-
-    GLenum last_blend_dst_rgb;
-    glGetIntegerv(GL_BLEND_DST_RGB, reinterpret_cast<GLint *>(&last_blend_dst_rgb));
-
-    GLenum last_blend_src_alpha;
-    glGetIntegerv(GL_BLEND_SRC_ALPHA, reinterpret_cast<GLint *>(&last_blend_src_alpha));
-
-    GLenum last_blend_dst_alpha;
-    glGetIntegerv(GL_BLEND_DST_ALPHA, reinterpret_cast<GLint *>(&last_blend_dst_alpha));
-
-    GLenum last_blend_equation_rgb;
-    glGetIntegerv(GL_BLEND_EQUATION_RGB, reinterpret_cast<GLint *>(&last_blend_equation_rgb));
-
-    GLenum last_blend_equation_alpha;
-    glGetIntegerv(GL_BLEND_EQUATION_ALPHA, reinterpret_cast<GLint *>(&last_blend_equation_alpha));
-
-    GLboolean last_enable_blend = glIsEnabled(GL_BLEND);
-    GLboolean last_enable_cull_face = glIsEnabled(GL_CULL_FACE);
-    GLboolean last_enable_depth_test = glIsEnabled(GL_DEPTH_TEST);
-    GLboolean last_enable_stencil_test = glIsEnabled(GL_STENCIL_TEST);
-    GLboolean last_enable_scissor_test = glIsEnabled(GL_SCISSOR_TEST);
-#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_PRIMITIVE_RESTART
-    GLboolean last_enable_primitive_restart = (bd->GlVersion >= 310) ? glIsEnabled(GL_PRIMITIVE_RESTART) : GL_FALSE;
-#endif
-
-    // Setup desired GL state
-    // Recreate the VAO every time (this is to easily allow multiple GL contexts to be rendered to. VAO are not shared among GL contexts)
-    // The renderer would actually work without any VAO bound, but then our VertexAttrib calls would overwrite the default one currently bound.
-    GLuint vertex_array_object = 0;
-#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    glGenVertexArrays(1, &vertex_array_object);
-#endif
-    ImGui_ImplSwitch_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object);
+    ImGui_ImplSwitch_SetupRenderState(draw_data, fb_width, fb_height);
+    const bool whole_frame = ImGui_ImplSwitch_UploadFrame(draw_data);
 
     // Will project scissor/clipping rectangles into framebuffer space
     ImVec2 clip_off = draw_data->DisplayPos;         // (0,0) unless using multi-viewports
     ImVec2 clip_scale = draw_data->FramebufferScale; // (1,1) unless using retina display which are often (2,2)
 
+    // Textures are created and the font atlas swapped between frames, so
+    // the binding is only trusted within one.
+    GLuint bound_texture = 0;
+    bool texture_known = false;
+    GLint scissor[4] = {-1, -1, -1, -1};
+
     // Render command lists
+    unsigned int list_vtx_start = 0;
+    unsigned int list_idx_start = 0;
     for (int n = 0; n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList *cmd_list = draw_data->CmdLists[n];
 
-        // Upload vertex/index buffers
-        // - On Intel windows drivers we got reports that regular glBufferData() led to accumulating leaks when using multi-viewports, so we started using orphaning + glBufferSubData(). (See https://github.com/ocornut/imgui/issues/4468)
-        // - On NVIDIA drivers we got reports that using orphaning + glBufferSubData() led to glitches when using multi-viewports.
-        // - OpenGL drivers are in a very sorry state in 2022, for now we are switching code path based on vendors.
-        const GLsizeiptr vtx_buffer_size = static_cast<GLsizeiptr>(cmd_list->VtxBuffer.Size) * static_cast<int>(sizeof(ImDrawVert));
-        const GLsizeiptr idx_buffer_size = static_cast<GLsizeiptr>(cmd_list->IdxBuffer.Size) * static_cast<int>(sizeof(ImDrawIdx));
-        if (bd->UseBufferSubData)
-        {
-            if (bd->VertexBufferSize < vtx_buffer_size)
-            {
-                bd->VertexBufferSize = vtx_buffer_size;
-                glBufferData(GL_ARRAY_BUFFER, bd->VertexBufferSize, nullptr, GL_STREAM_DRAW);
-            }
-            if (bd->IndexBufferSize < idx_buffer_size)
-            {
-                bd->IndexBufferSize = idx_buffer_size;
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, bd->IndexBufferSize, nullptr, GL_STREAM_DRAW);
-            }
-            glBufferSubData(GL_ARRAY_BUFFER, 0, vtx_buffer_size, static_cast<const GLvoid *>(cmd_list->VtxBuffer.Data));
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, idx_buffer_size, static_cast<const GLvoid *>(cmd_list->IdxBuffer.Data));
-        }
-        else
+        if (!whole_frame)
         {
+            const GLsizeiptr vtx_buffer_size = static_cast<GLsizeiptr>(cmd_list->VtxBuffer.Size) * static_cast<int>(sizeof(ImDrawVert));
+            const GLsizeiptr idx_buffer_size = static_cast<GLsizeiptr>(cmd_list->IdxBuffer.Size) * static_cast<int>(sizeof(ImDrawIdx));
             glBufferData(GL_ARRAY_BUFFER, vtx_buffer_size, static_cast<const GLvoid *>(cmd_list->VtxBuffer.Data), GL_STREAM_DRAW);
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx_buffer_size, static_cast<const GLvoid *>(cmd_list->IdxBuffer.Data), GL_STREAM_DRAW);
         }
@@ -569,9 +553,15 @@ void ImGui_ImplSwitch_RenderDrawData(ImDrawData *draw_data)
                 // User callback, registered via ImDrawList::AddCallback()
                 // (ImDrawCallback_ResetRenderState is a special callback value used by the user to request the renderer to reset render state.)
                 if (pcmd->UserCallback == ImDrawCallback_ResetRenderState)
-                    ImGui_ImplSwitch_SetupRenderState(draw_data, fb_width, fb_height, vertex_array_object);
+                {
+                    bd->StateReady = false;
+                    ImGui_ImplSwitch_SetupRenderState(draw_data, fb_width, fb_height);
+                }
                 else
                     pcmd->UserCallback(cmd_list, pcmd);
+                // Either may have changed any of it.
+                texture_known = false;
+                scissor[0] = -1;
             }
             else
             {
@@ -582,86 +572,39 @@ void ImGui_ImplSwitch_RenderDrawData(ImDrawData *draw_data)
                     continue;
 
                 // Apply scissor/clipping rectangle (Y is inverted in OpenGL)
-                glScissor(static_cast<int>(clip_min.x), static_cast<int>(static_cast<float>(fb_height) - clip_max.y), static_cast<int>(clip_max.x - clip_min.x), static_cast<int>(clip_max.y - clip_min.y));
+                const GLint rect[4] = {static_cast<int>(clip_min.x), static_cast<int>(static_cast<float>(fb_height) - clip_max.y), static_cast<int>(clip_max.x - clip_min.x), static_cast<int>(clip_max.y - clip_min.y)};
+                if (memcmp(rect, scissor, sizeof(rect)) != 0)
+                {
+                    memcpy(scissor, rect, sizeof(rect));
+                    glScissor(rect[0], rect[1], rect[2], rect[3]);
+                }
 
                 // Bind texture, Draw
-                glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(reinterpret_cast<intptr_t>(pcmd->GetTexID())));
+                const GLuint texture = static_cast<GLuint>(reinterpret_cast<intptr_t>(pcmd->GetTexID()));
+                if (!texture_known || texture != bound_texture)
+                {
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                    bound_texture = texture;
+                    texture_known = true;
+                }
 #ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_VTX_OFFSET
                 if (bd->GlVersion >= 320)
-                    glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(pcmd->ElemCount), sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void *)static_cast<intptr_t>(pcmd->IdxOffset * sizeof(ImDrawIdx)), static_cast<GLint>(pcmd->VtxOffset));
+                {
+                    const unsigned int vtx_offset = whole_frame ? list_vtx_start + pcmd->VtxOffset : pcmd->VtxOffset;
+                    const unsigned int idx_offset = whole_frame ? list_idx_start + pcmd->IdxOffset : pcmd->IdxOffset;
+                    glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(pcmd->ElemCount), sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void *)static_cast<intptr_t>(idx_offset * sizeof(ImDrawIdx)), static_cast<GLint>(vtx_offset));
+                }
                 else
 #endif
                     glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(pcmd->ElemCount), sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void *)static_cast<intptr_t>(pcmd->IdxOffset * sizeof(ImDrawIdx)));
             }
         }
+        list_vtx_start += static_cast<unsigned int>(cmd_list->VtxBuffer.Size);
+        list_idx_start += static_cast<unsigned int>(cmd_list->IdxBuffer.Size);
     }
 
-    // Destroy the temporary VAO
-#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    glDeleteVertexArrays(1, &vertex_array_object);
-#endif
-
-    // Restore modified GL state
-    glUseProgram(last_program);
-    glBindTexture(GL_TEXTURE_2D, last_texture);
-#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_BIND_SAMPLER
-    if (bd->GlVersion >= 330)
-        glBindSampler(0, last_sampler);
-#endif
-    glActiveTexture(last_active_texture);
-#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    glBindVertexArray(last_vertex_array_object);
-#endif
-    glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
-#ifndef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
-    last_vtx_attrib_state_pos.SetState(bd->AttribLocationVtxPos);
-    last_vtx_attrib_state_uv.SetState(bd->AttribLocationVtxUV);
-    last_vtx_attrib_state_color.SetState(bd->AttribLocationVtxColor);
-#endif
-    glBlendEquationSeparate(last_blend_equation_rgb, last_blend_equation_alpha);
-    glBlendFuncSeparate(last_blend_src_rgb, last_blend_dst_rgb, last_blend_src_alpha, last_blend_dst_alpha);
-
-    if (last_enable_blend)
-        glEnable(GL_BLEND);
-    else
-        glDisable(GL_BLEND);
-
-    if (last_enable_cull_face)
-        glEnable(GL_CULL_FACE);
-    else
-        glDisable(GL_CULL_FACE);
-
-    if (last_enable_depth_test)
-        glEnable(GL_DEPTH_TEST);
-    else
-        glDisable(GL_DEPTH_TEST);
-
-    if (last_enable_stencil_test)
-        glEnable(GL_STENCIL_TEST);
-    else
-        glDisable(GL_STENCIL_TEST);
-
-    if (last_enable_scissor_test)
-        glEnable(GL_SCISSOR_TEST);
-    else
-        glDisable(GL_SCISSOR_TEST);
-#ifdef IMGUI_IMPL_OPENGL_MAY_HAVE_PRIMITIVE_RESTART
-    if (bd->GlVersion >= 310)
-    {
-        if (last_enable_primitive_restart)
-            glEnable(GL_PRIMITIVE_RESTART);
-        else
-            glDisable(GL_PRIMITIVE_RESTART);
-    }
-#endif
-
-#ifdef IMGUI_IMPL_HAS_POLYGON_MODE
-    glPolygonMode(GL_FRONT_AND_BACK, (GLenum)last_polygon_mode[0]);
-#endif
-    glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
-    glScissor(last_scissor_box[0], last_scissor_box[1], (GLsizei)last_scissor_box[2], (GLsizei)last_scissor_box[3]);
-    (void)bd; // Not all compilation paths use this
+    // gui.cpp clears the next frame with glClear(), which the scissor would clip.
+    glDisable(GL_SCISSOR_TEST);
 }
 
 bool ImGui_ImplSwitch_CreateFontsTexture(void)
@@ -924,9 +867,15 @@ bool ImGui_ImplSwitch_CreateDeviceObjects(void)
     bd->AttribLocationVtxUV = static_cast<GLuint>(glGetAttribLocation(bd->ShaderHandle, "UV"));
     bd->AttribLocationVtxColor = static_cast<GLuint>(glGetAttribLocation(bd->ShaderHandle, "Color"));
 
-    // Create buffers
+    // Create buffers, and the VAO that keeps their layout across frames
     glGenBuffers(1, &bd->VboHandle);
     glGenBuffers(1, &bd->ElementsHandle);
+    bd->VertexBufferSize = 0;
+    bd->IndexBufferSize = 0;
+#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
+    glGenVertexArrays(1, &bd->VaoHandle);
+#endif
+    bd->StateReady = false;
 
     ImGui_ImplSwitch_CreateFontsTexture();
 
@@ -943,6 +892,15 @@ bool ImGui_ImplSwitch_CreateDeviceObjects(void)
 void ImGui_ImplSwitch_DestroyDeviceObjects(void)
 {
     ImGui_ImplSwitch_Data *bd = ImGui_ImplSwitch_GetBackendData();
+    bd->StateReady = false;
+
+#ifdef IMGUI_IMPL_OPENGL_USE_VERTEX_ARRAY
+    if (bd->VaoHandle)
+    {
+        glDeleteVertexArrays(1, &bd->VaoHandle);
+        bd->VaoHandle = 0;
+    }
+#endif
 
     if (bd->VboHandle)
     {
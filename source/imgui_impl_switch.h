@@ -38,6 +38,9 @@ enum FontType {
 IMGUI_IMPL_API bool ImGui_ImplSwitch_Init(const char *glsl_version = nullptr);
 IMGUI_IMPL_API void ImGui_ImplSwitch_Shutdown(void);
 IMGUI_IMPL_API u64 ImGui_ImplSwitch_NewFrame(void);
+// Whether a button, stick or the touch screen is in use right now. Reads
+// its own pad state, so NewFrame() still sees every press.
+IMGUI_IMPL_API bool ImGui_ImplSwitch_InputActive(void);
 IMGUI_IMPL_API void ImGui_ImplSwitch_RenderDrawData(ImDrawData *draw_data);
 
 // (Optional) Called by Init/NewFrame/Shutdown
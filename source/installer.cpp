@@ -0,0 +1,997 @@
+#include <switch.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zstd.h>
+
+#include "clients/remote_client.h"
+#include "installer.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "lang.h"
+#include "logger.h"
+#include "remote_block_cache.h"
+#include "remote_reader.h"
+#include "threads.h"
+#include "util.h"
+#include "windows.h"
+#include "cancel.h"
+
+namespace
+{
+    const uint32_t kMagicPfs0 = 0x30534650; // "PFS0"
+    const uint32_t kMagicHfs0 = 0x30534648; // "HFS0"
+    const uint64_t kMagicNczSection = 0x4e544345535a434eULL; // "NCZSECTN"
+    const uint64_t kMagicNczBlock = 0x4b434f4c425a434eULL;   // "NCZBLOCK"
+    // An NCZ keeps the NCA header as it is; the compressed body follows.
+    const uint64_t kNczHeadSize = 0x4000;
+    const size_t kChunkSize = 1024 * 1024;
+    // Decoded chunks waiting for their placeholder write.
+    const size_t kQueuedChunks = 4;
+
+    struct PackageEntry
+    {
+        std::string name;
+        // Absolute offset in the package.
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    bool HasSuffix(const std::string &name, const char *suffix)
+    {
+        size_t len = strlen(suffix);
+        return name.size() >= len && strcasecmp(name.c_str() + name.size() - len, suffix) == 0;
+    }
+
+    // Contents are named after their id, 32 hex digits.
+    bool ParseContentId(const std::string &name, NcmContentId &id)
+    {
+        if (name.size() < 32)
+            return false;
+        for (int i = 0; i < 16; ++i)
+        {
+            char byte[3] = {name[i * 2], name[i * 2 + 1], 0};
+            char *end = nullptr;
+            unsigned long value = strtoul(byte, &end, 16);
+            if (end != byte + 2)
+                return false;
+            id.c[i] = (u8)value;
+        }
+        return true;
+    }
+
+    // Reads ranges of the package through the block cache, which keeps
+    // the blocks ahead of the reader in flight as parallel ranged requests.
+    class PackageSource
+    {
+    public:
+        PackageSource(RemoteClient *client, const std::string &path, uint64_t size)
+        {
+            ReadHints hints;
+            hints.size = (int64_t)size;
+            reader = client->OpenRead(path, hints);
+            if (reader != nullptr)
+            {
+                cache.reset(new RemoteBlockCache(*reader));
+                cache->Start();
+            }
+        }
+
+        ~PackageSource()
+        {
+            // The fetch thread may still be reading through the reader.
+            cache.reset();
+        }
+
+        bool IsOpen() const { return cache != nullptr; }
+        uint64_t Size() const { return cache->Size(); }
+
+        bool ReadAt(uint64_t offset, void *out, size_t size)
+        {
+            char *dst = (char *)out;
+            while (size > 0)
+            {
+                const void *data;
+                ssize_t got = cache->Read(offset, &data);
+                if (got <= 0)
+                    return false;
+                size_t n = std::min(size, (size_t)got);
+                memcpy(dst, data, n);
+                dst += n;
+                offset += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        // Hands [offset, offset + size) to `on_data` a cached block at a time.
+        template <typename Fn>
+        bool Stream(uint64_t offset, uint64_t size, Fn on_data)
+        {
+            while (size > 0)
+            {
+                if (Cancel::Stopped())
+                    return false;
+                const void *data;
+                ssize_t got = cache->Read(offset, &data);
+                if (got <= 0)
+                    return false;
+                size_t n = (size_t)std::min(size, (uint64_t)got);
+                if (!on_data((const char *)data, n))
+                    return false;
+                offset += n;
+                size -= n;
+            }
+            return true;
+        }
+
+    private:
+        std::unique_ptr<RemoteReader> reader;
+        std::unique_ptr<RemoteBlockCache> cache;
+    };
+
+    // PFS0 (nsp) and HFS0 (xci) share a layout apart from the entry size.
+    bool ReadPartition(PackageSource &src, uint64_t base, std::vector<PackageEntry> &entries)
+    {
+        struct
+        {
+            uint32_t magic;
+            uint32_t file_count;
+            uint32_t string_table_size;
+            uint32_t reserved;
+        } header;
+        if (!src.ReadAt(base, &header, sizeof(header)))
+            return false;
+        size_t entry_size;
+        if (header.magic == kMagicPfs0)
+            entry_size = 0x18;
+        else if (header.magic == kMagicHfs0)
+            entry_size = 0x40;
+        else
+            return false;
+        if (header.file_count == 0 || header.file_count > 4096 || header.string_table_size > 0x100000)
+            return false;
+
+        std::vector<char> table(header.file_count * entry_size + header.string_table_size + 1, 0);
+        if (!src.ReadAt(base + sizeof(header), table.data(), table.size() - 1))
+            return false;
+        const char *strings = table.data() + header.file_count * entry_size;
+        uint64_t data_start = base + sizeof(header) + table.size() - 1;
+
+        for (uint32_t i = 0; i < header.file_count; ++i)
+        {
+            const char *raw = table.data() + i * entry_size;
+            uint64_t offset, size;
+            uint32_t name_offset;
+            memcpy(&offset, raw, 8);
+            memcpy(&size, raw + 8, 8);
+            memcpy(&name_offset, raw + 16, 4);
+            if (name_offset >= header.string_table_size)
+                return false;
+            PackageEntry entry;
+            entry.name = strings + name_offset;
+            entry.offset = data_start + offset;
+            entry.size = size;
+            if (entry.offset + entry.size > src.Size())
+                return false;
+            entries.push_back(entry);
+        }
+        return true;
+    }
+
+    struct NczSection
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t crypto_type;
+        uint64_t padding;
+        uint8_t key[16];
+        uint8_t counter[16];
+    };
+
+    struct NczBlocks
+    {
+        uint32_t exponent = 0;
+        uint64_t decompressed_size = 0;
+        std::vector<uint32_t> sizes;
+    };
+
+    struct NczLayout
+    {
+        std::vector<NczSection> sections;
+        bool block = false;
+        NczBlocks blocks;
+        // Absolute offset of the compressed body and its length.
+        uint64_t body = 0;
+        uint64_t body_size = 0;
+        uint64_t nca_size = 0;
+    };
+
+    bool ReadNczLayout(PackageSource &src, const PackageEntry &entry, NczLayout &out)
+    {
+        uint64_t pos = entry.offset + kNczHeadSize;
+        uint64_t head[2];
+        if (entry.size <= kNczHeadSize + sizeof(head) || !src.ReadAt(pos, head, sizeof(head)) ||
+            head[0] != kMagicNczSection || head[1] == 0 || head[1] > 64)
+            return false;
+        pos += sizeof(head);
+        out.sections.resize(head[1]);
+        if (!src.ReadAt(pos, out.sections.data(), out.sections.size() * sizeof(NczSection)))
+            return false;
+        pos += out.sections.size() * sizeof(NczSection);
+
+        out.nca_size = kNczHeadSize;
+        for (const NczSection &section : out.sections)
+        {
+            // XTS sections never occur past the header, which stays as is.
+            if (section.crypto_type == 2 || section.crypto_type > 4)
+                return false;
+            out.nca_size = std::max(out.nca_size, section.offset + section.size);
+        }
+
+        uint64_t magic;
+        if (!src.ReadAt(pos, &magic, sizeof(magic)))
+            return false;
+        if (magic == kMagicNczBlock)
+        {
+            // magic, version, type, unused, exponent, count, decompressed size.
+            uint8_t header[24];
+            if (!src.ReadAt(pos, header, sizeof(header)))
+                return false;
+            uint32_t count;
+            out.block = true;
+            out.blocks.exponent = header[11];
+            memcpy(&count, header + 12, 4);
+            memcpy(&out.blocks.decompressed_size, header + 16, 8);
+            if (out.blocks.exponent < 14 || out.blocks.exponent > 32 || count == 0 || count > 0x100000)
+                return false;
+            pos += sizeof(header);
+            out.blocks.sizes.resize(count);
+            if (!src.ReadAt(pos, out.blocks.sizes.data(), count * sizeof(uint32_t)))
+                return false;
+            pos += count * sizeof(uint32_t);
+        }
+        out.body = pos;
+        if (pos >= entry.offset + entry.size)
+            return false;
+        out.body_size = entry.offset + entry.size - pos;
+        return true;
+    }
+
+    // Puts the decrypted NCA bytes at `offset` back under their sections'
+    // AES-CTR encryption.
+    void EncryptSections(const std::vector<NczSection> &sections, uint64_t offset, char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            const NczSection *in = nullptr;
+            uint64_t next = UINT64_MAX;
+            for (const NczSection &section : sections)
+            {
+                if (offset >= section.offset && offset < section.offset + section.size)
+                    in = &section;
+                else if (section.offset > offset)
+                    next = std::min(next, section.offset);
+            }
+            size_t run = in ? (size_t)std::min((uint64_t)size, in->offset + in->size - offset)
+                            : (size_t)std::min((uint64_t)size, next - offset);
+            if (in && in->crypto_type >= 3)
+            {
+                uint8_t counter[16];
+                memcpy(counter, in->counter, 16);
+                uint64_t block = offset >> 4;
+                for (int i = 0; i < 8; ++i)
+                {
+                    counter[15 - i] = (uint8_t)block;
+                    block >>= 8;
+                }
+                Aes128CtrContext ctx;
+                aes128CtrContextCreate(&ctx, in->key, counter);
+                if (offset & 15)
+                {
+                    uint8_t skip[16] = {0};
+                    aes128CtrCrypt(&ctx, skip, skip, offset & 15);
+                }
+                aes128CtrCrypt(&ctx, data, data, run);
+            }
+            offset += run;
+            data += run;
+            size -= run;
+        }
+    }
+
+    // Decompresses and re-encrypts one NCZ on its own thread, handing NCA
+    // chunks to the installing thread, which writes them meanwhile.
+    class NczDecoder
+    {
+    public:
+        NczDecoder(PackageSource &src, const NczLayout &layout)
+            : src(src), layout(layout)
+        {
+        }
+
+        ~NczDecoder()
+        {
+            if (started)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    closing = true;
+                }
+                cv.notify_all();
+                Threads::Join(&thread);
+            }
+        }
+
+        bool Start()
+        {
+            Result rc = Threads::Create(&thread, decodeThread, this, 0x10000, Threads::ROLE_COMPUTE, "ncz decode");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL ncz threadCreate failed rc=0x%x", rc);
+                return false;
+            }
+            threadStart(&thread);
+            started = true;
+            return true;
+        }
+
+        // Takes the next chunk; false at the end, see Failed().
+        bool Next(TransferBuffer &out, size_t &size, uint64_t &offset)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]
+                    { return !queue.empty() || finished; });
+            if (queue.empty())
+                return false;
+            out = std::move(queue.front().buffer);
+            size = queue.front().size;
+            offset = queue.front().offset;
+            queue.pop_front();
+            cv.notify_all();
+            return true;
+        }
+
+        bool Failed() const { return failed; }
+        // Compressed bytes read so far, for the progress bar.
+        uint64_t Consumed() const { return consumed; }
+
+    private:
+        struct Chunk
+        {
+            TransferBuffer buffer;
+            size_t size = 0;
+            uint64_t offset = 0;
+        };
+
+        PackageSource &src;
+        const NczLayout &layout;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Chunk> queue;
+        bool finished = false;
+        bool failed = false;
+        bool closing = false;
+        bool started = false;
+        std::atomic<uint64_t> consumed{0};
+        Thread thread;
+
+        static void decodeThread(void *arg)
+        {
+            NczDecoder *self = (NczDecoder *)arg;
+            bool ok = self->layout.block ? self->decodeBlocks() : self->decodeStream();
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->failed = !ok;
+            self->finished = true;
+            self->cv.notify_all();
+        }
+
+        bool push(Chunk &chunk)
+        {
+            EncryptSections(layout.sections, chunk.offset, chunk.buffer.data(), chunk.size);
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]
+                    { return queue.size() < kQueuedChunks || closing; });
+            if (closing)
+                return false;
+            queue.push_back(std::move(chunk));
+            cv.notify_all();
+            return true;
+        }
+
+        bool decodeStream()
+        {
+            ZSTD_DStream *stream = ZSTD_createDStream();
+            if (!stream)
+                return false;
+            ZSTD_initDStream(stream);
+
+            uint64_t out_offset = kNczHeadSize;
+            Chunk chunk;
+            bool ok = chunk.buffer.Acquire(kChunkSize);
+            chunk.offset = out_offset;
+            ok = ok && src.Stream(layout.body, layout.body_size, [&](const char *data, size_t size)
+                                  {
+                                      ZSTD_inBuffer in = {data, size, 0};
+                                      while (in.pos < in.size)
+                                      {
+                                          ZSTD_outBuffer out = {chunk.buffer.data(), kChunkSize, chunk.size};
+                                          size_t rc = ZSTD_decompressStream(stream, &out, &in);
+                                          if (ZSTD_isError(rc))
+                                          {
+                                              Logger::Logf(Logger::LOG_ERROR, "INSTALL ncz zstd error=%s", ZSTD_getErrorName(rc));
+                                              return false;
+                                          }
+                                          chunk.size = out.pos;
+                                          if (chunk.size == kChunkSize)
+                                          {
+                                              out_offset += chunk.size;
+                                              if (!push(chunk))
+                                                  return false;
+                                              chunk = Chunk();
+                                              chunk.offset = out_offset;
+                                              if (!chunk.buffer.Acquire(kChunkSize))
+                                                  return false;
+                                          }
+                                      }
+                                      consumed += size;
+                                      return true; });
+            ZSTD_freeDStream(stream);
+            if (ok && chunk.size > 0)
+            {
+                out_offset += chunk.size;
+                ok = push(chunk);
+            }
+            return ok && out_offset == layout.nca_size;
+        }
+
+        bool decodeBlocks()
+        {
+            const uint64_t block_size = 1ULL << layout.blocks.exponent;
+            uint64_t in_offset = layout.body;
+            uint64_t out_offset = kNczHeadSize;
+            uint64_t remaining = layout.blocks.decompressed_size;
+            TransferBuffer packed;
+            for (uint32_t compressed : layout.blocks.sizes)
+            {
+                if (Cancel::Stopped() || remaining == 0)
+                    return false;
+                size_t size = (size_t)std::min(block_size, remaining);
+                if (compressed > size || !packed.Acquire(compressed) || !src.ReadAt(in_offset, packed.data(), compressed))
+                    return false;
+
+                Chunk chunk;
+                if (!chunk.buffer.Acquire(size))
+                    return false;
+                if (compressed < size)
+                {
+                    size_t rc = ZSTD_decompress(chunk.buffer.data(), size, packed.data(), compressed);
+                    if (ZSTD_isError(rc) || rc != size)
+                        return false;
+                }
+                else
+                {
+                    // Blocks that did not shrink are stored.
+                    memcpy(chunk.buffer.data(), packed.data(), size);
+                }
+                chunk.size = size;
+                chunk.offset = out_offset;
+                in_offset += compressed;
+                out_offset += size;
+                remaining -= size;
+                consumed = in_offset - layout.body;
+                if (!push(chunk))
+                    return false;
+            }
+            return remaining == 0 && out_offset == layout.nca_size;
+        }
+    };
+
+    // ns ContentStorageRecord, one per content meta of an application.
+    struct StorageRecord
+    {
+        NcmContentMetaKey key;
+        u8 storage_id;
+        u8 padding[7];
+    };
+
+    class Install
+    {
+    public:
+        explicit Install(PackageSource &src) : src(src) {}
+
+        ~Install()
+        {
+            if (!committed)
+            {
+                // Nothing of a failed install stays behind.
+                for (NcmContentId &id : registered)
+                    ncmContentStorageDelete(&storage, &id);
+            }
+            if (storage_open)
+                ncmContentStorageClose(&storage);
+            if (db_open)
+                ncmContentMetaDatabaseClose(&db);
+        }
+
+        bool Open(NcmStorageId id)
+        {
+            storage_id = id;
+            Result rc = ncmOpenContentStorage(&storage, id);
+            storage_open = R_SUCCEEDED(rc);
+            if (storage_open)
+            {
+                rc = ncmOpenContentMetaDatabase(&db, id);
+                db_open = R_SUCCEEDED(rc);
+            }
+            if (R_FAILED(rc))
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL ncm open failed storage=%d rc=0x%x", (int)id, rc);
+            return storage_open && db_open;
+        }
+
+        bool WriteContent(const PackageEntry &entry)
+        {
+            NcmContentId id;
+            if (!ParseContentId(entry.name, id))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL bad content name=%s", entry.name.c_str());
+                return false;
+            }
+            bool ncz = HasSuffix(entry.name, ".ncz");
+            NczLayout layout;
+            if (ncz && !ReadNczLayout(src, entry, layout))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL bad ncz name=%s", entry.name.c_str());
+                return false;
+            }
+            uint64_t nca_size = ncz ? layout.nca_size : entry.size;
+            if (HasSuffix(entry.name, ".cnmt.nca"))
+                metas.push_back(Meta{id, nca_size});
+
+            bool has = false;
+            if (R_SUCCEEDED(ncmContentStorageHas(&storage, &has, &id)) && has)
+            {
+                Logger::Logf("INSTALL content present name=%s", entry.name.c_str());
+                done += entry.size;
+                return true;
+            }
+
+            NcmPlaceHolderId placeholder;
+            Result rc = ncmContentStorageGeneratePlaceHolderId(&storage, &placeholder);
+            if (R_SUCCEEDED(rc))
+            {
+                ncmContentStorageDeletePlaceHolder(&storage, &placeholder);
+                rc = ncmContentStorageCreatePlaceHolder(&storage, &id, &placeholder, (s64)nca_size);
+            }
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL placeholder failed name=%s size=%llu rc=0x%x",
+                             entry.name.c_str(), (unsigned long long)nca_size, rc);
+                return false;
+            }
+
+            uint64_t start = Util::GetTick();
+            bool ok = ncz ? writeNcz(entry, layout, placeholder) : writePlain(entry, placeholder);
+            if (ok)
+            {
+                rc = ncmContentStorageRegister(&storage, &id, &placeholder);
+                ok = R_SUCCEEDED(rc);
+                if (ok)
+                    registered.push_back(id);
+                else
+                    Logger::Logf(Logger::LOG_ERROR, "INSTALL register failed name=%s rc=0x%x", entry.name.c_str(), rc);
+            }
+            ncmContentStorageDeletePlaceHolder(&storage, &placeholder);
+            if (ok)
+            {
+                double secs = (Util::GetTick() - start) / 1000000.0;
+                Logger::Logf("INSTALL content name=%s size=%llu ncz=%d elapsed=%.2fs avg=%.2f MiB/s", entry.name.c_str(),
+                             (unsigned long long)nca_size, ncz ? 1 : 0, secs,
+                             secs > 0 ? entry.size / 1048576.0 / secs : 0.0);
+            }
+            return ok;
+        }
+
+        // Registers the content meta of every cnmt written and the
+        // application records, then commits.
+        bool Commit()
+        {
+            for (const Meta &meta : metas)
+            {
+                if (!registerMeta(meta))
+                    return false;
+            }
+            Result rc = ncmContentMetaDatabaseCommit(&db);
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL meta commit failed rc=0x%x", rc);
+                return false;
+            }
+            committed = true;
+            return true;
+        }
+
+        // Package bytes handled so far, for the progress bar.
+        uint64_t done = 0;
+
+    private:
+        struct Meta
+        {
+            NcmContentId id;
+            uint64_t size;
+        };
+
+        PackageSource &src;
+        NcmStorageId storage_id = NcmStorageId_SdCard;
+        NcmContentStorage storage;
+        NcmContentMetaDatabase db;
+        bool storage_open = false;
+        bool db_open = false;
+        bool committed = false;
+        std::vector<NcmContentId> registered;
+        std::vector<Meta> metas;
+
+        bool writePlain(const PackageEntry &entry, NcmPlaceHolderId &placeholder)
+        {
+            uint64_t written = 0;
+            uint64_t base = done;
+            bool ok = src.Stream(entry.offset, entry.size, [&](const char *data, size_t size)
+                                 {
+                                     Result rc = ncmContentStorageWritePlaceHolder(&storage, &placeholder, written, data, size);
+                                     if (R_FAILED(rc))
+                                     {
+                                         Logger::Logf(Logger::LOG_ERROR, "INSTALL write failed name=%s offset=%llu rc=0x%x",
+                                                      entry.name.c_str(), (unsigned long long)written, rc);
+                                         return false;
+                                     }
+                                     written += size;
+                                     bytes_transfered = base + written;
+                                     return true; });
+            done = base + entry.size;
+            return ok;
+        }
+
+        bool writeNcz(const PackageEntry &entry, const NczLayout &layout, NcmPlaceHolderId &placeholder)
+        {
+            // The NCA header is stored as it is.
+            TransferBuffer head(kNczHeadSize);
+            Result rc = 0;
+            if (!head.data() || !src.ReadAt(entry.offset, head.data(), kNczHeadSize) ||
+                R_FAILED(rc = ncmContentStorageWritePlaceHolder(&storage, &placeholder, 0, head.data(), kNczHeadSize)))
+                return false;
+            head.Release();
+
+            uint64_t base = done;
+            NczDecoder decoder(src, layout);
+            if (!decoder.Start())
+                return false;
+            TransferBuffer chunk;
+            size_t size;
+            uint64_t offset;
+            bool ok = true;
+            while (decoder.Next(chunk, size, offset))
+            {
+                rc = ncmContentStorageWritePlaceHolder(&storage, &placeholder, offset, chunk.data(), size);
+                chunk.Release();
+                if (R_FAILED(rc))
+                {
+                    Logger::Logf(Logger::LOG_ERROR, "INSTALL write failed name=%s offset=%llu rc=0x%x",
+                                 entry.name.c_str(), (unsigned long long)offset, rc);
+                    ok = false;
+                    break;
+                }
+                bytes_transfered = base + kNczHeadSize + decoder.Consumed();
+            }
+            done = base + entry.size;
+            return ok && !decoder.Failed() && !Cancel::Stopped();
+        }
+
+        bool readMeta(const Meta &meta, std::vector<char> &cnmt)
+        {
+            char path[FS_MAX_PATH] = {0};
+            Result rc = ncmContentStorageGetPath(&storage, path, sizeof(path), &meta.id);
+            FsFileSystem fs;
+            if (R_SUCCEEDED(rc))
+                rc = fsOpenFileSystemWithId(&fs, 0, FsFileSystemType_ContentMeta, path, FsContentAttributes_All);
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL cnmt open failed rc=0x%x", rc);
+                return false;
+            }
+
+            bool ok = false;
+            FsDir dir;
+            if (R_SUCCEEDED(fsFsOpenDirectory(&fs, "/", FsDirOpenMode_ReadFiles, &dir)))
+            {
+                FsDirectoryEntry dirent;
+                s64 count = 0;
+                while (!ok && R_SUCCEEDED(fsDirRead(&dir, &count, 1, &dirent)) && count == 1)
+                {
+                    std::string file = dirent.name;
+                    if (!HasSuffix(file, ".cnmt"))
+                        continue;
+                    FsFile fp;
+                    std::string full = "/" + file;
+                    if (R_FAILED(fsFsOpenFile(&fs, full.c_str(), FsOpenMode_Read, &fp)))
+                        break;
+                    s64 size = 0;
+                    u64 got = 0;
+                    if (R_SUCCEEDED(fsFileGetSize(&fp, &size)) && size >= 0x20 && size < 0x100000)
+                    {
+                        cnmt.resize((size_t)size);
+                        ok = R_SUCCEEDED(fsFileRead(&fp, 0, cnmt.data(), (u64)size, FsReadOption_None, &got)) &&
+                             got == (u64)size;
+                    }
+                    fsFileClose(&fp);
+                }
+                fsDirClose(&dir);
+            }
+            fsFsClose(&fs);
+            return ok;
+        }
+
+        bool registerMeta(const Meta &meta)
+        {
+            std::vector<char> cnmt;
+            if (!readMeta(meta, cnmt))
+                return false;
+
+            // Packaged content meta: a 0x20 byte header, the extended
+            // header, 0x38 byte content infos (a hash, then the install
+            // form) and 0x10 byte content meta infos.
+            const char *raw = cnmt.data();
+            NcmContentMetaKey key = {};
+            uint16_t ext_size, content_count, meta_count;
+            memcpy(&key.id, raw, 8);
+            memcpy(&key.version, raw + 8, 4);
+            key.type = (u8)raw[0x0c];
+            key.install_type = NcmContentInstallType_Full;
+            memcpy(&ext_size, raw + 0x0e, 2);
+            memcpy(&content_count, raw + 0x10, 2);
+            memcpy(&meta_count, raw + 0x12, 2);
+            uint8_t attributes = (uint8_t)raw[0x14];
+            size_t infos = 0x20 + ext_size;
+            if (infos + content_count * 0x38 + meta_count * 0x10 > cnmt.size())
+                return false;
+
+            // Install form: an 8 byte header, the extended header, the
+            // content infos led by the meta content itself, less the delta
+            // fragments, and the content meta infos.
+            std::vector<char> out(8);
+            out.insert(out.end(), raw + 0x20, raw + infos);
+            char self[0x18] = {0};
+            memcpy(self, meta.id.c, 16);
+            for (int i = 0; i < 6; ++i)
+                self[16 + i] = (char)(meta.size >> (8 * i));
+            self[0x16] = NcmContentType_Meta;
+            out.insert(out.end(), self, self + sizeof(self));
+            uint16_t installed = 1;
+            for (uint16_t i = 0; i < content_count; ++i)
+            {
+                const char *info = raw + infos + i * 0x38 + 0x20;
+                if ((u8)info[0x16] == NcmContentType_DeltaFragment)
+                    continue;
+                out.insert(out.end(), info, info + 0x18);
+                installed++;
+            }
+            const char *metas_at = raw + infos + content_count * 0x38;
+            out.insert(out.end(), metas_at, metas_at + meta_count * 0x10);
+            memcpy(out.data(), &ext_size, 2);
+            memcpy(out.data() + 2, &installed, 2);
+            memcpy(out.data() + 4, &meta_count, 2);
+            out[6] = (char)attributes;
+            out[7] = 0;
+
+            Result rc = ncmContentMetaDatabaseSet(&db, &key, out.data(), out.size());
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL meta set failed id=%016llx rc=0x%x", (unsigned long long)key.id, rc);
+                return false;
+            }
+            Logger::Logf("INSTALL meta id=%016llx version=%u type=0x%x contents=%u", (unsigned long long)key.id,
+                         key.version, key.type, installed);
+            return pushRecord(key);
+        }
+
+        bool pushRecord(const NcmContentMetaKey &key)
+        {
+            u64 app_id = key.id;
+            if (key.type == NcmContentMetaType_Patch)
+                app_id = key.id ^ 0x800;
+            else if (key.type == NcmContentMetaType_AddOnContent)
+                app_id = (key.id ^ 0x1000) & ~0xfffULL;
+            else if (key.type != NcmContentMetaType_Application)
+                return true;
+
+            Service *ns = nsGetServiceSession_ApplicationManagerInterface();
+            // The record lists every content meta of the application; keep
+            // the others and replace ours.
+            std::vector<StorageRecord> records(64);
+            struct
+            {
+                u64 offset;
+                u64 application_id;
+            } list_in = {0, app_id};
+            s32 listed = 0;
+            Result rc = serviceDispatchInOut(ns, 17, list_in, listed,
+                                             .buffer_attrs = {SfBufferAttr_HipcMapAlias | SfBufferAttr_Out},
+                                             .buffers = {{records.data(), records.size() * sizeof(StorageRecord)}});
+            records.resize(R_SUCCEEDED(rc) && listed > 0 ? std::min((size_t)listed, records.size()) : 0);
+            bool had = !records.empty();
+            records.erase(std::remove_if(records.begin(), records.end(), [&key](const StorageRecord &record)
+                                         { return record.key.id == key.id && record.key.type == key.type; }),
+                          records.end());
+            StorageRecord mine = {};
+            mine.key = key;
+            mine.storage_id = storage_id;
+            records.push_back(mine);
+
+            if (had)
+                serviceDispatchIn(ns, 27, app_id);
+            struct
+            {
+                u8 last_modified_event;
+                u8 padding[7];
+                u64 application_id;
+            } push_in = {3, {0}, app_id};
+            rc = serviceDispatchIn(ns, 16, push_in,
+                                   .buffer_attrs = {SfBufferAttr_HipcMapAlias | SfBufferAttr_In},
+                                   .buffers = {{records.data(), records.size() * sizeof(StorageRecord)}});
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL record failed app=%016llx rc=0x%x", (unsigned long long)app_id, rc);
+                return false;
+            }
+            return true;
+        }
+    };
+
+    bool ImportTicket(const std::vector<char> &ticket, const std::vector<char> &cert)
+    {
+        Service es;
+        Result rc = smGetService(&es, "es");
+        if (R_SUCCEEDED(rc))
+        {
+            rc = serviceDispatch(&es, 1,
+                                 .buffer_attrs = {SfBufferAttr_HipcMapAlias | SfBufferAttr_In,
+                                                  SfBufferAttr_HipcMapAlias | SfBufferAttr_In},
+                                 .buffers = {{ticket.data(), ticket.size()}, {cert.data(), cert.size()}});
+            serviceClose(&es);
+        }
+        if (R_FAILED(rc))
+            Logger::Logf(Logger::LOG_ERROR, "INSTALL ticket import failed rc=0x%x", rc);
+        return R_SUCCEEDED(rc);
+    }
+}
+
+namespace Installer
+{
+    bool CanInstall(const DirEntry &file)
+    {
+        std::string name = file.name;
+        return !file.isDir && (HasSuffix(name, ".nsp") || HasSuffix(name, ".nsz") ||
+                               HasSuffix(name, ".xci") || HasSuffix(name, ".xcz"));
+    }
+
+    int InstallRemote(const DirEntry &file, RemoteClient *client)
+    {
+        std::string name = file.name;
+        if (HasSuffix(name, ".xci") || HasSuffix(name, ".xcz"))
+        {
+            // Game card NCAs are marked for card distribution; installing
+            // them needs the header rewritten with keys this app does not
+            // hold.
+            Logger::Logf(Logger::LOG_WARN, "INSTALL xci not supported path=%s", file.path);
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_INSTALL_SKIPPED], file.name);
+            return 0;
+        }
+
+        int64_t size = file.file_size;
+        if (size <= 0)
+            client->Size(file.path, &size);
+        if (size <= 0)
+        {
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_INSTALL_FAILED], file.name);
+            return 0;
+        }
+
+        snprintf(activity_message, 255, "%s %s", lang_strings[STR_INSTALLING], file.name);
+        bytes_to_download = size;
+        bytes_transfered = 0;
+        prev_tick = Util::GetTick();
+
+        Result rc = ncmInitialize();
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "INSTALL ncmInitialize failed rc=0x%x", rc);
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_INSTALL_FAILED], file.name);
+            return 0;
+        }
+        rc = nsInitialize();
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "INSTALL nsInitialize failed rc=0x%x", rc);
+            ncmExit();
+            snprintf(status_message, 1023, "%s %s", lang_strings[STR_INSTALL_FAILED], file.name);
+            return 0;
+        }
+
+        uint64_t start = Util::GetTick();
+        int ret = 0;
+        {
+            PackageSource src(client, file.path, (uint64_t)size);
+            std::vector<PackageEntry> entries;
+            Install install(src);
+            if (!src.IsOpen())
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL open failed path=%s err=%s", file.path, client->LastResponse());
+            }
+            else if (!ReadPartition(src, 0, entries))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "INSTALL bad package header path=%s", file.path);
+            }
+            else if (install.Open(install_to_nand ? NcmStorageId_BuiltInUser : NcmStorageId_SdCard))
+            {
+                // In file order, so the cache's read-ahead keeps up.
+                std::sort(entries.begin(), entries.end(), [](const PackageEntry &a, const PackageEntry &b)
+                          { return a.offset < b.offset; });
+                std::vector<std::pair<std::vector<char>, std::string>> tickets, certs;
+                bool ok = true;
+                for (const PackageEntry &entry : entries)
+                {
+                    if (!ok || Cancel::Stopped())
+                        break;
+                    bool tik = HasSuffix(entry.name, ".tik");
+                    if (tik || HasSuffix(entry.name, ".cert"))
+                    {
+                        std::vector<char> data((size_t)std::min(entry.size, (uint64_t)0x100000));
+                        ok = src.ReadAt(entry.offset, data.data(), data.size());
+                        std::string stem = entry.name.substr(0, entry.name.rfind('.'));
+                        (tik ? tickets : certs).push_back(std::make_pair(std::move(data), stem));
+                        install.done += entry.size;
+                    }
+                    else if (HasSuffix(entry.name, ".nca") || HasSuffix(entry.name, ".ncz"))
+                    {
+                        ok = install.WriteContent(entry);
+                    }
+                    else
+                    {
+                        install.done += entry.size;
+                    }
+                    bytes_transfered = install.done;
+                }
+
+                for (size_t i = 0; ok && !Cancel::Stopped() && i < tickets.size(); ++i)
+                {
+                    auto cert = std::find_if(certs.begin(), certs.end(), [&](const std::pair<std::vector<char>, std::string> &c)
+                                             { return c.second == tickets[i].second; });
+                    if (cert != certs.end())
+                        ok = ImportTicket(tickets[i].first, cert->first);
+                    else
+                        Logger::Logf(Logger::LOG_WARN, "INSTALL ticket without cert name=%s", tickets[i].second.c_str());
+                }
+                if (ok && !Cancel::Stopped())
+                    ret = install.Commit() ? 1 : 0;
+            }
+        }
+        nsExit();
+        ncmExit();
+
+        double secs = (Util::GetTick() - start) / 1000000.0;
+        Logger::Logf("INSTALL %s path=%s size=%lld storage=%s elapsed=%.2fs avg=%.2f MiB/s", ret ? "done" : "failed",
+                     file.path, (long long)size, install_to_nand ? "nand" : "sd", secs,
+                     secs > 0 ? size / 1048576.0 / secs : 0.0);
+        if (Cancel::Stopped())
+            snprintf(status_message, 1023, "%s", lang_strings[STR_CANCEL_ACTION_MSG]);
+        else
+            snprintf(status_message, 1023, "%s %s", lang_strings[ret ? STR_INSTALL_SUCCESS : STR_INSTALL_FAILED], file.name);
+        return ret;
+    }
+}
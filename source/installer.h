@@ -0,0 +1,24 @@
+#ifndef NEO_INSTALLER_H
+#define NEO_INSTALLER_H
+
+#include "clients/remote_client.h"
+#include "common.h"
+
+// Installs NSP and NSZ packages straight from a remote site, without a
+// copy on the SD card. The PFS0 header is read through the block cache
+// (GetRanges, parallel ranged requests on WebDAV/HTTP, archive_prefetch
+// blocks ahead), tickets are imported, and every NCA is written into a
+// content storage placeholder as its blocks arrive, then registered with
+// the content meta and application record. NCZ contents are decompressed
+// and re-encrypted on a worker thread while the previous chunk is written.
+namespace Installer
+{
+    // Whether `file` is named like a package (nsp, nsz, xci, xcz).
+    bool CanInstall(const DirEntry &file);
+    // Installs `file` from `client` to the SD card, or to the console's
+    // storage with install_to_nand. Returns 1 on success and 0 on failure,
+    // with status_message saying why.
+    int InstallRemote(const DirEntry &file, RemoteClient *client);
+}
+
+#endif
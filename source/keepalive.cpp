@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "keepalive.h"
+#include "config.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    const uint64_t kNever = UINT64_MAX;
+
+    struct Entry
+    {
+        KeepAlive::Task task;
+        uint64_t deadline = kNever;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    // A handful of owners at most, so the earliest deadline is a scan.
+    std::map<std::string, Entry> tasks;
+    // The task out of the lock right now, for Cancel().
+    std::string running;
+    bool stopping = false;
+    bool thread_started = false;
+    Thread thread;
+
+    void KeepAliveThread(void *argp)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            auto next = tasks.end();
+            for (auto it = tasks.begin(); it != tasks.end(); ++it)
+            {
+                if (next == tasks.end() || it->second.deadline < next->second.deadline)
+                    next = it;
+            }
+            if (next == tasks.end() || next->second.deadline == kNever)
+            {
+                cv.wait(lock);
+                continue;
+            }
+            uint64_t now = Util::GetTick();
+            if (next->second.deadline > now)
+            {
+                cv.wait_for(lock, std::chrono::microseconds(next->second.deadline - now));
+                continue;
+            }
+
+            std::string name = next->first;
+            KeepAlive::Task task = next->second.task;
+            // A Schedule() while it runs leaves its deadline here.
+            next->second.deadline = kNever;
+            running = name;
+            lock.unlock();
+            int64_t delay = task();
+            lock.lock();
+            running.clear();
+            cv.notify_all();
+
+            auto it = tasks.find(name);
+            if (it == tasks.end())
+                continue;
+            if (delay >= 0)
+                it->second.deadline = std::min(it->second.deadline, Util::GetTick() + (uint64_t)delay);
+            else if (it->second.deadline == kNever)
+                tasks.erase(it);
+        }
+    }
+}
+
+namespace KeepAlive
+{
+    void Init()
+    {
+        if (keepalive_seconds <= 0)
+            return;
+        stopping = false;
+        // Room for an FTP login when a pooled session is replaced.
+        Result rc = Threads::Create(&thread, KeepAliveThread, nullptr, 0x20000, Threads::ROLE_BACKGROUND, "keep-alive");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "KEEPALIVE threadCreate failed rc=0x%x", rc);
+            return;
+        }
+        threadStart(&thread);
+        thread_started = true;
+        Logger::Logf("KEEPALIVE init seconds=%d pool_seconds=%d", keepalive_seconds, keepalive_pool_seconds);
+    }
+
+    void Exit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            cv.notify_all();
+        }
+        if (thread_started)
+        {
+            Threads::Join(&thread);
+            thread_started = false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.clear();
+    }
+
+    void Schedule(const char *name, const Task &task, uint64_t delay_us)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread_started || stopping)
+            return;
+        Entry &entry = tasks[name];
+        entry.task = task;
+        uint64_t at = Util::GetTick() + delay_us;
+        if (at < entry.deadline)
+        {
+            entry.deadline = at;
+            cv.notify_all();
+        }
+    }
+
+    void Cancel(const char *name)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        tasks.erase(name);
+        cv.wait(lock, [name]
+                { return running != name; });
+    }
+
+    uint64_t Interval()
+    {
+        return thread_started ? (uint64_t)keepalive_seconds * 1000000 : 0;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef NEO_KEEPALIVE_H
+#define NEO_KEEPALIVE_H
+
+#include <cstdint>
+#include <functional>
+
+// One thread keeps idle connections from being dropped by the server: the
+// pooled FTP and SMB sessions and the primary connection. Each owner is a
+// named task that says when it next wants to run; the thread sleeps until
+// the earliest of those deadlines, so nothing wakes while every connection
+// is busy or none is open. Tasks probe only what really sat idle for
+// keepalive_seconds (a NOOP, an SMB echo, an SSH keepalive) and log out
+// what failed the probe or went unused for keepalive_pool_seconds.
+namespace KeepAlive
+{
+    // Runs on the keep-alive thread. Returns the microseconds until it
+    // wants to run again, or -1 to wait for the next Schedule().
+    typedef std::function<int64_t()> Task;
+
+    void Init();
+    // Stops the thread; it may wait for a task in flight.
+    void Exit();
+
+    // Runs `task` as `name` after `delay_us`, or at the deadline it already
+    // has when that comes sooner. `name` must be a literal.
+    void Schedule(const char *name, const Task &task, uint64_t delay_us);
+    // Drops `name`, waiting for it when it is running, so what the task
+    // uses can go away afterwards.
+    void Cancel(const char *name);
+
+    // keepalive_seconds in microseconds, 0 when keep-alives are off.
+    uint64_t Interval();
+}
+
+#endif
@@ -145,6 +145,58 @@ char lang_strings[LANG_STRINGS_NUM][LANG_STR_SIZE] = {
 	"Failed to mount NFS share",															// STR_FAIL_MOUNT_NFS_MSG
 	"View Image",																			// STR_VIEW_IMAGE
 	"Language",                                                                             // STR_LANGUAGE
+	"Loading %d entries...",																// STR_LOADING_ENTRIES
+	"%d unfinished download(s) from this site, %.1f MiB left. Resume them?",				// STR_RESUME_DOWNLOADS_MSG
+	"Record transfer timing trace",															// STR_TRANSFER_TRACE
+	"Checksum mismatch, the downloaded file was deleted",									// STR_CHECKSUM_MISMATCH
+	"Sync to local",																		// STR_SYNC_TO_LOCAL
+	"Sync to remote",																		// STR_SYNC_TO_REMOTE
+	"Comparing",																			// STR_SYNC_COMPARING
+	"Already in sync",																		// STR_SYNC_UP_TO_DATE
+	"Connecting",																			// STR_CONNECTING
+	"Viewer",																				// STR_VIEWER
+	"Go to line",																			// STR_GO_TO_LINE
+	"Page up/down",																			// STR_PAGE_UP_DOWN
+	"Top/end",																				// STR_TOP_END
+	"Counting... %lld files",																// STR_COUNTING_FILES
+	"%lld files, %lld folders",																// STR_FOLDER_CONTENTS
+	"Not enough free space: %.1f MiB needed, %.1f MiB free",								// STR_NOT_ENOUGH_SPACE
+	"Background downloads are running; wait for them or cancel them first",				// STR_TRANSFERS_BUSY
+	"%d item(s) added to the download queue",												// STR_DOWNLOADS_QUEUED
+	"Build catalogue",																// STR_BUILD_CATALOGUE
+	"Cataloguing: %lld folders, %lld files",										// STR_CATALOGUE_PROGRESS
+	"Catalogue ready: %lld folders, %lld files",									// STR_CATALOGUE_BUILT
+	"%lld catalogue matches (%lld shown)",											// STR_CATALOGUE_MATCHES
+	"%lld matches found by the server",												// STR_SEARCH_MATCHES
+	"Compress to remote",														// STR_COMPRESS_TO_REMOTE
+	"Files already exist",														// STR_CONFLICTS
+	"%d file(s) already exist on the SD card. Checked files are overwritten, the others are kept.", // STR_CONFLICTS_MSG
+	"Overwrite all",															// STR_OVERWRITE_ALL
+	"Skip all",																	// STR_SKIP_ALL
+	"Benchmark SD card writes",													// STR_SD_BENCHMARK
+	"Writing test files to the SD card...",										// STR_SD_BENCHMARK_RUNNING
+	"Use recommended disk settings",											// STR_SD_BENCHMARK_APPLY
+	"Benchmark this site",														// STR_BENCHMARK_SITE
+	"Select a large remote file to benchmark this site with",					// STR_BENCHMARK_SITE_NEED_FILE
+	"Benchmark %d/%d: %s",														// STR_BENCHMARK_SITE_PROGRESS
+	"Save to site profile",														// STR_BENCHMARK_SITE_SAVE
+	"Show memory overlay",														// STR_MEMORY_OVERLAY
+	"Show frame profiler",														// STR_FRAME_PROFILER
+	"Record thread timeline",													// STR_TIMELINE_TRACE
+	"Export timeline",															// STR_TIMELINE_EXPORT
+	"Exporting timeline...",													// STR_TIMELINE_EXPORTING
+	"Transfer history",															// STR_TRANSFER_HISTORY
+	"No downloads from this site recorded yet",									// STR_TRANSFER_HISTORY_EMPTY
+	"unreachable",																// STR_SITE_UNREACHABLE
+	"TCP connect",																// STR_PROBE_CONNECT
+	"Handshake",																// STR_PROBE_HANDSHAKE
+	"First byte",																// STR_PROBE_FIRST_BYTE
+	"Invert Selection",														// STR_INVERT_SELECTION
+	"Homebrew",																// STR_PACKAGE_HOMEBREW
+	"Base",																	// STR_PACKAGE_BASE
+	"Update",																// STR_PACKAGE_UPDATE
+	"DLC",																	// STR_PACKAGE_DLC
+	"Short of space (%.1f MiB needed, %.1f MiB free): emptying the trash before the downloads start",	// STR_SPACE_AFTER_TRASH
 };
 
 bool needs_extended_font = false;
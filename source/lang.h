@@ -138,7 +138,59 @@
 	FUNC(STR_FAIL_INIT_NFS_CONTEXT)      \
 	FUNC(STR_FAIL_MOUNT_NFS_MSG)         \
 	FUNC(STR_VIEW_IMAGE)                 \
-	FUNC(STR_LANGUAGE)
+	FUNC(STR_LANGUAGE)                   \
+	FUNC(STR_LOADING_ENTRIES)            \
+	FUNC(STR_RESUME_DOWNLOADS_MSG)       \
+	FUNC(STR_TRANSFER_TRACE)             \
+	FUNC(STR_CHECKSUM_MISMATCH)          \
+	FUNC(STR_SYNC_TO_LOCAL)              \
+	FUNC(STR_SYNC_TO_REMOTE)             \
+	FUNC(STR_SYNC_COMPARING)             \
+	FUNC(STR_SYNC_UP_TO_DATE)            \
+	FUNC(STR_CONNECTING)                 \
+	FUNC(STR_VIEWER)                     \
+	FUNC(STR_GO_TO_LINE)                 \
+	FUNC(STR_PAGE_UP_DOWN)               \
+	FUNC(STR_TOP_END)                    \
+	FUNC(STR_COUNTING_FILES)             \
+	FUNC(STR_FOLDER_CONTENTS)            \
+	FUNC(STR_NOT_ENOUGH_SPACE)           \
+	FUNC(STR_TRANSFERS_BUSY)             \
+	FUNC(STR_DOWNLOADS_QUEUED)           \
+	FUNC(STR_BUILD_CATALOGUE)            \
+	FUNC(STR_CATALOGUE_PROGRESS)         \
+	FUNC(STR_CATALOGUE_BUILT)            \
+	FUNC(STR_CATALOGUE_MATCHES)          \
+	FUNC(STR_SEARCH_MATCHES)             \
+	FUNC(STR_COMPRESS_TO_REMOTE)         \
+	FUNC(STR_CONFLICTS)                  \
+	FUNC(STR_CONFLICTS_MSG)              \
+	FUNC(STR_OVERWRITE_ALL)              \
+	FUNC(STR_SKIP_ALL)                   \
+	FUNC(STR_SD_BENCHMARK)               \
+	FUNC(STR_SD_BENCHMARK_RUNNING)       \
+	FUNC(STR_SD_BENCHMARK_APPLY)         \
+	FUNC(STR_BENCHMARK_SITE)             \
+	FUNC(STR_BENCHMARK_SITE_NEED_FILE)   \
+	FUNC(STR_BENCHMARK_SITE_PROGRESS)    \
+	FUNC(STR_BENCHMARK_SITE_SAVE)       \
+	FUNC(STR_MEMORY_OVERLAY)             \
+	FUNC(STR_FRAME_PROFILER) \
+	FUNC(STR_TIMELINE_TRACE) \
+	FUNC(STR_TIMELINE_EXPORT) \
+	FUNC(STR_TIMELINE_EXPORTING) \
+	FUNC(STR_TRANSFER_HISTORY) \
+	FUNC(STR_TRANSFER_HISTORY_EMPTY) \
+	FUNC(STR_SITE_UNREACHABLE) \
+	FUNC(STR_PROBE_CONNECT) \
+	FUNC(STR_PROBE_HANDSHAKE) \
+	FUNC(STR_PROBE_FIRST_BYTE) \
+	FUNC(STR_INVERT_SELECTION) \
+	FUNC(STR_PACKAGE_HOMEBREW) \
+	FUNC(STR_PACKAGE_BASE) \
+	FUNC(STR_PACKAGE_UPDATE) \
+	FUNC(STR_PACKAGE_DLC) \
+	FUNC(STR_SPACE_AFTER_TRASH)
 
 #define GET_VALUE(x) x,
 #define GET_STRING(x) #x,
@@ -148,7 +200,7 @@ enum
 	FOREACH_STR(GET_VALUE)
 };
 
-#define LANG_STRINGS_NUM 134
+#define LANG_STRINGS_NUM 186
 #define LANG_ID_SIZE 65
 #define LANG_STR_SIZE 384
 extern char lang_identifiers[LANG_STRINGS_NUM][LANG_ID_SIZE];
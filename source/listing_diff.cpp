@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include "listing_diff.h"
+#include "util.h"
+
+namespace
+{
+    // Exact seconds within a day; later days only compare larger.
+    int64_t DateKey(const DateTime &d)
+    {
+        return ((((int64_t)d.year * 13 + d.month) * 32 + d.day) * 24 + d.hours) * 3600 +
+               (int64_t)d.minutes * 60 + d.seconds;
+    }
+
+    struct Sorted
+    {
+        std::vector<std::string> keys;
+        std::vector<uint32_t> order;
+
+        explicit Sorted(const CompactListing &list)
+        {
+            keys.resize(list.Size());
+            order.reserve(list.Size());
+            for (size_t i = 0; i < list.Size(); i++)
+            {
+                if (strcmp(list.Name(i), "..") == 0)
+                    continue;
+                keys[i] = Util::ToLower(list.Name(i));
+                order.push_back((uint32_t)i);
+            }
+            std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+                      { return keys[a] < keys[b]; });
+        }
+    };
+
+    bool Changed(const CompactListing &source, size_t s, const CompactListing &dest, size_t d)
+    {
+        if (source.IsDir(s) != dest.IsDir(d))
+            return true;
+        if (source.IsDir(s))
+            return false;
+        if (source.FileSize(s) != dest.FileSize(d))
+            return true;
+        // Some servers list no dates; the size is all there is then.
+        const DateTime &modified = source.Modified(s);
+        if (modified.year == 0)
+            return false;
+        return DateKey(modified) - DateKey(dest.Modified(d)) > ListingDiff::kMtimeSlack;
+    }
+}
+
+void ListingDiff::Compare(const CompactListing &source, const CompactListing &dest, const VisitFn &visit)
+{
+    Sorted from(source);
+    Sorted to(dest);
+
+    size_t i = 0, j = 0;
+    while (i < from.order.size() || j < to.order.size())
+    {
+        if (j == to.order.size())
+        {
+            visit(DIFF_NEW, from.order[i++], kNone);
+            continue;
+        }
+        if (i == from.order.size())
+        {
+            visit(DIFF_EXTRA, kNone, to.order[j++]);
+            continue;
+        }
+
+        uint32_t s = from.order[i];
+        uint32_t d = to.order[j];
+        int cmp = from.keys[s].compare(to.keys[d]);
+        if (cmp < 0)
+        {
+            visit(DIFF_NEW, s, kNone);
+            i++;
+        }
+        else if (cmp > 0)
+        {
+            visit(DIFF_EXTRA, kNone, d);
+            j++;
+        }
+        else
+        {
+            visit(Changed(source, s, dest, d) ? DIFF_CHANGED : DIFF_SAME, s, d);
+            i++;
+            j++;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef NEO_LISTING_DIFF_H
+#define NEO_LISTING_DIFF_H
+
+#include <functional>
+#include <cstddef>
+
+#include "compact_listing.h"
+
+// One-way comparison of a folder as a sync copies it from (`source`) and as
+// it already is where the sync copies to (`dest`).
+namespace ListingDiff
+{
+    enum Change
+    {
+        // Only in the source.
+        DIFF_NEW,
+        // In both, but the size differs, the source is newer, or one side
+        // is a folder and the other a file.
+        DIFF_CHANGED,
+        // In both and up to date; folders in both always land here.
+        DIFF_SAME,
+        // Only in the destination.
+        DIFF_EXTRA
+    };
+
+    // Index passed for the side an entry is missing from.
+    const size_t kNone = (size_t)-1;
+
+    // A source mtime may lead by this many seconds and still count as the
+    // same file; FAT keeps times at two-second resolution.
+    const int kMtimeSlack = 2;
+
+    typedef std::function<void(Change change, size_t source, size_t dest)> VisitFn;
+
+    // Orders both listings by lowercase name, the way the SD card matches
+    // names, and walks them together in one merge pass, calling `visit`
+    // once per name in that order. ".." is skipped.
+    void Compare(const CompactListing &source, const CompactListing &dest, const VisitFn &visit);
+}
+
+#endif
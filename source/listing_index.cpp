@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <string.h>
+
+#include "listing_index.h"
+#include "util.h"
+#include "listing_kernels.h"
+
+namespace
+{
+    int64_t DateKey(const DateTime &d)
+    {
+        return ((((int64_t)d.year * 13 + d.month) * 32 + d.day) * 24 + d.hours) * 3600 +
+               (int64_t)d.minutes * 60 + d.seconds;
+    }
+}
+
+void ListingIndex::Assign(const std::string &path, CompactListing &&list)
+{
+    folder = path;
+    valid = true;
+    entries = std::move(list);
+    keys.resize(entries.Size());
+    order.resize(entries.Size());
+    for (size_t i = 0; i < entries.Size(); i++)
+    {
+        keys[i].assign(entries.Name(i));
+        ListingKernels::FoldLower(keys[i].data(), keys[i].size(), &keys[i][0]);
+        order[i] = (uint32_t)i;
+    }
+    by_name.clear();
+    by_name_valid = false;
+    sortOrder();
+    refilter(order);
+    measure();
+}
+
+void ListingIndex::Assign(const std::string &path, const std::vector<DirEntry> &list)
+{
+    Assign(path, CompactListing(list));
+}
+
+void ListingIndex::Clear()
+{
+    folder.clear();
+    valid = false;
+    entries.Clear();
+    keys.clear();
+    order.clear();
+    matches.clear();
+    by_name.clear();
+    by_name_valid = false;
+    held.Set(0);
+}
+
+int ListingIndex::Merge(const CompactListing &fresh)
+{
+    if (!valid)
+        return -1;
+    indexNames();
+    std::vector<bool> gone(entries.Size(), true);
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < fresh.Size(); i++)
+    {
+        uint32_t index = find(fresh.Name(i));
+        if (index == kNone)
+        {
+            changed.push_back(i);
+            continue;
+        }
+        gone[index] = false;
+        if (entries.IsDir(index) != fresh.IsDir(i) || entries.FileSize(index) != fresh.FileSize(i) ||
+            DateKey(entries.Modified(index)) != DateKey(fresh.Modified(i)))
+            changed.push_back(i);
+    }
+    size_t removed = (size_t)std::count(gone.begin(), gone.end(), true);
+    size_t changes = changed.size() + removed;
+    if (changes > std::max<size_t>(16, entries.Size() / 4))
+        return -1;
+
+    if (removed > 0)
+        erase(gone);
+    DirEntry entry;
+    for (size_t i : changed)
+    {
+        fresh.Get(i, entry);
+        upsert(entry);
+    }
+    measure();
+    return (int)changes;
+}
+
+void ListingIndex::Upsert(const DirEntry &entry)
+{
+    indexNames();
+    upsert(entry);
+    measure();
+}
+
+void ListingIndex::upsert(const DirEntry &entry)
+{
+    uint32_t index = find(entry.name);
+    if (index != kNone)
+    {
+        unplace(index);
+        entries.Set(index, entry);
+    }
+    else
+    {
+        index = (uint32_t)entries.Size();
+        entries.Append(entry);
+        keys.push_back(ListingKernels::FoldLower(entry.name));
+        auto at = std::lower_bound(by_name.begin(), by_name.end(), entry.name, [this](uint32_t i, const char *name)
+                                   { return strcmp(entries.Name(i), name) < 0; });
+        by_name.insert(at, index);
+    }
+    place(index);
+}
+
+bool ListingIndex::Remove(const char *name)
+{
+    indexNames();
+    uint32_t index = find(name);
+    if (index == kNone)
+        return false;
+    std::vector<bool> drop(entries.Size(), false);
+    drop[index] = true;
+    erase(drop);
+    measure();
+    return true;
+}
+
+bool ListingIndex::Contains(const char *name)
+{
+    indexNames();
+    return find(name) != kNone;
+}
+
+void ListingIndex::SetSort(ListingSort value)
+{
+    if (value == sort)
+        return;
+    sort = value;
+    sortOrder();
+    refilter(order);
+}
+
+void ListingIndex::SetFilter(const std::string &value)
+{
+    std::string lower = ListingKernels::FoldLower(value);
+    if (lower == filter)
+        return;
+    // Every name containing the longer filter also contains the shorter
+    // one, so the previous matches are all that need to be looked at.
+    bool narrowing = !filter.empty() && lower.find(filter) != std::string::npos;
+    filter = lower;
+    if (narrowing)
+    {
+        std::vector<uint32_t> previous;
+        previous.swap(matches);
+        refilter(previous);
+    }
+    else
+    {
+        refilter(order);
+    }
+}
+
+void ListingIndex::View(std::vector<DirEntry> &out) const
+{
+    out.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); i++)
+        entries.Get(matches[i], out[i]);
+}
+
+ListingSort ListingIndex::ParseSort(const std::string &value)
+{
+    std::string lower = Util::ToLower(value);
+    if (lower == "size")
+        return LISTING_SORT_SIZE;
+    if (lower == "date")
+        return LISTING_SORT_DATE;
+    return LISTING_SORT_NAME;
+}
+
+bool ListingIndex::before(uint32_t a, uint32_t b) const
+{
+    // Same grouping as DirEntry::Sort: "..", then folders, then files.
+    // Size and date put the largest and newest first; names break ties.
+    bool upA = keys[a] == "..";
+    bool upB = keys[b] == "..";
+    if (upA != upB)
+        return upA;
+    bool dirA = entries.IsDir(a);
+    if (dirA != entries.IsDir(b))
+        return dirA;
+    if (sort == LISTING_SORT_SIZE && !dirA && entries.FileSize(a) != entries.FileSize(b))
+        return entries.FileSize(a) > entries.FileSize(b);
+    if (sort == LISTING_SORT_DATE)
+    {
+        int64_t dateA = DateKey(entries.Modified(a));
+        int64_t dateB = DateKey(entries.Modified(b));
+        if (dateA != dateB)
+            return dateA > dateB;
+    }
+    return keys[a] < keys[b];
+}
+
+bool ListingIndex::passes(uint32_t index) const
+{
+    return filter.empty() || keys[index] == ".." || keys[index].find(filter) != std::string::npos;
+}
+
+void ListingIndex::sortOrder()
+{
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+              { return before(a, b); });
+}
+
+void ListingIndex::refilter(const std::vector<uint32_t> &from)
+{
+    matches.clear();
+    if (filter.empty())
+    {
+        matches = from;
+        return;
+    }
+    for (uint32_t index : from)
+    {
+        if (passes(index))
+            matches.push_back(index);
+    }
+}
+
+void ListingIndex::indexNames()
+{
+    if (by_name_valid)
+        return;
+    by_name.resize(entries.Size());
+    for (size_t i = 0; i < entries.Size(); i++)
+        by_name[i] = (uint32_t)i;
+    std::sort(by_name.begin(), by_name.end(), [this](uint32_t a, uint32_t b)
+              { return strcmp(entries.Name(a), entries.Name(b)) < 0; });
+    by_name_valid = true;
+}
+
+uint32_t ListingIndex::find(const char *name) const
+{
+    auto at = std::lower_bound(by_name.begin(), by_name.end(), name, [this](uint32_t i, const char *value)
+                               { return strcmp(entries.Name(i), value) < 0; });
+    if (at == by_name.end() || strcmp(entries.Name(*at), name) != 0)
+        return kNone;
+    return *at;
+}
+
+void ListingIndex::unplace(uint32_t index)
+{
+    order.erase(std::find(order.begin(), order.end(), index));
+    auto match = std::find(matches.begin(), matches.end(), index);
+    if (match != matches.end())
+        matches.erase(match);
+}
+
+void ListingIndex::place(uint32_t index)
+{
+    auto less = [this](uint32_t a, uint32_t b)
+    { return before(a, b); };
+    order.insert(std::lower_bound(order.begin(), order.end(), index, less), index);
+    // Matches keep the order's sequence, so the same search places it.
+    if (passes(index))
+        matches.insert(std::lower_bound(matches.begin(), matches.end(), index, less), index);
+}
+
+void ListingIndex::erase(const std::vector<bool> &drop)
+{
+    std::vector<uint32_t> renumber(entries.Size(), kNone);
+    uint32_t next = 0;
+    for (size_t i = 0; i < entries.Size(); i++)
+    {
+        if (drop[i])
+            continue;
+        renumber[i] = next;
+        if (next != i)
+            keys[next].swap(keys[i]);
+        next++;
+    }
+    keys.resize(next);
+    entries.Erase(drop);
+    for (std::vector<uint32_t> *list : {&order, &matches, &by_name})
+    {
+        size_t kept = 0;
+        for (uint32_t index : *list)
+        {
+            if (renumber[index] != kNone)
+                (*list)[kept++] = renumber[index];
+        }
+        list->resize(kept);
+    }
+}
+
+void ListingIndex::measure()
+{
+    size_t bytes = entries.Bytes() + (order.capacity() * 2 + by_name.capacity()) * sizeof(uint32_t) +
+                   keys.capacity() * sizeof(std::string);
+    for (const std::string &key : keys)
+        bytes += key.capacity();
+    held.Set((int64_t)bytes);
+}
@@ -0,0 +1,98 @@
+#ifndef NEO_LISTING_INDEX_H
+#define NEO_LISTING_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "common.h"
+#include "compact_listing.h"
+#include "metrics.h"
+
+enum ListingSort
+{
+    LISTING_SORT_NAME,
+    LISTING_SORT_SIZE,
+    LISTING_SORT_DATE
+};
+
+// A complete folder listing, stored compactly, with the order and filter
+// the pane shows kept as permutations of entry indices. Names are folded to
+// lowercase once when the listing arrives, so sorting compares keys and
+// moves 4-byte indices instead of whole DirEntry structs, and filtering
+// never goes back to the disk or the server. A filter that extends the
+// previous one (the user typing on) only rescans the entries the previous
+// one matched. A listing of the same folder fetched again, or the entries
+// a transfer just wrote, are merged in by name: only what changed is
+// inserted into, moved within or dropped from the order, nothing is
+// sorted again, and the rows around them keep their place.
+class ListingIndex
+{
+public:
+    // Takes over the full listing of `path`.
+    void Assign(const std::string &path, CompactListing &&entries);
+    void Assign(const std::string &path, const std::vector<DirEntry> &entries);
+    void Clear();
+
+    // Applies `fresh`, a new listing of the folder held, as the entries
+    // that appeared, changed or went, and returns their number. -1, with
+    // nothing done, when the index holds nothing or more than a quarter of
+    // the entries differ, which Assign() does as quickly.
+    int Merge(const CompactListing &fresh);
+    // Adds `entry`, or replaces the one of the same name.
+    void Upsert(const DirEntry &entry);
+    // Drops the entry named `name`; false when there is none.
+    bool Remove(const char *name);
+    bool Contains(const char *name);
+
+    // Whether the index holds the listing of `path`.
+    bool Holds(const std::string &path) const { return valid && path == folder; }
+    // The filter in effect, folded to lowercase.
+    const std::string &Filter() const { return filter; }
+    const CompactListing &Entries() const { return entries; }
+
+    void SetSort(ListingSort sort);
+    // Keeps entries whose name contains `filter`, ignoring case; ".." is
+    // always kept. An empty filter keeps everything.
+    void SetFilter(const std::string &filter);
+
+    // Copies the sorted, filtered entries to `out`.
+    void View(std::vector<DirEntry> &out) const;
+
+    // Parses the listing_sort knob ("name", "size" or "date").
+    static ListingSort ParseSort(const std::string &value);
+
+private:
+    std::string folder;
+    bool valid = false;
+    CompactListing entries;
+    std::vector<std::string> keys;
+    // All entries in display order, and the ones passing the filter.
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> matches;
+    // All entries by exact name, for the merges; built by the first one.
+    std::vector<uint32_t> by_name;
+    bool by_name_valid = false;
+    std::string filter;
+    ListingSort sort = LISTING_SORT_NAME;
+    Metrics::Held held{Metrics::GAUGE_MEM_LISTINGS};
+
+    static const uint32_t kNone = 0xFFFFFFFFU;
+
+    // Display order: "..", then folders, then files, by the sort.
+    bool before(uint32_t a, uint32_t b) const;
+    bool passes(uint32_t index) const;
+    void sortOrder();
+    void refilter(const std::vector<uint32_t> &from);
+    void indexNames();
+    uint32_t find(const char *name) const;
+    void upsert(const DirEntry &entry);
+    // Takes `index` out of, and puts it back into, order and matches.
+    void unplace(uint32_t index);
+    void place(uint32_t index);
+    // Drops the entries flagged in `drop` and renumbers the rest.
+    void erase(const std::vector<bool> &drop);
+    void measure();
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#ifdef __aarch64__
+#include <arm_neon.h>
+#endif
+
+#include "listing_kernels.h"
+
+namespace
+{
+    struct Tables
+    {
+        // Value of a hex digit, 0xFF for other bytes.
+        uint8_t hex[256];
+        // Bytes EncodePath() keeps as they are.
+        bool keep[256];
+
+        Tables()
+        {
+            memset(hex, 0xFF, sizeof(hex));
+            memset(keep, 0, sizeof(keep));
+            for (int c = 0; c < 10; c++)
+                hex['0' + c] = (uint8_t)c;
+            for (int c = 0; c < 6; c++)
+                hex['a' + c] = hex['A' + c] = (uint8_t)(10 + c);
+            for (int c = 0; c < 256; c++)
+                keep[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' ||
+                          c == '.' || c == '_' || c == '~' || c == '/';
+        }
+    };
+    const Tables tables;
+
+    // Three lowercase letters packed as Month() compares them.
+    const uint32_t kMonths[12] = {0x6a616e, 0x666562, 0x6d6172, 0x617072, 0x6d6179, 0x6a756e,
+                                  0x6a756c, 0x617567, 0x736570, 0x6f6374, 0x6e6f76, 0x646563};
+
+    // `count` decimal digits at `p`, -1 if any is not one.
+    int Digits(const char *p, int count)
+    {
+        int value = 0;
+        for (int i = 0; i < count; i++)
+        {
+            unsigned digit = (unsigned char)p[i] - '0';
+            if (digit > 9)
+                return -1;
+            value = value * 10 + (int)digit;
+        }
+        return value;
+    }
+}
+
+namespace ListingKernels
+{
+    size_t FindEscape(const char *s, size_t n, bool plus)
+    {
+        size_t i = 0;
+#ifdef __aarch64__
+        const uint8x16_t percent = vdupq_n_u8('%');
+        const uint8x16_t other = vdupq_n_u8(plus ? '+' : '%');
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t v = vld1q_u8((const uint8_t *)s + i);
+            if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, percent), vceqq_u8(v, other))) != 0)
+                break;
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (s[i] == '%' || (plus && s[i] == '+'))
+                return i;
+        }
+        return n;
+    }
+
+    size_t FindReserved(const char *s, size_t n)
+    {
+        size_t i = 0;
+#ifdef __aarch64__
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t v = vld1q_u8((const uint8_t *)s + i);
+            uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+            uint8x16_t keep = vcltq_u8(vsubq_u8(lower, vdupq_n_u8('a')), vdupq_n_u8(26));
+            // 0-9 and '-' '.' '/' are the run 0x2D to 0x39.
+            keep = vorrq_u8(keep, vcltq_u8(vsubq_u8(v, vdupq_n_u8('-')), vdupq_n_u8(13)));
+            keep = vorrq_u8(keep, vceqq_u8(v, vdupq_n_u8('_')));
+            keep = vorrq_u8(keep, vceqq_u8(v, vdupq_n_u8('~')));
+            if (vminvq_u8(keep) == 0)
+                break;
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (!tables.keep[(unsigned char)s[i]])
+                return i;
+        }
+        return n;
+    }
+
+    std::string DecodeUrl(const std::string &url, bool plus_as_space)
+    {
+        const char *s = url.data();
+        size_t n = url.size();
+        size_t i = FindEscape(s, n, plus_as_space);
+        if (i == n)
+            return url;
+
+        std::string out;
+        out.reserve(n);
+        out.append(s, i);
+        while (i < n)
+        {
+            uint8_t high = i + 2 < n ? tables.hex[(unsigned char)s[i + 1]] : 0xFF;
+            uint8_t low = i + 2 < n ? tables.hex[(unsigned char)s[i + 2]] : 0xFF;
+            if (s[i] == '+')
+            {
+                out.push_back(' ');
+                i++;
+            }
+            else if (high != 0xFF && low != 0xFF)
+            {
+                out.push_back((char)(high << 4 | low));
+                i += 3;
+            }
+            else
+            {
+                // Like curl, a '%' without two hex digits stays.
+                out.push_back('%');
+                i++;
+            }
+            size_t next = i + FindEscape(s + i, n - i, plus_as_space);
+            out.append(s + i, next - i);
+            i = next;
+        }
+        return out;
+    }
+
+    std::string EncodePath(const std::string &path)
+    {
+        static const char kDigits[] = "0123456789ABCDEF";
+        const char *s = path.data();
+        size_t n = path.size();
+        size_t i = FindReserved(s, n);
+        if (i == n)
+            return path;
+
+        std::string out;
+        out.reserve(n + n / 2);
+        out.append(s, i);
+        while (i < n)
+        {
+            unsigned char c = (unsigned char)s[i++];
+            out.push_back('%');
+            out.push_back(kDigits[c >> 4]);
+            out.push_back(kDigits[c & 15]);
+            size_t next = i + FindReserved(s + i, n - i);
+            out.append(s + i, next - i);
+            i = next;
+        }
+        return out;
+    }
+
+    int Month(const char *s)
+    {
+        if (s[0] == '\0' || s[1] == '\0' || s[2] == '\0')
+            return 0;
+        uint32_t key = (uint32_t)((unsigned char)s[0] | 0x20) << 16 | (uint32_t)((unsigned char)s[1] | 0x20) << 8 |
+                       (uint32_t)((unsigned char)s[2] | 0x20);
+        for (int i = 0; i < 12; i++)
+        {
+            if (kMonths[i] == key)
+                return i + 1;
+        }
+        return 0;
+    }
+
+    bool ParseHttpDate(const char *s, size_t n, DateTime &out)
+    {
+        const char *p = s;
+        const char *end = s + n;
+        while (p < end && *p == ' ')
+            p++;
+        // "Sun, "
+        if (end - p >= 5 && p[3] == ',')
+        {
+            p += 4;
+            while (p < end && *p == ' ')
+                p++;
+        }
+        // "6 Nov 1994 08:49:37" or "06 Nov 1994 08:49:37"
+        int day_digits = (end - p >= 2 && p[1] == ' ') ? 1 : 2;
+        if (end - p < day_digits + 18)
+            return false;
+        int day = Digits(p, day_digits);
+        p += day_digits;
+        if (day < 1 || p[0] != ' ' || p[4] != ' ')
+            return false;
+        int month = Month(p + 1);
+        p += 5;
+        int year = Digits(p, 4);
+        if (month == 0 || year < 0 || p[4] != ' ' || p[7] != ':' || p[10] != ':')
+            return false;
+        int hours = Digits(p + 5, 2);
+        int minutes = Digits(p + 8, 2);
+        int seconds = Digits(p + 11, 2);
+        if (hours < 0 || minutes < 0 || seconds < 0)
+            return false;
+        out.year = (uint16_t)year;
+        out.month = (uint8_t)month;
+        out.day = (uint8_t)day;
+        out.hours = (uint8_t)hours;
+        out.minutes = (uint8_t)minutes;
+        out.seconds = (uint8_t)seconds;
+        return true;
+    }
+
+    bool ParseIsoDate(const char *s, size_t n, DateTime &out)
+    {
+        if (n < 10 || s[4] != '-' || s[7] != '-')
+            return false;
+        int year = Digits(s, 4);
+        int month = Digits(s + 5, 2);
+        int day = Digits(s + 8, 2);
+        if (year < 0 || month < 1 || month > 12 || day < 1)
+            return false;
+        int hours = 0;
+        int minutes = 0;
+        int seconds = 0;
+        if (n >= 16 && (s[10] == 'T' || s[10] == 't' || s[10] == ' ') && s[13] == ':')
+        {
+            hours = Digits(s + 11, 2);
+            minutes = Digits(s + 14, 2);
+            if (n >= 19 && s[16] == ':')
+                seconds = Digits(s + 17, 2);
+            if (hours < 0 || minutes < 0 || seconds < 0)
+                return false;
+        }
+        out.year = (uint16_t)year;
+        out.month = (uint8_t)month;
+        out.day = (uint8_t)day;
+        out.hours = (uint8_t)hours;
+        out.minutes = (uint8_t)minutes;
+        out.seconds = (uint8_t)seconds;
+        return true;
+    }
+
+    void FoldLower(const char *s, size_t n, char *out)
+    {
+        size_t i = 0;
+#ifdef __aarch64__
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t v = vld1q_u8((const uint8_t *)s + i);
+            uint8x16_t upper = vcltq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(26));
+            vst1q_u8((uint8_t *)out + i, vorrq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20))));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            unsigned char c = (unsigned char)s[i];
+            out[i] = (char)(c - 'A' < 26u ? c | 0x20 : c);
+        }
+    }
+
+    std::string FoldLower(const std::string &s)
+    {
+        std::string out(s.size(), '\0');
+        FoldLower(s.data(), s.size(), &out[0]);
+        return out;
+    }
+}
+
+void DirEntry::Sort(std::vector<DirEntry> &list, size_t first)
+{
+    if (list.size() <= first + 1)
+        return;
+    // Names are folded once into one pool and an index is sorted, so the
+    // entries, 1.7 KB each, move once instead of at every qsort() swap.
+    size_t count = list.size() - first;
+    DirEntry *entries = &list[first];
+    std::vector<uint32_t> offsets(count);
+    std::vector<char> pool;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t length = strnlen(entries[i].name, sizeof(entries[i].name));
+        offsets[i] = (uint32_t)pool.size();
+        pool.resize(pool.size() + length + 1);
+        ListingKernels::FoldLower(entries[i].name, length, &pool[offsets[i]]);
+        pool.back() = '\0';
+    }
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = (uint32_t)i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              {
+                  // "..", then folders, then files, as DirEntryComparator.
+                  bool upA = strcmp(entries[a].name, "..") == 0;
+                  bool upB = strcmp(entries[b].name, "..") == 0;
+                  if (upA != upB)
+                      return upA;
+                  if (entries[a].isDir != entries[b].isDir)
+                      return entries[a].isDir;
+                  return strcmp(&pool[offsets[a]], &pool[offsets[b]]) < 0;
+              });
+
+    // Position i takes the entry at order[i]; each cycle of the
+    // permutation goes round through one spare entry.
+    DirEntry spare;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (order[i] == i)
+            continue;
+        spare = entries[i];
+        size_t j = i;
+        while (order[j] != i)
+        {
+            size_t from = order[j];
+            entries[j] = entries[from];
+            order[j] = (uint32_t)j;
+            j = from;
+        }
+        entries[j] = spare;
+        order[j] = (uint32_t)j;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef NEO_LISTING_KERNELS_H
+#define NEO_LISTING_KERNELS_H
+
+#include <cstddef>
+#include <string>
+
+#include "common.h"
+
+// Byte-level work every listing repeats per entry, done in bulk. On the
+// Switch's Cortex-A57 the scans look at 16 bytes per NEON compare, so a
+// name without anything to escape or decode goes through in a few
+// instructions and is returned as it came; other builds run the same
+// tables a byte at a time. Before this each CHTTPClient::EncodeUrl() and
+// DecodeUrl() set up a curl handle of its own, the dates went through
+// sscanf() or Util::Split(), and DirEntry::Sort() ran strcasecmp() inside
+// a qsort() of whole entries.
+namespace ListingKernels
+{
+    // Offset of the first '%' (or '+' with `plus`) in `s`, `n` if none.
+    size_t FindEscape(const char *s, size_t n, bool plus);
+    // Offset of the first byte curl_easy_escape() would escape, which is
+    // every one but A-Z a-z 0-9 - . _ ~, and `n` if none.
+    size_t FindReserved(const char *s, size_t n);
+
+    // curl_easy_unescape(), and '+' as a space with `plus_as_space`.
+    std::string DecodeUrl(const std::string &url, bool plus_as_space);
+    // curl_easy_escape() of each '/'-separated segment, slashes kept.
+    std::string EncodePath(const std::string &path);
+
+    // 1 to 12 for "Jan" to "Dec" in any case, 0 otherwise.
+    int Month(const char *s);
+    // "Sun, 06 Nov 1994 08:49:37 GMT" (RFC 1123, as in getlastmodified and
+    // nginx's JSON index), also without the weekday. The time is taken as
+    // written. False, leaving `out` alone, for anything else.
+    bool ParseHttpDate(const char *s, size_t n, DateTime &out);
+    // "2024-05-01T12:34:56", with or without fractional seconds and a
+    // zone, which is ignored; a space may stand for the 'T'. The date alone
+    // leaves the time at 0.
+    bool ParseIsoDate(const char *s, size_t n, DateTime &out);
+    inline bool ParseHttpDate(const std::string &s, DateTime &out) { return ParseHttpDate(s.data(), s.size(), out); }
+    inline bool ParseIsoDate(const std::string &s, DateTime &out) { return ParseIsoDate(s.data(), s.size(), out); }
+
+    // ASCII lowercase of `n` bytes into `out`, which may be `s`; other
+    // bytes (UTF-8 included) are copied, as strcasecmp() compares them.
+    void FoldLower(const char *s, size_t n, char *out);
+    std::string FoldLower(const std::string &s);
+}
+
+#endif
@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <switch.h>
+
+#include "local_copy.h"
+#include "local_sink.h"
+#include "preflight.h"
+#include "buffer_pool.h"
+#include "fs.h"
+#include "lang.h"
+#include "util.h"
+#include "windows.h"
+#include "logger.h"
+#include "threads.h"
+#include "cancel.h"
+
+namespace
+{
+    const size_t kCopyBlockSize = 4 * 1024 * 1024;
+
+    std::mutex copy_progress_mutex;
+
+    void AddProgress(int64_t delta)
+    {
+        std::lock_guard<std::mutex> lock(copy_progress_mutex);
+        bytes_transfered += delta;
+    }
+
+    std::string JoinPath(const std::string &dir, const char *name)
+    {
+        std::string out = dir;
+        if (out.empty() || out.back() != '/')
+            out.push_back('/');
+        return out + name;
+    }
+
+    struct CopyJob
+    {
+        std::string source;
+        std::string dest;
+        int64_t size = 0;
+        size_t item = 0;
+    };
+
+    struct CopyPlan
+    {
+        const LocalCopy::ConfirmFn *confirm = nullptr;
+        bool move = false;
+        std::mutex mutex;
+        std::deque<CopyJob> jobs;
+        // Failed files per selected item; a moved folder is only removed
+        // when none of its files failed.
+        std::vector<int> itemFailures;
+        int failed = 0;
+        std::string firstFailure;
+    };
+
+    // Creates the folder tree under `dest` and queues every file below
+    // `source`, returning the bytes queued.
+    int64_t PlanFolder(CopyPlan &plan, const std::string &source, const std::string &dest, size_t item)
+    {
+        int64_t total = 0;
+        int err;
+        FS::MkDirs(dest);
+        std::vector<DirEntry> entries = FS::ListDir(source, &err);
+        for (const DirEntry &entry : entries)
+        {
+            if (Cancel::Stopped())
+                break;
+            if (strcmp(entry.name, "..") == 0)
+                continue;
+
+            std::string target = JoinPath(dest, entry.name);
+            if (entry.isDir)
+            {
+                total += PlanFolder(plan, entry.path, target, item);
+                continue;
+            }
+
+            CopyJob job;
+            job.source = entry.path;
+            job.dest = target;
+            job.size = (int64_t)entry.file_size;
+            job.item = item;
+            plan.jobs.push_back(job);
+            total += job.size;
+        }
+        return total;
+    }
+
+    void CopyWorker(CopyPlan *plan)
+    {
+        while (true)
+        {
+            CopyJob job;
+            {
+                std::lock_guard<std::mutex> lock(plan->mutex);
+                if (Cancel::Stopped() || plan->jobs.empty())
+                    return;
+                job = plan->jobs.front();
+                plan->jobs.pop_front();
+                snprintf(activity_message, 1024, "%s %s",
+                         plan->move ? lang_strings[STR_MOVING] : lang_strings[STR_COPYING], job.source.c_str());
+            }
+
+            bool ok = true;
+            bool skipped = FS::FileExists(job.dest) && !(*plan->confirm)(job.dest);
+            if (!skipped)
+            {
+                ok = LocalCopy::CopyFile(job.source, job.dest);
+                if (ok && plan->move)
+                    FS::Rm(job.source);
+            }
+
+            std::lock_guard<std::mutex> lock(plan->mutex);
+            batch_files_done++;
+            if (skipped)
+            {
+                // Count the skipped bytes so the bar still reaches the end.
+                AddProgress(job.size);
+            }
+            if (!ok && !Cancel::Stopped())
+            {
+                Logger::Logf(Logger::LOG_ERROR, "LOCAL COPY failed src=%s dst=%s", job.source.c_str(), job.dest.c_str());
+                plan->itemFailures[job.item]++;
+                if (plan->failed++ == 0)
+                    plan->firstFailure = job.source;
+            }
+        }
+    }
+
+    void CopyWorkerThread(void *arg)
+    {
+        CopyWorker(static_cast<CopyPlan *>(arg));
+    }
+}
+
+namespace LocalCopy
+{
+    bool CopyFile(const std::string &from, const std::string &to)
+    {
+        int in = open(from.c_str(), O_RDONLY);
+        if (in < 0)
+            return false;
+
+        struct stat st = {0};
+        fstat(in, &st);
+
+        // Reads land in pool blocks that the sink's writer thread takes over,
+        // so block N+1 is read while block N is being written.
+        LocalFileSink sink(to);
+        if (!sink.Open(false))
+        {
+            close(in);
+            return false;
+        }
+        if (st.st_size > 0)
+            sink.Preallocate((uint64_t)st.st_size);
+
+        uint64_t offset = 0;
+        bool ok = true;
+        while (!Cancel::Stopped())
+        {
+            TransferBuffer block(kCopyBlockSize);
+            if (!block)
+            {
+                ok = false;
+                break;
+            }
+
+            ssize_t n = read(in, block.data(), block.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                ok = false;
+                break;
+            }
+            if (n == 0)
+                break;
+
+            if (!sink.Submit(offset, block, (size_t)n))
+            {
+                ok = false;
+                break;
+            }
+            offset += (uint64_t)n;
+            AddProgress(n);
+        }
+        close(in);
+
+        if (!sink.Close())
+            ok = false;
+        if (!ok || Cancel::Stopped())
+        {
+            FS::Rm(to);
+            return false;
+        }
+        return true;
+    }
+
+    int Run(const std::vector<Item> &items, bool move, int workers,
+            const ConfirmFn &confirm, std::string *failed_path)
+    {
+        CopyPlan plan;
+        plan.confirm = &confirm;
+        plan.move = move;
+        plan.itemFailures.assign(items.size(), 0);
+
+        // Same-mount moves are a rename each; only the rest is planned.
+        std::vector<bool> renamed(items.size(), false);
+        int64_t total = 0;
+        for (size_t i = 0; i < items.size() && !Cancel::Stopped(); ++i)
+        {
+            const Item &item = items[i];
+            bool exists = item.isDir ? FS::FolderExists(item.dest) : FS::FileExists(item.dest);
+            if (move && !exists && FS::Rename(item.source, item.dest))
+            {
+                renamed[i] = true;
+                continue;
+            }
+
+            if (item.isDir)
+            {
+                total += PlanFolder(plan, item.source, item.dest, i);
+                continue;
+            }
+
+            CopyJob job;
+            job.source = item.source;
+            job.dest = item.dest;
+            job.size = FS::GetSize(item.source);
+            job.item = i;
+            if (job.size < 0)
+                job.size = 0;
+            plan.jobs.push_back(job);
+            total += job.size;
+        }
+
+        if (!plan.jobs.empty())
+        {
+            std::vector<Preflight::File> files;
+            files.reserve(plan.jobs.size());
+            for (const CopyJob &job : plan.jobs)
+                files.push_back({job.dest, (uint64_t)job.size});
+            std::string root = plan.jobs[0].dest.substr(0, plan.jobs[0].dest.find_last_of('/') + 1);
+            Preflight::Plan space = Preflight::Check(root, files, 0, true);
+            if (!space.Fits())
+            {
+                snprintf(status_message, 1023, lang_strings[STR_NOT_ENOUGH_SPACE], space.needed / 1048576.0,
+                         space.free / 1048576.0);
+                return -1;
+            }
+        }
+
+        bytes_to_download = total;
+        bytes_transfered = 0;
+        batch_files_total = (int)plan.jobs.size();
+        batch_files_done = 0;
+        batch_bytes_total = total;
+        batch_bytes_done = 0;
+        batch_start_tick = Util::GetTick();
+        prev_tick = batch_start_tick;
+
+        int extra = workers - 1;
+        if (extra > (int)plan.jobs.size() - 1)
+            extra = (int)plan.jobs.size() - 1;
+        if (extra < 0)
+            extra = 0;
+
+        Logger::Logf("LOCAL COPY start items=%d files=%d bytes=%lld workers=%d move=%d",
+                     (int)items.size(), (int)plan.jobs.size(), (long long)total, extra + 1, move ? 1 : 0);
+
+        std::vector<Thread> threads(extra);
+        std::vector<bool> started(extra, false);
+        for (int i = 0; i < extra; ++i)
+        {
+            Result rc = Threads::Create(&threads[i], CopyWorkerThread, &plan, 0x10000, Threads::ROLE_DISK, "local copy");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "LOCAL COPY threadCreate failed index=%d rc=0x%x", i, rc);
+                continue;
+            }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        // This thread works the queue too.
+        CopyWorker(&plan);
+
+        for (int i = 0; i < extra; ++i)
+        {
+            if (!started[i])
+                continue;
+            Threads::Join(&threads[i]);
+        }
+
+        if (move && !Cancel::Stopped())
+        {
+            for (size_t i = 0; i < items.size(); ++i)
+            {
+                if (!renamed[i] && items[i].isDir && plan.itemFailures[i] == 0)
+                    FS::RmRecursive(items[i].source);
+            }
+        }
+
+        uint64_t elapsed = Util::GetTick() - batch_start_tick;
+        Logger::Logf("LOCAL COPY done files=%d failed=%d bytes=%lld elapsed=%.2fs",
+                     batch_files_done, plan.failed, (long long)bytes_transfered, elapsed / 1000000.0);
+
+        batch_files_total = 0;
+        batch_bytes_total = 0;
+        if (failed_path && plan.failed > 0)
+            *failed_path = plan.firstFailure;
+        return plan.failed;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef NEO_LOCAL_COPY_H
+#define NEO_LOCAL_COPY_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// Copy/move engine for local files and folders. Folders are walked up front
+// so progress covers the whole selection, files are spread over a small
+// worker pool, and each file is read in large blocks while the destination
+// sink writes the previous one on its writer thread.
+namespace LocalCopy
+{
+    struct Item
+    {
+        std::string source;
+        // Full destination path of the file or folder, not its parent.
+        std::string dest;
+        bool isDir = false;
+    };
+
+    // Asked for every file whose destination exists; false skips the file.
+    using ConfirmFn = std::function<bool(const std::string &dest)>;
+
+    // Copies or moves `items` with up to `workers` files in flight. Moves are
+    // tried as a rename first and only copied when that fails (other mount,
+    // existing destination); sources are removed once their copy succeeded.
+    // Returns the number of files that failed; the first one is stored in
+    // `failed_path` when given. Returns -1, with status_message set, when
+    // the copies would not fit on the destination (Preflight).
+    int Run(const std::vector<Item> &items, bool move, int workers,
+            const ConfirmFn &confirm, std::string *failed_path = nullptr);
+
+    // Copies one file, adding its bytes to bytes_transfered. A partial
+    // destination is removed on failure or cancel.
+    bool CopyFile(const std::string &from, const std::string &to);
+}
+
+#endif
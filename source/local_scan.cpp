@@ -0,0 +1,269 @@
+#include <atomic>
+#include <mutex>
+#include <switch.h>
+
+#include "local_scan.h"
+#include "folder_size.h"
+#include "fs.h"
+#include "logger.h"
+#include "metrics.h"
+#include "threads.h"
+#include "util.h"
+
+namespace LocalScan
+{
+    namespace
+    {
+        // Rows are handed over in batches of this many.
+        const size_t kBatch = 64;
+
+        struct CachedFolder
+        {
+            std::string path;
+            bool details = false;
+            CompactListing entries;
+            uint64_t lastUse = 0;
+            Metrics::Held held{Metrics::GAUGE_MEM_LISTINGS};
+        };
+
+        // The scan in progress. `generation` retires a worker without a
+        // lock; the rest is guarded by `mutex`.
+        std::mutex mutex;
+        std::atomic<uint32_t> generation{0};
+        uint32_t worker_generation = 0;
+        std::string scan_path;
+        bool scan_details = false;
+        std::vector<DirEntry> pending;
+        bool finished = false;
+        bool scan_ok = false;
+        // Something changed the folder while it was being listed.
+        bool invalidated = false;
+
+        // UI thread only.
+        Thread thread;
+        bool running = false;
+        bool threaded = false;
+        uint64_t started_at = 0;
+        CompactListing result;
+
+        std::mutex cache_mutex;
+        std::vector<CachedFolder> cache;
+        uint64_t use_clock = 0;
+
+        std::string Normalize(const std::string &path)
+        {
+            std::string out = path;
+            while (out.size() > 1 && out.back() == '/')
+                out.pop_back();
+            return out;
+        }
+
+        bool Affects(const std::string &changed, const std::string &parent, const std::string &folder)
+        {
+            if (folder == parent || folder == changed)
+                return true;
+            return folder.size() > changed.size() && folder.compare(0, changed.size(), changed) == 0 &&
+                   (folder[changed.size()] == '/' || changed == "/");
+        }
+
+        void Scan()
+        {
+            std::string path;
+            bool details;
+            uint32_t mine;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                path = scan_path;
+                details = scan_details;
+                mine = worker_generation;
+            }
+
+            std::vector<DirEntry> batch;
+            batch.reserve(kBatch);
+            auto flush = [&batch]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.insert(pending.end(), batch.begin(), batch.end());
+                batch.clear();
+            };
+            bool ok = FS::ScanDir(path, details, [&](const DirEntry &entry)
+                                  {
+                                      if (generation.load() != mine)
+                                          return false;
+                                      batch.push_back(entry);
+                                      if (batch.size() >= kBatch)
+                                          flush();
+                                      return true;
+                                  });
+            flush();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            scan_ok = ok;
+            finished = true;
+        }
+
+        void ScanThread(void *arg)
+        {
+            (void)arg;
+            Scan();
+        }
+    }
+
+    void Start(const std::string &path, bool details)
+    {
+        Cancel();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            worker_generation = ++generation;
+            scan_path = Normalize(path);
+            scan_details = details;
+            pending.clear();
+            finished = false;
+            scan_ok = false;
+            invalidated = false;
+        }
+        result.Clear();
+        started_at = Util::GetTick();
+        running = true;
+
+        ::Result rc = Threads::Create(&thread, ScanThread, nullptr, 0x10000, Threads::ROLE_DISK, "local listing");
+        threaded = R_SUCCEEDED(rc);
+        if (threaded)
+        {
+            threadStart(&thread);
+            return;
+        }
+        // No thread to spare; list right here, Poll() hands it all over.
+        Logger::Logf(Logger::LOG_WARN, "LOCAL LISTING threadCreate failed rc=0x%x, listing inline", rc);
+        Scan();
+    }
+
+    bool Poll(std::vector<DirEntry> &rows, bool *ok)
+    {
+        if (!running)
+            return false;
+
+        bool done;
+        bool store;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const DirEntry &entry : pending)
+                result.Append(entry);
+            rows.insert(rows.end(), pending.begin(), pending.end());
+            pending.clear();
+            done = finished;
+            *ok = scan_ok;
+            store = scan_ok && !invalidated;
+        }
+        if (!done)
+            return false;
+
+        if (threaded)
+            Threads::Join(&thread);
+        running = false;
+        Logger::Logf("LOCAL LISTING path=%s entries=%zu details=%d ms=%llu ok=%d", scan_path.c_str(), result.Size(),
+                     scan_details ? 1 : 0, (unsigned long long)((Util::GetTick() - started_at) / 1000), *ok ? 1 : 0);
+        if (store)
+            Store(scan_path, scan_details, result);
+        return true;
+    }
+
+    CompactListing &Result()
+    {
+        return result;
+    }
+
+    bool Running()
+    {
+        return running;
+    }
+
+    const std::string &Path()
+    {
+        return scan_path;
+    }
+
+    void Cancel()
+    {
+        if (!running)
+            return;
+        generation++;
+        if (threaded)
+            Threads::Join(&thread);
+        running = false;
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.clear();
+        result.Clear();
+    }
+
+    bool Lookup(const std::string &path, bool details, CompactListing &out)
+    {
+        std::string key = Normalize(path);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (CachedFolder &folder : cache)
+        {
+            if (folder.path != key || (details && !folder.details))
+                continue;
+            folder.lastUse = ++use_clock;
+            out = folder.entries;
+            return true;
+        }
+        return false;
+    }
+
+    void Store(const std::string &path, bool details, const CompactListing &entries)
+    {
+        std::string key = Normalize(path);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        CachedFolder *slot = nullptr;
+        for (CachedFolder &folder : cache)
+        {
+            if (folder.path == key)
+                slot = &folder;
+        }
+        if (slot == nullptr && cache.size() < kCacheFolders)
+        {
+            cache.emplace_back();
+            slot = &cache.back();
+        }
+        if (slot == nullptr)
+        {
+            slot = &cache[0];
+            for (CachedFolder &folder : cache)
+            {
+                if (folder.lastUse < slot->lastUse)
+                    slot = &folder;
+            }
+        }
+        slot->path = key;
+        slot->details = details;
+        slot->entries = entries;
+        slot->lastUse = ++use_clock;
+        slot->held.Set((int64_t)entries.Bytes());
+    }
+
+    void Invalidate(const std::string &path)
+    {
+        std::string changed = Normalize(path);
+        size_t slash = changed.find_last_of('/');
+        std::string parent = slash == std::string::npos ? changed : (slash == 0 ? "/" : changed.substr(0, slash));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (Affects(changed, parent, scan_path))
+                invalidated = true;
+        }
+        FolderSize::Invalidate("", changed);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (size_t i = 0; i < cache.size();)
+        {
+            if (Affects(changed, parent, cache[i].path))
+            {
+                cache[i] = std::move(cache.back());
+                cache.pop_back();
+            }
+            else
+                i++;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef NEO_LOCAL_SCAN_H
+#define NEO_LOCAL_SCAN_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "compact_listing.h"
+
+// Lists SD card folders for the local pane on a thread of its own, so
+// opening a folder of thousands of entries never stalls the UI. Rows come
+// from readdir alone, d_type telling folders from files; files are only
+// stat()ed when `details` asks for it (sorting by size or date), otherwise
+// the pane fills in the rows it shows with FS::EnsureDetails().
+//
+// Complete listings are cached in memory by folder, up to kCacheFolders of
+// them. Every change the app itself makes on the card goes through FS or
+// LocalFileSink, which call Invalidate(); changes made by anything else
+// show up on an explicit refresh, which bypasses the cache.
+namespace LocalScan
+{
+    static const size_t kCacheFolders = 16;
+
+    // Starts listing `path`, abandoning a listing still running.
+    void Start(const std::string &path, bool details);
+    // Moves the rows found since the last call to `rows`. Returns true once
+    // the listing is over, `*ok` false when the folder could not be opened.
+    bool Poll(std::vector<DirEntry> &rows, bool *ok);
+    // The complete listing, valid after Poll() returned true.
+    CompactListing &Result();
+    // A listing was started and not yet polled to its end.
+    bool Running();
+    const std::string &Path();
+    void Cancel();
+
+    // The cached listing of `path`, when there is one at least as detailed.
+    bool Lookup(const std::string &path, bool details, CompactListing &out);
+    void Store(const std::string &path, bool details, const CompactListing &entries);
+    // Forgets the listings a change to `path` affects: the folder holding
+    // it, and `path` itself with everything below it when it is a folder.
+    // The FolderSize totals of the folders above it go too.
+    void Invalidate(const std::string &path);
+}
+
+#endif
@@ -0,0 +1,652 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <switch.h>
+#include <switch/runtime/devices/fs_dev.h>
+
+#include "local_sink.h"
+#include "local_scan.h"
+#include "preflight.h"
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+#include "memory_governor.h"
+#include "threads.h"
+#include "transfer_trace.h"
+#include "timeline.h"
+#include "transfer_stats.h"
+#include "util.h"
+
+namespace
+{
+    const uint64_t kWriteAlign = 64 * 1024;
+
+    bool WriteFully(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= (size_t)n;
+        }
+        return true;
+    }
+
+    // Walks the path with mkdir() so a split folder can be created wherever
+    // its parents are missing.
+    bool MakeTree(const std::string &directory)
+    {
+        std::string current;
+        for (size_t i = 0; i < directory.size(); ++i)
+        {
+            current.push_back(directory[i]);
+            if ((directory[i] == '/' && current.size() > 1) || i + 1 == directory.size())
+                mkdir(current.c_str(), 0777);
+        }
+        struct stat st = {0};
+        return stat(directory.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+}
+
+LocalFileSink::LocalFileSink(const std::string &p, uint64_t part)
+    : path(p), partSize(part)
+{
+}
+
+LocalFileSink::~LocalFileSink()
+{
+    Close();
+}
+
+void LocalFileSink::writerThread(void *arg)
+{
+    static_cast<LocalFileSink *>(arg)->writerLoop();
+}
+
+void LocalFileSink::startWriter()
+{
+    if (writerRunning || disk_queue_mb <= 0)
+        return;
+
+    queueLimit = MemoryGovernor::DiskQueueBytes();
+    // Half the queue at most, so the queue keeps room for new arrivals.
+    reorderLimit = std::min((size_t)disk_reorder_mb * 1024 * 1024, queueLimit / 2);
+    stopping = false;
+    Result rc = Threads::Create(&writer, writerThread, this, 0x10000, Threads::ROLE_DISK, "sink writer");
+    if (R_FAILED(rc))
+    {
+        // Inline writes still work, they just stall the network side.
+        Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK writer threadCreate failed path=%s rc=0x%x", path.c_str(), rc);
+        return;
+    }
+    threadStart(&writer);
+    writerRunning = true;
+}
+
+void LocalFileSink::stopWriter()
+{
+    if (!writerRunning)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        drain(lock);
+        stopping = true;
+    }
+    queueCv.notify_all();
+    Threads::Join(&writer);
+    writerRunning = false;
+
+    if (writes > 0)
+    {
+        Logger::Logf("LOCAL SINK queue path=%s writes=%llu bytes=%llu producer_waits=%llu wait_ms=%llu max_queued_kb=%zu disk_ms=%llu appended=%llu positioned=%llu",
+                     path.c_str(),
+                     (unsigned long long)writes,
+                     (unsigned long long)bytesWritten,
+                     (unsigned long long)producerWaits,
+                     (unsigned long long)(producerWaitUs / 1000),
+                     maxQueued / 1024,
+                     (unsigned long long)(diskUs / 1000),
+                     (unsigned long long)appendedWrites,
+                     (unsigned long long)positionedWrites);
+    }
+}
+
+bool LocalFileSink::mustFlush() const
+{
+    return heldBytes >= reorderLimit || producersWaiting > 0 || drainers > 0 || stopping || failed;
+}
+
+void LocalFileSink::writerLoop()
+{
+    while (true)
+    {
+        QueuedWrite item;
+        bool ok;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            auto next = held.end();
+            while (true)
+            {
+                while (!queue.empty())
+                {
+                    heldBytes += queue.front().size;
+                    held.emplace(queue.front().offset, std::move(queue.front()));
+                    queue.pop_front();
+                }
+                next = held.find(writeCursor);
+                if (next != held.end())
+                {
+                    appendedWrites++;
+                    break;
+                }
+                if (!held.empty() && mustFlush())
+                {
+                    next = held.begin();
+                    positionedWrites++;
+                    break;
+                }
+                if (stopping && held.empty())
+                    return;
+                queueCv.wait(lock);
+            }
+            item = std::move(next->second);
+            held.erase(next);
+            heldBytes -= item.size;
+            writeCursor = item.offset + item.size;
+            writing = true;
+            // Once a write failed the download is lost; just recycle the rest.
+            ok = !failed;
+        }
+
+        uint64_t start = Util::GetTick();
+        if (ok)
+            ok = writeNow(item.offset, item.buffer.data(), item.size);
+        uint64_t elapsed = Util::GetTick() - start;
+        item.buffer.Release();
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queued -= item.size;
+            TransferStats::AddDiskBacklog(-(int64_t)item.size);
+            writing = false;
+            if (!ok)
+                failed = true;
+            writes++;
+            bytesWritten += item.size;
+            diskUs += elapsed;
+        }
+        queueCv.notify_all();
+    }
+}
+
+void LocalFileSink::drain(std::unique_lock<std::mutex> &lock)
+{
+    drainers++;
+    queueCv.notify_all();
+    queueCv.wait(lock, [this]
+                 { return queue.empty() && held.empty() && !writing; });
+    drainers--;
+}
+
+bool LocalFileSink::enqueue(uint64_t offset, TransferBuffer &buffer, size_t size)
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    // Backpressure: hold the producer while the writer is this far behind.
+    // A single write larger than the limit still goes through alone.
+    if (!failed && queued > 0 && queued + size > queueLimit)
+    {
+        uint64_t start = Util::GetTick();
+        producerWaits++;
+        // A waiting producer makes the writer give up on held gaps.
+        producersWaiting++;
+        queueCv.notify_all();
+        queueCv.wait(lock, [this, size]
+                     { return failed || queued == 0 || queued + size <= queueLimit; });
+        producersWaiting--;
+        uint64_t now = Util::GetTick();
+        producerWaitUs += now - start;
+        Timeline::Record("disk queue full", start, now);
+    }
+    if (failed)
+        return false;
+
+    QueuedWrite item;
+    item.offset = offset;
+    item.buffer = std::move(buffer);
+    item.size = size;
+    queue.push_back(std::move(item));
+    queued += size;
+    TransferStats::AddDiskBacklog((int64_t)size);
+    if (queued > maxQueued)
+        maxQueued = queued;
+    lock.unlock();
+    queueCv.notify_all();
+    return true;
+}
+
+bool LocalFileSink::NeedsSplit(uint64_t size, bool probe)
+{
+    return force_fat32 || (size > 0xFFFFFFFFULL && (webdav_split_large || !Preflight::LargeFilesSupported(probe)));
+}
+
+int64_t LocalFileSink::SplitLocalSize(const std::string &base, uint64_t part)
+{
+    std::string dir = base;
+    if (!FS::hasEndSlash(dir.c_str()))
+        dir.push_back('/');
+
+    int64_t total = 0;
+    for (int index = 0;; ++index)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%02d", index);
+        int64_t sz = FS::GetSize(dir + name);
+        if (sz <= 0)
+            break;
+        total += sz;
+        if ((uint64_t)sz < part)
+            break;
+    }
+    return total;
+}
+
+std::string LocalFileSink::partPath(size_t index) const
+{
+    if (!IsSplit())
+        return path;
+    char name[16];
+    snprintf(name, sizeof(name), "%02d", (int)index);
+    std::string out = path;
+    if (!FS::hasEndSlash(out.c_str()))
+        out.push_back('/');
+    return out + name;
+}
+
+bool LocalFileSink::Open(bool keep_existing)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    keep = keep_existing;
+    LocalScan::Invalidate(path);
+
+    if (IsSplit())
+    {
+        // A flat file left by an earlier non-split attempt would block the
+        // folder of the same name.
+        if (FS::FileExists(path) && !FS::FolderExists(path))
+            FS::Rm(path);
+        if (!MakeTree(path))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK mkdirs failed path=%s errno=%d", path.c_str(), errno);
+            return false;
+        }
+        startWriter();
+        return true;
+    }
+
+    Part *part = acquirePart(0, true);
+    if (part == nullptr)
+        return false;
+    part->users--;
+    startWriter();
+    return true;
+}
+
+LocalFileSink::Part *LocalFileSink::acquirePart(size_t index, bool create)
+{
+    while (index >= parts.size())
+        parts.emplace_back(new Part());
+    Part &part = *parts[index];
+    if (part.fd < 0)
+    {
+        if (!create && !keep && !part.created)
+            return nullptr;
+        // Parts in use by another worker stay open past the limit.
+        while (openParts >= kMaxOpenParts)
+        {
+            Part *idle = nullptr;
+            for (auto &other : parts)
+            {
+                if (other->fd >= 0 && other->users == 0 && (idle == nullptr || other->lastUse < idle->lastUse))
+                    idle = other.get();
+            }
+            if (idle == nullptr)
+                break;
+            closePart(*idle);
+        }
+
+        std::string file = partPath(index);
+        int flags = O_RDWR | O_CREAT;
+        if (!keep && !part.created)
+            flags |= O_TRUNC;
+        part.fd = open(file.c_str(), flags, 0666);
+        if (part.fd < 0)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK open failed path=%s errno=%d", file.c_str(), errno);
+            return nullptr;
+        }
+        part.created = true;
+        openParts++;
+    }
+    part.users++;
+    part.lastUse = ++useClock;
+    return &part;
+}
+
+void LocalFileSink::releasePart(Part *part)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    part->users--;
+}
+
+void LocalFileSink::closePart(Part &part)
+{
+    close(part.fd);
+    part.fd = -1;
+    openParts--;
+}
+
+bool LocalFileSink::Preallocate(uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t parts = IsSplit() ? (size_t)((size + partSize - 1) / partSize) : 1;
+    for (size_t i = 0; i < parts; ++i)
+    {
+        uint64_t want = size;
+        if (IsSplit())
+            want = (i + 1 < parts) ? partSize : size - (uint64_t)i * partSize;
+        // A flat file over 4 GiB cannot exist on FAT32; let exFAT grow it.
+        if (!IsSplit() && want > 0xFFFFFFFFULL && force_fat32)
+            return true;
+
+        Part *part = acquirePart(i, true);
+        if (part == nullptr)
+            return false;
+        struct stat st;
+        bool grown = (fstat(part->fd, &st) == 0 && (uint64_t)st.st_size >= want) || ftruncate(part->fd, (off_t)want) == 0;
+        part->users--;
+        if (!grown)
+        {
+            // Not fatal: the writes still extend the file, just slower.
+            Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK preallocate failed path=%s size=%llu errno=%d",
+                         partPath(i).c_str(), (unsigned long long)want, errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LocalFileSink::WriteAt(uint64_t offset, const void *data, size_t size)
+{
+    if (writerRunning)
+    {
+        TransferBuffer copy(size);
+        if (copy)
+        {
+            memcpy(copy.data(), data, size);
+            return enqueue(offset, copy, size);
+        }
+        // Pool exhausted: write inline behind whatever is queued.
+        std::unique_lock<std::mutex> lock(queueMutex);
+        drain(lock);
+        if (failed)
+            return false;
+    }
+    return writeNow(offset, static_cast<const char *>(data), size);
+}
+
+bool LocalFileSink::Submit(uint64_t offset, TransferBuffer &buffer, size_t size)
+{
+    if (writerRunning)
+        return enqueue(offset, buffer, size);
+    return writeNow(offset, buffer.data(), size);
+}
+
+bool LocalFileSink::writeNow(uint64_t offset, const char *data, size_t size)
+{
+    uint64_t trace_start = TransferTrace::Enabled() ? Util::GetTick() : 0;
+    uint64_t trace_offset = offset;
+    size_t trace_size = size;
+    const char *ptr = data;
+    while (size > 0)
+    {
+        size_t index = IsSplit() ? (size_t)(offset / partSize) : 0;
+        uint64_t in_part = IsSplit() ? offset % partSize : offset;
+        size_t chunk = size;
+        if (IsSplit() && chunk > partSize - in_part)
+            chunk = (size_t)(partSize - in_part);
+
+        Part *part;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            part = acquirePart(index, true);
+        }
+        if (part == nullptr)
+            return false;
+        bool ok;
+        {
+            std::lock_guard<std::mutex> part_lock(part->lock);
+            ok = lseek(part->fd, (off_t)in_part, SEEK_SET) >= 0 && WriteFully(part->fd, ptr, chunk);
+        }
+        releasePart(part);
+        if (!ok)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK write failed path=%s offset=%llu size=%zu errno=%d",
+                         partPath(index).c_str(), (unsigned long long)in_part, chunk, errno);
+            if (trace_start)
+                TransferTrace::Record(TransferTrace::TRACE_DISK_WRITE, -1, trace_start, Util::GetTick(), trace_offset, trace_size, 0);
+            return false;
+        }
+
+        ptr += chunk;
+        size -= chunk;
+        offset += chunk;
+    }
+    if (trace_start)
+        TransferTrace::Record(TransferTrace::TRACE_DISK_WRITE, -1, trace_start, Util::GetTick(), trace_offset, trace_size, 1);
+    if (checksum)
+    {
+        std::lock_guard<std::mutex> lock(checksumMutex);
+        checksum->Update(trace_offset, data, trace_size);
+    }
+    return true;
+}
+
+bool LocalFileSink::readNow(uint64_t offset, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        size_t index = IsSplit() ? (size_t)(offset / partSize) : 0;
+        uint64_t in_part = IsSplit() ? offset % partSize : offset;
+        size_t chunk = size;
+        if (IsSplit() && chunk > partSize - in_part)
+            chunk = (size_t)(partSize - in_part);
+
+        Part *part;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            part = acquirePart(index, false);
+        }
+        if (part == nullptr)
+            return false;
+        bool ok;
+        {
+            std::lock_guard<std::mutex> part_lock(part->lock);
+            ok = lseek(part->fd, (off_t)in_part, SEEK_SET) >= 0;
+            size_t got = 0;
+            while (ok && got < chunk)
+            {
+                ssize_t n = read(part->fd, data + got, chunk - got);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK read back failed path=%s offset=%llu errno=%d",
+                                 partPath(index).c_str(), (unsigned long long)in_part, errno);
+                    ok = false;
+                }
+                else
+                    got += (size_t)n;
+            }
+        }
+        releasePart(part);
+        if (!ok)
+            return false;
+
+        data += chunk;
+        size -= chunk;
+        offset += chunk;
+    }
+    return true;
+}
+
+void LocalFileSink::EnableChecksum(FileDigest::Algo algo)
+{
+    std::lock_guard<std::mutex> lock(checksumMutex);
+    checksum.reset(algo == FileDigest::NONE ? nullptr : new ChecksumWriter(algo));
+}
+
+bool LocalFileSink::Digest(uint64_t size, FileDigest &out)
+{
+    if (writerRunning)
+    {
+        std::unique_lock<std::mutex> queue_lock(queueMutex);
+        drain(queue_lock);
+        if (failed)
+            return false;
+    }
+
+    std::lock_guard<std::mutex> lock(checksumMutex);
+    if (!checksum)
+        return false;
+    return checksum->Final(size, [this](uint64_t offset, char *data, size_t length)
+                           { return readNow(offset, data, length); },
+                           out);
+}
+
+bool LocalFileSink::ReadAt(uint64_t offset, char *data, size_t size)
+{
+    if (writerRunning)
+    {
+        std::unique_lock<std::mutex> queue_lock(queueMutex);
+        drain(queue_lock);
+        if (failed)
+            return false;
+    }
+    return readNow(offset, data, size);
+}
+
+bool LocalFileSink::Flush()
+{
+    if (writerRunning)
+    {
+        std::unique_lock<std::mutex> queue_lock(queueMutex);
+        drain(queue_lock);
+        if (failed)
+            return false;
+    }
+
+    // Evicted parts were flushed by close().
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = true;
+    for (auto &part : parts)
+    {
+        if (part->fd < 0)
+            continue;
+        std::lock_guard<std::mutex> part_lock(part->lock);
+        if (fsync(part->fd) != 0)
+            ok = false;
+    }
+    return ok;
+}
+
+bool LocalFileSink::Close()
+{
+    stopWriter();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &part : parts)
+    {
+        if (part->fd >= 0)
+            closePart(*part);
+    }
+    return !failed;
+}
+
+bool LocalFileSink::Finish()
+{
+    if (!Close())
+        return false;
+    if (!IsSplit())
+        return true;
+
+    // The data is complete either way; without the attribute the folder
+    // just shows up as a folder.
+    Result rc = fsdevSetConcatenationFileAttribute(path.c_str());
+    if (R_FAILED(rc))
+        Logger::Logf(Logger::LOG_ERROR, "LOCAL SINK failed to set concatenation attribute path=%s rc=0x%08x", path.c_str(), rc);
+    return true;
+}
+
+LocalSinkStream::LocalSinkStream(LocalFileSink &s, uint64_t start)
+    : sink(s), offset(start), blockSize((size_t)disk_block_kb * 1024)
+{
+}
+
+LocalSinkStream::~LocalSinkStream()
+{
+    Flush();
+}
+
+bool LocalSinkStream::Write(const void *data, size_t size)
+{
+    const char *ptr = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        // SD writes are fastest in large, aligned blocks. A queued flush
+        // hands the buffer to the sink, so lease the next one here.
+        if (used == 0 && !buffer && !buffer.Acquire(blockSize))
+        {
+            if (!sink.WriteAt(offset, ptr, size))
+                return false;
+            offset += size;
+            return true;
+        }
+
+        // The first block after an unaligned start is cut short so every
+        // later write lands on a 64 KiB boundary.
+        if (used == 0)
+            limit = blockSize - (size_t)(offset % kWriteAlign);
+
+        size_t take = limit - used;
+        if (take > size)
+            take = size;
+        memcpy(buffer.data() + used, ptr, take);
+        used += take;
+        ptr += take;
+        size -= take;
+
+        if (used == limit && !Flush())
+            return false;
+    }
+    return true;
+}
+
+bool LocalSinkStream::Flush()
+{
+    if (used == 0)
+        return true;
+    bool ok = sink.Submit(offset, buffer, used);
+    offset += used;
+    used = 0;
+    return ok;
+}
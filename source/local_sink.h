@@ -0,0 +1,197 @@
+#ifndef NEO_LOCAL_SINK_H
+#define NEO_LOCAL_SINK_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+#include <switch.h>
+
+#include "buffer_pool.h"
+#include "byte_sink.h"
+#include "checksum.h"
+
+// Local destination of a download: either one flat file or a DBI-style
+// split folder of kSplitPartSize parts ("00", "01", ...) that FAT32 can
+// hold. Writes go straight to file descriptors with write(), bypassing
+// stdio, and may arrive out of order from several workers at once. Each
+// part has its own lock, so workers writing to different parts never wait
+// on each other; up to kMaxOpenParts of them stay open, the least recently
+// used idle one being closed to make room.
+//
+// With disk_queue_mb above 0 the writes themselves happen on a writer
+// thread owned by the sink: callers queue filled buffers and go back to the
+// network, so an SD stall only blocks them once that many bytes are queued.
+// Write errors are sticky and reported by the next call, Flush() or Close().
+//
+// Parallel workers finish their ranges out of order, and scattered writes
+// make FAT32 walk cluster chains and the card write randomly. The writer
+// therefore holds queued writes (up to disk_reorder_mb) that do not start
+// where the last one ended, and writes a held run as soon as the gap before
+// it fills. When the window is full, a producer waits or the queue is
+// drained, the lowest held offset is written where it belongs instead.
+class LocalFileSink : public ByteSink
+{
+public:
+    // 4 GiB - 64 KiB, the part size DBI and Tinfoil expect.
+    static const uint64_t kSplitPartSize = 4294901760ULL;
+    static const size_t kMaxOpenParts = 4;
+
+    // `partSize` 0 writes a flat file at `path`; otherwise `path` becomes
+    // the split folder.
+    LocalFileSink(const std::string &path, uint64_t partSize = 0);
+    ~LocalFileSink();
+
+    // Creates the destination. With `keep`, bytes already on disk stay
+    // (resume); otherwise existing data is truncated.
+    bool Open(bool keep);
+    // Reserves `size` bytes up front with ftruncate, which on the Switch is
+    // a cluster reservation instead of the synchronous zero-fill a write of
+    // the last byte triggers on FAT32. Never shrinks existing parts.
+    bool Preallocate(uint64_t size);
+    // Thread-safe positioned write, split across parts as needed. Queued
+    // writes copy `data` into a pool buffer first.
+    bool WriteAt(uint64_t offset, const void *data, size_t size) override;
+    // Like WriteAt, but a queued write takes over `buffer` instead of
+    // copying it; the caller must lease a new one afterwards.
+    bool Submit(uint64_t offset, TransferBuffer &buffer, size_t size);
+    // Waits for queued writes and syncs the parts to the card.
+    bool Flush();
+    // Drains the queue, stops the writer and closes the parts. Returns
+    // false when any write failed.
+    bool Close();
+    // Closes the parts and, for a split folder, sets the concatenation
+    // attribute so the folder reads as one file.
+    bool Finish();
+
+    // Digests every write as it goes to disk; call before the first write,
+    // or again to digest afresh, reading back what later writes miss.
+    void EnableChecksum(FileDigest::Algo algo);
+    // Waits for queued writes and returns the digest of the first `size`
+    // bytes, reading back only what the writes did not cover. Call before
+    // Close().
+    bool Digest(uint64_t size, FileDigest &out);
+    // Waits for queued writes and reads bytes back from the card.
+    bool ReadAt(uint64_t offset, char *data, size_t size);
+
+    bool IsSplit() const { return partSize > 0; }
+    const std::string &Path() const { return path; }
+
+    // Whether a download of `size` bytes must be split on this card:
+    // always with force_fat32, and above 4 GiB when webdav_split_large is
+    // set (the knob predates the other protocols using it) or the card
+    // turned out not to take such files (Preflight). `probe` as for
+    // Preflight::LargeFilesSupported().
+    static bool NeedsSplit(uint64_t size, bool probe = true);
+    // Bytes of a split folder present on disk, stopping at the first short
+    // or missing part.
+    static int64_t SplitLocalSize(const std::string &path, uint64_t partSize);
+
+private:
+    struct QueuedWrite
+    {
+        uint64_t offset = 0;
+        TransferBuffer buffer;
+        size_t size = 0;
+    };
+
+    struct Part
+    {
+        // Held around each lseek() and write() on `fd`.
+        std::mutex lock;
+        int fd = -1;
+        // Opened (and truncated unless kept) this session already, so a
+        // reopen after an eviction keeps what was written.
+        bool created = false;
+        int users = 0;
+        uint64_t lastUse = 0;
+    };
+
+    std::string path;
+    uint64_t partSize;
+    bool keep = false;
+    // Guards the part table; never held during disk access.
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Part>> parts;
+    size_t openParts = 0;
+    uint64_t useClock = 0;
+    std::mutex checksumMutex;
+
+    // Writer stage, guarded by queueMutex.
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    std::deque<QueuedWrite> queue;
+    size_t queued = 0;
+    size_t queueLimit = 0;
+    // Reorder window: writes taken off `queue` that wait for the gap before
+    // them, by offset. Their bytes still count in `queued`.
+    std::multimap<uint64_t, QueuedWrite> held;
+    size_t heldBytes = 0;
+    size_t reorderLimit = 0;
+    // Where the last write ended.
+    uint64_t writeCursor = 0;
+    int producersWaiting = 0;
+    int drainers = 0;
+    bool writing = false;
+    bool stopping = false;
+    bool failed = false;
+    bool writerRunning = false;
+    Thread writer;
+
+    // Backpressure counters, logged when the sink closes.
+    uint64_t writes = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t producerWaits = 0;
+    uint64_t producerWaitUs = 0;
+    uint64_t diskUs = 0;
+    size_t maxQueued = 0;
+    uint64_t appendedWrites = 0;
+    uint64_t positionedWrites = 0;
+
+    std::unique_ptr<ChecksumWriter> checksum;
+
+    // The part at `index`, opened and marked in use, or nullptr. Without
+    // `create`, a part this session has not written is not opened, as
+    // that would truncate it. Called with `mutex` held.
+    Part *acquirePart(size_t index, bool create);
+    void releasePart(Part *part);
+    void closePart(Part &part);
+    std::string partPath(size_t index) const;
+    bool writeNow(uint64_t offset, const char *data, size_t size);
+    bool readNow(uint64_t offset, char *data, size_t size);
+    bool enqueue(uint64_t offset, TransferBuffer &buffer, size_t size);
+    void drain(std::unique_lock<std::mutex> &lock);
+    void startWriter();
+    void stopWriter();
+    void writerLoop();
+    // Whether the writer must stop waiting for gaps to fill. Called with
+    // `queueMutex` held.
+    bool mustFlush() const;
+    static void writerThread(void *arg);
+};
+
+// Coalesces a sequential stream of small writes into disk_block_kb writes
+// on a LocalFileSink, aligned to 64 KiB boundaries of the destination.
+class LocalSinkStream
+{
+public:
+    LocalSinkStream(LocalFileSink &sink, uint64_t offset);
+    ~LocalSinkStream();
+
+    bool Write(const void *data, size_t size);
+    bool Flush();
+
+private:
+    LocalFileSink &sink;
+    uint64_t offset;
+    TransferBuffer buffer;
+    size_t blockSize;
+    size_t used = 0;
+    size_t limit = 0;
+};
+
+#endif
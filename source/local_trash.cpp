@@ -0,0 +1,216 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "local_trash.h"
+#include "fs.h"
+#include "util.h"
+#include "logger.h"
+#include "metrics.h"
+#include "threads.h"
+#include "windows.h"
+
+namespace LocalTrash
+{
+    namespace
+    {
+        // Between checks of whether a transfer still needs the card.
+        const uint64_t kPauseNs = 200000000ULL;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        // Held by whoever walks the trash, so Empty() and the thread never
+        // remove the same entries at once.
+        std::mutex purge_mutex;
+        // Set while Empty() needs the space; nothing pauses then.
+        std::atomic<bool> urgent{false};
+        Thread thread;
+        bool running = false;
+        bool stopping = false;
+        // Moves since the thread last looked.
+        bool pending = false;
+        uint32_t moves = 0;
+
+        // Waits while a transfer runs or the sinks have writes on their way
+        // to the card. False once the thread is asked to stop.
+        bool Pause()
+        {
+            while (true)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (stopping)
+                        return false;
+                }
+                if (urgent)
+                    return true;
+                Metrics::Snapshot totals;
+                Metrics::Read(totals);
+                if (!file_transfering && totals.gauges[Metrics::GAUGE_DISK_BACKLOG] <= 0)
+                    return true;
+                svcSleepThread(kPauseNs);
+            }
+        }
+
+        // Removes what `path` holds, then the folder itself unless it is
+        // the trash. The names are read first, as removing entries while
+        // readdir() walks the folder may skip some.
+        bool Purge(const std::string &path, bool self, int *removed)
+        {
+            std::vector<std::pair<std::string, bool>> children;
+            DIR *dfd = opendir(path.c_str());
+            if (dfd != NULL)
+            {
+                struct dirent *dir;
+                while ((dir = readdir(dfd)) != NULL)
+                {
+                    if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+                        continue;
+                    children.emplace_back(path + "/" + dir->d_name, (dir->d_type & DT_DIR) != 0);
+                }
+                closedir(dfd);
+            }
+            for (const auto &child : children)
+            {
+                if (!Pause())
+                    return false;
+                if (child.second)
+                {
+                    if (!Purge(child.first, true, removed))
+                        return false;
+                }
+                else if (remove(child.first.c_str()) == 0)
+                    (*removed)++;
+                else
+                    Logger::Logf(Logger::LOG_ERROR, "TRASH remove failed path=%s", child.first.c_str());
+            }
+            if (self && rmdir(path.c_str()) == 0)
+                (*removed)++;
+            return true;
+        }
+
+        void Worker(void *arg)
+        {
+            (void)arg;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, []
+                            { return pending || stopping; });
+                    if (stopping)
+                        break;
+                    pending = false;
+                }
+                uint64_t started = Util::GetTick();
+                int removed = 0;
+                std::lock_guard<std::mutex> purge_lock(purge_mutex);
+                bool done = Purge(LOCAL_TRASH_PATH, false, &removed);
+                Logger::Logf("TRASH emptied=%d entries=%d ms=%llu", done ? 1 : 0, removed,
+                             (unsigned long long)((Util::GetTick() - started) / 1000));
+            }
+        }
+
+        // Starts the thread unless it runs; called with `mutex` held.
+        void Start()
+        {
+            if (running)
+                return;
+            ::Result rc = Threads::Create(&thread, Worker, nullptr, 0x20000, Threads::ROLE_BACKGROUND, "trash");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "TRASH threadCreate failed rc=0x%x", rc);
+                return;
+            }
+            running = true;
+            stopping = false;
+            threadStart(&thread);
+        }
+    }
+
+    void Init()
+    {
+        if (!FS::FolderExists(LOCAL_TRASH_PATH))
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        Start();
+        pending = true;
+        cv.notify_all();
+    }
+
+    void Exit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+                return;
+            stopping = true;
+            cv.notify_all();
+        }
+        Threads::Join(&thread);
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+
+    bool Empty()
+    {
+        if (!FS::FolderExists(LOCAL_TRASH_PATH))
+            return false;
+        // A pass of the thread under way runs on unpaused; this one then
+        // removes whatever it left.
+        urgent = true;
+        uint64_t started = Util::GetTick();
+        int removed = 0;
+        {
+            std::lock_guard<std::mutex> purge_lock(purge_mutex);
+            Purge(LOCAL_TRASH_PATH, false, &removed);
+        }
+        urgent = false;
+        Logger::Logf("TRASH emptied now entries=%d ms=%llu", removed,
+                     (unsigned long long)((Util::GetTick() - started) / 1000));
+        return true;
+    }
+
+    bool Pending()
+    {
+        DIR *dir = opendir(LOCAL_TRASH_PATH);
+        if (dir == nullptr)
+            return false;
+        bool found = false;
+        struct dirent *entry;
+        while (!found && (entry = readdir(dir)) != nullptr)
+            found = strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+        closedir(dir);
+        return found;
+    }
+
+    bool Move(const std::string &path)
+    {
+        if (!fast_delete)
+            return false;
+        // Neither the trash nor a folder holding it can go into the trash.
+        std::string trash = LOCAL_TRASH_PATH;
+        if ((path + "/").rfind(trash + "/", 0) == 0 || (trash + "/").rfind(path + "/", 0) == 0)
+            return false;
+
+        FS::MkDirs(trash);
+        std::lock_guard<std::mutex> lock(mutex);
+        char name[64];
+        snprintf(name, sizeof(name), "/%llx-%u", (unsigned long long)Util::GetTick(), moves++);
+        if (!FS::Rename(path, trash + name))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "TRASH rename failed path=%s", path.c_str());
+            return false;
+        }
+        Logger::Logf(Logger::LOG_DEBUG, "TRASH moved path=%s as=%s", path.c_str(), name + 1);
+        Start();
+        pending = true;
+        cv.notify_all();
+        return true;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef NEO_LOCAL_TRASH_H
+#define NEO_LOCAL_TRASH_H
+
+#include <string>
+
+#include "config.h"
+
+#define LOCAL_TRASH_PATH DATA_PATH "/trash"
+
+// Local deletes that return at once. With fast_delete on, a file or
+// folder is renamed into LOCAL_TRASH_PATH, on the same SD card and so one
+// FAT32 directory update however big the folder, and the pane drops it
+// right away. A background thread then removes what the trash holds one
+// entry at a time, at the lowest priority, pausing while a transfer runs
+// or the card has writes queued. What is still there at exit is removed
+// after the next launch.
+namespace LocalTrash
+{
+    // Starts emptying what an earlier session left. Call after the config
+    // is loaded.
+    void Init();
+    // Stops the thread; the rest of the trash waits for the next launch.
+    void Exit();
+    // Removes all of the trash on the calling thread, without pausing for
+    // the transfer that needs its space; false when there is no trash.
+    // Preflight calls it on the transfer thread before it turns a download
+    // away.
+    bool Empty();
+    // The trash holds something still to be removed. One directory read,
+    // so the UI thread may ask.
+    bool Pending();
+
+    // Renames `path` into the trash and wakes the thread. False, leaving
+    // `path` where it is, when fast_delete is off or the rename failed, so
+    // the caller deletes it the slow way.
+    bool Move(const std::string &path);
+}
+
+#endif
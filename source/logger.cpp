@@ -3,59 +3,350 @@
 #include <cstdio>
 #include <cstdarg>
 #include <ctime>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <switch.h>
 
 #include "fs.h"
 #include "config.h"
+#include "threads.h"
+#include "util.h"
 
 namespace
 {
+    // 256 lines of up to 1 KiB: a burst of a few hundred lines between two
+    // drains fits, and the ring costs a fixed ~260 KiB.
+    const size_t kSlots = 256;
+    const size_t kLineSize = 1024;
+    // How long the writer sleeps when the ring is empty.
+    const uint64_t kDrainIntervalNs = 50000000ull;
+
+    enum Stream
+    {
+        STREAM_LOG,
+        STREAM_TRACE
+    };
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        std::time_t time;
+        uint8_t stream;
+        char text[kLineSize];
+    };
+
+    // Bounded multi-producer ring (Vyukov): a slot's sequence number says
+    // whether it is free for the producer claiming `pos` (seq == pos) or
+    // holds a line for the consumer (seq == pos + 1). Only the writer thread
+    // consumes.
+    Slot slots[kSlots];
+    std::atomic<size_t> enqueue_pos{0};
+    size_t dequeue_pos = 0;
+    std::atomic<uint32_t> dropped{0};
+
+    Thread writer;
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    FILE *log_fd = nullptr;
+    FILE *trace_fd = nullptr;
+
+    // Log lines kept for Recent().
+    const size_t kTailLines = 64;
+    std::mutex tail_mutex;
+    std::deque<std::string> tail;
+
     std::string LogPath()
     {
         return std::string(LOG_FILE);
     }
 
+    std::string TracePath()
+    {
+        return std::string(TRACE_FILE);
+    }
+
     void EnsureDir()
     {
         FS::MkDirs(std::string(LOG_DIR));
     }
+
+    void WriteLine(FILE *fd, std::time_t t, const char *text)
+    {
+        char stamp[24] = "";
+        std::tm *tm = std::localtime(&t);
+        if (tm)
+            snprintf(stamp, sizeof(stamp), "[%04d-%02d-%02d %02d:%02d:%02d] ",
+                     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+                     tm->tm_hour, tm->tm_min, tm->tm_sec);
+        std::fprintf(fd, "%s%s\n", stamp, text);
+
+        if (status_port > 0)
+        {
+            std::lock_guard<std::mutex> lock(tail_mutex);
+            if (tail.size() >= kTailLines)
+                tail.pop_front();
+            tail.push_back(std::string(stamp) + text);
+        }
+    }
+
+    // Trace lines are CSV records and go out as they are.
+    void WriteSlot(FILE *fd, uint8_t stream, std::time_t t, const char *text)
+    {
+        if (stream == STREAM_TRACE)
+            std::fprintf(fd, "%s\n", text);
+        else
+            WriteLine(fd, t, text);
+    }
+
+    // Used before Init() and after Exit(), when there is no writer thread.
+    void WriteDirect(uint8_t stream, const char *text)
+    {
+        EnsureDir();
+        FILE *fd = FS::Append(stream == STREAM_TRACE ? TracePath() : LogPath());
+        if (!fd)
+            return;
+        WriteSlot(fd, stream, std::time(nullptr), text);
+        std::fclose(fd);
+    }
+
+    FILE *OpenStream(uint8_t stream)
+    {
+        FILE *&fd = (stream == STREAM_TRACE) ? trace_fd : log_fd;
+        if (!fd)
+        {
+            EnsureDir();
+            fd = FS::Append(stream == STREAM_TRACE ? TracePath() : LogPath());
+            if (fd)
+                setvbuf(fd, nullptr, _IOFBF, 64 * 1024);
+        }
+        return fd;
+    }
+
+    // Claims a slot for a new line; nullptr when the ring is full.
+    Slot *Claim(size_t &pos)
+    {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot &slot = slots[pos % kSlots];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return &slot;
+            }
+            else if (diff < 0)
+            {
+                return nullptr;
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Writes every line that is ready; returns how many.
+    size_t Drain()
+    {
+        size_t count = 0;
+        for (;;)
+        {
+            Slot &slot = slots[dequeue_pos % kSlots];
+            if (slot.seq.load(std::memory_order_acquire) != dequeue_pos + 1)
+                break;
+            FILE *fd = OpenStream(slot.stream);
+            if (fd)
+                WriteSlot(fd, slot.stream, slot.time, slot.text);
+            slot.seq.store(dequeue_pos + kSlots, std::memory_order_release);
+            dequeue_pos++;
+            count++;
+        }
+
+        uint32_t lost = dropped.exchange(0);
+        if (lost > 0 && OpenStream(STREAM_LOG))
+        {
+            char note[64];
+            snprintf(note, sizeof(note), "LOGGER ring full, dropped %u lines", lost);
+            WriteLine(log_fd, std::time(nullptr), note);
+        }
+        if (count > 0 || lost > 0)
+        {
+            if (log_fd)
+                std::fflush(log_fd);
+            if (trace_fd)
+                std::fflush(trace_fd);
+        }
+        return count;
+    }
+
+    void WriterThread(void *arg)
+    {
+        (void)arg;
+        while (!stopping.load())
+        {
+            if (Drain() == 0)
+                svcSleepThread(kDrainIntervalNs);
+        }
+        Drain();
+    }
+
+    void Vqueue(uint8_t stream, uint32_t suppressed, const char *fmt, va_list args)
+    {
+        if (!running.load())
+        {
+            char buf[kLineSize];
+            int len = vsnprintf(buf, sizeof(buf), fmt, args);
+            if (suppressed > 0 && len >= 0 && (size_t)len < sizeof(buf))
+                snprintf(buf + len, sizeof(buf) - len, " (%u similar suppressed)", suppressed);
+            WriteDirect(stream, buf);
+            return;
+        }
+
+        size_t pos;
+        Slot *slot = Claim(pos);
+        if (!slot)
+        {
+            dropped++;
+            return;
+        }
+        slot->time = std::time(nullptr);
+        slot->stream = stream;
+        int len = vsnprintf(slot->text, kLineSize, fmt, args);
+        if (suppressed > 0 && len >= 0 && (size_t)len < kLineSize)
+            snprintf(slot->text + len, kLineSize - len, " (%u similar suppressed)", suppressed);
+        slot->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    void Vlog(Logger::Level level, uint32_t suppressed, const char *fmt, va_list args)
+    {
+        if (Logger::Enabled(level))
+            Vqueue(STREAM_LOG, suppressed, fmt, args);
+    }
 }
 
 void Logger::Init()
 {
+    if (running.load())
+        return;
+    for (size_t i = 0; i < kSlots; i++)
+        slots[i].seq.store(i, std::memory_order_relaxed);
+    enqueue_pos.store(0);
+    dequeue_pos = 0;
+    stopping.store(false);
+
     if (!logging_enabled)
         return;
     EnsureDir();
+
+    Result rc = Threads::Create(&writer, WriterThread, nullptr, 0x10000, Threads::ROLE_BACKGROUND, "logger");
+    if (R_FAILED(rc))
+    {
+        WriteDirect(STREAM_LOG, "LOGGER threadCreate failed, writing synchronously");
+        return;
+    }
+    running.store(true);
+    threadStart(&writer);
 }
 
-void Logger::Log(const std::string &msg)
+void Logger::Exit()
 {
-    if (!logging_enabled)
-        return;
-    EnsureDir();
-    FILE *fd = FS::Append(LogPath());
-    if (!fd)
+    if (!running.load())
         return;
+    stopping.store(true);
+    // Not Threads::Join(): its exit line would land in the ring after the
+    // writer is gone.
+    threadWaitForExit(&writer);
+    threadClose(&writer);
+    running.store(false);
+    if (log_fd)
+    {
+        std::fclose(log_fd);
+        log_fd = nullptr;
+    }
+    if (trace_fd)
+    {
+        std::fclose(trace_fd);
+        trace_fd = nullptr;
+    }
+}
 
-    // Timestamp
-    std::time_t t = std::time(nullptr);
-    std::tm *tm = std::localtime(&t);
-    if (tm)
-        std::fprintf(fd, "[%04d-%02d-%02d %02d:%02d:%02d] %s\n",
-                     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-                     tm->tm_hour, tm->tm_min, tm->tm_sec, msg.c_str());
-    else
-        std::fprintf(fd, "%s\n", msg.c_str());
+void Logger::Recent(std::vector<std::string> &out)
+{
+    std::lock_guard<std::mutex> lock(tail_mutex);
+    out.assign(tail.begin(), tail.end());
+}
+
+bool Logger::Enabled(Level level)
+{
+    return logging_enabled && level <= log_level;
+}
+
+void Logger::Log(const std::string &msg)
+{
+    Logf(LOG_INFO, "%s", msg.c_str());
+}
 
-    std::fclose(fd);
+void Logger::Log(Level level, const std::string &msg)
+{
+    Logf(level, "%s", msg.c_str());
 }
 
 void Logger::Logf(const char *fmt, ...)
 {
-    char buf[1024];
     va_list args;
     va_start(args, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, args);
+    Vlog(LOG_INFO, 0, fmt, args);
     va_end(args);
-    Log(std::string(buf));
+}
+
+void Logger::Logf(Level level, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Vlog(level, 0, fmt, args);
+    va_end(args);
+}
+
+void Logger::LogfSuppressed(Level level, uint32_t suppressed, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Vlog(level, suppressed, fmt, args);
+    va_end(args);
+}
+
+void Logger::Trace(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Vqueue(STREAM_TRACE, 0, fmt, args);
+    va_end(args);
+}
+
+Logger::Level Logger::ParseLevel(const std::string &value)
+{
+    std::string lower = Util::ToLower(value);
+    if (lower == "error")
+        return LOG_ERROR;
+    if (lower == "warn")
+        return LOG_WARN;
+    if (lower == "debug")
+        return LOG_DEBUG;
+    return LOG_INFO;
+}
+
+bool Logger::RateLimit::Allow(uint32_t interval_ms, uint32_t &suppressed)
+{
+    uint64_t now = armTicksToNs(armGetSystemTick()) / 1000000ull;
+    uint64_t due = next.load(std::memory_order_relaxed);
+    if (now < due || !next.compare_exchange_strong(due, now + interval_ms, std::memory_order_relaxed))
+    {
+        dropped++;
+        return false;
+    }
+    suppressed = dropped.exchange(0);
+    return true;
 }
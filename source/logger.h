@@ -1,10 +1,74 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
 
+// Lines are formatted on the calling thread into a fixed ring of slots and
+// written by a background thread that keeps the log file open, so a log
+// call costs a vsnprintf and never touches the SD card. When the ring is
+// full lines are dropped (and counted in the log) rather than making the
+// caller wait.
 namespace Logger
 {
+    enum Level
+    {
+        LOG_ERROR,
+        LOG_WARN,
+        LOG_INFO,
+        LOG_DEBUG
+    };
+
+    // Starts the writer thread. Until then, and after Exit(), lines are
+    // written synchronously.
     void Init();
+    // Writes what is queued and closes the log.
+    void Exit();
+
+    // Whether a line at `level` would be logged (logging_enabled and
+    // log_level).
+    bool Enabled(Level level);
+
+    // Log() and Logf() without a level log at LOG_INFO.
     void Log(const std::string &msg);
+    void Log(Level level, const std::string &msg);
     void Logf(const char *fmt, ...);
+    void Logf(Level level, const char *fmt, ...);
+    // Logf() for LOG_RATE_LIMITED: notes how many lines the call site
+    // swallowed since its previous line.
+    void LogfSuppressed(Level level, uint32_t suppressed, const char *fmt, ...);
+    // Appends a raw line to TRACE_FILE through the same ring, whatever
+    // logging_enabled and log_level say; see TransferTrace.
+    void Trace(const char *fmt, ...);
+
+    // The last log lines written, oldest first, with their timestamps.
+    // Kept by the writer thread only while [Global] status_port is set;
+    // served by StatusServer.
+    void Recent(std::vector<std::string> &out);
+
+    // Parses the log_level knob ("error", "warn", "info" or "debug").
+    Level ParseLevel(const std::string &value);
+
+    // Lets one line per interval through a call site; see LOG_RATE_LIMITED.
+    class RateLimit
+    {
+    public:
+        bool Allow(uint32_t interval_ms, uint32_t &suppressed);
+
+    private:
+        std::atomic<uint64_t> next{0};
+        std::atomic<uint32_t> dropped{0};
+    };
 }
+
+// Logs at most one line every `interval_ms` from this call site, for
+// messages that can repeat per chunk or per retry.
+#define LOG_RATE_LIMITED(level, interval_ms, ...)                                      \
+    do                                                                                 \
+    {                                                                                  \
+        static Logger::RateLimit log_rate_limit_;                                      \
+        uint32_t log_suppressed_ = 0;                                                  \
+        if (Logger::Enabled(level) && log_rate_limit_.Allow(interval_ms, log_suppressed_)) \
+            Logger::LogfSuppressed(level, log_suppressed_, __VA_ARGS__);               \
+    } while (0)
@@ -8,7 +8,19 @@
 #include "config.h"
 #include "lang.h"
 #include "gui.h"
+#include "actions.h"
 #include "logger.h"
+#include "memory_governor.h"
+#include "threads.h"
+#include "resolver.h"
+#include "socket_tuning.h"
+#include "net_iface.h"
+#include "power.h"
+#include "status_server.h"
+#include "file_server.h"
+#include "site_probe.h"
+#include "local_trash.h"
+#include "httpclient/HTTPConnectionPool.h"
 // #include "dbglogger.h"
 
 static SetLanguage lang;
@@ -42,6 +54,14 @@ static void LogCurlInfo()
   if (info->features & CURL_VERSION_ALTSVC)
     line += " altsvc";
 #endif
+#ifdef CURL_VERSION_HTTP3
+  if (info->features & CURL_VERSION_HTTP3)
+    line += " http3";
+#endif
+#ifdef CURL_VERSION_SSLS_EXPORT
+  if (info->features & CURL_VERSION_SSLS_EXPORT)
+    line += " ssls-export";
+#endif
 #ifdef CURL_VERSION_BROTLI
   if (info->features & CURL_VERSION_BROTLI)
     line += " brotli";
@@ -69,21 +89,21 @@ namespace Services
   int Init(void)
   {
     curl_global_init(CURL_GLOBAL_DEFAULT);
-    // Boost CPU and optimize wireless for better transfer performance.
-    appletSetCpuBoostMode(ApmCpuBoostMode_FastLoad);
+    // Optimize wireless for transfers; the CPU boost and auto-sleep follow
+    // the work going on (Power::Update).
     appletSetWirelessPriorityMode(AppletWirelessPriorityMode_OptimizedForWlan);
-    // Keep the console awake while this app is running so long downloads
-    // are not interrupted by auto-sleep.
-    appletSetAutoSleepDisabled(true);
 
     plInitialize(PlServiceType_User);
     romfsInit();
-    socketInitializeDefault();
+    SocketInitConfig sockets = SocketTuning::InitConfig();
+    socketInitialize(&sockets);
     nxlinkStdio();
     setInitialize();
     Logger::Init();
     Logger::Log("App start");
+    NetIface::Init();
     LogCurlInfo();
+    CHTTPConnectionPool::Init();
     remoteclient = nullptr;
     u64 lang_code = -1;
     setGetSystemLanguage(&lang_code);
@@ -91,6 +111,13 @@ namespace Services
     setExit();
 
     CONFIG::LoadConfig();
+    CHTTPConnectionPool::LoadSessions();
+    MemoryGovernor::Init();
+    Threads::Init();
+    Power::Init();
+    StatusServer::Start();
+    FileServer::Start();
+    LocalTrash::Init();
     Lang::SetTranslation(lang);
     FontType fontType = FONT_TYPE_LATIN;
     if (strcasecmp(language, "Simplified Chinese") == 0 || lang == 6 || lang == 15)
@@ -126,23 +153,33 @@ namespace Services
       fontType = FONT_TYPE_GREEK;
     }
 
+    // GUI::Init() closes pl once the shared fonts are rasterised.
     GUI::Init(fontType);
-    plExit();
 
     return 0;
   }
 
   void Exit(void)
   {
+    Actions::StopConnectionManager();
+    SiteProbe::Exit();
+    LocalTrash::Exit();
     if (remoteclient != nullptr)
     {
       remoteclient->Quit();
       delete remoteclient;
       remoteclient = nullptr;
     }
+    FileServer::Stop();
+    StatusServer::Stop();
+    Power::Exit();
+    Resolver::Exit();
+    CHTTPConnectionPool::SaveSessions();
+    CHTTPConnectionPool::Exit();
     curl_global_cleanup();
     GUI::Exit();
     romfsExit();
+    NetIface::Exit();
     socketExit();
   }
 } // namespace Services
@@ -157,5 +194,6 @@ int main(int argc, char* argv[])
 
   Services::Exit();
   Logger::Log("App exit");
+  Logger::Exit();
   return 0;
 }
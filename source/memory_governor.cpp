@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <switch.h>
+
+#include "memory_governor.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "util.h"
+
+namespace
+{
+    const uint64_t kMiB = 1024 * 1024;
+    const uint64_t kCheckUs = 1000000;
+    // A parallel worker's share of the budget: its stream buffer and the
+    // out-of-order ranges it leaves in the reorder window.
+    const uint64_t kWorkerBytes = 8 * kMiB;
+    // Cached listings cost about 100 bytes an entry; a bit more is assumed.
+    const uint64_t kListingEntryBytes = 128;
+    const size_t kMinBudget = 16 * kMiB;
+
+    uint64_t heap_size = 0;
+    bool applet = false;
+    std::atomic<int> level{MemoryGovernor::LEVEL_NORMAL};
+    std::atomic<uint64_t> checked_at{0};
+    std::mutex check_mutex;
+
+    bool Active()
+    {
+        return memory_governor && heap_size > 0;
+    }
+
+    // Halved at TIGHT, quartered at CRITICAL.
+    uint64_t Scale(uint64_t value)
+    {
+        return value >> std::min(2, level.load(std::memory_order_relaxed));
+    }
+
+    size_t Budget()
+    {
+        uint64_t configured = (uint64_t)transfer_memory_mb * kMiB;
+        if (!Active())
+            return (size_t)configured;
+        uint64_t base = std::min(configured, std::max<uint64_t>(32 * kMiB, heap_size / 8 * 3));
+        return (size_t)std::max<uint64_t>(kMinBudget, Scale(base));
+    }
+
+    void Check()
+    {
+        uint64_t now = Util::GetTick();
+        uint64_t at = checked_at.load(std::memory_order_relaxed);
+        if (!Active() || (at != 0 && now - at < kCheckUs))
+            return;
+        std::unique_lock<std::mutex> lock(check_mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+            return;
+        checked_at.store(now, std::memory_order_relaxed);
+
+        MemoryStats::Heap heap;
+        MemoryStats::ReadHeap(heap);
+        uint64_t reserve = (uint64_t)memory_reserve_mb * kMiB;
+        int current = level.load(std::memory_order_relaxed);
+        int next = current;
+        if (heap.heap_free < reserve)
+            next = MemoryGovernor::LEVEL_CRITICAL;
+        else if (heap.heap_free < 2 * reserve)
+            next = std::max(current, (int)MemoryGovernor::LEVEL_TIGHT);
+        else if (heap.heap_free < 3 * reserve)
+            next = std::min(current, (int)MemoryGovernor::LEVEL_TIGHT);
+        else
+            next = MemoryGovernor::LEVEL_NORMAL;
+        if (next == current)
+            return;
+
+        level.store(next, std::memory_order_relaxed);
+        Logger::Logf("MEMORY GOVERNOR level=%s heap_free_mb=%llu reserve_mb=%d budget_mb=%llu",
+                     MemoryGovernor::LevelName((MemoryGovernor::Level)next),
+                     (unsigned long long)(heap.heap_free / kMiB), memory_reserve_mb,
+                     (unsigned long long)(Budget() / kMiB));
+        // Idle buffers are heap nobody uses; hand them back first.
+        if (next > current)
+            BufferPool::Trim();
+    }
+}
+
+namespace MemoryGovernor
+{
+    void Init()
+    {
+        AppletType type = appletGetAppletType();
+        applet = type != AppletType_Application && type != AppletType_SystemApplication;
+        MemoryStats::Heap heap;
+        MemoryStats::ReadHeap(heap);
+        heap_size = heap.heap_size;
+        Logger::Logf("MEMORY GOVERNOR start enabled=%d applet=%d heap_mb=%llu budget_mb=%llu workers=%d chunk_mb=%lld "
+                     "listing_entries=%zu image_cache_mb=%zu",
+                     memory_governor ? 1 : 0, applet ? 1 : 0, (unsigned long long)(heap_size / kMiB),
+                     (unsigned long long)(Budget() / kMiB), Workers(32), (long long)(ChunkBytes(32 * kMiB) / kMiB),
+                     ListingCacheEntries(), ImageCacheBytes() / kMiB);
+    }
+
+    Level Current()
+    {
+        Check();
+        return (Level)level.load(std::memory_order_relaxed);
+    }
+
+    const char *LevelName(Level value)
+    {
+        switch (value)
+        {
+        case LEVEL_TIGHT:
+            return "tight";
+        case LEVEL_CRITICAL:
+            return "critical";
+        default:
+            return "normal";
+        }
+    }
+
+    bool AppletMode()
+    {
+        return applet;
+    }
+
+    size_t TransferBudget()
+    {
+        return Budget();
+    }
+
+    int Workers(int wanted)
+    {
+        if (!Active())
+            return wanted;
+        if (Current() == LEVEL_CRITICAL)
+            return 1;
+        int cap = (int)std::max<uint64_t>(1, Budget() / kWorkerBytes);
+        return std::max(1, std::min(wanted, cap));
+    }
+
+    int64_t ChunkBytes(int64_t wanted)
+    {
+        if (!Active())
+            return wanted;
+        int64_t cap = Current() == LEVEL_CRITICAL ? (int64_t)kMiB : (int64_t)std::max<uint64_t>(kMiB, Budget() / 8);
+        return std::min(wanted, cap);
+    }
+
+    int ParallelFiles(int wanted)
+    {
+        if (!Active())
+            return wanted;
+        switch (Current())
+        {
+        case LEVEL_CRITICAL:
+            return 1;
+        case LEVEL_TIGHT:
+            return std::min(wanted, 2);
+        default:
+            return wanted;
+        }
+    }
+
+    size_t DiskQueueBytes()
+    {
+        size_t configured = (size_t)disk_queue_mb * kMiB;
+        if (!Active())
+            return configured;
+        Check();
+        return std::min(configured, Budget() / 4);
+    }
+
+    size_t ListingCacheEntries()
+    {
+        size_t configured = (size_t)std::max(0, listing_cache_entries);
+        if (!Active())
+            return configured;
+        Check();
+        return std::min(configured, (size_t)Scale(heap_size / 32 / kListingEntryBytes));
+    }
+
+    size_t ImageCacheBytes()
+    {
+        size_t configured = (size_t)std::max(0, image_cache_mb) * kMiB;
+        if (!Active())
+            return configured;
+        Check();
+        return std::min(configured, (size_t)Scale(heap_size / 16));
+    }
+}
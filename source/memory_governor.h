@@ -0,0 +1,50 @@
+#ifndef NEO_MEMORY_GOVERNOR_H
+#define NEO_MEMORY_GOVERNOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Scales what the app keeps in flight to the heap it got. Launched from
+// the album as an applet it has a few hundred MiB; over a title it has
+// gigabytes, yet the knobs are the same. The heap size read at start-up
+// sets the transfer budget (at most transfer_memory_mb) and caps on
+// workers, range sizes, the disk writer's queue, the listing cache and the
+// image cache. While the program runs the free heap is checked again at
+// most once a second: below twice memory_reserve_mb the caps go to the
+// TIGHT level, below the reserve to CRITICAL, and back once three times
+// the reserve is free. A new level trims the idle transfer buffers.
+// Every cap returns the configured value unchanged while the governor is
+// off ([Global] memory_governor=0) or the heap is big enough for it.
+namespace MemoryGovernor
+{
+    enum Level
+    {
+        LEVEL_NORMAL,
+        LEVEL_TIGHT,
+        LEVEL_CRITICAL
+    };
+
+    // Reads the heap size and the applet type; after CONFIG::LoadConfig().
+    void Init();
+    // The current level, rechecked when the last check is a second old.
+    Level Current();
+    const char *LevelName(Level level);
+    // Whether the app runs as a library applet (album launch).
+    bool AppletMode();
+
+    // Bytes of BufferPool leases at once. Never rechecks, so the pool can
+    // call it under its lock.
+    size_t TransferBudget();
+    // Connections of one parallel engine, range size, and files
+    // downloaded at once.
+    int Workers(int wanted);
+    int64_t ChunkBytes(int64_t wanted);
+    int ParallelFiles(int wanted);
+    // A LocalFileSink writer's queue (disk_queue_mb) in bytes.
+    size_t DiskQueueBytes();
+    // Entries of the remote listing cache and bytes of image textures.
+    size_t ListingCacheEntries();
+    size_t ImageCacheBytes();
+}
+
+#endif
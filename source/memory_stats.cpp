@@ -0,0 +1,97 @@
+#include <malloc.h>
+#include <algorithm>
+#include <atomic>
+#include <switch.h>
+
+#include "memory_stats.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "logger.h"
+#include "memory_governor.h"
+#include "util.h"
+
+// Bounds of the newlib heap, set up by libnx at start-up.
+extern "C" char *fake_heap_start;
+extern "C" char *fake_heap_end;
+
+namespace
+{
+    // mallinfo() walks the free lists under the malloc lock; a range
+    // scheduler asking per range reuses the last answer this long.
+    const uint64_t kHeadroomCacheUs = 20000;
+
+    std::atomic<uint64_t> headroom_at{0};
+    std::atomic<int64_t> headroom{0};
+
+    int64_t Mb(int64_t bytes)
+    {
+        return bytes / (1024 * 1024);
+    }
+}
+
+namespace MemoryStats
+{
+    bool ReadHeap(Heap &out)
+    {
+        bool ok = R_SUCCEEDED(svcGetInfo(&out.process_total, InfoType_TotalMemorySize, CUR_PROCESS_HANDLE, 0)) &&
+                  R_SUCCEEDED(svcGetInfo(&out.process_used, InfoType_UsedMemorySize, CUR_PROCESS_HANDLE, 0));
+
+        struct mallinfo info = mallinfo();
+        out.heap_size = (uint64_t)(fake_heap_end - fake_heap_start);
+        out.heap_used = (uint64_t)info.uordblks;
+        // Never grown into yet, plus what malloc holds free.
+        uint64_t arena = std::min<uint64_t>((uint64_t)info.arena, out.heap_size);
+        out.heap_free = out.heap_size - arena + (uint64_t)info.fordblks;
+        return ok;
+    }
+
+    int64_t Headroom()
+    {
+        uint64_t now = Util::GetTick();
+        uint64_t at = headroom_at.load(std::memory_order_relaxed);
+        if (at != 0 && now - at < kHeadroomCacheUs)
+            return headroom.load(std::memory_order_relaxed);
+
+        Heap heap;
+        ReadHeap(heap);
+        int64_t budget = (int64_t)MemoryGovernor::TransferBudget() - (int64_t)BufferPool::GetStats().in_use;
+        int64_t free_heap = (int64_t)heap.heap_free - (int64_t)memory_reserve_mb * 1024 * 1024;
+        int64_t value = std::min(budget, free_heap);
+        headroom.store(value, std::memory_order_relaxed);
+        headroom_at.store(now, std::memory_order_relaxed);
+        return value;
+    }
+
+    void Read(Report &out)
+    {
+        ReadHeap(out.heap);
+        Metrics::Snapshot totals;
+        Metrics::Read(totals);
+        for (int g = 0; g < Metrics::GAUGE_COUNT; g++)
+            out.gauges[g] = totals.gauges[g];
+        BufferPool::Stats pool = BufferPool::GetStats();
+        out.pool_idle = pool.idle;
+        out.pool_peak = pool.peak;
+        out.pool_budget = MemoryGovernor::TransferBudget();
+        out.level = MemoryGovernor::Current();
+        out.headroom = Headroom();
+    }
+
+    void Log(const char *tag)
+    {
+        Report r;
+        Read(r);
+        Logger::Logf("MEMORY %s process_mb=%lld/%lld heap_mb=%lld/%lld heap_free_mb=%lld pool_mb=%lld idle_mb=%lld "
+                     "listings_kb=%lld http_bodies_kb=%lld textures_kb=%lld fonts_kb=%lld archive_kb=%lld "
+                     "headroom_mb=%lld governor=%s",
+                     tag, (long long)Mb(r.heap.process_used), (long long)Mb(r.heap.process_total),
+                     (long long)Mb(r.heap.heap_used), (long long)Mb(r.heap.heap_size), (long long)Mb(r.heap.heap_free),
+                     (long long)Mb(r.gauges[Metrics::GAUGE_POOL_BYTES]), (long long)Mb(r.pool_idle),
+                     (long long)(r.gauges[Metrics::GAUGE_MEM_LISTINGS] / 1024),
+                     (long long)(r.gauges[Metrics::GAUGE_MEM_HTTP_BODIES] / 1024),
+                     (long long)(r.gauges[Metrics::GAUGE_MEM_TEXTURES] / 1024),
+                     (long long)(r.gauges[Metrics::GAUGE_MEM_FONTS] / 1024),
+                     (long long)(r.gauges[Metrics::GAUGE_MEM_ARCHIVE] / 1024), (long long)Mb(r.headroom),
+                     MemoryGovernor::LevelName((MemoryGovernor::Level)r.level));
+    }
+}
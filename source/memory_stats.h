@@ -0,0 +1,55 @@
+#ifndef NEO_MEMORY_STATS_H
+#define NEO_MEMORY_STATS_H
+
+#include <cstdint>
+
+#include "metrics.h"
+
+// Where the memory goes. The process figures come from svcGetInfo, but
+// libnx hands the whole free address space to the heap at start-up, so
+// "used" there is mostly the heap reservation; what matters is how much
+// of that heap newlib's malloc has handed out (mallinfo). On top of that
+// the subsystems that can grow large keep Metrics gauges of their own:
+// listings, HTTP bodies, the buffer pool, textures, the font atlas and
+// the archive block cache. The overlay ([Global] memory_overlay), the
+// status server and the parallel engines read them from here.
+namespace MemoryStats
+{
+    struct Heap
+    {
+        // svcGetInfo: the process' memory limit and what it has mapped.
+        uint64_t process_total = 0;
+        uint64_t process_used = 0;
+        // The malloc heap: its size, bytes handed out and bytes left,
+        // free chunks included.
+        uint64_t heap_size = 0;
+        uint64_t heap_used = 0;
+        uint64_t heap_free = 0;
+    };
+
+    struct Report
+    {
+        Heap heap;
+        // Metrics::GAUGE_POOL_BYTES and the GAUGE_MEM_* gauges.
+        int64_t gauges[Metrics::GAUGE_COUNT] = {};
+        uint64_t pool_idle = 0;
+        uint64_t pool_peak = 0;
+        uint64_t pool_budget = 0;
+        int64_t headroom = 0;
+        // MemoryGovernor::Level.
+        int level = 0;
+    };
+
+    bool ReadHeap(Heap &out);
+    void Read(Report &out);
+    // Bytes that can still be claimed for transfer data: the smaller of
+    // what is left of the transfer budget (MemoryGovernor) and the free
+    // heap less memory_reserve_mb. Negative once the reserve is eaten
+    // into. Sampled at most every few milliseconds, so callers may ask per
+    // range.
+    int64_t Headroom();
+    // One MEMORY log line, e.g. at the end of a batch.
+    void Log(const char *tag);
+}
+
+#endif
@@ -0,0 +1,381 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#include "metalink.h"
+#include "config.h"
+#include "fs.h"
+#include "lang.h"
+#include "local_sink.h"
+#include "logger.h"
+#include "metrics.h"
+#include "util.h"
+#include "httpclient/HTTPMultiClient.h"
+#include "pugixml/pugixml.hpp"
+#include "cancel.h"
+
+extern Metrics::Value<int64_t> bytes_transfered;
+
+namespace
+{
+    // Rounds of fetching pieces that failed their hash, each with the
+    // mirrors rotated by one.
+    const int kRounds = 3;
+    // Ranges span whole pieces, at least this much.
+    const int64_t kMinChunk = 4 * 1024 * 1024;
+
+    // `name` without its namespace prefix.
+    const char *LocalName(const pugi::xml_node &node)
+    {
+        const char *name = node.name();
+        const char *colon = strrchr(name, ':');
+        return colon != nullptr ? colon + 1 : name;
+    }
+
+    bool Is(const pugi::xml_node &node, const char *name)
+    {
+        return node.type() == pugi::node_element && strcmp(LocalName(node), name) == 0;
+    }
+
+    // "sha-256" (RFC 5854) or "sha256" (Metalink 3).
+    FileDigest::Algo HashAlgo(std::string type)
+    {
+        type.erase(std::remove(type.begin(), type.end(), '-'), type.end());
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+        if (type == "sha256")
+            return FileDigest::SHA256;
+        if (type == "sha1")
+            return FileDigest::SHA1;
+        if (type == "md5")
+            return FileDigest::MD5;
+        return FileDigest::NONE;
+    }
+
+    int Strength(FileDigest::Algo algo)
+    {
+        return algo == FileDigest::SHA256 ? 3 : algo == FileDigest::SHA1 ? 2 : algo == FileDigest::MD5 ? 1 : 0;
+    }
+
+    std::string Text(const pugi::xml_node &node)
+    {
+        std::string text = node.child_value();
+        Util::Trim(text, " \t\r\n");
+        return text;
+    }
+
+    // Collects the hashes, pieces, size and URLs below `node`, which is
+    // the <file> itself or a <verification>/<resources> group in it.
+    void ReadFile(const pugi::xml_node &node, Metalink::File &file, std::vector<std::pair<int, std::string>> &urls)
+    {
+        for (pugi::xml_node child : node.children())
+        {
+            if (Is(child, "size"))
+                file.size = strtoll(Text(child).c_str(), nullptr, 10);
+            else if (Is(child, "hash"))
+            {
+                FileDigest digest = Checksum::FromHex(HashAlgo(child.attribute("type").value()), Text(child));
+                if (digest.Valid() && Strength(digest.algo) > Strength(file.digest.algo))
+                    file.digest = digest;
+            }
+            else if (Is(child, "pieces"))
+            {
+                FileDigest::Algo algo = HashAlgo(child.attribute("type").value());
+                if (Strength(algo) <= Strength(file.piece_algo))
+                    continue;
+                std::vector<std::vector<uint8_t>> pieces;
+                for (pugi::xml_node hash : child.children())
+                {
+                    if (!Is(hash, "hash"))
+                        continue;
+                    FileDigest digest = Checksum::FromHex(algo, Text(hash));
+                    if (!digest.Valid())
+                    {
+                        pieces.clear();
+                        break;
+                    }
+                    pieces.push_back(digest.value);
+                }
+                int64_t length = strtoll(child.attribute("length").value(), nullptr, 10);
+                if (length > 0 && !pieces.empty())
+                {
+                    file.piece_algo = algo;
+                    file.piece_length = length;
+                    file.pieces.swap(pieces);
+                }
+            }
+            else if (Is(child, "url"))
+            {
+                std::string url = Text(child);
+                if (url.compare(0, 7, "http://") != 0 && url.compare(0, 8, "https://") != 0)
+                    continue;
+                // RFC 5854 priority counts up from 1 as the best; Metalink 3
+                // preference counts down from 100.
+                int rank = 999999;
+                if (!child.attribute("priority").empty())
+                    rank = child.attribute("priority").as_int(999999);
+                else if (!child.attribute("preference").empty())
+                    rank = 101 - child.attribute("preference").as_int(0);
+                urls.push_back({rank, url});
+            }
+            else if (Is(child, "verification") || Is(child, "resources"))
+                ReadFile(child, file, urls);
+        }
+    }
+
+    void FindFiles(const pugi::xml_node &node, std::vector<Metalink::File> &files)
+    {
+        for (pugi::xml_node child : node.children())
+        {
+            if (!Is(child, "file"))
+            {
+                if (Is(child, "files"))
+                    FindFiles(child, files);
+                continue;
+            }
+            Metalink::File file;
+            file.name = child.attribute("name").value();
+            std::vector<std::pair<int, std::string>> urls;
+            ReadFile(child, file, urls);
+            std::stable_sort(urls.begin(), urls.end(), [](const std::pair<int, std::string> &a,
+                                                          const std::pair<int, std::string> &b)
+                             { return a.first < b.first; });
+            for (const auto &url : urls)
+                file.urls.push_back(url.second);
+
+            // Pieces that cannot cover the file are worthless.
+            if (file.size > 0 && file.piece_length > 0 &&
+                (int64_t)file.pieces.size() != (file.size + file.piece_length - 1) / file.piece_length)
+            {
+                Logger::Logf(Logger::LOG_WARN, "METALINK pieces ignored name=%s pieces=%zu", file.name.c_str(),
+                             file.pieces.size());
+                file.piece_algo = FileDigest::NONE;
+                file.piece_length = 0;
+                file.pieces.clear();
+            }
+            // The name is joined to a local folder: nothing may climb out.
+            bool safe = !file.name.empty() && file.name[0] != '/' && file.name.find('\\') == std::string::npos;
+            for (const std::string &part : Util::Split(file.name, "/"))
+                safe = safe && part != "..";
+            if (!safe || file.size <= 0 || file.urls.empty())
+            {
+                Logger::Logf(Logger::LOG_WARN, "METALINK file skipped name=%s size=%lld urls=%zu", file.name.c_str(),
+                             (long long)file.size, file.urls.size());
+                continue;
+            }
+            files.push_back(file);
+        }
+    }
+
+    // Reads back [offset, offset + size) of the download from the card.
+    bool ReadLocal(const std::string &path, uint64_t part_size, uint64_t offset, char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            std::string file = path;
+            uint64_t pos = offset;
+            size_t take = size;
+            if (part_size > 0)
+            {
+                char name[16];
+                snprintf(name, sizeof(name), "/%02d", (int)(offset / part_size));
+                file += name;
+                pos = offset % part_size;
+                take = (size_t)std::min<uint64_t>(size, part_size - pos);
+            }
+            int fd = open(file.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            bool ok = lseek(fd, (off_t)pos, SEEK_SET) >= 0;
+            for (size_t left = take; ok && left > 0;)
+            {
+                ssize_t got = read(fd, data + (take - left), left);
+                ok = got > 0;
+                left -= ok ? (size_t)got : 0;
+            }
+            close(fd);
+            if (!ok)
+                return false;
+            offset += take;
+            data += take;
+            size -= take;
+        }
+        return true;
+    }
+}
+
+namespace Metalink
+{
+    bool IsMetalink(const std::string &path)
+    {
+        std::string lower = path;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        return Util::EndsWith(lower, ".meta4") || Util::EndsWith(lower, ".metalink");
+    }
+
+    bool Parse(const std::string &data, std::vector<File> &files)
+    {
+        pugi::xml_document doc;
+        if (!doc.load_buffer(data.data(), data.size()))
+            return false;
+        pugi::xml_node root = doc.document_element();
+        if (!Is(root, "metalink"))
+            return false;
+        FindFiles(root, files);
+        return !files.empty();
+    }
+
+    bool Download(const File &file, const std::string &dest, std::string &error)
+    {
+        uint64_t started = Util::GetTick();
+        uint64_t size = (uint64_t)file.size;
+        uint64_t part_size = LocalFileSink::NeedsSplit(size) ? LocalFileSink::kSplitPartSize : 0;
+        LocalFileSink sink(dest, part_size);
+        if (!sink.Open(false))
+        {
+            error = lang_strings[STR_FAIL_CREATE_LOCAL_FILE_MSG];
+            return false;
+        }
+        sink.Preallocate(size);
+        if (file.digest.Valid())
+            sink.EnableChecksum(file.digest.algo);
+
+        bool pieced = !file.pieces.empty();
+        int64_t piece = pieced ? file.piece_length : (int64_t)size;
+        int64_t chunk = pieced ? piece * std::max<int64_t>(1, (kMinChunk + piece - 1) / piece)
+                               : (int64_t)webdav_chunk_size_mb * 1024 * 1024;
+        auto pieceSize = [&](size_t index)
+        { return std::min<int64_t>(piece, (int64_t)size - (int64_t)index * piece); };
+
+        // Each piece is digested as its bytes go by and checked once its
+        // ranges are all in; all of it runs on the engine's thread.
+        std::vector<std::unique_ptr<ChecksumWriter>> writers(pieced ? file.pieces.size() : 0);
+        std::vector<int64_t> covered(writers.size(), 0);
+        std::vector<CHTTPMultiClient::Span> todo = {{0, (int64_t)size}};
+        std::vector<size_t> bad;
+        int refetched = 0;
+
+        for (int round = 0; !todo.empty() && round < kRounds; round++)
+        {
+            for (const CHTTPMultiClient::Span &span : todo)
+            {
+                for (size_t p = (size_t)(span.first / piece); pieced && (int64_t)p * piece < span.second; p++)
+                {
+                    writers[p].reset(new ChecksumWriter(file.piece_algo));
+                    covered[p] = 0;
+                }
+            }
+            bad.clear();
+
+            // A piece that failed with one mirror first is asked of the next.
+            std::vector<std::string> order;
+            for (size_t i = 0; i < file.urls.size(); i++)
+                order.push_back(file.urls[(i + round) % file.urls.size()]);
+
+            CHTTPMultiClient engine;
+            engine.SetCertificateFile(CACERT_FILE);
+            engine.SetRetryPolicy(6, 1000000, 16000000);
+            engine.SetProgressCounter(bytes_transfered.Atomic());
+            engine.SetCancelFlag(Cancel::Flag());
+            engine.SetEndgameSteal((int64_t)webdav_range_steal_kb * 1024);
+            int index = engine.AddFileSpans(
+                order[0], (int64_t)size, chunk,
+                [&](int64_t offset, const char *data, size_t len)
+                {
+                    for (int64_t at = offset, end = offset + (int64_t)len; pieced && at < end;)
+                    {
+                        size_t p = (size_t)(at / piece);
+                        int64_t stop = std::min(end, (int64_t)(p + 1) * piece);
+                        writers[p]->Update((uint64_t)(at - (int64_t)p * piece), data + (at - offset),
+                                           (size_t)(stop - at));
+                        at = stop;
+                    }
+                    return sink.WriteAt((uint64_t)offset, data, len);
+                },
+                todo,
+                [&](int64_t start, int64_t end)
+                {
+                    for (size_t p = (size_t)(start / piece); pieced && (int64_t)p * piece <= end; p++)
+                    {
+                        int64_t from = std::max(start, (int64_t)p * piece);
+                        int64_t to = std::min(end + 1, (int64_t)p * piece + pieceSize(p));
+                        covered[p] += to - from;
+                        if (covered[p] < pieceSize(p))
+                            continue;
+                        // What the writer did not see in order is read
+                        // back, once the queued writes are on the card.
+                        bool flushed = false;
+                        uint64_t base = (uint64_t)p * piece;
+                        FileDigest got;
+                        bool ok = writers[p]->Final((uint64_t)pieceSize(p),
+                                                    [&](uint64_t offset, char *data, size_t len)
+                                                    {
+                                                        if (!flushed && !(flushed = sink.Flush()))
+                                                            return false;
+                                                        return ReadLocal(dest, part_size, base + offset, data, len);
+                                                    },
+                                                    got);
+                        if (ok && got.value == file.pieces[p])
+                            continue;
+                        Logger::Logf(Logger::LOG_WARN, "METALINK piece bad name=%s piece=%zu round=%d",
+                                     file.name.c_str(), p, round);
+                        bad.push_back(p);
+                        bytes_transfered += -pieceSize(p);
+                    }
+                });
+            if (order.size() > 1)
+                engine.AddMirrors(index, std::vector<std::string>(order.begin() + 1, order.end()));
+
+            bool ok = engine.Run(http_parallel_connections);
+            if (!ok)
+            {
+                const CHTTPMultiClient::FileResult &result = engine.GetResult(index);
+                error = Cancel::Stopped() ? lang_strings[STR_CANCEL_ACTION_MSG]
+                        : result.errorMessage.empty() ? lang_strings[STR_FAIL_DOWNLOAD_MSG] : result.errorMessage;
+                sink.Close();
+                Logger::Logf(Logger::LOG_ERROR, "METALINK download failed name=%s err=%s", file.name.c_str(),
+                             error.c_str());
+                return false;
+            }
+
+            std::sort(bad.begin(), bad.end());
+            todo.clear();
+            for (size_t p : bad)
+            {
+                int64_t from = (int64_t)p * piece;
+                if (!todo.empty() && todo.back().second == from)
+                    todo.back().second += pieceSize(p);
+                else
+                    todo.push_back({from, from + pieceSize(p)});
+            }
+            refetched += (int)bad.size();
+        }
+
+        FileDigest actual;
+        bool digested = todo.empty() && file.digest.Valid() && sink.Digest(size, actual);
+        bool written = sink.Finish();
+        bool verified = todo.empty() && (!digested || actual.value == file.digest.value);
+        if (!written || !verified)
+        {
+            error = !written ? lang_strings[STR_FAIL_DOWNLOAD_MSG] : lang_strings[STR_CHECKSUM_MISMATCH];
+            Logger::Logf(Logger::LOG_ERROR, "METALINK verify failed name=%s written=%d spans_left=%zu actual=%s",
+                         file.name.c_str(), written ? 1 : 0, todo.size(), actual.Hex().c_str());
+            // Left in place, the full-size file would pass for a finished one.
+            if (part_size > 0)
+                FS::RmRecursive(dest);
+            else
+                FS::Rm(dest);
+            return false;
+        }
+
+        double secs = (Util::GetTick() - started) / 1000000.0;
+        Logger::Logf("METALINK done name=%s size=%llu urls=%zu pieces=%zu refetched=%d %s=%s ms=%.0f mib_s=%.2f",
+                     file.name.c_str(), (unsigned long long)size, file.urls.size(), file.pieces.size(), refetched,
+                     FileDigest::Name(file.digest.algo), digested ? "ok" : "none", secs * 1000.0,
+                     secs > 0.0 ? size / secs / 1048576.0 : 0.0);
+        return true;
+    }
+}
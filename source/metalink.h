@@ -0,0 +1,42 @@
+#ifndef NEO_METALINK_H
+#define NEO_METALINK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "checksum.h"
+
+// Metalink descriptions (RFC 5854 .meta4, and the older .metalink) of files
+// served by several mirrors. A downloaded description fetches the files it
+// lists across all their HTTP(S) URLs at once through CHTTPMultiClient,
+// each piece checked against its hash as soon as its ranges are in, and the
+// pieces that fail fetched again with the mirrors in another order.
+namespace Metalink
+{
+    struct File
+    {
+        // Relative path the description gives the file.
+        std::string name;
+        int64_t size = -1;
+        // Strongest whole-file hash listed.
+        FileDigest digest;
+        // Piece hashes of `piece_length` bytes each, the last one shorter.
+        FileDigest::Algo piece_algo = FileDigest::NONE;
+        int64_t piece_length = 0;
+        std::vector<std::vector<uint8_t>> pieces;
+        // HTTP(S) URLs, most preferred first.
+        std::vector<std::string> urls;
+    };
+
+    // Whether `path` names a Metalink description, by its extension.
+    bool IsMetalink(const std::string &path);
+    // The files described in `data`; false when it is no Metalink or lists
+    // no file we can fetch.
+    bool Parse(const std::string &data, std::vector<File> &files);
+    // Downloads `file` to `dest`, adding to bytes_transfered. Returns false
+    // with `error` set when it failed, was cancelled or did not verify.
+    bool Download(const File &file, const std::string &dest, std::string &error);
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include "metrics.h"
+
+namespace Metrics
+{
+    namespace
+    {
+        struct alignas(kCacheLine) Shard
+        {
+            std::atomic<int64_t> counters[COUNTER_COUNT];
+            std::atomic<int64_t> gauges[GAUGE_COUNT];
+        };
+
+        Shard shards[kShards];
+        // Set() levels, apart from the shards Move() adds into.
+        alignas(kCacheLine) std::atomic<int64_t> levels[GAUGE_COUNT];
+        std::atomic<int> next_shard{0};
+        thread_local int shard = -1;
+
+        Shard &Own()
+        {
+            if (shard < 0)
+                shard = next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+            return shards[shard];
+        }
+    }
+
+    void Count(Counter counter, int64_t delta)
+    {
+        Own().counters[counter].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void Move(Gauge gauge, int64_t delta)
+    {
+        Own().gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void Set(Gauge gauge, int64_t value)
+    {
+        levels[gauge].store(value, std::memory_order_relaxed);
+    }
+
+    void ResetCounters()
+    {
+        for (Shard &s : shards)
+        {
+            for (int c = 0; c < COUNTER_COUNT; c++)
+                s.counters[c].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Read(Snapshot &out)
+    {
+        for (int g = 0; g < GAUGE_COUNT; g++)
+            out.gauges[g] = levels[g].load(std::memory_order_relaxed);
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            out.counters[c] = 0;
+        for (const Shard &s : shards)
+        {
+            for (int c = 0; c < COUNTER_COUNT; c++)
+                out.counters[c] += s.counters[c].load(std::memory_order_relaxed);
+            for (int g = 0; g < GAUGE_COUNT; g++)
+                out.gauges[g] += s.gauges[g].load(std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef NEO_METRICS_H
+#define NEO_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+
+// Process-wide transfer counters and gauges. Worker threads add into a
+// shard of their own, one cache line each, so parallel downloads at high
+// chunk rates never write the same line; readers sum the shards into a
+// Snapshot once a frame or once a batch. Shards are handed out to threads
+// round robin on first use and shared past kShards threads, which only
+// costs contention, not accuracy.
+//
+// TransferStats keeps the per-worker view (file, position, chunk map) on
+// top of this; the progress dialog, the TRANSFER SUMMARY line and the
+// trace read the totals from here.
+namespace Metrics
+{
+    static const int kCacheLine = 64;
+    static const int kShards = 16;
+
+    enum Counter
+    {
+        // Bytes received or sent by the bound queue workers.
+        COUNTER_BYTES,
+        // Network requests timed by TransferTrace.
+        COUNTER_REQUESTS,
+        COUNTER_RETRIES,
+        COUNTER_COUNT
+    };
+
+    enum Gauge
+    {
+        // Queue jobs not started yet.
+        GAUGE_QUEUED,
+        // Bytes handed to a LocalFileSink writer and not yet on the card.
+        GAUGE_DISK_BACKLOG,
+        // Bytes of BufferPool buffers leased out.
+        GAUGE_POOL_BYTES,
+        // Heap bytes by subsystem, for MemoryStats: cached and shown
+        // listings, HTTP response bodies held in memory, image textures,
+        // the font atlas, and the archive block caches (also pool bytes).
+        GAUGE_MEM_LISTINGS,
+        GAUGE_MEM_HTTP_BODIES,
+        GAUGE_MEM_TEXTURES,
+        GAUGE_MEM_FONTS,
+        GAUGE_MEM_ARCHIVE,
+        GAUGE_COUNT
+    };
+
+    struct Snapshot
+    {
+        int64_t counters[COUNTER_COUNT] = {};
+        int64_t gauges[GAUGE_COUNT] = {};
+    };
+
+    void Count(Counter counter, int64_t delta = 1);
+    // Moves a gauge from any thread.
+    void Move(Gauge gauge, int64_t delta);
+    // Sets a gauge with a single owner; not mixed with Move() on the same
+    // gauge.
+    void Set(Gauge gauge, int64_t value);
+    // Counters back to 0 for a new batch; gauges keep their level.
+    void ResetCounters();
+    void Read(Snapshot &out);
+
+    // Bytes one object holds, kept in a Move() gauge until it is destroyed.
+    // A copy holds nothing of its own; a move takes the bytes along.
+    class Held
+    {
+    public:
+        explicit Held(Gauge gauge) : gauge(gauge) {}
+        Held(const Held &other) : gauge(other.gauge) {}
+        Held(Held &&other) : gauge(other.gauge), bytes(other.bytes) { other.bytes = 0; }
+        Held &operator=(const Held &)
+        {
+            Set(0);
+            return *this;
+        }
+        Held &operator=(Held &&other)
+        {
+            if (this != &other)
+            {
+                Set(0);
+                gauge = other.gauge;
+                bytes = other.bytes;
+                other.bytes = 0;
+            }
+            return *this;
+        }
+        ~Held() { Set(0); }
+
+        void Set(int64_t value)
+        {
+            if (value != bytes)
+                Move(gauge, value - bytes);
+            bytes = value;
+        }
+        int64_t Bytes() const { return bytes; }
+
+    private:
+        Gauge gauge;
+        int64_t bytes = 0;
+    };
+
+    // The current file of a single-stream job, as the shared progress
+    // values (bytes_transfered, bytes_to_download, prev_tick) hold it: a
+    // relaxed atomic on a cache line of its own with the integer operators
+    // their writers use, so a client thread updating one never races the
+    // dialog reading it.
+    template <typename T>
+    class alignas(kCacheLine) Value
+    {
+    public:
+        Value &operator=(T v)
+        {
+            value.store(v, std::memory_order_relaxed);
+            return *this;
+        }
+        Value &operator=(const Value &other) { return *this = (T)other; }
+        Value &operator+=(T delta)
+        {
+            value.fetch_add(delta, std::memory_order_relaxed);
+            return *this;
+        }
+        Value &operator-=(T delta)
+        {
+            value.fetch_sub(delta, std::memory_order_relaxed);
+            return *this;
+        }
+        operator T() const { return value.load(std::memory_order_relaxed); }
+        // For code that counts into a plain atomic (CHTTPMultiClient).
+        std::atomic<T> *Atomic() { return &value; }
+
+    private:
+        std::atomic<T> value{0};
+    };
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <switch.h>
+
+#include "net_iface.h"
+#include "logger.h"
+
+namespace
+{
+    bool initialized = false;
+    // type * 16 + signal, so the trace can read it per record without a lock.
+    std::atomic<int> last{0};
+}
+
+namespace NetIface
+{
+    void Init()
+    {
+        ::Result rc = nifmInitialize(NifmServiceType_User);
+        initialized = R_SUCCEEDED(rc);
+        if (!initialized)
+            Logger::Logf(Logger::LOG_ERROR, "NET nifmInitialize failed rc=0x%x", rc);
+    }
+
+    void Exit()
+    {
+        if (initialized)
+            nifmExit();
+        initialized = false;
+    }
+
+    State Query()
+    {
+        State state;
+        NifmInternetConnectionType type;
+        NifmInternetConnectionStatus status;
+        u32 strength = 0;
+        if (initialized && R_SUCCEEDED(nifmGetInternetConnectionStatus(&type, &strength, &status)))
+        {
+            if (type == NifmInternetConnectionType_Ethernet)
+            {
+                state.type = TYPE_ETHERNET;
+                state.signal = 3;
+            }
+            else if (type == NifmInternetConnectionType_WiFi)
+            {
+                state.type = TYPE_WIFI;
+                state.signal = (int)(strength > 3 ? 3 : strength);
+            }
+        }
+
+        if (last.exchange(state.type * 16 + state.signal) != state.type * 16 + state.signal)
+            Logger::Logf("NET iface=%s signal=%d", Name(state.type), state.signal);
+        return state;
+    }
+
+    State Last()
+    {
+        int packed = last.load(std::memory_order_relaxed);
+        State state;
+        state.type = (Type)(packed / 16);
+        state.signal = packed % 16;
+        return state;
+    }
+
+    const char *Name(Type type)
+    {
+        switch (type)
+        {
+        case TYPE_ETHERNET:
+            return "ethernet";
+        case TYPE_WIFI:
+            return "wifi";
+        default:
+            return "none";
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef NEO_NET_IFACE_H
+#define NEO_NET_IFACE_H
+
+// Which link the console is on. Docked on USB Ethernet and on a busy Wi-Fi
+// the best transfer settings differ several times over, so a site can name
+// a profile per interface (profile_ethernet, profile_wifi) that
+// CONFIG::ApplySiteProfile() takes instead of `profile`, and the transfer
+// summaries and benchmark results say which link they were measured on.
+namespace NetIface
+{
+    enum Type
+    {
+        TYPE_NONE,
+        TYPE_WIFI,
+        TYPE_ETHERNET
+    };
+
+    // Needs nifm (Init); TYPE_NONE without a connection or without nifm.
+    struct State
+    {
+        Type type = TYPE_NONE;
+        // Wi-Fi bars, 0 to 3; 3 on Ethernet.
+        int signal = 0;
+    };
+
+    void Init();
+    void Exit();
+
+    // Asks nifm now; an IPC round trip, so once per connect or batch.
+    State Query();
+    // What the last Query() saw.
+    State Last();
+    const char *Name(Type type);
+}
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+#include "package_info.h"
+#include "fs.h"
+#include "lang.h"
+#include "logger.h"
+
+namespace
+{
+    const uint32_t kMagicNro = 0x304f524e;  // "NRO0"
+    const uint32_t kMagicAset = 0x54455341; // "ASET"
+    const uint32_t kMagicPfs0 = 0x30534650; // "PFS0"
+    // The NRO header follows the 0x10 byte NroStart.
+    const uint64_t kNroHeadBytes = 0x20;
+    const uint64_t kAsetHeadBytes = 0x38;
+    // Header and file table of an NSP, which is usually well under this;
+    // a longer table takes a second read.
+    const uint64_t kPfs0HeadBytes = 16 * 1024;
+    const uint64_t kNacpBytes = 0x4000;
+    const size_t kNacpLanguages = 16;
+    const size_t kNacpLanguageBytes = 0x300;
+    const size_t kNacpNameBytes = 0x200;
+    const size_t kNacpVersionOffset = 0x3060;
+    // An icon is a 256x256 JPEG; anything much larger is not one.
+    const uint64_t kMaxIconBytes = 512 * 1024;
+    // Packages remembered; the oldest go when the file is loaded.
+    const size_t kMaxKept = 4096;
+
+    std::mutex mutex;
+    std::map<std::string, PackageInfo::Info> known;
+    bool loaded = false;
+
+    uint32_t Get32(const unsigned char *p)
+    {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    uint64_t Get64(const unsigned char *p)
+    {
+        return (uint64_t)Get32(p) | (uint64_t)Get32(p + 4) << 32;
+    }
+
+    bool HasSuffix(const std::string &name, const char *suffix)
+    {
+        size_t len = strlen(suffix);
+        return name.size() >= len && strcasecmp(name.c_str() + name.size() - len, suffix) == 0;
+    }
+
+    // Reads every range of `entry` from `client`, or from the card.
+    bool ReadRanges(const DirEntry &entry, RemoteClient *client, std::vector<RemoteRange> &ranges)
+    {
+        if (client != nullptr)
+            return client->GetRanges(entry.path, ranges) > 0;
+
+        FILE *in = FS::OpenRead(entry.path);
+        if (in == nullptr)
+            return false;
+        bool ok = true;
+        for (RemoteRange &range : ranges)
+        {
+            range.ok = FS::Seek(in, range.offset) == 0 &&
+                       fread(range.buffer, 1, range.size, in) == range.size;
+            ok = ok && range.ok;
+        }
+        FS::Close(in);
+        return ok;
+    }
+
+    bool ReadOne(const DirEntry &entry, RemoteClient *client, uint64_t offset, void *buffer, uint64_t size)
+    {
+        std::vector<RemoteRange> ranges(1);
+        ranges[0].offset = offset;
+        ranges[0].size = size;
+        ranges[0].buffer = buffer;
+        return ReadRanges(entry, client, ranges);
+    }
+
+    std::string Field(const char *text, size_t max)
+    {
+        std::string out(text, strnlen(text, max));
+        // Tabs and line breaks would split a line of the kept file.
+        for (char &c : out)
+        {
+            if (c == '\t' || c == '\n' || c == '\r')
+                c = ' ';
+        }
+        return out;
+    }
+
+    // Title, publisher and display version of a NACP: the first language
+    // with a name, American English before the others.
+    void ParseNacp(const unsigned char *nacp, PackageInfo::Info &info)
+    {
+        for (size_t i = 0; i < kNacpLanguages; i++)
+        {
+            const char *name = (const char *)nacp + i * kNacpLanguageBytes;
+            if (name[0] == '\0')
+                continue;
+            info.title = Field(name, kNacpNameBytes);
+            info.publisher = Field(name + kNacpNameBytes, kNacpLanguageBytes - kNacpNameBytes);
+            break;
+        }
+        info.version = Field((const char *)nacp + kNacpVersionOffset, 0x10);
+    }
+
+    // "[0100ABCD12340000]" and "[v65536]" in the name, as NSP and XCI
+    // dumps are usually called.
+    void ParseName(const char *name, PackageInfo::Info &info)
+    {
+        for (const char *p = strchr(name, '['); p != nullptr; p = strchr(p + 1, '['))
+        {
+            const char *end = strchr(p, ']');
+            if (end == nullptr)
+                break;
+            size_t len = end - p - 1;
+            char *stop = nullptr;
+            if (len == 16 && info.title_id == 0)
+            {
+                uint64_t id = strtoull(p + 1, &stop, 16);
+                if (stop == end)
+                    info.title_id = id;
+            }
+            else if (len > 1 && (p[1] == 'v' || p[1] == 'V') && info.version.empty())
+            {
+                strtoull(p + 2, &stop, 10);
+                if (stop == end)
+                    info.version = std::string(p + 1, len);
+            }
+        }
+        if (info.title_id == 0)
+            return;
+        // Updates are the base id with 0x800, DLC ids follow at 0x1000 up.
+        if ((info.title_id & 0xfff) == 0)
+            info.kind = PackageInfo::KIND_BASE;
+        else if ((info.title_id & 0xfff) == 0x800)
+            info.kind = PackageInfo::KIND_UPDATE;
+        else
+            info.kind = PackageInfo::KIND_DLC;
+    }
+
+    bool ReadNro(const DirEntry &entry, RemoteClient *client, PackageInfo::Info &info, std::vector<char> &icon)
+    {
+        unsigned char head[kNroHeadBytes];
+        if (!ReadOne(entry, client, 0, head, sizeof(head)))
+            return false;
+        info.kind = PackageInfo::KIND_HOMEBREW;
+        uint32_t nro_size = Get32(head + 0x18);
+        if (Get32(head + 0x10) != kMagicNro || nro_size + kAsetHeadBytes > entry.file_size)
+            return true;
+
+        unsigned char aset[kAsetHeadBytes];
+        if (!ReadOne(entry, client, nro_size, aset, sizeof(aset)))
+            return false;
+        if (Get32(aset) != kMagicAset)
+            return true;
+        uint64_t icon_offset = nro_size + Get64(aset + 0x08), icon_size = Get64(aset + 0x10);
+        uint64_t nacp_offset = nro_size + Get64(aset + 0x18), nacp_size = Get64(aset + 0x20);
+
+        std::vector<unsigned char> nacp;
+        std::vector<RemoteRange> ranges;
+        if (nacp_size >= kNacpBytes && nacp_offset + kNacpBytes <= entry.file_size)
+        {
+            nacp.resize(kNacpBytes);
+            RemoteRange range;
+            range.offset = nacp_offset;
+            range.size = kNacpBytes;
+            range.buffer = nacp.data();
+            ranges.push_back(range);
+        }
+        if (icon_size > 0 && icon_size <= kMaxIconBytes && icon_offset + icon_size <= entry.file_size)
+        {
+            icon.resize(icon_size);
+            RemoteRange range;
+            range.offset = icon_offset;
+            range.size = icon_size;
+            range.buffer = icon.data();
+            ranges.push_back(range);
+        }
+        if (ranges.empty())
+            return true;
+        if (!ReadRanges(entry, client, ranges))
+        {
+            icon.clear();
+            return false;
+        }
+        if (!nacp.empty())
+            ParseNacp(nacp.data(), info);
+        info.icon = !icon.empty();
+        return true;
+    }
+
+    // The PFS0 table of an NSP or NSZ; a loose NACP and icon are read
+    // where the package has them next to its NCAs.
+    bool ReadNsp(const DirEntry &entry, RemoteClient *client, PackageInfo::Info &info, std::vector<char> &icon)
+    {
+        std::vector<unsigned char> head(std::min<uint64_t>(kPfs0HeadBytes, entry.file_size));
+        if (head.size() < 0x10)
+            return true;
+        if (!ReadOne(entry, client, 0, head.data(), head.size()))
+            return false;
+        if (Get32(head.data()) != kMagicPfs0)
+            return true;
+        uint32_t count = Get32(head.data() + 4), strings_size = Get32(head.data() + 8);
+        if (count == 0 || count > 4096 || strings_size > 0x100000)
+            return true;
+        uint64_t table_size = 0x10 + (uint64_t)count * 0x18 + strings_size;
+        if (table_size > entry.file_size)
+            return true;
+        if (table_size > head.size())
+        {
+            head.resize(table_size);
+            if (!ReadOne(entry, client, 0, head.data(), table_size))
+                return false;
+        }
+
+        const unsigned char *strings = head.data() + 0x10 + (uint64_t)count * 0x18;
+        uint64_t nacp_offset = 0, icon_offset = 0, icon_size = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const unsigned char *raw = head.data() + 0x10 + (uint64_t)i * 0x18;
+            uint64_t offset = table_size + Get64(raw), size = Get64(raw + 8);
+            uint32_t name_offset = Get32(raw + 16);
+            if (name_offset >= strings_size || offset + size > entry.file_size)
+                return true;
+            std::string name((const char *)strings + name_offset, strnlen((const char *)strings + name_offset, strings_size - name_offset));
+            if (HasSuffix(name, ".nacp") && size >= kNacpBytes)
+                nacp_offset = offset;
+            // icon_AmericanEnglish.dat first, as the NACP's first language.
+            else if ((HasSuffix(name, ".dat") || HasSuffix(name, ".jpg")) && strncasecmp(name.c_str(), "icon_", 5) == 0 &&
+                     size > 0 && size <= kMaxIconBytes && (icon_size == 0 || strcasecmp(name.c_str(), "icon_AmericanEnglish.dat") == 0))
+            {
+                icon_offset = offset;
+                icon_size = size;
+            }
+        }
+
+        std::vector<unsigned char> nacp;
+        std::vector<RemoteRange> ranges;
+        if (nacp_offset > 0)
+        {
+            nacp.resize(kNacpBytes);
+            RemoteRange range;
+            range.offset = nacp_offset;
+            range.size = kNacpBytes;
+            range.buffer = nacp.data();
+            ranges.push_back(range);
+        }
+        if (icon_size > 0)
+        {
+            icon.resize(icon_size);
+            RemoteRange range;
+            range.offset = icon_offset;
+            range.size = icon_size;
+            range.buffer = icon.data();
+            ranges.push_back(range);
+        }
+        if (ranges.empty())
+            return true;
+        if (!ReadRanges(entry, client, ranges))
+        {
+            icon.clear();
+            return false;
+        }
+        if (!nacp.empty())
+        {
+            // The name's version number stays; the NACP's is the one shown.
+            std::string number = info.version;
+            ParseNacp(nacp.data(), info);
+            if (info.version.empty())
+                info.version = number;
+        }
+        info.icon = !icon.empty();
+        return true;
+    }
+
+    void Load()
+    {
+        loaded = true;
+        std::vector<std::string> lines;
+        if (!FS::LoadText(&lines, PACKAGE_INFO_PATH))
+            return;
+        for (const std::string &line : lines)
+        {
+            // Util::Split() drops empty fields, and a title may be empty.
+            std::vector<std::string> fields;
+            for (size_t start = 0;;)
+            {
+                size_t tab = line.find('\t', start);
+                fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+                if (tab == std::string::npos)
+                    break;
+                start = tab + 1;
+            }
+            if (fields.size() < 7)
+                continue;
+            PackageInfo::Info info;
+            info.title = fields[1];
+            info.publisher = fields[2];
+            info.version = fields[3];
+            info.title_id = strtoull(fields[4].c_str(), nullptr, 16);
+            int kind = atoi(fields[5].c_str());
+            info.kind = kind >= PackageInfo::KIND_UNKNOWN && kind <= PackageInfo::KIND_DLC ? (PackageInfo::Kind)kind
+                                                                                          : PackageInfo::KIND_UNKNOWN;
+            info.icon = fields[6] == "1";
+            known[fields[0]] = info;
+        }
+        // The newest lines are last; only those are written back.
+        if (lines.size() > kMaxKept)
+        {
+            lines.erase(lines.begin(), lines.end() - kMaxKept);
+            FS::SaveText(&lines, PACKAGE_INFO_PATH);
+            Logger::Logf("PACKAGE INFO pruned kept=%d", (int)lines.size());
+        }
+    }
+}
+
+namespace PackageInfo
+{
+    bool IsPackage(const DirEntry &entry)
+    {
+        if (entry.isDir)
+            return false;
+        std::string name = entry.name;
+        return HasSuffix(name, ".nro") || HasSuffix(name, ".nsp") || HasSuffix(name, ".nsz") ||
+               HasSuffix(name, ".xci") || HasSuffix(name, ".xcz");
+    }
+
+    bool Read(const DirEntry &entry, RemoteClient *client, Info &info, std::vector<char> &icon)
+    {
+        info = Info();
+        icon.clear();
+        std::string name = entry.name;
+        if (HasSuffix(name, ".nro"))
+            return ReadNro(entry, client, info, icon);
+
+        ParseName(entry.name, info);
+        if (HasSuffix(name, ".nsp") || HasSuffix(name, ".nsz"))
+            return ReadNsp(entry, client, info, icon);
+        // An XCI holds nothing but NCAs below its HFS0 partitions.
+        return true;
+    }
+
+    bool Find(const std::string &key, Info &info)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded)
+            Load();
+        auto it = known.find(key);
+        if (it == known.end())
+            return false;
+        info = it->second;
+        return true;
+    }
+
+    void Store(const std::string &key, const Info &info)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded)
+            Load();
+        known[key] = info;
+
+        char number[48];
+        snprintf(number, sizeof(number), "%016llx\t%d\t%d\n", (unsigned long long)info.title_id, (int)info.kind,
+                 info.icon ? 1 : 0);
+        std::string line = Field(key.c_str(), key.size()) + "\t" + info.title + "\t" + info.publisher + "\t" +
+                           info.version + "\t" + number;
+        FS::MkDirs(CATALOGUE_PATH);
+        FILE *out = FS::Append(PACKAGE_INFO_PATH);
+        if (out == nullptr)
+            return;
+        FS::Write(out, line.data(), line.size());
+        FS::Close(out);
+    }
+
+    const char *KindLabel(Kind kind)
+    {
+        switch (kind)
+        {
+        case KIND_HOMEBREW:
+            return lang_strings[STR_PACKAGE_HOMEBREW];
+        case KIND_BASE:
+            return lang_strings[STR_PACKAGE_BASE];
+        case KIND_UPDATE:
+            return lang_strings[STR_PACKAGE_UPDATE];
+        case KIND_DLC:
+            return lang_strings[STR_PACKAGE_DLC];
+        default:
+            return "";
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef NEO_PACKAGE_INFO_H
+#define NEO_PACKAGE_INFO_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "catalogue.h"
+#include "clients/remote_client.h"
+
+#define PACKAGE_INFO_PATH CATALOGUE_PATH "/packages.txt"
+
+// What an NRO, NSP, NSZ, XCI or XCZ says about itself, read with a few
+// ranged requests instead of the whole file: the NRO header, its ASET
+// header, then its icon and NACP in one GetRanges() batch; the PFS0 table
+// of an NSP, then its loose NACP and icon where the package carries them.
+// The contents of an NSP or XCI are NCAs, encrypted with the console's
+// keys, which this app has no part in; their title id, version and kind
+// come from the "[0100...][v...]" name the usual tools give them. The
+// thumbnail workers read packages in the grid view (the icon is the
+// thumbnail); what they found is kept beside the catalogues, keyed like
+// the thumbnails, so the list and a later session show it without a read.
+namespace PackageInfo
+{
+    enum Kind
+    {
+        KIND_UNKNOWN,
+        KIND_HOMEBREW,
+        KIND_BASE,
+        KIND_UPDATE,
+        KIND_DLC
+    };
+
+    struct Info
+    {
+        std::string title;
+        std::string publisher;
+        std::string version;
+        uint64_t title_id = 0;
+        Kind kind = KIND_UNKNOWN;
+        // Whether the package has an icon; it is kept as the thumbnail.
+        bool icon = false;
+    };
+
+    // Whether `entry` is named like a package this can read.
+    bool IsPackage(const DirEntry &entry);
+    // Reads `entry` from `client`, or from the card with nullptr, and the
+    // icon JPEG into `icon` when there is one. False when the file could
+    // not be read; a file that turns out not to be a package still gives
+    // what its name says.
+    bool Read(const DirEntry &entry, RemoteClient *client, Info &info, std::vector<char> &icon);
+
+    // What was read of the file thumbnails know as `key` (Thumbnails::Key()),
+    // read from the card on first use. False when it was never read.
+    bool Find(const std::string &key, Info &info);
+    void Store(const std::string &key, const Info &info);
+
+    // Short label of `kind` for the UI, "" for KIND_UNKNOWN.
+    const char *KindLabel(Kind kind);
+}
+
+#endif
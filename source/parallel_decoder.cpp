@@ -0,0 +1,437 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <lzma.h>
+#include <zstd.h>
+
+#include "parallel_decoder.h"
+#include "config.h"
+#include "windows.h"
+#include "logger.h"
+#include "memory_governor.h"
+#include "threads.h"
+#include "cancel.h"
+
+namespace
+{
+    const uint8_t kXzMagic[6] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+    const uint32_t kZstdMagic = 0xFD2FB528;
+    // 0x184D2A50 to 0x184D2A5F; pzstd marks its frame sizes with one.
+    const uint32_t kZstdSkippableMagic = 0x184D2A50;
+
+    bool ReadAt(int fd, uint64_t offset, void *data, size_t size)
+    {
+        uint8_t *out = static_cast<uint8_t *>(data);
+        while (size > 0)
+        {
+            ssize_t n = pread(fd, out, size, (off_t)offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            out += n;
+            offset += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    uint32_t Le32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    // Blocks of the xz stream ending the file, from the record count of
+    // the index its footer points at; 0 when that cannot be told, e.g.
+    // behind stream padding.
+    uint64_t XzBlocks(int fd, uint64_t file_size)
+    {
+        uint8_t footer[12];
+        if (file_size < 32 || !ReadAt(fd, file_size - sizeof(footer), footer, sizeof(footer)) ||
+            footer[10] != 'Y' || footer[11] != 'Z')
+            return 0;
+        uint64_t index_size = ((uint64_t)Le32(footer + 4) + 1) * 4;
+        if (index_size + 24 > file_size)
+            return 0;
+
+        uint8_t index[10];
+        size_t n = (size_t)std::min<uint64_t>(sizeof(index), index_size);
+        if (!ReadAt(fd, file_size - sizeof(footer) - index_size, index, n) || index[0] != 0x00)
+            return 0;
+        uint64_t records = 0;
+        for (size_t i = 1, shift = 0; i < n; i++, shift += 7)
+        {
+            records |= (uint64_t)(index[i] & 0x7F) << shift;
+            if ((index[i] & 0x80) == 0)
+                return records;
+        }
+        return 0;
+    }
+}
+
+ParallelDecoder::ParallelDecoder(const std::string &path, int workers, size_t limit)
+    : path(path), workers(workers), limit(limit)
+{
+    if (this->limit == 0)
+        this->limit = (size_t)archive_cache_mb * 1024 * 1024;
+}
+
+ParallelDecoder::~ParallelDecoder()
+{
+    if (threads.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    cv.notify_all();
+    for (Thread &thread : threads)
+        Threads::Join(&thread);
+
+    Logger::Logf("ARCHIVE DECODE path=%s format=%s parts=%d threads=%d decoded=%llu reader_waits=%llu worker_waits=%llu failed=%d",
+                 path.c_str(), format == FORMAT_XZ ? "xz" : "zstd", (int)partCount, format == FORMAT_XZ ? workers : (int)threads.size(),
+                 (unsigned long long)decoded, (unsigned long long)readerWaits, (unsigned long long)workerWaits, failed ? 1 : 0);
+}
+
+bool ParallelDecoder::Open()
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st = {0};
+    uint8_t magic[6] = {0};
+    if (fstat(fd, &st) != 0 || !ReadAt(fd, 0, magic, sizeof(magic)))
+    {
+        close(fd);
+        return false;
+    }
+    fileSize = (uint64_t)st.st_size;
+
+    if (memcmp(magic, kXzMagic, sizeof(kXzMagic)) == 0 && XzBlocks(fd, fileSize) > 1)
+    {
+        format = FORMAT_XZ;
+        partCount = 1;
+    }
+    else if (Le32(magic) == kZstdMagic && indexZstd(fd) && frames.size() > 1)
+    {
+        format = FORMAT_ZSTD;
+        partCount = frames.size();
+    }
+    close(fd);
+    return format != FORMAT_NONE && workers > 1;
+}
+
+// Walks the frames through their block headers (RFC 8878) without
+// decoding anything: a handful of bytes read per 128 KiB block.
+bool ParallelDecoder::indexZstd(int fd)
+{
+    static const int kDictIdSize[4] = {0, 1, 2, 4};
+    static const int kContentSize[4] = {0, 2, 4, 8};
+
+    uint64_t pos = 0;
+    while (pos < fileSize)
+    {
+        uint8_t head[8];
+        if (fileSize - pos < sizeof(head) || !ReadAt(fd, pos, head, sizeof(head)))
+            return false;
+        uint32_t magic = Le32(head);
+        if ((magic & 0xFFFFFFF0) == kZstdSkippableMagic)
+        {
+            pos += 8 + (uint64_t)Le32(head + 4);
+            continue;
+        }
+        if (magic != kZstdMagic)
+            return false;
+
+        uint8_t descriptor = head[4];
+        bool single_segment = (descriptor & 0x20) != 0;
+        int content_size = kContentSize[descriptor >> 6];
+        if (content_size == 0 && single_segment)
+            content_size = 1;
+        uint64_t block = pos + 5 + (single_segment ? 0 : 1) + kDictIdSize[descriptor & 3] + content_size;
+        for (;;)
+        {
+            uint8_t header[3];
+            if (block + sizeof(header) > fileSize || !ReadAt(fd, block, header, sizeof(header)))
+                return false;
+            uint32_t value = header[0] | header[1] << 8 | header[2] << 16;
+            uint32_t type = (value >> 1) & 3;
+            if (type == 3)
+                return false;
+            // An RLE block holds one byte, repeated.
+            block += sizeof(header) + (type == 1 ? 1 : value >> 3);
+            if (value & 1)
+                break;
+        }
+        if (descriptor & 0x04)
+            block += 4;
+        if (block > fileSize)
+            return false;
+        frames.push_back({pos, block - pos});
+        pos = block;
+    }
+    return true;
+}
+
+bool ParallelDecoder::Start()
+{
+    // liblzma runs its own threads; zstd frames get one each.
+    int count = format == FORMAT_XZ ? 1 : std::min<int>(workers, (int)frames.size());
+    threads.resize(count);
+    int started = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Result rc = Threads::Create(&threads[started], workerThread, this, 0x10000, Threads::ROLE_COMPUTE, "archive decode");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "ARCHIVE DECODE threadCreate failed index=%d rc=0x%x", i, rc);
+            continue;
+        }
+        threadStart(&threads[started]);
+        started++;
+    }
+    threads.resize(started);
+    if (started == 0)
+        error = "threadCreate failed";
+    return started > 0;
+}
+
+ssize_t ParallelDecoder::Read(const void **data)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // Back to the pool, making room for the workers.
+    current = Filled();
+
+    for (;;)
+    {
+        if (failed || Cancel::Stopped())
+            return -1;
+        if (reading >= partCount)
+            return 0;
+        Part &part = parts[reading];
+        if (!part.chunks.empty())
+        {
+            current = std::move(part.chunks.front());
+            part.chunks.pop_front();
+            queued -= current.size;
+            cv.notify_all();
+            *data = current.buffer.data();
+            return (ssize_t)current.size;
+        }
+        if (part.done)
+        {
+            parts.erase(reading);
+            reading++;
+            // A worker may be holding the next part back.
+            cv.notify_all();
+            continue;
+        }
+        readerWaits++;
+        // stop_activity is set from the UI without a notify, so poll it.
+        cv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
+
+void ParallelDecoder::workerThread(void *arg)
+{
+    ParallelDecoder *decoder = static_cast<ParallelDecoder *>(arg);
+    if (decoder->format == FORMAT_XZ)
+        decoder->xzLoop();
+    else
+        decoder->zstdLoop();
+}
+
+bool ParallelDecoder::push(size_t part, Filled &filled)
+{
+    if (filled.size == 0)
+        return true;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queued + filled.size > limit && part != reading && !closing && !failed && !Cancel::Stopped())
+    {
+        workerWaits++;
+        while (!cv.wait_for(lock, std::chrono::milliseconds(100), [&]
+                            { return queued + filled.size <= limit || part == reading || closing || failed || Cancel::Stopped(); }))
+            ;
+    }
+    if (closing || failed || Cancel::Stopped())
+        return false;
+
+    queued += filled.size;
+    decoded += filled.size;
+    parts[part].chunks.push_back(std::move(filled));
+    filled = Filled();
+    cv.notify_all();
+    return true;
+}
+
+void ParallelDecoder::finish(size_t part)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    parts[part].done = true;
+    cv.notify_all();
+}
+
+void ParallelDecoder::fail(const std::string &why)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!failed && !closing)
+    {
+        error = why;
+        Logger::Logf(Logger::LOG_ERROR, "ARCHIVE DECODE failed path=%s err=%s", path.c_str(), why.c_str());
+    }
+    failed = true;
+    cv.notify_all();
+}
+
+void ParallelDecoder::xzLoop()
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        fail("open failed");
+        return;
+    }
+
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = (uint32_t)workers;
+    // Past this liblzma decodes on one thread rather than failing.
+    mt.memlimit_threading = (uint64_t)MemoryGovernor::TransferBudget();
+    mt.memlimit_stop = UINT64_MAX;
+    lzma_ret ret = lzma_stream_decoder_mt(&strm, &mt);
+    if (ret != LZMA_OK)
+    {
+        close(fd);
+        fail("lzma_stream_decoder_mt failed");
+        return;
+    }
+
+    TransferBuffer in(kBufferSize);
+    Filled out;
+    lzma_action action = LZMA_RUN;
+    bool ok = (bool)in;
+    while (ok)
+    {
+        if (strm.avail_in == 0 && action == LZMA_RUN)
+        {
+            ssize_t n = read(fd, in.data(), kBufferSize);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                fail("read failed");
+                ok = false;
+                break;
+            }
+            strm.next_in = (const uint8_t *)in.data();
+            strm.avail_in = (size_t)n;
+            if (n == 0)
+                action = LZMA_FINISH;
+        }
+        if (!out.buffer && !out.buffer.Acquire(kBufferSize))
+        {
+            fail("out of memory");
+            ok = false;
+            break;
+        }
+        strm.next_out = (uint8_t *)out.buffer.data() + out.size;
+        strm.avail_out = kBufferSize - out.size;
+        ret = lzma_code(&strm, action);
+        out.size = kBufferSize - strm.avail_out;
+        if (out.size == kBufferSize && !push(0, out))
+            ok = false;
+        if (ret == LZMA_STREAM_END)
+            break;
+        if (ret != LZMA_OK)
+        {
+            fail("xz data is corrupt");
+            ok = false;
+        }
+    }
+    if (ok && push(0, out))
+        finish(0);
+    lzma_end(&strm);
+    close(fd);
+}
+
+void ParallelDecoder::zstdLoop()
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    TransferBuffer in(kBufferSize);
+    if (fd < 0 || dctx == nullptr || !in)
+    {
+        fail("zstd decoder setup failed");
+        if (dctx != nullptr)
+            ZSTD_freeDCtx(dctx);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    for (;;)
+    {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closing || failed || nextPart >= frames.size())
+                break;
+            index = nextPart++;
+        }
+
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        uint64_t offset = frames[index].offset;
+        uint64_t left = frames[index].size;
+        Filled out;
+        bool ok = true;
+        while (ok && left > 0)
+        {
+            size_t n = (size_t)std::min<uint64_t>(kBufferSize, left);
+            if (!ReadAt(fd, offset, in.data(), n))
+            {
+                fail("read failed");
+                ok = false;
+                break;
+            }
+            offset += n;
+            left -= n;
+
+            ZSTD_inBuffer input = {in.data(), n, 0};
+            // A full output buffer may leave more in the decoder.
+            bool more = true;
+            while (ok && (input.pos < input.size || more))
+            {
+                if (!out.buffer && !out.buffer.Acquire(kBufferSize))
+                {
+                    fail("out of memory");
+                    ok = false;
+                    break;
+                }
+                ZSTD_outBuffer output = {out.buffer.data(), kBufferSize, out.size};
+                size_t rc = ZSTD_decompressStream(dctx, &output, &input);
+                if (ZSTD_isError(rc))
+                {
+                    fail(ZSTD_getErrorName(rc));
+                    ok = false;
+                    break;
+                }
+                out.size = output.pos;
+                more = output.pos == output.size;
+                if (more && !push(index, out))
+                    ok = false;
+            }
+        }
+        if (!ok || !push(index, out))
+            break;
+        finish(index);
+    }
+    ZSTD_freeDCtx(dctx);
+    close(fd);
+}
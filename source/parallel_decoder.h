@@ -0,0 +1,109 @@
+#ifndef NEO_PARALLEL_DECODER_H
+#define NEO_PARALLEL_DECODER_H
+
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <condition_variable>
+#include <sys/types.h>
+#include <switch.h>
+
+#include "buffer_pool.h"
+
+// Decompresses a local .xz or .zst file on several threads for libarchive
+// to read as a plain tar, where the file allows it. xz needs more than one
+// block (xz -T, pixz), decoded by liblzma's threaded decoder on `workers`
+// threads; zstd needs more than one frame (pzstd, zstd --block-size...),
+// the frames being found from their block headers and decoded one per
+// worker. Decoded bytes come out in order, in 1 MiB buffers queued up to
+// archive_cache_mb MiB; the frame the reader is in is never held back.
+class ParallelDecoder
+{
+public:
+    static const size_t kBufferSize = 1024 * 1024;
+
+    enum Format
+    {
+        FORMAT_NONE,
+        FORMAT_XZ,
+        FORMAT_ZSTD
+    };
+
+    // `limit` caps the queued bytes; 0 means archive_cache_mb.
+    ParallelDecoder(const std::string &path, int workers, size_t limit = 0);
+    ~ParallelDecoder();
+
+    // Recognises and indexes the file. False when it is neither, or would
+    // decode on one thread only, and single-threaded libarchive filters do
+    // as well.
+    bool Open();
+    // Starts the decoding threads.
+    bool Start();
+    // As RemoteStreamReader::Read(): the next decoded bytes, valid until
+    // the next call; 0 at the end and -1 on corrupt data or cancel.
+    ssize_t Read(const void **data);
+
+    Format GetFormat() const { return format; }
+    const std::string &Error() const { return error; }
+
+private:
+    struct Frame
+    {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    struct Filled
+    {
+        TransferBuffer buffer;
+        size_t size = 0;
+    };
+
+    // Decoded output of one zstd frame, or of the whole xz file as part 0.
+    struct Part
+    {
+        std::deque<Filled> chunks;
+        bool done = false;
+    };
+
+    std::string path;
+    int workers;
+    size_t limit;
+    Format format = FORMAT_NONE;
+    uint64_t fileSize = 0;
+    std::vector<Frame> frames;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<size_t, Part> parts;
+    size_t partCount = 0;
+    // Next zstd frame a worker takes, and the part the reader is in.
+    size_t nextPart = 0;
+    size_t reading = 0;
+    size_t queued = 0;
+    bool failed = false;
+    bool closing = false;
+    std::string error;
+
+    // The buffer the reader holds.
+    Filled current;
+
+    std::vector<Thread> threads;
+    uint64_t decoded = 0;
+    uint64_t readerWaits = 0;
+    uint64_t workerWaits = 0;
+
+    static void workerThread(void *arg);
+    void xzLoop();
+    void zstdLoop();
+    bool indexZstd(int fd);
+    // Queues `filled` as the next output of `part`. Waits while the queue
+    // is full, unless the reader is waiting for that very part.
+    bool push(size_t part, Filled &filled);
+    void finish(size_t part);
+    void fail(const std::string &why);
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include <malloc.h>
+
+#include "parse_profile.h"
+#include "logger.h"
+#include "timeline.h"
+#include "util.h"
+
+namespace
+{
+    int64_t HeapInUse()
+    {
+        struct mallinfo info = mallinfo();
+        return (int64_t)info.uordblks;
+    }
+}
+
+ParseProfile::ParseProfile(const char *parser, size_t input_bytes, const std::vector<DirEntry> &out)
+    : parser(parser), enabled(Logger::Enabled(Logger::LOG_DEBUG)), timeline(Timeline::Enabled()), out(&out),
+      bytes(input_bytes)
+{
+    if (enabled)
+    {
+        out_start = out.size();
+        heap_start = HeapInUse();
+    }
+    Resume();
+}
+
+ParseProfile::ParseProfile(const char *parser)
+    : parser(parser), enabled(Logger::Enabled(Logger::LOG_DEBUG)), timeline(Timeline::Enabled())
+{
+    if (enabled)
+        heap_start = HeapInUse();
+}
+
+ParseProfile::~ParseProfile()
+{
+    Pause();
+    if (!enabled)
+        return;
+    if (out)
+        entries = out->size() - out_start;
+    double ms = elapsed / 1000.0;
+    Logger::Logf(Logger::LOG_DEBUG, "LISTING PARSE parser=%s bytes=%zu entries=%zu ms=%.2f entries_s=%.0f heap_kb=%lld",
+                 parser, bytes, entries, ms, elapsed > 0 ? entries * 1000000.0 / elapsed : 0.0,
+                 (long long)((HeapInUse() - heap_start) / 1024));
+}
+
+void ParseProfile::Resume()
+{
+    if ((enabled || timeline) && started == 0)
+        started = Util::GetTick();
+}
+
+void ParseProfile::Pause()
+{
+    if (started == 0)
+        return;
+    uint64_t now = Util::GetTick();
+    elapsed += now - started;
+    if (timeline)
+        Timeline::Record(parser, started, now);
+    started = 0;
+}
+
+void ParseProfile::Add(size_t input_bytes, size_t count)
+{
+    bytes += input_bytes;
+    entries += count;
+}
@@ -0,0 +1,47 @@
+#ifndef NEO_PARSE_PROFILE_H
+#define NEO_PARSE_PROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+// Measures one listing parse and logs it at LOG_DEBUG when it goes out of
+// scope:
+//
+//   LISTING PARSE parser=<name> bytes=... entries=... ms=... entries_s=... heap_kb=...
+//
+// `ms` is parser time only, without the network; `heap_kb` is how much more
+// heap is in use afterwards (mostly the entries themselves). Does nothing
+// unless debug logging is on. With timeline_trace each stretch of parsing
+// is also a Timeline span named after the parser.
+class ParseProfile
+{
+public:
+    // Times from here to the destructor, for a parser given the whole
+    // response; entries are the ones appended to `out` meanwhile.
+    ParseProfile(const char *parser, size_t input_bytes, const std::vector<DirEntry> &out);
+    // For a parser fed piece by piece: only the time between Resume() and
+    // Pause() counts, and input and entries are added with Add().
+    explicit ParseProfile(const char *parser);
+    ~ParseProfile();
+
+    void Resume();
+    void Pause();
+    void Add(size_t input_bytes, size_t entries);
+
+private:
+    const char *parser;
+    bool enabled;
+    bool timeline;
+    const std::vector<DirEntry> *out = nullptr;
+    size_t out_start = 0;
+    size_t bytes = 0;
+    size_t entries = 0;
+    uint64_t started = 0;
+    uint64_t elapsed = 0;
+    int64_t heap_start = 0;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include <switch.h>
+
+#include "power.h"
+#include "config.h"
+#include "logger.h"
+#include "util.h"
+
+namespace Power
+{
+    namespace
+    {
+        // The battery is read at most this often.
+        const uint64_t kBatteryPollUs = 10ULL * 1000000;
+
+        bool psm_ready = false;
+        bool lbl_ready = false;
+        bool boosted = false;
+        bool awake = false;
+        bool screen_off = false;
+        uint64_t busy_at = 0;
+        uint64_t input_at = 0;
+        uint64_t battery_at = 0;
+        int battery = -1;
+        bool charging = false;
+
+        void PollBattery(uint64_t now)
+        {
+            if (!psm_ready || (battery_at != 0 && now - battery_at < kBatteryPollUs))
+                return;
+            battery_at = now;
+            u32 percent = 0;
+            PsmChargerType charger = PsmChargerType_Unconnected;
+            if (R_SUCCEEDED(psmGetBatteryChargePercentage(&percent)))
+                battery = (int)percent;
+            if (R_SUCCEEDED(psmGetChargerType(&charger)))
+                charging = charger != PsmChargerType_Unconnected;
+        }
+
+        void SetBoost(bool on, const char *reason)
+        {
+            if (on == boosted)
+                return;
+            ::Result rc = appletSetCpuBoostMode(on ? ApmCpuBoostMode_FastLoad : ApmCpuBoostMode_Normal);
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_WARN, "POWER boost=%d failed rc=0x%x", on ? 1 : 0, rc);
+                return;
+            }
+            boosted = on;
+            Logger::Logf("POWER boost=%d reason=%s battery=%d charging=%d", on ? 1 : 0, reason, battery,
+                         charging ? 1 : 0);
+        }
+
+        // Media playback also holds off the system's dimming.
+        void SetAwake(bool on)
+        {
+            if (on == awake)
+                return;
+            appletSetAutoSleepDisabled(on);
+            appletSetMediaPlaybackState(on);
+            awake = on;
+            Logger::Logf("POWER keep_awake=%d", on ? 1 : 0);
+        }
+
+        void SetScreen(bool off)
+        {
+            if (off == screen_off || !lbl_ready)
+                return;
+            // Fade times are in nanoseconds.
+            ::Result rc = off ? lblSwitchBacklightOff(500000000ULL) : lblSwitchBacklightOn(100000000ULL);
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_WARN, "POWER screen_off=%d failed rc=0x%x", off ? 1 : 0, rc);
+                return;
+            }
+            screen_off = off;
+            Logger::Logf("POWER screen_off=%d", off ? 1 : 0);
+        }
+    }
+
+    void Init()
+    {
+        psm_ready = R_SUCCEEDED(psmInitialize());
+        lbl_ready = R_SUCCEEDED(lblInitialize());
+        input_at = Util::GetTick();
+        PollBattery(input_at);
+        if (cpu_boost == 2)
+            SetBoost(true, "always");
+    }
+
+    void Exit()
+    {
+        SetBoost(false, "exit");
+        SetScreen(false);
+        SetAwake(false);
+        if (lbl_ready)
+            lblExit();
+        if (psm_ready)
+            psmExit();
+        psm_ready = false;
+        lbl_ready = false;
+    }
+
+    void Update(bool busy, bool keep_awake)
+    {
+        uint64_t now = Util::GetTick();
+        if (busy)
+            busy_at = now;
+        PollBattery(now);
+
+        // Once the job ends the screen comes back and the console may go to
+        // sleep on the system's own timer again.
+        bool hold = keep_awake && keep_awake_enabled;
+        SetAwake(hold);
+        uint64_t screen_after = (uint64_t)screen_off_minutes * 60 * 1000000;
+        SetScreen(hold && screen_after > 0 && now - input_at > screen_after);
+
+        if (cpu_boost == 0)
+        {
+            SetBoost(false, "disabled");
+            return;
+        }
+        if (!charging && battery >= 0 && battery < cpu_boost_min_battery)
+        {
+            SetBoost(false, "battery");
+            return;
+        }
+        if (cpu_boost == 2)
+            SetBoost(true, "always");
+        else if (busy)
+            SetBoost(true, "busy");
+        else if (busy_at == 0 || now - busy_at > kBoostLingerUs)
+            SetBoost(false, "idle");
+    }
+
+    void NoteInput()
+    {
+        input_at = Util::GetTick();
+        SetScreen(false);
+    }
+
+    bool Boosted()
+    {
+        return boosted;
+    }
+
+    bool ScreenOff()
+    {
+        return screen_off;
+    }
+
+    int Battery(bool *plugged)
+    {
+        if (plugged != nullptr)
+            *plugged = charging;
+        return battery;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef NEO_POWER_H
+#define NEO_POWER_H
+
+#include <cstdint>
+
+// Clock policy of the console while the app runs. CPU boost (FastLoad, the
+// mode installers use) trades GPU clock for CPU clock, which is what SSH
+// and TLS crypto, zip and NSZ work need on the A57; it is asked for while
+// such a job runs and given back a few seconds after, and on battery below
+// [Global] cpu_boost_min_battery.
+//
+// While a transfer or another long job runs the console is also kept from
+// auto-sleeping and dimming (keep_awake), and after screen_off_minutes
+// without input the backlight goes off until a button or touch wakes it,
+// so an overnight download runs at full speed on a dark screen.
+namespace Power
+{
+    // Idle this long before the boost is given back, so it does not flap
+    // between the files of a batch.
+    static const uint64_t kBoostLingerUs = 3ULL * 1000000;
+
+    void Init();
+    void Exit();
+    // Called every frame with whether a CPU-bound job runs and whether
+    // one that must not be put to sleep (a transfer) does.
+    void Update(bool busy, bool keep_awake);
+    // Called on every frame with input; turns the screen back on.
+    void NoteInput();
+
+    bool Boosted();
+    bool ScreenOff();
+    // Battery charge in percent, -1 when unknown; `charging` is set when a
+    // charger or the dock is connected.
+    int Battery(bool *charging = nullptr);
+}
+
+#endif
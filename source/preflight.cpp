@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+
+#include "preflight.h"
+#include "config.h"
+#include "fs.h"
+#include "local_sink.h"
+#include "local_trash.h"
+#include "logger.h"
+
+namespace Preflight
+{
+    namespace
+    {
+        const uint64_t kFlatLimit = 0xFFFFFFFFULL;
+
+        // -1 until probed; the mutex keeps two transfer threads from
+        // probing at once.
+        std::atomic<int> large_files{-1};
+        std::mutex probe_mutex;
+
+        // Bytes of `dest` on the card already, as the download would find
+        // them: the parts of a split folder, or the flat file.
+        uint64_t OnDisk(const std::string &dest, uint64_t size, bool split)
+        {
+            int64_t have = split ? LocalFileSink::SplitLocalSize(dest, LocalFileSink::kSplitPartSize) : FS::GetSize(dest);
+            if (have <= 0)
+                return 0;
+            return std::min((uint64_t)have, size);
+        }
+    }
+
+    bool LargeFilesSupported(bool probe)
+    {
+        if (force_fat32)
+            return false;
+        int known = large_files;
+        if (known >= 0 || !probe)
+            return known != 0;
+
+        std::lock_guard<std::mutex> lock(probe_mutex);
+        known = large_files;
+        if (known >= 0)
+            return known == 1;
+
+        // A 4 GiB ftruncate only reserves clusters, but that can still take
+        // a while on a slow card, and it needs the room.
+        uint64_t free_bytes = 0;
+        if (!FS::FreeSpace(DATA_PATH, &free_bytes) || free_bytes <= kFlatLimit + (64ULL << 20))
+            return true;
+
+        std::string probe_path = std::string(DATA_PATH) + "/.large_file_probe";
+        int fd = open(probe_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+        if (fd < 0)
+            return true;
+        bool ok = ftruncate(fd, (off_t)(kFlatLimit + 1)) == 0;
+        int err = errno;
+        close(fd);
+        unlink(probe_path.c_str());
+
+        large_files = ok ? 1 : 0;
+        Logger::Logf("PREFLIGHT large_files=%d errno=%d", ok ? 1 : 0, ok ? 0 : err);
+        return ok;
+    }
+
+    Plan Check(const std::string &root, const std::vector<File> &files, uint64_t extra, bool reclaim)
+    {
+        Plan plan;
+        plan.bytes = extra;
+        plan.largeFiles = LargeFilesSupported(reclaim);
+        for (const File &file : files)
+        {
+            if (LocalFileSink::NeedsSplit(file.size, reclaim))
+                plan.split++;
+            plan.bytes += file.size;
+        }
+        plan.needed = plan.bytes;
+        plan.freeKnown = FS::FreeSpace(root, &plan.free);
+        // A stat() per file only when the batch would not fit whole.
+        if (!plan.Fits())
+        {
+            plan.needed = extra;
+            for (const File &file : files)
+                plan.needed += file.size - OnDisk(file.dest, file.size, LocalFileSink::NeedsSplit(file.size, reclaim));
+        }
+        // What was just deleted is still in the trash, waiting for the
+        // transfer to end.
+        if (!plan.Fits())
+        {
+            if (!reclaim)
+                plan.trash = LocalTrash::Pending();
+            else if (LocalTrash::Empty())
+                plan.freeKnown = FS::FreeSpace(root, &plan.free);
+        }
+
+        Logger::Logf(plan.Fits() ? Logger::LOG_INFO : plan.trash ? Logger::LOG_WARN : Logger::LOG_ERROR,
+                     "PREFLIGHT root=%s files=%zu bytes=%llu needed=%llu free=%lld split=%d large_files=%d fits=%d "
+                     "trash=%d",
+                     root.c_str(), files.size(), (unsigned long long)plan.bytes, (unsigned long long)plan.needed,
+                     plan.freeKnown ? (long long)plan.free : -1LL, plan.split, plan.largeFiles ? 1 : 0,
+                     plan.Fits() ? 1 : 0, plan.trash ? 1 : 0);
+        return plan;
+    }
+
+    bool Fits(const std::string &dest, uint64_t size, Plan *plan)
+    {
+        Plan own;
+        Plan &out = plan != nullptr ? *plan : own;
+        out = Plan();
+        out.bytes = size;
+        out.freeKnown = FS::FreeSpace(dest.substr(0, dest.find_last_of('/') + 1), &out.free);
+        if (!out.freeKnown || size <= out.free)
+        {
+            out.needed = size;
+            return true;
+        }
+        bool split = LocalFileSink::NeedsSplit(size);
+        out.split = split ? 1 : 0;
+        out.needed = size - OnDisk(dest, size, split);
+        if (out.Fits())
+            return true;
+        if (LocalTrash::Empty())
+        {
+            out.freeKnown = FS::FreeSpace(dest.substr(0, dest.find_last_of('/') + 1), &out.free);
+            if (out.Fits())
+                return true;
+        }
+        Logger::Logf(Logger::LOG_ERROR, "PREFLIGHT file=%s needed=%llu free=%llu", dest.c_str(),
+                     (unsigned long long)out.needed, (unsigned long long)out.free);
+        return false;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef NEO_PREFLIGHT_H
+#define NEO_PREFLIGHT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Checks a batch bound for the SD card before a byte of it moves: whether
+// it fits in the free space, counting what resumed and overwritten files
+// already hold, and which files are written as DBI-style split folders.
+// Whether the card takes flat files over 4 GiB is probed once, so a FAT32
+// card gets split files without force_fat32 being set; each file's own
+// space is then reserved by LocalFileSink::Preallocate as it starts.
+namespace Preflight
+{
+    struct File
+    {
+        // Full local path of the file.
+        std::string dest;
+        uint64_t size = 0;
+    };
+
+    struct Plan
+    {
+        uint64_t bytes = 0;
+        // `bytes` less what is on the card already; worked out only when
+        // `bytes` alone does not fit.
+        uint64_t needed = 0;
+        uint64_t free = 0;
+        bool freeKnown = false;
+        // Files to be written as split folders.
+        int split = 0;
+        bool largeFiles = true;
+        // Short of space while the trash still holds deletes, which may
+        // make up the difference once it is emptied.
+        bool trash = false;
+
+        bool Fits() const { return !freeKnown || needed <= free; }
+    };
+
+    // The card holds flat files over 4 GiB (exFAT). False with force_fat32;
+    // true while unknown, e.g. with too little free space to probe. The
+    // probe is a 4 GiB ftruncate on the card, which can take a while, so
+    // the UI thread passes `probe` false and takes what it finds.
+    bool LargeFilesSupported(bool probe = true);
+
+    // Sizes up `files`, plus `extra` bytes known only as a total (folders
+    // not listed yet), on the file system holding `root`, and logs it.
+    // When they do not fit, `reclaim` empties the trash and checks again,
+    // which can take a while; the UI thread leaves it off and gets `trash`
+    // set instead, for the transfer thread to do it. Only with `reclaim`
+    // is the card probed for large files.
+    Plan Check(const std::string &root, const std::vector<File> &files, uint64_t extra = 0, bool reclaim = false);
+    // Check() of one file, for those queued without a manifest, without
+    // the log line when it fits. `plan` gets the figures when given. Only
+    // for transfer threads: it empties the trash when short.
+    bool Fits(const std::string &dest, uint64_t size, Plan *plan = nullptr);
+}
+
+#endif
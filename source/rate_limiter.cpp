@@ -0,0 +1,82 @@
+#include <atomic>
+#include <mutex>
+#include <switch.h>
+
+#include "rate_limiter.h"
+#include "config.h"
+#include "util.h"
+#include "windows.h"
+#include "cancel.h"
+
+namespace
+{
+    // Credit a thread may run ahead of schedule, so short stalls (a slow
+    // server reply, a disk flush) are not lost and small reads never sleep.
+    const uint64_t kBurstUs = 100000;
+    // Longest single sleep; shorter slices keep Cancel responsive.
+    const uint64_t kSliceUs = 50000;
+    // Longest a bulk call waits for interactive requests, so a slow listing
+    // slows a transfer down without stalling it.
+    const uint64_t kMaxYieldUs = 250000;
+    const uint64_t kYieldSliceUs = 5000;
+
+    std::mutex mutex;
+    // Time at which everything booked so far has been paid for.
+    uint64_t next_free = 0;
+
+    std::atomic<int> interactive_count{0};
+    thread_local int interactive_depth = 0;
+
+    void YieldToInteractive()
+    {
+        for (uint64_t waited = 0; waited < kMaxYieldUs && !Cancel::Stopped(); waited += kYieldSliceUs)
+        {
+            if (interactive_count.load(std::memory_order_relaxed) == 0)
+                return;
+            svcSleepThread(kYieldSliceUs * 1000);
+        }
+    }
+}
+
+RateLimiter::Interactive::Interactive(bool enabled)
+    : enabled(enabled)
+{
+    if (enabled && interactive_depth++ == 0)
+        interactive_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+RateLimiter::Interactive::~Interactive()
+{
+    if (enabled && --interactive_depth == 0)
+        interactive_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RateLimiter::Consume(size_t bytes)
+{
+    if (interactive_depth > 0 || bytes == 0)
+        return;
+    if (interactive_count.load(std::memory_order_relaxed) > 0)
+        YieldToInteractive();
+
+    int kb = rate_limit_kb;
+    if (kb <= 0)
+        return;
+
+    uint64_t wait;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t now = Util::GetTick();
+        // Idle time earns no credit beyond the burst.
+        if (next_free < now)
+            next_free = now;
+        next_free += (uint64_t)bytes * 1000000 / ((uint64_t)kb * 1024);
+        wait = (next_free > now + kBurstUs) ? next_free - now - kBurstUs : 0;
+    }
+
+    while (wait > 0 && !Cancel::Stopped())
+    {
+        uint64_t slice = wait < kSliceUs ? wait : kSliceUs;
+        svcSleepThread(slice * 1000);
+        wait -= slice;
+    }
+}
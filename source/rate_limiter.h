@@ -0,0 +1,42 @@
+#ifndef NEO_RATE_LIMITER_H
+#define NEO_RATE_LIMITER_H
+
+#include <cstddef>
+
+// One bandwidth budget shared by every transfer thread on every protocol,
+// capped at rate_limit_kb (KiB/s, 0 = unlimited) for the connected site.
+//
+// The protocol clients call Consume() from their bulk data paths only (HTTP
+// GET/PUT bodies, SFTP reads and writes, FTP binary data connections), so
+// listings, stats and other small requests never wait behind a large copy.
+// Each call books its bytes after everything booked before it, which gives
+// the workers of a batch equal shares of the cap instead of the fastest
+// connection taking it all.
+//
+// Requests made under an Interactive scope form a second, priority lane:
+// they are never charged, and while one is in flight the bulk callers on
+// other threads hold back so the listing or stat is not stuck behind full
+// socket buffers.
+namespace RateLimiter
+{
+    // Accounts `bytes` just moved and, when that puts the caller ahead of the
+    // budget, sleeps the calling thread until it is back on schedule.
+    void Consume(size_t bytes);
+
+    // Marks what the calling thread sends while it lives as interactive
+    // (browsing, metadata, folder expansion) unless `enabled` is false.
+    // Scopes may nest.
+    class Interactive
+    {
+    public:
+        explicit Interactive(bool enabled = true);
+        ~Interactive();
+        Interactive(const Interactive &) = delete;
+        Interactive &operator=(const Interactive &) = delete;
+
+    private:
+        bool enabled;
+    };
+}
+
+#endif
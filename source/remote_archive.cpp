@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <zlib.h>
+
+#include "remote_archive.h"
+#include "remote_block_cache.h"
+#include "remote_reader.h"
+#include "local_sink.h"
+#include "buffer_pool.h"
+#include "zip_util.h"
+#include "fs.h"
+#include "lang.h"
+#include "util.h"
+#include "windows.h"
+#include "logger.h"
+#include "cancel.h"
+
+namespace
+{
+    const uint32_t kEndOfCentralDir = 0x06054b50;
+    const uint32_t kZip64EndLocator = 0x07064b50;
+    const uint32_t kZip64EndOfCentralDir = 0x06064b50;
+    const uint32_t kCentralHeader = 0x02014b50;
+    const uint32_t kLocalHeader = 0x04034b50;
+    // End record with the longest possible comment, and the zip64 locator
+    // that precedes it.
+    const uint64_t kTailSize = 22 + 0xFFFF + 20;
+    // Larger central directories are refused rather than held in memory.
+    const uint64_t kMaxCentralDir = 64 * 1024 * 1024;
+    const size_t kInflateChunk = 256 * 1024;
+
+    struct Entry
+    {
+        // Path inside the archive, without leading or trailing slashes.
+        std::string name;
+        uint64_t size = 0;
+        uint64_t compressed = 0;
+        uint64_t headerOffset = 0;
+        uint32_t crc = 0;
+        uint16_t method = 0;
+        uint16_t flags = 0;
+        bool isDir = false;
+        DateTime modified = {};
+    };
+
+    struct ArchiveState
+    {
+        DirEntry file;
+        std::string path;
+        uint64_t size = 0;
+        // Zip archives are indexed and extracted here; other formats go
+        // through libarchive.
+        bool native = false;
+        std::vector<Entry> entries;
+    };
+
+    // Written by the activity thread that opened the archive, read by the
+    // UI thread; the index itself is built outside the lock.
+    std::mutex archive_mutex;
+    bool archive_open = false;
+    ArchiveState archive;
+
+    uint16_t Le16(const uint8_t *p)
+    {
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+
+    uint32_t Le32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    uint64_t Le64(const uint8_t *p)
+    {
+        return (uint64_t)Le32(p) | ((uint64_t)Le32(p + 4) << 32);
+    }
+
+    void DosToDateTime(uint16_t date, uint16_t time, DateTime &out)
+    {
+        out.year = 1980 + (date >> 9);
+        out.month = (date >> 5) & 0x0F;
+        out.day = date & 0x1F;
+        out.hours = time >> 11;
+        out.minutes = (time >> 5) & 0x3F;
+        out.seconds = (time & 0x1F) * 2;
+    }
+
+    std::string CleanName(std::string name)
+    {
+        Util::ReplaceAll(name, "\\", "/");
+        while (name.compare(0, 2, "./") == 0)
+            name.erase(0, 2);
+        Util::Trim(name, "/");
+        return name;
+    }
+
+    // Extracting `name` must not leave the destination folder.
+    bool SafeName(const std::string &name)
+    {
+        return !name.empty() && name[0] != '/' && name != ".." && name.compare(0, 3, "../") != 0 &&
+               name.find("/../") == std::string::npos &&
+               (name.size() < 3 || name.compare(name.size() - 3, 3, "/..") != 0);
+    }
+
+    bool ReadZipIndex(RemoteReader &reader, ArchiveState &state)
+    {
+        RemoteClient *client = reader.Client();
+        const std::string &path = state.path;
+        std::vector<Entry> &entries = state.entries;
+        uint64_t tail_len = MIN(state.size, kTailSize);
+        uint64_t tail_start = state.size - tail_len;
+        std::vector<uint8_t> tail(tail_len);
+        if (tail_len < 22 || !reader.Read(tail_start, tail.data(), tail_len))
+        {
+            snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAILED], client->LastResponse());
+            return false;
+        }
+
+        int64_t eocd = -1;
+        for (int64_t i = (int64_t)tail_len - 22; i >= 0; --i)
+        {
+            if (Le32(&tail[i]) == kEndOfCentralDir)
+            {
+                eocd = i;
+                break;
+            }
+        }
+        if (eocd < 0)
+        {
+            snprintf(status_message, 1023, "%s - no zip end record", lang_strings[STR_FAILED]);
+            return false;
+        }
+
+        const uint8_t *end = &tail[eocd];
+        uint64_t count = Le16(end + 10);
+        uint64_t cd_size = Le32(end + 12);
+        uint64_t cd_offset = Le32(end + 16);
+        if (count == 0xFFFF || cd_size == 0xFFFFFFFF || cd_offset == 0xFFFFFFFF)
+        {
+            uint8_t record[56];
+            if (eocd < 20 || Le32(&tail[eocd - 20]) != kZip64EndLocator ||
+                !reader.Read(Le64(&tail[eocd - 20 + 8]), record, sizeof(record)) ||
+                Le32(record) != kZip64EndOfCentralDir)
+            {
+                snprintf(status_message, 1023, "%s - bad zip64 end record", lang_strings[STR_FAILED]);
+                return false;
+            }
+            count = Le64(record + 32);
+            cd_size = Le64(record + 40);
+            cd_offset = Le64(record + 48);
+        }
+
+        if (cd_size > kMaxCentralDir || cd_offset + cd_size > state.size)
+        {
+            snprintf(status_message, 1023, "%s - bad zip central directory", lang_strings[STR_FAILED]);
+            return false;
+        }
+
+        // Small archives have their whole directory in the tail already.
+        std::vector<uint8_t> cd(cd_size);
+        if (cd_offset >= tail_start)
+        {
+            memcpy(cd.data(), &tail[cd_offset - tail_start], cd_size);
+        }
+        else if (cd_size > 0 && !reader.Read(cd_offset, cd.data(), cd_size))
+        {
+            snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAILED], client->LastResponse());
+            return false;
+        }
+
+        entries.reserve(MIN(count, (uint64_t)65536));
+        size_t pos = 0;
+        while (pos + 46 <= cd.size())
+        {
+            const uint8_t *h = &cd[pos];
+            if (Le32(h) != kCentralHeader)
+                break;
+
+            uint16_t name_len = Le16(h + 28);
+            uint16_t extra_len = Le16(h + 30);
+            uint16_t comment_len = Le16(h + 32);
+            if (pos + 46 + name_len + extra_len + comment_len > cd.size())
+                break;
+
+            Entry entry;
+            entry.flags = Le16(h + 8);
+            entry.method = Le16(h + 10);
+            entry.crc = Le32(h + 16);
+            entry.compressed = Le32(h + 20);
+            entry.size = Le32(h + 24);
+            entry.headerOffset = Le32(h + 42);
+            DosToDateTime(Le16(h + 14), Le16(h + 12), entry.modified);
+
+            std::string raw_name((const char *)h + 46, name_len);
+            entry.isDir = !raw_name.empty() && (raw_name.back() == '/' || raw_name.back() == '\\');
+            entry.name = CleanName(raw_name);
+
+            // Zip64 extra field: only the values saturated above are present,
+            // in this order.
+            const uint8_t *x = h + 46 + name_len;
+            const uint8_t *x_end = x + extra_len;
+            while (x + 4 <= x_end)
+            {
+                uint16_t id = Le16(x);
+                uint16_t len = Le16(x + 2);
+                const uint8_t *f = x + 4;
+                const uint8_t *f_end = f + len;
+                if (f_end > x_end)
+                    break;
+                if (id == 0x0001)
+                {
+                    if (entry.size == 0xFFFFFFFF && f + 8 <= f_end)
+                    {
+                        entry.size = Le64(f);
+                        f += 8;
+                    }
+                    if (entry.compressed == 0xFFFFFFFF && f + 8 <= f_end)
+                    {
+                        entry.compressed = Le64(f);
+                        f += 8;
+                    }
+                    if (entry.headerOffset == 0xFFFFFFFF && f + 8 <= f_end)
+                        entry.headerOffset = Le64(f);
+                }
+                x = f_end;
+            }
+
+            if (!entry.name.empty())
+                entries.push_back(entry);
+            pos += 46 + name_len + extra_len + comment_len;
+        }
+
+        Logger::Logf("ARCHIVE INDEX zip path=%s entries=%d directory=%llu bytes",
+                     path.c_str(), (int)entries.size(), (unsigned long long)cd_size);
+        return true;
+    }
+
+    bool ReadLibarchiveIndex(RemoteClient *client, ArchiveState &state)
+    {
+        std::vector<Entry> &entries = state.entries;
+        std::vector<ArchiveEntryInfo> infos;
+        if (!ZipUtil::ListEntries(state.file, client, infos))
+            return false;
+
+        for (const ArchiveEntryInfo &info : infos)
+        {
+            Entry entry;
+            entry.name = CleanName(info.pathname);
+            entry.size = info.size > 0 ? (uint64_t)info.size : 0;
+            entry.isDir = info.isDir;
+            struct tm tm = {};
+            time_t mtime = info.mtime;
+            if (gmtime_r(&mtime, &tm) != nullptr)
+            {
+                entry.modified.year = tm.tm_year + 1900;
+                entry.modified.month = tm.tm_mon + 1;
+                entry.modified.day = tm.tm_mday;
+                entry.modified.hours = tm.tm_hour;
+                entry.modified.minutes = tm.tm_min;
+                entry.modified.seconds = tm.tm_sec;
+            }
+            if (!entry.name.empty())
+                entries.push_back(entry);
+        }
+
+        Logger::Logf("ARCHIVE INDEX libarchive path=%s entries=%d", state.path.c_str(), (int)entries.size());
+        return true;
+    }
+
+    // Path of `dir` inside the archive; empty for its root.
+    std::string InnerPath(const std::string &dir)
+    {
+        if (dir.size() <= archive.path.size())
+            return "";
+        return CleanName(dir.substr(archive.path.size()));
+    }
+
+    // Called with archive_mutex held.
+    bool InsideArchive(std::string dir)
+    {
+        Util::Rtrim(dir, "/");
+        return archive_open && dir.compare(0, archive.path.size(), archive.path) == 0 &&
+               (dir.size() == archive.path.size() || dir[archive.path.size()] == '/');
+    }
+
+    DirEntry MakeEntry(const std::string &dir, const std::string &name, bool isDir, uint64_t size, const DateTime &modified)
+    {
+        DirEntry e;
+        memset(&e, 0, sizeof(e));
+        snprintf(e.directory, sizeof(e.directory), "%s", dir.c_str());
+        snprintf(e.name, sizeof(e.name), "%s", name.c_str());
+        std::string path = dir + "/" + name;
+        snprintf(e.path, sizeof(e.path), "%s", path.c_str());
+        e.isDir = isDir;
+        e.isLink = false;
+        e.selectable = true;
+        e.file_size = size;
+        e.modified = modified;
+        if (isDir)
+            snprintf(e.display_size, sizeof(e.display_size), "%s", lang_strings[STR_FOLDER]);
+        else
+            DirEntry::SetDisplaySize(&e);
+        snprintf(e.display_date, sizeof(e.display_date), "%04d-%02d-%02d %02d:%02d", modified.year,
+                 modified.month, modified.day, modified.hours, modified.minutes);
+        return e;
+    }
+
+    bool CacheRead(RemoteBlockCache &cache, uint64_t offset, void *buffer, size_t size)
+    {
+        char *out = static_cast<char *>(buffer);
+        while (size > 0)
+        {
+            const void *data;
+            ssize_t n = cache.Read(offset, &data);
+            if (n <= 0)
+                return false;
+            size_t take = MIN((size_t)n, size);
+            memcpy(out, data, take);
+            out += take;
+            offset += take;
+            size -= take;
+        }
+        return true;
+    }
+
+    bool CopyStored(RemoteBlockCache &cache, uint64_t offset, const Entry &entry, LocalSinkStream &out)
+    {
+        uint64_t left = entry.compressed;
+        uLong crc = crc32(0L, Z_NULL, 0);
+        while (left > 0)
+        {
+            if (Cancel::Stopped())
+                return false;
+            const void *data;
+            ssize_t n = cache.Read(offset, &data);
+            if (n <= 0)
+                return false;
+            size_t take = (size_t)MIN((uint64_t)n, left);
+            crc = crc32(crc, (const Bytef *)data, (uInt)take);
+            if (!out.Write(data, take))
+                return false;
+            offset += take;
+            left -= take;
+            bytes_transfered += take;
+        }
+        return crc == entry.crc;
+    }
+
+    bool Inflate(RemoteBlockCache &cache, uint64_t offset, const Entry &entry, LocalSinkStream &out)
+    {
+        TransferBuffer chunk(kInflateChunk);
+        if (!chunk)
+            return false;
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+            return false;
+
+        uint64_t left = entry.compressed;
+        uint64_t produced = 0;
+        uLong crc = crc32(0L, Z_NULL, 0);
+        int ret = Z_OK;
+        bool ok = true;
+        while (ret != Z_STREAM_END)
+        {
+            if (Cancel::Stopped())
+            {
+                ok = false;
+                break;
+            }
+            // The cache pointer stays valid until the next Read, which only
+            // happens once zlib consumed it.
+            if (zs.avail_in == 0)
+            {
+                const void *data;
+                ssize_t n = left > 0 ? cache.Read(offset, &data) : 0;
+                if (n <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                size_t take = (size_t)MIN((uint64_t)n, left);
+                zs.next_in = (Bytef *)data;
+                zs.avail_in = (uInt)take;
+                offset += take;
+                left -= take;
+            }
+
+            zs.next_out = (Bytef *)chunk.data();
+            zs.avail_out = (uInt)chunk.size();
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && !(ret == Z_BUF_ERROR && zs.avail_in == 0))
+            {
+                ok = false;
+                break;
+            }
+
+            size_t have = chunk.size() - zs.avail_out;
+            if (have > 0)
+            {
+                crc = crc32(crc, (const Bytef *)chunk.data(), (uInt)have);
+                if (!out.Write(chunk.data(), have))
+                {
+                    ok = false;
+                    break;
+                }
+                produced += have;
+                bytes_transfered = produced;
+            }
+        }
+        inflateEnd(&zs);
+
+        return ok && produced == entry.size && crc == entry.crc;
+    }
+
+    bool ExtractZipEntry(RemoteBlockCache &cache, const Entry &entry, const std::string &target)
+    {
+        if (entry.flags & 0x0001)
+        {
+            Logger::Logf("ARCHIVE EXTRACT encrypted entry=%s", entry.name.c_str());
+            return false;
+        }
+        if (entry.method != 0 && entry.method != 8)
+        {
+            Logger::Logf("ARCHIVE EXTRACT unsupported method=%d entry=%s", entry.method, entry.name.c_str());
+            return false;
+        }
+
+        uint8_t local[30];
+        if (!CacheRead(cache, entry.headerOffset, local, sizeof(local)) || Le32(local) != kLocalHeader)
+        {
+            Logger::Logf("ARCHIVE EXTRACT bad local header entry=%s offset=%llu",
+                         entry.name.c_str(), (unsigned long long)entry.headerOffset);
+            return false;
+        }
+        uint64_t data_offset = entry.headerOffset + sizeof(local) + Le16(local + 26) + Le16(local + 28);
+
+        FS::MkDirs(target, true);
+        LocalFileSink sink(target);
+        if (!sink.Open(false))
+            return false;
+        if (entry.size > 0)
+            sink.Preallocate(entry.size);
+
+        bool ok;
+        {
+            LocalSinkStream out(sink, 0);
+            if (entry.method == 0)
+                ok = CopyStored(cache, data_offset, entry, out);
+            else
+                ok = Inflate(cache, data_offset, entry, out);
+            if (ok)
+                ok = out.Flush();
+        }
+        if (!sink.Close())
+            ok = false;
+        return ok;
+    }
+
+    struct ExtractJob
+    {
+        size_t index;
+        // Destination path relative to the extraction folder.
+        std::string target;
+    };
+
+    int ExtractZipJobs(RemoteClient *client, const ArchiveState &state, const std::vector<ExtractJob> &jobs,
+                       const std::string &dest)
+    {
+        int failed = 0;
+        ReadHints hints;
+        hints.size = (int64_t)state.size;
+        std::unique_ptr<RemoteReader> reader = client->OpenRead(state.path, hints);
+        if (reader == nullptr)
+        {
+            snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAILED], client->LastResponse());
+            return (int)jobs.size();
+        }
+        {
+            RemoteBlockCache cache(*reader);
+            cache.Start();
+
+            for (const ExtractJob &job : jobs)
+            {
+                if (Cancel::Stopped())
+                    break;
+
+                const Entry &entry = state.entries[job.index];
+                std::string target = dest + (FS::hasEndSlash(dest.c_str()) ? "" : "/") + job.target;
+                if (entry.isDir)
+                {
+                    FS::MkDirs(target);
+                    continue;
+                }
+
+                snprintf(activity_message, 255, "%s: %s", lang_strings[STR_EXTRACTING], job.target.c_str());
+                bytes_to_download = entry.size;
+                bytes_transfered = 0;
+                prev_tick = Util::GetTick();
+                if (!ExtractZipEntry(cache, entry, target))
+                {
+                    FS::Rm(target);
+                    if (Cancel::Stopped())
+                        break;
+                    failed++;
+                    snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAILED_TO_EXTRACT], job.target.c_str());
+                }
+            }
+        }
+        return failed;
+    }
+}
+
+namespace RemoteArchive
+{
+    bool IsSupported(const DirEntry &file)
+    {
+        if (file.isDir)
+            return false;
+        std::string ext = FS::GetFileExt(file.name);
+        return ext == ".ZIP" || ext == ".7Z" || ext == ".RAR";
+    }
+
+    bool Open(RemoteClient *client, const DirEntry &file)
+    {
+        Close();
+
+        int64_t size = file.file_size;
+        if (size <= 0 && (!client->Size(file.path, &size) || size <= 0))
+        {
+            snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAILED], client->LastResponse());
+            return false;
+        }
+
+        ArchiveState state;
+        state.file = file;
+        state.path = file.path;
+        Util::Rtrim(state.path, "/");
+        state.size = (uint64_t)size;
+        state.native = FS::GetFileExt(file.name) == ".ZIP";
+
+        bool ok;
+        if (state.native)
+        {
+            ReadHints hints;
+            hints.size = (int64_t)state.size;
+            std::unique_ptr<RemoteReader> reader = client->OpenRead(state.path, hints);
+            if (reader == nullptr)
+                snprintf(status_message, 1023, "%s - %s", lang_strings[STR_FAILED], client->LastResponse());
+            ok = reader != nullptr && ReadZipIndex(*reader, state);
+        }
+        else
+        {
+            ok = ReadLibarchiveIndex(client, state);
+        }
+        if (!ok)
+            return false;
+
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        archive = std::move(state);
+        archive_open = true;
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        archive_open = false;
+        archive = ArchiveState();
+    }
+
+    bool IsOpen()
+    {
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        return archive_open;
+    }
+
+    bool Contains(const std::string &dir)
+    {
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        return InsideArchive(dir);
+    }
+
+    std::vector<DirEntry> ListDir(const std::string &pdir)
+    {
+        std::vector<DirEntry> out;
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        std::string dir = pdir;
+        Util::Rtrim(dir, "/");
+        if (!InsideArchive(dir))
+            return out;
+
+        DateTime none = {};
+        DirEntry up = MakeEntry(dir, "..", true, 0, none);
+        snprintf(up.path, sizeof(up.path), "%s", dir.c_str());
+        snprintf(up.display_date, sizeof(up.display_date), "%s", "");
+        out.push_back(up);
+
+        std::string inner = InnerPath(dir);
+        std::string prefix = inner.empty() ? "" : inner + "/";
+        // Folders often have no entry of their own and show up only as a
+        // prefix of the files in them.
+        std::map<std::string, DirEntry> children;
+        for (const Entry &entry : archive.entries)
+        {
+            if (entry.name.size() <= prefix.size() || entry.name.compare(0, prefix.size(), prefix) != 0)
+                continue;
+            std::string rest = entry.name.substr(prefix.size());
+            size_t slash = rest.find('/');
+            std::string child = rest.substr(0, slash);
+            if (child.empty() || children.find(child) != children.end())
+                continue;
+            bool isDir = slash != std::string::npos || entry.isDir;
+            children[child] = MakeEntry(dir, child, isDir, isDir ? 0 : entry.size, entry.modified);
+        }
+        for (auto &child : children)
+            out.push_back(child.second);
+        return out;
+    }
+
+    int Extract(RemoteClient *client, const std::vector<DirEntry> &selected, const std::string &dest)
+    {
+        std::vector<ExtractJob> jobs;
+        std::map<std::string, std::string> wanted;
+        // A snapshot, so the UI can keep listing while this runs.
+        ArchiveState state;
+        {
+            std::lock_guard<std::mutex> lock(archive_mutex);
+            if (!archive_open)
+                return 0;
+            state = archive;
+
+            for (const DirEntry &row : selected)
+            {
+                if (strcmp(row.name, "..") == 0 || !InsideArchive(row.path))
+                    continue;
+                std::string inner = InnerPath(row.path);
+                std::string base = InnerPath(row.directory);
+                size_t strip = base.empty() ? 0 : base.size() + 1;
+                for (size_t i = 0; i < state.entries.size(); ++i)
+                {
+                    const std::string &name = state.entries[i].name;
+                    if (name != inner && name.compare(0, inner.size() + 1, inner + "/") != 0)
+                        continue;
+                    std::string target = name.substr(strip);
+                    if (!SafeName(target) || wanted.find(name) != wanted.end())
+                        continue;
+                    wanted[name] = target;
+                    jobs.push_back({i, target});
+                }
+            }
+        }
+
+        Logger::Logf("ARCHIVE EXTRACT path=%s entries=%d dest=%s native=%d",
+                     state.path.c_str(), (int)jobs.size(), dest.c_str(), state.native ? 1 : 0);
+        if (jobs.empty())
+            return 0;
+
+        FS::MkDirs(dest);
+        if (state.native)
+            return ExtractZipJobs(client, state, jobs, dest);
+
+        // libarchive has to walk the archive from the start, but only the
+        // selected entries are decompressed and written.
+        int ret = ZipUtil::Extract(state.file, dest, client, [&wanted](std::string &pathname)
+                                   {
+                                       auto it = wanted.find(CleanName(pathname));
+                                       if (it == wanted.end())
+                                           return false;
+                                       pathname = it->second;
+                                       return true;
+                                   });
+        return ret ? 0 : 1;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef NEO_REMOTE_ARCHIVE_H
+#define NEO_REMOTE_ARCHIVE_H
+
+#include <string>
+#include <vector>
+
+#include "clients/remote_client.h"
+#include "common.h"
+
+// A remote archive opened as a folder. Its entries are listed without
+// downloading it: a zip's central directory is read with a couple of
+// ranged reads from the end of the file, other formats (7z keeps its
+// header at the end too) are listed through libarchive over the block
+// cache. While open, remote_directory values below the archive's own path
+// name folders inside it.
+namespace RemoteArchive
+{
+    // Whether `file` has an extension that can be opened as a folder.
+    bool IsSupported(const DirEntry &file);
+
+    // Reads the entry list of `file`. On failure the reason is left in
+    // status_message and false returned.
+    bool Open(RemoteClient *client, const DirEntry &file);
+    void Close();
+    bool IsOpen();
+
+    // Whether the remote directory `dir` lies inside the open archive.
+    bool Contains(const std::string &dir);
+
+    // Entries of the folder `dir` inside the archive, starting with "..".
+    std::vector<DirEntry> ListDir(const std::string &dir);
+
+    // Extracts the `selected` rows of ListDir (folders recursively) below
+    // `dest`, reading only their local headers and data. Returns the number
+    // of entries that failed; the last failure is left in status_message.
+    int Extract(RemoteClient *client, const std::vector<DirEntry> &selected, const std::string &dest);
+}
+
+#endif
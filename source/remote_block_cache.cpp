@@ -0,0 +1,265 @@
+#include "remote_block_cache.h"
+#include "config.h"
+#include "util.h"
+#include "windows.h"
+#include "logger.h"
+#include "threads.h"
+#include "timeline.h"
+#include "cancel.h"
+
+RemoteBlockCache::RemoteBlockCache(RemoteReader &reader)
+    : reader(reader), path(reader.Path()), size(reader.Size())
+{
+    blockCount = (size + kBlockSize - 1) / kBlockSize;
+    prefetch = archive_prefetch;
+    maxBlocks = (size_t)archive_cache_mb * 1024 * 1024 / kBlockSize;
+    // Room for the prefetch window, the reader's block and the tail.
+    if (maxBlocks < (size_t)prefetch + 2)
+        maxBlocks = (size_t)prefetch + 2;
+}
+
+RemoteBlockCache::~RemoteBlockCache()
+{
+    if (threadStarted)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        Threads::Join(&thread);
+    }
+
+    for (const auto &entry : blocks)
+    {
+        if (entry.second.prefetched)
+            unused++;
+    }
+    Logger::Logf("ARCHIVE CACHE path=%s blocks=%llu hits=%llu misses=%llu fetched=%llu unused=%llu failed=%llu wait_ms=%llu",
+                 path.c_str(), (unsigned long long)blockCount, (unsigned long long)hits,
+                 (unsigned long long)misses, (unsigned long long)fetched, (unsigned long long)unused,
+                 (unsigned long long)failures, (unsigned long long)(waitUs / 1000));
+}
+
+void RemoteBlockCache::Start()
+{
+    if (threadStarted || blockCount == 0)
+        return;
+
+    Result rc = Threads::Create(&thread, fetchThread, this, 0x10000, Threads::ROLE_DISK, "archive cache");
+    if (R_FAILED(rc))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "ARCHIVE CACHE threadCreate failed rc=0x%x path=%s", rc, path.c_str());
+        return;
+    }
+    threadStart(&thread);
+    threadStarted = true;
+}
+
+ssize_t RemoteBlockCache::Read(uint64_t offset, const void **data)
+{
+    if (offset >= size)
+        return 0;
+
+    uint64_t index = offset / kBlockSize;
+    std::unique_lock<std::mutex> lock(mutex);
+    current = index;
+
+    auto it = blocks.find(index);
+    if (it != blocks.end() && it->second.failed)
+    {
+        // A failed prefetch gets one more try now that it is needed.
+        blocks.erase(it);
+        it = blocks.end();
+    }
+
+    if (it == blocks.end() || !it->second.ready)
+    {
+        misses++;
+        uint64_t start = Util::GetTick();
+        demand = index;
+        if (threadStarted)
+        {
+            cv.notify_all();
+            cv.wait(lock, [this, index]
+                    {
+                        auto found = blocks.find(index);
+                        return Cancel::Stopped() || (found != blocks.end() && (found->second.ready || found->second.failed));
+                    });
+        }
+        else
+        {
+            fetchLocked(lock, planLocked());
+        }
+        demand = kNone;
+        waitUs += Util::GetTick() - start;
+        it = blocks.find(index);
+    }
+    else
+    {
+        hits++;
+    }
+
+    if (it == blocks.end() || !it->second.ready || Cancel::Stopped())
+        return -1;
+
+    Block &block = it->second;
+    block.lastUse = ++useClock;
+    block.prefetched = false;
+    // The window moved; let the fetch thread top it up.
+    cv.notify_all();
+
+    size_t within = (size_t)(offset - index * kBlockSize);
+    if (within >= block.length)
+        return -1;
+    *data = block.data.data() + within;
+    return (ssize_t)(block.length - within);
+}
+
+void RemoteBlockCache::fetchThread(void *arg)
+{
+    static_cast<RemoteBlockCache *>(arg)->fetchLoop();
+}
+
+void RemoteBlockCache::fetchLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        std::vector<uint64_t> indexes;
+        if (!Cancel::Stopped())
+            indexes = planLocked();
+        if (indexes.empty())
+        {
+            cv.wait(lock);
+            continue;
+        }
+        fetchLocked(lock, indexes);
+    }
+}
+
+std::vector<uint64_t> RemoteBlockCache::planLocked()
+{
+    std::vector<uint64_t> out;
+    size_t limit = prefetch > 0 ? (size_t)prefetch : 1;
+
+    if (demand != kNone && blocks.find(demand) == blocks.end())
+        out.push_back(demand);
+
+    // The central directory (zip) or end header (7z) sits at the end and is
+    // read first, then again for every entry.
+    if (!tailQueued)
+    {
+        uint64_t tail = blockCount - 1;
+        if (blocks.find(tail) == blocks.end() && (out.empty() || out[0] != tail))
+            out.push_back(tail);
+        tailQueued = true;
+    }
+
+    // Prefetch only follows a reader that is moving forward from a block it
+    // already has, and never past what the cache can hold.
+    uint64_t from = demand != kNone ? demand + 1 : (current != kNone ? current + 1 : kNone);
+    if (from != kNone && prefetch > 0)
+    {
+        for (uint64_t i = from; i < blockCount && i < from + (uint64_t)prefetch && out.size() < limit + 1; ++i)
+        {
+            if (blocks.find(i) == blocks.end() && (out.empty() || out[0] != i))
+                out.push_back(i);
+        }
+    }
+    return out;
+}
+
+void RemoteBlockCache::fetchLocked(std::unique_lock<std::mutex> &lock, const std::vector<uint64_t> &indexes)
+{
+    if (indexes.empty())
+        return;
+    TIMELINE_SCOPE("archive block fetch");
+
+    // Placeholders keep the fetch thread from planning the same blocks again
+    // and eviction from touching them.
+    for (uint64_t index : indexes)
+    {
+        Block &block = blocks[index];
+        block.length = blockLength(index);
+    }
+    lock.unlock();
+
+    std::vector<TransferBuffer> buffers(indexes.size());
+    std::vector<RemoteRange> ranges;
+    std::vector<size_t> slots;
+    for (size_t i = 0; i < indexes.size(); ++i)
+    {
+        size_t length = blockLength(indexes[i]);
+        if (!buffers[i].Acquire(length))
+            continue;
+        RemoteRange range;
+        range.offset = indexes[i] * kBlockSize;
+        range.size = length;
+        range.buffer = buffers[i].data();
+        ranges.push_back(range);
+        slots.push_back(i);
+    }
+
+    reader.ReadRanges(ranges);
+
+    std::vector<bool> ok(indexes.size(), false);
+    for (size_t i = 0; i < ranges.size(); ++i)
+        ok[slots[i]] = ranges[i].ok;
+
+    lock.lock();
+    for (size_t i = 0; i < indexes.size(); ++i)
+    {
+        Block &block = blocks[indexes[i]];
+        if (ok[i])
+        {
+            block.data = std::move(buffers[i]);
+            block.held.Set((int64_t)block.length);
+            block.ready = true;
+            block.prefetched = indexes[i] != demand;
+            block.lastUse = ++useClock;
+            fetched++;
+        }
+        else
+        {
+            block.failed = true;
+            failures++;
+            Logger::Logf(Logger::LOG_ERROR, "ARCHIVE CACHE fetch failed path=%s offset=%llu err=%s",
+                         path.c_str(), (unsigned long long)(indexes[i] * kBlockSize), reader.Client()->LastResponse());
+        }
+    }
+    evictLocked();
+    cv.notify_all();
+}
+
+void RemoteBlockCache::evictLocked()
+{
+    uint64_t tail = blockCount - 1;
+    while (blocks.size() > maxBlocks)
+    {
+        auto victim = blocks.end();
+        for (auto it = blocks.begin(); it != blocks.end(); ++it)
+        {
+            if (it->first == current || it->first == tail || it->first == demand)
+                continue;
+            if (!it->second.ready && !it->second.failed)
+                continue;
+            if (victim == blocks.end() || it->second.lastUse < victim->second.lastUse)
+                victim = it;
+        }
+        if (victim == blocks.end())
+            return;
+        if (victim->second.prefetched)
+            unused++;
+        blocks.erase(victim);
+    }
+}
+
+size_t RemoteBlockCache::blockLength(uint64_t index) const
+{
+    uint64_t start = index * kBlockSize;
+    uint64_t end = start + kBlockSize;
+    if (end > size)
+        end = size;
+    return (size_t)(end - start);
+}
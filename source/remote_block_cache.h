@@ -0,0 +1,96 @@
+#ifndef NEO_REMOTE_BLOCK_CACHE_H
+#define NEO_REMOTE_BLOCK_CACHE_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <switch.h>
+
+#include "remote_reader.h"
+#include "buffer_pool.h"
+#include "metrics.h"
+
+// Block cache in front of random reads of one remote file, used by archive
+// extraction. Blocks are fetched in batches through the reader's
+// ReadRanges() (concurrent ranged requests on WebDAV) by a fetch thread that keeps the next
+// archive_prefetch blocks ahead of the reader, the last block stays cached
+// for the central directory, and the rest is evicted least recently used
+// once archive_cache_mb is reached.
+class RemoteBlockCache
+{
+public:
+    static const uint64_t kBlockSize = 1024 * 1024;
+
+    // `reader` must outlive the cache.
+    explicit RemoteBlockCache(RemoteReader &reader);
+    ~RemoteBlockCache();
+
+    // Starts the fetch thread. Without it blocks are fetched on demand,
+    // still batched with the prefetch window.
+    void Start();
+
+    // Points `*data` at the bytes cached from `offset` to the end of its
+    // block and returns their number. The pointer stays valid until the
+    // next Read(). Returns 0 at the end of the file and -1 when the block
+    // could not be fetched or the activity was cancelled.
+    ssize_t Read(uint64_t offset, const void **data);
+
+    uint64_t Size() const { return size; }
+
+private:
+    struct Block
+    {
+        TransferBuffer data;
+        size_t length = 0;
+        bool ready = false;
+        bool failed = false;
+        uint64_t lastUse = 0;
+        // Fetched ahead of the reader and not read yet.
+        bool prefetched = false;
+        Metrics::Held held{Metrics::GAUGE_MEM_ARCHIVE};
+    };
+
+    static const uint64_t kNone = ~0ULL;
+
+    RemoteReader &reader;
+    std::string path;
+    uint64_t size;
+    uint64_t blockCount;
+    size_t maxBlocks;
+    int prefetch;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<uint64_t, Block> blocks;
+    // Block the reader's last pointer is in, and the one it waits for.
+    uint64_t current = kNone;
+    uint64_t demand = kNone;
+    uint64_t useClock = 0;
+    bool tailQueued = false;
+
+    Thread thread;
+    bool threadStarted = false;
+    bool stopping = false;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t fetched = 0;
+    uint64_t unused = 0;
+    uint64_t failures = 0;
+    uint64_t waitUs = 0;
+
+    static void fetchThread(void *arg);
+    void fetchLoop();
+    // Blocks to fetch next: the one the reader waits for, the tail, then
+    // the prefetch window. Called with `mutex` held.
+    std::vector<uint64_t> planLocked();
+    // Fetches `indexes` with `lock` released and stores the results.
+    void fetchLocked(std::unique_lock<std::mutex> &lock, const std::vector<uint64_t> &indexes);
+    void evictLocked();
+    size_t blockLength(uint64_t index) const;
+};
+
+#endif
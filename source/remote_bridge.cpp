@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "remote_bridge.h"
+#include "remote_stream_reader.h"
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+#include "util.h"
+
+namespace
+{
+    void LogCopy(const std::string &path, const std::string &dest, uint64_t size, uint64_t start,
+                 const char *mode, bool ok)
+    {
+        double secs = (Util::GetTick() - start) / 1000000.0;
+        Logger::Logf("SITE COPY path=%s dest=%s bytes=%llu ms=%.0f mib_s=%.2f mode=%s ok=%d",
+                     path.c_str(), dest.c_str(), (unsigned long long)size, secs * 1000.0,
+                     secs > 0.0 ? size / secs / 1048576.0 : 0.0, mode, ok ? 1 : 0);
+    }
+
+    int Spool(RemoteClient *from, const std::string &path, RemoteClient *to, const std::string &dest,
+              std::string &error)
+    {
+        int ret = from->GetKnownSize(TMP_SITE_COPY_FILE, path, -1);
+        if (ret > 0)
+        {
+            ret = to->Put(TMP_SITE_COPY_FILE, dest);
+            if (ret <= 0)
+                error = to->LastResponse();
+        }
+        else
+        {
+            error = from->LastResponse();
+        }
+        FS::Rm(TMP_SITE_COPY_FILE);
+        return ret > 0 ? 1 : 0;
+    }
+}
+
+int RemoteBridge::CopyFile(RemoteClient *from, const std::string &path, uint64_t size,
+                           RemoteClient *to, const std::string &dest, std::string &error)
+{
+    uint64_t start = Util::GetTick();
+    RemoteStreamReader reader(from, path, size, (size_t)site_copy_buffer_mb * 1024 * 1024);
+
+    // The fetch starts with the first pull, so a destination that turns
+    // the stream down has cost nothing.
+    bool started = false;
+    bool fetch_failed = false;
+    const char *pending = nullptr;
+    size_t left = 0;
+    RemoteSourceFn source = [&](char *buffer, size_t len) -> int64_t
+    {
+        if (fetch_failed)
+            return -1;
+        if (!started)
+        {
+            started = true;
+            if (!reader.Start())
+            {
+                fetch_failed = true;
+                return -1;
+            }
+        }
+        if (left == 0)
+        {
+            const void *data = nullptr;
+            ssize_t got = reader.Read(&data);
+            if (got <= 0)
+            {
+                fetch_failed = got < 0;
+                return got < 0 ? -1 : 0;
+            }
+            pending = static_cast<const char *>(data);
+            left = (size_t)got;
+        }
+        size_t take = len < left ? len : left;
+        memcpy(buffer, pending, take);
+        pending += take;
+        left -= take;
+        return (int64_t)take;
+    };
+
+    int ret = to->PutStream(dest, size, source);
+    if (ret < 0 && !started)
+    {
+        ret = Spool(from, path, to, dest, error);
+        LogCopy(path, dest, size, start, "spool", ret > 0);
+        return ret;
+    }
+
+    if (ret <= 0)
+    {
+        if (fetch_failed && !reader.Error().empty())
+            error = reader.Error();
+        else
+            error = to->LastResponse();
+    }
+    LogCopy(path, dest, size, start, "stream", ret > 0);
+    return ret > 0 ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+#ifndef NEO_REMOTE_BRIDGE_H
+#define NEO_REMOTE_BRIDGE_H
+
+#include <string>
+#include <cstdint>
+
+#include "clients/remote_client.h"
+
+// Copies files from one connected site to another. A RemoteStreamReader
+// fetch thread runs the source's GetStream() into pool buffers (at most
+// site_copy_buffer_mb MiB) while the calling thread uploads them with the
+// destination's PutStream(), so the download and the upload overlap and
+// nothing is written to the SD card. The two clients must be separate
+// sessions, even when both point at the same server.
+namespace RemoteBridge
+{
+    // Copies `path` (`size` bytes) on `from` to `dest` on `to`. A
+    // destination without PutStream() gets the file through
+    // TMP_SITE_COPY_FILE instead. Returns 1 on success, 0 with `error` set.
+    int CopyFile(RemoteClient *from, const std::string &path, uint64_t size,
+                 RemoteClient *to, const std::string &dest, std::string &error);
+}
+
+#endif
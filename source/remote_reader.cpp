@@ -0,0 +1,99 @@
+#include <fcntl.h>
+
+#include "remote_reader.h"
+#include "logger.h"
+
+RemoteReader::RemoteReader(RemoteClient *client, const std::string &path, const ReadHints &hints)
+    : client(client), path(path), hints(hints)
+{
+}
+
+RemoteReader::~RemoteReader()
+{
+    if (fp != nullptr)
+        client->Close(fp);
+    if (ftp_paused)
+        ((FtpClient *)client)->SetCallbackXferFunction(ftp_xfer);
+}
+
+bool RemoteReader::Open()
+{
+    if (hints.size >= 0)
+        size = (uint64_t)hints.size;
+    else
+    {
+        int64_t remote_size = 0;
+        if (!client->Size(path, &remote_size) || remote_size < 0)
+            return false;
+        size = (uint64_t)remote_size;
+    }
+
+    if (!hints.progress && client->clientType() == CLIENT_TYPE_FTP)
+    {
+        FtpClient *ftp = (FtpClient *)client;
+        ftp_xfer = ftp->GetCallbackXferFunction();
+        ftp->SetCallbackXferFunction(nullptr);
+        ftp_paused = true;
+    }
+    return true;
+}
+
+bool RemoteReader::Handle()
+{
+    if (fp != nullptr)
+        return true;
+    if (!(client->SupportedActions() & REMOTE_ACTION_RAW_READ) || opened)
+        return false;
+    opened = true;
+    fp = client->Open(path, O_RDONLY);
+    if (fp == nullptr)
+        Logger::Logf(Logger::LOG_ERROR, "READER open failed path=%s err=%s", path.c_str(), client->LastResponse());
+    return fp != nullptr;
+}
+
+bool RemoteReader::Read(uint64_t offset, void *buffer, uint64_t length)
+{
+    if (length == 0)
+        return true;
+    if (Handle())
+        return client->GetRange(fp, buffer, length, offset) > 0;
+    if (client->SupportedActions() & REMOTE_ACTION_RAW_READ)
+        return false;
+    return client->GetRange(path, buffer, length, offset) > 0;
+}
+
+bool RemoteReader::ReadRanges(std::vector<RemoteRange> &ranges)
+{
+    if (ranges.empty())
+        return true;
+    if (!Handle())
+        return !(client->SupportedActions() & REMOTE_ACTION_RAW_READ) && client->GetRanges(path, ranges) > 0;
+    bool ok = true;
+    for (RemoteRange &range : ranges)
+    {
+        range.ok = client->GetRange(fp, range.buffer, range.size, range.offset) > 0;
+        ok = ok && range.ok;
+    }
+    return ok;
+}
+
+bool RemoteReader::StreamTo(ByteSink &sink)
+{
+    uint64_t offset = 0;
+    return client->GetStream(path, size, [&](const char *data, size_t length)
+                             {
+                                 if (!sink.WriteAt(offset, data, length))
+                                     return false;
+                                 offset += length;
+                                 return true;
+                             }) > 0 &&
+           offset == size;
+}
+
+std::unique_ptr<RemoteReader> RemoteClient::OpenRead(const std::string &path, const ReadHints &hints)
+{
+    std::unique_ptr<RemoteReader> reader(new RemoteReader(this, path, hints));
+    if (!reader->Open())
+        return nullptr;
+    return reader;
+}
@@ -0,0 +1,74 @@
+#ifndef NEO_REMOTE_READER_H
+#define NEO_REMOTE_READER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "clients/remote_client.h"
+#include "clients/ftpclient.h"
+#include "byte_sink.h"
+
+// What the caller knows before the first read.
+struct ReadHints
+{
+    // Size from the listing, -1 to ask the server.
+    int64_t size = -1;
+    // FTP reports reads to its transfer callback, which belongs to the
+    // download progress; it stays detached while the reader is open
+    // unless the reads are the download.
+    bool progress = false;
+};
+
+// One remote file opened for reading, the same way on every protocol:
+// positioned reads, batches of ranges in flight together, and the whole
+// file as one stream, each into a buffer or a ByteSink. Clients with
+// REMOTE_ACTION_RAW_READ (SFTP, SMB, NFS) read through a handle kept open
+// for the reader's life; the others name the path on each request, and
+// WebDAV/HTTP serve a batch as parallel ranged requests. Archive indexes
+// and extraction, package installs and libarchive all read this way, so
+// what one protocol does faster reaches them all. Get one from
+// RemoteClient::OpenRead(); not for use from two threads at once.
+class RemoteReader
+{
+public:
+    RemoteReader(RemoteClient *client, const std::string &path, const ReadHints &hints);
+    virtual ~RemoteReader();
+    RemoteReader(const RemoteReader &) = delete;
+    RemoteReader &operator=(const RemoteReader &) = delete;
+
+    // Learns the size when the hints did not give it. The handle is opened
+    // by the first Read() or ReadRanges(), so a reader only streamed never
+    // opens one next to GetStream()'s own.
+    virtual bool Open();
+
+    uint64_t Size() const { return size; }
+    const std::string &Path() const { return path; }
+    RemoteClient *Client() const { return client; }
+
+    // Exactly `size` bytes at `offset` into `buffer`.
+    virtual bool Read(uint64_t offset, void *buffer, uint64_t size);
+    // Every range into its buffer, setting its `ok`; in flight together
+    // where the protocol can (RemoteClient::GetRanges()), one after another
+    // through the handle otherwise. False when any failed.
+    virtual bool ReadRanges(std::vector<RemoteRange> &ranges);
+    // The whole file into `sink` in order, as one transfer where the
+    // protocol allows it (RemoteClient::GetStream()).
+    virtual bool StreamTo(ByteSink &sink);
+
+protected:
+    // `fp`, opened on first use; false when the client has no handles.
+    bool Handle();
+
+    RemoteClient *client;
+    std::string path;
+    ReadHints hints;
+    uint64_t size = 0;
+    void *fp = nullptr;
+    bool opened = false;
+    // The FTP transfer callback put aside while the reader is open.
+    FtpCallbackXfer ftp_xfer = nullptr;
+    bool ftp_paused = false;
+};
+
+#endif
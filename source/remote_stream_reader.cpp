@@ -0,0 +1,154 @@
+#include <string.h>
+#include <chrono>
+
+#include "remote_stream_reader.h"
+#include "config.h"
+#include "windows.h"
+#include "logger.h"
+#include "threads.h"
+#include "cancel.h"
+
+RemoteStreamReader::RemoteStreamReader(RemoteClient *client, const std::string &path, uint64_t size, size_t limit)
+    : client(client), path(path), size(size), limit(limit)
+{
+    if (this->limit == 0)
+        this->limit = (size_t)archive_cache_mb * 1024 * 1024;
+}
+
+RemoteStreamReader::~RemoteStreamReader()
+{
+    if (threadStarted)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        cv.notify_all();
+        Threads::Join(&thread);
+
+        Logger::Logf("ARCHIVE STREAM path=%s size=%llu received=%llu reader_waits=%llu fetch_waits=%llu failed=%d",
+                     path.c_str(), (unsigned long long)size, (unsigned long long)received,
+                     (unsigned long long)readerWaits, (unsigned long long)fetchWaits, failed ? 1 : 0);
+    }
+}
+
+bool RemoteStreamReader::Start()
+{
+    Result rc = Threads::Create(&thread, fetchThread, this, 0x10000, Threads::ROLE_DISK, "archive stream");
+    if (R_FAILED(rc))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "ARCHIVE STREAM threadCreate failed rc=0x%x path=%s", rc, path.c_str());
+        error = "threadCreate failed";
+        return false;
+    }
+    threadStart(&thread);
+    threadStarted = true;
+    return true;
+}
+
+bool RemoteStreamReader::StartFolderArchive()
+{
+    folder = true;
+    return Start();
+}
+
+ssize_t RemoteStreamReader::Read(const void **data)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // The reader is done with the previous buffer; it can go back to the
+    // pool and make room for the fetch thread.
+    current = Filled();
+
+    if (queue.empty() && !finished && !Cancel::Stopped())
+    {
+        readerWaits++;
+        // stop_activity is set from the UI without a notify, so poll it.
+        while (!cv.wait_for(lock, std::chrono::milliseconds(100), [this]
+                            { return !queue.empty() || finished || Cancel::Stopped(); }))
+            ;
+    }
+    if (queue.empty())
+        return failed || Cancel::Stopped() ? -1 : 0;
+
+    current = std::move(queue.front());
+    queue.pop_front();
+    queued -= current.size;
+    cv.notify_all();
+
+    *data = current.buffer.data();
+    return (ssize_t)current.size;
+}
+
+void RemoteStreamReader::fetchThread(void *arg)
+{
+    static_cast<RemoteStreamReader *>(arg)->fetchLoop();
+}
+
+void RemoteStreamReader::fetchLoop()
+{
+    auto on_data = [this](const char *data, size_t len)
+    { return onData(data, len); };
+    int ret = folder ? client->GetFolderArchive(path, on_data) : client->GetStream(path, size, on_data);
+    bool ok = ret > 0 && push();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ret < 0)
+    {
+        failed = true;
+        unsupported = true;
+    }
+    else if (!ok && !closing)
+    {
+        failed = true;
+        error = client->LastResponse();
+        Logger::Logf(Logger::LOG_ERROR, "ARCHIVE STREAM fetch failed path=%s received=%llu err=%s",
+                     path.c_str(), (unsigned long long)received, error.c_str());
+    }
+    finished = true;
+    cv.notify_all();
+}
+
+bool RemoteStreamReader::onData(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (!filling.buffer && !filling.buffer.Acquire(kBufferSize))
+            return false;
+
+        size_t take = kBufferSize - filling.size;
+        if (take > len)
+            take = len;
+        memcpy(filling.buffer.data() + filling.size, data, take);
+        filling.size += take;
+        data += take;
+        len -= take;
+        received += take;
+
+        if (filling.size == kBufferSize && !push())
+            return false;
+    }
+    return true;
+}
+
+bool RemoteStreamReader::push()
+{
+    if (filling.size == 0)
+        return true;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queued + filling.size > limit && !closing && !Cancel::Stopped())
+    {
+        fetchWaits++;
+        while (!cv.wait_for(lock, std::chrono::milliseconds(100), [this]
+                            { return queued + filling.size <= limit || closing || Cancel::Stopped(); }))
+            ;
+    }
+    if (closing || Cancel::Stopped())
+        return false;
+
+    queued += filling.size;
+    queue.push_back(std::move(filling));
+    filling = Filled();
+    cv.notify_all();
+    return true;
+}
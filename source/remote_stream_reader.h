@@ -0,0 +1,86 @@
+#ifndef NEO_REMOTE_STREAM_READER_H
+#define NEO_REMOTE_STREAM_READER_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <switch.h>
+
+#include "clients/remote_client.h"
+#include "buffer_pool.h"
+
+// Forward-only reader over one remote file, used to extract archives while
+// they download. A fetch thread runs client->GetStream() (a single GET on
+// HTTP clients) and packs the body into 1 MiB buffers queued for the
+// reader, holding at most archive_cache_mb MiB so a slow SD card throttles
+// the download instead of filling memory.
+class RemoteStreamReader
+{
+public:
+    static const size_t kBufferSize = 1024 * 1024;
+
+    // `limit` caps the queued bytes; 0 means archive_cache_mb.
+    RemoteStreamReader(RemoteClient *client, const std::string &path, uint64_t size, size_t limit = 0);
+    ~RemoteStreamReader();
+
+    // Starts the fetch thread.
+    bool Start();
+    // Starts it on the folder `path` as one server-built archive
+    // (RemoteClient::GetFolderArchive) instead of a file.
+    bool StartFolderArchive();
+
+    // Points `*data` at the next bytes of the file and returns their
+    // number. The pointer stays valid until the next Read(). Returns 0 at
+    // the end of the file and -1 when the transfer failed or the activity
+    // was cancelled.
+    ssize_t Read(const void **data);
+
+    // Reason the transfer failed, from the client.
+    const std::string &Error() const { return error; }
+    // Whether the server turned down the folder archive before sending
+    // anything.
+    bool Unsupported() const { return unsupported; }
+
+private:
+    struct Filled
+    {
+        TransferBuffer buffer;
+        size_t size = 0;
+    };
+
+    RemoteClient *client;
+    std::string path;
+    uint64_t size;
+    size_t limit;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Filled> queue;
+    size_t queued = 0;
+    bool finished = false;
+    bool failed = false;
+    bool closing = false;
+    bool folder = false;
+    bool unsupported = false;
+    std::string error;
+
+    // Buffer being filled on the fetch thread, and the one the reader holds.
+    Filled filling;
+    Filled current;
+
+    Thread thread;
+    bool threadStarted = false;
+
+    uint64_t received = 0;
+    uint64_t readerWaits = 0;
+    uint64_t fetchWaits = 0;
+
+    static void fetchThread(void *arg);
+    void fetchLoop();
+    bool onData(const char *data, size_t size);
+    bool push();
+};
+
+#endif
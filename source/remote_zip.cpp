@@ -0,0 +1,262 @@
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <switch.h>
+
+#include "remote_zip.h"
+#include "clients/ftpclient.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "folder_size.h"
+#include "fs.h"
+#include "lang.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+#include "windows.h"
+#include "zip_util.h"
+#include "zip_writer.h"
+#include "cancel.h"
+
+namespace
+{
+    const size_t kPieceSize = 1024 * 1024;
+
+    // The archive between the zipping thread and the upload.
+    class ZipStream
+    {
+    public:
+        ZipStream(const std::vector<DirEntry> &files, size_t limit) : files(files), limit(limit) {}
+        ~ZipStream() { Stop(); }
+
+        bool Start()
+        {
+            Result rc = Threads::Create(&thread, producerThread, this, 0x40000, Threads::ROLE_DISK, "remote zip");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "REMOTE ZIP threadCreate failed rc=0x%x", rc);
+                error = "cannot start the zipping thread";
+                return false;
+            }
+            threadStart(&thread);
+            started = true;
+            return true;
+        }
+
+        // RemoteSourceFn of the upload.
+        int64_t Pull(char *buffer, size_t size)
+        {
+            if (sent == sending.size)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                sending = Piece();
+                sent = 0;
+                // stop_activity is polled, nobody notifies it.
+                while (pieces.empty() && !finished && !Cancel::Stopped())
+                    cv.wait_for(lock, std::chrono::milliseconds(100));
+                if (Cancel::Stopped() || (finished && !ok))
+                    return -1;
+                if (pieces.empty())
+                    return 0;
+                sending = std::move(pieces.front());
+                pieces.pop_front();
+                queued -= sending.size;
+                cv.notify_all();
+            }
+            size_t take = std::min(size, sending.size - sent);
+            memcpy(buffer, sending.buffer.data() + sent, take);
+            sent += take;
+            uploaded += take;
+            return (int64_t)take;
+        }
+
+        // Stops the zipping thread if the upload ended first.
+        void Stop()
+        {
+            if (!started)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            cv.notify_all();
+            Threads::Join(&thread);
+            started = false;
+        }
+
+        bool Started() const { return started; }
+        uint64_t Uploaded() const { return uploaded; }
+        const std::string &Error() const { return error; }
+
+    private:
+        struct Piece
+        {
+            TransferBuffer buffer;
+            size_t size = 0;
+        };
+
+        const std::vector<DirEntry> &files;
+        size_t limit;
+        Thread thread;
+        bool started = false;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Piece> pieces;
+        size_t queued = 0;
+        bool finished = false;
+        bool ok = false;
+        // The upload is over; the zipping thread gives up.
+        bool closed = false;
+        std::string error;
+
+        // Owned by the zipping thread and the upload respectively.
+        Piece filling;
+        Piece sending;
+        size_t sent = 0;
+        uint64_t uploaded = 0;
+
+        static void producerThread(void *arg)
+        {
+            static_cast<ZipStream *>(arg)->produce();
+        }
+
+        void produce()
+        {
+            ZipWriter zip([this](const void *data, size_t size)
+                          { return write(data, size); },
+                          zip_workers);
+            bool done = zip.Open() && ZipUtil::ZipAddEntries(zip, files) > 0 && !Cancel::Stopped() && zip.Close() &&
+                        (filling.size == 0 || queue());
+            if (!done)
+                zip.Abort();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!done && error.empty())
+                error = zip.Error().empty() ? lang_strings[STR_ERROR_CREATE_ZIP] : zip.Error();
+            finished = true;
+            ok = done;
+            cv.notify_all();
+        }
+
+        bool write(const void *data, size_t size)
+        {
+            const char *from = static_cast<const char *>(data);
+            while (size > 0)
+            {
+                if (filling.size == 0 && !filling.buffer.Acquire(kPieceSize))
+                    return false;
+                size_t take = std::min(size, kPieceSize - filling.size);
+                memcpy(filling.buffer.data() + filling.size, from, take);
+                filling.size += take;
+                from += take;
+                size -= take;
+                if (filling.size == kPieceSize && !queue())
+                    return false;
+            }
+            return true;
+        }
+
+        // Hands `filling` to the upload, waiting while `limit` bytes wait.
+        bool queue()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (queued > 0 && queued + filling.size > limit && !closed && !Cancel::Stopped())
+                cv.wait_for(lock, std::chrono::milliseconds(100));
+            if (closed || Cancel::Stopped())
+                return false;
+            queued += filling.size;
+            pieces.push_back(std::move(filling));
+            filling = Piece();
+            cv.notify_all();
+            return true;
+        }
+    };
+
+    // The bytes to compress, for the progress bar; the upload counts the
+    // compressed bytes against it, so it ends short of full.
+    int64_t SelectionSize(const std::vector<DirEntry> &files)
+    {
+        int64_t total = 0;
+        for (const DirEntry &file : files)
+        {
+            if (!file.isDir)
+            {
+                total += file.file_size;
+                continue;
+            }
+            FolderSize::Totals totals;
+            if (!FolderSize::Lookup(FolderSize::Key("", file.path), totals))
+            {
+                FolderSize::Progress progress;
+                if (FolderSize::Local(file.path, folder_size_workers, progress))
+                    FolderSize::Store(FolderSize::Key("", file.path), progress.Snapshot());
+                totals = progress.Snapshot();
+            }
+            total += totals.bytes;
+        }
+        return total;
+    }
+
+    int Spool(RemoteClient *client, const std::vector<DirEntry> &files, const std::string &dest,
+              std::string &error)
+    {
+        ZipWriter zip(TMP_REMOTE_ZIP_FILE, zip_workers);
+        if (!zip.Open() || ZipUtil::ZipAddEntries(zip, files) <= 0 || Cancel::Stopped() || !zip.Close())
+        {
+            error = zip.Error().empty() ? lang_strings[STR_ERROR_CREATE_ZIP] : zip.Error();
+            zip.Abort();
+            return 0;
+        }
+        int ret = client->Put(TMP_REMOTE_ZIP_FILE, dest);
+        if (ret <= 0)
+            error = client->LastResponse();
+        FS::Rm(TMP_REMOTE_ZIP_FILE);
+        return ret > 0 ? 1 : 0;
+    }
+}
+
+int RemoteZip::Create(RemoteClient *client, const std::vector<DirEntry> &files, const std::string &dest,
+                      std::string &error)
+{
+    uint64_t start = Util::GetTick();
+    ZipStream stream(files, (size_t)site_copy_buffer_mb * 1024 * 1024);
+
+    // Zipping starts with the first pull, so a client that turns the
+    // stream down has cost nothing.
+    bool pulled = false;
+    RemoteSourceFn source = [&](char *buffer, size_t len) -> int64_t
+    {
+        if (!pulled)
+        {
+            pulled = true;
+            if (!stream.Start())
+                return -1;
+            bytes_to_download = SelectionSize(files);
+        }
+        return stream.Pull(buffer, len);
+    };
+
+    int ret = client->PutStream(dest, REMOTE_SIZE_UNKNOWN, source);
+    stream.Stop();
+    const char *mode = "stream";
+    if (ret < 0 && !pulled)
+    {
+        mode = "spool";
+        ret = Spool(client, files, dest, error);
+    }
+    else if (ret <= 0)
+    {
+        error = !stream.Error().empty() ? stream.Error() : client->LastResponse();
+        client->Delete(dest);
+    }
+
+    double secs = (Util::GetTick() - start) / 1000000.0;
+    Logger::Logf("REMOTE ZIP dest=%s files=%d bytes=%llu ms=%.0f mib_s=%.2f mode=%s ok=%d", dest.c_str(),
+                 (int)files.size(), (unsigned long long)stream.Uploaded(), secs * 1000.0,
+                 secs > 0.0 ? stream.Uploaded() / secs / 1048576.0 : 0.0, mode, ret > 0 ? 1 : 0);
+    return ret > 0 ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef NEO_REMOTE_ZIP_H
+#define NEO_REMOTE_ZIP_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "clients/remote_client.h"
+
+// Creates a zip of local files straight on a remote site. A zipping thread
+// runs ZipWriter in its streaming mode (compression on zip_workers threads)
+// into pool buffers, at most site_copy_buffer_mb MiB, while the calling
+// thread uploads them with the client's PutStream() of unknown size: one
+// chunked PUT on WebDAV, the write pipeline on SFTP, a plain data
+// connection on FTP. Compression and upload overlap and nothing is written
+// to the SD card; a site that cannot upload from a stream (SMB) gets the zip
+// through TMP_REMOTE_ZIP_FILE instead.
+namespace RemoteZip
+{
+    // Zips `files` (entries of one local folder, named relative to it) into
+    // `dest` on `client`. Returns 1 on success, 0 with `error` set; an
+    // unfinished upload is deleted.
+    int Create(RemoteClient *client, const std::vector<DirEntry> &files, const std::string &dest,
+               std::string &error);
+}
+
+#endif
@@ -0,0 +1,533 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "resolver.h"
+#include "config.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    // The system resolver gets this long before Resolve() gives up on it.
+    const int kSystemTimeoutMs = 10000;
+    // How long the public servers get to answer.
+    const int kQueryTimeoutMs = 2000;
+
+    struct Entry
+    {
+        struct sockaddr_storage addr;
+        socklen_t len;
+        uint64_t expires;
+    };
+
+    // One getaddrinfo() on the lookup thread, shared by every Resolve()
+    // of the same host while it runs.
+    struct Lookup
+    {
+        std::string host;
+        bool done = false;
+        bool ok = false;
+        struct sockaddr_storage addr;
+        socklen_t len = 0;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, Entry> entries;
+    std::map<std::string, std::shared_ptr<Lookup>> in_flight;
+    std::deque<std::shared_ptr<Lookup>> queue;
+    Thread lookup_thread;
+    bool lookup_thread_started = false;
+    bool stopping = false;
+
+    void SetPort(struct sockaddr_storage *addr, int port)
+    {
+        if (addr->ss_family == AF_INET)
+            ((struct sockaddr_in *)addr)->sin_port = htons(port);
+        else if (addr->ss_family == AF_INET6)
+            ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+    }
+
+    bool Numeric(const std::string &host, struct sockaddr_storage *out, socklen_t *out_len)
+    {
+        memset(out, 0, sizeof(*out));
+        struct sockaddr_in *sa = (struct sockaddr_in *)out;
+        if (inet_pton(AF_INET, host.c_str(), &sa->sin_addr) == 1)
+        {
+            sa->sin_family = AF_INET;
+            *out_len = sizeof(struct sockaddr_in);
+            return true;
+        }
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)out;
+        if (inet_pton(AF_INET6, host.c_str(), &sa6->sin6_addr) == 1)
+        {
+            sa6->sin6_family = AF_INET6;
+            *out_len = sizeof(struct sockaddr_in6);
+            return true;
+        }
+        return false;
+    }
+
+    // getaddrinfo(), IPv4 results first.
+    bool SystemResolve(const std::string &host, struct sockaddr_storage *out, socklen_t *out_len)
+    {
+        struct addrinfo hints;
+        struct addrinfo *res = nullptr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || res == nullptr)
+        {
+            if (res)
+                freeaddrinfo(res);
+            return false;
+        }
+
+        struct addrinfo *chosen = nullptr;
+        for (struct addrinfo *p = res; p != nullptr && chosen == nullptr; p = p->ai_next)
+        {
+            if (p->ai_family == AF_INET)
+                chosen = p;
+        }
+        for (struct addrinfo *p = res; p != nullptr && chosen == nullptr; p = p->ai_next)
+        {
+            if (p->ai_family == AF_INET6)
+                chosen = p;
+        }
+        bool ok = chosen != nullptr && chosen->ai_addrlen <= sizeof(*out);
+        if (ok)
+        {
+            memset(out, 0, sizeof(*out));
+            memcpy(out, chosen->ai_addr, chosen->ai_addrlen);
+            *out_len = (socklen_t)chosen->ai_addrlen;
+        }
+        freeaddrinfo(res);
+        return ok;
+    }
+
+    void LookupThread(void *arg)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [] { return stopping || !queue.empty(); });
+            if (stopping)
+                break;
+            std::shared_ptr<Lookup> lookup = queue.front();
+            queue.pop_front();
+
+            lock.unlock();
+            struct sockaddr_storage addr;
+            socklen_t len = 0;
+            bool ok = SystemResolve(lookup->host, &addr, &len);
+            lock.lock();
+
+            lookup->ok = ok;
+            if (ok)
+            {
+                lookup->addr = addr;
+                lookup->len = len;
+            }
+            lookup->done = true;
+            auto it = in_flight.find(lookup->host);
+            if (it != in_flight.end() && it->second == lookup)
+                in_flight.erase(it);
+            cv.notify_all();
+        }
+    }
+
+    // The system lookup of `host`, joining one already running; nullptr
+    // when there is no lookup thread. Called with `mutex` held.
+    std::shared_ptr<Lookup> StartLookup(const std::string &host)
+    {
+        auto it = in_flight.find(host);
+        if (it != in_flight.end())
+            return it->second;
+        if (stopping)
+            return nullptr;
+        if (!lookup_thread_started)
+        {
+            if (R_FAILED(Threads::Create(&lookup_thread, LookupThread, nullptr, 0x20000, Threads::ROLE_NETWORK, "resolver")))
+                return nullptr;
+            lookup_thread_started = true;
+            threadStart(&lookup_thread);
+        }
+        std::shared_ptr<Lookup> lookup = std::make_shared<Lookup>();
+        lookup->host = host;
+        in_flight[host] = lookup;
+        queue.push_back(lookup);
+        cv.notify_all();
+        return lookup;
+    }
+
+    bool SkipDnsName(const unsigned char *buf, size_t len, size_t &offset)
+    {
+        while (offset < len)
+        {
+            unsigned char labellen = buf[offset];
+            if (labellen == 0)
+            {
+                offset += 1;
+                return true;
+            }
+            // Compression pointer: 11xxxxxx xxxxxxxx
+            if ((labellen & 0xC0) == 0xC0)
+            {
+                if (offset + 1 >= len)
+                    return false;
+                offset += 2;
+                return true;
+            }
+            offset += 1 + labellen;
+        }
+        return false;
+    }
+
+    // An A query for `host` with id `id`; 0 when the name does not fit.
+    size_t BuildQuery(const std::string &host, uint16_t id, unsigned char *buf, size_t size)
+    {
+        memset(buf, 0, size);
+        buf[0] = (id >> 8) & 0xFF;
+        buf[1] = id & 0xFF;
+        buf[2] = 0x01; // RD
+        buf[5] = 0x01; // QDCOUNT = 1
+
+        std::string h = host;
+        if (!h.empty() && h.back() == '.')
+            h.pop_back();
+
+        size_t offset = 12;
+        size_t start = 0;
+        while (start < h.size())
+        {
+            size_t dot = h.find('.', start);
+            if (dot == std::string::npos)
+                dot = h.size();
+            size_t labellen = dot - start;
+            if (labellen == 0 || labellen > 63 || offset + 1 + labellen >= size)
+                return 0;
+            buf[offset++] = (unsigned char)labellen;
+            memcpy(buf + offset, h.c_str() + start, labellen);
+            offset += labellen;
+            start = dot + 1;
+        }
+        // End of the name, then QTYPE=A, QCLASS=IN.
+        if (offset + 5 > size)
+            return 0;
+        buf[offset++] = 0;
+        buf[offset++] = 0;
+        buf[offset++] = 1;
+        buf[offset++] = 0;
+        buf[offset++] = 1;
+        return offset;
+    }
+
+    // The first A record of the reply to query `id`, with its TTL.
+    bool ParseAnswer(const unsigned char *buf, size_t len, uint16_t id, struct in_addr *out, uint32_t *ttl)
+    {
+        if (len < 12 || ((buf[0] << 8) | buf[1]) != id || (buf[3] & 0x0F) != 0)
+            return false;
+        uint16_t qdcount = (buf[4] << 8) | buf[5];
+        uint16_t ancount = (buf[6] << 8) | buf[7];
+        if (qdcount != 1 || ancount == 0)
+            return false;
+
+        size_t offset = 12;
+        if (!SkipDnsName(buf, len, offset) || offset + 4 > len)
+            return false;
+        // QTYPE/QCLASS
+        offset += 4;
+
+        for (uint32_t i = 0; i < ancount && offset < len; ++i)
+        {
+            if (!SkipDnsName(buf, len, offset) || offset + 10 > len)
+                return false;
+            uint16_t type = (buf[offset] << 8) | buf[offset + 1];
+            uint16_t clas = (buf[offset + 2] << 8) | buf[offset + 3];
+            uint32_t record_ttl = ((uint32_t)buf[offset + 4] << 24) | ((uint32_t)buf[offset + 5] << 16) |
+                                  ((uint32_t)buf[offset + 6] << 8) | buf[offset + 7];
+            uint16_t rdlength = (buf[offset + 8] << 8) | buf[offset + 9];
+            offset += 10;
+            if (offset + rdlength > len)
+                return false;
+            if (type == 1 && clas == 1 && rdlength == 4)
+            {
+                memcpy(out, buf + offset, 4);
+                *ttl = record_ttl;
+                return true;
+            }
+            offset += rdlength;
+        }
+        return false;
+    }
+
+    std::vector<std::string> Servers()
+    {
+        std::vector<std::string> out;
+        std::string list = dns_servers;
+        size_t start = 0;
+        while (start <= list.size())
+        {
+            size_t comma = list.find(',', start);
+            if (comma == std::string::npos)
+                comma = list.size();
+            std::string server = list.substr(start, comma - start);
+            server = Util::Trim(server, " ");
+            if (!server.empty())
+                out.push_back(server);
+            start = comma + 1;
+        }
+        return out;
+    }
+
+    // Asks every dns_servers address for `host` at once. Returns as soon
+    // as one answers or `lookup` (when set) succeeds, whichever is first;
+    // `via` names the winner.
+    bool QueryServers(const std::string &host, const std::shared_ptr<Lookup> &lookup, struct sockaddr_storage *out,
+                      socklen_t *out_len, uint32_t *ttl, const char **via)
+    {
+        std::vector<std::string> servers = Servers();
+        unsigned char query[512];
+        uint16_t id = (uint16_t)rand();
+        size_t query_len = BuildQuery(host, id, query, sizeof(query));
+        if (query_len == 0)
+            return false;
+
+        std::vector<struct pollfd> fds;
+        for (const std::string &server : servers)
+        {
+            struct sockaddr_in dns_addr;
+            memset(&dns_addr, 0, sizeof(dns_addr));
+            dns_addr.sin_family = AF_INET;
+            dns_addr.sin_port = htons(53);
+            if (inet_pton(AF_INET, server.c_str(), &dns_addr.sin_addr) != 1)
+                continue;
+            int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+            if (sockfd < 0)
+                continue;
+            if (sendto(sockfd, query, query_len, 0, (struct sockaddr *)&dns_addr, sizeof(dns_addr)) < 0)
+            {
+                close(sockfd);
+                continue;
+            }
+            struct pollfd pfd;
+            pfd.fd = sockfd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            fds.push_back(pfd);
+        }
+
+        bool ok = false;
+        size_t open = fds.size();
+        uint64_t deadline = Util::GetTick() + (uint64_t)kQueryTimeoutMs * 1000;
+        while (!ok && (open > 0 || lookup != nullptr))
+        {
+            uint64_t now = Util::GetTick();
+            if (now >= deadline)
+                break;
+            if (lookup != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (lookup->done && lookup->ok)
+                {
+                    memcpy(out, &lookup->addr, lookup->len);
+                    *out_len = lookup->len;
+                    *ttl = (uint32_t)dns_cache_seconds;
+                    *via = "system";
+                    ok = true;
+                    break;
+                }
+                if (lookup->done && open == 0)
+                    break;
+            }
+            // Short slices, so the system lookup is noticed when it wins.
+            int wait_ms = (int)std::min<uint64_t>((deadline - now) / 1000 + 1, 50);
+            if (open == 0)
+            {
+                svcSleepThread((uint64_t)wait_ms * 1000000);
+                continue;
+            }
+            if (poll(fds.data(), fds.size(), wait_ms) <= 0)
+                continue;
+            for (struct pollfd &pfd : fds)
+            {
+                if (pfd.fd < 0 || (pfd.revents & (POLLIN | POLLERR | POLLHUP)) == 0)
+                    continue;
+                unsigned char reply[512];
+                ssize_t got = recv(pfd.fd, reply, sizeof(reply), 0);
+                struct in_addr addr;
+                if (!ok && got > 0 && ParseAnswer(reply, (size_t)got, id, &addr, ttl))
+                {
+                    memset(out, 0, sizeof(*out));
+                    struct sockaddr_in *sa = (struct sockaddr_in *)out;
+                    sa->sin_family = AF_INET;
+                    sa->sin_addr = addr;
+                    *out_len = sizeof(struct sockaddr_in);
+                    *via = "servers";
+                    ok = true;
+                }
+                close(pfd.fd);
+                pfd.fd = -1;
+                open--;
+            }
+        }
+        for (struct pollfd &pfd : fds)
+        {
+            if (pfd.fd >= 0)
+                close(pfd.fd);
+        }
+        return ok;
+    }
+}
+
+namespace Resolver
+{
+    bool Resolve(const std::string &host, int port, struct sockaddr_storage *out, socklen_t *out_len)
+    {
+        if (Numeric(host, out, out_len))
+        {
+            SetPort(out, port);
+            return true;
+        }
+
+        uint64_t start = Util::GetTick();
+        std::shared_ptr<Lookup> lookup;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto it = entries.find(host);
+            if (it != entries.end() && Util::GetTick() < it->second.expires)
+            {
+                memcpy(out, &it->second.addr, it->second.len);
+                *out_len = it->second.len;
+                SetPort(out, port);
+                return true;
+            }
+            if (it != entries.end())
+                entries.erase(it);
+
+            // The system resolver's head start.
+            lookup = StartLookup(host);
+            if (lookup != nullptr)
+                cv.wait_for(lock, std::chrono::milliseconds(dns_race_ms), [&] { return lookup->done; });
+        }
+
+        struct sockaddr_storage addr;
+        socklen_t len = 0;
+        uint32_t ttl = (uint32_t)dns_cache_seconds;
+        const char *via = "system";
+        bool ok = false;
+        if (lookup == nullptr)
+        {
+            ok = SystemResolve(host, &addr, &len);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (lookup->done && lookup->ok)
+            {
+                addr = lookup->addr;
+                len = lookup->len;
+                ok = true;
+            }
+        }
+        if (!ok)
+            ok = QueryServers(host, lookup, &addr, &len, &ttl, &via);
+        if (!ok && lookup != nullptr)
+        {
+            // The public servers had nothing (a name only the local network
+            // knows, or no reply at all); the system lookup may still.
+            std::unique_lock<std::mutex> lock(mutex);
+            uint64_t waited_ms = (Util::GetTick() - start) / 1000;
+            if (waited_ms < (uint64_t)kSystemTimeoutMs)
+                cv.wait_for(lock, std::chrono::milliseconds(kSystemTimeoutMs - waited_ms), [&] { return lookup->done; });
+            if (lookup->done && lookup->ok)
+            {
+                addr = lookup->addr;
+                len = lookup->len;
+                via = "system";
+                ok = true;
+            }
+        }
+
+        Logger::Logf(Logger::LOG_DEBUG, "DNS host=%s ok=%d via=%s ms=%llu", host.c_str(), ok ? 1 : 0, via,
+                     (unsigned long long)((Util::GetTick() - start) / 1000));
+        if (!ok)
+            return false;
+
+        if (ttl > (uint32_t)dns_cache_seconds)
+            ttl = (uint32_t)dns_cache_seconds;
+        if (ttl > 0)
+        {
+            Entry entry;
+            entry.addr = addr;
+            entry.len = len;
+            entry.expires = Util::GetTick() + (uint64_t)ttl * 1000000;
+            std::lock_guard<std::mutex> lock(mutex);
+            entries[host] = entry;
+        }
+        memcpy(out, &addr, len);
+        *out_len = len;
+        SetPort(out, port);
+        return true;
+    }
+
+    bool ResolveText(const std::string &host, std::string &address)
+    {
+        struct sockaddr_storage addr;
+        socklen_t len = 0;
+        if (!Resolve(host, 0, &addr, &len))
+            return false;
+        char text[INET6_ADDRSTRLEN];
+        if (addr.ss_family == AF_INET6)
+        {
+            if (inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&addr)->sin6_addr, text, sizeof(text)) == nullptr)
+                return false;
+            address = std::string("[") + text + "]";
+            return true;
+        }
+        if (inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, text, sizeof(text)) == nullptr)
+            return false;
+        address = text;
+        return true;
+    }
+
+    void Forget(const std::string &host)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.erase(host);
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    void Exit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            cv.notify_all();
+        }
+        if (lookup_thread_started)
+        {
+            Threads::Join(&lookup_thread);
+            lookup_thread_started = false;
+        }
+    }
+}
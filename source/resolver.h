@@ -0,0 +1,30 @@
+#ifndef NEO_RESOLVER_H
+#define NEO_RESOLVER_H
+
+#include <string>
+#include <sys/socket.h>
+
+// Host name lookups for every client, cached for dns_cache_seconds (or the
+// record's TTL when shorter) so the worker sessions of a transfer and a
+// reconnect skip them. The system resolver is asked first, on a thread of
+// its own; when it has not answered within dns_race_ms, A queries go to
+// every dns_servers address at once and the first answer from either side
+// wins. Names only the local network knows still resolve, since public
+// servers have no answer for them. A host whose address stopped answering
+// is forgotten by the caller.
+namespace Resolver
+{
+    // Fills `out` with an address of `host` (IPv4 first) and `port`.
+    // Numeric addresses are taken as they are.
+    bool Resolve(const std::string &host, int port, struct sockaddr_storage *out, socklen_t *out_len);
+    // Resolve() as text, "[...]" around IPv6, for libcurl and libsmb2.
+    bool ResolveText(const std::string &host, std::string &address);
+
+    void Forget(const std::string &host);
+    // After a resume from sleep, which may have joined another network.
+    void Clear();
+    // Stops the system lookup thread; it may wait for a lookup in flight.
+    void Exit();
+}
+
+#endif
@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <switch.h>
+
+#include "sd_bench.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    const char *kTestFile = DATA_PATH "/sd_bench.tmp";
+    const char *kTestFile2 = DATA_PATH "/sd_bench2.tmp";
+    // Written per pass; enough to get past the card's cache.
+    const uint64_t kPassBytes = 32ULL * 1024 * 1024;
+    const size_t kMaxBlock = 4 * 1024 * 1024;
+    const size_t kScatterBlock = 1024 * 1024;
+    const int kRegions = 4;
+
+    std::mutex mutex;
+    Thread thread;
+    bool running = false;
+    bool joinable = false;
+    bool have_last = false;
+    SdBench::Result last;
+
+    bool WriteFully(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= (size_t)n;
+        }
+        return true;
+    }
+
+    // Open test files, preallocated as LocalFileSink does.
+    struct Files
+    {
+        int fds[2] = {-1, -1};
+        int count = 0;
+
+        bool Open(int files, uint64_t size, std::string &error)
+        {
+            const char *paths[2] = {kTestFile, kTestFile2};
+            for (count = 0; count < files; count++)
+            {
+                fds[count] = open(paths[count], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                if (fds[count] < 0 || ftruncate(fds[count], (off_t)size) != 0)
+                {
+                    error = std::string("cannot create ") + paths[count] + ": " + strerror(errno);
+                    if (fds[count] >= 0)
+                        count++;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        ~Files()
+        {
+            for (int i = 0; i < count; i++)
+                close(fds[i]);
+            FS::Rm(kTestFile);
+            FS::Rm(kTestFile2);
+        }
+    };
+
+    struct Pass
+    {
+        double mib_s = 0;
+        double max_write_ms = 0;
+        double fsync_ms = 0;
+    };
+
+    // Writes kPassBytes in `block` writes, the i-th one to the file and
+    // offset `place` picks, then syncs.
+    template <typename Place>
+    bool Run(Files &files, const char *data, size_t block, Place place, Pass &out, std::string &error)
+    {
+        uint64_t started = Util::GetTick();
+        uint64_t max_us = 0;
+        uint64_t writes = kPassBytes / block;
+        for (uint64_t i = 0; i < writes; i++)
+        {
+            int fd = -1;
+            uint64_t offset = 0;
+            place(i, fd, offset);
+            uint64_t t = Util::GetTick();
+            if (lseek(fd, (off_t)offset, SEEK_SET) < 0 || !WriteFully(fd, data, block))
+            {
+                error = std::string("write failed: ") + strerror(errno);
+                return false;
+            }
+            max_us = std::max(max_us, Util::GetTick() - t);
+        }
+        uint64_t synced = Util::GetTick();
+        for (int i = 0; i < files.count; i++)
+            fsync(files.fds[i]);
+        uint64_t now = Util::GetTick();
+        out.mib_s = kPassBytes / 1048576.0 / ((now - started) / 1000000.0);
+        out.max_write_ms = max_us / 1000.0;
+        out.fsync_ms = (now - synced) / 1000.0;
+        return true;
+    }
+
+    void Recommend(SdBench::Result &r)
+    {
+        // The smallest block within 5% of the best, as bigger ones only
+        // cost memory.
+        double best = *std::max_element(r.seq_mib_s, r.seq_mib_s + SdBench::kBlockSizes);
+        for (int i = 0; i < SdBench::kBlockSizes; i++)
+        {
+            if (r.seq_mib_s[i] >= best * 0.95)
+            {
+                r.rec_block_kb = r.block_kb[i];
+                break;
+            }
+        }
+
+        // How much scattered writes lose against 1 MiB sequential ones
+        // decides how much the reorder window is worth.
+        double seq = r.seq_mib_s[2];
+        double scattered = seq > 0 ? r.scattered_mib_s / seq : 1.0;
+        r.rec_reorder_mb = scattered < 0.75 ? 32 : scattered < 0.95 ? 16 : 4;
+
+        // A card that stalls for a while needs a deeper queue to keep the
+        // network side going; the window takes half of it at most.
+        double stall = *std::max_element(r.max_write_ms, r.max_write_ms + SdBench::kBlockSizes);
+        r.rec_queue_mb = std::max(stall > 200.0 ? 64 : 32, 2 * r.rec_reorder_mb);
+
+        // Two files at once on a card that thrashes between them is slower
+        // than one after the other.
+        double two = seq > 0 ? r.two_files_mib_s / seq : 1.0;
+        r.rec_parallel_files = two < 0.6 ? 1 : std::max(2, download_parallel_files);
+    }
+
+    void Measure(SdBench::Result &r)
+    {
+        uint64_t free_bytes = 0;
+        if (FS::FreeSpace(DATA_PATH, &free_bytes) && free_bytes < kPassBytes + (64ULL << 20))
+        {
+            r.error = "not enough free space";
+            return;
+        }
+        TransferBuffer buffer;
+        if (!buffer.Acquire(kMaxBlock))
+        {
+            r.error = "out of memory";
+            return;
+        }
+        // Not zeros, in case the card or its controller compresses.
+        for (size_t i = 0; i < kMaxBlock; i++)
+            buffer.data()[i] = (char)(i * 2654435761u >> 24);
+
+        for (int b = 0; b < SdBench::kBlockSizes; b++)
+        {
+            size_t block = (size_t)r.block_kb[b] * 1024;
+            Files files;
+            Pass pass;
+            if (!files.Open(1, kPassBytes, r.error) ||
+                !Run(files, buffer.data(), block, [&](uint64_t i, int &fd, uint64_t &offset)
+                     { fd = files.fds[0]; offset = i * block; },
+                     pass, r.error))
+                return;
+            r.seq_mib_s[b] = pass.mib_s;
+            r.max_write_ms[b] = pass.max_write_ms;
+            r.fsync_ms[b] = pass.fsync_ms;
+        }
+
+        {
+            // Write i goes to region i % kRegions, each filled in order.
+            uint64_t region = kPassBytes / kRegions;
+            Files files;
+            Pass pass;
+            if (!files.Open(1, kPassBytes, r.error) ||
+                !Run(files, buffer.data(), kScatterBlock, [&](uint64_t i, int &fd, uint64_t &offset)
+                     { fd = files.fds[0]; offset = (i % kRegions) * region + (i / kRegions) * kScatterBlock; },
+                     pass, r.error))
+                return;
+            r.scattered_mib_s = pass.mib_s;
+        }
+
+        {
+            Files files;
+            Pass pass;
+            if (!files.Open(2, kPassBytes / 2, r.error) ||
+                !Run(files, buffer.data(), kScatterBlock, [&](uint64_t i, int &fd, uint64_t &offset)
+                     { fd = files.fds[i % 2]; offset = (i / 2) * kScatterBlock; },
+                     pass, r.error))
+                return;
+            r.two_files_mib_s = pass.mib_s;
+        }
+
+        Recommend(r);
+        r.ok = true;
+    }
+
+    void BenchThread(void *)
+    {
+        SdBench::Result result;
+        Measure(result);
+        if (result.ok)
+            Logger::Logf("SD BENCH seq_mib_s=%.1f/%.1f/%.1f/%.1f max_write_ms=%.0f/%.0f/%.0f/%.0f fsync_ms=%.0f "
+                         "scattered_mib_s=%.1f two_files_mib_s=%.1f rec_block_kb=%d rec_reorder_mb=%d rec_queue_mb=%d "
+                         "rec_parallel_files=%d",
+                         result.seq_mib_s[0], result.seq_mib_s[1], result.seq_mib_s[2], result.seq_mib_s[3],
+                         result.max_write_ms[0], result.max_write_ms[1], result.max_write_ms[2], result.max_write_ms[3],
+                         result.fsync_ms[2], result.scattered_mib_s, result.two_files_mib_s, result.rec_block_kb,
+                         result.rec_reorder_mb, result.rec_queue_mb, result.rec_parallel_files);
+        else
+            Logger::Logf(Logger::LOG_ERROR, "SD BENCH failed err=%s", result.error.c_str());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        last = result;
+        have_last = true;
+        running = false;
+    }
+}
+
+namespace SdBench
+{
+    bool Start()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running)
+            return false;
+        if (joinable)
+        {
+            // Finished, so this does not wait.
+            Threads::Join(&thread);
+            joinable = false;
+        }
+        ::Result rc = Threads::Create(&thread, BenchThread, nullptr, 0x10000, Threads::ROLE_DISK, "sd bench");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "SD BENCH threadCreate failed rc=0x%x", rc);
+            return false;
+        }
+        threadStart(&thread);
+        running = true;
+        joinable = true;
+        return true;
+    }
+
+    bool Running()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running;
+    }
+
+    bool Last(Result &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!have_last)
+            return false;
+        out = last;
+        return true;
+    }
+
+    void Apply(const Result &result)
+    {
+        if (!result.ok)
+            return;
+        disk_block_kb = result.rec_block_kb;
+        disk_reorder_mb = result.rec_reorder_mb;
+        disk_queue_mb = result.rec_queue_mb;
+        download_parallel_files = result.rec_parallel_files;
+        CONFIG::SaveDiskTuning();
+        Logger::Logf("SD BENCH applied disk_block_kb=%d disk_reorder_mb=%d disk_queue_mb=%d download_parallel_files=%d",
+                     disk_block_kb, disk_reorder_mb, disk_queue_mb, download_parallel_files);
+    }
+
+    std::string Summary(const Result &r)
+    {
+        if (!r.ok)
+            return r.error;
+        char text[512];
+        snprintf(text, sizeof(text),
+                 "Sequential MiB/s: %.1f (64K) %.1f (256K) %.1f (1M) %.1f (4M)\n"
+                 "Slowest write %.0f ms, fsync %.0f ms\n"
+                 "Scattered %.1f MiB/s, two files %.1f MiB/s\n"
+                 "Block %d KiB, reorder %d MiB, queue %d MiB, files at once %d",
+                 r.seq_mib_s[0], r.seq_mib_s[1], r.seq_mib_s[2], r.seq_mib_s[3],
+                 *std::max_element(r.max_write_ms, r.max_write_ms + kBlockSizes), r.fsync_ms[2], r.scattered_mib_s,
+                 r.two_files_mib_s, r.rec_block_kb, r.rec_reorder_mb, r.rec_queue_mb, r.rec_parallel_files);
+        return text;
+    }
+}
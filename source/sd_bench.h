@@ -0,0 +1,52 @@
+#ifndef NEO_SD_BENCH_H
+#define NEO_SD_BENCH_H
+
+#include <string>
+
+// Write benchmark of the SD card, run from the settings dialog. Cards
+// differ by an order of magnitude (A1/A2, worn or fake ones), and on a fast
+// network the card is often what limits a download. Test files under
+// DATA_PATH are written the ways the downloads write them:
+//   - sequentially, at each block size a LocalSinkStream could use, with
+//     the time of the closing fsync;
+//   - as four interleaved regions of one file, like parallel ranges
+//     arriving without the reorder window;
+//   - as two files at once, like download_parallel_files.
+// From that it recommends disk_block_kb, disk_reorder_mb, disk_queue_mb and
+// download_parallel_files, which Apply() sets and saves.
+namespace SdBench
+{
+    static const int kBlockSizes = 4;
+
+    struct Result
+    {
+        bool ok = false;
+        std::string error;
+        // Sequential passes, by block size.
+        int block_kb[kBlockSizes] = {64, 256, 1024, 4096};
+        double seq_mib_s[kBlockSizes] = {0};
+        // Slowest single write() of each pass, and the closing fsync.
+        double max_write_ms[kBlockSizes] = {0};
+        double fsync_ms[kBlockSizes] = {0};
+        // 1 MiB writes of four interleaved regions, and of two files.
+        double scattered_mib_s = 0;
+        double two_files_mib_s = 0;
+
+        int rec_block_kb = 0;
+        int rec_reorder_mb = 0;
+        int rec_queue_mb = 0;
+        int rec_parallel_files = 0;
+    };
+
+    // Starts the benchmark on a disk thread; false while one is running.
+    bool Start();
+    bool Running();
+    // The last finished run, false before the first.
+    bool Last(Result &out);
+    // Sets the recommended knobs of `result` and saves them to the config.
+    void Apply(const Result &result);
+    // A few lines for the settings dialog.
+    std::string Summary(const Result &result);
+}
+
+#endif
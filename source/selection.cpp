@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <string.h>
+#include <unordered_set>
+
+#include "selection.h"
+
+bool Selection::parent(size_t row) const
+{
+    return row == 0 && !rows.empty() && strcmp(rows[0].name, "..") == 0;
+}
+
+void Selection::fit()
+{
+    bits.resize((rows.size() + 63) / 64, 0);
+}
+
+void Selection::recount()
+{
+    fit();
+    size_t tail = rows.size() % 64;
+    if (tail != 0)
+        bits.back() &= (UINT64_C(1) << tail) - 1;
+    if (parent(0))
+        bits[0] &= ~UINT64_C(1);
+    count = 0;
+    for (uint64_t word : bits)
+        count += (size_t)__builtin_popcountll(word);
+}
+
+void Selection::clear()
+{
+    // The words stay allocated for the next marks.
+    std::fill(bits.begin(), bits.end(), 0);
+    count = 0;
+    anchor = -1;
+}
+
+void Selection::Set(size_t row, bool on)
+{
+    if (row >= rows.size() || parent(row) || Has(row) == on)
+        return;
+    fit();
+    bits[row / 64] ^= UINT64_C(1) << (row % 64);
+    if (on)
+        count++;
+    else
+        count--;
+}
+
+void Selection::Toggle(size_t row)
+{
+    Set(row, !Has(row));
+    anchor = (int64_t)row;
+}
+
+bool Selection::Toggle(const char *name)
+{
+    int64_t row = find(name);
+    if (row < 0)
+        return false;
+    Toggle((size_t)row);
+    return true;
+}
+
+bool Selection::SelectTo(const char *name)
+{
+    int64_t row = find(name);
+    if (row < 0)
+        return false;
+    if (anchor < 0 || anchor >= (int64_t)rows.size())
+        Set((size_t)row, true);
+    else
+        SelectRange((size_t)std::min(anchor, row), (size_t)std::max(anchor, row));
+    anchor = row;
+    return true;
+}
+
+void Selection::SelectAll()
+{
+    fit();
+    std::fill(bits.begin(), bits.end(), ~UINT64_C(0));
+    recount();
+}
+
+void Selection::Invert()
+{
+    fit();
+    for (uint64_t &word : bits)
+        word = ~word;
+    recount();
+}
+
+void Selection::SelectRange(size_t first, size_t last)
+{
+    if (rows.empty() || first > last || first >= rows.size())
+        return;
+    if (last >= rows.size())
+        last = rows.size() - 1;
+    fit();
+    size_t first_word = first / 64;
+    size_t last_word = last / 64;
+    uint64_t head = ~UINT64_C(0) << (first % 64);
+    uint64_t tail = last % 64 == 63 ? ~UINT64_C(0) : (UINT64_C(1) << (last % 64 + 1)) - 1;
+    if (first_word == last_word)
+        bits[first_word] |= head & tail;
+    else
+    {
+        bits[first_word] |= head;
+        std::fill(bits.begin() + first_word + 1, bits.begin() + last_word, ~UINT64_C(0));
+        bits[last_word] |= tail;
+    }
+    recount();
+}
+
+std::vector<DirEntry> Selection::Entries() const
+{
+    std::vector<DirEntry> entries;
+    entries.reserve(count);
+    ForEach([&](const DirEntry &entry)
+            { entries.push_back(entry); });
+    return entries;
+}
+
+Selection::Marks Selection::Save() const
+{
+    Marks marks;
+    marks.reserve(count);
+    ForEach([&](const DirEntry &entry)
+            { marks.emplace_back(entry.name); });
+    return marks;
+}
+
+void Selection::Restore(const Marks &marks)
+{
+    clear();
+    if (marks.empty())
+        return;
+    fit();
+    std::unordered_set<std::string> names(marks.begin(), marks.end());
+    for (size_t row = 0; row < rows.size(); row++)
+    {
+        if (names.count(rows[row].name) != 0)
+            bits[row / 64] |= UINT64_C(1) << (row % 64);
+    }
+    recount();
+}
+
+int64_t Selection::find(const char *name) const
+{
+    for (size_t row = 0; row < rows.size(); row++)
+    {
+        if (strcmp(rows[row].name, name) == 0)
+            return (int64_t)row;
+    }
+    return -1;
+}
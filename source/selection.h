@@ -0,0 +1,92 @@
+#ifndef NEO_SELECTION_H
+#define NEO_SELECTION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// The rows of a pane marked for an operation, one bit per row of the
+// listing on screen (local_files, remote_files) instead of a copy of each
+// marked DirEntry: marking every row of a 50,000-entry folder, inverting
+// the marks or marking a range touches a word per 64 rows, and nothing
+// is copied until an operation asks for its entries (Entries()). ".." is
+// never marked.
+//
+// Bits follow row numbers, so code that replaces the rows clears the
+// marks first, as a new folder or filter always did, and code that only
+// rearranges them (a merge, a re-sort) carries the marks over by name with
+// Save() and Restore(). Rows appended (a listing streaming in) start
+// unmarked. Used from the UI thread, and from an operation's thread while
+// the activity dialog holds the panes still.
+class Selection
+{
+public:
+    // The names marked before the rows were rearranged.
+    typedef std::vector<std::string> Marks;
+
+    explicit Selection(const std::vector<DirEntry> &rows) : rows(rows) {}
+
+    // Marked rows.
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear();
+
+    bool Has(size_t row) const
+    {
+        return row / 64 < bits.size() && (bits[row / 64] >> (row % 64) & 1) != 0;
+    }
+    void Set(size_t row, bool on);
+    // Flips the mark of `row` and makes it the anchor of SelectTo().
+    void Toggle(size_t row);
+    // Toggle() of the row named `name`; false when there is none.
+    bool Toggle(const char *name);
+    // Marks the rows from the anchor to the one named `name`, both ends
+    // included; just that one without an anchor.
+    bool SelectTo(const char *name);
+    void SelectAll();
+    void Invert();
+    // Marks rows `first` to `last`, both included.
+    void SelectRange(size_t first, size_t last);
+
+    // Copies of the marked rows, in row order.
+    std::vector<DirEntry> Entries() const;
+    // Calls `fn` with each marked row, in row order.
+    template <typename Fn>
+    void ForEach(Fn fn) const
+    {
+        for (size_t word = 0; word < bits.size(); word++)
+        {
+            uint64_t set = bits[word];
+            while (set != 0)
+            {
+                size_t row = word * 64 + (size_t)__builtin_ctzll(set);
+                set &= set - 1;
+                if (row < rows.size())
+                    fn(rows[row]);
+            }
+        }
+    }
+
+    Marks Save() const;
+    // Marks the rows named in `marks`, dropping the other marks.
+    void Restore(const Marks &marks);
+
+private:
+    const std::vector<DirEntry> &rows;
+    std::vector<uint64_t> bits;
+    size_t count = 0;
+    // Row last toggled, -1 for none.
+    int64_t anchor = -1;
+
+    // Whether `row` is "..", which is listed first when present.
+    bool parent(size_t row) const;
+    // Sizes the words to the rows, keeping the marks.
+    void fit();
+    // Clears the bits past the last row and of "..", and counts the rest.
+    void recount();
+    int64_t find(const char *name) const;
+};
+
+#endif
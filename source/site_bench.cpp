@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <mutex>
+
+#include "site_bench.h"
+#include "config.h"
+#include "fs.h"
+#include "lang.h"
+#include "logger.h"
+#include "metrics.h"
+#include "util.h"
+#include "windows.h"
+#include "cancel.h"
+
+namespace
+{
+    const char *kScratchFile = DATA_PATH "/site_bench.tmp";
+
+    std::mutex mutex;
+    bool have_last = false;
+    SiteBench::Result last;
+}
+
+namespace SiteBench
+{
+    std::vector<Point> Sweep(ClientType type)
+    {
+        std::vector<Point> points;
+        if (type == CLIENT_TYPE_WEBDAV || type == CLIENT_TYPE_HTTP_SERVER)
+        {
+            for (int chunk_mb : {1, 2, 4, 8})
+            {
+                for (int workers : {1, 2, 4, 8})
+                {
+                    Point point;
+                    point.workers = workers;
+                    point.chunk_kb = chunk_mb * 1024;
+                    points.push_back(point);
+                }
+            }
+        }
+        else if (type == CLIENT_TYPE_SFTP)
+        {
+            for (int depth : {8, 16, 32, 64})
+            {
+                Point point;
+                point.workers = depth;
+                point.chunk_kb = sftp_request_kb;
+                points.push_back(point);
+            }
+        }
+        return points;
+    }
+
+    void Run(RemoteClient *client, const DirEntry &file, Result &out,
+             const std::function<void(int index, int count, const Point &point)> &progress)
+    {
+        out = Result();
+        out.path = file.path;
+        out.type = client->clientType();
+        out.points = Sweep(out.type);
+        out.iface = NetIface::Query();
+        out.bytes = std::min<uint64_t>((uint64_t)file.file_size, (uint64_t)site_bench_mb * 1024 * 1024);
+
+        for (size_t i = 0; i < out.points.size() && !Cancel::Stopped(); i++)
+        {
+            Point &point = out.points[i];
+            progress((int)i, (int)out.points.size(), point);
+            Metrics::Snapshot before, after;
+            Metrics::Read(before);
+            uint64_t started = Util::GetTick();
+            int ret = client->BenchRead(file.path, out.bytes, point.workers, point.chunk_kb, kScratchFile);
+            uint64_t elapsed = Util::GetTick() - started;
+            Metrics::Read(after);
+            if (ret < 0)
+            {
+                out.error = lang_strings[STR_UNSUPPORTED_OPERATION_MSG];
+                break;
+            }
+            point.ok = ret > 0 && elapsed > 0;
+            point.mib_s = point.ok ? out.bytes / 1048576.0 / (elapsed / 1000000.0) : 0;
+            point.requests = after.counters[Metrics::COUNTER_REQUESTS] - before.counters[Metrics::COUNTER_REQUESTS];
+            point.retries = after.counters[Metrics::COUNTER_RETRIES] - before.counters[Metrics::COUNTER_RETRIES];
+            Logger::Logf("SITE BENCH path=%s iface=%s signal=%d point=%s ok=%d mib_s=%.2f requests=%lld retries=%lld",
+                         out.path.c_str(), NetIface::Name(out.iface.type), out.iface.signal,
+                         Label(out.type, point).c_str(), point.ok ? 1 : 0, point.mib_s, (long long)point.requests,
+                         (long long)point.retries);
+        }
+        FS::Rm(kScratchFile);
+
+        // Fewer connections and smaller ranges within 5% of the fastest are
+        // kinder to the server and to a cancel; the sweep lists them first.
+        // Points that needed retries were pushing the server too hard, and
+        // only count when all of them did.
+        double fastest = 0;
+        for (const Point &point : out.points)
+            fastest = std::max(fastest, point.mib_s);
+        for (int pass = 0; pass < 2 && out.best < 0 && fastest > 0; pass++)
+        {
+            for (size_t i = 0; i < out.points.size(); i++)
+            {
+                const Point &point = out.points[i];
+                if (point.ok && (pass == 1 || point.retries == 0) && point.mib_s >= fastest * 0.95 &&
+                    (out.best < 0 || point.workers < out.points[out.best].workers))
+                    out.best = (int)i;
+            }
+        }
+        out.ok = out.best >= 0 && !Cancel::Stopped();
+        if (!out.ok && out.error.empty())
+            out.error = client->LastResponse();
+    }
+
+    std::string Label(ClientType type, const Point &point)
+    {
+        char text[64];
+        if (type == CLIENT_TYPE_SFTP)
+            snprintf(text, sizeof(text), "depth %d", point.workers);
+        else
+            snprintf(text, sizeof(text), "%d x %d MiB", point.workers, point.chunk_kb / 1024);
+        return text;
+    }
+
+    void SetLast(const Result &result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        last = result;
+        have_last = true;
+    }
+
+    bool Last(Result &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!have_last)
+            return false;
+        out = last;
+        return true;
+    }
+
+    void Apply(const Result &result, RemoteSettings *settings, const char *site)
+    {
+        if (!result.ok)
+            return;
+        const Point &best = result.points[result.best];
+        if (result.type == CLIENT_TYPE_SFTP)
+            settings->sftp_pipeline_depth = best.workers;
+        else
+        {
+            settings->webdav_chunk_mb = best.chunk_kb / 1024;
+            if (result.type == CLIENT_TYPE_WEBDAV)
+                settings->webdav_parallel = best.workers;
+            else
+                settings->http_parallel = best.workers;
+        }
+        CONFIG::SaveSiteBenchmark(site, settings);
+        CONFIG::ApplySiteProfile(settings);
+        Logger::Logf("SITE BENCH applied site=%s iface=%s point=%s mib_s=%.2f", site, NetIface::Name(result.iface.type),
+                     Label(result.type, best).c_str(), best.mib_s);
+    }
+}
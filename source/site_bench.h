@@ -0,0 +1,66 @@
+#ifndef NEO_SITE_BENCH_H
+#define NEO_SITE_BENCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "clients/remote_client.h"
+#include "common.h"
+#include "net_iface.h"
+
+struct RemoteSettings;
+
+// "Benchmark this site" of the connection panel. The first site_bench_mb
+// of a large remote file is downloaded once per point of a sweep through
+// the client's BenchRead() — the ranged engine on WebDAV/HTTP (range size
+// x ranges in flight), the read pipeline on SFTP (depth) — into a scratch
+// file, so each point costs what a real download would, disk included.
+// Requests and retries of each point come from the Metrics registry. The
+// fastest point, or a gentler one within 5% of it, can be saved as the
+// site's overrides (webdav_chunk_mb, webdav_parallel, http_parallel,
+// sftp_pipeline_depth), which replace the profile's from the next connect.
+namespace SiteBench
+{
+    struct Point
+    {
+        int workers = 0;
+        int chunk_kb = 0;
+        bool ok = false;
+        double mib_s = 0;
+        int64_t requests = 0;
+        int64_t retries = 0;
+    };
+
+    struct Result
+    {
+        bool ok = false;
+        std::string error;
+        std::string path;
+        ClientType type = CLINET_TYPE_UNKNOWN;
+        uint64_t bytes = 0;
+        // The link it was measured on.
+        NetIface::State iface;
+        std::vector<Point> points;
+        // Index into `points` of the recommendation, -1 when none worked.
+        int best = -1;
+    };
+
+    // The points measured for `type`; empty when it has none.
+    std::vector<Point> Sweep(ClientType type);
+    // Measures every point on `client` with `file`; `progress` is called
+    // before each one. Stops early with stop_activity.
+    void Run(RemoteClient *client, const DirEntry &file, Result &out,
+             const std::function<void(int index, int count, const Point &point)> &progress);
+    // "4 x 8 MiB" or "depth 32", as the dialog lists the points.
+    std::string Label(ClientType type, const Point &point);
+
+    // The result the dialog shows, kept until the next run.
+    void SetLast(const Result &result);
+    bool Last(Result &out);
+    // Writes the recommended point into the overrides of `settings`,
+    // saves them for `site` and applies them to the session.
+    void Apply(const Result &result, RemoteSettings *settings, const char *site);
+}
+
+#endif
@@ -0,0 +1,401 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <switch.h>
+#include <libssh2.h>
+
+#include "clients/webdav.h"
+#include "httpclient/HTTPClient.h"
+#include "site_probe.h"
+#include "config.h"
+#include "host_caps.h"
+#include "logger.h"
+#include "resolver.h"
+#include "socket_tuning.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    static const int kMaxWorkers = 8;
+    // Past this an SFTP, FTP, SMB or NFS site counts as unreachable;
+    // WebDAV/HTTP get CHTTPClient's connect timeout.
+    static const int kTimeoutMs = 4000;
+    // How long a finished round is shown before the next Start() redoes it.
+    static const uint64_t kFreshUs = 60ULL * 1000000;
+
+    struct Job
+    {
+        std::string site;
+        std::string server;
+        std::string username;
+        std::string password;
+        ClientType type;
+        HostCaps::Caps caps;
+    };
+
+    struct Entry
+    {
+        std::string server;
+        SiteProbe::Result result;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Entry> results;
+    std::vector<Job> jobs;
+    size_t next_job = 0;
+    Thread threads[kMaxWorkers];
+    int thread_count = 0;
+    std::atomic<int> running{0};
+    uint64_t finished_at = 0;
+    bool stopping = false;
+
+    // scheme://[user@]host[:port][/...] of `server`, brackets off an IPv6
+    // host; `port` stays as it is without one.
+    bool HostPort(const std::string &server, std::string &host, int &port)
+    {
+        size_t scheme = server.find("://");
+        size_t start = (scheme == std::string::npos) ? 0 : scheme + 3;
+        size_t end = server.find_first_of("/?#", start);
+        std::string authority = server.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t at = authority.rfind('@');
+        if (at != std::string::npos)
+            authority.erase(0, at + 1);
+        size_t colon = std::string::npos;
+        if (!authority.empty() && authority[0] == '[')
+        {
+            size_t close = authority.find(']');
+            if (close == std::string::npos)
+                return false;
+            host = authority.substr(1, close - 1);
+            if (close + 1 < authority.size() && authority[close + 1] == ':')
+                colon = close + 1;
+        }
+        else
+        {
+            colon = authority.find(':');
+            host = authority.substr(0, colon);
+        }
+        if (colon != std::string::npos)
+        {
+            int value = atoi(authority.c_str() + colon + 1);
+            if (value > 0 && value < 65536)
+                port = value;
+        }
+        return !host.empty();
+    }
+
+    // Waits up to what is left of `deadline` for `events` on `fd`, waking
+    // every 100 ms to see whether Exit() was called.
+    bool Wait(int fd, short events, uint64_t deadline)
+    {
+        while (!stopping)
+        {
+            uint64_t now = Util::GetTick();
+            if (now >= deadline)
+                return false;
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = events;
+            pfd.revents = 0;
+            int slice = (int)std::min<uint64_t>((deadline - now) / 1000 + 1, 100);
+            int rc = poll(&pfd, 1, slice);
+            if (rc > 0)
+                return true;
+            if (rc < 0 && errno != EINTR)
+                return false;
+        }
+        return false;
+    }
+
+    // A connected, blocking socket to `host`, -1 when it does not answer
+    // within kTimeoutMs; `connect_us` is what the handshake took.
+    int Connect(const std::string &host, int port, const std::string &tune_host, int64_t &connect_us)
+    {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!Resolver::Resolve(host, port, &addr, &addr_len))
+            return -1;
+        int s = socket(((struct sockaddr *)&addr)->sa_family, SOCK_STREAM, 0);
+        if (s < 0)
+            return -1;
+        SocketTuning::Apply(s, tune_host);
+        int flag = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        int flags = fcntl(s, F_GETFL, 0);
+        fcntl(s, F_SETFL, flags | O_NONBLOCK);
+
+        uint64_t start = Util::GetTick();
+        int rc = connect(s, (struct sockaddr *)&addr, addr_len);
+        if (rc != 0 && errno == EINPROGRESS)
+        {
+            int error = ETIMEDOUT;
+            socklen_t len = sizeof(error);
+            if (Wait(s, POLLOUT, start + kTimeoutMs * 1000ULL))
+                getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &len);
+            rc = error == 0 ? 0 : -1;
+        }
+        if (rc != 0)
+        {
+            close(s);
+            return -1;
+        }
+        connect_us = (int64_t)(Util::GetTick() - start);
+        SocketTuning::ObserveRtt(tune_host, (uint64_t)connect_us);
+        fcntl(s, F_SETFL, flags & ~O_NONBLOCK);
+        return s;
+    }
+
+    void ProbeSsh(const Job &job, SiteProbe::Result &result)
+    {
+        std::string host;
+        int port = 22;
+        if (!HostPort(job.server, host, port))
+            return;
+        int s = Connect(host, port, SocketTuning::HostOf(job.server), result.connect_us);
+        if (s < 0)
+            return;
+        LIBSSH2_SESSION *sess = libssh2_session_init();
+        if (sess != nullptr)
+        {
+            libssh2_session_set_blocking(sess, 1);
+            libssh2_session_set_timeout(sess, kTimeoutMs);
+            // The key exchange is the handshake a login waits for; the
+            // banner it starts with is the server's first byte.
+            uint64_t start = Util::GetTick();
+            if (libssh2_session_handshake(sess, s) == 0)
+            {
+                result.handshake_us = (int64_t)(Util::GetTick() - start);
+                result.ok = true;
+                libssh2_session_disconnect(sess, "probe");
+            }
+            libssh2_session_free(sess);
+        }
+        close(s);
+    }
+
+    void ProbeFtp(const Job &job, SiteProbe::Result &result)
+    {
+        std::string host;
+        int port = 21;
+        if (!HostPort(job.server, host, port))
+            return;
+        int s = Connect(host, port, SocketTuning::HostOf(job.server), result.connect_us);
+        if (s < 0)
+            return;
+        uint64_t start = Util::GetTick();
+        char banner[4];
+        if (Wait(s, POLLIN, start + kTimeoutMs * 1000ULL) && recv(s, banner, sizeof(banner), 0) > 0)
+        {
+            result.first_byte_us = (int64_t)(Util::GetTick() - start);
+            result.ok = banner[0] == '2';
+        }
+        // Leaving without QUIT; servers log it like any dropped client.
+        close(s);
+    }
+
+    void ProbeTcp(const Job &job, int port, SiteProbe::Result &result)
+    {
+        std::string host;
+        if (!HostPort(job.server, host, port))
+            return;
+        int s = Connect(host, port, SocketTuning::HostOf(job.server), result.connect_us);
+        if (s < 0)
+            return;
+        result.ok = true;
+        close(s);
+    }
+
+    void ProbeHttp(const Job &job, SiteProbe::Result &result)
+    {
+        std::string url = WebDAVClient::GetHttpUrl(job.server);
+        // What the site's client will learn on top of, seeded early so
+        // the HEAD adds to it rather than starting over.
+        HostCaps::Seed(url, job.caps);
+
+        CHTTPClient http([](const std::string &) {});
+        http.SetBasicAuth(job.username, job.password);
+        http.InitSession(false, CHTTPClient::SettingsFlag::NO_FLAGS);
+        http.SetCertificateFile(CACERT_FILE);
+        http.SetCancelFlag(&stopping);
+        CHTTPClient::HttpResponse res;
+        if (!http.Head(url, {}, res))
+            return;
+        // Any answer, a 401 or a 405 included, means the server is there.
+        result.ok = res.iCode > 0;
+        int64_t connect_us = 0, tls_us = 0, first_byte_us = 0;
+        long version = 0;
+        http.LastTimings(connect_us, tls_us, first_byte_us, version);
+        result.connect_us = connect_us;
+        if (url.compare(0, 8, "https://") == 0)
+        {
+            result.handshake_us = tls_us;
+            // libcurl offers h2 over TLS only, so plain http:// says nothing.
+            HostCaps::Learn(url, &HostCaps::Caps::http2, version >= CURL_HTTP_VERSION_2_0 ? 1 : 0);
+        }
+        result.first_byte_us = first_byte_us;
+    }
+
+    SiteProbe::Result Probe(const Job &job)
+    {
+        SiteProbe::Result result;
+        uint64_t start = Util::GetTick();
+        switch (job.type)
+        {
+        case CLIENT_TYPE_SFTP:
+            ProbeSsh(job, result);
+            break;
+        case CLIENT_TYPE_FTP:
+            ProbeFtp(job, result);
+            break;
+        case CLIENT_TYPE_SMB:
+            ProbeTcp(job, 445, result);
+            break;
+        case CLIENT_TYPE_NFS:
+            ProbeTcp(job, 2049, result);
+            break;
+        case CLIENT_TYPE_WEBDAV:
+        case CLIENT_TYPE_HTTP_SERVER:
+            ProbeHttp(job, result);
+            break;
+        default:
+            break;
+        }
+        result.done = true;
+        Logger::Logf(Logger::LOG_DEBUG, "PROBE site=%s server=%s ok=%d connect_us=%lld handshake_us=%lld first_byte_us=%lld took_ms=%llu",
+                     job.site.c_str(), job.server.c_str(), result.ok ? 1 : 0, (long long)result.connect_us,
+                     (long long)result.handshake_us, (long long)result.first_byte_us,
+                     (unsigned long long)((Util::GetTick() - start) / 1000));
+        return result;
+    }
+
+    void Worker(void *)
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping || next_job >= jobs.size())
+                    break;
+                job = jobs[next_job++];
+            }
+            SiteProbe::Result result = Probe(job);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                break;
+            Entry &entry = results[job.site];
+            entry.server = job.server;
+            entry.result = result;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0)
+            finished_at = Util::GetTick();
+    }
+
+    // Called with the lock not held; waits for every thread of the last
+    // round, which have ended or been told to.
+    void JoinAll()
+    {
+        for (int i = 0; i < thread_count; i++)
+            Threads::Join(&threads[i]);
+        thread_count = 0;
+    }
+}
+
+namespace SiteProbe
+{
+    int64_t Result::Total() const
+    {
+        int64_t total = 0;
+        for (int64_t step : {connect_us, handshake_us, first_byte_us})
+        {
+            if (step > 0)
+                total += step;
+        }
+        return total;
+    }
+
+    void Start()
+    {
+        if (site_probe_workers <= 0 || sites.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (running > 0 || (finished_at != 0 && Util::GetTick() - finished_at < kFreshUs))
+                return;
+        }
+        JoinAll();
+
+        std::vector<Job> round;
+        for (const std::string &site : sites)
+        {
+            const RemoteSettings &settings = site_settings[site];
+            if (settings.server[0] == '\0')
+                continue;
+            Job job;
+            job.site = site;
+            job.server = settings.server;
+            job.username = settings.username;
+            job.password = settings.password;
+            job.type = settings.type;
+            job.caps = settings.caps;
+            round.push_back(job);
+        }
+        if (round.empty())
+            return;
+
+        int count = std::min<int>(std::min(site_probe_workers, kMaxWorkers), (int)round.size());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.swap(round);
+            next_job = 0;
+            stopping = false;
+            running = count;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            // mbedtls and libssh2 key exchanges want a roomy stack.
+            ::Result rc = Threads::Create(&threads[thread_count], Worker, nullptr, 0x40000, Threads::ROLE_BACKGROUND, "site-probe");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "PROBE threadCreate failed rc=0x%x", rc);
+                std::lock_guard<std::mutex> lock(mutex);
+                running -= count - i;
+                if (running == 0)
+                    finished_at = Util::GetTick();
+                break;
+            }
+            threadStart(&threads[thread_count++]);
+        }
+        Logger::Logf("PROBE start sites=%d workers=%d", (int)jobs.size(), thread_count);
+    }
+
+    bool Get(const std::string &site, const std::string &server, Result &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = results.find(site);
+        if (it == results.end() || it->second.server != server)
+            return false;
+        out = it->second.result;
+        return true;
+    }
+
+    void Exit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        JoinAll();
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef NEO_SITE_PROBE_H
+#define NEO_SITE_PROBE_H
+
+#include <cstdint>
+#include <string>
+
+// How far each saved site is right now, measured from the connection
+// panel so the LAN NAS, the Tailscale endpoint and a public mirror can be
+// told apart before connecting to one. site_probe_workers threads go over
+// the sites at once, each timing the TCP connect, the TLS or SSH handshake
+// and the first byte of an answer (an HTTP HEAD, the FTP banner); SMB and
+// NFS only connect. The DNS answers stay in the Resolver's cache, a HEAD's
+// connection and TLS session in the shared curl pool, the round trip in
+// SocketTuning and what the HEAD showed (HTTP/2, an Alt-Svc h3) in HostCaps,
+// so the connect that follows starts where the probe left off.
+namespace SiteProbe
+{
+    // Microseconds each step took, -1 for one the site's protocol does not
+    // have or that never finished.
+    struct Result
+    {
+        bool done = false;
+        bool ok = false;
+        int64_t connect_us = -1;
+        int64_t handshake_us = -1;
+        int64_t first_byte_us = -1;
+
+        // Connect to the last step measured, what a session waits before
+        // it can use the server.
+        int64_t Total() const;
+    };
+
+    // Probes every site on worker threads, unless site_probe_workers is 0,
+    // a round is still running or the last one ended under a minute ago.
+    // Call from the UI thread; it copies what it needs from site_settings.
+    void Start();
+    // The latest result for `site` if it was probed with the `server` it
+    // has now; false when there is none yet.
+    bool Get(const std::string &site, const std::string &server, Result &out);
+    // Stops the round in flight and waits for its threads.
+    void Exit();
+}
+
+#endif
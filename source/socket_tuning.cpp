@@ -0,0 +1,158 @@
+#include <sys/socket.h>
+#include <ctype.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <curl/curl.h>
+
+#include "socket_tuning.h"
+#include "config.h"
+#include "logger.h"
+
+namespace
+{
+    // Rates from less than this are mostly slow start.
+    const uint64_t kMinRateBytes = 256 * 1024;
+    const int kRound = 16 * 1024;
+
+    struct Link
+    {
+        // Smoothed handshake round trip, 0 until one was seen.
+        uint64_t rtt_us = 0;
+        // Best bytes a second one connection has reached.
+        double rate = 0;
+        // What BufferBytes() last logged.
+        int logged = 0;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Link> links;
+
+    int Size(const Link &link)
+    {
+        if (!socket_tuning || link.rtt_us == 0)
+            return SocketTuning::kDefaultBytes;
+        double link_rate = socket_link_mbps * 1000000.0 / 8;
+        double rate = link.rate > 0 ? std::min(link_rate, link.rate * 2) : link_rate;
+        double bytes = rate * link.rtt_us / 1000000.0;
+        int size = (int)std::min<double>(bytes, SocketTuning::kMaxBytes);
+        size = (size + kRound - 1) / kRound * kRound;
+        return std::max(SocketTuning::kMinBytes, std::min(SocketTuning::kMaxBytes, size));
+    }
+
+    int CurlSockopt(void *clientp, curl_socket_t fd, curlsocktype purpose)
+    {
+        if (purpose == CURLSOCKTYPE_IPCXN && clientp != nullptr)
+            SocketTuning::Apply((int)fd, *static_cast<const std::string *>(clientp));
+        return CURL_SOCKOPT_OK;
+    }
+}
+
+namespace SocketTuning
+{
+    SocketInitConfig InitConfig()
+    {
+        SocketInitConfig config = *socketGetDefaultInitConfig();
+        config.tcp_tx_buf_max_size = std::max<u32>(config.tcp_tx_buf_max_size, kMaxBytes);
+        config.tcp_rx_buf_max_size = std::max<u32>(config.tcp_rx_buf_max_size, kMaxBytes);
+        return config;
+    }
+
+    std::string HostOf(const std::string &url)
+    {
+        size_t start = url.find("://");
+        start = start == std::string::npos ? 0 : start + 3;
+        size_t end = url.find_first_of("/?#", start);
+        std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t at = authority.rfind('@');
+        if (at != std::string::npos)
+            authority.erase(0, at + 1);
+        if (!authority.empty() && authority[0] == '[')
+        {
+            size_t close = authority.find(']');
+            authority = authority.substr(1, close == std::string::npos ? std::string::npos : close - 1);
+        }
+        else
+        {
+            size_t colon = authority.find(':');
+            if (colon != std::string::npos)
+                authority.erase(colon);
+        }
+        for (char &c : authority)
+            c = (char)tolower((unsigned char)c);
+        return authority;
+    }
+
+    int BufferBytes(const std::string &host)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Link &link = links[host];
+        int size = Size(link);
+        if (size != link.logged)
+        {
+            link.logged = size;
+            Logger::Logf(Logger::LOG_DEBUG, "SOCKET TUNE host=%s rtt_ms=%.1f rate_mib_s=%.1f buffer_kb=%d", host.c_str(),
+                         link.rtt_us / 1000.0, link.rate / 1048576.0, size / 1024);
+        }
+        return size;
+    }
+
+    void Apply(int fd, const std::string &host)
+    {
+        int size = BufferBytes(host);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    double Rate(const std::string &host)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = links.find(host);
+        return it == links.end() ? 0 : it->second.rate;
+    }
+
+    void ObserveRtt(const std::string &host, uint64_t rtt_us)
+    {
+        if (rtt_us == 0 || host.empty())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        Link &link = links[host];
+        link.rtt_us = link.rtt_us == 0 ? rtt_us : (link.rtt_us * 3 + rtt_us) / 4;
+    }
+
+    void ObserveRate(const std::string &host, uint64_t bytes, uint64_t us)
+    {
+        if (bytes < kMinRateBytes || us == 0 || host.empty())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        Link &link = links[host];
+        link.rate = std::max(link.rate, bytes * 1000000.0 / us);
+    }
+
+    void ObserveCurl(CURL *easy, const std::string &host)
+    {
+        long connects = 0;
+        curl_off_t lookup = 0, connect = 0, start = 0, total = 0, down = 0, up = 0, pretransfer = 0;
+        curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+        curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+        curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+        curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &start);
+        curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME_T, &total);
+        curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &down);
+        curl_easy_getinfo(easy, CURLINFO_SIZE_UPLOAD_T, &up);
+        // Only a new connection made a handshake of its own.
+        if (connects > 0 && connect > lookup)
+            ObserveRtt(host, (uint64_t)(connect - lookup));
+        if (down > 0 && total > start)
+            ObserveRate(host, (uint64_t)down, (uint64_t)(total - start));
+        if (up > 0 && total > pretransfer)
+            ObserveRate(host, (uint64_t)up, (uint64_t)(total - pretransfer));
+    }
+
+    void SetupCurl(CURL *easy, const std::string *host)
+    {
+        curl_easy_setopt(easy, CURLOPT_SOCKOPTFUNCTION, &CurlSockopt);
+        curl_easy_setopt(easy, CURLOPT_SOCKOPTDATA, (void *)host);
+    }
+}
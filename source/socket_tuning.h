@@ -0,0 +1,53 @@
+#ifndef NEO_SOCKET_TUNING_H
+#define NEO_SOCKET_TUNING_H
+
+#include <switch.h>
+#include <cstdint>
+#include <string>
+
+typedef void CURL;
+
+// TCP buffer sizes per host from what its connections have shown: the
+// round trip (a TCP handshake, an SMB echo) times the bandwidth one
+// connection can get, which is twice the best rate a connection to the host
+// has reached so far, so the window is never what holds it back and grows
+// as it proves too small, and socket_link_mbps until one has been
+// measured. A LAN host gets small buffers instead of wasting the socket
+// service's memory; a distant one (Tailscale, a VPN) gets windows wide
+// enough to keep the link full. Without a round trip yet, kDefaultBytes.
+// Everything is clamped to what the socket service was set up with
+// (InitConfig), and socket_tuning=0 keeps kDefaultBytes everywhere. Set
+// before connect() so the window scale covers it. Kept until the app exits.
+namespace SocketTuning
+{
+    static const int kMinBytes = 64 * 1024;
+    static const int kDefaultBytes = 256 * 1024;
+    static const int kMaxBytes = 1024 * 1024;
+
+    // libnx's defaults with the TCP buffer maximum raised to kMaxBytes; the
+    // socket service would cap SO_RCVBUF at its 256 KiB default otherwise.
+    SocketInitConfig InitConfig();
+
+    // "host" of scheme://[user[:pass]@]host[:port]/..., lowercase.
+    std::string HostOf(const std::string &url);
+
+    int BufferBytes(const std::string &host);
+    // SO_RCVBUF and SO_SNDBUF of `fd` for a connection to `host`.
+    void Apply(int fd, const std::string &host);
+
+    // Best bytes a second one connection to `host` has reached, 0 before
+    // one was measured.
+    double Rate(const std::string &host);
+
+    void ObserveRtt(const std::string &host, uint64_t rtt_us);
+    // `bytes` moved over one connection in `us`; small transfers are ignored.
+    void ObserveRate(const std::string &host, uint64_t bytes, uint64_t us);
+    // Both, from a finished curl transfer.
+    void ObserveCurl(CURL *easy, const std::string &host);
+
+    // Sizes the sockets `easy` opens for `host` (CURLOPT_SOCKOPTFUNCTION),
+    // which must outlive its transfers.
+    void SetupCurl(CURL *easy, const std::string *host);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef NEO_SSH_CRYPTO_H
+#define NEO_SSH_CRYPTO_H
+
+#include <string>
+#include <vector>
+
+// Speed ranking of the SSH ciphers and MACs on this console. On a LAN the
+// SSH crypto, not the network, caps SFTP, and on the Cortex-A57 the AES
+// instructions make some choices several times cheaper than others. The
+// ranking is measured once with the mbedTLS primitives libssh2 itself runs
+// on and kept in [SFTP] cipher_order/mac_order; it describes this device,
+// so every site shares it and only the negotiated pick differs.
+namespace SshCrypto
+{
+    // Cipher and MAC names in OpenSSH spelling, fastest first. Runs the
+    // probe (well under a second) on the first call when the INI has none.
+    void Ranking(std::vector<std::string> &ciphers, std::vector<std::string> &macs);
+}
+
+#endif
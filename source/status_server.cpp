@@ -0,0 +1,351 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include <atomic>
+#include <switch.h>
+
+#include "status_server.h"
+#include "config.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "metrics.h"
+#include "power.h"
+#include "threads.h"
+#include "transfer_stats.h"
+#include "util.h"
+#include "windows.h"
+
+namespace StatusServer
+{
+    namespace
+    {
+        const int kMaxClients = 4;
+        const size_t kMaxRequest = 2048;
+        // A client that has not sent its request line by then is dropped.
+        const uint64_t kClientTimeoutUs = 5000000;
+        const int kPollMs = 500;
+
+        struct Client
+        {
+            int fd = -1;
+            std::string in;
+            std::string out;
+            size_t sent = 0;
+            uint64_t since = 0;
+        };
+
+        Thread thread;
+        bool running = false;
+        std::atomic<bool> stopping{false};
+        int listen_fd = -1;
+        uint64_t started_at = 0;
+
+        void Append(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+        void Append(std::string &out, const char *fmt, ...)
+        {
+            char buf[512];
+            va_list args;
+            va_start(args, fmt);
+            int len = vsnprintf(buf, sizeof(buf), fmt, args);
+            va_end(args);
+            if (len > 0)
+                out.append(buf, (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+        }
+
+        void AppendJsonString(std::string &out, const std::string &text)
+        {
+            out += '"';
+            for (unsigned char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out += '\\';
+                    out += (char)c;
+                }
+                else if (c < 0x20)
+                    Append(out, "\\u%04x", c);
+                else
+                    out += (char)c;
+            }
+            out += '"';
+        }
+
+        std::string StatusJson()
+        {
+            Metrics::Snapshot totals;
+            Metrics::Read(totals);
+            TransferStats::Snapshot stats;
+            TransferStats::Read(stats);
+            uint64_t now = Util::GetTick();
+            bool charging = false;
+            int battery = Power::Battery(&charging);
+
+            std::string out;
+            Append(out, "{\"uptime_s\":%.1f,", (now - started_at) / 1000000.0);
+            Append(out, "\"metrics\":{\"bytes\":%lld,\"requests\":%lld,\"retries\":%lld,",
+                   (long long)totals.counters[Metrics::COUNTER_BYTES],
+                   (long long)totals.counters[Metrics::COUNTER_REQUESTS],
+                   (long long)totals.counters[Metrics::COUNTER_RETRIES]);
+            Append(out, "\"queued\":%lld,\"disk_backlog\":%lld,\"pool_bytes\":%lld},",
+                   (long long)totals.gauges[Metrics::GAUGE_QUEUED],
+                   (long long)totals.gauges[Metrics::GAUGE_DISK_BACKLOG],
+                   (long long)totals.gauges[Metrics::GAUGE_POOL_BYTES]);
+            MemoryStats::Heap heap;
+            MemoryStats::ReadHeap(heap);
+            Append(out, "\"memory\":{\"process_used\":%llu,\"process_total\":%llu,\"heap_used\":%llu,\"heap_size\":%llu,",
+                   (unsigned long long)heap.process_used, (unsigned long long)heap.process_total,
+                   (unsigned long long)heap.heap_used, (unsigned long long)heap.heap_size);
+            Append(out, "\"listings\":%lld,\"http_bodies\":%lld,\"textures\":%lld,\"fonts\":%lld,\"archive\":%lld,",
+                   (long long)totals.gauges[Metrics::GAUGE_MEM_LISTINGS],
+                   (long long)totals.gauges[Metrics::GAUGE_MEM_HTTP_BODIES],
+                   (long long)totals.gauges[Metrics::GAUGE_MEM_TEXTURES],
+                   (long long)totals.gauges[Metrics::GAUGE_MEM_FONTS],
+                   (long long)totals.gauges[Metrics::GAUGE_MEM_ARCHIVE]);
+            Append(out, "\"headroom\":%lld},", (long long)MemoryStats::Headroom());
+
+            int files_total = batch_files_total;
+            uint64_t batch_start = batch_start_tick;
+            Append(out, "\"batch\":{\"active\":%s,\"files_done\":%d,\"files_total\":%d,", stats.active ? "true" : "false",
+                   batch_files_done, files_total);
+            Append(out, "\"bytes_done\":%lld,\"bytes_total\":%lld,\"elapsed_s\":%.1f},", (long long)batch_bytes_done,
+                   (long long)batch_bytes_total,
+                   (files_total > 0 && batch_start > 0 && now > batch_start) ? (now - batch_start) / 1000000.0 : 0.0);
+            Append(out, "\"file\":{\"done\":%lld,\"size\":%lld},", (long long)(int64_t)bytes_transfered,
+                   (long long)(int64_t)bytes_to_download);
+
+            out += "\"workers\":[";
+            bool first = true;
+            for (size_t i = 0; i < stats.workers.size(); i++)
+            {
+                const TransferStats::Worker &worker = stats.workers[i];
+                if (!worker.busy)
+                    continue;
+                if (!first)
+                    out += ',';
+                first = false;
+                Append(out, "{\"slot\":%zu,\"name\":", i);
+                AppendJsonString(out, worker.name);
+                Append(out, ",\"done\":%lld,\"size\":%lld,\"retries\":%u,\"ranged\":%s}", (long long)worker.done,
+                       (long long)worker.size, worker.retries, worker.ranged ? "true" : "false");
+            }
+            out += "],";
+            Append(out, "\"power\":{\"boosted\":%s,\"screen_off\":%s,\"battery\":%d,\"charging\":%s}}\n",
+                   Power::Boosted() ? "true" : "false", Power::ScreenOff() ? "true" : "false", battery,
+                   charging ? "true" : "false");
+            return out;
+        }
+
+        std::string LogText()
+        {
+            std::vector<std::string> lines;
+            Logger::Recent(lines);
+            std::string out;
+            for (const std::string &line : lines)
+            {
+                out += line;
+                out += '\n';
+            }
+            return out;
+        }
+
+        void Respond(Client &client, int code, const char *type, const std::string &body)
+        {
+            const char *reason = code == 200 ? "OK" : code == 404 ? "Not Found" : code == 405 ? "Method Not Allowed" : "Bad Request";
+            client.out.clear();
+            Append(client.out, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                               "Cache-Control: no-store\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+                   code, reason, type, body.size());
+            client.out += body;
+            client.sent = 0;
+        }
+
+        // Answers once the request head is in; false while it is not.
+        bool Handle(Client &client)
+        {
+            size_t end = client.in.find("\r\n\r\n");
+            if (end == std::string::npos && client.in.size() < kMaxRequest)
+                return false;
+
+            char method[8] = "";
+            char target[256] = "";
+            if (sscanf(client.in.c_str(), "%7s %255s", method, target) != 2)
+            {
+                Respond(client, 400, "text/plain", "bad request\n");
+                return true;
+            }
+            std::string path(target);
+            size_t query = path.find('?');
+            if (query != std::string::npos)
+                path.resize(query);
+
+            if (strcmp(method, "GET") != 0)
+                Respond(client, 405, "text/plain", "GET only\n");
+            else if (path == "/" || path == "/status")
+                Respond(client, 200, "application/json", StatusJson());
+            else if (path == "/log")
+                Respond(client, 200, "text/plain; charset=utf-8", LogText());
+            else
+                Respond(client, 404, "text/plain", "try /status or /log\n");
+            return true;
+        }
+
+        void CloseClient(Client &client)
+        {
+            close(client.fd);
+            client = Client();
+        }
+
+        void ServerThread(void *arg)
+        {
+            (void)arg;
+            Client clients[kMaxClients];
+            struct pollfd fds[kMaxClients + 1];
+            while (!stopping)
+            {
+                int count = 0;
+                fds[count++] = {listen_fd, POLLIN, 0};
+                int index[kMaxClients];
+                for (int i = 0; i < kMaxClients; i++)
+                {
+                    if (clients[i].fd < 0)
+                        continue;
+                    index[count - 1] = i;
+                    fds[count++] = {clients[i].fd, (short)(clients[i].out.empty() ? POLLIN : POLLOUT), 0};
+                }
+                if (poll(fds, count, kPollMs) < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    Logger::Logf(Logger::LOG_ERROR, "STATUS poll failed errno=%d", errno);
+                    break;
+                }
+                uint64_t now = Util::GetTick();
+
+                for (int f = 1; f < count; f++)
+                {
+                    Client &client = clients[index[f - 1]];
+                    if (fds[f].revents & (POLLERR | POLLHUP | POLLNVAL))
+                    {
+                        CloseClient(client);
+                        continue;
+                    }
+                    if (fds[f].revents & POLLIN)
+                    {
+                        char buf[512];
+                        ssize_t got = recv(client.fd, buf, sizeof(buf), 0);
+                        if (got <= 0)
+                        {
+                            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                                CloseClient(client);
+                            continue;
+                        }
+                        client.in.append(buf, got);
+                        Handle(client);
+                    }
+                    else if (fds[f].revents & POLLOUT)
+                    {
+                        ssize_t put = send(client.fd, client.out.data() + client.sent, client.out.size() - client.sent, 0);
+                        if (put < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                        {
+                            CloseClient(client);
+                            continue;
+                        }
+                        if (put > 0)
+                            client.sent += put;
+                        if (client.sent >= client.out.size())
+                            CloseClient(client);
+                    }
+                    else if (client.out.empty() && now - client.since > kClientTimeoutUs)
+                        CloseClient(client);
+                }
+
+                if (fds[0].revents & POLLIN)
+                {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd < 0)
+                        continue;
+                    int slot = -1;
+                    for (int i = 0; i < kMaxClients && slot < 0; i++)
+                    {
+                        if (clients[i].fd < 0)
+                            slot = i;
+                    }
+                    if (slot < 0)
+                    {
+                        close(fd);
+                        continue;
+                    }
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                    clients[slot].fd = fd;
+                    clients[slot].since = now;
+                }
+            }
+            for (Client &client : clients)
+            {
+                if (client.fd >= 0)
+                    CloseClient(client);
+            }
+        }
+    }
+
+    void Start()
+    {
+        if (status_port <= 0 || running)
+            return;
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "STATUS socket failed errno=%d", errno);
+            return;
+        }
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)status_port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, kMaxClients) < 0)
+        {
+            Logger::Logf(Logger::LOG_ERROR, "STATUS listen failed port=%d errno=%d", status_port, errno);
+            close(listen_fd);
+            listen_fd = -1;
+            return;
+        }
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+
+        started_at = Util::GetTick();
+        stopping = false;
+        ::Result rc = Threads::Create(&thread, ServerThread, nullptr, 0x10000, Threads::ROLE_BACKGROUND, "status server");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "STATUS threadCreate failed rc=0x%x", rc);
+            close(listen_fd);
+            listen_fd = -1;
+            return;
+        }
+        threadStart(&thread);
+        running = true;
+        Logger::Logf("STATUS listening port=%d", status_port);
+    }
+
+    void Stop()
+    {
+        if (!running)
+            return;
+        stopping = true;
+        Threads::Join(&thread);
+        running = false;
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
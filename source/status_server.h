@@ -0,0 +1,17 @@
+#ifndef NEO_STATUS_SERVER_H
+#define NEO_STATUS_SERVER_H
+
+// Read-only HTTP status page on [Global] status_port, for watching a long
+// transfer from a laptop: GET /status answers JSON with the Metrics totals,
+// the batch progress, each queue worker's file and the power state, and
+// GET /log the last log lines as text. One background thread polls the
+// listening socket and its few clients with non-blocking I/O and answers
+// each request in one go, then closes it; it sleeps in poll() otherwise.
+namespace StatusServer
+{
+    // Listens when status_port is set; call after the config is loaded.
+    void Start();
+    void Stop();
+}
+
+#endif
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "text_pager.h"
+#include "actions.h"
+#include "lang.h"
+#include "logger.h"
+#include "threads.h"
+#include "windows.h"
+
+namespace
+{
+    const uint64_t kLinesPerCheckpoint = 256;
+    // The local index is read in bigger steps than pages, between them.
+    const size_t kIndexStep = 4 * TextPager::kPageSize;
+    // A line start is looked for this far back; past it the line is cut up
+    // from there.
+    const uint64_t kBackScan = TextPager::kPageSize;
+}
+
+const uint64_t TextPager::kPageSize;
+const uint64_t TextPager::kMaxLine;
+
+TextPager::TextPager()
+{
+}
+
+TextPager::~TextPager()
+{
+    Close();
+}
+
+void TextPager::Open(const std::string &path, uint64_t size, const RemoteSettings *remote)
+{
+    Close();
+    this->path = path;
+    this->size = size;
+    this->remote = remote != nullptr;
+    if (remote != nullptr)
+        settings = *remote;
+    maxPages = std::max<size_t>(8, (size_t)viewer_cache_mb * 1024 * 1024 / kPageSize);
+    top = 0;
+    topLine = 0;
+    pendingRows = 0;
+    pendingLine = -1;
+    checkpoints.assign(1, 0);
+    indexedTo = 0;
+    indexedLines = 0;
+    endsWithBreak = false;
+    indexFailed = false;
+    failed = false;
+    fetched = 0;
+    stopping = false;
+
+    Result rc = Threads::Create(&thread, fetchThread, this, 0x100000,
+                                this->remote ? Threads::ROLE_NETWORK : Threads::ROLE_DISK, "viewer");
+    if (R_FAILED(rc))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "VIEWER threadCreate failed rc=0x%x", rc);
+        failed = true;
+        return;
+    }
+    threadStart(&thread);
+    threadStarted = true;
+    Logger::Logf("VIEWER open path=%s size=%llu remote=%d cache_pages=%zu", path.c_str(),
+                 (unsigned long long)size, this->remote, maxPages);
+}
+
+void TextPager::Close()
+{
+    if (threadStarted)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            cv.notify_all();
+        }
+        Threads::Join(&thread);
+        threadStarted = false;
+        Logger::Logf("VIEWER close path=%s pages_fetched=%llu lines_indexed=%lld indexed_bytes=%llu",
+                     path.c_str(), (unsigned long long)fetched, (long long)indexedLines,
+                     (unsigned long long)indexedTo);
+    }
+    pages.clear();
+    wanted.clear();
+    checkpoints.clear();
+}
+
+void TextPager::fetchThread(void *arg)
+{
+    ((TextPager *)arg)->fetchLoop();
+}
+
+void TextPager::fetchLoop()
+{
+    RemoteClient *client = nullptr;
+    FILE *fd = nullptr;
+    if (remote)
+        client = Actions::ConnectBackgroundClient(settings, "Viewer");
+    else
+        fd = fopen(path.c_str(), "rb");
+    if (client == nullptr && fd == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+        snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAILED], path.c_str());
+        Logger::Logf(Logger::LOG_ERROR, "VIEWER open failed path=%s remote=%d", path.c_str(), remote);
+        return;
+    }
+
+    std::vector<char> index_buffer;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        uint64_t index;
+        if (nextPageLocked(&index))
+        {
+            // In flight: neither asked for again nor fetched twice.
+            pages[index];
+            lock.unlock();
+            uint64_t offset = index * kPageSize;
+            size_t length = (size_t)std::min<uint64_t>(kPageSize, size - offset);
+            std::vector<char> data(length);
+            bool ok;
+            if (client != nullptr)
+                ok = client->GetRange(path, data.data(), length, offset) > 0;
+            else
+                ok = fseeko(fd, offset, SEEK_SET) == 0 && fread(data.data(), 1, length, fd) == length;
+            lock.lock();
+
+            Page &page = pages[index];
+            page.data.swap(data);
+            page.ready = ok;
+            page.failed = !ok;
+            page.lastUse = ++useClock;
+            wanted.erase(std::remove(wanted.begin(), wanted.end(), index), wanted.end());
+            fetched++;
+            if (!ok)
+            {
+                failed = true;
+                snprintf(status_message, 1023, "%s %s", lang_strings[STR_FAILED], path.c_str());
+                Logger::Logf(Logger::LOG_ERROR, "VIEWER read failed path=%s offset=%llu", path.c_str(),
+                             (unsigned long long)offset);
+            }
+            // Remote files are only indexed as far as they were fetched in
+            // one run from the start.
+            while (remote && indexedTo < size)
+            {
+                auto it = pages.find(indexedTo / kPageSize);
+                if (it == pages.end() || !it->second.ready)
+                    break;
+                indexLocked(it->second.data.data(), it->second.data.size());
+            }
+            evictLocked();
+            continue;
+        }
+
+        if (!remote && !indexFailed && indexedTo < size)
+        {
+            uint64_t offset = indexedTo;
+            size_t length = (size_t)std::min<uint64_t>(kIndexStep, size - offset);
+            lock.unlock();
+            index_buffer.resize(length);
+            bool ok = fseeko(fd, offset, SEEK_SET) == 0 && fread(index_buffer.data(), 1, length, fd) == length;
+            lock.lock();
+            if (ok)
+                indexLocked(index_buffer.data(), length);
+            else
+                indexFailed = true;
+            continue;
+        }
+
+        cv.wait(lock);
+    }
+    lock.unlock();
+
+    if (fd != nullptr)
+        fclose(fd);
+    if (client != nullptr)
+        Actions::ReleaseBackgroundClient(client);
+}
+
+bool TextPager::nextPageLocked(uint64_t *index)
+{
+    for (uint64_t page : wanted)
+    {
+        if (pages.find(page) == pages.end())
+        {
+            *index = page;
+            return true;
+        }
+    }
+    // Then the page on top, two after it and one before, for scrolling.
+    uint64_t count = (size + kPageSize - 1) / kPageSize;
+    uint64_t anchor = top / kPageSize;
+    const int64_t around[] = {0, 1, 2, -1};
+    for (int64_t delta : around)
+    {
+        if ((delta < 0 && anchor < (uint64_t)-delta) || anchor + delta >= count)
+            continue;
+        if (pages.find(anchor + delta) == pages.end())
+        {
+            *index = anchor + delta;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TextPager::evictLocked()
+{
+    while (pages.size() > maxPages)
+    {
+        auto oldest = pages.end();
+        for (auto it = pages.begin(); it != pages.end(); ++it)
+        {
+            if (!it->second.ready && !it->second.failed)
+                continue;
+            if (oldest == pages.end() || it->second.lastUse < oldest->second.lastUse)
+                oldest = it;
+        }
+        if (oldest == pages.end())
+            return;
+        pages.erase(oldest);
+    }
+}
+
+void TextPager::indexLocked(const char *data, size_t length)
+{
+    const char *end = data + length;
+    const char *from = data;
+    while (from < end)
+    {
+        const char *found = (const char *)memchr(from, '\n', end - from);
+        if (found == nullptr)
+            break;
+        indexedLines++;
+        if (indexedLines % kLinesPerCheckpoint == 0)
+            checkpoints.push_back(indexedTo + (found - data) + 1);
+        from = found + 1;
+    }
+    indexedTo += length;
+    if (length > 0 && indexedTo == size)
+        endsWithBreak = data[length - 1] == '\n';
+}
+
+const TextPager::Page *TextPager::pageLocked(uint64_t offset)
+{
+    uint64_t index = offset / kPageSize;
+    auto it = pages.find(index);
+    if (it == pages.end())
+    {
+        if (std::find(wanted.begin(), wanted.end(), index) == wanted.end())
+        {
+            wanted.push_back(index);
+            cv.notify_all();
+        }
+        return nullptr;
+    }
+    it->second.lastUse = ++useClock;
+    return &it->second;
+}
+
+int TextPager::nextLineLocked(uint64_t offset, uint64_t *next, bool *newline)
+{
+    uint64_t limit = std::min<uint64_t>(size, offset + kMaxLine);
+    uint64_t pos = offset;
+    while (pos < limit)
+    {
+        const Page *page = pageLocked(pos);
+        if (page == nullptr || !page->ready)
+            return (page != nullptr && page->failed) ? -1 : 0;
+        size_t in = pos % kPageSize;
+        size_t length = (size_t)std::min<uint64_t>(page->data.size() - in, limit - pos);
+        const char *start = page->data.data() + in;
+        const char *found = (const char *)memchr(start, '\n', length);
+        if (found != nullptr)
+        {
+            *next = pos + (found - start) + 1;
+            *newline = true;
+            return 1;
+        }
+        pos += length;
+    }
+    *next = limit;
+    *newline = false;
+    return 1;
+}
+
+int TextPager::prevLineLocked(uint64_t offset, uint64_t *prev, bool *newline)
+{
+    const Page *page = pageLocked(offset - 1);
+    if (page == nullptr || !page->ready)
+        return (page != nullptr && page->failed) ? -1 : 0;
+    *newline = page->data[(offset - 1) % kPageSize] == '\n';
+
+    // The line before ends at `end`; its start follows the break before.
+    uint64_t end = *newline ? offset - 1 : offset;
+    uint64_t floor = offset > kBackScan ? offset - kBackScan : 0;
+    uint64_t start = floor;
+    uint64_t pos = end;
+    bool found = false;
+    while (pos > floor && !found)
+    {
+        page = pageLocked(pos - 1);
+        if (page == nullptr || !page->ready)
+            return (page != nullptr && page->failed) ? -1 : 0;
+        uint64_t page_start = (pos - 1) / kPageSize * kPageSize;
+        uint64_t from = std::max(page_start, floor);
+        for (uint64_t i = pos; i > from; i--)
+        {
+            if (page->data[i - 1 - page_start] == '\n')
+            {
+                start = i;
+                found = true;
+                break;
+            }
+        }
+        pos = from;
+    }
+    // The last of the pieces nextLineLocked() cuts that line into.
+    *prev = start + (offset - 1 - start) / kMaxLine * kMaxLine;
+    return 1;
+}
+
+void TextPager::Scroll(int lines)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingRows += lines;
+    pendingLine = -1;
+}
+
+void TextPager::Home()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    top = 0;
+    topLine = 0;
+    pendingRows = 0;
+    pendingLine = -1;
+}
+
+void TextPager::End(int rows)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    top = size;
+    // Counting back from the end needs every line break before it.
+    topLine = indexedTo >= size ? indexedLines : -1;
+    pendingRows = -rows;
+    pendingLine = -1;
+}
+
+void TextPager::GoToLine(int64_t line)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingRows = 0;
+    pendingLine = std::max<int64_t>(line, 0);
+}
+
+bool TextPager::Lines(int rows, std::vector<std::string> &lines)
+{
+    lines.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    // Only what this frame needs is asked for.
+    wanted.clear();
+
+    uint64_t next;
+    bool newline;
+    if (pendingLine >= 0)
+    {
+        size_t checkpoint = (size_t)std::min<uint64_t>(pendingLine / kLinesPerCheckpoint, checkpoints.size() - 1);
+        int64_t checkpoint_line = (int64_t)(checkpoint * kLinesPerCheckpoint);
+        if (topLine < checkpoint_line || topLine > pendingLine)
+        {
+            top = checkpoints[checkpoint];
+            topLine = checkpoint_line;
+        }
+        while (topLine < pendingLine)
+        {
+            int res = nextLineLocked(top, &next, &newline);
+            if (res == 0)
+                break;
+            if (res < 0 || next >= size)
+            {
+                pendingLine = -1;
+                break;
+            }
+            top = next;
+            if (newline)
+                topLine++;
+        }
+        if (topLine == pendingLine)
+            pendingLine = -1;
+    }
+    while (pendingRows > 0)
+    {
+        int res = nextLineLocked(top, &next, &newline);
+        if (res == 0)
+            break;
+        // The last line stays on top.
+        if (res < 0 || next >= size)
+        {
+            pendingRows = 0;
+            break;
+        }
+        top = next;
+        if (newline && topLine >= 0)
+            topLine++;
+        pendingRows--;
+    }
+    while (pendingRows < 0)
+    {
+        if (top == 0)
+        {
+            pendingRows = 0;
+            break;
+        }
+        int res = prevLineLocked(top, &next, &newline);
+        if (res == 0)
+            break;
+        if (res < 0)
+        {
+            pendingRows = 0;
+            break;
+        }
+        top = next;
+        if (newline && topLine >= 0)
+            topLine--;
+        pendingRows++;
+    }
+    if (top == 0)
+        topLine = 0;
+
+    bool loading = pendingRows != 0 || pendingLine >= 0;
+    uint64_t offset = top;
+    while ((int)lines.size() < rows && offset < size)
+    {
+        int res = nextLineLocked(offset, &next, &newline);
+        if (res <= 0)
+        {
+            loading = loading || res == 0;
+            break;
+        }
+        std::string line;
+        line.reserve(next - offset);
+        for (uint64_t pos = offset; pos < next;)
+        {
+            const Page &page = pages[pos / kPageSize];
+            size_t in = pos % kPageSize;
+            size_t length = (size_t)std::min<uint64_t>(page.data.size() - in, next - pos);
+            line.append(page.data.data() + in, length);
+            pos += length;
+        }
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        lines.push_back(std::move(line));
+        offset = next;
+    }
+    return !loading;
+}
+
+int64_t TextPager::TopLine()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return topLine;
+}
+
+int64_t TextPager::LineCount(bool *complete)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    *complete = indexedTo >= size;
+    if (*complete && size > 0 && !endsWithBreak)
+        return indexedLines + 1;
+    return indexedLines;
+}
+
+bool TextPager::Failed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
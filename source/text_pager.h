@@ -0,0 +1,115 @@
+#ifndef NEO_TEXT_PAGER_H
+#define NEO_TEXT_PAGER_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <switch.h>
+
+#include "config.h"
+
+// Read-only view of a text file of any size. The file is read in 64 KiB
+// pages by a fetch thread, local files with fread and remote ones with
+// GetRange on a connection of its own, around the viewport only; pages
+// are evicted least recently used past viewer_cache_mb. The viewport is a
+// byte offset, so moving it only needs the pages it lands on. A sparse
+// line index (the offset of every 256th line) is built with memchr, in the
+// background for local files and over the pages fetched so far for remote
+// ones, and serves line numbers and GoToLine().
+class TextPager
+{
+public:
+    static const uint64_t kPageSize = 64 * 1024;
+    // Longer lines are shown in pieces of this many bytes.
+    static const uint64_t kMaxLine = 2048;
+
+    TextPager();
+    ~TextPager();
+
+    // Starts viewing `path`, `size` bytes, on the remote site `remote` or
+    // the SD card when nullptr.
+    void Open(const std::string &path, uint64_t size, const RemoteSettings *remote);
+    void Close();
+
+    // Queues moves of the viewport, applied by Lines() as the pages they
+    // cross arrive.
+    void Scroll(int lines);
+    void Home();
+    void End(int rows);
+    void GoToLine(int64_t line);
+
+    // Moves the viewport by what was queued and fills `lines` with up to
+    // `rows` lines from it. Returns false while pages are still loading.
+    bool Lines(int rows, std::vector<std::string> &lines);
+
+    // Line number of the top of the viewport, -1 when not known yet.
+    int64_t TopLine();
+    // Lines indexed so far, all of them once `*complete`.
+    int64_t LineCount(bool *complete);
+    uint64_t Size() const { return size; }
+    // A page could not be read; the message is in status_message.
+    bool Failed();
+
+private:
+    struct Page
+    {
+        std::vector<char> data;
+        uint64_t lastUse = 0;
+        bool ready = false;
+        bool failed = false;
+    };
+
+    std::string path;
+    uint64_t size = 0;
+    bool remote = false;
+    RemoteSettings settings;
+    size_t maxPages = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<uint64_t, Page> pages;
+    // Pages the viewport needs that are not here yet.
+    std::vector<uint64_t> wanted;
+    uint64_t useClock = 0;
+    bool failed = false;
+
+    uint64_t top = 0;
+    int64_t topLine = 0;
+    int pendingRows = 0;
+    int64_t pendingLine = -1;
+
+    // checkpoints[k] is where line k * 256 starts; the bytes before
+    // indexedTo hold indexedLines line breaks.
+    std::vector<uint64_t> checkpoints;
+    uint64_t indexedTo = 0;
+    int64_t indexedLines = 0;
+    bool endsWithBreak = false;
+    // The local index stops at a read error.
+    bool indexFailed = false;
+    uint64_t fetched = 0;
+
+    Thread thread;
+    bool threadStarted = false;
+    bool stopping = false;
+
+    static void fetchThread(void *arg);
+    void fetchLoop();
+    // The next page to read: wanted ones, then those around the viewport.
+    // Called with `mutex` held; false when there is none.
+    bool nextPageLocked(uint64_t *index);
+    void evictLocked();
+    // Counts the line breaks of `length` bytes at indexedTo.
+    void indexLocked(const char *data, size_t length);
+
+    // The cached page holding `offset`, asked for when missing. Called from
+    // the UI thread with `mutex` held.
+    const Page *pageLocked(uint64_t offset);
+    // Start of the line after the one at `offset`, and whether a line break
+    // ended it. 1 when known, 0 while loading, -1 on a failed page.
+    int nextLineLocked(uint64_t offset, uint64_t *next, bool *newline);
+    int prevLineLocked(uint64_t offset, uint64_t *prev, bool *newline);
+};
+
+#endif
@@ -1,6 +1,10 @@
 #include <cstring>
 #include <string>
 #include <memory>
+#include <iterator>
+#include <list>
+#include <algorithm>
+#include <cstdint>
 #include <sys/stat.h>
 
 // BMP
@@ -30,9 +34,12 @@
 
 #include <switch.h>
 
+#include "config.h"
 #include "fs.h"
 #include "gui.h"
 #include "imgui_impl_switch.h"
+#include "memory_governor.h"
+#include "metrics.h"
 #include "textures.h"
 #include "windows.h"
 
@@ -74,6 +81,15 @@ namespace Textures {
         ImageTypeWEBP,
         ImageTypeOther
     } ImageType;
+
+    // Textures of recently viewed remote images, most recent first.
+    struct CachedTexture {
+        std::string key;
+        Tex texture;
+        std::size_t bytes;
+    };
+    static std::list<CachedTexture> texture_cache;
+    static std::size_t texture_cache_bytes = 0;
     
     static bool ReadFile(const std::string &path, unsigned char **buffer, std::size_t &size) {
         FILE *file = fopen(path.c_str(), "rb");
@@ -113,39 +129,162 @@ namespace Textures {
         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 #endif
         glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, data);
+        Metrics::Move(Metrics::GAUGE_MEM_TEXTURES, static_cast<int64_t>(texture.width) * texture.height * BYTES_PER_PIXEL);
         return true;
     }
+
+    static void Delete(Tex &texture) {
+        glDeleteTextures(1, std::addressof(texture.id));
+        Metrics::Move(Metrics::GAUGE_MEM_TEXTURES, -static_cast<int64_t>(texture.width) * texture.height * BYTES_PER_PIXEL);
+    }
     
-    static bool LoadImagePNG(const std::string &path, Tex &texture) {
-        bool ret = false;
-        png_image image;
-        std::memset(std::addressof(image), 0, (sizeof image));
-        image.version = PNG_IMAGE_VERSION;
-
-        if (png_image_begin_read_from_file(std::addressof(image), path.c_str()) != 0) {
-            png_bytep buffer;
-            image.format = PNG_FORMAT_RGBA;
-            buffer = new png_byte[PNG_IMAGE_SIZE(image)];
-
-            if (buffer != nullptr && png_image_finish_read(std::addressof(image), nullptr, buffer, 0, nullptr) != 0) {
-                texture.width = image.width;
-                texture.height = image.height;
-                ret = Textures::Create(buffer, GL_RGBA, texture);
-                delete[] buffer;
-                png_image_free(std::addressof(image));
+    // Size `width` x `height` is shown at in a max_width x max_height box,
+    // never enlarged.
+    static void FitDisplay(int width, int height, int max_width, int max_height, int &fit_width, int &fit_height) {
+        fit_width = width;
+        fit_height = height;
+        if (width > max_width || height > max_height) {
+            if (static_cast<long long>(width) * max_height > static_cast<long long>(height) * max_width) {
+                fit_width = max_width;
+                fit_height = std::max(1, static_cast<int>(static_cast<long long>(height) * max_width / width));
             }
             else {
-                if (buffer == nullptr)
-                    png_image_free(std::addressof(image));
-                else
-                    delete[] buffer;
+                fit_height = max_height;
+                fit_width = std::max(1, static_cast<int>(static_cast<long long>(width) * max_height / height));
             }
         }
+    }
 
-        return ret;
+    // Largest whole factor an image shrinks by and still covers its
+    // display size; the GPU filters the rest.
+    static int BoxFactor(int width, int height, int max_width, int max_height) {
+        int fit_width, fit_height;
+        Textures::FitDisplay(width, height, max_width, max_height, fit_width, fit_height);
+        return std::max(1, std::min(width / fit_width, height / fit_height));
+    }
+
+    static bool Allocate(int width, int height, Image &image) {
+        if (width <= 0 || height <= 0 || (static_cast<long long>(width) * height) > (MAX_IMAGE_BYTES/BYTES_PER_PIXEL))
+            return false;
+        image.width = width;
+        image.height = height;
+        image.pixels.resize(static_cast<std::size_t>(width) * height * BYTES_PER_PIXEL);
+        return true;
+    }
+
+    struct PngMemoryReader {
+        const unsigned char *data;
+        std::size_t size;
+        std::size_t offset;
+    };
+
+    static void PngReadMemory(png_structp png, png_bytep out, png_size_t length) {
+        PngMemoryReader *reader = static_cast<PngMemoryReader *>(png_get_io_ptr(png));
+        if (length > reader->size - reader->offset)
+            png_error(png, "truncated image");
+        std::memcpy(out, reader->data + reader->offset, length);
+        reader->offset += length;
+    }
+
+    // Reads the image a row at a time and box-filters each block of
+    // factor x factor pixels into one, so only the output and a row of
+    // sums are ever held. Interlaced images arrive in passes and are read
+    // whole instead.
+    static bool DecodePNG(unsigned char *data, std::size_t size, int max_width, int max_height, Image &image) {
+        png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (png == nullptr)
+            return false;
+        png_infop info = png_create_info_struct(png);
+        if (info == nullptr) {
+            png_destroy_read_struct(std::addressof(png), nullptr, nullptr);
+            return false;
+        }
+
+        unsigned char *volatile row = nullptr;
+        std::uint32_t *volatile sums = nullptr;
+        png_bytep *volatile rows = nullptr;
+        if (setjmp(png_jmpbuf(png))) {
+            delete[] row;
+            delete[] sums;
+            delete[] rows;
+            png_destroy_read_struct(std::addressof(png), std::addressof(info), nullptr);
+            return false;
+        }
+
+        PngMemoryReader reader = { data, size, 0 };
+        png_set_read_fn(png, std::addressof(reader), Textures::PngReadMemory);
+        png_read_info(png, info);
+
+        int width = static_cast<int>(png_get_image_width(png, info));
+        int height = static_cast<int>(png_get_image_height(png, info));
+        int color_type = png_get_color_type(png, info);
+        bool alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0;
+        if (png_get_bit_depth(png, info) == 16)
+            png_set_strip_16(png);
+        if (color_type == PNG_COLOR_TYPE_PALETTE)
+            png_set_palette_to_rgb(png);
+        if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+            png_set_expand_gray_1_2_4_to_8(png);
+            png_set_gray_to_rgb(png);
+        }
+        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+            png_set_tRNS_to_alpha(png);
+            alpha = true;
+        }
+        if (!alpha)
+            png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+        int passes = png_set_interlace_handling(png);
+        png_read_update_info(png, info);
+
+        int factor = passes > 1 ? 1 : Textures::BoxFactor(width, height, max_width, max_height);
+        if (!Textures::Allocate(width / factor, height / factor, image))
+            png_error(png, "image too large");
+
+        std::size_t stride = static_cast<std::size_t>(image.width) * BYTES_PER_PIXEL;
+        unsigned char *pixels = image.pixels.data();
+        if (passes > 1) {
+            rows = new png_bytep[image.height];
+            for (int y = 0; y < image.height; y++)
+                rows[y] = pixels + y * stride;
+            png_read_image(png, rows);
+        }
+        else if (factor == 1) {
+            for (int y = 0; y < image.height; y++)
+                png_read_row(png, pixels + y * stride, nullptr);
+        }
+        else {
+            row = new unsigned char[static_cast<std::size_t>(width) * BYTES_PER_PIXEL];
+            sums = new std::uint32_t[stride];
+            std::uint32_t area = static_cast<std::uint32_t>(factor * factor);
+            for (int y = 0; y < image.height; y++) {
+                std::memset(sums, 0, stride * sizeof(std::uint32_t));
+                for (int dy = 0; dy < factor; dy++) {
+                    png_read_row(png, row, nullptr);
+                    const unsigned char *in = row;
+                    for (int x = 0; x < image.width; x++) {
+                        std::uint32_t *sum = sums + x * BYTES_PER_PIXEL;
+                        for (int dx = 0; dx < factor; dx++, in += BYTES_PER_PIXEL) {
+                            sum[0] += in[0];
+                            sum[1] += in[1];
+                            sum[2] += in[2];
+                            sum[3] += in[3];
+                        }
+                    }
+                }
+                unsigned char *out = pixels + y * stride;
+                for (std::size_t i = 0; i < stride; i++)
+                    out[i] = static_cast<unsigned char>(sums[i] / area);
+            }
+        }
+
+        delete[] row;
+        delete[] sums;
+        delete[] rows;
+        png_destroy_read_struct(std::addressof(png), std::addressof(info), nullptr);
+        return true;
     }
     
-    static bool LoadImageBMP(unsigned char **data, std::size_t &size, Tex &texture) {
+    static bool DecodeBMP(unsigned char *data, std::size_t size, Image &image) {
         bmp_bitmap_callback_vt bitmap_callbacks = {
             BMP::bitmap_create,
             BMP::bitmap_destroy,
@@ -157,7 +296,7 @@ namespace Textures {
         bmp_image bmp;
         bmp_create(std::addressof(bmp), std::addressof(bitmap_callbacks));
         
-        code = bmp_analyse(std::addressof(bmp), size, *data);
+        code = bmp_analyse(std::addressof(bmp), size, data);
         if (code != BMP_OK) {
             bmp_finalise(std::addressof(bmp));
             return false;
@@ -177,34 +316,99 @@ namespace Textures {
             }
         }
         
-        texture.width = bmp.width;
-        texture.height = bmp.height;
-        bool ret = Textures::Create(static_cast<unsigned char *>(bmp.bitmap), GL_RGBA, texture);
+        bool ret = Textures::Allocate(bmp.width, bmp.height, image);
+        if (ret)
+            std::memcpy(image.pixels.data(), bmp.bitmap, image.pixels.size());
         bmp_finalise(std::addressof(bmp));
         return ret;
     }
 
-    static bool LoadImageJPEG(unsigned char **data, std::size_t &size, Tex &texture) {
-        tjhandle jpeg = tjInitDecompress();
-        int jpegsubsamp = 0;
-        tjDecompressHeader2(jpeg, *data, size, std::addressof(texture.width), std::addressof(texture.height), std::addressof(jpegsubsamp));
-        unsigned char *buffer = new unsigned char[texture.width * texture.height * 4];
-        tjDecompress2(jpeg, *data, size, buffer, texture.width, 0, texture.height, TJPF_RGBA, TJFLAG_FASTDCT);
-        bool ret = Textures::Create(buffer, GL_RGBA, texture);
-        tjDestroy(jpeg);
-        delete[] buffer;
-        return ret;
+    // One decompressor per decoding thread (the viewer, the prefetcher,
+    // the thumbnail workers), kept across images instead of set up and torn
+    // down for each.
+    struct JpegDecompressor {
+        tjhandle handle = nullptr;
+
+        ~JpegDecompressor() {
+            if (handle != nullptr)
+                tjDestroy(handle);
+        }
+
+        tjhandle Get() {
+            if (handle == nullptr)
+                handle = tjInitDecompress();
+            return handle;
+        }
+    };
+    static thread_local JpegDecompressor jpeg_decompressor;
+
+    // Decodes at the smallest of turbojpeg's scaling factors (down to 1/8)
+    // that still covers the display size, in the IDCT itself, and straight
+    // into the pixels Upload() hands to GL. A scaled-down decode also takes
+    // the cheaper chroma upsampling, which the reduction hides.
+    static bool DecodeJPEG(unsigned char *data, std::size_t size, int max_width, int max_height, Image &image) {
+        tjhandle jpeg = jpeg_decompressor.Get();
+        int width = 0, height = 0, jpegsubsamp = 0;
+        if (jpeg == nullptr || tjDecompressHeader2(jpeg, data, size, std::addressof(width), std::addressof(height), std::addressof(jpegsubsamp)) != 0)
+            return false;
+
+        int fit_width, fit_height;
+        Textures::FitDisplay(width, height, max_width, max_height, fit_width, fit_height);
+        int out_width = width, out_height = height;
+        int factors = 0;
+        tjscalingfactor *scaling = tjGetScalingFactors(std::addressof(factors));
+        for (int i = 0; scaling != nullptr && i < factors; i++) {
+            int scaled_width = TJSCALED(width, scaling[i]);
+            int scaled_height = TJSCALED(height, scaling[i]);
+            if (scaled_width >= fit_width && scaled_height >= fit_height &&
+                static_cast<long long>(scaled_width) * scaled_height < static_cast<long long>(out_width) * out_height) {
+                out_width = scaled_width;
+                out_height = scaled_height;
+            }
+        }
+
+        int flags = TJFLAG_FASTDCT;
+        if (out_width < width)
+            flags |= TJFLAG_FASTUPSAMPLE;
+        return Textures::Allocate(out_width, out_height, image) &&
+            tjDecompress2(jpeg, data, size, image.pixels.data(), out_width, 0, out_height, TJPF_RGBA, flags) == 0;
     }
 
-    static bool LoadImageOther(const std::string &path, Tex &texture) {
-        unsigned char *image = stbi_load(path.c_str(), std::addressof(texture.width), std::addressof(texture.height), nullptr, STBI_rgb_alpha);
-        bool ret = Textures::Create(image, GL_RGBA, texture);
+    static bool DecodeOther(unsigned char *data, std::size_t size, Image &image) {
+        int width = 0, height = 0;
+        unsigned char *pixels = stbi_load_from_memory(data, size, std::addressof(width), std::addressof(height), nullptr, STBI_rgb_alpha);
+        if (pixels == nullptr)
+            return false;
+        bool ret = Textures::Allocate(width, height, image);
+        if (ret)
+            std::memcpy(image.pixels.data(), pixels, image.pixels.size());
+        stbi_image_free(pixels);
         return ret;
     }
 
-    static bool LoadImageWEBP(unsigned char **data, std::size_t &size, Tex &texture) {
-        *data = WebPDecodeRGBA(*data, size, std::addressof(texture.width), std::addressof(texture.height));
-        bool ret = Textures::Create(*data, GL_RGBA, texture);
+    // libwebp scales while decoding, straight to the display size and into
+    // the output buffer.
+    static bool DecodeWEBP(unsigned char *data, std::size_t size, int max_width, int max_height, Image &image) {
+        WebPDecoderConfig config;
+        if (!WebPInitDecoderConfig(std::addressof(config)) || WebPGetFeatures(data, size, std::addressof(config.input)) != VP8_STATUS_OK)
+            return false;
+
+        int fit_width, fit_height;
+        Textures::FitDisplay(config.input.width, config.input.height, max_width, max_height, fit_width, fit_height);
+        if (!Textures::Allocate(fit_width, fit_height, image))
+            return false;
+        if (fit_width != config.input.width || fit_height != config.input.height) {
+            config.options.use_scaling = 1;
+            config.options.scaled_width = fit_width;
+            config.options.scaled_height = fit_height;
+        }
+        config.output.colorspace = MODE_RGBA;
+        config.output.is_external_memory = 1;
+        config.output.u.RGBA.rgba = image.pixels.data();
+        config.output.u.RGBA.stride = fit_width * BYTES_PER_PIXEL;
+        config.output.u.RGBA.size = image.pixels.size();
+        bool ret = WebPDecode(data, size, std::addressof(config)) == VP8_STATUS_OK;
+        WebPFreeDecBuffer(std::addressof(config.output));
         return ret;
     }
 
@@ -223,53 +427,106 @@ namespace Textures {
         return ImageTypeOther;
     }
 
-    bool LoadImageFile(const std::string &path, Tex &texture) {
-        bool ret = false;
+    bool DecodeImage(const std::string &name, unsigned char *data, std::size_t size, int max_width, int max_height, Image &image) {
+        switch(Textures::GetImageType(name)) {
+            case ImageTypeBMP:
+                return Textures::DecodeBMP(data, size, image);
+            case ImageTypeJPEG:
+                return Textures::DecodeJPEG(data, size, max_width, max_height, image);
+            case ImageTypePNG:
+                return Textures::DecodePNG(data, size, max_width, max_height, image);
+            case ImageTypeWEBP:
+                return Textures::DecodeWEBP(data, size, max_width, max_height, image);
+            default:
+                return Textures::DecodeOther(data, size, image);
+        }
+    }
 
-        ImageType type = Textures::GetImageType(path);
+    bool Upload(const Image &image, Tex &texture) {
+        if (image.pixels.empty())
+            return false;
+        texture.width = image.width;
+        texture.height = image.height;
+        return Textures::Create(const_cast<unsigned char *>(image.pixels.data()), GL_RGBA, texture);
+    }
 
-        if (type == ImageTypePNG)
-            ret = Textures::LoadImagePNG(path, texture);
-        else if (type == ImageTypeOther)
-            ret = Textures::LoadImageOther(path, texture);
-        else {
-            unsigned char *data = nullptr;
-            std::size_t size = 0;
-            
-            if (!Textures::ReadFile(path, std::addressof(data), size)) {
-                delete[] data;
-                return ret;
-            }
+    bool LoadImageMemory(const std::string &name, unsigned char *data, std::size_t size, Tex &texture) {
+        Image image;
+        return Textures::DecodeImage(name, data, size, MAX_IMAGE_WIDTH, MAX_IMAGE_HEIGHT, image) && Textures::Upload(image, texture);
+    }
 
-            switch(type) {
-                case ImageTypeBMP:
-                    ret = Textures::LoadImageBMP(std::addressof(data), size, texture);
-                    break;
-                    
-                case ImageTypeJPEG:
-                    ret = Textures::LoadImageJPEG(std::addressof(data), size, texture);
-                    break;
-                    
-                case ImageTypeWEBP:
-                    ret = Textures::LoadImageWEBP(std::addressof(data), size, texture);
-                    break;
-                    
-                default:
-                    break;
-            }
+    bool LoadImageFile(const std::string &path, Tex &texture) {
+        unsigned char *data = nullptr;
+        std::size_t size = 0;
 
+        if (!Textures::ReadFile(path, std::addressof(data), size)) {
             delete[] data;
+            return false;
         }
+
+        bool ret = Textures::LoadImageMemory(path, data, size, texture);
+        delete[] data;
         return ret;
     }
-    
+
+    bool CacheLookup(const std::string &key, Tex &texture) {
+        for (auto it = texture_cache.begin(); it != texture_cache.end(); ++it) {
+            if (it->key != key)
+                continue;
+            texture = it->texture;
+            texture_cache.splice(texture_cache.begin(), texture_cache, it);
+            return true;
+        }
+        return false;
+    }
+
+    bool CacheContains(const std::string &key) {
+        for (const CachedTexture &cached : texture_cache) {
+            if (cached.key == key)
+                return true;
+        }
+        return false;
+    }
+
+    bool CacheStore(const std::string &key, const Tex &texture, GLuint keep) {
+        std::size_t bytes = static_cast<std::size_t>(texture.width) * texture.height * BYTES_PER_PIXEL;
+        std::size_t budget = MemoryGovernor::ImageCacheBytes();
+        if (bytes == 0 || bytes > budget)
+            return false;
+
+        // least recently viewed first out
+        while (!texture_cache.empty() && texture_cache_bytes + bytes > budget) {
+            CachedTexture &oldest = texture_cache.back();
+            if (keep != 0 && oldest.texture.id == keep) {
+                if (texture_cache.size() == 1)
+                    return false;
+                texture_cache.splice(texture_cache.begin(), texture_cache, std::prev(texture_cache.end()));
+                continue;
+            }
+            Delete(oldest.texture);
+            texture_cache_bytes -= oldest.bytes;
+            texture_cache.pop_back();
+        }
+        texture_cache.push_front({ key, texture, bytes });
+        texture_cache_bytes += bytes;
+        return true;
+    }
+
     void Init(void) {
     }
     
     void Free(Tex &texture) {
-        glDeleteTextures(1, std::addressof(texture.id));
+        for (const CachedTexture &cached : texture_cache) {
+            if (cached.texture.id == texture.id)
+                return;
+        }
+        Delete(texture);
     }
     
     void Exit(void) {
+        for (CachedTexture &cached : texture_cache)
+            Delete(cached.texture);
+        texture_cache.clear();
+        texture_cache_bytes = 0;
     }
 }
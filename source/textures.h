@@ -2,8 +2,14 @@
 
 #include <glad/glad.h>
 #include <switch.h>
+#include <string>
 #include <vector>
 
+// Viewer area; larger images are decoded straight to the size they are
+// shown at in it.
+#define MAX_IMAGE_WIDTH 1280
+#define MAX_IMAGE_HEIGHT 720
+
 typedef struct {
     GLuint id = 0;
     int width = 0;
@@ -11,8 +17,32 @@ typedef struct {
     int delay = 0;
 } Tex;
 
+// Decoded RGBA pixels that are not a texture yet.
+typedef struct {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+} Image;
+
 namespace Textures {
     bool LoadImageFile(const std::string &path, Tex &texture);
+    // Decodes to RGBA, shrunk by the decoder where it can to about what a
+    // max_width x max_height box shows. Touches no GL state, so any thread
+    // may call it; Upload() then makes the texture on the UI thread.
+    bool DecodeImage(const std::string &name, unsigned char *data, std::size_t size, int max_width, int max_height, Image &image);
+    bool Upload(const Image &image, Tex &texture);
+    // Decodes an image already in memory; `name` picks the decoder by its
+    // extension, as LoadImageFile() does with the path.
+    bool LoadImageMemory(const std::string &name, unsigned char *data, std::size_t size, Tex &texture);
+    // Textures of viewed remote images, kept until they exceed
+    // image_cache_mb of video memory, least recently viewed out first.
+    // A cached texture belongs to the cache, and Free() leaves it alone.
+    bool CacheLookup(const std::string &key, Tex &texture);
+    bool CacheContains(const std::string &key);
+    // Stores `texture`, making room without evicting `keep`, the one on
+    // screen. False when it does not fit, and the texture is still the
+    // caller's.
+    bool CacheStore(const std::string &key, const Tex &texture, GLuint keep = 0);
     void Free(Tex &texture);
     void Init(void);
     void Exit(void);
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "threads.h"
+#include "cancel.h"
+#include "config.h"
+#include "logger.h"
+
+namespace
+{
+    const int kCores = 3;
+    const int kComputePriority = 0x2C;
+    const int kBackgroundPriority = 0x3F;
+
+    struct Record
+    {
+        Handle handle;
+        const char *name;
+        Threads::Role role;
+        int core;
+        int priority;
+    };
+
+    std::mutex mutex;
+    std::vector<Record> live;
+    Handle ui_handle = INVALID_HANDLE;
+    std::atomic<uint32_t> next_core{0};
+
+    const char *RoleName(Threads::Role role)
+    {
+        switch (role)
+        {
+        case Threads::ROLE_NETWORK:
+            return "network";
+        case Threads::ROLE_DISK:
+            return "disk";
+        case Threads::ROLE_COMPUTE:
+            return "compute";
+        default:
+            return "background";
+        }
+    }
+
+    int RolePriority(Threads::Role role)
+    {
+        switch (role)
+        {
+        case Threads::ROLE_NETWORK:
+            return network_priority;
+        case Threads::ROLE_COMPUTE:
+            return kComputePriority;
+        case Threads::ROLE_DISK:
+            return disk_priority;
+        default:
+            return kBackgroundPriority;
+        }
+    }
+
+    // What a new thread runs, and the cancel flag it inherits.
+    struct Start
+    {
+        ThreadFunc entry;
+        void *arg;
+        bool *cancel;
+    };
+
+    void Trampoline(void *arg)
+    {
+        Start start = *(Start *)arg;
+        delete (Start *)arg;
+        Cancel::Bind(start.cancel);
+        start.entry(start.arg);
+    }
+
+    int RoleCore(Threads::Role role)
+    {
+        if (!thread_affinity)
+            return -2;
+        uint32_t n = next_core.fetch_add(1, std::memory_order_relaxed);
+        switch (role)
+        {
+        case Threads::ROLE_BACKGROUND:
+            return ui_core;
+        case Threads::ROLE_COMPUTE:
+            return n % kCores;
+        default:
+            // The two cores other than the UI's.
+            return (ui_core + 1 + n % (kCores - 1)) % kCores;
+        }
+    }
+}
+
+namespace Threads
+{
+    void Init()
+    {
+        ui_handle = threadGetCurHandle();
+        if (!thread_affinity)
+            return;
+        Result rc = svcSetThreadCoreMask(CUR_THREAD_HANDLE, ui_core, 1u << ui_core);
+        if (R_FAILED(rc))
+            Logger::Logf(Logger::LOG_WARN, "THREAD ui core=%d rc=0x%x", ui_core, rc);
+        Logger::Logf("THREAD init ui_core=%d network_priority=0x%x disk_priority=0x%x",
+                     ui_core, network_priority, disk_priority);
+    }
+
+    Result Create(Thread *thread, ThreadFunc entry, void *arg, size_t stack_size, Role role, const char *name)
+    {
+        int core = RoleCore(role);
+        int priority = RolePriority(role);
+        Start *start = new Start{entry, arg, Cancel::Flag()};
+        Result rc = threadCreate(thread, Trampoline, start, nullptr, stack_size, priority, core);
+        if (R_FAILED(rc))
+        {
+            delete start;
+            return rc;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        live.push_back({thread->handle, name, role, core, priority});
+        return rc;
+    }
+
+    void Join(Thread *thread)
+    {
+        threadWaitForExit(thread);
+        Record record = {thread->handle, "?", ROLE_NETWORK, -2, 0};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < live.size(); i++)
+            {
+                if (live[i].handle == thread->handle)
+                {
+                    record = live[i];
+                    live.erase(live.begin() + i);
+                    break;
+                }
+            }
+        }
+        if (Logger::Enabled(Logger::LOG_DEBUG))
+            Logger::Logf(Logger::LOG_DEBUG, "THREAD exit name=%s role=%s core=%d prio=0x%x cpu_ms=%llu", record.name,
+                         RoleName(record.role), record.core, record.priority,
+                         (unsigned long long)(CpuTime(thread->handle) / 1000));
+        threadClose(thread);
+    }
+
+    uint64_t CpuTime(Handle handle)
+    {
+        uint64_t ticks = 0;
+        if (R_FAILED(svcGetInfo(&ticks, InfoType_ThreadTickCount, handle, (uint64_t)-1)))
+            return 0;
+        return armTicksToNs(ticks) / 1000;
+    }
+
+    void LogUsage(const char *tag)
+    {
+        if (ui_handle != INVALID_HANDLE)
+            Logger::Logf("THREAD usage tag=%s name=ui core=%d cpu_ms=%llu", tag, thread_affinity ? ui_core : -2,
+                         (unsigned long long)(CpuTime(ui_handle) / 1000));
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Record &record : live)
+            Logger::Logf("THREAD usage tag=%s name=%s role=%s core=%d prio=0x%x cpu_ms=%llu", tag, record.name,
+                         RoleName(record.role), record.core, record.priority,
+                         (unsigned long long)(CpuTime(record.handle) / 1000));
+    }
+
+    std::string Label(Handle handle)
+    {
+        if (handle == ui_handle)
+            return "ui";
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Record &record : live)
+        {
+            if (record.handle != handle)
+                continue;
+            char label[96];
+            snprintf(label, sizeof(label), "%s (%s, core %d)", record.name, RoleName(record.role), record.core);
+            return label;
+        }
+        return "thread";
+    }
+
+    bool Alive(Handle handle)
+    {
+        if (handle == ui_handle)
+            return true;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Record &record : live)
+        {
+            if (record.handle == handle)
+                return true;
+        }
+        return false;
+    }
+}
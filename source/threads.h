@@ -0,0 +1,56 @@
+#ifndef NEO_THREADS_H
+#define NEO_THREADS_H
+
+#include <switch.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Where the app's threads run. An application gets cores 0-2, and a thread
+// created on core -2 lands on the process default core, which is the UI's.
+// Threads are instead created for a role. Network and disk threads go round
+// robin over the cores the UI is not on. Background threads share the UI
+// core at the lowest priority, since the UI sleeps between frames. Compute
+// threads spread over all three. With thread_affinity off, every role gets
+// core -2 as before, at the role's priority.
+namespace Threads
+{
+    enum Role
+    {
+        // Activity threads, queue and connection workers; libssh2 and
+        // mbedtls crypto run on these.
+        ROLE_NETWORK,
+        // Writers and read-ahead feeding a transfer from or to the SD card.
+        ROLE_DISK,
+        // CPU-bound work split across every core, e.g. deflate.
+        ROLE_COMPUTE,
+        // Logger, listing prefetch, keep-alives, thumbnails.
+        ROLE_BACKGROUND
+    };
+
+    // Pins the calling thread, the UI, to ui_core. Call once from the main
+    // thread after the config is loaded.
+    void Init();
+
+    // threadCreate() with the core and priority of `role`. `name` must
+    // outlive the thread; it labels it in the THREAD log lines. The thread
+    // polls the cancel flag of the calling one (see cancel.h).
+    Result Create(Thread *thread, ThreadFunc entry, void *arg, size_t stack_size, Role role, const char *name);
+    // threadWaitForExit() and threadClose(), logging the thread's CPU time
+    // at LOG_DEBUG.
+    void Join(Thread *thread);
+
+    // CPU time the thread has used so far, in microseconds; 0 when the
+    // kernel does not tell.
+    uint64_t CpuTime(Handle handle);
+    // Logs the CPU time of the UI thread and of every live thread.
+    void LogUsage(const char *tag);
+
+    // The name, role and core a thread was created with, e.g. "writer
+    // (disk, core 1)", or "ui"; "thread" for one Create() did not make.
+    std::string Label(Handle handle);
+    // False once Join() has been called for the thread.
+    bool Alive(Handle handle);
+}
+
+#endif
@@ -0,0 +1,679 @@
+#include <switch.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <turbojpeg.h>
+
+#include "thumbnails.h"
+#include "actions.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+#include "package_info.h"
+#include "remote_reader.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    enum SlotState
+    {
+        SLOT_QUEUED,
+        SLOT_WORKING,
+        SLOT_DECODED,
+        SLOT_READY,
+        SLOT_FAILED
+    };
+
+    struct Slot
+    {
+        DirEntry entry;
+        bool remote = false;
+        SlotState state = SLOT_QUEUED;
+        // Last frame Get() asked for it.
+        uint64_t wanted = 0;
+        Image image;
+        Tex texture;
+    };
+
+    // Thumbnails kept, at most 48 KiB of video memory each.
+    const size_t kMaxSlots = 256;
+    // Textures made per frame, so a page of cached thumbnails arriving at
+    // once does not stall the UI.
+    const int kUploadsPerFrame = 4;
+    // A queued thumbnail not asked for in this many frames has scrolled
+    // out of view.
+    const uint64_t kStaleFrames = 2;
+    // Head of a JPEG searched for an EXIF thumbnail; APP1 is at most 64 KiB.
+    const size_t kExifHeadBytes = 64 * 1024;
+    // A server preview larger than this is not a thumbnail.
+    const size_t kMaxPreviewBytes = 512 * 1024;
+    // Larger images get an icon rather than a long fetch.
+    const int64_t kMaxSourceBytes = 16 * 1024 * 1024;
+    const int kCacheQuality = 80;
+    // A worker's remote connection is released after this long idle.
+    const int kIdleSeconds = 10;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, Slot> slots;
+    std::vector<Thread> workers;
+    bool stopping = false;
+    uint64_t frame = 0;
+    // The connected site, copied for the workers' connections. Clear(true)
+    // bumps the generation, and workers drop connections to an older one.
+    RemoteSettings site;
+    bool have_site = false;
+    uint32_t site_generation = 0;
+
+    std::mutex cache_mutex;
+    int64_t cache_bytes = 0;
+
+    std::string CacheFile(const std::string &key)
+    {
+        // FNV-1a
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char c : key)
+        {
+            hash ^= c;
+            hash *= 0x100000001b3ULL;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "/%016llx.jpg", (unsigned long long)hash);
+        return THUMBNAIL_CACHE_PATH + std::string(name);
+    }
+
+    bool IsImage(const DirEntry &entry)
+    {
+        std::string ext = Util::ToLower(FS::GetFileExt(entry.name));
+        return image_file_extensions.find(ext) != image_file_extensions.end();
+    }
+
+    bool IsJpeg(const char *name)
+    {
+        std::string ext = FS::GetFileExt(name);
+        return ext == ".JPG" || ext == ".JPEG";
+    }
+
+    // Reads up to `size` bytes from the start of the file into `buffer`.
+    // Returns the count, or -1 on failure.
+    int64_t ReadHead(const DirEntry &entry, RemoteClient *client, TransferBuffer &buffer, size_t size)
+    {
+        if (!buffer.Acquire(size))
+            return -1;
+        if (client != nullptr)
+            return client->GetRange(entry.path, buffer.data(), size, 0);
+
+        FILE *in = FS::OpenRead(entry.path);
+        if (in == nullptr)
+            return -1;
+        int64_t got = 0;
+        while (got < (int64_t)size)
+        {
+            int n = FS::Read(in, buffer.data() + got, size - got);
+            if (n <= 0)
+                break;
+            got += n;
+        }
+        FS::Close(in);
+        return got;
+    }
+
+    int64_t ReadWhole(const DirEntry &entry, RemoteClient *client, TransferBuffer &buffer)
+    {
+        int64_t size = entry.file_size;
+        if (size <= 0 && client != nullptr && !client->Size(entry.path, &size))
+            return -1;
+        if (size <= 0 && client == nullptr)
+            size = FS::GetSize(entry.path);
+        if (size <= 0 || size > kMaxSourceBytes)
+            return -1;
+        if (client == nullptr)
+            return ReadHead(entry, nullptr, buffer, size) == size ? size : -1;
+
+        ReadHints hints;
+        hints.size = size;
+        // The client may be mid-download on another thread; its FTP
+        // callback is left alone.
+        hints.progress = true;
+        std::unique_ptr<RemoteReader> reader = client->OpenRead(entry.path, hints);
+        if (reader == nullptr || !buffer.Acquire(size))
+            return -1;
+        MemorySink sink(buffer.data(), size);
+        return reader->StreamTo(sink) ? size : -1;
+    }
+
+    // The preview `client` has the server make or send of `entry`, decoded
+    // by what its first bytes say it is. False when there is none.
+    bool GetPreview(const DirEntry &entry, RemoteClient *client, TransferBuffer &buffer, Image &image)
+    {
+        if (!buffer.Acquire(kMaxPreviewBytes))
+            return false;
+        size_t received = 0;
+        int ok = client->GetPreview(entry.path, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, [&](const char *data, size_t len)
+                                    {
+                                        if (received + len > kMaxPreviewBytes)
+                                            return false;
+                                        memcpy(buffer.data() + received, data, len);
+                                        received += len;
+                                        return true;
+                                    });
+        const unsigned char *data = (const unsigned char *)buffer.data();
+        const char *type = nullptr;
+        if (ok > 0 && received >= 12 && data[0] == 0xFF && data[1] == 0xD8)
+            type = ".jpg";
+        else if (ok > 0 && received >= 12 && memcmp(data, "\x89PNG", 4) == 0)
+            type = ".png";
+        else if (ok > 0 && received >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0)
+            type = ".webp";
+        bool made = type != nullptr && Textures::DecodeImage(type, (unsigned char *)buffer.data(), received,
+                                                             THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, image);
+        buffer.Release();
+        return made;
+    }
+
+    uint16_t Get16(const unsigned char *p, bool little)
+    {
+        return little ? (p[0] | p[1] << 8) : (p[0] << 8 | p[1]);
+    }
+
+    uint32_t Get32(const unsigned char *p, bool little)
+    {
+        return little ? ((uint32_t)Get16(p + 2, true) << 16 | Get16(p, true))
+                      : ((uint32_t)Get16(p, false) << 16 | Get16(p + 2, false));
+    }
+
+    // Finds the JPEG thumbnail a camera embeds in the EXIF APP1 segment:
+    // the JPEGInterchangeFormat (0x0201) and its length (0x0202) in IFD1.
+    bool FindExifThumbnail(const unsigned char *data, size_t size, const unsigned char *&thumb, size_t &thumb_size)
+    {
+        if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+            return false;
+        size_t pos = 2;
+        while (pos + 4 <= size && data[pos] == 0xFF)
+        {
+            unsigned char marker = data[pos + 1];
+            size_t length = Get16(data + pos + 2, false);
+            // Start of scan: the image data follows, no more metadata.
+            if (marker == 0xDA || length < 2)
+                return false;
+            if (marker != 0xE1 || length < 16 || pos + 2 + length > size || memcmp(data + pos + 4, "Exif\0\0", 6) != 0)
+            {
+                pos += 2 + length;
+                continue;
+            }
+
+            const unsigned char *tiff = data + pos + 10;
+            size_t tiff_size = length - 8;
+            bool little = tiff[0] == 'I';
+            if ((tiff[0] != 'I' && tiff[0] != 'M') || Get16(tiff + 2, little) != 42)
+                return false;
+            uint32_t ifd0 = Get32(tiff + 4, little);
+            if ((uint64_t)ifd0 + 2 > tiff_size)
+                return false;
+            uint64_t ifd1_link = (uint64_t)ifd0 + 2 + 12 * Get16(tiff + ifd0, little);
+            if (ifd1_link + 4 > tiff_size)
+                return false;
+            uint32_t ifd1 = Get32(tiff + ifd1_link, little);
+            if (ifd1 == 0 || (uint64_t)ifd1 + 2 > tiff_size)
+                return false;
+
+            uint32_t offset = 0, count = 0;
+            uint16_t entries = Get16(tiff + ifd1, little);
+            for (uint16_t i = 0; i < entries && (uint64_t)ifd1 + 2 + 12 * (i + 1) <= tiff_size; i++)
+            {
+                const unsigned char *tag = tiff + ifd1 + 2 + 12 * i;
+                if (Get16(tag, little) == 0x0201)
+                    offset = Get32(tag + 8, little);
+                else if (Get16(tag, little) == 0x0202)
+                    count = Get32(tag + 8, little);
+            }
+            if (offset == 0 || count == 0 || (uint64_t)offset + count > tiff_size)
+                return false;
+            thumb = tiff + offset;
+            thumb_size = count;
+            return true;
+        }
+        return false;
+    }
+
+    // Area-averages `image` down to fit the thumbnail box; the decoders
+    // only get within a whole factor of it.
+    void Shrink(Image &image)
+    {
+        if (image.width <= THUMBNAIL_WIDTH && image.height <= THUMBNAIL_HEIGHT)
+            return;
+        int width = THUMBNAIL_WIDTH, height = THUMBNAIL_HEIGHT;
+        if ((int64_t)image.width * THUMBNAIL_HEIGHT > (int64_t)image.height * THUMBNAIL_WIDTH)
+            height = std::max(1, (int)((int64_t)image.height * THUMBNAIL_WIDTH / image.width));
+        else
+            width = std::max(1, (int)((int64_t)image.width * THUMBNAIL_HEIGHT / image.height));
+
+        Image out;
+        out.width = width;
+        out.height = height;
+        out.pixels.resize((size_t)width * height * 4);
+        for (int y = 0; y < height; y++)
+        {
+            int y0 = (int64_t)y * image.height / height, y1 = std::max(y0 + 1, (int)((int64_t)(y + 1) * image.height / height));
+            for (int x = 0; x < width; x++)
+            {
+                int x0 = (int64_t)x * image.width / width, x1 = std::max(x0 + 1, (int)((int64_t)(x + 1) * image.width / width));
+                uint32_t sum[4] = {0, 0, 0, 0};
+                for (int sy = y0; sy < y1; sy++)
+                {
+                    const unsigned char *in = image.pixels.data() + ((size_t)sy * image.width + x0) * 4;
+                    for (int sx = x0; sx < x1; sx++, in += 4)
+                    {
+                        sum[0] += in[0];
+                        sum[1] += in[1];
+                        sum[2] += in[2];
+                        sum[3] += in[3];
+                    }
+                }
+                uint32_t area = (uint32_t)(x1 - x0) * (y1 - y0);
+                unsigned char *px = out.pixels.data() + ((size_t)y * width + x) * 4;
+                for (int c = 0; c < 4; c++)
+                    px[c] = sum[c] / area;
+            }
+        }
+        image = std::move(out);
+    }
+
+    // Deletes the oldest cached thumbnails until the cache is back under
+    // three quarters of thumbnail_cache_mb.
+    void PruneCache()
+    {
+        struct CachedFile
+        {
+            std::string path;
+            time_t mtime;
+            int64_t size;
+        };
+        std::vector<CachedFile> files;
+        int64_t total = 0;
+        for (const std::string &name : FS::ListFiles(THUMBNAIL_CACHE_PATH))
+        {
+            std::string path = THUMBNAIL_CACHE_PATH "/" + name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0)
+                continue;
+            files.push_back({path, st.st_mtime, (int64_t)st.st_size});
+            total += st.st_size;
+        }
+
+        int64_t limit = (int64_t)thumbnail_cache_mb * 1024 * 1024;
+        if (total > limit)
+        {
+            std::sort(files.begin(), files.end(), [](const CachedFile &a, const CachedFile &b)
+                      { return a.mtime < b.mtime; });
+            int removed = 0;
+            for (size_t i = 0; i < files.size() && total > limit * 3 / 4; i++, removed++)
+            {
+                FS::Rm(files[i].path);
+                total -= files[i].size;
+            }
+            Logger::Logf("THUMBNAIL CACHE pruned files=%d bytes=%lld", removed, (long long)total);
+        }
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache_bytes = total;
+    }
+
+    void SaveCache(const std::string &path, const Image &image)
+    {
+        tjhandle jpeg = tjInitCompress();
+        if (jpeg == nullptr)
+            return;
+        unsigned char *out = nullptr;
+        unsigned long out_size = 0;
+        if (tjCompress2(jpeg, image.pixels.data(), image.width, 0, image.height, TJPF_RGBA, &out, &out_size,
+                        TJSAMP_420, kCacheQuality, TJFLAG_FASTDCT) == 0)
+        {
+            FS::Save(path, out, out_size);
+            bool prune;
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                cache_bytes += out_size;
+                prune = cache_bytes > (int64_t)thumbnail_cache_mb * 1024 * 1024;
+            }
+            if (prune)
+                PruneCache();
+        }
+        tjFree(out);
+        tjDestroy(jpeg);
+    }
+
+    bool LoadCache(const std::string &path, Image &image)
+    {
+        TransferBuffer buffer;
+        FILE *in = FS::OpenRead(path);
+        if (in == nullptr)
+            return false;
+        int64_t size = FS::GetSize(path);
+        bool ok = size > 0 && size <= (int64_t)kExifHeadBytes * 4 && buffer.Acquire(size) &&
+                  FS::Read(in, buffer.data(), size) == size;
+        FS::Close(in);
+        return ok && Textures::DecodeImage(".jpg", (unsigned char *)buffer.data(), size, THUMBNAIL_WIDTH,
+                                           THUMBNAIL_HEIGHT, image);
+    }
+
+    // The icon of a package, with its title and version kept by
+    // PackageInfo. A package read before is not read again: without an
+    // icon then there is none, and a cached one is the thumbnail.
+    bool MakePackageIcon(const std::string &key, const DirEntry &entry, RemoteClient *client, Image &image)
+    {
+        std::string cache_file = CacheFile(key);
+        PackageInfo::Info info;
+        bool known = PackageInfo::Find(key, info);
+        if (known && !info.icon)
+            return false;
+        if (known && thumbnail_cache_mb > 0 && LoadCache(cache_file, image))
+            return true;
+
+        std::vector<char> icon;
+        uint64_t started = Util::GetTick();
+        if (!PackageInfo::Read(entry, client, info, icon))
+            return false;
+        PackageInfo::Store(key, info);
+        Logger::Logf(Logger::LOG_DEBUG, "PACKAGE INFO path=%s title=%s version=%s icon=%d ms=%llu", entry.path,
+                     info.title.c_str(), info.version.c_str(), (int)icon.size(),
+                     (unsigned long long)((Util::GetTick() - started) / 1000));
+        if (icon.empty() || !Textures::DecodeImage(".jpg", (unsigned char *)icon.data(), icon.size(), THUMBNAIL_WIDTH,
+                                                   THUMBNAIL_HEIGHT, image))
+            return false;
+        Shrink(image);
+        if (thumbnail_cache_mb > 0)
+            SaveCache(cache_file, image);
+        return true;
+    }
+
+    bool MakeThumbnail(const std::string &key, const DirEntry &entry, RemoteClient *client, Image &image)
+    {
+        if (PackageInfo::IsPackage(entry))
+            return MakePackageIcon(key, entry, client, image);
+
+        std::string cache_file = CacheFile(key);
+        if (thumbnail_cache_mb > 0 && LoadCache(cache_file, image))
+            return true;
+
+        TransferBuffer buffer;
+        bool made = client != nullptr && GetPreview(entry, client, buffer, image);
+        if (!made && IsJpeg(entry.name))
+        {
+            int64_t got = ReadHead(entry, client, buffer, std::min<uint64_t>(kExifHeadBytes, entry.file_size > 0 ? entry.file_size : kExifHeadBytes));
+            const unsigned char *thumb = nullptr;
+            size_t thumb_size = 0;
+            if (got > 0 && FindExifThumbnail((unsigned char *)buffer.data(), got, thumb, thumb_size))
+                made = Textures::DecodeImage(".jpg", (unsigned char *)thumb, thumb_size, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, image);
+            // A small file may have been read whole already.
+            else if (got > 0 && (uint64_t)got == entry.file_size)
+                made = Textures::DecodeImage(entry.name, (unsigned char *)buffer.data(), got, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, image);
+            buffer.Release();
+        }
+        if (!made)
+        {
+            int64_t got = ReadWhole(entry, client, buffer);
+            made = got > 0 && Textures::DecodeImage(entry.name, (unsigned char *)buffer.data(), got, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, image);
+        }
+        if (!made)
+            return false;
+
+        Shrink(image);
+        if (thumbnail_cache_mb > 0)
+            SaveCache(cache_file, image);
+        return true;
+    }
+
+    // The queued slot wanted most recently, dropping the stale ones.
+    std::map<std::string, Slot>::iterator NextJob()
+    {
+        auto best = slots.end();
+        for (auto it = slots.begin(); it != slots.end();)
+        {
+            if (it->second.state != SLOT_QUEUED)
+            {
+                ++it;
+                continue;
+            }
+            if (it->second.wanted + kStaleFrames < frame)
+            {
+                it = slots.erase(it);
+                continue;
+            }
+            if (best == slots.end() || it->second.wanted > best->second.wanted)
+                best = it;
+            ++it;
+        }
+        return best;
+    }
+
+    void WorkerThread(void *arg)
+    {
+        RemoteClient *client = nullptr;
+        uint32_t client_generation = 0;
+        // A site this worker failed to connect to is not retried for
+        // every thumbnail.
+        bool connect_failed = false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            auto job = NextJob();
+            if (job == slots.end())
+            {
+                // The connection outlives a pause in scrolling, then goes
+                // back.
+                if (client == nullptr)
+                    cv.wait(lock);
+                else if (cv.wait_for(lock, std::chrono::seconds(kIdleSeconds)) == std::cv_status::timeout)
+                {
+                    lock.unlock();
+                    Actions::ReleaseBackgroundClient(client);
+                    client = nullptr;
+                    lock.lock();
+                }
+                continue;
+            }
+
+            job->second.state = SLOT_WORKING;
+            std::string key = job->first;
+            DirEntry entry = job->second.entry;
+            bool remote = job->second.remote;
+            RemoteSettings settings = site;
+            uint32_t generation = site_generation;
+            lock.unlock();
+
+            if (client_generation != generation)
+            {
+                if (client != nullptr)
+                    Actions::ReleaseBackgroundClient(client);
+                client = nullptr;
+                client_generation = generation;
+                connect_failed = false;
+            }
+            if (remote && client == nullptr && !connect_failed)
+            {
+                client = Actions::ConnectBackgroundClient(settings, "Thumbnail");
+                connect_failed = client == nullptr;
+            }
+
+            Image image;
+            bool ok = (!remote || client != nullptr) && MakeThumbnail(key, entry, remote ? client : nullptr, image);
+
+            lock.lock();
+            auto it = slots.find(key);
+            if (it != slots.end() && it->second.state == SLOT_WORKING)
+            {
+                it->second.state = ok ? SLOT_DECODED : SLOT_FAILED;
+                it->second.image = std::move(image);
+            }
+        }
+        lock.unlock();
+        if (client != nullptr)
+            Actions::ReleaseBackgroundClient(client);
+    }
+}
+
+namespace Thumbnails
+{
+    void Init()
+    {
+        if (thumbnail_workers <= 0)
+            return;
+        if (thumbnail_cache_mb > 0)
+        {
+            FS::MkDirs(THUMBNAIL_CACHE_PATH);
+            PruneCache();
+        }
+
+        stopping = false;
+        workers.resize(thumbnail_workers);
+        int started = 0;
+        for (int i = 0; i < thumbnail_workers; i++)
+        {
+            // Decoders want more stack than a transfer does.
+            Result rc = Threads::Create(&workers[started], WorkerThread, nullptr, 0x20000, Threads::ROLE_BACKGROUND, "thumbnail");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "THUMBNAIL threadCreate failed index=%d rc=0x%x", i, rc);
+                continue;
+            }
+            threadStart(&workers[started]);
+            started++;
+        }
+        workers.resize(started);
+        Logger::Logf("THUMBNAIL init workers=%d cache_mb=%d", started, thumbnail_cache_mb);
+    }
+
+    void Exit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (Thread &thread : workers)
+        {
+            Threads::Join(&thread);
+        }
+        workers.clear();
+
+        for (auto &it : slots)
+        {
+            if (it.second.state == SLOT_READY)
+                Textures::Free(it.second.texture);
+        }
+        slots.clear();
+    }
+
+    const Tex *Get(const DirEntry &entry, bool remote)
+    {
+        if (entry.isDir || (!IsImage(entry) && !(package_info && PackageInfo::IsPackage(entry))) || (remote && remote_settings == nullptr))
+            return nullptr;
+        std::string key = Key(entry, remote);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (workers.empty())
+            return nullptr;
+        auto it = slots.find(key);
+        if (it == slots.end())
+        {
+            if (remote && !have_site)
+            {
+                site = *remote_settings;
+                have_site = true;
+            }
+            Slot &slot = slots[key];
+            slot.entry = entry;
+            slot.remote = remote;
+            slot.wanted = frame;
+            cv.notify_one();
+            return nullptr;
+        }
+        it->second.wanted = frame;
+        return it->second.state == SLOT_READY ? &it->second.texture : nullptr;
+    }
+
+    void Upload()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frame++;
+
+        int uploads = 0;
+        for (auto it = slots.begin(); it != slots.end() && uploads < kUploadsPerFrame; ++it)
+        {
+            Slot &slot = it->second;
+            if (slot.state != SLOT_DECODED)
+                continue;
+            slot.state = Textures::Upload(slot.image, slot.texture) ? SLOT_READY : SLOT_FAILED;
+            std::vector<unsigned char>().swap(slot.image.pixels);
+            uploads++;
+        }
+
+        // Retire the thumbnails shown longest ago, never one on screen.
+        while (slots.size() > kMaxSlots)
+        {
+            auto oldest = slots.end();
+            for (auto it = slots.begin(); it != slots.end(); ++it)
+            {
+                if (it->second.state == SLOT_WORKING || it->second.wanted + 1 >= frame)
+                    continue;
+                if (oldest == slots.end() || it->second.wanted < oldest->second.wanted)
+                    oldest = it;
+            }
+            if (oldest == slots.end())
+                break;
+            if (oldest->second.state == SLOT_READY)
+                Textures::Free(oldest->second.texture);
+            slots.erase(oldest);
+        }
+    }
+
+    bool Busy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &it : slots)
+        {
+            if (it.second.state == SLOT_QUEUED || it.second.state == SLOT_WORKING || it.second.state == SLOT_DECODED)
+                return true;
+        }
+        return false;
+    }
+
+    std::string Key(const DirEntry &entry, bool remote)
+    {
+        char key[1400];
+        snprintf(key, sizeof(key), "%s|%s|%llu|%04d%02d%02d%02d%02d%02d",
+                 remote ? remote_settings->server : "sdmc", entry.path, (unsigned long long)entry.file_size,
+                 entry.modified.year, entry.modified.month, entry.modified.day, entry.modified.hours,
+                 entry.modified.minutes, entry.modified.seconds);
+        return key;
+    }
+
+    void Clear(bool remote)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = slots.begin(); it != slots.end();)
+        {
+            if (it->second.remote != remote)
+            {
+                ++it;
+                continue;
+            }
+            if (it->second.state == SLOT_READY)
+                Textures::Free(it->second.texture);
+            it = slots.erase(it);
+        }
+        if (remote)
+        {
+            have_site = false;
+            site_generation++;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef NEO_THUMBNAILS_H
+#define NEO_THUMBNAILS_H
+
+#include "common.h"
+#include "textures.h"
+
+// Box a grid cell shows its thumbnail in.
+#define THUMBNAIL_WIDTH 128
+#define THUMBNAIL_HEIGHT 96
+#define THUMBNAIL_CACHE_PATH DATA_PATH "/thumbs"
+
+// Thumbnails for the grid view. thumbnail_workers threads fetch and decode
+// them off the UI thread, most recently wanted first, so the cells on
+// screen fill in while it keeps scrolling; what scrolled away before a
+// worker got to it is dropped. Remote images are read on connections of
+// the workers' own: the preview the server makes or keeps where it has
+// one (RemoteClient::GetPreview()), else JPEGs from their embedded EXIF
+// thumbnail when the first 64 KiB hold one. Packages get their icon, read
+// by PackageInfo, which keeps their title and version as well. Made
+// thumbnails are kept as small JPEGs under THUMBNAIL_CACHE_PATH, up to
+// thumbnail_cache_mb MiB.
+namespace Thumbnails
+{
+    void Init();
+    void Exit();
+
+    // The thumbnail of `entry`, or nullptr while it is being made or when
+    // it cannot have one. Asking once a frame keeps it wanted.
+    const Tex *Get(const DirEntry &entry, bool remote);
+    // Turns a few finished decodes into textures and retires the least
+    // recently shown; once a frame, on the UI thread.
+    void Upload();
+    // Thumbnails asked for are still being made.
+    bool Busy();
+    // Forgets the remote thumbnails, e.g. after disconnecting.
+    void Clear(bool remote);
+    // What the thumbnail of `entry` is cached under: the site, path, size
+    // and date. Also the key of PackageInfo::Find().
+    std::string Key(const DirEntry &entry, bool remote);
+}
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <switch.h>
+
+#include "timeline.h"
+#include "config.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+
+namespace
+{
+    using Timeline::kEvents;
+    using Timeline::kThreads;
+
+    // Tracks per thread for the multi client's slots; later slots share
+    // the last one.
+    const int kSlotTracks = 64;
+    // A thread that found no free ring tries again this much later.
+    const uint64_t kClaimRetryUs = 1000000;
+
+    struct Event
+    {
+        const char *name;
+        uint64_t start;
+        uint32_t dur;
+        int16_t slot;
+        int32_t tls_us;
+        int32_t ttfb_us;
+        int64_t bytes;
+    };
+
+    struct Ring
+    {
+        // Written only by the owning thread; `count` is published with
+        // release so the exporter sees the events before it.
+        Event *events = nullptr;
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint64_t> last_us{0};
+        // Under `mutex`.
+        Handle owner = INVALID_HANDLE;
+        std::string label;
+    };
+
+    // Guards the rings' owners and labels; held by the export throughout.
+    std::mutex mutex;
+    Ring rings[kThreads];
+    // Set while an export reads the rings; recording is skipped meanwhile
+    // so the rings hold still.
+    std::atomic<bool> paused{false};
+    thread_local Ring *ring = nullptr;
+    thread_local uint64_t claim_retry_at = 0;
+
+    std::mutex export_mutex;
+    Thread export_thread;
+    bool exporting = false;
+    bool joinable = false;
+    std::string last_export;
+
+    Ring *Claim()
+    {
+        uint64_t now = Util::GetTick();
+        if (claim_retry_at != 0 && now < claim_retry_at)
+            return nullptr;
+
+        Handle self = threadGetCurHandle();
+        std::lock_guard<std::mutex> lock(mutex);
+        Ring *found = nullptr;
+        for (Ring &r : rings)
+        {
+            if (r.owner == INVALID_HANDLE)
+            {
+                found = &r;
+                break;
+            }
+        }
+        if (found == nullptr)
+        {
+            // The ring of the thread that exited longest ago.
+            for (Ring &r : rings)
+            {
+                if (!Threads::Alive(r.owner) &&
+                    (found == nullptr || r.last_us.load(std::memory_order_relaxed) < found->last_us.load()))
+                    found = &r;
+            }
+        }
+        if (found != nullptr && found->events == nullptr)
+            found->events = new (std::nothrow) Event[kEvents];
+        if (found == nullptr || found->events == nullptr)
+        {
+            claim_retry_at = now + kClaimRetryUs;
+            return nullptr;
+        }
+        found->owner = self;
+        found->label = Threads::Label(self);
+        found->count.store(0, std::memory_order_relaxed);
+        found->last_us.store(now, std::memory_order_relaxed);
+        return found;
+    }
+
+    int Tid(int ring_index, int slot)
+    {
+        if (slot < 0)
+            return ring_index + 1;
+        return (ring_index + 1) * 1000 + 1 + std::min(slot, kSlotTracks - 1);
+    }
+
+    bool Write(FILE *file, size_t &events, int &threads)
+    {
+        // The earliest span is time zero.
+        uint64_t origin = UINT64_MAX;
+        for (Ring &r : rings)
+        {
+            uint32_t count = r.count.load(std::memory_order_acquire);
+            uint32_t first = count > (uint32_t)kEvents ? count - kEvents : 0;
+            for (uint32_t i = first; i < count; i++)
+                origin = std::min(origin, r.events[i % kEvents].start);
+        }
+        if (origin == UINT64_MAX)
+            origin = 0;
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"" APP_ID "\"}}");
+        for (int t = 0; t < kThreads; t++)
+        {
+            Ring &r = rings[t];
+            uint32_t count = r.count.load(std::memory_order_acquire);
+            if (r.events == nullptr || count == 0)
+                continue;
+            threads++;
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    Tid(t, -1), r.label.c_str());
+
+            bool named[kSlotTracks] = {false};
+            uint32_t first = count > (uint32_t)kEvents ? count - kEvents : 0;
+            for (uint32_t i = first; i < count; i++)
+            {
+                const Event &e = r.events[i % kEvents];
+                if (e.slot >= 0 && !named[std::min<int>(e.slot, kSlotTracks - 1)])
+                {
+                    named[std::min<int>(e.slot, kSlotTracks - 1)] = true;
+                    fprintf(file,
+                            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s slot %d\"}}",
+                            Tid(t, e.slot), r.label.c_str(), e.slot);
+                }
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%u", e.name,
+                        Tid(t, e.slot), (unsigned long long)(e.start - origin), e.dur);
+                if (e.bytes >= 0 || e.tls_us >= 0 || e.ttfb_us >= 0)
+                {
+                    const char *sep = "";
+                    fprintf(file, ",\"args\":{");
+                    if (e.bytes >= 0)
+                    {
+                        fprintf(file, "\"bytes\":%lld", (long long)e.bytes);
+                        sep = ",";
+                    }
+                    if (e.tls_us >= 0)
+                    {
+                        fprintf(file, "%s\"tls_us\":%d", sep, e.tls_us);
+                        sep = ",";
+                    }
+                    if (e.ttfb_us >= 0)
+                        fprintf(file, "%s\"ttfb_us\":%d", sep, e.ttfb_us);
+                    fprintf(file, "}");
+                }
+                fprintf(file, "}");
+                events++;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return !ferror(file);
+    }
+
+    void ExportThread(void *)
+    {
+        uint64_t started = Util::GetTick();
+        size_t events = 0;
+        int threads = 0;
+        bool ok = false;
+        FILE *file = fopen(TIMELINE_FILE, "w");
+        if (file != nullptr)
+        {
+            static char buffer[64 * 1024];
+            setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+            paused.store(true);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ok = Write(file, events, threads);
+            }
+            paused.store(false);
+            ok = fclose(file) == 0 && ok;
+        }
+
+        char text[256];
+        if (ok)
+            snprintf(text, sizeof(text), "%zu events of %d threads saved to %s", events, threads, TIMELINE_FILE);
+        else
+            snprintf(text, sizeof(text), "Could not write %s", TIMELINE_FILE);
+        Logger::Logf(ok ? Logger::LOG_INFO : Logger::LOG_ERROR, "TIMELINE export ok=%d events=%zu threads=%d ms=%llu",
+                     ok ? 1 : 0, events, threads, (unsigned long long)((Util::GetTick() - started) / 1000));
+
+        std::lock_guard<std::mutex> lock(export_mutex);
+        last_export = text;
+        exporting = false;
+    }
+}
+
+namespace Timeline
+{
+    bool Enabled()
+    {
+        return timeline_trace;
+    }
+
+    void Record(const char *name, uint64_t start_us, uint64_t end_us, int slot, int64_t bytes, int32_t tls_us,
+                int32_t ttfb_us)
+    {
+        if (!timeline_trace || paused.load(std::memory_order_relaxed))
+            return;
+        if (ring == nullptr && (ring = Claim()) == nullptr)
+            return;
+
+        uint32_t count = ring->count.load(std::memory_order_relaxed);
+        Event &e = ring->events[count % kEvents];
+        e.name = name;
+        e.start = start_us;
+        e.dur = end_us > start_us ? (uint32_t)std::min<uint64_t>(end_us - start_us, UINT32_MAX) : 0;
+        e.slot = (int16_t)slot;
+        e.bytes = bytes;
+        e.tls_us = tls_us;
+        e.ttfb_us = ttfb_us;
+        ring->last_us.store(end_us, std::memory_order_relaxed);
+        ring->count.store(count + 1, std::memory_order_release);
+    }
+
+    bool Export()
+    {
+        std::lock_guard<std::mutex> lock(export_mutex);
+        if (exporting)
+            return false;
+        if (joinable)
+        {
+            // Finished, so this does not wait.
+            Threads::Join(&export_thread);
+            joinable = false;
+        }
+        ::Result rc = Threads::Create(&export_thread, ExportThread, nullptr, 0x10000, Threads::ROLE_DISK,
+                                      "timeline export");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "TIMELINE threadCreate failed rc=0x%x", rc);
+            return false;
+        }
+        threadStart(&export_thread);
+        exporting = true;
+        joinable = true;
+        return true;
+    }
+
+    bool Exporting()
+    {
+        std::lock_guard<std::mutex> lock(export_mutex);
+        return exporting;
+    }
+
+    std::string LastExport()
+    {
+        std::lock_guard<std::mutex> lock(export_mutex);
+        return last_export;
+    }
+
+    Scope::Scope(const char *name) : name(name), start(timeline_trace ? Util::GetTick() : 0)
+    {
+    }
+
+    Scope::~Scope()
+    {
+        if (start != 0)
+            Record(name, start, Util::GetTick());
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef NEO_TIMELINE_H
+#define NEO_TIMELINE_H
+
+#include <cstdint>
+#include <string>
+
+// A timeline of what every thread was doing, with [Global] timeline_trace,
+// exported from Settings as Chrome trace-event JSON (TIMELINE_FILE) that
+// chrome://tracing or ui.perfetto.dev opens. Where trace.csv answers how
+// long each request took, this shows the threads side by side: the UI's
+// frames and their sections (FrameProfiler), each request of the transfer
+// engines by slot (TransferTrace), listing parses, archive work and the
+// disk writer, so e.g. TLS handshakes queued on one core or the writer
+// stalling the network threads show up as gaps and overlaps.
+//
+// Each thread records into a ring of its own, claimed on its first event,
+// so recording takes no lock; once kThreads rings are in use a new thread
+// takes over the one of a thread that has exited, and records nothing if
+// there is none. A ring keeps the last kEvents events. Off, a Scope costs
+// a branch.
+namespace Timeline
+{
+    static const int kThreads = 32;
+    static const int kEvents = 4096;
+
+    bool Enabled();
+
+    // One finished span on the calling thread. `name` must be a string
+    // literal or otherwise outlive the export. `slot` puts the span on a
+    // track of its own under the thread (the HTTP multi client's request
+    // slots); -1 for the thread's own track. `bytes`, `tls_us` and
+    // `ttfb_us` are exported as arguments when not negative.
+    void Record(const char *name, uint64_t start_us, uint64_t end_us, int slot = -1, int64_t bytes = -1,
+                int32_t tls_us = -1, int32_t ttfb_us = -1);
+
+    // Writes TIMELINE_FILE on a disk thread; false while an export runs.
+    bool Export();
+    bool Exporting();
+    // The outcome of the last export, empty before the first.
+    std::string LastExport();
+
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *name;
+        uint64_t start;
+    };
+}
+
+#define TIMELINE_CONCAT_(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT_(a, b)
+// Records the enclosing block as a span named `name`.
+#define TIMELINE_SCOPE(name) Timeline::Scope TIMELINE_CONCAT(timeline_scope_, __LINE__)(name)
+
+#endif
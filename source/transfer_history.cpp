@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "transfer_history.h"
+#include "config.h"
+#include "fs.h"
+#include "logger.h"
+
+namespace TransferHistory
+{
+    namespace
+    {
+        const char kMagic[8] = {'N', 'E', 'O', 'H', 'I', 'S', 'T', 0};
+        const uint32_t kVersion = 1;
+        // Batches smaller than this mostly measure connection setup, so
+        // Best() does not go by them.
+        const int64_t kMinBestBytes = 64LL * 1024 * 1024;
+        // Best() compares the newest this many of a site's batches, so
+        // a server that got faster or slower is followed.
+        const int kBestWindow = 32;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+        };
+
+        std::mutex mutex;
+        bool loaded = false;
+        // The file does not match `records` (missing, foreign or cut off
+        // mid-record) and is rewritten by the next Add().
+        bool rewrite = false;
+        std::vector<Record> records;
+
+        void Load()
+        {
+            if (loaded)
+                return;
+            loaded = true;
+            rewrite = true;
+            FILE *in = fopen(HISTORY_FILE, "rb");
+            if (in == nullptr)
+                return;
+            Header header;
+            if (fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+                header.version == kVersion && header.record_size == sizeof(Record))
+            {
+                Record record;
+                while (fread(&record, sizeof(record), 1, in) == 1)
+                {
+                    record.site[sizeof(record.site) - 1] = '\0';
+                    records.push_back(record);
+                }
+                rewrite = !feof(in) || ftell(in) != (long)(sizeof(Header) + records.size() * sizeof(Record));
+            }
+            fclose(in);
+            if (records.size() > (size_t)kMaxRecords)
+                rewrite = true;
+        }
+
+        // Drops all but the newest kKeepPerLink of each site, interface
+        // and direction.
+        void Compact()
+        {
+            size_t before = records.size();
+            std::vector<Record> kept;
+            std::map<std::string, int> per_link;
+            for (size_t i = records.size(); i-- > 0;)
+            {
+                const Record &r = records[i];
+                std::string link = std::string(r.site) + '/' + (char)('0' + r.iface) + (char)('0' + r.direction);
+                if (per_link[link]++ < kKeepPerLink)
+                    kept.push_back(r);
+            }
+            if (kept.size() > (size_t)kMaxRecords / 2)
+                kept.resize(kMaxRecords / 2);
+            std::reverse(kept.begin(), kept.end());
+            records.swap(kept);
+            Logger::Logf("HISTORY compacted records=%zu->%zu", before, records.size());
+        }
+
+        bool Rewrite()
+        {
+            if (records.size() > (size_t)kMaxRecords)
+                Compact();
+            std::string tmp = std::string(HISTORY_FILE) + ".tmp";
+            FILE *out = FS::Create(tmp);
+            if (out == nullptr)
+                return false;
+            Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.version = kVersion;
+            header.record_size = sizeof(Record);
+            bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+            if (!records.empty())
+                ok = fwrite(records.data(), sizeof(Record), records.size(), out) == records.size() && ok;
+            ok = fclose(out) == 0 && ok;
+            if (!ok)
+            {
+                FS::Rm(tmp);
+                return false;
+            }
+            FS::Rm(HISTORY_FILE);
+            return FS::Rename(tmp, HISTORY_FILE);
+        }
+
+        double Median(std::vector<float> values)
+        {
+            if (values.empty())
+                return 0;
+            std::sort(values.begin(), values.end());
+            return values[values.size() / 2];
+        }
+    }
+
+    void Add(Record record)
+    {
+        if (!transfer_history || record.bytes <= 0)
+            return;
+        NetIface::State iface = NetIface::Last();
+        record.time = (uint64_t)time(nullptr);
+        record.iface = (uint8_t)iface.type;
+        record.signal = (int8_t)iface.signal;
+        record.site[sizeof(record.site) - 1] = '\0';
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Load();
+        records.push_back(record);
+        bool ok;
+        if (rewrite || records.size() > (size_t)kMaxRecords)
+        {
+            ok = Rewrite();
+            rewrite = !ok;
+        }
+        else
+        {
+            FILE *out = fopen(HISTORY_FILE, "ab");
+            ok = out != nullptr && fwrite(&record, sizeof(record), 1, out) == 1;
+            if (out != nullptr)
+                ok = fclose(out) == 0 && ok;
+            // A half-written record is cut off by the rewrite.
+            rewrite = !ok;
+        }
+        Logger::Logf(Logger::LOG_DEBUG, "HISTORY add site=%s protocol=%d direction=%d iface=%s bytes=%lld mib_s=%.2f "
+                     "workers=%d parallel=%d chunk_mb=%d ok=%d",
+                     record.site, record.protocol, record.direction, NetIface::Name(iface.type), (long long)record.bytes,
+                     record.mib_s, record.workers, record.parallel, record.chunk_mb, ok ? 1 : 0);
+    }
+
+    std::vector<Trend> Trends(const char *site)
+    {
+        std::vector<Trend> trends;
+        std::lock_guard<std::mutex> lock(mutex);
+        Load();
+        const NetIface::Type kinds[] = {NetIface::TYPE_ETHERNET, NetIface::TYPE_WIFI, NetIface::TYPE_NONE};
+        for (NetIface::Type kind : kinds)
+        {
+            Trend trend;
+            trend.iface = kind;
+            std::vector<float> rates;
+            for (const Record &r : records)
+            {
+                if (r.direction != DIRECTION_DOWNLOAD || r.iface != kind || strcmp(r.site, site) != 0)
+                    continue;
+                trend.runs++;
+                trend.last_mib_s = r.mib_s;
+                rates.push_back(r.mib_s);
+                if (r.mib_s > trend.best_mib_s)
+                {
+                    trend.best_mib_s = r.mib_s;
+                    trend.best_workers = r.workers;
+                    trend.best_parallel = r.parallel;
+                    trend.best_chunk_mb = r.chunk_mb;
+                }
+            }
+            if (trend.runs == 0)
+                continue;
+            trend.median_mib_s = Median(rates);
+            size_t first = rates.size() > (size_t)kSparkline ? rates.size() - kSparkline : 0;
+            trend.recent.assign(rates.begin() + first, rates.end());
+            trends.push_back(trend);
+        }
+        return trends;
+    }
+
+    bool Best(const char *site, int protocol, NetIface::Type iface, int *parallel, int *chunk_mb)
+    {
+        if (!transfer_history)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        Load();
+        // Average MiB/s and count per (parallel, chunk_mb).
+        std::map<std::pair<int, int>, std::pair<double, int>> tunings;
+        int seen = 0;
+        for (size_t i = records.size(); i-- > 0 && seen < kBestWindow;)
+        {
+            const Record &r = records[i];
+            if (r.direction != DIRECTION_DOWNLOAD || r.protocol != protocol || r.iface != iface ||
+                r.parallel == 0 || r.chunk_mb == 0 || r.bytes < kMinBestBytes || strcmp(r.site, site) != 0)
+                continue;
+            seen++;
+            std::pair<double, int> &t = tunings[std::make_pair((int)r.parallel, (int)r.chunk_mb)];
+            t.first += r.mib_s;
+            t.second++;
+        }
+        double best = 0;
+        for (const auto &t : tunings)
+        {
+            double average = t.second.first / t.second.second;
+            if (average > best)
+            {
+                best = average;
+                *parallel = t.first.first;
+                *chunk_mb = t.first.second;
+            }
+        }
+        if (best <= 0)
+            return false;
+        Logger::Logf("HISTORY best site=%s iface=%s parallel=%d chunk_mb=%d mib_s=%.2f runs=%d", site,
+                     NetIface::Name(iface), *parallel, *chunk_mb, best, seen);
+        return true;
+    }
+
+    std::string Summary(const Trend &t)
+    {
+        char text[256];
+        int n = snprintf(text, sizeof(text), "%s: %d runs, last %.1f MiB/s, median %.1f, best %.1f (%d workers",
+                         t.iface == NetIface::TYPE_ETHERNET ? "Ethernet" : t.iface == NetIface::TYPE_WIFI ? "Wi-Fi" : "Unknown",
+                         t.runs, t.last_mib_s, t.median_mib_s, t.best_mib_s, t.best_workers);
+        if (t.best_parallel > 0 && n > 0 && n < (int)sizeof(text))
+            n += snprintf(text + n, sizeof(text) - n, ", %d x %d MiB ranges", t.best_parallel, t.best_chunk_mb);
+        if (n > 0 && n < (int)sizeof(text))
+            snprintf(text + n, sizeof(text) - n, ")");
+        return text;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef NEO_TRANSFER_HISTORY_H
+#define NEO_TRANSFER_HISTORY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "net_iface.h"
+
+// Completed transfer batches, kept on the SD card across sessions
+// (HISTORY_FILE): site, protocol, interface, size, duration, the workers
+// and ranged tuning they ran with, retries and the throughput reached.
+// Records are fixed size and appended; once the file holds kMaxRecords
+// it is rewritten with the newest kKeepPerLink of each site, interface
+// and direction. The settings dialog shows the trend of the current site
+// per interface, and Best() gives webdav_autotune the tuning that was
+// fastest for a site on the interface in use, where the per-site values
+// in the config are the same on Wi-Fi and Ethernet. transfer_history=0
+// keeps nothing and seeds nothing.
+namespace TransferHistory
+{
+    static const int kMaxRecords = 2048;
+    static const int kKeepPerLink = 64;
+
+    enum Direction
+    {
+        DIRECTION_DOWNLOAD,
+        DIRECTION_UPLOAD
+    };
+
+    struct Record
+    {
+        // Unix time the batch ended.
+        uint64_t time;
+        // The site's config section ("Site 1").
+        char site[32];
+        int64_t bytes;
+        uint32_t ms;
+        uint32_t files;
+        uint32_t retries;
+        // ClientType, Direction, NetIface::Type and Wi-Fi bars.
+        uint8_t protocol;
+        uint8_t direction;
+        uint8_t iface;
+        int8_t signal;
+        // Queue workers, and the ranged requests per file and chunk size
+        // webdav_autotune ended on (0 when it did not run).
+        uint8_t workers;
+        uint8_t parallel;
+        uint16_t chunk_mb;
+        float mib_s;
+    };
+
+    // One interface's downloads from a site, newest last.
+    struct Trend
+    {
+        NetIface::Type iface = NetIface::TYPE_NONE;
+        int runs = 0;
+        double last_mib_s = 0;
+        double median_mib_s = 0;
+        double best_mib_s = 0;
+        int best_workers = 0;
+        int best_parallel = 0;
+        int best_chunk_mb = 0;
+        // The last kSparkline runs' MiB/s, for a plot.
+        std::vector<float> recent;
+    };
+    static const int kSparkline = 32;
+
+    // Appends `record` (time, iface and signal are filled in here).
+    void Add(Record record);
+    std::vector<Trend> Trends(const char *site);
+    // The ranged tuning whose downloads from `site` over `protocol` on
+    // `iface` averaged the most MiB/s; false without such history.
+    bool Best(const char *site, int protocol, NetIface::Type iface, int *parallel, int *chunk_mb);
+    // One line of the settings dialog.
+    std::string Summary(const Trend &trend);
+}
+
+#endif
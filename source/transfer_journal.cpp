@@ -0,0 +1,314 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "transfer_journal.h"
+#include "config.h"
+#include "fs.h"
+#include "util.h"
+#include "logger.h"
+
+#define JOURNAL_HEADER "neo_sftp journal 1"
+
+namespace
+{
+    // FNV-1a keeps journal names short and valid on FAT32 whatever the
+    // destination path contains.
+    std::string HashName(const std::string &text)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char ch : text)
+        {
+            hash ^= ch;
+            hash *= 1099511628211ULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.jnl", (unsigned long long)hash);
+        return name;
+    }
+
+    const char *Value(const std::string &line, const char *key)
+    {
+        size_t len = strlen(key);
+        if (line.size() > len && line.compare(0, len, key) == 0 && line[len] == '=')
+            return line.c_str() + len + 1;
+        return nullptr;
+    }
+}
+
+std::string TransferJournal::UploadKey(const std::string &site, const std::string &remote_path)
+{
+    return "upload\n" + site + "\n" + remote_path;
+}
+
+std::string TransferJournal::Key() const
+{
+    return upload ? UploadKey(site, remote_path) : local_path;
+}
+
+std::string TransferJournal::PathFor(const std::string &key)
+{
+    return std::string(JOURNAL_PATH) + "/" + HashName(key);
+}
+
+int64_t TransferJournal::BlockCount() const
+{
+    return (size + kBlockSize - 1) / kBlockSize;
+}
+
+int64_t TransferJournal::BlockBytes(int64_t block) const
+{
+    return std::min(kBlockSize, size - block * kBlockSize);
+}
+
+bool TransferJournal::IsDone(int64_t block) const
+{
+    return (done[block / 8] & (1 << (block % 8))) != 0;
+}
+
+void TransferJournal::Reset(int64_t total)
+{
+    size = (total > 0) ? total : 0;
+    done.assign((BlockCount() + 7) / 8, 0);
+    partial.assign(BlockCount(), 0);
+    crcs.clear();
+    last_save = 0;
+}
+
+bool TransferJournal::Parse(const std::string &file)
+{
+    std::vector<std::string> lines;
+    if (!FS::LoadText(&lines, file) || lines.empty() || lines[0] != JOURNAL_HEADER)
+        return false;
+
+    std::string bitmap;
+    std::string sums;
+    int64_t block = 0;
+    for (const std::string &line : lines)
+    {
+        const char *v;
+        if ((v = Value(line, "site")) != nullptr)
+            site = v;
+        else if ((v = Value(line, "remote")) != nullptr)
+            remote_path = v;
+        else if ((v = Value(line, "local")) != nullptr)
+            local_path = v;
+        else if ((v = Value(line, "url")) != nullptr)
+            url = v;
+        else if ((v = Value(line, "validator")) != nullptr)
+            validator = v;
+        else if ((v = Value(line, "size")) != nullptr)
+            size = strtoll(v, nullptr, 10);
+        else if ((v = Value(line, "part_size")) != nullptr)
+            part_size = strtoull(v, nullptr, 10);
+        else if ((v = Value(line, "direction")) != nullptr)
+            upload = strcmp(v, "upload") == 0;
+        else if ((v = Value(line, "block")) != nullptr)
+            block = strtoll(v, nullptr, 10);
+        else if ((v = Value(line, "done")) != nullptr)
+            bitmap = v;
+        else if ((v = Value(line, "crc")) != nullptr)
+            sums = v;
+    }
+
+    // A journal written with another block size cannot be mapped.
+    if (size <= 0 || block != kBlockSize || local_path.empty())
+        return false;
+
+    Reset(size);
+    if (bitmap.size() != done.size() * 2)
+        return false;
+    for (size_t i = 0; i < done.size(); ++i)
+    {
+        char hex[3] = {bitmap[i * 2], bitmap[i * 2 + 1], 0};
+        done[i] = (uint8_t)strtoul(hex, nullptr, 16);
+    }
+    // Block CRCs are a hint; a list that does not fit is dropped.
+    if (sums.size() == (size_t)BlockCount() * 8)
+    {
+        crcs.resize(BlockCount());
+        for (size_t i = 0; i < crcs.size(); ++i)
+            crcs[i] = (uint32_t)strtoul(sums.substr(i * 8, 8).c_str(), nullptr, 16);
+    }
+    return true;
+}
+
+bool TransferJournal::Load(const std::string &path)
+{
+    std::string file = PathFor(path);
+    if (!FS::FileExists(file))
+        return false;
+    // Hash collisions are harmless but must not hand out another file's map.
+    return Parse(file) && !upload && local_path == path;
+}
+
+bool TransferJournal::LoadUpload(const std::string &site_name, const std::string &remote)
+{
+    std::string file = PathFor(UploadKey(site_name, remote));
+    if (!FS::FileExists(file))
+        return false;
+    return Parse(file) && upload && site == site_name && remote_path == remote;
+}
+
+bool TransferJournal::Save()
+{
+    if (!Kept())
+        return false;
+    if (!FS::FolderExists(JOURNAL_PATH))
+        FS::MkDirs(JOURNAL_PATH);
+
+    char number[32];
+    std::vector<std::string> lines;
+    lines.push_back(JOURNAL_HEADER);
+    lines.push_back("site=" + site);
+    lines.push_back("remote=" + remote_path);
+    lines.push_back("local=" + local_path);
+    lines.push_back("url=" + url);
+    lines.push_back("validator=" + validator);
+    snprintf(number, sizeof(number), "%lld", (long long)size);
+    lines.push_back(std::string("size=") + number);
+    snprintf(number, sizeof(number), "%llu", (unsigned long long)part_size);
+    lines.push_back(std::string("part_size=") + number);
+    // Older journals have no direction and are all downloads.
+    if (upload)
+        lines.push_back("direction=upload");
+    snprintf(number, sizeof(number), "%lld", (long long)kBlockSize);
+    lines.push_back(std::string("block=") + number);
+
+    std::string bitmap;
+    bitmap.reserve(done.size() * 2);
+    for (uint8_t byte : done)
+    {
+        snprintf(number, sizeof(number), "%02x", byte);
+        bitmap += number;
+    }
+    lines.push_back("done=" + bitmap);
+    if (std::any_of(crcs.begin(), crcs.end(), [](uint32_t crc)
+                    { return crc != 0; }))
+    {
+        std::string sums;
+        sums.reserve(crcs.size() * 8);
+        for (uint32_t crc : crcs)
+        {
+            snprintf(number, sizeof(number), "%08x", (unsigned)crc);
+            sums += number;
+        }
+        lines.push_back("crc=" + sums);
+    }
+
+    // Write aside and swap in, so a crash mid-save keeps the old journal.
+    std::string file = PathFor(Key());
+    std::string tmp = file + ".tmp";
+    if (!FS::SaveText(&lines, tmp))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "JOURNAL save failed path=%s", tmp.c_str());
+        return false;
+    }
+    FS::Rm(file);
+    if (!FS::Rename(tmp, file))
+    {
+        Logger::Logf(Logger::LOG_ERROR, "JOURNAL rename failed path=%s", file.c_str());
+        return false;
+    }
+    last_save = Util::GetTick();
+    return true;
+}
+
+bool TransferJournal::SaveDue() const
+{
+    return Kept() && Util::GetTick() - last_save >= 3000000;
+}
+
+void TransferJournal::SaveThrottled()
+{
+    if (SaveDue())
+        Save();
+}
+
+void TransferJournal::Remove()
+{
+    if (Kept())
+        FS::Rm(PathFor(Key()));
+}
+
+void TransferJournal::MarkDone(int64_t start, int64_t end)
+{
+    if (size <= 0 || start < 0 || end < start)
+        return;
+    end = std::min(end, size - 1);
+
+    for (int64_t block = start / kBlockSize; block <= end / kBlockSize; ++block)
+    {
+        if (IsDone(block))
+            continue;
+        int64_t lo = std::max(start, block * kBlockSize);
+        int64_t hi = std::min(end + 1, block * kBlockSize + BlockBytes(block));
+        partial[block] += (uint32_t)(hi - lo);
+        if (partial[block] >= BlockBytes(block))
+            done[block / 8] |= (uint8_t)(1 << (block % 8));
+    }
+}
+
+void TransferJournal::MarkMissing(int64_t start, int64_t end)
+{
+    if (size <= 0 || start < 0 || end < start)
+        return;
+    end = std::min(end, size - 1);
+
+    for (int64_t block = start / kBlockSize; block <= end / kBlockSize; ++block)
+    {
+        done[block / 8] &= (uint8_t)~(1 << (block % 8));
+        partial[block] = 0;
+        if (block < (int64_t)crcs.size())
+            crcs[block] = 0;
+    }
+}
+
+std::vector<std::pair<int64_t, int64_t>> TransferJournal::MissingSpans() const
+{
+    std::vector<std::pair<int64_t, int64_t>> spans;
+    for (int64_t block = 0; block < BlockCount(); ++block)
+    {
+        if (IsDone(block))
+            continue;
+        int64_t lo = block * kBlockSize;
+        int64_t hi = lo + BlockBytes(block);
+        if (!spans.empty() && spans.back().second == lo)
+            spans.back().second = hi;
+        else
+            spans.push_back(std::make_pair(lo, hi));
+    }
+    return spans;
+}
+
+int64_t TransferJournal::DoneBytes() const
+{
+    int64_t bytes = 0;
+    for (int64_t block = 0; block < BlockCount(); ++block)
+    {
+        if (IsDone(block))
+            bytes += BlockBytes(block);
+    }
+    return bytes;
+}
+
+bool TransferJournal::Exists(const std::string &local_path)
+{
+    TransferJournal journal;
+    return journal.Load(local_path);
+}
+
+std::vector<TransferJournal> TransferJournal::List(const std::string &site)
+{
+    std::vector<TransferJournal> out;
+    for (const std::string &name : FS::ListFiles(JOURNAL_PATH))
+    {
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".jnl") != 0)
+            continue;
+        TransferJournal journal;
+        if (journal.Parse(std::string(JOURNAL_PATH) + "/" + name) && !journal.upload && journal.site == site)
+            out.push_back(journal);
+    }
+    return out;
+}
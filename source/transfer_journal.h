@@ -0,0 +1,88 @@
+#ifndef NEO_TRANSFER_JOURNAL_H
+#define NEO_TRANSFER_JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+// On-SD record of one ranged download in progress, so a transfer cut off by
+// sleep mode, a crash or a relaunch only fetches the blocks it is missing.
+// Each journal is a small text file under JOURNAL_PATH named after the
+// local destination, and is removed once the download completes.
+//
+// An upload journal (`upload`) is named after the site and the remote
+// destination instead. It records which local file, as of which mtime, the
+// partial remote file was started from, so a later attempt only continues
+// a remote file this one wrote.
+class TransferJournal
+{
+public:
+    // Bitmap granularity. Ranges do not have to be aligned to it.
+    static const int64_t kBlockSize = 4 * 1024 * 1024;
+
+    std::string site;
+    std::string remote_path;
+    // Destination as requested by the download; this is the journal key.
+    std::string local_path;
+    std::string url;
+    // Remote "etag:..." or "mtime:..." when the download started.
+    std::string validator;
+    int64_t size = 0;
+    // DBI split part size, 0 for a single file.
+    uint64_t part_size = 0;
+    // Local to remote; `validator` is then the local file's "mtime:...".
+    bool upload = false;
+    // CRC-32 of each block as it arrived (ChunkHashTree), so a later
+    // session can tell a block the card mangled from an intact one; 0
+    // where none was recorded, empty when none were.
+    std::vector<uint32_t> crcs;
+
+    // Reads the journal kept for `local_path`. Returns false when there is
+    // none or it cannot be parsed.
+    bool Load(const std::string &local_path);
+    // Reads the upload journal kept for `remote_path` on `site`.
+    bool LoadUpload(const std::string &site, const std::string &remote_path);
+    // Starts over with `size` bytes and nothing done.
+    void Reset(int64_t size);
+    // A journal without a destination only tracks blocks in memory; Save()
+    // and Remove() are no-ops for it.
+    bool Kept() const { return !local_path.empty(); }
+    bool Save();
+    // Saves at most every few seconds; meant for range completions.
+    void SaveThrottled();
+    // Whether SaveThrottled() would write now, for callers that must sync
+    // their data first.
+    bool SaveDue() const;
+    void Remove();
+
+    // Records bytes [start, end] as written. A block becomes done once all
+    // of its bytes arrived, even when several ranges cover it.
+    void MarkDone(int64_t start, int64_t end);
+    // Records the blocks holding bytes [start, end] as to be fetched again.
+    void MarkMissing(int64_t start, int64_t end);
+    std::vector<std::pair<int64_t, int64_t>> MissingSpans() const;
+    int64_t DoneBytes() const;
+
+    static bool Exists(const std::string &local_path);
+    // Journals of unfinished downloads from `site`; uploads are left out.
+    static std::vector<TransferJournal> List(const std::string &site);
+
+private:
+    std::vector<uint8_t> done;
+    // Bytes received per block that is not done yet; not persisted.
+    std::vector<uint32_t> partial;
+    uint64_t last_save = 0;
+
+    int64_t BlockCount() const;
+    int64_t BlockBytes(int64_t block) const;
+    bool IsDone(int64_t block) const;
+    // What the file is named after: the local path, or the site and
+    // remote path of an upload.
+    std::string Key() const;
+    static std::string UploadKey(const std::string &site, const std::string &remote_path);
+    static std::string PathFor(const std::string &key);
+    bool Parse(const std::string &file);
+};
+
+#endif
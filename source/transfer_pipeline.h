@@ -0,0 +1,149 @@
+#ifndef NEO_TRANSFER_PIPELINE_H
+#define NEO_TRANSFER_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "byte_sink.h"
+#include "local_sink.h"
+#include "rate_limiter.h"
+#include "transfer_trace.h"
+
+// What a download does with each buffer the network hands it, from the
+// protocol's read loop to the card, as a chain of stages fixed at compile
+// time: Pipeline::Compose(trace, throttle, disk) is a Chain<Trace,
+// Throttle, Disk> whose Push() inlines every stage into the read loop,
+// with no allocation and no call through a pointer until the coalesced
+// block reaches LocalFileSink. Hashing, split parts and reordering stay in
+// the sink, on its writer thread, off the network thread.
+//
+// A stage is any type with
+//     template <typename Next> bool Push(const char *data, size_t size, Next &next);
+//     template <typename Next> bool Finish(Next &next);
+// that passes the bytes on to `next`; the last one has Push(data, size)
+// and Finish() instead. False from any stage stops the transfer. A Chain
+// holds its stages by reference, so they outlive it and the caller reads
+// their counters afterwards. Combinations no loop spells out go through
+// ToSink, the type-erased end over any ByteSink.
+namespace Pipeline
+{
+    template <typename... Stages>
+    class Chain;
+
+    template <typename Last>
+    class Chain<Last>
+    {
+    public:
+        explicit Chain(Last &last) : last(last) {}
+
+        bool Push(const char *data, size_t size) { return last.Push(data, size); }
+        bool Finish() { return last.Finish(); }
+
+    private:
+        Last &last;
+    };
+
+    template <typename First, typename... Rest>
+    class Chain<First, Rest...>
+    {
+    public:
+        Chain(First &first, Rest &...rest) : first(first), rest(rest...) {}
+
+        bool Push(const char *data, size_t size) { return first.Push(data, size, rest); }
+        bool Finish() { return first.Finish(rest); }
+
+    private:
+        First &first;
+        Chain<Rest...> rest;
+    };
+
+    template <typename... Stages>
+    Chain<Stages...> Compose(Stages &...stages)
+    {
+        return Chain<Stages...>(stages...);
+    }
+
+    // Books what reached the stages after it against rate_limit_kb.
+    struct Throttle
+    {
+        template <typename Next>
+        bool Push(const char *data, size_t size, Next &next)
+        {
+            if (!next.Push(data, size))
+                return false;
+            RateLimiter::Consume(size);
+            return true;
+        }
+        template <typename Next>
+        bool Finish(Next &next) { return next.Finish(); }
+    };
+
+    // Counts what reached the stages after it, in `bytes` and through
+    // `Add` (a client's AddProgress). Bytes still coalescing count as
+    // done; a caller that fails on Finish() takes `bytes` back.
+    template <void (*Add)(int64_t)>
+    struct Progress
+    {
+        uint64_t bytes = 0;
+
+        template <typename Next>
+        bool Push(const char *data, size_t size, Next &next)
+        {
+            if (!next.Push(data, size))
+                return false;
+            bytes += size;
+            Add((int64_t)size);
+            return true;
+        }
+        template <typename Next>
+        bool Finish(Next &next) { return next.Finish(); }
+    };
+
+    // TransferTrace blocks of what went through.
+    struct Trace
+    {
+        TransferTrace::Block block;
+
+        Trace(TransferTrace::Kind kind, uint64_t offset) : block(kind, offset) {}
+
+        template <typename Next>
+        bool Push(const char *data, size_t size, Next &next)
+        {
+            block.Add(size);
+            return next.Push(data, size);
+        }
+        template <typename Next>
+        bool Finish(Next &next) { return next.Finish(); }
+    };
+
+    // The common end: disk_block_kb writes on a LocalFileSink.
+    struct Disk
+    {
+        LocalSinkStream stream;
+
+        Disk(LocalFileSink &sink, uint64_t offset) : stream(sink, offset) {}
+
+        bool Push(const char *data, size_t size) { return stream.Write(data, size); }
+        bool Finish() { return stream.Flush(); }
+    };
+
+    // Any other destination, one virtual WriteAt() per buffer.
+    struct ToSink
+    {
+        ByteSink &sink;
+        uint64_t offset;
+
+        ToSink(ByteSink &sink, uint64_t offset) : sink(sink), offset(offset) {}
+
+        bool Push(const char *data, size_t size)
+        {
+            if (!sink.WriteAt(offset, data, size))
+                return false;
+            offset += size;
+            return true;
+        }
+        bool Finish() { return true; }
+    };
+}
+
+#endif
@@ -0,0 +1,277 @@
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <switch.h>
+
+#include "transfer_stats.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "metrics.h"
+#include "net_iface.h"
+#include "util.h"
+
+namespace
+{
+    struct Slot
+    {
+        // Guards `name` only, which BeginFile() replaces.
+        std::mutex mutex;
+        std::string name;
+        std::atomic<bool> busy{false};
+        std::atomic<int64_t> size{0};
+        std::atomic<int64_t> done{0};
+        std::atomic<uint32_t> retries{0};
+        std::atomic<bool> ranged{false};
+        std::atomic<int64_t> cells[TransferStats::kCells];
+    };
+
+    Slot slots[TransferStats::kMaxWorkers];
+    std::atomic<int> worker_count{0};
+    thread_local int bound = -1;
+
+    // Request latencies in half-octave buckets: bucket b holds
+    // [2^(b/2), 2^((b+1)/2)) microseconds, up to ~70 minutes.
+    const int kLatencyBuckets = 64;
+    std::atomic<uint32_t> latency[kLatencyBuckets];
+    std::atomic<uint64_t> batch_start{0};
+    std::atomic<uint64_t> peak_memory{0};
+
+    void SampleMemory()
+    {
+        uint64_t used = 0;
+        if (R_FAILED(svcGetInfo(&used, InfoType_UsedMemorySize, CUR_PROCESS_HANDLE, 0)))
+            return;
+        uint64_t peak = peak_memory.load(std::memory_order_relaxed);
+        while (used > peak && !peak_memory.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Upper bound of the bucket holding the `pct` percentile, in ms; -1
+    // without samples.
+    double Percentile(uint32_t total, double pct)
+    {
+        if (total == 0)
+            return -1.0;
+        uint32_t want = (uint32_t)std::ceil(total * pct);
+        uint32_t seen = 0;
+        for (int b = 0; b < kLatencyBuckets; b++)
+        {
+            seen += latency[b].load(std::memory_order_relaxed);
+            if (seen >= want)
+                return std::pow(2.0, (b + 1) / 2.0) / 1000.0;
+        }
+        return -1.0;
+    }
+
+    Slot *Current()
+    {
+        if (bound < 0 || bound >= worker_count.load(std::memory_order_relaxed))
+            return nullptr;
+        return &slots[bound];
+    }
+
+    void ClearCells(Slot &slot)
+    {
+        for (int i = 0; i < TransferStats::kCells; i++)
+            slot.cells[i].store(0, std::memory_order_relaxed);
+        slot.ranged.store(false, std::memory_order_relaxed);
+    }
+}
+
+void TransferStats::Reset(int workers)
+{
+    if (workers > kMaxWorkers)
+        workers = kMaxWorkers;
+    else if (workers < 0)
+        workers = 0;
+    for (int i = 0; i < kMaxWorkers; i++)
+    {
+        Slot &slot = slots[i];
+        slot.busy.store(false, std::memory_order_relaxed);
+        slot.size.store(0, std::memory_order_relaxed);
+        slot.done.store(0, std::memory_order_relaxed);
+        slot.retries.store(0, std::memory_order_relaxed);
+        ClearCells(slot);
+    }
+    // The disk backlog is a level and drains on its own.
+    Metrics::ResetCounters();
+    Metrics::Set(Metrics::GAUGE_QUEUED, 0);
+    for (int b = 0; b < kLatencyBuckets; b++)
+        latency[b].store(0, std::memory_order_relaxed);
+    peak_memory.store(0, std::memory_order_relaxed);
+    SampleMemory();
+    batch_start.store(Util::GetTick(), std::memory_order_relaxed);
+    worker_count.store(workers, std::memory_order_release);
+}
+
+void TransferStats::Bind(int slot)
+{
+    bound = slot;
+}
+
+int TransferStats::CurrentWorker()
+{
+    return bound;
+}
+
+void TransferStats::BeginFile(const std::string &name, int64_t size)
+{
+    Slot *slot = Current();
+    if (!slot)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        slot->name = name;
+    }
+    slot->size.store(size, std::memory_order_relaxed);
+    slot->done.store(0, std::memory_order_relaxed);
+    ClearCells(*slot);
+    slot->busy.store(true, std::memory_order_release);
+}
+
+void TransferStats::EndFile()
+{
+    Slot *slot = Current();
+    if (!slot)
+        return;
+    slot->busy.store(false, std::memory_order_release);
+    SampleMemory();
+}
+
+void TransferStats::AddBytes(int64_t delta)
+{
+    Slot *slot = Current();
+    if (!slot)
+        return;
+    slot->done.fetch_add(delta, std::memory_order_relaxed);
+    Metrics::Count(Metrics::COUNTER_BYTES, delta);
+}
+
+void TransferStats::SetBytes(int64_t done)
+{
+    Slot *slot = Current();
+    if (!slot)
+        return;
+    // Only forward progress counts; a restarted file moves back.
+    int64_t prev = slot->done.exchange(done, std::memory_order_relaxed);
+    if (done > prev)
+        Metrics::Count(Metrics::COUNTER_BYTES, done - prev);
+}
+
+void TransferStats::AddRetry()
+{
+    Metrics::Count(Metrics::COUNTER_RETRIES);
+    Slot *slot = Current();
+    if (slot)
+        slot->retries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::RangeDone(int64_t start, int64_t end)
+{
+    Slot *slot = Current();
+    if (!slot)
+        return;
+    int64_t size = slot->size.load(std::memory_order_relaxed);
+    if (size <= 0 || start >= end)
+        return;
+    slot->ranged.store(true, std::memory_order_relaxed);
+
+    // Spread the range over the cells it overlaps.
+    int first = (int)(start * kCells / size);
+    for (int i = first; i < kCells; i++)
+    {
+        int64_t cell_start = size * i / kCells;
+        int64_t cell_end = size * (i + 1) / kCells;
+        if (cell_start >= end)
+            break;
+        int64_t from = start > cell_start ? start : cell_start;
+        int64_t to = end < cell_end ? end : cell_end;
+        if (to > from)
+            slot->cells[i].fetch_add(to - from, std::memory_order_relaxed);
+    }
+}
+
+void TransferStats::AddRequest(uint64_t us)
+{
+    int b = 0;
+    if (us > 0)
+        b = (int)(2.0 * std::log2((double)us));
+    if (b < 0)
+        b = 0;
+    else if (b >= kLatencyBuckets)
+        b = kLatencyBuckets - 1;
+    latency[b].fetch_add(1, std::memory_order_relaxed);
+    Metrics::Count(Metrics::COUNTER_REQUESTS);
+}
+
+void TransferStats::SetQueued(int jobs)
+{
+    Metrics::Set(Metrics::GAUGE_QUEUED, jobs);
+}
+
+void TransferStats::AddDiskBacklog(int64_t delta)
+{
+    Metrics::Move(Metrics::GAUGE_DISK_BACKLOG, delta);
+}
+
+void TransferStats::Read(Snapshot &out)
+{
+    int count = worker_count.load(std::memory_order_acquire);
+    out.active = count > 0;
+    out.workers.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        Slot &slot = slots[i];
+        Worker &worker = out.workers[i];
+        worker.busy = slot.busy.load(std::memory_order_acquire);
+        if (!worker.busy)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(slot.mutex);
+            worker.name = slot.name;
+        }
+        worker.size = slot.size.load(std::memory_order_relaxed);
+        worker.done = slot.done.load(std::memory_order_relaxed);
+        worker.retries = slot.retries.load(std::memory_order_relaxed);
+        worker.ranged = slot.ranged.load(std::memory_order_relaxed);
+        for (int c = 0; c < kCells; c++)
+        {
+            int64_t cell_size = worker.size * (c + 1) / kCells - worker.size * c / kCells;
+            int64_t filled = slot.cells[c].load(std::memory_order_relaxed);
+            worker.cells[c] = (cell_size > 0) ? (uint8_t)(filled >= cell_size ? 255 : filled * 255 / cell_size) : 0;
+        }
+    }
+    Metrics::Snapshot totals;
+    Metrics::Read(totals);
+    out.queued = (int)totals.gauges[Metrics::GAUGE_QUEUED];
+    int64_t backlog = totals.gauges[Metrics::GAUGE_DISK_BACKLOG];
+    out.disk_backlog = backlog > 0 ? backlog : 0;
+    out.pool_bytes = totals.gauges[Metrics::GAUGE_POOL_BYTES];
+    out.retries = (uint32_t)totals.counters[Metrics::COUNTER_RETRIES];
+    out.bytes = totals.counters[Metrics::COUNTER_BYTES];
+}
+
+TransferStats::Summary TransferStats::LogSummary(const char *what, int files, int64_t bytes)
+{
+    SampleMemory();
+    double secs = (Util::GetTick() - batch_start.load(std::memory_order_relaxed)) / 1000000.0;
+    Metrics::Snapshot totals;
+    Metrics::Read(totals);
+    uint32_t requests = (uint32_t)totals.counters[Metrics::COUNTER_REQUESTS];
+
+    NetIface::State iface = NetIface::Last();
+    Logger::Logf("TRANSFER SUMMARY %s iface=%s signal=%d files=%d bytes=%lld wire_bytes=%lld secs=%.1f mib_s=%.2f "
+                 "workers=%d retries=%lld requests=%u p50_ms=%.1f p99_ms=%.1f peak_mem_mb=%.1f",
+                 what, NetIface::Name(iface.type), iface.signal, files, (long long)bytes, (long long)totals.counters[Metrics::COUNTER_BYTES], secs,
+                 secs > 0.0 ? bytes / secs / 1048576.0 : 0.0, worker_count.load(std::memory_order_relaxed),
+                 (long long)totals.counters[Metrics::COUNTER_RETRIES], requests, Percentile(requests, 0.50),
+                 Percentile(requests, 0.99), peak_memory.load(std::memory_order_relaxed) / 1048576.0);
+    MemoryStats::Log(what);
+
+    Summary summary;
+    summary.secs = secs;
+    summary.workers = worker_count.load(std::memory_order_relaxed);
+    summary.retries = totals.counters[Metrics::COUNTER_RETRIES];
+    return summary;
+}
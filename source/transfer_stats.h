@@ -0,0 +1,94 @@
+#ifndef NEO_TRANSFER_STATS_H
+#define NEO_TRANSFER_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Live per-worker counters for the download queue, read by the progress
+// dialog. Each queue worker owns one slot and binds it to its thread; the
+// protocol clients count into whatever slot the calling thread is bound
+// to, so the shared bytes_transfered counter (which every worker resets
+// when it starts a file) is no longer the only view of a parallel batch.
+// Threads that are not bound (uploads, browsing) count nothing.
+//
+// Every counter is a relaxed atomic: the dialog reads a snapshot once a
+// frame and a torn name or a byte count a frame old is harmless. Totals
+// across workers (bytes, requests, retries, queue depth, disk backlog)
+// are kept in the sharded Metrics registry.
+namespace TransferStats
+{
+    static const int kMaxWorkers = 8;
+    // Cells in the chunk map of a ranged file.
+    static const int kCells = 64;
+
+    struct Worker
+    {
+        bool busy = false;
+        std::string name;
+        int64_t size = 0;
+        int64_t done = 0;
+        uint32_t retries = 0;
+        // Whether parts of the file arrive out of order (ranged or
+        // segmented download), so `cells` means something.
+        bool ranged = false;
+        // Fraction of each 1/kCells of the file that has completed, 0..255.
+        uint8_t cells[kCells];
+    };
+
+    struct Snapshot
+    {
+        bool active = false;
+        std::vector<Worker> workers;
+        int queued = 0;
+        int64_t disk_backlog = 0;
+        // Transfer buffers leased out.
+        int64_t pool_bytes = 0;
+        uint32_t retries = 0;
+        // Bytes the workers have counted since Reset(); a resumed file
+        // counts the part it already had.
+        int64_t bytes = 0;
+    };
+
+    // Starts a batch with `workers` slots (0 ends it).
+    void Reset(int workers);
+    // Binds the calling thread to `slot` (-1 unbinds). Helper threads a
+    // worker spawns for one file bind to the worker's CurrentWorker().
+    void Bind(int slot);
+    int CurrentWorker();
+
+    void BeginFile(const std::string &name, int64_t size);
+    void EndFile();
+    void AddBytes(int64_t delta);
+    // For progress reported as an absolute position (single-stream GETs
+    // and resumed files).
+    void SetBytes(int64_t done);
+    void AddRetry();
+    // Marks [start, end) of the current file as written.
+    void RangeDone(int64_t start, int64_t end);
+
+    // Latency of one network request (only fed while transfer_trace is on,
+    // by TransferTrace).
+    void AddRequest(uint64_t us);
+
+    void SetQueued(int jobs);
+    // Bytes handed to a LocalFileSink writer and not yet on the card.
+    void AddDiskBacklog(int64_t delta);
+
+    void Read(Snapshot &out);
+
+    struct Summary
+    {
+        double secs = 0;
+        int workers = 0;
+        int64_t retries = 0;
+    };
+
+    // Logs one TRANSFER SUMMARY line for the batch started by the last
+    // Reset(): throughput, retries, request latency percentiles and peak
+    // process memory, so runs against the same server compare directly.
+    // Returns the batch's duration, workers and retries for the history.
+    Summary LogSummary(const char *what, int files, int64_t bytes);
+}
+
+#endif
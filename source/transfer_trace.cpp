@@ -0,0 +1,108 @@
+#include <atomic>
+#include <curl/curl.h>
+
+#include "transfer_trace.h"
+#include "transfer_stats.h"
+#include "timeline.h"
+#include "config.h"
+#include "logger.h"
+#include "net_iface.h"
+#include "util.h"
+
+namespace
+{
+    const char *kKindNames[] = {"http_get", "http_range", "sftp_read", "ftp_block", "smb_block", "disk_write"};
+
+    std::atomic<int> next_thread{0};
+    thread_local int thread_number = -1;
+    std::atomic<bool> header_written{false};
+
+    int ThreadNumber()
+    {
+        if (thread_number < 0)
+            thread_number = next_thread++;
+        return thread_number;
+    }
+
+    void Write(TransferTrace::Kind kind, int slot, uint64_t start_us, uint64_t end_us, uint64_t offset,
+               uint64_t bytes, long status, long long dns, long long connect, long long tls, long long ttfb)
+    {
+        if (Timeline::Enabled())
+            Timeline::Record(kKindNames[kind], start_us, end_us, slot, (int64_t)bytes,
+                             tls >= 0 ? (int32_t)tls : -1, ttfb >= 0 ? (int32_t)ttfb : -1);
+        if (!transfer_trace)
+            return;
+        if (kind != TransferTrace::TRACE_DISK_WRITE && end_us >= start_us)
+            TransferStats::AddRequest(end_us - start_us);
+        if (!header_written.exchange(true))
+            Logger::Trace("kind,thread,slot,start_us,end_us,offset,bytes,status,dns_us,connect_us,tls_us,ttfb_us,iface");
+        Logger::Trace("%s,%d,%d,%llu,%llu,%llu,%llu,%ld,%lld,%lld,%lld,%lld,%s", kKindNames[kind], ThreadNumber(), slot,
+                      (unsigned long long)start_us, (unsigned long long)end_us, (unsigned long long)offset,
+                      (unsigned long long)bytes, status, dns, connect, tls, ttfb, NetIface::Name(NetIface::Last().type));
+    }
+}
+
+bool TransferTrace::Enabled()
+{
+    return transfer_trace || Timeline::Enabled();
+}
+
+void TransferTrace::Record(Kind kind, int slot, uint64_t start_us, uint64_t end_us, uint64_t offset, uint64_t bytes,
+                           long status)
+{
+    if (!Enabled())
+        return;
+    Write(kind, slot, start_us, end_us, offset, bytes, status, -1, -1, -1, -1);
+}
+
+void TransferTrace::RecordCurl(CURL *easy, Kind kind, int slot, uint64_t start_us, uint64_t offset, long status)
+{
+    if (!Enabled())
+        return;
+
+    curl_off_t dns = -1, connect = -1, tls = -1, ttfb = -1, bytes = 0;
+    curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    // A reused connection reports no TLS handshake of its own.
+    if (tls == 0)
+        tls = -1;
+    Write(kind, slot, start_us, Util::GetTick(), offset, bytes > 0 ? (uint64_t)bytes : 0, status,
+          dns, connect, tls, ttfb);
+}
+
+TransferTrace::Block::Block(Kind kind, uint64_t offset)
+    : kind(kind), enabled(Enabled()), offset(offset)
+{
+    if (enabled)
+        start = Util::GetTick();
+}
+
+TransferTrace::Block::~Block()
+{
+    if (bytes > 0)
+        Finish(true);
+}
+
+void TransferTrace::Block::Add(uint64_t count)
+{
+    if (!enabled)
+        return;
+    bytes += count;
+    if (bytes >= kBlockSize)
+        Finish(true);
+}
+
+void TransferTrace::Block::Finish(bool ok)
+{
+    if (!enabled)
+        return;
+    uint64_t now = Util::GetTick();
+    if (bytes > 0 || !ok)
+        Record(kind, -1, start, now, offset, bytes, ok ? 1 : 0);
+    offset += bytes;
+    bytes = 0;
+    start = now;
+}
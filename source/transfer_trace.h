@@ -0,0 +1,66 @@
+#ifndef NEO_TRANSFER_TRACE_H
+#define NEO_TRANSFER_TRACE_H
+
+#include <cstdint>
+
+typedef void CURL;
+
+// Per-request timing records for diagnosing slow transfers, written as CSV
+// to TRACE_FILE through the logger's ring when transfer_trace is set. One
+// line per HTTP GET or range, SFTP read batch, FTP or SMB block and local
+// disk write:
+//
+//   kind,thread,slot,start_us,end_us,offset,bytes,status,dns_us,connect_us,tls_us,ttfb_us,iface
+//
+// Times are Util::GetTick() microseconds. `thread` numbers the threads that
+// recorded something in order of first use; `slot` is the concurrent
+// request slot of the HTTP multi client (-1 elsewhere). `status` is the
+// HTTP code, or 1/0 for success/failure. The curl phases are cumulative
+// from the start of the request, as curl reports them, and -1 when not
+// applicable. `iface` is the link (NetIface) the last connect or batch
+// found. With timeline_trace the same records also go to the Timeline
+// as spans named by kind; Enabled() is true for either.
+namespace TransferTrace
+{
+    enum Kind
+    {
+        TRACE_HTTP_GET,
+        TRACE_HTTP_RANGE,
+        TRACE_SFTP_READ,
+        TRACE_FTP_BLOCK,
+        TRACE_SMB_BLOCK,
+        TRACE_DISK_WRITE
+    };
+
+    bool Enabled();
+
+    void Record(Kind kind, int slot, uint64_t start_us, uint64_t end_us, uint64_t offset, uint64_t bytes,
+                long status);
+    // Record() for a finished curl transfer, with its phase timings and
+    // downloaded byte count.
+    void RecordCurl(CURL *easy, Kind kind, int slot, uint64_t start_us, uint64_t offset, long status);
+
+    // Collects small reads (FTP hands out a few KiB at a time) into one
+    // record per kBlockSize.
+    class Block
+    {
+    public:
+        Block(Kind kind, uint64_t offset);
+        ~Block();
+
+        void Add(uint64_t bytes);
+        // Records what was collected so far, with `ok` as the status.
+        void Finish(bool ok);
+
+    private:
+        static const uint64_t kBlockSize = 1024 * 1024;
+
+        Kind kind;
+        bool enabled;
+        uint64_t offset;
+        uint64_t bytes = 0;
+        uint64_t start = 0;
+    };
+}
+
+#endif
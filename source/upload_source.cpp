@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <switch.h>
+
+#include "upload_source.h"
+#include "fs.h"
+#include "logger.h"
+#include "threads.h"
+#include "util.h"
+
+UploadSource::UploadSource(const std::string &p, uint64_t off, int64_t len)
+    : path(p), offset(off), wantedLength(len)
+{
+}
+
+UploadSource::~UploadSource()
+{
+    Close();
+}
+
+int64_t UploadSource::SplitSize(const std::string &path)
+{
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr)
+        return -1;
+
+    std::vector<int> indexes;
+    bool parts_only = true;
+    struct dirent *entry;
+    while (parts_only && (entry = readdir(dir)) != nullptr)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        const char *name = entry->d_name;
+        parts_only = strlen(name) == 2 && name[0] >= '0' && name[0] <= '9' && name[1] >= '0' && name[1] <= '9' &&
+                     !(entry->d_type & DT_DIR);
+        indexes.push_back((name[0] - '0') * 10 + (name[1] - '0'));
+    }
+    closedir(dir);
+    if (!parts_only || indexes.empty())
+        return -1;
+
+    std::sort(indexes.begin(), indexes.end());
+    for (size_t i = 0; i < indexes.size(); i++)
+    {
+        if (indexes[i] != (int)i)
+            return -1;
+    }
+    std::string base = path;
+    while (base.size() > 1 && base.back() == '/')
+        base.pop_back();
+    if (indexes.size() == 1 && FS::GetFileExt(base).empty())
+        return -1;
+    base.push_back('/');
+    int64_t total = 0;
+    int64_t part_size = 0;
+    for (size_t i = 0; i < indexes.size(); i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%02d", (int)i);
+        int64_t size = FS::GetSize(base + name);
+        if (size <= 0 || (i > 0 && size > part_size) || (i > 0 && i + 1 < indexes.size() && size != part_size))
+            return -1;
+        if (i == 0)
+            part_size = size;
+        total += size;
+    }
+    return total;
+}
+
+bool UploadSource::Open()
+{
+    struct stat st = {0};
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    uint64_t total = 0;
+    if (S_ISDIR(st.st_mode))
+    {
+        // A split folder reads as its parts in order; the first short or
+        // missing one ends it.
+        std::string dir = path;
+        if (!FS::hasEndSlash(dir.c_str()))
+            dir.push_back('/');
+        for (int index = 0;; ++index)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "%02d", index);
+            int fd = open((dir + name).c_str(), O_RDONLY);
+            if (fd < 0)
+                break;
+            struct stat part = {0};
+            if (fstat(fd, &part) != 0 || part.st_size <= 0)
+            {
+                close(fd);
+                break;
+            }
+            fds.push_back(fd);
+            partSizes.push_back((uint64_t)part.st_size);
+            total += (uint64_t)part.st_size;
+            if (index == 0)
+                partSize = (uint64_t)part.st_size;
+            else if ((uint64_t)part.st_size < partSize)
+                break;
+        }
+        if (fds.empty())
+            return false;
+    }
+    else
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        fds.push_back(fd);
+        partSizes.push_back((uint64_t)st.st_size);
+        total = (uint64_t)st.st_size;
+    }
+
+    if (offset > total)
+        offset = total;
+    length = total - offset;
+    if (wantedLength >= 0 && (uint64_t)wantedLength < length)
+        length = (uint64_t)wantedLength;
+
+    for (Slot &slot : slots)
+    {
+        if (!slot.data.Acquire(kBufferSize))
+        {
+            Close();
+            return false;
+        }
+    }
+    startReader();
+    return true;
+}
+
+void UploadSource::Close()
+{
+    stopReader();
+    if (!fds.empty())
+        Logger::Logf(Logger::LOG_DEBUG, "UPLOAD SOURCE close path=%s offset=%llu size=%llu parts=%zu disk_ms=%llu waits=%llu wait_ms=%llu",
+                     path.c_str(), (unsigned long long)offset, (unsigned long long)length, fds.size(),
+                     (unsigned long long)(diskUs / 1000), (unsigned long long)consumerWaits,
+                     (unsigned long long)(consumerWaitUs / 1000));
+    for (int fd : fds)
+        close(fd);
+    fds.clear();
+    partSizes.clear();
+    for (Slot &slot : slots)
+        slot.data.Release();
+}
+
+bool UploadSource::readAt(uint64_t pos, char *data, size_t size)
+{
+    // `pos` is in the file, across parts.
+    size_t index = 0;
+    while (index < partSizes.size() && pos >= partSizes[index])
+    {
+        pos -= partSizes[index];
+        index++;
+    }
+    while (size > 0)
+    {
+        if (index >= fds.size())
+            return false;
+        size_t chunk = (size_t)std::min<uint64_t>(size, partSizes[index] - pos);
+        if (lseek(fds[index], (off_t)pos, SEEK_SET) < 0)
+            return false;
+        size_t got = 0;
+        while (got < chunk)
+        {
+            ssize_t n = read(fds[index], data + got, chunk - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                Logger::Logf(Logger::LOG_ERROR, "UPLOAD SOURCE read failed path=%s part=%zu offset=%llu errno=%d",
+                             path.c_str(), index, (unsigned long long)pos, errno);
+                return false;
+            }
+            got += (size_t)n;
+        }
+        data += chunk;
+        size -= chunk;
+        index++;
+        pos = 0;
+    }
+    return true;
+}
+
+void UploadSource::readerThread(void *arg)
+{
+    static_cast<UploadSource *>(arg)->readerLoop();
+}
+
+void UploadSource::readerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping && readPos < length)
+    {
+        Slot &slot = slots[readSlot];
+        if (slot.full)
+        {
+            cv.wait(lock);
+            continue;
+        }
+        uint64_t pos = readPos;
+        size_t count = (size_t)std::min<uint64_t>(kBufferSize, length - pos);
+        lock.unlock();
+        uint64_t started = Util::GetTick();
+        bool ok = readAt(offset + pos, slot.data.data(), count);
+        uint64_t took = Util::GetTick() - started;
+        lock.lock();
+        diskUs += took;
+        if (!ok)
+        {
+            readError = true;
+            cv.notify_all();
+            return;
+        }
+        slot.length = count;
+        slot.full = true;
+        readPos += count;
+        readSlot = (readSlot + 1) % kBuffers;
+        cv.notify_all();
+    }
+}
+
+void UploadSource::startReader()
+{
+    stopping = false;
+    Result rc = Threads::Create(&reader, readerThread, this, 0x4000, Threads::ROLE_DISK, "upload reader");
+    if (R_FAILED(rc))
+    {
+        // Read() fills the buffers itself then, one at a time.
+        Logger::Logf(Logger::LOG_WARN, "UPLOAD SOURCE threadCreate failed rc=0x%x, reading inline", rc);
+        return;
+    }
+    threadStart(&reader);
+    readerRunning = true;
+}
+
+void UploadSource::stopReader()
+{
+    if (!readerRunning)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        cv.notify_all();
+    }
+    Threads::Join(&reader);
+    readerRunning = false;
+}
+
+int64_t UploadSource::Read(char *buffer, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (sendPos >= length)
+        return 0;
+
+    Slot &slot = slots[sendSlot];
+    if (!slot.full)
+    {
+        if (!readerRunning)
+        {
+            size_t count = (size_t)std::min<uint64_t>(kBufferSize, length - sendPos);
+            if (!readAt(offset + sendPos, slot.data.data(), count))
+                return -1;
+            slot.length = count;
+            slot.full = true;
+        }
+        else
+        {
+            consumerWaits++;
+            uint64_t started = Util::GetTick();
+            cv.wait(lock, [this, &slot]
+                    { return slot.full || readError; });
+            consumerWaitUs += Util::GetTick() - started;
+            if (!slot.full)
+                return -1;
+        }
+    }
+
+    size_t count = std::min(size, slot.length - sendUsed);
+    memcpy(buffer, slot.data.data() + sendUsed, count);
+    sendUsed += count;
+    sendPos += count;
+    if (sendUsed == slot.length)
+    {
+        slot.full = false;
+        sendUsed = 0;
+        sendSlot = (sendSlot + 1) % kBuffers;
+        cv.notify_all();
+    }
+    return (int64_t)count;
+}
+
+bool UploadSource::Seek(uint64_t pos)
+{
+    if (pos > length)
+        return false;
+    stopReader();
+    for (Slot &slot : slots)
+        slot.full = false;
+    readPos = pos;
+    sendPos = pos;
+    readSlot = 0;
+    sendSlot = 0;
+    sendUsed = 0;
+    readError = false;
+    startReader();
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef NEO_UPLOAD_SOURCE_H
+#define NEO_UPLOAD_SOURCE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <switch.h>
+
+#include "buffer_pool.h"
+
+// Local source of an upload body: a range of one flat file or of a DBI-style
+// split folder ("00", "01", ... as LocalFileSink writes them). A reader
+// thread fills kBuffers pool buffers of kBufferSize ahead of the consumer
+// with read(), so the SD card is read in large blocks while the network
+// side encrypts and sends the previous one, and Read() only copies out of
+// memory. Seek() restarts the read-ahead, for curl rewinding a body it has
+// to resend.
+class UploadSource
+{
+public:
+    static const size_t kBufferSize = 1024 * 1024;
+    static const int kBuffers = 3;
+
+    // `length` -1 sends from `offset` to the end of the file.
+    UploadSource(const std::string &path, uint64_t offset = 0, int64_t length = -1);
+    ~UploadSource();
+
+    // Opens the file or its parts and starts reading ahead.
+    bool Open();
+    void Close();
+
+    // Bytes this source sends.
+    uint64_t Size() const { return length; }
+
+    // Size of the file the split folder `path` holds, or -1 when `path` is
+    // not one: a folder of nothing but parts "00", "01", ... in sequence,
+    // all as large as the first but the last. A lone "00" only counts in a
+    // folder named like a file ("game.nsp"), as force_fat32 leaves them.
+    static int64_t SplitSize(const std::string &path);
+    // Copies up to `size` bytes into `buffer`. Returns 0 at the end of the
+    // range and -1 on a read error.
+    int64_t Read(char *buffer, size_t size);
+    // Continues from `pos` bytes into the range.
+    bool Seek(uint64_t pos);
+
+private:
+    struct Slot
+    {
+        TransferBuffer data;
+        size_t length = 0;
+        bool full = false;
+    };
+
+    std::string path;
+    uint64_t offset;
+    uint64_t length = 0;
+    int64_t wantedLength;
+    uint64_t partSize = 0;
+    std::vector<int> fds;
+    std::vector<uint64_t> partSizes;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    Slot slots[kBuffers];
+    // Next byte of the range to read (the reader) and to hand out.
+    uint64_t readPos = 0;
+    uint64_t sendPos = 0;
+    int readSlot = 0;
+    int sendSlot = 0;
+    size_t sendUsed = 0;
+    bool readError = false;
+    bool stopping = false;
+    bool readerRunning = false;
+    Thread reader;
+
+    // Read-ahead stats, logged by Close().
+    uint64_t diskUs = 0;
+    uint64_t consumerWaits = 0;
+    uint64_t consumerWaitUs = 0;
+
+    bool readAt(uint64_t pos, char *data, size_t size);
+    void startReader();
+    void stopReader();
+    void readerLoop();
+    static void readerThread(void *arg);
+};
+
+#endif
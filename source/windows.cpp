@@ -4,6 +4,7 @@
 #include <set>
 #include "windows.h"
 #include "fs.h"
+#include "local_scan.h"
 #include "config.h"
 #include "gui.h"
 #include "actions.h"
@@ -12,21 +13,40 @@
 #include "ime_dialog.h"
 #include "IconsFontAwesome6.h"
 #include "textures.h"
+#include "remote_archive.h"
+#include "transfer_stats.h"
+#include "buffer_pool.h"
+#include "cancel.h"
+#include "thumbnails.h"
+#include "package_info.h"
+#include "image_prefetch.h"
+#include "installer.h"
+#include "text_pager.h"
+#include "power.h"
+#include "file_server.h"
+#include "sd_bench.h"
+#include "transfer_history.h"
+#include "site_bench.h"
+#include "frame_profiler.h"
+#include "timeline.h"
+#include "memory_governor.h"
+#include "memory_stats.h"
+#include "site_probe.h"
 
 extern "C"
 {
 #include "inifile.h"
 }
 
-#define MAX_IMAGE_WIDTH 1280
-#define MAX_IMAGE_HEIGHT 720
-
 static u64 pad_prev;
 bool paused = false;
 int view_mode;
 static float scroll_direction = 0.0f;
 static int selected_local_position = -1;
 static int selected_remote_position = -1;
+// Panes showing the thumbnail grid instead of the list (Minus).
+static bool local_grid = false;
+static bool remote_grid = false;
 
 static ime_callback_t ime_callback = nullptr;
 static ime_callback_t ime_after_update = nullptr;
@@ -37,22 +57,35 @@ static char *ime_single_field;
 static int ime_field_size;
 
 bool handle_updates = false;
-int64_t bytes_transfered;
-int64_t bytes_to_download;
-uint64_t prev_tick;
+Metrics::Value<int64_t> bytes_transfered;
+Metrics::Value<int64_t> bytes_to_download;
+Metrics::Value<uint64_t> prev_tick;
+int batch_files_total;
+int batch_files_done;
+int64_t batch_bytes_total;
+int64_t batch_bytes_done;
+uint64_t batch_start_tick;
 std::vector<DirEntry> local_files;
 std::vector<DirEntry> remote_files;
-std::set<DirEntry> multi_selected_local_files;
-std::set<DirEntry> multi_selected_remote_files;
+Selection multi_selected_local_files(local_files);
+Selection multi_selected_remote_files(remote_files);
 std::vector<DirEntry> local_paste_files;
 std::vector<DirEntry> remote_paste_files;
 ACTIONS paste_action;
+ACTIONS remote_paste_action;
+RemoteSettings remote_paste_settings;
 DirEntry selected_local_file;
 DirEntry selected_remote_file;
 ACTIONS selected_action;
 char status_message[1024];
 char local_file_to_select[256];
 char remote_file_to_select[256];
+// A focused row a merge moved, and by how many rows, so it stays focused
+// and where it was on screen.
+char local_file_to_keep[256];
+char remote_file_to_keep[256];
+int local_keep_shift;
+int remote_keep_shift;
 char local_filter[64];
 char remote_filter[64];
 char editor_text[1024];
@@ -67,6 +100,7 @@ bool set_focus_to_remote = false;
 char extract_zip_folder[256];
 char zip_file_path[384];
 bool show_settings = false;
+static bool show_site_bench = false;
 
 // Editor variables
 std::vector<std::string> edit_buffer;
@@ -80,9 +114,18 @@ int edit_line_to_select = -1;
 std::string copy_text;
 int apply_native_filter_state;
 
+// Viewer variables, for text files too big for the editor
+static TextPager viewer;
+bool viewer_inprogress = false;
+DirEntry viewer_entry;
+char viewer_goto[16];
+
 // Images varaibles
 bool view_image= false;
 Tex texture;
+// The file on screen and its pane, for stepping through the folder.
+DirEntry image_entry;
+bool image_remote = false;
 
 bool show_pkg_info = false;
 std::map<std::string, std::string> sfo_params;
@@ -95,6 +138,8 @@ int overwrite_type = OVERWRITE_PROMPT;
 
 int confirm_state = CONFIRM_NONE;
 char confirm_message[256];
+std::vector<TransferConflict> transfer_conflicts;
+int conflicts_state = CONFIRM_NONE;
 ACTIONS action_to_take = ACTION_NONE;
 PadState padstate;
 
@@ -117,6 +162,9 @@ namespace Windows
         apply_native_filter_state = 2;
 
         Actions::RefreshLocalFiles(false);
+        Thumbnails::Init();
+        ImagePrefetch::Init();
+        Actions::StartConnectionManager();
     }
 
     void HandleWindowInput(u64 pad)
@@ -126,29 +174,21 @@ namespace Windows
 
         if ((pad_prev & HidNpadButton_Y) && !(pad & HidNpadButton_Y) && !paused)
         {
+            // With ZL held, Y marks every row from the one last toggled.
+            bool range = pad & HidNpadButton_ZL;
             if (selected_browser & LOCAL_BROWSER && strcmp(selected_local_file.name, "..") != 0)
             {
-                auto search_item = multi_selected_local_files.find(selected_local_file);
-                if (search_item != multi_selected_local_files.end())
-                {
-                    multi_selected_local_files.erase(search_item);
-                }
+                if (range)
+                    multi_selected_local_files.SelectTo(selected_local_file.name);
                 else
-                {
-                    multi_selected_local_files.insert(selected_local_file);
-                }
+                    multi_selected_local_files.Toggle(selected_local_file.name);
             }
             if (selected_browser & REMOTE_BROWSER && strcmp(selected_remote_file.name, "..") != 0)
             {
-                auto search_item = multi_selected_remote_files.find(selected_remote_file);
-                if (search_item != multi_selected_remote_files.end())
-                {
-                    multi_selected_remote_files.erase(search_item);
-                }
+                if (range)
+                    multi_selected_remote_files.SelectTo(selected_remote_file.name);
                 else
-                {
-                    multi_selected_remote_files.insert(selected_remote_file);
-                }
+                    multi_selected_remote_files.Toggle(selected_remote_file.name);
             }
         }
 
@@ -162,6 +202,14 @@ namespace Windows
             set_focus_to_local = true;
         }
 
+        if ((pad_prev & HidNpadButton_Minus) && !(pad & HidNpadButton_Minus) && !paused)
+        {
+            if (selected_browser & LOCAL_BROWSER)
+                local_grid = !local_grid;
+            else if (selected_browser & REMOTE_BROWSER)
+                remote_grid = !remote_grid;
+        }
+
         if ((pad_prev & HidNpadButton_Plus) && !(pad & HidNpadButton_Plus) && !paused)
         {
             selected_action = ACTION_DISCONNECT_AND_EXIT;
@@ -181,7 +229,7 @@ namespace Windows
         std::string zipname;
         std::vector<DirEntry> files;
         if (multi_selected_local_files.size() > 0)
-            std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(files));
+            files = multi_selected_local_files.Entries();
         else
             files.push_back(selected_local_file);
 
@@ -227,14 +275,14 @@ namespace Windows
         if (local_browser_selected)
         {
             if (multi_selected_local_files.size() > 0)
-                std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(files));
+                files = multi_selected_local_files.Entries();
             else
                 files.push_back(selected_local_file);
         }
         else
         {
             if (multi_selected_remote_files.size() > 0)
-                std::copy(multi_selected_remote_files.begin(), multi_selected_remote_files.end(), std::back_inserter(files));
+                files = multi_selected_remote_files.Entries();
             else
                 files.push_back(selected_remote_file);
         }
@@ -246,6 +294,42 @@ namespace Windows
         return zipfolder;
     }
 
+    static void FormatProbeMs(char *out, size_t size, int64_t us)
+    {
+        if (us < 10000)
+            snprintf(out, size, "%.1f ms", us / 1000.0);
+        else
+            snprintf(out, size, "%lld ms", (long long)(us / 1000));
+    }
+
+    // What the site list shows after a probed site's server; the steps it
+    // took go in SiteProbeTooltip().
+    static void SiteProbeText(const SiteProbe::Result &result, char *out, size_t size)
+    {
+        if (!result.ok)
+        {
+            snprintf(out, size, "%s", lang_strings[STR_SITE_UNREACHABLE]);
+            return;
+        }
+        FormatProbeMs(out, size, result.Total());
+    }
+
+    static void SiteProbeTooltip(const SiteProbe::Result &result)
+    {
+        const int64_t steps[] = {result.connect_us, result.handshake_us, result.first_byte_us};
+        const int labels[] = {STR_PROBE_CONNECT, STR_PROBE_HANDSHAKE, STR_PROBE_FIRST_BYTE};
+        char ms[32];
+        ImGui::BeginTooltip();
+        for (int i = 0; i < 3; i++)
+        {
+            if (steps[i] < 0)
+                continue;
+            FormatProbeMs(ms, sizeof(ms), steps[i]);
+            ImGui::Text("%s: %s", lang_strings[labels[i]], ms);
+        }
+        ImGui::EndTooltip();
+    }
+
     void ConnectionPanel()
     {
         ImGuiStyle *style = &ImGui::GetStyle();
@@ -259,6 +343,15 @@ namespace Windows
 
         ImGui::SetCursorPosX(ImGui::GetCursorPosX() + 4);
         bool is_connected = remoteclient != nullptr && remoteclient->IsConnected();
+        // Once when the panel comes up and again after each disconnect.
+        static bool probed = false;
+        if (is_connected)
+            probed = false;
+        else if (!probed)
+        {
+            SiteProbe::Start();
+            probed = true;
+        }
 
         if (ImGui::IsWindowAppearing())
         {
@@ -288,17 +381,30 @@ namespace Windows
         {
             static char site_id[64];
             static char site_display[512];
+            static char site_probe[64];
+            if (ImGui::IsWindowAppearing())
+                SiteProbe::Start();
             for (int n = 0; n < sites.size(); n++)
             {
                 const bool is_selected = strcmp(sites[n].c_str(), last_site) == 0;
+                const RemoteSettings &settings = site_settings[sites[n]];
+                SiteProbe::Result probe;
+                bool has_probe = SiteProbe::Get(sites[n], settings.server, probe);
+                site_probe[0] = '\0';
+                if (has_probe)
+                    SiteProbeText(probe, site_probe, sizeof(site_probe));
                 sprintf(site_id, "%s %d", lang_strings[STR_SITE], n + 1);
-                sprintf(site_display, "%s %d    %s", lang_strings[STR_SITE], n + 1, site_settings[sites[n]].server);
+                // The ID stays the same as the probe text comes in.
+                snprintf(site_display, sizeof(site_display), "%s %d    %s    %s###site%d", lang_strings[STR_SITE], n + 1,
+                         settings.server, site_probe, n);
                 if (ImGui::Selectable(site_display, is_selected))
                 {
                     sprintf(last_site, "%s", sites[n].c_str());
                     sprintf(display_site, "%s", site_id);
                     remote_settings = &site_settings[sites[n]];
                 }
+                if (has_probe && probe.ok && ImGui::IsItemHovered())
+                    SiteProbeTooltip(probe);
 
                 // Set the initial focus when opening the combo (scrolling + keyboard navigation focus)
                 if (is_selected)
@@ -387,6 +493,31 @@ namespace Windows
         }
         ImGui::PopStyleVar();
 
+        ImGui::SameLine();
+        ImGui::SetCursorPosX(1210);
+        // Benchmarks with the selected remote file, so one must be picked.
+        bool can_bench = is_connected && !selected_remote_file.isDir && selected_remote_file.name[0] != '\0' &&
+                         !SiteBench::Sweep(remoteclient->clientType()).empty();
+        if (!can_bench)
+        {
+            ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
+            ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.3f);
+        }
+        if (ImGui::Button(ICON_FA_GAUGE_HIGH "###sitebench", ImVec2(25, 0)))
+        {
+            selected_action = ACTION_BENCHMARK_SITE;
+        }
+        if (!can_bench)
+        {
+            ImGui::PopItemFlag();
+            ImGui::PopStyleVar();
+        }
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled))
+        {
+            ImGui::BeginTooltip();
+            ImGui::Text("%s", can_bench ? lang_strings[STR_BENCHMARK_SITE] : lang_strings[STR_BENCHMARK_SITE_NEED_FILE]);
+            ImGui::EndTooltip();
+        }
         ImGui::SameLine();
         ImGui::SetCursorPosX(1240);
         if (ImGui::Button(ICON_FA_GEAR, ImVec2(25, 0)))
@@ -404,6 +535,195 @@ namespace Windows
         EndGroupPanel();
     }
 
+    // Index of the entry named `name`, or -1. Empty names match nothing.
+    static int FindEntryIndex(const std::vector<DirEntry> &files, const char *name)
+    {
+        if (name[0] == '\0')
+            return -1;
+        for (size_t j = 0; j < files.size(); j++)
+        {
+            if (strcmp(files[j].name, name) == 0)
+                return (int)j;
+        }
+        return -1;
+    }
+
+    // What activating a row or grid cell of each pane does.
+    static void ActivateLocalEntry(const DirEntry &item)
+    {
+        selected_local_file = item;
+        saved_selected_browser = LOCAL_BROWSER;
+        if (item.isDir)
+        {
+            selected_action = ACTION_CHANGE_LOCAL_DIRECTORY;
+        }
+        else
+        {
+            std::string filename = Util::ToLower(selected_local_file.name);
+            size_t dot_pos = filename.find_last_of(".");
+            if (dot_pos != std::string::npos)
+            {
+                std::string ext = filename.substr(dot_pos);
+                if (image_file_extensions.find(ext) != image_file_extensions.end())
+                {
+                    selected_action = ACTION_VIEW_LOCAL_IMAGE;
+                }
+                else if (text_file_extensions.find(ext) != text_file_extensions.end())
+                {
+                    selected_action = ACTION_LOCAL_EDIT;
+                }
+            }
+        }
+    }
+
+    static void ActivateRemoteEntry(const DirEntry &item)
+    {
+        selected_remote_file = item;
+        saved_selected_browser = REMOTE_BROWSER;
+        if (item.isDir)
+        {
+            selected_action = ACTION_CHANGE_REMOTE_DIRECTORY;
+        }
+        else if (RemoteArchive::Contains(remote_directory))
+        {
+            // Entries of an opened archive can only be extracted.
+        }
+        else if (RemoteArchive::IsSupported(selected_remote_file) &&
+                 (remoteclient->SupportedActions() & REMOTE_ACTION_EXTRACT))
+        {
+            selected_action = ACTION_OPEN_REMOTE_ARCHIVE;
+        }
+        else
+        {
+            std::string filename = Util::ToLower(selected_remote_file.name);
+            size_t dot_pos = filename.find_last_of(".");
+            if (dot_pos != std::string::npos)
+            {
+                std::string ext = filename.substr(dot_pos);
+                if (image_file_extensions.find(ext) != image_file_extensions.end())
+                {
+                    selected_action = ACTION_VIEW_REMOTE_IMAGE;
+                }
+                else if (text_file_extensions.find(ext) != text_file_extensions.end())
+                {
+                    selected_action = ACTION_REMOTE_EDIT;
+                }
+            }
+        }
+    }
+
+    // What PackageInfo read of `item` so far; the grid has it read.
+    static bool FindPackageInfo(const DirEntry &item, bool remote, PackageInfo::Info &info)
+    {
+        if (!PackageInfo::IsPackage(item) || (remote && remote_settings == nullptr))
+            return false;
+        return PackageInfo::Find(Thumbnails::Key(item, remote), info);
+    }
+
+    // Tooltip of a row or cell: the name, and for a package what it is.
+    static void EntryTooltip(const char *name, const PackageInfo::Info *info)
+    {
+        ImGui::BeginTooltip();
+        ImGui::Text("%s", name);
+        if (info != nullptr)
+        {
+            if (!info->title.empty())
+                ImGui::Text("%s", info->title.c_str());
+            if (!info->publisher.empty())
+                ImGui::TextDisabled("%s", info->publisher.c_str());
+            char line[96];
+            int n = snprintf(line, sizeof(line), "%s", info->version.c_str());
+            if (info->kind != PackageInfo::KIND_UNKNOWN)
+                n += snprintf(line + n, sizeof(line) - n, "%s%s", n > 0 ? "  " : "", PackageInfo::KindLabel(info->kind));
+            if (info->title_id != 0 && n < (int)sizeof(line))
+                snprintf(line + n, sizeof(line) - n, "%s%016llX", n > 0 ? "  " : "", (unsigned long long)info->title_id);
+            if (line[0] != '\0')
+                ImGui::TextDisabled("%s", line);
+        }
+        ImGui::EndTooltip();
+    }
+
+    // Draws the thumbnail (or icon) and name of a grid cell at `pos`; a
+    // package shows its title instead of the name once it is known.
+    static void DrawGridCell(const DirEntry &item, bool remote, bool marked, ImVec2 pos, ImVec2 cell)
+    {
+        ImDrawList *draw = ImGui::GetWindowDrawList();
+        ImVec2 box(pos.x + (cell.x - THUMBNAIL_WIDTH) / 2, pos.y + 4);
+        const Tex *thumb = Thumbnails::Get(item, remote);
+        if (thumb != nullptr)
+        {
+            ImVec2 offset((THUMBNAIL_WIDTH - thumb->width) / 2.0f, (THUMBNAIL_HEIGHT - thumb->height) / 2.0f);
+            ImVec2 p0(box.x + offset.x, box.y + offset.y);
+            draw->AddImage(thumb->id, p0, ImVec2(p0.x + thumb->width, p0.y + thumb->height));
+        }
+        else
+        {
+            const char *icon = item.isDir ? ICON_FA_FOLDER : ICON_FA_FILE;
+            ImVec2 icon_size = ImGui::CalcTextSize(icon);
+            draw->AddText(ImVec2(box.x + (THUMBNAIL_WIDTH - icon_size.x) / 2, box.y + (THUMBNAIL_HEIGHT - icon_size.y) / 2),
+                          ImGui::GetColorU32(ImGuiCol_Text), icon);
+        }
+
+        PackageInfo::Info info;
+        const char *label = FindPackageInfo(item, remote, info) && !info.title.empty() ? info.title.c_str() : item.name;
+        ImU32 color = marked ? IM_COL32(0, 255, 0, 255) : ImGui::GetColorU32(ImGuiCol_Text);
+        ImVec2 name_pos(pos.x + 4, pos.y + cell.y - ImGui::GetTextLineHeight() - 2);
+        draw->PushClipRect(pos, ImVec2(pos.x + cell.x - 4, pos.y + cell.y), true);
+        draw->AddText(name_pos, color, label);
+        draw->PopClipRect();
+    }
+
+    // Grid view of a pane: rows of kGridColumns cells, only the rows in
+    // view submitted, like the list. Returns the index of the activated
+    // cell, or -1.
+    static int ThumbnailGrid(const std::vector<DirEntry> &files, const Selection &marked, bool remote,
+                             DirEntry &focused, char *file_to_select)
+    {
+        const int kGridColumns = 4;
+        const ImVec2 cell(144, THUMBNAIL_HEIGHT + ImGui::GetTextLineHeight() + 12);
+
+        int activated = -1;
+        ImGuiListClipper clipper;
+        clipper.Begin((files.size() + kGridColumns - 1) / kGridColumns, cell.y + ImGui::GetStyle().ItemSpacing.y);
+        int focus_index = FindEntryIndex(files, file_to_select);
+        if (focus_index >= 0)
+            clipper.ForceDisplayRangeByIndices(focus_index / kGridColumns, focus_index / kGridColumns + 1);
+        while (clipper.Step())
+        {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+            {
+                for (int j = row * kGridColumns; j < (row + 1) * kGridColumns && j < (int)files.size(); j++)
+                {
+                    const DirEntry &item = files[j];
+                    if (j % kGridColumns != 0)
+                        ImGui::SameLine();
+                    ImVec2 pos = ImGui::GetCursorScreenPos();
+                    ImGui::PushID(remote ? 99999 + j : j);
+                    if (ImGui::Selectable("##cell", false, 0, cell))
+                        activated = j;
+                    ImGui::PopID();
+                    if (ImGui::IsItemFocused())
+                        focused = item;
+                    if (ImGui::IsItemHovered())
+                    {
+                        PackageInfo::Info info;
+                        bool package = FindPackageInfo(item, remote, info);
+                        if (package || ImGui::CalcTextSize(item.name).x > cell.x - 8)
+                            EntryTooltip(item.name, package ? &info : nullptr);
+                    }
+                    if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows) && strcmp(file_to_select, item.name) == 0)
+                    {
+                        SetNavFocusHere();
+                        ImGui::SetScrollHereY(0.5f);
+                        sprintf(file_to_select, "");
+                    }
+                    DrawGridCell(item, remote, marked.Has(j), pos, cell);
+                }
+            }
+        }
+        return activated;
+    }
+
     void BrowserPanel()
     {
         ImGuiStyle *style = &ImGui::GetStyle();
@@ -488,8 +808,6 @@ namespace Windows
         ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 10);
 
         ImGui::BeginChild("Local##ChildWindow", ImVec2(609, 420));
-        ImGui::Separator();
-        ImGui::Columns(2, "Local##Columns", true);
         int i = 0;
         if (set_focus_to_local)
         {
@@ -497,107 +815,137 @@ namespace Windows
             ImGui::SetWindowFocus();
         }
 
-        for (int j = 0; j < local_files.size(); j++)
+        if (local_grid)
         {
-            DirEntry item = local_files[j];
-            
-            ImGui::SetColumnWidth(-1, 460);
-            ImGui::PushID(i);
-            auto search_item = multi_selected_local_files.find(item);
-            if (search_item != multi_selected_local_files.end())
+            // Cells of a row move together; a moved one is just refocused.
+            if (local_file_to_keep[0] != '\0')
             {
-                ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(0, 255, 0, 255));
+                snprintf(local_file_to_select, 256, "%s", local_file_to_keep);
+                local_file_to_keep[0] = '\0';
             }
-            if (ImGui::Selectable(item.name, false, ImGuiSelectableFlags_SpanAllColumns, ImVec2(609, 0)))
+            int activated = ThumbnailGrid(local_files, multi_selected_local_files, false, selected_local_file, local_file_to_select);
+            if (activated >= 0)
+                ActivateLocalEntry(local_files[activated]);
+            if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
+                selected_browser |= LOCAL_BROWSER;
+        }
+        else
+        {
+            ImGui::Separator();
+            ImGui::Columns(2, "Local##Columns", true);
+            // Only the rows in view are submitted; a folder of tens of thousands
+            // of entries costs the same per frame as a page of them. Rows the
+            // code is about to focus are kept in range.
+            ImGuiListClipper local_clipper;
+            local_clipper.Begin(local_files.size());
+            int local_focus_index = FindEntryIndex(local_files, local_file_to_select);
+            if (local_focus_index >= 0)
+                local_clipper.ForceDisplayRangeByIndices(local_focus_index, local_focus_index + 1);
+            int local_keep_index = FindEntryIndex(local_files, local_file_to_keep);
+            if (local_keep_index >= 0)
+                local_clipper.ForceDisplayRangeByIndices(local_keep_index, local_keep_index + 1);
+            else
+                local_file_to_keep[0] = '\0';
+            if (selected_local_position >= 0 && selected_local_position < (int)local_files.size())
+                local_clipper.ForceDisplayRangeByIndices(selected_local_position, selected_local_position + 1);
+            while (local_clipper.Step())
             {
-                selected_local_file = item;
-                saved_selected_browser = LOCAL_BROWSER;
-                if (item.isDir)
-                {
-                    selected_action = ACTION_CHANGE_LOCAL_DIRECTORY;
-                }
-                else
+                for (int j = local_clipper.DisplayStart; j < local_clipper.DisplayEnd; j++)
                 {
-                    std::string filename = Util::ToLower(selected_local_file.name);
-                    size_t dot_pos = filename.find_last_of(".");
-                    if (dot_pos != std::string::npos)
+                    // Listed without stat(); only drawn rows pay for it.
+                    DirEntry &item = local_files[j];
+                    FS::EnsureDetails(item);
+                    i = j;
+
+                    ImGui::SetColumnWidth(-1, 460);
+                    ImGui::PushID(i);
+                    bool marked = multi_selected_local_files.Has(j);
+                    if (marked)
+                    {
+                        ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(0, 255, 0, 255));
+                    }
+                    if (ImGui::Selectable(item.name, false, ImGuiSelectableFlags_SpanAllColumns, ImVec2(609, 0)))
                     {
-                        std::string ext = filename.substr(dot_pos);
-                        if (image_file_extensions.find(ext) != image_file_extensions.end())
+                        ActivateLocalEntry(item);
+                    }
+                    ImGui::PopID();
+                    if (ImGui::IsItemFocused())
+                    {
+                        selected_local_file = item;
+                    }
+                    if (ImGui::IsItemHovered())
+                    {
+                        PackageInfo::Info info;
+                        bool package = FindPackageInfo(item, false, info);
+                        if (package || ImGui::CalcTextSize(item.name).x > 450)
+                            EntryTooltip(item.name, package ? &info : nullptr);
+                        if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadUp) && !paused)
                         {
-                            selected_action = ACTION_VIEW_LOCAL_IMAGE;
+                            if (j == 0)
+                            {
+                                selected_local_position = local_files.size()-1;
+                                scroll_direction = 0.0f;
+                            }
                         }
-                        else if (text_file_extensions.find(ext) != text_file_extensions.end())
+                        else if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadDown) && !paused)
                         {
-                            selected_action = ACTION_LOCAL_EDIT;
+                            if (j == local_files.size()-1)
+                            {
+                                selected_local_position = 0;
+                                scroll_direction = 1.0f;
+                            }
                         }
                     }
-                }
-            }
-            ImGui::PopID();
-            if (ImGui::IsItemFocused())
-            {
-                selected_local_file = item;
-            }
-            if (ImGui::IsItemHovered())
-            {
-                if (ImGui::CalcTextSize(item.name).x > 450)
-                {
-                    ImGui::BeginTooltip();
-                    ImGui::Text(item.name);
-                    ImGui::EndTooltip();
-                }
-                if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadUp) && !paused)
-                {
-                    if (j == 0)
+                    if (local_file_to_keep[0] != '\0' && strcmp(local_file_to_keep, item.name) == 0 && local_clipper.ItemsHeight > 0)
                     {
-                        selected_local_position = local_files.size()-1;
-                        scroll_direction = 0.0f;
+                        // Rows came or went above it in a merge.
+                        if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
+                            SetNavFocusHere();
+                        ImGui::SetScrollY(ImGui::GetScrollY() + local_keep_shift * local_clipper.ItemsHeight);
+                        local_file_to_keep[0] = '\0';
                     }
-                }
-                else if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadDown) && !paused)
-                {
-                    if (j == local_files.size()-1)
+                    if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
+                    {
+                        if (strcmp(local_file_to_select, item.name) == 0)
+                        {
+                            SetNavFocusHere();
+                            ImGui::SetScrollHereY(0.5f);
+                            sprintf(local_file_to_select, "");
+                        }
+                        if (selected_local_position == j && !paused)
+                        {
+                            SetNavFocusHere();
+                            ImGui::SetScrollHereY(scroll_direction);
+                            selected_local_position = -1;
+                        }
+                        selected_browser |= LOCAL_BROWSER;
+                    }
+                    ImGui::NextColumn();
+                    ImGui::SetColumnWidth(-1, 120);
+                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + ImGui::GetColumnWidth() - ImGui::CalcTextSize(item.display_size).x - ImGui::GetScrollX() - ImGui::GetStyle().ItemSpacing.x);
+                    ImGui::Text(item.display_size);
+                    if (marked)
                     {
-                        selected_local_position = 0;
-                        scroll_direction = 1.0f;
+                        ImGui::PopStyleColor();
                     }
+                    ImGui::NextColumn();
+                    ImGui::Separator();
                 }
             }
-            if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
-            {
-                if (strcmp(local_file_to_select, item.name) == 0)
-                {
-                    SetNavFocusHere();
-                    ImGui::SetScrollHereY(0.5f);
-                    sprintf(local_file_to_select, "");
-                }
-                if (selected_local_position == j && !paused)
-                {
-                    SetNavFocusHere();
-                    ImGui::SetScrollHereY(scroll_direction);
-                    selected_local_position = -1;
-                }
-                selected_browser |= LOCAL_BROWSER;
-            }
-            ImGui::NextColumn();
-            ImGui::SetColumnWidth(-1, 120);
-            ImGui::SetCursorPosX(ImGui::GetCursorPosX() + ImGui::GetColumnWidth() - ImGui::CalcTextSize(item.display_size).x - ImGui::GetScrollX() - ImGui::GetStyle().ItemSpacing.x);
-            ImGui::Text(item.display_size);
-            if (search_item != multi_selected_local_files.end())
-            {
-                ImGui::PopStyleColor();
-            }
-            ImGui::NextColumn();
-            ImGui::Separator();
-            i++;
+            ImGui::Columns(1);
         }
-        ImGui::Columns(1);
         ImGui::EndChild();
         EndGroupPanel();
         ImGui::SameLine();
 
-        BeginGroupPanel(lang_strings[STR_REMOTE], ImVec2(628, 420));
+        // The rows of the previous folder stay up while a listing runs;
+        // the spinner in the title says they are about to change.
+        char remote_title[128];
+        if (Actions::RemoteListingInProgress())
+            snprintf(remote_title, sizeof(remote_title), "%s  %c", lang_strings[STR_REMOTE], "|/-\\"[(int)(ImGui::GetTime() * 8) % 4]);
+        else
+            snprintf(remote_title, sizeof(remote_title), "%s", lang_strings[STR_REMOTE]);
+        BeginGroupPanel(remote_title, ImVec2(628, 420));
         ImGui::Dummy(ImVec2(0, 10));
         posX = ImGui::GetCursorPosX();
         ImGui::PushStyleVar(ImGuiStyleVar_ButtonTextAlign, ImVec2(0.0f, 1.0f));
@@ -677,109 +1025,130 @@ namespace Windows
             set_focus_to_remote = false;
             ImGui::SetWindowFocus();
         }
-        ImGui::Separator();
-        ImGui::Columns(2, "Remote##Columns", true);
-        i = 99999;
-        for (int j = 0; j < remote_files.size(); j++)
+        if (remote_grid)
         {
-            DirEntry item = remote_files[j];
-
-            ImGui::SetColumnWidth(-1, 460);
-            auto search_item = multi_selected_remote_files.find(item);
-            if (search_item != multi_selected_remote_files.end())
+            // Cells of a row move together; a moved one is just refocused.
+            if (remote_file_to_keep[0] != '\0')
             {
-                ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(0, 255, 0, 255));
+                snprintf(remote_file_to_select, 256, "%s", remote_file_to_keep);
+                remote_file_to_keep[0] = '\0';
             }
-            ImGui::PushID(i);
-            if (ImGui::Selectable(item.name, false, ImGuiSelectableFlags_SpanAllColumns, ImVec2(609, 0)))
+            int activated = ThumbnailGrid(remote_files, multi_selected_remote_files, true, selected_remote_file, remote_file_to_select);
+            if (activated >= 0)
+                ActivateRemoteEntry(remote_files[activated]);
+            if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
+                selected_browser |= REMOTE_BROWSER;
+        }
+        else
+        {
+            ImGui::Separator();
+            ImGui::Columns(2, "Remote##Columns", true);
+            ImGuiListClipper remote_clipper;
+            remote_clipper.Begin(remote_files.size());
+            int remote_focus_index = FindEntryIndex(remote_files, remote_file_to_select);
+            if (remote_focus_index >= 0)
+                remote_clipper.ForceDisplayRangeByIndices(remote_focus_index, remote_focus_index + 1);
+            int remote_keep_index = FindEntryIndex(remote_files, remote_file_to_keep);
+            if (remote_keep_index >= 0)
+                remote_clipper.ForceDisplayRangeByIndices(remote_keep_index, remote_keep_index + 1);
+            else
+                remote_file_to_keep[0] = '\0';
+            if (selected_remote_position >= 0 && selected_remote_position < (int)remote_files.size())
+                remote_clipper.ForceDisplayRangeByIndices(selected_remote_position, selected_remote_position + 1);
+            while (remote_clipper.Step())
             {
-                selected_remote_file = item;
-                saved_selected_browser = REMOTE_BROWSER;
-                if (item.isDir)
+                for (int j = remote_clipper.DisplayStart; j < remote_clipper.DisplayEnd; j++)
                 {
-                    selected_action = ACTION_CHANGE_REMOTE_DIRECTORY;
-                }
-                else
-                {
-                    std::string filename = Util::ToLower(selected_remote_file.name);
-                    size_t dot_pos = filename.find_last_of(".");
-                    if (dot_pos != std::string::npos)
+                    const DirEntry &item = remote_files[j];
+                    i = 99999 + j;
+
+                    ImGui::SetColumnWidth(-1, 460);
+                    bool marked = multi_selected_remote_files.Has(j);
+                    if (marked)
+                    {
+                        ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(0, 255, 0, 255));
+                    }
+                    ImGui::PushID(i);
+                    if (ImGui::Selectable(item.name, false, ImGuiSelectableFlags_SpanAllColumns, ImVec2(609, 0)))
+                    {
+                        ActivateRemoteEntry(item);
+                    }
+                    if (ImGui::IsItemFocused())
+                    {
+                        selected_remote_file = item;
+                    }
+                    if (ImGui::IsItemHovered())
                     {
-                        std::string ext = filename.substr(dot_pos);
-                        if (image_file_extensions.find(ext) != image_file_extensions.end())
+                        // Catalogue matches live in other folders.
+                        bool elsewhere = strcmp(item.name, "..") != 0 && strcmp(item.directory, remote_directory) != 0;
+                        PackageInfo::Info info;
+                        bool package = FindPackageInfo(item, true, info);
+                        if (package || ImGui::CalcTextSize(item.name).x > 450 || elsewhere)
+                            EntryTooltip(elsewhere ? item.path : item.name, package ? &info : nullptr);
+                        if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadUp) && !paused)
                         {
-                            selected_action = ACTION_VIEW_REMOTE_IMAGE;
+                            if (j == 0)
+                            {
+                                selected_remote_position = remote_files.size()-1;
+                                scroll_direction = 0.0f;
+                            }
                         }
-                        else if (text_file_extensions.find(ext) != text_file_extensions.end())
+                        else if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadDown) && !paused)
                         {
-                            selected_action = ACTION_REMOTE_EDIT;
+                            if (j == remote_files.size()-1)
+                            {
+                                selected_remote_position = 0;
+                                scroll_direction = 1.0f;
+                            }
                         }
                     }
-                }
-            }
-            if (ImGui::IsItemFocused())
-            {
-                selected_remote_file = item;
-            }
-            if (ImGui::IsItemHovered())
-            {
-                if (ImGui::CalcTextSize(item.name).x > 450)
-                {
-                    ImGui::BeginTooltip();
-                    ImGui::Text(item.name);
-                    ImGui::EndTooltip();
-                }
-                if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadUp) && !paused)
-                {
-                    if (j == 0)
+                    ImGui::PopID();
+                    if (ImGui::IsItemFocused())
                     {
-                        selected_remote_position = remote_files.size()-1;
-                        scroll_direction = 0.0f;
+                        selected_remote_file = item;
                     }
-                }
-                else if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadDown) && !paused)
-                {
-                    if (j == remote_files.size()-1)
+                    if (remote_file_to_keep[0] != '\0' && strcmp(remote_file_to_keep, item.name) == 0 && remote_clipper.ItemsHeight > 0)
                     {
-                        selected_remote_position = 0;
-                        scroll_direction = 1.0f;
+                        // Rows came or went above it in a merge.
+                        if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
+                            SetNavFocusHere();
+                        ImGui::SetScrollY(ImGui::GetScrollY() + remote_keep_shift * remote_clipper.ItemsHeight);
+                        remote_file_to_keep[0] = '\0';
                     }
+                    if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
+                    {
+                        if (strcmp(remote_file_to_select, item.name) == 0)
+                        {
+                            SetNavFocusHere();
+                            ImGui::SetScrollHereY(0.5f);
+                            sprintf(remote_file_to_select, "");
+                        }
+                        if (selected_remote_position == j && !paused)
+                        {
+                            SetNavFocusHere();
+                            ImGui::SetScrollHereY(scroll_direction);
+                            selected_remote_position = -1;
+                        }
+                        selected_browser |= REMOTE_BROWSER;
+                    }
+                    ImGui::NextColumn();
+                    ImGui::SetColumnWidth(-1, 120);
+                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + ImGui::GetColumnWidth() - ImGui::CalcTextSize(item.display_size).x - ImGui::GetScrollX() - ImGui::GetStyle().ItemSpacing.x);
+                    ImGui::Text(item.display_size);
+                    if (marked)
+                    {
+                        ImGui::PopStyleColor();
+                    }
+                    ImGui::NextColumn();
+                    ImGui::Separator();
                 }
             }
-            ImGui::PopID();
-            if (ImGui::IsItemFocused())
-            {
-                selected_remote_file = item;
-            }
-            if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows))
-            {
-                if (strcmp(remote_file_to_select, item.name) == 0)
-                {
-                    SetNavFocusHere();
-                    ImGui::SetScrollHereY(0.5f);
-                    sprintf(remote_file_to_select, "");
-                }
-                if (selected_remote_position == j && !paused)
-                {
-                    SetNavFocusHere();
-                    ImGui::SetScrollHereY(scroll_direction);
-                    selected_remote_position = -1;
-                }
-                selected_browser |= REMOTE_BROWSER;
-            }
-            ImGui::NextColumn();
-            ImGui::SetColumnWidth(-1, 120);
-            ImGui::SetCursorPosX(ImGui::GetCursorPosX() + ImGui::GetColumnWidth() - ImGui::CalcTextSize(item.display_size).x - ImGui::GetScrollX() - ImGui::GetStyle().ItemSpacing.x);
-            ImGui::Text(item.display_size);
-            if (search_item != multi_selected_remote_files.end())
-            {
-                ImGui::PopStyleColor();
-            }
-            ImGui::NextColumn();
-            ImGui::Separator();
-            i++;
+            ImGui::Columns(1);
+        }
+        if (Actions::RemoteListingInProgress())
+        {
+            ImGui::TextColored(colors[ImGuiCol_ButtonHovered], lang_strings[STR_LOADING_ENTRIES], Actions::RemoteListingCount());
         }
-        ImGui::Columns(1);
         ImGui::EndChild();
         EndGroupPanel();
 
@@ -801,6 +1170,42 @@ namespace Windows
         }
     }
 
+    // One line under the messages for the background download queue, in
+    // place of the progress dialog.
+    static void BackgroundDownloadsStrip(const ImVec2 &pos)
+    {
+        TransferStats::Snapshot stats;
+        TransferStats::Read(stats);
+        int64_t done = batch_bytes_done;
+        for (const TransferStats::Worker &worker : stats.workers)
+            if (worker.busy)
+                done += worker.done;
+        uint64_t now = Util::GetTick();
+        double sec = (now - batch_start_tick) * 1.0 / 1000000.0;
+        double rate = (sec > 0.0) ? done / sec : 0.0;
+
+        char text[192];
+        if (batch_files_total > 0)
+        {
+            if (done > batch_bytes_total)
+                done = batch_bytes_total;
+            int eta = (rate > 0.0) ? (int)((batch_bytes_total - done) / rate) : 0;
+            snprintf(text, sizeof(text), "%s %d/%d files | %.1f/%.1f MiB | %.2f MB/s | ETA %d:%02d:%02d",
+                     lang_strings[STR_DOWNLOADING], batch_files_done, batch_files_total, done / 1048576.0,
+                     batch_bytes_total / 1048576.0, rate / 1048576.0, eta / 3600, (eta / 60) % 60, eta % 60);
+        }
+        else
+            snprintf(text, sizeof(text), "%s %d files | %.1f MiB | %.2f MB/s | %d queued", lang_strings[STR_DOWNLOADING],
+                     batch_files_done, done / 1048576.0, rate / 1048576.0, stats.queued);
+
+        float progress = (batch_bytes_total > 0) ? (float)done / (float)batch_bytes_total : 0.0f;
+        ImGui::SetCursorPos(ImVec2(pos.x, pos.y + 32));
+        ImGui::ProgressBar(progress, ImVec2(820, 0), text);
+        ImGui::SameLine();
+        if (ImGui::Button(lang_strings[STR_CANCEL], ImVec2(100, 0)))
+            Actions::CancelBackgroundDownloads(false);
+    }
+
     void StatusPanel()
     {
         ImGui::Dummy(ImVec2(0, 5));
@@ -818,6 +1223,8 @@ namespace Windows
             ImGui::Text(status_message);
         }
         ImGui::PopTextWrapPos();
+        if (Actions::BackgroundDownloadsRunning())
+            BackgroundDownloadsStrip(pos);
         ImGui::SameLine();
         EndGroupPanel();
     }
@@ -828,6 +1235,12 @@ namespace Windows
         bool local_browser_selected = saved_selected_browser & LOCAL_BROWSER;
         bool remote_browser_selected = saved_selected_browser & REMOTE_BROWSER;
 
+        // Inside an archive opened as a folder, entries can only be
+        // extracted (Download extracts to the local folder).
+        bool in_archive = remote_browser_selected && RemoteArchive::Contains(remote_directory);
+        if (in_archive && !(remote_action & (REMOTE_ACTION_DOWNLOAD | REMOTE_ACTION_EXTRACT)))
+            return flag;
+
         if ((local_browser_selected && selected_local_file.selectable) ||
             (remote_browser_selected && selected_remote_file.selectable &&
              remoteclient != nullptr && (remoteclient->SupportedActions() & remote_action)))
@@ -897,6 +1310,19 @@ namespace Windows
             ImGui::PopID();
             ImGui::Separator();
 
+            ImGui::PushID("Invert Selection##settings");
+            if (ImGui::Selectable(lang_strings[STR_INVERT_SELECTION], false, ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+            {
+                SetModalMode(false);
+                if (local_browser_selected)
+                    selected_action = ACTION_LOCAL_INVERT_SELECTION;
+                else if (remote_browser_selected)
+                    selected_action = ACTION_REMOTE_INVERT_SELECTION;
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::PopID();
+            ImGui::Separator();
+
             if (local_browser_selected)
             {
                 ImGui::PushID("Cut##settings");
@@ -953,6 +1379,61 @@ namespace Windows
                 ImGui::PopID();
                 ImGui::Separator();
             }
+            else if (remote_browser_selected)
+            {
+                ImGui::PushID("RemoteCut##settings");
+                if (ImGui::Selectable(lang_strings[STR_CUT], false, getSelectableFlag(REMOTE_ACTION_DELETE) | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    selected_action = ACTION_REMOTE_CUT;
+                    SetModalMode(false);
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
+
+                ImGui::PushID("RemoteCopy##settings");
+                if (ImGui::Selectable(lang_strings[STR_COPY], false, getSelectableFlag(REMOTE_ACTION_DOWNLOAD) | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    selected_action = ACTION_REMOTE_COPY;
+                    SetModalMode(false);
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
+
+                // Files copied on another site paste here too; they
+                // stream from a second connection to that site.
+                ImGui::PushID("RemotePaste##settings");
+                flags = ImGuiSelectableFlags_Disabled;
+                if (remote_paste_files.size() && remoteclient != nullptr &&
+                    (remoteclient->SupportedActions() & REMOTE_ACTION_UPLOAD))
+                    flags = ImGuiSelectableFlags_None;
+                if (ImGui::Selectable(lang_strings[STR_PASTE], false, flags | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    SetModalMode(false);
+                    selected_action = ACTION_REMOTE_PASTE;
+                    ImGui::CloseCurrentPopup();
+                }
+                if (ImGui::IsItemHovered())
+                {
+                    ImGui::SetNextWindowSize(ImVec2(500, (remote_paste_files.size() * 30) + 72));
+                    ImGui::BeginTooltip();
+                    int text_width = ImGui::CalcTextSize(lang_strings[STR_FILES]).x;
+                    int file_pos = ImGui::GetCursorPosX() + text_width + 15;
+                    ImGui::Text("%s: %s", lang_strings[STR_TYPE], remote_paste_action == ACTION_REMOTE_CUT ? lang_strings[STR_CUT] : lang_strings[STR_COPY]);
+                    ImGui::Text("%s: %s", lang_strings[STR_SITE], remote_paste_settings.site_name);
+                    ImGui::Text("%s:", lang_strings[STR_FILES]);
+                    ImGui::SameLine();
+                    for (std::vector<DirEntry>::iterator it = remote_paste_files.begin(); it != remote_paste_files.end(); ++it)
+                    {
+                        ImGui::SetCursorPosX(file_pos);
+                        ImGui::Text("%s", it->path);
+                    }
+                    ImGui::EndTooltip();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
+            }
 
             ImGui::PushID("Delete##settings");
             if (ImGui::Selectable(lang_strings[STR_DELETE], false, getSelectableFlag(REMOTE_ACTION_DELETE) | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
@@ -1088,6 +1569,32 @@ namespace Windows
                 ImGui::PopID();
                 ImGui::Separator();
 
+                // The zip is written into the remote folder as it is made.
+                flags = ImGuiSelectableFlags_Disabled;
+                if (remoteclient != nullptr && (remoteclient->SupportedActions() & REMOTE_ACTION_UPLOAD) &&
+                    !RemoteArchive::Contains(remote_directory))
+                    flags = ImGuiSelectableFlags_None;
+                ImGui::PushID("CompressToRemote##settings");
+                if (ImGui::Selectable(lang_strings[STR_COMPRESS_TO_REMOTE], false, flags | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    std::string zipname = getUniqueZipFilename();
+                    zipname = zipname.substr(zipname.find_last_of("/") + 1);
+
+                    ResetImeCallbacks();
+                    snprintf(zip_file_path, 384, "%s%s%s", remote_directory, FS::hasEndSlash(remote_directory) ? "" : "/", zipname.c_str());
+                    ime_single_field = zip_file_path;
+                    ime_field_size = 383;
+                    ime_callback = SingleValueImeCallback;
+                    ime_after_update = AfterRemoteZipFileCallback;
+                    Dialog::initImeDialog(lang_strings[STR_ZIP_FILE_PATH], zip_file_path, 383, SwkbdType_All, 0, 0);
+                    gui_mode = GUI_MODE_IME;
+                    file_transfering = true;
+                    SetModalMode(false);
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
+
                 flags = getSelectableFlag(REMOTE_ACTION_UPLOAD);
                 if (local_browser_selected && remoteclient != nullptr && !(remoteclient->SupportedActions() & REMOTE_ACTION_UPLOAD))
                 {
@@ -1105,6 +1612,22 @@ namespace Windows
                 }
                 ImGui::PopID();
                 ImGui::Separator();
+
+                // Sync works on the whole folder, whatever is selected.
+                flags = ImGuiSelectableFlags_Disabled;
+                if (remoteclient != nullptr && (remoteclient->SupportedActions() & REMOTE_ACTION_UPLOAD) &&
+                    !RemoteArchive::Contains(remote_directory))
+                    flags = ImGuiSelectableFlags_None;
+                ImGui::PushID("SyncToRemote##settings");
+                if (ImGui::Selectable(lang_strings[STR_SYNC_TO_REMOTE], false, flags | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    SetModalMode(false);
+                    selected_action = ACTION_SYNC_TO_REMOTE;
+                    file_transfering = true;
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
             }
 
             if (remote_browser_selected)
@@ -1121,6 +1644,48 @@ namespace Windows
                 }
                 ImGui::PopID();
                 ImGui::Separator();
+
+                flags = getSelectableFlag(REMOTE_ACTION_INSTALL);
+                if (!Installer::CanInstall(selected_remote_file) || RemoteArchive::Contains(remote_directory))
+                    flags = ImGuiSelectableFlags_Disabled;
+                ImGui::PushID("Install##settings");
+                if (ImGui::Selectable(lang_strings[STR_INSTALL], false, flags | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    SetModalMode(false);
+                    selected_action = ACTION_INSTALL_REMOTE_PACKAGES;
+                    file_transfering = true;
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
+
+                flags = ImGuiSelectableFlags_Disabled;
+                if (remoteclient != nullptr && (remoteclient->SupportedActions() & REMOTE_ACTION_DOWNLOAD) &&
+                    !RemoteArchive::Contains(remote_directory))
+                    flags = ImGuiSelectableFlags_None;
+                ImGui::PushID("SyncToLocal##settings");
+                if (ImGui::Selectable(lang_strings[STR_SYNC_TO_LOCAL], false, flags | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    SetModalMode(false);
+                    selected_action = ACTION_SYNC_TO_LOCAL;
+                    file_transfering = true;
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
+
+                flags = ImGuiSelectableFlags_Disabled;
+                if (remoteclient != nullptr && !RemoteArchive::Contains(remote_directory))
+                    flags = ImGuiSelectableFlags_None;
+                ImGui::PushID("BuildCatalogue##settings");
+                if (ImGui::Selectable(lang_strings[STR_BUILD_CATALOGUE], false, flags | ImGuiSelectableFlags_DontClosePopups, ImVec2(220, 0)))
+                {
+                    SetModalMode(false);
+                    selected_action = ACTION_BUILD_CATALOGUE;
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::PopID();
+                ImGui::Separator();
             }
 
             flags = ImGuiSelectableFlags_Disabled;
@@ -1192,6 +1757,69 @@ namespace Windows
             }
         }
 
+        if (conflicts_state == CONFIRM_WAIT)
+        {
+            ImGui::OpenPopup(lang_strings[STR_CONFLICTS]);
+            ImGui::SetNextWindowPos(ImVec2(340, 150));
+            ImGui::SetNextWindowSizeConstraints(ImVec2(600, 100), ImVec2(600, 440), NULL, NULL);
+            if (ImGui::BeginPopupModal(lang_strings[STR_CONFLICTS], NULL, ImGuiWindowFlags_AlwaysAutoResize))
+            {
+                ImGui::PushTextWrapPos(ImGui::GetCursorPos().x + 585);
+                ImGui::Text("%s", confirm_message);
+                ImGui::PopTextWrapPos();
+                ImGui::BeginChild("Conflicts##ChildWindow", ImVec2(585, 260), true);
+                ImGuiListClipper clipper;
+                clipper.Begin((int)transfer_conflicts.size());
+                while (clipper.Step())
+                {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                    {
+                        TransferConflict &conflict = transfer_conflicts[i];
+                        ImGui::PushID(i);
+                        ImGui::Checkbox("##Overwrite", &conflict.overwrite);
+                        ImGui::SameLine();
+                        ImGui::Text("%s (%.2f MiB)", conflict.path.c_str(), conflict.size / 1048576.0);
+                        ImGui::PopID();
+                    }
+                }
+                ImGui::EndChild();
+
+                ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 5);
+                if (ImGui::Button(lang_strings[STR_OVERWRITE_ALL], ImVec2(135, 0)))
+                {
+                    for (TransferConflict &conflict : transfer_conflicts)
+                        conflict.overwrite = true;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button(lang_strings[STR_SKIP_ALL], ImVec2(135, 0)))
+                {
+                    for (TransferConflict &conflict : transfer_conflicts)
+                        conflict.overwrite = false;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button(lang_strings[STR_CANCEL], ImVec2(135, 0)))
+                {
+                    conflicts_state = CONFIRM_NO;
+                    selected_action = ACTION_NONE;
+                    SetModalMode(false);
+                    ImGui::CloseCurrentPopup();
+                }
+                if (ImGui::IsWindowAppearing())
+                {
+                    ImGui::SetItemDefaultFocus();
+                }
+                ImGui::SameLine();
+                if (ImGui::Button(lang_strings[STR_CONTINUE], ImVec2(135, 0)))
+                {
+                    conflicts_state = CONFIRM_YES;
+                    selected_action = action_to_take;
+                    SetModalMode(false);
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::EndPopup();
+            }
+        }
+
         if (confirm_transfer_state == 0)
         {
             ImGui::OpenPopup(lang_strings[STR_OVERWRITE_OPTIONS]);
@@ -1235,7 +1863,7 @@ namespace Windows
         }
     }
 
-    void ShowPropertiesDialog(DirEntry item)
+    void ShowPropertiesDialog(DirEntry item, bool remote)
     {
         ImGuiIO &io = ImGui::GetIO();
         (void)io;
@@ -1263,7 +1891,30 @@ namespace Windows
             ImGui::TextColored(colors[ImGuiCol_ButtonHovered], "%s:", lang_strings[STR_SIZE]);
             ImGui::SameLine();
             ImGui::SetCursorPosX(105);
-            ImGui::Text("%lld   (%s)", item.file_size, item.display_size);
+            if (item.isDir && strcmp(item.name, "..") != 0)
+            {
+                // Counted in the background while the dialog is open.
+                Actions::StartFolderSize(item, remote);
+                FolderSize::Totals totals;
+                bool ok;
+                bool done = Actions::FolderSizeStatus(totals, &ok);
+                DirEntry sized = item;
+                sized.file_size = totals.bytes;
+                DirEntry::SetDisplaySize(&sized);
+                if (!done)
+                    ImGui::Text(lang_strings[STR_COUNTING_FILES], (long long)totals.files);
+                else if (!ok)
+                    ImGui::Text("-");
+                else
+                    ImGui::Text("%lld   (%s)", (long long)totals.bytes, sized.display_size);
+                if (done && ok && totals.files >= 0)
+                {
+                    ImGui::SetCursorPosX(105);
+                    ImGui::Text(lang_strings[STR_FOLDER_CONTENTS], (long long)totals.files, (long long)totals.folders);
+                }
+            }
+            else
+                ImGui::Text("%lld   (%s)", item.file_size, item.display_size);
             ImGui::Separator();
 
             ImGui::TextColored(colors[ImGuiCol_ButtonHovered], "%s:", lang_strings[STR_DATE]);
@@ -1277,6 +1928,7 @@ namespace Windows
             ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 5);
             if (ImGui::Button(lang_strings[STR_CLOSE], ImVec2(100, 0)))
             {
+                Actions::CancelFolderSize();
                 SetModalMode(false);
                 selected_action = ACTION_NONE;
                 ImGui::CloseCurrentPopup();
@@ -1284,6 +1936,7 @@ namespace Windows
 
             if (ImGui::IsKeyPressed(ImGuiKey_GamepadFaceRight, false))
             {
+                Actions::CancelFolderSize();
                 SetModalMode(false);
                 selected_action = ACTION_NONE;
                 ImGui::CloseCurrentPopup();
@@ -1293,6 +1946,79 @@ namespace Windows
         }
     }
 
+    // One row per busy download worker: its file, a bar with its own rate
+    // and, for files fetched in ranges or segments, a map of the parts that
+    // have landed. The footer shows what tuning concurrency needs: jobs not
+    // yet started, bytes waiting for the SD card, leased transfer buffers
+    // and retried requests.
+    static void ShowTransfersPanel(const TransferStats::Snapshot &stats, uint64_t now)
+    {
+        static uint64_t last_tick[TransferStats::kMaxWorkers];
+        static int64_t last_done[TransferStats::kMaxWorkers];
+        static double rate[TransferStats::kMaxWorkers];
+
+        ImGui::Separator();
+        for (size_t i = 0; i < stats.workers.size(); i++)
+        {
+            const TransferStats::Worker &worker = stats.workers[i];
+            if (!worker.busy)
+            {
+                last_tick[i] = 0;
+                continue;
+            }
+
+            // Same windowed, smoothed rate as the main bar, per worker.
+            if (last_tick[i] == 0 || worker.done < last_done[i])
+            {
+                last_tick[i] = now;
+                last_done[i] = worker.done;
+                rate[i] = 0.0;
+            }
+            double window_sec = (now - last_tick[i]) / 1000000.0;
+            if (window_sec >= 0.3)
+            {
+                double inst = (worker.done > last_done[i]) ? (worker.done - last_done[i]) / window_sec / 1048576.0 : 0.0;
+                rate[i] = rate[i] * 0.7 + inst * 0.3;
+                last_tick[i] = now;
+                last_done[i] = worker.done;
+            }
+
+            ImGui::PushTextWrapPos(ImGui::GetCursorPosX() + 490);
+            ImGui::Text("%s", worker.name.c_str());
+            ImGui::PopTextWrapPos();
+
+            char text[96];
+            if (worker.retries > 0)
+                snprintf(text, sizeof(text), "%.1f/%.1f MiB | %.2f MB/s | %u retries",
+                         worker.done / 1048576.0, worker.size / 1048576.0, rate[i], worker.retries);
+            else
+                snprintf(text, sizeof(text), "%.1f/%.1f MiB | %.2f MB/s",
+                         worker.done / 1048576.0, worker.size / 1048576.0, rate[i]);
+            float fraction = (worker.size > 0) ? (float)worker.done / (float)worker.size : 0.0f;
+            ImGui::ProgressBar(fraction, ImVec2(505, 0), text);
+
+            if (worker.ranged)
+            {
+                ImDrawList *draw = ImGui::GetWindowDrawList();
+                ImVec2 origin = ImGui::GetCursorScreenPos();
+                float cell_w = 505.0f / TransferStats::kCells;
+                ImU32 empty = ImGui::GetColorU32(ImGuiCol_FrameBg);
+                for (int c = 0; c < TransferStats::kCells; c++)
+                {
+                    ImVec2 a(origin.x + c * cell_w, origin.y);
+                    ImVec2 b(origin.x + (c + 1) * cell_w - 1.0f, origin.y + 6.0f);
+                    draw->AddRectFilled(a, b, empty);
+                    if (worker.cells[c] > 0)
+                        draw->AddRectFilled(a, b, ImGui::GetColorU32(ImGuiCol_PlotHistogram, worker.cells[c] / 255.0f));
+                }
+                ImGui::Dummy(ImVec2(505, 8));
+            }
+        }
+
+        ImGui::Text("queued %d | disk backlog %.1f MiB | buffers %.1f MiB | retries %u",
+                    stats.queued, stats.disk_backlog / 1048576.0, stats.pool_bytes / 1048576.0, stats.retries);
+    }
+
     void ShowProgressDialog()
     {
         if (activity_inprogess)
@@ -1307,8 +2033,13 @@ namespace Windows
             SetModalMode(true);
             ImGui::OpenPopup(lang_strings[STR_PROGRESS]);
 
-            ImGui::SetNextWindowPos(ImVec2(380, 250));
-            ImGui::SetNextWindowSizeConstraints(ImVec2(520, 80), ImVec2(520, 200), NULL, NULL);
+            // The transfers panel grows the dialog, so it starts higher up.
+            TransferStats::Snapshot stats;
+            TransferStats::Read(stats);
+            bool show_transfers = file_transfering && stats.active;
+
+            ImGui::SetNextWindowPos(ImVec2(380, show_transfers ? 60 : 250));
+            ImGui::SetNextWindowSizeConstraints(ImVec2(520, 80), ImVec2(520, show_transfers ? 640 : 200), NULL, NULL);
             if (ImGui::BeginPopupModal(lang_strings[STR_PROGRESS], NULL, ImGuiWindowFlags_AlwaysAutoResize))
             {
                 ImVec2 cur_pos = ImGui::GetCursorPos();
@@ -1362,6 +2093,34 @@ namespace Windows
 
                     snprintf(progress_text, sizeof(progress_text), "cur %.2f MB/s | avg %.2f MB/s", smoothed_speed, avg_speed);
                     ImGui::ProgressBar(progress, ImVec2(505, 0), progress_text);
+
+                    if (batch_files_total > 0)
+                    {
+                        // Without per-worker counters the in-flight bytes of
+                        // the current file(s) are only approximated by the
+                        // shared bytes_transfered counter.
+                        int64_t in_flight = bytes_transfered;
+                        if (show_transfers)
+                        {
+                            in_flight = 0;
+                            for (const TransferStats::Worker &worker : stats.workers)
+                                if (worker.busy)
+                                    in_flight += worker.done;
+                        }
+                        int64_t done = batch_bytes_done + in_flight;
+                        if (done > batch_bytes_total)
+                            done = batch_bytes_total;
+                        double batch_sec = (cur_tick - batch_start_tick) * 1.0 / 1000000.0;
+                        double rate = (batch_sec > 0.0) ? done / batch_sec : 0.0;
+                        int eta = (rate > 0.0) ? (int)((batch_bytes_total - done) / rate) : 0;
+                        ImGui::Text("%d/%d files | %.1f/%.1f MiB | ETA %d:%02d:%02d",
+                                    batch_files_done, batch_files_total,
+                                    done / 1048576.0, batch_bytes_total / 1048576.0,
+                                    eta / 3600, (eta / 60) % 60, eta % 60);
+                    }
+
+                    if (show_transfers)
+                        ShowTransfersPanel(stats, cur_tick);
                 }
                 else
                 {
@@ -1376,6 +2135,14 @@ namespace Windows
                     last_bytes = 0;
                 }
 
+                bool charging = false;
+                int battery = Power::Battery(&charging);
+                if (battery >= 0)
+                    ImGui::TextDisabled("CPU %s | battery %d%%%s", Power::Boosted() ? "boost" : "normal", battery,
+                                        charging ? " (charging)" : "");
+                else
+                    ImGui::TextDisabled("CPU %s", Power::Boosted() ? "boost" : "normal");
+
                 ImGui::Separator();
                 ImGui::SetCursorPosX(ImGui::GetCursorPosX() + 225);
                 ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 5);
@@ -1395,7 +2162,7 @@ namespace Windows
 
                         if (ImGui::Button(lang_strings[STR_YES], ImVec2(100, 0)))
                         {
-                            stop_activity = true;
+                            Cancel::Request();
                             SetModalMode(false);
                             cancel_confirm = false;
                             ImGui::CloseCurrentPopup();
@@ -1462,6 +2229,7 @@ namespace Windows
                         FS::SaveText(&edit_buffer, TMP_EDITOR_FILE);
                         if (remoteclient != nullptr)
                         {
+                            Actions::CancelRemoteListing();
                             remoteclient->Put(TMP_EDITOR_FILE, selected_remote_file.path);
                             selected_action = ACTION_REFRESH_REMOTE_FILES;
                         }
@@ -1559,6 +2327,103 @@ namespace Windows
         }
     }
 
+    // Printable copy of a line: tabs are expanded and control characters,
+    // which ImGui would draw as boxes, are shown as dots.
+    static std::string PrintableLine(const std::string &line)
+    {
+        std::string out;
+        out.reserve(line.size());
+        for (char c : line)
+        {
+            if (c == '\t')
+                out.append("    ");
+            else if ((unsigned char)c < 0x20 || c == 0x7f)
+                out.push_back('.');
+            else
+                out.push_back(c);
+        }
+        return out;
+    }
+
+    void ShowViewerDialog()
+    {
+        if (viewer_inprogress)
+        {
+            SetModalMode(true);
+            ImGui::OpenPopup(lang_strings[STR_VIEWER]);
+
+            ImGui::SetNextWindowPos(ImVec2(0, 0));
+            ImGui::SetNextWindowSizeConstraints(ImVec2(1280, 720), ImVec2(1280, 720), NULL, NULL);
+            if (ImGui::BeginPopupModal(lang_strings[STR_VIEWER], NULL, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoScrollbar))
+            {
+                char id[128];
+                sprintf(id, "%s##viewer", lang_strings[STR_CLOSE]);
+                if (ImGui::Button(id, ImVec2(1270, 0)))
+                {
+                    viewer.Close();
+                    viewer_inprogress = false;
+                    SetModalMode(false);
+                    ImGui::CloseCurrentPopup();
+                    ImGui::EndPopup();
+                    return;
+                }
+
+                ImGui::Separator();
+                ImGui::BeginChild("Viewer##ChildWindow", ImVec2(1270, 595), false, ImGuiWindowFlags_NoScrollbar);
+                int rows = std::max(1, (int)(595 / ImGui::GetTextLineHeightWithSpacing()));
+                if (gui_mode != GUI_MODE_IME)
+                {
+                    if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadDown, true))
+                        viewer.Scroll(1);
+                    else if (ImGui::IsKeyPressed(ImGuiKey_GamepadDpadUp, true))
+                        viewer.Scroll(-1);
+                    else if (ImGui::IsKeyPressed(ImGuiKey_GamepadR1, true))
+                        viewer.Scroll(rows - 1);
+                    else if (ImGui::IsKeyPressed(ImGuiKey_GamepadL1, true))
+                        viewer.Scroll(-(rows - 1));
+                    else if (ImGui::IsKeyPressed(ImGuiKey_GamepadR2, false))
+                        viewer.End(rows);
+                    else if (ImGui::IsKeyPressed(ImGuiKey_GamepadL2, false))
+                        viewer.Home();
+                    else if (ImGui::IsKeyPressed(ImGuiKey_GamepadFaceUp, false))
+                    {
+                        int64_t line = viewer.TopLine();
+                        snprintf(viewer_goto, sizeof(viewer_goto), "%lld", (long long)(line >= 0 ? line + 1 : 1));
+                        ResetImeCallbacks();
+                        ime_single_field = viewer_goto;
+                        ime_field_size = sizeof(viewer_goto) - 1;
+                        ime_callback = SingleValueImeCallback;
+                        ime_after_update = AfterViewerGoToCallback;
+                        Dialog::initImeDialog(lang_strings[STR_GO_TO_LINE], viewer_goto, sizeof(viewer_goto) - 1, SwkbdType_NumPad, 0, 0);
+                        gui_mode = GUI_MODE_IME;
+                    }
+                }
+
+                static std::vector<std::string> lines;
+                bool ready = viewer.Lines(rows, lines);
+                for (const std::string &line : lines)
+                    ImGui::TextUnformatted(PrintableLine(line).c_str());
+                ImGui::EndChild();
+
+                bool complete;
+                int64_t count = viewer.LineCount(&complete);
+                int64_t top_line = viewer.TopLine();
+                char line_text[64];
+                if (top_line >= 0)
+                    snprintf(line_text, sizeof(line_text), "%lld", (long long)(top_line + 1));
+                else
+                    snprintf(line_text, sizeof(line_text), "?");
+                ImGui::Text("%s    %s / %lld%s    %s%s", edit_file, line_text, (long long)count, complete ? "" : "+",
+                            viewer_entry.display_size, ready ? "" : "    ...");
+                ImGui::Separator();
+                ImGui::Text("L1/R1 - %s        ZL/ZR - %s        X - %s", lang_strings[STR_PAGE_UP_DOWN], lang_strings[STR_TOP_END],
+                            lang_strings[STR_GO_TO_LINE]);
+
+                ImGui::EndPopup();
+            }
+        }
+    }
+
     void ShowSettingsDialog()
     {
         if (show_settings)
@@ -1604,6 +2469,78 @@ namespace Windows
                     }
                     ImGui::EndCombo();
                 }
+                ImGui::SetCursorPosX(posX + 5);
+                ImGui::Checkbox(lang_strings[STR_TRANSFER_TRACE], &transfer_trace);
+                ImGui::SetCursorPosX(posX + 5);
+                ImGui::Checkbox(lang_strings[STR_MEMORY_OVERLAY], &memory_overlay);
+                ImGui::SetCursorPosX(posX + 5);
+                ImGui::Checkbox(lang_strings[STR_FRAME_PROFILER], &frame_profiler);
+                ImGui::SetCursorPosX(posX + 5);
+                ImGui::Checkbox(lang_strings[STR_TIMELINE_TRACE], &timeline_trace);
+                if (timeline_trace)
+                {
+                    ImGui::SetCursorPosX(posX + 5);
+                    if (Timeline::Exporting())
+                        ImGui::Text("%s", lang_strings[STR_TIMELINE_EXPORTING]);
+                    else
+                    {
+                        sprintf(id, "%s##settings", lang_strings[STR_TIMELINE_EXPORT]);
+                        if (ImGui::Button(id, ImVec2(375, 0)))
+                            Timeline::Export();
+                    }
+                    std::string exported = Timeline::LastExport();
+                    if (!exported.empty())
+                    {
+                        ImGui::SetCursorPosX(posX + 5);
+                        ImGui::TextWrapped("%s", exported.c_str());
+                    }
+                }
+
+                ImGui::Separator();
+                ImGui::SetCursorPosX(posX + 5);
+                if (SdBench::Running())
+                    ImGui::Text("%s", lang_strings[STR_SD_BENCHMARK_RUNNING]);
+                else
+                {
+                    sprintf(id, "%s##settings", lang_strings[STR_SD_BENCHMARK]);
+                    if (ImGui::Button(id, ImVec2(375, 0)))
+                        SdBench::Start();
+                    SdBench::Result bench;
+                    if (SdBench::Last(bench))
+                    {
+                        ImGui::SetCursorPosX(posX + 5);
+                        ImGui::TextWrapped("%s", SdBench::Summary(bench).c_str());
+                        ImGui::SetCursorPosX(posX + 5);
+                        sprintf(id, "%s##settings", lang_strings[STR_SD_BENCHMARK_APPLY]);
+                        if (bench.ok && ImGui::Button(id, ImVec2(375, 0)))
+                            SdBench::Apply(bench);
+                    }
+                }
+
+                // Read once per opening; the first read loads the file.
+                static std::vector<TransferHistory::Trend> trends;
+                if (ImGui::IsWindowAppearing())
+                    trends = TransferHistory::Trends(last_site);
+                if (transfer_history)
+                {
+                    ImGui::Separator();
+                    ImGui::SetCursorPosX(posX + 5);
+                    ImGui::TextColored(colors[ImGuiCol_ButtonHovered], "%s", lang_strings[STR_TRANSFER_HISTORY]);
+                    if (trends.empty())
+                    {
+                        ImGui::SetCursorPosX(posX + 5);
+                        ImGui::Text("%s", lang_strings[STR_TRANSFER_HISTORY_EMPTY]);
+                    }
+                    for (const TransferHistory::Trend &trend : trends)
+                    {
+                        ImGui::SetCursorPosX(posX + 5);
+                        ImGui::TextWrapped("%s", TransferHistory::Summary(trend).c_str());
+                        ImGui::SetCursorPosX(posX + 5);
+                        sprintf(id, "##history%d", (int)trend.iface);
+                        ImGui::PlotLines(id, trend.recent.data(), (int)trend.recent.size(), 0, nullptr, 0.0f,
+                                         (float)trend.best_mib_s, ImVec2(375, 40));
+                    }
+                }
 
                 ImGui::Separator();
                 sprintf(id, "%s##settings", lang_strings[STR_CLOSE]);
@@ -1633,6 +2570,165 @@ namespace Windows
         }
     }
 
+    void ShowSiteBench()
+    {
+        show_site_bench = true;
+    }
+
+    void ShowSiteBenchDialog()
+    {
+        SiteBench::Result result;
+        if (!show_site_bench || !SiteBench::Last(result))
+            return;
+
+        SetModalMode(true);
+        ImGui::OpenPopup(lang_strings[STR_BENCHMARK_SITE]);
+        ImGui::SetNextWindowPos(ImVec2(340, 60));
+        ImGui::SetNextWindowSizeConstraints(ImVec2(600, 80), ImVec2(600, 640), NULL, NULL);
+        if (ImGui::BeginPopupModal(lang_strings[STR_BENCHMARK_SITE], NULL, ImGuiWindowFlags_AlwaysAutoResize))
+        {
+            ImGui::PushTextWrapPos(ImGui::GetCursorPos().x + 580);
+            ImGui::Text("%s (%lld MiB)", result.path.c_str(), (long long)(result.bytes / 1048576));
+            if (!result.error.empty())
+                ImGui::Text("%s", result.error.c_str());
+            ImGui::PopTextWrapPos();
+            ImGui::Separator();
+
+            // One bar per point, scaled to the fastest.
+            double fastest = 0;
+            for (const SiteBench::Point &point : result.points)
+                fastest = std::max(fastest, point.mib_s);
+            for (size_t i = 0; i < result.points.size(); i++)
+            {
+                const SiteBench::Point &point = result.points[i];
+                ImGui::Text("%s%s", (int)i == result.best ? "> " : "  ", SiteBench::Label(result.type, point).c_str());
+                ImGui::SameLine();
+                ImGui::SetCursorPosX(150);
+                char overlay[64];
+                if (point.ok)
+                    snprintf(overlay, sizeof(overlay), "%.1f MiB/s%s", point.mib_s, point.retries > 0 ? "  (retries)" : "");
+                else
+                    snprintf(overlay, sizeof(overlay), "-");
+                ImGui::ProgressBar(fastest > 0 ? (float)(point.mib_s / fastest) : 0.0f, ImVec2(430, 0), overlay);
+            }
+
+            ImGui::Separator();
+            bool close = false;
+            if (result.ok)
+            {
+                if (ImGui::Button(lang_strings[STR_BENCHMARK_SITE_SAVE], ImVec2(285, 0)))
+                {
+                    SiteBench::Apply(result, remote_settings, last_site);
+                    close = true;
+                }
+                ImGui::SameLine();
+            }
+            if (ImGui::Button(lang_strings[STR_CLOSE], ImVec2(result.ok ? 285 : 580, 0)) ||
+                ImGui::IsKeyPressed(ImGuiKey_GamepadFaceRight, false))
+                close = true;
+            if (close)
+            {
+                show_site_bench = false;
+                SetModalMode(false);
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::EndPopup();
+        }
+    }
+
+    // Fetches a remote image into a pooled buffer and decodes it from
+    // there, reusing the cached texture when this version was viewed
+    // before. Caching it evicts any texture but `keep`.
+    static bool LoadRemoteImage(const DirEntry &entry, Tex &texture, GLuint keep = 0)
+    {
+        std::string key = ImagePrefetch::Key(entry, true);
+        if (Textures::CacheLookup(key, texture))
+            return true;
+
+        int64_t size = entry.file_size;
+        if (size <= 0 && !remoteclient->Size(entry.path, &size))
+            return false;
+        TransferBuffer buffer;
+        if (size <= 0 || size > MAX_REMOTE_IMAGE_BYTES || !buffer.Acquire(size))
+        {
+            std::string image_file = TMP_IMAGE_PATH + FS::GetFileExt(entry.name);
+            return remoteclient->Get(image_file, entry.path) && Textures::LoadImageFile(image_file, texture);
+        }
+
+        size_t received = 0;
+        int ok = remoteclient->GetStream(entry.path, size, [&](const char *data, size_t len)
+                                         {
+                                             if (received + len > (size_t)size)
+                                                 return false;
+                                             memcpy(buffer.data() + received, data, len);
+                                             received += len;
+                                             return true;
+                                         });
+        if (!ok || received != (size_t)size)
+            return false;
+        if (!Textures::LoadImageMemory(entry.name, reinterpret_cast<unsigned char *>(buffer.data()), received, texture))
+            return false;
+        if (image_cache_mb > 0)
+            Textures::CacheStore(key, texture, keep);
+        return true;
+    }
+
+    // Local images are cached once viewed as well, as the ones decoded
+    // ahead are.
+    static bool LoadLocalImage(DirEntry &entry, Tex &texture, GLuint keep = 0)
+    {
+        FS::EnsureDetails(entry);
+        std::string key = ImagePrefetch::Key(entry, false);
+        if (Textures::CacheLookup(key, texture))
+            return true;
+        if (!Textures::LoadImageFile(entry.path, texture))
+            return false;
+        if (image_cache_mb > 0)
+            Textures::CacheStore(key, texture, keep);
+        return true;
+    }
+
+    // Position of the image on screen in its pane's listing, or -1 when
+    // the listing changed under it.
+    static int ImageIndex(const std::vector<DirEntry> &files)
+    {
+        for (int i = 0; i < (int)files.size(); i++)
+        {
+            if (strcmp(files[i].path, image_entry.path) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    // Shows the image `direction` steps away in the folder and wants the
+    // ones beyond it decoded ahead. Stays put at either end.
+    static void StepImage(int direction)
+    {
+        if (image_remote && (remoteclient == nullptr || Actions::RemoteConnectionBusy()))
+            return;
+        std::vector<DirEntry> &files = image_remote ? remote_files : local_files;
+        int current = ImageIndex(files);
+        if (current < 0)
+            return;
+        int next = current + direction;
+        while (next >= 0 && next < (int)files.size() && !ImagePrefetch::Viewable(files[next]))
+            next += direction;
+        if (next < 0 || next >= (int)files.size())
+            return;
+
+        Tex shown;
+        DirEntry entry = files[next];
+        bool ok = image_remote ? LoadRemoteImage(entry, shown, texture.id) : LoadLocalImage(entry, shown, texture.id);
+        // A file that does not decode is stepped over on the next press.
+        image_entry = entry;
+        if (ok)
+        {
+            Textures::Free(texture);
+            texture = shown;
+        }
+        ImagePrefetch::Want(files, next, direction, image_remote, texture);
+    }
+
     void ShowImageDialog()
     {
         if (view_image)
@@ -1674,10 +2770,15 @@ namespace Windows
             {
                 ImGui::SetCursorPos(ImVec2(0,0));
                 ImGui::Image(texture.id, image_size);
+                if (ImGui::IsKeyPressed(ImGuiKey_GamepadR1, false) || ImGui::IsKeyPressed(ImGuiKey_GamepadDpadRight, false))
+                    StepImage(1);
+                else if (ImGui::IsKeyPressed(ImGuiKey_GamepadL1, false) || ImGui::IsKeyPressed(ImGuiKey_GamepadDpadLeft, false))
+                    StepImage(-1);
                 if (ImGui::IsKeyPressed(ImGuiKey_GamepadFaceRight, false))
                 {
                     view_image = false;
                     SetModalMode(false);
+                    ImagePrefetch::Cancel();
                     Textures::Free(texture);
                     ImGui::CloseCurrentPopup();
                 }
@@ -1700,32 +2801,206 @@ namespace Windows
         draw->AddText(text_pos, color, credit);
     }
 
+    // The panes' DirEntry vectors, counted once a frame, and with
+    // memory_overlay the MemoryStats report in a corner, refreshed twice
+    // a second.
+    void MemoryOverlay()
+    {
+        static Metrics::Held panes(Metrics::GAUGE_MEM_LISTINGS);
+        panes.Set((int64_t)((local_files.capacity() + remote_files.capacity() + local_paste_files.capacity() +
+                             remote_paste_files.capacity()) * sizeof(DirEntry)));
+        if (!memory_overlay)
+            return;
+
+        static MemoryStats::Report report;
+        static uint64_t read_at = 0;
+        uint64_t now = Util::GetTick();
+        if (read_at == 0 || now - read_at > 500000)
+        {
+            MemoryStats::Read(report);
+            read_at = now;
+        }
+
+        const double mb = 1024.0 * 1024.0;
+        ImGui::SetNextWindowPos(ImVec2(1270, 10), ImGuiCond_Always, ImVec2(1.0f, 0.0f));
+        ImGui::SetNextWindowBgAlpha(0.75f);
+        if (ImGui::Begin("##memory_overlay", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+                                                          ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoNav |
+                                                          ImGuiWindowFlags_NoFocusOnAppearing))
+        {
+            const MemoryStats::Heap &heap = report.heap;
+            const int64_t *g = report.gauges;
+            ImGui::Text("Process   %7.1f / %7.1f MiB", heap.process_used / mb, heap.process_total / mb);
+            ImGui::Text("Heap      %7.1f / %7.1f MiB", heap.heap_used / mb, heap.heap_size / mb);
+            ImGui::Text("Heap free %7.1f MiB", heap.heap_free / mb);
+            ImGui::Text("Pool      %7.1f / %7.1f MiB", g[Metrics::GAUGE_POOL_BYTES] / mb, report.pool_budget / mb);
+            ImGui::Text("  idle %.1f, peak %.1f MiB", report.pool_idle / mb, report.pool_peak / mb);
+            ImGui::Separator();
+            ImGui::Text("Listings  %7.1f MiB", g[Metrics::GAUGE_MEM_LISTINGS] / mb);
+            ImGui::Text("HTTP      %7.1f MiB", g[Metrics::GAUGE_MEM_HTTP_BODIES] / mb);
+            ImGui::Text("Textures  %7.1f MiB", g[Metrics::GAUGE_MEM_TEXTURES] / mb);
+            ImGui::Text("Fonts     %7.1f MiB", g[Metrics::GAUGE_MEM_FONTS] / mb);
+            ImGui::Text("Archive   %7.1f MiB", g[Metrics::GAUGE_MEM_ARCHIVE] / mb);
+            ImGui::Separator();
+            ImGui::Text("Headroom  %7.1f MiB", report.headroom / mb);
+            ImGui::Text("Governor  %s%s", MemoryGovernor::LevelName((MemoryGovernor::Level)report.level),
+                        MemoryGovernor::AppletMode() ? " (applet)" : "");
+        }
+        ImGui::End();
+    }
+
     void MainWindow()
     {
         Windows::SetupWindow();
         ImGuiIO &io = ImGui::GetIO();
         (void)io;
         ImGui::SetMouseCursor(ImGuiMouseCursor_None);
+        {
+            FrameProfiler::Scope scope(FrameProfiler::SECTION_TEXTURES);
+            Thumbnails::Upload();
+            ImagePrefetch::Upload();
+        }
 
         if (ImGui::Begin("ezRemote Client", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoScrollbar))
         {
-            ConnectionPanel();
+            {
+                FrameProfiler::Scope scope(FrameProfiler::SECTION_CONNECTION_PANEL);
+                ConnectionPanel();
+            }
             ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 3);
-            BrowserPanel();
+            {
+                FrameProfiler::Scope scope(FrameProfiler::SECTION_BROWSER_PANEL);
+                BrowserPanel();
+            }
             ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 3);
-            StatusPanel();
+            {
+                FrameProfiler::Scope scope(FrameProfiler::SECTION_STATUS_PANEL);
+                StatusPanel();
+            }
+            FrameProfiler::Scope dialogs(FrameProfiler::SECTION_DIALOGS);
             ShowSettingsDialog();
+            ShowSiteBenchDialog();
             ShowProgressDialog();
             ShowActionsDialog();
             ShowEditorDialog();
+            ShowViewerDialog();
             ShowImageDialog();
             DrawCreditsOverlay();
         }
         ImGui::End();
+        MemoryOverlay();
+        FrameProfiler::Draw();
+    }
+
+    // Actions that may run while a remote listing is still streaming in.
+    // Anything else talks to the remote connection the listing thread is
+    // using, so it stays queued until the listing finishes.
+    static bool RunsDuringBackgroundConnect(int action)
+    {
+        switch (action)
+        {
+        case ACTION_CHANGE_LOCAL_DIRECTORY:
+        case ACTION_REFRESH_LOCAL_FILES:
+        case ACTION_UPDATE_LOCAL_FILES:
+        case ACTION_APPLY_LOCAL_FILTER:
+        case ACTION_LOCAL_SELECT_ALL:
+        case ACTION_LOCAL_CLEAR_ALL:
+        case ACTION_LOCAL_INVERT_SELECTION:
+        case ACTION_DISCONNECT:
+        case ACTION_DISCONNECT_AND_EXIT:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool RunsDuringRemoteListing(int action)
+    {
+        switch (action)
+        {
+        case ACTION_NONE:
+        case ACTION_CHANGE_LOCAL_DIRECTORY:
+        case ACTION_REFRESH_LOCAL_FILES:
+        case ACTION_UPDATE_LOCAL_FILES:
+        case ACTION_APPLY_LOCAL_FILTER:
+        case ACTION_CHANGE_REMOTE_DIRECTORY:
+        case ACTION_REFRESH_REMOTE_FILES:
+        case ACTION_APPLY_REMOTE_FILTER:
+        case ACTION_LOCAL_SELECT_ALL:
+        case ACTION_LOCAL_CLEAR_ALL:
+        case ACTION_LOCAL_INVERT_SELECTION:
+        case ACTION_DISCONNECT:
+        case ACTION_DISCONNECT_AND_EXIT:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Transfers that would share the batch counters with the background
+    // download queue wait until it is done.
+    static bool WaitsForBackgroundDownloads(int action)
+    {
+        switch (action)
+        {
+        case ACTION_UPLOAD:
+        case ACTION_RESUME_DOWNLOADS:
+        case ACTION_SYNC_TO_LOCAL:
+        case ACTION_SYNC_TO_REMOTE:
+        case ACTION_EXTRACT_LOCAL_ZIP:
+        case ACTION_INSTALL_REMOTE_PACKAGES:
+        case ACTION_EXTRACT_REMOTE_ZIP:
+        case ACTION_CREATE_LOCAL_ZIP:
+        case ACTION_CREATE_REMOTE_ZIP:
+        case ACTION_BUILD_CATALOGUE:
+        case ACTION_BENCHMARK_SITE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    int FrameRate()
+    {
+        if (selected_action != ACTION_NONE)
+            return 60;
+        if (activity_inprogess || file_transfering || Actions::BackgroundDownloadsRunning() ||
+            Actions::RemoteListingInProgress() || LocalScan::Running() ||
+            Actions::RemoteConnectionBusy() || Actions::BackgroundConnectInProgress() || Thumbnails::Busy() ||
+            ImagePrefetch::Busy())
+            return progress_fps;
+        return idle_fps;
     }
 
     void ExecuteActions()
     {
+        bool transferring = activity_inprogess || file_transfering || Actions::BackgroundDownloadsRunning() || FileServer::Busy();
+        Power::Update(transferring || Thumbnails::Busy(), transferring);
+        Actions::PollConnectionManager();
+        Actions::PollBackgroundDownloads();
+        Actions::PollRemoteListing();
+        Actions::PollLocalListing();
+        Actions::PollFolderSize();
+        // Actions on the dead session or without one wait for the login.
+        if (Actions::BackgroundConnectInProgress() && !RunsDuringBackgroundConnect(selected_action))
+            return;
+        if (Actions::RemoteConnectionBusy() && !RunsDuringRemoteListing(selected_action))
+        {
+            // A prefetch gives way to anything else that needs the connection.
+            Actions::CancelRemotePrefetch();
+            return;
+        }
+        if (selected_action == ACTION_NONE)
+            Actions::PrefetchRemoteListings();
+        if (Actions::BackgroundDownloadsRunning() && WaitsForBackgroundDownloads(selected_action))
+        {
+            snprintf(status_message, 1023, "%s", lang_strings[STR_TRANSFERS_BUSY]);
+            file_transfering = false;
+            confirm_transfer_state = -1;
+            selected_action = ACTION_NONE;
+            return;
+        }
+
         switch (selected_action)
         {
         case ACTION_CHANGE_LOCAL_DIRECTORY:
@@ -1737,15 +3012,18 @@ namespace Windows
         case ACTION_REFRESH_LOCAL_FILES:
             Actions::HandleRefreshLocalFiles();
             break;
+        case ACTION_UPDATE_LOCAL_FILES:
+            Actions::HandleUpdateLocalFiles();
+            break;
         case ACTION_REFRESH_REMOTE_FILES:
             Actions::HandleRefreshRemoteFiles();
             break;
         case ACTION_APPLY_LOCAL_FILTER:
-            Actions::RefreshLocalFiles(true);
+            Actions::ApplyLocalFilter();
             selected_action = ACTION_NONE;
             break;
         case ACTION_APPLY_REMOTE_FILTER:
-            Actions::RefreshRemoteFiles(true);
+            Actions::ApplyRemoteFilter();
             selected_action = ACTION_NONE;
             break;
         case ACTION_NEW_LOCAL_FOLDER:
@@ -1795,14 +3073,49 @@ namespace Windows
             sprintf(status_message, "%s", "");
             if (dont_prompt_overwrite || (!dont_prompt_overwrite && confirm_transfer_state == 1))
             {
-                activity_inprogess = true;
-                sprintf(activity_message, "%s", "");
-                stop_activity = false;
-                Actions::DownloadFiles();
+                if (Actions::QueueBackgroundDownloads())
+                    file_transfering = false;
+                else if (Actions::BackgroundDownloadsRunning())
+                {
+                    // It cannot join the running queue (overwrite prompt, archive).
+                    snprintf(status_message, 1023, "%s", lang_strings[STR_TRANSFERS_BUSY]);
+                    file_transfering = false;
+                }
+                else
+                {
+                    activity_inprogess = true;
+                    sprintf(activity_message, "%s", "");
+                    stop_activity = false;
+                    Actions::DownloadFiles();
+                }
                 confirm_transfer_state = -1;
                 selected_action = ACTION_NONE;
             }
             break;
+        case ACTION_RESUME_DOWNLOADS:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            Actions::ResumeDownloads();
+            selected_action = ACTION_NONE;
+            break;
+        case ACTION_SYNC_TO_LOCAL:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            selected_action = ACTION_NONE;
+            Actions::SyncToLocal();
+            break;
+        case ACTION_SYNC_TO_REMOTE:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            selected_action = ACTION_NONE;
+            Actions::SyncToRemote();
+            break;
         case ACTION_EXTRACT_LOCAL_ZIP:
             sprintf(status_message, "%s", "");
             activity_inprogess = true;
@@ -1812,6 +3125,40 @@ namespace Windows
             selected_action = ACTION_NONE;
             Actions::ExtractLocalZips();
             break;
+        case ACTION_BUILD_CATALOGUE:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            selected_action = ACTION_NONE;
+            Actions::BuildCatalogue();
+            break;
+        case ACTION_BENCHMARK_SITE:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            file_transfering = true;
+            selected_action = ACTION_NONE;
+            Actions::BenchmarkSite();
+            break;
+        case ACTION_OPEN_REMOTE_ARCHIVE:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            selected_action = ACTION_NONE;
+            Actions::OpenRemoteArchive();
+            break;
+        case ACTION_INSTALL_REMOTE_PACKAGES:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            file_transfering = true;
+            selected_action = ACTION_NONE;
+            Actions::InstallRemotePackages();
+            break;
         case ACTION_EXTRACT_REMOTE_ZIP:
             sprintf(status_message, "%s", "");
             activity_inprogess = true;
@@ -1830,6 +3177,15 @@ namespace Windows
             selected_action = ACTION_NONE;
             Actions::MakeLocalZip();
             break;
+        case ACTION_CREATE_REMOTE_ZIP:
+            sprintf(status_message, "%s", "");
+            activity_inprogess = true;
+            sprintf(activity_message, "%s", "");
+            stop_activity = false;
+            file_transfering = true;
+            selected_action = ACTION_NONE;
+            Actions::MakeRemoteZip();
+            break;
         case ACTION_RENAME_LOCAL:
             if (gui_mode != GUI_MODE_IME)
             {
@@ -1859,10 +3215,11 @@ namespace Windows
             }
             break;
         case ACTION_SHOW_LOCAL_PROPERTIES:
-            ShowPropertiesDialog(selected_local_file);
+            FS::EnsureDetails(selected_local_file);
+            ShowPropertiesDialog(selected_local_file, false);
             break;
         case ACTION_SHOW_REMOTE_PROPERTIES:
-            ShowPropertiesDialog(selected_remote_file);
+            ShowPropertiesDialog(selected_remote_file, true);
             break;
         case ACTION_LOCAL_SELECT_ALL:
             Actions::SelectAllLocalFiles();
@@ -1880,6 +3237,14 @@ namespace Windows
             multi_selected_remote_files.clear();
             selected_action = ACTION_NONE;
             break;
+        case ACTION_LOCAL_INVERT_SELECTION:
+            multi_selected_local_files.Invert();
+            selected_action = ACTION_NONE;
+            break;
+        case ACTION_REMOTE_INVERT_SELECTION:
+            multi_selected_remote_files.Invert();
+            selected_action = ACTION_NONE;
+            break;
         case ACTION_CONNECT:
             sprintf(status_message, "%s", "");
             Actions::Connect();
@@ -1896,12 +3261,32 @@ namespace Windows
             paste_action = selected_action;
             local_paste_files.clear();
             if (multi_selected_local_files.size() > 0)
-                std::copy(multi_selected_local_files.begin(), multi_selected_local_files.end(), std::back_inserter(local_paste_files));
+                local_paste_files = multi_selected_local_files.Entries();
             else
                 local_paste_files.push_back(selected_local_file);
             multi_selected_local_files.clear();
             selected_action = ACTION_NONE;
             break;
+        case ACTION_REMOTE_CUT:
+        case ACTION_REMOTE_COPY:
+            remote_paste_action = selected_action;
+            remote_paste_settings = *remote_settings;
+            remote_paste_files.clear();
+            if (multi_selected_remote_files.size() > 0)
+                remote_paste_files = multi_selected_remote_files.Entries();
+            else
+                remote_paste_files.push_back(selected_remote_file);
+            multi_selected_remote_files.clear();
+            selected_action = ACTION_NONE;
+            break;
+        case ACTION_REMOTE_PASTE:
+            sprintf(status_message, "%s", "");
+            sprintf(activity_message, "%s", "");
+            activity_inprogess = true;
+            stop_activity = false;
+            selected_action = ACTION_NONE;
+            Actions::PasteRemoteFiles();
+            break;
         case ACTION_LOCAL_PASTE:
             sprintf(status_message, "%s", "");
             sprintf(activity_message, "%s", "");
@@ -1923,26 +3308,34 @@ namespace Windows
             }
             break;
         case ACTION_VIEW_LOCAL_IMAGE:
-            if (Textures::LoadImageFile(selected_local_file.path, texture))
+            if (LoadLocalImage(selected_local_file, texture))
             {
                 view_image = true;
+                image_entry = selected_local_file;
+                image_remote = false;
+                ImagePrefetch::Want(local_files, ImageIndex(local_files), 0, false, texture);
             }
             selected_action = ACTION_NONE;
             break;
         case ACTION_VIEW_REMOTE_IMAGE:
+            if (LoadRemoteImage(selected_remote_file, texture))
             {
-                std::string image_file = TMP_IMAGE_PATH + FS::GetFileExt(selected_remote_file.name);
-                remoteclient->Get(image_file, selected_remote_file.path);
-                if (Textures::LoadImageFile(image_file, texture))
-                {
-                    view_image = true;
-                }
+                view_image = true;
+                image_entry = selected_remote_file;
+                image_remote = true;
+                ImagePrefetch::Want(remote_files, ImageIndex(remote_files), 0, true, texture);
             }
             selected_action = ACTION_NONE;
             break;
         case ACTION_LOCAL_EDIT:
+            FS::EnsureDetails(selected_local_file);
             if (selected_local_file.file_size > max_edit_file_size)
-                sprintf(status_message, "%s %d", lang_strings[STR_MAX_EDIT_FILE_SIZE_MSG], max_edit_file_size);
+            {
+                snprintf(edit_file, 255, "%s", selected_local_file.path);
+                viewer_entry = selected_local_file;
+                viewer.Open(selected_local_file.path, selected_local_file.file_size, nullptr);
+                viewer_inprogress = true;
+            }
             else
             {
                 snprintf(edit_file, 255, "%s", selected_local_file.path);
@@ -1954,7 +3347,14 @@ namespace Windows
             break;
         case ACTION_REMOTE_EDIT:
             if (selected_remote_file.file_size > max_edit_file_size)
-                sprintf(status_message, "%s %d", lang_strings[STR_MAX_EDIT_FILE_SIZE_MSG], max_edit_file_size);
+            {
+                // Read around the screen on a connection of the viewer's
+                // own, not downloaded to TMP_EDITOR_FILE first.
+                snprintf(edit_file, 255, "%s", selected_remote_file.path);
+                viewer_entry = selected_remote_file;
+                viewer.Open(selected_remote_file.path, selected_remote_file.file_size, remote_settings);
+                viewer_inprogress = true;
+            }
             else if (remoteclient != nullptr && remoteclient->Get(TMP_EDITOR_FILE, selected_remote_file.path))
             {
                 snprintf(edit_file, 255, "%s", selected_remote_file.path);
@@ -2117,6 +3517,11 @@ namespace Windows
         selected_action = ACTION_CREATE_LOCAL_ZIP;
     }
 
+    void AfterRemoteZipFileCallback(int ime_result)
+    {
+        selected_action = ACTION_CREATE_REMOTE_ZIP;
+    }
+
     void AferServerChangeCallback(int ime_result)
     {
         if (ime_result == IME_DIALOG_RESULT_FINISHED)
@@ -2148,6 +3553,12 @@ namespace Windows
     }
 
 
+    void AfterViewerGoToCallback(int ime_result)
+    {
+        if (ime_result == IME_DIALOG_RESULT_FINISHED)
+            viewer.GoToLine(atoll(viewer_goto) - 1);
+    }
+
     void AfterRemoteNativeFilterCallback(int ime_result)
     {
         if (ime_result == IME_DIALOG_RESULT_FINISHED)
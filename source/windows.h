@@ -7,29 +7,47 @@
 #include <set>
 #include "common.h"
 #include "fs.h"
+#include "config.h"
 #include "actions.h"
+#include "metrics.h"
+#include "selection.h"
 
 #define LOCAL_BROWSER 1
 #define REMOTE_BROWSER 2
 
 extern int view_mode;
 extern bool handle_updates;
-extern int64_t bytes_transfered;
-extern int64_t bytes_to_download;
-extern uint64_t prev_tick;
+extern Metrics::Value<int64_t> bytes_transfered;
+extern Metrics::Value<int64_t> bytes_to_download;
+extern Metrics::Value<uint64_t> prev_tick;
+// Whole-batch progress of a download whose file list is known up front;
+// batch_files_total is 0 otherwise.
+extern int batch_files_total;
+extern int batch_files_done;
+extern int64_t batch_bytes_total;
+extern int64_t batch_bytes_done;
+extern uint64_t batch_start_tick;
 extern std::vector<DirEntry> local_files;
 extern std::vector<DirEntry> remote_files;
-extern std::set<DirEntry> multi_selected_local_files;
-extern std::set<DirEntry> multi_selected_remote_files;
+extern Selection multi_selected_local_files;
+extern Selection multi_selected_remote_files;
 extern std::vector<DirEntry> local_paste_files;
 extern std::vector<DirEntry> remote_paste_files;
 extern ACTIONS paste_action;
+// Remote Cut/Copy, and the site the files were taken from, which may no
+// longer be the connected one when they are pasted.
+extern ACTIONS remote_paste_action;
+extern RemoteSettings remote_paste_settings;
 extern DirEntry selected_local_file;
 extern DirEntry selected_remote_file;
 extern ACTIONS selected_action;
 extern char status_message[];
 extern char local_file_to_select[];
 extern char remote_file_to_select[];
+extern char local_file_to_keep[];
+extern char remote_file_to_keep[];
+extern int local_keep_shift;
+extern int remote_keep_shift;
 extern char local_filter[];
 extern char remote_filter[];
 extern char activity_message[];
@@ -37,6 +55,8 @@ extern char confirm_message[];
 extern bool activity_inprogess;
 extern bool stop_activity;
 extern int confirm_state;
+extern std::vector<TransferConflict> transfer_conflicts;
+extern int conflicts_state;
 extern int overwrite_type;
 extern ACTIONS action_to_take;
 extern bool file_transfering;
@@ -193,10 +213,16 @@ namespace Windows
     void Init();
     void HandleWindowInput(u64 pad);
     void MainWindow();
+    // Frames per second the browser needs while the controls are idle:
+    // 60 while an action is pending, progress_fps while work runs in the
+    // background, idle_fps otherwise.
+    int FrameRate();
     void HandleImeInput();
     void ExecuteActions();
     void ResetImeCallbacks();
     void SetModalMode(bool modal);
+    // Opens the results dialog of the last SiteBench run.
+    void ShowSiteBench();
 
     void SingleValueImeCallback(int ime_result);
     void MultiValueImeCallback(int ime_result);
@@ -208,7 +234,9 @@ namespace Windows
     void AfterExtractFolderCallback(int ime_result);
     void AfterExtractRemoteFolderCallback(int ime_result);
     void AfterZipFileCallback(int ime_result);
+    void AfterRemoteZipFileCallback(int ime_result);
     void AfterEditorCallback(int ime_result);
+    void AfterViewerGoToCallback(int ime_result);
     void AferServerChangeCallback(int ime_result);
     void AfterRemoteNativeFilterCallback(int ime_result);
     void AfterRemoteNativeFilterCancelCallback(int ime_result);
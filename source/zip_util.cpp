@@ -6,9 +6,13 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <archive.h>
 #include <archive_entry.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include "clients/remote_client.h"
 #include "clients/ftpclient.h"
 #include "common.h"
@@ -17,121 +21,49 @@
 #include "windows.h"
 #include "zip_util.h"
 #include "util.h"
-
-#define TRANSFER_SIZE (128 * 1024)
+#include "logger.h"
+#include "buffer_pool.h"
+#include "remote_block_cache.h"
+#include "remote_reader.h"
+#include "zip_writer.h"
+#include "remote_stream_reader.h"
+#include "local_sink.h"
+#include "parallel_decoder.h"
+#include "threads.h"
+#include "timeline.h"
+#include "config.h"
+#include "cancel.h"
 
 namespace ZipUtil
 {
-    int ZipAddFile(struct archive *a, const std::string &path, int filename_start)
+    int ZipAddFile(ZipWriter &zip, const std::string &path, int filename_start)
     {
-        struct archive_entry *entry;
-        int res;
-
-        // Get file stat
-        struct stat file_stat;
-        memset(&file_stat, 0, sizeof(file_stat));
-        res = stat(path.c_str(), &file_stat);
-        if (res < 0)
-            return res;
-
-        // Get file local time
-        entry = archive_entry_new();
-
-        bytes_transfered = 0;
-        prev_tick = Util::GetTick();
-        bytes_to_download = file_stat.st_size;
-
-        archive_entry_set_pathname(entry, path.substr(filename_start).c_str());
-        archive_entry_set_filetype(entry, AE_IFREG);
-        archive_entry_set_size(entry, file_stat.st_size);
-        archive_entry_set_perm(entry, 0644);
-        archive_write_header(a, entry);
-
-        // Open file to add
-        FILE *fd = FS::OpenRead(path);
-        if (fd == NULL)
-        {
-            archive_entry_free(entry);
-            return 0;
-        }
-
-        // Add file to zip
-        void *buf = malloc(TRANSFER_SIZE);
-        uint64_t seek = 0;
-
-        while (1)
-        {
-            int read = FS::Read(fd, buf, TRANSFER_SIZE);
-            if (read < 0)
-            {
-                free(buf);
-                FS::Close(fd);
-                archive_entry_free(entry);
-                return read;
-            }
-
-            if (read == 0)
-                break;
-
-            int written = archive_write_data(a, buf, read);
-            if (written < 0)
-            {
-                free(buf);
-                FS::Close(fd);
-                archive_entry_free(entry);
-                return written;
-            }
-
-            seek += written;
-            bytes_transfered += read;
-        }
-
-        free(buf);
-        FS::Close(fd);
-        archive_entry_free(entry);
-
-        return 1;
+        return zip.AddFile(path, path.substr(filename_start)) ? 1 : 0;
     }
 
-    int ZipAddFolder(struct archive *a, const std::string &path, int filename_start)
+    int ZipAddFolder(ZipWriter &zip, const std::string &path, int filename_start)
     {
         if (filename_start > path.length())
         {
             return 1;
         }
 
-        struct archive_entry *entry;
-        int res;
-
         // Get file stat
         struct stat file_stat;
         memset(&file_stat, 0, sizeof(file_stat));
-        res = stat(path.c_str(), &file_stat);
+        int res = stat(path.c_str(), &file_stat);
         if (res < 0)
             return res;
 
-        entry = archive_entry_new();
-
-        // Open new file in zip
-        std::string folder = path.substr(filename_start);
-        if (folder[folder.length() - 1] != '/')
-            folder = folder + "/";
-
-        archive_entry_set_pathname(entry, folder.c_str());
-        archive_entry_set_filetype(entry, AE_IFDIR);
-        archive_entry_set_perm(entry, 0755);
-        archive_write_header(a, entry);
-
-        archive_entry_free(entry);
-        return 1;
+        return zip.AddFolder(path.substr(filename_start), file_stat.st_mtime) ? 1 : 0;
     }
 
-    int ZipAddPath(struct archive *a, const std::string &path, int filename_start)
+    int ZipAddPath(ZipWriter &zip, const std::string &path, int filename_start)
     {
         DIR *dfd = opendir(path.c_str());
         if (dfd != NULL)
         {
-            int ret = ZipAddFolder(a, path, filename_start);
+            int ret = ZipAddFolder(zip, path, filename_start);
             if (ret <= 0)
                 return ret;
 
@@ -139,7 +71,7 @@ namespace ZipUtil
             do
             {
                 dirent = readdir(dfd);
-                if (stop_activity)
+                if (Cancel::Stopped())
                     return 1;
                 if (dirent != NULL && strcmp(dirent->d_name, ".") != 0 && strcmp(dirent->d_name, "..") != 0)
                 {
@@ -151,12 +83,12 @@ namespace ZipUtil
 
                     if (dirent->d_type & DT_DIR)
                     {
-                        ret = ZipAddPath(a, new_path, filename_start);
+                        ret = ZipAddPath(zip, new_path, filename_start);
                     }
                     else
                     {
                         sprintf(activity_message, "%s %s", lang_strings[STR_COMPRESSING], new_path);
-                        ret = ZipAddFile(a, new_path, filename_start);
+                        ret = ZipAddFile(zip, new_path, filename_start);
                     }
 
                     free(new_path);
@@ -175,12 +107,31 @@ namespace ZipUtil
         else
         {
             sprintf(activity_message, "%s %s", lang_strings[STR_COMPRESSING], path.c_str());
-            return ZipAddFile(a, path, filename_start);
+            return ZipAddFile(zip, path, filename_start);
         }
 
         return 1;
     }
 
+    int ZipAddEntries(ZipWriter &zip, const std::vector<DirEntry> &files)
+    {
+        int res = 1;
+        for (const DirEntry &file : files)
+        {
+            if (Cancel::Stopped())
+                break;
+
+            if (strcmp(file.path, file.directory) != 0 && strlen(file.path) > strlen(file.directory))
+                res = ZipAddPath(zip, file.path, strlen(file.directory) + 1);
+            else
+                res = -1;
+
+            if (res <= 0)
+                break;
+        }
+        return res;
+    }
+
     /* duplicate a path name, possibly converting to lower case */
     static char *pathdup(const char *path)
     {
@@ -248,7 +199,10 @@ namespace ZipUtil
         uint32_t write_len;
         uint32_t current_progress = 0;
         ssize_t len = 0;
-        unsigned char *buffer = (unsigned char *)malloc(ARCHIVE_TRANSFER_SIZE);
+        TransferBuffer lease(ARCHIVE_TRANSFER_SIZE);
+        unsigned char *buffer = (unsigned char *)lease.data();
+        if (buffer == NULL)
+            return 0;
 
         /* loop over file contents and write to fd */
         for (int n = 0;; n++)
@@ -257,14 +211,12 @@ namespace ZipUtil
 
             if (len == 0)
             {
-                free(buffer);
                 return 1;
             }
 
             if (len < 0)
             {
                 sprintf(status_message, "error archive_read_data('%s')", pathname.c_str());
-                free(buffer);
                 return 0;
             }
             current_progress += len;
@@ -274,12 +226,10 @@ namespace ZipUtil
             if (write_len != len)
             {
                 sprintf(status_message, "error write('%s')", pathname.c_str());
-                free(buffer);
                 return 0;
             }
         }
 
-        free(buffer);
         return 1;
     }
 
@@ -288,6 +238,7 @@ namespace ZipUtil
      */
     void extract_file(struct archive *a, struct archive_entry *e, const std::string &path)
     {
+        TIMELINE_SCOPE("extract entry");
         struct stat sb;
         void *fd;
         const char *linkname;
@@ -320,16 +271,18 @@ namespace ZipUtil
         FS::Close(fd);
     }
 
-    void extract(struct archive *a, struct archive_entry *e, const std::string &base_dir)
+    /*
+     * Where entry `e` goes below `base_dir`, or false when it is skipped:
+     * unsafe names, special files and what `filter` turns down.
+     */
+    static bool entry_target(struct archive_entry *e, const std::string &base_dir, const EntryFilter &filter,
+                             std::string &target, std::string &name)
     {
         char *pathname, *realpathname;
         mode_t filetype;
 
         if ((pathname = pathdup(archive_entry_pathname(e))) == NULL)
-        {
-            archive_read_data_skip(a);
-            return;
-        }
+            return false;
         filetype = archive_entry_filetype(e);
 
         /* sanity checks */
@@ -337,88 +290,87 @@ namespace ZipUtil
             strncmp(pathname, "../", 3) == 0 ||
             strstr(pathname, "/../") != NULL)
         {
-            archive_read_data_skip(a);
             free(pathname);
-            return;
+            return false;
         }
 
         /* I don't think this can happen in a zipfile.. */
         if (!S_ISDIR(filetype) && !S_ISREG(filetype) && !S_ISLNK(filetype))
         {
-            archive_read_data_skip(a);
             free(pathname);
-            return;
+            return false;
+        }
+
+        if (filter)
+        {
+            std::string rewritten = pathname;
+            free(pathname);
+            if (!filter(rewritten) || (pathname = pathdup(rewritten.c_str())) == NULL)
+                return false;
         }
 
         realpathname = pathcat(base_dir.c_str(), pathname);
+        target = realpathname;
+        name = pathname;
+        free(realpathname);
+        free(pathname);
+        return true;
+    }
+
+    void extract(struct archive *a, struct archive_entry *e, const std::string &base_dir, const EntryFilter &filter)
+    {
+        std::string realpathname, pathname;
+
+        if (!entry_target(e, base_dir, filter, realpathname, pathname))
+        {
+            archive_read_data_skip(a);
+            return;
+        }
 
         /* ensure that parent directory exists */
         FS::MkDirs(realpathname, true);
 
-        if (S_ISDIR(filetype))
+        if (S_ISDIR(archive_entry_filetype(e)))
             extract_dir(a, e, realpathname);
         else
         {
-            snprintf(activity_message, 255, "%s: %s", lang_strings[STR_EXTRACTING], pathname);
+            snprintf(activity_message, 255, "%s: %s", lang_strings[STR_EXTRACTING], pathname.c_str());
             bytes_transfered = 0;
             prev_tick = Util::GetTick();
 
             extract_file(a, e, realpathname);
         }
-
-        free(realpathname);
-        free(pathname);
     }
 
     static RemoteArchiveData *OpenRemoteArchive(const std::string &file, RemoteClient *client)
     {
-        RemoteArchiveData *data;
+        std::unique_ptr<RemoteReader> reader = client->OpenRead(file, ReadHints());
+        if (reader == nullptr)
+            return nullptr;
 
-        data = (RemoteArchiveData *)malloc(sizeof(RemoteArchiveData));
-        memset(data, 0, sizeof(RemoteArchiveData));
-
-        data->offset = 0;
-        client->Size(file, &data->size);
+        RemoteArchiveData *data = new RemoteArchiveData();
+        data->size = reader->Size();
         data->client = client;
-        data->path = file;
-        if (client->SupportedActions() & REMOTE_ACTION_RAW_READ)
-        {
-            data->fp = client->Open(file, O_RDONLY);
-        }
-
-        if (client->clientType() == CLIENT_TYPE_FTP)
-        {
-            FtpClient *_client = (FtpClient *)client;
-            data->ftp_xfer_callbak = _client->GetCallbackXferFunction();
-            _client->SetCallbackXferFunction(nullptr);
-        }
+        data->reader = reader.release();
+        data->cache = new RemoteBlockCache(*data->reader);
+        data->cache->Start();
         return data;
     }
 
     static ssize_t ReadRemoteArchive(struct archive *a, void *client_data, const void **buff)
     {
-        ssize_t to_read;
-        int ret;
-        RemoteArchiveData *data;
-
-        data = (RemoteArchiveData *)client_data;
-        *buff = data->buf;
-
-        to_read = data->size - data->offset;
-        if (to_read == 0)
-            return 0;
-
-        to_read = MIN(to_read, ARCHIVE_TRANSFER_SIZE);
-        if (data->client->SupportedActions() & REMOTE_ACTION_RAW_READ)
-            ret = data->client->GetRange(data->fp, data->buf, to_read, data->offset);
-        else
-            ret = data->client->GetRange(data->path, data->buf, to_read, data->offset);
+        RemoteArchiveData *data = (RemoteArchiveData *)client_data;
 
-        if (ret == 0)
+        TIMELINE_SCOPE("archive read");
+        ssize_t ret = data->cache->Read(data->offset, buff);
+        if (ret < 0)
+        {
+            archive_set_error(a, EIO, "%s", data->client->LastResponse());
             return -1;
-        data->offset = data->offset + to_read;
+        }
+        data->offset += ret;
 
-        return to_read;
+        return ret;
     }
 
     static int CloseRemoteArchive(struct archive *a, void *client_data)
@@ -427,15 +379,10 @@ namespace ZipUtil
         {
             RemoteArchiveData *data;
             data = (RemoteArchiveData *)client_data;
-            if (data->client->clientType() == CLIENT_TYPE_FTP)
-            {
-                FtpClient *_client = (FtpClient *)data->client;
-                _client->SetCallbackXferFunction(data->ftp_xfer_callbak);
-            }
-            if (data->client->SupportedActions() & REMOTE_ACTION_RAW_READ)
-                data->client->Close(data->fp);
-
-            free(client_data);
+            // The fetch thread may still be reading through the reader.
+            delete data->cache;
+            delete data->reader;
+            delete data;
         }
         return 0;
     }
@@ -444,21 +391,20 @@ namespace ZipUtil
     {
         RemoteArchiveData *data = (RemoteArchiveData *)client_data;
 
+        int64_t target;
         if (whence == SEEK_SET)
-        {
-            data->offset = offset;
-        }
+            target = offset;
         else if (whence == SEEK_CUR)
-        {
-            data->offset = data->offset + offset - 1;
-        }
+            target = (int64_t)data->offset + offset;
         else if (whence == SEEK_END)
-        {
-            data->offset = data->size - 1;
-        }
+            target = (int64_t)data->size + offset;
         else
             return ARCHIVE_FATAL;
 
+        if (target < 0)
+            return ARCHIVE_FATAL;
+        data->offset = (uint64_t)target;
+
         return data->offset;
     }
 
@@ -466,38 +412,92 @@ namespace ZipUtil
     {
         RemoteArchiveData *data = (RemoteArchiveData *)client_data;
 
-        data->offset = data->offset + request - 1;
+        if (request < 0)
+            return 0;
+        uint64_t left = data->size > data->offset ? data->size - data->offset : 0;
+        if ((uint64_t)request > left)
+            request = (int64_t)left;
+        data->offset += request;
 
         return request;
     }
 
-    /*
-     * Main loop: open the zipfile, iterate over its contents and decide what
-     * to do with each entry.
-     */
-    int Extract(const DirEntry &file, const std::string &basepath, RemoteClient *client)
+    static ssize_t ReadDecodedArchive(struct archive *a, void *client_data, const void **buff)
+    {
+        ParallelDecoder *decoder = (ParallelDecoder *)client_data;
+
+        ssize_t ret = decoder->Read(buff);
+        if (ret < 0)
+        {
+            archive_set_error(a, EIO, "%s", decoder->Error().c_str());
+            return -1;
+        }
+        return ret;
+    }
+
+    static int CloseDecodedArchive(struct archive *a, void *client_data)
+    {
+        delete (ParallelDecoder *)client_data;
+        return 0;
+    }
+
+    // A local .tar.xz or .tar.zst decoded on unzip_workers threads, when
+    // the file was compressed in independent blocks or frames; nullptr
+    // otherwise, for libarchive's own single-threaded filters.
+    static ParallelDecoder *OpenParallelDecoder(const DirEntry &file)
+    {
+        if (unzip_workers < 2)
+            return nullptr;
+        std::string name = Util::ToLower(file.name);
+        if (!Util::EndsWith(name, ".tar.xz") && !Util::EndsWith(name, ".txz") &&
+            !Util::EndsWith(name, ".tar.zst") && !Util::EndsWith(name, ".tzst"))
+            return nullptr;
+
+        ParallelDecoder *decoder = new ParallelDecoder(file.path, unzip_workers);
+        if (!decoder->Open() || !decoder->Start())
+        {
+            delete decoder;
+            return nullptr;
+        }
+        return decoder;
+    }
+
+    // Opens `file` for reading, locally or through `client`. On failure the
+    // reason is left in status_message and nullptr returned.
+    static struct archive *OpenArchive(const DirEntry &file, RemoteClient *client)
     {
         struct archive *a;
-        struct archive_entry *e;
         RemoteArchiveData *client_data = nullptr;
         int ret;
 
         if ((a = archive_read_new()) == NULL)
         {
             sprintf(status_message, "%s", "archive_read_new failed");
-            return 0;
+            return nullptr;
         }
 
         archive_read_support_format_all(a);
         archive_read_support_filter_all(a);
 
-        if (client == nullptr)
+        ParallelDecoder *decoder = client == nullptr ? OpenParallelDecoder(file) : nullptr;
+        if (decoder != nullptr)
+        {
+            ret = archive_read_open2(a, decoder, NULL, ReadDecodedArchive, NULL, CloseDecodedArchive);
+            if (ret < ARCHIVE_OK)
+            {
+                sprintf(status_message, "archive_read_open failed - %s", archive_error_string(a));
+                archive_read_free(a);
+                return nullptr;
+            }
+        }
+        else if (client == nullptr)
         {
             ret = archive_read_open_filename(a, file.path, ARCHIVE_TRANSFER_SIZE);
             if (ret < ARCHIVE_OK)
             {
                 sprintf(status_message, "%s", "archive_read_open_filename failed");
-                return 0;
+                archive_read_free(a);
+                return nullptr;
             }
         }
         else
@@ -506,27 +506,256 @@ namespace ZipUtil
             if (client_data == nullptr)
             {
                 sprintf(status_message, "%s", "archive_read_open_filename failed");
-                return 0;
+                archive_read_free(a);
+                return nullptr;
             }
 
             ret = archive_read_set_seek_callback(a, SeekRemoteArchive);
             if (ret < ARCHIVE_OK)
             {
                 sprintf(status_message, "archive_read_set_seek_callback failed - %s", archive_error_string(a));
-                return 0;
+                CloseRemoteArchive(a, client_data);
+                archive_read_free(a);
+                return nullptr;
             }
 
             ret = archive_read_open2(a, client_data, NULL, ReadRemoteArchive, SkipRemoteArchive, CloseRemoteArchive);
             if (ret < ARCHIVE_OK)
             {
                 sprintf(status_message, "archive_read_open failed - %s", archive_error_string(a));
-                return 0;
+                archive_read_free(a);
+                return nullptr;
+            }
+        }
+        return a;
+    }
+
+    static bool IsLocalZip(const char *path)
+    {
+        uint8_t magic[4] = {0};
+        FILE *in = FS::OpenRead(path);
+        if (in == nullptr)
+            return false;
+        bool zip = FS::Read(in, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, MAGIC_ZIP_1, sizeof(magic)) == 0;
+        FS::Close(in);
+        return zip;
+    }
+
+    // A local zip unpacked by unzip_workers threads. Zip entries are
+    // independent, so each worker opens the archive on its own and walks
+    // the central directory, libarchive seeking over the data of entries
+    // it skips; the first worker to reach an entry claims it. `filter` is
+    // called from every worker.
+    struct ParallelExtract
+    {
+        const DirEntry *file = nullptr;
+        std::string basepath;
+        const EntryFilter *filter = nullptr;
+        std::mutex mutex;
+        std::vector<bool> claimed;
+        int files = 0;
+        int failed = 0;
+        bool broken = false;
+    };
+
+    static bool ClaimEntry(ParallelExtract &job, size_t index)
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (index >= job.claimed.size())
+            job.claimed.resize(index + 1, false);
+        if (job.claimed[index])
+            return false;
+        job.claimed[index] = true;
+        return true;
+    }
+
+    // Decompresses the current entry of `a` into `path` through the sink's
+    // writer thread, one pool buffer per block. A partial file is removed
+    // on failure or cancel.
+    static bool ExtractToSink(struct archive *a, struct archive_entry *e, const std::string &path)
+    {
+        TIMELINE_SCOPE("extract entry");
+        struct stat sb;
+        if (lstat(path.c_str(), &sb) == 0)
+            (void)unlink(path.c_str());
+        if (archive_entry_symlink(e) != NULL)
+            return true;
+
+        LocalFileSink sink(path);
+        if (!sink.Open(false))
+            return false;
+        if (archive_entry_size_is_set(e) && archive_entry_size(e) > 0)
+            sink.Preallocate((uint64_t)archive_entry_size(e));
+
+        uint64_t offset = 0;
+        bool ok = true;
+        while (!Cancel::Stopped())
+        {
+            TransferBuffer block(ARCHIVE_TRANSFER_SIZE);
+            if (!block)
+            {
+                ok = false;
+                break;
+            }
+            ssize_t len = archive_read_data(a, block.data(), ARCHIVE_TRANSFER_SIZE);
+            if (len == 0)
+                break;
+            if (len < 0 || !sink.Submit(offset, block, (size_t)len))
+            {
+                ok = false;
+                break;
             }
+            offset += (uint64_t)len;
+            bytes_transfered += len;
+        }
+        if (!sink.Close())
+            ok = false;
+        if (!ok || Cancel::Stopped())
+        {
+            FS::Rm(path);
+            return false;
         }
+        return true;
+    }
+
+    static void ExtractWorker(ParallelExtract *job)
+    {
+        struct archive *a;
+        struct archive_entry *e;
+
+        if ((a = OpenArchive(*job->file, nullptr)) == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->broken = true;
+            return;
+        }
+
+        for (size_t index = 0; !Cancel::Stopped(); index++)
+        {
+            int ret = archive_read_next_header(a, &e);
+            if (ret == ARCHIVE_EOF)
+                break;
+            if (ret < ARCHIVE_OK)
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->broken = true;
+                break;
+            }
+            if (!ClaimEntry(*job, index))
+                continue;
+
+            std::string target, name;
+            if (!entry_target(e, job->basepath, *job->filter, target, name))
+                continue;
+            FS::MkDirs(target, true);
+            if (S_ISDIR(archive_entry_filetype(e)))
+            {
+                FS::MkDirs(target);
+                continue;
+            }
+
+            bool ok = ExtractToSink(a, e, target);
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->files++;
+            if (!ok && !Cancel::Stopped() && job->failed++ == 0)
+                snprintf(status_message, 1023, "error write('%s')", target.c_str());
+        }
+        archive_read_free(a);
+    }
+
+    static void ExtractWorkerThread(void *arg)
+    {
+        ExtractWorker(static_cast<ParallelExtract *>(arg));
+    }
+
+    static int ExtractParallel(const DirEntry &file, const std::string &basepath, const EntryFilter &filter)
+    {
+        struct archive *a;
+        struct archive_entry *e;
+
+        // The central directory first, for the progress of the whole
+        // archive; reading it seeks past every entry's data.
+        if ((a = OpenArchive(file, nullptr)) == nullptr)
+            return 0;
+        int64_t total = 0;
+        int entries = 0;
+        while (archive_read_next_header(a, &e) == ARCHIVE_OK)
+        {
+            if (archive_entry_size_is_set(e) && !S_ISDIR(archive_entry_filetype(e)))
+                total += archive_entry_size(e);
+            entries++;
+        }
+        archive_read_free(a);
+
+        ParallelExtract job;
+        job.file = &file;
+        job.basepath = basepath;
+        EntryFilter keep_all;
+        job.filter = filter ? &filter : &keep_all;
+        job.claimed.assign(entries, false);
+
+        snprintf(activity_message, 255, "%s: %s", lang_strings[STR_EXTRACTING], file.name);
+        bytes_to_download = total;
+        bytes_transfered = 0;
+        prev_tick = Util::GetTick();
+        uint64_t start = prev_tick;
+
+        int extra = std::min(unzip_workers, entries) - 1;
+        std::vector<Thread> threads(std::max(extra, 0));
+        std::vector<bool> started(threads.size(), false);
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            // libarchive wants more stack than a copy does.
+            Result rc = Threads::Create(&threads[i], ExtractWorkerThread, &job, 0x20000, Threads::ROLE_COMPUTE, "unzip");
+            if (R_FAILED(rc))
+            {
+                Logger::Logf(Logger::LOG_ERROR, "UNZIP threadCreate failed index=%d rc=0x%x", (int)i, rc);
+                continue;
+            }
+            threadStart(&threads[i]);
+            started[i] = true;
+        }
+
+        // This thread takes entries too.
+        ExtractWorker(&job);
+
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            if (started[i])
+                Threads::Join(&threads[i]);
+        }
+
+        Logger::Logf("UNZIP done path=%s entries=%d files=%d failed=%d bytes=%lld workers=%d elapsed=%.2fs", file.path,
+                     entries, job.files, job.failed, (long long)bytes_transfered, (int)threads.size() + 1,
+                     (Util::GetTick() - start) / 1000000.0);
+        if (job.broken)
+        {
+            sprintf(status_message, "%s", "archive_read_next_header failed");
+            return 0;
+        }
+        return job.failed == 0 ? 1 : 0;
+    }
+
+    /*
+     * Main loop: open the zipfile, iterate over its contents and decide what
+     * to do with each entry.
+     */
+    int Extract(const DirEntry &file, const std::string &basepath, RemoteClient *client, const EntryFilter &filter)
+    {
+        struct archive *a;
+        struct archive_entry *e;
+        int ret;
+
+        // Zips on the SD card are unpacked on several cores.
+        if (client == nullptr && unzip_workers > 1 && IsLocalZip(file.path))
+            return ExtractParallel(file, basepath, filter);
+
+        if ((a = OpenArchive(file, client)) == nullptr)
+            return 0;
 
         for (;;)
         {
-            if (stop_activity)
+            if (Cancel::Stopped())
                 break;
 
             ret = archive_read_next_header(a, &e);
@@ -540,7 +769,7 @@ namespace ZipUtil
             if (ret == ARCHIVE_EOF)
                 break;
 
-            extract(a, e, basepath);
+            extract(a, e, basepath, filter);
         }
 
         archive_read_free(a);
@@ -548,4 +777,187 @@ namespace ZipUtil
         return 1;
     }
 
-}
\ No newline at end of file
+    struct StreamArchiveData
+    {
+        RemoteStreamReader *reader = nullptr;
+        FtpCallbackXfer ftp_xfer_callbak = nullptr;
+        RemoteClient *client = nullptr;
+    };
+
+    static ssize_t ReadStreamArchive(struct archive *a, void *client_data, const void **buff)
+    {
+        StreamArchiveData *data = (StreamArchiveData *)client_data;
+
+        ssize_t ret = data->reader->Read(buff);
+        if (ret < 0)
+        {
+            archive_set_error(a, EIO, "%s", data->reader->Error().c_str());
+            return -1;
+        }
+        return ret;
+    }
+
+    static int CloseStreamArchive(struct archive *a, void *client_data)
+    {
+        return 0;
+    }
+
+    bool CanStream(const DirEntry &file)
+    {
+        if (file.isDir)
+            return false;
+        // Zip local headers and tar headers come before their data; 7z and
+        // rar keep what they need elsewhere and want to seek.
+        std::string name = Util::ToLower(file.name);
+        static const char *kStreamable[] = {".zip", ".tar", ".tgz", ".txz", ".tbz2", ".tzst"};
+        for (const char *ext : kStreamable)
+        {
+            if (Util::EndsWith(name, ext))
+                return true;
+        }
+        return name.find(".tar.") != std::string::npos;
+    }
+
+    // Extracts what `reader` (taken over) delivers, a file or a folder
+    // archive, front to back. Returns as ExtractStreamed() and
+    // ExtractFolderStreamed() do.
+    static int ExtractFromReader(RemoteStreamReader *reader, bool folder, const char *path,
+                                 const std::string &basepath, RemoteClient *client, const EntryFilter &filter)
+    {
+        struct archive *a;
+        struct archive_entry *e;
+        int ret;
+
+        StreamArchiveData data;
+        data.client = client;
+        data.reader = reader;
+        if (client->clientType() == CLIENT_TYPE_FTP)
+        {
+            FtpClient *_client = (FtpClient *)client;
+            data.ftp_xfer_callbak = _client->GetCallbackXferFunction();
+            _client->SetCallbackXferFunction(nullptr);
+        }
+
+        int result = 1;
+        bool started = false;
+        if ((a = archive_read_new()) == NULL)
+        {
+            sprintf(status_message, "%s", "archive_read_new failed");
+            result = 0;
+        }
+        else
+        {
+            archive_read_support_format_all(a);
+            archive_read_support_filter_all(a);
+
+            // No seek or skip callbacks: libarchive then reads the archive
+            // front to back exactly as it arrives.
+            if (!(folder ? data.reader->StartFolderArchive() : data.reader->Start()))
+            {
+                sprintf(status_message, "%s", data.reader->Error().c_str());
+                result = 0;
+            }
+            else if (archive_read_open2(a, &data, NULL, ReadStreamArchive, NULL, CloseStreamArchive) < ARCHIVE_OK)
+            {
+                sprintf(status_message, "archive_read_open failed - %s", archive_error_string(a));
+                result = -1;
+            }
+            else
+            {
+                for (;;)
+                {
+                    if (Cancel::Stopped())
+                        break;
+
+                    ret = archive_read_next_header(a, &e);
+                    if (ret == ARCHIVE_EOF)
+                        break;
+                    if (ret < ARCHIVE_OK)
+                    {
+                        sprintf(status_message, "%s", "archive_read_next_header failed");
+                        result = !data.reader->Error().empty() ? 0 : -1;
+                        break;
+                    }
+
+                    started = true;
+                    extract(a, e, basepath, filter);
+                }
+            }
+            archive_read_free(a);
+        }
+
+        // A format error in the middle of a zip (e.g. a stored entry with a
+        // data descriptor) needs the central directory: let the caller retry
+        // with random access. Transport errors are final.
+        if (result < 0 && !Cancel::Stopped())
+            Logger::Logf("ARCHIVE STREAM not streamable path=%s started=%d err=%s", path, started ? 1 : 0, status_message);
+        // A folder archive has no random-access fallback: only one the
+        // server never sent leaves the caller another way.
+        if ((Cancel::Stopped() || (folder && (started || !data.reader->Unsupported()))) && result < 0)
+            result = 0;
+
+        delete data.reader;
+        if (client->clientType() == CLIENT_TYPE_FTP)
+        {
+            FtpClient *_client = (FtpClient *)client;
+            _client->SetCallbackXferFunction(data.ftp_xfer_callbak);
+        }
+        return result;
+    }
+
+    int ExtractStreamed(const DirEntry &file, const std::string &basepath, RemoteClient *client)
+    {
+        RemoteStreamReader *reader = new RemoteStreamReader(client, file.path, file.file_size > 0 ? (uint64_t)file.file_size : 0);
+        return ExtractFromReader(reader, false, file.path, basepath, client, nullptr);
+    }
+
+    int ExtractFolderStreamed(const DirEntry &folder, const std::string &basepath, RemoteClient *client,
+                              const EntryFilter &filter)
+    {
+        RemoteStreamReader *reader = new RemoteStreamReader(client, folder.path, 0);
+        return ExtractFromReader(reader, true, folder.path, basepath, client, filter);
+    }
+
+    int ListEntries(const DirEntry &file, RemoteClient *client, std::vector<ArchiveEntryInfo> &entries)
+    {
+        struct archive *a;
+        struct archive_entry *e;
+        int ret;
+
+        if ((a = OpenArchive(file, client)) == nullptr)
+            return 0;
+
+        for (;;)
+        {
+            if (Cancel::Stopped())
+                break;
+
+            ret = archive_read_next_header(a, &e);
+            if (ret == ARCHIVE_EOF)
+                break;
+            if (ret < ARCHIVE_OK)
+            {
+                sprintf(status_message, "%s", "archive_read_next_header failed");
+                archive_read_free(a);
+                return 0;
+            }
+
+            const char *pathname = archive_entry_pathname(e);
+            if (pathname != NULL)
+            {
+                ArchiveEntryInfo info;
+                info.pathname = pathname;
+                info.size = archive_entry_size(e);
+                info.isDir = S_ISDIR(archive_entry_filetype(e));
+                info.mtime = archive_entry_mtime(e);
+                entries.push_back(info);
+            }
+            archive_read_data_skip(a);
+        }
+
+        archive_read_free(a);
+
+        return Cancel::Stopped() ? 0 : 1;
+    }
+
+}
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <archive.h>
+#include <functional>
+#include <vector>
 #include "clients/remote_client.h"
 #include "common.h"
 #include "fs.h"
@@ -26,21 +28,52 @@ enum CompressFileType {
     COMPRESS_FILE_TYPE_UNKNOWN
 };
 
+class RemoteBlockCache;
+class RemoteReader;
+class ZipWriter;
+
 struct RemoteArchiveData
 {
-    void *fp;
-    std::string path;
-    uint64_t size;
-    uint64_t offset;
-    uint8_t buf[ARCHIVE_TRANSFER_SIZE];
-    int buf_ref;
-    FtpCallbackXfer ftp_xfer_callbak;
-    RemoteClient *client;
+    uint64_t size = 0;
+    uint64_t offset = 0;
+    RemoteReader *reader = nullptr;
+    RemoteBlockCache *cache = nullptr;
+    RemoteClient *client = nullptr;
+};
+
+struct ArchiveEntryInfo
+{
+    std::string pathname;
+    int64_t size = 0;
+    bool isDir = false;
+    time_t mtime = 0;
 };
 
 namespace ZipUtil
 {
-    int ZipAddPath(struct archive *a, const std::string &path, int filename_start);
-    int Extract(const DirEntry &file, const std::string &dir, RemoteClient *client = nullptr);
+    // Decides per entry pathname whether it is extracted, and may rewrite
+    // the pathname it is extracted to (relative to the destination).
+    typedef std::function<bool(std::string &pathname)> EntryFilter;
+
+    int ZipAddPath(ZipWriter &zip, const std::string &path, int filename_start);
+    // ZipAddPath() of each of `files`, named relative to their folder.
+    int ZipAddEntries(ZipWriter &zip, const std::vector<DirEntry> &files);
+    int Extract(const DirEntry &file, const std::string &dir, RemoteClient *client = nullptr, const EntryFilter &filter = nullptr);
+    // Whether `file` is a format that can be extracted front to back while
+    // it downloads (zip, tar and compressed tar).
+    bool CanStream(const DirEntry &file);
+    // Extracts the remote `file` below `dir` from a single sequential
+    // download, without storing the archive. Returns 1 on success, 0 on
+    // failure and -1 when the archive turned out to need random access, in
+    // which case Extract() with `client` should be used instead.
+    int ExtractStreamed(const DirEntry &file, const std::string &dir, RemoteClient *client);
+    // Extracts the remote folder `folder` below `dir` from one archive the
+    // server builds of it (RemoteClient::GetFolderArchive). Returns 1 on
+    // success, 0 on failure, and -1 when the server builds none, in which
+    // case nothing was written.
+    int ExtractFolderStreamed(const DirEntry &folder, const std::string &dir, RemoteClient *client,
+                              const EntryFilter &filter = nullptr);
+    // Reads the entry headers of `file` without extracting anything.
+    int ListEntries(const DirEntry &file, RemoteClient *client, std::vector<ArchiveEntryInfo> &entries);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,587 @@
+#include <sys/stat.h>
+#include <math.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "zip_writer.h"
+#include "fs.h"
+#include "util.h"
+#include "windows.h"
+#include "logger.h"
+#include "threads.h"
+#include "timeline.h"
+#include "cancel.h"
+
+namespace
+{
+    const size_t kDictionarySize = 32 * 1024;
+    // Entries at least this large get a zip64 extra field in their local
+    // header, leaving room for deflate to grow incompressible data.
+    const uint64_t kZip64Threshold = 0xFF000000ULL;
+    const uint32_t kMax32 = 0xFFFFFFFFU;
+
+    typedef std::vector<uint8_t> Bytes;
+
+    void Put16(Bytes &out, uint16_t v)
+    {
+        out.push_back(v & 0xFF);
+        out.push_back((v >> 8) & 0xFF);
+    }
+
+    void Put32(Bytes &out, uint32_t v)
+    {
+        Put16(out, v & 0xFFFF);
+        Put16(out, (v >> 16) & 0xFFFF);
+    }
+
+    void Put64(Bytes &out, uint64_t v)
+    {
+        Put32(out, (uint32_t)(v & 0xFFFFFFFFULL));
+        Put32(out, (uint32_t)(v >> 32));
+    }
+
+    uint32_t Clamp32(uint64_t v)
+    {
+        return v >= kMax32 ? kMax32 : (uint32_t)v;
+    }
+
+    void DosDateTime(time_t mtime, uint16_t *dosTime, uint16_t *dosDate)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        localtime_r(&mtime, &tm);
+        if (tm.tm_year < 80)
+        {
+            *dosTime = 0;
+            *dosDate = (1 << 5) | 1;
+            return;
+        }
+        *dosTime = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+        *dosDate = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+    }
+
+    // Fills `buffer` unless the file ends first; returns the bytes read or
+    // -1 on a read error.
+    int64_t ReadFull(FILE *fd, char *buffer, size_t size)
+    {
+        size_t total = 0;
+        while (total < size)
+        {
+            int read = FS::Read(fd, buffer + total, size - total);
+            if (read < 0)
+                return -1;
+            if (read == 0)
+                break;
+            total += read;
+        }
+        return total;
+    }
+}
+
+ZipWriter::ZipWriter(const std::string &path, int workers)
+    : path(path), workerCount(workers < 1 ? 1 : workers)
+{
+}
+
+ZipWriter::ZipWriter(const OutputFn &output, int workers)
+    : path("stream"), workerCount(workers < 1 ? 1 : workers), output(output)
+{
+}
+
+ZipWriter::~ZipWriter()
+{
+    stopWorkers();
+}
+
+bool ZipWriter::Open()
+{
+    if (!output)
+    {
+        sink.reset(new LocalFileSink(path));
+        if (!sink->Open(false))
+            return fail("cannot create " + path);
+        stream.reset(new LocalSinkStream(*sink, 0));
+    }
+    offset = 0;
+    startTick = Util::GetTick();
+
+    stopping = false;
+    threads.resize(workerCount);
+    for (int i = 0; i < workerCount; i++)
+    {
+        // Spread over the three application cores; compression is the one
+        // job here that is bound by the CPU rather than I/O.
+        Result rc = Threads::Create(&threads[i], workerThread, this, 0x10000, Threads::ROLE_COMPUTE, "zip deflate");
+        if (R_FAILED(rc))
+        {
+            Logger::Logf(Logger::LOG_ERROR, "ZIP WRITER threadCreate failed index=%d rc=0x%x", i, rc);
+            threads.resize(i);
+            break;
+        }
+        threadStart(&threads[i]);
+    }
+    if (threads.empty())
+        return fail("cannot start compression threads");
+    return true;
+}
+
+bool ZipWriter::AddFolder(std::string name, time_t mtime)
+{
+    if (name.empty() || name.back() != '/')
+        name.push_back('/');
+
+    Entry entry;
+    entry.name = name;
+    entry.isDir = true;
+    entry.headerOffset = offset;
+    DosDateTime(mtime, &entry.dosTime, &entry.dosDate);
+    if (!writeLocalHeader(entry, offset))
+        return false;
+    entries.push_back(entry);
+    return true;
+}
+
+bool ZipWriter::AddFile(const std::string &source, const std::string &name)
+{
+    struct stat file_stat;
+    memset(&file_stat, 0, sizeof(file_stat));
+    if (stat(source.c_str(), &file_stat) != 0)
+        return fail("cannot stat " + source);
+
+    FILE *fd = FS::OpenRead(source);
+    if (fd == NULL)
+        return fail("cannot open " + source);
+
+    if (!output)
+    {
+        bytes_transfered = 0;
+        prev_tick = Util::GetTick();
+        bytes_to_download = file_stat.st_size;
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.headerOffset = offset;
+    entry.zip64 = (uint64_t)file_stat.st_size >= kZip64Threshold;
+    entry.descriptor = (bool)output;
+    entry.crc = crc32(0L, Z_NULL, 0);
+    DosDateTime(file_stat.st_mtime, &entry.dosTime, &entry.dosDate);
+
+    std::unique_ptr<Chunk> chunk(new Chunk());
+    int64_t read = -1;
+    if (chunk->input.Acquire(kChunkSize))
+        read = ReadFull(fd, chunk->input.data(), kChunkSize);
+    if (read < 0)
+    {
+        FS::Close(fd);
+        return fail("cannot read " + source);
+    }
+    bool store = read == 0 || shouldStore(name) || looksCompressed(chunk->input.data(), read);
+    entry.method = store ? 0 : Z_DEFLATED;
+    if (store)
+        storedEntries++;
+    else
+        deflatedEntries++;
+
+    if (!writeLocalHeader(entry, offset))
+    {
+        FS::Close(fd);
+        return false;
+    }
+
+    size_t limit = threads.size() * 2 + 1;
+    while (true)
+    {
+        chunk->size = read;
+        chunk->last = (size_t)read < kChunkSize;
+        chunk->store = store;
+        bool last = chunk->last;
+
+        std::unique_ptr<Chunk> next;
+        if (!last)
+        {
+            // Prime the next chunk with this one's tail so splitting the
+            // file costs almost nothing in ratio.
+            next.reset(new Chunk());
+            if (!store)
+                next->dictionary.assign(chunk->input.data() + read - kDictionarySize, chunk->input.data() + read);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(chunk.get());
+            inflight.push_back(std::move(chunk));
+        }
+        cv.notify_all();
+
+        while (inflight.size() >= limit || (last && !inflight.empty()))
+        {
+            if (!writeOldest(entry))
+            {
+                FS::Close(fd);
+                return false;
+            }
+        }
+        if (last)
+            break;
+
+        if (Cancel::Stopped())
+        {
+            FS::Close(fd);
+            return fail("cancelled");
+        }
+
+        chunk = std::move(next);
+        read = -1;
+        if (chunk->input.Acquire(kChunkSize))
+            read = ReadFull(fd, chunk->input.data(), kChunkSize);
+        if (read < 0)
+        {
+            FS::Close(fd);
+            return fail("cannot read " + source);
+        }
+    }
+    FS::Close(fd);
+
+    if (!entry.zip64 && (entry.size >= kMax32 || entry.compressedSize >= kMax32))
+        return fail(source + " grew past 4 GiB while being compressed");
+
+    // The header went out with zero sizes; patch it now that they are known,
+    // or follow the data with them when the archive is streamed.
+    if (entry.descriptor)
+    {
+        if (!writeDescriptor(entry))
+            return false;
+    }
+    else if (!stream->Flush() || !writeLocalHeader(entry, entry.headerOffset))
+        return false;
+    bytesIn += entry.size;
+    entries.push_back(entry);
+    return true;
+}
+
+bool ZipWriter::Close()
+{
+    stopWorkers();
+
+    Bytes out;
+    uint64_t cdOffset = offset;
+    for (const Entry &entry : entries)
+    {
+        bool sizes64 = entry.zip64 || entry.size >= kMax32 || entry.compressedSize >= kMax32;
+        bool offset64 = entry.headerOffset >= kMax32;
+        Bytes extra;
+        if (sizes64 || offset64)
+        {
+            Put16(extra, 0x0001);
+            Put16(extra, (sizes64 ? 16 : 0) + (offset64 ? 8 : 0));
+            if (sizes64)
+            {
+                Put64(extra, entry.size);
+                Put64(extra, entry.compressedSize);
+            }
+            if (offset64)
+                Put64(extra, entry.headerOffset);
+        }
+        uint16_t version = (sizes64 || offset64) ? 45 : 20;
+        uint32_t mode = entry.isDir ? 040755 : 0100644;
+
+        out.clear();
+        Put32(out, 0x02014b50);
+        Put16(out, (3 << 8) | version);
+        Put16(out, version);
+        Put16(out, entry.descriptor ? 0x0808 : 0x0800);
+        Put16(out, entry.method);
+        Put16(out, entry.dosTime);
+        Put16(out, entry.dosDate);
+        Put32(out, entry.crc);
+        Put32(out, sizes64 ? kMax32 : (uint32_t)entry.compressedSize);
+        Put32(out, sizes64 ? kMax32 : (uint32_t)entry.size);
+        Put16(out, entry.name.size());
+        Put16(out, extra.size());
+        Put16(out, 0);
+        Put16(out, 0);
+        Put16(out, 0);
+        Put32(out, (mode << 16) | (entry.isDir ? 0x10 : 0));
+        Put32(out, offset64 ? kMax32 : (uint32_t)entry.headerOffset);
+        out.insert(out.end(), entry.name.begin(), entry.name.end());
+        out.insert(out.end(), extra.begin(), extra.end());
+        if (!write(out.data(), out.size()))
+            return false;
+    }
+    uint64_t cdSize = offset - cdOffset;
+
+    out.clear();
+    if (entries.size() >= 0xFFFF || cdOffset >= kMax32 || cdSize >= kMax32)
+    {
+        uint64_t recordOffset = offset;
+        Put32(out, 0x06064b50);
+        Put64(out, 44);
+        Put16(out, (3 << 8) | 45);
+        Put16(out, 45);
+        Put32(out, 0);
+        Put32(out, 0);
+        Put64(out, entries.size());
+        Put64(out, entries.size());
+        Put64(out, cdSize);
+        Put64(out, cdOffset);
+
+        Put32(out, 0x07064b50);
+        Put32(out, 0);
+        Put64(out, recordOffset);
+        Put32(out, 1);
+    }
+    uint16_t count = entries.size() >= 0xFFFF ? 0xFFFF : (uint16_t)entries.size();
+    Put32(out, 0x06054b50);
+    Put16(out, 0);
+    Put16(out, 0);
+    Put16(out, count);
+    Put16(out, count);
+    Put32(out, Clamp32(cdSize));
+    Put32(out, Clamp32(cdOffset));
+    Put16(out, 0);
+    if (!write(out.data(), out.size()))
+        return false;
+
+    if (!output)
+    {
+        bool ok = stream->Flush();
+        stream.reset();
+        ok = sink->Close() && ok;
+        if (!ok)
+            return fail("write failed " + path);
+        sink.reset();
+    }
+
+    Logger::Logf("ZIP WRITER path=%s entries=%llu deflated=%llu stored=%llu in=%llu out=%llu workers=%d ms=%llu",
+                 path.c_str(), (unsigned long long)entries.size(), (unsigned long long)deflatedEntries,
+                 (unsigned long long)storedEntries, (unsigned long long)bytesIn, (unsigned long long)offset,
+                 (int)threads.size(), (unsigned long long)((Util::GetTick() - startTick) / 1000));
+    return true;
+}
+
+void ZipWriter::Abort()
+{
+    stopWorkers();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.clear();
+        inflight.clear();
+    }
+    stream.reset();
+    if (sink)
+    {
+        sink->Close();
+        sink.reset();
+        FS::Rm(path);
+    }
+}
+
+void ZipWriter::workerThread(void *arg)
+{
+    static_cast<ZipWriter *>(arg)->workerLoop();
+}
+
+void ZipWriter::workerLoop()
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    bool ready = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cv.wait(lock, [this]
+                { return stopping || !pending.empty(); });
+        if (stopping)
+            break;
+        Chunk *chunk = pending.front();
+        pending.pop_front();
+        lock.unlock();
+
+        if (ready)
+            compress(*chunk, &zs);
+
+        lock.lock();
+        chunk->done = true;
+        cv.notify_all();
+    }
+    lock.unlock();
+
+    if (ready)
+        deflateEnd(&zs);
+}
+
+void ZipWriter::compress(Chunk &chunk, void *zstream)
+{
+    TIMELINE_SCOPE("deflate");
+    const Bytef *input = (const Bytef *)chunk.input.data();
+    chunk.crc = crc32(crc32(0L, Z_NULL, 0), input, chunk.size);
+    if (chunk.store)
+    {
+        chunk.ok = true;
+        return;
+    }
+
+    z_stream &zs = *static_cast<z_stream *>(zstream);
+    if (deflateReset(&zs) != Z_OK)
+        return;
+    if (!chunk.dictionary.empty() &&
+        deflateSetDictionary(&zs, (const Bytef *)chunk.dictionary.data(), chunk.dictionary.size()) != Z_OK)
+        return;
+
+    // A sync flush adds an empty stored block on top of the bound.
+    size_t bound = deflateBound(&zs, chunk.size) + 16;
+    if (!chunk.output.Acquire(bound))
+        return;
+
+    zs.next_in = (Bytef *)input;
+    zs.avail_in = chunk.size;
+    zs.next_out = (Bytef *)chunk.output.data();
+    zs.avail_out = bound;
+    int ret = deflate(&zs, chunk.last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (chunk.last ? ret != Z_STREAM_END : (ret != Z_OK || zs.avail_out == 0))
+        return;
+    chunk.outSize = bound - zs.avail_out;
+    chunk.ok = true;
+}
+
+void ZipWriter::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (Thread &thread : threads)
+    {
+        Threads::Join(&thread);
+    }
+    threads.clear();
+}
+
+bool ZipWriter::writeOldest(Entry &entry)
+{
+    std::unique_ptr<Chunk> chunk;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]
+                { return inflight.front()->done; });
+        chunk = std::move(inflight.front());
+        inflight.pop_front();
+    }
+    if (!chunk->ok)
+        return fail("compression failed for " + entry.name);
+
+    const char *data = chunk->store ? chunk->input.data() : chunk->output.data();
+    size_t size = chunk->store ? chunk->size : chunk->outSize;
+    if (!write(data, size))
+        return false;
+
+    entry.crc = crc32_combine(entry.crc, chunk->crc, chunk->size);
+    entry.size += chunk->size;
+    entry.compressedSize += size;
+    if (!output)
+        bytes_transfered += chunk->size;
+    return true;
+}
+
+bool ZipWriter::write(const void *data, size_t size)
+{
+    if (output ? !output(data, size) : !stream->Write(data, size))
+        return fail("write failed " + path);
+    offset += size;
+    return true;
+}
+
+bool ZipWriter::writeLocalHeader(const Entry &entry, uint64_t at)
+{
+    Bytes out;
+    Put32(out, 0x04034b50);
+    Put16(out, entry.zip64 ? 45 : 20);
+    Put16(out, entry.descriptor ? 0x0808 : 0x0800);
+    Put16(out, entry.method);
+    Put16(out, entry.dosTime);
+    Put16(out, entry.dosDate);
+    Put32(out, entry.crc);
+    Put32(out, entry.zip64 ? kMax32 : (uint32_t)entry.compressedSize);
+    Put32(out, entry.zip64 ? kMax32 : (uint32_t)entry.size);
+    Put16(out, entry.name.size());
+    Put16(out, entry.zip64 ? 20 : 0);
+    out.insert(out.end(), entry.name.begin(), entry.name.end());
+    if (entry.zip64)
+    {
+        Put16(out, 0x0001);
+        Put16(out, 16);
+        Put64(out, entry.size);
+        Put64(out, entry.compressedSize);
+    }
+
+    if (at == offset)
+        return write(out.data(), out.size());
+    if (!sink->WriteAt(at, out.data(), out.size()))
+        return fail("write failed " + path);
+    return true;
+}
+
+bool ZipWriter::writeDescriptor(const Entry &entry)
+{
+    // Entries with a zip64 local header carry 8-byte sizes here too.
+    Bytes out;
+    Put32(out, 0x08074b50);
+    Put32(out, entry.crc);
+    if (entry.zip64)
+    {
+        Put64(out, entry.compressedSize);
+        Put64(out, entry.size);
+    }
+    else
+    {
+        Put32(out, (uint32_t)entry.compressedSize);
+        Put32(out, (uint32_t)entry.size);
+    }
+    return write(out.data(), out.size());
+}
+
+bool ZipWriter::fail(const std::string &message)
+{
+    error = message;
+    Logger::Logf("ZIP WRITER %s", message.c_str());
+    return false;
+}
+
+bool ZipWriter::shouldStore(const std::string &name)
+{
+    static const char *kCompressed[] = {
+        ".NSP", ".NSZ", ".XCI", ".XCZ", ".ZIP", ".7Z", ".RAR", ".GZ", ".TGZ", ".BZ2", ".XZ", ".ZST", ".LZ4",
+        ".JPG", ".JPEG", ".PNG", ".WEBP", ".GIF", ".MP4", ".MKV", ".MOV", ".AVI", ".WEBM",
+        ".MP3", ".OGG", ".OPUS", ".FLAC", ".M4A", ".AAC"};
+    std::string ext = FS::GetFileExt(name);
+    for (const char *known : kCompressed)
+    {
+        if (ext == known)
+            return true;
+    }
+    return false;
+}
+
+bool ZipWriter::looksCompressed(const char *data, size_t size)
+{
+    // Byte entropy of the first 64 KiB: compressed or encrypted data sits
+    // just under 8 bits per byte, anything deflate can shrink well below.
+    size_t sample = size < 64 * 1024 ? size : 64 * 1024;
+    if (sample < 4096)
+        return false;
+    uint32_t counts[256] = {0};
+    for (size_t i = 0; i < sample; i++)
+        counts[(uint8_t)data[i]]++;
+    double entropy = 0;
+    for (uint32_t count : counts)
+    {
+        if (count == 0)
+            continue;
+        double p = (double)count / sample;
+        entropy -= p * log2(p);
+    }
+    return entropy > 7.9;
+}
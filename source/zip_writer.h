@@ -0,0 +1,134 @@
+#ifndef NEO_ZIP_WRITER_H
+#define NEO_ZIP_WRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <time.h>
+#include <switch.h>
+
+#include "buffer_pool.h"
+#include "local_sink.h"
+
+// Zip archive writer that compresses on a pool of zip_workers threads.
+// Files are cut into 1 MiB chunks that are raw-deflated independently (each
+// primed with the previous chunk's last 32 KiB as dictionary and ended with
+// a sync flush, as pigz does), so the chunks of one entry concatenate into a
+// single deflate stream and even one large file keeps every core busy. The
+// calling thread reads ahead and writes finished chunks in order.
+//
+// Entries that are already compressed (by extension, or when a sample of
+// their first chunk looks random) are stored; their CRC still runs on the
+// workers. Sizes and CRC are patched into each local header once the entry
+// is written, and zip64 records are added where sizes or offsets need them.
+// A streamed archive, which cannot be patched, carries them in a data
+// descriptor after each entry's data instead.
+class ZipWriter
+{
+public:
+    static const size_t kChunkSize = 1024 * 1024;
+
+    // Receives the archive in order when it is streamed rather than written
+    // to a file. Return false to stop the archive.
+    typedef std::function<bool(const void *data, size_t size)> OutputFn;
+
+    ZipWriter(const std::string &path, int workers);
+    // Streams the archive to `output`. Progress is left to whoever
+    // consumes the stream, so bytes_transfered is not touched.
+    ZipWriter(const OutputFn &output, int workers);
+    ~ZipWriter();
+
+    // Creates the archive and starts the workers.
+    bool Open();
+    // Adds a folder entry; `name` is its path inside the archive.
+    bool AddFolder(std::string name, time_t mtime);
+    // Compresses the local file `source` as `name`. Updates bytes_transfered
+    // as it goes and stops early on stop_activity.
+    bool AddFile(const std::string &source, const std::string &name);
+    // Writes the central directory and closes the file.
+    bool Close();
+    // Closes and removes an unfinished archive.
+    void Abort();
+
+    const std::string &Error() const { return error; }
+
+private:
+    struct Chunk
+    {
+        TransferBuffer input;
+        size_t size = 0;
+        bool last = false;
+        bool store = false;
+        // Tail of the previous chunk, the deflate dictionary.
+        std::vector<char> dictionary;
+
+        TransferBuffer output;
+        size_t outSize = 0;
+        uint32_t crc = 0;
+        bool done = false;
+        bool ok = false;
+    };
+
+    struct Entry
+    {
+        std::string name;
+        uint64_t headerOffset = 0;
+        uint64_t size = 0;
+        uint64_t compressedSize = 0;
+        uint32_t crc = 0;
+        uint16_t method = 0;
+        uint16_t dosTime = 0;
+        uint16_t dosDate = 0;
+        bool isDir = false;
+        bool zip64 = false;
+        // Sizes and CRC follow the data (general purpose flag bit 3).
+        bool descriptor = false;
+    };
+
+    std::string path;
+    int workerCount;
+    std::string error;
+
+    OutputFn output;
+    std::unique_ptr<LocalFileSink> sink;
+    std::unique_ptr<LocalSinkStream> stream;
+    uint64_t offset = 0;
+    std::vector<Entry> entries;
+
+    // Chunks of the current entry still being compressed or written, in
+    // file order. Workers take them from `pending`.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<Chunk>> inflight;
+    std::deque<Chunk *> pending;
+    bool stopping = false;
+    std::vector<Thread> threads;
+
+    // Totals, logged when the archive is closed.
+    uint64_t storedEntries = 0;
+    uint64_t deflatedEntries = 0;
+    uint64_t bytesIn = 0;
+    uint64_t startTick = 0;
+
+    static void workerThread(void *arg);
+    void workerLoop();
+    static void compress(Chunk &chunk, void *zstream);
+    void stopWorkers();
+
+    // Waits for the oldest in-flight chunk and appends it to the entry.
+    bool writeOldest(Entry &entry);
+    bool write(const void *data, size_t size);
+    bool writeLocalHeader(const Entry &entry, uint64_t at);
+    bool writeDescriptor(const Entry &entry);
+    bool fail(const std::string &message);
+
+    static bool shouldStore(const std::string &name);
+    static bool looksCompressed(const char *data, size_t size);
+};
+
+#endif